@@ -110,6 +110,9 @@
 #include "ruleset.h"
 #include "parserif.h"
 #include "statsobj.h"
+#include "trace.h"
+#include "rsprobe.h"
+#include "pipestats.h"
 
 #define NO_TIME_PROVIDED 0 /* indicate we do not provide any cached time */
 
@@ -173,6 +176,7 @@ configSettings_t cs_save;				/* our saved (scope!) config settings */
  */
 int iActionNbr = 0;
 int bActionReportSuspension = 1;
+static int iTplCacheSlots = 0;	/* number of worker template cache slots assigned so far */
 int bActionReportSuspensionCont = 0;
 
 /* tables for interfacing with the v6 config system */
@@ -188,7 +192,18 @@ static struct cnfparamdescr cnfparamdescr[] = {
 	{ "action.resumeretrycount", eCmdHdlrInt, 0 }, /* legacy: actionresumeretrycount */
 	{ "action.reportsuspension", eCmdHdlrBinary, 0 },
 	{ "action.reportsuspensioncontinuation", eCmdHdlrBinary, 0 },
-	{ "action.resumeinterval", eCmdHdlrInt, 0 }
+	{ "action.resumeinterval", eCmdHdlrInt, 0 },
+	{ "action.latencystats", eCmdHdlrBinary, 0 },
+	{ "action.resumeintervalmax", eCmdHdlrPositiveInt, 0 },
+	{ "action.resumejitter", eCmdHdlrInt, 0 },
+	{ "action.circuitbreaker", eCmdHdlrPositiveInt, 0 },
+	{ "action.workerautoscale", eCmdHdlrBinary, 0 },
+	{ "action.workerautoscalemin", eCmdHdlrPositiveInt, 0 },
+	{ "action.parambuffermax", eCmdHdlrSize, 0 },
+	{ "action.minbatch", eCmdHdlrPositiveInt, 0 },
+	{ "action.lingertime", eCmdHdlrInt, 0 },
+	{ "action.coalesce.template", eCmdHdlrGetWord, 0 },
+	{ "action.coalesce.window", eCmdHdlrInt, 0 }
 };
 static struct cnfparamblk pblk =
 	{ CNFPARAMBLK_VERSION,
@@ -305,6 +320,12 @@ rsRetVal actionDestruct(action_t * const pThis)
 		pThis->pMod->freeInstance(pThis->pModData);
 
 	pthread_mutex_destroy(&pThis->mutAction);
+	pthread_mutex_destroy(&pThis->mutHist);
+	pthread_mutex_destroy(&pThis->mutBreaker);
+	pthread_mutex_destroy(&pThis->mutAutoscale);
+	pthread_mutex_destroy(&pThis->mutCoalesce);
+	if(pThis->coalesceMap != NULL)
+		hashmapDestruct(&pThis->coalesceMap);
 	d_free(pThis->pszName);
 	d_free(pThis->ppTpl);
 
@@ -356,6 +377,15 @@ rsRetVal actionConstruct(action_t **ppThis)
 	pThis->tLastOccur = datetime.GetTime(NULL);	/* done once per action on startup only */
 	pThis->iActionNbr = iActionNbr;
 	pthread_mutex_init(&pThis->mutAction, NULL);
+	pthread_mutex_init(&pThis->mutHist, NULL);
+	pthread_mutex_init(&pThis->mutBreaker, NULL);
+	pthread_mutex_init(&pThis->mutAutoscale, NULL);
+	pthread_mutex_init(&pThis->mutCoalesce, NULL);
+	pThis->iAutoscaleMin = 1;
+	pThis->lenParamBufMax = ACTION_PARAMBUF_MAX_DFLT;
+	pThis->breakerState = ACT_BREAKER_CLOSED;
+	pThis->iResumeJitter = 10;
+	pThis->seedJitter = (unsigned) time(NULL) ^ (unsigned) iActionNbr;
 	INIT_ATOMIC_HELPER_MUT(pThis->mutCAS);
 
 	/* indicate we have a new action */
@@ -367,6 +397,170 @@ finalize_it:
 }
 
 
+/* ---------- commit latency and batch size histograms ---------- */
+
+/* get the current (if possible monotonic) time in microseconds, used for
+ * measurements only.
+ */
+static inline uint64
+actionTimeUs(void)
+{
+	struct timespec t;
+#	if _POSIX_TIMERS <= 0
+	struct timeval tv;
+#	endif
+
+#	if _POSIX_TIMERS > 0
+#	ifdef CLOCK_MONOTONIC
+	clock_gettime(CLOCK_MONOTONIC, &t);
+#	else
+	clock_gettime(CLOCK_REALTIME, &t);
+#	endif
+#	else
+	gettimeofday(&tv, NULL);
+	t.tv_sec = tv.tv_sec;
+	t.tv_nsec = tv.tv_usec * 1000;
+#	endif
+	return (uint64) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+/* get the start time for a measurement. If we do not gather the stats, 0 is
+ * returned without querying the clock. A zero start time is never recorded.
+ */
+static inline uint64
+actionHistStart(action_t *__restrict__ const pThis)
+{
+	if(!pThis->bLatencyStats || !GatherStats)
+		return 0;
+	return actionTimeUs();
+}
+
+/* record the time elapsed since tStart (and, if pHistSize is non-NULL, the
+ * number of messages) for one doAction() or commit.
+ */
+static inline void
+actionHistDone(action_t *__restrict__ const pThis, statshist_t *const pHistTime,
+	       const uint64 tStart, statshist_t *const pHistSize, const unsigned nMsgs)
+{
+	uint64 tNow;
+
+	if(tStart == 0)
+		return;
+	tNow = actionTimeUs();
+	pthread_mutex_lock(&pThis->mutHist);
+	statshistRecord(pHistTime, (tNow > tStart) ? tNow - tStart : 0);
+	if(pHistSize != NULL)
+		statshistRecord(pHistSize, nMsgs);
+	pthread_mutex_unlock(&pThis->mutHist);
+}
+
+/* record the end-to-end latency of a probe message (PROBE_MSG). Probes are
+ * measured at the point where they would be handed to the output, which
+ * includes the action queue, and then dropped.
+ */
+static inline void
+actionProbeDone(action_t *__restrict__ const pThis, msg_t *__restrict__ const pMsg)
+{
+	uint64 age;
+
+	if(!pThis->bLatencyStats || !GatherStats)
+		return;
+	age = MsgGetProbeAge(pMsg);
+	pthread_mutex_lock(&pThis->mutHist);
+	statshistRecord(&pThis->histProbe, age);
+	pthread_mutex_unlock(&pThis->mutHist);
+}
+
+/* ---------- action queue worker autoscaling ----------
+ * With action.workerAutoscale, the number of action queue workers is adapted
+ * between action.workerAutoscaleMin and queue.workerThreads. Once per
+ * interval, the queue depth and the average batch latency (which includes the
+ * commit) are checked: if messages pile up, one more worker is permitted.
+ * If the latency went up considerably after the last worker was added, the
+ * backend is saturated and that worker is removed again. If the queue is
+ * almost empty, the number of workers is reduced. The actual worker
+ * start/stop is done by the wtp, see wtpSetWorkerCap().
+ */
+#define ACTION_AUTOSCALE_INTERVAL 1000000 /* us between two decisions */
+#define ACTION_AUTOSCALE_SATURATED -2	/* iAutoscaleDir: shrunk because latency went up */
+
+static void
+actionAutoscale(action_t *const pThis, const uint64 tStart)
+{
+	uint64 tNow;
+	uint64 latAvg;
+	int nDepth;
+	int nBatch;
+	int nCap;
+	int dir;
+	sbool bChanged;
+
+	tNow = actionTimeUs();
+	pthread_mutex_lock(&pThis->mutAutoscale);
+	pThis->autoscaleLatSum += (tNow > tStart) ? tNow - tStart : 0;
+	++pThis->autoscaleNBatches;
+	if(tNow - pThis->tAutoscaleLast < ACTION_AUTOSCALE_INTERVAL) {
+		pthread_mutex_unlock(&pThis->mutAutoscale);
+		return;
+	}
+
+	latAvg = pThis->autoscaleLatSum / pThis->autoscaleNBatches;
+	nDepth = qqueueGetApproxSize(pThis->pQueue);
+	nBatch = (pThis->pQueue->iDeqBatchSize > 0) ? pThis->pQueue->iDeqBatchSize : 1;
+	nCap = pThis->iAutoscaleCap;
+	dir = 0;
+	if(pThis->iAutoscaleDir > 0 && pThis->autoscaleLatPrev > 0
+	   && latAvg > pThis->autoscaleLatPrev + pThis->autoscaleLatPrev / 2
+	   && nCap > pThis->iAutoscaleMin) {
+		dir = ACTION_AUTOSCALE_SATURATED;
+	} else if(nDepth > nCap * nBatch && nCap < pThis->pQueue->iNumWorkerThreads
+		  && pThis->iAutoscaleDir != ACTION_AUTOSCALE_SATURATED) {
+		dir = 1;
+	} else if(nDepth < nBatch && nCap > pThis->iAutoscaleMin) {
+		dir = -1;
+	}
+	nCap += (dir > 0) ? 1 : (dir < 0) ? -1 : 0;
+	bChanged = (nCap != pThis->iAutoscaleCap);
+	pThis->iAutoscaleCap = nCap;
+	pThis->iAutoscaleDir = dir;
+	pThis->autoscaleLatPrev = latAvg;
+	pThis->autoscaleLatSum = 0;
+	pThis->autoscaleNBatches = 0;
+	pThis->tAutoscaleLast = tNow;
+	pthread_mutex_unlock(&pThis->mutAutoscale);
+
+	if(bChanged) {
+		DBGPRINTF("action '%s': autoscaling to %d worker(s), queue depth %d, "
+			  "avg batch latency %llu us\n", pThis->pszName, nCap, nDepth,
+			  (unsigned long long) latAvg);
+		qqueueSetWorkerCap(pThis->pQueue, nCap);
+	}
+}
+
+
+/* register the percentile counters of a histogram with the action's
+ * statsobj. They are updated under mutHist, so no init call.
+ */
+static rsRetVal
+actionHistAddCounters(action_t *const pThis, statshist_t *const pHist, const char *const name)
+{
+	char ctrName[64];
+	DEFiRet;
+
+	snprintf(ctrName, sizeof(ctrName), "%s.p50", name);
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, (uchar*) ctrName,
+		ctrType_IntCtr, CTR_FLAG_NONE, &pHist->ctrP50));
+	snprintf(ctrName, sizeof(ctrName), "%s.p99", name);
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, (uchar*) ctrName,
+		ctrType_IntCtr, CTR_FLAG_NONE, &pHist->ctrP99));
+	snprintf(ctrName, sizeof(ctrName), "%s.max", name);
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, (uchar*) ctrName,
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pHist->ctrMax));
+finalize_it:
+	RETiRet;
+}
+
+
 /* action construction finalizer
  */
 rsRetVal
@@ -387,24 +581,15 @@ actionConstructFinalize(action_t *__restrict__ const pThis, struct nvlst *lst)
 
 	/* cache transactional attribute */
 	pThis->isTransactional = pThis->pMod->mod.om.supportsTX;
-	if(pThis->isTransactional && pThis->eParamPassing != ACT_STRING_PASSING) {
-		errmsg.LogError(0, RS_RET_INVLD_OMOD, "action '%s'(%d) is transactional but "
-		                "uses invalid paramter passing mode -- disabling "
-				"action. This is probably caused by a pre-v7 "
-				"output module that needs upgrade.",
-				pThis->pszName, pThis->iActionNbr);
-		actionDisable(pThis);
-		ABORT_FINALIZE(RS_RET_INVLD_OMOD);
-	}
 
 
 	/* support statistics gathering */
 	CHKiRet(statsobj.Construct(&pThis->statsobj));
 	CHKiRet(statsobj.SetName(pThis->statsobj, pThis->pszName));
 
-	STATSCOUNTER_INIT(pThis->ctrProcessed, pThis->mutCtrProcessed);
+	STATSCOUNTER_PT_INIT(pThis->ctrProcessed);
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("processed"),
-		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrProcessed));
+		ctrType_IntCtrPerThread, CTR_FLAG_RESETTABLE, &pThis->ctrProcessed));
 
 	STATSCOUNTER_INIT(pThis->ctrFail, pThis->mutCtrFail);
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("failed"),
@@ -420,6 +605,24 @@ actionConstructFinalize(action_t *__restrict__ const pThis, struct nvlst *lst)
 	STATSCOUNTER_INIT(pThis->ctrResume, pThis->mutCtrResume);
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("resumed"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrResume));
+	STATSCOUNTER_INIT(pThis->ctrBreakerOpen, pThis->mutCtrBreakerOpen);
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("breaker.opened"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrBreakerOpen));
+	if(pThis->pCoalesceTpl != NULL) {
+		STATSCOUNTER_INIT(pThis->ctrCoalesced, pThis->mutCtrCoalesced);
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("coalesced"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrCoalesced));
+	}
+
+	if(pThis->bLatencyStats) {
+		if(pThis->isTransactional) {
+			CHKiRet(actionHistAddCounters(pThis, &pThis->histCommit, "commit.latency"));
+			CHKiRet(actionHistAddCounters(pThis, &pThis->histBatchSize, "commit.batchsize"));
+		} else {
+			CHKiRet(actionHistAddCounters(pThis, &pThis->histDoAction, "doaction.latency"));
+		}
+		CHKiRet(actionHistAddCounters(pThis, &pThis->histProbe, "probe.latency"));
+	}
 
 	CHKiRet(statsobj.ConstructFinalize(pThis->statsobj));
 
@@ -502,6 +705,35 @@ actionConstructFinalize(action_t *__restrict__ const pThis, struct nvlst *lst)
 #	undef setQPROP
 #	undef setQPROPstr
 
+	/* linger: the queue worker waits a bit for a larger batch, so that
+	 * transactional outputs need fewer commits (round-trips).
+	 */
+	if(pThis->iLingerTime > 0) {
+		if(pThis->pQueue->qType == QUEUETYPE_DIRECT) {
+			parser_warnmsg("action '%s': action.lingertime requires a non-direct "
+				"action queue, ignored", pThis->pszName);
+		} else {
+			if(!pThis->isTransactional)
+				parser_warnmsg("action '%s': module %s does not support transactions, "
+					"action.lingertime only adds latency", pThis->pszName,
+					(char*)modGetName(pThis->pMod));
+			qqueueSetiLingerMin(pThis->pQueue, (pThis->iMinBatch > 0) ? pThis->iMinBatch
+					    : pThis->pQueue->iDeqBatchSize);
+			qqueueSetiLingerTime(pThis->pQueue, pThis->iLingerTime);
+		}
+	}
+
+	if(pThis->pCoalesceTpl != NULL) {
+		if(pThis->pQueue->qType == QUEUETYPE_DIRECT) {
+			parser_warnmsg("action '%s': action.coalesce.template requires a "
+				"non-direct action queue, ignored", pThis->pszName);
+			pThis->pCoalesceTpl = NULL;
+		} else if(pThis->iCoalesceWindow > 0) {
+			CHKiRet(hashmapConstruct(&pThis->coalesceMap, 64, 0, hashmapHashString,
+				hashmapKeyEqualsString, free, free));
+		}
+	}
+
 	qqueueDbgPrint(pThis->pQueue);
 
 	DBGPRINTF("Action %p: queue %p created\n", pThis, pThis->pQueue);
@@ -620,6 +852,128 @@ static void actionRetry(action_t * const pThis, wti_t * const pWti)
 	incActionResumeInRow(pWti, pThis);
 }
 
+/* ---------- resume backoff and circuit breaker ----------
+ * With action.resumeintervalmax set, the time between resume attempts doubles
+ * with every failed tryResume() (counted over all workers of the action),
+ * starting at action.resumeinterval, and is randomized by action.resumejitter
+ * percent so that many actions pointing to the same backend do not retry in
+ * lock-step. Without it, the traditional fixed interval is used.
+ * With action.circuitbreaker=n, the breaker opens after n failed resumes in
+ * a row. While it is open, no worker calls tryResume(). Workers of actions
+ * with eternal retries just wait, so that the action queue fills up and
+ * spills to disk (if it is a DA queue) instead of hammering the backend. When
+ * the backoff expires, the breaker becomes half-open and exactly one worker
+ * probes the backend. Success closes the breaker, failure re-opens it with
+ * a longer backoff.
+ */
+
+/* compute the backoff in milliseconds. Must be called with mutBreaker locked
+ * (because of the jitter seed).
+ */
+static long long
+actionBackoffMs(action_t *const pThis)
+{
+	long long delay;
+	long long jitter;
+	unsigned shift;
+
+	delay = (long long) pThis->iResumeInterval * 1000;
+	if(pThis->iResumeIntervalMax <= 0)
+		return delay;
+	shift = (pThis->nResumeFailed == 0) ? 0 : pThis->nResumeFailed - 1;
+	if(shift > 20)
+		shift = 20;
+	delay <<= shift;
+	if(delay > (long long) pThis->iResumeIntervalMax * 1000)
+		delay = (long long) pThis->iResumeIntervalMax * 1000;
+	if(pThis->iResumeJitter > 0) {
+		jitter = delay * pThis->iResumeJitter / 100;
+		delay += (long long) (rand_r(&pThis->seedJitter) % (2 * jitter + 1)) - jitter;
+	}
+	return delay;
+}
+
+static inline long long
+actionGetBackoffMs(action_t *const pThis)
+{
+	long long delay;
+	pthread_mutex_lock(&pThis->mutBreaker);
+	delay = actionBackoffMs(pThis);
+	pthread_mutex_unlock(&pThis->mutBreaker);
+	return delay;
+}
+
+/* check if the calling worker may call tryResume(). If the breaker is open
+ * and its backoff expired, the caller becomes the (only) half-open prober.
+ */
+static sbool
+actionBreakerMayProbe(action_t *const pThis, const time_t ttNow)
+{
+	sbool bMayProbe;
+
+	if(pThis->iBreakerThreshold == 0)
+		return 1;
+	pthread_mutex_lock(&pThis->mutBreaker);
+	if(pThis->breakerState == ACT_BREAKER_CLOSED) {
+		bMayProbe = 1;
+	} else if(pThis->breakerState == ACT_BREAKER_OPEN && ttNow >= pThis->ttBreakerProbe) {
+		pThis->breakerState = ACT_BREAKER_HALFOPEN;
+		bMayProbe = 1;
+	} else {
+		bMayProbe = 0;
+	}
+	pthread_mutex_unlock(&pThis->mutBreaker);
+	DBGPRINTF("action '%s': circuit breaker state %d, may probe: %d\n",
+		  pThis->pszName, pThis->breakerState, bMayProbe);
+	return bMayProbe;
+}
+
+/* record a failed tryResume(). Returns the time to wait until the next try
+ * in milliseconds.
+ */
+static long long
+actionResumeFailed(action_t *const pThis, const time_t ttNow)
+{
+	long long delay;
+	sbool bOpened = 0;
+
+	pthread_mutex_lock(&pThis->mutBreaker);
+	++pThis->nResumeFailed;
+	delay = actionBackoffMs(pThis);
+	if(pThis->iBreakerThreshold > 0 && pThis->nResumeFailed >= (unsigned) pThis->iBreakerThreshold) {
+		bOpened = (pThis->breakerState == ACT_BREAKER_CLOSED);
+		pThis->breakerState = ACT_BREAKER_OPEN;
+		pThis->ttBreakerProbe = ttNow + (delay + 999) / 1000;
+	}
+	pthread_mutex_unlock(&pThis->mutBreaker);
+
+	if(bOpened) {
+		STATSCOUNTER_INC(pThis->ctrBreakerOpen, pThis->mutCtrBreakerOpen);
+		errmsg.LogMsg(0, RS_RET_SUSPENDED, LOG_WARNING, "action '%s': circuit "
+			      "breaker opened after %u failed resume attempts",
+			      pThis->pszName, pThis->nResumeFailed);
+	}
+	return delay;
+}
+
+/* record a successful tryResume() */
+static void
+actionResumeSucceeded(action_t *const pThis)
+{
+	sbool bClosed;
+
+	pthread_mutex_lock(&pThis->mutBreaker);
+	bClosed = (pThis->breakerState != ACT_BREAKER_CLOSED);
+	pThis->breakerState = ACT_BREAKER_CLOSED;
+	pThis->nResumeFailed = 0;
+	pthread_mutex_unlock(&pThis->mutBreaker);
+
+	if(bClosed) {
+		errmsg.LogMsg(0, RS_RET_OK, LOG_INFO, "action '%s': circuit breaker closed",
+			      pThis->pszName);
+	}
+}
+
 /* Suspend action, this involves changing the action state as well
  * as setting the next retry time.
  * if we have more than 10 retries, we prolong the
@@ -652,7 +1006,14 @@ actionSuspend(action_t * const pThis, wti_t * const pWti)
 	 * since caching, and this would break logic (and it actually did so!)
 	 */
 	datetime.GetTime(&ttNow);
-	suspendDuration = pThis->iResumeInterval * (getActionNbrResRtry(pWti, pThis) / 10 + 1);
+	if(pThis->iResumeIntervalMax > 0)
+		suspendDuration = (actionGetBackoffMs(pThis) + 999) / 1000;
+	else
+		suspendDuration = pThis->iResumeInterval * (getActionNbrResRtry(pWti, pThis) / 10 + 1);
+	/* with an open breaker, there is no point in retrying before it can be probed */
+	if(pThis->iBreakerThreshold > 0 && pThis->breakerState == ACT_BREAKER_OPEN
+	   && pThis->ttBreakerProbe > ttNow + suspendDuration)
+		suspendDuration = pThis->ttBreakerProbe - ttNow;
 	pThis->ttResumeRtry = ttNow + suspendDuration;
 	actionSetState(pThis, pWti, ACT_STATE_SUSP);
 	pThis->ctrSuspendDuration += suspendDuration;
@@ -668,6 +1029,9 @@ actionSuspend(action_t * const pThis, wti_t * const pWti)
 			      "action '%s' suspended, next retry is %s",
 			      pThis->pszName, timebuf);
 	}
+	TRACE(TRC_ACTION, "action %d suspended for %ds, iNbrResRtry %d", pThis->iActionNbr,
+	      suspendDuration, getActionNbrResRtry(pWti, pThis));
+	RS_PROBE(action_suspend, (char*) pThis->pszName, pThis->iActionNbr, suspendDuration);
 	DBGPRINTF("action '%s' suspended, earliest retry=%lld (now %lld), iNbrResRtry %d, "
 		  "duration %d\n",
 		  pThis->pszName, (long long) pThis->ttResumeRtry, (long long) ttNow,
@@ -694,8 +1058,9 @@ static rsRetVal
 actionDoRetry(action_t * const pThis, wti_t * const pWti)
 {
 	int iRetries;
-	int iSleepPeriod;
+	long long iSleepPeriod;
 	int bTreatOKasSusp;
+	time_t ttNow;
 	DEFiRet;
 
 	ASSERT(pThis != NULL);
@@ -703,6 +1068,19 @@ actionDoRetry(action_t * const pThis, wti_t * const pWti)
 	iRetries = 0;
 	while((*pWti->pbShutdownImmediate == 0) && getActionState(pWti, pThis) == ACT_STATE_RTRY) {
 		DBGPRINTF("actionDoRetry: %s enter loop, iRetries=%d\n", pThis->pszName, iRetries);
+		datetime.GetTime(&ttNow);
+		if(!actionBreakerMayProbe(pThis, ttNow)) {
+			/* breaker open (or someone else probing): leave the backend alone */
+			if(pThis->iResumeRetryCount != -1) {
+				actionSuspend(pThis, pWti);
+			} else {
+				iSleepPeriod = (pThis->ttBreakerProbe > ttNow) ? pThis->ttBreakerProbe - ttNow : 1;
+				if(iSleepPeriod > pThis->iResumeInterval && pThis->iResumeInterval > 0)
+					iSleepPeriod = pThis->iResumeInterval;
+				srSleep((int) iSleepPeriod, 0);
+			}
+			continue;
+		}
 		iRet = pThis->pMod->tryResume(pWti->actWrkrInfo[pThis->iActionNbr].actWrkrData);
 		DBGPRINTF("actionDoRetry: %s action->tryResume returned %d\n", pThis->pszName, iRet);
 		if((getActionResumeInRow(pWti, pThis) > 9) && (getActionResumeInRow(pWti, pThis) % 10 == 0)) {
@@ -719,9 +1097,12 @@ actionDoRetry(action_t * const pThis, wti_t * const pWti)
 					      "resumed (module '%s')",
 					      pThis->pszName, pThis->pMod->pszName);
 			}
+			TRACE(TRC_ACTION, "action %d resumed", pThis->iActionNbr);
+			actionResumeSucceeded(pThis);
 			setActionJustResumed(pWti, pThis, 1);
 			actionSetState(pThis, pWti, ACT_STATE_RDY);
 		} else if(iRet == RS_RET_SUSPENDED || bTreatOKasSusp) {
+			iSleepPeriod = actionResumeFailed(pThis, ttNow);
 			/* max retries reached? */
 			DBGPRINTF("actionDoRetry: %s check for max retries, iResumeRetryCount "
 				  "%d, iRetries %d\n",
@@ -732,14 +1113,15 @@ actionDoRetry(action_t * const pThis, wti_t * const pWti)
 					incActionNbrResRtry(pWti, pThis);
 			} else {
 				++iRetries;
-				iSleepPeriod = pThis->iResumeInterval;
-				srSleep(iSleepPeriod, 0);
+				srSleep((int) (iSleepPeriod / 1000), (int) (iSleepPeriod % 1000) * 1000);
 				if(*pWti->pbShutdownImmediate) {
 					ABORT_FINALIZE(RS_RET_FORCE_TERM);
 				}
 			}
 		} else if(iRet == RS_RET_DISABLE_ACTION) {
 			actionDisable(pThis);
+		} else {
+			actionResumeFailed(pThis, ttNow);
 		}
 	}
 
@@ -794,7 +1176,10 @@ actionTryResume(action_t * const pThis, wti_t * const pWti)
 	if(getActionState(pWti, pThis) == ACT_STATE_RTRY) {
 		if(ttNow == NO_TIME_PROVIDED) /* use cached result if we have it */
 			datetime.GetTime(&ttNow);
-		CHKiRet(actionDoRetry(pThis, pWti));
+		iRet = actionDoRetry(pThis, pWti);
+		RS_PROBE(action_resume, (char*) pThis->pszName, pThis->iActionNbr, iRet);
+		if(iRet != RS_RET_OK)
+			FINALIZE;
 	}
 
 	if(Debug && (getActionState(pWti, pThis) == ACT_STATE_RTRY ||getActionState(pWti, pThis) == ACT_STATE_SUSP)) {
@@ -881,6 +1266,52 @@ static rsRetVal actionDbgPrint(action_t *pThis)
 #endif
 
 
+/* render a template into an action parameter. If the template is shared
+ * by multiple actions, the worker's template cache is consulted first, so
+ * that the template is rendered only once per message. Caching only
+ * happens while the main queue worker executes the ruleset for pMsg.
+ */
+static rsRetVal
+tplToStringCached(struct template *__restrict__ const pTpl,
+		  wti_t *__restrict__ const pWti,
+		  msg_t *__restrict__ const pMsg,
+		  actWrkrIParams_t *__restrict__ const iparam,
+		  struct syslogTime *const ttNow)
+{
+	wtiTplCacheEntry_t *pEnt;
+	uchar *pNewBuf;
+	DEFiRet;
+
+	if(pTpl->iCacheSlot < 0 || pMsg != pWti->tplCache.pMsg) {
+		CHKiRet(tplToString(pTpl, pMsg, iparam, ttNow));
+		FINALIZE;
+	}
+
+	pEnt = &(pWti->tplCache.ent[pTpl->iCacheSlot]);
+	if(pEnt->gen == pWti->tplCache.gen && pEnt->pBuf != NULL) {
+		if(iparam->lenBuf < pEnt->lenStr + 1)
+			CHKiRet(ExtendBuf(iparam, pEnt->lenStr + 1));
+		memcpy(iparam->param, pEnt->pBuf, pEnt->lenStr + 1);
+		iparam->lenStr = pEnt->lenStr;
+		FINALIZE;
+	}
+
+	CHKiRet(tplToString(pTpl, pMsg, iparam, ttNow));
+	if(pEnt->lenBuf < iparam->lenStr + 1) {
+		if((pNewBuf = realloc(pEnt->pBuf, iparam->lenStr + 1)) == NULL)
+			FINALIZE; /* not caching is no error */
+		pEnt->pBuf = pNewBuf;
+		pEnt->lenBuf = iparam->lenStr + 1;
+	}
+	memcpy(pEnt->pBuf, iparam->param, iparam->lenStr + 1);
+	pEnt->lenStr = iparam->lenStr;
+	pEnt->gen = pWti->tplCache.gen;
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* prepare the calling parameters for doAction()
  * rgerhards, 2009-05-07
  */
@@ -891,6 +1322,7 @@ prepareDoActionParams(action_t * __restrict__ const pAction,
 		      struct syslogTime *ttNow)
 {
 	int i;
+	uchar **arr;
 	struct json_object *json;
 	actWrkrIParams_t *iparams;
 	actWrkrInfo_t *__restrict__ pWrkrInfo;
@@ -900,15 +1332,34 @@ prepareDoActionParams(action_t * __restrict__ const pAction,
 	if(pAction->isTransactional) {
 		CHKiRet(wtiNewIParam(pWti, pAction, &iparams));
 		for(i = 0 ; i < pAction->iNumTpls ; ++i) {
-			CHKiRet(tplToString(pAction->ppTpl[i], pMsg, 
-					    &actParam(iparams, pAction->iNumTpls, 0, i),
-				            ttNow));
+			/* only strings are kept for reuse, everything else is
+			 * created per message and freed after commit.
+			 */
+			switch(pAction->eParamPassing) {
+			case ACT_ARRAY_PASSING:
+				CHKiRet(tplToArray(pAction->ppTpl[i], pMsg, &arr, ttNow));
+				actParam(iparams, pAction->iNumTpls, 0, i).param = (void*) arr;
+				break;
+			case ACT_MSG_PASSING:
+				actParam(iparams, pAction->iNumTpls, 0, i).param = (void*) MsgAddRef(pMsg);
+				break;
+			case ACT_JSON_PASSING:
+				CHKiRet(tplToJSON(pAction->ppTpl[i], pMsg, &json, ttNow));
+				actParam(iparams, pAction->iNumTpls, 0, i).param = (void*) json;
+				break;
+			case ACT_STRING_PASSING:
+			default:
+				CHKiRet(tplToStringCached(pAction->ppTpl[i], pWti, pMsg,
+						    &actParam(iparams, pAction->iNumTpls, 0, i),
+					            ttNow));
+				break;
+			}
 		}
 	} else {
 		for(i = 0 ; i < pAction->iNumTpls ; ++i) {
 			switch(pAction->eParamPassing) {
 			case ACT_STRING_PASSING:
-				CHKiRet(tplToString(pAction->ppTpl[i], pMsg,
+				CHKiRet(tplToStringCached(pAction->ppTpl[i], pWti, pMsg,
 					   &(pWrkrInfo->p.nontx.actParams[i]),
 					   ttNow));
 				break;
@@ -937,6 +1388,41 @@ finalize_it:
 }
 
 
+/* free a parameter of a transactional action. */
+void
+actionFreeTxIParam(const action_t *const pAction, actWrkrIParams_t *const piparam)
+{
+	uchar **arr;
+	msg_t *pMsg;
+	int i;
+
+	if(piparam->param == NULL)
+		return;
+	switch(pAction->eParamPassing) {
+	case ACT_ARRAY_PASSING:
+		arr = (uchar**) piparam->param;
+		for(i = 0 ; arr[i] != NULL ; ++i)
+			free(arr[i]);
+		free(arr);
+		break;
+	case ACT_MSG_PASSING:
+		pMsg = (msg_t*) piparam->param;
+		msgDestruct(&pMsg);
+		break;
+	case ACT_JSON_PASSING:
+		json_object_put((struct json_object*) piparam->param);
+		break;
+	case ACT_STRING_PASSING:
+	default:
+		free(piparam->param);
+		break;
+	}
+	piparam->param = NULL;
+	piparam->lenBuf = 0;
+	piparam->lenStr = 0;
+}
+
+
 static void
 releaseDoActionParams(action_t *__restrict__ const pAction, wti_t *__restrict__ const pWti)
 {
@@ -945,8 +1431,8 @@ releaseDoActionParams(action_t *__restrict__ const pAction, wti_t *__restrict__
 	actWrkrInfo_t *__restrict__ pWrkrInfo;
 	uchar ***ppMsgs;
 
-	if(pAction->eParamPassing == ACT_STRING_PASSING || pAction->eParamPassing == ACT_MSG_PASSING)
-		goto done; /* we need to do nothing with these types! */
+	if(pAction->eParamPassing == ACT_MSG_PASSING)
+		goto done; /* we need to do nothing with this type! */
 
 	pWrkrInfo = &(pWti->actWrkrInfo[pAction->iActionNbr]);
 	switch(pAction->eParamPassing) {
@@ -973,7 +1459,12 @@ releaseDoActionParams(action_t *__restrict__ const pAction, wti_t *__restrict__
 		}
 		break;
 	case ACT_STRING_PASSING:
-		/* strings are destructed when the worker terminates */
+		/* strings are kept for the next message and destructed when the
+		 * worker terminates, unless they grew too large.
+		 */
+		for(j = 0 ; j < pAction->iNumTpls ; ++j)
+			wtiTrimIParam(&pWrkrInfo->p.nontx.actParams[j], pAction->lenParamBufMax);
+		break;
 	case ACT_MSG_PASSING:
 		/* can never happen, just to keep compiler happy! */
 		break;
@@ -1093,6 +1584,84 @@ actionCallCommitTransaction(action_t * const pThis,
 }
 
 
+/* call the commitBatch output plugin entry point. The module reports a
+ * result for each message. If it asks for a retry, only the messages it
+ * did not finish with are kept in the iparams array (in their original
+ * order) so that they, and only they, are resent after the action has
+ * resumed. Messages that failed permanently are counted as failed.
+ */
+static rsRetVal
+actionCallCommitBatch(action_t * const pThis,
+	actWrkrInfo_t *const wrkrInfo,
+	wti_t *const pWti)
+{
+	const int nParams = wrkrInfo->p.tx.currIParam;
+	const int nTpls = pThis->iNumTpls;
+	actWrkrIParams_t *const iparams = wrkrInfo->p.tx.iparams;
+	rsRetVal *results;
+	actWrkrIParams_t tmp;
+	int nFailed = 0;
+	int i, j, k;
+	DEFiRet;
+
+	DBGPRINTF("entering actionCallCommitBatch(), state: %s, actionNbr %d, "
+		  "nMsgs %d\n", getActStateName(pThis, pWti), pThis->iActionNbr, nParams);
+
+	if(wrkrInfo->p.tx.maxResults < wrkrInfo->p.tx.maxIParams) {
+		CHKmalloc(results = realloc(wrkrInfo->p.tx.results,
+					    sizeof(rsRetVal) * wrkrInfo->p.tx.maxIParams));
+		wrkrInfo->p.tx.results = results;
+		wrkrInfo->p.tx.maxResults = wrkrInfo->p.tx.maxIParams;
+	}
+	results = wrkrInfo->p.tx.results;
+	for(i = 0 ; i < nParams ; ++i)
+		results[i] = RS_RET_SUSPENDED;
+
+	iRet = pThis->pMod->mod.om.commitBatch(wrkrInfo->actWrkrData,
+		    iparams, nParams, results);
+
+	wrkrInfo->p.tx.bRetryPending = 0;
+	if(iRet == RS_RET_SUSPENDED) {
+		for(i = j = 0 ; i < nParams ; ++i) {
+			if(results[i] == RS_RET_SUSPENDED) {
+				if(i != j) {
+					for(k = 0 ; k < nTpls ; ++k) {
+						tmp = actParam(iparams, nTpls, j, k);
+						actParam(iparams, nTpls, j, k) = actParam(iparams, nTpls, i, k);
+						actParam(iparams, nTpls, i, k) = tmp;
+					}
+				}
+				++j;
+				continue;
+			}
+			if(results[i] != RS_RET_OK)
+				++nFailed;
+			for(k = 0 ; k < nTpls ; ++k) {
+				if(pThis->eParamPassing != ACT_STRING_PASSING)
+					actionFreeTxIParam(pThis, &actParam(iparams, nTpls, i, k));
+				else
+					wtiTrimIParam(&actParam(iparams, nTpls, i, k), pThis->lenParamBufMax);
+			}
+		}
+		wrkrInfo->p.tx.currIParam = j;
+		wrkrInfo->p.tx.bRetryPending = (j > 0);
+		DBGPRINTF("actionCallCommitBatch: action %d suspended, %d of %d messages "
+			  "to be retried\n", pThis->iActionNbr, j, nParams);
+	} else {
+		for(i = 0 ; i < nParams ; ++i) {
+			if(results[i] != RS_RET_OK && results[i] != RS_RET_SUSPENDED)
+				++nFailed;
+		}
+	}
+	if(nFailed > 0)
+		STATSCOUNTER_ADD(pThis->ctrFail, pThis->mutCtrFail, nFailed);
+
+	iRet = handleActionExecResult(pThis, pWti, iRet);
+finalize_it:
+	RETiRet;
+}
+
+
 /* process a message
  * this readies the action and then calls doAction()
  * rgerhards, 2008-01-28
@@ -1100,13 +1669,19 @@ actionCallCommitTransaction(action_t * const pThis,
 rsRetVal
 actionProcessMessage(action_t * const pThis, void *actParams, wti_t * const pWti)
 {
+	uint64 tStart;
 	DEFiRet;
 
 	CHKiRet(actionPrepare(pThis, pWti));
 	if(pThis->pMod->mod.om.SetShutdownImmdtPtr != NULL)
 		pThis->pMod->mod.om.SetShutdownImmdtPtr(pThis->pModData, pWti->pbShutdownImmediate);
-	if(getActionState(pWti, pThis) == ACT_STATE_ITX)
-		CHKiRet(actionCallDoAction(pThis, actParams, pWti));
+	if(getActionState(pWti, pThis) == ACT_STATE_ITX) {
+		/* transactional actions are measured per commit, see doTransaction() */
+		tStart = pThis->isTransactional ? 0 : actionHistStart(pThis);
+		iRet = actionCallDoAction(pThis, actParams, pWti);
+		actionHistDone(pThis, &pThis->histDoAction, tStart, NULL, 0);
+		CHKiRet(iRet);
+	}
 
 	iRet = getReturnCode(pThis, pWti);
 finalize_it:
@@ -1119,11 +1694,18 @@ static rsRetVal
 doTransaction(action_t *__restrict__ const pThis, wti_t *__restrict__ const pWti)
 {
 	actWrkrInfo_t *wrkrInfo;
+	uint64 tStart;
+	int nParams;
 	int i;
 	DEFiRet;
 
 	wrkrInfo = &(pWti->actWrkrInfo[pThis->iActionNbr]);
-	if(pThis->pMod->mod.om.commitTransaction != NULL) {
+	nParams = wrkrInfo->p.tx.currIParam;
+	tStart = actionHistStart(pThis);
+	if(pThis->pMod->mod.om.commitBatch != NULL) {
+		DBGPRINTF("doTransaction: have commitBatch IF, using that, pWrkrInfo %p\n", wrkrInfo);
+		CHKiRet(actionCallCommitBatch(pThis, wrkrInfo, pWti));
+	} else if(pThis->pMod->mod.om.commitTransaction != NULL) {
 		DBGPRINTF("doTransaction: have commitTransaction IF, using that, pWrkrInfo %p\n", wrkrInfo);
 		CHKiRet(actionCallCommitTransaction(pThis, wrkrInfo, pWti));
 	} else { /* note: this branch is for compatibility with old TX modules */
@@ -1137,20 +1719,48 @@ doTransaction(action_t *__restrict__ const pThis, wti_t *__restrict__ const pWti
 				&actParam(wrkrInfo->p.tx.iparams, pThis->iNumTpls, i, 0), pWti);
 		}
 	}
+	actionHistDone(pThis, &pThis->histCommit, tStart,
+		       &pThis->histBatchSize, nParams);
 finalize_it:
 	RETiRet;
 }
 
 
+/* pipestats: a sampled message was handed to this action and the action
+ * is done with it. Failed messages are not counted, but dropped from the
+ * sample.
+ */
+static inline void
+actionStageCommitted(action_t *const pThis, wti_t *const pWti, const rsRetVal ret)
+{
+	actWrkrInfo_t *const wrkrInfo = &(pWti->actWrkrInfo[pThis->iActionNbr]);
+
+	if(wrkrInfo->tStageSample == 0)
+		return;
+	if(ret == RS_RET_OK)
+		pipestatsCommitted(wrkrInfo->tStageSample);
+	wrkrInfo->tStageSample = 0;
+}
+
 /* Commit try committing (do not handle retry processing and such) */
 static rsRetVal
 actionTryCommit(action_t *__restrict__ const pThis, wti_t *__restrict__ const pWti)
 {
+	actWrkrInfo_t *__restrict__ wrkrInfo;
+	int i;
 	DEFiRet;
 
+	wrkrInfo = &(pWti->actWrkrInfo[pThis->iActionNbr]);
 	doTransaction(pThis, pWti);
 
 	CHKiRet(actionPrepare(pThis, pWti));
+	while(wrkrInfo->p.tx.bRetryPending && getActionState(pWti, pThis) == ACT_STATE_ITX) {
+		/* the action resumed: resend what commitBatch() did not deliver */
+		DBGPRINTF("actionTryCommit: action %d resumed, retrying %d messages\n",
+			  pThis->iActionNbr, wrkrInfo->p.tx.currIParam);
+		doTransaction(pThis, pWti);
+		CHKiRet(actionPrepare(pThis, pWti));
+	}
 	if(getActionState(pWti, pThis) == ACT_STATE_ITX) {
 		iRet = pThis->pMod->mod.om.endTransaction(pWti->actWrkrInfo[pThis->iActionNbr].actWrkrData);
 		switch(iRet) {
@@ -1182,7 +1792,20 @@ actionTryCommit(action_t *__restrict__ const pThis, wti_t *__restrict__ const pW
 	iRet = getReturnCode(pThis, pWti);
 
 finalize_it:
-	pWti->actWrkrInfo[pThis->iActionNbr].p.tx.currIParam = 0; /* reset to beginning */
+	if(wrkrInfo->p.tx.bRetryPending) {
+		/* action suspended (or shutdown) before the rest could be delivered */
+		STATSCOUNTER_ADD(pThis->ctrFail, pThis->mutCtrFail, wrkrInfo->p.tx.currIParam);
+		wrkrInfo->p.tx.bRetryPending = 0;
+	}
+	if(pThis->eParamPassing != ACT_STRING_PASSING) {
+		for(i = 0 ; i < wrkrInfo->p.tx.currIParam * pThis->iNumTpls ; ++i)
+			actionFreeTxIParam(pThis, &wrkrInfo->p.tx.iparams[i]);
+	} else if(pThis->lenParamBufMax != 0) {
+		/* release oversized buffers, all others are reused by the next batch */
+		for(i = 0 ; i < wrkrInfo->p.tx.currIParam * pThis->iNumTpls ; ++i)
+			wtiTrimIParam(&wrkrInfo->p.tx.iparams[i], pThis->lenParamBufMax);
+	}
+	wrkrInfo->p.tx.currIParam = 0; /* reset to beginning */
 	RETiRet;
 }
 
@@ -1195,6 +1818,7 @@ static rsRetVal
 actionCommit(action_t *__restrict__ const pThis, wti_t *__restrict__ const pWti)
 {
 	sbool bDone;
+	int __attribute__((unused)) nParams; /* only used by the action_commit probe */
 	DEFiRet;
 
 	if(!pThis->isTransactional ||
@@ -1217,6 +1841,7 @@ actionCommit(action_t *__restrict__ const pThis, wti_t *__restrict__ const pWti)
 		any of these partial implementations).
 		rgerhards, 2013-11-04
 	 */
+	nParams = pWti->actWrkrInfo[pThis->iActionNbr].p.tx.currIParam;
 	bDone = 0;
 	do {
 		iRet = actionTryCommit(pThis, pWti);
@@ -1233,6 +1858,9 @@ actionCommit(action_t *__restrict__ const pThis, wti_t *__restrict__ const pWti)
 			bDone = 1;
 		}
 	} while(!bDone);
+	RS_PROBE(action_commit, (char*) pThis->pszName, pThis->iActionNbr, nParams, iRet);
+	if(iRet != RS_RET_SUSPENDED)
+		actionStageCommitted(pThis, pWti, iRet);
 finalize_it:
 	RETiRet;
 }
@@ -1269,6 +1897,11 @@ processMsgMain(action_t *__restrict__ const pAction,
 {
 	DEFiRet;
 
+	if(pMsg->msgFlags & PROBE_MSG) {
+		actionProbeDone(pAction, pMsg);
+		RETiRet; /* not via finalize_it, probes must not change the exec state */
+	}
+
 	if(pAction->bExecWhenPrevSusp && !pWti->execState.bPrevWasSuspended) {
 		DBGPRINTF("action %d: NOT executing, as previous action was "
 			  "not suspended\n", pAction->iActionNbr);
@@ -1277,6 +1910,9 @@ processMsgMain(action_t *__restrict__ const pAction,
 
 	iRet = prepareDoActionParams(pAction, pWti, pMsg, ttNow);
 
+	if(pMsg->pStages != NULL && pWti->actWrkrInfo[pAction->iActionNbr].tStageSample == 0)
+		pWti->actWrkrInfo[pAction->iActionNbr].tStageSample = pMsg->pStages->ts[PIPESTAGE_PARSE];
+
 	if(pAction->isTransactional) {
 		pWti->actWrkrInfo[pAction->iActionNbr].pAction = pAction;
 		DBGPRINTF("action %d is transactional - executing in commit phase\n", pAction->iActionNbr);
@@ -1289,15 +1925,160 @@ processMsgMain(action_t *__restrict__ const pAction,
 				    pWti->actWrkrInfo[pAction->iActionNbr].p.nontx.actParams,
 				    pWti);
 	releaseDoActionParams(pAction, pWti);
+	if(iRet != RS_RET_SUSPENDED)
+		actionStageCommitted(pAction, pWti, iRet);
 finalize_it:
 	if(iRet == RS_RET_OK) {
 		if(pWti->execState.bDoAutoCommit)
 			iRet = actionCommit(pAction, pWti);
 	}
+	if(pAction->eParamPassing == ACT_MSG_PASSING)
+		wtiTplCacheInvalidate(pWti); /* message modification modules */
 	pWti->execState.bPrevWasSuspended = (iRet == RS_RET_SUSPENDED || iRet == RS_RET_ACTION_FAILED);
 	RETiRet;
 }
 
+/* Coalescing of duplicate messages (action.coalesce.*). Messages are keyed
+ * on a template, which is rendered before any output template. Without a
+ * window, duplicates within a batch are discarded and the first message
+ * of each key carries the number of messages it represents in $!coalesced.
+ * With a window, the first message of a key is passed on and duplicates
+ * are discarded until the window has expired. The next message for that
+ * key then carries the count, much like "last message repeated n times".
+ * Duplicates after which no further message for the key arrives are only
+ * visible in the "coalesced" counter.
+ * As messages are shared between actions, the count is set on a copy.
+ */
+typedef struct actCoalesceEntry_s {
+	time_t	ttStart;	/* start of the current window */
+	unsigned nDropped;	/* duplicates discarded since then */
+	int	iElem;		/* batch mode: element that represents the key */
+} actCoalesceEntry_t;
+
+struct actCoalesceCtx {
+	batch_t *pBatch;
+	time_t ttNow;
+	int iWindow;
+};
+
+static void
+actionCoalesceSetCount(batch_t *__restrict__ const pBatch, const int i, const unsigned count)
+{
+	msg_t *pCopy;
+
+	if((pCopy = MsgDup(pBatch->pElem[i].pMsg)) == NULL)
+		return; /* then we simply have no count */
+	msgAddJSON(pCopy, (uchar*) "!coalesced", json_object_new_int((int) count));
+	msgDestruct(&pBatch->pElem[i].pMsg);
+	pBatch->pElem[i].pMsg = pCopy;
+}
+
+static int
+actionCoalesceBatchCB(const void __attribute__((unused)) *key, void *val, void *usrptr)
+{
+	actCoalesceEntry_t *const pEnt = (actCoalesceEntry_t*) val;
+
+	if(pEnt->nDropped > 0)
+		actionCoalesceSetCount(((struct actCoalesceCtx*) usrptr)->pBatch, pEnt->iElem,
+			pEnt->nDropped + 1);
+	return HASHMAP_KEEP;
+}
+
+static int
+actionCoalesceSweepCB(const void __attribute__((unused)) *key, void *val, void *usrptr)
+{
+	struct actCoalesceCtx *const ctx = (struct actCoalesceCtx*) usrptr;
+
+	if(ctx->ttNow - ((actCoalesceEntry_t*) val)->ttStart >= ctx->iWindow) {
+		free(val);
+		return HASHMAP_REMOVE;
+	}
+	return HASHMAP_KEEP;
+}
+
+static rsRetVal
+actionCoalesce(action_t *__restrict__ const pAction,
+	batch_t *__restrict__ const pBatch,
+	struct syslogTime *ttNow)
+{
+	hashmap_t *map = NULL;
+	actCoalesceEntry_t *pEnt;
+	actWrkrIParams_t iparam;
+	struct actCoalesceCtx ctx;
+	char *keyCopy;
+	msg_t *pMsg;
+	unsigned nDropped = 0;
+	int bLocked = 0;
+	int i;
+	DEFiRet;
+
+	memset(&iparam, 0, sizeof(iparam));
+	ctx.pBatch = pBatch;
+	ctx.iWindow = pAction->iCoalesceWindow;
+	if(ctx.iWindow > 0) {
+		ctx.ttNow = time(NULL);
+		pthread_mutex_lock(&pAction->mutCoalesce);
+		bLocked = 1;
+		map = pAction->coalesceMap;
+		if(ctx.ttNow - pAction->ttCoalesceSweep >= ctx.iWindow) {
+			hashmapIterate(map, actionCoalesceSweepCB, &ctx);
+			pAction->ttCoalesceSweep = ctx.ttNow;
+		}
+	} else {
+		ctx.ttNow = 0;
+		CHKiRet(hashmapConstruct(&map, batchNumMsgs(pBatch), 0, hashmapHashString,
+			hashmapKeyEqualsString, free, free));
+	}
+
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+		pMsg = pBatch->pElem[i].pMsg;
+		if(!batchIsValidElem(pBatch, i) || (pMsg->msgFlags & PROBE_MSG))
+			continue;
+		if(tplToString(pAction->pCoalesceTpl, pMsg, &iparam, ttNow) != RS_RET_OK)
+			continue; /* not coalescing is no error */
+		if((pEnt = hashmapSearch(map, iparam.param)) == NULL) {
+			if((pEnt = malloc(sizeof(actCoalesceEntry_t))) == NULL)
+				continue;
+			if((keyCopy = strdup((char*) iparam.param)) == NULL) {
+				free(pEnt);
+				continue;
+			}
+			pEnt->ttStart = ctx.ttNow;
+			pEnt->nDropped = 0;
+			pEnt->iElem = i;
+			if(hashmapInsert(map, keyCopy, pEnt) != RS_RET_OK) {
+				free(keyCopy);
+				free(pEnt);
+			}
+			continue;
+		}
+		if(ctx.iWindow > 0 && ctx.ttNow - pEnt->ttStart >= ctx.iWindow) {
+			/* new window, this message represents the ones dropped */
+			if(pEnt->nDropped > 0)
+				actionCoalesceSetCount(pBatch, i, pEnt->nDropped + 1);
+			pEnt->ttStart = ctx.ttNow;
+			pEnt->nDropped = 0;
+			continue;
+		}
+		++pEnt->nDropped;
+		++nDropped;
+		batchSetElemState(pBatch, i, BATCH_STATE_DISC);
+	}
+
+	if(ctx.iWindow == 0)
+		hashmapIterate(map, actionCoalesceBatchCB, &ctx);
+	if(nDropped > 0)
+		STATSCOUNTER_ADD(pAction->ctrCoalesced, pAction->mutCtrCoalesced, nDropped);
+
+finalize_it:
+	if(bLocked)
+		pthread_mutex_unlock(&pAction->mutCoalesce);
+	else if(map != NULL)
+		hashmapDestruct(&map);
+	free(iparam.param);
+	RETiRet;
+}
+
 /* This entry point is called by the ACTION queue (not main queue!)
  */
 static rsRetVal
@@ -1307,14 +2088,20 @@ processBatchMain(void *__restrict__ const pVoid,
 {
 	action_t *__restrict__ const pAction = (action_t*__restrict__ const) pVoid;
 	int i;
+	uint64 tStart;
 	struct syslogTime ttNow;
 	DEFiRet;
 
 	wtiResetExecState(pWti, pBatch);
 	/* indicate we have not yet read the date */
 	ttNow.year = 0;
+	tStart = pAction->bAutoscale ? actionTimeUs() : 0;
+	if(pAction->pCoalesceTpl != NULL)
+		actionCoalesce(pAction, pBatch, &ttNow);
 
+	batchPrefetchStart(pBatch);
 	for(i = 0 ; i < batchNumMsgs(pBatch) && !*pWti->pbShutdownImmediate ; ++i) {
+		batchPrefetch(pBatch, i);
 		if(batchIsValidElem(pBatch, i)) {
 			iRet = processMsgMain(pAction, pWti, pBatch->pElem[i].pMsg, &ttNow);
 			batchSetElemState(pBatch, i, BATCH_STATE_COMM);
@@ -1322,6 +2109,8 @@ processBatchMain(void *__restrict__ const pVoid,
 	}
 
 	iRet = actionCommit(pAction, pWti);
+	if(tStart != 0)
+		actionAutoscale(pAction, tStart);
 	RETiRet;
 }
 
@@ -1367,6 +2156,9 @@ static rsRetVal setActionQueType(void __attribute__((unused)) *pVal, uchar *pszT
 	} else if (!strcasecmp((char *) pszType, "direct")) {
 		cs.ActionQueType = QUEUETYPE_DIRECT;
 		DBGPRINTF("action queue type set to DIRECT (no queueing at all)\n");
+	} else if (!strcasecmp((char *) pszType, "lockfree")) {
+		cs.ActionQueType = QUEUETYPE_LOCKFREE;
+		DBGPRINTF("action queue type set to LOCKFREE\n");
 	} else {
 		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "unknown actionqueue parameter: %s", (char *) pszType);
 		iRet = RS_RET_INVALID_PARAMS;
@@ -1391,7 +2183,7 @@ doSubmitToActionQ(action_t * const pAction, wti_t * const pWti, msg_t *pMsg)
 
 	DBGPRINTF("Called action, logging to %s\n", module.GetStateName(pAction->pMod));
 
-	STATSCOUNTER_INC(pAction->ctrProcessed, pAction->mutCtrProcessed);
+	STATSCOUNTER_PT_INC(pAction->ctrProcessed);
 	if(pAction->pQueue->qType == QUEUETYPE_DIRECT) {
 		ttNow.year = 0;
 		iRet = processMsgMain(pAction, pWti, pMsg, &ttNow);
@@ -1526,6 +2318,24 @@ DEFFUNC_llExecFunc(doActivateActions)
 		}
 		actionDisable(pThis);
 	}
+	if(pThis->bAutoscale) {
+		if(pThis->pQueue->qType == QUEUETYPE_DIRECT) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "action '%s': "
+				"action.workerAutoscale requires an action queue, ignored",
+				pThis->pszName);
+			pThis->bAutoscale = 0;
+		} else if(pThis->pQueue->iTargetResidency > 0) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "action '%s': "
+				"action.workerAutoscale conflicts with queue.targetResidency, "
+				"ignored", pThis->pszName);
+			pThis->bAutoscale = 0;
+		} else {
+			pThis->iAutoscaleCap = (pThis->iAutoscaleMin < pThis->pQueue->iNumWorkerThreads)
+					     ? pThis->iAutoscaleMin : pThis->pQueue->iNumWorkerThreads;
+			pThis->tAutoscaleLast = actionTimeUs();
+			qqueueSetWorkerCap(pThis->pQueue, pThis->iAutoscaleCap);
+		}
+	}
 	DBGPRINTF("Action %s[%p]: queue %p started\n", modGetName(pThis->pMod),
 		  pThis, pThis->pQueue);
 	ENDfunc
@@ -1599,6 +2409,7 @@ doSubmitToActionQNotAllMark(action_t * const pAction, wti_t * const pWti, msg_t
 static rsRetVal
 actionApplyCnfParam(action_t * const pAction, struct cnfparamvals * const pvals)
 {
+	char *cstr;
 	int i;
 	
 	for(i = 0 ; i < pblk.nParams ; ++i) {
@@ -1628,6 +2439,39 @@ actionApplyCnfParam(action_t * const pAction, struct cnfparamvals * const pvals)
 			pAction->bReportSuspensionCont = (int) pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "action.resumeinterval")) {
 			pAction->iResumeInterval = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "action.latencystats")) {
+			pAction->bLatencyStats = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "action.resumeintervalmax")) {
+			pAction->iResumeIntervalMax = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "action.resumejitter")) {
+			pAction->iResumeJitter = pvals[i].val.d.n;
+			if(pAction->iResumeJitter < 0 || pAction->iResumeJitter > 100) {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "action.resumejitter %d "
+					"is not within 0..100, using 100", pAction->iResumeJitter);
+				pAction->iResumeJitter = 100;
+			}
+		} else if(!strcmp(pblk.descr[i].name, "action.circuitbreaker")) {
+			pAction->iBreakerThreshold = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "action.workerautoscale")) {
+			pAction->bAutoscale = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "action.workerautoscalemin")) {
+			pAction->iAutoscaleMin = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "action.parambuffermax")) {
+			pAction->lenParamBufMax = (size_t) pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "action.minbatch")) {
+			pAction->iMinBatch = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "action.lingertime")) {
+			pAction->iLingerTime = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "action.coalesce.template")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			pAction->pCoalesceTpl = tplFind(ourConf, cstr, strlen(cstr));
+			if(pAction->pCoalesceTpl == NULL) {
+				errmsg.LogError(0, RS_RET_NOT_FOUND, "action.coalesce.template: "
+					"template '%s' not found - coalescing disabled", cstr);
+			}
+			free(cstr);
+		} else if(!strcmp(pblk.descr[i].name, "action.coalesce.window")) {
+			pAction->iCoalesceWindow = pvals[i].val.d.n;
 		} else {
 			dbgprintf("action: program error, non-handled "
 			  "param '%s'\n", pblk.descr[i].name);
@@ -1642,6 +2486,23 @@ actionApplyCnfParam(action_t * const pAction, struct cnfparamvals * const pvals)
  * Note: this function pulls global data that specifies action config state.
  * rgerhards, 2007-07-27
  */
+/* register a template as being used by an action for string passing. As soon
+ * as a template is shared by more than one action, it is assigned a slot in
+ * the worker's template cache (if it can be cached and slots are left).
+ */
+static void
+actionTplCacheRegister(struct template *pTpl)
+{
+	if(++pTpl->nStrUses != 2 || pTpl->iCacheSlot != -1)
+		return;
+	if(iTplCacheSlots < WTI_TPLCACHE_SLOTS && tplIsCacheable(pTpl)) {
+		pTpl->iCacheSlot = iTplCacheSlots++;
+		DBGPRINTF("template '%s' is shared by actions, assigned render "
+			  "cache slot %d\n", pTpl->pszName, pTpl->iCacheSlot);
+	}
+}
+
+
 rsRetVal
 addAction(action_t **ppAction, modInfo_t *pMod, void *pModData,
 	  omodStringRequest_t *pOMSR, struct cnfparamvals *actParams,
@@ -1730,6 +2591,11 @@ addAction(action_t **ppAction, modInfo_t *pMod, void *pModData,
 		DBGPRINTF("template: '%s' assigned\n", pTplName);
 	}
 
+	if(pAction->eParamPassing == ACT_STRING_PASSING) {
+		for(i = 0 ; i < pAction->iNumTpls ; ++i)
+			actionTplCacheRegister(pAction->ppTpl[i]);
+	}
+
 	pAction->pMod = pMod;
 	pAction->pModData = pModData;
 
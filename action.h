@@ -27,6 +27,7 @@
 
 #include "syslogd-types.h"
 #include "queue.h"
+#include "hashmap.h"
 
 /* external data */
 extern int glbliActionResumeRetryCount;
@@ -34,6 +35,14 @@ extern int bActionReportSuspension;
 extern int bActionReportSuspensionCont;
 
 
+/* default for action.paramBufferMax: larger template buffers are not kept */
+#define ACTION_PARAMBUF_MAX_DFLT (64 * 1024)
+
+/* circuit breaker states */
+#define ACT_BREAKER_CLOSED	0	/* normal operation */
+#define ACT_BREAKER_OPEN	1	/* backend considered dead, do not call tryResume() */
+#define ACT_BREAKER_HALFOPEN	2	/* a single worker is probing the backend */
+
 /* the following struct defines the action object data structure
  */
 struct action_s {
@@ -53,6 +62,9 @@ struct action_s {
 	time_t	ttResumeRtry;	/* when is it time to retry the resume? */
 	int	iResumeInterval;/* resume interval for this action */
 	int	iResumeRetryCount;/* how often shall we retry a suspended action? (-1 --> eternal) */
+	int	iResumeIntervalMax;/* if > 0, back off exponentially up to this many seconds */
+	int	iResumeJitter;	/* random +/- percentage applied to the backoff */
+	int	iBreakerThreshold;/* failed resumes that open the circuit breaker (0 --> off) */
 	int	iNbrNoExec;	/* number of matches that did not yet yield to an exec */
 	int	iExecEveryNthOccur;/* execute this action only every n-th occurence (with n=0,1 -> always) */
 	int  	iExecEveryNthOccurTO;/* timeout for n-th occurence feature */
@@ -74,11 +86,44 @@ struct action_s {
 	DEF_ATOMIC_HELPER_MUT(mutCAS);
 	/* for statistics subsystem */
 	statsobj_t *statsobj;
-	STATSCOUNTER_DEF(ctrProcessed, mutCtrProcessed);
+	STATSCOUNTER_PT_DEF(ctrProcessed);	/* per-thread, all workers update it */
 	STATSCOUNTER_DEF(ctrFail, mutCtrFail);
 	STATSCOUNTER_DEF(ctrSuspend, mutCtrSuspend);
 	STATSCOUNTER_DEF(ctrSuspendDuration, mutCtrSuspendDuration);
 	STATSCOUNTER_DEF(ctrResume, mutCtrResume);
+	STATSCOUNTER_DEF(ctrBreakerOpen, mutCtrBreakerOpen);
+	STATSCOUNTER_DEF(ctrCoalesced, mutCtrCoalesced);
+	/* resume backoff and circuit breaker, shared by all workers */
+	pthread_mutex_t mutBreaker;/* guards the members below */
+	int	breakerState;	/* ACT_BREAKER_* */
+	unsigned nResumeFailed;	/* failed tryResume() calls in a row */
+	time_t	ttBreakerProbe;	/* earliest time an open breaker may be probed */
+	unsigned seedJitter;	/* rand_r() state for the backoff jitter */
+	/* action queue worker autoscaling */
+	size_t	lenParamBufMax;	/* param buffers larger than this are freed after use (0: never) */
+	sbool	bAutoscale;	/* adapt the number of queue workers? */
+	int	iAutoscaleMin;	/* never go below this many workers */
+	pthread_mutex_t mutAutoscale;/* guards the members below */
+	int	iAutoscaleCap;	/* current number of workers permitted */
+	int	iAutoscaleDir;	/* last change: +1 grown, -1 shrunk, 0 none */
+	uint64	tAutoscaleLast;	/* time of the last decision (us) */
+	uint64	autoscaleLatSum;/* sum of batch latencies since then (us) */
+	unsigned autoscaleNBatches;/* number of batches since then */
+	uint64	autoscaleLatPrev;/* average batch latency before the last decision */
+	int	iMinBatch;	/* linger until the queue holds this many messages... */
+	int	iLingerTime;	/* ...or this many ms have passed (0 - no linger) */
+	/* coalescing of duplicate messages */
+	struct template *pCoalesceTpl;	/* key template, NULL - no coalescing */
+	int	iCoalesceWindow;	/* window (seconds), 0 - within a batch only */
+	pthread_mutex_t mutCoalesce;	/* guards the members below */
+	hashmap_t *coalesceMap;		/* key -> actCoalesceEntry_t (window mode) */
+	time_t	ttCoalesceSweep;	/* last time expired keys were removed */
+	sbool	bLatencyStats;	/* gather the histograms below? */
+	pthread_mutex_t mutHist;/* guards the histograms */
+	statshist_t histCommit;	/* time (us) per commit of a transactional action */
+	statshist_t histBatchSize;	/* number of messages per commit */
+	statshist_t histDoAction;	/* time (us) per doAction() of a non-transactional action */
+	statshist_t histProbe;	/* age (us) of latency probes when they reach the action */
 };
 
 
@@ -98,6 +143,7 @@ rsRetVal activateActions(void);
 rsRetVal actionNewInst(struct nvlst *lst, action_t **ppAction);
 rsRetVal actionProcessCnf(struct cnfobj *o);
 void actionCommitAllDirect(wti_t *pWti);
+void actionFreeTxIParam(const action_t *pAction, actWrkrIParams_t *piparam);
 
 /* external data */
 extern int iActionNbr;
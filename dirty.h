@@ -32,6 +32,7 @@ rsRetVal multiSubmitMsg2(multi_submit_t *pMultiSub); /* friends only! */
 rsRetVal submitMsg2(msg_t *pMsg);
 rsRetVal __attribute__((deprecated)) submitMsg(msg_t *pMsg);
 rsRetVal multiSubmitFlush(multi_submit_t *pMultiSub);
+int getSubmitFlowCtlState(ruleset_t *pRuleset);
 rsRetVal logmsgInternal(const int iErr, const int pri, const uchar *const msg, int flags);
 rsRetVal __attribute__((deprecated)) parseAndSubmitMessage(uchar *hname, uchar *hnameIP, uchar *msg, int len, int flags, flowControl_t flowCtlTypeu, prop_t *pInputName, struct syslogTime *stTime, time_t ttGenTime, ruleset_t *pRuleset);
 rsRetVal diagGetMainMsgQSize(int *piSize); /* for imdiag */
@@ -26,6 +26,7 @@ void dbgprintf(char *fmt, ...) __attribute__((format(printf, 1, 2)));
 void parser_errmsg(char *fmt, ...) __attribute__((format(printf, 1, 2)));
 void parser_warnmsg(char *fmt, ...) __attribute__((format(printf, 1, 2)));
 void tellLexEndParsing(void);
+int cnfIsScriptOnly(void);
 extern int yydebug;
 extern int yylineno;
 
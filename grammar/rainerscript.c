@@ -49,6 +49,9 @@
 #include "ruleset.h"
 #include "msg.h"
 #include "wti.h"
+#include "acmatch.h"
+#include "ratelimit.h"
+#include "glbl.h"
 #include "unicode-helper.h"
 
 DEFobjCurrIf(obj)
@@ -399,6 +402,88 @@ qs_arrcmp(const void *s1, const void *s2)
 }
 
 
+/* Hash set for membership tests (==, !=) against large constant arrays.
+ * Open addressing with linear probing and a load factor of at most 0.5.
+ * The hashes of the members are stored, so a lookup usually costs one
+ * hash computation and one memcmp(). The set does not own the strings,
+ * they belong to the array.
+ */
+#define CNFARRSET_MIN_MEMB 16	/* smaller arrays use binary search */
+struct cnfarrset {
+	unsigned mask;		/* number of slots - 1, slots are a power of two */
+	struct cnfarrset_slot {
+		unsigned hash;
+		es_str_t *estr;	/* NULL if the slot is empty */
+	} *slots;
+};
+
+static inline unsigned
+cnfarrsetHash(const unsigned char *const buf, const es_size_t len)
+{
+	unsigned hash = 2166136261u; /* FNV-1a */
+	es_size_t i;
+	for(i = 0 ; i < len ; ++i)
+		hash = (hash ^ buf[i]) * 16777619u;
+	return hash;
+}
+
+static struct cnfarrset *
+cnfarrsetConstruct(struct cnfarray *const ar)
+{
+	struct cnfarrset *set;
+	unsigned nSlots;
+	unsigned hash;
+	unsigned i;
+	int n;
+
+	for(nSlots = CNFARRSET_MIN_MEMB ; nSlots < 2u * ar->nmemb ; nSlots <<= 1)
+		/* just search */;
+	if((set = malloc(sizeof(struct cnfarrset))) == NULL)
+		return NULL;
+	if((set->slots = calloc(nSlots, sizeof(struct cnfarrset_slot))) == NULL) {
+		free(set);
+		return NULL;
+	}
+	set->mask = nSlots - 1;
+	for(n = 0 ; n < ar->nmemb ; ++n) {
+		hash = cnfarrsetHash(es_getBufAddr(ar->arr[n]), es_strlen(ar->arr[n]));
+		for(i = hash & set->mask ; set->slots[i].estr != NULL ; i = (i + 1) & set->mask) {
+			if(set->slots[i].hash == hash && !es_strcmp(set->slots[i].estr, ar->arr[n]))
+				break; /* duplicate member */
+		}
+		set->slots[i].hash = hash;
+		set->slots[i].estr = ar->arr[n];
+	}
+	return set;
+}
+
+static void
+cnfarrsetDestruct(struct cnfarrset *const set)
+{
+	if(set == NULL)
+		return;
+	free(set->slots);
+	free(set);
+}
+
+static inline int
+cnfarrsetContains(const struct cnfarrset *const set, es_str_t *const estr)
+{
+	const es_size_t len = es_strlen(estr);
+	const unsigned hash = cnfarrsetHash(es_getBufAddr(estr), len);
+	const struct cnfarrset_slot *slot;
+	unsigned i;
+
+	for(i = hash & set->mask ; set->slots[i].estr != NULL ; i = (i + 1) & set->mask) {
+		slot = set->slots + i;
+		if(   slot->hash == hash && es_strlen(slot->estr) == len
+		   && !memcmp(es_getBufAddr(slot->estr), es_getBufAddr(estr), len))
+			return 1;
+	}
+	return 0;
+}
+
+
 struct objlst*
 objlstNew(struct cnfobj *o)
 {
@@ -701,6 +786,8 @@ doGetQueueType(struct nvlst *valnode, struct cnfparamdescr *param,
 		val->val.d.n = QUEUETYPE_DISK;
 	} else if(!es_strcasebufcmp(valnode->val.d.estr, (uchar*)"direct", 6)) {
 		val->val.d.n = QUEUETYPE_DIRECT;
+	} else if(!es_strcasebufcmp(valnode->val.d.estr, (uchar*)"lockfree", 8)) {
+		val->val.d.n = QUEUETYPE_LOCKFREE;
 	} else {
 		cstr = es_str2cstr(valnode->val.d.estr, NULL);
 		parser_errmsg("param '%s': unknown queue type: '%s'",
@@ -1191,8 +1278,15 @@ static long long
 var2Number(struct var *r, int *bSuccess)
 {
 	long long n;
+	es_str_t *estr;
 	if(r->datatype == 'S') {
 		n = es_str2num(r->d.estr, bSuccess);
+	} else if(r->datatype == 'V') {
+		/* rare, so we do not duplicate the es_str2num() logic */
+		estr = es_newStrFromBuf((char*) r->d.view.p, r->d.view.len);
+		n = (estr == NULL) ? 0 : es_str2num(estr, bSuccess);
+		if(estr != NULL)
+			es_deleteStr(estr);
 	} else {
 		if(r->datatype == 'J') {
 #ifdef HAVE_JSON_OBJECT_NEW_INT64
@@ -1230,6 +1324,9 @@ var2String(struct var *__restrict__ const r, int *__restrict__ const bMustFree)
 			lenstr = strlen(cstr);
 		}
 		estr = es_newStrFromCStr(cstr, lenstr);
+	} else if(r->datatype == 'V') {
+		*bMustFree = 1;
+		estr = es_newStrFromBuf((char*) r->d.view.p, r->d.view.len);
 	} else {
 		*bMustFree = 0;
 		estr = r->d.estr;
@@ -1237,13 +1334,27 @@ var2String(struct var *__restrict__ const r, int *__restrict__ const bMustFree)
 	return estr;
 }
 
+/* Note: the returned string is a transient allocation from the worker
+ * arena and thus MUST be released via wtiArenaFree() (if bMustFree is set),
+ * not free(). Like es_str2cstr(), we drop embedded NUL characters.
+ */
 static uchar*
 var2CString(struct var *__restrict__ const r, int *__restrict__ const bMustFree)
 {
 	uchar *cstr;
+	uchar *src;
 	es_str_t *estr;
+	es_size_t i, len;
+	int iDst;
 	estr = var2String(r, bMustFree);
-	cstr = (uchar*) es_str2cstr(estr, NULL);
+	len = es_strlen(estr);
+	if((cstr = (uchar*) wtiArenaAlloc(len + 1)) != NULL) {
+		src = es_getBufAddr(estr);
+		for(i = 0, iDst = 0 ; i < len ; ++i)
+			if(src[i] != '\0')
+				cstr[iDst++] = src[i];
+		cstr[iDst] = '\0';
+	}
 	if(*bMustFree)
 		es_deleteStr(estr);
 	*bMustFree = 1;
@@ -1267,45 +1378,40 @@ varFreeMembers(struct var *r)
 	if(r->datatype == 'S') es_deleteStr(r->d.estr);
 }
 
+/* The field() helpers below do not copy anything: they locate the requested
+ * field inside buf (which need not be NUL-terminated) and return it as a
+ * slice (*pFld, *pLenFld) of buf. It is up to the caller to decide if the
+ * slice must be copied.
+ */
 static rsRetVal
-doExtractFieldByChar(uchar *str, uchar delim, const int matchnbr, uchar **resstr)
+doExtractFieldByChar(const uchar *const buf, const es_size_t len, const uchar delim,
+	const int matchnbr, const uchar **const pFld, es_size_t *const pLenFld)
 {
+	const uchar *const end = buf + len;
+	const uchar *pFldStart;
+	const uchar *pFldEnd;
 	int iCurrFld;
-	int iLen;
-	uchar *pBuf;
-	uchar *pFld;
-	uchar *pFldEnd;
 	DEFiRet;
 
 	/* first, skip to the field in question */
 	iCurrFld = 1;
-	pFld = str;
-	while(*pFld && iCurrFld < matchnbr) {
+	pFldStart = buf;
+	while(pFldStart < end && iCurrFld < matchnbr) {
 		/* skip fields until the requested field or end of string is found */
-		while(*pFld && (uchar) *pFld != delim)
-			++pFld; /* skip to field terminator */
-		if(*pFld == delim) {
-			++pFld; /* eat it */
+		if((pFldStart = memchr(pFldStart, delim, end - pFldStart)) == NULL) {
+			pFldStart = end;
+		} else {
+			++pFldStart; /* eat delimiter */
 			++iCurrFld;
 		}
 	}
 	dbgprintf("field() field requested %d, field found %d\n", matchnbr, iCurrFld);
-	
+
 	if(iCurrFld == matchnbr) {
-		/* field found, now extract it */
-		/* first of all, we need to find the end */
-		pFldEnd = pFld;
-		while(*pFldEnd && *pFldEnd != delim)
-			++pFldEnd;
-		--pFldEnd; /* we are already at the delimiter - so we need to
-			    * step back a little not to copy it as part of the field. */
-		/* we got our end pointer, now do the copy */
-		iLen = pFldEnd - pFld + 1; /* the +1 is for an actual char, NOT \0! */
-		CHKmalloc(pBuf = MALLOC((iLen + 1) * sizeof(char)));
-		/* now copy */
-		memcpy(pBuf, pFld, iLen);
-		pBuf[iLen] = '\0'; /* terminate it */
-		*resstr = pBuf;
+		/* field found, now find its end */
+		pFldEnd = memchr(pFldStart, delim, end - pFldStart);
+		*pFld = pFldStart;
+		*pLenFld = ((pFldEnd == NULL) ? end : pFldEnd) - pFldStart;
 	} else {
 		ABORT_FINALIZE(RS_RET_FIELD_NOT_FOUND);
 	}
@@ -1315,42 +1421,32 @@ finalize_it:
 
 
 static rsRetVal
-doExtractFieldByStr(uchar *str, char *delim, const rs_size_t lenDelim, const int matchnbr, uchar **resstr)
+doExtractFieldByStr(const uchar *const buf, const es_size_t len, const uchar *const delim,
+	const es_size_t lenDelim, const int matchnbr, const uchar **const pFld,
+	es_size_t *const pLenFld)
 {
+	const uchar *const end = buf + len;
+	const uchar *pFldStart;
+	const uchar *pFldEnd;
 	int iCurrFld;
-	int iLen;
-	uchar *pBuf;
-	uchar *pFld;
-	uchar *pFldEnd;
 	DEFiRet;
 
 	/* first, skip to the field in question */
 	iCurrFld = 1;
-	pFld = str;
-	while(pFld != NULL && iCurrFld < matchnbr) {
-		if((pFld = (uchar*) strstr((char*)pFld, delim)) != NULL) {
-			pFld += lenDelim;
+	pFldStart = buf;
+	while(pFldStart != NULL && iCurrFld < matchnbr) {
+		if((pFldStart = memmem(pFldStart, end - pFldStart, delim, lenDelim)) != NULL) {
+			pFldStart += lenDelim;
 			++iCurrFld;
 		}
 	}
 	dbgprintf("field() field requested %d, field found %d\n", matchnbr, iCurrFld);
-	
+
 	if(iCurrFld == matchnbr) {
-		/* field found, now extract it */
-		/* first of all, we need to find the end */
-		pFldEnd = (uchar*) strstr((char*)pFld, delim);
-		if(pFldEnd == NULL) {
-			iLen = strlen((char*) pFld);
-		} else { /* found delmiter!  Note that pFldEnd *is* already on 
-			  * the first delmi char, we don't need that. */
-			iLen = pFldEnd - pFld;
-		}
-		/* we got our end pointer, now do the copy */
-		CHKmalloc(pBuf = MALLOC((iLen + 1) * sizeof(char)));
-		/* now copy */
-		memcpy(pBuf, pFld, iLen);
-		pBuf[iLen] = '\0'; /* terminate it */
-		*resstr = pBuf;
+		/* field found, now find its end */
+		pFldEnd = memmem(pFldStart, end - pFldStart, delim, lenDelim);
+		*pFld = pFldStart;
+		*pLenFld = ((pFldEnd == NULL) ? end : pFldEnd) - pFldStart;
 	} else {
 		ABORT_FINALIZE(RS_RET_FIELD_NOT_FOUND);
 	}
@@ -1358,6 +1454,83 @@ finalize_it:
 	RETiRet;
 }
 
+/* like doExtractFieldByChar(), but use (and extend) the field starts
+ * recorded in the worker's field memo. So if multiple fields of the same
+ * string are requested, the string is split only once.
+ */
+static rsRetVal
+doExtractFieldMemo(wtiFieldMemo_t *const memo, const unsigned gen, const uchar *const buf,
+	const es_size_t len, const uchar delim, const int matchnbr,
+	const uchar **const pFld, es_size_t *const pLenFld)
+{
+	const uchar *pSep;
+	uint32_t start;
+	DEFiRet;
+
+	if(memo->buf != buf || memo->len != len || memo->delim != delim || memo->gen != gen) {
+		memo->gen = gen;
+		memo->buf = buf;
+		memo->len = len;
+		memo->delim = delim;
+		memo->bEnd = 0;
+		memo->fldStart[0] = 0;
+		memo->nFlds = 1;
+	}
+
+	/* we need the start of the next field to know where the requested one ends */
+	while(!memo->bEnd && memo->nFlds < WTI_FIELDMEMO_MAXFLDS && memo->nFlds <= matchnbr) {
+		start = memo->fldStart[memo->nFlds - 1];
+		if((pSep = memchr(buf + start, delim, len - start)) == NULL)
+			memo->bEnd = 1;
+		else
+			memo->fldStart[memo->nFlds++] = pSep - buf + 1;
+	}
+
+	if(matchnbr < 1) {
+		ABORT_FINALIZE(RS_RET_FIELD_NOT_FOUND);
+	} else if(matchnbr < memo->nFlds) {
+		*pFld = buf + memo->fldStart[matchnbr - 1];
+		*pLenFld = memo->fldStart[matchnbr] - 1 - memo->fldStart[matchnbr - 1];
+	} else if(memo->bEnd) {
+		if(matchnbr > memo->nFlds)
+			ABORT_FINALIZE(RS_RET_FIELD_NOT_FOUND);
+		*pFld = buf + memo->fldStart[matchnbr - 1];
+		*pLenFld = len - memo->fldStart[matchnbr - 1];
+	} else {
+		/* beyond what the memo can hold, continue from the last known field */
+		start = memo->fldStart[memo->nFlds - 1];
+		iRet = doExtractFieldByChar(buf + start, len - start, delim,
+					    matchnbr - memo->nFlds + 1, pFld, pLenFld);
+	}
+finalize_it:
+	RETiRet;
+}
+
+/* locate a field in buf, delim is either a string or a character (number).
+ * If buf stays valid while the current message is unmodified (bStable),
+ * the split is shared with later field() calls for the same message.
+ */
+static rsRetVal
+doExtractField(const uchar *const buf, const es_size_t len, struct var *const delim,
+	const int matchnbr, const uchar **const pFld, es_size_t *const pLenFld,
+	const int bStable, void *const usrptr)
+{
+	wti_t *pWti;
+
+	if(delim->datatype == 'S')
+		return doExtractFieldByStr(buf, len, es_getBufAddr(delim->d.estr),
+					   es_strlen(delim->d.estr), matchnbr, pFld, pLenFld);
+	if(   bStable
+	   && (pWti = wtiGetCurrWorker()) != NULL
+	   && pWti->tplCache.pMsg == (msg_t*) usrptr)
+		return doExtractFieldMemo(&pWti->fieldMemo, pWti->tplCache.gen, buf, len,
+					  (uchar) var2Number(delim, NULL), matchnbr, pFld, pLenFld);
+	return doExtractFieldByChar(buf, len, (uchar) var2Number(delim, NULL), matchnbr,
+				    pFld, pLenFld);
+}
+
+#define FIELD_NOT_FOUND_STR "***FIELD NOT FOUND***"
+
 static inline void
 doFunc_re_extract(struct cnffunc *func, struct var *ret, void* usrptr)
 {
@@ -1395,8 +1568,8 @@ doFunc_re_extract(struct cnffunc *func, struct var *ret, void* usrptr)
 	 */
 	while(!bFound) {
 		int iREstat;
-		iREstat = regexp.regexec(func->funcdata, (char*)(str + iOffs),
-					 submatchnbr+1, pmatch, 0);
+		iREstat = regexp.rsregExec(func->funcdata, (char*)(str + iOffs),
+					   submatchnbr+1, pmatch);
 		dbgprintf("re_extract: regexec return is %d\n", iREstat);
 		if(iREstat == 0) {
 			if(pmatch[0].rm_so == -1) {
@@ -1433,7 +1606,7 @@ doFunc_re_extract(struct cnffunc *func, struct var *ret, void* usrptr)
 	}
 
 finalize_it:
-	if(bMustFree) free(str);
+	if(bMustFree) wtiArenaFree(str);
 	varFreeMembers(&r[0]);
 	varFreeMembers(&r[2]);
 	varFreeMembers(&r[3]);
@@ -1479,6 +1652,34 @@ doFunc_exec_template(struct cnffunc *__restrict__ const func,
 }
 
 
+/* helper for hash64(), hash_mod() and sample(): 64 bit FNV-1a hash of
+ * the string value of the first parameter. The hash does not depend on
+ * the host or process, so results are the same on all machines.
+ */
+static uint64_t
+doFunc_hash64(struct cnffunc *__restrict__ const func, void *__restrict__ const usrptr)
+{
+	struct var r;
+	es_str_t *estr;
+	int bMustFree;
+	const unsigned char *buf;
+	es_size_t len, i;
+	uint64_t hash = 14695981039346656037ull;
+
+	cnfexprEval(func->expr[0], &r, usrptr);
+	estr = var2String(&r, &bMustFree);
+	buf = es_getBufAddr(estr);
+	len = es_strlen(estr);
+	for(i = 0 ; i < len ; ++i)
+		hash = (hash ^ buf[i]) * 1099511628211ull;
+	if(bMustFree) es_deleteStr(estr);
+	varFreeMembers(&r);
+	return hash;
+}
+
+static inline void evalVarMemo(struct cnfvar *__restrict__ const var, void *__restrict__ const usrptr,
+	struct var *__restrict__ const ret, const int bBorrow, sbool *const pbFree);
+
 /* Perform a function call. This has been moved out of cnfExprEval in order
  * to keep the code small and easier to maintain.
  */
@@ -1491,13 +1692,15 @@ doFuncCall(struct cnffunc *__restrict__ const func, struct var *__restrict__ con
 	int bMustFree;
 	es_str_t *estr;
 	char *str;
-	uchar *resStr;
+	const uchar *pFld;
+	es_size_t lenFld;
+	sbool bFree;
 	int retval;
 	struct var r[CNFFUNC_MAX_ARGS];
-	int delim;
 	int matchnbr;
 	struct funcData_prifilt *pPrifilt;
 	rsRetVal localRet;
+	long long modulo;
 
 	dbgprintf("rainerscript: executing function id %d\n", func->fID);
 	switch(func->fID) {
@@ -1571,7 +1774,7 @@ doFuncCall(struct cnffunc *__restrict__ const func, struct var *__restrict__ con
 	case CNFFUNC_RE_MATCH:
 		cnfexprEval(func->expr[0], &r[0], usrptr);
 		str = (char*) var2CString(&r[0], &bMustFree);
-		retval = regexp.regexec(func->funcdata, str, 0, NULL, 0);
+		retval = regexp.rsregExec(func->funcdata, str, 0, NULL);
 		if(retval == 0)
 			ret->d.n = 1;
 		else {
@@ -1581,7 +1784,7 @@ doFuncCall(struct cnffunc *__restrict__ const func, struct var *__restrict__ con
 			}
 		}
 		ret->datatype = 'N';
-		if(bMustFree) free(str);
+		if(bMustFree) wtiArenaFree(str);
 		varFreeMembers(&r[0]);
 		break;
 	case CNFFUNC_RE_EXTRACT:
@@ -1591,34 +1794,30 @@ doFuncCall(struct cnffunc *__restrict__ const func, struct var *__restrict__ con
 		doFunc_exec_template(func, ret, (msg_t*) usrptr);
 		break;
 	case CNFFUNC_FIELD:
-		cnfexprEval(func->expr[0], &r[0], usrptr);
+		/* a variable as source is borrowed from the property memo, so
+		 * the message property is not copied just to extract a field.
+		 */
+		if(func->expr[0]->nodetype == 'V') {
+			evalVarMemo((struct cnfvar*) func->expr[0], usrptr, &r[0], 1, &bFree);
+		} else {
+			cnfexprEval(func->expr[0], &r[0], usrptr);
+			bFree = (r[0].datatype == 'S');
+		}
 		cnfexprEval(func->expr[1], &r[1], usrptr);
 		cnfexprEval(func->expr[2], &r[2], usrptr);
-		str = (char*) var2CString(&r[0], &bMustFree);
+		estr = var2String(&r[0], &bMustFree);
 		matchnbr = var2Number(&r[2], NULL);
-		if(r[1].datatype == 'S') {
-			char *delimstr;
-			delimstr = (char*) es_str2cstr(r[1].d.estr, NULL);
-			localRet = doExtractFieldByStr((uchar*)str, delimstr, es_strlen(r[1].d.estr),
-							matchnbr, &resStr);
-			free(delimstr);
-		} else {
-			delim = var2Number(&r[1], NULL);
-			localRet = doExtractFieldByChar((uchar*)str, (char) delim, matchnbr, &resStr);
-		}
+		localRet = doExtractField(es_getBufAddr(estr), es_strlen(estr), &r[1], matchnbr,
+					  &pFld, &lenFld, !bFree && !bMustFree, usrptr);
 		if(localRet == RS_RET_OK) {
-			ret->d.estr = es_newStrFromCStr((char*)resStr, strlen((char*)resStr));
-			free(resStr);
-		} else if(localRet == RS_RET_FIELD_NOT_FOUND) {
-			ret->d.estr = es_newStrFromCStr("***FIELD NOT FOUND***",
-					sizeof("***FIELD NOT FOUND***")-1);
+			ret->d.estr = es_newStrFromBuf((char*) pFld, lenFld);
 		} else {
-			ret->d.estr = es_newStrFromCStr("***ERROR in field() FUNCTION***",
-					sizeof("***ERROR in field() FUNCTION***")-1);
+			ret->d.estr = es_newStrFromCStr(FIELD_NOT_FOUND_STR,
+					sizeof(FIELD_NOT_FOUND_STR)-1);
 		}
 		ret->datatype = 'S';
-		if(bMustFree) free(str);
-		varFreeMembers(&r[0]);
+		if(bMustFree) es_deleteStr(estr);
+		if(bFree) varFreeMembers(&r[0]);
 		varFreeMembers(&r[1]);
 		varFreeMembers(&r[2]);
 		break;
@@ -1632,6 +1831,34 @@ doFuncCall(struct cnffunc *__restrict__ const func, struct var *__restrict__ con
 			ret->d.n = 1;
 		ret->datatype = 'N';
 		break;
+	case CNFFUNC_HASH64:
+		ret->d.n = (long long) doFunc_hash64(func, usrptr);
+		ret->datatype = 'N';
+		break;
+	case CNFFUNC_HASH_MOD:
+		cnfexprEval(func->expr[1], &r[1], usrptr);
+		modulo = var2Number(&r[1], NULL);
+		varFreeMembers(&r[1]);
+		if(modulo <= 0) {
+			DBGPRINTF("hash_mod: invalid modulo %lld, returning 0\n", modulo);
+			ret->d.n = 0;
+		} else {
+			ret->d.n = doFunc_hash64(func, usrptr) % (uint64_t) modulo;
+		}
+		ret->datatype = 'N';
+		break;
+	case CNFFUNC_SAMPLE:
+		cnfexprEval(func->expr[1], &r[1], usrptr);
+		modulo = var2Number(&r[1], NULL);
+		varFreeMembers(&r[1]);
+		if(modulo <= 0)
+			ret->d.n = 0;
+		else if(modulo >= 1000)
+			ret->d.n = 1;
+		else
+			ret->d.n = (doFunc_hash64(func, usrptr) % 1000) < (uint64_t) modulo;
+		ret->datatype = 'N';
+		break;
 	case CNFFUNC_LOOKUP:
 dbgprintf("DDDD: executing lookup\n");
 		ret->datatype = 'S';
@@ -1642,9 +1869,21 @@ dbgprintf("DDDD: executing lookup\n");
 		cnfexprEval(func->expr[1], &r[1], usrptr);
 		str = (char*) var2CString(&r[1], &bMustFree);
 		ret->d.estr = lookupKey_estr(func->funcdata, (uchar*)str);
-		if(bMustFree) free(str);
+		if(bMustFree) wtiArenaFree(str);
 		if(r[1].datatype == 'S') es_deleteStr(r[1].d.estr);
 		break;
+	case CNFFUNC_RATELIMIT:
+		ret->datatype = 'N';
+		if(func->funcdata == NULL) { /* invalid config, do not drop anything */
+			ret->d.n = 1;
+			break;
+		}
+		cnfexprEval(func->expr[0], &r[0], usrptr);
+		str = (char*) var2CString(&r[0], &bMustFree);
+		ret->d.n = ratelimitKeyedCheck(func->funcdata, (uchar*)str);
+		if(bMustFree) wtiArenaFree(str);
+		varFreeMembers(&r[0]);
+		break;
 	default:
 		if(Debug) {
 			fname = es_str2cstr(func->fname, NULL);
@@ -1658,7 +1897,7 @@ dbgprintf("DDDD: executing lookup\n");
 }
 
 static inline void
-evalVar(struct cnfvar *__restrict__ const var, void *__restrict__ const usrptr,
+evalVarFetch(struct cnfvar *__restrict__ const var, void *__restrict__ const usrptr,
 	struct var *__restrict__ const ret)
 {
 	rs_size_t propLen;
@@ -1667,7 +1906,11 @@ evalVar(struct cnfvar *__restrict__ const var, void *__restrict__ const usrptr,
 	rsRetVal localRet;
 	struct json_object *json;
 
-	if(var->prop.id == PROP_CEE        ||
+	if(   var->prop.id == PROP_LOCAL_VAR
+	   && msgGetLocalVar((msg_t*)usrptr, &var->prop, ret) == RS_RET_OK) {
+		DBGPRINTF("rainerscript: var %d:%s: from slot %d, type %c\n", var->prop.id,
+			  var->prop.name, var->prop.localSlot, ret->datatype);
+	} else if(var->prop.id == PROP_CEE        ||
 	   var->prop.id == PROP_LOCAL_VAR  ||
 	   var->prop.id == PROP_GLOBAL_VAR   ) {
 		localRet = msgGetJSONPropJSON((msg_t*)usrptr, &var->prop, &json);
@@ -1687,6 +1930,57 @@ evalVar(struct cnfvar *__restrict__ const var, void *__restrict__ const usrptr,
 
 }
 
+/* Obtain the value of a variable via the property memo of the current
+ * worker, so that a property referenced by many filters is fetched only
+ * once per message (until the message is modified). If bBorrow is set, a
+ * string may be handed out that is owned by the memo; *pbFree tells the
+ * caller if it must free the result.
+ */
+static inline void
+evalVarMemo(struct cnfvar *__restrict__ const var, void *__restrict__ const usrptr,
+	struct var *__restrict__ const ret, const int bBorrow, sbool *const pbFree)
+{
+	wti_t *pWti;
+	wtiPropMemoEntry_t *ent;
+
+	if(   var->memoSlot < 0
+	   || (pWti = wtiGetCurrWorker()) == NULL
+	   || pWti->tplCache.pMsg != (msg_t*) usrptr) {
+		evalVarFetch(var, usrptr, ret);
+		*pbFree = (ret->datatype == 'S');
+		return;
+	}
+
+	ent = pWti->propMemo + var->memoSlot;
+	if(ent->v.datatype == 0 || ent->gen != pWti->tplCache.gen) {
+		if(ent->v.datatype == 'S')
+			es_deleteStr(ent->v.d.estr);
+		evalVarFetch(var, usrptr, ret);
+		ent->gen = pWti->tplCache.gen;
+		ent->v = *ret; /* whole var, so every datatype keeps its union member */
+	} else {
+		*ret = ent->v;
+	}
+
+	if(ret->datatype == 'S' && !bBorrow) {
+		if((ret->d.estr = es_strdup(ent->v.d.estr)) == NULL) {
+			ret->datatype = 'N';
+			ret->d.n = 0;
+		}
+		*pbFree = (ret->datatype == 'S');
+	} else {
+		*pbFree = 0;
+	}
+}
+
+static inline void
+evalVar(struct cnfvar *__restrict__ const var, void *__restrict__ const usrptr,
+	struct var *__restrict__ const ret)
+{
+	sbool bFree;
+	evalVarMemo(var, usrptr, ret, 0, &bFree);
+}
+
 /* perform a string comparision operation against a while array. Semantic is
  * that one one comparison is true, the whole construct is true.
  * TODO: we can obviously optimize this process. One idea is to
@@ -1701,12 +1995,15 @@ evalStrArrayCmp(es_str_t *const estr_l, struct cnfarray *__restrict__ const ar,
 	int i;
 	int r = 0;
 	es_str_t **res;
-	if(cmpop == CMP_EQ) {
-		res = bsearch(&estr_l, ar->arr, ar->nmemb, sizeof(es_str_t*), qs_arrcmp);
-		r = res != NULL;
-	} else if(cmpop == CMP_NE) {
-		res = bsearch(&estr_l, ar->arr, ar->nmemb, sizeof(es_str_t*), qs_arrcmp);
-		r = res == NULL;
+	if(cmpop == CMP_EQ || cmpop == CMP_NE) {
+		if(ar->set != NULL) {
+			r = cnfarrsetContains(ar->set, estr_l);
+		} else {
+			res = bsearch(&estr_l, ar->arr, ar->nmemb, sizeof(es_str_t*), qs_arrcmp);
+			r = res != NULL;
+		}
+		if(cmpop == CMP_NE)
+			r = !r;
 	} else {
 		for(i = 0 ; (r == 0) && (i < ar->nmemb) ; ++i) {
 			switch(cmpop) {
@@ -1879,7 +2176,9 @@ cnfexprEval(const struct cnfexpr *__restrict__ const expr, struct var *__restric
 			}
 		} else if(l.datatype == 'J') {
 			estr_l = var2String(&l, &bMustFree);
-			if(r.datatype == 'S') {
+			if(expr->r->nodetype == 'A') {
+				ret->d.n = evalStrArrayCmp(estr_l,  (struct cnfarray*) expr->r, CMP_NE);
+			} else if(r.datatype == 'S') {
 				ret->d.n = es_strcmp(estr_l, r.d.estr); /*CMP*/
 			} else {
 				n_l = var2Number(&l, &convok_l);
@@ -2250,6 +2549,7 @@ void
 cnfarrayContentDestruct(struct cnfarray *ar)
 {
 	unsigned short i;
+	cnfarrsetDestruct(ar->set);
 	for(i = 0 ; i < ar->nmemb ; ++i) {
 		es_deleteStr(ar->arr[i]);
 	}
@@ -2269,11 +2569,16 @@ cnffuncDestruct(struct cnffunc *func)
 		case CNFFUNC_RE_MATCH:
 		case CNFFUNC_RE_EXTRACT:
 			if(func->funcdata != NULL)
-				regexp.regfree(func->funcdata);
+				regexp.rsregFree((rsregex_t**) &func->funcdata);
+			break;
+		case CNFFUNC_RATELIMIT:
+			ratelimitKeyedDestruct(func->funcdata);
+			func->funcdata = NULL;
 			break;
 		default:break;
 	}
-	if(func->fID != CNFFUNC_EXEC_TEMPLATE)
+	/* templates and lookup tables belong to the config, not to us */
+	if(func->fID != CNFFUNC_EXEC_TEMPLATE && func->fID != CNFFUNC_LOOKUP)
 		free(func->funcdata);
 	free(func->fname);
 }
@@ -2353,112 +2658,724 @@ cnfexprEvalBool(struct cnfexpr *__restrict__ const expr, void *__restrict__ cons
 	return var2Number(&ret, &convok);
 }
 
-inline static void
-doIndent(int indent)
+
+/* ---- expression programs (see struct cnfprog in rainerscript.h) ---- */
+
+/* a register of the expression machine. String values are either
+ * owned by the register (and must be freed) or borrowed from the
+ * expression tree (constants).
+ */
+struct cnfreg {
+	struct var v;
+	sbool bFree;
+};
+
+struct cnfprogbld {	/* state while compiling a program */
+	struct cnfprog *prog;
+	unsigned short maxInstr;
+	int bFailed;
+};
+
+static inline void
+cnfregFree(struct cnfreg *const reg)
 {
-	int i;
-	for(i = 0 ; i < indent ; ++i)
-		dbgprintf("  ");
+	if(reg->bFree) {
+		es_deleteStr(reg->v.d.estr);
+		reg->bFree = 0;
+	}
 }
 
-static void
-pmaskPrint(uchar *pmask, int indent)
+static inline void
+cnfregSetNum(struct cnfreg *const reg, const long long n)
 {
-	int i;
-	doIndent(indent);
-	dbgprintf("pmask: ");
-	for (i = 0; i <= LOG_NFACILITIES; i++)
-		if (pmask[i] == TABLE_NOPRI)
-			dbgprintf(" X ");
-		else
-			dbgprintf("%2X ", pmask[i]);
-	dbgprintf("\n");
+	reg->v.datatype = 'N';
+	reg->v.d.n = n;
+	reg->bFree = 0;
 }
 
-static void
-cnfarrayPrint(struct cnfarray *ar, int indent)
+static struct cnfinstr *
+cnfprogAddInstr(struct cnfprogbld *const bld, const enum cnfopcode opcode,
+		const unsigned dst, const unsigned src)
 {
-	int i;
-	doIndent(indent); dbgprintf("ARRAY:\n");
-	for(i = 0 ; i < ar->nmemb ; ++i) {
-		doIndent(indent+1);
-		cstrPrint("string '", ar->arr[i]);
-		dbgprintf("'\n");
+	struct cnfprog *const prog = bld->prog;
+	struct cnfinstr *newinstr;
+	struct cnfinstr *instr;
+
+	if(bld->bFailed)
+		return NULL;
+	if(dst >= CNFPROG_MAX_REGS || src >= CNFPROG_MAX_REGS) {
+		bld->bFailed = 1;
+		return NULL;
+	}
+	if(prog->nInstr == bld->maxInstr) {
+		if(bld->maxInstr >= 0x8000) {
+			bld->bFailed = 1;
+			return NULL;
+		}
+		bld->maxInstr = (bld->maxInstr == 0) ? 16 : 2 * bld->maxInstr;
+		newinstr = realloc(prog->instr, sizeof(struct cnfinstr) * bld->maxInstr);
+		if(newinstr == NULL) {
+			bld->bFailed = 1;
+			return NULL;
+		}
+		prog->instr = newinstr;
 	}
+	instr = prog->instr + prog->nInstr++;
+	instr->opcode = opcode;
+	instr->dst = dst;
+	instr->src = src;
+	instr->cmpop = 0;
+	if(dst >= prog->nRegs)
+		prog->nRegs = dst + 1;
+	if(src >= prog->nRegs)
+		prog->nRegs = src + 1;
+	return instr;
 }
 
-void
-cnfexprPrint(struct cnfexpr *expr, int indent)
+/* check if func is a field() call with constant delimiter and field
+ * number, which we can execute without the tree walker.
+ */
+static int
+cnfprogIsConstField(const struct cnffunc *const func)
 {
-	struct cnffunc *func;
-	int i;
+	return    func->fID == CNFFUNC_FIELD
+	       && (func->expr[1]->nodetype == 'S' || func->expr[1]->nodetype == 'N')
+	       && func->expr[2]->nodetype == 'N';
+}
+
+/* emit code that leaves the value of expr in register dst. Registers
+ * above dst are used as temporaries.
+ */
+static void
+cnfprogEmit(struct cnfprogbld *const bld, struct cnfexpr *const expr, const unsigned dst)
+{
+	struct cnfinstr *instr;
+	enum cnfopcode opcode;
+	unsigned iJmp;
 
 	switch(expr->nodetype) {
-	case CMP_EQ:
-		cnfexprPrint(expr->l, indent+1);
-		doIndent(indent);
-		dbgprintf("==\n");
-		cnfexprPrint(expr->r, indent+1);
+	case 'N':
+		if((instr = cnfprogAddInstr(bld, CNFOP_NUM, dst, dst)) != NULL)
+			instr->d.n = ((struct cnfnumval*)expr)->val;
 		break;
-	case CMP_NE:
-		cnfexprPrint(expr->l, indent+1);
-		doIndent(indent);
-		dbgprintf("!=\n");
-		cnfexprPrint(expr->r, indent+1);
+	case 'S':
+		if((instr = cnfprogAddInstr(bld, CNFOP_STR, dst, dst)) != NULL)
+			instr->d.estr = ((struct cnfstringval*)expr)->estr;
 		break;
-	case CMP_LE:
-		cnfexprPrint(expr->l, indent+1);
-		doIndent(indent);
-		dbgprintf("<=\n");
-		cnfexprPrint(expr->r, indent+1);
+	case 'A':
+		/* with "normal" operations, an array evaluates to its first element */
+		if((instr = cnfprogAddInstr(bld, CNFOP_STR, dst, dst)) != NULL)
+			instr->d.estr = ((struct cnfarray*)expr)->arr[0];
 		break;
-	case CMP_GE:
-		cnfexprPrint(expr->l, indent+1);
-		doIndent(indent);
-		dbgprintf(">=\n");
-		cnfexprPrint(expr->r, indent+1);
+	case 'V':
+		if((instr = cnfprogAddInstr(bld, CNFOP_VAR, dst, dst)) != NULL)
+			instr->d.var = (struct cnfvar*) expr;
 		break;
-	case CMP_LT:
-		cnfexprPrint(expr->l, indent+1);
-		doIndent(indent);
-		dbgprintf("<\n");
-		cnfexprPrint(expr->r, indent+1);
+	case '+':
+	case '-':
+	case '*':
+	case '/':
+	case '%':
+	case '&':
+		switch(expr->nodetype) {
+		case '+': opcode = CNFOP_ADD; break;
+		case '-': opcode = CNFOP_SUB; break;
+		case '*': opcode = CNFOP_MUL; break;
+		case '/': opcode = CNFOP_DIV; break;
+		case '%': opcode = CNFOP_MOD; break;
+		default:  opcode = CNFOP_CONCAT; break;
+		}
+		cnfprogEmit(bld, expr->l, dst);
+		cnfprogEmit(bld, expr->r, dst + 1);
+		cnfprogAddInstr(bld, opcode, dst, dst + 1);
 		break;
+	case CMP_EQ:
+	case CMP_NE:
+	case CMP_LE:
+	case CMP_GE:
+	case CMP_LT:
 	case CMP_GT:
-		cnfexprPrint(expr->l, indent+1);
-		doIndent(indent);
-		dbgprintf(">\n");
-		cnfexprPrint(expr->r, indent+1);
-		break;
+	case CMP_STARTSWITH:
+	case CMP_STARTSWITHI:
 	case CMP_CONTAINS:
-		cnfexprPrint(expr->l, indent+1);
-		doIndent(indent);
-		dbgprintf("CONTAINS\n");
-		cnfexprPrint(expr->r, indent+1);
-		break;
 	case CMP_CONTAINSI:
-		cnfexprPrint(expr->l, indent+1);
-		doIndent(indent);
-		dbgprintf("CONTAINS_I\n");
-		cnfexprPrint(expr->r, indent+1);
+		cnfprogEmit(bld, expr->l, dst);
+		cnfprogEmit(bld, expr->r, dst + 1);
+		if((instr = cnfprogAddInstr(bld, CNFOP_CMP, dst, dst + 1)) != NULL) {
+			instr->cmpop = expr->nodetype;
+			instr->d.ar = (expr->r->nodetype == 'A') ? (struct cnfarray*) expr->r : NULL;
+		}
 		break;
-	case CMP_STARTSWITH:
-		cnfexprPrint(expr->l, indent+1);
-		doIndent(indent);
-		dbgprintf("STARTSWITH\n");
-		cnfexprPrint(expr->r, indent+1);
+	case AND:
+	case OR:
+		cnfprogEmit(bld, expr->l, dst);
+		iJmp = bld->prog->nInstr;
+		cnfprogAddInstr(bld, (expr->nodetype == AND) ? CNFOP_JMP_FALSE : CNFOP_JMP_TRUE,
+				dst, dst);
+		cnfprogEmit(bld, expr->r, dst);
+		cnfprogAddInstr(bld, CNFOP_BOOL, dst, dst);
+		if(!bld->bFailed)
+			bld->prog->instr[iJmp].d.target = bld->prog->nInstr;
 		break;
-	case CMP_STARTSWITHI:
-		cnfexprPrint(expr->l, indent+1);
-		doIndent(indent);
-		dbgprintf("STARTSWITH_I\n");
-		cnfexprPrint(expr->r, indent+1);
+	case NOT:
+		cnfprogEmit(bld, expr->r, dst);
+		cnfprogAddInstr(bld, CNFOP_NOT, dst, dst);
 		break;
-	case OR:
-		cnfexprPrint(expr->l, indent+1);
-		doIndent(indent);
-		dbgprintf("OR\n");
-		cnfexprPrint(expr->r, indent+1);
+	case 'M':
+		cnfprogEmit(bld, expr->r, dst);
+		cnfprogAddInstr(bld, CNFOP_NEG, dst, dst);
+		break;
+	case 'F':
+		if(cnfprogIsConstField((struct cnffunc*) expr)) {
+			cnfprogEmit(bld, ((struct cnffunc*) expr)->expr[0], dst);
+			if((instr = cnfprogAddInstr(bld, CNFOP_FIELD, dst, dst)) != NULL)
+				instr->d.expr = expr;
+			break;
+		}
+		/*FALLTHROUGH*/
+	default: /* functions and everything else are evaluated by the tree walker */
+		if((instr = cnfprogAddInstr(bld, CNFOP_EVAL, dst, dst)) != NULL)
+			instr->d.expr = expr;
+		break;
+	}
+}
+
+/* Compile an (already optimized) expression. Returns NULL if the expression
+ * cannot be compiled, in which case it must be evaluated by cnfexprEval().
+ */
+struct cnfprog *
+cnfprogCompile(struct cnfexpr *expr)
+{
+	struct cnfprogbld bld;
+
+	if(expr == NULL)
+		return NULL;
+	if((bld.prog = calloc(1, sizeof(struct cnfprog))) == NULL)
+		return NULL;
+	bld.maxInstr = 0;
+	bld.bFailed = 0;
+	cnfprogEmit(&bld, expr, 0);
+	if(bld.bFailed) {
+		DBGPRINTF("expression %p could not be compiled, using tree evaluation\n", expr);
+		cnfprogDestruct(bld.prog);
+		return NULL;
+	}
+	DBGPRINTF("expression %p compiled to %u instructions, %u registers\n",
+		  expr, bld.prog->nInstr, bld.prog->nRegs);
+	return bld.prog;
+}
+
+void
+cnfprogDestruct(struct cnfprog *prog)
+{
+	if(prog == NULL)
+		return;
+	free(prog->instr);
+	free(prog);
+}
+
+static inline long long
+cnfprogNumCmp(const unsigned cmpop, const long long l, const long long r)
+{
+	switch(cmpop) {
+	case CMP_EQ: return l == r;
+	case CMP_NE: return l != r;
+	case CMP_LE: return l <= r;
+	case CMP_GE: return l >= r;
+	case CMP_LT: return l < r;
+	default:     return l > r; /* CMP_GT */
+	}
+}
+
+/* map an es_strcmp() result to the comparison result. Note that NE
+ * returns the raw result, just like cnfexprEval() does.
+ */
+static inline long long
+cnfprogStrCmp(const unsigned cmpop, const int c)
+{
+	switch(cmpop) {
+	case CMP_EQ: return !c;
+	case CMP_NE: return c;
+	case CMP_LE: return c <= 0;
+	case CMP_GE: return c >= 0;
+	case CMP_LT: return c < 0;
+	default:     return c > 0; /* CMP_GT */
+	}
+}
+
+/* perform a comparison. This must yield exactly the same results as the
+ * CMP_* cases of cnfexprEval(), including their type conversion rules.
+ * ar is the array if the right-hand operand is a constant array (in which
+ * case r holds its first element).
+ */
+static long long
+cnfprogCmp(const unsigned cmpop, struct var *const l, struct var *const r,
+	   struct cnfarray *const ar)
+{
+	es_str_t *estr_l, *estr_r;
+	int bMustFree, bMustFree2;
+	int convok;
+	long long n;
+	long long res;
+
+	switch(cmpop) {
+	case CMP_STARTSWITH:
+	case CMP_STARTSWITHI:
+	case CMP_CONTAINS:
+	case CMP_CONTAINSI:
+		estr_l = var2String(l, &bMustFree2);
+		if(ar != NULL) {
+			res = evalStrArrayCmp(estr_l, ar, cmpop);
+		} else {
+			estr_r = var2String(r, &bMustFree);
+			if(cmpop == CMP_STARTSWITH)
+				res = es_strncmp(estr_l, estr_r, estr_r->lenStr) == 0;
+			else if(cmpop == CMP_STARTSWITHI)
+				res = es_strncasecmp(estr_l, estr_r, estr_r->lenStr) == 0;
+			else if(cmpop == CMP_CONTAINS)
+				res = es_strContains(estr_l, estr_r) != -1;
+			else
+				res = es_strCaseContains(estr_l, estr_r) != -1;
+			if(bMustFree) es_deleteStr(estr_r);
+		}
+		if(bMustFree2) es_deleteStr(estr_l);
+		return res;
+	default:
+		break;
+	}
+
+	if(   ar != NULL && (cmpop == CMP_EQ || cmpop == CMP_NE)
+	   && (l->datatype == 'S' || l->datatype == 'J')) {
+		estr_l = var2String(l, &bMustFree);
+		res = evalStrArrayCmp(estr_l, ar, cmpop);
+		if(bMustFree) es_deleteStr(estr_l);
+		return res;
+	}
+
+	if(l->datatype == 'S' || l->datatype == 'J') {
+		estr_l = var2String(l, &bMustFree2);
+		if(r->datatype == 'S') {
+			res = cnfprogStrCmp(cmpop, es_strcmp(estr_l, r->d.estr));
+		} else {
+			n = var2Number(l, &convok);
+			if(convok) {
+				res = cnfprogNumCmp(cmpop, n, r->d.n);
+			} else {
+				estr_r = var2String(r, &bMustFree);
+				res = cnfprogStrCmp(cmpop, es_strcmp(estr_l, estr_r));
+				if(bMustFree) es_deleteStr(estr_r);
+			}
+		}
+		if(bMustFree2) es_deleteStr(estr_l);
+	} else {
+		if(r->datatype == 'S') {
+			n = var2Number(r, &convok);
+			if(convok) {
+				res = cnfprogNumCmp(cmpop, l->d.n, n);
+			} else {
+				estr_l = var2String(l, &bMustFree);
+				res = cnfprogStrCmp(cmpop, es_strcmp(r->d.estr, estr_l));
+				if(bMustFree) es_deleteStr(estr_l);
+			}
+		} else {
+			res = cnfprogNumCmp(cmpop, l->d.n, r->d.n);
+		}
+	}
+	return res;
+}
+
+/* concatenate src to dst. If dst owns its string, we simply append to it. */
+static inline void
+cnfprogConcat(struct cnfreg *const dst, struct cnfreg *const src)
+{
+	es_str_t *estr_l, *estr_r;
+	int bMustFree, bMustFree2;
+
+	estr_r = var2String(&src->v, &bMustFree);
+	if(dst->bFree) {
+		es_addStr(&dst->v.d.estr, estr_r);
+	} else {
+		estr_l = var2String(&dst->v, &bMustFree2);
+		if(!bMustFree2)
+			estr_l = es_strdup(estr_l);
+		es_addStr(&estr_l, estr_r);
+		dst->v.datatype = 'S';
+		dst->v.d.estr = estr_l;
+		dst->bFree = 1;
+	}
+	if(bMustFree) es_deleteStr(estr_r);
+	cnfregFree(src);
+}
+
+/* turn a view in reg into a string owned by the register */
+static inline void
+cnfregOwnView(struct cnfreg *const reg)
+{
+	if(reg->v.datatype != 'V')
+		return;
+	reg->v.d.estr = es_newStrFromBuf((char*) reg->v.d.view.p, reg->v.d.view.len);
+	if(reg->v.d.estr == NULL) {
+		cnfregSetNum(reg, 0ll);
+	} else {
+		reg->v.datatype = 'S';
+		reg->bFree = 1;
+	}
+}
+
+/* compare a view against a string the same way es_strcmp() does */
+static inline int
+cnfprogViewCmp(const uchar *const p, const es_size_t len, es_str_t *const estr)
+{
+	const uchar *const c2 = es_getBufAddr(estr);
+	const es_size_t len2 = es_strlen(estr);
+	es_size_t i;
+
+	for(i = 0 ; i < len ; ++i) {
+		if(i == len2)
+			return 1;
+		if(p[i] != c2[i])
+			return p[i] - c2[i];
+	}
+	return (i < len2) ? -1 : 0;
+}
+
+/* compare a view (l) against a string (r) without copying. Returns 0 if
+ * that is not possible for this operation, then the caller must use
+ * cnfprogCmp().
+ */
+static inline int
+cnfprogCmpView(const unsigned cmpop, const struct var *const l, es_str_t *const r,
+	       long long *const pRes)
+{
+	const es_size_t lenR = es_strlen(r);
+
+	switch(cmpop) {
+	case CMP_EQ:
+	case CMP_NE:
+	case CMP_LE:
+	case CMP_GE:
+	case CMP_LT:
+	case CMP_GT:
+		*pRes = cnfprogStrCmp(cmpop, cnfprogViewCmp(l->d.view.p, l->d.view.len, r));
+		return 1;
+	case CMP_STARTSWITH:
+		*pRes = l->d.view.len >= lenR && !memcmp(l->d.view.p, es_getBufAddr(r), lenR);
+		return 1;
+	case CMP_CONTAINS:
+		if(lenR == 0)
+			return 0;
+		*pRes = memmem(l->d.view.p, l->d.view.len, es_getBufAddr(r), lenR) != NULL;
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* execute field() with constant delimiter and field number on the value of
+ * reg. If the value is borrowed (and thus stays valid during program
+ * execution), the result is a view into it and nothing is copied.
+ */
+static void
+cnfprogField(struct cnfreg *const reg, const struct cnffunc *const func, void *const usrptr)
+{
+	struct var delim;
+	const uchar *buf;
+	es_size_t len;
+	const uchar *pFld;
+	es_size_t lenFld;
+	es_str_t *estr = NULL;
+	es_str_t *res;
+	int bMustFree = 0;
+	rsRetVal localRet;
+
+	if(func->expr[1]->nodetype == 'S') {
+		delim.datatype = 'S';
+		delim.d.estr = ((struct cnfstringval*) func->expr[1])->estr;
+	} else {
+		delim.datatype = 'N';
+		delim.d.n = ((struct cnfnumval*) func->expr[1])->val;
+	}
+
+	if(reg->v.datatype == 'V') {
+		buf = reg->v.d.view.p;
+		len = reg->v.d.view.len;
+	} else if(   reg->v.datatype == 'J' && reg->v.d.json != NULL
+		  && json_object_get_type(reg->v.d.json) == json_type_string) {
+		buf = (const uchar*) json_object_get_string(reg->v.d.json);
+		len = strlen((const char*) buf);
+	} else {
+		estr = var2String(&reg->v, &bMustFree);
+		buf = es_getBufAddr(estr);
+		len = es_strlen(estr);
+	}
+
+	localRet = doExtractField(buf, len, &delim, ((struct cnfnumval*) func->expr[2])->val,
+				 &pFld, &lenFld, !reg->bFree && !bMustFree, usrptr);
+	if(localRet != RS_RET_OK) {
+		pFld = (const uchar*) FIELD_NOT_FOUND_STR;
+		lenFld = sizeof(FIELD_NOT_FOUND_STR) - 1;
+	}
+
+	if(reg->bFree || bMustFree) {
+		/* the source goes away, so the field must be copied */
+		res = es_newStrFromBuf((char*) pFld, lenFld);
+		if(bMustFree) es_deleteStr(estr);
+		cnfregFree(reg);
+		if(res == NULL) {
+			cnfregSetNum(reg, 0ll);
+		} else {
+			reg->v.datatype = 'S';
+			reg->v.d.estr = res;
+			reg->bFree = 1;
+		}
+	} else {
+		reg->v.datatype = 'V';
+		reg->v.d.view.p = pFld;
+		reg->v.d.view.len = lenFld;
+	}
+}
+
+/* run the program, the result is left in regs[0] */
+static void
+cnfprogExec(const struct cnfprog *__restrict__ const prog, struct cnfreg *__restrict__ const regs,
+	    void *__restrict__ const usrptr)
+{
+	const struct cnfinstr *instr;
+	struct cnfreg *dst, *src;
+	unsigned pc = 0;
+	long long n;
+	int convok;
+
+	while(pc < prog->nInstr) {
+		instr = prog->instr + pc++;
+		dst = regs + instr->dst;
+		src = regs + instr->src;
+		switch(instr->opcode) {
+		case CNFOP_NUM:
+			cnfregSetNum(dst, instr->d.n);
+			break;
+		case CNFOP_STR:
+			dst->v.datatype = 'S';
+			dst->v.d.estr = instr->d.estr;
+			dst->bFree = 0;
+			break;
+		case CNFOP_VAR:
+			evalVarMemo(instr->d.var, usrptr, &dst->v, 1, &dst->bFree);
+			break;
+		case CNFOP_EVAL:
+			cnfexprEval(instr->d.expr, &dst->v, usrptr);
+			dst->bFree = (dst->v.datatype == 'S');
+			break;
+		case CNFOP_ADD:
+			n = var2Number(&dst->v, &convok) + var2Number(&src->v, &convok);
+			cnfregFree(src); cnfregFree(dst);
+			cnfregSetNum(dst, n);
+			break;
+		case CNFOP_SUB:
+			n = var2Number(&dst->v, &convok) - var2Number(&src->v, &convok);
+			cnfregFree(src); cnfregFree(dst);
+			cnfregSetNum(dst, n);
+			break;
+		case CNFOP_MUL:
+			n = var2Number(&dst->v, &convok) * var2Number(&src->v, &convok);
+			cnfregFree(src); cnfregFree(dst);
+			cnfregSetNum(dst, n);
+			break;
+		case CNFOP_DIV:
+			n = var2Number(&dst->v, &convok) / var2Number(&src->v, &convok);
+			cnfregFree(src); cnfregFree(dst);
+			cnfregSetNum(dst, n);
+			break;
+		case CNFOP_MOD:
+			n = var2Number(&dst->v, &convok) % var2Number(&src->v, &convok);
+			cnfregFree(src); cnfregFree(dst);
+			cnfregSetNum(dst, n);
+			break;
+		case CNFOP_NEG:
+			n = -var2Number(&dst->v, &convok);
+			cnfregFree(dst);
+			cnfregSetNum(dst, n);
+			break;
+		case CNFOP_NOT:
+			n = !var2Number(&dst->v, &convok);
+			cnfregFree(dst);
+			cnfregSetNum(dst, n);
+			break;
+		case CNFOP_BOOL:
+			n = var2Number(&dst->v, &convok) ? 1ll : 0ll;
+			cnfregFree(dst);
+			cnfregSetNum(dst, n);
+			break;
+		case CNFOP_CONCAT:
+			cnfprogConcat(dst, src);
+			break;
+		case CNFOP_CMP:
+			if(   dst->v.datatype != 'V' || src->v.datatype != 'S' || instr->d.ar != NULL
+			   || !cnfprogCmpView(instr->cmpop, &dst->v, src->v.d.estr, &n)) {
+				cnfregOwnView(dst);
+				cnfregOwnView(src);
+				n = cnfprogCmp(instr->cmpop, &dst->v, &src->v, instr->d.ar);
+			}
+			cnfregFree(src); cnfregFree(dst);
+			cnfregSetNum(dst, n);
+			break;
+		case CNFOP_FIELD:
+			cnfprogField(dst, (struct cnffunc*) instr->d.expr, usrptr);
+			break;
+		case CNFOP_JMP_TRUE:
+			n = var2Number(&dst->v, &convok);
+			cnfregFree(dst);
+			if(n) {
+				cnfregSetNum(dst, 1ll);
+				pc = instr->d.target;
+			}
+			break;
+		case CNFOP_JMP_FALSE:
+			n = var2Number(&dst->v, &convok);
+			cnfregFree(dst);
+			if(!n) {
+				cnfregSetNum(dst, 0ll);
+				pc = instr->d.target;
+			}
+			break;
+		}
+	}
+}
+
+/* evaluate a compiled expression; same semantics as cnfexprEval() */
+void
+cnfprogEval(const struct cnfprog *__restrict__ const prog, struct var *__restrict__ const ret,
+	    void *__restrict__ const usrptr)
+{
+	struct cnfreg regs[CNFPROG_MAX_REGS];
+
+	cnfprogExec(prog, regs, usrptr);
+	cnfregOwnView(&regs[0]); /* the result outlives the program */
+	*ret = regs[0].v;
+	if(ret->datatype == 'S' && !regs[0].bFree)
+		ret->d.estr = es_strdup(ret->d.estr);
+}
+
+/* evaluate a compiled expression as a bool, see cnfexprEvalBool() */
+int
+cnfprogEvalBool(const struct cnfprog *__restrict__ const prog, void *__restrict__ const usrptr)
+{
+	struct cnfreg regs[CNFPROG_MAX_REGS];
+	int convok;
+	long long n;
+
+	cnfprogExec(prog, regs, usrptr);
+	n = var2Number(&regs[0].v, &convok);
+	cnfregFree(&regs[0]);
+	return n;
+}
+
+inline static void
+doIndent(int indent)
+{
+	int i;
+	for(i = 0 ; i < indent ; ++i)
+		dbgprintf("  ");
+}
+
+static void
+pmaskPrint(uchar *pmask, int indent)
+{
+	int i;
+	doIndent(indent);
+	dbgprintf("pmask: ");
+	for (i = 0; i <= LOG_NFACILITIES; i++)
+		if (pmask[i] == TABLE_NOPRI)
+			dbgprintf(" X ");
+		else
+			dbgprintf("%2X ", pmask[i]);
+	dbgprintf("\n");
+}
+
+static void
+cnfarrayPrint(struct cnfarray *ar, int indent)
+{
+	int i;
+	doIndent(indent); dbgprintf("ARRAY:\n");
+	for(i = 0 ; i < ar->nmemb ; ++i) {
+		doIndent(indent+1);
+		cstrPrint("string '", ar->arr[i]);
+		dbgprintf("'\n");
+	}
+}
+
+void
+cnfexprPrint(struct cnfexpr *expr, int indent)
+{
+	struct cnffunc *func;
+	int i;
+
+	switch(expr->nodetype) {
+	case CMP_EQ:
+		cnfexprPrint(expr->l, indent+1);
+		doIndent(indent);
+		dbgprintf("==\n");
+		cnfexprPrint(expr->r, indent+1);
+		break;
+	case CMP_NE:
+		cnfexprPrint(expr->l, indent+1);
+		doIndent(indent);
+		dbgprintf("!=\n");
+		cnfexprPrint(expr->r, indent+1);
+		break;
+	case CMP_LE:
+		cnfexprPrint(expr->l, indent+1);
+		doIndent(indent);
+		dbgprintf("<=\n");
+		cnfexprPrint(expr->r, indent+1);
+		break;
+	case CMP_GE:
+		cnfexprPrint(expr->l, indent+1);
+		doIndent(indent);
+		dbgprintf(">=\n");
+		cnfexprPrint(expr->r, indent+1);
+		break;
+	case CMP_LT:
+		cnfexprPrint(expr->l, indent+1);
+		doIndent(indent);
+		dbgprintf("<\n");
+		cnfexprPrint(expr->r, indent+1);
+		break;
+	case CMP_GT:
+		cnfexprPrint(expr->l, indent+1);
+		doIndent(indent);
+		dbgprintf(">\n");
+		cnfexprPrint(expr->r, indent+1);
+		break;
+	case CMP_CONTAINS:
+		cnfexprPrint(expr->l, indent+1);
+		doIndent(indent);
+		dbgprintf("CONTAINS\n");
+		cnfexprPrint(expr->r, indent+1);
+		break;
+	case CMP_CONTAINSI:
+		cnfexprPrint(expr->l, indent+1);
+		doIndent(indent);
+		dbgprintf("CONTAINS_I\n");
+		cnfexprPrint(expr->r, indent+1);
+		break;
+	case CMP_STARTSWITH:
+		cnfexprPrint(expr->l, indent+1);
+		doIndent(indent);
+		dbgprintf("STARTSWITH\n");
+		cnfexprPrint(expr->r, indent+1);
+		break;
+	case CMP_STARTSWITHI:
+		cnfexprPrint(expr->l, indent+1);
+		doIndent(indent);
+		dbgprintf("STARTSWITH_I\n");
+		cnfexprPrint(expr->r, indent+1);
+		break;
+	case OR:
+		cnfexprPrint(expr->l, indent+1);
+		doIndent(indent);
+		dbgprintf("OR\n");
+		cnfexprPrint(expr->r, indent+1);
 		break;
 	case AND:
 		cnfexprPrint(expr->l, indent+1);
@@ -2604,6 +3521,20 @@ cnfstmtPrintOnly(struct cnfstmt *stmt, int indent, sbool subtree)
 			doIndent(indent); dbgprintf("END PROPFILT\n");
 		}
 		break;
+	case S_MULTIMATCH:
+		doIndent(indent); dbgprintf("MULTIMATCH [%d patterns]\n", stmt->d.s_mm.ac->nPatterns);
+		if(subtree) {
+			cnfstmtPrint(stmt->d.s_mm.stmts, indent+1);
+			doIndent(indent); dbgprintf("END MULTIMATCH\n");
+		}
+		break;
+	case S_PRIDISPATCH:
+		doIndent(indent); dbgprintf("PRIDISPATCH\n");
+		if(subtree) {
+			cnfstmtPrint(stmt->d.s_pd.stmts, indent+1);
+			doIndent(indent); dbgprintf("END PRIDISPATCH\n");
+		}
+		break;
 	default:
 		dbgprintf("error: unknown stmt type %u\n",
 			(unsigned) stmt->nodetype);
@@ -2650,6 +3581,7 @@ cnfarrayNew(es_str_t *val)
 	if((ar = malloc(sizeof(struct cnfarray))) != NULL) {
 		ar->nodetype = 'A';
 		ar->nmemb = 1;
+		ar->set = NULL;
 		if((ar->arr = malloc(sizeof(es_str_t*))) == NULL) {
 			free(ar);
 			ar = NULL;
@@ -2688,6 +3620,46 @@ cnfarrayDup(struct cnfarray *old)
 	return ar;
 }
 
+/* registry of the properties that have a slot in the worker property
+ * memo. Slots are handed out at config load, one per distinct property
+ * (JSON properties are told apart by their name).
+ */
+static struct {
+	propid_t id;
+	uchar *name;	/* CEE and local variables only */
+} memoProps[WTI_PROPMEMO_SLOTS];
+static int nMemoProps = 0;
+
+/* return the memo slot for a property, -1 if it must not be memoized.
+ * Time-based system properties change during processing of a message and
+ * global variables may be modified by other workers, so these are always
+ * fetched.
+ */
+static int
+cnfvarMemoSlot(const msgPropDescr_t *const prop)
+{
+	const int bJSON = (prop->id == PROP_CEE || prop->id == PROP_LOCAL_VAR);
+	int i;
+
+	if(   prop->id == PROP_INVALID
+	   || prop->id == PROP_GLOBAL_VAR
+	   || prop->id == PROP_SYS_UPTIME
+	   || (prop->id >= PROP_SYS_NOW && prop->id <= PROP_SYS_MINUTE))
+		return -1;
+	for(i = 0 ; i < nMemoProps ; ++i) {
+		if(   memoProps[i].id == prop->id
+		   && (!bJSON || !ustrcmp(prop->name, memoProps[i].name)))
+			return i;
+	}
+	if(nMemoProps == WTI_PROPMEMO_SLOTS)
+		return -1;
+	memoProps[i].name = NULL;
+	if(bJSON && (memoProps[i].name = ustrdup(prop->name)) == NULL)
+		return -1;
+	memoProps[i].id = prop->id;
+	return nMemoProps++;
+}
+
 struct cnfvar*
 cnfvarNew(char *name)
 {
@@ -2695,19 +3667,53 @@ cnfvarNew(char *name)
 	if((var = malloc(sizeof(struct cnfvar))) != NULL) {
 		var->nodetype = 'V';
 		var->name = name;
-		msgPropDescrFill(&var->prop, (uchar*)var->name, strlen(var->name));
+		if(msgPropDescrFill(&var->prop, (uchar*)var->name, strlen(var->name)) == RS_RET_OK)
+			var->memoSlot = cnfvarMemoSlot(&var->prop);
+		else
+			var->memoSlot = -1;
 	}
 	return var;
 }
 
+/* config file names referenced by statements. The lexer frees its copy of
+ * the name when a file is finished, so we keep one of our own per file.
+ */
+static struct cnffnlst {
+	uchar *fn;
+	struct cnffnlst *next;
+} *cnffnRoot = NULL;
+
+static uchar *
+cnfstmtCurrFn(void)
+{
+	struct cnffnlst *fnl;
+
+	if(cnfcurrfn == NULL)
+		return NULL;
+	for(fnl = cnffnRoot ; fnl != NULL ; fnl = fnl->next)
+		if(!strcmp((char*) fnl->fn, cnfcurrfn))
+			return fnl->fn;
+	if((fnl = malloc(sizeof(struct cnffnlst))) == NULL)
+		return NULL;
+	if((fnl->fn = (uchar*) strdup(cnfcurrfn)) == NULL) {
+		free(fnl);
+		return NULL;
+	}
+	fnl->next = cnffnRoot;
+	cnffnRoot = fnl;
+	return fnl->fn;
+}
+
 struct cnfstmt *
 cnfstmtNew(unsigned s_type)
 {
 	struct cnfstmt* cnfstmt;
-	if((cnfstmt = malloc(sizeof(struct cnfstmt))) != NULL) {
+	if((cnfstmt = calloc(1, sizeof(struct cnfstmt))) != NULL) {
 		cnfstmt->nodetype = s_type;
 		cnfstmt->printable = NULL;
 		cnfstmt->next = NULL;
+		cnfstmt->cnffn = cnfstmtCurrFn();
+		cnfstmt->lineno = yylineno;
 	}
 	return cnfstmt;
 }
@@ -2718,6 +3724,11 @@ void cnfstmtDestructLst(struct cnfstmt *root);
 static void
 cnfstmtDestruct(struct cnfstmt *stmt)
 {
+	if(stmt->bInlined) {
+		/* contents belong to the called ruleset's tree */
+		free(stmt);
+		return;
+	}
 	switch(stmt->nodetype) {
 	case S_NOP:
 	case S_STOP:
@@ -2729,6 +3740,7 @@ cnfstmtDestruct(struct cnfstmt *stmt)
 		actionDestruct(stmt->d.act);
 		break;
 	case S_IF:
+		cnfprogDestruct(stmt->d.s_if.prog);
 		cnfexprDestruct(stmt->d.s_if.expr);
 		if(stmt->d.s_if.t_then != NULL) {
 			cnfstmtDestructLst(stmt->d.s_if.t_then);
@@ -2739,6 +3751,7 @@ cnfstmtDestruct(struct cnfstmt *stmt)
 		break;
 	case S_SET:
 		free(stmt->d.s_set.varname);
+		cnfprogDestruct(stmt->d.s_set.prog);
 		cnfexprDestruct(stmt->d.s_set.expr);
 		break;
 	case S_UNSET:
@@ -2748,6 +3761,14 @@ cnfstmtDestruct(struct cnfstmt *stmt)
 		cnfstmtDestructLst(stmt->d.s_prifilt.t_then);
 		cnfstmtDestructLst(stmt->d.s_prifilt.t_else);
 		break;
+	case S_MULTIMATCH:
+		acmatchDestruct(&stmt->d.s_mm.ac);
+		cnfstmtDestructLst(stmt->d.s_mm.stmts);
+		break;
+	case S_PRIDISPATCH:
+		free(stmt->d.s_pd.tbl);
+		cnfstmtDestructLst(stmt->d.s_pd.stmts);
+		break;
 	case S_PROPFILT:
 		msgPropDescrDestruct(&stmt->d.s_propfilt.prop);
 		if(stmt->d.s_propfilt.regex_cache != NULL)
@@ -2783,6 +3804,7 @@ cnfstmtNewSet(char *var, struct cnfexpr *expr)
 	struct cnfstmt* cnfstmt;
 	if((cnfstmt = cnfstmtNew(S_SET)) != NULL) {
 		cnfstmt->d.s_set.varname = (uchar*) var;
+		cnfstmt->d.s_set.localSlot = msgLocalVarSlot((uchar*) var);
 		cnfstmt->d.s_set.expr = expr;
 	}
 	return cnfstmt;
@@ -2804,6 +3826,7 @@ cnfstmtNewUnset(char *var)
 	struct cnfstmt* cnfstmt;
 	if((cnfstmt = cnfstmtNew(S_UNSET)) != NULL) {
 		cnfstmt->d.s_unset.varname = (uchar*) var;
+		cnfstmt->d.s_unset.localSlot = msgLocalVarSlot((uchar*) var);
 	}
 	return cnfstmt;
 }
@@ -2852,6 +3875,13 @@ cnfstmtNewAct(struct nvlst *lst)
 	rsRetVal localRet;
 	if((cnfstmt = cnfstmtNew(S_ACT)) == NULL) 
 		goto done;
+	if(cnfIsScriptOnly()) {
+		parser_errmsg("actions are not permitted in ruleset files, define "
+			      "them in a ruleset of the main config and use \"call\"");
+		nvlstDestruct(lst);
+		cnfstmt->nodetype = S_NOP;
+		goto done;
+	}
 	localRet = actionNewInst(lst, &cnfstmt->d.act);
 	if(localRet == RS_RET_OK_WARN) {
 		parser_errmsg("warnings occured in file '%s' around line %d",
@@ -2879,6 +3909,12 @@ cnfstmtNewLegaAct(char *actline)
 	if((cnfstmt = cnfstmtNew(S_ACT)) == NULL) 
 		goto done;
 	cnfstmt->printable = (uchar*)strdup((char*)actline);
+	if(cnfIsScriptOnly()) {
+		parser_errmsg("actions are not permitted in ruleset files, define "
+			      "them in a ruleset of the main config and use \"call\"");
+		cnfstmt->nodetype = S_NOP;
+		goto done;
+	}
 	localRet = cflineDoAction(loadConf, (uchar**)&actline, &cnfstmt->d.act);
 	if(localRet != RS_RET_OK && localRet != RS_RET_OK_WARN) {
 		parser_errmsg("%s occured in file '%s' around line %d",
@@ -3122,17 +4158,50 @@ cnfexprOptimize_AND_OR(struct cnfexpr *expr)
 
 
 /* optimize array for EQ/NEQ comparisons. We sort the array in
- * this case so that we can apply binary search later on.
+ * this case so that we can apply binary search later on. Large arrays
+ * additionally get a hash set, which is faster than binary search.
  */
 static inline void
 cnfexprOptimize_CMPEQ_arr(struct cnfarray *arr)
 {
 	DBGPRINTF("optimizer: sorting array of %d members for CMP_EQ/NEQ comparison\n", arr->nmemb);
 	qsort(arr->arr, arr->nmemb, sizeof(es_str_t*), qs_arrcmp);
+	if(arr->nmemb >= CNFARRSET_MIN_MEMB && arr->set == NULL) {
+		arr->set = cnfarrsetConstruct(arr);
+		DBGPRINTF("optimizer: hash set %p for array of %d members\n", arr->set, arr->nmemb);
+	}
 }
 
 
-/* (recursively) optimize an expression */
+/* (recursively) optimize an expression */
+/* fold a comparison of two numeric constants into a constant.
+ * Returns 1 if folded, 0 otherwise.
+ */
+static int
+constFoldNumCmp(struct cnfexpr *expr)
+{
+	long long ln, rn, val;
+
+	if(expr->l->nodetype != 'N' || expr->r->nodetype != 'N')
+		return 0;
+	ln = ((struct cnfnumval*)expr->l)->val;
+	rn = ((struct cnfnumval*)expr->r)->val;
+	switch(expr->nodetype) {
+	case CMP_EQ:	val = (ln == rn); break;
+	case CMP_NE:	val = (ln != rn); break;
+	case CMP_LE:	val = (ln <= rn); break;
+	case CMP_GE:	val = (ln >= rn); break;
+	case CMP_LT:	val = (ln < rn); break;
+	case CMP_GT:	val = (ln > rn); break;
+	default:	return 0;
+	}
+	cnfexprDestruct(expr->l);
+	cnfexprDestruct(expr->r);
+	expr->nodetype = 'N';
+	((struct cnfnumval*)expr)->val = val;
+	return 1;
+}
+
 struct cnfexpr*
 cnfexprOptimize(struct cnfexpr *expr)
 {
@@ -3178,6 +4247,8 @@ cnfexprOptimize(struct cnfexpr *expr)
 	case CMP_EQ:
 		expr->l = cnfexprOptimize(expr->l);
 		expr->r = cnfexprOptimize(expr->r);
+		if(constFoldNumCmp(expr))
+			break;
 		if(expr->l->nodetype == 'A') {
 			if(expr->r->nodetype == 'A') {
 				parser_errmsg("warning: '==' or '<>' "
@@ -3205,6 +4276,8 @@ cnfexprOptimize(struct cnfexpr *expr)
 	case CMP_GT:
 		expr->l = cnfexprOptimize(expr->l);
 		expr->r = cnfexprOptimize(expr->r);
+		if(constFoldNumCmp(expr))
+			break;
 		expr = cnfexprOptimize_CMP_severity_facility(expr);
 		break;
 	case CMP_CONTAINS:
@@ -3262,6 +4335,80 @@ done:	return newRoot;
 }
 
 
+/* replace stmt by the statement list subroot, which is consumed. If the
+ * list is empty, stmt becomes a NOP.
+ */
+static void
+cnfstmtReplaceByLst(struct cnfstmt *stmt, struct cnfstmt *subroot)
+{
+	struct cnfstmt *last;
+
+	if(subroot == NULL) {
+		stmt->nodetype = S_NOP;
+		return;
+	}
+	for(last = subroot ; last->next != NULL ; last = last->next)
+		/* find last node in subtree */;
+	last->next = stmt->next;
+	memcpy(stmt, subroot, sizeof(struct cnfstmt));
+	free(subroot);
+}
+
+/* check if a statement is always left via "stop", so that anything
+ * following it can never be reached.
+ */
+static int
+cnfstmtAlwaysStops(struct cnfstmt *stmt)
+{
+	struct cnfstmt *t_then, *t_else;
+
+	switch(stmt->nodetype) {
+	case S_STOP:
+		return 1;
+	case S_IF:
+		t_then = stmt->d.s_if.t_then;
+		t_else = stmt->d.s_if.t_else;
+		break;
+	case S_PRIFILT:
+		t_then = stmt->d.s_prifilt.t_then;
+		t_else = stmt->d.s_prifilt.t_else;
+		break;
+	default:
+		return 0;
+	}
+	if(t_then == NULL || t_else == NULL)
+		return 0;
+	while(t_then->next != NULL)
+		t_then = t_then->next;
+	while(t_else->next != NULL)
+		t_else = t_else->next;
+	return cnfstmtAlwaysStops(t_then) && cnfstmtAlwaysStops(t_else);
+}
+
+/* an IF with a constant condition is replaced by the branch that is
+ * always taken.
+ */
+static void
+cnfstmtOptimizeConstIf(struct cnfstmt *stmt)
+{
+	struct cnfstmt *t_keep, *t_drop;
+
+	DBGPRINTF("optimizer: IF condition is constant %lld, removing IF\n",
+		  ((struct cnfnumval*)stmt->d.s_if.expr)->val);
+	if(((struct cnfnumval*)stmt->d.s_if.expr)->val) {
+		t_keep = stmt->d.s_if.t_then;
+		t_drop = stmt->d.s_if.t_else;
+	} else {
+		t_keep = stmt->d.s_if.t_else;
+		t_drop = stmt->d.s_if.t_then;
+	}
+	cnfstmtDestructLst(t_drop);
+	cnfexprDestruct(stmt->d.s_if.expr);
+	free(stmt->printable);
+	stmt->printable = NULL;
+	cnfstmtReplaceByLst(stmt, t_keep);
+}
+
 static inline void
 cnfstmtOptimizeIf(struct cnfstmt *stmt)
 {
@@ -3270,12 +4417,21 @@ cnfstmtOptimizeIf(struct cnfstmt *stmt)
 	struct cnffunc *func;
 	struct funcData_prifilt *prifilt;
 
+	/* statements may be optimized more than once (e.g. if converted to
+	 * PRIFILT), and optimizing may change the tree the program refers to.
+	 */
+	cnfprogDestruct(stmt->d.s_if.prog);
+	stmt->d.s_if.prog = NULL;
 	expr = stmt->d.s_if.expr = cnfexprOptimize(stmt->d.s_if.expr);
 	stmt->d.s_if.t_then = removeNOPs(stmt->d.s_if.t_then);
 	stmt->d.s_if.t_else = removeNOPs(stmt->d.s_if.t_else);
 	cnfstmtOptimize(stmt->d.s_if.t_then);
 	cnfstmtOptimize(stmt->d.s_if.t_else);
 
+	if(expr->nodetype == 'N') {
+		cnfstmtOptimizeConstIf(stmt);
+		return;
+	}
 	if(stmt->d.s_if.expr->nodetype == 'F') {
 		func = (struct cnffunc*)expr;
 		   if(func->fID == CNFFUNC_PRIFILT) {
@@ -3297,6 +4453,8 @@ cnfstmtOptimizeIf(struct cnfstmt *stmt)
 			cnfstmtOptimizePRIFilt(stmt);
 		}
 	}
+	if(stmt->nodetype == S_IF)
+		stmt->d.s_if.prog = cnfprogCompile(stmt->d.s_if.expr);
 }
 
 static inline void
@@ -3317,7 +4475,6 @@ cnfstmtOptimizePRIFilt(struct cnfstmt *stmt)
 {
 	int i;
 	int isAlways = 1;
-	struct cnfstmt *subroot, *last;
 
 	stmt->d.s_prifilt.t_then = removeNOPs(stmt->d.s_prifilt.t_then);
 	cnfstmtOptimize(stmt->d.s_prifilt.t_then);
@@ -3337,19 +4494,10 @@ cnfstmtOptimizePRIFilt(struct cnfstmt *stmt)
 	}
 	free(stmt->printable);
 	stmt->printable = NULL;
-	subroot = stmt->d.s_prifilt.t_then;
-	if(subroot == NULL) {
-		/* very strange, we set it to NOP, best we can do
-		 * This case is NOT expected in practice
-		 */
-		 stmt->nodetype = S_NOP;
-		 goto done;
-	}
-	for(last = subroot ; last->next != NULL ; last = last->next)
-		/* find last node in subtree */;
-	last->next = stmt->next;
-	memcpy(stmt, subroot, sizeof(struct cnfstmt));
-	free(subroot);
+	/* an empty then part is very strange and NOT expected in practice,
+	 * the filter becomes a NOP in that case, best we can do.
+	 */
+	cnfstmtReplaceByLst(stmt, stmt->d.s_prifilt.t_then);
 
 done:	return;
 }
@@ -3377,6 +4525,9 @@ cnfstmtOptimizeCall(struct cnfstmt *stmt)
 		  pRuleset, rsName, rulesetHasQueue(pRuleset));
 	if(rulesetHasQueue(pRuleset)) {
 		stmt->d.s_call.ruleset = pRuleset;
+	} else if(rulesetIsReloadable(pRuleset)) {
+		stmt->d.s_call.ruleset = NULL;
+		stmt->d.s_call.dynRuleset = pRuleset;
 	} else {
 		stmt->d.s_call.ruleset = NULL;
 		stmt->d.s_call.stmt = pRuleset->root;
@@ -3385,6 +4536,266 @@ done:
 	free(rsName);
 	return;
 }
+
+
+/* a filter statement which may be part of a multi-match chain */
+struct mmcand {
+	struct cnfvar *var;	/* S_IF: the property */
+	msgPropDescr_t *prop;	/* the property (for S_IF, the var's one) */
+	sbool bFoldCase;
+};
+
+/* check if stmt is a contains/startswith filter over a property that can
+ * be evaluated by a multi-match and fill cand if so.
+ */
+static int
+multiMatchCandidate(struct cnfstmt *const stmt, struct mmcand *const cand)
+{
+	struct cnfexpr *expr;
+	struct cnfarray *ar;
+	msgPropDescr_t *prop;
+	int i;
+
+	switch(stmt->nodetype) {
+	case S_IF:
+		expr = stmt->d.s_if.expr;
+		if(   expr->nodetype != CMP_CONTAINS && expr->nodetype != CMP_CONTAINSI
+		   && expr->nodetype != CMP_STARTSWITH && expr->nodetype != CMP_STARTSWITHI)
+			return 0;
+		if(expr->l->nodetype != 'V')
+			return 0;
+		if(expr->r->nodetype == 'S') {
+			if(es_strlen(((struct cnfstringval*)expr->r)->estr) == 0)
+				return 0;
+		} else if(expr->r->nodetype == 'A') {
+			ar = (struct cnfarray*) expr->r;
+			for(i = 0 ; i < ar->nmemb ; ++i)
+				if(es_strlen(ar->arr[i]) == 0)
+					return 0;
+		} else {
+			return 0;
+		}
+		cand->var = (struct cnfvar*) expr->l;
+		cand->bFoldCase = (expr->nodetype == CMP_CONTAINSI || expr->nodetype == CMP_STARTSWITHI);
+		prop = &cand->var->prop;
+		break;
+	case S_PROPFILT:
+		if(   stmt->d.s_propfilt.operation != FIOP_CONTAINS
+		   && stmt->d.s_propfilt.operation != FIOP_STARTSWITH)
+			return 0;
+		if(   stmt->d.s_propfilt.pCSCompValue == NULL
+		   || rsCStrLen(stmt->d.s_propfilt.pCSCompValue) == 0)
+			return 0;
+		cand->var = NULL;
+		cand->bFoldCase = 0;
+		prop = &stmt->d.s_propfilt.prop;
+		break;
+	default:
+		return 0;
+	}
+	/* the value must not change while the chain is evaluated */
+	if(   prop->id == PROP_INVALID || prop->id == PROP_GLOBAL_VAR || prop->id == PROP_SYS_UPTIME
+	   || (prop->id >= PROP_SYS_NOW && prop->id <= PROP_SYS_MINUTE))
+		return 0;
+	cand->prop = prop;
+	return 1;
+}
+
+static int
+multiMatchSameChain(const struct mmcand *const c1, const struct mmcand *const c2)
+{
+	if((c1->var == NULL) != (c2->var == NULL) || c1->bFoldCase != c2->bFoldCase)
+		return 0;
+	if(c1->prop->id != c2->prop->id)
+		return 0;
+	if(c1->prop->id == PROP_CEE || c1->prop->id == PROP_LOCAL_VAR)
+		return !strcmp((char*)c1->prop->name, (char*)c2->prop->name);
+	return 1;
+}
+
+/* add the patterns of filter stmt to the matcher, using id */
+static rsRetVal
+multiMatchAddStmt(acmatch_t *const ac, struct cnfstmt *const stmt, const unsigned id)
+{
+	struct cnfexpr *expr;
+	struct cnfarray *ar;
+	es_str_t *estr;
+	sbool bAnchored;
+	int i;
+	DEFiRet;
+
+	if(stmt->nodetype == S_PROPFILT) {
+		CHKiRet(acmatchAddPattern(ac, rsCStrGetBufBeg(stmt->d.s_propfilt.pCSCompValue),
+			rsCStrLen(stmt->d.s_propfilt.pCSCompValue), id,
+			stmt->d.s_propfilt.operation == FIOP_STARTSWITH));
+	} else {
+		expr = stmt->d.s_if.expr;
+		bAnchored = (expr->nodetype == CMP_STARTSWITH || expr->nodetype == CMP_STARTSWITHI);
+		if(expr->r->nodetype == 'S') {
+			estr = ((struct cnfstringval*)expr->r)->estr;
+			CHKiRet(acmatchAddPattern(ac, es_getBufAddr(estr), es_strlen(estr), id, bAnchored));
+		} else {
+			ar = (struct cnfarray*) expr->r;
+			for(i = 0 ; i < ar->nmemb ; ++i)
+				CHKiRet(acmatchAddPattern(ac, es_getBufAddr(ar->arr[i]),
+					es_strlen(ar->arr[i]), id, bAnchored));
+		}
+	}
+finalize_it:
+	RETiRet;
+}
+
+/* Chains of sibling filters like
+ *    if $msg contains "a" then ...
+ *    if $msg contains "b" then ...
+ * rescan the property for each filter. If a chain is long enough, we
+ * compile all its patterns into a single matcher and replace the chain
+ * by a S_MULTIMATCH statement, which finds the results for all filters
+ * of the chain with a single pass over the property value. Execution
+ * order and semantics do not change.
+ */
+#define MULTIMATCH_MIN_STMTS 3	/* shorter chains are evaluated filter by filter */
+static void
+cnfstmtOptimizeMultiMatch(struct cnfstmt *root)
+{
+	struct cnfstmt *stmt, *last, *head;
+	struct mmcand first, cand;
+	acmatch_t *ac;
+	unsigned n;
+	rsRetVal localRet;
+
+	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		if(!multiMatchCandidate(stmt, &first))
+			continue;
+		n = 1;
+		for(last = stmt ;    last->next != NULL && n < ACMATCH_MAX_IDS
+				  && multiMatchCandidate(last->next, &cand)
+				  && multiMatchSameChain(&first, &cand) ; last = last->next)
+			++n;
+		if(n < MULTIMATCH_MIN_STMTS) {
+			stmt = last;
+			continue;
+		}
+
+		if((localRet = acmatchConstruct(&ac, first.bFoldCase)) != RS_RET_OK) {
+			stmt = last;
+			continue;
+		}
+		n = 0;
+		for(head = stmt ; localRet == RS_RET_OK && head != last->next ; head = head->next)
+			localRet = multiMatchAddStmt(ac, head, n++);
+		if(localRet == RS_RET_OK)
+			localRet = acmatchFinalize(ac);
+		if(localRet != RS_RET_OK || (head = malloc(sizeof(struct cnfstmt))) == NULL) {
+			acmatchDestruct(&ac);
+			stmt = last;
+			continue;
+		}
+		DBGPRINTF("optimizer: combining %u filters into MULTIMATCH\n", n);
+		/* the chain (starting with a copy of stmt) becomes the sub-list
+		 * of stmt, which is turned into the S_MULTIMATCH node.
+		 */
+		memcpy(head, stmt, sizeof(struct cnfstmt));
+		stmt->next = last->next;
+		last->next = NULL;
+		multiMatchCandidate(head, &first); /* stmt's content has moved */
+		stmt->nodetype = S_MULTIMATCH;
+		stmt->printable = NULL;
+		stmt->d.s_mm.ac = ac;
+		stmt->d.s_mm.stmts = head;
+		stmt->d.s_mm.var = first.var;
+		stmt->d.s_mm.prop = (first.var == NULL) ? first.prop : NULL;
+	}
+}
+
+
+#define PRIDISPATCH_MIN_STMTS 3	/* shorter chains are evaluated filter by filter */
+#define PRIDISPATCH_MAX_STMTS 64	/* one bit per filter in a table entry */
+/* Combine a chain of PRI filters into a single S_PRIDISPATCH node. Its
+ * table holds, for each facility/severity pair, which filters of the chain
+ * match, so all of them are evaluated by a single lookup.
+ */
+static void
+cnfstmtOptimizePriDispatch(struct cnfstmt *root)
+{
+	struct cnfstmt *stmt, *last, *head, *sub;
+	uint64_t *tbl;
+	unsigned n;
+	int fac, sev;
+
+	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		if(stmt->nodetype != S_PRIFILT)
+			continue;
+		n = 1;
+		for(last = stmt ;    last->next != NULL && n < PRIDISPATCH_MAX_STMTS
+				  && last->next->nodetype == S_PRIFILT ; last = last->next)
+			++n;
+		if(n < PRIDISPATCH_MIN_STMTS) {
+			stmt = last;
+			continue;
+		}
+		if((tbl = calloc(PRIDISPATCH_TBLSIZE, sizeof(uint64_t))) == NULL) {
+			stmt = last;
+			continue;
+		}
+		if((head = malloc(sizeof(struct cnfstmt))) == NULL) {
+			free(tbl);
+			stmt = last;
+			continue;
+		}
+		n = 0;
+		for(sub = stmt ; sub != last->next ; sub = sub->next, ++n) {
+			for(fac = 0 ; fac <= LOG_NFACILITIES ; ++fac)
+				for(sev = 0 ; sev < 8 ; ++sev)
+					if(sub->d.s_prifilt.pmask[fac] & (1 << sev))
+						tbl[PRIDISPATCH_IDX(fac, sev)] |= (uint64_t) 1 << n;
+		}
+		DBGPRINTF("optimizer: combining %u PRI filters into PRIDISPATCH\n", n);
+		/* as for S_MULTIMATCH, stmt becomes the new node */
+		memcpy(head, stmt, sizeof(struct cnfstmt));
+		stmt->next = last->next;
+		last->next = NULL;
+		stmt->nodetype = S_PRIDISPATCH;
+		stmt->printable = NULL;
+		stmt->d.s_pd.tbl = tbl;
+		stmt->d.s_pd.stmts = head;
+	}
+}
+
+
+/* obtain the results of all filters of a S_MULTIMATCH statement. Bit i
+ * of the result is set if the i-th filter of the chain matches (without
+ * a possible negation of a property filter applied).
+ */
+uint64_t
+cnfstmtMultiMatch(struct cnfstmt *const stmt, void *const usrptr)
+{
+	struct var v;
+	es_str_t *estr;
+	int bMustFree;
+	uchar *pszProp;
+	rs_size_t propLen;
+	unsigned short bMustBeFreed = 0;
+	uint64_t found;
+
+	if(stmt->d.s_mm.var != NULL) {
+		/* same value as evaluated by the CMP_* operations */
+		evalVar(stmt->d.s_mm.var, usrptr, &v);
+		estr = var2String(&v, &bMustFree);
+		found = acmatchExec(stmt->d.s_mm.ac, es_getBufAddr(estr), es_strlen(estr));
+		if(bMustFree) es_deleteStr(estr);
+		varFreeMembers(&v);
+	} else {
+		/* same value as evaluated by evalPROPFILT() */
+		pszProp = MsgGetProp((msg_t*)usrptr, NULL, stmt->d.s_mm.prop,
+				     &propLen, &bMustBeFreed, NULL);
+		found = acmatchExec(stmt->d.s_mm.ac, pszProp, strlen((char*)pszProp));
+		if(bMustBeFreed)
+			free(pszProp);
+	}
+	return found;
+}
+
 /* (recursively) optimize a statement */
 void
 cnfstmtOptimize(struct cnfstmt *root)
@@ -3404,7 +4815,9 @@ cnfstmtOptimize(struct cnfstmt *root)
 			cnfstmtOptimize(stmt->d.s_propfilt.t_then);
 			break;
 		case S_SET:
+			cnfprogDestruct(stmt->d.s_set.prog); /* see cnfstmtOptimizeIf() */
 			stmt->d.s_set.expr = cnfexprOptimize(stmt->d.s_set.expr);
+			stmt->d.s_set.prog = cnfprogCompile(stmt->d.s_set.expr);
 			break;
 		case S_ACT:
 			cnfstmtOptimizeAct(stmt);
@@ -3417,6 +4830,8 @@ cnfstmtOptimize(struct cnfstmt *root)
 				parser_errmsg("STOP is followed by unreachable statements!\n");
 			break;
 		case S_UNSET: /* nothing to do */
+		case S_MULTIMATCH: /* already optimized */
+		case S_PRIDISPATCH:
 			break;
 		case S_NOP:
 			DBGPRINTF("optimizer error: we see a NOP, how come?\n");
@@ -3426,10 +4841,128 @@ cnfstmtOptimize(struct cnfstmt *root)
 				(unsigned) stmt->nodetype);
 			break;
 		}
+		if(stmt->next != NULL && cnfstmtAlwaysStops(stmt)) {
+			DBGPRINTF("optimizer: removing unreachable statements\n");
+			cnfstmtDestructLst(stmt->next);
+			stmt->next = NULL;
+		}
+	}
+	cnfstmtOptimizePriDispatch(root);
+	cnfstmtOptimizeMultiMatch(root);
+done:	return;
+}
+
+
+#define INLINE_MAX_STMTS 16	/* larger rulesets are still CALLed */
+#define INLINE_MAX_DEPTH 16	/* max nesting of inlined rulesets */
+
+static void cnfstmtInlineCallsLst(struct cnfstmt *root, struct cnfstmt **active, int depth);
+
+/* replace a CALL of a small, queue-less ruleset by shallow copies of the
+ * called ruleset's top-level statements. The copies are flagged as inlined,
+ * so that the statements' contents are only owned (and destructed) by the
+ * callee. Rulesets that are currently being inlined (recursive calls) are
+ * not touched.
+ */
+static void
+cnfstmtInlineCall(struct cnfstmt *stmt, struct cnfstmt **active, int depth)
+{
+	struct cnfstmt *callee, *sub, *copy;
+	struct cnfstmt *first = NULL, *last = NULL;
+	int nStmts = 0;
+	int i;
+
+	callee = stmt->d.s_call.stmt;
+	if(   stmt->d.s_call.ruleset != NULL || stmt->d.s_call.dynRuleset != NULL
+	   || callee == NULL || depth >= INLINE_MAX_DEPTH)
+		goto done;
+	for(i = 0 ; i < depth ; ++i)
+		if(active[i] == callee)
+			goto done;
+	active[depth] = callee;
+	cnfstmtInlineCallsLst(callee, active, depth + 1);
+	for(sub = callee ; sub != NULL ; sub = sub->next)
+		if(sub->nodetype != S_NOP)
+			++nStmts;
+	if(nStmts > INLINE_MAX_STMTS)
+		goto done;
+
+	for(sub = callee ; sub != NULL ; sub = sub->next) {
+		if(sub->nodetype == S_NOP)
+			continue;
+		if((copy = malloc(sizeof(struct cnfstmt))) == NULL) {
+			cnfstmtDestructLst(first);
+			goto done;
+		}
+		memcpy(copy, sub, sizeof(struct cnfstmt));
+		copy->next = NULL;
+		if(sub->nodetype == S_CALL) {
+			/* a CALL left in place may itself be inlined later on,
+			 * so the copy needs to own its name.
+			 */
+			copy->printable = NULL;
+			copy->d.s_call.name = es_strdup(sub->d.s_call.name);
+		} else {
+			copy->bInlined = 1;
+		}
+		if(first == NULL)
+			first = copy;
+		else
+			last->next = copy;
+		last = copy;
 	}
+	DBGPRINTF("optimizer: inlining %d statements of called ruleset\n", nStmts);
+	es_deleteStr(stmt->d.s_call.name);
+	cnfstmtReplaceByLst(stmt, first);
 done:	return;
 }
 
+static void
+cnfstmtInlineCallsLst(struct cnfstmt *root, struct cnfstmt **active, int depth)
+{
+	struct cnfstmt *stmt;
+
+	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		if(stmt->bInlined)
+			continue;
+		switch(stmt->nodetype) {
+		case S_CALL:
+			cnfstmtInlineCall(stmt, active, depth);
+			break;
+		case S_IF:
+			cnfstmtInlineCallsLst(stmt->d.s_if.t_then, active, depth);
+			cnfstmtInlineCallsLst(stmt->d.s_if.t_else, active, depth);
+			break;
+		case S_PRIFILT:
+			cnfstmtInlineCallsLst(stmt->d.s_prifilt.t_then, active, depth);
+			cnfstmtInlineCallsLst(stmt->d.s_prifilt.t_else, active, depth);
+			break;
+		case S_PROPFILT:
+			cnfstmtInlineCallsLst(stmt->d.s_propfilt.t_then, active, depth);
+			break;
+		case S_MULTIMATCH:
+			cnfstmtInlineCallsLst(stmt->d.s_mm.stmts, active, depth);
+			break;
+		case S_PRIDISPATCH:
+			cnfstmtInlineCallsLst(stmt->d.s_pd.stmts, active, depth);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* inline the CALLs inside a ruleset. Must only be run after all rulesets
+ * have been optimized, as the inlined statements are copies.
+ */
+void
+cnfstmtInlineCalls(struct cnfstmt *root)
+{
+	struct cnfstmt *active[INLINE_MAX_DEPTH];
+	active[0] = root;
+	cnfstmtInlineCallsLst(root, active, 1);
+}
+
 
 struct cnffparamlst *
 cnffparamlstNew(struct cnfexpr *expr, struct cnffparamlst *next)
@@ -3485,16 +5018,16 @@ funcName2ID(es_str_t *fname, unsigned short nParams)
 		}
 		return CNFFUNC_CNUM;
 	} else if(!es_strbufcmp(fname, (unsigned char*)"re_match", sizeof("re_match") - 1)) {
-		if(nParams != 2) {
+		if(nParams != 2 && nParams != 3) {
 			parser_errmsg("number of parameters for re_match() must be two "
-				      "but is %d.", nParams);
+				      "or three but is %d.", nParams);
 			return CNFFUNC_INVALID;
 		}
 		return CNFFUNC_RE_MATCH;
 	} else if(!es_strbufcmp(fname, (unsigned char*)"re_extract", sizeof("re_extract") - 1)) {
-		if(nParams != 5) {
+		if(nParams != 5 && nParams != 6) {
 			parser_errmsg("number of parameters for re_extract() must be five "
-				      "but is %d.", nParams);
+				      "or six but is %d.", nParams);
 			return CNFFUNC_INVALID;
 		}
 		return CNFFUNC_RE_EXTRACT;
@@ -3526,18 +5059,51 @@ funcName2ID(es_str_t *fname, unsigned short nParams)
 			return CNFFUNC_INVALID;
 		}
 		return CNFFUNC_LOOKUP;
+	} else if(!es_strbufcmp(fname, (unsigned char*)"hash64", sizeof("hash64") - 1)) {
+		if(nParams != 1) {
+			parser_errmsg("number of parameters for hash64() must be one "
+				      "but is %d.", nParams);
+			return CNFFUNC_INVALID;
+		}
+		return CNFFUNC_HASH64;
+	} else if(!es_strbufcmp(fname, (unsigned char*)"hash_mod", sizeof("hash_mod") - 1)) {
+		if(nParams != 2) {
+			parser_errmsg("number of parameters for hash_mod() must be two "
+				      "but is %d.", nParams);
+			return CNFFUNC_INVALID;
+		}
+		return CNFFUNC_HASH_MOD;
+	} else if(!es_strbufcmp(fname, (unsigned char*)"sample", sizeof("sample") - 1)) {
+		if(nParams != 2) {
+			parser_errmsg("number of parameters for sample() must be two "
+				      "but is %d.", nParams);
+			return CNFFUNC_INVALID;
+		}
+		return CNFFUNC_SAMPLE;
+	} else if(!es_strbufcmp(fname, (unsigned char*)"ratelimit", sizeof("ratelimit") - 1)) {
+		if(nParams != 3 && nParams != 4) {
+			parser_errmsg("number of parameters for ratelimit() must be three "
+				      "or four but is %d.", nParams);
+			return CNFFUNC_INVALID;
+		}
+		return CNFFUNC_RATELIMIT;
 	} else {
 		return CNFFUNC_INVALID;
 	}
 }
 
 
+/* The optional last parameter of re_match() and re_extract() selects the
+ * regex engine for this expression, else global(regex.engine) is used.
+ */
 static inline rsRetVal
 initFunc_re_match(struct cnffunc *func)
 {
 	rsRetVal localRet;
 	char *regex = NULL;
-	regex_t *re;
+	char *engineName = NULL;
+	int engine = glblRegexEngine;
+	unsigned short iEngineParam;
 	DEFiRet;
 
 	func->funcdata = NULL;
@@ -3546,13 +5112,30 @@ initFunc_re_match(struct cnffunc *func)
 		FINALIZE;
 	}
 
-	CHKmalloc(re = malloc(sizeof(regex_t)));
-	func->funcdata = re;
+	iEngineParam = (func->fID == CNFFUNC_RE_MATCH) ? 2 : 5;
+	if(func->nParams > iEngineParam) {
+		if(func->expr[iEngineParam]->nodetype != 'S') {
+			parser_errmsg("param %d of %s() must be a constant string",
+				      iEngineParam + 1, (func->fID == CNFFUNC_RE_MATCH)
+				      ? "re_match" : "re_extract");
+			FINALIZE;
+		}
+		engineName = es_str2cstr(((struct cnfstringval*) func->expr[iEngineParam])->estr, NULL);
+		if((engine = regexpEngineByName(engineName)) == -1) {
+			parser_errmsg("unknown regex engine '%s'", engineName);
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		}
+	}
 
 	regex = es_str2cstr(((struct cnfstringval*) func->expr[1])->estr, NULL);
 	
 	if((localRet = objUse(regexp, LM_REGEXP_FILENAME)) == RS_RET_OK) {
-		if(regexp.regcomp(re, (char*) regex, REG_EXTENDED) != 0) {
+		localRet = regexp.rsregComp((rsregex_t**) &func->funcdata, regex, REG_EXTENDED, engine);
+		if(localRet == RS_RET_NOT_IMPLEMENTED) {
+			parser_errmsg("regex engine for '%s' is not supported by this build "
+				      "(no PCRE2 support)", regex);
+			ABORT_FINALIZE(localRet);
+		} else if(localRet != RS_RET_OK) {
 			parser_errmsg("cannot compile regex '%s'", regex);
 			ABORT_FINALIZE(RS_RET_ERR);
 		}
@@ -3563,6 +5146,7 @@ initFunc_re_match(struct cnffunc *func)
 
 finalize_it:
 	free(regex);
+	free(engineName);
 	RETiRet;
 }
 
@@ -3639,6 +5223,42 @@ finalize_it:
 }
 
 
+/* ratelimit(key, burst, interval[, maxkeys]) - all but the key must be
+ * constant numbers, as the limiter is created at config load.
+ */
+static inline rsRetVal
+initFunc_ratelimit(struct cnffunc *func)
+{
+	long long params[3] = { 0, 0, 0 };
+	unsigned short i;
+	DEFiRet;
+
+	func->funcdata = NULL;
+	for(i = 1 ; i < func->nParams ; ++i) {
+		if(func->expr[i]->nodetype != 'N') {
+			parser_errmsg("param %d of ratelimit() must be a constant number", i + 1);
+			FINALIZE;
+		}
+		params[i - 1] = ((struct cnfnumval*)func->expr[i])->val;
+	}
+	if(params[0] < 1 || params[0] > 65535 || params[1] < 1 || params[1] > 86400
+	   || params[2] < 0 || params[2] > 100000000) {
+		parser_errmsg("ratelimit(): burst must be 1..65535, interval 1..86400 "
+			      "seconds and maxkeys 0..100000000");
+		FINALIZE;
+	}
+	if(ratelimitKeyedNew((ratelimit_keyed_t**) &func->funcdata, "ratelimit()",
+			     (unsigned) params[1], (unsigned) params[0],
+			     (unsigned) params[2]) != RS_RET_OK) {
+		parser_errmsg("ratelimit(): could not create the ratelimiter");
+		func->funcdata = NULL;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 struct cnffunc *
 cnffuncNew(es_str_t *fname, struct cnffparamlst* paramlst)
 {
@@ -3679,9 +5299,25 @@ cnffuncNew(es_str_t *fname, struct cnffparamlst* paramlst)
 			case CNFFUNC_LOOKUP:
 				initFunc_lookup(func);
 				break;
+			case CNFFUNC_RATELIMIT:
+				initFunc_ratelimit(func);
+				break;
 			case CNFFUNC_EXEC_TEMPLATE:
 				initFunc_exec_template(func);
 				break;
+			case CNFFUNC_HASH_MOD:
+				if(func->expr[1]->nodetype == 'N'
+				   && ((struct cnfnumval*)func->expr[1])->val <= 0)
+					parser_errmsg("param 2 of hash_mod() must be greater "
+						      "than zero");
+				break;
+			case CNFFUNC_SAMPLE:
+				if(func->expr[1]->nodetype == 'N'
+				   && (((struct cnfnumval*)func->expr[1])->val < 0
+				       || ((struct cnfnumval*)func->expr[1])->val > 1000))
+					parser_errmsg("param 2 of sample() must be a permille "
+						      "value between 0 and 1000");
+				break;
 			default:break;
 		}
 	}
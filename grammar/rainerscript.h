@@ -19,6 +19,7 @@
 #ifndef INC_UTILS_H
 #define INC_UTILS_H
 #include <stdio.h>
+#include <stdint.h>
 #include <libestr.h>
 #include <typedefs.h>
 #include <sys/types.h>
@@ -99,9 +100,16 @@ struct var {
 		struct cnfarray *ar;
 		long long n;
 		struct json_object *json;
+		struct {
+			const uchar *p;
+			es_size_t len;
+		} view;
 	} d;
-	char datatype; /* 'N' number, 'S' string, 'J' JSON, 'A' array
-			* Note: 'A' is only supported during config phase
+	char datatype; /* 'N' number, 'S' string, 'J' JSON, 'A' array,
+			* 'V' string view (non-owning slice of another string)
+			* Note: 'A' is only supported during config phase,
+			* 'V' only inside registers of compiled programs
+			* (see cnfprogExec()) and never escapes them
 			*/
 };
 
@@ -150,6 +158,12 @@ struct nvlst {
 #define S_SET 4006
 #define S_UNSET 4007
 #define S_CALL 4008
+#define S_MULTIMATCH 4009	/* optimizer result, see cnfstmtOptimizeMultiMatch() */
+#define S_PRIDISPATCH 4010	/* optimizer result, see cnfstmtOptimizePriDispatch() */
+
+/* S_PRIDISPATCH table, one entry per facility/severity pair */
+#define PRIDISPATCH_TBLSIZE ((LOG_NFACILITIES+1) * 8)
+#define PRIDISPATCH_IDX(fac, sev) ((fac) * 8 + (sev))
 
 enum cnfFiltType { CNFFILT_NONE, CNFFILT_PRI, CNFFILT_PROP, CNFFILT_SCRIPT };
 static inline char*
@@ -173,23 +187,33 @@ struct cnfstmt {
 	unsigned nodetype;
 	struct cnfstmt *next;
 	uchar *printable; /* printable text for debugging */
+	uchar *cnffn;	/* config file the statement stems from (shared, do not free) */
+	int lineno;	/* line on which parsing of the statement completed */
+	struct cnfstmtprof *prof; /* execution profile, NULL if not profiled */
+	sbool bInlined;	/* copy made by call inlining, contents owned by callee */
 	union {
 		struct {
 			struct cnfexpr *expr;
 			struct cnfstmt *t_then;
 			struct cnfstmt *t_else;
+			struct cnfprog *prog; /* compiled expr, NULL if not compiled */
 		} s_if;
 		struct {
 			uchar *varname;
+			int localSlot; /* slot for $.xxx, see msgLocalVarSlot(), -1 if none */
 			struct cnfexpr *expr;
+			struct cnfprog *prog; /* compiled expr, NULL if not compiled */
 		} s_set;
 		struct {
 			uchar *varname;
+			int localSlot;
 		} s_unset;
 		struct {
 			es_str_t *name;
 			struct cnfstmt *stmt;
 			ruleset_t *ruleset;	/* non-NULL if the ruleset has a queue assigned */
+			ruleset_t *dynRuleset;	/* non-NULL if the ruleset is reloadable, its
+						 * root must then be read on each call */
 		} s_call;
 		struct {
 			uchar pmask[LOG_NFACILITIES+1];	/* priority mask */
@@ -198,13 +222,23 @@ struct cnfstmt {
 		} s_prifilt;
 		struct {
 			fiop_t operation;
-			regex_t *regex_cache;/* cache for compiled REs, if used */
+			struct rsregex_s *regex_cache;/* cache for compiled REs, if used */
 			struct cstr_s *pCSCompValue;/* value to "compare" against */
 			sbool isNegated;
 			msgPropDescr_t prop; /* requested property */
 			struct cnfstmt *t_then;
 			struct cnfstmt *t_else;
 		} s_propfilt;
+		struct {
+			acmatch_t *ac;	/* matcher for all statements */
+			struct cnfstmt *stmts; /* S_IF or S_PROPFILT, all over the same property */
+			struct cnfvar *var; /* S_IF: the property, else NULL */
+			msgPropDescr_t *prop; /* S_PROPFILT: the property, else NULL */
+		} s_mm;
+		struct {
+			uint64_t *tbl; /* bit i set if i-th filter matches the PRI */
+			struct cnfstmt *stmts; /* the S_PRIFILT chain */
+		} s_pd;
 		struct action_s *act;
 	} d;
 };
@@ -229,12 +263,14 @@ struct cnfvar {
 	unsigned nodetype;
 	char *name;
 	msgPropDescr_t prop;
+	int memoSlot;	/* slot in the worker's property memo, -1 if not memoized */
 };
 
 struct cnfarray {
 	unsigned nodetype;
 	int nmemb;
 	es_str_t **arr;
+	struct cnfarrset *set;	/* hash set of arr for large ==/!= arrays, else NULL */
 };
 
 struct cnffparamlst {
@@ -256,7 +292,11 @@ enum cnffuncid {
 	CNFFUNC_FIELD,
 	CNFFUNC_PRIFILT,
 	CNFFUNC_LOOKUP,
-	CNFFUNC_EXEC_TEMPLATE
+	CNFFUNC_EXEC_TEMPLATE,
+	CNFFUNC_HASH64,
+	CNFFUNC_HASH_MOD,
+	CNFFUNC_SAMPLE,
+	CNFFUNC_RATELIMIT
 };
 
 struct cnffunc {
@@ -268,6 +308,60 @@ struct cnffunc {
 	struct cnfexpr *expr[];
 };
 
+/* Expressions of if and set statements are compiled into a linear
+ * program for a simple register machine after they have been optimized.
+ * Each register holds a (typed) struct var. The program is evaluated in a
+ * tight loop without recursion, and numbers and comparison results as
+ * well as string constants never need to be allocated. Node types the
+ * compiler does not handle (e.g. function calls) are evaluated via
+ * cnfexprEval() into a register. The program refers to the expression
+ * tree and thus must be destructed before it.
+ */
+#define CNFPROG_MAX_REGS 32
+	/**< max number of registers, expressions needing more are not
+	 *   compiled but evaluated via cnfexprEval().
+	 */
+enum cnfopcode {
+	CNFOP_NUM,		/* dst = number constant */
+	CNFOP_STR,		/* dst = string constant (not copied) */
+	CNFOP_VAR,		/* dst = variable */
+	CNFOP_EVAL,		/* dst = cnfexprEval(expr) */
+	CNFOP_ADD,		/* dst = dst + src, likewise for the following */
+	CNFOP_SUB,
+	CNFOP_MUL,
+	CNFOP_DIV,
+	CNFOP_MOD,
+	CNFOP_NEG,		/* dst = -dst */
+	CNFOP_NOT,		/* dst = !dst */
+	CNFOP_BOOL,		/* dst = dst ? 1 : 0 */
+	CNFOP_CONCAT,		/* dst = dst & src */
+	CNFOP_CMP,		/* dst = dst <cmpop> src (or array) */
+	CNFOP_FIELD,		/* dst = field(dst, <const>, <const>), may be a view into dst */
+	CNFOP_JMP_TRUE,		/* if(dst) { dst = 1; goto target; } */
+	CNFOP_JMP_FALSE		/* if(!dst) { dst = 0; goto target; } */
+};
+
+struct cnfinstr {
+	unsigned char opcode;	/* enum cnfopcode */
+	unsigned char dst;	/* register index */
+	unsigned char src;	/* register index */
+	unsigned cmpop;		/* CMP_* token for CNFOP_CMP */
+	union {
+		long long n;
+		es_str_t *estr;
+		struct cnfvar *var;
+		struct cnfexpr *expr;
+		struct cnfarray *ar;	/* CNFOP_CMP: array on right side or NULL */
+		unsigned target;	/* jumps: index of next instruction if taken */
+	} d;
+};
+
+struct cnfprog {
+	unsigned short nInstr;
+	unsigned short nRegs;
+	struct cnfinstr *instr;
+};
+
 /* future extensions
 struct x {
 	int nodetype;
@@ -331,6 +425,10 @@ struct cnfexpr* cnfexprNew(unsigned nodetype, struct cnfexpr *l, struct cnfexpr
 void cnfexprPrint(struct cnfexpr *expr, int indent);
 void cnfexprEval(const struct cnfexpr *const expr, struct var *ret, void *pusr);
 int cnfexprEvalBool(struct cnfexpr *expr, void *usrptr);
+struct cnfprog *cnfprogCompile(struct cnfexpr *expr);
+void cnfprogEval(const struct cnfprog *prog, struct var *ret, void *usrptr);
+int cnfprogEvalBool(const struct cnfprog *prog, void *usrptr);
+void cnfprogDestruct(struct cnfprog *prog);
 void cnfexprDestruct(struct cnfexpr *expr);
 struct cnfnumval* cnfnumvalNew(long long val);
 struct cnfstringval* cnfstringvalNew(es_str_t *estr);
@@ -361,6 +459,8 @@ struct cnfstmt * cnfstmtNewCall(es_str_t *name);
 struct cnfstmt * cnfstmtNewContinue(void);
 void cnfstmtDestructLst(struct cnfstmt *root);
 void cnfstmtOptimize(struct cnfstmt *root);
+void cnfstmtInlineCalls(struct cnfstmt *root);
+uint64_t cnfstmtMultiMatch(struct cnfstmt *stmt, void *usrptr);
 struct cnfarray* cnfarrayNew(es_str_t *val);
 struct cnfarray* cnfarrayDup(struct cnfarray *old);
 struct cnfarray* cnfarrayAdd(struct cnfarray *ar, es_str_t *val);
@@ -36,6 +36,7 @@
 #include <netdb.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <pthread.h>
 #if HAVE_FCNTL_H
 #include <fcntl.h>
 #endif
@@ -52,6 +53,8 @@
 #include "msg.h"
 #include "datetime.h"
 #include "ratelimit.h"
+#include "ruleset.h"
+#include "rsconf.h"
 #include "net.h" /* for permittedPeers, may be removed when this is removed */
 
 MODULE_TYPE_INPUT
@@ -66,6 +69,7 @@ DEFobjCurrIf(netstrm)
 DEFobjCurrIf(errmsg)
 DEFobjCurrIf(datetime)
 DEFobjCurrIf(prop)
+DEFobjCurrIf(ruleset)
 
 /* Module static data */
 static tcpsrv_t *pOurTcpsrv = NULL;  /* our TCP server(listener) TODO: change for multiple instances */
@@ -84,6 +88,12 @@ static int iTCPSessMax = 20; /* max number of sessions */
 static int iStrmDrvrMode = 0; /* mode for stream driver, driver-dependent (0 mostly means plain tcp) */
 static uchar *pszStrmDrvrAuthMode = NULL; /* authentication mode to use */
 static uchar *pszInputName = NULL; /* value for inputname property, NULL is OK and handled by core engine */
+static int iProbeInterval = 0; /* ms between latency probes, 0 - no probes */
+static uchar *pszProbeRuleset = NULL; /* ruleset to submit probes to, NULL - default ruleset */
+
+/* latency probes */
+static ruleset_t *pProbeRuleset = NULL;
+static int bProbeStop = 0;
 
 
 /* callbacks */
@@ -225,6 +235,62 @@ finalize_it:
 }
 
 
+/* Latency probes: if $IMDiagProbeInterval is set, a canary message (flagged
+ * PROBE_MSG) is submitted every interval. Canaries pass through the regular
+ * pipeline, but instead of being handed to an output, the actions (and the
+ * ruleset) record their age in the probe.latency histograms (see
+ * action.latencyStats and the ruleset latencyStats parameter).
+ */
+static rsRetVal
+doInjectProbe(void)
+{
+	static const char szProbe[] = "<46>rsyslog-probe: imdiag latency probe";
+	msg_t *pMsg;
+	DEFiRet;
+
+	CHKiRet(msgConstruct(&pMsg));
+	MsgSetRawMsg(pMsg, (char*) szProbe, sizeof(szProbe) - 1);
+	MsgSetInputName(pMsg, pInputName);
+	MsgSetFlowControlType(pMsg, eFLOWCTL_NO_DELAY);
+	pMsg->msgFlags  = NEEDS_PARSING | PROBE_MSG;
+	MsgSetRcvFrom(pMsg, pRcvDummy);
+	CHKiRet(MsgSetRcvFromIP(pMsg, pRcvIPDummy));
+	MsgSetRuleset(pMsg, pProbeRuleset);
+	CHKiRet(submitMsg2(pMsg));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* submit probes until *pbStop is set. We sleep in slices of at most one
+ * second, so that we terminate in time even with long intervals.
+ */
+static void
+probeLoop(int *pbStop)
+{
+	int iWait;
+	int iSlice;
+
+	while(!*pbStop) {
+		doInjectProbe();
+		for(iWait = iProbeInterval ; iWait > 0 && !*pbStop ; iWait -= iSlice) {
+			iSlice = (iWait > 1000) ? 1000 : iWait;
+			srSleep(iSlice / 1000, (iSlice % 1000) * 1000);
+		}
+	}
+}
+
+
+static void *
+probeThread(void __attribute__((unused)) *arg)
+{
+	dbgSetThrdName((uchar*)"imdiag probes");
+	probeLoop(&bProbeStop);
+	return NULL;
+}
+
+
 /* This function injects messages. Command format:
  * injectmsg <fromnbr> <number-of-messages>
  * rgerhards, 2009-05-27
@@ -425,10 +491,30 @@ ENDfreeCnf
 /* This function is called to gather input.
  */
 BEGINrunInput
+	pthread_t thrdProbe;
+	int bHaveProbeThrd = 0;
 CODESTARTrunInput
+	if(pOurTcpsrv == NULL) {
+		/* probes only, so we can do them on the input thread */
+		probeLoop(&pThrd->bShallStop);
+		FINALIZE;
+	}
 	CHKiRet(tcpsrv.ConstructFinalize(pOurTcpsrv));
+	if(iProbeInterval > 0) {
+		bProbeStop = 0;
+		if(pthread_create(&thrdProbe, NULL, probeThread, NULL) == 0) {
+			bHaveProbeThrd = 1;
+		} else {
+			errmsg.LogError(errno, RS_RET_ERR, "imdiag: could not create "
+				"latency probe thread, no probes are sent");
+		}
+	}
 	iRet = tcpsrv.Run(pOurTcpsrv);
 finalize_it:
+	if(bHaveProbeThrd) {
+		bProbeStop = 1;
+		pthread_join(thrdProbe, NULL);
+	}
 ENDrunInput
 
 
@@ -436,8 +522,16 @@ ENDrunInput
 BEGINwillRun
 CODESTARTwillRun
 	/* first apply some config settings */
-	if(pOurTcpsrv == NULL)
+	if(pOurTcpsrv == NULL && iProbeInterval <= 0)
 		ABORT_FINALIZE(RS_RET_NO_RUN);
+	pProbeRuleset = NULL;
+	if(iProbeInterval > 0 && pszProbeRuleset != NULL) {
+		if(ruleset.GetRuleset(runConf, &pProbeRuleset, pszProbeRuleset) != RS_RET_OK) {
+			errmsg.LogError(0, RS_RET_RULESET_NOT_FOUND, "imdiag: probe ruleset '%s' "
+				"not found - using default ruleset instead", pszProbeRuleset);
+			pProbeRuleset = NULL;
+		}
+	}
 	/* we need to create the inputName property (only once during our lifetime) */
 	CHKiRet(prop.Construct(&pInputName));
 	CHKiRet(prop.SetString(pInputName, UCHAR_CONSTANT("imdiag"), sizeof("imdiag") - 1));
@@ -477,6 +571,7 @@ CODESTARTmodExit
 
 	/* free some globals to keep valgrind happy */
 	free(pszInputName);
+	free(pszProbeRuleset);
 
 	/* release objects we used */
 	objRelease(net, LM_NET_FILENAME);
@@ -486,6 +581,7 @@ CODESTARTmodExit
 	objRelease(errmsg, CORE_COMPONENT);
 	objRelease(datetime, CORE_COMPONENT);
 	objRelease(prop, CORE_COMPONENT);
+	objRelease(ruleset, CORE_COMPONENT);
 ENDmodExit
 
 
@@ -496,6 +592,9 @@ resetConfigVariables(uchar __attribute__((unused)) *pp, void __attribute__((unus
 	iStrmDrvrMode = 0;
 	free(pszInputName);
 	pszInputName = NULL;
+	iProbeInterval = 0;
+	free(pszProbeRuleset);
+	pszProbeRuleset = NULL;
 	if(pszStrmDrvrAuthMode != NULL) {
 		free(pszStrmDrvrAuthMode);
 		pszStrmDrvrAuthMode = NULL;
@@ -531,6 +630,7 @@ CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
 	CHKiRet(objUse(datetime, CORE_COMPONENT));
 	CHKiRet(objUse(prop, CORE_COMPONENT));
+	CHKiRet(objUse(ruleset, CORE_COMPONENT));
 
 	/* register config file handlers */
 	CHKiRet(omsdRegCFSLineHdlr(UCHAR_CONSTANT("imdiagserverrun"), 0, eCmdHdlrGetWord,
@@ -545,6 +645,10 @@ CODEmodInit_QueryRegCFSLineHdlr
 				   eCmdHdlrGetWord, setPermittedPeer, NULL, STD_LOADABLE_MODULE_ID));
 	CHKiRet(omsdRegCFSLineHdlr(UCHAR_CONSTANT("imdiagserverinputname"), 0,
 				   eCmdHdlrGetWord, NULL, &pszInputName, STD_LOADABLE_MODULE_ID));
+	CHKiRet(omsdRegCFSLineHdlr(UCHAR_CONSTANT("imdiagprobeinterval"), 0,
+				   eCmdHdlrInt, NULL, &iProbeInterval, STD_LOADABLE_MODULE_ID));
+	CHKiRet(omsdRegCFSLineHdlr(UCHAR_CONSTANT("imdiagproberuleset"), 0,
+				   eCmdHdlrGetWord, NULL, &pszProbeRuleset, STD_LOADABLE_MODULE_ID));
 	CHKiRet(omsdRegCFSLineHdlr(UCHAR_CONSTANT("resetconfigvariables"), 1, eCmdHdlrCustomHandler,
 		resetConfigVariables, NULL, STD_LOADABLE_MODULE_ID));
 ENDmodInit
@@ -34,6 +34,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <fnmatch.h>
+#include <glob.h>
+#include <poll.h>
+#include <time.h>
 #ifdef HAVE_SYS_INOTIFY_H
 #include <sys/inotify.h>
 #endif
@@ -55,6 +58,9 @@
 #include "stringbuf.h"
 #include "ruleset.h"
 #include "ratelimit.h"
+#include "hashtable.h"
+#include "hashtable_itr.h"
+#include "regexp.h"
 
 MODULE_TYPE_INPUT	/* must be present for input modules, do not remove */
 MODULE_TYPE_NOKEEP
@@ -70,11 +76,13 @@ DEFobjCurrIf(datetime)
 DEFobjCurrIf(strm)
 DEFobjCurrIf(prop)
 DEFobjCurrIf(ruleset)
+DEFobjCurrIf(regexp)
 
 static int bLegacyCnfModGlobalsPermitted;/* are legacy module-global config parameters permitted? */
 
 #define NUM_MULTISUB 1024 /* default max number of submits */
 #define DFLT_PollInterval 10
+#define DFLT_StateDbInterval 5
 
 #define INIT_FILE_TAB_SIZE 4 /* default file table size - is extended as needed, use 2^x value */
 #define INIT_FILE_IN_DIR_TAB_SIZE 1 /* initial size for "associated files tab" in directory table */
@@ -100,9 +108,31 @@ typedef struct fileInfo_s {
 	sbool escapeLF;	/* escape LF inside the MSG content? */
 	ruleset_t *pRuleset;	/* ruleset to bind listener to (use system default if unspecified) */
 	ratelimit_t *ratelimiter;
-	multi_submit_t multiSub;
+	struct imBatch_s *pBatch; /* lines read, but not yet submitted */
+	int8_t wrkState;	/* FILE_WRKR_* state, only used with reader workers */
+	struct fileInfo_s *pWrkNext;	/* next file in the worker queue */
+	sbool bDynamic;	/* created for a wildcard match (owns pszBaseName, deleted when file is gone) */
+	sbool bDelete;	/* entry shall be deleted as soon as no worker uses it */
+	int closeTimeout;	/* close stream after this many seconds w/o data (0 - never) */
+	time_t tLastActive;	/* last time we read data from this file */
+	rsregex_t *startRegex;	/* start of message regex (owned by instance), NULL if not used */
+	uchar *pszStartPrefix;	/* literal prefix every start line has (owned by instance) */
+	size_t lenStartPrefix;
+	sbool bStartIsPrefix;	/* regex is just the literal prefix, no need to run it */
+	int readTimeout;	/* submit a pending message after this many seconds w/o new line */
+	cstr_t *pPending;	/* message being assembled in startmsg.regex mode */
+	time_t tPending;	/* when the last line was added to pPending */
 } fileInfo_t;
 
+/* states of a file with respect to the reader worker pool. A file is
+ * either queued or processed by at most one worker, so its lines are still
+ * read in order and its state file is written by one thread at a time.
+ */
+#define FILE_WRKR_IDLE 0	/* nothing to do */
+#define FILE_WRKR_QUEUED 1	/* in the work queue */
+#define FILE_WRKR_BUSY 2	/* being read by a worker */
+#define FILE_WRKR_RERUN 3	/* being read, and must be queued again when done */
+
 static struct configSettings_s {
 	uchar *pszFileName;
 	uchar *pszFileTag;
@@ -131,6 +161,15 @@ struct instanceConf_s {
 	uint8_t readMode;
 	sbool escapeLF;
 	int maxLinesAtOnce;
+	int closeTimeout;
+	uchar *pszStartRegex;
+	rsregex_t *startRegex;
+	uchar *pszStartPrefix;
+	size_t lenStartPrefix;
+	sbool bStartIsPrefix;
+	int readTimeout;
+	sbool bWildcard;	/* file name contains wildcards (inotify mode only) */
+	int fileIdx;		/* file table entry for non-wildcard instances, -1 if none */
 	ruleset_t *pBindRuleset;	/* ruleset to bind listener to (use system default if unspecified) */
 	struct instanceConf_s *next;
 };
@@ -150,15 +189,29 @@ struct modConfData_s {
 	int iPollInterval;	/* number of seconds to sleep when there was no file activity */
 	instanceConf_t *root, *tail;
 	uint8_t opMode;
+	int nWrkrs;		/* number of reader workers, 0 - read on the input thread */
+	uchar *pszStateDb;	/* name of consolidated state database, NULL - use per-file state files */
+	int iStateDbInterval;	/* seconds between state database writes */
 	sbool configSetViaV2Method;
 };
 static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
 static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current load process */
 
-static int iFilPtr = 0;		/* number of files to be monitored; pointer to next free spot during config */
-static fileInfo_t *files = NULL;
+static int iFilPtr = 0;		/* high water mark of the file table */
+static fileInfo_t **files = NULL;	/* file table; entries are NULL if unused (after deleting a dynamic file) */
 static int allocMaxFiles;	/* max file table size currently allocated */
 
+/* the reader worker pool */
+static struct {
+	int nWrkrs;		/* number of workers running (0 - pool not used) */
+	pthread_t *tids;
+	pthread_mutex_t mut;
+	pthread_cond_t cond;
+	fileInfo_t *qHead;	/* work queue, linked via pWrkNext; each file is queued at most once */
+	fileInfo_t *qTail;
+	sbool bStop;
+} wrkrPool;
+
 #if HAVE_INOTIFY_INIT
 /* support for inotify mode */
 
@@ -209,7 +262,10 @@ static prop_t *pInputName = NULL;	/* there is only one global inputName for all
 /* module-global parameters */
 static struct cnfparamdescr modpdescr[] = {
 	{ "pollinginterval", eCmdHdlrPositiveInt, 0 },
-	{ "mode", eCmdHdlrGetWord, 0 }
+	{ "mode", eCmdHdlrGetWord, 0 },
+	{ "workerthreads", eCmdHdlrNonNegInt, 0 },
+	{ "statedb", eCmdHdlrString, 0 },
+	{ "statedb.interval", eCmdHdlrPositiveInt, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -229,7 +285,10 @@ static struct cnfparamdescr inppdescr[] = {
 	{ "escapelf", eCmdHdlrBinary, 0 },
 	{ "maxlinesatonce", eCmdHdlrInt, 0 },
 	{ "maxsubmitatonce", eCmdHdlrInt, 0 },
-	{ "persiststateinterval", eCmdHdlrInt, 0 }
+	{ "persiststateinterval", eCmdHdlrInt, 0 },
+	{ "closetimeout", eCmdHdlrNonNegInt, 0 },
+	{ "startmsg.regex", eCmdHdlrString, 0 },
+	{ "readtimeout", eCmdHdlrNonNegInt, 0 }
 };
 static struct cnfparamblk inppblk =
 	{ CNFPARAMBLK_VERSION,
@@ -317,7 +376,7 @@ wdmapAdd(int wd, int dirIdx, int fileIdx)
 	if(i < nWdmap) {
 		/* we need to shift to make room for new entry */
 		dbgprintf("DDDD: imfile doing wdmap mmemmov(%d, %d, %d) for ADD\n", i,i+1,nWdmap-i);
-		memmove(wdmap + i, wdmap + i + 1, nWdmap - i);
+		memmove(wdmap + i + 1, wdmap + i, sizeof(wd_map_t) * (nWdmap - i));
 	}
 	wdmap[i].wd = wd;
 	wdmap[i].dirIdx = dirIdx;
@@ -332,19 +391,20 @@ finalize_it:
 static rsRetVal
 wdmapDel(int wd)
 {
+	wd_map_t *etry;
 	int i;
 	DEFiRet;
 
-	for(i = 0 ; i < nWdmap && wdmap[i].wd < wd ; ++i)
-		; 	/* just scan */
-	if(i == nWdmap ||  wdmap[i].wd != wd) {
+	etry = wdmapLookup(wd);
+	if(etry == NULL) {
 		DBGPRINTF("imfile: wd %d shall be deleted but not in wdmap!\n", wd);
 		FINALIZE;
 	}
+	i = etry - wdmap;
 	if(i < nWdmap-1) {
 		/* we need to shift to delete it (see comment at wdmap definition) */
 		dbgprintf("DDDD: imfile doing wdmap mmemmov(%d, %d, %d) for DEL\n", i,i+1,nWdmap-i-1);
-		memmove(wdmap + i, wdmap + i+1, nWdmap - i-1);
+		memmove(wdmap + i, wdmap + i+1, sizeof(wd_map_t) * (nWdmap - i-1));
 	}
 	--nWdmap;
 	dbgprintf("DDDD: imfile: wd %d deleted, was idx %d\n", wd, i);
@@ -379,7 +439,350 @@ static rsRetVal enqLine(fileInfo_t *pInfo, cstr_t *cstrLine)
 	pMsg->iFacility = LOG_FAC(pInfo->iFacility);
 	pMsg->iSeverity = LOG_PRI(pInfo->iSeverity);
 	MsgSetRuleset(pMsg, pInfo->pRuleset);
-	ratelimitAddMsg(pInfo->ratelimiter, &pInfo->multiSub, pMsg);
+	imBatchAdd(pInfo->pBatch, pInfo->ratelimiter, pMsg);
+finalize_it:
+	RETiRet;
+}
+
+
+/* ------------------------------ state database ------------------------------ */
+
+/* With module parameter "statedb", the read positions of all files are kept
+ * in a single file inside the work directory instead of one state file per
+ * monitored file. Updates go to an in-memory table only; every
+ * statedb.interval seconds the changed entries are appended to the database
+ * with a single write and fsync. Each record is a line "<inode> <offset> <key>",
+ * where key is the state file name the file would otherwise use. Later
+ * records override earlier ones, an offset of -1 deletes the key. When the
+ * file holds more than twice as many records as there are live keys, it is
+ * rewritten with just the live ones.
+ */
+typedef struct stateDbEtry_s {
+	int64 inode;
+	int64 offs;	/* -1 - deleted */
+	sbool bDirty;	/* not yet written to the database file */
+} stateDbEtry_t;
+
+static struct {
+	struct hashtable *ht;	/* state file name -> stateDbEtry_t, NULL if db not used */
+	pthread_mutex_t mut;
+	int fd;		/* database file, open for append */
+	int nRecords;	/* records currently in the database file */
+	int nDirty;	/* entries not yet written */
+	char *pszFile;	/* full path of the database file */
+	time_t tLastWrite;
+} stateDb;
+
+/* append a record to a growing buffer */
+static rsRetVal
+stateDbFmtRecord(char **ppBuf, size_t *pLenBuf, size_t *pAlloc, char *key, stateDbEtry_t *etry)
+{
+	int len;
+	char *newBuf;
+	DEFiRet;
+
+	while(1) {
+		len = snprintf(*ppBuf + *pLenBuf, *pAlloc - *pLenBuf, "%lld %lld %s\n",
+			       (long long) etry->inode, (long long) etry->offs, key);
+		if(len < 0)
+			ABORT_FINALIZE(RS_RET_ERR);
+		if(*pLenBuf + len < *pAlloc)
+			break;
+		CHKmalloc(newBuf = realloc(*ppBuf, 2 * *pAlloc + len));
+		*ppBuf = newBuf;
+		*pAlloc = 2 * *pAlloc + len;
+	}
+	*pLenBuf += len;
+finalize_it:
+	RETiRet;
+}
+
+/* write all changed entries. If bCompact is set, the database is rewritten
+ * instead, containing only the live entries. Must be called with the mutex
+ * locked.
+ */
+static rsRetVal
+stateDbWrite(int bCompact)
+{
+	struct hashtable_itr *itr = NULL;
+	stateDbEtry_t *etry;
+	char *buf = NULL;
+	size_t lenBuf = 0;
+	size_t allocBuf = 4096;
+	char tmpName[MAXFNAME];
+	int fdTmp = -1;
+	int nRecords = 0;
+	int bMore;
+	ssize_t wr;
+	size_t done;
+	DEFiRet;
+
+	CHKmalloc(buf = malloc(allocBuf));
+	if(hashtable_count(stateDb.ht) > 0) {
+		CHKmalloc(itr = hashtable_iterator(stateDb.ht));
+		do {
+			etry = (stateDbEtry_t*) hashtable_iterator_value(itr);
+			if((bCompact && etry->offs != -1) || (!bCompact && etry->bDirty)) {
+				CHKiRet(stateDbFmtRecord(&buf, &lenBuf, &allocBuf,
+					(char*) hashtable_iterator_key(itr), etry));
+				++nRecords;
+			}
+			bMore = hashtable_iterator_advance(itr);
+		} while(bMore);
+	}
+
+	if(bCompact) {
+		snprintf(tmpName, sizeof(tmpName), "%s.tmp", stateDb.pszFile);
+		fdTmp = open(tmpName, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+		if(fdTmp == -1) {
+			errmsg.LogError(errno, RS_RET_IO_ERROR, "imfile: cannot create state "
+					"database file '%s'", tmpName);
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+	}
+
+	for(done = 0 ; done < lenBuf ; done += wr) {
+		wr = write(bCompact ? fdTmp : stateDb.fd, buf + done, lenBuf - done);
+		if(wr < 0) {
+			if(errno == EINTR) {
+				wr = 0;
+				continue;
+			}
+			errmsg.LogError(errno, RS_RET_IO_ERROR, "imfile: error writing state "
+					"database '%s'", stateDb.pszFile);
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+	}
+
+	if(bCompact) {
+		if(fsync(fdTmp) != 0 || rename(tmpName, stateDb.pszFile) != 0) {
+			errmsg.LogError(errno, RS_RET_IO_ERROR, "imfile: cannot replace state "
+					"database '%s'", stateDb.pszFile);
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+		if(stateDb.fd != -1)
+			close(stateDb.fd);
+		stateDb.fd = fdTmp;
+		fdTmp = -1;
+		stateDb.nRecords = nRecords;
+	} else {
+		fdatasync(stateDb.fd);
+		stateDb.nRecords += nRecords;
+	}
+
+	/* everything is on disk now, so deleted entries are no longer needed */
+	free(itr);
+	itr = NULL;
+	if(hashtable_count(stateDb.ht) > 0) {
+		CHKmalloc(itr = hashtable_iterator(stateDb.ht));
+		do {
+			etry = (stateDbEtry_t*) hashtable_iterator_value(itr);
+			etry->bDirty = 0;
+			if(etry->offs == -1) {
+				free(etry);
+				bMore = hashtable_iterator_remove(itr);
+			} else {
+				bMore = hashtable_iterator_advance(itr);
+			}
+		} while(bMore);
+	}
+	stateDb.nDirty = 0;
+
+finalize_it:
+	if(fdTmp != -1) {
+		close(fdTmp);
+		unlink(tmpName);
+	}
+	free(itr);
+	free(buf);
+	RETiRet;
+}
+
+/* write changed entries if the write interval has expired (or bForce is set).
+ * Called periodically from the input thread.
+ */
+static void
+stateDbFlush(int bForce)
+{
+	time_t tNow;
+
+	if(stateDb.ht == NULL)
+		return;
+	pthread_mutex_lock(&stateDb.mut);
+	time(&tNow);
+	if(stateDb.nDirty > 0 && (bForce || tNow - stateDb.tLastWrite >= runModConf->iStateDbInterval)) {
+		stateDbWrite(stateDb.nRecords + stateDb.nDirty > 2 * (int) hashtable_count(stateDb.ht) + 64);
+		stateDb.tLastWrite = tNow;
+	}
+	pthread_mutex_unlock(&stateDb.mut);
+}
+
+/* record a new position for key. offs -1 deletes the entry. Must be called
+ * with the mutex locked.
+ */
+static rsRetVal
+stateDbSet(uchar *key, int64 inode, int64 offs)
+{
+	stateDbEtry_t *etry;
+	char *keyCopy = NULL;
+	DEFiRet;
+
+	etry = (stateDbEtry_t*) hashtable_search(stateDb.ht, key);
+	if(etry == NULL) {
+		if(offs == -1)
+			FINALIZE; /* nothing to delete */
+		CHKmalloc(keyCopy = strdup((char*) key));
+		CHKmalloc(etry = calloc(1, sizeof(stateDbEtry_t)));
+		if(!hashtable_insert(stateDb.ht, keyCopy, etry)) {
+			free(etry);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		keyCopy = NULL; /* now owned by hashtable */
+	}
+	etry->inode = inode;
+	etry->offs = offs;
+	if(!etry->bDirty) {
+		etry->bDirty = 1;
+		++stateDb.nDirty;
+	}
+finalize_it:
+	free(keyCopy);
+	RETiRet;
+}
+
+static rsRetVal
+stateDbUpdate(uchar *key, int64 inode, int64 offs)
+{
+	DEFiRet;
+	pthread_mutex_lock(&stateDb.mut);
+	iRet = stateDbSet(key, inode, offs);
+	pthread_mutex_unlock(&stateDb.mut);
+	RETiRet;
+}
+
+/* obtain the stored position for key */
+static rsRetVal
+stateDbLookup(uchar *key, int64 *pInode, int64 *pOffs)
+{
+	stateDbEtry_t *etry;
+	DEFiRet;
+
+	pthread_mutex_lock(&stateDb.mut);
+	etry = (stateDbEtry_t*) hashtable_search(stateDb.ht, key);
+	if(etry == NULL || etry->offs == -1) {
+		iRet = RS_RET_NOT_FOUND;
+	} else {
+		*pInode = etry->inode;
+		*pOffs = etry->offs;
+	}
+	pthread_mutex_unlock(&stateDb.mut);
+	RETiRet;
+}
+
+/* load the state database, if one is configured. On error, we log it and
+ * fall back to per-file state files.
+ */
+static rsRetVal
+stateDbOpen(void)
+{
+	FILE *fp = NULL;
+	char *line = NULL;
+	size_t lenLine = 0;
+	ssize_t lenRead;
+	long long inode, offs;
+	int nKey;
+	uchar *workDir;
+	DEFiRet;
+
+	stateDb.ht = NULL;
+	stateDb.fd = -1;
+	stateDb.pszFile = NULL;
+	if(runModConf->pszStateDb == NULL)
+		FINALIZE;
+
+	workDir = glbl.GetWorkDir();
+	if(workDir == NULL) {
+		errmsg.LogError(0, RS_RET_ERR, "imfile: state database requires a "
+				"work directory, using per-file state files");
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	CHKmalloc(stateDb.pszFile = malloc(ustrlen(workDir) + ustrlen(runModConf->pszStateDb) + 2));
+	sprintf(stateDb.pszFile, "%s/%s", (char*) workDir, (char*) runModConf->pszStateDb);
+	CHKmalloc(stateDb.ht = create_hashtable(100, hash_from_string, key_equals_string, NULL));
+	pthread_mutex_init(&stateDb.mut, NULL);
+	stateDb.nRecords = 0;
+	stateDb.nDirty = 0;
+
+	if((fp = fopen(stateDb.pszFile, "r")) != NULL) {
+		while((lenRead = getline(&line, &lenLine, fp)) > 0) {
+			if(line[lenRead-1] == '\n')
+				line[lenRead-1] = '\0';
+			nKey = -1;
+			if(sscanf(line, "%lld %lld %n", &inode, &offs, &nKey) != 2 || nKey == -1
+			   || line[nKey] == '\0') {
+				DBGPRINTF("imfile: ignoring invalid state database record '%s'\n", line);
+				continue;
+			}
+			CHKiRet(stateDbSet((uchar*) line + nKey, inode, offs));
+			++stateDb.nRecords;
+		}
+		DBGPRINTF("imfile: state database '%s' loaded, %d records, %d entries\n",
+			  stateDb.pszFile, stateDb.nRecords, (int) hashtable_count(stateDb.ht));
+	}
+
+	/* we start with a compacted database, this also opens it for append */
+	CHKiRet(stateDbWrite(1));
+	time(&stateDb.tLastWrite);
+
+finalize_it:
+	if(fp != NULL)
+		fclose(fp);
+	free(line);
+	if(iRet != RS_RET_OK && stateDb.ht != NULL) {
+		errmsg.LogError(0, iRet, "imfile: cannot use state database '%s', "
+				"using per-file state files", stateDb.pszFile);
+		hashtable_destroy(stateDb.ht, 1);
+		stateDb.ht = NULL;
+		pthread_mutex_destroy(&stateDb.mut);
+	}
+	if(stateDb.ht == NULL) {
+		free(stateDb.pszFile);
+		stateDb.pszFile = NULL;
+	}
+	RETiRet;
+}
+
+static void
+stateDbClose(void)
+{
+	if(stateDb.ht == NULL)
+		return;
+	stateDbFlush(1);
+	if(stateDb.fd != -1)
+		close(stateDb.fd);
+	hashtable_destroy(stateDb.ht, 1);
+	stateDb.ht = NULL;
+	pthread_mutex_destroy(&stateDb.mut);
+	free(stateDb.pszFile);
+	stateDb.pszFile = NULL;
+}
+
+
+/* resume reading a file at a position obtained from the state database */
+static rsRetVal
+openFileFromDb(fileInfo_t *pThis, int64 inode, int64 offs)
+{
+	DEFiRet;
+
+	CHKiRet(strm.Construct(&pThis->pStrm));
+	CHKiRet(strm.SettOperationsMode(pThis->pStrm, STREAMMODE_READ));
+	CHKiRet(strm.SetsType(pThis->pStrm, STREAMTYPE_FILE_MONITOR));
+	CHKiRet(strm.SetFName(pThis->pStrm, pThis->pszFileName, strlen((char*) pThis->pszFileName)));
+	strmSetResumeOffs(pThis->pStrm, inode, offs);
+	CHKiRet(strm.ConstructFinalize(pThis->pStrm));
+	strm.CheckFileChange(pThis->pStrm);
+	CHKiRet(strm.SeekCurrOffs(pThis->pStrm));
+
 finalize_it:
 	RETiRet;
 }
@@ -396,6 +799,15 @@ openFile(fileInfo_t *pThis)
 	uchar pszSFNam[MAXFNAME];
 	size_t lenSFNam;
 	struct stat stat_buf;
+	int64 inode, offs;
+
+	/* with a state database, a per-file state file is only used if the
+	 * database does not know the file yet (migration from older versions).
+	 */
+	if(stateDb.ht != NULL && stateDbLookup(pThis->pszStateFile, &inode, &offs) == RS_RET_OK) {
+		CHKiRet(openFileFromDb(pThis, inode, offs));
+		FINALIZE;
+	}
 
 	/* Construct file name */
 	lenSFNam = snprintf((char*)pszSFNam, sizeof(pszSFNam) / sizeof(uchar), "%s/%s",
@@ -448,6 +860,79 @@ finalize_it:
 }
 
 
+/* startmsg.regex mode: does this line start a new message? */
+static inline int
+isStartLine(fileInfo_t *pThis, cstr_t *pCStr)
+{
+	uchar *psz = rsCStrGetSzStrNoNULL(pCStr);
+
+	if(pThis->lenStartPrefix > 0) {
+		if((size_t) rsCStrLen(pCStr) < pThis->lenStartPrefix
+		   || memcmp(psz, pThis->pszStartPrefix, pThis->lenStartPrefix))
+			return 0;
+		if(pThis->bStartIsPrefix)
+			return 1;
+	}
+	return regexp.rsregExec(pThis->startRegex, (char*) psz, 0, NULL) == 0;
+}
+
+/* submit the message assembled in startmsg.regex mode, if any */
+static rsRetVal
+flushPending(fileInfo_t *pThis)
+{
+	DEFiRet;
+
+	if(pThis->pPending == NULL)
+		FINALIZE;
+	CHKiRet(cstrFinalize(pThis->pPending));
+	iRet = enqLine(pThis, pThis->pPending);
+	rsCStrDestruct(&pThis->pPending);
+finalize_it:
+	RETiRet;
+}
+
+/* startmsg.regex mode: add a line to the message being assembled. A line
+ * matching the start regex submits the previous message and begins a new
+ * one. We take over ownership of the line.
+ */
+static rsRetVal
+addLineStartRegex(fileInfo_t *pThis, cstr_t **ppCStr)
+{
+	DEFiRet;
+
+	if(pThis->pPending != NULL && !isStartLine(pThis, *ppCStr)) {
+		if(pThis->escapeLF) {
+			CHKiRet(rsCStrAppendStrWithLen(pThis->pPending, (uchar*)"#012", sizeof("#012")-1));
+		} else {
+			CHKiRet(cstrAppendChar(pThis->pPending, '\n'));
+		}
+		CHKiRet(cstrAppendCStr(pThis->pPending, *ppCStr));
+		rsCStrDestruct(ppCStr);
+	} else {
+		CHKiRet(flushPending(pThis));
+		pThis->pPending = *ppCStr;
+		*ppCStr = NULL;
+	}
+	pThis->tPending = time(NULL);
+finalize_it:
+	RETiRet;
+}
+
+/* startmsg.regex mode: submit the pending message if no line was added for
+ * readTimeout seconds. The last message of a file has no following start
+ * line, so without this it would only be submitted on close.
+ */
+static void
+checkReadTimeout(fileInfo_t *pThis)
+{
+	if(pThis->pPending != NULL && pThis->readTimeout > 0
+	   && time(NULL) - pThis->tPending >= pThis->readTimeout) {
+		flushPending(pThis);
+		imBatchFlush(pThis->pBatch);
+	}
+}
+
+
 /* The following is a cancel cleanup handler for strmReadLine(). It is necessary in case
  * strmReadLine() is cancelled while processing the stream. -- rgerhards, 2008-03-27
  */
@@ -482,11 +967,16 @@ static rsRetVal pollFile(fileInfo_t *pThis, int *pbHadFileData)
 		if(pThis->maxLinesAtOnce != 0 && nProcessed >= pThis->maxLinesAtOnce)
 			break;
 		CHKiRet(strm.ReadLine(pThis->pStrm, &pCStr, pThis->readMode, pThis->escapeLF));
-		++nProcessed;
+		if(nProcessed++ == 0)
+			pThis->tLastActive = time(NULL);
 		if(pbHadFileData != NULL)
 			*pbHadFileData = 1; /* this is just a flag, so set it and forget it */
-		CHKiRet(enqLine(pThis, pCStr)); /* process line */
-		rsCStrDestruct(&pCStr); /* discard string (must be done by us!) */
+		if(pThis->startRegex != NULL) {
+			CHKiRet(addLineStartRegex(pThis, &pCStr));
+		} else {
+			CHKiRet(enqLine(pThis, pCStr)); /* process line */
+			rsCStrDestruct(&pCStr); /* discard string (must be done by us!) */
+		}
 		if(pThis->iPersistStateInterval > 0 && pThis->nRecords++ >= pThis->iPersistStateInterval) {
 			persistStrmState(pThis);
 			pThis->nRecords = 0;
@@ -494,7 +984,8 @@ static rsRetVal pollFile(fileInfo_t *pThis, int *pbHadFileData)
 	}
 
 finalize_it:
-	multiSubmitFlush(&pThis->multiSub);
+	checkReadTimeout(pThis);
+	imBatchFlush(pThis->pBatch);
 	pthread_cleanup_pop(0);
 
 	if(pCStr != NULL) {
@@ -506,6 +997,162 @@ finalize_it:
 #pragma GCC diagnostic warning "-Wempty-body"
 
 
+/* ------------------------------ reader worker pool ------------------------------ */
+
+/* must be called with the pool mutex locked */
+static inline void
+wrkrEnqueue(fileInfo_t *pThis)
+{
+	pThis->pWrkNext = NULL;
+	if(wrkrPool.qTail == NULL)
+		wrkrPool.qHead = pThis;
+	else
+		wrkrPool.qTail->pWrkNext = pThis;
+	wrkrPool.qTail = pThis;
+	pThis->wrkState = FILE_WRKR_QUEUED;
+	pthread_cond_signal(&wrkrPool.cond);
+}
+
+
+/* request that a file is read. If a worker currently reads it, it will
+ * read it once again when done, so that no data is missed.
+ */
+static void
+wrkrSchedFile(fileInfo_t *pThis)
+{
+	pthread_mutex_lock(&wrkrPool.mut);
+	if(pThis->wrkState == FILE_WRKR_IDLE && !pThis->bDelete)
+		wrkrEnqueue(pThis);
+	else if(pThis->wrkState == FILE_WRKR_BUSY)
+		pThis->wrkState = FILE_WRKR_RERUN;
+	pthread_mutex_unlock(&wrkrPool.mut);
+}
+
+
+/* check if the file is currently not used by any worker. If so, no worker
+ * will touch it before the input thread schedules it again, so the input
+ * thread can then safely close or delete it.
+ */
+static int
+wrkrFileIsIdle(fileInfo_t *pThis)
+{
+	int bIdle;
+
+	if(wrkrPool.nWrkrs == 0)
+		return 1;
+	pthread_mutex_lock(&wrkrPool.mut);
+	bIdle = (pThis->wrkState == FILE_WRKR_IDLE);
+	pthread_mutex_unlock(&wrkrPool.mut);
+	return bIdle;
+}
+
+
+/* a reader worker. A file is read for at most maxLinesAtOnce lines and then,
+ * if it had data, it is put at the end of the queue again. That way the
+ * fairness between files holds across all workers.
+ */
+static void *
+wrkrThrd(void __attribute__((unused)) *arg)
+{
+	fileInfo_t *pThis;
+	int bHadFileData;
+
+	pthread_mutex_lock(&wrkrPool.mut);
+	while(1) {
+		while(wrkrPool.qHead == NULL && !wrkrPool.bStop)
+			pthread_cond_wait(&wrkrPool.cond, &wrkrPool.mut);
+		if(wrkrPool.bStop)
+			break;
+		pThis = wrkrPool.qHead;
+		wrkrPool.qHead = pThis->pWrkNext;
+		if(wrkrPool.qHead == NULL)
+			wrkrPool.qTail = NULL;
+		pThis->wrkState = FILE_WRKR_BUSY;
+		pthread_mutex_unlock(&wrkrPool.mut);
+
+		bHadFileData = 0;
+		pollFile(pThis, &bHadFileData);
+
+		pthread_mutex_lock(&wrkrPool.mut);
+		if((bHadFileData || pThis->wrkState == FILE_WRKR_RERUN)
+		   && !pThis->bDelete && glbl.GetGlobalInputTermState() == 0) {
+			wrkrEnqueue(pThis);
+		} else {
+			pThis->wrkState = FILE_WRKR_IDLE;
+		}
+	}
+	pthread_mutex_unlock(&wrkrPool.mut);
+	return NULL;
+}
+
+
+static rsRetVal
+wrkrPoolStart(int nWrkrs)
+{
+	int i;
+	DEFiRet;
+
+	wrkrPool.qHead = NULL;
+	wrkrPool.qTail = NULL;
+	wrkrPool.bStop = 0;
+	wrkrPool.nWrkrs = 0;
+	CHKmalloc(wrkrPool.tids = malloc(sizeof(pthread_t) * nWrkrs));
+	pthread_mutex_init(&wrkrPool.mut, NULL);
+	pthread_cond_init(&wrkrPool.cond, NULL);
+	for(i = 0 ; i < nWrkrs ; ++i) {
+		if(pthread_create(&wrkrPool.tids[i], NULL, wrkrThrd, NULL) != 0) {
+			errmsg.LogError(errno, RS_RET_SYS_ERR, "imfile: could only start %d of "
+				"%d reader workers", i, nWrkrs);
+			break;
+		}
+		++wrkrPool.nWrkrs;
+	}
+	DBGPRINTF("imfile: started %d reader workers\n", wrkrPool.nWrkrs);
+	if(wrkrPool.nWrkrs == 0) {
+		/* no worker at all, read on the input thread */
+		pthread_mutex_destroy(&wrkrPool.mut);
+		pthread_cond_destroy(&wrkrPool.cond);
+		free(wrkrPool.tids);
+		wrkrPool.tids = NULL;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+static void
+wrkrPoolStop(void)
+{
+	int i;
+
+	if(wrkrPool.nWrkrs == 0)
+		return;
+	pthread_mutex_lock(&wrkrPool.mut);
+	wrkrPool.bStop = 1;
+	pthread_cond_broadcast(&wrkrPool.cond);
+	pthread_mutex_unlock(&wrkrPool.mut);
+	for(i = 0 ; i < wrkrPool.nWrkrs ; ++i)
+		pthread_join(wrkrPool.tids[i], NULL);
+	wrkrPool.nWrkrs = 0;
+	pthread_mutex_destroy(&wrkrPool.mut);
+	pthread_cond_destroy(&wrkrPool.cond);
+	free(wrkrPool.tids);
+	wrkrPool.tids = NULL;
+}
+
+
+/* read new data from a file, either directly or via the worker pool */
+static inline void
+schedPollFile(fileInfo_t *pThis)
+{
+	if(wrkrPool.nWrkrs > 0)
+		wrkrSchedFile(pThis);
+	else
+		pollFile(pThis, NULL);
+}
+
+
 /* create input instance, set default paramters, and
  * add it to the list of instances.
  */
@@ -529,6 +1176,15 @@ createInstance(instanceConf_t **pinst)
 	inst->iPersistStateInterval = 0;
 	inst->readMode = 0;
 	inst->escapeLF = 1;
+	inst->closeTimeout = 0;
+	inst->pszStartRegex = NULL;
+	inst->startRegex = NULL;
+	inst->pszStartPrefix = NULL;
+	inst->lenStartPrefix = 0;
+	inst->bStartIsPrefix = 0;
+	inst->readTimeout = 0;
+	inst->bWildcard = 0;
+	inst->fileIdx = -1;
 
 	/* node created, let's add to config */
 	if(loadModConf->tail == NULL) {
@@ -544,6 +1200,56 @@ finalize_it:
 }
 
 
+/* compile the startmsg.regex of an instance. We also obtain the literal
+ * prefix each start line must begin with, so that most lines can be rejected
+ * by a memcmp() without running the regex. This is only done for regexes
+ * anchored with "^" and without alternation; a character followed by a
+ * quantifier is not part of the prefix.
+ */
+static rsRetVal
+setupStartRegex(instanceConf_t *inst)
+{
+	char *re = (char*) inst->pszStartRegex;
+	size_t i;
+	size_t len;
+	rsRetVal localRet;
+	DEFiRet;
+
+	if(inst->readMode != 0) {
+		errmsg.LogError(0, RS_RET_CONFIG_ERROR, "imfile: startmsg.regex and readMode "
+				"can not be used together, file '%s'", inst->pszFileName);
+		ABORT_FINALIZE(RS_RET_CONFIG_ERROR);
+	}
+	CHKiRet(objUse(regexp, LM_REGEXP_FILENAME));
+	localRet = regexp.rsregComp(&inst->startRegex, re, REG_EXTENDED | REG_NOSUB, glblRegexEngine);
+	if(localRet == RS_RET_NOT_IMPLEMENTED)
+		localRet = regexp.rsregComp(&inst->startRegex, re, REG_EXTENDED | REG_NOSUB, RSREGEX_POSIX);
+	if(localRet != RS_RET_OK) {
+		errmsg.LogError(0, RS_RET_CONFIG_ERROR, "imfile: invalid startmsg.regex '%s'", re);
+		ABORT_FINALIZE(RS_RET_CONFIG_ERROR);
+	}
+
+	if(re[0] != '^' || strchr(re, '|') != NULL)
+		FINALIZE;
+	for(i = 1 ; re[i] != '\0' && strchr(".[]()*+?{}\\^$", re[i]) == NULL ; ++i)
+		; /* just scan */
+	len = i - 1;
+	if(re[i] != '\0' && strchr("*?{", re[i]) != NULL && len > 0)
+		--len; /* last char is optional */
+	if(len > 0) {
+		CHKmalloc(inst->pszStartPrefix = malloc(len));
+		memcpy(inst->pszStartPrefix, re + 1, len);
+		inst->lenStartPrefix = len;
+		inst->bStartIsPrefix = (re[i] == '\0');
+	}
+	DBGPRINTF("imfile: startmsg.regex '%s' has literal prefix length %d%s\n", re,
+		  (int) inst->lenStartPrefix, inst->bStartIsPrefix ? " (complete)" : "");
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* this function checks instance parameters and does some required pre-processing
  * (e.g. split filename in path and actual name)
  * Note: we do NOT use dirname()/basename() as they have portability problems.
@@ -579,6 +1285,9 @@ checkInstance(instanceConf_t *inst)
 	dirn[i] = '\0';
 	CHKmalloc(inst->pszFileBaseName = (uchar*) strdup(basen));
 	CHKmalloc(inst->pszDirName = (uchar*) strdup(dirn));
+	inst->bWildcard = (strpbrk(basen, "*?[") != NULL);
+	if(inst->pszStartRegex != NULL)
+		CHKiRet(setupStartRegex(inst));
 
 	if(dirn[0] == '\0') {
 		dirn[0] = '/';
@@ -650,22 +1359,31 @@ finalize_it:
 }
 
 
-/* This function is called when a new listener (monitor) shall be added. */
-static inline rsRetVal
-addListner(instanceConf_t *inst)
+/* add a new entry to the file table. pszFileName and pszStateFile are
+ * copied. pszBaseName is taken over for dynamic (wildcard) entries, for
+ * others it must be the one from the instance.
+ * Free slots (from deleted dynamic files) are reused. The index of the
+ * new entry is returned in *pIdx.
+ */
+static rsRetVal
+fileTabAdd(instanceConf_t *inst, uchar *pszFileName, uchar *pszBaseName, uchar *pszStateFile,
+	sbool bDynamic, int *pIdx)
 {
 	DEFiRet;
+	int i;
 	int newMax;
-	fileInfo_t *newFileTab;
-	fileInfo_t *pThis;
+	fileInfo_t **newFileTab;
+	fileInfo_t *pThis = NULL;
 
-	if(iFilPtr == allocMaxFiles) {
+	for(i = 0 ; i < iFilPtr && files[i] != NULL ; ++i)
+		; /* just scan for a free slot */
+	if(i == allocMaxFiles) {
 		newMax = 2 * allocMaxFiles;
-		newFileTab = realloc(files, newMax * sizeof(fileInfo_t));
+		newFileTab = realloc(files, newMax * sizeof(fileInfo_t*));
 		if(newFileTab == NULL) {
 			errmsg.LogError(0, RS_RET_OUT_OF_MEMORY,
 					"cannot alloc memory to monitor file '%s' - ignoring",
-					inst->pszFileName);
+					pszFileName);
 			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 		}
 		files = newFileTab;
@@ -674,31 +1392,131 @@ addListner(instanceConf_t *inst)
 	}
 
 	/* if we reach this point, there is space in the file table for the new entry */
-	pThis = &files[iFilPtr];
-	pThis->pszFileName = (uchar*) strdup((char*) inst->pszFileName);
+	CHKmalloc(pThis = calloc(1, sizeof(fileInfo_t)));
+	CHKmalloc(pThis->pszFileName = (uchar*) strdup((char*) pszFileName));
 	pThis->pszDirName = inst->pszDirName; /* use value from inst! */
-	pThis->pszBaseName = inst->pszFileBaseName; /* use value from inst! */
-	pThis->pszTag = (uchar*) strdup((char*) inst->pszTag);
+	pThis->pszBaseName = pszBaseName;
+	CHKmalloc(pThis->pszTag = (uchar*) strdup((char*) inst->pszTag));
 	pThis->lenTag = ustrlen(pThis->pszTag);
-	pThis->pszStateFile = (uchar*) strdup((char*) inst->pszStateFile);
+	CHKmalloc(pThis->pszStateFile = (uchar*) strdup((char*) pszStateFile));
 
-	CHKiRet(ratelimitNew(&pThis->ratelimiter, "imfile", (char*)inst->pszFileName));
-	CHKmalloc(pThis->multiSub.ppMsgs = MALLOC(inst->nMultiSub * sizeof(msg_t*)));
-	pThis->multiSub.maxElem = inst->nMultiSub;
-	pThis->multiSub.nElem = 0;
+	CHKiRet(ratelimitNew(&pThis->ratelimiter, "imfile", (char*)pszFileName));
+	CHKmalloc(pThis->pBatch = calloc(1, sizeof(imBatch_t)));
+	CHKiRet(imBatchConstruct(pThis->pBatch, inst->nMultiSub, IM_BATCH_DFLT_DELAY));
 	pThis->iSeverity = inst->iSeverity;
 	pThis->iFacility = inst->iFacility;
 	pThis->maxLinesAtOnce = inst->maxLinesAtOnce;
 	pThis->iPersistStateInterval = inst->iPersistStateInterval;
 	pThis->readMode = inst->readMode;
+	pThis->startRegex = inst->startRegex;
+	pThis->pszStartPrefix = inst->pszStartPrefix;
+	pThis->lenStartPrefix = inst->lenStartPrefix;
+	pThis->bStartIsPrefix = inst->bStartIsPrefix;
+	pThis->readTimeout = inst->readTimeout;
+	pThis->pPending = NULL;
 	pThis->escapeLF = inst->escapeLF;
 	pThis->pRuleset = inst->pBindRuleset;
+	pThis->closeTimeout = inst->closeTimeout;
 	pThis->nRecords = 0;
 	pThis->pStrm = NULL;
-	++iFilPtr;	/* we got a new file to monitor */
+	pThis->wrkState = FILE_WRKR_IDLE;
+	pThis->bDynamic = bDynamic;
+	pThis->tLastActive = time(NULL);
+	files[i] = pThis;
+	if(i == iFilPtr)
+		++iFilPtr;	/* we got a new file to monitor */
+	*pIdx = i;
 
-	resetConfigVariables(NULL, NULL); /* values are both dummies */
 finalize_it:
+	if(iRet != RS_RET_OK && pThis != NULL) {
+		if(pThis->ratelimiter != NULL)
+			ratelimitDestruct(pThis->ratelimiter);
+		if(pThis->pBatch != NULL) {
+			imBatchDestruct(pThis->pBatch);
+			free(pThis->pBatch);
+		}
+		free(pThis->pszFileName);
+		free(pThis->pszTag);
+		free(pThis->pszStateFile);
+		free(pThis);
+	}
+	RETiRet;
+}
+
+
+/* close a file table entry. The stream state is persisted, unless the file
+ * is gone, in which case we also remove its state file.
+ */
+static void
+fileClose(fileInfo_t *pThis, sbool bGone)
+{
+	uchar pszSFNam[MAXFNAME];
+
+	flushPending(pThis);
+	imBatchFlush(pThis->pBatch);
+	if(pThis->pStrm != NULL) {
+		if(!bGone)
+			persistStrmState(pThis);
+		strm.Destruct(&pThis->pStrm);
+	}
+	if(bGone) {
+		if(stateDb.ht != NULL)
+			stateDbUpdate(pThis->pszStateFile, 0, -1);
+		snprintf((char*)pszSFNam, sizeof(pszSFNam), "%s/%s",
+			 (char*) glbl.GetWorkDir(), (char*)pThis->pszStateFile);
+		unlink((char*)pszSFNam);
+	}
+}
+
+
+/* delete a file table entry and free its slot */
+static void
+fileTabDel(int i)
+{
+	fileInfo_t *pThis = files[i];
+
+	flushPending(pThis);
+	imBatchFlush(pThis->pBatch);
+	if(pThis->pStrm != NULL) {
+		persistStrmState(pThis);
+		strm.Destruct(&pThis->pStrm);
+	}
+	ratelimitDestruct(pThis->ratelimiter);
+	imBatchDestruct(pThis->pBatch);
+	free(pThis->pBatch);
+	free(pThis->pszFileName);
+	free(pThis->pszTag);
+	free(pThis->pszStateFile);
+	if(pThis->bDynamic)
+		free(pThis->pszBaseName);
+	free(pThis);
+	files[i] = NULL;
+}
+
+
+/* This function is called when a new listener (monitor) shall be added.
+ * Wildcard instances do not get a file table entry here, entries are
+ * created as matching files show up (inotify mode only).
+ */
+static inline rsRetVal
+addListner(instanceConf_t *inst)
+{
+	DEFiRet;
+
+	if(inst->bWildcard) {
+		if(runModConf->opMode != OPMODE_INOTIFY) {
+			errmsg.LogError(0, RS_RET_CONFIG_ERROR, "imfile: wildcards in file name "
+					"'%s' are only supported in inotify mode - ignoring",
+					inst->pszFileName);
+			ABORT_FINALIZE(RS_RET_CONFIG_ERROR);
+		}
+		FINALIZE;
+	}
+	CHKiRet(fileTabAdd(inst, inst->pszFileName, inst->pszFileBaseName, inst->pszStateFile,
+		0, &inst->fileIdx));
+
+finalize_it:
+	resetConfigVariables(NULL, NULL); /* values are both dummies */
 	RETiRet;
 }
 
@@ -747,6 +1565,12 @@ CODESTARTnewInpInst
 			inst->iPersistStateInterval = pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "maxsubmitatonce")) {
 			inst->nMultiSub = pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "closetimeout")) {
+			inst->closeTimeout = pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "startmsg.regex")) {
+			inst->pszStartRegex = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(inppblk.descr[i].name, "readtimeout")) {
+			inst->readTimeout = pvals[i].val.d.n;
 		} else {
 			dbgprintf("imfile: program error, non-handled "
 			  "param '%s'\n", inppblk.descr[i].name);
@@ -765,6 +1589,9 @@ CODESTARTbeginCnfLoad
 	/* init our settings */
 	loadModConf->opMode = OPMODE_POLLING;
 	loadModConf->iPollInterval = DFLT_PollInterval;
+	loadModConf->nWrkrs = 0;
+	loadModConf->pszStateDb = NULL;
+	loadModConf->iStateDbInterval = DFLT_StateDbInterval;
 	loadModConf->configSetViaV2Method = 0;
 	bLegacyCnfModGlobalsPermitted = 1;
 	/* init legacy config vars */
@@ -814,6 +1641,12 @@ CODESTARTsetModCnf
 					"mode '%s'", cstr);
 				free(cstr);
 			}
+		} else if(!strcmp(modpblk.descr[i].name, "workerthreads")) {
+			loadModConf->nWrkrs = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "statedb")) {
+			loadModConf->pszStateDb = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(modpblk.descr[i].name, "statedb.interval")) {
+			loadModConf->iStateDbInterval = (int) pvals[i].val.d.n;
 		} else {
 			dbgprintf("imfile: program error, non-handled "
 			  "param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
@@ -870,19 +1703,21 @@ ENDcheckCnf
  */
 BEGINactivateCnf
 	instanceConf_t *inst;
+	int nInst = 0;
 CODESTARTactivateCnf
 	runModConf = pModConf;
 	free(files); /* clear any previous instance */
-	CHKmalloc(files = (fileInfo_t*) malloc(sizeof(fileInfo_t) * INIT_FILE_TAB_SIZE));
+	CHKmalloc(files = (fileInfo_t**) malloc(sizeof(fileInfo_t*) * INIT_FILE_TAB_SIZE));
 	allocMaxFiles = INIT_FILE_TAB_SIZE;
 	iFilPtr = 0;
 
 	for(inst = runModConf->root ; inst != NULL ; inst = inst->next) {
-		addListner(inst);
+		if(addListner(inst) == RS_RET_OK)
+			++nInst;
 	}
 
 	/* if we could not set up any listeners, there is no point in running... */
-	if(iFilPtr == 0) {
+	if(nInst == 0) {
 		errmsg.LogError(0, NO_ERRCODE, "imfile: no file monitors could be started, "
 				"input not activated.\n");
 		ABORT_FINALIZE(RS_RET_NO_RUN);
@@ -901,10 +1736,15 @@ CODESTARTfreeCnf
 		free(inst->pszFileBaseName);
 		free(inst->pszTag);
 		free(inst->pszStateFile);
+		free(inst->pszStartRegex);
+		free(inst->pszStartPrefix);
+		if(inst->startRegex != NULL)
+			regexp.rsregFree(&inst->startRegex);
 		del = inst;
 		inst = inst->next;
 		free(del);
 	}
+	free(pModConf->pszStateDb);
 	free(files);
 ENDfreeCnf
 
@@ -932,16 +1772,32 @@ doPolling(void)
 	int i;
 	int bHadFileData; /* were there at least one file with data during this run? */
 	DEFiRet;
+
+	if(wrkrPool.nWrkrs > 0) {
+		/* the workers keep re-reading files as long as they have data, so we
+		 * just need to kick all files once per polling interval.
+		 */
+		while(glbl.GetGlobalInputTermState() == 0) {
+			for(i = 0 ; i < iFilPtr ; ++i)
+				wrkrSchedFile(files[i]);
+			stateDbFlush(0);
+			if(glbl.GetGlobalInputTermState() == 0)
+				srSleep(runModConf->iPollInterval, 10);
+		}
+		FINALIZE;
+	}
+
 	while(glbl.GetGlobalInputTermState() == 0) {
 		do {
 			bHadFileData = 0;
 			for(i = 0 ; i < iFilPtr ; ++i) {
 				if(glbl.GetGlobalInputTermState() == 1)
 					break; /* terminate input! */
-				pollFile(&files[i], &bHadFileData);
+				pollFile(files[i], &bHadFileData);
 			}
 		} while(iFilPtr > 1 && bHadFileData == 1 && glbl.GetGlobalInputTermState() == 0);
 		  /* warning: do...while()! */
+		stateDbFlush(0);
 
 		/* Note: the additional 10ns wait is vitally important. It guards rsyslog
 		 * against totally hogging the CPU if the users selects a polling interval
@@ -951,7 +1807,8 @@ doPolling(void)
 		if(glbl.GetGlobalInputTermState() == 0)
 			srSleep(runModConf->iPollInterval, 10);
 	}
-	
+
+finalize_it:
 	RETiRet;
 }
 
@@ -972,6 +1829,7 @@ dirsAdd(uchar *dirName)
 			errmsg.LogError(0, RS_RET_OUT_OF_MEMORY,
 					"cannot alloc memory to monitor directory '%s' - ignoring",
 					dirName);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 		}
 		dirs = newDirTab;
 		allocMaxDirs = newMax;
@@ -989,25 +1847,20 @@ finalize_it:
 	RETiRet;
 }
 
-/* checks if a file name is already inside the dirs array. Note that wildcards
- * apply. Returns either the array index or -1 if not found.
+/* checks if a file name is associated with a dir entry. The name must match
+ * exactly. Returns either the file table index or -1 if not found.
  * i is the index of the dir entry to search.
  */
 static int
 dirsFindFile(int i, uchar *fn)
 {
 	int f;
-	uchar *baseName;
 
 	for(f = 0 ; f < dirs[i].currMaxFiles ; ++f) {
-		baseName = files[dirs[i].files[f].idx].pszBaseName;
-		if(!fnmatch((char*)fn, (char*)baseName, FNM_PATHNAME | FNM_PERIOD))
-			break; /* found */
-	}
-	if(f == dirs[i].currMaxFiles)
-		f = -1;
-	//dbgprintf("DDDD: dir '%s', file '%s', found:%d\n", dirs[i].dirName, fn, f);
-	return f;
+		if(!ustrcmp(fn, files[dirs[i].files[f].idx]->pszBaseName))
+			return dirs[i].files[f].idx;
+	}
+	return -1;
 }
 
 /* checks if a dir name is already inside the dirs array. If so, returns
@@ -1059,11 +1912,11 @@ dirsAddFile(int i)
 	dirInfo_t *dir;
 	DEFiRet;
 
-	dirIdx = dirsFindDir(files[i].pszDirName);
+	dirIdx = dirsFindDir(files[i]->pszDirName);
 	if(dirIdx == -1) {
 		errmsg.LogError(0, RS_RET_INTERNAL_ERROR, "imfile: could not find "
 			"directory '%s' in dirs array - ignoring",
-			files[i].pszDirName);
+			files[i]->pszDirName);
 		FINALIZE;
 	}
 
@@ -1075,28 +1928,29 @@ dirsAddFile(int i)
 		 * continue to work. */
 		++dir->files[j].refcnt;
 		DBGPRINTF("imfile: file '%s' already registered in directory '%s', recnt now %d\n",
-			files[i].pszFileName, dir->dirName, dir->files[j].refcnt);
+			files[i]->pszFileName, dir->dirName, dir->files[j].refcnt);
 		FINALIZE;
 	}
 
 	if(dir->currMaxFiles == dir->allocMaxFiles) {
-		newMax = 2 * allocMaxFiles;
-		newFileTab = realloc(dirs, newMax * sizeof(dirInfoFiles_t));
+		newMax = 2 * dir->allocMaxFiles;
+		newFileTab = realloc(dir->files, newMax * sizeof(dirInfoFiles_t));
 		if(newFileTab == NULL) {
 			errmsg.LogError(0, RS_RET_OUT_OF_MEMORY,
 					"cannot alloc memory to map directory '%s' file relationship "
-					"'%s' - ignoring", files[i].pszFileName, dir->dirName);
+					"'%s' - ignoring", files[i]->pszFileName, dir->dirName);
 			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 		}
 		dir->files = newFileTab;
 		dir->allocMaxFiles = newMax;
-		DBGPRINTF("imfile: increased dir table to %d entries\n", allocMaxDirs);
+		DBGPRINTF("imfile: increased file table of dir '%s' to %d entries\n",
+			dir->dirName, newMax);
 	}
 
 	dir->files[dir->currMaxFiles].idx = i;
 	dir->files[dir->currMaxFiles].refcnt = 1;
 	dbgprintf("DDDD: associated file %d[%s] to directory %d[%s]\n",
-		i, files[i].pszFileName, dirIdx, dir->dirName);
+		i, files[i]->pszFileName, dirIdx, dir->dirName);
 	++dir->currMaxFiles;
 finalize_it:
 	RETiRet;
@@ -1104,19 +1958,22 @@ finalize_it:
 
 /* delete a file from directory (remove association) 
  * fIdx is index into file table, all other information is pulled from that table.
+ * *pbGone is set to 1 if the last association was removed, that is no
+ * inotify watch refers to the file any longer.
  */
 static rsRetVal
-dirsDelFile(int fIdx)
+dirsDelFile(int fIdx, int *pbGone)
 {
 	int dirIdx;
 	int j;
 	dirInfo_t *dir;
 	DEFiRet;
 
-	dirIdx = dirsFindDir(files[fIdx].pszDirName);
+	*pbGone = 0;
+	dirIdx = dirsFindDir(files[fIdx]->pszDirName);
 	if(dirIdx == -1) {
 		DBGPRINTF("imfile: could not find directory '%s' in dirs array - ignoring",
-			files[fIdx].pszDirName);
+			files[fIdx]->pszDirName);
 		FINALIZE;
 	}
 
@@ -1125,7 +1982,7 @@ dirsDelFile(int fIdx)
 		; /* just scan */
 	if(j == dir->currMaxFiles) {
 		DBGPRINTF("imfile: no association for file '%s' in directory '%s' "
-			"found - ignoring\n", files[fIdx].pszFileName, dir->dirName);
+			"found - ignoring\n", files[fIdx]->pszFileName, dir->dirName);
 		FINALIZE;
 	}
 	dir->files[j].refcnt--;
@@ -1137,9 +1994,10 @@ dirsDelFile(int fIdx)
 				(dir->currMaxFiles -j-1) * sizeof(dirInfoFiles_t));
 		}
 		--dir->currMaxFiles;
+		*pbGone = 1;
 	}
 	DBGPRINTF("imfile: removed association of file '%s' to directory '%s'\n",
-		  files[fIdx].pszFileName, dir->dirName);
+		  files[fIdx]->pszFileName, dir->dirName);
 
 finalize_it:
 	RETiRet;
@@ -1149,10 +2007,10 @@ static void
 in_setupDirWatch(int i)
 {
 	int wd;
-	wd = inotify_add_watch(ino_fd, (char*)dirs[i].dirName, IN_CREATE);
+	wd = inotify_add_watch(ino_fd, (char*)dirs[i].dirName, IN_CREATE | IN_MOVED_TO);
 	if(wd < 0) {
 		DBGPRINTF("imfile: could not create dir watch for '%s'\n",
-			files[i].pszFileName);
+			dirs[i].dirName);
 		goto done;
 	}
 	wdmapAdd(wd, i, -1);
@@ -1164,21 +2022,84 @@ done:	return;
  * Note: we need to try to read this file, as it may already contain data this
  * needs to be processed, and we won't get an event for that as notifications
  * happen only for things after the watch has been activated.
+ * If the inode is already watched (inotify hands back the same wd), only
+ * the read is done.
  */
 static void
 in_setupFileWatch(int i)
 {
 	int wd;
-	wd = inotify_add_watch(ino_fd, (char*)files[i].pszFileName, IN_MODIFY);
+	wd = inotify_add_watch(ino_fd, (char*)files[i]->pszFileName, IN_MODIFY);
 	if(wd < 0) {
 		DBGPRINTF("imfile: could not create initial file for '%s'\n",
-			files[i].pszFileName);
+			files[i]->pszFileName);
+		goto done;
+	}
+	if(wdmapLookup(wd) == NULL) {
+		wdmapAdd(wd, -1, i);
+		dbgprintf("DDDD: watch %d added for file %s\n", wd, files[i]->pszFileName);
+		dirsAddFile(i);
+	}
+	schedPollFile(files[i]);
+done:	return;
+}
+
+/* a file matching a wildcard instance showed up. Create a file table entry
+ * for it (unless we already monitor a file of that name) and watch it.
+ * The state file name is the instance's one, suffixed by the file name.
+ */
+static void
+in_addDynFile(instanceConf_t *inst, int dirIdx, char *name)
+{
+	int fIdx;
+	int len;
+	uchar *pszBaseName;
+	uchar fullName[MAXFNAME];
+	uchar stateFile[MAXFNAME];
+
+	fIdx = dirsFindFile(dirIdx, (uchar*)name);
+	if(fIdx == -1) {
+		len = snprintf((char*)fullName, sizeof(fullName), "%s/%s", (char*)inst->pszDirName, name);
+		if(len < 0 || len >= (int) sizeof(fullName))
+			goto done;
+		len = snprintf((char*)stateFile, sizeof(stateFile), "%s-%s", (char*)inst->pszStateFile, name);
+		if(len < 0 || len >= (int) sizeof(stateFile))
+			goto done;
+		if((pszBaseName = ustrdup((uchar*)name)) == NULL)
+			goto done;
+		if(fileTabAdd(inst, fullName, pszBaseName, stateFile, 1, &fIdx) != RS_RET_OK) {
+			free(pszBaseName);
+			goto done;
+		}
+		DBGPRINTF("imfile: file '%s' matches '%s', now monitored\n", fullName, inst->pszFileName);
+	}
+	in_setupFileWatch(fIdx);
+done:	return;
+}
+
+/* pick up the files that already match a wildcard instance */
+static void
+in_scanWildcard(instanceConf_t *inst)
+{
+	glob_t gl;
+	struct stat sb;
+	size_t k;
+	char *name;
+	int dirIdx;
+
+	dirIdx = dirsFindDir(inst->pszDirName);
+	if(dirIdx == -1)
+		goto done;
+	if(glob((char*)inst->pszFileName, GLOB_NOSORT, NULL, &gl) != 0)
 		goto done;
+	for(k = 0 ; k < gl.gl_pathc ; ++k) {
+		if(stat(gl.gl_pathv[k], &sb) != 0 || !S_ISREG(sb.st_mode))
+			continue;
+		name = strrchr(gl.gl_pathv[k], '/');
+		name = (name == NULL) ? gl.gl_pathv[k] : name + 1;
+		in_addDynFile(inst, dirIdx, name);
 	}
-	wdmapAdd(wd, -1, i);
-	dbgprintf("DDDD: watch %d added for file %s\n", wd, files[i].pszFileName);
-	dirsAddFile(i);
-	pollFile(&files[i], NULL);
+	globfree(&gl);
 done:	return;
 }
 
@@ -1187,13 +2108,19 @@ static rsRetVal
 in_setupInitialWatches()
 {
 	int i;
+	instanceConf_t *inst;
 	DEFiRet;
 
 	for(i = 0 ; i < currMaxDirs ; ++i) {
 		in_setupDirWatch(i);
 	}
 	for(i = 0 ; i < iFilPtr ; ++i) {
-		in_setupFileWatch(i);
+		if(files[i] != NULL)
+			in_setupFileWatch(i);
+	}
+	for(inst = runModConf->root ; inst != NULL ; inst = inst->next) {
+		if(inst->bWildcard)
+			in_scanWildcard(inst);
 	}
 	RETiRet;
 }
@@ -1234,24 +2161,52 @@ in_dbg_showEv(struct inotify_event *ev)
 	 }
 }
 
+/* a file was created in (or moved into) a watched directory. It may be a
+ * configured file that re-appeared or a new match for a wildcard.
+ */
 static void
 in_handleDirEvent(struct inotify_event *ev, int dirIdx)
 {
-	int fileIdx;
+	instanceConf_t *inst;
+
 	dbgprintf("DDDD: handle dir event for %s\n", dirs[dirIdx].dirName);
-	if(!(ev->mask & IN_CREATE)) {
+	if(!(ev->mask & (IN_CREATE | IN_MOVED_TO))) {
 		DBGPRINTF("imfile: got non-expected inotify event:\n");
 		in_dbg_showEv(ev);
 		goto done;
 	}
-	fileIdx = dirsFindFile(dirIdx, (uchar*)ev->name);
-	if(fileIdx == -1) {
-		dbgprintf("imfile: file '%s' not associated with dir '%s'\n",
-			ev->name, dirs[dirIdx].dirName);
+	if(ev->len == 0 || (ev->mask & IN_ISDIR))
 		goto done;
+	for(inst = runModConf->root ; inst != NULL ; inst = inst->next) {
+		if(ustrcmp(inst->pszDirName, dirs[dirIdx].dirName))
+			continue;
+		if(inst->bWildcard) {
+			if(!fnmatch((char*)inst->pszFileBaseName, ev->name, FNM_PATHNAME | FNM_PERIOD))
+				in_addDynFile(inst, dirIdx, ev->name);
+		} else if(inst->fileIdx != -1 && !ustrcmp(inst->pszFileBaseName, (uchar*)ev->name)) {
+			dbgprintf("DDDD: file '%s' associated with dir '%s'\n", ev->name, dirs[dirIdx].dirName);
+			in_setupFileWatch(inst->fileIdx);
+		}
+	}
+done:	return;
+}
+
+/* delete the entry of a wildcard-matched file that is gone. If a worker is
+ * still busy with it, housekeeping will delete it later.
+ */
+static void
+in_deleteDynFile(int fIdx)
+{
+	if(wrkrPool.nWrkrs > 0) {
+		pthread_mutex_lock(&wrkrPool.mut);
+		files[fIdx]->bDelete = 1;
+		pthread_mutex_unlock(&wrkrPool.mut);
+		if(!wrkrFileIsIdle(files[fIdx]))
+			goto done;
 	}
-	dbgprintf("DDDD: file '%s' associated with dir '%s'\n", ev->name, dirs[dirIdx].dirName);
-	in_setupFileWatch(fileIdx);
+	DBGPRINTF("imfile: file '%s' is gone, no longer monitored\n", files[fIdx]->pszFileName);
+	fileClose(files[fIdx], 1);
+	fileTabDel(fIdx);
 done:	return;
 }
 
@@ -1262,8 +2217,12 @@ done:	return;
 static void
 in_removeFile(struct inotify_event *ev, int fIdx)
 {
+	int bGone;
+
 	wdmapDel(ev->wd);
-	dirsDelFile(fIdx);
+	dirsDelFile(fIdx, &bGone);
+	if(bGone && files[fIdx]->bDynamic)
+		in_deleteDynFile(fIdx);
 }
 
 
@@ -1271,7 +2230,7 @@ static void
 in_handleFileEvent(struct inotify_event *ev, int fIdx)
 {
 	if(ev->mask & IN_MODIFY) {
-		pollFile(&files[fIdx], NULL);
+		schedPollFile(files[fIdx]);
 	} else if(ev->mask & IN_IGNORED) {
 		in_removeFile(ev, fIdx);
 	} else {
@@ -1299,12 +2258,46 @@ in_processEvent(struct inotify_event *ev)
 done:	return;
 }
 
+/* housekeeping, done about once a second: delete the entries of vanished
+ * files that could not be deleted right away, and close the streams of files
+ * that had no new data for closeTimeout seconds. This bounds the number of
+ * open file descriptors; the next modify event reopens the file at the
+ * persisted offset.
+ */
+static void
+in_housekeeping(void)
+{
+	int i;
+	time_t tNow;
+
+	stateDbFlush(0);
+	time(&tNow);
+	for(i = 0 ; i < iFilPtr ; ++i) {
+		if(files[i] == NULL || !wrkrFileIsIdle(files[i]))
+			continue;
+		if(files[i]->bDelete) {
+			DBGPRINTF("imfile: file '%s' is gone, no longer monitored\n", files[i]->pszFileName);
+			fileClose(files[i], 1);
+			fileTabDel(i);
+		} else if(files[i]->closeTimeout > 0 && files[i]->pStrm != NULL
+			  && tNow - files[i]->tLastActive >= files[i]->closeTimeout) {
+			DBGPRINTF("imfile: closing inactive file '%s'\n", files[i]->pszFileName);
+			fileClose(files[i], 0);
+		} else {
+			checkReadTimeout(files[i]);
+		}
+	}
+}
+
 /* Monitor files in inotify mode */
 static rsRetVal
 do_inotify()
 {
 	char iobuf[8192];
 	struct inotify_event *ev;
+	struct pollfd pfd;
+	time_t tNow;
+	time_t tLastHousekeeping = 0;
 	int rd;
 	int currev;
 	DEFiRet;
@@ -1315,9 +2308,22 @@ do_inotify()
 	DBGPRINTF("imfile: inotify fd %d\n", ino_fd);
 	CHKiRet(in_setupInitialWatches());
 
+	pfd.fd = ino_fd;
+	pfd.events = POLLIN;
 	while(glbl.GetGlobalInputTermState() == 0) {
+		/* we wake up at least once a second for housekeeping */
+		rd = poll(&pfd, 1, 1000);
+		tNow = time(NULL);
+		if(tNow != tLastHousekeeping) {
+			in_housekeeping();
+			tLastHousekeeping = tNow;
+		}
+		if(rd <= 0)
+			continue; /* timeout or EINTR */
 		rd = read(ino_fd, iobuf, sizeof(iobuf));
 		if(rd < 0) {
+			if(errno == EINTR || errno == EAGAIN)
+				continue;
 			perror("inotify read"); exit(1);
 		}
 		currev = 0;
@@ -1348,11 +2354,15 @@ BEGINrunInput
 CODESTARTrunInput
 	DBGPRINTF("imfile: working in %s mode\n", 
 		 (runModConf->opMode == OPMODE_POLLING) ? "polling" : "inotify");
+	if(runModConf->nWrkrs > 0)
+		CHKiRet(wrkrPoolStart(runModConf->nWrkrs));
 	if(runModConf->opMode == OPMODE_POLLING)
 		iRet = doPolling();
 	else
 		iRet = do_inotify();
+	wrkrPoolStop();
 
+finalize_it:
 	DBGPRINTF("imfile: terminating upon request of rsyslog core\n");
 	RETiRet;	/* use it to make sure the housekeeping is done! */
 ENDrunInput
@@ -1371,6 +2381,7 @@ CODESTARTwillRun
 	CHKiRet(prop.Construct(&pInputName));
 	CHKiRet(prop.SetString(pInputName, UCHAR_CONSTANT("imfile"), sizeof("imfile") - 1));
 	CHKiRet(prop.ConstructFinalize(pInputName));
+	stateDbOpen(); /* errors are not fatal, we then use per-file state files */
 
 finalize_it:
 ENDwillRun
@@ -1388,9 +2399,16 @@ persistStrmState(fileInfo_t *pInfo)
 	DEFiRet;
 	strm_t *psSF = NULL; /* state file (stream) */
 	size_t lenDir;
+	int64 inode, offs;
 
 	ASSERT(pInfo != NULL);
 
+	if(stateDb.ht != NULL) {
+		offs = strmGetResumeOffs(pInfo->pStrm, &inode);
+		CHKiRet(stateDbUpdate(pInfo->pszStateFile, inode, offs));
+		FINALIZE;
+	}
+
 	/* TODO: create a function persistObj in obj.c? */
 	CHKiRet(strm.Construct(&psSF));
 	lenDir = ustrlen(glbl.GetWorkDir());
@@ -1433,16 +2451,10 @@ CODESTARTafterRun
 	 * before we change anything, we need to make sure the stream was open.
 	 */
 	for(i = 0 ; i < iFilPtr ; ++i) {
-		if(files[i].pStrm != NULL) { /* stream open? */
-			persistStrmState(&files[i]);
-			strm.Destruct(&(files[i].pStrm));
-		}
-		ratelimitDestruct(files[i].ratelimiter);
-		free(files[i].multiSub.ppMsgs);
-		free(files[i].pszFileName);
-		free(files[i].pszTag);
-		free(files[i].pszStateFile);
+		if(files[i] != NULL)
+			fileTabDel(i);
 	}
+	stateDbClose();
 
 	if(pInputName != NULL)
 		prop.Destruct(&pInputName);
@@ -1469,6 +2481,7 @@ CODESTARTmodExit
 	objRelease(errmsg, CORE_COMPONENT);
 	objRelease(prop, CORE_COMPONENT);
 	objRelease(ruleset, CORE_COMPONENT);
+	objRelease(regexp, LM_REGEXP_FILENAME);
 ENDmodExit
 
 
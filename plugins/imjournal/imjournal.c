@@ -49,6 +49,8 @@
 #include "srUtils.h"
 #include "unicode-helper.h"
 #include "ratelimit.h"
+#define IM_HELPER_NO_INSTANCES
+#include "im-helper.h"
 
 MODULE_TYPE_INPUT
 MODULE_TYPE_NOKEEP
@@ -70,6 +72,10 @@ static struct configSettings_s {
 	int bIgnorePrevious;
 	int iDfltSeverity;
 	int iDfltFacility;
+	int iPersistStatePeriod;	/* max seconds between state file writes, 0 = off */
+	int iBatchSize;			/* max number of messages submitted as one batch */
+	int nFields;			/* number of entries in ppszFields, 0 = all fields */
+	char **ppszFields;		/* journal fields to extract into the json tree */
 } cs;
 
 static rsRetVal facilityHdlr(uchar **pp, void *pVal);
@@ -82,7 +88,10 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "persiststateinterval", eCmdHdlrInt, 0 },
 	{ "ignorepreviousmessages", eCmdHdlrBinary, 0 },
 	{ "defaultseverity", eCmdHdlrSeverity, 0 },
-	{ "defaultfacility", eCmdHdlrString, 0 }
+	{ "defaultfacility", eCmdHdlrString, 0 },
+	{ "persiststate.period", eCmdHdlrNonNegInt, 0 },
+	{ "batchsize", eCmdHdlrPositiveInt, 0 },
+	{ "fields", eCmdHdlrArray, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -91,6 +100,8 @@ static struct cnfparamblk modpblk =
 	};
 
 #define DFLT_persiststateinterval 10
+#define DFLT_persiststateperiod 10
+#define DFLT_batchsize 32
 #define DFLT_SEVERITY LOG_PRI(LOG_NOTICE)
 #define DFLT_FACILITY LOG_FAC(LOG_USER)
 
@@ -101,6 +112,9 @@ static prop_t *pLocalHostIP = NULL;	/* a pseudo-constant propterty for 127.0.0.1
 
 static ratelimit_t *ratelimiter = NULL;
 static sd_journal *j;
+static imBatch_t batch;		/* messages not yet submitted */
+static int nUnpersisted = 0;		/* messages read since the state was last persisted */
+static time_t tLastPersist = 0;		/* time the state was last persisted */
 
 
 /* ugly workaround to handle facility numbers; values
@@ -171,21 +185,132 @@ enqMsg(uchar *msg, uchar *pszTag, int iFacility, int iSeverity, struct timeval *
 		msgAddJSON(pMsg, (uchar*)"!", json);
 	}
 
-	CHKiRet(ratelimitAddMsg(ratelimiter, NULL, pMsg));
+	CHKiRet(imBatchAdd(&batch, ratelimiter, pMsg));
 
 finalize_it:
 	RETiRet;
 }
 
 
+/* translate a journal field name to its lumberjack name (if there is one).
+ * Returns a newly allocated string or NULL if out of memory.
+ */
+static char *
+journalFieldName(const char *get, size_t prefixlen)
+{
+	const char *parse;
+	char *name;
+
+	parse = get;
+	switch (*parse)
+	{
+	case '_':
+		++parse;
+		if (*parse == 'P') {
+			if (!strncmp(parse+1, "ID=", 4)) {
+				name = strdup("pid");
+			} else {
+				name = strndup(get, prefixlen);
+			}
+		} else if (*parse == 'G') {
+			if (!strncmp(parse+1, "ID=", 4)) {
+				name = strdup("gid");
+			} else {
+				name = strndup(get, prefixlen);
+			}
+		} else if (*parse == 'U') {
+			if (!strncmp(parse+1, "ID=", 4)) {
+				name = strdup("uid");
+			} else {
+				name = strndup(get, prefixlen);
+			}
+		} else if (*parse == 'E') {
+			if (!strncmp(parse+1, "XE=", 4)) {
+				name = strdup("exe");
+			} else {
+				name = strndup(get, prefixlen);
+			}
+		} else if (*parse == 'C') {
+			parse++;
+			if (*parse == 'O') {
+				if (!strncmp(parse+1, "MM=", 4)) {
+					name = strdup("appname");
+				} else {
+					name = strndup(get, prefixlen);
+				}
+			} else if (*parse == 'M') {
+				if (!strncmp(parse+1, "DLINE=", 7)) {
+					name = strdup("cmd");
+				} else {
+					name = strndup(get, prefixlen);
+				}
+			} else {
+				name = strndup(get, prefixlen);
+			}
+		} else {
+			name = strndup(get, prefixlen);
+		}
+		break;
+
+	default:
+		name = strndup(get, prefixlen);
+		break;
+	}
+	return name;
+}
+
+
+/* add a single "NAME=value" journal field to the json tree */
+static rsRetVal
+addJournalField(struct json_object *json, const void *get, size_t l)
+{
+	const void *equal_sign;
+	struct json_object *jval;
+	char *name = NULL;
+	char *data = NULL;
+	size_t prefixlen;
+	DEFiRet;
+
+	/* locate equal sign, this is always present */
+	equal_sign = memchr(get, '=', l);
+
+	/* ... but we know better than to trust the specs */
+	if (equal_sign == NULL) {
+		errmsg.LogError(0, RS_RET_ERR, "SD_JOURNAL_FOREACH_DATA()"
+			"returned a malformed field (has no '='): '%s'", (char*)get);
+		FINALIZE; /* skip the entry */
+	}
+
+	/* get length of journal data prefix */
+	prefixlen = ((char *)equal_sign - (char *)get);
+
+	CHKmalloc(name = journalFieldName(get, prefixlen));
+	prefixlen++; /* remove '=' */
+	CHKmalloc(data = strndup((char*)get + prefixlen, l - prefixlen));
+
+	/* and save them to json object */
+	jval = json_object_new_string((char *)data);
+	json_object_object_add(json, name, jval);
+
+finalize_it:
+	free(data);
+	free(name);
+	RETiRet;
+}
+
+
 /* Read journal log while data are available, each read() reads one
  * record of printk buffer.
+ * If a field list is configured, only the listed fields are looked up
+ * instead of enumerating all fields of the entry. This saves a lot of
+ * work, as a typical entry carries 20 and more fields.
  */
 static rsRetVal
 readjournal() {
 	DEFiRet;
 
 	struct timeval tv;
+	struct timeval *ptv = NULL;
 	uint64_t timestamp;
 
 	struct json_object *json = NULL;
@@ -199,17 +324,11 @@ readjournal() {
 
 	const void *get;
 	const void *pidget;
-	char *parse;
 	size_t length;
 	size_t pidlength;
 
-	const void *equal_sign;
-	struct json_object *jval;
-	char *data;
-	char *name;
 	size_t l;
-
-	long prefixlen = 0;
+	int i;
 
 	int severity = cs.iDfltSeverity;
 	int facility = cs.iDfltFacility;
@@ -297,109 +416,37 @@ readjournal() {
 
 	json = json_object_new_object();
 
-	SD_JOURNAL_FOREACH_DATA(j, get, l) {
-		/* locate equal sign, this is always present */
-		equal_sign = memchr(get, '=', l);
-
-		/* ... but we know better than to trust the specs */
-		if (equal_sign == NULL) {
-			errmsg.LogError(0, RS_RET_ERR, "SD_JOURNAL_FOREACH_DATA()"
-				"returned a malformed field (has no '='): '%s'", (char*)get);
-			continue; /* skip the entry */
-		}
-
-		/* get length of journal data prefix */
-		prefixlen = ((char *)equal_sign - (char *)get);
-
-		/* translate name fields to lumberjack names */
-		parse = (char *)get;
+	if (json == NULL) {
+		iRet = RS_RET_OUT_OF_MEMORY;
+		goto finalize_it;
+	}
 
-		switch (*parse)
-		{
-		case '_':
-			++parse;
-			if (*parse == 'P') {
-				if (!strncmp(parse+1, "ID=", 4)) {
-					name = strdup("pid");
-				} else {
-					name = strndup(get, prefixlen);
-				}
-			} else if (*parse == 'G') {
-				if (!strncmp(parse+1, "ID=", 4)) {
-					name = strdup("gid");
-				} else {
-					name = strndup(get, prefixlen);
-				}
-			} else if (*parse == 'U') {
-				if (!strncmp(parse+1, "ID=", 4)) {
-					name = strdup("uid");
-				} else {
-					name = strndup(get, prefixlen);
-				}
-			} else if (*parse == 'E') {
-				if (!strncmp(parse+1, "XE=", 4)) {
-					name = strdup("exe");
-				} else {
-					name = strndup(get, prefixlen);
-				}
-			} else if (*parse == 'C') {
-				parse++;
-				if (*parse == 'O') {
-					if (!strncmp(parse+1, "MM=", 4)) {
-						name = strdup("appname");
-					} else {
-						name = strndup(get, prefixlen);
-					}
-				} else if (*parse == 'M') {
-					if (!strncmp(parse+1, "DLINE=", 7)) {
-						name = strdup("cmd");
-					} else {
-						name = strndup(get, prefixlen);
-					}
-				} else {
-					name = strndup(get, prefixlen);
-				}
-			} else {
-				name = strndup(get, prefixlen);
+	if (cs.nFields > 0) {
+		for (i = 0 ; i < cs.nFields ; ++i) {
+			if (sd_journal_get_data(j, cs.ppszFields[i], &get, &l) >= 0) {
+				CHKiRet(addJournalField(json, get, l));
 			}
-			break;
-
-		default:
-			name = strndup(get, prefixlen);
-			break;
 		}
-
-		if (name == NULL) {
-			iRet = RS_RET_OUT_OF_MEMORY;
-			goto ret;
-		}
-
-		prefixlen++; /* remove '=' */
-
-		data = strndup(get + prefixlen, l - prefixlen);
-		if (data == NULL) {
-			iRet = RS_RET_OUT_OF_MEMORY;
-			free (name);
-			goto ret;
+	} else {
+		SD_JOURNAL_FOREACH_DATA(j, get, l) {
+			CHKiRet(addJournalField(json, get, l));
 		}
-
-		/* and save them to json object */
-		jval = json_object_new_string((char *)data);
-		json_object_object_add(json, name, jval);
-		free (data);
-		free (name);
 	}
 
 	/* calculate timestamp */
 	if (sd_journal_get_realtime_usec(j, &timestamp) >= 0) {
 		tv.tv_sec = timestamp / 1000000;
 		tv.tv_usec = timestamp % 1000000;
+		ptv = &tv;
 	}
 
 	/* submit message */
-	enqMsg((uchar *)message, (uchar *) sys_iden_help, facility, severity, &tv, json);
+	enqMsg((uchar *)message, (uchar *) sys_iden_help, facility, severity, ptv, json);
+	json = NULL; /* now owned by the message */
 
 finalize_it:
+	if (json != NULL)
+		json_object_put(json);
 	free(sys_iden_help);
 free_message:
 	free(message);
@@ -443,19 +490,68 @@ persistJournalState () {
 }
 
 
+/* Submit the current batch and, if due, persist the journal cursor. The
+ * state is written once persiststateinterval messages have been read or
+ * persiststate.period seconds have passed since the last write, whatever
+ * comes first. The batch is always submitted before the cursor is written,
+ * so the state file never points past messages still held by us.
+ */
+static rsRetVal
+checkpointJournalState(int bForce)
+{
+	time_t tNow;
+	DEFiRet;
+
+	if (nUnpersisted == 0)
+		FINALIZE;
+
+	if (!bForce) {
+		if (cs.iPersistStateInterval > 0 && nUnpersisted >= cs.iPersistStateInterval) {
+			bForce = 1;
+		} else if (cs.iPersistStatePeriod > 0) {
+			datetime.GetTime(&tNow);
+			if (tNow - tLastPersist >= cs.iPersistStatePeriod)
+				bForce = 1;
+		}
+	}
+
+	if (bForce) {
+		imBatchFlush(&batch);
+		if (cs.stateFile) { /* can't persist without a state file */
+			persistJournalState();
+		}
+		nUnpersisted = 0;
+		datetime.GetTime(&tLastPersist);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* Polls the journal for new messages. Similar to sd_journal_wait()
- * except for the special handling of EINTR.
+ * except for the special handling of EINTR. If there is unpersisted
+ * state, we wake up in time to write it when persiststate.period is set.
  */
 static rsRetVal
 pollJournal()
 {
 	DEFiRet;
 	struct pollfd pollfd;
+	time_t tNow;
+	int timeout = -1;
 	int r;
 
+	if (nUnpersisted > 0 && cs.iPersistStatePeriod > 0) {
+		datetime.GetTime(&tNow);
+		timeout = (tLastPersist + cs.iPersistStatePeriod - tNow) * 1000;
+		if (timeout < 0)
+			timeout = 0;
+	}
+
 	pollfd.fd = sd_journal_get_fd(j);
 	pollfd.events = sd_journal_get_events(j);
-	r = poll(&pollfd, 1, -1);
+	r = poll(&pollfd, 1, timeout);
 	if (r == -1) {
 		if (errno == EINTR) {
 			/* EINTR is also received during termination
@@ -472,7 +568,11 @@ pollJournal()
 		}
 	}
 
-	assert(r == 1);
+	if (r == 0) {
+		/* timeout: persist state if due, we are idle anyway */
+		CHKiRet(checkpointJournalState(0));
+		FINALIZE;
+	}
 
 	r = sd_journal_process(j);
 	if (r < 0) {
@@ -568,6 +668,10 @@ CODESTARTrunInput
 	ratelimitSetLinuxLike(ratelimiter, cs.ratelimitInterval, cs.ratelimitBurst);
 	ratelimitSetNoTimeCache(ratelimiter);
 
+	CHKiRet(imBatchConstruct(&batch, cs.iBatchSize, IM_BATCH_DFLT_DELAY));
+	nUnpersisted = 0;
+	datetime.GetTime(&tLastPersist);
+
 	if (cs.stateFile) {
 		CHKiRet(loadJournalState());
 	}
@@ -576,7 +680,7 @@ CODESTARTrunInput
 	 * signalled to do so. This, however, is handled by the framework.
 	 */
 	while (glbl.GetGlobalInputTermState() == 0) {
-		int count = 0, r;
+		int r;
 
 		r = sd_journal_next(j);
 		if (r < 0) {
@@ -589,23 +693,19 @@ CODESTARTrunInput
 		}
 
 		if (r == 0) {
-			/* No new messages, wait for activity. */
+			/* No new messages, submit what we have and wait for activity. */
+			imBatchFlush(&batch);
 			CHKiRet(pollJournal());
 			continue;
 		}
 
 		CHKiRet(readjournal());
-		if (cs.stateFile) { /* can't persist without a state file */
-			/* TODO: This could use some finer metric. */
-			count++;
-			if (count == cs.iPersistStateInterval) {
-				count = 0;
-				persistJournalState();
-			}
-		}
+		++nUnpersisted;
+		CHKiRet(checkpointJournalState(0));
 	}
 
 finalize_it:
+	imBatchFlush(&batch);
 ENDrunInput
 
 
@@ -619,6 +719,10 @@ CODESTARTbeginCnfLoad
 	cs.ratelimitInterval = 600;
 	cs.iDfltSeverity = DFLT_SEVERITY;
 	cs.iDfltFacility = DFLT_FACILITY;
+	cs.iPersistStatePeriod = DFLT_persiststateperiod;
+	cs.iBatchSize = DFLT_batchsize;
+	cs.nFields = 0;
+	cs.ppszFields = NULL;
 ENDbeginCnfLoad
 
 
@@ -638,7 +742,13 @@ ENDactivateCnf
 
 
 BEGINfreeCnf
+	int i;
 CODESTARTfreeCnf
+	for (i = 0 ; i < cs.nFields ; ++i)
+		free(cs.ppszFields[i]);
+	free(cs.ppszFields);
+	cs.ppszFields = NULL;
+	cs.nFields = 0;
 ENDfreeCnf
 
 /* open journal */
@@ -659,6 +769,7 @@ CODESTARTafterRun
 	}
 	sd_journal_close(j);
 	ratelimitDestruct(ratelimiter);
+	imBatchDestruct(&batch);
 ENDafterRun
 
 
@@ -680,7 +791,7 @@ ENDmodExit
 
 BEGINsetModCnf
 	struct cnfparamvals *pvals = NULL;
-	int i;
+	int i, k;
 CODESTARTsetModCnf
 	pvals = nvlstGetParams(lst, &modpblk, NULL);
 	if (pvals == NULL) {
@@ -718,6 +829,16 @@ CODESTARTsetModCnf
 			fac = p = es_str2cstr(pvals[i].val.d.estr, NULL);
 			facilityHdlr((uchar **) &p, (void *) &cs.iDfltFacility);
 			free(fac);
+		} else if (!strcmp(modpblk.descr[i].name, "persiststate.period")) {
+			cs.iPersistStatePeriod = (int) pvals[i].val.d.n;
+		} else if (!strcmp(modpblk.descr[i].name, "batchsize")) {
+			cs.iBatchSize = (int) pvals[i].val.d.n;
+		} else if (!strcmp(modpblk.descr[i].name, "fields")) {
+			CHKmalloc(cs.ppszFields = calloc(pvals[i].val.d.ar->nmemb, sizeof(char*)));
+			for (k = 0 ; k < pvals[i].val.d.ar->nmemb ; ++k) {
+				CHKmalloc(cs.ppszFields[k] = es_str2cstr(pvals[i].val.d.ar->arr[k], NULL));
+				cs.nFields = k + 1;
+			}
 		} else {
 			dbgprintf("imjournal: program error, non-handled "
 				"param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
@@ -224,6 +224,7 @@ readklog(modConfData_t *pModConf)
 
 	len = 0;
 	for (;;) {
+		imklogFlush(); /* submit what we have before we block in read() */
 		dbgprintf("imklog(BSD/Linux) waiting for kernel log line\n");
 		i = read(fklog, pRcv + len, iMaxLine - len);
 		if (i > 0) {
@@ -252,6 +253,7 @@ readklog(modConfData_t *pModConf)
 	}
 	if (len > 0)
 		submitSyslog(pModConf, LOG_INFO, pRcv);
+	imklogFlush();
 
 	if(pRcv != NULL && (size_t) iMaxLine >= sizeof(bufRcv) - 1)
 		free(pRcv);
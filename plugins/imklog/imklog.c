@@ -61,6 +61,8 @@
 #include "prop.h"
 #include "errmsg.h"
 #include "unicode-helper.h"
+#define IM_HELPER_NO_INSTANCES
+#include "im-helper.h"
 
 MODULE_TYPE_INPUT
 MODULE_TYPE_NOKEEP
@@ -106,6 +108,7 @@ static struct cnfparamblk modpblk =
 
 static prop_t *pInputName = NULL;	/* there is only one global inputName for all messages generated by this module */
 static prop_t *pLocalHostIP = NULL;
+static imBatch_t batch;	/* messages not yet submitted, used by the input thread only */
 
 static inline void
 initConfigSettings(void)
@@ -151,7 +154,7 @@ enqMsg(uchar *msg, uchar* pszTag, int iFacility, int iSeverity, struct timeval *
 	pMsg->iFacility = iFacility;
 	pMsg->iSeverity = iSeverity;
 	/* note: we do NOT use rate-limiting, as the kernel itself does rate-limiting */
-	CHKiRet(submitMsg2(pMsg));
+	CHKiRet(imBatchAdd(&batch, NULL, pMsg));
 
 finalize_it:
 	RETiRet;
@@ -257,6 +260,16 @@ finalize_it:
 }
 
 
+/* submit all kernel messages obtained so far. Drivers must call this before
+ * they wait for the next message.
+ */
+rsRetVal
+imklogFlush(void)
+{
+	return imBatchFlush(&batch);
+}
+
+
 /* helper for some klog drivers which need to know the MaxLine global setting. They can
  * not obtain it themselfs, because they are no modules and can not query the object hander.
  * It would probably be a good idea to extend the interface to support it, but so far
@@ -398,11 +411,13 @@ ENDfreeCnf
 
 BEGINwillRun
 CODESTARTwillRun
+	iRet = imBatchConstruct(&batch, CONF_NUM_MULTISUB, IM_BATCH_DFLT_DELAY);
 ENDwillRun
 
 
 BEGINafterRun
 CODESTARTafterRun
+	imBatchDestruct(&batch);
         iRet = klogAfterRun(runModConf);
 ENDafterRun
 
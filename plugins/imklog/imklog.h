@@ -55,6 +55,7 @@ int klogFacilIntMsg();
 /* the functions below may be called by the drivers */
 rsRetVal imklogLogIntMsg(int priority, char *fmt, ...) __attribute__((format(printf,2, 3)));
 rsRetVal Syslog(int priority, uchar *msg, struct timeval *tp);
+rsRetVal imklogFlush(void);
 
 /* prototypes */
 extern int klog_getMaxLine(void); /* work-around for klog drivers to get configured max line size */
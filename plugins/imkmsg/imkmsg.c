@@ -48,6 +48,9 @@
 #include "prop.h"
 #include "errmsg.h"
 #include "unicode-helper.h"
+#include "statsobj.h"
+#define IM_HELPER_NO_INSTANCES
+#include "im-helper.h"
 
 MODULE_TYPE_INPUT
 MODULE_TYPE_NOKEEP
@@ -60,6 +63,11 @@ DEFobjCurrIf(glbl)
 DEFobjCurrIf(prop)
 DEFobjCurrIf(net)
 DEFobjCurrIf(errmsg)
+DEFobjCurrIf(statsobj)
+
+static statsobj_t *modStats;
+STATSCOUNTER_DEF(ctrSubmit, mutCtrSubmit)
+STATSCOUNTER_DEF(ctrOverruns, mutCtrOverruns)
 
 /* config settings */
 typedef struct configSettings_s {
@@ -73,6 +81,7 @@ static int bLegacyCnfModGlobalsPermitted;/* are legacy module-global config para
 
 static prop_t *pInputName = NULL;	/* there is only one global inputName for all messages generated by this module */
 static prop_t *pLocalHostIP = NULL;	/* a pseudo-constant propterty for 127.0.0.1 */
+static imBatch_t batch;	/* messages not yet submitted, used by the input thread only */
 
 static inline void
 initConfigSettings(void)
@@ -113,13 +122,33 @@ enqMsg(uchar *msg, uchar* pszTag, int iFacility, int iSeverity, struct timeval *
 	pMsg->iFacility = iFacility;
 	pMsg->iSeverity = iSeverity;
 	pMsg->json = json;
-	CHKiRet(submitMsg(pMsg));
+	CHKiRet(imBatchAdd(&batch, NULL, pMsg));
+	STATSCOUNTER_INC(ctrSubmit, mutCtrSubmit);
 
 finalize_it:
 	RETiRet;
 }
 
 
+/* submit all kernel messages obtained so far. The driver must call this
+ * before it waits for the next message.
+ */
+rsRetVal
+imkmsgFlush(void)
+{
+	return imBatchFlush(&batch);
+}
+
+
+/* account for records the kernel overwrote before we could read them.
+ */
+void
+imkmsgCountOverrun(long nLost)
+{
+	STATSCOUNTER_ADD(ctrOverruns, mutCtrOverruns, nLost);
+}
+
+
 /* log an imkmsg-internal message
  * rgerhards, 2008-04-14
  */
@@ -225,11 +254,13 @@ ENDfreeCnf
 
 BEGINwillRun
 CODESTARTwillRun
+	iRet = imBatchConstruct(&batch, CONF_NUM_MULTISUB, IM_BATCH_DFLT_DELAY);
 ENDwillRun
 
 
 BEGINafterRun
 CODESTARTafterRun
+	imBatchDestruct(&batch);
         iRet = klogAfterRun(runModConf);
 ENDafterRun
 
@@ -240,6 +271,7 @@ CODESTARTmodExit
 		prop.Destruct(&pInputName);
 	if(pLocalHostIP != NULL)
 		prop.Destruct(&pLocalHostIP);
+	statsobj.Destruct(&modStats);
 
 	/* release objects we used */
 	objRelease(glbl, CORE_COMPONENT);
@@ -247,6 +279,7 @@ CODESTARTmodExit
 	objRelease(datetime, CORE_COMPONENT);
 	objRelease(prop, CORE_COMPONENT);
 	objRelease(errmsg, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
 ENDmodExit
 
 
@@ -272,6 +305,7 @@ CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(prop, CORE_COMPONENT));
 	CHKiRet(objUse(net, CORE_COMPONENT));
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 
 	/* we need to create the inputName property (only once during our lifetime) */
 	CHKiRet(prop.CreateStringProp(&pInputName, UCHAR_CONSTANT("imkmsg"), sizeof("imkmsg") - 1));
@@ -280,6 +314,17 @@ CODEmodInit_QueryRegCFSLineHdlr
 	/* init legacy config settings */
 	initConfigSettings();
 
+	/* support statistics gathering */
+	CHKiRet(statsobj.Construct(&modStats));
+	CHKiRet(statsobj.SetName(modStats, UCHAR_CONSTANT("imkmsg")));
+	STATSCOUNTER_INIT(ctrSubmit, mutCtrSubmit);
+	CHKiRet(statsobj.AddCounter(modStats, UCHAR_CONSTANT("submitted"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrSubmit));
+	STATSCOUNTER_INIT(ctrOverruns, mutCtrOverruns);
+	CHKiRet(statsobj.AddCounter(modStats, UCHAR_CONSTANT("overruns"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrOverruns));
+	CHKiRet(statsobj.ConstructFinalize(modStats));
+
 	CHKiRet(omsdRegCFSLineHdlr((uchar *)"debugprintkernelsymbols", 0, eCmdHdlrGoneAway,
 			NULL, NULL, STD_LOADABLE_MODULE_ID));
 	CHKiRet(omsdRegCFSLineHdlr((uchar *)"klogsymbollookup", 0, eCmdHdlrGoneAway,
@@ -49,6 +49,8 @@ int klogFacilIntMsg();
 /* the functions below may be called by the drivers */
 rsRetVal imkmsgLogIntMsg(int priority, char *fmt, ...) __attribute__((format(printf,2, 3)));
 rsRetVal Syslog(int priority, uchar *msg, struct timeval *tp, struct json_object *json);
+rsRetVal imkmsgFlush(void);
+void imkmsgCountOverrun(long nLost);
 
 /* prototypes */
 extern int klog_getMaxLine(void); /* work-around for klog drivers to get configured max line size */
@@ -32,8 +32,10 @@
 #include <errno.h>
 #include <string.h>
 #include <ctype.h>
+#include <poll.h>
 #include <sys/klog.h>
 #include <sys/sysinfo.h>
+#include <sys/time.h>
 #include <json.h>
 
 #include "rsyslog.h"
@@ -43,6 +45,14 @@
 
 /* globals */
 static int	fklog = -1;	/* kernel log fd */
+static long	lastSequnum = -1; /* sequence number of last record read, for overrun detection */
+
+/* records read from the device in one go before they are parsed and
+ * submitted. Each read() returns exactly one record.
+ */
+#define KMSG_BATCH_SIZE 64
+#define KMSG_MAX_REC 8192
+static uchar (*recBatch)[KMSG_MAX_REC+1] = NULL;
 
 #ifndef _PATH_KLOG
 #	define _PATH_KLOG "/dev/kmsg"
@@ -50,14 +60,14 @@ static int	fklog = -1;	/* kernel log fd */
 
 /* submit a message to imkmsg Syslog() API. In this function, we parse
  * necessary information from kernel log line, and make json string
- * from the rest.
+ * from the rest. tvBoot is the system boot time, which the caller
+ * computes once for the whole batch.
  */
 static void
-submitSyslog(uchar *buf)
+submitSyslog(uchar *buf, struct timeval *tvBoot)
 {
 	long offs = 0;
 	struct timeval tv;
-	struct sysinfo info;
 	unsigned long int timestamp = 0;
 	char name[1024];
 	char value[1024];
@@ -80,6 +90,12 @@ submitSyslog(uchar *buf)
 		sequnum = (sequnum * 10) + (*buf - '0');
 	}
 	buf++; /* skip , */
+	/* sequence numbers are contiguous, so a gap means the kernel
+	 * overwrote records before we could read them.
+	 */
+	if(lastSequnum != -1 && sequnum > lastSequnum + 1)
+		imkmsgCountOverrun(sequnum - lastSequnum - 1);
+	lastSequnum = sequnum;
 	jval = json_object_new_int(sequnum);
 	json_object_object_add(json, "sequnum", jval);
 
@@ -129,12 +145,7 @@ submitSyslog(uchar *buf)
 	}
 
 	/* calculate timestamp */
-	sysinfo(&info);
-	gettimeofday(&tv, NULL);
-
-	/* get boot time */
-	tv.tv_sec -= info.uptime;
-
+	tv = *tvBoot;
 	tv.tv_sec += timestamp / 1000000;
 	tv.tv_usec += timestamp % 1000000;
 
@@ -160,7 +171,10 @@ klogWillRun(modConfData_t *pModConf)
 	char errmsg[2048];
 	DEFiRet;
 
-	fklog = open(_PATH_KLOG, O_RDONLY, 0);
+	CHKmalloc(recBatch = malloc(KMSG_BATCH_SIZE * sizeof(*recBatch)));
+
+	/* non-blocking, so that we notice when all pending records are read */
+	fklog = open(_PATH_KLOG, O_RDONLY | O_NONBLOCK, 0);
 	if (fklog < 0) {
 		imkmsgLogIntMsg(RS_RET_ERR_OPEN_KLOG, "imkmsg: cannot open kernel log(%s): %s.",
 			_PATH_KLOG, rs_strerror_r(errno, errmsg, sizeof(errmsg)));
@@ -171,32 +185,72 @@ finalize_it:
 	RETiRet;
 }
 
+/* parse and submit the records read so far. The boot time is only
+ * computed once per batch, it is the same for all records.
+ */
+static void
+submitBatch(int nRecs)
+{
+	struct timeval tvBoot;
+	struct sysinfo info;
+	int i;
+
+	if(nRecs == 0)
+		return;
+	sysinfo(&info);
+	gettimeofday(&tvBoot, NULL);
+	tvBoot.tv_sec -= info.uptime;
+	for(i = 0 ; i < nRecs ; ++i)
+		submitSyslog(recBatch[i], &tvBoot);
+}
+
+
 /* Read kernel log while data are available, each read() reads one
- * record of printk buffer.
+ * record of printk buffer. We drain the device into recBatch without
+ * doing anything else, so that we keep up with the kernel during log
+ * storms. Records are parsed when the batch is full or no more are
+ * pending, and submitted to the main queue whenever no more are pending.
  */
 static void
 readkmsg(void)
 {
 	int i;
-	uchar pRcv[8192+1];
+	int nRecs = 0;
 	char errmsg[2048];
+	struct pollfd pfd;
 
 	for (;;) {
-		dbgprintf("imkmsg waiting for kernel log line\n");
+		if(nRecs == KMSG_BATCH_SIZE) {
+			submitBatch(nRecs);
+			nRecs = 0;
+		}
 
 		/* every read() from the opened device node receives one record of the printk buffer */
-		i = read(fklog, pRcv, 8192);
+		i = read(fklog, recBatch[nRecs], KMSG_MAX_REC);
 
 		if (i > 0) {
 			/* successful read of message of nonzero length */
-			pRcv[i] = '\0';
-		} else if (i == -EPIPE) {
+			recBatch[nRecs++][i] = '\0';
+		} else if (i < 0 && errno == EPIPE) {
+			/* the next read() returns the oldest record still present,
+			 * the number of records lost is counted via the sequence
+			 * number gap.
+			 */
 			imkmsgLogIntMsg(LOG_WARNING,
 					"imkmsg: some messages in circular buffer got overwritten");
-			continue;
+		} else if (i < 0 && errno == EAGAIN) {
+			/* all pending records read - submit them and wait for more */
+			submitBatch(nRecs);
+			nRecs = 0;
+			imkmsgFlush();
+			dbgprintf("imkmsg waiting for kernel log line\n");
+			pfd.fd = fklog;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, -1) < 0)
+				break; /* usually EINTR, the caller checks for termination */
 		} else {
 			/* something went wrong - error or zero length message */
-			if (i < 0 && errno != EINTR && errno != EAGAIN) {
+			if (i < 0 && errno != EINTR) {
 				/* error occured */
 				imkmsgLogIntMsg(LOG_ERR,
 				       "imkmsg: error reading kernel log - shutting down: %s",
@@ -205,9 +259,9 @@ readkmsg(void)
 			}
 			break;
 		}
-
-		submitSyslog(pRcv);
 	}
+	submitBatch(nRecs);
+	imkmsgFlush();
 }
 
 
@@ -219,6 +273,8 @@ rsRetVal klogAfterRun(modConfData_t *pModConf)
 	DEFiRet;
 	if(fklog != -1)
 		close(fklog);
+	free(recBatch);
+	recBatch = NULL;
 	/* Turn on logging of messages to console, but only if a log level was speficied */
 	if(pModConf->console_log_level != -1)
 		klogctl(7, NULL, 0);
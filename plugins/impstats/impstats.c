@@ -35,6 +35,9 @@
 #include <errno.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <poll.h>
 
 #include "dirty.h"
 #include "cfsysline.h"
@@ -56,6 +59,8 @@ MODULE_CNFNAME("impstats")
 #define DEFAULT_STATS_PERIOD (5 * 60)
 #define DEFAULT_FACILITY 5 /* syslog */
 #define DEFAULT_SEVERITY 6 /* info */
+#define HTTP_MAX_REQ 4096 /* max size of request line + headers we accept */
+#define HTTP_TIMEOUT 2 /* seconds a client may take to send its request */
 
 /* Module static data */
 DEF_IMOD_STATIC_DATA
@@ -83,7 +88,11 @@ struct modConfData_s {
 	statsFmtType_t statsFmt;
 	sbool bLogToSyslog;
 	sbool bResetCtrs;
+	sbool bDeltaOnly;	/* emit only counters that changed since the last interval */
 	char *logfile;
+	int httpPort;		/* port of the metrics endpoint, 0 - disabled */
+	uchar *httpAddress;	/* address to bind it to, NULL - all */
+	int httpfd;		/* listen socket of the metrics endpoint, -1 if none */
 	sbool configSetViaV2Method;
 	uchar *pszBindRuleset;		/* name of ruleset to bind to */
 };
@@ -103,7 +112,10 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "resetcounters", eCmdHdlrBinary, 0 },
 	{ "log.file", eCmdHdlrGetWord, 0 },
 	{ "format", eCmdHdlrGetWord, 0 },
-	{ "ruleset", eCmdHdlrString, 0 }
+	{ "ruleset", eCmdHdlrString, 0 },
+	{ "deltaonly", eCmdHdlrBinary, 0 },
+	{ "http.port", eCmdHdlrNonNegInt, 0 },
+	{ "http.address", eCmdHdlrGetWord, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -241,11 +253,9 @@ doStatsLine(void __attribute__((unused)) *usrptr, cstr_t *cstr)
 }
 
 
-/* the function to generate the actual statistics messages
- * rgerhards, 2010-09-09
- */
-static inline void
-generateStatsMsgs(void)
+/* update our own resource usage counters */
+static void
+updateResourceCtrs(void)
 {
 	struct rusage ru;
 	int r;
@@ -263,7 +273,199 @@ generateStatsMsgs(void)
 	st_ru_oublock = ru.ru_oublock;
 	st_ru_nvcsw = ru.ru_nvcsw;
 	st_ru_nivcsw = ru.ru_nivcsw;
-	statsobj.GetAllStatsLines(doStatsLine, NULL, runModConf->statsFmt, runModConf->bResetCtrs);
+}
+
+
+/* the function to generate the actual statistics messages
+ * rgerhards, 2010-09-09
+ */
+static inline void
+generateStatsMsgs(void)
+{
+	int8_t flags = 0;
+
+	if(runModConf->bResetCtrs)
+		flags |= STATS_FLAG_RESET;
+	if(runModConf->bDeltaOnly)
+		flags |= STATS_FLAG_DELTA;
+	updateResourceCtrs();
+	statsobj.GetAllStatsLines(doStatsLine, NULL, runModConf->statsFmt, flags);
+}
+
+
+/* ------------------------------ metrics endpoint ------------------------------
+ * A minimal HTTP server for Prometheus (and compatible) scrapers. It is run
+ * by the input thread in between the stats intervals and serves one request
+ * per connection. Only "GET /metrics" is supported, which is all scrapers
+ * need. The exposition is generated from the stats objects on each request;
+ * counters are read without locks, so scraping does not slow down message
+ * processing.
+ */
+
+/* open the listen socket, returns -1 on failure (which is logged) */
+static int
+httpOpenListener(modConfData_t *modConf)
+{
+	struct addrinfo hints;
+	struct addrinfo *res = NULL;
+	struct addrinfo *r;
+	char port[8];
+	int on = 1;
+	int fd = -1;
+	int err;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(port, sizeof(port), "%d", modConf->httpPort);
+	if((err = getaddrinfo((char*)modConf->httpAddress, port, &hints, &res)) != 0) {
+		errmsg.LogError(0, RS_RET_ERR, "impstats: http.address '%s': %s",
+				modConf->httpAddress == NULL ? "*" : (char*)modConf->httpAddress,
+				gai_strerror(err));
+		goto done;
+	}
+	/* prefer IPv6, which (usually) also accepts IPv4 when bound to any */
+	for(r = res ; r != NULL && r->ai_family != AF_INET6 ; r = r->ai_next)
+		/* just search */;
+	if(r == NULL)
+		r = res;
+	for( ; r != NULL ; r = r->ai_next) {
+		if((fd = socket(r->ai_family, r->ai_socktype | SOCK_CLOEXEC, r->ai_protocol)) == -1)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if(bind(fd, r->ai_addr, r->ai_addrlen) == 0 && listen(fd, 8) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	if(fd == -1) {
+		errmsg.LogError(errno, RS_RET_ERR, "impstats: could not listen on port %d "
+				"for the metrics endpoint", modConf->httpPort);
+	}
+done:
+	if(res != NULL)
+		freeaddrinfo(res);
+	return fd;
+}
+
+
+/* statsobj callback: collect the exposition */
+static rsRetVal
+httpCollect(void *usrptr, cstr_t *cstr)
+{
+	return rsCStrAppendStrWithLen((cstr_t*) usrptr, rsCStrGetSzStrNoNULL(cstr), cstrLen(cstr));
+}
+
+
+static void
+httpSend(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while(len > 0) {
+		n = send(fd, buf, len, MSG_NOSIGNAL);
+		if(n <= 0) {
+			if(n == -1 && errno == EINTR && glbl.GetGlobalInputTermState() == 0)
+				continue;
+			DBGPRINTF("impstats: http send failed, errno %d\n", errno);
+			return;
+		}
+		buf += n;
+		len -= (size_t) n;
+	}
+}
+
+
+static void
+httpReply(int fd, const char *status, const char *ctype, const uchar *body, size_t lenBody)
+{
+	char hdr[256];
+	int lenHdr;
+
+	lenHdr = snprintf(hdr, sizeof(hdr), "HTTP/1.0 %s\r\nContent-Type: %s\r\n"
+			  "Content-Length: %llu\r\nConnection: close\r\n\r\n",
+			  status, ctype, (unsigned long long) lenBody);
+	httpSend(fd, hdr, lenHdr);
+	httpSend(fd, (const char*) body, lenBody);
+}
+
+
+/* serve a single request on an accepted connection */
+static void
+httpServe(int fd)
+{
+	char req[HTTP_MAX_REQ + 1];
+	size_t len = 0;
+	ssize_t n;
+	struct timeval tv;
+	int bOpenMetrics;
+	cstr_t *body = NULL;
+
+	tv.tv_sec = HTTP_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	/* we only need the headers, a GET has no body */
+	while(len < HTTP_MAX_REQ) {
+		n = recv(fd, req + len, HTTP_MAX_REQ - len, 0);
+		if(n <= 0)
+			goto done; /* error, timeout or termination signal */
+		len += n;
+		req[len] = '\0';
+		if(strstr(req, "\r\n\r\n") != NULL || strstr(req, "\n\n") != NULL)
+			break;
+	}
+	req[len] = '\0';
+
+	if(strncmp(req, "GET ", 4)) {
+		httpReply(fd, "405 Method Not Allowed", "text/plain",
+			  UCHAR_CONSTANT("only GET is supported\n"), sizeof("only GET is supported\n") - 1);
+		goto done;
+	}
+	if(strncmp(req + 4, "/metrics", 8) || (req[12] != ' ' && req[12] != '?')) {
+		httpReply(fd, "404 Not Found", "text/plain",
+			  UCHAR_CONSTANT("try /metrics\n"), sizeof("try /metrics\n") - 1);
+		goto done;
+	}
+
+	/* scrapers that can do OpenMetrics say so in the Accept header */
+	bOpenMetrics = strstr(req, "application/openmetrics-text") != NULL;
+	updateResourceCtrs();
+	if(cstrConstruct(&body) != RS_RET_OK)
+		goto done;
+	if(statsobj.GetAllStatsLines(httpCollect, body,
+		bOpenMetrics ? statsFmt_OpenMetrics : statsFmt_Prometheus, 0) != RS_RET_OK) {
+		httpReply(fd, "500 Internal Server Error", "text/plain", UCHAR_CONSTANT(""), 0);
+		goto done;
+	}
+	httpReply(fd, "200 OK", bOpenMetrics
+		  ? "application/openmetrics-text; version=1.0.0; charset=utf-8"
+		  : "text/plain; version=0.0.4; charset=utf-8",
+		  rsCStrGetBufBeg(body), cstrLen(body));
+
+done:
+	if(body != NULL)
+		rsCStrDestruct(&body);
+	close(fd);
+}
+
+
+/* wait for the next stats interval, serving metrics requests meanwhile */
+static void
+httpServeUntil(time_t tNext)
+{
+	struct pollfd pfd;
+	time_t now;
+	int fd;
+
+	pfd.fd = runModConf->httpfd;
+	pfd.events = POLLIN;
+	while(glbl.GetGlobalInputTermState() == 0 && (now = time(NULL)) < tNext) {
+		if(poll(&pfd, 1, (tNext - now > 60 ? 60 : tNext - now) * 1000) <= 0)
+			continue; /* timeout, or a signal (which may be termination) */
+		if((fd = accept(runModConf->httpfd, NULL, NULL)) != -1)
+			httpServe(fd);
+	}
 }
 
 
@@ -282,6 +484,10 @@ CODESTARTbeginCnfLoad
 	loadModConf->pszBindRuleset = NULL;
 	loadModConf->bLogToSyslog = 1;
 	loadModConf->bResetCtrs = 0;
+	loadModConf->bDeltaOnly = 0;
+	loadModConf->httpPort = 0;
+	loadModConf->httpAddress = NULL;
+	loadModConf->httpfd = -1;
 	bLegacyCnfModGlobalsPermitted = 1;
 	/* init legacy config vars */
 	initConfigSettings();
@@ -335,6 +541,12 @@ CODESTARTsetModCnf
 			free(mode);
 		} else if(!strcmp(modpblk.descr[i].name, "ruleset")) {
 			loadModConf->pszBindRuleset = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(modpblk.descr[i].name, "deltaonly")) {
+			loadModConf->bDeltaOnly = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "http.port")) {
+			loadModConf->httpPort = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "http.address")) {
+			loadModConf->httpAddress = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else {
 			dbgprintf("impstats: program error, non-handled "
 			  "param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
@@ -399,10 +611,23 @@ CODESTARTcheckCnf
 				"default of %d seconds", DEFAULT_STATS_PERIOD);
 		pModConf->iStatsInterval = DEFAULT_STATS_PERIOD;
 	}
+	if(pModConf->httpPort > 65535) {
+		errmsg.LogError(0, RS_RET_PARAM_ERROR, "impstats: invalid http.port %d, "
+				"metrics endpoint disabled", pModConf->httpPort);
+		pModConf->httpPort = 0;
+	}
 	iRet = checkRuleset(pModConf);
 ENDcheckCnf
 
 
+/* the metrics port may be privileged, so we listen before dropping privileges */
+BEGINactivateCnfPrePrivDrop
+CODESTARTactivateCnfPrePrivDrop
+	if(pModConf->httpPort != 0)
+		pModConf->httpfd = httpOpenListener(pModConf);
+ENDactivateCnfPrePrivDrop
+
+
 BEGINactivateCnf
 	rsRetVal localRet;
 CODESTARTactivateCnf
@@ -449,7 +674,10 @@ BEGINfreeCnf
 CODESTARTfreeCnf
 	if(runModConf->logfd != -1)
 		close(runModConf->logfd);
+	if(runModConf->httpfd != -1)
+		close(runModConf->httpfd);
 	free(runModConf->logfile);
+	free(runModConf->httpAddress);
 ENDfreeCnf
 
 
@@ -462,7 +690,10 @@ CODESTARTrunInput
 	 * on configuration, they may not make it to the final destination...
 	 */
 	while(glbl.GetGlobalInputTermState() == 0) {
-		srSleep(runModConf->iStatsInterval, 0); /* seconds, micro seconds */
+		if(runModConf->httpfd == -1)
+			srSleep(runModConf->iStatsInterval, 0); /* seconds, micro seconds */
+		else
+			httpServeUntil(time(NULL) + runModConf->iStatsInterval);
 		DBGPRINTF("impstats: woke up, generating messages\n");
 		generateStatsMsgs();
 	}
@@ -484,6 +715,7 @@ CODESTARTqueryEtryPt
 CODEqueryEtryPt_STD_IMOD_QUERIES
 CODEqueryEtryPt_STD_CONF2_QUERIES
 CODEqueryEtryPt_STD_CONF2_setModCnf_QUERIES
+CODEqueryEtryPt_STD_CONF2_PREPRIVDROP_QUERIES
 CODEqueryEtryPt_IsCompatibleWithFeature_IF_OMOD_QUERIES
 ENDqueryEtryPt
 
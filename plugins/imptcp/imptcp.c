@@ -49,6 +49,9 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 #include <netinet/tcp.h>
 #include <stdint.h>
 #include <zlib.h>
@@ -70,7 +73,12 @@
 #include "msg.h"
 #include "statsobj.h"
 #include "ratelimit.h"
+#include "atomic.h"
 #include "net.h" /* for permittedPeers, may be removed when this is removed */
+#include "cmpr.h"
+#include "memacct.h"
+#include "netstrms.h"
+#include "netstrm.h"
 
 /* the define is from tcpsrv.h, we need to find a new (but easier!!!) abstraction layer some time ... */
 #define TCPSRV_NO_ADDTL_DELIMITER -1 /* specifies that no additional delimiter is to be used in TCP framing */
@@ -89,6 +97,12 @@ DEFobjCurrIf(datetime)
 DEFobjCurrIf(errmsg)
 DEFobjCurrIf(ruleset)
 DEFobjCurrIf(statsobj)
+DEFobjCurrIf(cmpr)
+DEFobjCurrIf(netstrms)
+DEFobjCurrIf(netstrm)
+
+static sbool bCmprIfLoaded = 0;	/* cmpr interface is only obtained if actually used */
+static sbool bNetstrmIfLoaded = 0; /* netstrm(s) interfaces are only obtained if TLS is used */
 
 /* forward references */
 static void * wrkr(void *myself);
@@ -118,13 +132,17 @@ static configSettings_t cs;
 
 struct instanceConf_s {
 	int bKeepAlive;			/* support keep-alive packets */
+	int iFastOpen;			/* TCP Fast Open queue length, 0 = off */
 	int iKeepAliveIntvl;
 	int iKeepAliveProbes;
 	int iKeepAliveTime;
 	int bEmitMsgOnClose;
 	int bSuppOctetFram;		/* support octet-counted framing? */
+	int bParseInInput;		/* parse messages in our workers, not in the main queue */
 	int iAddtlFrameDelim;
 	uint8_t compressionMode;
+	int strmCmprAlgo;		/* stream compression algorithm, CMPR_ALGO_ZLIB is built-in inflate */
+	uchar *pszStrmCmprDict;		/* stream compression dictionary file (zstd only) */
 	uchar *pszBindPort;		/* port to bind to */
 	uchar *pszBindAddr;		/* IP to bind socket to */
 	uchar *pszBindRuleset;		/* name of ruleset to bind to */
@@ -133,6 +151,10 @@ struct instanceConf_s {
 	uchar *dfltTZ;
 	int ratelimitInterval;
 	int ratelimitBurst;
+	int iStrmDrvrMode;		/* 0 - plain tcp handled by ourselfs, else via stream driver */
+	uchar *pszStrmDrvrName;		/* stream driver to use, NULL is global default */
+	uchar *pszStrmDrvrAuthMode;
+	permittedPeers_t *pPermPeers;
 	struct instanceConf_s *next;
 };
 
@@ -141,6 +163,11 @@ struct modConfData_s {
 	rsconf_t *pConf;		/* our overall config object */
 	instanceConf_t *root, *tail;
 	int wrkrMax;
+	sbool bUseUring;		/* use io_uring instead of epoll for socket I/O? */
+	sbool bShardEpoll;		/* one epoll set per worker instead of a shared one? */
+	sbool bShardLeastLoad;		/* assign sessions to least loaded shard (else round-robin) */
+	sbool bShardReusePort;		/* give each shard its own SO_REUSEPORT listeners? */
+	sbool bSessBackpressure;	/* pause heavy sessions instead of blocking in flow control? */
 	sbool configSetViaV2Method;
 };
 
@@ -149,7 +176,12 @@ static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current lo
 
 /* module-global parameters */
 static struct cnfparamdescr modpdescr[] = {
-	{ "threads", eCmdHdlrPositiveInt, 0 }
+	{ "threads", eCmdHdlrPositiveInt, 0 },
+	{ "iomode", eCmdHdlrGetWord, 0 },
+	{ "epoll.sharded", eCmdHdlrBinary, 0 },
+	{ "epoll.sharded.assign", eCmdHdlrGetWord, 0 },
+	{ "epoll.sharded.reuseport", eCmdHdlrBinary, 0 },
+	{ "sessionbackpressure", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -165,15 +197,23 @@ static struct cnfparamdescr inppdescr[] = {
 	{ "ruleset", eCmdHdlrString, 0 },
 	{ "defaulttz", eCmdHdlrString, 0 },
 	{ "supportoctetcountedframing", eCmdHdlrBinary, 0 },
+	{ "parseininput", eCmdHdlrBinary, 0 },
 	{ "notifyonconnectionclose", eCmdHdlrBinary, 0 },
 	{ "compression.mode", eCmdHdlrGetWord, 0 },
+	{ "compression.stream.algorithm", eCmdHdlrGetWord, 0 },
+	{ "compression.stream.dictionary", eCmdHdlrString, 0 },
 	{ "keepalive", eCmdHdlrBinary, 0 },
 	{ "keepalive.probes", eCmdHdlrInt, 0 },
 	{ "keepalive.time", eCmdHdlrInt, 0 },
 	{ "keepalive.interval", eCmdHdlrInt, 0 },
+	{ "tcpfastopen", eCmdHdlrNonNegInt, 0 },
 	{ "addtlframedelimiter", eCmdHdlrInt, 0 },
 	{ "ratelimit.interval", eCmdHdlrInt, 0 },
-	{ "ratelimit.burst", eCmdHdlrInt, 0 }
+	{ "ratelimit.burst", eCmdHdlrInt, 0 },
+	{ "streamdriver.mode", eCmdHdlrInt, 0 },
+	{ "streamdriver.authmode", eCmdHdlrString, 0 },
+	{ "streamdriver.name", eCmdHdlrString, 0 },
+	{ "permittedpeer", eCmdHdlrArray, 0 }
 };
 static struct cnfparamblk inppblk =
 	{ CNFPARAMBLK_VERSION,
@@ -203,6 +243,8 @@ struct ptcpsrv_s {
 	int iKeepAliveProbes;
 	int iKeepAliveTime;
 	uint8_t compressionMode;
+	int strmCmprAlgo;
+	uchar *pszStrmCmprDict;		/* shared with instanceConf, like dfltTZ */
 	uchar *pszInputName;
 	uchar *dfltTZ;
 	prop_t *pInputName;		/* InputName in (fast to process) property format */
@@ -211,9 +253,16 @@ struct ptcpsrv_s {
 	ptcpsess_t *pSess;		/* root of our sessions */
 	pthread_mutex_t mutSessLst;
 	sbool bKeepAlive;		/* support keep-alive packets */
+	int iFastOpen;			/* TCP Fast Open queue length, 0 = off */
 	sbool bEmitMsgOnClose;
 	sbool bSuppOctetFram;
+	sbool bParseInInput;
 	ratelimit_t *ratelimiter;
+	int iStrmDrvrMode;		/* the stream driver settings are shared with instanceConf */
+	uchar *pszStrmDrvrName;
+	uchar *pszStrmDrvrAuthMode;
+	permittedPeers_t *pPermPeers;
+	netstrms_t *pNS;		/* netstream subsystem, only if a stream driver is used */
 };
 
 /* the ptcp session object. Describes a single active session.
@@ -223,10 +272,18 @@ struct ptcpsess_s {
 	ptcplstn_t *pLstn;	/* our listener */
 	ptcpsess_t *prev, *next;
 	int sock;
+	netstrm_t *pStrm;	/* stream driver session (sock belongs to it), NULL for plain tcp */
+	int iShard;		/* epoll shard we are registered with, -1 if none */
 	epolld_t *epd;
+	sbool bPaused;		/* read interest removed by session backpressure */
+	ptcpsess_t *pNextPaused;
+	unsigned bpEpoch;	/* backpressure window nBytesWnd belongs to */
+	unsigned nBytesWnd;	/* bytes received in that window */
 	sbool bzInitDone; /* did we do an init of zstrm already? */
 	z_stream zstrm;	/* zip stream to use for tcp compression */
+	cmprCtx_t *pCmprCtx;	/* context for non-zlib stream decompression */
 	uint8_t compressionMode;
+	int strmCmprAlgo;	/* copy from server, to speed up access */
 //--- from tcps_sess.h
 	int iMsg;		 /* index of next char to store in msg */
 	int bAtStrtOfFram;	/* are we at the very beginning of a new frame? */
@@ -238,7 +295,8 @@ struct ptcpsess_s {
 	} inputState;		/* our current state */
 	int iOctetsRemain;	/* Number of Octets remaining in message */
 	TCPFRAMINGMODE eFraming;
-	uchar *pMsg;		/* message (fragment) received */
+	uchar *pMsg;		/* message (fragment) received, see bufPool */
+	sbool bPooledBuf;	/* pMsg is a pool buffer (else carry-over or NULL) */
 	prop_t *peerName;	/* host name we received messages from */
 	prop_t *peerIP;
 //--- END from tcps_sess.h
@@ -251,11 +309,14 @@ struct ptcplstn_s {
 	ptcpsrv_t *pSrv;	/* our server */
 	ptcplstn_t *prev, *next;
 	int sock;
+	netstrm_t *pStrm;	/* stream driver listener (sock belongs to it), NULL for plain tcp */
+	int iShard;		/* shard this (SO_REUSEPORT) listener belongs to, -1 if none */
 	sbool bSuppOctetFram;
 	epolld_t *epd;
 	statsobj_t *stats;	/* listener stats */
 	intctr_t rcvdBytes;
 	intctr_t rcvdDecompressed;
+	intctr_t ctrPaused;	/* sessions paused by backpressure */
 	STATSCOUNTER_DEF(ctrSubmit, mutCtrSubmit)
 };
 
@@ -273,6 +334,28 @@ static pthread_mutex_t wrkrMut;
 static pthread_cond_t wrkrIdle;
 static int wrkrRunning;
 
+#ifdef HAVE_LIBURING
+/* In io_uring mode, each worker owns a ring of its own. All rings carry a
+ * multishot accept for every listener, so the kernel spreads new sessions
+ * over the rings. A session stays on the ring that accepted it and receives
+ * via multishot recv out of the ring's provided buffer group, so no locking
+ * is required on the I/O path.
+ */
+#define URING_ENTRIES 256
+#define URING_NBUFS 256		/* number of provided buffers, must be a power of two */
+#define URING_BUFSIZE (16*1024)
+static struct uringWrkr_s {
+	pthread_t tid;
+	struct io_uring ring;
+	struct io_uring_buf_ring *bufRing;
+	char *bufs;		/* backing store for the provided buffers */
+	int bgid;		/* buffer group id */
+	sbool bThrdStarted;
+	long long unsigned numCQEs;	/* how many completions were processed */
+} *uringWrkrs = NULL;
+static int nUringWrkrs = 0;
+#endif
+
 
 /* type of object stored in epoll descriptor */
 typedef enum {
@@ -286,6 +369,7 @@ typedef enum {
 struct epolld_s {
 	epolld_type_t typ;
 	void *ptr;
+	int efd;		/* epoll set we are registered with, -1 if none */
 	struct epoll_event ev;
 };
 
@@ -293,19 +377,231 @@ struct epolld_s {
 /* global data */
 pthread_attr_t wrkrThrdAttr;	/* Attribute for session threads; read only after startup */
 static ptcpsrv_t *pSrvRoot = NULL;
-static int epollfd = -1;			/* (sole) descriptor for epoll */
+static int epollfd = -1;			/* main descriptor for epoll (listeners only if sharded) */
+
+/* If epoll sharding is enabled, each worker thread runs its own epoll set
+ * for its sessions, so data events do not contend on a single instance.
+ * The main epollfd then only carries the listeners; it is served by the
+ * input thread, which assigns new sessions to shards. With reuseport,
+ * each shard additionally has listeners of its own and keeps the sessions
+ * accepted there.
+ */
+static struct epollShard_s {
+	int efd;
+	pthread_t tid;
+	int nSess;		/* sessions on this shard, for least-load assignment */
+	sbool bThrdStarted;
+	long long unsigned numEvents;	/* how many events were processed */
+} shards[16];
+static int nShards = 0;		/* 0 means sharding is not active */
+static int shardNext = 0;	/* next shard for round-robin assignment */
+DEF_ATOMIC_HELPER_MUT(mutShardSess);
 static int iMaxLine; /* maximum size of a single message */
 
+/* Session backpressure. Without it, flow control blocks the worker that
+ * submits while the queue is above its light delay mark, which stalls all
+ * sessions served by that worker. With it, a session that sent more than
+ * its fair share during the last second is paused instead once the queue
+ * reaches the light delay mark: its read interest is removed from epoll, so
+ * the TCP window pushes back on that sender only. The input thread resumes
+ * paused sessions when their queue is below the low watermark. Flow control
+ * is still in place as the last resort.
+ * The byte counters are not protected by mutexes; we accept that they may
+ * not be 100% correct.
+ */
+#define BP_CHECK_INTERVAL 100	/* ms between checks for sessions to resume */
+static pthread_mutex_t mutPaused;
+static ptcpsess_t *pPausedRoot = NULL;
+static volatile unsigned bpEpoch = 1;	/* current one-second window */
+static unsigned bpBytesWnd;	/* bytes received by all sessions in current window */
+static unsigned bpSessWnd;	/* sessions that received data in current window */
+static volatile unsigned bpFairShare;	/* bytes per session in last window, 0 - unknown */
+static time_t bpTtEpoch;
+
+/* Message assembly buffers. A session holds a full-sized (iMaxLine) buffer
+ * from this pool only while it processes received data. In between, a session
+ * keeps just its partial frame (if any) in a right-sized carry-over buffer,
+ * so idle sessions cost almost no memory.
+ */
+#define BUFPOOL_MAX_IDLE 32
+static struct {
+	pthread_mutex_t mut;
+	uchar *idle[BUFPOOL_MAX_IDLE];
+	int nIdle;
+	statsobj_t *stats;
+	/* the counters are modified under mut only */
+	intctr_t ctrGets;		/* buffers handed out */
+	intctr_t ctrAllocs;		/* of those, buffers newly allocated */
+	intctr_t nInUse;		/* pool buffers currently held by sessions */
+	intctr_t nCarryOver;		/* sessions holding a partial frame */
+	intctr_t bytesCarryOver;	/* total size of the partial frames */
+} bufPool;
+
 /* forward definitions */
 static rsRetVal resetConfigVariables(uchar __attribute__((unused)) *pp, void __attribute__((unused)) *pVal);
-static rsRetVal addLstn(ptcpsrv_t *pSrv, int sock, int isIPv6);
+static rsRetVal addLstn(ptcpsrv_t *pSrv, int sock, int isIPv6, int iShard, netstrm_t *pStrm);
+
+
+/* buffer pool handling */
+static rsRetVal
+bufPoolInit(void)
+{
+	DEFiRet;
+
+	pthread_mutex_init(&bufPool.mut, NULL);
+	bufPool.nIdle = 0;
+	bufPool.ctrGets = bufPool.ctrAllocs = 0;
+	bufPool.nInUse = bufPool.nCarryOver = bufPool.bytesCarryOver = 0;
+	CHKiRet(statsobj.Construct(&bufPool.stats));
+	CHKiRet(statsobj.SetName(bufPool.stats, UCHAR_CONSTANT("imptcp-bufpool")));
+	CHKiRet(statsobj.AddCounter(bufPool.stats, UCHAR_CONSTANT("gets"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &bufPool.ctrGets));
+	CHKiRet(statsobj.AddCounter(bufPool.stats, UCHAR_CONSTANT("allocs"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &bufPool.ctrAllocs));
+	CHKiRet(statsobj.AddCounter(bufPool.stats, UCHAR_CONSTANT("inuse"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &bufPool.nInUse));
+	CHKiRet(statsobj.AddCounter(bufPool.stats, UCHAR_CONSTANT("carryover.sessions"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &bufPool.nCarryOver));
+	CHKiRet(statsobj.AddCounter(bufPool.stats, UCHAR_CONSTANT("carryover.bytes"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &bufPool.bytesCarryOver));
+	CHKiRet(statsobj.ConstructFinalize(bufPool.stats));
+
+finalize_it:
+	RETiRet;
+}
+
+static void
+bufPoolDestruct(void)
+{
+	while(bufPool.nIdle > 0) {
+		free(bufPool.idle[--bufPool.nIdle]);
+		memacctSub(MEMACCT_IMPTCP, iMaxLine);
+	}
+	if(bufPool.stats != NULL)
+		statsobj.Destruct(&bufPool.stats);
+	pthread_mutex_destroy(&bufPool.mut);
+}
+
+/* make sure the session has a full-sized assembly buffer. A partial
+ * frame from the carry-over buffer is moved into it.
+ */
+static rsRetVal
+sessAcquireBuf(ptcpsess_t *pSess)
+{
+	uchar *buf = NULL;
+	DEFiRet;
+
+	if(pSess->bPooledBuf)
+		FINALIZE;
+
+	pthread_mutex_lock(&bufPool.mut);
+	if(bufPool.nIdle > 0)
+		buf = bufPool.idle[--bufPool.nIdle];
+	else
+		++bufPool.ctrAllocs;
+	++bufPool.ctrGets;
+	++bufPool.nInUse;
+	if(pSess->pMsg != NULL) {
+		--bufPool.nCarryOver;
+		bufPool.bytesCarryOver -= pSess->iMsg;
+	}
+	pthread_mutex_unlock(&bufPool.mut);
+
+	if(buf == NULL) {
+		if((buf = malloc(iMaxLine * sizeof(uchar))) == NULL) {
+			pthread_mutex_lock(&bufPool.mut);
+			--bufPool.nInUse;
+			if(pSess->pMsg != NULL) {
+				++bufPool.nCarryOver;
+				bufPool.bytesCarryOver += pSess->iMsg;
+			}
+			pthread_mutex_unlock(&bufPool.mut);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		memacctAdd(MEMACCT_IMPTCP, iMaxLine);
+	}
+
+	if(pSess->pMsg != NULL) {
+		memcpy(buf, pSess->pMsg, pSess->iMsg);
+		free(pSess->pMsg);
+		memacctSub(MEMACCT_IMPTCP, pSess->iMsg);
+	}
+	pSess->pMsg = buf;
+	pSess->bPooledBuf = 1;
+
+finalize_it:
+	RETiRet;
+}
+
+/* hand the assembly buffer back to the pool, keeping only the partial
+ * frame (if any). If the carry-over cannot be allocated, the session
+ * simply keeps the pool buffer until next time.
+ */
+static void
+sessReleaseBuf(ptcpsess_t *pSess)
+{
+	uchar *carry = NULL;
+	uchar *buf;
+
+	if(!pSess->bPooledBuf)
+		return;
+
+	if(pSess->iMsg > 0) {
+		if((carry = malloc(pSess->iMsg)) == NULL)
+			return;
+		memcpy(carry, pSess->pMsg, pSess->iMsg);
+		memacctAdd(MEMACCT_IMPTCP, pSess->iMsg);
+	}
+
+	buf = pSess->pMsg;
+	pthread_mutex_lock(&bufPool.mut);
+	if(bufPool.nIdle < BUFPOOL_MAX_IDLE) {
+		bufPool.idle[bufPool.nIdle++] = buf;
+		buf = NULL;
+	}
+	--bufPool.nInUse;
+	if(carry != NULL) {
+		++bufPool.nCarryOver;
+		bufPool.bytesCarryOver += pSess->iMsg;
+	}
+	pthread_mutex_unlock(&bufPool.mut);
+	if(buf != NULL) {
+		free(buf);
+		memacctSub(MEMACCT_IMPTCP, iMaxLine);
+	}
+
+	pSess->pMsg = carry;
+	pSess->bPooledBuf = 0;
+}
+
+/* free whatever assembly buffer the session holds */
+static void
+sessFreeBuf(ptcpsess_t *pSess)
+{
+	if(pSess->pMsg == NULL)
+		return;
+	pthread_mutex_lock(&bufPool.mut);
+	if(pSess->bPooledBuf) {
+		--bufPool.nInUse;
+	} else {
+		--bufPool.nCarryOver;
+		bufPool.bytesCarryOver -= pSess->iMsg;
+	}
+	pthread_mutex_unlock(&bufPool.mut);
+	memacctSub(MEMACCT_IMPTCP, pSess->bPooledBuf ? (uint64) iMaxLine : (uint64) pSess->iMsg);
+	free(pSess->pMsg);
+	pSess->pMsg = NULL;
+	pSess->bPooledBuf = 0;
+}
 
 
 /* some simple constructors/destructors */
 static void
 destructSess(ptcpsess_t *pSess)
 {
-	free(pSess->pMsg);
+	sessFreeBuf(pSess);
+	if(pSess->pCmprCtx != NULL)
+		cmpr.Destruct(&pSess->pCmprCtx);
 	free(pSess->epd);
 	prop.Destruct(&pSess->peerName);
 	prop.Destruct(&pSess->peerIP);
@@ -319,6 +615,8 @@ static void
 destructSrv(ptcpsrv_t *pSrv)
 {
 	ratelimitDestruct(pSrv->ratelimiter);
+	if(pSrv->pNS != NULL)
+		netstrms.Destruct(&pSrv->pNS);
 	prop.Destruct(&pSrv->pInputName);
 	pthread_mutex_destroy(&pSrv->mutSessLst);
 	free(pSrv->pszInputName);
@@ -332,6 +630,108 @@ destructSrv(ptcpsrv_t *pSrv)
  */
 
 
+/* create, bind and listen on a single listen socket for the given address.
+ * Returns the socket or -1 if it could not be set up.
+ */
+static int
+createLstnSock(struct addrinfo *r, sbool bReusePort, int iFastOpen, int *pIsIPv6)
+{
+	int sock;
+	int sockflags;
+	int on = 1;
+
+	sock = socket(r->ai_family, r->ai_socktype, r->ai_protocol);
+	if(sock < 0) {
+		if(!(r->ai_family == PF_INET6 && errno == EAFNOSUPPORT))
+			DBGPRINTF("error %d creating tcp listen socket", errno);
+			/* it is debatable if PF_INET with EAFNOSUPPORT should
+			 * also be ignored...
+			 */
+		return -1;
+	}
+
+	if(r->ai_family == AF_INET6) {
+		*pIsIPv6 = 1;
+#ifdef IPV6_V6ONLY
+		if(setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY,
+		      (char *)&on, sizeof (on)) < 0) {
+			goto fail;
+		}
+#endif
+	} else {
+		*pIsIPv6 = 0;
+	}
+	if(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *) &on, sizeof(on)) < 0 ) {
+		DBGPRINTF("error %d setting tcp socket option\n", errno);
+		goto fail;
+	}
+#ifdef SO_REUSEPORT
+	if(bReusePort && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (char *) &on, sizeof(on)) < 0 ) {
+		DBGPRINTF("error %d setting SO_REUSEPORT on tcp socket\n", errno);
+		goto fail;
+	}
+#endif
+
+	/* We use non-blocking IO! */
+	if((sockflags = fcntl(sock, F_GETFL)) != -1) {
+		sockflags |= O_NONBLOCK;
+		/* SETFL could fail too, so get it caught by the subsequent
+		 * error check.
+		 */
+		sockflags = fcntl(sock, F_SETFL, sockflags);
+	}
+	if(sockflags == -1) {
+		DBGPRINTF("error %d setting fcntl(O_NONBLOCK) on tcp socket", errno);
+		goto fail;
+	}
+
+	/* We need to enable BSD compatibility. Otherwise an attacker
+	 * could flood our log files by sending us tons of ICMP errors.
+	 */
+#ifndef BSD
+	if(net.should_use_so_bsdcompat()) {
+		if (setsockopt(sock, SOL_SOCKET, SO_BSDCOMPAT,
+				(char *) &on, sizeof(on)) < 0) {
+			errmsg.LogError(errno, NO_ERRCODE, "TCP setsockopt(BSDCOMPAT)");
+			goto fail;
+		}
+	}
+#endif
+
+	if( (bind(sock, r->ai_addr, r->ai_addrlen) < 0)
+#ifndef IPV6_V6ONLY
+	     && (errno != EADDRINUSE)
+#endif
+	   ) {
+		/* TODO: check if *we* bound the socket - else we *have* an error! */
+		char errStr[1024];
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		dbgprintf("error %d while binding tcp socket: %s\n", errno, errStr);
+		goto fail;
+	}
+
+#ifdef TCP_FASTOPEN
+	/* not fatal: the socket works fine without, clients just do a regular handshake */
+	if(iFastOpen > 0 && setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN,
+				       &iFastOpen, sizeof(iFastOpen)) < 0) {
+		errmsg.LogError(errno, NO_ERRCODE, "imptcp: could not enable TCP Fast Open "
+				"on listen socket, continuing without");
+	}
+#endif
+
+	if(listen(sock, 511) < 0) {
+		DBGPRINTF("tcp listen error %d, suspending\n", errno);
+		goto fail;
+	}
+
+	return sock;
+
+fail:
+	close(sock);
+	return -1;
+}
+
+
 /* Start up a server. That means all of its listeners are created.
  * Does NOT yet accept/process any incoming data (but binds ports). Hint: this
  * code is to be executed before dropping privileges.
@@ -340,10 +740,11 @@ static rsRetVal
 startupSrv(ptcpsrv_t *pSrv)
 {
 	DEFiRet;
-        int error, maxs, on = 1;
+        int error, maxs;
 	int sock = -1;
 	int numSocks;
-	int sockflags;
+	int i;
+	sbool bReusePort;
         struct addrinfo hints, *res = NULL, *r;
 	uchar *lstnIP;
 	int isIPv6 = 0;
@@ -368,96 +769,23 @@ startupSrv(ptcpsrv_t *pSrv)
 		/* EMPTY */;
 
         numSocks = 0;   /* num of sockets counter at start of array */
+	bReusePort = runModConf->bShardReusePort && nShards > 0;
 	for(r = res; r != NULL ; r = r->ai_next) {
-               sock = socket(r->ai_family, r->ai_socktype, r->ai_protocol);
-        	if(sock < 0) {
-			if(!(r->ai_family == PF_INET6 && errno == EAFNOSUPPORT))
-				DBGPRINTF("error %d creating tcp listen socket", errno);
-				/* it is debatable if PF_INET with EAFNOSUPPORT should
-				 * also be ignored...
-				 */
-                        continue;
-                }
-
-                if(r->ai_family == AF_INET6) {
-			isIPv6 = 1;
-#ifdef IPV6_V6ONLY
-                	int iOn = 1;
-			if(setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY,
-			      (char *)&iOn, sizeof (iOn)) < 0) {
-				close(sock);
-				sock = -1;
-				continue;
-                	}
-#endif
-                } else {
-			isIPv6 = 0;
-		}
-       		if(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *) &on, sizeof(on)) < 0 ) {
-			DBGPRINTF("error %d setting tcp socket option\n", errno);
-                        close(sock);
-			sock = -1;
-			continue;
-		}
-
-		/* We use non-blocking IO! */
-		if((sockflags = fcntl(sock, F_GETFL)) != -1) {
-			sockflags |= O_NONBLOCK;
-			/* SETFL could fail too, so get it caught by the subsequent
-			 * error check.
-			 */
-			sockflags = fcntl(sock, F_SETFL, sockflags);
-		}
-		if(sockflags == -1) {
-			DBGPRINTF("error %d setting fcntl(O_NONBLOCK) on tcp socket", errno);
-                        close(sock);
-			sock = -1;
-			continue;
-		}
-
-
-
-		/* We need to enable BSD compatibility. Otherwise an attacker
-		 * could flood our log files by sending us tons of ICMP errors.
-		 */
-#ifndef BSD	
-		if(net.should_use_so_bsdcompat()) {
-			if (setsockopt(sock, SOL_SOCKET, SO_BSDCOMPAT,
-					(char *) &on, sizeof(on)) < 0) {
-				errmsg.LogError(errno, NO_ERRCODE, "TCP setsockopt(BSDCOMPAT)");
-                                close(sock);
-				sock = -1;
-				continue;
-			}
-		}
-#endif
-
-	        if( (bind(sock, r->ai_addr, r->ai_addrlen) < 0)
-#ifndef IPV6_V6ONLY
-		     && (errno != EADDRINUSE)
-#endif
-	           ) {
-			/* TODO: check if *we* bound the socket - else we *have* an error! */
-			char errStr[1024];
-			rs_strerror_r(errno, errStr, sizeof(errStr));
-                        dbgprintf("error %d while binding tcp socket: %s\n", errno, errStr);
-                	close(sock);
-			sock = -1;
-                        continue;
-                }
-
-		if(listen(sock, 511) < 0) {
-			DBGPRINTF("tcp listen error %d, suspending\n", errno);
-			close(sock);
-			sock = -1;
+		if((sock = createLstnSock(r, bReusePort, pSrv->iFastOpen, &isIPv6)) == -1)
 			continue;
-		}
 
 		/* if we reach this point, we were able to obtain a valid socket, so we can
 		 * create our listener object. -- rgerhards, 2010-08-10
 		 */
-		CHKiRet(addLstn(pSrv, sock, isIPv6));
+		CHKiRet(addLstn(pSrv, sock, isIPv6, -1, NULL));
 		++numSocks;
+
+		/* duplicates for the epoll shards, the kernel balances between them */
+		for(i = 0 ; bReusePort && i < nShards ; ++i) {
+			if((sock = createLstnSock(r, bReusePort, pSrv->iFastOpen, &isIPv6)) == -1)
+				continue;
+			CHKiRet(addLstn(pSrv, sock, isIPv6, i, NULL));
+		}
 	}
 
 	if(numSocks != maxs)
@@ -482,6 +810,59 @@ finalize_it:
 }
 
 
+/* callback for netstrm.LstnInit(), adds a stream driver listener. The
+ * stream still belongs to the caller if we fail.
+ */
+static rsRetVal
+addStrmLstn(void *pUsr, netstrm_t *pStrm)
+{
+	ptcpsrv_t *pSrv = (ptcpsrv_t*) pUsr;
+	struct sockaddr_storage addr;
+	socklen_t addrlen = sizeof(addr);
+	int sock;
+	DEFiRet;
+
+	CHKiRet(netstrm.GetSock(pStrm, &sock));
+	if(getsockname(sock, (struct sockaddr*) &addr, &addrlen) != 0)
+		addr.ss_family = AF_INET; /* only used for the stats name */
+	CHKiRet(addLstn(pSrv, sock, addr.ss_family == AF_INET6, -1, pStrm));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* Start up a server that uses a stream driver (TLS). The listen sockets
+ * are created by the driver, so there are no per-shard SO_REUSEPORT
+ * duplicates. Sessions are still spread over the shards on accept.
+ */
+static rsRetVal
+startupStrmSrv(ptcpsrv_t *pSrv)
+{
+	DEFiRet;
+
+	DBGPRINTF("imptcp: creating stream driver listener on server '%s', port %s, mode %d\n",
+		  pSrv->lstnIP == NULL ? "" : (char*)pSrv->lstnIP, pSrv->port, pSrv->iStrmDrvrMode);
+	CHKiRet(netstrms.Construct(&pSrv->pNS));
+	if(pSrv->pszStrmDrvrName != NULL)
+		CHKiRet(netstrms.SetDrvrName(pSrv->pNS, pSrv->pszStrmDrvrName));
+	CHKiRet(netstrms.SetDrvrMode(pSrv->pNS, pSrv->iStrmDrvrMode));
+	if(pSrv->pszStrmDrvrAuthMode != NULL)
+		CHKiRet(netstrms.SetDrvrAuthMode(pSrv->pNS, pSrv->pszStrmDrvrAuthMode));
+	if(pSrv->pPermPeers != NULL)
+		CHKiRet(netstrms.SetDrvrPermPeers(pSrv->pNS, pSrv->pPermPeers));
+	CHKiRet(netstrms.SetDrvrFastOpen(pSrv->pNS, pSrv->iFastOpen));
+	CHKiRet(netstrms.ConstructFinalize(pSrv->pNS));
+	/* the session max is only used to size the listen backlog; 5000
+	 * gives about the same backlog as our own listen sockets.
+	 */
+	CHKiRet(netstrm.LstnInit(pSrv->pNS, pSrv, addStrmLstn, pSrv->port, pSrv->lstnIP, 5000));
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* Set pRemHost based on the address provided. This is to be called upon accept()ing
  * a connection request. It must be provided by the socket we received the
  * message on as well as a NI_MAXHOST size large character buffer for the FQDN.
@@ -616,31 +997,19 @@ finalize_it:
 }
 
 
-/* accept an incoming connection request
- * rgerhards, 2008-04-22
+/* set up a freshly accepted socket: keep-alive, peer names and
+ * non-blocking mode. On error, the caller must close the socket.
  */
 static rsRetVal
-AcceptConnReq(ptcplstn_t *pLstn, int *newSock, prop_t **peerName, prop_t **peerIP)
+setupAcceptedSock(ptcplstn_t *pLstn, int iNewSock, struct sockaddr *pAddr, prop_t **peerName, prop_t **peerIP)
 {
 	int sockflags;
-	struct sockaddr_storage addr;
-	socklen_t addrlen = sizeof(addr);
-	int iNewSock = -1;
-
 	DEFiRet;
 
-	iNewSock = accept(pLstn->sock, (struct sockaddr*) &addr, &addrlen);
-	if(iNewSock < 0) {
-		if(errno == EAGAIN || errno == EWOULDBLOCK)
-			ABORT_FINALIZE(RS_RET_NO_MORE_DATA);
-		ABORT_FINALIZE(RS_RET_ACCEPT_ERR);
-	}
-
 	if(pLstn->pSrv->bKeepAlive)
 		EnableKeepAlive(pLstn, iNewSock);/* we ignore errors, best to do! */
 
-	
-	CHKiRet(getPeerNames(peerName, peerIP, (struct sockaddr*) &addr));
+	CHKiRet(getPeerNames(peerName, peerIP, pAddr));
 
 	/* set the new socket to non-blocking IO */
 	if((sockflags = fcntl(iNewSock, F_GETFL)) != -1) {
@@ -655,6 +1024,31 @@ AcceptConnReq(ptcplstn_t *pLstn, int *newSock, prop_t **peerName, prop_t **peerI
 		ABORT_FINALIZE(RS_RET_IO_ERROR);
 	}
 
+finalize_it:
+	RETiRet;
+}
+
+
+/* accept an incoming connection request
+ * rgerhards, 2008-04-22
+ */
+static rsRetVal
+AcceptConnReq(ptcplstn_t *pLstn, int *newSock, prop_t **peerName, prop_t **peerIP)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen = sizeof(addr);
+	int iNewSock = -1;
+
+	DEFiRet;
+
+	iNewSock = accept(pLstn->sock, (struct sockaddr*) &addr, &addrlen);
+	if(iNewSock < 0) {
+		if(errno == EAGAIN || errno == EWOULDBLOCK)
+			ABORT_FINALIZE(RS_RET_NO_MORE_DATA);
+		ABORT_FINALIZE(RS_RET_ACCEPT_ERR);
+	}
+
+	CHKiRet(setupAcceptedSock(pLstn, iNewSock, (struct sockaddr*) &addr, peerName, peerIP));
 	*newSock = iNewSock;
 
 finalize_it:
@@ -700,6 +1094,8 @@ doSubmitMsg(ptcpsess_t *pThis, struct syslogTime *stTime, time_t ttGenTime, mult
 	if(pSrv->dfltTZ != NULL)
 		MsgSetDfltTZ(pMsg, (char*) pSrv->dfltTZ);
 	pMsg->msgFlags  = NEEDS_PARSING | PARSE_HOSTNAME;
+	if(pSrv->bParseInInput)
+		pMsg->msgFlags |= PARSE_IN_INPUT;
 	MsgSetRcvFrom(pMsg, pThis->peerName);
 	CHKiRet(MsgSetRcvFromIP(pMsg, pThis->peerIP));
 	MsgSetRuleset(pMsg, pSrv->pRuleset);
@@ -808,6 +1204,68 @@ processDataRcvd(ptcpsess_t *pThis, char c, struct syslogTime *stTime, time_t ttG
 }
 
 
+/* Fast path for the body of a frame, called in state eInMsg only. Instead
+ * of running the state machine for each character, we locate the next frame
+ * delimiter via memchr() (or use the octet count) and copy everything in
+ * front of it in one go. The result is the same as with processDataRcvd(),
+ * including splitting of oversize messages.
+ * EXTRACT from tcps_sess.c
+ * Returns the number of bytes consumed. 0 means the caller must use the
+ * per-character state machine (done for an invalid octet count).
+ */
+static inline size_t
+processDataRcvdBulk(ptcpsess_t *pThis, char *pData, size_t iLen,
+		    struct syslogTime *stTime, time_t ttGenTime, multi_submit_t *pMultiSub)
+{
+	char *const pStart = pData;
+	char *pStop;
+	char *pDelim = NULL;
+	size_t n;
+
+	if(pThis->eFraming == TCP_FRAMING_OCTET_COUNTING) {
+		if(pThis->iOctetsRemain < 1)
+			return 0;
+		pStop = pData + (((size_t) pThis->iOctetsRemain < iLen) ? (size_t) pThis->iOctetsRemain : iLen);
+	} else {
+		pDelim = memchr(pData, '\n', iLen);
+		if(pThis->pLstn->pSrv->iAddtlFrameDelim != TCPSRV_NO_ADDTL_DELIMITER) {
+			pStop = memchr(pData, pThis->pLstn->pSrv->iAddtlFrameDelim,
+				       ((pDelim == NULL) ? iLen : (size_t) (pDelim - pData)));
+			if(pStop != NULL)
+				pDelim = pStop;
+		}
+		pStop = (pDelim == NULL) ? pData + iLen : pDelim;
+	}
+
+	while(pData < pStop) {
+		if(pThis->iMsg >= iMaxLine) {
+			DBGPRINTF("error: message received is larger than max msg size, we split it\n");
+			doSubmitMsg(pThis, stTime, ttGenTime, pMultiSub);
+		}
+		n = pStop - pData;
+		if(n > (size_t) (iMaxLine - pThis->iMsg))
+			n = iMaxLine - pThis->iMsg;
+		memcpy(pThis->pMsg + pThis->iMsg, pData, n);
+		pThis->iMsg += n;
+		pData += n;
+	}
+
+	if(pThis->eFraming == TCP_FRAMING_OCTET_COUNTING) {
+		pThis->iOctetsRemain -= pData - pStart;
+		if(pThis->iOctetsRemain < 1) {
+			doSubmitMsg(pThis, stTime, ttGenTime, pMultiSub);
+			pThis->inputState = eAtStrtFram;
+		}
+	} else if(pDelim != NULL) {
+		doSubmitMsg(pThis, stTime, ttGenTime, pMultiSub);
+		pThis->inputState = eAtStrtFram;
+		++pData; /* the delimiter itself */
+	}
+
+	return pData - pStart;
+}
+
+
 /* Processes the data received via a TCP session. If there
  * is no other way to handle it, data is discarded.
  * Input parameter data is the data received, iLen is its
@@ -830,6 +1288,7 @@ DataRcvdUncompressed(ptcpsess_t *pThis, char *pData, size_t iLen, struct syslogT
 	multi_submit_t multiSub;
 	msg_t *pMsgs[CONF_NUM_MULTISUB];
 	char *pEnd;
+	size_t nUsed;
 	DEFiRet;
 
 	assert(pData != NULL);
@@ -845,6 +1304,12 @@ DataRcvdUncompressed(ptcpsess_t *pThis, char *pData, size_t iLen, struct syslogT
 	pEnd = pData + iLen; /* this is one off, which is intensional */
 
 	while(pData < pEnd) {
+		if(   pThis->inputState == eInMsg
+		   && (nUsed = processDataRcvdBulk(pThis, pData, pEnd - pData,
+						   stTime, ttGenTime, &multiSub)) > 0) {
+			pData += nUsed;
+			continue;
+		}
 		CHKiRet(processDataRcvd(pThis, *pData++, stTime, ttGenTime, &multiSub));
 	}
 
@@ -854,6 +1319,40 @@ finalize_it:
 	RETiRet;
 }
 
+/* stream decompression via the generic compression layer (zstd, lz4).
+ * If buf is NULL, only pending output is drained.
+ */
+static rsRetVal
+DataRcvdCmpr(ptcpsess_t *pThis, char *buf, size_t len, struct syslogTime *stTime, time_t ttGenTime)
+{
+	const uchar *pIn;
+	size_t lenIn;
+	uchar *pOut;
+	size_t lenOut;
+	uchar zipBuf[64*1024];
+	DEFiRet;
+
+	if(pThis->pCmprCtx == NULL) {
+		CHKiRet(cmpr.Construct(&pThis->pCmprCtx, pThis->pLstn->pSrv->strmCmprAlgo, 1, -1,
+				       pThis->pLstn->pSrv->pszStrmCmprDict));
+	}
+	pIn = (uchar*) buf;
+	lenIn = len;
+	do {
+		pOut = zipBuf;
+		lenOut = sizeof(zipBuf);
+		CHKiRet(cmpr.Process(pThis->pCmprCtx, &pIn, &lenIn, &pOut, &lenOut, CMPR_OP_RUN));
+		if(lenOut != sizeof(zipBuf)) {
+			pThis->pLstn->rcvdDecompressed += sizeof(zipBuf) - lenOut;
+			CHKiRet(DataRcvdUncompressed(pThis, (char*)zipBuf, sizeof(zipBuf) - lenOut,
+						     stTime, ttGenTime));
+		}
+	} while(lenOut == 0);
+
+finalize_it:
+	RETiRet;
+}
+
 static rsRetVal
 DataRcvdCompressed(ptcpsess_t *pThis, char *buf, size_t len)
 {
@@ -870,6 +1369,11 @@ DataRcvdCompressed(ptcpsess_t *pThis, char *buf, size_t len)
 	datetime.getCurrTime(&stTime, &ttGenTime);
 	outtotal = 0;
 
+	if(pThis->strmCmprAlgo != CMPR_ALGO_ZLIB) {
+		iRet = DataRcvdCmpr(pThis, buf, len, &stTime, ttGenTime);
+		FINALIZE;
+	}
+
 	if(!pThis->bzInitDone) {
 		/* allocate deflate state */
 		pThis->zstrm.zalloc = Z_NULL;
@@ -912,10 +1416,13 @@ DataRcvd(ptcpsess_t *pThis, char *pData, size_t iLen)
 	struct syslogTime stTime;
 	DEFiRet;
 	pThis->pLstn->rcvdBytes += iLen;
+	CHKiRet(sessAcquireBuf(pThis));
 	if(pThis->compressionMode >= COMPRESS_STREAM_ALWAYS)
 		iRet =  DataRcvdCompressed(pThis, pData, iLen);
 	else
 		iRet =  DataRcvdUncompressed(pThis, pData, iLen, &stTime, 0);
+	sessReleaseBuf(pThis);
+finalize_it:
 	RETiRet;
 }
 
@@ -940,7 +1447,7 @@ initConfigSettings(void)
 /* add socket to the epoll set
  */
 static inline rsRetVal
-addEPollSock(epolld_type_t typ, void *ptr, int sock, epolld_t **pEpd)
+addEPollSock(epolld_type_t typ, void *ptr, int sock, int efd, epolld_t **pEpd)
 {
 	DEFiRet;
 	epolld_t *epd = NULL;
@@ -948,11 +1455,15 @@ addEPollSock(epolld_type_t typ, void *ptr, int sock, epolld_t **pEpd)
 	CHKmalloc(epd = calloc(sizeof(epolld_t), 1));
 	epd->typ = typ;
 	epd->ptr = ptr;
+	epd->efd = efd;
 	*pEpd = epd;
 	epd->ev.events = EPOLLIN|EPOLLET;
 	epd->ev.data.ptr = (void*) epd;
 
-	if(epoll_ctl(epollfd, EPOLL_CTL_ADD, sock, &(epd->ev)) != 0) {
+	if(efd == -1)
+		FINALIZE; /* io_uring mode: epd is only used as completion tag */
+
+	if(epoll_ctl(efd, EPOLL_CTL_ADD, sock, &(epd->ev)) != 0) {
 		char errStr[1024];
 		int eno = errno;
 		errmsg.LogError(0, RS_RET_EPOLL_CTL_FAILED, "os error (%d) during epoll ADD: %s",
@@ -960,7 +1471,7 @@ addEPollSock(epolld_type_t typ, void *ptr, int sock, epolld_t **pEpd)
 		ABORT_FINALIZE(RS_RET_EPOLL_CTL_FAILED);
 	}
 
-	DBGPRINTF("imptcp: added socket %d to epoll[%d] set\n", sock, epollfd);
+	DBGPRINTF("imptcp: added socket %d to epoll[%d] set\n", sock, efd);
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
@@ -981,9 +1492,12 @@ removeEPollSock(int sock, epolld_t *epd)
 {
 	DEFiRet;
 
-	DBGPRINTF("imptcp: removing socket %d from epoll[%d] set\n", sock, epollfd);
+	if(epd->efd == -1)
+		FINALIZE;
+
+	DBGPRINTF("imptcp: removing socket %d from epoll[%d] set\n", sock, epd->efd);
 
-	if(epoll_ctl(epollfd, EPOLL_CTL_DEL, sock, &(epd->ev)) != 0) {
+	if(epoll_ctl(epd->efd, EPOLL_CTL_DEL, sock, &(epd->ev)) != 0) {
 		char errStr[1024];
 		int eno = errno;
 		errmsg.LogError(0, RS_RET_EPOLL_CTL_FAILED, "os error (%d) during epoll DEL: %s",
@@ -999,7 +1513,7 @@ finalize_it:
 /* add a listener to the server 
  */
 static rsRetVal
-addLstn(ptcpsrv_t *pSrv, int sock, int isIPv6)
+addLstn(ptcpsrv_t *pSrv, int sock, int isIPv6, int iShard, netstrm_t *pStrm)
 {
 	DEFiRet;
 	ptcplstn_t *pLstn;
@@ -1009,11 +1523,19 @@ addLstn(ptcpsrv_t *pSrv, int sock, int isIPv6)
 	pLstn->pSrv = pSrv;
 	pLstn->bSuppOctetFram = pSrv->bSuppOctetFram;
 	pLstn->sock = sock;
+	pLstn->pStrm = pStrm;
+	pLstn->iShard = iShard;
 	/* support statistics gathering */
 	CHKiRet(statsobj.Construct(&(pLstn->stats)));
-	snprintf((char*)statname, sizeof(statname), "imptcp(%s/%s/%s)",
-		(pSrv->lstnIP == NULL) ? "*" : (char*)pSrv->lstnIP, pSrv->port,
-		isIPv6 ? "IPv6" : "IPv4");
+	if(iShard == -1) {
+		snprintf((char*)statname, sizeof(statname), "imptcp(%s/%s/%s)",
+			(pSrv->lstnIP == NULL) ? "*" : (char*)pSrv->lstnIP, pSrv->port,
+			isIPv6 ? "IPv6" : "IPv4");
+	} else {
+		snprintf((char*)statname, sizeof(statname), "imptcp(%s/%s/%s/shard%d)",
+			(pSrv->lstnIP == NULL) ? "*" : (char*)pSrv->lstnIP, pSrv->port,
+			isIPv6 ? "IPv6" : "IPv4", iShard);
+	}
 	statname[sizeof(statname)-1] = '\0'; /* just to be on the save side... */
 	CHKiRet(statsobj.SetName(pLstn->stats, statname));
 	STATSCOUNTER_INIT(pLstn->ctrSubmit, pLstn->mutCtrSubmit);
@@ -1023,10 +1545,15 @@ addLstn(ptcpsrv_t *pSrv, int sock, int isIPv6)
 	 * that they may not be 100% correct */
 	pLstn->rcvdBytes = 0,
 	pLstn->rcvdDecompressed = 0;
+	pLstn->ctrPaused = 0;
 	CHKiRet(statsobj.AddCounter(pLstn->stats, UCHAR_CONSTANT("bytes.received"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pLstn->rcvdBytes)));
 	CHKiRet(statsobj.AddCounter(pLstn->stats, UCHAR_CONSTANT("bytes.decompressed"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pLstn->rcvdDecompressed)));
+	if(runModConf->bSessBackpressure) {
+		CHKiRet(statsobj.AddCounter(pLstn->stats, UCHAR_CONSTANT("sessions.paused"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pLstn->ctrPaused)));
+	}
 	CHKiRet(statsobj.ConstructFinalize(pLstn->stats));
 
 	/* add to start of server's listener list */
@@ -1036,7 +1563,8 @@ addLstn(ptcpsrv_t *pSrv, int sock, int isIPv6)
 		pSrv->pLstn->prev = pLstn;
 	pSrv->pLstn = pLstn;
 
-	iRet = addEPollSock(epolld_lstn, pLstn, sock, &pLstn->epd);
+	iRet = addEPollSock(epolld_lstn, pLstn, sock, (iShard == -1) ? epollfd : shards[iShard].efd,
+			    &pLstn->epd);
 
 finalize_it:
 	RETiRet;
@@ -1046,16 +1574,22 @@ finalize_it:
 /* add a session to the server 
  */
 static rsRetVal
-addSess(ptcplstn_t *pLstn, int sock, prop_t *peerName, prop_t *peerIP)
+addSess(ptcplstn_t *pLstn, int sock, prop_t *peerName, prop_t *peerIP, int iShard, ptcpsess_t **ppSess)
 {
 	DEFiRet;
 	ptcpsess_t *pSess = NULL;
 	ptcpsrv_t *pSrv = pLstn->pSrv;
 
 	CHKmalloc(pSess = malloc(sizeof(ptcpsess_t)));
-	CHKmalloc(pSess->pMsg = malloc(iMaxLine * sizeof(uchar)));
+	pSess->pMsg = NULL; /* assembly buffer is taken from bufPool on demand */
+	pSess->bPooledBuf = 0;
 	pSess->pLstn = pLstn;
 	pSess->sock = sock;
+	pSess->pStrm = NULL;
+	pSess->bPaused = 0;
+	pSess->pNextPaused = NULL;
+	pSess->bpEpoch = 0;
+	pSess->nBytesWnd = 0;
 	pSess->bSuppOctetFram = pLstn->bSuppOctetFram;
 	pSess->inputState = eAtStrtFram;
 	pSess->iMsg = 0;
@@ -1064,6 +1598,8 @@ addSess(ptcplstn_t *pLstn, int sock, prop_t *peerName, prop_t *peerIP)
 	pSess->peerName = peerName;
 	pSess->peerIP = peerIP;
 	pSess->compressionMode = pLstn->pSrv->compressionMode;
+	pSess->strmCmprAlgo = pLstn->pSrv->strmCmprAlgo;
+	pSess->pCmprCtx = NULL;
 
 	/* add to start of server's listener list */
 	pSess->prev = NULL;
@@ -1074,7 +1610,15 @@ addSess(ptcplstn_t *pLstn, int sock, prop_t *peerName, prop_t *peerIP)
 	pSrv->pSess = pSess;
 	pthread_mutex_unlock(&pSrv->mutSessLst);
 
-	iRet = addEPollSock(epolld_sess, pSess, sock, &pSess->epd);
+	pSess->iShard = iShard;
+	iRet = addEPollSock(epolld_sess, pSess, sock, (iShard == -1) ? epollfd : shards[iShard].efd,
+			    &pSess->epd);
+	if(iRet == RS_RET_OK) {
+		if(iShard != -1)
+			ATOMIC_INC(&shards[iShard].nSess, &mutShardSess);
+		if(ppSess != NULL)
+			*ppSess = pSess;
+	}
 
 finalize_it:
 	RETiRet;
@@ -1092,9 +1636,20 @@ doZipFinish(ptcpsess_t *pSess)
 	struct syslogTime stTime;
 	uchar zipBuf[32*1024]; // TODO: use "global" one from pSess
 
+	if(pSess->pCmprCtx != NULL) {
+		if(sessAcquireBuf(pSess) == RS_RET_OK) {
+			datetime.getCurrTime(&stTime, NULL);
+			iRet = DataRcvdCmpr(pSess, NULL, 0, &stTime, 0);
+			sessReleaseBuf(pSess);
+		}
+		cmpr.Destruct(&pSess->pCmprCtx);
+		goto done;
+	}
+
 	if(!pSess->bzInitDone)
 		goto done;
 
+	CHKiRet(sessAcquireBuf(pSess));
 	pSess->zstrm.avail_in = 0;
 	/* run inflate() on buffer until everything has been compressed */
 	do {
@@ -1111,6 +1666,7 @@ doZipFinish(ptcpsess_t *pSess)
 	} while (pSess->zstrm.avail_out == 0);
 
 finalize_it:
+	sessReleaseBuf(pSess);
 	zRet = inflateEnd(&pSess->zstrm);
 	if(zRet != Z_OK) {
 		DBGPRINTF("imptcp: error %d returned from zlib/inflateEnd()\n", zRet);
@@ -1135,7 +1691,12 @@ closeSess(ptcpsess_t *pSess)
 
 	sock = pSess->sock;
 	CHKiRet(removeEPollSock(sock, pSess->epd));
-	close(sock);
+	if(pSess->pStrm != NULL)
+		netstrm.Destruct(&pSess->pStrm);
+	else
+		close(sock);
+	if(pSess->iShard != -1)
+		ATOMIC_DEC(&shards[pSess->iShard].nSess, &mutShardSess);
 
 	pthread_mutex_lock(&pSess->pLstn->pSrv->mutSessLst);
 	/* finally unlink session from structures */
@@ -1174,7 +1735,9 @@ createInstance(instanceConf_t **pinst)
 	inst->pszBindRuleset = NULL;
 	inst->pszInputName = NULL;
 	inst->bSuppOctetFram = 1;
+	inst->bParseInInput = 0;
 	inst->bKeepAlive = 0;
+	inst->iFastOpen = 0;
 	inst->iKeepAliveIntvl = 0;
 	inst->iKeepAliveProbes = 0;
 	inst->iKeepAliveTime = 0;
@@ -1185,6 +1748,12 @@ createInstance(instanceConf_t **pinst)
 	inst->ratelimitBurst = 10000; /* arbitrary high limit */
 	inst->ratelimitInterval = 0; /* off */
 	inst->compressionMode = COMPRESS_SINGLE_MSG;
+	inst->strmCmprAlgo = CMPR_ALGO_ZLIB;
+	inst->pszStrmCmprDict = NULL;
+	inst->iStrmDrvrMode = 0;
+	inst->pszStrmDrvrName = NULL;
+	inst->pszStrmDrvrAuthMode = NULL;
+	inst->pPermPeers = NULL;
 
 	/* node created, let's add to config */
 	if(loadModConf->tail == NULL) {
@@ -1259,13 +1828,22 @@ addListner(modConfData_t __attribute__((unused)) *modConf, instanceConf_t *inst)
 	pSrv->pSess = NULL;
 	pSrv->pLstn = NULL;
 	pSrv->bSuppOctetFram = inst->bSuppOctetFram;
+	pSrv->bParseInInput = inst->bParseInInput;
 	pSrv->bKeepAlive = inst->bKeepAlive;
+	pSrv->iFastOpen = inst->iFastOpen;
 	pSrv->iKeepAliveIntvl = inst->iKeepAliveTime;
 	pSrv->iKeepAliveProbes = inst->iKeepAliveProbes;
 	pSrv->iKeepAliveTime = inst->iKeepAliveTime;
 	pSrv->bEmitMsgOnClose = inst->bEmitMsgOnClose;
 	pSrv->compressionMode = inst->compressionMode;
+	pSrv->strmCmprAlgo = inst->strmCmprAlgo;
+	pSrv->pszStrmCmprDict = inst->pszStrmCmprDict;
 	pSrv->dfltTZ = inst->dfltTZ;
+	pSrv->iStrmDrvrMode = inst->iStrmDrvrMode;
+	pSrv->pszStrmDrvrName = inst->pszStrmDrvrName;
+	pSrv->pszStrmDrvrAuthMode = inst->pszStrmDrvrAuthMode;
+	pSrv->pPermPeers = inst->pPermPeers;
+	pSrv->pNS = NULL;
 	CHKiRet(ratelimitNew(&pSrv->ratelimiter, "imtcp", (char*)inst->pszBindPort));
 	ratelimitSetLinuxLike(pSrv->ratelimiter, inst->ratelimitInterval, inst->ratelimitBurst);
 	ratelimitSetThreadSafe(pSrv->ratelimiter);
@@ -1357,7 +1935,10 @@ startupServers()
 	pSrv = pSrvRoot;
 	while(pSrv != NULL) {
 		DBGPRINTF("imptcp: starting up server for port %s, name '%s'\n", pSrv->port, pSrv->pszInputName);
-		localRet = startupSrv(pSrv);
+		if(pSrv->iStrmDrvrMode != 0)
+			localRet = startupStrmSrv(pSrv);
+		else
+			localRet = startupSrv(pSrv);
 		if(localRet == RS_RET_OK)
 			iOK++;
 		else
@@ -1374,6 +1955,89 @@ startupServers()
 }
 
 
+/* select the epoll shard for a session accepted on the given listener.
+ * Sessions from a shard's own listener stay on that shard. All others are
+ * accepted by the input thread only, so no locking is needed for the
+ * round-robin state. The session counts read for least-load may be
+ * slightly outdated, which does not matter.
+ */
+static inline int
+shardForLstn(ptcplstn_t *pLstn)
+{
+	int i;
+	int iShard;
+
+	if(nShards == 0)
+		return -1;
+	if(pLstn->iShard != -1)
+		return pLstn->iShard;
+	if(runModConf->bShardLeastLoad) {
+		iShard = 0;
+		for(i = 1 ; i < nShards ; ++i) {
+			if(shards[i].nSess < shards[iShard].nSess)
+				iShard = i;
+		}
+	} else {
+		iShard = shardNext;
+		shardNext = (shardNext + 1) % nShards;
+	}
+	return iShard;
+}
+
+
+/* accept new connections on a stream driver listener. The driver does
+ * the accept() and, for TLS, starts the handshake, which then is
+ * completed by the first Rcv() calls on the session. A failure on a
+ * single connection does not affect the others, so we carry on.
+ */
+static rsRetVal
+lstnActivityStrm(ptcplstn_t *pLstn)
+{
+	netstrm_t *pNewStrm;
+	struct sockaddr_storage *pAddr;
+	prop_t *peerName;
+	prop_t *peerIP;
+	ptcpsess_t *pSess;
+	int sock;
+	rsRetVal localRet;
+	DEFiRet;
+
+	while(glbl.GetGlobalInputTermState() == 0) {
+		pNewStrm = NULL;
+		localRet = netstrm.AcceptConnReq(pLstn->pStrm, &pNewStrm);
+		if(localRet == RS_RET_ACCEPT_ERR)
+			break; /* the driver does not tell EAGAIN from real errors */
+		if(localRet != RS_RET_OK) {
+			DBGPRINTF("imptcp: error %d accepting stream driver session - ignored\n",
+				  localRet);
+			continue;
+		}
+		peerName = peerIP = NULL;
+		localRet = netstrm.GetSock(pNewStrm, &sock);
+		if(localRet == RS_RET_OK)
+			localRet = netstrm.GetRemAddr(pNewStrm, &pAddr);
+		if(localRet == RS_RET_OK) {
+			if(pLstn->pSrv->bKeepAlive)
+				EnableKeepAlive(pLstn, sock);/* we ignore errors, best to do! */
+			localRet = getPeerNames(&peerName, &peerIP, (struct sockaddr*) pAddr);
+		}
+		if(localRet == RS_RET_OK)
+			localRet = addSess(pLstn, sock, peerName, peerIP, shardForLstn(pLstn), &pSess);
+		if(localRet != RS_RET_OK) {
+			if(peerName != NULL)
+				prop.Destruct(&peerName);
+			if(peerIP != NULL)
+				prop.Destruct(&peerIP);
+			netstrm.Destruct(&pNewStrm);
+			continue;
+		}
+		pSess->pStrm = pNewStrm;
+	}
+
+	RETiRet;
+}
+
+
 /* process new activity on listener. This means we need to accept a new
  * connection.
  */
@@ -1387,12 +2051,176 @@ lstnActivity(ptcplstn_t *pLstn)
 	DEFiRet;
 
 	DBGPRINTF("imptcp: new connection on listen socket %d\n", pLstn->sock);
+	if(pLstn->pStrm != NULL) {
+		iRet = lstnActivityStrm(pLstn);
+		FINALIZE;
+	}
 	while(glbl.GetGlobalInputTermState() == 0) {
 		localRet = AcceptConnReq(pLstn, &newSock, &peerName, &peerIP);
 		if(localRet == RS_RET_NO_MORE_DATA || glbl.GetGlobalInputTermState() == 1)
 			break;
 		CHKiRet(localRet);
-		CHKiRet(addSess(pLstn, newSock, peerName, peerIP));
+		CHKiRet(addSess(pLstn, newSock, peerName, peerIP, shardForLstn(pLstn), NULL));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* the remote peer closed the session, so do clean-up
+ */
+static rsRetVal
+sessPeerClosed(ptcpsess_t *pSess)
+{
+	uchar *peerName;
+	int lenPeer;
+	int remsock = 0; /* init just to keep compiler happy... :-( */
+	sbool bEmitOnClose = 0;
+	DEFiRet;
+
+	if(pSess->pLstn->pSrv->bEmitMsgOnClose) {
+		prop.GetString(pSess->peerName, &peerName, &lenPeer),
+		remsock = pSess->sock;
+		bEmitOnClose = 1;
+	}
+	CHKiRet(closeSess(pSess)); /* close may emit more messages in strmzip mode! */
+	if(bEmitOnClose) {
+		errmsg.LogError(0, RS_RET_PEER_CLOSED_CONN, "imptcp session %d closed by "
+				"remote peer %s.", remsock, peerName);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* account received data for session backpressure */
+static inline void
+bpAccount(ptcpsess_t *pSess, int lenRcv)
+{
+	const unsigned epoch = bpEpoch;
+
+	if(pSess->bpEpoch != epoch) {
+		pSess->bpEpoch = epoch;
+		pSess->nBytesWnd = 0;
+		++bpSessWnd;
+	}
+	pSess->nBytesWnd += lenRcv;
+	bpBytesWnd += lenRcv;
+}
+
+
+/* check if the session must be paused and do so if needed. Returns 1 if
+ * the session was paused. In that case, the caller must no longer touch
+ * the session, as the input thread may resume it at any time.
+ */
+static int
+bpChkPause(ptcpsess_t *pSess)
+{
+	const unsigned share = bpFairShare;
+	ptcplstn_t *pLstn = pSess->pLstn;
+	struct epoll_event ev;
+
+	if(share == 0 || pSess->bpEpoch != bpEpoch || pSess->nBytesWnd <= share)
+		return 0;	/* not a heavy sender */
+	if(getSubmitFlowCtlState(pLstn->pSrv->pRuleset) != QUEUE_FLOWCTL_DELAY)
+		return 0;
+
+	pthread_mutex_lock(&mutPaused);
+	ev.events = 0;
+	ev.data.ptr = pSess->epd;
+	if(epoll_ctl(pSess->epd->efd, EPOLL_CTL_MOD, pSess->sock, &ev) != 0) {
+		pthread_mutex_unlock(&mutPaused);
+		DBGPRINTF("imptcp: error %d pausing session socket %d - ignored\n", errno, pSess->sock);
+		return 0;
+	}
+	pSess->bPaused = 1;
+	pSess->pNextPaused = pPausedRoot;
+	pPausedRoot = pSess;
+	++pLstn->ctrPaused;
+	pthread_mutex_unlock(&mutPaused);
+	DBGPRINTF("imptcp: session socket %d paused by backpressure (%u bytes, fair share %u)\n",
+		  pSess->sock, pSess->nBytesWnd, share);
+	return 1;
+}
+
+
+/* periodic backpressure housekeeping, done by the input thread: start a
+ * new window every second and resume paused sessions whose queue is
+ * below the low watermark again. Re-adding the read interest makes epoll
+ * report the data that is already waiting.
+ */
+static void
+bpCheck(void)
+{
+	ptcpsess_t *pSess, *pPrev, *pNext;
+	time_t ttNow;
+
+	datetime.GetTime(&ttNow);
+	if(ttNow != bpTtEpoch) {
+		bpFairShare = (bpSessWnd == 0) ? 0 : bpBytesWnd / bpSessWnd;
+		bpBytesWnd = 0;
+		bpSessWnd = 0;
+		bpTtEpoch = ttNow;
+		++bpEpoch;
+	}
+
+	pthread_mutex_lock(&mutPaused);
+	for(pPrev = NULL, pSess = pPausedRoot ; pSess != NULL ; pSess = pNext) {
+		pNext = pSess->pNextPaused;
+		if(getSubmitFlowCtlState(pSess->pLstn->pSrv->pRuleset) != QUEUE_FLOWCTL_OK
+		   && glbl.GetGlobalInputTermState() == 0) {
+			pPrev = pSess;
+			continue;
+		}
+		if(pPrev == NULL)
+			pPausedRoot = pNext;
+		else
+			pPrev->pNextPaused = pNext;
+		pSess->pNextPaused = NULL;
+		pSess->bPaused = 0;
+		pSess->epd->ev.events = EPOLLIN|EPOLLET;
+		if(epoll_ctl(pSess->epd->efd, EPOLL_CTL_MOD, pSess->sock, &pSess->epd->ev) != 0) {
+			errmsg.LogError(errno, RS_RET_EPOLL_CTL_FAILED, "imptcp: could not resume "
+					"session socket %d", pSess->sock);
+		}
+		DBGPRINTF("imptcp: session socket %d resumed\n", pSess->sock);
+	}
+	pthread_mutex_unlock(&mutPaused);
+}
+
+
+/* process new activity on a stream driver session. With TLS, socket
+ * readiness and available data do not match (records are buffered by the
+ * driver), so as we are edge-triggered, we must read until the driver
+ * tells us to retry.
+ */
+static rsRetVal
+sessActivityStrm(ptcpsess_t *pSess)
+{
+	ssize_t lenRcv;
+	rsRetVal localRet;
+	char rcvBuf[128*1024];
+	DEFiRet;
+
+	while(1) {
+		lenRcv = sizeof(rcvBuf);
+		localRet = netstrm.Rcv(pSess->pStrm, (uchar*) rcvBuf, &lenRcv);
+		if(localRet == RS_RET_OK) {
+			if(lenRcv > 0)
+				CHKiRet(DataRcvd(pSess, rcvBuf, lenRcv));
+		} else if(localRet == RS_RET_RETRY) {
+			break;
+		} else if(localRet == RS_RET_CLOSED) {
+			CHKiRet(sessPeerClosed(pSess));
+			break;
+		} else {
+			DBGPRINTF("imptcp: error %d on stream session socket %d - closed.\n",
+				  localRet, pSess->sock);
+			closeSess(pSess); /* try clean-up by dropping session */
+			break;
+		}
 	}
 
 finalize_it:
@@ -1408,35 +2236,32 @@ sessActivity(ptcpsess_t *pSess)
 {
 	int lenRcv;
 	int lenBuf;
-	uchar *peerName;
-	int lenPeer;
-	int remsock = 0; /* init just to keep compiler happy... :-( */
-	sbool bEmitOnClose = 0;
 	char rcvBuf[128*1024];
 	DEFiRet;
 
 	DBGPRINTF("imptcp: new activity on session socket %d\n", pSess->sock);
+	if(pSess->pStrm != NULL) {
+		iRet = sessActivityStrm(pSess);
+		FINALIZE;
+	}
+	if(pSess->bPaused)
+		FINALIZE; /* e.g. EPOLLHUP, which is always reported; handled on resume */
 
 	while(1) {
+		if(runModConf->bSessBackpressure && bpChkPause(pSess))
+			break;
 		lenBuf = sizeof(rcvBuf);
 		lenRcv = recv(pSess->sock, rcvBuf, lenBuf, 0);
 
 		if(lenRcv > 0) {
+			if(runModConf->bSessBackpressure)
+				bpAccount(pSess, lenRcv);
 			/* have data, process it */
 			DBGPRINTF("imptcp: data(%d) on socket %d: %s\n", lenBuf, pSess->sock, rcvBuf);
 			CHKiRet(DataRcvd(pSess, rcvBuf, lenRcv));
 		} else if (lenRcv == 0) {
 			/* session was closed, do clean-up */
-			if(pSess->pLstn->pSrv->bEmitMsgOnClose) {
-				prop.GetString(pSess->peerName, &peerName, &lenPeer),
-				remsock = pSess->sock;
-				bEmitOnClose = 1;
-			}
-			CHKiRet(closeSess(pSess)); /* close may emit more messages in strmzip mode! */
-			if(bEmitOnClose) {
-				errmsg.LogError(0, RS_RET_PEER_CLOSED_CONN, "imptcp session %d closed by "
-					  	"remote peer %s.", remsock, peerName);
-			}
+			CHKiRet(sessPeerClosed(pSess));
 			break;
 		} else {
 			if(errno == EAGAIN || errno == EWOULDBLOCK)
@@ -1557,11 +2382,377 @@ wrkr(void *myself)
 }
 
 
+/* create an epoll set */
+static rsRetVal
+createEpollSet(int *pEfd)
+{
+	int efd = -1;
+	DEFiRet;
+
+#	if defined(EPOLL_CLOEXEC) && defined(HAVE_EPOLL_CREATE1)
+	DBGPRINTF("imptcp uses epoll_create1()\n");
+	efd = epoll_create1(EPOLL_CLOEXEC);
+	if(efd < 0 && errno == ENOSYS)
+#	endif
+	{
+		DBGPRINTF("imptcp uses epoll_create()\n");
+		/* reading the docs, the number of epoll events passed to
+		 * epoll_create() seems not to be used at all in kernels. So
+		 * we just provide "a" number, happens to be 10.
+		 */
+		efd = epoll_create(10);
+	}
+
+	if(efd < 0) {
+		errmsg.LogError(0, RS_RET_EPOLL_CR_FAILED, "error: epoll_create() failed");
+		ABORT_FINALIZE(RS_RET_NO_RUN);
+	}
+	*pEfd = efd;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* create the epoll sets for the shards (one per worker) */
+static rsRetVal
+createShards(void)
+{
+	int nWrkrs;
+	DEFiRet;
+
+	INIT_ATOMIC_HELPER_MUT(mutShardSess);
+	nWrkrs = (runModConf->wrkrMax > 16) ? 16 : runModConf->wrkrMax;
+	for(nShards = 0 ; nShards < nWrkrs ; ++nShards) {
+		shards[nShards].nSess = 0;
+		shards[nShards].numEvents = 0;
+		shards[nShards].bThrdStarted = 0;
+		CHKiRet(createEpollSet(&shards[nShards].efd));
+	}
+	DBGPRINTF("imptcp: using %d epoll shards\n", nShards);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* worker for an epoll shard. It processes all events itself, there is no
+ * dispatching. We wake up once a second to check for termination, as
+ * helper threads are not interrupted by the core.
+ */
+static void *
+shardWrkr(void *myself)
+{
+	struct epollShard_s *me = (struct epollShard_s*) myself;
+	struct epoll_event events[128];
+	int nEvents;
+	int i;
+
+	while(glbl.GetGlobalInputTermState() == 0) {
+		nEvents = epoll_wait(me->efd, events, sizeof(events)/sizeof(struct epoll_event), 1000);
+		for(i = 0 ; (i < nEvents) && (glbl.GetGlobalInputTermState() == 0) ; ++i) {
+			processWorkItem(events+i);
+		}
+		if(nEvents > 0)
+			me->numEvents += nEvents;
+	}
+	return NULL;
+}
+
+
+static void
+startShards(void)
+{
+	int i;
+
+	for(i = 0 ; i < nShards ; ++i) {
+		if(pthread_create(&shards[i].tid, &wrkrThrdAttr, shardWrkr, &shards[i]) == 0)
+			shards[i].bThrdStarted = 1;
+	}
+}
+
+
+/* wait for the shard workers to terminate and release the epoll sets */
+static void
+stopShards(void)
+{
+	int i;
+
+	for(i = 0 ; i < nShards ; ++i) {
+		if(shards[i].bThrdStarted)
+			pthread_join(shards[i].tid, NULL);
+		DBGPRINTF("imptcp: info: shard %d processed %llu events, %d sessions left\n",
+			  i, shards[i].numEvents, shards[i].nSess);
+		close(shards[i].efd);
+	}
+	nShards = 0;
+	DESTROY_ATOMIC_HELPER_MUT(mutShardSess);
+}
+
+
+#ifdef HAVE_LIBURING
+/* obtain a submission queue entry. If the SQ is full, we flush it
+ * to the kernel and try again.
+ */
+static inline struct io_uring_sqe *
+uringGetSqe(struct uringWrkr_s *pUr)
+{
+	struct io_uring_sqe *sqe;
+
+	if((sqe = io_uring_get_sqe(&pUr->ring)) == NULL) {
+		io_uring_submit(&pUr->ring);
+		sqe = io_uring_get_sqe(&pUr->ring);
+	}
+	return sqe;
+}
+
+
+static rsRetVal
+uringArmAccept(struct uringWrkr_s *pUr, ptcplstn_t *pLstn)
+{
+	struct io_uring_sqe *sqe;
+	DEFiRet;
+
+	if((sqe = uringGetSqe(pUr)) == NULL)
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	io_uring_prep_multishot_accept(sqe, pLstn->sock, NULL, NULL, 0);
+	io_uring_sqe_set_data(sqe, pLstn->epd);
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal
+uringArmRecv(struct uringWrkr_s *pUr, ptcpsess_t *pSess)
+{
+	struct io_uring_sqe *sqe;
+	DEFiRet;
+
+	if((sqe = uringGetSqe(pUr)) == NULL)
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	io_uring_prep_recv_multishot(sqe, pSess->sock, NULL, 0, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = pUr->bgid;
+	io_uring_sqe_set_data(sqe, pSess->epd);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* process an accept completion: res is the new socket or a negative errno */
+static inline void
+uringLstnCompletion(struct uringWrkr_s *pUr, ptcplstn_t *pLstn, int res, unsigned flags)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen = sizeof(addr);
+	prop_t *peerName;
+	prop_t *peerIP;
+	ptcpsess_t *pSess;
+
+	if(res >= 0) {
+		if(   getpeername(res, (struct sockaddr*) &addr, &addrlen) != 0
+		   || setupAcceptedSock(pLstn, res, (struct sockaddr*) &addr, &peerName, &peerIP) != RS_RET_OK
+		   || addSess(pLstn, res, peerName, peerIP, -1, &pSess) != RS_RET_OK) {
+			DBGPRINTF("imptcp: could not set up io_uring session on socket %d\n", res);
+			close(res);
+		} else if(uringArmRecv(pUr, pSess) != RS_RET_OK) {
+			closeSess(pSess);
+		}
+	} else {
+		DBGPRINTF("imptcp: io_uring accept on listen socket %d failed: %d\n", pLstn->sock, res);
+	}
+
+	if(!(flags & IORING_CQE_F_MORE) && glbl.GetGlobalInputTermState() == 0)
+		uringArmAccept(pUr, pLstn);
+}
+
+
+/* process a recv completion. Data is in the provided buffer indicated by
+ * the cqe flags, which is handed back to the kernel right after processing.
+ */
+static inline void
+uringSessCompletion(struct uringWrkr_s *pUr, ptcpsess_t *pSess, int res, unsigned flags)
+{
+	char *buf;
+	unsigned bid;
+
+	if(res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+		bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		buf = pUr->bufs + (size_t) bid * URING_BUFSIZE;
+		DataRcvd(pSess, buf, res);
+		io_uring_buf_ring_add(pUr->bufRing, buf, URING_BUFSIZE, bid,
+				      io_uring_buf_ring_mask(URING_NBUFS), 0);
+		io_uring_buf_ring_advance(pUr->bufRing, 1);
+		if(!(flags & IORING_CQE_F_MORE))
+			uringArmRecv(pUr, pSess);
+	} else if(res == 0) {
+		sessPeerClosed(pSess);
+	} else if(res == -ENOBUFS) {
+		/* all buffers were in flight - they are back now, so just re-arm */
+		uringArmRecv(pUr, pSess);
+	} else {
+		DBGPRINTF("imptcp: error %d on session socket %d - closed.\n", res, pSess->sock);
+		closeSess(pSess);
+	}
+}
+
+
+/* the io_uring event loop. Completions are processed in batches; the
+ * resulting re-arm requests are submitted together with the next wait.
+ * We wake up once a second to check for termination, as helper threads
+ * are not interrupted by the core.
+ */
+static void
+uringLoop(struct uringWrkr_s *pUr)
+{
+	struct io_uring_cqe *cqe;
+	struct __kernel_timespec ts = { .tv_sec = 1, .tv_nsec = 0 };
+	epolld_t *epd;
+	unsigned head;
+	unsigned nCQEs;
+	int ret;
+
+	while(glbl.GetGlobalInputTermState() == 0) {
+		ret = io_uring_submit_and_wait_timeout(&pUr->ring, &cqe, 1, &ts, NULL);
+		if(ret < 0 && ret != -ETIME && ret != -EINTR) {
+			DBGPRINTF("imptcp: io_uring wait on ring %d returned %d\n", pUr->bgid, ret);
+		}
+		nCQEs = 0;
+		io_uring_for_each_cqe(&pUr->ring, head, cqe) {
+			++nCQEs;
+			if((epd = io_uring_cqe_get_data(cqe)) == NULL)
+				continue;
+			if(epd->typ == epolld_lstn) {
+				uringLstnCompletion(pUr, (ptcplstn_t*) epd->ptr, cqe->res, cqe->flags);
+			} else {
+				uringSessCompletion(pUr, (ptcpsess_t*) epd->ptr, cqe->res, cqe->flags);
+			}
+		}
+		io_uring_cq_advance(&pUr->ring, nCQEs);
+		pUr->numCQEs += nCQEs;
+	}
+}
+
+
+static void *
+uringWrkr(void *myself)
+{
+	uringLoop((struct uringWrkr_s*) myself);
+	return NULL;
+}
+
+
+/* release all rings. Must only be called when no thread uses them any longer. */
+static void
+uringTeardown(void)
+{
+	int i;
+
+	for(i = 0 ; i < nUringWrkrs ; ++i) {
+		DBGPRINTF("imptcp: info: io_uring worker %d processed %llu completions\n",
+			  i, uringWrkrs[i].numCQEs);
+		if(uringWrkrs[i].bufRing != NULL)
+			io_uring_free_buf_ring(&uringWrkrs[i].ring, uringWrkrs[i].bufRing,
+					       URING_NBUFS, uringWrkrs[i].bgid);
+		io_uring_queue_exit(&uringWrkrs[i].ring);
+		free(uringWrkrs[i].bufs);
+	}
+	free(uringWrkrs);
+	uringWrkrs = NULL;
+	nUringWrkrs = 0;
+}
+
+
+/* create one ring and buffer group per worker. If anything fails here,
+ * the caller falls back to epoll.
+ */
+static rsRetVal
+uringSetup(void)
+{
+	struct uringWrkr_s *pUr;
+	int nWrkrs;
+	int i;
+	int ret;
+	DEFiRet;
+
+	nWrkrs = (runModConf->wrkrMax > 16) ? 16 : runModConf->wrkrMax;
+	CHKmalloc(uringWrkrs = calloc(nWrkrs, sizeof(struct uringWrkr_s)));
+	for(i = 0 ; i < nWrkrs ; ++i) {
+		pUr = &uringWrkrs[i];
+		if((ret = io_uring_queue_init(URING_ENTRIES, &pUr->ring, 0)) < 0) {
+			DBGPRINTF("imptcp: io_uring_queue_init failed: %d\n", ret);
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+		++nUringWrkrs;
+		pUr->bgid = i;
+		CHKmalloc(pUr->bufs = malloc((size_t) URING_NBUFS * URING_BUFSIZE));
+		pUr->bufRing = io_uring_setup_buf_ring(&pUr->ring, URING_NBUFS, pUr->bgid, 0, &ret);
+		if(pUr->bufRing == NULL) {
+			DBGPRINTF("imptcp: io_uring_setup_buf_ring failed: %d\n", ret);
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+		for(ret = 0 ; ret < URING_NBUFS ; ++ret) {
+			io_uring_buf_ring_add(pUr->bufRing, pUr->bufs + (size_t) ret * URING_BUFSIZE,
+					      URING_BUFSIZE, ret, io_uring_buf_ring_mask(URING_NBUFS), ret);
+		}
+		io_uring_buf_ring_advance(pUr->bufRing, URING_NBUFS);
+	}
+	DBGPRINTF("imptcp: using io_uring with %d rings\n", nUringWrkrs);
+
+finalize_it:
+	if(iRet != RS_RET_OK)
+		uringTeardown();
+	RETiRet;
+}
+
+
+/* arm the listeners on all rings, start the helper threads and then run
+ * ring 0 on the input thread itself.
+ */
+static void
+uringRun(void)
+{
+	ptcpsrv_t *pSrv;
+	ptcplstn_t *pLstn;
+	int i;
+
+	for(i = 0 ; i < nUringWrkrs ; ++i) {
+		for(pSrv = pSrvRoot ; pSrv != NULL ; pSrv = pSrv->pNext) {
+			for(pLstn = pSrv->pLstn ; pLstn != NULL ; pLstn = pLstn->next) {
+				uringArmAccept(&uringWrkrs[i], pLstn);
+			}
+		}
+	}
+	for(i = 1 ; i < nUringWrkrs ; ++i) {
+		if(pthread_create(&uringWrkrs[i].tid, &wrkrThrdAttr, uringWrkr, &uringWrkrs[i]) == 0)
+			uringWrkrs[i].bThrdStarted = 1;
+	}
+	uringLoop(&uringWrkrs[0]);
+}
+
+
+static void
+uringStop(void)
+{
+	int i;
+
+	for(i = 1 ; i < nUringWrkrs ; ++i) {
+		if(uringWrkrs[i].bThrdStarted)
+			pthread_join(uringWrkrs[i].tid, NULL);
+	}
+	uringTeardown();
+}
+#endif /* #ifdef HAVE_LIBURING */
+
+
 BEGINnewInpInst
 	struct cnfparamvals *pvals;
 	instanceConf_t *inst;
 	char *cstr;
-	int i;
+	rsRetVal iRetLocal;
+	int i, j;
 CODESTARTnewInpInst
 	DBGPRINTF("newInpInst (imptcp)\n");
 
@@ -1587,6 +2778,8 @@ CODESTARTnewInpInst
 			inst->pszInputName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(inppblk.descr[i].name, "ruleset")) {
 			inst->pszBindRuleset = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(inppblk.descr[i].name, "parseininput")) {
+			inst->bParseInInput = (int) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "supportoctetcountedframing")) {
 			inst->bSuppOctetFram = (int) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "compression.mode")) {
@@ -1602,8 +2795,27 @@ CODESTARTnewInpInst
 				ABORT_FINALIZE(RS_RET_PARAM_ERROR);
 			}
 			free(cstr);
+		} else if(!strcmp(inppblk.descr[i].name, "compression.stream.algorithm")) {
+			if(!bCmprIfLoaded) {
+				CHKiRet(objUse(cmpr, LM_CMPR_FILENAME));
+				bCmprIfLoaded = 1;
+			}
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(cmpr.GetAlgo((uchar*) cstr, &inst->strmCmprAlgo) != RS_RET_OK
+			   || inst->strmCmprAlgo == CMPR_ALGO_GZIP
+			   || !cmpr.IsSupported(inst->strmCmprAlgo)) {
+				errmsg.LogError(0, RS_RET_CMPR_ALGO_UNSUPPORTED, "imptcp: compression "
+					 "algorithm '%s' is not supported", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_CMPR_ALGO_UNSUPPORTED);
+			}
+			free(cstr);
+		} else if(!strcmp(inppblk.descr[i].name, "compression.stream.dictionary")) {
+			inst->pszStrmCmprDict = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(inppblk.descr[i].name, "keepalive")) {
 			inst->bKeepAlive = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "tcpfastopen")) {
+			inst->iFastOpen = (int) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "keepalive.probes")) {
 			inst->iKeepAliveProbes = (int) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "keepalive.time")) {
@@ -1620,11 +2832,29 @@ CODESTARTnewInpInst
 			inst->ratelimitBurst = (int) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "ratelimit.interval")) {
 			inst->ratelimitInterval = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "streamdriver.mode")) {
+			inst->iStrmDrvrMode = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "streamdriver.authmode")) {
+			inst->pszStrmDrvrAuthMode = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(inppblk.descr[i].name, "streamdriver.name")) {
+			inst->pszStrmDrvrName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(inppblk.descr[i].name, "permittedpeer")) {
+			for(j = 0 ; j < pvals[i].val.d.ar->nmemb ; ++j) {
+				cstr = es_str2cstr(pvals[i].val.d.ar->arr[j], NULL);
+				iRetLocal = net.AddPermittedPeer(&inst->pPermPeers, (uchar*) cstr);
+				free(cstr);
+				CHKiRet(iRetLocal);
+			}
 		} else {
 			dbgprintf("imptcp: program error, non-handled "
 			  "param '%s'\n", inppblk.descr[i].name);
 		}
 	}
+	if(inst->iStrmDrvrMode != 0 && !bNetstrmIfLoaded) {
+		CHKiRet(objUse(netstrms, LM_NETSTRMS_FILENAME));
+		CHKiRet(objUse(netstrm, LM_NETSTRMS_FILENAME));
+		bNetstrmIfLoaded = 1;
+	}
 finalize_it:
 CODE_STD_FINALIZERnewInpInst
 	cnfparamvalsDestruct(pvals, &inppblk);
@@ -1637,6 +2867,11 @@ CODESTARTbeginCnfLoad
 	pModConf->pConf = pConf;
 	/* init our settings */
 	loadModConf->wrkrMax = DFLT_wrkrMax;
+	loadModConf->bUseUring = 0;
+	loadModConf->bShardEpoll = 0;
+	loadModConf->bShardLeastLoad = 1;
+	loadModConf->bShardReusePort = 0;
+	loadModConf->bSessBackpressure = 0;
 	loadModConf->configSetViaV2Method = 0;
 	bLegacyCnfModGlobalsPermitted = 1;
 	/* init legacy config vars */
@@ -1646,6 +2881,7 @@ ENDbeginCnfLoad
 
 BEGINsetModCnf
 	struct cnfparamvals *pvals = NULL;
+	char *cstr;
 	int i;
 CODESTARTsetModCnf
 	pvals = nvlstGetParams(lst, &modpblk, NULL);
@@ -1665,6 +2901,38 @@ CODESTARTsetModCnf
 			continue;
 		if(!strcmp(modpblk.descr[i].name, "threads")) {
 			loadModConf->wrkrMax = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "epoll.sharded")) {
+			loadModConf->bShardEpoll = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "epoll.sharded.reuseport")) {
+			loadModConf->bShardReusePort = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "sessionbackpressure")) {
+			loadModConf->bSessBackpressure = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "epoll.sharded.assign")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(!strcasecmp(cstr, "leastload")) {
+				loadModConf->bShardLeastLoad = 1;
+			} else if(!strcasecmp(cstr, "roundrobin")) {
+				loadModConf->bShardLeastLoad = 0;
+			} else {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "imptcp: invalid value for "
+					 "'epoll.sharded.assign' parameter (given is '%s')", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+			}
+			free(cstr);
+		} else if(!strcmp(modpblk.descr[i].name, "iomode")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(!strcasecmp(cstr, "uring")) {
+				loadModConf->bUseUring = 1;
+			} else if(!strcasecmp(cstr, "epoll")) {
+				loadModConf->bUseUring = 0;
+			} else {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "imptcp: invalid value for 'iomode' "
+					 "parameter (given is '%s')", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+			}
+			free(cstr);
 		} else {
 			dbgprintf("imptcp: program error, non-handled "
 			  "param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
@@ -1712,6 +2980,38 @@ BEGINcheckCnf
 CODESTARTcheckCnf
 	for(inst = pModConf->root ; inst != NULL ; inst = inst->next) {
 		std_checkRuleset(pModConf, inst);
+		if(inst->iStrmDrvrMode != 0 && pModConf->bUseUring) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "imptcp: stream drivers (TLS) are "
+					"not supported in iomode=\"uring\" - using epoll");
+			pModConf->bUseUring = 0;
+		}
+	}
+#	ifndef HAVE_LIBURING
+	if(pModConf->bUseUring) {
+		errmsg.LogError(0, RS_RET_PARAM_ERROR, "imptcp: iomode=\"uring\" requested, but "
+				"io_uring support was not compiled in - using epoll");
+		pModConf->bUseUring = 0;
+	}
+#	endif
+#	ifndef SO_REUSEPORT
+	if(pModConf->bShardReusePort) {
+		errmsg.LogError(0, RS_RET_PARAM_ERROR, "imptcp: epoll.sharded.reuseport is not "
+				"supported on this platform - ignored");
+		pModConf->bShardReusePort = 0;
+	}
+#	endif
+	if(pModConf->bShardReusePort && !pModConf->bShardEpoll) {
+		errmsg.LogError(0, RS_RET_PARAM_ERROR, "imptcp: epoll.sharded.reuseport requires "
+				"epoll.sharded=\"on\" - ignored");
+		pModConf->bShardReusePort = 0;
+	}
+	if(pModConf->bShardEpoll && pModConf->bUseUring) {
+		DBGPRINTF("imptcp: epoll.sharded has no effect in io_uring mode\n");
+	}
+	if(pModConf->bSessBackpressure && pModConf->bUseUring) {
+		errmsg.LogError(0, RS_RET_PARAM_ERROR, "imptcp: sessionbackpressure is not "
+				"supported in iomode=\"uring\" - ignored");
+		pModConf->bSessBackpressure = 0;
 	}
 ENDcheckCnf
 
@@ -1721,6 +3021,7 @@ BEGINactivateCnfPrePrivDrop
 CODESTARTactivateCnfPrePrivDrop
 	iMaxLine = glbl.GetMaxLine(); /* get maximum size we currently support */
 	DBGPRINTF("imptcp: config params iMaxLine %d\n", iMaxLine);
+	CHKiRet(bufPoolInit());
 
 	runModConf = pModConf;
 	for(inst = runModConf->root ; inst != NULL ; inst = inst->next) {
@@ -1731,25 +3032,25 @@ CODESTARTactivateCnfPrePrivDrop
 		ABORT_FINALIZE(RS_RET_NO_RUN);
 	}
 
-#	if defined(EPOLL_CLOEXEC) && defined(HAVE_EPOLL_CREATE1)
-	DBGPRINTF("imptcp uses epoll_create1()\n");
-	epollfd = epoll_create1(EPOLL_CLOEXEC);
-	if(epollfd < 0 && errno == ENOSYS)
-#	endif
-	{
-		DBGPRINTF("imptcp uses epoll_create()\n");
-		/* reading the docs, the number of epoll events passed to
-		 * epoll_create() seems not to be used at all in kernels. So
-		 * we just provide "a" number, happens to be 10.
-		 */
-		epollfd = epoll_create(10);
+#	ifdef HAVE_LIBURING
+	if(runModConf->bUseUring) {
+		if(uringSetup() != RS_RET_OK) {
+			errmsg.LogError(0, RS_RET_IO_ERROR, "imptcp: io_uring could not be set up "
+					"(kernel too old?) - falling back to epoll");
+			runModConf->bUseUring = 0;
+		}
 	}
+	if(runModConf->bUseUring)
+		goto startup;	/* no epoll set needed */
+#	endif
 
-	if(epollfd < 0) {
-		errmsg.LogError(0, RS_RET_EPOLL_CR_FAILED, "error: epoll_create() failed");
-		ABORT_FINALIZE(RS_RET_NO_RUN);
-	}
+	CHKiRet(createEpollSet(&epollfd));
+	if(runModConf->bShardEpoll)
+		CHKiRet(createShards());
 
+#	ifdef HAVE_LIBURING
+startup:
+#	endif
 	/* start up servers, but do not yet read input data */
 	CHKiRet(startupServers());
 	DBGPRINTF("imptcp started up, but not yet receiving data\n");
@@ -1772,6 +3073,11 @@ CODESTARTfreeCnf
 		free(inst->pszBindRuleset);
 		free(inst->pszInputName);
 		free(inst->dfltTZ);
+		free(inst->pszStrmCmprDict);
+		free(inst->pszStrmDrvrName);
+		free(inst->pszStrmDrvrAuthMode);
+		if(inst->pPermPeers != NULL)
+			net.DestructPermittedPeers(&inst->pPermPeers);
 		del = inst;
 		inst = inst->next;
 		free(del);
@@ -1783,18 +3089,44 @@ ENDfreeCnf
  */
 BEGINrunInput
 	int nEvents;
+	int i;
 	struct epoll_event events[128];
 CODESTARTrunInput
+#	ifdef HAVE_LIBURING
+	if(runModConf->bUseUring) {
+		DBGPRINTF("imptcp: now beginning to process input data via io_uring\n");
+		uringRun();
+		FINALIZE;
+	}
+#	endif
+	if(nShards > 0) {
+		/* the input thread only serves the listeners, sessions are on the shards */
+		startShards();
+		DBGPRINTF("imptcp: now beginning to process input data on %d shards\n", nShards);
+		while(glbl.GetGlobalInputTermState() == 0) {
+			nEvents = epoll_wait(epollfd, events, sizeof(events)/sizeof(struct epoll_event),
+					     runModConf->bSessBackpressure ? BP_CHECK_INTERVAL : -1);
+			for(i = 0 ; (i < nEvents) && (glbl.GetGlobalInputTermState() == 0) ; ++i)
+				processWorkItem(events+i);
+			if(runModConf->bSessBackpressure)
+				bpCheck();
+		}
+		FINALIZE;
+	}
 	startWorkerPool();
 	DBGPRINTF("imptcp: now beginning to process input data\n");
 	while(glbl.GetGlobalInputTermState() == 0) {
 		DBGPRINTF("imptcp going on epoll_wait\n");
-		nEvents = epoll_wait(epollfd, events, sizeof(events)/sizeof(struct epoll_event), -1);
+		nEvents = epoll_wait(epollfd, events, sizeof(events)/sizeof(struct epoll_event),
+				     runModConf->bSessBackpressure ? BP_CHECK_INTERVAL : -1);
 		DBGPRINTF("imptcp: epoll returned %d events\n", nEvents);
 		processWorkSet(nEvents, events);
+		if(runModConf->bSessBackpressure)
+			bpCheck();
 	}
 	DBGPRINTF("imptcp: successfully terminated\n");
 	/* we stop the worker pool in AfterRun, in case we get cancelled for some reason (old Interface) */
+finalize_it:
 ENDrunInput
 
 
@@ -1816,7 +3148,10 @@ shutdownSrv(ptcpsrv_t *pSrv)
 	/* listeners */
 	pLstn = pSrv->pLstn;
 	while(pLstn != NULL) {
-		close(pLstn->sock);
+		if(pLstn->pStrm != NULL)
+			netstrm.Destruct(&pLstn->pStrm);
+		else
+			close(pLstn->sock);
 		statsobj.Destruct(&(pLstn->stats));
 		/* now unlink listner */
 		lstnDel = pLstn;
@@ -1831,7 +3166,10 @@ shutdownSrv(ptcpsrv_t *pSrv)
 	/* sessions */
 	pSess = pSrv->pSess;
 	while(pSess != NULL) {
-		close(pSess->sock);
+		if(pSess->pStrm != NULL)
+			netstrm.Destruct(&pSess->pStrm);
+		else
+			close(pSess->sock);
 		sessDel = pSess;
 		pSess = pSess->next;
 		DBGPRINTF("imptcp shutdown session socket %d\n", sessDel->sock);
@@ -1843,7 +3181,15 @@ shutdownSrv(ptcpsrv_t *pSrv)
 BEGINafterRun
 	ptcpsrv_t *pSrv, *srvDel;
 CODESTARTafterRun
-	stopWorkerPool();
+#	ifdef HAVE_LIBURING
+	if(runModConf->bUseUring)
+		uringStop(); /* rings must be gone before the sockets are closed */
+	else
+#	endif
+	if(nShards > 0)
+		stopShards();
+	else
+		stopWorkerPool();
 
 	/* we need to close everything that is still open */
 	pSrv = pSrvRoot;
@@ -1854,13 +3200,20 @@ CODESTARTafterRun
 		destructSrv(srvDel);
 	}
 
-	close(epollfd);
+	bufPoolDestruct(); /* only after all sessions are gone */
+	pPausedRoot = NULL; /* paused sessions are gone as well */
+
+	if(epollfd != -1) {
+		close(epollfd);
+		epollfd = -1;
+	}
 ENDafterRun
 
 
 BEGINmodExit
 CODESTARTmodExit
 	pthread_attr_destroy(&wrkrThrdAttr);
+	pthread_mutex_destroy(&mutPaused);
 	/* release objects we used */
 	objRelease(glbl, CORE_COMPONENT);
 	objRelease(statsobj, CORE_COMPONENT);
@@ -1869,6 +3222,12 @@ CODESTARTmodExit
 	objRelease(datetime, CORE_COMPONENT);
 	objRelease(errmsg, CORE_COMPONENT);
 	objRelease(ruleset, CORE_COMPONENT);
+	if(bCmprIfLoaded)
+		objRelease(cmpr, LM_CMPR_FILENAME);
+	if(bNetstrmIfLoaded) {
+		objRelease(netstrm, LM_NETSTRMS_FILENAME);
+		objRelease(netstrms, LM_NETSTRMS_FILENAME);
+	}
 ENDmodExit
 
 
@@ -1924,6 +3283,7 @@ CODEmodInit_QueryRegCFSLineHdlr
 
 	/* initialize "read-only" thread attributes */
 	pthread_attr_init(&wrkrThrdAttr);
+	pthread_mutex_init(&mutPaused, NULL);
 	pthread_attr_setstacksize(&wrkrThrdAttr, 4096*1024);
 
 	/* init legacy config settings */
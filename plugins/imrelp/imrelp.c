@@ -35,6 +35,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <signal.h>
+#include <pthread.h>
 #include <librelp.h>
 #include "rsyslog.h"
 #include "dirty.h"
@@ -48,6 +49,7 @@
 #include "ruleset.h"
 #include "glbl.h"
 #include "statsobj.h"
+#include "srUtils.h"
 
 MODULE_TYPE_INPUT
 MODULE_TYPE_NOKEEP
@@ -67,8 +69,25 @@ static rsRetVal resetConfigVariables(uchar __attribute__((unused)) *pp, void __a
 
 
 /* Module static data */
+/* librelp runs all sessions of an engine on the thread that called
+ * relpEngineRun(). To use more than one core, we run multiple engines,
+ * each on its own thread, and distribute the listeners over them. The
+ * first engine is run by the input thread itself.
+ */
+typedef struct relpWrkr_s {
+	relpEngine_t *pEngine;
+	pthread_t tid;
+	sbool bThrdStarted;
+	volatile sbool bThrdDone;
+	/* the last peer seen on this engine, so that we do not need to create
+	 * new properties for each message. Only used by the engine's thread.
+	 */
+	prop_t *pRcvFrom;
+	prop_t *pRcvFromIP;
+} relpWrkr_t;
+static relpWrkr_t *relpWrkrs = NULL;	/* our relp engines */
+static int nRelpWrkrs = 0;
 /* config vars for legacy config system */
-static relpEngine_t *pRelpEngine;	/* our relp engine */
 static prop_t *pInputName = NULL;	/* there is only one global inputName for all messages generated by this module */
 static struct configSettings_s {
 	uchar *pszBindRuleset;		/* name of Ruleset to bind to */
@@ -104,6 +123,7 @@ struct instanceConf_s {
 	struct {
 		statsobj_t *stats;	/* listener stats */
 		STATSCOUNTER_DEF(ctrSubmit, mutCtrSubmit)
+		relpWrkr_t *pWrkr;	/* engine this listener runs on */
 	} data;
 };
 
@@ -113,6 +133,7 @@ struct modConfData_s {
 	instanceConf_t *root, *tail;
 	uchar *pszBindRuleset;		/* name of Ruleset to bind to */
 	ruleset_t *pBindRuleset; /* due to librelp limitation, we need to bind all listerns to the same set */
+	int nWrkrs;			/* number of relp engines (threads) to run */
 };
 
 static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
@@ -121,6 +142,7 @@ static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current lo
 /* module-global parameters */
 static struct cnfparamdescr modpdescr[] = {
 	{ "ruleset", eCmdHdlrGetWord, 0 },
+	{ "workerthreads", eCmdHdlrPositiveInt, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -192,9 +214,9 @@ onAuthErr(void *pUsr, char *authinfo, char* errmesg, __attribute__((unused)) rel
 static relpRetVal
 onSyslogRcv(void *pUsr, uchar *pHostname, uchar *pIP, uchar *msg, size_t lenMsg)
 {
-	prop_t *pProp = NULL;
 	msg_t *pMsg;
 	instanceConf_t *inst = (instanceConf_t*) pUsr;
+	relpWrkr_t *pWrkr = inst->data.pWrkr;
 	DEFiRet;
 
 	CHKiRet(msgConstruct(&pMsg));
@@ -204,13 +226,12 @@ onSyslogRcv(void *pUsr, uchar *pHostname, uchar *pIP, uchar *msg, size_t lenMsg)
 	MsgSetRuleset(pMsg, runModConf->pBindRuleset);
 	pMsg->msgFlags  = PARSE_HOSTNAME | NEEDS_PARSING;
 
-	/* TODO: optimize this, we can store it inside the session, requires
-	 * changes to librelp --> next librelp iteration?. rgerhards, 2012-10-29
+	/* We do not know the session, so we keep the last peer per engine.
+	 * As librelp delivers all messages of a received buffer in a row,
+	 * the properties can usually be reused.
 	 */
-	MsgSetRcvFromStr(pMsg, pHostname, ustrlen(pHostname), &pProp);
-	CHKiRet(prop.Destruct(&pProp));
-	CHKiRet(MsgSetRcvFromIPStr(pMsg, pIP, ustrlen(pIP), &pProp));
-	CHKiRet(prop.Destruct(&pProp));
+	MsgSetRcvFromStr(pMsg, pHostname, ustrlen(pHostname), &pWrkr->pRcvFrom);
+	CHKiRet(MsgSetRcvFromIPStr(pMsg, pIP, ustrlen(pIP), &pWrkr->pRcvFromIP));
 	CHKiRet(submitMsg2(pMsg));
 	STATSCOUNTER_INC(inst->data.ctrSubmit, inst->data.mutCtrSubmit);
 
@@ -297,9 +318,11 @@ addListner(modConfData_t __attribute__((unused)) *modConf, instanceConf_t *inst)
 	int relpRet;
 	uchar statname[64];
 	int i;
+	relpEngine_t *pRelpEngine;
 	DEFiRet;
-	if(pRelpEngine == NULL) {
-		CHKiRet(relpEngineConstruct(&pRelpEngine));
+	if(inst->data.pWrkr->pEngine == NULL) {
+		CHKiRet(relpEngineConstruct(&inst->data.pWrkr->pEngine));
+		pRelpEngine = inst->data.pWrkr->pEngine;
 		CHKiRet(relpEngineSetDbgprint(pRelpEngine, dbgprintf));
 		CHKiRet(relpEngineSetFamily(pRelpEngine, glbl.GetDefPFFamily()));
 		CHKiRet(relpEngineSetEnableCmd(pRelpEngine, (uchar*) "syslog", eRelpCmdState_Required));
@@ -311,6 +334,7 @@ addListner(modConfData_t __attribute__((unused)) *modConf, instanceConf_t *inst)
 			CHKiRet(relpEngineSetDnsLookupMode(pRelpEngine, 1));
 		}
 	}
+	pRelpEngine = inst->data.pWrkr->pEngine;
 
 	CHKiRet(relpEngineListnerConstruct(pRelpEngine, &pSrv));
 	CHKiRet(relpSrvSetLstnPort(pSrv, inst->pszBindPort));
@@ -449,6 +473,7 @@ CODESTARTbeginCnfLoad
 	pModConf->pConf = pConf;
 	pModConf->pszBindRuleset = NULL;
 	pModConf->pBindRuleset = NULL;
+	pModConf->nWrkrs = 1;
 	/* init legacy config variables */
 	cs.pszBindRuleset = NULL;
 ENDbeginCnfLoad
@@ -475,6 +500,8 @@ CODESTARTsetModCnf
 			continue;
 		if(!strcmp(modpblk.descr[i].name, "ruleset")) {
 			loadModConf->pszBindRuleset = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(modpblk.descr[i].name, "workerthreads")) {
+			loadModConf->nWrkrs = (int) pvals[i].val.d.n;
 		} else {
 			dbgprintf("imrelp: program error, non-handled "
 			  "param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
@@ -529,12 +556,29 @@ ENDcheckCnf
 
 BEGINactivateCnfPrePrivDrop
 	instanceConf_t *inst;
+	int nInst;
+	int i;
 CODESTARTactivateCnfPrePrivDrop
 	runModConf = pModConf;
-	for(inst = runModConf->root ; inst != NULL ; inst = inst->next) {
+	/* more engines than listeners do not make sense, as a listener's
+	 * sessions are all handled by the listener's engine.
+	 */
+	nInst = 0;
+	for(inst = runModConf->root ; inst != NULL ; inst = inst->next)
+		++nInst;
+	nRelpWrkrs = (runModConf->nWrkrs < nInst) ? runModConf->nWrkrs : nInst;
+	if(nRelpWrkrs == 0)
+		ABORT_FINALIZE(RS_RET_NO_RUN);
+	CHKmalloc(relpWrkrs = calloc(nRelpWrkrs, sizeof(relpWrkr_t)));
+	DBGPRINTF("imrelp: %d listeners on %d relp engines\n", nInst, nRelpWrkrs);
+
+	for(i = 0, inst = runModConf->root ; inst != NULL ; inst = inst->next, ++i) {
+		inst->data.pWrkr = &relpWrkrs[i % nRelpWrkrs];
 		addListner(pModConf, inst);
 	}
-	if(pRelpEngine == NULL)
+	for(i = 0 ; i < nRelpWrkrs && relpWrkrs[i].pEngine == NULL ; ++i)
+		/* search */;
+	if(i == nRelpWrkrs)
 		ABORT_FINALIZE(RS_RET_NO_RUN);
 finalize_it:
 ENDactivateCnfPrePrivDrop
@@ -567,36 +611,112 @@ ENDfreeCnf
  * other activity on the thread. As such, it is safe to request the stop. When
  * we terminate, relpEngine is called, and it's select() loop interrupted. But
  * only *after this function is done*. So we do not have a race!
+ * The handler is shared by all engine threads, so we simply tell all
+ * engines to stop, no matter which thread received the signal.
  */
 static void
 doSIGTTIN(int __attribute__((unused)) sig)
 {
+	int i;
 	DBGPRINTF("imrelp: termination requested via SIGTTIN - telling RELP engine\n");
-	relpEngineSetStop(pRelpEngine);
+	for(i = 0 ; i < nRelpWrkrs ; ++i) {
+		if(relpWrkrs[i].pEngine != NULL)
+			relpEngineSetStop(relpWrkrs[i].pEngine);
+	}
+}
+
+
+/* set up the calling thread so that only SIGTTIN is delivered to it,
+ * which is used to interrupt the relp engine.
+ */
+static void
+setupEngineThrdSignals(void)
+{
+	sigset_t sigSet;
+
+	sigfillset(&sigSet);
+	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+	sigemptyset(&sigSet);
+	sigaddset(&sigSet, SIGTTIN);
+	pthread_sigmask(SIG_UNBLOCK, &sigSet, NULL);
+}
+
+
+/* thread for running an additional relp engine
+ */
+static void *
+engineThrd(void *myself)
+{
+	relpWrkr_t *pWrkr = (relpWrkr_t*) myself;
+
+	setupEngineThrdSignals();
+	DBGPRINTF("imrelp: engine thread %p started\n", pWrkr);
+	relpEngineRun(pWrkr->pEngine);
+	DBGPRINTF("imrelp: engine thread %p terminates\n", pWrkr);
+	pWrkr->bThrdDone = 1;
+	return NULL;
+}
+
+
+/* stop the additional engine threads. The stop request has already been
+ * placed into all engines by doSIGTTIN(), but the threads may be blocked
+ * inside the engine's wait, so we interrupt them until they are gone.
+ */
+static void
+stopEngineThrds(void)
+{
+	int i;
+
+	for(i = 0 ; i < nRelpWrkrs ; ++i) {
+		if(!relpWrkrs[i].bThrdStarted)
+			continue;
+		relpEngineSetStop(relpWrkrs[i].pEngine);
+		while(!relpWrkrs[i].bThrdDone) {
+			pthread_kill(relpWrkrs[i].tid, SIGTTIN);
+			srSleep(0, 10000);
+		}
+		pthread_join(relpWrkrs[i].tid, NULL);
+		relpWrkrs[i].bThrdStarted = 0;
+	}
 }
 
 
 /* This function is called to gather input.
  */
 BEGINrunInput
-	sigset_t sigSet;
 	struct sigaction sigAct;
+	relpWrkr_t *pMain = NULL;
+	int i;
 CODESTARTrunInput
 	/* we want to support non-cancel input termination. To do so, we must signal librelp
 	 * when to stop. As we run on the same thread, we need to register as SIGTTIN handler,
 	 * which will be used to put the terminating condition into librelp.
 	 */
-	sigfillset(&sigSet);
-	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
-	sigemptyset(&sigSet);
-	sigaddset(&sigSet, SIGTTIN);
-	pthread_sigmask(SIG_UNBLOCK, &sigSet, NULL);
+	setupEngineThrdSignals();
 	memset(&sigAct, 0, sizeof (sigAct));
 	sigemptyset(&sigAct.sa_mask);
 	sigAct.sa_handler = doSIGTTIN;
 	sigaction(SIGTTIN, &sigAct, NULL);
 
-	iRet = relpEngineRun(pRelpEngine);
+	/* the first engine is run by ourselfs, all others get their own thread */
+	for(i = 0 ; i < nRelpWrkrs ; ++i) {
+		if(relpWrkrs[i].pEngine == NULL)
+			continue;
+		if(pMain == NULL) {
+			pMain = &relpWrkrs[i];
+			continue;
+		}
+		relpWrkrs[i].bThrdDone = 0;
+		if(pthread_create(&relpWrkrs[i].tid, NULL, engineThrd, &relpWrkrs[i]) == 0) {
+			relpWrkrs[i].bThrdStarted = 1;
+		} else {
+			errmsg.LogError(errno, RS_RET_ERR, "imrelp: could not start engine "
+					"thread, listeners on it are inactive");
+		}
+	}
+
+	iRet = relpEngineRun(pMain->pEngine);
+	stopEngineThrds();
 ENDrunInput
 
 
@@ -612,9 +732,19 @@ ENDafterRun
 
 
 BEGINmodExit
+	int i;
 CODESTARTmodExit
-	if(pRelpEngine != NULL)
-		iRet = relpEngineDestruct(&pRelpEngine);
+	for(i = 0 ; i < nRelpWrkrs ; ++i) {
+		if(relpWrkrs[i].pEngine != NULL)
+			iRet = relpEngineDestruct(&relpWrkrs[i].pEngine);
+		if(relpWrkrs[i].pRcvFrom != NULL)
+			prop.Destruct(&relpWrkrs[i].pRcvFrom);
+		if(relpWrkrs[i].pRcvFromIP != NULL)
+			prop.Destruct(&relpWrkrs[i].pRcvFromIP);
+	}
+	free(relpWrkrs);
+	relpWrkrs = NULL;
+	nRelpWrkrs = 0;
 
 	/* global variable cleanup */
 	if(pInputName != NULL)
@@ -661,7 +791,6 @@ BEGINmodInit()
 CODESTARTmodInit
 	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
 CODEmodInit_QueryRegCFSLineHdlr
-	pRelpEngine = NULL;
 	/* request objects we use */
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
 	CHKiRet(objUse(prop, CORE_COMPONENT));
@@ -118,6 +118,8 @@ struct modConfData_s {
 	instanceConf_t *root, *tail;
 	int iTCPSessMax; /* max number of sessions */
 	int iTCPLstnMax; /* max number of sessions */
+	int iNumWrkr; /* session workers with own poll set, 0 = shared pool */
+	int iFastOpen; /* TCP Fast Open queue length, 0 = off */
 	int iStrmDrvrMode; /* mode for stream driver, driver-dependent (0 mostly means plain tcp) */
 	int iAddtlFrameDelim; /* addtl frame delimiter, e.g. for netscreen, default none */
 	int bSuppOctetFram;
@@ -148,7 +150,9 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "streamdriver.authmode", eCmdHdlrString, 0 },
 	{ "streamdriver.name", eCmdHdlrString, 0 },
 	{ "permittedpeer", eCmdHdlrArray, 0 },
-	{ "keepalive", eCmdHdlrBinary, 0 }
+	{ "keepalive", eCmdHdlrBinary, 0 },
+	{ "workerthreads", eCmdHdlrNonNegInt, 0 },
+	{ "tcpfastopen", eCmdHdlrNonNegInt, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -327,6 +331,8 @@ addListner(modConfData_t *modConf, instanceConf_t *inst)
 		CHKiRet(tcpsrv.SetKeepAlive(pOurTcpsrv, modConf->bKeepAlive));
 		CHKiRet(tcpsrv.SetSessMax(pOurTcpsrv, modConf->iTCPSessMax));
 		CHKiRet(tcpsrv.SetLstnMax(pOurTcpsrv, modConf->iTCPLstnMax));
+		CHKiRet(tcpsrv.SetNumWrkr(pOurTcpsrv, modConf->iNumWrkr));
+		CHKiRet(tcpsrv.SetFastOpen(pOurTcpsrv, modConf->iFastOpen));
 		CHKiRet(tcpsrv.SetDrvrMode(pOurTcpsrv, modConf->iStrmDrvrMode));
 		CHKiRet(tcpsrv.SetUseFlowControl(pOurTcpsrv, modConf->bUseFlowControl));
 		CHKiRet(tcpsrv.SetAddtlFrameDelim(pOurTcpsrv, modConf->iAddtlFrameDelim));
@@ -417,6 +423,8 @@ CODESTARTbeginCnfLoad
 	/* init our settings */
 	loadModConf->iTCPSessMax = 200;
 	loadModConf->iTCPLstnMax = 20;
+	loadModConf->iNumWrkr = 0;
+	loadModConf->iFastOpen = 0;
 	loadModConf->bSuppOctetFram = 1;
 	loadModConf->iStrmDrvrMode = 0;
 	loadModConf->bUseFlowControl = 1;
@@ -471,6 +479,10 @@ CODESTARTsetModCnf
 			loadModConf->iTCPLstnMax = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "keepalive")) {
 			loadModConf->bKeepAlive = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "workerthreads")) {
+			loadModConf->iNumWrkr = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "tcpfastopen")) {
+			loadModConf->iFastOpen = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "streamdriver.mode")) {
 			loadModConf->iStrmDrvrMode = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "streamdriver.authmode")) {
@@ -27,11 +27,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <ctype.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
 #include <pthread.h>
 #if HAVE_SYS_EPOLL_H
 #	include <sys/epoll.h>
@@ -39,6 +42,19 @@
 #ifdef HAVE_SCHED_H
 #	include <sched.h>
 #endif
+#ifdef HAVE_LINUX_FILTER_H
+#	include <linux/filter.h>
+#endif
+#ifdef HAVE_LINUX_IF_PACKET_H
+#	include <sys/mman.h>
+#	include <net/if.h>
+#	include <netinet/in.h>
+#	include <linux/if_packet.h>
+#	include <linux/if_ether.h>
+#	if defined(HAVE_LINUX_FILTER_H) && defined(TPACKET3_HDRLEN)
+#		define HAVE_IMUDP_RING 1
+#	endif
+#endif
 #include "rsyslog.h"
 #include "dirty.h"
 #include "net.h"
@@ -52,9 +68,11 @@
 #include "datetime.h"
 #include "prop.h"
 #include "ruleset.h"
+#include "conf.h"
 #include "statsobj.h"
 #include "ratelimit.h"
 #include "unicode-helper.h"
+#include "rsprobe.h"
 
 MODULE_TYPE_INPUT
 MODULE_TYPE_NOKEEP
@@ -74,17 +92,73 @@ DEFobjCurrIf(ruleset)
 DEFobjCurrIf(statsobj)
 
 
+/* Listener prefilter. It is evaluated on the raw datagram in the worker
+ * thread, before a message object is created, so dropping is very cheap.
+ * It is intentionally limited to things that need no parsing: a PRI
+ * selector, sender networks and strings in the raw message. Anything more
+ * complex belongs into the ruleset.
+ */
+struct prefiltNet_s {
+	int family;		/* AF_INET or AF_INET6 */
+	uint8_t addr[16];	/* network byte order, 4 bytes used for AF_INET */
+	int bits;		/* significant bits */
+};
+
+struct prefiltStr_s {
+	uchar *sz;
+	size_t len;
+};
+
+struct prefilt_s {
+	sbool bPri;			/* pmask is set */
+	uchar pmask[LOG_NFACILITIES+1];	/* drop messages matching this PRI selector */
+	struct prefiltNet_s *nets;	/* drop messages from these networks */
+	int nNets;
+	struct prefiltStr_s *prefixes;	/* drop raw messages beginning with one of these */
+	int nPrefixes;
+	struct prefiltStr_s *contains;	/* drop raw messages containing one of these */
+	int nContains;
+};
+
 static struct lstn_s {
 	struct lstn_s *next;
 	int sock;		/* socket */
+	int iWrkr;		/* worker owning this socket (reuseport), -1: shared by all */
+	struct udpRing_s *pRing;/* packet ring read via sock, NULL for regular sockets */
+	sbool bGro;		/* UDP_GRO is active on sock */
 	ruleset_t *pRuleset;	/* bound ruleset */
 	prop_t *pInputName;
 	statsobj_t *stats;	/* listener stats */
 	ratelimit_t *ratelimiter;
 	uchar *dfltTZ;
+	struct prefilt_s *pFilt;/* prefilter, NULL if none */
+	sbool bParseInInput;	/* parse in our worker, not in the main queue */
 	STATSCOUNTER_DEF(ctrSubmit, mutCtrSubmit)
+	STATSCOUNTER_DEF(ctrFiltDrops, mutCtrFiltDrops)
+	intctr_t ctrRingDrops;	/* packets the kernel dropped as the ring was full */
 } *lcnfRoot = NULL, *lcnfLast = NULL;
 
+#ifdef HAVE_IMUDP_RING
+/* a TPACKET_V3 receive ring. The kernel fills blocks of frames and hands
+ * them over by setting TP_STATUS_USER; we hand them back when done.
+ */
+#define UDP_RING_BLOCK_SIZE (1 << 20)
+#define UDP_RING_BLOCK_NR 16
+#define UDP_RING_FRAME_SIZE 2048
+#define UDP_RING_BLOCK_TOV 10	/* ms until a partially filled block is handed over */
+#define UDP_RING_MAX_ADDRS 8	/* max addresses the bind address may resolve to */
+struct udpRing_s {
+	uint8_t *map;		/* the mmap()ed ring */
+	size_t lenMap;
+	struct tpacket_block_desc **blocks;
+	unsigned nBlocks;
+	unsigned currBlock;	/* next block to look at */
+	uint16_t port;		/* listener port, network byte order */
+	int nAddrs;		/* number of listener addresses, 0: any */
+	struct sockaddr_storage addrs[UDP_RING_MAX_ADDRS];
+};
+#endif
+
 
 static int bLegacyCnfModGlobalsPermitted;/* are legacy module-global config parameters permitted? */
 static int bDoACLCheck;			/* are ACL checks neeed? Cached once immediately before listener startup */
@@ -95,6 +169,16 @@ static time_t ttLastDiscard = 0;	/* timestamp when a message from a non-permitte
 					 */
 #define BATCH_SIZE_DFLT 32		/* do not overdo, has heavy toll on memory, especially with large msgs */
 #define TIME_REQUERY_DFLT 2
+#define SNDR_CACHE_SIZE_DFLT 1024	/* sender cache entries per worker */
+#define SNDR_CACHE_WAYS 4		/* sender cache associativity */
+#define SNDR_RL_BURST_DFLT 1000		/* per-sender rate limit burst */
+#define SNDR_RL_REPORT_INTERVAL 60	/* seconds between per-sender rate limit reports */
+#define SNDR_RL_REPORT_TOP 5		/* number of senders named in the report */
+#if defined(HAVE_RECVMMSG) && defined(UDP_GRO)
+#	define HAVE_IMUDP_GRO 1
+#	define GRO_BUF_SIZE 65536	/* max size of a coalesced receive */
+#	define GRO_CMSG_SIZE CMSG_SPACE(sizeof(int))
+#endif
 #define SCHED_PRIO_UNSET -12345678	/* a value that indicates that the scheduling priority has not been set */
 /* config vars for legacy config system */
 static struct configSettings_s {
@@ -117,6 +201,29 @@ struct instanceConf_s {
 	int rcvbuf;			/* 0 means: do not set, keep OS default */
 	struct instanceConf_s *next;
 	sbool bAppendPortToInpname;
+	sbool bReusePort;		/* one SO_REUSEPORT socket per worker thread */
+	sbool bCpuSteering;		/* steer packets to the socket matching the rx cpu */
+	uchar *pszRingIf;		/* if set, read from packet rings on this interface */
+	sbool bGro;			/* let the kernel coalesce datagrams (UDP_GRO) */
+	struct prefilt_s *pFilt;	/* prefilter, NULL if none */
+	sbool bParseInInput;		/* parse in our worker, not in the main queue */
+};
+
+/* Per-worker sender cache. It remembers the ACL decision for a sender
+ * and, if no DNS lookup is needed, the ready-made fromhost/fromhost-ip
+ * properties. It is set associative with LRU replacement inside a set.
+ * As ACLs and DNS settings only change with the config, the cache lives
+ * exactly as long as the listeners.
+ */
+struct sndrCacheEntry_s {
+	struct sockaddr_storage addr;	/* key, only family and address are compared */
+	uint32_t lastUse;		/* for LRU replacement, 0 means unused */
+	int iPermitted;			/* ACL decision as by net.isAllowedSender2() */
+	prop_t *pFromHost;		/* NULL if resolution is done in the main queue */
+	prop_t *pFromHostIP;
+	unsigned rlTokens;		/* per-sender rate limit token bucket */
+	time_t rlLast;			/* last refill, 0 means the bucket is full */
+	unsigned rlDropped;		/* dropped since the last report */
 };
 
 /* The following structure controls the worker threads. Global data is
@@ -130,7 +237,18 @@ static struct wrkrInfo_s {
 	STATSCOUNTER_DEF(ctrCall_recvmmsg, mutCtrCall_recvmmsg)
 	STATSCOUNTER_DEF(ctrCall_recvmsg, mutCtrCall_recvmsg)
 	STATSCOUNTER_DEF(ctrMsgsRcvd, mutCtrMsgsRcvd)
+	STATSCOUNTER_DEF(ctrSndrHit, mutCtrSndrHit)
+	STATSCOUNTER_DEF(ctrSndrMiss, mutCtrSndrMiss)
+	STATSCOUNTER_DEF(ctrSndrRlDrops, mutCtrSndrRlDrops)
+	time_t ttSndrRlReport;	/* when the next rate limit report is due, 0: no drops pending */
 	uchar *pRcvBuf;		/* receive buffer (for a single packet) */
+#	ifdef HAVE_IMUDP_GRO
+	uchar *pGroBuf;		/* receive buffers for UDP_GRO sockets, NULL if none */
+	uchar *pGroCmsg;	/* control message buffers for UDP_GRO sockets */
+#	endif
+	struct sndrCacheEntry_s *sndrCache; /* NULL if disabled */
+	unsigned sndrCacheMask;	/* number of sets - 1 */
+	uint32_t sndrCacheClock;
 #	ifdef HAVE_RECVMMSG
 	struct sockaddr_storage *frominet;
 	struct mmsghdr *recvmsg_mmh;
@@ -145,8 +263,16 @@ struct modConfData_s {
 	int iSchedPolicy;		/* scheduling policy as SCHED_xxx */
 	int iSchedPrio;			/* scheduling priority */
 	int iTimeRequery;		/* how often is time to be queried inside tight recv loop? 0=always */
+	int iSndrCacheSize;		/* sender cache entries per worker, 0: only last sender */
+	int iSndrRlInterval;		/* per-sender rate limit interval in seconds, 0: off */
+	int iSndrRlBurst;		/* messages permitted per sender and interval */
 	int batchSize;			/* max nbr of input batch --> also recvmmsg() max count */
 	int8_t wrkrMax;			/* max nbr of worker threads */
+	uchar *pszCpuSet;		/* cpus the worker threads shall run on */
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	cpu_set_t cpuSet;		/* pszCpuSet, parsed */
+	sbool bCpuSet;			/* cpuSet is valid and shall be applied */
+#endif
 	sbool configSetViaV2Method;
 };
 static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
@@ -158,7 +284,11 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "schedulingpriority", eCmdHdlrInt, 0 },
 	{ "batchsize", eCmdHdlrInt, 0 },
 	{ "threads", eCmdHdlrPositiveInt, 0 },
-	{ "timerequery", eCmdHdlrInt, 0 }
+	{ "timerequery", eCmdHdlrInt, 0 },
+	{ "sendercache.size", eCmdHdlrNonNegInt, 0 },
+	{ "ratelimit.sender.interval", eCmdHdlrNonNegInt, 0 },
+	{ "ratelimit.sender.burst", eCmdHdlrPositiveInt, 0 },
+	{ "cpuset", eCmdHdlrGetWord, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -176,6 +306,15 @@ static struct cnfparamdescr inppdescr[] = {
 	{ "ratelimit.interval", eCmdHdlrInt, 0 },
 	{ "ratelimit.burst", eCmdHdlrInt, 0 },
 	{ "rcvbufsize", eCmdHdlrSize, 0 },
+	{ "reuseport", eCmdHdlrBinary, 0 },
+	{ "reuseport.cpusteering", eCmdHdlrBinary, 0 },
+	{ "ring.interface", eCmdHdlrGetWord, 0 },
+	{ "gro", eCmdHdlrBinary, 0 },
+	{ "parseininput", eCmdHdlrBinary, 0 },
+	{ "prefilter.droppri", eCmdHdlrString, 0 },
+	{ "prefilter.dropfrom", eCmdHdlrArray, 0 },
+	{ "prefilter.dropprefix", eCmdHdlrArray, 0 },
+	{ "prefilter.dropcontains", eCmdHdlrArray, 0 },
 	{ "ruleset", eCmdHdlrString, 0 }
 };
 static struct cnfparamblk inppblk =
@@ -207,6 +346,12 @@ createInstance(instanceConf_t **pinst)
 	inst->ratelimitInterval = 0; /* off */
 	inst->rcvbuf = 0;
 	inst->dfltTZ = NULL;
+	inst->bReusePort = 0;
+	inst->bCpuSteering = 0;
+	inst->pszRingIf = NULL;
+	inst->bGro = 0;
+	inst->pFilt = NULL;
+	inst->bParseInInput = 0;
 
 	/* node created, let's add to config */
 	if(loadModConf->tail == NULL) {
@@ -251,22 +396,403 @@ finalize_it:
 }
 
 
+/* attach a classic BPF program to the SO_REUSEPORT group of sock, which
+ * selects the socket by the cpu that received the packet. As the sockets
+ * are indexed in the order they joined the group, packets received on
+ * cpu n go to worker n modulo the number of workers. Combined with RSS
+ * or irq affinity, this keeps a flow on one cpu from the nic to rsyslog.
+ */
+static void
+attachCpuSteering(int sock, int nSocks)
+{
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	struct sock_filter code[] = {
+		{ BPF_LD  | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },	/* A = rx cpu */
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, nSocks },			/* A %= nSocks */
+		{ BPF_RET | BPF_A, 0, 0, 0 }					/* socket index */
+	};
+	struct sock_fprog prog;
+	char errStr[1024];
+
+	prog.len = sizeof(code) / sizeof(struct sock_filter);
+	prog.filter = code;
+	if(setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(0, NO_ERRCODE, "imudp: could not attach cpu steering "
+				"program to fd %d: %s - using kernel default distribution",
+				sock, errStr);
+	}
+#else
+	errmsg.LogError(0, RS_RET_NOT_IMPLEMENTED, "imudp: reuseport.cpusteering "
+			"is not supported on this platform, ignored (fd %d, %d sockets)",
+			sock, nSocks);
+#endif
+}
+
+
+/* create a listener entry for an already bound socket and link it to the
+ * list of listeners. iWrkr is the owning worker or -1 if the socket is
+ * shared by all workers; pRing is non-NULL for packet ring sockets.
+ */
+static rsRetVal
+addLstnSock(instanceConf_t *inst, int sock, int iWrkr, uchar *dispname, struct udpRing_s *pRing, sbool bGro)
+{
+	DEFiRet;
+	struct lstn_s *newlcnfinfo;
+	uchar inpnameBuf[128];
+	uchar *inputname;
+	uchar *port;
+
+	port = (inst->pszBindPort == NULL || *inst->pszBindPort == '\0') ? (uchar*) "514" : inst->pszBindPort;
+	CHKmalloc(newlcnfinfo = (struct lstn_s*) calloc(1, sizeof(struct lstn_s)));
+	newlcnfinfo->next = NULL;
+	newlcnfinfo->sock = sock;
+	newlcnfinfo->iWrkr = iWrkr;
+	newlcnfinfo->pRing = pRing;
+	newlcnfinfo->bGro = bGro;
+	newlcnfinfo->pRuleset = inst->pBindRuleset;
+	newlcnfinfo->dfltTZ = inst->dfltTZ;
+	newlcnfinfo->pFilt = inst->pFilt;
+	newlcnfinfo->bParseInInput = inst->bParseInInput;
+	if(inst->inputname == NULL) {
+		inputname = (uchar*)"imudp";
+	} else {
+		inputname = inst->inputname;
+	}
+	CHKiRet(ratelimitNew(&newlcnfinfo->ratelimiter, (char*)dispname, NULL));
+	if(inst->bAppendPortToInpname) {
+		snprintf((char*)inpnameBuf, sizeof(inpnameBuf), "%s%s",
+			inputname, port);
+		inpnameBuf[sizeof(inpnameBuf)-1] = '\0';
+		inputname = inpnameBuf;
+	}
+	CHKiRet(prop.Construct(&newlcnfinfo->pInputName));
+	CHKiRet(prop.SetString(newlcnfinfo->pInputName,
+		inputname, ustrlen(inputname)));
+	CHKiRet(prop.ConstructFinalize(newlcnfinfo->pInputName));
+	ratelimitSetLinuxLike(newlcnfinfo->ratelimiter, inst->ratelimitInterval,
+			      inst->ratelimitBurst);
+	/* support statistics gathering */
+	CHKiRet(statsobj.Construct(&(newlcnfinfo->stats)));
+	CHKiRet(statsobj.SetName(newlcnfinfo->stats, dispname));
+	STATSCOUNTER_INIT(newlcnfinfo->ctrSubmit, newlcnfinfo->mutCtrSubmit);
+	CHKiRet(statsobj.AddCounter(newlcnfinfo->stats, UCHAR_CONSTANT("submitted"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(newlcnfinfo->ctrSubmit)));
+	if(inst->pFilt != NULL) {
+		STATSCOUNTER_INIT(newlcnfinfo->ctrFiltDrops, newlcnfinfo->mutCtrFiltDrops);
+		CHKiRet(statsobj.AddCounter(newlcnfinfo->stats, UCHAR_CONSTANT("prefilter.dropped"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(newlcnfinfo->ctrFiltDrops)));
+	}
+	if(pRing != NULL) {
+		/* only updated by the owning worker */
+		CHKiRet(statsobj.AddCounter(newlcnfinfo->stats, UCHAR_CONSTANT("ring.drops"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(newlcnfinfo->ctrRingDrops)));
+	}
+	CHKiRet(statsobj.ConstructFinalize(newlcnfinfo->stats));
+	/* link to list. Order must be preserved to take care for 
+	 * conflicting matches.
+	 */
+	if(lcnfRoot == NULL)
+		lcnfRoot = newlcnfinfo;
+	if(lcnfLast == NULL)
+		lcnfLast = newlcnfinfo;
+	else {
+		lcnfLast->next = newlcnfinfo;
+		lcnfLast = newlcnfinfo;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+#ifdef HAVE_IMUDP_RING
+static void
+destructRing(struct udpRing_s *pRing)
+{
+	if(pRing->map != MAP_FAILED)
+		munmap(pRing->map, pRing->lenMap);
+	free(pRing->blocks);
+	free(pRing);
+}
+
+
+/* attach a BPF program to a UDP socket which drops everything. Used when
+ * a packet ring receives the traffic: the socket is still bound so that
+ * the kernel does not answer with ICMP port unreachable, but we do not
+ * want a second copy of each datagram queued on it.
+ */
+static void
+attachDropAll(int sock)
+{
+	struct sock_filter code[] = {
+		{ BPF_RET | BPF_K, 0, 0, 0 }
+	};
+	struct sock_fprog prog;
+	char errStr[1024];
+
+	prog.len = sizeof(code) / sizeof(struct sock_filter);
+	prog.filter = code;
+	if(setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(0, NO_ERRCODE, "imudp: could not attach drop filter to "
+				"fd %d: %s", sock, errStr);
+	}
+}
+
+
+/* record the addresses the listener is bound to, so that the ring only
+ * takes datagrams addressed to them. bindAddr NULL or a wildcard address
+ * means any local address.
+ */
+static rsRetVal
+setRingAddrs(struct udpRing_s *pRing, uchar *bindAddr, int iPort)
+{
+	struct addrinfo hints;
+	struct addrinfo *res = NULL;
+	struct addrinfo *r;
+	int error;
+	DEFiRet;
+
+	pRing->port = htons(iPort);
+	pRing->nAddrs = 0;
+	if(bindAddr == NULL)
+		FINALIZE;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags = AI_PASSIVE;
+	hints.ai_family = glbl.GetDefPFFamily();
+	hints.ai_socktype = SOCK_DGRAM;
+	if((error = getaddrinfo((char*) bindAddr, NULL, &hints, &res)) != 0) {
+		errmsg.LogError(0, RS_RET_ADDRESS_UNKNOWN, "imudp: could not resolve "
+				"address '%s' for packet ring: %s", bindAddr, gai_strerror(error));
+		ABORT_FINALIZE(RS_RET_ADDRESS_UNKNOWN);
+	}
+	for(r = res ; r != NULL && pRing->nAddrs < UDP_RING_MAX_ADDRS ; r = r->ai_next) {
+		if(   (r->ai_family == AF_INET
+		       && ((struct sockaddr_in*) r->ai_addr)->sin_addr.s_addr == htonl(INADDR_ANY))
+		   || (r->ai_family == AF_INET6
+		       && IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6*) r->ai_addr)->sin6_addr))) {
+			pRing->nAddrs = 0; /* wildcard */
+			FINALIZE;
+		}
+		if(r->ai_family == AF_INET || r->ai_family == AF_INET6)
+			memcpy(&pRing->addrs[pRing->nAddrs++], r->ai_addr, r->ai_addrlen);
+	}
+
+finalize_it:
+	if(res != NULL)
+		freeaddrinfo(res);
+	RETiRet;
+}
+
+/* check if a datagram's destination address (in network byte order) is
+ * one of the listener's addresses
+ */
+static int
+ringAddrMatches(struct udpRing_s *pRing, int family, const uchar *dstAddr)
+{
+	int i;
+
+	if(pRing->nAddrs == 0)
+		return 1;
+	for(i = 0 ; i < pRing->nAddrs ; ++i) {
+		if(pRing->addrs[i].ss_family != family)
+			continue;
+		if(family == AF_INET) {
+			if(!memcmp(&((struct sockaddr_in*) &pRing->addrs[i])->sin_addr, dstAddr, 4))
+				return 1;
+		} else {
+			if(!memcmp(&((struct sockaddr_in6*) &pRing->addrs[i])->sin6_addr, dstAddr, 16))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+
+/* set up a TPACKET_V3 receive ring on interface pszIf which receives
+ * all IPv4 and IPv6 UDP datagrams to port iPort on bindAddr (NULL: any
+ * address). The packet socket is of type SOCK_DGRAM, so the frames start
+ * with the network header, whatever the link layer of the interface is.
+ * If nFanout > 1, the socket joins fanout group fanoutId, so that the
+ * packets are spread over the rings of the workers. Returns the packet
+ * socket in *pSock.
+ */
+static rsRetVal
+createRing(uchar *pszIf, uchar *bindAddr, int iPort, int nFanout, int fanoutId, sbool bCpuSteering,
+	   int *pSock, struct udpRing_s **ppRing)
+{
+	/* equivalent to tcpdump -dd "udp dst port <iPort>" on a cooked
+	 * socket, but also rejecting ipv4 fragments, as they can not be
+	 * reassembled here. The destination address is checked when the
+	 * frame is processed, as the bind address may resolve to several.
+	 */
+	struct sock_filter code[] = {
+		{ BPF_LD  | BPF_B | BPF_ABS, 0, 0, 0 },		/* ip version */
+		{ BPF_ALU | BPF_RSH | BPF_K, 0, 0, 4 },
+		{ BPF_JMP | BPF_JEQ | BPF_K, 0, 4, 6 },
+		{ BPF_LD  | BPF_B | BPF_ABS, 0, 0, 6 },		/* ipv6 next header */
+		{ BPF_JMP | BPF_JEQ | BPF_K, 0, 11, IPPROTO_UDP },
+		{ BPF_LD  | BPF_H | BPF_ABS, 0, 0, 42 },		/* udp dst port */
+		{ BPF_JMP | BPF_JEQ | BPF_K, 8, 9, iPort },
+		{ BPF_JMP | BPF_JEQ | BPF_K, 0, 8, 4 },
+		{ BPF_LD  | BPF_B | BPF_ABS, 0, 0, 9 },		/* ipv4 protocol */
+		{ BPF_JMP | BPF_JEQ | BPF_K, 0, 6, IPPROTO_UDP },
+		{ BPF_LD  | BPF_H | BPF_ABS, 0, 0, 6 },		/* ipv4 flags/frag offset */
+		{ BPF_JMP | BPF_JSET | BPF_K, 4, 0, 0x3fff },		/* MF or offset: fragment */
+		{ BPF_LDX | BPF_B | BPF_MSH, 0, 0, 0 },		/* X = ipv4 header len */
+		{ BPF_LD  | BPF_H | BPF_IND, 0, 0, 2 },		/* udp dst port */
+		{ BPF_JMP | BPF_JEQ | BPF_K, 0, 1, iPort },
+		{ BPF_RET | BPF_K, 0, 0, 0x40000 },
+		{ BPF_RET | BPF_K, 0, 0, 0 }
+	};
+	struct sock_fprog prog;
+	struct tpacket_req3 req;
+	struct sockaddr_ll sll;
+	struct udpRing_s *pRing = NULL;
+	int version = TPACKET_V3;
+	int fanout;
+	int sock = -1;
+	unsigned i;
+	char errStr[1024];
+	DEFiRet;
+
+	CHKmalloc(pRing = calloc(1, sizeof(struct udpRing_s)));
+	pRing->map = MAP_FAILED;
+	CHKiRet(setRingAddrs(pRing, bindAddr, iPort));
+	if((sock = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_ALL))) < 0) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(0, RS_RET_IO_ERROR, "imudp: could not create packet "
+				"socket for ring on %s: %s", pszIf, errStr);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	/* filter before binding, so that no foreign packet enters the ring */
+	prog.len = sizeof(code) / sizeof(struct sock_filter);
+	prog.filter = code;
+	if(setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0
+	   || setsockopt(sock, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(0, RS_RET_IO_ERROR, "imudp: could not set up packet "
+				"socket for ring on %s: %s", pszIf, errStr);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = UDP_RING_BLOCK_SIZE;
+	req.tp_block_nr = UDP_RING_BLOCK_NR;
+	req.tp_frame_size = UDP_RING_FRAME_SIZE;
+	req.tp_frame_nr = (UDP_RING_BLOCK_SIZE / UDP_RING_FRAME_SIZE) * UDP_RING_BLOCK_NR;
+	req.tp_retire_blk_tov = UDP_RING_BLOCK_TOV;
+	if(setsockopt(sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(0, RS_RET_IO_ERROR, "imudp: could not create packet "
+				"ring on %s: %s", pszIf, errStr);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	pRing->lenMap = (size_t) req.tp_block_size * req.tp_block_nr;
+	pRing->map = mmap(NULL, pRing->lenMap, PROT_READ | PROT_WRITE, MAP_SHARED, sock, 0);
+	if(pRing->map == MAP_FAILED) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(0, RS_RET_IO_ERROR, "imudp: could not map packet "
+				"ring on %s: %s", pszIf, errStr);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	pRing->nBlocks = req.tp_block_nr;
+	CHKmalloc(pRing->blocks = malloc(pRing->nBlocks * sizeof(struct tpacket_block_desc*)));
+	for(i = 0 ; i < pRing->nBlocks ; ++i)
+		pRing->blocks[i] = (struct tpacket_block_desc*) (pRing->map + i * req.tp_block_size);
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = if_nametoindex((char*) pszIf);
+	if(sll.sll_ifindex == 0 || bind(sock, (struct sockaddr*) &sll, sizeof(sll)) < 0) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(0, RS_RET_IO_ERROR, "imudp: could not bind packet "
+				"ring to interface %s: %s", pszIf, errStr);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+
+	if(nFanout > 1) {
+		fanout = (fanoutId & 0xffff)
+		       | ((bCpuSteering ? PACKET_FANOUT_CPU : PACKET_FANOUT_HASH) << 16);
+		if(setsockopt(sock, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0) {
+			rs_strerror_r(errno, errStr, sizeof(errStr));
+			errmsg.LogError(0, RS_RET_IO_ERROR, "imudp: could not join fanout "
+					"group for ring on %s: %s", pszIf, errStr);
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+	}
+
+	*pSock = sock;
+	*ppRing = pRing;
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		if(pRing != NULL)
+			destructRing(pRing);
+		if(sock != -1)
+			close(sock);
+	}
+	RETiRet;
+}
+#endif /* #ifdef HAVE_IMUDP_RING */
+
+
+/* enable UDP_GRO on a socket. Returns if the kernel accepted it; if not,
+ * the socket is simply used without coalescing.
+ */
+static sbool
+enableGro(int sock)
+{
+#ifdef HAVE_IMUDP_GRO
+	int on = 1;
+	char errStr[1024];
+
+	if(setsockopt(sock, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0)
+		return 1;
+	rs_strerror_r(errno, errStr, sizeof(errStr));
+	errmsg.LogError(0, NO_ERRCODE, "imudp: could not enable UDP_GRO on fd %d: %s - "
+			"receiving without it", sock, errStr);
+#else
+	errmsg.LogError(0, RS_RET_NOT_IMPLEMENTED, "imudp: gro is not supported on "
+			"this platform, ignored for fd %d", sock);
+#endif
+	return 0;
+}
+
+
 /* This function is called when a new listener shall be added. It takes
  * the instance config description, tries to bind the socket and, if that
  * succeeds, adds it to the list of existing listen sockets.
+ * With reuseport, one set of sockets is bound for each worker thread, so
+ * that the workers do not contend on a single socket. Each of these
+ * sockets is only polled by its owning worker.
+ * With ring.interface, the datagrams are read from packet rings instead
+ * (one per worker with reuseport, else one owned by the first worker).
+ * The UDP socket is still bound, but everything on it is dropped.
  */
 static inline rsRetVal
 addListner(instanceConf_t *inst)
 {
 	DEFiRet;
 	uchar *bindAddr;
-	int *newSocks;
+	int *newSocks = NULL;
 	int iSrc;
-	struct lstn_s *newlcnfinfo;
+	int iWrkr;
+	int nSets;
 	uchar *bindName;
 	uchar *port;
-	uchar dispname[64], inpnameBuf[128];
+	uchar dispname[64];
 	uchar *inputname;
+	sbool bRing = 0;
+#	ifdef HAVE_IMUDP_RING
+	static int fanoutSeq = 0;
+	struct udpRing_s *pRing;
+	int sock;
+	int fanoutId;
+#	endif
 
 	/* check which address to bind to. We could do this more compact, but have not
 	 * done so in order to make the code more readable. -- rgerhards, 2007-12-27
@@ -279,58 +805,70 @@ addListner(instanceConf_t *inst)
 		bindAddr = inst->pszBindAddr;
 	bindName = (bindAddr == NULL) ? (uchar*)"*" : bindAddr;
 	port = (inst->pszBindPort == NULL || *inst->pszBindPort == '\0') ? (uchar*) "514" : inst->pszBindPort;
+	inputname = (inst->inputname == NULL) ? (uchar*)"imudp" : inst->inputname;
+
+	nSets = inst->bReusePort ? runModConf->wrkrMax : 1;
+	if(inst->pszRingIf != NULL) {
+#		ifdef HAVE_IMUDP_RING
+		DBGPRINTF("Trying to open packet rings for UDP port %s on %s.\n", port, inst->pszRingIf);
+		fanoutId = (getpid() + fanoutSeq++) & 0xffff;
+		for(iWrkr = 0 ; iWrkr < nSets ; ++iWrkr) {
+			if(createRing(inst->pszRingIf, bindAddr, atoi((char*) port), nSets, fanoutId,
+				      inst->bCpuSteering, &sock, &pRing) != RS_RET_OK)
+				break;
+			snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s/r%d)",
+				 inputname, inst->pszRingIf, port, iWrkr);
+			dispname[sizeof(dispname)-1] = '\0';
+			if(addLstnSock(inst, sock, iWrkr, dispname, pRing, 0) != RS_RET_OK) {
+				destructRing(pRing);
+				close(sock);
+				break;
+			}
+			bRing = 1;
+		}
+		if(bRing) {
+			nSets = 1; /* the UDP socket is only a placeholder */
+		} else {
+			errmsg.LogError(0, NO_ERRCODE, "imudp: no packet ring on %s, using "
+					"regular socket for port %s", inst->pszRingIf, port);
+		}
+#		else
+		errmsg.LogError(0, RS_RET_NOT_IMPLEMENTED, "imudp: ring.interface is not "
+				"supported on this platform, using regular socket for port %s",
+				port);
+#		endif
+	}
 
 	DBGPRINTF("Trying to open syslog UDP ports at %s:%s.\n", bindName, inst->pszBindPort);
 
-	newSocks = net.create_udp_socket(bindAddr, port, 1, inst->rcvbuf);
-	if(newSocks != NULL) {
+	for(iWrkr = 0 ; iWrkr < nSets ; ++iWrkr) {
+		newSocks = net.create_udp_socket(bindAddr, port, 1, inst->rcvbuf, inst->bReusePort && !bRing);
+		if(newSocks == NULL)
+			continue;
+		if(iWrkr == 0 && inst->bCpuSteering && !bRing) {
+			for(iSrc = 1 ; iSrc <= newSocks[0] ; ++iSrc)
+				attachCpuSteering(newSocks[iSrc], nSets);
+		}
 		/* we now need to add the new sockets to the existing set */
 		/* ready to copy */
 		for(iSrc = 1 ; iSrc <= newSocks[0] ; ++iSrc) {
-			CHKmalloc(newlcnfinfo = (struct lstn_s*) MALLOC(sizeof(struct lstn_s)));
-			newlcnfinfo->next = NULL;
-			newlcnfinfo->sock = newSocks[iSrc];
-			newlcnfinfo->pRuleset = inst->pBindRuleset;
-			newlcnfinfo->dfltTZ = inst->dfltTZ;
-			if(inst->inputname == NULL) {
-				inputname = (uchar*)"imudp";
+#			ifdef HAVE_IMUDP_RING
+			if(bRing)
+				attachDropAll(newSocks[iSrc]);
+#			endif
+			if(inst->bReusePort && !bRing) {
+				snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s/w%d)",
+					 inputname, bindName, port, iWrkr);
 			} else {
-				inputname = inst->inputname;
+				snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s)",
+					 inputname, bindName, port);
 			}
-			snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s)", inputname, bindName, port);
 			dispname[sizeof(dispname)-1] = '\0'; /* just to be on the save side... */
-			CHKiRet(ratelimitNew(&newlcnfinfo->ratelimiter, (char*)dispname, NULL));
-			if(inst->bAppendPortToInpname) {
-				snprintf((char*)inpnameBuf, sizeof(inpnameBuf), "%s%s",
-					inputname, port);
-				inpnameBuf[sizeof(inpnameBuf)-1] = '\0';
-				inputname = inpnameBuf;
-			}
-			CHKiRet(prop.Construct(&newlcnfinfo->pInputName));
-			CHKiRet(prop.SetString(newlcnfinfo->pInputName,
-				inputname, ustrlen(inputname)));
-			CHKiRet(prop.ConstructFinalize(newlcnfinfo->pInputName));
-			ratelimitSetLinuxLike(newlcnfinfo->ratelimiter, inst->ratelimitInterval,
-					      inst->ratelimitBurst);
-			/* support statistics gathering */
-			CHKiRet(statsobj.Construct(&(newlcnfinfo->stats)));
-			CHKiRet(statsobj.SetName(newlcnfinfo->stats, dispname));
-			STATSCOUNTER_INIT(newlcnfinfo->ctrSubmit, newlcnfinfo->mutCtrSubmit);
-			CHKiRet(statsobj.AddCounter(newlcnfinfo->stats, UCHAR_CONSTANT("submitted"),
-				ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(newlcnfinfo->ctrSubmit)));
-			CHKiRet(statsobj.ConstructFinalize(newlcnfinfo->stats));
-			/* link to list. Order must be preserved to take care for 
-			 * conflicting matches.
-			 */
-			if(lcnfRoot == NULL)
-				lcnfRoot = newlcnfinfo;
-			if(lcnfLast == NULL)
-				lcnfLast = newlcnfinfo;
-			else {
-				lcnfLast->next = newlcnfinfo;
-				lcnfLast = newlcnfinfo;
-			}
+			CHKiRet(addLstnSock(inst, newSocks[iSrc], (inst->bReusePort && !bRing) ? iWrkr : -1,
+					    dispname, NULL, (inst->bGro && !bRing) ? enableGro(newSocks[iSrc]) : 0));
 		}
+		free(newSocks);
+		newSocks = NULL;
 	}
 
 finalize_it:
@@ -349,25 +887,334 @@ std_checkRuleset_genErrMsg(__attribute__((unused)) modConfData_t *modConf, insta
 }
 
 
+/* log that a message from a disallowed sender was discarded, if so
+ * configured. This is done at most once a minute to prevent remote DoS.
+ */
+static inline void
+logDisallowedSender(void)
+{
+	time_t tt;
+
+	DBGPRINTF("msg is not from an allowed sender\n");
+	if(glbl.GetOption_DisallowWarning) {
+		datetime.GetTime(&tt);
+		if(tt > ttLastDiscard + 60) {
+			ttLastDiscard = tt;
+			errmsg.LogError(0, NO_ERRCODE,
+			"UDP message from disallowed sender discarded");
+		}
+	}
+}
+
+
+/* hash the address part of a sender for the sender cache */
+static inline unsigned
+sndrCacheHash(struct sockaddr_storage *sa)
+{
+	uint32_t h;
+	uint32_t a[4];
+
+	if(sa->ss_family == AF_INET) {
+		h = ((struct sockaddr_in*) sa)->sin_addr.s_addr;
+	} else if(sa->ss_family == AF_INET6) {
+		memcpy(a, ((struct sockaddr_in6*) sa)->sin6_addr.s6_addr, sizeof(a));
+		h = a[0] ^ a[1] ^ a[2] ^ a[3];
+	} else {
+		h = 0;
+	}
+	h *= 2654435761u; /* Knuth's multiplicative hash */
+	return h ^ (h >> 16);
+}
+
+
+/* look up a sender in the worker's sender cache. On a miss, the least
+ * recently used entry of the set is replaced: the ACL check is done
+ * and, if the host names need no DNS lookup, the fromhost properties
+ * are built. Lookups that would require DNS are still left to the main
+ * queue, as they could block the receiver.
+ */
+static struct sndrCacheEntry_s *
+sndrCacheLookup(struct wrkrInfo_s *pWrkr, struct sockaddr_storage *frominet)
+{
+	struct sndrCacheEntry_s *set;
+	struct sndrCacheEntry_s *victim;
+	int i;
+
+	set = pWrkr->sndrCache + (sndrCacheHash(frominet) & pWrkr->sndrCacheMask) * SNDR_CACHE_WAYS;
+	victim = set;
+	for(i = 0 ; i < SNDR_CACHE_WAYS ; ++i) {
+		if(set[i].lastUse != 0
+		   && net.CmpHost(frominet, &set[i].addr, sizeof(struct sockaddr_storage)) == 0) {
+			set[i].lastUse = ++pWrkr->sndrCacheClock;
+			STATSCOUNTER_INC(pWrkr->ctrSndrHit, pWrkr->mutCtrSndrHit);
+			return set + i;
+		}
+		if(set[i].lastUse < victim->lastUse)
+			victim = set + i;
+	}
+
+	STATSCOUNTER_INC(pWrkr->ctrSndrMiss, pWrkr->mutCtrSndrMiss);
+	if(victim->pFromHost != NULL)
+		prop.Destruct(&victim->pFromHost);
+	if(victim->pFromHostIP != NULL)
+		prop.Destruct(&victim->pFromHostIP);
+	memcpy(&victim->addr, frominet, sizeof(struct sockaddr_storage));
+	victim->rlLast = 0;
+	victim->rlDropped = 0;
+	/* Here we check if a host is permitted to send us syslog messages. If the
+	 * check would require name resolution, it is postponed to the main queue.
+	 * See also my blog post at
+	 * http://blog.gerhards.net/2009/11/acls-imudp-and-accepting-messages.html
+	 */
+	victim->iPermitted = bDoACLCheck ? net.isAllowedSender2((uchar*)"UDP",
+					(struct sockaddr *)frominet, "", 0) : 1;
+	if(victim->iPermitted == 1 && glbl.GetDisableDNS()) {
+		if(net.cvthname(frominet, &victim->pFromHost, NULL, &victim->pFromHostIP) != RS_RET_OK) {
+			victim->pFromHost = NULL;
+			victim->pFromHostIP = NULL;
+		}
+	}
+	victim->lastUse = ++pWrkr->sndrCacheClock;
+	return victim;
+}
+
+
+/* release the sender cache of a worker, including its properties */
+static void
+sndrCacheDestruct(struct wrkrInfo_s *pWrkr)
+{
+	unsigned i;
+
+	if(pWrkr->sndrCache == NULL)
+		return;
+	for(i = 0 ; i < (pWrkr->sndrCacheMask + 1) * SNDR_CACHE_WAYS ; ++i) {
+		if(pWrkr->sndrCache[i].pFromHost != NULL)
+			prop.Destruct(&pWrkr->sndrCache[i].pFromHost);
+		if(pWrkr->sndrCache[i].pFromHostIP != NULL)
+			prop.Destruct(&pWrkr->sndrCache[i].pFromHostIP);
+	}
+	free(pWrkr->sndrCache);
+	pWrkr->sndrCache = NULL;
+}
+
+
+/* Per-sender rate limiting. Each sender cache entry carries a token
+ * bucket that holds up to ratelimit.sender.burst tokens and is refilled
+ * at burst tokens per ratelimit.sender.interval seconds. The check is done
+ * on the raw datagram, so a flooding sender costs us no message object.
+ * As the cache is per worker, so are the buckets; with reuseport, the
+ * kernel keeps a sender on one socket anyway. Returns 1 if the datagram
+ * must be dropped.
+ */
+static inline int
+sndrRateLimited(struct sndrCacheEntry_s *pSndr, time_t tt)
+{
+	const unsigned burst = runModConf->iSndrRlBurst;
+	uint64_t refill;
+
+	if(pSndr->rlLast == 0 || tt < pSndr->rlLast) {
+		/* new sender (or the clock was set back) */
+		pSndr->rlTokens = burst;
+		pSndr->rlLast = tt;
+	} else if(tt > pSndr->rlLast) {
+		/* a fraction of a token is lost on refill, which does not matter
+		 * for a limit that is meant to stop floods.
+		 */
+		refill = (uint64_t) (tt - pSndr->rlLast) * burst / runModConf->iSndrRlInterval;
+		if(refill > 0) {
+			pSndr->rlTokens = (refill >= burst - pSndr->rlTokens) ? burst
+									      : pSndr->rlTokens + refill;
+			pSndr->rlLast = tt;
+		}
+	}
+
+	if(pSndr->rlTokens == 0) {
+		++pSndr->rlDropped;
+		return 1;
+	}
+	--pSndr->rlTokens;
+	return 0;
+}
+
+
+/* report the senders that were rate limited most since the last report.
+ * The counts are taken from the sender cache, so senders that have been
+ * evicted meanwhile are missing; the "ratelimit.sender.dropped" counter
+ * is always exact.
+ */
+static void
+sndrRateLimitReport(struct wrkrInfo_s *pWrkr)
+{
+	struct sndrCacheEntry_s *top[SNDR_RL_REPORT_TOP];
+	struct sndrCacheEntry_s *pSndr;
+	char host[NI_MAXHOST];
+	char szTop[SNDR_RL_REPORT_TOP * (NI_MAXHOST + 16)];
+	size_t lenTop = 0;
+	unsigned total = 0;
+	unsigned i;
+	int j, nTop = 0;
+
+	for(i = 0 ; i < (pWrkr->sndrCacheMask + 1) * SNDR_CACHE_WAYS ; ++i) {
+		pSndr = pWrkr->sndrCache + i;
+		if(pSndr->lastUse == 0 || pSndr->rlDropped == 0)
+			continue;
+		total += pSndr->rlDropped;
+		/* insertion into the (tiny) sorted top list */
+		for(j = nTop ; j > 0 && top[j-1]->rlDropped < pSndr->rlDropped ; --j) {
+			if(j < SNDR_RL_REPORT_TOP)
+				top[j] = top[j-1];
+		}
+		if(j < SNDR_RL_REPORT_TOP) {
+			top[j] = pSndr;
+			if(nTop < SNDR_RL_REPORT_TOP)
+				++nTop;
+		}
+	}
+
+	szTop[0] = '\0';
+	for(j = 0 ; j < nTop ; ++j) {
+		if(getnameinfo((struct sockaddr*) &top[j]->addr, SALEN((struct sockaddr*) &top[j]->addr),
+			       host, sizeof(host), NULL, 0, NI_NUMERICHOST) != 0)
+			strcpy(host, "?");
+		lenTop += snprintf(szTop + lenTop, sizeof(szTop) - lenTop, "%s%s (%u)",
+				   j == 0 ? "" : ", ", host, top[j]->rlDropped);
+	}
+	for(i = 0 ; i < (pWrkr->sndrCacheMask + 1) * SNDR_CACHE_WAYS ; ++i)
+		pWrkr->sndrCache[i].rlDropped = 0;
+
+	errmsg.LogError(0, RS_RET_RATE_LIMITED, "imudp: worker %d dropped %u messages "
+			"due to per-sender rate limiting, top senders: %s",
+			pWrkr->id, total, szTop);
+}
+
+
+/* check if the sender address is inside a prefilter network. IPv4-mapped
+ * IPv6 senders are checked against the IPv4 networks.
+ */
+static inline int
+prefiltNetMatch(struct prefiltNet_s *pNet, struct sockaddr_storage *frominet)
+{
+	static const uint8_t v4mapped[12] = { 0,0,0,0, 0,0,0,0, 0,0,0xff,0xff };
+	const uint8_t *addr;
+	int nBytes, nBits;
+
+	if(frominet->ss_family == AF_INET) {
+		if(pNet->family != AF_INET)
+			return 0;
+		addr = (const uint8_t*) &((struct sockaddr_in*)frominet)->sin_addr;
+	} else if(frominet->ss_family == AF_INET6) {
+		addr = (const uint8_t*) &((struct sockaddr_in6*)frominet)->sin6_addr;
+		if(pNet->family == AF_INET) {
+			if(memcmp(addr, v4mapped, sizeof(v4mapped)))
+				return 0;
+			addr += sizeof(v4mapped);
+		}
+	} else {
+		return 0;
+	}
+
+	nBytes = pNet->bits / 8;
+	nBits = pNet->bits % 8;
+	if(memcmp(addr, pNet->addr, nBytes))
+		return 0;
+	if(nBits != 0 && ((addr[nBytes] ^ pNet->addr[nBytes]) & (0xff << (8 - nBits))))
+		return 0;
+	return 1;
+}
+
+
+/* apply the listener prefilter to a raw datagram. Returns 1 if it must be
+ * dropped. The PRI is extracted the same way as the parser does it.
+ */
+static inline int
+prefiltDrop(struct prefilt_s *pFilt, uchar *rcvBuf, size_t lenRcvBuf, struct sockaddr_storage *frominet)
+{
+	int i;
+	int pri;
+	size_t j;
+	uchar *p;
+
+	if(pFilt->bPri) {
+		pri = LOG_USER|LOG_NOTICE;
+		if(rcvBuf[0] == '<') {
+			pri = 0;
+			for(j = 1 ; j < lenRcvBuf && j < 5 && isdigit(rcvBuf[j]) ; ++j)
+				pri = 10 * pri + (rcvBuf[j] - '0');
+			if(pri & ~(LOG_FACMASK|LOG_PRIMASK))
+				pri = LOG_USER|LOG_NOTICE;
+		}
+		if(pFilt->pmask[LOG_FAC(pri)] != TABLE_NOPRI
+		   && (pFilt->pmask[LOG_FAC(pri)] & (1 << LOG_PRI(pri))))
+			return 1;
+	}
+	for(i = 0 ; i < pFilt->nNets ; ++i) {
+		if(prefiltNetMatch(pFilt->nets + i, frominet))
+			return 1;
+	}
+	for(i = 0 ; i < pFilt->nPrefixes ; ++i) {
+		if(lenRcvBuf >= pFilt->prefixes[i].len
+		   && !memcmp(rcvBuf, pFilt->prefixes[i].sz, pFilt->prefixes[i].len))
+			return 1;
+	}
+	for(i = 0 ; i < pFilt->nContains ; ++i) {
+		const size_t len = pFilt->contains[i].len;
+		const uchar *const sz = pFilt->contains[i].sz;
+		if(len > lenRcvBuf)
+			continue;
+		for(  p = rcvBuf
+		    ; (p = memchr(p, sz[0], lenRcvBuf - len + 1 - (p - rcvBuf))) != NULL
+		    ; ++p) {
+			if(!memcmp(p, sz, len))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+
 /* This function processes received data. It provides unified handling
  * in cases where recvmmsg() is available and not.
  */
 static inline rsRetVal
-processPacket(thrdInfo_t *pThrd, struct lstn_s *lstn, struct sockaddr_storage *frominetPrev, int *pbIsPermitted,
+processPacket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_storage *frominetPrev, int *pbIsPermitted,
 	uchar *rcvBuf, ssize_t lenRcvBuf, struct syslogTime *stTime, time_t ttGenTime,
 	struct sockaddr_storage *frominet, socklen_t socklen, multi_submit_t *multiSub)
 {
 	DEFiRet;
 	msg_t *pMsg;
+	struct sndrCacheEntry_s *pSndr = NULL;
 
-	assert(pThrd != NULL);
+	assert(pWrkr->pThrd != NULL);
 
 	if(lenRcvBuf == 0)
 		FINALIZE; /* this looks a bit strange, but practice shows it happens... */
 
+	if(lstn->pFilt != NULL && prefiltDrop(lstn->pFilt, rcvBuf, lenRcvBuf, frominet)) {
+		STATSCOUNTER_INC(lstn->ctrFiltDrops, lstn->mutCtrFiltDrops);
+		FINALIZE;
+	}
+
 	/* if we reach this point, we had a good receive and can process the packet received */
-	/* check if we have a different sender than before, if so, we need to query some new values */
-	if(bDoACLCheck) {
+	if(pWrkr->sndrCache != NULL) {
+		pSndr = sndrCacheLookup(pWrkr, frominet);
+		*pbIsPermitted = pSndr->iPermitted;
+		if(*pbIsPermitted == 0) {
+			logDisallowedSender();
+		} else if(runModConf->iSndrRlInterval > 0 && sndrRateLimited(pSndr, ttGenTime)) {
+			STATSCOUNTER_INC(pWrkr->ctrSndrRlDrops, pWrkr->mutCtrSndrRlDrops);
+			/* drops are collected for SNDR_RL_REPORT_INTERVAL and reported
+			 * with the first drop after that.
+			 */
+			if(pWrkr->ttSndrRlReport == 0) {
+				pWrkr->ttSndrRlReport = ttGenTime + SNDR_RL_REPORT_INTERVAL;
+			} else if(ttGenTime >= pWrkr->ttSndrRlReport) {
+				sndrRateLimitReport(pWrkr);
+				pWrkr->ttSndrRlReport = 0;
+			}
+			FINALIZE;
+		}
+	} else if(bDoACLCheck) {
+		/* check if we have a different sender than before, if so, we need to query some new values */
 		socklen = sizeof(struct sockaddr_storage);
 		if(net.CmpHost(frominet, frominetPrev, socklen) != 0) {
 			memcpy(frominetPrev, frominet, socklen); /* update cache indicator */
@@ -381,18 +1228,8 @@ processPacket(thrdInfo_t *pThrd, struct lstn_s *lstn, struct sockaddr_storage *f
 			*pbIsPermitted = net.isAllowedSender2((uchar*)"UDP",
 					    (struct sockaddr *)frominet, "", 0);
 	
-			if(*pbIsPermitted == 0) {
-				DBGPRINTF("msg is not from an allowed sender\n");
-				if(glbl.GetOption_DisallowWarning) {
-					time_t tt;
-					datetime.GetTime(&tt);
-					if(tt > ttLastDiscard + 60) {
-						ttLastDiscard = tt;
-						errmsg.LogError(0, NO_ERRCODE,
-						"UDP message from disallowed sender discarded");
-					}
-				}
-			}
+			if(*pbIsPermitted == 0)
+				logDisallowedSender();
 		}
 	} else {
 		*pbIsPermitted = 1; /* no check -> everything permitted */
@@ -409,10 +1246,18 @@ processPacket(thrdInfo_t *pThrd, struct lstn_s *lstn, struct sockaddr_storage *f
 		MsgSetFlowControlType(pMsg, eFLOWCTL_NO_DELAY);
 		if(lstn->dfltTZ != NULL)
 			MsgSetDfltTZ(pMsg, (char*) lstn->dfltTZ);
-		pMsg->msgFlags  = NEEDS_PARSING | PARSE_HOSTNAME | NEEDS_DNSRESOL;
-		if(*pbIsPermitted == 2)
-			pMsg->msgFlags  |= NEEDS_ACLCHK_U; /* request ACL check after resolution */
-		CHKiRet(msgSetFromSockinfo(pMsg, frominet));
+		if(pSndr != NULL && pSndr->pFromHost != NULL) {
+			pMsg->msgFlags  = NEEDS_PARSING | PARSE_HOSTNAME;
+			MsgSetRcvFrom(pMsg, pSndr->pFromHost);
+			CHKiRet(MsgSetRcvFromIP(pMsg, pSndr->pFromHostIP));
+		} else {
+			pMsg->msgFlags  = NEEDS_PARSING | PARSE_HOSTNAME | NEEDS_DNSRESOL;
+			if(*pbIsPermitted == 2)
+				pMsg->msgFlags  |= NEEDS_ACLCHK_U; /* request ACL check after resolution */
+			CHKiRet(msgSetFromSockinfo(pMsg, frominet));
+		}
+		if(lstn->bParseInInput)
+			pMsg->msgFlags |= PARSE_IN_INPUT;
 		CHKiRet(ratelimitAddMsg(lstn->ratelimiter, multiSub, pMsg));
 		STATSCOUNTER_INC(lstn->ctrSubmit, lstn->mutCtrSubmit);
 	}
@@ -424,6 +1269,49 @@ finalize_it:
 
 
 
+#ifdef HAVE_IMUDP_GRO
+/* process a receive from a UDP_GRO socket. The kernel may have coalesced
+ * several datagrams of the same flow into the buffer; in that case, the
+ * UDP_GRO control message tells the segment size. All segments but the
+ * last have exactly that size. Each segment becomes its own message.
+ */
+static inline void
+processGroBuf(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct mmsghdr *mmh,
+	struct sockaddr_storage *frominetPrev, int *pbIsPermitted, struct syslogTime *stTime,
+	time_t ttGenTime, multi_submit_t *multiSub)
+{
+	struct cmsghdr *cmsg;
+	uchar *buf = mmh->msg_hdr.msg_iov->iov_base;
+	unsigned lenBuf = mmh->msg_len;
+	unsigned lenSeg = lenBuf;
+	unsigned lenMsg;
+	unsigned offs;
+	int gso;
+
+	for(cmsg = CMSG_FIRSTHDR(&mmh->msg_hdr) ; cmsg != NULL ; cmsg = CMSG_NXTHDR(&mmh->msg_hdr, cmsg)) {
+		if(cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+			memcpy(&gso, CMSG_DATA(cmsg), sizeof(gso));
+			if(gso > 0)
+				lenSeg = gso;
+			break;
+		}
+	}
+
+	for(offs = 0 ; offs < lenBuf ; offs += lenSeg) {
+		lenMsg = (lenBuf - offs < lenSeg) ? lenBuf - offs : lenSeg;
+		if(lenMsg > (unsigned) iMaxLine)
+			lenMsg = iMaxLine; /* same as the regular receive */
+		processPacket(pWrkr, lstn, frominetPrev, pbIsPermitted, buf + offs, lenMsg, stTime,
+			      ttGenTime, (struct sockaddr_storage*) mmh->msg_hdr.msg_name,
+			      mmh->msg_hdr.msg_namelen, multiSub);
+		++pWrkr->ctrMsgsRcvd;
+	}
+	if(lenBuf == 0) /* keep the original accounting for empty datagrams */
+		++pWrkr->ctrMsgsRcvd;
+}
+#endif /* #ifdef HAVE_IMUDP_GRO */
+
+
 /* The following "two" functions are helpers to runInput. Actually, it is
  * just one function. Depending on whether or not we have recvmmsg(),
  * an appropriate version is compiled (as such we need to maintain both!).
@@ -452,8 +1340,18 @@ processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_sto
 		memset(pWrkr->recvmsg_iov, 0, runModConf->batchSize * sizeof(struct iovec));
 		memset(pWrkr->recvmsg_mmh, 0, runModConf->batchSize * sizeof(struct mmsghdr));
 		for(i = 0 ; i < runModConf->batchSize ; ++i) {
-			pWrkr->recvmsg_iov[i].iov_base = pWrkr->pRcvBuf+(i*(iMaxLine+1));
-			pWrkr->recvmsg_iov[i].iov_len = iMaxLine;
+#			ifdef HAVE_IMUDP_GRO
+			if(lstn->bGro) {
+				pWrkr->recvmsg_iov[i].iov_base = pWrkr->pGroBuf + i * GRO_BUF_SIZE;
+				pWrkr->recvmsg_iov[i].iov_len = GRO_BUF_SIZE;
+				pWrkr->recvmsg_mmh[i].msg_hdr.msg_control = pWrkr->pGroCmsg + i * GRO_CMSG_SIZE;
+				pWrkr->recvmsg_mmh[i].msg_hdr.msg_controllen = GRO_CMSG_SIZE;
+			} else
+#			endif
+			{
+				pWrkr->recvmsg_iov[i].iov_base = pWrkr->pRcvBuf+(i*(iMaxLine+1));
+				pWrkr->recvmsg_iov[i].iov_len = iMaxLine;
+			}
 			pWrkr->recvmsg_mmh[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage); 
 			pWrkr->recvmsg_mmh[i].msg_hdr.msg_name = &(pWrkr->frominet[i]);
 			pWrkr->recvmsg_mmh[i].msg_hdr.msg_iov = &(pWrkr->recvmsg_iov[i]);
@@ -480,14 +1378,23 @@ processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_sto
 			}
 			ABORT_FINALIZE(RS_RET_ERR); // this most often is NOT an error, state is not checked by caller!
 		}
+		RS_PROBE(udp_batch, lstn->sock, nelem);
 
 		if((runModConf->iTimeRequery == 0) || (iNbrTimeUsed++ % runModConf->iTimeRequery) == 0) {
 			datetime.getCurrTime(&stTime, &ttGenTime);
 		}
 
+#		ifdef HAVE_IMUDP_GRO
+		if(lstn->bGro) {
+			for(i = 0 ; i < nelem ; ++i)
+				processGroBuf(pWrkr, lstn, &pWrkr->recvmsg_mmh[i], frominetPrev, pbIsPermitted,
+					      &stTime, ttGenTime, &multiSub);
+			continue;
+		}
+#		endif
 		pWrkr->ctrMsgsRcvd += nelem;
 		for(i = 0 ; i < nelem ; ++i) {
-			processPacket(pWrkr->pThrd, lstn, frominetPrev, pbIsPermitted, pWrkr->recvmsg_mmh[i].msg_hdr.msg_iov->iov_base,
+			processPacket(pWrkr, lstn, frominetPrev, pbIsPermitted, pWrkr->recvmsg_mmh[i].msg_hdr.msg_iov->iov_base,
 				      pWrkr->recvmsg_mmh[i].msg_len, &stTime, ttGenTime, &(pWrkr->frominet[i]),
 				      pWrkr->recvmsg_mmh[i].msg_hdr.msg_namelen, &multiSub);
 		}
@@ -553,12 +1460,13 @@ processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_sto
 			ABORT_FINALIZE(RS_RET_ERR); // this most often is NOT an error, state is not checked by caller!
 		}
 
+		RS_PROBE(udp_batch, lstn->sock, 1);
 		++pWrkr->ctrMsgsRcvd;
 		if((runModConf->iTimeRequery == 0) || (iNbrTimeUsed++ % runModConf->iTimeRequery) == 0) {
 			datetime.getCurrTime(&stTime, &ttGenTime);
 		}
 
-		CHKiRet(processPacket(pWrkr->pThrd, lstn, frominetPrev, pbIsPermitted, pWrkr->pRcvBuf, lenRcvBuf, &stTime,
+		CHKiRet(processPacket(pWrkr, lstn, frominetPrev, pbIsPermitted, pWrkr->pRcvBuf, lenRcvBuf, &stTime,
 			ttGenTime, &frominet, mh.msg_namelen, &multiSub));
 	}
 
@@ -569,6 +1477,136 @@ finalize_it:
 }
 #endif /* #ifdef HAVE_RECVMMSG */
 
+#ifdef HAVE_IMUDP_RING
+/* process a single frame from a packet ring. The socket filter only
+ * lets unfragmented ipv4 and plain ipv6 UDP datagrams to our port pass,
+ * but we still need to validate the lengths. The payload is handed to
+ * processPacket() directly from the ring, so the only copy is the one
+ * into the message object.
+ */
+static inline void
+processRingFrame(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct tpacket3_hdr *ppd,
+	struct sockaddr_storage *frominetPrev, int *pbIsPermitted, struct syslogTime *stTime,
+	time_t ttGenTime, multi_submit_t *multiSub)
+{
+	/* the socket is SOCK_DGRAM, so the frame starts with the ip header */
+	uchar *frame = (uchar*) ppd + ppd->tp_net;
+	unsigned len = ppd->tp_snaplen;
+	struct udpRing_s *pRing = lstn->pRing;
+	struct sockaddr_ll *sll;
+	struct sockaddr_storage frominet;
+	struct sockaddr_in *sin;
+	struct sockaddr_in6 *sin6;
+	unsigned offsUdp;
+	unsigned lenMsg;
+
+	/* on loopback, we would otherwise see each datagram twice; frames for
+	 * other hosts are only seen in promiscuous mode
+	 */
+	sll = (struct sockaddr_ll*) ((uchar*) ppd + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+	if(sll->sll_pkttype == PACKET_OUTGOING || sll->sll_pkttype == PACKET_OTHERHOST || len < 1)
+		return;
+
+	memset(&frominet, 0, sizeof(frominet));
+	if((frame[0] >> 4) == 4) {
+		offsUdp = (frame[0] & 0x0f) * 4;
+		if(offsUdp < 20 || len < offsUdp + 8 || !ringAddrMatches(pRing, AF_INET, frame + 16))
+			return;
+		sin = (struct sockaddr_in*) &frominet;
+		sin->sin_family = AF_INET;
+		memcpy(&sin->sin_addr, frame + 12, 4);
+		memcpy(&sin->sin_port, frame + offsUdp, 2);
+	} else if((frame[0] >> 4) == 6) {
+		offsUdp = 40;
+		if(len < offsUdp + 8 || !ringAddrMatches(pRing, AF_INET6, frame + 24))
+			return;
+		sin6 = (struct sockaddr_in6*) &frominet;
+		sin6->sin6_family = AF_INET6;
+		memcpy(&sin6->sin6_addr, frame + 8, 16);
+		memcpy(&sin6->sin6_port, frame + offsUdp, 2);
+	} else {
+		return;
+	}
+	if(memcmp(frame + offsUdp + 2, &pRing->port, 2))
+		return; /* the BPF filter should have caught it, but be safe */
+	lenMsg = (frame[offsUdp + 4] << 8) | frame[offsUdp + 5];
+	if(lenMsg < 8 || offsUdp + lenMsg > len)
+		return; /* truncated or bogus */
+	lenMsg -= 8;
+	if(lenMsg > (unsigned) iMaxLine)
+		lenMsg = iMaxLine; /* same as the regular receive */
+	processPacket(pWrkr, lstn, frominetPrev, pbIsPermitted, frame + offsUdp + 8,
+		      lenMsg, stTime, ttGenTime, &frominet, sizeof(frominet), multiSub);
+}
+
+
+/* process all blocks the kernel has handed over in a packet ring. Each
+ * block is returned to the kernel as soon as its frames are processed.
+ */
+static rsRetVal
+processRing(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_storage *frominetPrev, int *pbIsPermitted)
+{
+	struct udpRing_s *pRing = lstn->pRing;
+	struct tpacket_block_desc *pbd;
+	struct tpacket3_hdr *ppd;
+	struct tpacket_stats_v3 st;
+	socklen_t lenSt;
+	unsigned nPkts;
+	unsigned i;
+	time_t ttGenTime;
+	struct syslogTime stTime;
+	msg_t *pMsgs[CONF_NUM_MULTISUB];
+	multi_submit_t multiSub;
+	DEFiRet;
+
+	multiSub.ppMsgs = pMsgs;
+	multiSub.maxElem = CONF_NUM_MULTISUB;
+	multiSub.nElem = 0;
+	while(1) {
+		if(pWrkr->pThrd->bShallStop == RSTRUE)
+			ABORT_FINALIZE(RS_RET_FORCE_TERM);
+		pbd = pRing->blocks[pRing->currBlock];
+		if((pbd->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+			break;
+		__sync_synchronize(); /* read the frames only after the status */
+		datetime.getCurrTime(&stTime, &ttGenTime);
+		nPkts = pbd->hdr.bh1.num_pkts;
+		ppd = (struct tpacket3_hdr*) ((uint8_t*) pbd + pbd->hdr.bh1.offset_to_first_pkt);
+		for(i = 0 ; i < nPkts ; ++i) {
+			processRingFrame(pWrkr, lstn, ppd, frominetPrev, pbIsPermitted,
+					 &stTime, ttGenTime, &multiSub);
+			ppd = (struct tpacket3_hdr*) ((uint8_t*) ppd + ppd->tp_next_offset);
+		}
+		pWrkr->ctrMsgsRcvd += nPkts;
+		__sync_synchronize(); /* we are done with the frames */
+		pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		pRing->currBlock = (pRing->currBlock + 1) % pRing->nBlocks;
+	}
+
+	lenSt = sizeof(st);
+	if(getsockopt(lstn->sock, SOL_PACKET, PACKET_STATISTICS, &st, &lenSt) == 0)
+		lstn->ctrRingDrops += st.tp_drops;
+
+finalize_it:
+	multiSubmitFlush(&multiSub);
+	RETiRet;
+}
+#endif /* #ifdef HAVE_IMUDP_RING */
+
+
+/* process whatever is ready on a listener */
+static inline void
+processLstn(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_storage *frominetPrev, int *pbIsPermitted)
+{
+#	ifdef HAVE_IMUDP_RING
+	if(lstn->pRing != NULL) {
+		processRing(pWrkr, lstn, frominetPrev, pbIsPermitted);
+		return;
+	}
+#	endif
+	processSocket(pWrkr, lstn, frominetPrev, pbIsPermitted);
+}
+
 
 /* check configured scheduling priority.
  * Precondition: iSchedPolicy must have been set
@@ -691,6 +1729,47 @@ finalize_it:
 }
 
 
+/* checks the worker cpu set during config check phase. If the cpu set
+ * is taken from a NUMA node ("node:<n>"), messages are also allocated on
+ * that node, as msg objects are created (and first touched) by the workers.
+ */
+static void
+checkCpuSet(modConfData_t *modConf)
+{
+	if(modConf->pszCpuSet == NULL)
+		return;
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	if(srParseCpuSet(modConf->pszCpuSet, &modConf->cpuSet) == RS_RET_OK) {
+		modConf->bCpuSet = 1;
+	} else {
+		errmsg.LogError(0, RS_RET_INVALID_VALUE, "imudp: cpuset '%s' is invalid, "
+			"must be a cpu list like \"0-3,8\" or \"node:<n>\" - ignoring setting",
+			modConf->pszCpuSet);
+		modConf->bCpuSet = 0;
+	}
+#else
+	errmsg.LogError(0, NO_ERRCODE, "imudp: cannot set thread cpu affinity, "
+		"pthread_setaffinity_np() not available - ignoring setting");
+#endif
+}
+
+/* bind the calling worker thread to the configured cpus (if any) */
+static void
+setCpuSet(modConfData_t __attribute__((unused)) *modConf)
+{
+#	ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	int err;
+
+	if(!modConf->bCpuSet)
+		return;
+	err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &modConf->cpuSet);
+	if(err != 0) {
+		errmsg.LogError(err, NO_ERRCODE, "imudp: pthread_setaffinity_np() failed - ignoring");
+	}
+#	endif
+}
+
+
 /* This function implements the main reception loop. Depending on the environment,
  * we either use the traditional (but slower) select() or the Linux-specific epoll()
  * interface. ./configure settings control which one is used.
@@ -744,7 +1823,7 @@ rsRetVal rcvMainLoop(struct wrkrInfo_s *pWrkr)
 	 */
 	i = 0;
 	for(lstn = lcnfRoot ; lstn != NULL ; lstn = lstn->next) {
-		if(lstn->sock != -1) {
+		if(lstn->sock != -1 && (lstn->iWrkr == -1 || lstn->iWrkr == pWrkr->id)) {
 			udpEPollEvt[i].events = EPOLLIN | EPOLLET;
 			udpEPollEvt[i].data.ptr = lstn;
 			if(epoll_ctl(efd, EPOLL_CTL_ADD,  lstn->sock, &(udpEPollEvt[i])) < 0) {
@@ -765,7 +1844,7 @@ rsRetVal rcvMainLoop(struct wrkrInfo_s *pWrkr)
 			break; /* terminate input! */
 
 		for(i = 0 ; i < nfds ; ++i) {
-			processSocket(pWrkr, currEvt[i].data.ptr, &frominetPrev, &bIsPermitted);
+			processLstn(pWrkr, currEvt[i].data.ptr, &frominetPrev, &bIsPermitted);
 		}
 	}
 
@@ -777,7 +1856,7 @@ finalize_it:
 }
 #else /* #if HAVE_EPOLL_CREATE1 */
 /* this is the code for the select() interface */
-rsRetVal rcvMainLoop(thrdInfo_t *pWrkr)
+rsRetVal rcvMainLoop(struct wrkrInfo_s *pWrkr)
 {
 	DEFiRet;
 	int maxfds;
@@ -802,7 +1881,7 @@ rsRetVal rcvMainLoop(thrdInfo_t *pWrkr)
 
 		/* Add the UDP listen sockets to the list of read descriptors. */
 		for(lstn = lcnfRoot ; lstn != NULL ; lstn = lstn->next) {
-			if (lstn->sock != -1) {
+			if (lstn->sock != -1 && (lstn->iWrkr == -1 || lstn->iWrkr == pWrkr->id)) {
 				if(Debug)
 					net.debugListenInfo(lstn->sock, "UDP");
 				FD_SET(lstn->sock, &readfds);
@@ -823,8 +1902,9 @@ rsRetVal rcvMainLoop(thrdInfo_t *pWrkr)
 			break; /* terminate input! */
 
 		for(lstn = lcnfRoot ; nfds && lstn != NULL ; lstn = lstn->next) {
-			if(FD_ISSET(lstn->sock, &readfds)) {
-		       		processSocket(pWrkr, lstn, &frominetPrev, &bIsPermitted);
+			if(lstn->sock != -1 && (lstn->iWrkr == -1 || lstn->iWrkr == pWrkr->id)
+			   && FD_ISSET(lstn->sock, &readfds)) {
+		       		processLstn(pWrkr, lstn, &frominetPrev, &bIsPermitted);
 			--nfds; /* indicate we have processed one descriptor */
 			}
 	       }
@@ -836,6 +1916,136 @@ rsRetVal rcvMainLoop(thrdInfo_t *pWrkr)
 #endif /* #if HAVE_EPOLL_CREATE1 */
 
 
+/* parse a prefilter.dropfrom entry, "address[/bits]" */
+static rsRetVal
+prefiltAddNet(struct prefilt_s *pFilt, es_str_t *estr)
+{
+	struct prefiltNet_s *pNet;
+	char *str = NULL;
+	char *slash;
+	int maxBits;
+	DEFiRet;
+
+	CHKmalloc(str = es_str2cstr(estr, NULL));
+	CHKmalloc(pNet = realloc(pFilt->nets, (pFilt->nNets + 1) * sizeof(struct prefiltNet_s)));
+	pFilt->nets = pNet;
+	pNet += pFilt->nNets;
+	memset(pNet, 0, sizeof(struct prefiltNet_s));
+	if((slash = strchr(str, '/')) != NULL)
+		*slash++ = '\0';
+	if(inet_pton(AF_INET, str, pNet->addr) == 1) {
+		pNet->family = AF_INET;
+		maxBits = 32;
+	} else if(inet_pton(AF_INET6, str, pNet->addr) == 1) {
+		pNet->family = AF_INET6;
+		maxBits = 128;
+	} else {
+		errmsg.LogError(0, RS_RET_INVALID_VALUE, "imudp: prefilter.dropfrom: '%s' "
+				"is not a numeric IP address - ignored", str);
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+	}
+	pNet->bits = (slash == NULL) ? maxBits : atoi(slash);
+	if(pNet->bits < 0 || pNet->bits > maxBits) {
+		errmsg.LogError(0, RS_RET_INVALID_VALUE, "imudp: prefilter.dropfrom: invalid "
+				"number of bits '%s' for '%s' - ignored", slash, str);
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+	}
+	++pFilt->nNets;
+
+finalize_it:
+	free(str);
+	RETiRet;
+}
+
+
+/* convert a string array parameter to prefilter strings */
+static rsRetVal
+prefiltGetStrs(struct cnfarray *ar, struct prefiltStr_s **ppStrs, int *pnStrs)
+{
+	int i;
+	struct prefiltStr_s *pStrs;
+	DEFiRet;
+
+	CHKmalloc(pStrs = calloc(ar->nmemb, sizeof(struct prefiltStr_s)));
+	*ppStrs = pStrs;
+	for(i = 0 ; i < ar->nmemb ; ++i) {
+		CHKmalloc(pStrs[*pnStrs].sz = (uchar*) es_str2cstr(ar->arr[i], NULL));
+		pStrs[*pnStrs].len = ustrlen(pStrs[*pnStrs].sz);
+		if(pStrs[*pnStrs].len == 0) {
+			free(pStrs[*pnStrs].sz); /* would drop everything */
+			continue;
+		}
+		++*pnStrs;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+static void
+prefiltDestruct(struct prefilt_s *pFilt)
+{
+	int i;
+
+	if(pFilt == NULL)
+		return;
+	for(i = 0 ; i < pFilt->nPrefixes ; ++i)
+		free(pFilt->prefixes[i].sz);
+	for(i = 0 ; i < pFilt->nContains ; ++i)
+		free(pFilt->contains[i].sz);
+	free(pFilt->prefixes);
+	free(pFilt->contains);
+	free(pFilt->nets);
+	free(pFilt);
+}
+
+
+/* build the prefilter from the instance parameters. Invalid entries are
+ * reported and skipped, the rest of the filter is still used.
+ */
+static rsRetVal
+prefiltConstruct(instanceConf_t *inst, struct cnfparamvals *pvals)
+{
+	struct prefilt_s *pFilt = NULL;
+	struct cnfarray *ar;
+	uchar *cstr;
+	int i, j;
+	DEFiRet;
+
+	for(i = 0 ; i < inppblk.nParams ; ++i) {
+		if(!pvals[i].bUsed || strncmp(inppblk.descr[i].name, "prefilter.", 10))
+			continue;
+		if(pFilt == NULL)
+			CHKmalloc(pFilt = calloc(1, sizeof(struct prefilt_s)));
+		if(!strcmp(inppblk.descr[i].name, "prefilter.droppri")) {
+			cstr = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(DecodePRIFilter(cstr, pFilt->pmask) == RS_RET_OK) {
+				pFilt->bPri = 1;
+			} else {
+				errmsg.LogError(0, RS_RET_INVALID_VALUE, "imudp: prefilter.droppri: "
+						"invalid selector '%s' - ignored", cstr);
+			}
+			free(cstr);
+		} else if(!strcmp(inppblk.descr[i].name, "prefilter.dropfrom")) {
+			ar = pvals[i].val.d.ar;
+			for(j = 0 ; j < ar->nmemb ; ++j)
+				prefiltAddNet(pFilt, ar->arr[j]);
+		} else if(!strcmp(inppblk.descr[i].name, "prefilter.dropprefix")) {
+			CHKiRet(prefiltGetStrs(pvals[i].val.d.ar, &pFilt->prefixes, &pFilt->nPrefixes));
+		} else if(!strcmp(inppblk.descr[i].name, "prefilter.dropcontains")) {
+			CHKiRet(prefiltGetStrs(pvals[i].val.d.ar, &pFilt->contains, &pFilt->nContains));
+		}
+	}
+	inst->pFilt = pFilt;
+	pFilt = NULL;
+
+finalize_it:
+	prefiltDestruct(pFilt);
+	RETiRet;
+}
+
+
 static inline rsRetVal
 createListner(es_str_t *port, struct cnfparamvals *pvals)
 {
@@ -866,11 +2076,24 @@ createListner(es_str_t *port, struct cnfparamvals *pvals)
 			inst->ratelimitInterval = (int) pvals[i].val.d.n;
 		} else if(!strcmp(inppblk.descr[i].name, "rcvbufsize")) {
 			inst->rcvbuf = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "reuseport")) {
+			inst->bReusePort = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "reuseport.cpusteering")) {
+			inst->bCpuSteering = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "ring.interface")) {
+			inst->pszRingIf = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(inppblk.descr[i].name, "gro")) {
+			inst->bGro = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "parseininput")) {
+			inst->bParseInInput = (sbool) pvals[i].val.d.n;
+		} else if(!strncmp(inppblk.descr[i].name, "prefilter.", 10)) {
+			continue;	/* handled by prefiltConstruct() */
 		} else {
 			dbgprintf("imudp: program error, non-handled "
 			  "param '%s'\n", inppblk.descr[i].name);
 		}
 	}
+	CHKiRet(prefiltConstruct(inst, pvals));
 finalize_it:
 	RETiRet;
 }
@@ -912,8 +2135,12 @@ CODESTARTbeginCnfLoad
 	loadModConf->wrkrMax = 1; /* conservative, but least msg reordering */
 	loadModConf->batchSize = BATCH_SIZE_DFLT;
 	loadModConf->iTimeRequery = TIME_REQUERY_DFLT;
+	loadModConf->iSndrCacheSize = SNDR_CACHE_SIZE_DFLT;
+	loadModConf->iSndrRlInterval = 0;
+	loadModConf->iSndrRlBurst = SNDR_RL_BURST_DFLT;
 	loadModConf->iSchedPrio = SCHED_PRIO_UNSET;
 	loadModConf->pszSchedPolicy = NULL;
+	loadModConf->pszCpuSet = NULL;
 	bLegacyCnfModGlobalsPermitted = 1;
 	/* init legacy config vars */
 	cs.pszBindRuleset = NULL;
@@ -946,12 +2173,20 @@ CODESTARTsetModCnf
 			continue;
 		if(!strcmp(modpblk.descr[i].name, "timerequery")) {
 			loadModConf->iTimeRequery = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "sendercache.size")) {
+			loadModConf->iSndrCacheSize = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "ratelimit.sender.interval")) {
+			loadModConf->iSndrRlInterval = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "ratelimit.sender.burst")) {
+			loadModConf->iSndrRlBurst = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "batchsize")) {
 			loadModConf->batchSize = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "schedulingpriority")) {
 			loadModConf->iSchedPrio = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "schedulingpolicy")) {
 			loadModConf->pszSchedPolicy = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(modpblk.descr[i].name, "cpuset")) {
+			loadModConf->pszCpuSet = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(modpblk.descr[i].name, "threads")) {
 			wrkrMax = (int) pvals[i].val.d.n;
 			if(wrkrMax > MAX_WRKR_THREADS) {
@@ -1003,8 +2238,21 @@ BEGINcheckCnf
 	instanceConf_t *inst;
 CODESTARTcheckCnf
 	checkSchedParam(pModConf); /* this can not cause fatal errors */
+	checkCpuSet(pModConf); /* neither can this */
+	if(pModConf->iSndrRlInterval > 0 && pModConf->iSndrCacheSize == 0) {
+		errmsg.LogError(0, RS_RET_CONF_PARSE_WARNING, "imudp: "
+				"ratelimit.sender.interval requires the sender cache, "
+				"per-sender rate limiting disabled");
+		pModConf->iSndrRlInterval = 0;
+	}
 	for(inst = pModConf->root ; inst != NULL ; inst = inst->next) {
 		std_checkRuleset(pModConf, inst);
+		if(inst->bCpuSteering && !inst->bReusePort) {
+			errmsg.LogError(0, RS_RET_CONF_PARSE_WARNING, "imudp: "
+					"reuseport.cpusteering requires reuseport, ignored "
+					"for port %s", inst->pszBindPort);
+			inst->bCpuSteering = 0;
+		}
 	}
 	if(pModConf->root == NULL) {
 		errmsg.LogError(0, RS_RET_NO_LISTNERS , "imudp: module loaded, but "
@@ -1035,6 +2283,11 @@ ENDactivateCnfPrePrivDrop
 BEGINactivateCnf
 	int i;
 	int lenRcvBuf;
+	unsigned nSets;
+#	ifdef HAVE_IMUDP_GRO
+	struct lstn_s *lstn;
+	sbool bGro;
+#	endif
 CODESTARTactivateCnf
 	/* caching various settings */
 	iMaxLine = glbl.GetMaxLine();
@@ -1043,6 +2296,12 @@ CODESTARTactivateCnf
 	lenRcvBuf *= runModConf->batchSize;
 #	endif
 	DBGPRINTF("imudp: config params iMaxLine %d, lenRcvBuf %d\n", iMaxLine, lenRcvBuf);
+#	ifdef HAVE_IMUDP_GRO
+	/* coalesced receives need large buffers, so only get them if used */
+	bGro = 0;
+	for(lstn = lcnfRoot ; lstn != NULL ; lstn = lstn->next)
+		bGro |= lstn->bGro;
+#	endif
 	for(i = 0 ; i < runModConf->wrkrMax ; ++i) {
 #		ifdef HAVE_RECVMMSG
 		CHKmalloc(wrkrInfo[i].recvmsg_iov = MALLOC(runModConf->batchSize * sizeof(struct iovec)));
@@ -1051,6 +2310,25 @@ CODESTARTactivateCnf
 #		endif
 		CHKmalloc(wrkrInfo[i].pRcvBuf = MALLOC(lenRcvBuf));
 		wrkrInfo[i].id = i;
+#		ifdef HAVE_IMUDP_GRO
+		wrkrInfo[i].pGroBuf = NULL;
+		wrkrInfo[i].pGroCmsg = NULL;
+		if(bGro) {
+			CHKmalloc(wrkrInfo[i].pGroBuf = MALLOC(runModConf->batchSize * GRO_BUF_SIZE));
+			CHKmalloc(wrkrInfo[i].pGroCmsg = calloc(runModConf->batchSize, GRO_CMSG_SIZE));
+		}
+#		endif
+		wrkrInfo[i].sndrCache = NULL;
+		if(runModConf->iSndrCacheSize > 0) {
+			/* number of sets must be a power of two for masking */
+			for(nSets = 1 ; nSets * SNDR_CACHE_WAYS < runModConf->iSndrCacheSize ; nSets *= 2)
+				/* just count */;
+			CHKmalloc(wrkrInfo[i].sndrCache = calloc(nSets * SNDR_CACHE_WAYS,
+								 sizeof(struct sndrCacheEntry_s)));
+			wrkrInfo[i].sndrCacheMask = nSets - 1;
+			wrkrInfo[i].sndrCacheClock = 0;
+			wrkrInfo[i].ttSndrRlReport = 0;
+		}
 	}
 finalize_it:
 ENDactivateCnf
@@ -1064,10 +2342,13 @@ CODESTARTfreeCnf
 		free(inst->pszBindAddr);
 		free(inst->inputname);
 		free(inst->dfltTZ);
+		free(inst->pszRingIf);
+		prefiltDestruct(inst->pFilt);
 		del = inst;
 		inst = inst->next;
 		free(del);
 	}
+	free(pModConf->pszCpuSet);
 ENDfreeCnf
 
 
@@ -1098,6 +2379,7 @@ wrkr(void *myself)
 	 * privileges within the same instance.
 	 */
 	setSchedParams(runModConf);
+	setCpuSet(runModConf);
 
 	/* support statistics gathering */
 	statsobj.Construct(&(pWrkr->stats));
@@ -1111,6 +2393,19 @@ wrkr(void *myself)
 	STATSCOUNTER_INIT(pWrkr->ctrMsgsRcvd, pWrkr->mutCtrMsgsRcvd);
 	statsobj.AddCounter(pWrkr->stats, UCHAR_CONSTANT("msgs.received"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pWrkr->ctrMsgsRcvd));
+	if(pWrkr->sndrCache != NULL) {
+		STATSCOUNTER_INIT(pWrkr->ctrSndrHit, pWrkr->mutCtrSndrHit);
+		statsobj.AddCounter(pWrkr->stats, UCHAR_CONSTANT("sendercache.hits"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pWrkr->ctrSndrHit));
+		STATSCOUNTER_INIT(pWrkr->ctrSndrMiss, pWrkr->mutCtrSndrMiss);
+		statsobj.AddCounter(pWrkr->stats, UCHAR_CONSTANT("sendercache.misses"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pWrkr->ctrSndrMiss));
+	}
+	if(runModConf->iSndrRlInterval > 0) {
+		STATSCOUNTER_INIT(pWrkr->ctrSndrRlDrops, pWrkr->mutCtrSndrRlDrops);
+		statsobj.AddCounter(pWrkr->stats, UCHAR_CONSTANT("ratelimit.sender.dropped"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pWrkr->ctrSndrRlDrops));
+	}
 	statsobj.ConstructFinalize(pWrkr->stats);
 
 	rcvMainLoop(pWrkr);
@@ -1163,6 +2458,10 @@ CODESTARTafterRun
 	for(lstn = lcnfRoot ; lstn != NULL ; ) {
 		statsobj.Destruct(&(lstn->stats));
 		ratelimitDestruct(lstn->ratelimiter);
+#		ifdef HAVE_IMUDP_RING
+		if(lstn->pRing != NULL)
+			destructRing(lstn->pRing);
+#		endif
 		close(lstn->sock);
 		prop.Destruct(&lstn->pInputName);
 		lstnDel = lstn;
@@ -1175,8 +2474,13 @@ CODESTARTafterRun
 		free(wrkrInfo[i].recvmsg_iov);
 		free(wrkrInfo[i].recvmsg_mmh);
 		free(wrkrInfo[i].frominet);
+#		endif
+#		ifdef HAVE_IMUDP_GRO
+		free(wrkrInfo[i].pGroBuf);
+		free(wrkrInfo[i].pGroCmsg);
 #		endif
 		free(wrkrInfo[i].pRcvBuf);
+		sndrCacheDestruct(&wrkrInfo[i]);
 	}
 ENDafterRun
 
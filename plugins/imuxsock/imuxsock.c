@@ -54,7 +54,7 @@
 #include "sd-daemon.h"
 #include "statsobj.h"
 #include "datetime.h"
-#include "hashtable.h"
+#include "hashmap.h"
 #include "ratelimit.h"
 
 MODULE_TYPE_INPUT
@@ -104,27 +104,70 @@ statsobj_t *modStats;
 STATSCOUNTER_DEF(ctrSubmit, mutCtrSubmit)
 STATSCOUNTER_DEF(ctrLostRatelimit, mutCtrLostRatelimit)
 STATSCOUNTER_DEF(ctrNumRatelimiters, mutCtrNumRatelimiters)
+STATSCOUNTER_DEF(ctrExpiredRatelimiters, mutCtrExpiredRatelimiters)
+STATSCOUNTER_DEF(ctrPidCacheHits, mutCtrPidCacheHits)
+STATSCOUNTER_DEF(ctrPidCacheMisses, mutCtrPidCacheMisses)
 
 
 /* a very simple "hash function" for process IDs - we simply use the
- * pid itself: it is quite expected that all pids may log some time, but
- * from a collision point of view it is likely that long-running daemons 
- * start early and so will stay right in the top spots of the
- * collision list.
+ * pid itself, the hash map mixes the bits on its own. pids are stored
+ * inline in the map, so there is no key allocation.
  */
-static unsigned int
-hash_from_key_fn(void *k)
+static unsigned
+hash_from_key_fn(const void *k)
 {
-	return((unsigned) *((pid_t*) k));
+	return((unsigned) *((const pid_t*) k));
 }
 
 static int
-key_equals_fn(void *key1, void *key2)
+key_equals_fn(const void *key1, const void *key2)
 {
-	return *((pid_t*) key1) == *((pid_t*) key2);
+	return *((const pid_t*) key1) == *((const pid_t*) key2);
 }
 
 
+/* per-pid ratelimiter, as kept in a listener's hash map. Entries that have
+ * not been used for a while are expired, else the table would grow with every
+ * process that ever logged.
+ */
+typedef struct pidRatelimiter_s {
+	ratelimit_t *rl;
+	time_t tLastUsed;
+} pidRatelimiter_t;
+
+static void
+pidRatelimiterDestruct(void *p)
+{
+	ratelimitDestruct(((pidRatelimiter_t*) p)->rl);
+	free(p);
+}
+
+
+/* trusted properties of a process. Reading them from /proc is by far the
+ * most expensive part of annotation, so they can be cached for pidcache.ttl
+ * seconds. A cache entry is only used if uid and gid still match the
+ * credentials of the message, which makes it unlikely that a reused pid
+ * picks up the properties of an earlier process.
+ */
+typedef struct pidInfo_s {
+	uid_t uid;
+	gid_t gid;
+	time_t tExpire;
+	sbool bCached;	/* entry is owned by the cache */
+	uchar *comm;	/* NULL if not available */
+	uchar *exe;
+	uchar *cmdline;
+	int lenComm;
+	int lenExe;
+	int lenCmdline;
+} pidInfo_t;
+static hashmap_t *pidCache = NULL; /* pid -> pidInfo_t, NULL if caching is turned off */
+
+static time_t tNextExpiry = 0;	/* when to remove expired ratelimiters and cache entries */
+#define EXPIRY_INTERVAL 60	/* check for expired entries that often (seconds) */
+#define RATELIMITER_MIN_IDLE 60	/* expire per-pid ratelimiters idle at least that long */
+
+
 /* structure to describe a specific listener */
 typedef struct lstn_s {
 	uchar *sockName;	/* read-only after startup */
@@ -136,7 +179,7 @@ typedef struct lstn_s {
 	int ratelimitBurst;
 	ratelimit_t *dflt_ratelimiter;/*ratelimiter to apply if none else is to be used */
 	intTiny ratelimitSev;	/* severity level (and below) for which rate-limiting shall apply */
-	struct hashtable *ht;	/* our hashtable for rate-limiting */
+	hashmap_t *ht;		/* pid -> pidRatelimiter_t for rate-limiting */
 	sbool bParseHost;	/* should parser parse host name?  read-only after startup */
 	sbool bCreatePath;	/* auto-creation of socket directory? */
 	sbool bUseCreds;	/* pull original creator credentials from socket */
@@ -163,6 +206,8 @@ static int sd_fds = 0;			/* number of systemd activated sockets */
 #define DFLT_ratelimitInterval 0
 #define DFLT_ratelimitBurst 200
 #define DFLT_ratelimitSeverity 1			/* do not rate-limit emergency messages */
+#define DFLT_batchSize 32
+#define AUX_SIZE 128	/* size of control message buffer per datagram */
 /* config vars for the legacy config system */
 static struct configSettings_s {
 	int bOmitLocalLogging;
@@ -224,6 +269,8 @@ struct modConfData_s {
 	sbool bDiscardOwnMsgs;
 	sbool configSetViaV2Method;
 	sbool bUnlink;
+	int batchSize;			/* max number of datagrams to receive with one recvmmsg() */
+	int pidCacheTTL;		/* seconds to cache trusted properties, 0 - do not cache */
 };
 static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
 static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current load process */
@@ -242,7 +289,9 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "syssock.usepidfromsystem", eCmdHdlrBinary, 0 },
 	{ "syssock.ratelimit.interval", eCmdHdlrInt, 0 },
 	{ "syssock.ratelimit.burst", eCmdHdlrInt, 0 },
-	{ "syssock.ratelimit.severity", eCmdHdlrInt, 0 }
+	{ "syssock.ratelimit.severity", eCmdHdlrInt, 0 },
+	{ "batchsize", eCmdHdlrPositiveInt, 0 },
+	{ "pidcache.ttl", eCmdHdlrNonNegInt, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -273,8 +322,13 @@ static struct cnfparamblk inppblk =
 	  inppdescr
 	};
 
-/* we do not use this, because we do not bind to a ruleset so far
- * enable when this is changed: #include "im-helper.h" */ /* must be included AFTER the type definitions! */
+/* we do not bind to a ruleset so far, so we only use the batching helpers.
+ * Drop IM_HELPER_NO_INSTANCES when this is changed.
+ */
+#define IM_HELPER_NO_INSTANCES
+#include "im-helper.h" /* must be included AFTER the type definitions! */
+
+static imBatch_t batch;	/* messages not yet submitted, used by the input thread only */
 
 static int bLegacyCnfModGlobalsPermitted;/* are legacy module-global config parameters permitted? */
 
@@ -381,8 +435,8 @@ addListner(instanceConf_t *inst)
 		CHKiRet(prop.ConstructFinalize(listeners[nfd].hostName));
 	}
 	if(inst->ratelimitInterval > 0) {
-		if((listeners[nfd].ht = create_hashtable(100, hash_from_key_fn, key_equals_fn,
-			(void(*)(void*))ratelimitDestruct)) == NULL) {
+		if(hashmapConstruct(&listeners[nfd].ht, 100, sizeof(pid_t), hash_from_key_fn, key_equals_fn,
+			NULL, pidRatelimiterDestruct) != RS_RET_OK) {
 			/* in this case, we simply turn off rate-limiting */
 			DBGPRINTF("imuxsock: turning off rate limiting because we could not "
 				  "create hash table\n");
@@ -434,7 +488,7 @@ static rsRetVal discardLogSockets(void)
 			prop.Destruct(&(listeners[i].hostName));
 		}
 		if(listeners[i].ht != NULL) {
-			hashtable_destroy(listeners[i].ht, 1); /* 1 => free all values automatically */
+			hashmapDestruct(&listeners[i].ht); /* destructs all ratelimiters */
 		}
 		ratelimitDestruct(listeners[i].dflt_ratelimiter);
 	}
@@ -549,11 +603,10 @@ finalize_it:
  * listener (the latter being a performance enhancement).
  */
 static inline rsRetVal
-findRatelimiter(lstn_t *pLstn, struct ucred *cred, ratelimit_t **prl)
+findRatelimiter(lstn_t *pLstn, struct ucred *cred, time_t tNow, ratelimit_t **prl)
 {
-	ratelimit_t *rl;
-	int r;
-	pid_t *keybuf;
+	ratelimit_t *rl = NULL;
+	pidRatelimiter_t *pidRl;
 	char pidbuf[256];
 	DEFiRet;
 
@@ -570,8 +623,8 @@ findRatelimiter(lstn_t *pLstn, struct ucred *cred, ratelimit_t **prl)
 		FINALIZE;
 	}
 
-	rl = hashtable_search(pLstn->ht, &cred->pid);
-	if(rl == NULL) {
+	pidRl = hashmapSearch(pLstn->ht, &cred->pid);
+	if(pidRl == NULL) {
 		/* we need to add a new ratelimiter, process not seen before! */
 		DBGPRINTF("imuxsock: no ratelimiter for pid %lu, creating one\n",
 			  (unsigned long) cred->pid);
@@ -582,16 +635,21 @@ findRatelimiter(lstn_t *pLstn, struct ucred *cred, ratelimit_t **prl)
 		CHKiRet(ratelimitNew(&rl, "imuxsock", pidbuf));
 		ratelimitSetLinuxLike(rl, pLstn->ratelimitInterval, pLstn->ratelimitBurst);
 		ratelimitSetSeverity(rl, pLstn->ratelimitSev);
-		CHKmalloc(keybuf = malloc(sizeof(pid_t)));
-		*keybuf = cred->pid;
-		r = hashtable_insert(pLstn->ht, keybuf, rl);
-		if(r == 0)
+		CHKmalloc(pidRl = malloc(sizeof(pidRatelimiter_t)));
+		pidRl->rl = rl;
+		rl = NULL; /* now owned by pidRl */
+		if(hashmapInsert(pLstn->ht, &cred->pid, pidRl) != RS_RET_OK) {
+			pidRatelimiterDestruct(pidRl);
 			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
 	}
 
-	*prl = rl;
+	pidRl->tLastUsed = tNow;
+	*prl = pidRl->rl;
 
 finalize_it:
+	if(rl != NULL)
+		ratelimitDestruct(rl);
 	if(*prl == NULL)
 		*prl = pLstn->dflt_ratelimiter;
 	RETiRet;
@@ -698,6 +756,146 @@ finalize_it:
 }
 
 
+static void
+pidInfoDestruct(void *p)
+{
+	pidInfo_t *pInfo = (pidInfo_t*) p;
+
+	free(pInfo->comm);
+	free(pInfo->exe);
+	free(pInfo->cmdline);
+	free(pInfo);
+}
+
+/* (re-)read the trusted properties of the process described by cred */
+static void
+pidInfoFill(pidInfo_t *pInfo, struct ucred *cred)
+{
+	uchar propBuf[1024];
+	int lenProp;
+
+	free(pInfo->comm);
+	free(pInfo->exe);
+	free(pInfo->cmdline);
+	pInfo->comm = pInfo->exe = pInfo->cmdline = NULL;
+	pInfo->uid = cred->uid;
+	pInfo->gid = cred->gid;
+	if(getTrustedProp(cred, "comm", propBuf, sizeof(propBuf), &lenProp) == RS_RET_OK) {
+		pInfo->comm = ustrdup(propBuf);
+		pInfo->lenComm = lenProp;
+	}
+	if(getTrustedExe(cred, propBuf, sizeof(propBuf), &lenProp) == RS_RET_OK) {
+		pInfo->exe = ustrdup(propBuf);
+		pInfo->lenExe = lenProp;
+	}
+	if(getTrustedProp(cred, "cmdline", propBuf, sizeof(propBuf), &lenProp) == RS_RET_OK) {
+		pInfo->cmdline = ustrdup(propBuf);
+		pInfo->lenCmdline = lenProp;
+	}
+}
+
+/* obtain the trusted properties for cred, from the cache if possible.
+ * The result must be released via pidInfoRelease().
+ */
+static rsRetVal
+getPidInfo(struct ucred *cred, time_t tNow, pidInfo_t **ppInfo)
+{
+	pidInfo_t *pInfo = NULL;
+	DEFiRet;
+
+	if(pidCache != NULL) {
+		pInfo = hashmapSearch(pidCache, &cred->pid);
+		if(   pInfo != NULL && tNow < pInfo->tExpire
+		   && pInfo->uid == cred->uid && pInfo->gid == cred->gid) {
+			STATSCOUNTER_INC(ctrPidCacheHits, mutCtrPidCacheHits);
+			FINALIZE;
+		}
+		STATSCOUNTER_INC(ctrPidCacheMisses, mutCtrPidCacheMisses);
+	}
+
+	if(pInfo == NULL) {
+		CHKmalloc(pInfo = calloc(1, sizeof(pidInfo_t)));
+		if(pidCache != NULL && hashmapInsert(pidCache, &cred->pid, pInfo) == RS_RET_OK)
+			pInfo->bCached = 1; /* else use it uncached */
+	}
+	pidInfoFill(pInfo, cred);
+	if(pidCache != NULL)
+		pInfo->tExpire = tNow + runModConf->pidCacheTTL;
+
+finalize_it:
+	*ppInfo = pInfo;
+	RETiRet;
+}
+
+static inline void
+pidInfoRelease(pidInfo_t *pInfo)
+{
+	if(!pInfo->bCached)
+		pidInfoDestruct(pInfo);
+}
+
+
+/* hashmapIterate() callbacks for expireEntries() */
+struct expireCtx_s {
+	time_t tNow;
+	time_t maxIdle;
+};
+
+static int
+expireRatelimiter(const void __attribute__((unused)) *key, void *val, void *usrptr)
+{
+	struct expireCtx_s *const ctx = (struct expireCtx_s*) usrptr;
+	pidRatelimiter_t *const pidRl = (pidRatelimiter_t*) val;
+
+	if(ctx->tNow - pidRl->tLastUsed <= ctx->maxIdle)
+		return HASHMAP_KEEP;
+	pidRatelimiterDestruct(pidRl);
+	STATSCOUNTER_INC(ctrExpiredRatelimiters, mutCtrExpiredRatelimiters);
+	return HASHMAP_REMOVE;
+}
+
+static int
+expirePidInfo(const void __attribute__((unused)) *key, void *val, void *usrptr)
+{
+	struct expireCtx_s *const ctx = (struct expireCtx_s*) usrptr;
+	pidInfo_t *const pInfo = (pidInfo_t*) val;
+
+	if(ctx->tNow < pInfo->tExpire)
+		return HASHMAP_KEEP;
+	pidInfoDestruct(pInfo);
+	return HASHMAP_REMOVE;
+}
+
+/* remove per-pid ratelimiters that have not been used for a while as well
+ * as expired pid cache entries. This is done at most every EXPIRY_INTERVAL
+ * seconds, and only from the input thread.
+ */
+static void
+expireEntries(time_t tNow)
+{
+	struct expireCtx_s ctx;
+	int i;
+
+	/* note: the second check guards against the clock being set back */
+	if(tNow < tNextExpiry && tNextExpiry - tNow <= EXPIRY_INTERVAL)
+		return;
+	tNextExpiry = tNow + EXPIRY_INTERVAL;
+
+	ctx.tNow = tNow;
+	for(i = 0 ; i < nfd ; ++i) {
+		if(listeners[i].ht == NULL || hashmapCount(listeners[i].ht) == 0)
+			continue;
+		/* a ratelimiter idle for more than its interval is in initial state again */
+		ctx.maxIdle = (listeners[i].ratelimitInterval > RATELIMITER_MIN_IDLE) ?
+				listeners[i].ratelimitInterval : RATELIMITER_MIN_IDLE;
+		hashmapIterate(listeners[i].ht, expireRatelimiter, &ctx);
+	}
+
+	if(pidCache != NULL && hashmapCount(pidCache) > 0)
+		hashmapIterate(pidCache, expirePidInfo, &ctx);
+}
+
+
 /* copy a trusted property in escaped mode. That is, the property can contain
  * any character and so it must be properly quoted AND escaped.
  * It is assumed the output buffer is large enough. Returns the number of
@@ -742,7 +940,8 @@ SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct tim
 	ratelimit_t *ratelimiter = NULL;
 	uchar propBuf[1024];
 	uchar msgbuf[8192];
-	uchar *pmsgbuf;
+	uchar *pmsgbuf = NULL;
+	pidInfo_t *pInfo = NULL;
 	int toffs; /* offset for trusted properties */
 	struct syslogTime dummyTS;
 	struct json_object *json = NULL, *jval;
@@ -771,8 +970,6 @@ SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct tim
 	facil = LOG_FAC(pri);
 	sever = LOG_PRI(pri);
 
-	findRatelimiter(pLstn, cred, &ratelimiter); /* ignore error, better so than others... */
-
 	if(ts == NULL) {
 		datetime.getCurrTime(&st, &tt);
 	} else {
@@ -780,6 +977,8 @@ SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct tim
 		tt = ts->tv_sec;
 	}
 
+	findRatelimiter(pLstn, cred, tt, &ratelimiter); /* ignore error, better so than others... */
+
 #if 0 // TODO: think about stats counters (or wait for request...?)
 	if(ratelimiter != NULL && !withinRatelimit(ratelimiter, tt, cred->pid)) {
 		STATSCOUNTER_INC(ctrLostRatelimit, mutCtrLostRatelimit);
@@ -794,6 +993,7 @@ SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct tim
 		} else {
 			CHKmalloc(pmsgbuf = malloc(lenRcv+4096));
 		}
+		CHKiRet(getPidInfo(cred, tt, &pInfo));
 
 		if (pLstn->bParseTrusted) {
 			json = json_object_new_object();
@@ -804,16 +1004,16 @@ SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct tim
 			json_object_object_add(json, "uid", jval);
 			jval = json_object_new_int(cred->gid);
 			json_object_object_add(json, "gid", jval);
-			if(getTrustedProp(cred, "comm", propBuf, sizeof(propBuf), &lenProp) == RS_RET_OK) {
-				jval = json_object_new_string((char*)propBuf);
+			if(pInfo->comm != NULL) {
+				jval = json_object_new_string((char*)pInfo->comm);
 				json_object_object_add(json, "appname", jval);
 			}
-			if(getTrustedExe(cred, propBuf, sizeof(propBuf), &lenProp) == RS_RET_OK) {
-				jval = json_object_new_string((char*)propBuf);
+			if(pInfo->exe != NULL) {
+				jval = json_object_new_string((char*)pInfo->exe);
 				json_object_object_add(json, "exe", jval);
 			}
-			if(getTrustedProp(cred, "cmdline", propBuf, sizeof(propBuf), &lenProp) == RS_RET_OK) {
-				jval = json_object_new_string((char*)propBuf);
+			if(pInfo->cmdline != NULL) {
+				jval = json_object_new_string((char*)pInfo->cmdline);
 				json_object_object_add(json, "cmd", jval);
 			}
 		} else {
@@ -826,20 +1026,20 @@ SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct tim
 			memcpy(pmsgbuf+toffs, propBuf, lenProp);
 			toffs = toffs + lenProp;
 	
-			if(getTrustedProp(cred, "comm", propBuf, sizeof(propBuf), &lenProp) == RS_RET_OK) {
+			if(pInfo->comm != NULL) {
 				memcpy(pmsgbuf+toffs, " _COMM=", 7);
-				memcpy(pmsgbuf+toffs+7, propBuf, lenProp);
-				toffs = toffs + 7 + lenProp;
+				memcpy(pmsgbuf+toffs+7, pInfo->comm, pInfo->lenComm);
+				toffs = toffs + 7 + pInfo->lenComm;
 			}
-			if(getTrustedExe(cred, propBuf, sizeof(propBuf), &lenProp) == RS_RET_OK) {
+			if(pInfo->exe != NULL) {
 				memcpy(pmsgbuf+toffs, " _EXE=", 6);
-				memcpy(pmsgbuf+toffs+6, propBuf, lenProp);
-				toffs = toffs + 6 + lenProp;
+				memcpy(pmsgbuf+toffs+6, pInfo->exe, pInfo->lenExe);
+				toffs = toffs + 6 + pInfo->lenExe;
 			}
-			if(getTrustedProp(cred, "cmdline", propBuf, sizeof(propBuf), &lenProp) == RS_RET_OK) {
+			if(pInfo->cmdline != NULL) {
 				memcpy(pmsgbuf+toffs, " _CMDLINE=", 10);
 				toffs = toffs + 10 + 
-					copyescaped(pmsgbuf+toffs+10, propBuf, lenProp);
+					copyescaped(pmsgbuf+toffs+10, pInfo->cmdline, pInfo->lenCmdline);
 			}
 
 			/* finalize string */
@@ -920,13 +1120,149 @@ SubmitMsg(uchar *pRcv, int lenRcv, lstn_t *pLstn, struct ucred *cred, struct tim
 
 	MsgSetRcvFrom(pMsg, pLstn->hostName == NULL ? glbl.GetLocalHostNameProp() : pLstn->hostName);
 	CHKiRet(MsgSetRcvFromIP(pMsg, pLocalHostIP));
-	ratelimitAddMsg(ratelimiter, NULL, pMsg);
+	imBatchAdd(&batch, ratelimiter, pMsg);
 	STATSCOUNTER_INC(ctrSubmit, mutCtrSubmit);
 finalize_it:
+	if(pInfo != NULL)
+		pidInfoRelease(pInfo);
+	if(pmsgbuf != NULL && pmsgbuf != msgbuf)
+		free(pmsgbuf);
 	RETiRet;
 }
 
 
+/* process a datagram received via recvmsg()/recvmmsg(): pull credentials
+ * and timestamp from the control messages and submit it.
+ */
+static inline rsRetVal
+processDatagram(lstn_t *pLstn, struct msghdr *msgh, uchar *pRcv, int iRcvd)
+{
+	struct cmsghdr *cm;
+	struct ucred *cred;
+	struct timeval *ts;
+	DEFiRet;
+
+	cred = NULL;
+	ts = NULL;
+	if(pLstn->bUseCreds) {
+		for(cm = CMSG_FIRSTHDR(msgh); cm; cm = CMSG_NXTHDR(msgh, cm)) {
+#			if HAVE_SCM_CREDENTIALS
+			if(   pLstn->bUseCreds
+			   && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_CREDENTIALS) {
+				cred = (struct ucred*) CMSG_DATA(cm);
+			}
+#			endif /* HAVE_SCM_CREDENTIALS */
+#			if HAVE_SO_TIMESTAMP
+			if(   pLstn->bUseSysTimeStamp 
+			   && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_TIMESTAMP) {
+				ts = (struct timeval *)CMSG_DATA(cm);
+			}
+#			endif /* HAVE_SO_TIMESTAMP */
+		}
+	}
+	CHKiRet(SubmitMsg(pRcv, iRcvd, pLstn, cred, ts));
+finalize_it:
+	RETiRet;
+}
+
+
+#ifdef HAVE_RECVMMSG
+/* buffers for batched receives. They are only used by the input thread. */
+static struct {
+	int nBatch;
+	int iMaxLine;
+	uchar *pRcvBuf;		/* nBatch buffers of iMaxLine+1 bytes */
+	char *pAux;		/* nBatch control message buffers of AUX_SIZE bytes */
+	struct iovec *iov;
+	struct mmsghdr *mmh;
+} rcvBatch;
+
+static rsRetVal
+rcvBatchInit(void)
+{
+	DEFiRet;
+
+	rcvBatch.nBatch = runModConf->batchSize;
+	rcvBatch.iMaxLine = glbl.GetMaxLine();
+	CHKmalloc(rcvBatch.pRcvBuf = malloc(rcvBatch.nBatch * (rcvBatch.iMaxLine + 1)));
+	CHKmalloc(rcvBatch.pAux = malloc(rcvBatch.nBatch * AUX_SIZE));
+	CHKmalloc(rcvBatch.iov = malloc(rcvBatch.nBatch * sizeof(struct iovec)));
+	CHKmalloc(rcvBatch.mmh = malloc(rcvBatch.nBatch * sizeof(struct mmsghdr)));
+finalize_it:
+	RETiRet;
+}
+
+static void
+rcvBatchExit(void)
+{
+	free(rcvBatch.pRcvBuf);
+	free(rcvBatch.pAux);
+	free(rcvBatch.iov);
+	free(rcvBatch.mmh);
+	memset(&rcvBatch, 0, sizeof(rcvBatch));
+}
+
+/* This function receives data from a socket indicated to be ready
+ * to receive and adds the messages received to the submission batch. Up
+ * to batchSize datagrams are pulled with a single recvmmsg() call.
+ */
+static rsRetVal readSocket(lstn_t *pLstn)
+{
+	int nelem;
+	int i;
+	struct msghdr *msgh;
+	DEFiRet;
+
+	assert(pLstn->fd >= 0);
+
+	memset(rcvBatch.mmh, 0, rcvBatch.nBatch * sizeof(struct mmsghdr));
+	for(i = 0 ; i < rcvBatch.nBatch ; ++i) {
+		rcvBatch.iov[i].iov_base = rcvBatch.pRcvBuf + i * (rcvBatch.iMaxLine + 1);
+		rcvBatch.iov[i].iov_len = rcvBatch.iMaxLine;
+		msgh = &rcvBatch.mmh[i].msg_hdr;
+		msgh->msg_iov = &rcvBatch.iov[i];
+		msgh->msg_iovlen = 1;
+#		if HAVE_SCM_CREDENTIALS
+		if(pLstn->bUseCreds) {
+			msgh->msg_control = rcvBatch.pAux + i * AUX_SIZE;
+			msgh->msg_controllen = AUX_SIZE;
+		}
+#		endif
+	}
+	nelem = recvmmsg(pLstn->fd, rcvBatch.mmh, rcvBatch.nBatch, MSG_DONTWAIT, NULL);
+	if(nelem < 0 && errno == ENOSYS) {
+		/* be careful: some versions of valgrind do not support recvmmsg()! */
+		DBGPRINTF("imuxsock: error ENOSYS on call to recvmmsg() - fall back to recvmsg\n");
+		nelem = recvmsg(pLstn->fd, &rcvBatch.mmh[0].msg_hdr, MSG_DONTWAIT);
+		if(nelem >= 0) {
+			rcvBatch.mmh[0].msg_len = nelem;
+			nelem = 1;
+		}
+	}
+ 
+	DBGPRINTF("Message from UNIX socket: #%d, %d datagrams\n", pLstn->fd, nelem);
+	if(nelem < 0) {
+		if(errno != EINTR && errno != EAGAIN) {
+			char errStr[1024];
+			rs_strerror_r(errno, errStr, sizeof(errStr));
+			DBGPRINTF("UNIX socket error: %d = %s.\n", errno, errStr);
+			errmsg.LogError(errno, NO_ERRCODE, "imuxsock: recvfrom UNIX");
+		}
+		FINALIZE;
+	}
+
+	for(i = 0 ; i < nelem ; ++i) {
+		if(rcvBatch.mmh[i].msg_len > 0)
+			processDatagram(pLstn, &rcvBatch.mmh[i].msg_hdr, rcvBatch.iov[i].iov_base,
+					rcvBatch.mmh[i].msg_len);
+	}
+	if(nelem > 0)
+		expireEntries(time(NULL));
+
+finalize_it:
+	RETiRet;
+}
+#else /* we do not have recvmmsg() */
 /* This function receives data from a socket indicated to be ready
  * to receive and submits the message received for processing.
  * rgerhards, 2007-12-20
@@ -941,13 +1277,10 @@ static rsRetVal readSocket(lstn_t *pLstn)
 	int iMaxLine;
 	struct msghdr msgh;
 	struct iovec msgiov;
-	struct cmsghdr *cm;
-	struct ucred *cred;
-	struct timeval *ts;
 	uchar bufRcv[4096+1];
 	uchar *pRcv = NULL; /* receive buffer */
 #	if HAVE_SCM_CREDENTIALS
-	char aux[128];
+	char aux[AUX_SIZE];
 #	endif
 
 	assert(pLstn->fd >= 0);
@@ -983,25 +1316,8 @@ static rsRetVal readSocket(lstn_t *pLstn)
  
 	DBGPRINTF("Message from UNIX socket: #%d\n", pLstn->fd);
 	if(iRcvd > 0) {
-		cred = NULL;
-		ts = NULL;
-		if(pLstn->bUseCreds) {
-			for(cm = CMSG_FIRSTHDR(&msgh); cm; cm = CMSG_NXTHDR(&msgh, cm)) {
-#				if HAVE_SCM_CREDENTIALS
-				if(   pLstn->bUseCreds
-				   && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_CREDENTIALS) {
-					cred = (struct ucred*) CMSG_DATA(cm);
-				}
-#				endif /* HAVE_SCM_CREDENTIALS */
-#				if HAVE_SO_TIMESTAMP
-				if(   pLstn->bUseSysTimeStamp 
-				   && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_TIMESTAMP) {
-					ts = (struct timeval *)CMSG_DATA(cm);
-				}
-#				endif /* HAVE_SO_TIMESTAMP */
-			}
-		}
-		CHKiRet(SubmitMsg(pRcv, iRcvd, pLstn, cred, ts));
+		CHKiRet(processDatagram(pLstn, &msgh, pRcv, iRcvd));
+		expireEntries(time(NULL));
 	} else if(iRcvd < 0 && errno != EINTR && errno != EAGAIN) {
 		char errStr[1024];
 		rs_strerror_r(errno, errStr, sizeof(errStr));
@@ -1015,6 +1331,7 @@ finalize_it:
 
 	RETiRet;
 }
+#endif /* #ifdef HAVE_RECVMMSG */
 
 
 /* activate current listeners */
@@ -1044,8 +1361,10 @@ activateListeners()
 			listeners[0].sockName = (uchar*) SYSTEMD_PATH_LOG;
 		}
 	}
-	if(runModConf->ratelimitIntervalSysSock > 0) {
-		if((listeners[0].ht = create_hashtable(100, hash_from_key_fn, key_equals_fn, NULL)) == NULL) {
+	if(runModConf->ratelimitIntervalSysSock > 0 && listeners[0].ht == NULL) {
+		/* usually already created by modInit() */
+		if(hashmapConstruct(&listeners[0].ht, 100, sizeof(pid_t), hash_from_key_fn, key_equals_fn,
+			NULL, pidRatelimiterDestruct) != RS_RET_OK) {
 			/* in this case, we simply turn of rate-limiting */
 			errmsg.LogError(0, NO_ERRCODE, "imuxsock: turning off rate limiting because we could not "
 				  "create hash table\n");
@@ -1115,6 +1434,8 @@ CODESTARTbeginCnfLoad
 	pModConf->ratelimitIntervalSysSock = DFLT_ratelimitInterval;
 	pModConf->ratelimitBurstSysSock = DFLT_ratelimitBurst;
 	pModConf->ratelimitSeveritySysSock = DFLT_ratelimitSeverity;
+	pModConf->batchSize = DFLT_batchSize;
+	pModConf->pidCacheTTL = 0;
 	bLegacyCnfModGlobalsPermitted = 1;
 	/* reset legacy config vars */
 	resetConfigVariables(NULL, NULL);
@@ -1166,6 +1487,10 @@ CODESTARTsetModCnf
 			loadModConf->ratelimitBurstSysSock = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "syssock.ratelimit.severity")) {
 			loadModConf->ratelimitSeveritySysSock = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "batchsize")) {
+			loadModConf->batchSize = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "pidcache.ttl")) {
+			loadModConf->pidCacheTTL = (int) pvals[i].val.d.n;
 		} else {
 			dbgprintf("imuxsock: program error, non-handled "
 			  "param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
@@ -1371,7 +1696,8 @@ CODESTARTrunInput
 			dbgprintf("\n");
 		}
 
-		/* wait for io to become ready */
+		/* submit what the last round received, then wait for io to become ready */
+		imBatchFlush(&batch);
 		nfds = select(maxfds+1, (fd_set *) pReadfds, NULL, NULL, NULL);
 		if(glbl.GetGlobalInputTermState() == 1)
 			break; /* terminate input! */
@@ -1394,12 +1720,25 @@ ENDrunInput
 
 BEGINwillRun
 CODESTARTwillRun
+#	ifdef HAVE_RECVMMSG
+	CHKiRet(rcvBatchInit());
+#	endif
+	CHKiRet(imBatchConstruct(&batch, CONF_NUM_MULTISUB, IM_BATCH_DFLT_DELAY));
+	if(runModConf->pidCacheTTL > 0) {
+		if(hashmapConstruct(&pidCache, 100, sizeof(pid_t), hash_from_key_fn, key_equals_fn,
+			NULL, pidInfoDestruct) != RS_RET_OK) {
+			DBGPRINTF("imuxsock: turning off pid cache because we could not "
+				  "create hash table\n");
+		}
+	}
+finalize_it:
 ENDwillRun
 
 
 BEGINafterRun
 	int i;
 CODESTARTafterRun
+	imBatchDestruct(&batch);
 	/* do cleanup here */
 	/* Close the UNIX sockets. */
        for (i = 0; i < nfd; i++)
@@ -1426,6 +1765,12 @@ CODESTARTafterRun
 
 	discardLogSockets();
 	nfd = 1;
+	if(pidCache != NULL) {
+		hashmapDestruct(&pidCache);
+	}
+#	ifdef HAVE_RECVMMSG
+	rcvBatchExit();
+#	endif
 ENDafterRun
 
 
@@ -1538,8 +1883,8 @@ CODEmodInit_QueryRegCFSLineHdlr
 	listeners[0].bUnlink = 1;
 	listeners[0].bCreatePath = 0;
 	listeners[0].bUseSysTimeStamp = 1;
-	if((listeners[0].ht = create_hashtable(100, hash_from_key_fn, key_equals_fn,
-		(void(*)(void*))ratelimitDestruct)) == NULL) {
+	if(hashmapConstruct(&listeners[0].ht, 100, sizeof(pid_t), hash_from_key_fn, key_equals_fn,
+		NULL, pidRatelimiterDestruct) != RS_RET_OK) {
 		/* in this case, we simply turn off rate-limiting */
 		DBGPRINTF("imuxsock: turning off rate limiting for system socket "
 			  "because we could not create hash table\n");
@@ -1612,6 +1957,15 @@ CODEmodInit_QueryRegCFSLineHdlr
 	STATSCOUNTER_INIT(ctrNumRatelimiters, mutCtrNumRatelimiters);
 	CHKiRet(statsobj.AddCounter(modStats, UCHAR_CONSTANT("ratelimit.numratelimiters"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrNumRatelimiters));
+	STATSCOUNTER_INIT(ctrExpiredRatelimiters, mutCtrExpiredRatelimiters);
+	CHKiRet(statsobj.AddCounter(modStats, UCHAR_CONSTANT("ratelimit.numexpired"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrExpiredRatelimiters));
+	STATSCOUNTER_INIT(ctrPidCacheHits, mutCtrPidCacheHits);
+	CHKiRet(statsobj.AddCounter(modStats, UCHAR_CONSTANT("pidcache.hits"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrPidCacheHits));
+	STATSCOUNTER_INIT(ctrPidCacheMisses, mutCtrPidCacheMisses);
+	CHKiRet(statsobj.AddCounter(modStats, UCHAR_CONSTANT("pidcache.misses"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrPidCacheMisses));
 	CHKiRet(statsobj.ConstructFinalize(modStats));
 
 ENDmodInit
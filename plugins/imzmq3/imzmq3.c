@@ -33,6 +33,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <arpa/inet.h>
 #include "cfsysline.h"
 #include "dirty.h"
 #include "errmsg.h"
@@ -58,6 +61,23 @@ MODULE_CNFNAME("imzmq3");
 #define ACTION_CONNECT 1
 #define ACTION_BIND    2
 
+/* batch modes, must match what the sender (omzmq3) uses. In multipart
+ * mode, each frame of a multipart zmq message is one syslog message. In
+ * framed mode, a zmq message carries multiple syslog messages, each
+ * preceeded by its length as 4-byte unsigned integer in network byte order.
+ */
+#define BATCH_NONE      0
+#define BATCH_MULTIPART 1
+#define BATCH_FRAMED    2
+
+/* max number of messages submitted to the queue in one go */
+#define MAX_SUBMIT_BATCH 128
+
+/* max number of single (non-batch) messages read from a socket per poll,
+ * so that one busy socket does not starve the others on the same thread
+ */
+#define MAX_RCV_PER_POLL 1024
+
 /* Module static data */
 DEF_IMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
@@ -83,8 +103,22 @@ typedef struct _socket_action {
 typedef struct _poller_data {
     ruleset_t*  ruleset;
     thrdInfo_t* thread;
+    int         batchMode;
 } poller_data;
 
+/* a receiver thread. Listeners are distributed round-robin over the
+ * receivers, each of which runs its own zloop. The first receiver runs
+ * on the input thread itself.
+ */
+typedef struct _receiver {
+    pthread_t       tid;
+    thrdInfo_t*     thread;
+    zloop_t*        zloop;
+    int             nItems;
+    sbool           bThrdStarted;
+    volatile sbool  bThrdDone;
+} receiver;
+
 
 /* a linked-list of subscription topics */
 typedef struct sublist_t {
@@ -114,6 +148,8 @@ struct instanceConf_s {
     int                    reconnectIVLMax;
     int                    ipv4Only;
     int                    affinity;
+    int                    batchMode;
+    int                    readers; /* number of sockets (PULL/CONNECT only) */
     uchar*                 pszBindRuleset;
     ruleset_t*             pBindRuleset;
     struct instanceConf_s* next;
@@ -125,11 +161,13 @@ struct modConfData_s {
     instanceConf_t* root;
     instanceConf_t* tail;
     int             io_threads;
+    int             threads; /* number of receiver threads */
 };
 struct lstn_s {
     struct lstn_s* next;
     void* sock;
     ruleset_t* pRuleset;
+    int batchMode;
 };
 
 /* ----------------------------------------------------------------------------
@@ -139,7 +177,6 @@ static modConfData_t*       runModConf      = NULL;
 static struct lstn_s*       lcnfRoot        = NULL;
 static struct lstn_s*       lcnfLast        = NULL;
 static prop_t*              s_namep         = NULL;
-static zloop_t*             s_zloop         = NULL;
 static zctx_t*              s_context       = NULL;
 static socket_type          socketTypes[]   = {
     {"SUB",    ZMQ_SUB  },
@@ -155,6 +192,7 @@ static socket_action        socketActions[] = {
 
 static struct cnfparamdescr modpdescr[] = {
     { "ioThreads", eCmdHdlrInt,     0 },
+    { "threads",   eCmdHdlrPositiveInt, 0 },
 };
 
 static struct cnfparamblk modpblk = {
@@ -185,7 +223,9 @@ static struct cnfparamdescr inppdescr[] = {
     { "reconnectIVL",        eCmdHdlrInt,     0 },
     { "reconnectIVLMax",     eCmdHdlrInt,     0 },
     { "ipv4Only",            eCmdHdlrInt,     0 },
-    { "affinity",            eCmdHdlrInt,     0 }
+    { "affinity",            eCmdHdlrInt,     0 },
+    { "batchMode",           eCmdHdlrGetWord, 0 },
+    { "readers",             eCmdHdlrPositiveInt, 0 }
 };
 
 static struct cnfparamblk inppblk = {
@@ -267,6 +307,8 @@ static void setDefaults(instanceConf_t* info) {
     info->reconnectIVLMax = -1;
     info->ipv4Only        = -1;
     info->affinity        = -1;
+    info->batchMode       = BATCH_NONE;
+    info->readers         = 1;
     info->next            = NULL;
 };
 
@@ -336,6 +378,16 @@ static rsRetVal validateConfig(instanceConf_t* info) {
                         "only SUB sockets can have subscriptions");
         return RS_RET_INVALID_PARAMS;
     }
+    /* several connecting PULL sockets share the load of the peer's PUSH
+     * socket. Any other combination would either not be possible (bind)
+     * or duplicate messages (SUB).
+     */
+    if(info->readers > 1 && (info->type != ZMQ_PULL || info->action != ACTION_CONNECT)) {
+        errmsg.LogError(0, RS_RET_INVALID_PARAMS,
+                        "readers > 1 is only supported for PULL sockets with "
+                        "action CONNECT");
+        return RS_RET_INVALID_PARAMS;
+    }
     return RS_RET_OK;
 }
 
@@ -506,6 +558,23 @@ static rsRetVal createListener(struct cnfparamvals* pvals) {
             inst->ipv4Only = (int) pvals[i].val.d.n;
         } else if(!strcmp(inppblk.descr[i].name, "affinity")) {
             inst->affinity = (int) pvals[i].val.d.n;
+        } else if(!strcmp(inppblk.descr[i].name, "batchMode")) {
+            char* mode = es_str2cstr(pvals[i].val.d.estr, NULL);
+            if(!strcmp(mode, "none")) {
+                inst->batchMode = BATCH_NONE;
+            } else if(!strcmp(mode, "multipart")) {
+                inst->batchMode = BATCH_MULTIPART;
+            } else if(!strcmp(mode, "framed")) {
+                inst->batchMode = BATCH_FRAMED;
+            } else {
+                errmsg.LogError(0, RS_RET_CONFIG_ERROR, "imzmq3: unknown batchMode "
+                                "'%s', must be \"none\", \"multipart\" or \"framed\"", mode);
+                free(mode);
+                ABORT_FINALIZE(RS_RET_CONFIG_ERROR);
+            }
+            free(mode);
+        } else if(!strcmp(inppblk.descr[i].name, "readers")) {
+            inst->readers = (int) pvals[i].val.d.n;
         } else {
             errmsg.LogError(0, NO_ERRCODE, "imzmq3: program error, non-handled "
                             "param '%s'\n", inppblk.descr[i].name);
@@ -529,6 +598,7 @@ static rsRetVal addListener(instanceConf_t* inst){
     newcnfinfo->next = NULL;
     newcnfinfo->sock = sock;
     newcnfinfo->pRuleset = inst->pBindRuleset;
+    newcnfinfo->batchMode = inst->batchMode;
     
     /* add this struct to the global */
     if(lcnfRoot == NULL) {
@@ -545,27 +615,117 @@ finalize_it:
     RETiRet;
 }
 
-static int handlePoll(zloop_t __attribute__((unused)) * loop, zmq_pollitem_t *poller, void* pd) {
+static rsRetVal createMsg(poller_data* pollerData, char* buf, size_t len, msg_t** ppMsg) {
     msg_t* pMsg;
+    DEFiRet;
+
+    CHKiRet(msgConstruct(&pMsg));
+    MsgSetRawMsg(pMsg, buf, len);
+    MsgSetInputName(pMsg, s_namep);
+    MsgSetHOSTNAME(pMsg, glbl.GetLocalHostName(), ustrlen(glbl.GetLocalHostName()));
+    MsgSetRcvFrom(pMsg, glbl.GetLocalHostNameProp());
+    MsgSetRcvFromIP(pMsg, glbl.GetLocalHostIP());
+    MsgSetMSGoffs(pMsg, 0);
+    MsgSetFlowControlType(pMsg, eFLOWCTL_NO_DELAY);
+    MsgSetRuleset(pMsg, pollerData->ruleset);
+    pMsg->msgFlags = NEEDS_PARSING | PARSE_HOSTNAME;
+    *ppMsg = pMsg;
+finalize_it:
+    RETiRet;
+}
+
+/* add a message to the submit batch, submitting it if full */
+static rsRetVal addToSubmit(poller_data* pollerData, multi_submit_t* pMultiSub,
+                            char* buf, size_t len) {
+    DEFiRet;
+
+    CHKiRet(createMsg(pollerData, buf, len, &pMultiSub->ppMsgs[pMultiSub->nElem]));
+    if(++pMultiSub->nElem == pMultiSub->maxElem)
+        CHKiRet(multiSubmitMsg2(pMultiSub));
+finalize_it:
+    RETiRet;
+}
+
+/* receive a batch as sent by omzmq3 in multipart or framed mode. The
+ * zmq message data is used in place, no intermediate copy is made.
+ */
+static void rcvBatch(void* sock, poller_data* pollerData) {
+    msg_t* msgs[MAX_SUBMIT_BATCH];
+    multi_submit_t multiSub;
+    zmq_msg_t msg;
+    char* data;
+    size_t len;
+    size_t offs;
+    uint32_t lenFrame;
+    int more;
+
+    multiSub.ppMsgs = msgs;
+    multiSub.maxElem = MAX_SUBMIT_BATCH;
+    multiSub.nElem = 0;
+    do {
+        zmq_msg_init(&msg);
+        if(zmq_msg_recv(&msg, sock, 0) == -1) {
+            zmq_msg_close(&msg);
+            break;
+        }
+        data = zmq_msg_data(&msg);
+        len = zmq_msg_size(&msg);
+        if(pollerData->batchMode == BATCH_MULTIPART) {
+            addToSubmit(pollerData, &multiSub, data, len);
+        } else {
+            for(offs = 0 ; offs + 4 <= len ; offs += 4 + lenFrame) {
+                memcpy(&lenFrame, data + offs, 4);
+                lenFrame = ntohl(lenFrame);
+                if(lenFrame > len - offs - 4) {
+                    errmsg.LogError(0, NO_ERRCODE, "imzmq3: malformed framed batch, "
+                                    "frame length %u exceeds message size - rest of "
+                                    "batch discarded", (unsigned) lenFrame);
+                    break;
+                }
+                addToSubmit(pollerData, &multiSub, data + offs + 4, lenFrame);
+            }
+        }
+        more = zmq_msg_more(&msg);
+        zmq_msg_close(&msg);
+    } while(more);
+    multiSubmitFlush(&multiSub);
+}
+
+/* receive single messages. We read all that is available (up to a limit)
+ * and submit them in batches.
+ */
+static void rcvSingle(void* sock, poller_data* pollerData) {
+    msg_t* msgs[MAX_SUBMIT_BATCH];
+    multi_submit_t multiSub;
+    zmq_msg_t msg;
+    int flags = 0;
+    int i;
+
+    multiSub.ppMsgs = msgs;
+    multiSub.maxElem = MAX_SUBMIT_BATCH;
+    multiSub.nElem = 0;
+    for(i = 0 ; i < MAX_RCV_PER_POLL ; ++i) {
+        zmq_msg_init(&msg);
+        if(zmq_msg_recv(&msg, sock, flags) == -1) {
+            zmq_msg_close(&msg);
+            break;
+        }
+        addToSubmit(pollerData, &multiSub, zmq_msg_data(&msg), zmq_msg_size(&msg));
+        zmq_msg_close(&msg);
+        flags = ZMQ_DONTWAIT; /* only the first one is known to be there */
+    }
+    multiSubmitFlush(&multiSub);
+}
+
+static int handlePoll(zloop_t __attribute__((unused)) * loop, zmq_pollitem_t *poller, void* pd) {
     poller_data* pollerData = (poller_data*)pd;
 
-    char* buf = zstr_recv(poller->socket);
-    if (msgConstruct(&pMsg) == RS_RET_OK) {
-        MsgSetRawMsg(pMsg, buf, strlen(buf));
-        MsgSetInputName(pMsg, s_namep);
-        MsgSetHOSTNAME(pMsg, glbl.GetLocalHostName(), ustrlen(glbl.GetLocalHostName()));
-        MsgSetRcvFrom(pMsg, glbl.GetLocalHostNameProp());
-        MsgSetRcvFromIP(pMsg, glbl.GetLocalHostIP());
-        MsgSetMSGoffs(pMsg, 0);
-        MsgSetFlowControlType(pMsg, eFLOWCTL_NO_DELAY);
-        MsgSetRuleset(pMsg, pollerData->ruleset);
-        pMsg->msgFlags = NEEDS_PARSING | PARSE_HOSTNAME;
-        submitMsg2(pMsg);
+    if(pollerData->batchMode != BATCH_NONE) {
+        rcvBatch(poller->socket, pollerData);
+    } else {
+        rcvSingle(poller->socket, pollerData);
     }
     
-    /* gotta free the string returned from zstr_recv() */
-    free(buf);
-    
     if( pollerData->thread->bShallStop == TRUE) {
         /* a handler that returns -1 will terminate the 
            czmq reactor loop
@@ -576,21 +736,72 @@ static int handlePoll(zloop_t __attribute__((unused)) * loop, zmq_pollitem_t *po
     return 0;
 }
 
+/* run a receiver's zloop until we are told to stop. zloop_start()
+ * returns when it is interrupted by a signal, which is how SIGTTIN
+ * gets us here.
+ */
+static void runReceiver(receiver* rcvr) {
+    DBGPRINTF("imzmq3: zloop with %d sockets starting...\n", rcvr->nItems);
+    while(rcvr->thread->bShallStop != TRUE) {
+        if(zloop_start(rcvr->zloop) == -1 && rcvr->thread->bShallStop != TRUE) {
+            /* a handler asked to terminate, but we are not to stop. This
+             * can not happen, but we do not want to spin if it does.
+             */
+            break;
+        }
+    }
+    DBGPRINTF("imzmq3: zloop stopped.\n");
+}
+
+/* thread for an additional receiver. It inherits the input thread's
+ * signal setup, so SIGTTIN interrupts it.
+ */
+static void* receiverThrd(void* myself) {
+    receiver* rcvr = (receiver*) myself;
+
+    runReceiver(rcvr);
+    rcvr->bThrdDone = 1;
+    return NULL;
+}
+
+/* stop the additional receiver threads. They check bShallStop, which is
+ * already set, but may be blocked in zmq_poll(), so we interrupt them
+ * until they are gone.
+ */
+static void stopReceivers(receiver* rcvrs, int nRcvrs) {
+    int i;
+
+    for(i = 1 ; i < nRcvrs ; ++i) {
+        if(!rcvrs[i].bThrdStarted)
+            continue;
+        while(!rcvrs[i].bThrdDone) {
+            pthread_kill(rcvrs[i].tid, SIGTTIN);
+            srSleep(0, 10000);
+        }
+        pthread_join(rcvrs[i].tid, NULL);
+    }
+}
+
 /* called when runInput is called by rsyslog 
  */
 static rsRetVal rcv_loop(thrdInfo_t* pThrd){
     size_t          n_items = 0;
     size_t          i;
+    int             j;
     int             rv;
+    int             nRcvrs;
     zmq_pollitem_t* items = NULL;
     poller_data*    pollerData = NULL;
+    receiver*       rcvrs = NULL;
+    receiver*       rcvr;
     struct lstn_s*  current;
     instanceConf_t* inst;
     DEFiRet;
 
     /* now add listeners. This actually creates the sockets, etc... */
     for (inst = runModConf->root; inst != NULL; inst=inst->next) {
-        addListener(inst);
+        for(j = 0 ; j < inst->readers ; ++j)
+            addListener(inst);
     }
     if (lcnfRoot == NULL) {
         errmsg.LogError(0, NO_ERRCODE, "imzmq3: no listeners were "
@@ -619,21 +830,48 @@ static rsRetVal rcv_loop(thrdInfo_t* pThrd){
         /* now update the poller_data for this item */
         pollerData[i].thread  = pThrd;
         pollerData[i].ruleset = current->pRuleset;
+        pollerData[i].batchMode = current->batchMode;
     }
 
-    s_zloop = zloop_new();
+    /* there is no point in having more receivers than sockets */
+    nRcvrs = runModConf->threads;
+    if((size_t) nRcvrs > n_items)
+        nRcvrs = (int) n_items;
+    CHKmalloc(rcvrs = (receiver*)calloc(nRcvrs, sizeof(receiver)));
+    for(j=0; j<nRcvrs; ++j) {
+        rcvrs[j].thread = pThrd;
+        CHKmalloc(rcvrs[j].zloop = zloop_new());
+    }
     for(i=0; i<n_items; ++i) {
-        
-        rv = zloop_poller(s_zloop, &items[i], handlePoll, &pollerData[i]);
+        rcvr = &rcvrs[i % nRcvrs];
+        rv = zloop_poller(rcvr->zloop, &items[i], handlePoll, &pollerData[i]);
         if (rv) {
             errmsg.LogError(0, NO_ERRCODE, "imzmq3: zloop_poller failed for item %zu: %s", i, zmq_strerror(errno));
-        } 
+        } else {
+            ++rcvr->nItems;
+        }
+    }
+
+    /* the first receiver runs on our own thread, all others get their own */
+    for(j=1; j<nRcvrs; ++j) {
+        if(pthread_create(&rcvrs[j].tid, NULL, receiverThrd, &rcvrs[j]) == 0) {
+            rcvrs[j].bThrdStarted = 1;
+        } else {
+            errmsg.LogError(errno, RS_RET_ERR, "imzmq3: could not start receiver "
+                            "thread, sockets assigned to it are inactive");
+        }
     }
-    DBGPRINTF("imzmq3: zloop_poller starting...");
-    zloop_start(s_zloop);   
-    zloop_destroy(&s_zloop);
-    DBGPRINTF("imzmq3: zloop_poller stopped.");
+    runReceiver(&rcvrs[0]);
+    stopReceivers(rcvrs, nRcvrs);
+
 finalize_it:
+    if(rcvrs != NULL) {
+        for(j=0; j<nRcvrs; ++j) {
+            if(rcvrs[j].zloop != NULL)
+                zloop_destroy(&rcvrs[j].zloop);
+        }
+        free(rcvrs);
+    }
     zctx_destroy(&s_context);
 
     free(items);
@@ -703,6 +941,7 @@ CODESTARTbeginCnfLoad
     runModConf->pConf = pConf;
     /* init module config */
     runModConf->io_threads = 0; /* 0 means don't set it */
+    runModConf->threads = 1;
 ENDbeginCnfLoad
 
 
@@ -722,6 +961,8 @@ CODESTARTsetModCnf
             continue;
         if (!strcmp(modpblk.descr[i].name, "ioThreads")) {
             runModConf->io_threads = (int)pvals[i].val.d.n;
+        } else if (!strcmp(modpblk.descr[i].name, "threads")) {
+            runModConf->threads = (int)pvals[i].val.d.n;
         } else {
             errmsg.LogError(0, RS_RET_INVALID_PARAMS, 
                            "imzmq3: config error, unknown "
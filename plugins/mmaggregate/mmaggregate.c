@@ -0,0 +1,869 @@
+/* mmaggregate.c
+ * pre-aggregate messages into periodic metric summaries.
+ *
+ * Messages are grouped by a key, which is generated from a template.
+ * For each key, the number of messages and - if a value property is
+ * configured - sum, min, max and approximate percentiles of the value are
+ * kept. Every "interval" seconds, one summary message per key is emitted
+ * and the aggregates are reset.
+ *
+ * Each worker aggregates into its own table, guarded by a mutex of its
+ * own that only the summary thread competes for. Right before it emits
+ * the summaries, the summary thread merges all worker tables into the
+ * instance table, so each interval contains all messages aggregated up
+ * to then, no matter how many workers there are. Percentiles are computed from a log-scale histogram
+ * with HIST_SUB buckets per power of two, which keeps the relative error
+ * below ~10% while histograms of different workers can simply be added.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "rsyslog.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <json.h>
+#include "conf.h"
+#include "syslogd-types.h"
+#include "srUtils.h"
+#include "template.h"
+#include "module-template.h"
+#include "errmsg.h"
+#include "hashtable.h"
+#include "hashtable_itr.h"
+#include "statsobj.h"
+#include "glbl.h"
+#include "prop.h"
+#include "msg.h"
+#include "dirty.h"
+#include "unicode-helper.h"
+
+#define SUMMARY_FACILITY 5 /* syslog */
+#define SUMMARY_SEVERITY 6 /* info */
+#define HIST_SUB 4		/* histogram buckets per power of two */
+#define HIST_BUCKETS 128	/* covers values up to 2^(127/HIST_SUB) */
+#define MAX_PERCENTILES 16
+
+MODULE_TYPE_OUTPUT
+MODULE_TYPE_NOKEEP
+MODULE_CNFNAME("mmaggregate")
+
+
+DEFobjCurrIf(errmsg);
+DEFobjCurrIf(statsobj);
+DEFobjCurrIf(glbl);
+DEFobjCurrIf(prop);
+DEF_OMOD_STATIC_DATA
+
+/* the aggregate for one key */
+typedef struct aggEntry_s {
+	char *key;		/* owned by the hashtable */
+	uint64_t count;
+	double sum;
+	double min;
+	double max;
+	uint32_t *hist;		/* HIST_BUCKETS, only if a value is configured */
+} aggEntry_t;
+
+/* config variables */
+
+struct wrkrInstanceData;
+typedef struct _instanceData {
+	char *pszName;
+	char *pszTplName;
+	struct template *pTpl;		/* generates the key */
+	char *pszValue;
+	msgPropDescr_t *pValueProp;	/* pszValue, resolved */
+	int iInterval;			/* summary interval in seconds */
+	int iMaxKeys;
+	int nPercentiles;
+	double percentiles[MAX_PERCENTILES];
+	char *percentileNames[MAX_PERCENTILES];	/* "p99" etc, as given in the config */
+	sbool bDropOriginals;		/* end processing of aggregated messages */
+	pthread_mutex_t mutWrkrs;
+	struct wrkrInstanceData *pWrkrRoot;	/* all worker instances, under mutWrkrs */
+	pthread_mutex_t mut;
+	struct hashtable *htTotals;	/* key -> aggEntry_t, updated under mut */
+	statsobj_t *stats;
+	intctr_t ctrAggregated;
+	intctr_t ctrFailed;
+	intctr_t ctrOverflow;
+	intctr_t ctrSummaries;
+	time_t tLastSummary;
+	struct _instanceData *next;	/* list of all instances, for the summary thread */
+} instanceData;
+
+typedef struct wrkrInstanceData {
+	instanceData *pData;
+	actWrkrIParams_t iparam;	/* buffer for the key */
+	pthread_mutex_t mut;		/* guards ht and the counts below */
+	struct hashtable *ht;		/* local aggregates, key -> aggEntry_t */
+	/* local counts, added to the instance counters on merge */
+	int nAggregated;
+	int nFailed;
+	int nOverflow;
+	struct wrkrInstanceData *next;	/* list of the instance's workers */
+} wrkrInstanceData_t;
+
+/* all instances plus the thread that emits the summaries */
+static instanceData *pInstRoot = NULL;
+static pthread_mutex_t mutInstList = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t condSummary = PTHREAD_COND_INITIALIZER;
+static pthread_t summaryTid;
+static sbool bSummaryRunning = 0;
+static sbool bSummaryTerm = 0;
+static prop_t *pInputName = NULL;
+
+struct modConfData_s {
+	rsconf_t *pConf;	/* our overall config object */
+};
+static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
+static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current exec process */
+
+
+/* tables for interfacing with the v6 config system */
+/* action (instance) parameters */
+static struct cnfparamdescr actpdescr[] = {
+	{ "key", eCmdHdlrGetWord, 1 },
+	{ "value", eCmdHdlrGetWord, 0 },
+	{ "name", eCmdHdlrGetWord, 0 },
+	{ "interval", eCmdHdlrPositiveInt, 0 },
+	{ "maxkeys", eCmdHdlrPositiveInt, 0 },
+	{ "percentiles", eCmdHdlrArray, 0 },
+	{ "droporiginals", eCmdHdlrBinary, 0 }
+};
+static struct cnfparamblk actpblk =
+	{ CNFPARAMBLK_VERSION,
+	  sizeof(actpdescr)/sizeof(struct cnfparamdescr),
+	  actpdescr
+	};
+
+BEGINbeginCnfLoad
+CODESTARTbeginCnfLoad
+	loadModConf = pModConf;
+	pModConf->pConf = pConf;
+ENDbeginCnfLoad
+
+BEGINendCnfLoad
+CODESTARTendCnfLoad
+ENDendCnfLoad
+
+BEGINcheckCnf
+CODESTARTcheckCnf
+ENDcheckCnf
+
+BEGINactivateCnf
+CODESTARTactivateCnf
+	runModConf = pModConf;
+ENDactivateCnf
+
+BEGINfreeCnf
+CODESTARTfreeCnf
+ENDfreeCnf
+
+
+static void mergeAggregates(wrkrInstanceData_t *pWrkrData);
+static void unregisterInstance(instanceData *pData);
+
+static void
+aggEntryDestruct(void *p)
+{
+	aggEntry_t *const pEntry = (aggEntry_t*) p;
+	free(pEntry->hist);
+	free(pEntry);
+}
+
+static struct hashtable *
+createAggTable(void)
+{
+	return create_hashtable(100, hash_from_string, key_equals_string, aggEntryDestruct);
+}
+
+BEGINcreateInstance
+CODESTARTcreateInstance
+	pthread_mutex_init(&pData->mut, NULL);
+	pthread_mutex_init(&pData->mutWrkrs, NULL);
+ENDcreateInstance
+
+BEGINcreateWrkrInstance
+CODESTARTcreateWrkrInstance
+	pthread_mutex_init(&pWrkrData->mut, NULL);
+	pthread_mutex_lock(&pData->mutWrkrs);
+	pWrkrData->next = pData->pWrkrRoot;
+	pData->pWrkrRoot = pWrkrData;
+	pthread_mutex_unlock(&pData->mutWrkrs);
+ENDcreateWrkrInstance
+
+
+BEGINisCompatibleWithFeature
+CODESTARTisCompatibleWithFeature
+ENDisCompatibleWithFeature
+
+
+BEGINfreeInstance
+	int i;
+CODESTARTfreeInstance
+	unregisterInstance(pData);
+	if(pData->stats != NULL)
+		statsobj.Destruct(&pData->stats);
+	if(pData->htTotals != NULL)
+		hashtable_destroy(pData->htTotals, 1);
+	free(pData->pszName);
+	free(pData->pszTplName);
+	free(pData->pszValue);
+	if(pData->pValueProp != NULL) {
+		msgPropDescrDestruct(pData->pValueProp);
+		free(pData->pValueProp);
+	}
+	for(i = 0 ; i < pData->nPercentiles ; ++i)
+		free(pData->percentileNames[i]);
+	pthread_mutex_destroy(&pData->mut);
+	pthread_mutex_destroy(&pData->mutWrkrs);
+ENDfreeInstance
+
+
+BEGINfreeWrkrInstance
+	instanceData *pData;
+	wrkrInstanceData_t **ppPrev;
+CODESTARTfreeWrkrInstance
+	pData = pWrkrData->pData;
+	pthread_mutex_lock(&pData->mutWrkrs);
+	for(ppPrev = &pData->pWrkrRoot ; *ppPrev != NULL ; ppPrev = &(*ppPrev)->next) {
+		if(*ppPrev == pWrkrData) {
+			*ppPrev = pWrkrData->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pData->mutWrkrs);
+	mergeAggregates(pWrkrData);
+	pthread_mutex_destroy(&pWrkrData->mut);
+	free(pWrkrData->iparam.param);
+ENDfreeWrkrInstance
+
+static inline void
+setInstParamDefaults(instanceData *pData)
+{
+	pData->pszName = NULL;
+	pData->pszTplName = NULL;
+	pData->pTpl = NULL;
+	pData->pszValue = NULL;
+	pData->pValueProp = NULL;
+	pData->iInterval = 60;
+	pData->iMaxKeys = 10000;
+	pData->nPercentiles = 0;
+	pData->bDropOriginals = 0;
+	pData->pWrkrRoot = NULL;
+	pData->htTotals = NULL;
+	pData->stats = NULL;
+}
+
+
+/* the summary thread. It wakes up once a second and emits the summary
+ * messages for each instance whose interval has expired.
+ */
+static void emitSummaries(instanceData *pData);
+static void *
+summaryThread(void __attribute__((unused)) *arg)
+{
+	instanceData *pData;
+	struct timespec t;
+	time_t tNow;
+
+	pthread_mutex_lock(&mutInstList);
+	while(!bSummaryTerm) {
+		timeoutComp(&t, 1000);
+		pthread_cond_timedwait(&condSummary, &mutInstList, &t);
+		if(bSummaryTerm)
+			break;
+		tNow = time(NULL);
+		for(pData = pInstRoot ; pData != NULL ; pData = pData->next) {
+			if(tNow - pData->tLastSummary >= pData->iInterval) {
+				emitSummaries(pData);
+				pData->tLastSummary = tNow;
+			}
+		}
+	}
+	pthread_mutex_unlock(&mutInstList);
+	return NULL;
+}
+
+
+/* add an instance to the list and start the summary thread, if needed */
+static rsRetVal
+registerInstance(instanceData *pData)
+{
+	int r;
+	DEFiRet;
+
+	pthread_mutex_lock(&mutInstList);
+	pData->tLastSummary = time(NULL);
+	pData->next = pInstRoot;
+	pInstRoot = pData;
+	if(!bSummaryRunning) {
+		r = pthread_create(&summaryTid, NULL, summaryThread, NULL);
+		if(r != 0) {
+			errmsg.LogError(r, RS_RET_ERR, "mmaggregate: cannot start summary thread, "
+					"no summary messages will be emitted");
+		} else {
+			bSummaryRunning = 1;
+		}
+	}
+	pthread_mutex_unlock(&mutInstList);
+	RETiRet;
+}
+
+
+static void
+unregisterInstance(instanceData *pData)
+{
+	instanceData **ppPrev;
+
+	pthread_mutex_lock(&mutInstList);
+	for(ppPrev = &pInstRoot ; *ppPrev != NULL ; ppPrev = &(*ppPrev)->next) {
+		if(*ppPrev == pData) {
+			*ppPrev = pData->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mutInstList);
+}
+
+
+static rsRetVal
+createStats(instanceData *pData)
+{
+	uchar statsName[256];
+	DEFiRet;
+
+	CHKiRet(statsobj.Construct(&pData->stats));
+	snprintf((char*)statsName, sizeof(statsName), "mmaggregate(%s)", pData->pszName);
+	CHKiRet(statsobj.SetName(pData->stats, statsName));
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("aggregated"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pData->ctrAggregated));
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("failed"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pData->ctrFailed));
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("overflow"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pData->ctrOverflow));
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("summaries"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pData->ctrSummaries));
+	CHKiRet(statsobj.ConstructFinalize(pData->stats));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* add a percentile given in the config, e.g. "99.9" */
+static rsRetVal
+addPercentile(instanceData *pData, char *pszPct)
+{
+	char *pEnd;
+	double pct;
+	DEFiRet;
+
+	pct = strtod(pszPct, &pEnd);
+	if(pEnd == pszPct || *pEnd != '\0' || pct <= 0.0 || pct > 100.0) {
+		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "mmaggregate: invalid percentile '%s', "
+				"must be a number greater than 0 and up to 100", pszPct);
+		ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+	}
+	if(pData->nPercentiles == MAX_PERCENTILES) {
+		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "mmaggregate: too many percentiles, "
+				"at most %d are supported - ignoring '%s'", MAX_PERCENTILES, pszPct);
+		ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+	}
+	CHKmalloc(pData->percentileNames[pData->nPercentiles] = malloc(strlen(pszPct) + 2));
+	pData->percentileNames[pData->nPercentiles][0] = 'p';
+	strcpy(pData->percentileNames[pData->nPercentiles] + 1, pszPct);
+	pData->percentiles[pData->nPercentiles++] = pct;
+
+finalize_it:
+	RETiRet;
+}
+
+BEGINnewActInst
+	struct cnfparamvals *pvals;
+	char *cstr;
+	int i, j;
+CODESTARTnewActInst
+	DBGPRINTF("newActInst (mmaggregate)\n");
+	if((pvals = nvlstGetParams(lst, &actpblk, NULL)) == NULL) {
+		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+	}
+
+	CODE_STD_STRING_REQUESTnewActInst(1)
+	CHKiRet(OMSRsetEntry(*ppOMSR, 0, NULL, OMSR_TPL_AS_MSG));
+	CHKiRet(createInstance(&pData));
+	setInstParamDefaults(pData);
+
+	for(i = 0 ; i < actpblk.nParams ; ++i) {
+		if(!pvals[i].bUsed)
+			continue;
+		if(!strcmp(actpblk.descr[i].name, "key")) {
+			pData->pszTplName = es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "value")) {
+			pData->pszValue = es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "name")) {
+			pData->pszName = es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "interval")) {
+			pData->iInterval = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "maxkeys")) {
+			pData->iMaxKeys = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "droporiginals")) {
+			pData->bDropOriginals = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "percentiles")) {
+			for(j = 0 ; j < pvals[i].val.d.ar->nmemb ; ++j) {
+				cstr = es_str2cstr(pvals[i].val.d.ar->arr[j], NULL);
+				addPercentile(pData, cstr);
+				free(cstr);
+			}
+		} else {
+			dbgprintf("mmaggregate: program error, non-handled "
+				  "param '%s'\n", actpblk.descr[i].name);
+		}
+	}
+
+	/* templates must be defined before they are used, so we can look
+	 * it up right now.
+	 */
+	if((pData->pTpl = tplFind(loadModConf->pConf, pData->pszTplName,
+				  strlen(pData->pszTplName))) == NULL) {
+		errmsg.LogError(0, RS_RET_NOT_FOUND, "mmaggregate: key template '%s' not "
+				"found - action disabled", pData->pszTplName);
+		ABORT_FINALIZE(RS_RET_NOT_FOUND);
+	}
+
+	if(pData->pszValue != NULL) {
+		CHKmalloc(pData->pValueProp = calloc(1, sizeof(msgPropDescr_t)));
+		if(msgPropDescrFill(pData->pValueProp, (uchar*)pData->pszValue,
+				    strlen(pData->pszValue)) != RS_RET_OK) {
+			free(pData->pValueProp);
+			pData->pValueProp = NULL;
+			errmsg.LogError(0, RS_RET_INVALID_PARAMS, "mmaggregate: invalid value "
+					"property '%s'", pData->pszValue);
+			ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+		}
+		if(!pvals[cnfparamGetIdx(&actpblk, "percentiles")].bUsed) {
+			addPercentile(pData, "50");
+			addPercentile(pData, "90");
+			addPercentile(pData, "99");
+		}
+	} else if(pData->nPercentiles > 0) {
+		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "mmaggregate: percentiles "
+				"require a value property - ignored");
+	}
+
+	if(pData->pszName == NULL)
+		CHKmalloc(pData->pszName = strdup(pData->pszTplName));
+
+	if(NULL == (pData->htTotals = createAggTable())) {
+		DBGPRINTF("mmaggregate: error creating hash table!\n");
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	CHKiRet(createStats(pData));
+	CHKiRet(registerInstance(pData));
+CODE_STD_FINALIZERnewActInst
+	cnfparamvalsDestruct(pvals, &actpblk);
+ENDnewActInst
+
+
+BEGINdbgPrintInstInfo
+CODESTARTdbgPrintInstInfo
+	dbgprintf("mmaggregate: name '%s', key template '%s', value '%s', interval %d, "
+		  "droporiginals %d\n", pData->pszName, pData->pszTplName,
+		  pData->pszValue == NULL ? "(none)" : pData->pszValue, pData->iInterval,
+		  pData->bDropOriginals);
+ENDdbgPrintInstInfo
+
+
+BEGINtryResume
+CODESTARTtryResume
+ENDtryResume
+
+
+static inline int
+histBucket(double val)
+{
+	int b;
+
+	if(val < 1.0)
+		return 0;
+	b = (int) (log2(val) * HIST_SUB) + 1;
+	return (b >= HIST_BUCKETS) ? HIST_BUCKETS - 1 : b;
+}
+
+/* the value we report for a bucket: the geometric middle of its range */
+static inline double
+histBucketValue(int b)
+{
+	return (b == 0) ? 0.0 : exp2((b - 0.5) / HIST_SUB);
+}
+
+
+/* find the aggregate for a key in a table, creating it if needed. Returns
+ * NULL if the key is new and the table already holds iMaxKeys keys, or
+ * if we are out of memory.
+ */
+static aggEntry_t *
+getAggEntry(instanceData *pData, struct hashtable *ht, char *key)
+{
+	aggEntry_t *pEntry;
+	char *pKey;
+
+	if((pEntry = hashtable_search(ht, key)) != NULL)
+		return pEntry;
+	if((int) hashtable_count(ht) >= pData->iMaxKeys)
+		return NULL;
+
+	if(NULL == (pKey = strdup(key))) {
+		DBGPRINTF("mmaggregate: memory allocation for key failed\n");
+		return NULL;
+	}
+	if(NULL == (pEntry = calloc(1, sizeof(aggEntry_t)))) {
+		DBGPRINTF("mmaggregate: memory allocation for value failed\n");
+		free(pKey);
+		return NULL;
+	}
+	if(pData->pValueProp != NULL
+	   && NULL == (pEntry->hist = calloc(HIST_BUCKETS, sizeof(uint32_t)))) {
+		DBGPRINTF("mmaggregate: memory allocation for histogram failed\n");
+		free(pKey);
+		free(pEntry);
+		return NULL;
+	}
+	pEntry->key = pKey;
+	if(!hashtable_insert(ht, pKey, pEntry)) {
+		DBGPRINTF("mmaggregate: inserting element into hashtable failed\n");
+		free(pKey);
+		aggEntryDestruct(pEntry);
+		return NULL;
+	}
+	return pEntry;
+}
+
+
+/* add the worker-local aggregates to the instance table. Called by the
+ * summary thread for all workers and by a worker that is shut down. The
+ * local table is taken from the worker under its mutex, so the worker is
+ * only blocked for that moment. It starts a new table, so that keys no
+ * longer seen do not linger in the workers.
+ */
+static void
+mergeAggregates(wrkrInstanceData_t *pWrkrData)
+{
+	instanceData *const pData = pWrkrData->pData;
+	struct hashtable *ht;
+	struct hashtable_itr *itr;
+	aggEntry_t *pLocal;
+	aggEntry_t *pTotal;
+	int nAggregated, nFailed, nOverflow;
+	int i;
+
+	pthread_mutex_lock(&pWrkrData->mut);
+	ht = pWrkrData->ht;
+	pWrkrData->ht = NULL;
+	nAggregated = pWrkrData->nAggregated;
+	nFailed = pWrkrData->nFailed;
+	nOverflow = pWrkrData->nOverflow;
+	pWrkrData->nAggregated = 0;
+	pWrkrData->nFailed = 0;
+	pWrkrData->nOverflow = 0;
+	pthread_mutex_unlock(&pWrkrData->mut);
+
+	pthread_mutex_lock(&pData->mut);
+	/* Iterator constructor only returns a valid iterator if
+	 * the hashtable is not empty */
+	if(ht != NULL && hashtable_count(ht) > 0 && (itr = hashtable_iterator(ht)) != NULL) {
+		do {
+			pLocal = (aggEntry_t*) hashtable_iterator_value(itr);
+			pTotal = getAggEntry(pData, pData->htTotals, pLocal->key);
+			if(pTotal == NULL) {
+				nOverflow += pLocal->count;
+				nAggregated -= pLocal->count;
+				continue;
+			}
+			if(pTotal->count == 0 || pLocal->min < pTotal->min)
+				pTotal->min = pLocal->min;
+			if(pTotal->count == 0 || pLocal->max > pTotal->max)
+				pTotal->max = pLocal->max;
+			pTotal->count += pLocal->count;
+			pTotal->sum += pLocal->sum;
+			if(pLocal->hist != NULL) {
+				for(i = 0 ; i < HIST_BUCKETS ; ++i)
+					pTotal->hist[i] += pLocal->hist[i];
+			}
+		} while(hashtable_iterator_advance(itr));
+		free(itr);
+	}
+	pData->ctrAggregated += nAggregated;
+	pData->ctrFailed += nFailed;
+	pData->ctrOverflow += nOverflow;
+	pthread_mutex_unlock(&pData->mut);
+
+	if(ht != NULL)
+		hashtable_destroy(ht, 1);
+}
+
+
+/* add the value of a percentile to the summary */
+static void
+addPercentiles(instanceData *pData, aggEntry_t *pEntry, struct json_object *json)
+{
+	uint64_t rank;
+	uint64_t cum;
+	double val;
+	int b, i;
+
+	for(i = 0 ; i < pData->nPercentiles ; ++i) {
+		rank = (uint64_t) ceil(pData->percentiles[i] / 100.0 * pEntry->count);
+		if(rank == 0)
+			rank = 1;
+		cum = 0;
+		for(b = 0 ; b < HIST_BUCKETS - 1 ; ++b) {
+			cum += pEntry->hist[b];
+			if(cum >= rank)
+				break;
+		}
+		val = histBucketValue(b);
+		if(val < pEntry->min)
+			val = pEntry->min;
+		if(val > pEntry->max)
+			val = pEntry->max;
+		json_object_object_add(json, pData->percentileNames[i],
+				       json_object_new_double(val));
+	}
+}
+
+
+/* emit the summary message for one key. The message text is JSON, which
+ * is also made available as the message's json tree, so that the
+ * summary fields can be used as $!count, $!sum etc.
+ */
+static void
+emitSummary(instanceData *pData, aggEntry_t *pEntry)
+{
+	struct json_object *json;
+	msg_t *pMsg;
+
+	if((json = json_object_new_object()) == NULL)
+		return;
+	json_object_object_add(json, "name", json_object_new_string(pData->pszName));
+	json_object_object_add(json, "key", json_object_new_string(pEntry->key));
+	json_object_object_add(json, "interval", json_object_new_int(pData->iInterval));
+	json_object_object_add(json, "count", json_object_new_int64(pEntry->count));
+	if(pData->pValueProp != NULL) {
+		json_object_object_add(json, "sum", json_object_new_double(pEntry->sum));
+		json_object_object_add(json, "min", json_object_new_double(pEntry->min));
+		json_object_object_add(json, "max", json_object_new_double(pEntry->max));
+		json_object_object_add(json, "avg",
+				       json_object_new_double(pEntry->sum / pEntry->count));
+		addPercentiles(pData, pEntry, json);
+	}
+
+	if(msgConstruct(&pMsg) != RS_RET_OK) {
+		json_object_put(json);
+		return;
+	}
+	MsgSetInputName(pMsg, pInputName);
+	MsgSetRawMsgWOSize(pMsg, (char*)json_object_to_json_string(json));
+	MsgSetHOSTNAME(pMsg, glbl.GetLocalHostName(), ustrlen(glbl.GetLocalHostName()));
+	MsgSetRcvFrom(pMsg, glbl.GetLocalHostNameProp());
+	MsgSetRcvFromIP(pMsg, glbl.GetLocalHostIP());
+	MsgSetMSGoffs(pMsg, 0);
+	MsgSetTAG(pMsg, UCHAR_CONSTANT("rsyslogd-mmaggregate:"), sizeof("rsyslogd-mmaggregate:") - 1);
+	pMsg->iFacility = SUMMARY_FACILITY;
+	pMsg->iSeverity = SUMMARY_SEVERITY;
+	pMsg->msgFlags  = 0;
+	msgAddJSON(pMsg, (uchar*)"!", json); /* consumes json */
+	submitMsg2(pMsg);
+}
+
+
+/* emit the summaries for all keys of an instance and start a new
+ * interval. The workers' tables are merged first. The instance table is
+ * then swapped out under the mutex, so the workers are not blocked while
+ * we build the messages.
+ */
+static void
+emitSummaries(instanceData *pData)
+{
+	wrkrInstanceData_t *pWrkrData;
+	struct hashtable *ht;
+	struct hashtable *htNew;
+	struct hashtable_itr *itr;
+	int nSummaries = 0;
+
+	pthread_mutex_lock(&pData->mutWrkrs);
+	for(pWrkrData = pData->pWrkrRoot ; pWrkrData != NULL ; pWrkrData = pWrkrData->next)
+		mergeAggregates(pWrkrData);
+	pthread_mutex_unlock(&pData->mutWrkrs);
+
+	if((htNew = createAggTable()) == NULL)
+		return;
+	pthread_mutex_lock(&pData->mut);
+	ht = pData->htTotals;
+	pData->htTotals = htNew;
+	pthread_mutex_unlock(&pData->mut);
+
+	if(hashtable_count(ht) > 0 && (itr = hashtable_iterator(ht)) != NULL) {
+		do {
+			emitSummary(pData, (aggEntry_t*) hashtable_iterator_value(itr));
+			++nSummaries;
+		} while(hashtable_iterator_advance(itr));
+		free(itr);
+	}
+	hashtable_destroy(ht, 1);
+
+	pthread_mutex_lock(&pData->mut);
+	pData->ctrSummaries += nSummaries;
+	pthread_mutex_unlock(&pData->mut);
+}
+
+
+/* aggregate a message into the worker-local table. Must be called with
+ * the worker's mutex locked. Returns 1 if the message was aggregated.
+ */
+static int
+aggregateLocal(wrkrInstanceData_t *pWrkrData, msg_t *pMsg)
+{
+	instanceData *const pData = pWrkrData->pData;
+	aggEntry_t *pEntry;
+	uchar *pVal;
+	char *pEnd;
+	rs_size_t lenVal;
+	unsigned short bMustBeFreed = 0;
+	double val = 0.0;
+
+	if(pData->pValueProp != NULL) {
+		pVal = MsgGetProp(pMsg, NULL, pData->pValueProp, &lenVal, &bMustBeFreed, NULL);
+		val = strtod((char*)pVal, &pEnd);
+		if(pEnd == (char*)pVal) {
+			if(bMustBeFreed)
+				free(pVal);
+			pWrkrData->nFailed++;
+			return 0;
+		}
+		if(bMustBeFreed)
+			free(pVal);
+	}
+
+	if(tplToString(pData->pTpl, pMsg, &pWrkrData->iparam, NULL) != RS_RET_OK) {
+		pWrkrData->nFailed++;
+		return 0;
+	}
+
+	if(pWrkrData->ht == NULL && (pWrkrData->ht = createAggTable()) == NULL) {
+		pWrkrData->nFailed++;
+		return 0;
+	}
+	if((pEntry = getAggEntry(pData, pWrkrData->ht, (char*)pWrkrData->iparam.param)) == NULL) {
+		pWrkrData->nOverflow++;
+		return 0;
+	}
+
+	if(pEntry->count == 0 || val < pEntry->min)
+		pEntry->min = val;
+	if(pEntry->count == 0 || val > pEntry->max)
+		pEntry->max = val;
+	pEntry->count++;
+	pEntry->sum += val;
+	if(pEntry->hist != NULL)
+		pEntry->hist[histBucket(val)]++;
+	pWrkrData->nAggregated++;
+	return 1;
+}
+
+
+BEGINdoAction
+	msg_t *pMsg;
+	int bAggregated;
+CODESTARTdoAction
+	pMsg = (msg_t*) ppString[0];
+	pthread_mutex_lock(&pWrkrData->mut);
+	bAggregated = aggregateLocal(pWrkrData, pMsg);
+	pthread_mutex_unlock(&pWrkrData->mut);
+	/* messages that could not be aggregated are passed on, so they are not lost */
+	if(bAggregated && pWrkrData->pData->bDropOriginals)
+		pMsg->msgFlags |= DISCARD_MSG;
+ENDdoAction
+
+
+BEGINparseSelectorAct
+CODESTARTparseSelectorAct
+CODE_STD_STRING_REQUESTparseSelectorAct(1)
+	if(strncmp((char*) p, ":mmaggregate:", sizeof(":mmaggregate:") - 1)) {
+		errmsg.LogError(0, RS_RET_LEGA_ACT_NOT_SUPPORTED,
+			"mmaggregate supports only v6+ config format, use: "
+			"action(type=\"mmaggregate\" ...)");
+	}
+	ABORT_FINALIZE(RS_RET_CONFLINE_UNPROCESSED);
+CODE_STD_FINALIZERparseSelectorAct
+ENDparseSelectorAct
+
+
+BEGINmodExit
+CODESTARTmodExit
+	if(bSummaryRunning) {
+		pthread_mutex_lock(&mutInstList);
+		bSummaryTerm = 1;
+		pthread_cond_signal(&condSummary);
+		pthread_mutex_unlock(&mutInstList);
+		pthread_join(summaryTid, NULL);
+		bSummaryRunning = 0;
+	}
+	if(pInputName != NULL)
+		prop.Destruct(&pInputName);
+	objRelease(prop, CORE_COMPONENT);
+	objRelease(glbl, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
+	objRelease(errmsg, CORE_COMPONENT);
+ENDmodExit
+
+
+BEGINqueryEtryPt
+CODESTARTqueryEtryPt
+CODEqueryEtryPt_STD_OMOD_QUERIES
+CODEqueryEtryPt_STD_OMOD8_QUERIES
+CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
+CODEqueryEtryPt_STD_CONF2_QUERIES
+ENDqueryEtryPt
+
+
+
+BEGINmodInit()
+CODESTARTmodInit
+	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
+CODEmodInit_QueryRegCFSLineHdlr
+	DBGPRINTF("mmaggregate: module compiled with rsyslog version %s.\n", VERSION);
+	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
+	CHKiRet(objUse(glbl, CORE_COMPONENT));
+	CHKiRet(objUse(prop, CORE_COMPONENT));
+	CHKiRet(prop.Construct(&pInputName));
+	CHKiRet(prop.SetString(pInputName, UCHAR_CONSTANT("mmaggregate"), sizeof("mmaggregate") - 1));
+	CHKiRet(prop.ConstructFinalize(pInputName));
+ENDmodInit
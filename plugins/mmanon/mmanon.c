@@ -1,5 +1,8 @@
 /* mmanon.c
  * anonnymize IP addresses inside the syslog message part
+ * IPv4 and IPv6 addresses are supported. For IPv6, the text form must
+ * be one of RFC 4291; addresses with embedded IPv4 part are handled by
+ * anonymizing the IPv4 part only.
  *
  * Copyright 2013 Adiscon GmbH.
  *
@@ -30,6 +33,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <ctype.h>
 #include "conf.h"
 #include "syslogd-types.h"
 #include "srUtils.h"
@@ -63,16 +67,31 @@ static const uint32_t ipv4masks[33] = {
 /* define operation modes we have */
 #define SIMPLE_MODE 0	 /* just overwrite */
 #define REWRITE_MODE 1	 /* rewrite IP address, canoninized */
+/* IPv6 anonymization in rewrite mode */
+#define IPV6_ZERO 0	 /* set the anonymized bits to zero */
+#define IPV6_TRUNCATE 1	 /* write only the remaining prefix (2001:db8::/32) */
 typedef struct _instanceData {
 	char replChar;
 	int8_t mode;
 	struct {
+		sbool bEnable;
 		int8_t bits;
 	} ipv4;
+	struct {
+		sbool bEnable;
+		uint8_t bits;
+		int8_t anonmode;
+	} ipv6;
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	uchar *outbuf;		/* used if replacements make the message grow */
+	int sizeOutbuf;
+	int lenOut;
+	int iWrite;		/* msg offset where the next unmodified part goes to */
+	int iCopied;		/* msg offset up to which msg was already processed */
+	sbool bUseOutbuf;
 } wrkrInstanceData_t;
 
 struct modConfData_s {
@@ -88,6 +107,10 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "mode", eCmdHdlrGetWord, 0 },
 	{ "replacementchar", eCmdHdlrGetChar, 0 },
 	{ "ipv4.bits", eCmdHdlrInt, 0 },
+	{ "ipv4.enable", eCmdHdlrBinary, 0 },
+	{ "ipv6.bits", eCmdHdlrInt, 0 },
+	{ "ipv6.enable", eCmdHdlrBinary, 0 },
+	{ "ipv6.anonmode", eCmdHdlrGetWord, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -140,6 +163,7 @@ ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	free(pWrkrData->outbuf);
 ENDfreeWrkrInstance
 
 
@@ -149,6 +173,10 @@ setInstParamDefaults(instanceData *pData)
 	pData->mode = REWRITE_MODE;
 	pData->replChar = 'x';
 	pData->ipv4.bits = 16;
+	pData->ipv4.bEnable = 1;
+	pData->ipv6.bits = 96;
+	pData->ipv6.bEnable = 1;
+	pData->ipv6.anonmode = IPV6_ZERO;
 }
 
 BEGINnewActInst
@@ -187,6 +215,32 @@ CODESTARTnewActInst
 			pData->replChar = es_getBufAddr(pvals[i].val.d.estr)[0];
 		} else if(!strcmp(actpblk.descr[i].name, "ipv4.bits")) {
 			pData->ipv4.bits = (int8_t) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "ipv4.enable")) {
+			pData->ipv4.bEnable = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "ipv6.bits")) {
+			if(pvals[i].val.d.n < 1 || pvals[i].val.d.n > 128) {
+				errmsg.LogError(0, RS_RET_INVLD_ANON_BITS,
+					"mmanon: invalid number of ipv6 bits %d, "
+					"must be 1..128 - ignored", (int) pvals[i].val.d.n);
+			} else {
+				pData->ipv6.bits = (uint8_t) pvals[i].val.d.n;
+			}
+		} else if(!strcmp(actpblk.descr[i].name, "ipv6.enable")) {
+			pData->ipv6.bEnable = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "ipv6.anonmode")) {
+			if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"zero",
+					 sizeof("zero")-1)) {
+				pData->ipv6.anonmode = IPV6_ZERO;
+			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"truncate",
+					 sizeof("truncate")-1)) {
+				pData->ipv6.anonmode = IPV6_TRUNCATE;
+			} else {
+				char *cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+				errmsg.LogError(0, RS_RET_INVLD_MODE,
+					"mmanon: invalid ipv6 anonymization mode '%s' - ignored",
+					cstr);
+				free(cstr);
+			}
 		} else {
 			dbgprintf("mmanon: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
@@ -213,6 +267,18 @@ CODESTARTnewActInst
 				"mmanon: invalid number of ipv4 bits "
 				"in simple mode, corrected to %d",
 				pData->ipv4.bits);
+		if(pData->ipv6.bits % 16 != 0) {
+			pData->ipv6.bits = (pData->ipv6.bits / 16 + 1) * 16;
+			errmsg.LogError(0, RS_RET_INVLD_ANON_BITS,
+				"mmanon: invalid number of ipv6 bits "
+				"in simple mode, corrected to %d",
+				pData->ipv6.bits);
+		}
+		if(pData->ipv6.anonmode != IPV6_ZERO) {
+			errmsg.LogError(0, RS_RET_REPLCHAR_IGNORED,
+				"mmanon: ipv6.anonmode parameter is ignored "
+				"in simple mode");
+		}
 	} else { /* REWRITE_MODE */
 		if(pData->ipv4.bits < 1 || pData->ipv4.bits > 32) {
 			pData->ipv4.bits = 32;
@@ -243,86 +309,201 @@ CODESTARTtryResume
 ENDtryResume
 
 
-static int
-getnum(uchar *msg, int lenMsg, int *idx)
+/* The candidate scan looks at eight bytes at a time and checks if any of
+ * them is in the range '0'..':', that is a digit or a colon. Every IPv4
+ * address starts with a digit and every IPv6 address contains a colon
+ * (or a digit) within its first five characters, so everything else can
+ * be skipped without looking at the individual bytes. See
+ * http://graphics.stanford.edu/~seander/bithacks.html#HasBetweenInWord
+ * False positives are sorted out by the byte-wise loop.
+ */
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_HIGH 0x8080808080808080ULL
+#define SWAR_HASBETWEEN(x, m, n) \
+	((((SWAR_ONES*(127+(n))) - ((x) & (SWAR_ONES*127))) & ~(x) & \
+	  (((x) & (SWAR_ONES*127)) + (SWAR_ONES*(127-(m))))) & SWAR_HIGH)
+
+/* find the next character in the range '0'..hi, where hi is ':' while
+ * IPv6 addresses are searched for and '9' otherwise
+ */
+static inline int
+findCandidate(const uchar *msg, int lenMsg, int i, const uchar hi)
 {
-	int num = 0;
-	int i = *idx;
+	uint64_t v;
 
-	while(i < lenMsg && msg[i] >= '0' && msg[i] <= '9') {
-		num = num * 10 + msg[i] - '0';
-		++i;
+	while(i + 8 <= lenMsg) {
+		memcpy(&v, msg + i, sizeof(v));
+		if(SWAR_HASBETWEEN(v, '0' - 1, hi + 1))
+			break;
+		i += 8;
 	}
+	while(i < lenMsg && !(msg[i] >= '0' && msg[i] <= hi))
+		++i;
+	return i;
+}
 
-	*idx = i;
-	return num;
+static inline int
+hexval(uchar c)
+{
+	if(c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20; /* lower case */
+	if(c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
 }
 
 
-/* write an IP address octet to the output position */
-static int
-writeOctet(uchar *msg, int idx, int *nxtidx, uint8_t octet)
+/* return the offset of the next c at or after i, lenMsg if there is none.
+ * Every IPv6 address has a colon within its first five characters and
+ * every IPv4 address a dot within its first four, so with the offsets
+ * of the next colon and dot at hand, most candidates can be rejected
+ * without looking at them any further. memchr() is vectorized in all
+ * relevant libcs.
+ */
+static inline int
+nextChar(const uchar *msg, int lenMsg, int i, uchar c)
+{
+	const uchar *p = memchr(msg + i, c, lenMsg - i);
+	return (p == NULL) ? lenMsg : (int) (p - msg);
+}
+
+
+/* make sure the output buffer can hold lenAdd more bytes */
+static rsRetVal
+outbufReserve(wrkrInstanceData_t *pWrkrData, int lenAdd)
+{
+	uchar *newbuf;
+	int newsize;
+	DEFiRet;
+
+	if(pWrkrData->lenOut + lenAdd <= pWrkrData->sizeOutbuf)
+		FINALIZE;
+	newsize = (pWrkrData->sizeOutbuf == 0) ? 1024 : pWrkrData->sizeOutbuf;
+	while(newsize < pWrkrData->lenOut + lenAdd)
+		newsize *= 2;
+	CHKmalloc(newbuf = realloc(pWrkrData->outbuf, newsize));
+	pWrkrData->outbuf = newbuf;
+	pWrkrData->sizeOutbuf = newsize;
+finalize_it:
+	RETiRet;
+}
+
+
+/* replace msg[start, end) by repl. As long as the message does not grow,
+ * this is done in place: all data is moved to the front by the amount the
+ * message shrunk so far. Only if it grows, the message is assembled in the
+ * worker's output buffer instead.
+ */
+static rsRetVal
+replaceAddr(wrkrInstanceData_t *pWrkrData, uchar *msg, int start, int end,
+	    const uchar *repl, int lenRepl)
+{
+	const int lenCopy = start - pWrkrData->iCopied;
+	DEFiRet;
+
+	if(!pWrkrData->bUseOutbuf) {
+		if(pWrkrData->iWrite + lenCopy + lenRepl <= end) {
+			if(pWrkrData->iWrite != pWrkrData->iCopied)
+				memmove(msg + pWrkrData->iWrite, msg + pWrkrData->iCopied, lenCopy);
+			pWrkrData->iWrite += lenCopy;
+			memcpy(msg + pWrkrData->iWrite, repl, lenRepl);
+			pWrkrData->iWrite += lenRepl;
+			pWrkrData->iCopied = end;
+			FINALIZE;
+		}
+		/* we grow, so continue in the output buffer */
+		pWrkrData->lenOut = 0;
+		CHKiRet(outbufReserve(pWrkrData, pWrkrData->iWrite));
+		memcpy(pWrkrData->outbuf, msg, pWrkrData->iWrite);
+		pWrkrData->lenOut = pWrkrData->iWrite;
+		pWrkrData->bUseOutbuf = 1;
+	}
+	CHKiRet(outbufReserve(pWrkrData, lenCopy + lenRepl));
+	memcpy(pWrkrData->outbuf + pWrkrData->lenOut, msg + pWrkrData->iCopied, lenCopy);
+	pWrkrData->lenOut += lenCopy;
+	memcpy(pWrkrData->outbuf + pWrkrData->lenOut, repl, lenRepl);
+	pWrkrData->lenOut += lenRepl;
+	pWrkrData->iCopied = end;
+finalize_it:
+	RETiRet;
+}
+
+
+/* write an IP address octet to the output buffer, returns new index */
+static inline int
+writeOctet(uchar *buf, int idx, uint8_t octet)
 {
 	if(octet > 99) {
-		msg[idx++] = '0' + octet / 100;
+		buf[idx++] = '0' + octet / 100;
 		octet = octet % 100;
-	}
-	if(octet > 9) {
-		msg[idx++] = '0' + octet / 10;
+		buf[idx++] = '0' + octet / 10;
+		octet = octet % 10;
+	} else if(octet > 9) {
+		buf[idx++] = '0' + octet / 10;
 		octet = octet % 10;
 	}
-	msg[idx++] =  '0' + octet;
+	buf[idx++] =  '0' + octet;
+	return idx;
+}
+
 
-	if(nxtidx != NULL) {
-		if(idx + 1 != *nxtidx) {
-			/* we got shorter, fix it! */
-			msg[idx] = '.';
-			*nxtidx = idx + 1;
+/* try to parse an IPv4 address starting at msg[i]. On success, the
+ * address, the start of each octet and the end index are returned. On
+ * failure, *pEnd is the index to continue the search at.
+ */
+static int
+parseIPv4(const uchar *msg, int lenMsg, int i, uint32_t *pAddr, int ipstart[4], int *pEnd)
+{
+	uint32_t addr = 0;
+	int octet;
+	int ndigits;
+	int k;
+	int bOK = 0;
+
+	for(k = 0 ; k < 4 ; ++k) {
+		ipstart[k] = i;
+		octet = 0;
+		ndigits = 0;
+		while(i < lenMsg && msg[i] >= '0' && msg[i] <= '9') {
+			octet = octet * 10 + msg[i] - '0';
+			++i;
+			if(++ndigits > 3)
+				goto done;
+		}
+		if(ndigits == 0 || octet > 255)
+			goto done;
+		addr = (addr << 8) | octet;
+		if(k < 3) {
+			if(i >= lenMsg || msg[i] != '.')
+				goto done;
+			++i;
 		}
 	}
-	return idx;
+	bOK = 1;
+	*pAddr = addr;
+
+done:
+	/* skip the rest of an overlong number, so we do not start again in
+	 * the middle of it.
+	 */
+	while(!bOK && i < lenMsg && msg[i] >= '0' && msg[i] <= '9')
+		++i;
+	*pEnd = i;
+	return bOK;
 }
 
-/* currently works for IPv4 only! */
-void
-anonip(instanceData *pData, uchar *msg, int *pLenMsg, int *idx)
+
+static rsRetVal
+anonIPv4(wrkrInstanceData_t *pWrkrData, uchar *msg, int start, int end,
+	 uint32_t ipv4addr, int ipstart[4])
 {
-	int i = *idx;
-	int octet;
-	uint32_t ipv4addr;
-	int ipstart[4];
+	instanceData *const pData = pWrkrData->pData;
+	uchar buf[16];
+	int lenBuf;
 	int j;
-	int endpos;
-	int lenMsg = *pLenMsg;
+	DEFiRet;
 
-	while(i < lenMsg && (msg[i] <= '0' || msg[i] >= '9')) {
-		++i; /* skip to first number */
-	}
-	if(i >= lenMsg)
-		goto done;
-	
-	/* got digit, let's see if ip */
-	ipstart[0] = i;
-	octet = getnum(msg, lenMsg, &i);
-	if(octet > 255 || msg[i] != '.') goto done;
-	ipv4addr = octet << 24;
-	++i;
-	ipstart[1] = i;
-	octet = getnum(msg, lenMsg, &i);
-	if(octet > 255 || msg[i] != '.') goto done;
-	ipv4addr |= octet << 16;
-	++i;
-	ipstart[2] = i;
-	octet = getnum(msg, lenMsg, &i);
-	if(octet > 255 || msg[i] != '.') goto done;
-	ipv4addr |= octet << 8;
-	++i;
-	ipstart[3] = i;
-	octet = getnum(msg, lenMsg, &i);
-	if(octet > 255) goto done;
-	ipv4addr |= octet;
-
-	/* OK, we now found an ip address */
 	if(pData->mode == SIMPLE_MODE) {
 		if(pData->ipv4.bits == 8)
 			j = ipstart[3];
@@ -332,32 +513,186 @@ anonip(instanceData *pData, uchar *msg, int *pLenMsg, int *idx)
 			j = ipstart[1];
 		else /* due to our checks, this *must* be 32 */
 			j = ipstart[0];
-		while(j < i) {
+		for( ; j < end ; ++j) {
 			if(msg[j] != '.')
 				msg[j] = pData->replChar;
-			++j;
 		}
 	} else { /* REWRITE_MODE */
 		ipv4addr &= ipv4masks[pData->ipv4.bits];
-		if(pData->ipv4.bits > 24)
-			writeOctet(msg, ipstart[0], &(ipstart[1]), ipv4addr >> 24);
-		if(pData->ipv4.bits > 16)
-			writeOctet(msg, ipstart[1], &(ipstart[2]), (ipv4addr >> 16) & 0xff);
-		if(pData->ipv4.bits > 8)
-			writeOctet(msg, ipstart[2], &(ipstart[3]), (ipv4addr >> 8) & 0xff);
-		endpos = writeOctet(msg, ipstart[3], NULL, ipv4addr & 0xff);
-		/* if we had truncation, we need to shrink the msg */
-		dbgprintf("existing i %d, endpos %d\n", i, endpos);
-		if(i - endpos > 0) {
-			*pLenMsg = lenMsg - (i - endpos);
-			memmove(msg+endpos, msg+i, lenMsg - i + 1);
-			/* correct index for next search! */
-			i -= (i - endpos);
+		lenBuf = writeOctet(buf, 0, ipv4addr >> 24);
+		buf[lenBuf++] = '.';
+		lenBuf = writeOctet(buf, lenBuf, (ipv4addr >> 16) & 0xff);
+		buf[lenBuf++] = '.';
+		lenBuf = writeOctet(buf, lenBuf, (ipv4addr >> 8) & 0xff);
+		buf[lenBuf++] = '.';
+		lenBuf = writeOctet(buf, lenBuf, ipv4addr & 0xff);
+		CHKiRet(replaceAddr(pWrkrData, msg, start, end, buf, lenBuf));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* try to parse an IPv6 address starting at msg[i]. The eight groups are
+ * returned in grp[]; grpstart[] holds the offset of each group in msg,
+ * or -1 if the group was part of a "::" and is not present in the text.
+ * Embedded IPv4 addresses (::ffff:1.2.3.4) are not recognized, their
+ * IPv4 part is handled by the IPv4 scanner.
+ */
+static int
+parseIPv6(const uchar *msg, int lenMsg, int i, uint16_t grp[8], int grpstart[8], int *pEnd)
+{
+	uint16_t tmpgrp[8];
+	int tmpstart[8];
+	int ngrp = 0;
+	int dblcolon = -1;
+	int val, digit, ndigits;
+	int k;
+
+	if(msg[i] == ':') {
+		if(i + 1 >= lenMsg || msg[i+1] != ':')
+			return 0;
+		dblcolon = 0;
+		i += 2;
+	}
+
+	while(ngrp < 8) {
+		tmpstart[ngrp] = i;
+		val = 0;
+		for(ndigits = 0 ; i < lenMsg && (digit = hexval(msg[i])) != -1 ; ++ndigits, ++i) {
+			if(ndigits == 4)
+				return 0;
+			val = (val << 4) | digit;
+		}
+		if(ndigits == 0) { /* can only happen after "::" */
+			if(ngrp == 0)
+				return 0; /* a bare "::" is not worth it */
+			break;
+		}
+		if(i < lenMsg && msg[i] == '.')
+			return 0; /* embedded IPv4 or something else */
+		tmpgrp[ngrp++] = val;
+		if(i + 1 >= lenMsg || msg[i] != ':')
+			break;
+		if(msg[i+1] == ':') {
+			if(dblcolon != -1)
+				return 0;
+			dblcolon = ngrp;
+			i += 2;
+		} else if(hexval(msg[i+1]) != -1) {
+			++i;
+		} else {
+			break; /* colon is not part of the address */
+		}
+	}
+
+	if(dblcolon == -1 ? ngrp != 8 : ngrp > 7)
+		return 0;
+	if(i < lenMsg && (isalnum(msg[i]) || (msg[i] == ':'
+	   && i + 1 < lenMsg && (msg[i+1] == ':' || hexval(msg[i+1]) != -1))))
+		return 0;
+
+	if(dblcolon == -1) {
+		memcpy(grp, tmpgrp, sizeof(tmpgrp));
+		memcpy(grpstart, tmpstart, sizeof(tmpstart));
+	} else {
+		for(k = 0 ; k < dblcolon ; ++k) {
+			grp[k] = tmpgrp[k];
+			grpstart[k] = tmpstart[k];
+		}
+		for( ; k < 8 - (ngrp - dblcolon) ; ++k) {
+			grp[k] = 0;
+			grpstart[k] = -1;
+		}
+		for( ; k < 8 ; ++k) {
+			grp[k] = tmpgrp[k - 8 + ngrp];
+			grpstart[k] = tmpstart[k - 8 + ngrp];
+		}
+	}
+	*pEnd = i;
+	return 1;
+}
+
+
+/* format an IPv6 address in the recommended text representation
+ * (RFC 5952): lowercase, no leading zeros, longest run of two or more
+ * zero groups replaced by "::". Returns the length written.
+ */
+static int
+fmtIPv6(uchar *buf, const uint16_t grp[8])
+{
+	static const char hexdigits[] = "0123456789abcdef";
+	int bestStart = -1, bestLen = 1;
+	int runStart, k, shift;
+	int len = 0;
+
+	for(k = 0 ; k < 8 ; ) {
+		if(grp[k] != 0) {
+			++k;
+			continue;
+		}
+		for(runStart = k ; k < 8 && grp[k] == 0 ; ++k)
+			;
+		if(k - runStart > bestLen) {
+			bestStart = runStart;
+			bestLen = k - runStart;
+		}
+	}
+
+	for(k = 0 ; k < 8 ; ++k) {
+		if(k == bestStart) {
+			buf[len++] = ':';
+			buf[len++] = ':';
+			k += bestLen - 1;
+			continue;
+		}
+		if(k > 0 && k != bestStart + bestLen)
+			buf[len++] = ':';
+		for(shift = 12 ; shift > 0 && (grp[k] >> shift) == 0 ; shift -= 4)
+			;
+		for( ; shift >= 0 ; shift -= 4)
+			buf[len++] = hexdigits[(grp[k] >> shift) & 0xf];
+	}
+	return len;
+}
+
+
+static rsRetVal
+anonIPv6(wrkrInstanceData_t *pWrkrData, uchar *msg, int start, int end,
+	 uint16_t grp[8], int grpstart[8])
+{
+	instanceData *const pData = pWrkrData->pData;
+	const int bits = pData->ipv6.bits;
+	uchar buf[48]; /* max "ffff:...:ffff/128" */
+	int lenBuf;
+	int keep; /* number of groups not touched at all */
+	int j, k;
+	DEFiRet;
+
+	if(pData->mode == SIMPLE_MODE) {
+		for(k = 8 - bits / 16 ; k < 8 ; ++k) {
+			if(grpstart[k] == -1)
+				continue;
+			for(j = grpstart[k] ; j < end && hexval(msg[j]) != -1 ; ++j)
+				msg[j] = pData->replChar;
+		}
+	} else { /* REWRITE_MODE */
+		keep = (128 - bits) / 16;
+		if(keep < 8) {
+			grp[keep] &= (uint16_t) (0xffffu << (16 - (128 - bits) % 16));
+			for(k = keep + 1 ; k < 8 ; ++k)
+				grp[k] = 0;
+		}
+		lenBuf = fmtIPv6(buf, grp);
+		if(pData->ipv6.anonmode == IPV6_TRUNCATE) {
+			lenBuf += snprintf((char*)buf + lenBuf, sizeof(buf) - lenBuf, "/%d", 128 - bits);
 		}
+		CHKiRet(replaceAddr(pWrkrData, msg, start, end, buf, lenBuf));
 	}
 
-done:	*idx = i;
-	return;
+finalize_it:
+	RETiRet;
 }
 
 
@@ -365,16 +700,91 @@ BEGINdoAction
 	msg_t *pMsg;
 	uchar *msg;
 	int lenMsg;
-	int i;
+	int i, start, end;
+	int lowBound; /* IPv6 start positions below this were already tried */
+	int nextColon, nextDot;
+	sbool bScan6;	/* still looking for IPv6 addresses? */
+	uchar hi;	/* upper bound of candidate chars, see findCandidate() */
+	uint32_t ipv4addr;
+	int ipstart[4];
+	uint16_t grp[8];
+	int grpstart[8];
+	instanceData *pData;
 CODESTARTdoAction
+	pData = pWrkrData->pData;
 	pMsg = (msg_t*) ppString[0];
 	lenMsg = getMSGLen(pMsg);
-	msg = getMSG(pMsg);
-	for(i = 0 ; i < lenMsg ; ++i) {
-		anonip(pWrkrData->pData, msg, &lenMsg, &i);
+	msg = getMSGForWrite(pMsg);
+	pWrkrData->bUseOutbuf = 0;
+	pWrkrData->iWrite = 0;
+	pWrkrData->iCopied = 0;
+	lowBound = 0;
+	nextDot = -1;
+	/* without a colon, there is no IPv6 address, and the IPv4 scan does
+	 * not need to look at colons and hex letters at all
+	 */
+	nextColon = pData->ipv6.bEnable ? nextChar(msg, lenMsg, 0, ':') : lenMsg;
+	bScan6 = (nextColon < lenMsg);
+	hi = bScan6 ? ':' : '9';
+
+	i = findCandidate(msg, lenMsg, 0, hi);
+	while(i < lenMsg) {
+		if(bScan6 && nextColon < i) {
+			nextColon = nextChar(msg, lenMsg, i, ':');
+			if(nextColon == lenMsg) {
+				bScan6 = 0;
+				hi = '9';
+			}
+		}
+		if(bScan6 && nextColon - i <= 4) {
+			/* the address may start with up to four hex letters */
+			start = i;
+			while(start > lowBound && i - start < 4 && hexval(msg[start-1]) != -1)
+				--start;
+			if(   nextColon - start <= 4
+			   && (start == 0 || !(isalnum(msg[start-1]) || msg[start-1] == ':'))
+			   && parseIPv6(msg, lenMsg, start, grp, grpstart, &end)) {
+				CHKiRet(anonIPv6(pWrkrData, msg, start, end, grp, grpstart));
+				i = lowBound = end;
+				i = findCandidate(msg, lenMsg, i, hi);
+				continue;
+			}
+		}
+		if(msg[i] == ':') {
+			++i;
+		} else {
+			if(nextDot < i)
+				nextDot = nextChar(msg, lenMsg, i, '.');
+			if(!bScan6 && (!pData->ipv4.bEnable || nextDot == lenMsg))
+				break; /* nothing left that could be anonymized */
+			if(pData->ipv4.bEnable && nextDot - i <= 3) {
+				if(parseIPv4(msg, lenMsg, i, &ipv4addr, ipstart, &end)) {
+					CHKiRet(anonIPv4(pWrkrData, msg, i, end, ipv4addr, ipstart));
+				}
+				i = end;
+			} else {
+				/* skip the rest of this number */
+				while(i < lenMsg && msg[i] >= '0' && msg[i] <= '9')
+					++i;
+			}
+		}
+		lowBound = i;
+		i = findCandidate(msg, lenMsg, i, hi);
+	}
+
+	if(pWrkrData->bUseOutbuf) {
+		CHKiRet(outbufReserve(pWrkrData, lenMsg - pWrkrData->iCopied));
+		memcpy(pWrkrData->outbuf + pWrkrData->lenOut, msg + pWrkrData->iCopied,
+		       lenMsg - pWrkrData->iCopied);
+		pWrkrData->lenOut += lenMsg - pWrkrData->iCopied;
+		CHKiRet(MsgReplaceMSG(pMsg, pWrkrData->outbuf, pWrkrData->lenOut));
+	} else if(pWrkrData->iWrite != pWrkrData->iCopied) {
+		/* we shrunk, move the rest of the message including the '\0' */
+		memmove(msg + pWrkrData->iWrite, msg + pWrkrData->iCopied,
+			lenMsg - pWrkrData->iCopied + 1);
+		setMSGLen(pMsg, pWrkrData->iWrite + lenMsg - pWrkrData->iCopied);
 	}
-	if(lenMsg != getMSGLen(pMsg))
-		setMSGLen(pMsg, lenMsg);
+finalize_it:
 ENDdoAction
 
 
@@ -1,6 +1,12 @@
 /* mmcount.c
  * count messages by priority or json property of given app-name.
  *
+ * The counts can either be added to each message (the original mode of
+ * operation), or be aggregated and emitted as statsobj counters or as
+ * periodic summary messages. In the latter case, each worker counts
+ * locally and merges its counts into the instance totals every
+ * "interval" seconds, so that the workers do not contend on a mutex.
+ *
  * Copyright 2013 Red Hat Inc.
  *
  * This file is part of rsyslog.
@@ -30,6 +36,8 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <time.h>
+#include <pthread.h>
 #include <json.h>
 #include "conf.h"
 #include "syslogd-types.h"
@@ -38,9 +46,23 @@
 #include "module-template.h"
 #include "errmsg.h"
 #include "hashtable.h"
+#include "hashtable_itr.h"
+#include "statsobj.h"
+#include "glbl.h"
+#include "prop.h"
+#include "msg.h"
+#include "dirty.h"
+#include "unicode-helper.h"
 
 #define JSON_COUNT_NAME "!mmcount"
 #define SEVERITY_COUNT 8
+#define SUMMARY_FACILITY 5 /* syslog */
+#define SUMMARY_SEVERITY 6 /* info */
+
+/* where do the counts go to? */
+#define OUTPUT_MSG 0		/* running count into each message (default) */
+#define OUTPUT_STATS 1		/* statsobj counters */
+#define OUTPUT_SUMMARY 2	/* periodic summary messages */
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -48,24 +70,64 @@ MODULE_CNFNAME("mmcount")
 
 
 DEFobjCurrIf(errmsg);
+DEFobjCurrIf(statsobj);
+DEFobjCurrIf(glbl);
+DEFobjCurrIf(prop);
 DEF_OMOD_STATIC_DATA
 
+static const char *severityNames[SEVERITY_COUNT] = {
+	"emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"
+};
+
+/* an aggregated counter for one value of the key */
+typedef struct valueCtr_s {
+	intctr_t ctr;
+	char *name;
+} valueCtr_t;
+
 /* config variables */
 
 typedef struct _instanceData {
 	char *pszAppName;
 	int severity[SEVERITY_COUNT];
 	char *pszKey;
+	msgPropDescr_t *pKeyProp;	/* pszKey, resolved to a json property */
 	char *pszValue;
 	int valueCounter;
 	struct hashtable *ht;
 	pthread_mutex_t mut;
+	/* aggregated counts, only used if output is not OUTPUT_MSG. They are
+	 * updated under mut when a worker merges its local counts.
+	 */
+	int8_t output;
+	int iInterval;			/* merge (and summary) interval in seconds */
+	intctr_t sevTotals[SEVERITY_COUNT];
+	intctr_t valueTotal;
+	struct hashtable *htTotals;	/* value -> valueCtr_t, if no value given */
+	statsobj_t *stats;
+	time_t tLastSummary;
+	struct _instanceData *next;	/* list of instances with summary output */
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	/* local counts, merged into the instance every iInterval seconds */
+	int severity[SEVERITY_COUNT];
+	int valueCounter;
+	struct hashtable *ht;		/* value -> int */
+	int nPending;			/* messages counted since last merge */
+	time_t tLastMerge;
 } wrkrInstanceData_t;
 
+/* instances with summary output plus the thread that emits the summaries */
+static instanceData *pInstRoot = NULL;
+static pthread_mutex_t mutInstList = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t condSummary = PTHREAD_COND_INITIALIZER;
+static pthread_t summaryTid;
+static sbool bSummaryRunning = 0;
+static sbool bSummaryTerm = 0;
+static prop_t *pInputName = NULL;
+
 struct modConfData_s {
 	rsconf_t *pConf;	/* our overall config object */
 };
@@ -79,6 +141,8 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "appname", eCmdHdlrGetWord, 0 },
 	{ "key", eCmdHdlrGetWord, 0 },
 	{ "value", eCmdHdlrGetWord, 0 },
+	{ "output", eCmdHdlrGetWord, 0 },
+	{ "interval", eCmdHdlrPositiveInt, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -110,6 +174,9 @@ CODESTARTfreeCnf
 ENDfreeCnf
 
 
+static void mergeCounts(wrkrInstanceData_t *pWrkrData);
+static void unregisterInstance(instanceData *pData);
+
 BEGINcreateInstance
 CODESTARTcreateInstance
 	pthread_mutex_init(&pData->mut, NULL);
@@ -117,6 +184,7 @@ ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->tLastMerge = time(NULL);
 ENDcreateWrkrInstance
 
 
@@ -127,11 +195,31 @@ ENDisCompatibleWithFeature
 
 BEGINfreeInstance
 CODESTARTfreeInstance
+	if(pData->output == OUTPUT_SUMMARY)
+		unregisterInstance(pData);
+	if(pData->stats != NULL)
+		statsobj.Destruct(&pData->stats);
+	if(pData->htTotals != NULL)
+		hashtable_destroy(pData->htTotals, 1); /* 1 => free all values automatically */
+	if(pData->ht != NULL)
+		hashtable_destroy(pData->ht, 1);
+	free(pData->pszAppName);
+	free(pData->pszKey);
+	if(pData->pKeyProp != NULL) {
+		msgPropDescrDestruct(pData->pKeyProp);
+		free(pData->pKeyProp);
+	}
+	free(pData->pszValue);
+	pthread_mutex_destroy(&pData->mut);
 ENDfreeInstance
 
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	if(pWrkrData->nPending > 0)
+		mergeCounts(pWrkrData);
+	if(pWrkrData->ht != NULL)
+		hashtable_destroy(pWrkrData->ht, 1);
 ENDfreeWrkrInstance
 
 static inline void
@@ -143,9 +231,14 @@ setInstParamDefaults(instanceData *pData)
 	for (i = 0; i < SEVERITY_COUNT; i++)
 	        pData->severity[i] = 0;
 	pData->pszKey = NULL;
+	pData->pKeyProp = NULL;
 	pData->pszValue = NULL;
 	pData->valueCounter = 0;
 	pData->ht = NULL;
+	pData->output = OUTPUT_MSG;
+	pData->iInterval = 10;
+	pData->htTotals = NULL;
+	pData->stats = NULL;
 }
 
 static unsigned int
@@ -160,6 +253,111 @@ key_equals_fn(void *k1, void *k2)
 	return (*(unsigned int *)k1 == *(unsigned int *)k2);
 }
 
+
+/* the summary thread. It wakes up once a second and emits a summary
+ * message for each instance whose interval has expired.
+ */
+static void emitSummary(instanceData *pData);
+static void *
+summaryThread(void __attribute__((unused)) *arg)
+{
+	instanceData *pData;
+	struct timespec t;
+	time_t tNow;
+
+	pthread_mutex_lock(&mutInstList);
+	while(!bSummaryTerm) {
+		timeoutComp(&t, 1000);
+		pthread_cond_timedwait(&condSummary, &mutInstList, &t);
+		if(bSummaryTerm)
+			break;
+		tNow = time(NULL);
+		for(pData = pInstRoot ; pData != NULL ; pData = pData->next) {
+			if(tNow - pData->tLastSummary >= pData->iInterval) {
+				emitSummary(pData);
+				pData->tLastSummary = tNow;
+			}
+		}
+	}
+	pthread_mutex_unlock(&mutInstList);
+	return NULL;
+}
+
+
+/* add an instance to the summary list and start the thread, if needed */
+static rsRetVal
+registerInstance(instanceData *pData)
+{
+	int r;
+	DEFiRet;
+
+	pthread_mutex_lock(&mutInstList);
+	pData->tLastSummary = time(NULL);
+	pData->next = pInstRoot;
+	pInstRoot = pData;
+	if(!bSummaryRunning) {
+		r = pthread_create(&summaryTid, NULL, summaryThread, NULL);
+		if(r != 0) {
+			errmsg.LogError(r, RS_RET_ERR, "mmcount: cannot start summary thread, "
+					"no summary messages will be emitted");
+		} else {
+			bSummaryRunning = 1;
+		}
+	}
+	pthread_mutex_unlock(&mutInstList);
+	RETiRet;
+}
+
+
+static void
+unregisterInstance(instanceData *pData)
+{
+	instanceData **ppPrev;
+
+	pthread_mutex_lock(&mutInstList);
+	for(ppPrev = &pInstRoot ; *ppPrev != NULL ; ppPrev = &(*ppPrev)->next) {
+		if(*ppPrev == pData) {
+			*ppPrev = pData->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mutInstList);
+}
+
+
+/* create the statsobj for an instance with stats output. Counters for
+ * the individual values of a key are added when a value is first seen.
+ */
+static rsRetVal
+createStats(instanceData *pData)
+{
+	uchar statsName[256];
+	int i;
+	DEFiRet;
+
+	CHKiRet(statsobj.Construct(&pData->stats));
+	if(pData->pszKey == NULL) {
+		snprintf((char*)statsName, sizeof(statsName), "mmcount(%s)", pData->pszAppName);
+	} else {
+		snprintf((char*)statsName, sizeof(statsName), "mmcount(%s,%s)",
+			 pData->pszAppName, pData->pszKey);
+	}
+	CHKiRet(statsobj.SetName(pData->stats, statsName));
+	if(pData->pszKey == NULL) {
+		for(i = 0 ; i < SEVERITY_COUNT ; ++i) {
+			CHKiRet(statsobj.AddCounter(pData->stats, (uchar*)severityNames[i],
+				ctrType_IntCtr, CTR_FLAG_NONE, &pData->sevTotals[i]));
+		}
+	} else if(pData->pszValue != NULL) {
+		CHKiRet(statsobj.AddCounter(pData->stats, (uchar*)pData->pszValue,
+			ctrType_IntCtr, CTR_FLAG_NONE, &pData->valueTotal));
+	}
+	CHKiRet(statsobj.ConstructFinalize(pData->stats));
+
+finalize_it:
+	RETiRet;
+}
+
 BEGINnewActInst
 	struct cnfparamvals *pvals;
 	int i;
@@ -189,6 +387,29 @@ CODESTARTnewActInst
 			pData->pszValue = es_str2cstr(pvals[i].val.d.estr, NULL);
 			continue;
 		}
+		if(!strcmp(actpblk.descr[i].name, "output")) {
+			if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"message",
+					 sizeof("message")-1)) {
+				pData->output = OUTPUT_MSG;
+			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"stats",
+					 sizeof("stats")-1)) {
+				pData->output = OUTPUT_STATS;
+			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"summary",
+					 sizeof("summary")-1)) {
+				pData->output = OUTPUT_SUMMARY;
+			} else {
+				char *cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+				errmsg.LogError(0, RS_RET_INVLD_MODE,
+					"mmcount: invalid output '%s' - using 'message'",
+					cstr);
+				free(cstr);
+			}
+			continue;
+		}
+		if(!strcmp(actpblk.descr[i].name, "interval")) {
+			pData->iInterval = (int) pvals[i].val.d.n;
+			continue;
+		}
 		dbgprintf("mmcount: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
 	}
@@ -198,10 +419,43 @@ CODESTARTnewActInst
 		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
 	}
 
-	if(pData->pszKey != NULL && pData->pszValue == NULL) {
-		if(NULL == (pData->ht = create_hashtable(100, hash_from_key_fn, key_equals_fn, NULL))) {
-			DBGPRINTF("mmcount: error creating hash table!\n");
-			ABORT_FINALIZE(RS_RET_ERR);
+	if(pData->pszKey != NULL) {
+		/* the key has always been a json property; accept it with and
+		 * without the leading "!" */
+		uchar keyName[1024];
+		if(pData->pszKey[0] == '!' || pData->pszKey[0] == '$')
+			snprintf((char*)keyName, sizeof(keyName), "%s", pData->pszKey);
+		else
+			snprintf((char*)keyName, sizeof(keyName), "!%s", pData->pszKey);
+		CHKmalloc(pData->pKeyProp = calloc(1, sizeof(msgPropDescr_t)));
+		if(msgPropDescrFill(pData->pKeyProp, keyName, ustrlen(keyName)) != RS_RET_OK) {
+			free(pData->pKeyProp);
+			pData->pKeyProp = NULL;
+			errmsg.LogError(0, RS_RET_INVALID_PARAMS, "mmcount: invalid key '%s'",
+					pData->pszKey);
+			ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+		}
+	}
+
+	if(pData->output == OUTPUT_MSG) {
+		if(pData->pszKey != NULL && pData->pszValue == NULL) {
+			if(NULL == (pData->ht = create_hashtable(100, hash_from_key_fn, key_equals_fn, NULL))) {
+				DBGPRINTF("mmcount: error creating hash table!\n");
+				ABORT_FINALIZE(RS_RET_ERR);
+			}
+		}
+	} else {
+		if(pData->pszKey != NULL && pData->pszValue == NULL) {
+			if(NULL == (pData->htTotals = create_hashtable(100, hash_from_string,
+								      key_equals_string, NULL))) {
+				DBGPRINTF("mmcount: error creating hash table!\n");
+				ABORT_FINALIZE(RS_RET_ERR);
+			}
+		}
+		if(pData->output == OUTPUT_STATS) {
+			CHKiRet(createStats(pData));
+		} else {
+			CHKiRet(registerInstance(pData));
 		}
 	}
 CODE_STD_FINALIZERnewActInst
@@ -256,44 +510,51 @@ getCounter(struct hashtable *ht, char *str) {
 	return pCounter;
 }
 
-BEGINdoAction
-	msg_t *pMsg;
-	char *appname;
-	struct json_object *json = NULL;
-	es_str_t *estr = NULL;
+/* get the value of the key property from the message */
+static rsRetVal
+getKeyValue(instanceData *pData, msg_t *pMsg, char **ppszValue)
+{
 	struct json_object *keyjson = NULL;
-	char *pszValue;
-	int *pCounter;
-	instanceData *const pData = pWrkrData->pData;
-CODESTARTdoAction
-	pMsg = (msg_t*) ppString[0];
-	appname = getAPPNAME(pMsg, LOCK_MUTEX);
+	DEFiRet;
 
-	pthread_mutex_lock(&pData->mut);
-	if(0 != strcmp(appname, pData->pszAppName)) {
-		/* we are not working for this appname. nothing to do */
-		ABORT_FINALIZE(RS_RET_OK);
+	if(msgGetJSONPropJSON(pMsg, pData->pKeyProp, &keyjson) != RS_RET_OK) {
+		/* key not found in the message. nothing to do */
+		ABORT_FINALIZE(RS_RET_NOT_FOUND);
 	}
+	if((*ppszValue = (char*)json_object_get_string(keyjson)) == NULL)
+		ABORT_FINALIZE(RS_RET_NOT_FOUND);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* count the message in the instance and return the running count as
+ * json, which is to be added to the message (OUTPUT_MSG).
+ */
+static struct json_object *
+countInMsg(instanceData *pData, msg_t *pMsg)
+{
+	struct json_object *json = NULL;
+	char *pszValue;
+	int *pCounter;
 
 	if(!pData->pszKey) {
 		/* no key given for count, so we count severity */
-		if(pMsg->iSeverity <= SEVERITY_COUNT) {
+		if(pMsg->iSeverity < SEVERITY_COUNT) {
+			pthread_mutex_lock(&pData->mut);
 			pData->severity[pMsg->iSeverity]++;
 			json = json_object_new_int(pData->severity[pMsg->iSeverity]);
+			pthread_mutex_unlock(&pData->mut);
 		}
-		ABORT_FINALIZE(RS_RET_OK);
+		return json;
 	}
 
 	/* key is given, so get the property json */
-	estr = es_newStrFromBuf(pData->pszKey, strlen(pData->pszKey));
-	if(msgGetCEEPropJSON(pMsg, estr, &keyjson) != RS_RET_OK) {
-		/* key not found in the message. nothing to do */
-		ABORT_FINALIZE(RS_RET_OK);
-	}
-
-	/* key found, so get the value */
-	pszValue = (char*)json_object_get_string(keyjson);
+	if(getKeyValue(pData, pMsg, &pszValue) != RS_RET_OK)
+		return NULL;
 
+	pthread_mutex_lock(&pData->mut);
 	if(pData->pszValue) {
 		/* value also given for count */
 		if(!strcmp(pszValue, pData->pszValue)) {
@@ -301,24 +562,251 @@ CODESTARTdoAction
 			pData->valueCounter++;
 			json = json_object_new_int(pData->valueCounter);
 		}
-		ABORT_FINALIZE(RS_RET_OK);
+	} else {
+		/* value is not given, so we count for each value of given key */
+		pCounter = getCounter(pData->ht, pszValue);
+		if(pCounter) {
+			(*pCounter)++;
+			json = json_object_new_int(*pCounter);
+		}
 	}
+	pthread_mutex_unlock(&pData->mut);
+	return json;
+}
 
-	/* value is not given, so we count for each value of given key */
-	pCounter = getCounter(pData->ht, pszValue);
-	if(pCounter) {
-		(*pCounter)++;
-		json = json_object_new_int(*pCounter);
+
+/* get the worker-local counter for a value of the key */
+static int *
+getLocalCounter(wrkrInstanceData_t *pWrkrData, char *value)
+{
+	int *pCount;
+	char *pKey;
+
+	if(pWrkrData->ht == NULL) {
+		if(NULL == (pWrkrData->ht = create_hashtable(100, hash_from_string,
+							     key_equals_string, NULL))) {
+			DBGPRINTF("mmcount: error creating hash table!\n");
+			return NULL;
+		}
+	}
+	if((pCount = hashtable_search(pWrkrData->ht, value)) != NULL)
+		return pCount;
+
+	if(NULL == (pKey = strdup(value))) {
+		DBGPRINTF("mmcount: memory allocation for key failed\n");
+		return NULL;
+	}
+	if(NULL == (pCount = (int*)malloc(sizeof(int)))) {
+		DBGPRINTF("mmcount: memory allocation for value failed\n");
+		free(pKey);
+		return NULL;
+	}
+	*pCount = 0;
+	if(!hashtable_insert(pWrkrData->ht, pKey, pCount)) {
+		DBGPRINTF("mmcount: inserting element into hashtable failed\n");
+		free(pKey);
+		free(pCount);
+		return NULL;
+	}
+	return pCount;
+}
+
+
+/* count the message in the worker-local counters (OUTPUT_STATS and
+ * OUTPUT_SUMMARY). No locking needed.
+ */
+static void
+countLocal(wrkrInstanceData_t *pWrkrData, msg_t *pMsg)
+{
+	instanceData *const pData = pWrkrData->pData;
+	char *pszValue;
+	int *pCount;
+
+	if(!pData->pszKey) {
+		if(pMsg->iSeverity < SEVERITY_COUNT) {
+			pWrkrData->severity[pMsg->iSeverity]++;
+			pWrkrData->nPending++;
+		}
+		return;
+	}
+
+	if(getKeyValue(pData, pMsg, &pszValue) != RS_RET_OK)
+		return;
+
+	if(pData->pszValue) {
+		if(!strcmp(pszValue, pData->pszValue)) {
+			pWrkrData->valueCounter++;
+			pWrkrData->nPending++;
+		}
+	} else if((pCount = getLocalCounter(pWrkrData, pszValue)) != NULL) {
+		(*pCount)++;
+		pWrkrData->nPending++;
+	}
+}
+
+
+/* get the aggregated counter for a value of the key. If it does not yet
+ * exist, it is created and, with stats output, registered as counter.
+ * Must be called with pData->mut locked.
+ */
+static valueCtr_t *
+getTotalCtr(instanceData *pData, char *value)
+{
+	valueCtr_t *pCtr;
+	char *pKey;
+
+	if((pCtr = hashtable_search(pData->htTotals, value)) != NULL)
+		return pCtr;
+
+	if(NULL == (pKey = strdup(value))) {
+		DBGPRINTF("mmcount: memory allocation for key failed\n");
+		return NULL;
+	}
+	if(NULL == (pCtr = calloc(1, sizeof(valueCtr_t)))) {
+		DBGPRINTF("mmcount: memory allocation for value failed\n");
+		free(pKey);
+		return NULL;
+	}
+	pCtr->name = pKey; /* freed by the hashtable as key */
+	if(!hashtable_insert(pData->htTotals, pKey, pCtr)) {
+		DBGPRINTF("mmcount: inserting element into hashtable failed\n");
+		free(pKey);
+		free(pCtr);
+		return NULL;
+	}
+	if(pData->stats != NULL) {
+		statsobj.AddCounter(pData->stats, (uchar*)pCtr->name,
+			ctrType_IntCtr, CTR_FLAG_NONE, &pCtr->ctr);
+	}
+	return pCtr;
+}
+
+
+/* add the worker-local counts to the instance totals and reset them */
+static void
+mergeCounts(wrkrInstanceData_t *pWrkrData)
+{
+	instanceData *const pData = pWrkrData->pData;
+	struct hashtable_itr *itr;
+	valueCtr_t *pTotal;
+	int *pCount;
+	int i;
+
+	pthread_mutex_lock(&pData->mut);
+	for(i = 0 ; i < SEVERITY_COUNT ; ++i) {
+		pData->sevTotals[i] += pWrkrData->severity[i];
+		pWrkrData->severity[i] = 0;
+	}
+	pData->valueTotal += pWrkrData->valueCounter;
+	pWrkrData->valueCounter = 0;
+	/* Iterator constructor only returns a valid iterator if
+	 * the hashtable is not empty */
+	if(pWrkrData->ht != NULL && hashtable_count(pWrkrData->ht) > 0
+	   && (itr = hashtable_iterator(pWrkrData->ht)) != NULL) {
+		do {
+			pCount = (int*) hashtable_iterator_value(itr);
+			if(*pCount == 0)
+				continue;
+			pTotal = getTotalCtr(pData, (char*) hashtable_iterator_key(itr));
+			if(pTotal != NULL)
+				pTotal->ctr += *pCount;
+			*pCount = 0;
+		} while(hashtable_iterator_advance(itr));
+		free(itr);
 	}
-finalize_it:
 	pthread_mutex_unlock(&pData->mut);
-	if(estr) {
-		es_deleteStr(estr);
+	pWrkrData->nPending = 0;
+}
+
+
+/* emit a summary message with the current totals of an instance.
+ * The message text is JSON: {"appname": ..., "key": ..., "counts": {...}}
+ */
+static void
+emitSummary(instanceData *pData)
+{
+	struct json_object *json;
+	struct json_object *counts;
+	struct hashtable_itr *itr;
+	valueCtr_t *pCtr;
+	msg_t *pMsg;
+	int i;
+
+	if((json = json_object_new_object()) == NULL)
+		return;
+	if((counts = json_object_new_object()) == NULL)
+		goto finalize_it;
+	json_object_object_add(json, "appname", json_object_new_string(pData->pszAppName));
+	if(pData->pszKey != NULL)
+		json_object_object_add(json, "key", json_object_new_string(pData->pszKey));
+	json_object_object_add(json, "counts", counts);
+
+	pthread_mutex_lock(&pData->mut);
+	if(pData->pszKey == NULL) {
+		for(i = 0 ; i < SEVERITY_COUNT ; ++i) {
+			json_object_object_add(counts, severityNames[i],
+					       json_object_new_int64(pData->sevTotals[i]));
+		}
+	} else if(pData->pszValue != NULL) {
+		json_object_object_add(counts, pData->pszValue,
+				       json_object_new_int64(pData->valueTotal));
+	} else if(hashtable_count(pData->htTotals) > 0
+		  && (itr = hashtable_iterator(pData->htTotals)) != NULL) {
+		do {
+			pCtr = (valueCtr_t*) hashtable_iterator_value(itr);
+			json_object_object_add(counts, pCtr->name,
+					       json_object_new_int64(pCtr->ctr));
+		} while(hashtable_iterator_advance(itr));
+		free(itr);
+	}
+	pthread_mutex_unlock(&pData->mut);
+
+	if(msgConstruct(&pMsg) != RS_RET_OK)
+		goto finalize_it;
+	MsgSetInputName(pMsg, pInputName);
+	MsgSetRawMsgWOSize(pMsg, (char*)json_object_to_json_string(json));
+	MsgSetHOSTNAME(pMsg, glbl.GetLocalHostName(), ustrlen(glbl.GetLocalHostName()));
+	MsgSetRcvFrom(pMsg, glbl.GetLocalHostNameProp());
+	MsgSetRcvFromIP(pMsg, glbl.GetLocalHostIP());
+	MsgSetMSGoffs(pMsg, 0);
+	MsgSetTAG(pMsg, UCHAR_CONSTANT("rsyslogd-mmcount:"), sizeof("rsyslogd-mmcount:") - 1);
+	pMsg->iFacility = SUMMARY_FACILITY;
+	pMsg->iSeverity = SUMMARY_SEVERITY;
+	pMsg->msgFlags  = 0;
+	submitMsg2(pMsg);
+
+finalize_it:
+	json_object_put(json);
+}
+
+
+BEGINdoAction
+	msg_t *pMsg;
+	char *appname;
+	struct json_object *json;
+	time_t tNow;
+	instanceData *const pData = pWrkrData->pData;
+CODESTARTdoAction
+	pMsg = (msg_t*) ppString[0];
+	appname = getAPPNAME(pMsg, LOCK_MUTEX);
+
+	if(0 != strcmp(appname, pData->pszAppName)) {
+		/* we are not working for this appname. nothing to do */
+		FINALIZE;
 	}
 
-	if(json) {
-		msgAddJSON(pMsg, (uchar *)JSON_COUNT_NAME, json);
+	if(pData->output == OUTPUT_MSG) {
+		if((json = countInMsg(pData, pMsg)) != NULL)
+			msgAddJSON(pMsg, (uchar *)JSON_COUNT_NAME, json);
+	} else {
+		countLocal(pWrkrData, pMsg);
+		if(pWrkrData->nPending > 0
+		   && time(&tNow) - pWrkrData->tLastMerge >= pData->iInterval) {
+			mergeCounts(pWrkrData);
+			pWrkrData->tLastMerge = tNow;
+		}
 	}
+finalize_it:
 ENDdoAction
 
 
@@ -337,6 +825,19 @@ ENDparseSelectorAct
 
 BEGINmodExit
 CODESTARTmodExit
+	if(bSummaryRunning) {
+		pthread_mutex_lock(&mutInstList);
+		bSummaryTerm = 1;
+		pthread_cond_signal(&condSummary);
+		pthread_mutex_unlock(&mutInstList);
+		pthread_join(summaryTid, NULL);
+		bSummaryRunning = 0;
+	}
+	if(pInputName != NULL)
+		prop.Destruct(&pInputName);
+	objRelease(prop, CORE_COMPONENT);
+	objRelease(glbl, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
 	objRelease(errmsg, CORE_COMPONENT);
 ENDmodExit
 
@@ -357,4 +858,10 @@ CODESTARTmodInit
 CODEmodInit_QueryRegCFSLineHdlr
 	DBGPRINTF("mmcount: module compiled with rsyslog version %s.\n", VERSION);
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
+	CHKiRet(objUse(glbl, CORE_COMPONENT));
+	CHKiRet(objUse(prop, CORE_COMPONENT));
+	CHKiRet(prop.Construct(&pInputName));
+	CHKiRet(prop.SetString(pInputName, UCHAR_CONSTANT("mmcount"), sizeof("mmcount") - 1));
+	CHKiRet(prop.ConstructFinalize(pInputName));
 ENDmodInit
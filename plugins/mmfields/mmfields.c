@@ -54,6 +54,8 @@ DEF_OMOD_STATIC_DATA
 typedef struct _instanceData {
 	char separator;
 	uchar *jsonRoot;	/**< container where to store fields */
+	sbool *selected;	/**< selected[i]: add field i? NULL = all fields */
+	int maxField;		/**< highest selected field, 0 if all fields */
 } instanceData;
 
 typedef struct wrkrInstanceData {
@@ -71,7 +73,8 @@ static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current ex
 /* action (instance) parameters */
 static struct cnfparamdescr actpdescr[] = {
 	{ "separator", eCmdHdlrGetChar, 0 },
-	{ "jsonroot", eCmdHdlrString, 0 }
+	{ "jsonroot", eCmdHdlrString, 0 },
+	{ "fields", eCmdHdlrArray, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -120,6 +123,7 @@ ENDisCompatibleWithFeature
 BEGINfreeInstance
 CODESTARTfreeInstance
 	free(pData->jsonRoot);
+	free(pData->selected);
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
@@ -132,6 +136,45 @@ setInstParamDefaults(instanceData *pData)
 {
 	pData->separator = ',';
 	pData->jsonRoot = NULL;
+	pData->selected = NULL;
+	pData->maxField = 0;
+}
+
+
+/* set up the field selection from the "fields" array. Fields are
+ * numbered starting at 1, like their names f1, f2, ...
+ */
+static rsRetVal
+setFieldSelection(instanceData *pData, struct cnfarray *ar)
+{
+	int i;
+	int nbr;
+	int *nbrs = NULL;
+	char *cstr;
+	DEFiRet;
+
+	CHKmalloc(nbrs = malloc(ar->nmemb * sizeof(int)));
+	for(i = 0 ; i < ar->nmemb ; ++i) {
+		cstr = es_str2cstr(ar->arr[i], NULL);
+		nbr = (cstr == NULL) ? 0 : atoi(cstr);
+		if(nbr < 1) {
+			errmsg.LogError(0, RS_RET_INVALID_PARAMS, "mmfields: invalid field "
+					"number '%s', fields are numbered starting at 1",
+					cstr == NULL ? "" : cstr);
+			free(cstr);
+			ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+		}
+		free(cstr);
+		nbrs[i] = nbr;
+		if(nbr > pData->maxField)
+			pData->maxField = nbr;
+	}
+	CHKmalloc(pData->selected = calloc(pData->maxField + 1, sizeof(sbool)));
+	for(i = 0 ; i < ar->nmemb ; ++i)
+		pData->selected[nbrs[i]] = 1;
+finalize_it:
+	free(nbrs);
+	RETiRet;
 }
 
 BEGINnewActInst
@@ -155,6 +198,8 @@ CODESTARTnewActInst
 			pData->separator = es_getBufAddr(pvals[i].val.d.estr)[0];
 		} else if(!strcmp(actpblk.descr[i].name, "jsonroot")) {
 			pData->jsonRoot = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "fields")) {
+			CHKiRet(setFieldSelection(pData, pvals[i].val.d.ar));
 		} else {
 			dbgprintf("mmfields: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
@@ -179,55 +224,40 @@ CODESTARTtryResume
 ENDtryResume
 
 
-static inline rsRetVal
-extractField(instanceData *pData, uchar *msgtext, int lenMsg, int *curridx, uchar *fieldbuf)
-{
-	int i, j;
-	DEFiRet;
-	i = *curridx;
-	j = 0;
-	while(i < lenMsg && msgtext[i] != pData->separator) {
-		fieldbuf[j++] = msgtext[i++];
-	}
-	fieldbuf[j] = '\0';
-	if(i < lenMsg)
-		++i;
-	*curridx = i;
-
-	RETiRet;
-}
-
-
+/* split the message into fields. The message is not copied: we just
+ * locate the fields inside the message buffer and create json strings
+ * only for the fields that are actually selected. Scanning stops after
+ * the highest selected field.
+ */
 static inline rsRetVal
 parse_fields(instanceData *pData, msg_t *pMsg, uchar *msgtext, int lenMsg)
 {
-	uchar fieldbuf[32*1024];
-	uchar fieldname[512];
+	uchar fieldname[16];
 	struct json_object *json;
 	struct json_object *jval;
+	const uchar *pSep;
 	int field;
-	uchar *buf;
 	int currIdx = 0;
+	int lenFld;
 	DEFiRet;
 
-	if(lenMsg < (int) sizeof(fieldbuf)) {
-		buf = fieldbuf;
-	} else {
-		CHKmalloc(buf = malloc(lenMsg+1));
-	}
-
 	json =  json_object_new_object();
 	if(json == NULL) {
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
 	field = 1;
 	while(currIdx < lenMsg) {
-		CHKiRet(extractField(pData, msgtext, lenMsg, &currIdx, buf));
-		DBGPRINTF("mmfields: field %d: '%s'\n", field, buf);
-		snprintf((char*)fieldname, sizeof(fieldname), "f%d", field);
-		fieldname[sizeof(fieldname)-1] = '\0';
-		jval = json_object_new_string((char*)fieldbuf);
-		json_object_object_add(json, (char*)fieldname, jval);
+		if(pData->maxField != 0 && field > pData->maxField)
+			break;
+		pSep = memchr(msgtext + currIdx, pData->separator, lenMsg - currIdx);
+		lenFld = (pSep == NULL) ? lenMsg - currIdx : pSep - (msgtext + currIdx);
+		if(pData->selected == NULL || pData->selected[field]) {
+			DBGPRINTF("mmfields: field %d: '%.*s'\n", field, lenFld, msgtext + currIdx);
+			snprintf((char*)fieldname, sizeof(fieldname), "f%d", field);
+			jval = json_object_new_string_len((char*)msgtext + currIdx, lenFld);
+			json_object_object_add(json, (char*)fieldname, jval);
+		}
+		currIdx += lenFld + 1; /* also eat the separator */
 		field++;
 	}
  	msgAddJSON(pMsg, pData->jsonRoot, json);
@@ -35,6 +35,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <stdint.h>
 #include <json.h>
 #include "conf.h"
 #include "syslogd-types.h"
@@ -57,16 +58,43 @@ DEFobjCurrIf(errmsg);
  */
 DEF_OMOD_STATIC_DATA
 
+#define PARSER_JSONC 0	/* json-c tokener */
+#define PARSER_FAST 1	/* our own single-pass parser */
+#define FAST_MAX_DEPTH 32 /* same nesting limit as the json-c tokener */
+
 typedef struct _instanceData {
-	int dummy; /* not needed, but some compilers do not support empty structs */
-	/* REMOVE dummy when real data items are to be added! */
+	int parser;		/* PARSER_* */
+	char *container;	/* where to store the parsed object, "$!" by default */
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
 	struct json_tokener *tokener;
+	char *scratch;		/* fast parser: keys and unescaped strings, used as a stack */
+	size_t sizeScratch;
 } wrkrInstanceData_t;
 
+/* state of the fast parser while processing a single message */
+typedef struct fastParser_s {
+	wrkrInstanceData_t *pWrkrData;
+	const char *p;		/* current position */
+	const char *end;
+	size_t lenScratch;	/* used part of the scratch stack */
+	int depth;
+} fastParser_t;
+
+/* tables for interfacing with the v6 config system */
+/* action (instance) parameters */
+static struct cnfparamdescr actpdescr[] = {
+	{ "parser", eCmdHdlrGetWord, 0 },
+	{ "container", eCmdHdlrGetWord, 0 }
+};
+static struct cnfparamblk actpblk =
+	{ CNFPARAMBLK_VERSION,
+	  sizeof(actpdescr)/sizeof(struct cnfparamdescr),
+	  actpdescr
+	};
+
 struct modConfData_s {
 	rsconf_t *pConf;	/* our overall config object */
 };
@@ -104,6 +132,8 @@ ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->scratch = NULL;
+	pWrkrData->sizeScratch = 0;
 	pWrkrData->tokener = json_tokener_new();
 	if(pWrkrData->tokener == NULL) {
 		errmsg.LogError(0, RS_RET_ERR, "error: could not create json "
@@ -121,12 +151,14 @@ ENDisCompatibleWithFeature
 
 BEGINfreeInstance
 CODESTARTfreeInstance
+	free(pData->container);
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
 	if(pWrkrData->tokener != NULL)
 		json_tokener_free(pWrkrData->tokener);
+	free(pWrkrData->scratch);
 ENDfreeWrkrInstance
 
 
@@ -141,6 +173,442 @@ CODESTARTtryResume
 ENDtryResume
 
 
+/* ---BEGIN FAST PARSER-------------------------------------------------- */
+/* This is a single-pass recursive descent parser which builds the json-c
+ * objects directly from the message buffer. Other than the json-c tokener,
+ * it does not copy each character into an intermediate buffer: strings
+ * without escape sequences (the vast majority) are handed to json-c as is,
+ * and their end is found by scanning eight bytes at a time. Keys and
+ * strings with escapes are built in a scratch area that is kept per
+ * worker, so there is no allocation churn besides the objects themselves.
+ */
+
+#define SWAR_ONES  0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+/* non-zero if any byte of v is less than n (n <= 128) */
+#define SWAR_HASLESS(v, n) (((v) - SWAR_ONES * (n)) & ~(v) & SWAR_HIGHS)
+/* non-zero if any byte of v is zero */
+#define SWAR_HASZERO(v) SWAR_HASLESS(v, 1)
+
+static struct json_object *fastParseValue(fastParser_t *pThis);
+
+static inline void
+fastSkipWS(fastParser_t *pThis)
+{
+	while(pThis->p < pThis->end &&
+	      (*pThis->p == ' ' || *pThis->p == '\t' || *pThis->p == '\n' || *pThis->p == '\r'))
+		++pThis->p;
+}
+
+
+/* find the first '"', backslash or control character at or after p */
+static inline const char *
+fastScanString(const char *p, const char *end)
+{
+	uint64_t w;
+
+	while(p + 8 <= end) {
+		memcpy(&w, p, 8);
+		if(SWAR_HASZERO(w ^ (SWAR_ONES * '"')) || SWAR_HASZERO(w ^ (SWAR_ONES * '\\'))
+		   || SWAR_HASLESS(w, 0x20))
+			break;
+		p += 8;
+	}
+	while(p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20)
+		++p;
+	return p;
+}
+
+
+/* make sure the scratch stack is at least "needed" bytes large. Note
+ * that this may move it, so only offsets into it must be kept.
+ */
+static int
+fastScratchReserve(fastParser_t *pThis, size_t needed)
+{
+	wrkrInstanceData_t *pWrkrData = pThis->pWrkrData;
+	size_t newSize;
+	char *newBuf;
+
+	if(needed <= pWrkrData->sizeScratch)
+		return 0;
+	newSize = (pWrkrData->sizeScratch == 0) ? 1024 : 2 * pWrkrData->sizeScratch;
+	while(newSize < needed)
+		newSize *= 2;
+	if((newBuf = realloc(pWrkrData->scratch, newSize)) == NULL)
+		return -1;
+	pWrkrData->scratch = newBuf;
+	pWrkrData->sizeScratch = newSize;
+	return 0;
+}
+
+
+static int
+fastHex4(const char *p, unsigned *pVal)
+{
+	unsigned v = 0;
+	int i;
+
+	for(i = 0 ; i < 4 ; ++i) {
+		v <<= 4;
+		if(p[i] >= '0' && p[i] <= '9')
+			v |= p[i] - '0';
+		else if(p[i] >= 'a' && p[i] <= 'f')
+			v |= p[i] - 'a' + 10;
+		else if(p[i] >= 'A' && p[i] <= 'F')
+			v |= p[i] - 'A' + 10;
+		else
+			return -1;
+	}
+	*pVal = v;
+	return 0;
+}
+
+
+/* Parse a string (p is on the opening quote). If it contains no escapes,
+ * *ppStr points into the message buffer, else to the unescaped copy on top
+ * of the scratch stack, which starts at offset *pOldLen. If bTerm is set,
+ * the result is always on the scratch stack and NUL-terminated (needed for
+ * object keys). The caller must pop the scratch stack to *pOldLen when done
+ * with the string. Returns -1 on error.
+ */
+static int
+fastParseString(fastParser_t *pThis, int bTerm, const char **ppStr, size_t *pLen, size_t *pOldLen)
+{
+	const char *start;
+	const char *q;
+	char *dst;
+	size_t offs;
+	unsigned cp, cp2;
+
+	*pOldLen = pThis->lenScratch;
+	start = ++pThis->p;
+	q = fastScanString(start, pThis->end);
+	if(q >= pThis->end || (unsigned char)*q < 0x20)
+		return -1;
+	if(*q == '"' && !bTerm) {
+		*ppStr = start;
+		*pLen = q - start;
+		pThis->p = q + 1;
+		return 0;
+	}
+
+	/* slow path: copy to scratch, resolving escapes. Each segment is
+	 * followed by at most one escape (4 bytes of UTF-8) or the NUL.
+	 */
+	offs = pThis->lenScratch;
+	for(;;) {
+		if(fastScratchReserve(pThis, offs + (q - start) + 5) != 0)
+			return -1;
+		dst = pThis->pWrkrData->scratch + offs;
+		memcpy(dst, start, q - start);
+		dst += q - start;
+		if(q >= pThis->end || (unsigned char)*q < 0x20)
+			return -1;
+		if(*q == '"')
+			break;
+		/* backslash */
+		if(++q >= pThis->end)
+			return -1;
+		switch(*q++) {
+		case '"':  *dst++ = '"'; break;
+		case '\\': *dst++ = '\\'; break;
+		case '/':  *dst++ = '/'; break;
+		case 'b':  *dst++ = '\b'; break;
+		case 'f':  *dst++ = '\f'; break;
+		case 'n':  *dst++ = '\n'; break;
+		case 'r':  *dst++ = '\r'; break;
+		case 't':  *dst++ = '\t'; break;
+		case 'u':
+			if(pThis->end - q < 4 || fastHex4(q, &cp) != 0)
+				return -1;
+			q += 4;
+			if(cp >= 0xD800 && cp <= 0xDBFF) {
+				/* surrogate pair */
+				if(pThis->end - q < 6 || q[0] != '\\' || q[1] != 'u'
+				   || fastHex4(q + 2, &cp2) != 0 || cp2 < 0xDC00 || cp2 > 0xDFFF)
+					return -1;
+				q += 6;
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (cp2 - 0xDC00);
+			}
+			if(cp < 0x80) {
+				*dst++ = cp;
+			} else if(cp < 0x800) {
+				*dst++ = 0xC0 | (cp >> 6);
+				*dst++ = 0x80 | (cp & 0x3F);
+			} else if(cp < 0x10000) {
+				*dst++ = 0xE0 | (cp >> 12);
+				*dst++ = 0x80 | ((cp >> 6) & 0x3F);
+				*dst++ = 0x80 | (cp & 0x3F);
+			} else {
+				*dst++ = 0xF0 | (cp >> 18);
+				*dst++ = 0x80 | ((cp >> 12) & 0x3F);
+				*dst++ = 0x80 | ((cp >> 6) & 0x3F);
+				*dst++ = 0x80 | (cp & 0x3F);
+			}
+			break;
+		default:
+			return -1;
+		}
+		offs = dst - pThis->pWrkrData->scratch;
+		start = q;
+		q = fastScanString(start, pThis->end);
+	}
+	*ppStr = pThis->pWrkrData->scratch + pThis->lenScratch;
+	*pLen = dst - *ppStr;
+	*dst++ = '\0';
+	pThis->lenScratch = dst - pThis->pWrkrData->scratch;
+	pThis->p = q + 1;
+	return 0;
+}
+
+
+/* parse a number according to the JSON grammar. Integers that fit into
+ * 64 bits become int64 objects, everything else double, like json-c does.
+ */
+static struct json_object *
+fastParseNumber(fastParser_t *pThis)
+{
+	const char *p = pThis->p;
+	const char *start = p;
+	int bInt = 1;
+	char *endConv;
+	long long n;
+	double d;
+
+	if(p < pThis->end && *p == '-')
+		++p;
+	if(p >= pThis->end || !isdigit((unsigned char)*p))
+		return NULL;
+	if(*p == '0') {
+		++p;
+	} else {
+		while(p < pThis->end && isdigit((unsigned char)*p))
+			++p;
+	}
+	if(p < pThis->end && *p == '.') {
+		bInt = 0;
+		++p;
+		if(p >= pThis->end || !isdigit((unsigned char)*p))
+			return NULL;
+		while(p < pThis->end && isdigit((unsigned char)*p))
+			++p;
+	}
+	if(p < pThis->end && (*p == 'e' || *p == 'E')) {
+		bInt = 0;
+		++p;
+		if(p < pThis->end && (*p == '+' || *p == '-'))
+			++p;
+		if(p >= pThis->end || !isdigit((unsigned char)*p))
+			return NULL;
+		while(p < pThis->end && isdigit((unsigned char)*p))
+			++p;
+	}
+	pThis->p = p;
+
+	/* the grammar is validated, so strtoll()/strtod() stop exactly at p */
+	if(bInt) {
+		errno = 0;
+		n = strtoll(start, &endConv, 10);
+		if(errno == 0 && endConv == p)
+			return json_object_new_int64(n);
+	}
+	d = strtod(start, &endConv);
+	if(endConv != p)
+		return NULL;
+	return json_object_new_double(d);
+}
+
+
+static struct json_object *
+fastParseObject(fastParser_t *pThis)
+{
+	struct json_object *json;
+	struct json_object *jval;
+	const char *key;
+	size_t lenKey;
+	size_t oldLen;
+
+	if(++pThis->depth > FAST_MAX_DEPTH)
+		return NULL;
+	if((json = json_object_new_object()) == NULL)
+		return NULL;
+	++pThis->p; /* eat '{' */
+	fastSkipWS(pThis);
+	if(pThis->p < pThis->end && *pThis->p == '}') {
+		++pThis->p;
+		goto done;
+	}
+	for(;;) {
+		if(pThis->p >= pThis->end || *pThis->p != '"')
+			goto fail;
+		if(fastParseString(pThis, 1, &key, &lenKey, &oldLen) != 0)
+			goto fail;
+		fastSkipWS(pThis);
+		if(pThis->p >= pThis->end || *pThis->p != ':')
+			goto fail;
+		++pThis->p;
+		if((jval = fastParseValue(pThis)) == NULL && pThis->p == NULL)
+			goto fail;
+		/* the scratch stack may have moved while parsing the value */
+		key = pThis->pWrkrData->scratch + oldLen;
+		json_object_object_add(json, key, jval);
+		pThis->lenScratch = oldLen;
+		fastSkipWS(pThis);
+		if(pThis->p >= pThis->end)
+			goto fail;
+		if(*pThis->p == '}') {
+			++pThis->p;
+			break;
+		}
+		if(*pThis->p++ != ',')
+			goto fail;
+		fastSkipWS(pThis);
+	}
+done:
+	--pThis->depth;
+	return json;
+fail:
+	json_object_put(json);
+	pThis->p = NULL;
+	return NULL;
+}
+
+
+static struct json_object *
+fastParseArray(fastParser_t *pThis)
+{
+	struct json_object *json;
+	struct json_object *jval;
+
+	if(++pThis->depth > FAST_MAX_DEPTH)
+		return NULL;
+	if((json = json_object_new_array()) == NULL)
+		return NULL;
+	++pThis->p; /* eat '[' */
+	fastSkipWS(pThis);
+	if(pThis->p < pThis->end && *pThis->p == ']') {
+		++pThis->p;
+		goto done;
+	}
+	for(;;) {
+		if((jval = fastParseValue(pThis)) == NULL && pThis->p == NULL)
+			goto fail;
+		json_object_array_add(json, jval);
+		fastSkipWS(pThis);
+		if(pThis->p >= pThis->end)
+			goto fail;
+		if(*pThis->p == ']') {
+			++pThis->p;
+			break;
+		}
+		if(*pThis->p++ != ',')
+			goto fail;
+	}
+done:
+	--pThis->depth;
+	return json;
+fail:
+	json_object_put(json);
+	pThis->p = NULL;
+	return NULL;
+}
+
+
+static inline int
+fastMatchLiteral(fastParser_t *pThis, const char *lit, size_t len)
+{
+	if((size_t)(pThis->end - pThis->p) < len || memcmp(pThis->p, lit, len))
+		return 0;
+	pThis->p += len;
+	return 1;
+}
+
+
+/* parse any JSON value. As null is a valid value, errors are flagged
+ * by setting pThis->p to NULL.
+ */
+static struct json_object *
+fastParseValue(fastParser_t *pThis)
+{
+	struct json_object *json = NULL;
+	const char *str;
+	size_t len;
+	size_t oldLen;
+
+	fastSkipWS(pThis);
+	if(pThis->p >= pThis->end)
+		goto fail;
+	switch(*pThis->p) {
+	case '{':
+		json = fastParseObject(pThis);
+		break;
+	case '[':
+		json = fastParseArray(pThis);
+		break;
+	case '"':
+		if(fastParseString(pThis, 0, &str, &len, &oldLen) != 0)
+			goto fail;
+		json = json_object_new_string_len(str, len);
+		pThis->lenScratch = oldLen;
+		break;
+	case 't':
+		if(!fastMatchLiteral(pThis, "true", 4))
+			goto fail;
+		json = json_object_new_boolean(1);
+		break;
+	case 'f':
+		if(!fastMatchLiteral(pThis, "false", 5))
+			goto fail;
+		json = json_object_new_boolean(0);
+		break;
+	case 'n':
+		if(!fastMatchLiteral(pThis, "null", 4))
+			goto fail;
+		return NULL;
+	default:
+		json = fastParseNumber(pThis);
+		break;
+	}
+	if(json == NULL)
+		goto fail;
+	return json;
+fail:
+	pThis->p = NULL;
+	return NULL;
+}
+
+
+/* parse buf, which must contain exactly one JSON object */
+static struct json_object *
+fastParse(wrkrInstanceData_t *pWrkrData, const char *buf, size_t lenBuf)
+{
+	fastParser_t parser;
+	struct json_object *json;
+
+	parser.pWrkrData = pWrkrData;
+	parser.p = buf;
+	parser.end = buf + lenBuf;
+	parser.lenScratch = 0;
+	parser.depth = 0;
+
+	fastSkipWS(&parser);
+	if(parser.p >= parser.end || *parser.p != '{')
+		return NULL;
+	json = fastParseObject(&parser);
+	if(json == NULL)
+		return NULL;
+	fastSkipWS(&parser);
+	if(parser.p != parser.end) {
+		DBGPRINTF("mmjsonparse: extra characters after JSON object\n");
+		json_object_put(json);
+		return NULL;
+	}
+	return json;
+}
+/* ---END FAST PARSER---------------------------------------------------- */
+
+
 static rsRetVal
 processJSON(wrkrInstanceData_t *pWrkrData, msg_t *pMsg, char *buf, size_t lenBuf)
 {
@@ -148,6 +616,14 @@ processJSON(wrkrInstanceData_t *pWrkrData, msg_t *pMsg, char *buf, size_t lenBuf
 	const char *errMsg;
 	DEFiRet;
 
+	if(pWrkrData->pData->parser == PARSER_FAST) {
+		DBGPRINTF("mmjsonparse: toParse (fast): '%s'\n", buf);
+		if((json = fastParse(pWrkrData, buf, lenBuf)) == NULL)
+			ABORT_FINALIZE(RS_RET_NO_CEE_MSG);
+		msgAddJSON(pMsg, (uchar*)pWrkrData->pData->container + 1, json);
+		FINALIZE;
+	}
+
 	assert(pWrkrData->tokener != NULL);
 	DBGPRINTF("mmjsonparse: toParse: '%s'\n", buf);
 	json_tokener_reset(pWrkrData->tokener);
@@ -175,10 +651,12 @@ processJSON(wrkrInstanceData_t *pWrkrData, msg_t *pMsg, char *buf, size_t lenBuf
 	if(json == NULL
 	   || ((size_t)pWrkrData->tokener->char_offset < lenBuf)
 	   || (!json_object_is_type(json, json_type_object))) {
+		if(json != NULL)
+			json_object_put(json);
 		ABORT_FINALIZE(RS_RET_NO_CEE_MSG);
 	}
  
- 	msgAddJSON(pMsg, (uchar*)"!", json);
+ 	msgAddJSON(pMsg, (uchar*)pWrkrData->pData->container + 1, json);
 finalize_it:
 	RETiRet;
 }
@@ -188,6 +666,7 @@ finalize_it:
 BEGINdoAction
 	msg_t *pMsg;
 	uchar *buf;
+	int lenBuf;
 	int bSuccess = 0;
 	struct json_object *jval;
 	struct json_object *json;
@@ -198,9 +677,11 @@ CODESTARTdoAction
 	 * duplication. -- rgerhards, 2010-12-01
 	 */
 	buf = getMSG(pMsg);
+	lenBuf = getMSGLen(pMsg);
 
 	while(*buf && isspace(*buf)) {
 		++buf;
+		--lenBuf;
 	}
 
 	if(*buf == '\0' || strncmp((char*)buf, COOKIE, LEN_COOKIE)) {
@@ -208,7 +689,8 @@ CODESTARTdoAction
 		ABORT_FINALIZE(RS_RET_NO_CEE_MSG);
 	}
 	buf += LEN_COOKIE;
-	CHKiRet(processJSON(pWrkrData, pMsg, (char*) buf, strlen((char*)buf)));
+	lenBuf -= LEN_COOKIE;
+	CHKiRet(processJSON(pWrkrData, pMsg, (char*) buf, (size_t) lenBuf));
 	bSuccess = 1;
 finalize_it:
 	if(iRet == RS_RET_NO_CEE_MSG) {
@@ -216,27 +698,70 @@ finalize_it:
 		json = json_object_new_object();
 		jval = json_object_new_string((char*)buf);
 		json_object_object_add(json, "msg", jval);
-		msgAddJSON(pMsg, (uchar*)"!", json);
+		msgAddJSON(pMsg, (uchar*)pWrkrData->pData->container + 1, json);
 		iRet = RS_RET_OK;
 	}
 	MsgSetParseSuccess(pMsg, bSuccess);
 ENDdoAction
 
+static inline void
+setInstParamDefaults(instanceData *pData)
+{
+	pData->parser = PARSER_JSONC;
+	pData->container = strdup("$!");
+}
+
 BEGINnewActInst
+	struct cnfparamvals *pvals;
+	char *cstr;
+	int i;
 CODESTARTnewActInst
-	/* Note: we currently do not have any parameters, so we do not need
-	 * the lst ptr. However, we will most probably need params in the 
-	 * future.
-	 */
 	DBGPRINTF("newActInst (mmjsonparse)\n");
+	if((pvals = nvlstGetParams(lst, &actpblk, NULL)) == NULL) {
+		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+	}
 
 	CODE_STD_STRING_REQUESTnewActInst(1)
 	CHKiRet(OMSRsetEntry(*ppOMSR, 0, NULL, OMSR_TPL_AS_MSG));
 	CHKiRet(createInstance(&pData));
-	/*setInstParamDefaults(pData);*/
+	setInstParamDefaults(pData);
+
+	for(i = 0 ; i < actpblk.nParams ; ++i) {
+		if(!pvals[i].bUsed)
+			continue;
+		if(!strcmp(actpblk.descr[i].name, "parser")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(!strcmp(cstr, "json-c")) {
+				pData->parser = PARSER_JSONC;
+			} else if(!strcmp(cstr, "fast")) {
+				pData->parser = PARSER_FAST;
+			} else {
+				errmsg.LogError(0, RS_RET_INVLD_MODE, "mmjsonparse: invalid parser "
+						"'%s', must be 'json-c' or 'fast'", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_INVLD_MODE);
+			}
+			free(cstr);
+		} else if(!strcmp(actpblk.descr[i].name, "container")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(strlen(cstr) < 2 || cstr[0] != '$'
+			   || (cstr[1] != '!' && cstr[1] != '.' && cstr[1] != '/')) {
+				errmsg.LogError(0, RS_RET_VALUE_NOT_SUPPORTED, "mmjsonparse: "
+						"container must be a JSON variable like $!app, "
+						"got '%s'", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_VALUE_NOT_SUPPORTED);
+			}
+			free(pData->container);
+			pData->container = cstr;
+		} else {
+			DBGPRINTF("mmjsonparse: program error, non-handled "
+			  "param '%s'\n", actpblk.descr[i].name);
+		}
+	}
 
 CODE_STD_FINALIZERnewActInst
-/*	cnfparamvalsDestruct(pvals, &actpblk);*/
+	cnfparamvalsDestruct(pvals, &actpblk);
 ENDnewActInst
 
 BEGINparseSelectorAct
@@ -250,6 +775,7 @@ CODE_STD_STRING_REQUESTparseSelectorAct(1)
 	/* ok, if we reach this point, we have something for us */
 	p += sizeof(":mmjsonparse:") - 1; /* eat indicator sequence  (-1 because of '\0'!) */
 	CHKiRet(createInstance(&pData));
+	setInstParamDefaults(pData);
 
 	/* check if a non-standard template is to be applied */
 	if(*(p-1) == ';')
@@ -64,6 +64,9 @@ typedef struct _instanceData {
 	uchar 	*rulebase;	/**< name of rulebase to use */
 	ln_ctx ctxln;		/**< context to be used for liblognorm */
 	char *pszPath;		/**< path of normalized data */
+	char **fields;		/**< parsed fields to add to the message, NULL = all */
+	int nFields;
+	char *prefilter;	/**< only normalize messages containing this string */
 } instanceData;
 
 typedef struct wrkrInstanceData {
@@ -81,7 +84,9 @@ static configSettings_t cs;
 static struct cnfparamdescr actpdescr[] = {
 	{ "rulebase", eCmdHdlrGetWord, 1 },
 	{ "path", eCmdHdlrGetWord, 0 },
-	{ "userawmsg", eCmdHdlrBinary, 0 }
+	{ "userawmsg", eCmdHdlrBinary, 0 },
+	{ "fields", eCmdHdlrArray, 0 },
+	{ "prefilter", eCmdHdlrGetWord, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -171,10 +176,15 @@ ENDisCompatibleWithFeature
 
 
 BEGINfreeInstance
+	int i;
 CODESTARTfreeInstance
 	free(pData->rulebase);
 	ln_exitCtx(pData->ctxln);
 	free(pData->pszPath);
+	for(i = 0 ; i < pData->nFields ; ++i)
+		free(pData->fields[i]);
+	free(pData->fields);
+	free(pData->prefilter);
 ENDfreeInstance
 
 
@@ -193,21 +203,53 @@ BEGINtryResume
 CODESTARTtryResume
 ENDtryResume
 
+/* build a tree with only the configured fields of the parse result.
+ * The values are shared with the full tree, so nothing is copied. Returns
+ * NULL if none of the fields is present.
+ */
+static struct json_object *
+selectFields(instanceData *pData, struct json_object *json)
+{
+	struct json_object *jsel = NULL;
+	struct json_object *jval;
+	int i;
+
+	for(i = 0 ; i < pData->nFields ; ++i) {
+		jval = json_object_object_get(json, pData->fields[i]);
+		if(jval == NULL)
+			continue;
+		if(jsel == NULL && (jsel = json_object_new_object()) == NULL)
+			break;
+		json_object_object_add(jsel, pData->fields[i], json_object_get(jval));
+	}
+	return jsel;
+}
+
+
 BEGINdoAction
+	instanceData *pData = pWrkrData->pData;
 	msg_t *pMsg;
 	uchar *buf;
 	int len;
 	int r;
 	struct json_object *json = NULL;
+	struct json_object *jsel;
 CODESTARTdoAction
 	pMsg = (msg_t*) ppString[0];
-	if(pWrkrData->pData->bUseRawMsg) {
+	if(pData->bUseRawMsg) {
 		getRawMsg(pMsg, &buf, &len);
 	} else {
 		buf = getMSG(pMsg);
 		len = getMSGLen(pMsg);
 	}
-	r = ln_normalize(pWrkrData->pData->ctxln, (char*)buf, len, &json);
+	/* if the prefilter does not match, no rule can match either,
+	 * so we do not even call liblognorm.
+	 */
+	if(pData->prefilter != NULL && strstr((char*)buf, pData->prefilter) == NULL) {
+		MsgSetParseSuccess(pMsg, 0);
+		FINALIZE;
+	}
+	r = ln_normalize(pData->ctxln, (char*)buf, len, &json);
 	if(r != 0) {
 		DBGPRINTF("error %d during ln_normalize\n", r);
 		MsgSetParseSuccess(pMsg, 0);
@@ -215,8 +257,16 @@ CODESTARTdoAction
 		MsgSetParseSuccess(pMsg, 1);
 	}
 
- 	msgAddJSON(pMsg, (uchar*)pWrkrData->pData->pszPath + 1, json);
+	if(pData->fields != NULL && json != NULL) {
+		jsel = selectFields(pData, json);
+		json_object_put(json);
+		json = jsel;
+		if(json == NULL)
+			FINALIZE;
+	}
+ 	msgAddJSON(pMsg, (uchar*)pData->pszPath + 1, json);
 
+finalize_it:
 ENDdoAction
 
 
@@ -226,11 +276,14 @@ setInstParamDefaults(instanceData *pData)
 	pData->rulebase = NULL;
 	pData->bUseRawMsg = 0;
 	pData->pszPath = strdup("$!");
+	pData->fields = NULL;
+	pData->nFields = 0;
+	pData->prefilter = NULL;
 }
 
 BEGINnewActInst
 	struct cnfparamvals *pvals;
-	int i;
+	int i, j;
 	int bDestructPValsOnExit;
 	char *cstr;
 CODESTARTnewActInst
@@ -277,6 +330,14 @@ CODESTARTnewActInst
 				pData->pszPath = cstr;
 			}
 			continue;
+		} else if(!strcmp(actpblk.descr[i].name, "fields")) {
+			CHKmalloc(pData->fields = calloc(pvals[i].val.d.ar->nmemb, sizeof(char*)));
+			for(j = 0 ; j < pvals[i].val.d.ar->nmemb ; ++j) {
+				CHKmalloc(pData->fields[j] = es_str2cstr(pvals[i].val.d.ar->arr[j], NULL));
+				++pData->nFields;
+			}
+		} else if(!strcmp(actpblk.descr[i].name, "prefilter")) {
+			pData->prefilter = es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else {
 			DBGPRINTF("mmnormalize: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
@@ -313,6 +374,9 @@ CODE_STD_STRING_REQUESTparseSelectorAct(1)
 	pData->rulebase = cs.rulebase;
 	pData->bUseRawMsg = cs.bUseRawMsg;
 	pData->pszPath = strdup("$!"); /* old interface does not support this feature */
+	pData->fields = NULL;
+	pData->nFields = 0;
+	pData->prefilter = NULL;
 	/* all config vars auto-reset! */
 	cs.bUseRawMsg = 0;
 	cs.rulebase = NULL; /* we used it up! */
@@ -1,6 +1,7 @@
 /* mmpstrucdata.c
  * Parse all fields of the message into structured data inside the
- * JSON tree.
+ * JSON tree. With the "sd" parameter, only the given SD-ELEMENTs or
+ * SD-PARAMs are added.
  *
  * Copyright 2013 Adiscon GmbH.
  *
@@ -49,12 +50,52 @@ DEF_OMOD_STATIC_DATA
 
 /* config variables */
 
+/* an entry of the "sd" selection: a whole SD-ELEMENT (param == NULL)
+ * or a single SD-PARAM of it. Both are stored lower-cased.
+ */
+typedef struct sdSel_s {
+	uchar *id;
+	uchar *param;
+} sdSel_t;
+
+/* selection state of an SD-ELEMENT */
+#define SEL_ELEM_NONE 0		/* not selected */
+#define SEL_ELEM_PARAMS 1	/* only some params selected */
+#define SEL_ELEM_ALL 2		/* the whole element selected */
+
 typedef struct _instanceData {
 	uchar *jsonRoot;	/**< container where to store fields */
+	sdSel_t *sel;		/**< what to add to the message, NULL = everything */
+	int nSel;
 } instanceData;
 
+/* index of the structured data of the current message. Offsets are
+ * relative to the structured data buffer.
+ */
+typedef struct sdParam_s {
+	int nameOff, nameLen;
+	int valOff, valLen;
+	sbool bEscaped;		/* value contains escapes, must be unescaped */
+} sdParam_t;
+
+typedef struct sdElem_s {
+	int idOff, idLen;
+	int firstParam;		/* index of first param in params */
+	int nParams;
+} sdElem_t;
+
+typedef struct sdIndex_s {
+	sdElem_t *elems;
+	int nElems, maxElems;
+	sdParam_t *params;
+	int nParams, maxParams;
+} sdIndex_t;
+
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	sdIndex_t idx;		/* buffers are kept between messages */
+	uchar *valbuf;		/* for unescaping values */
+	int lenValbuf;
 } wrkrInstanceData_t;
 
 struct modConfData_s {
@@ -67,7 +108,8 @@ static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current ex
 /* tables for interfacing with the v6 config system */
 /* action (instance) parameters */
 static struct cnfparamdescr actpdescr[] = {
-	{ "jsonroot", eCmdHdlrString, 0 }
+	{ "jsonroot", eCmdHdlrString, 0 },
+	{ "sd", eCmdHdlrArray, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -114,12 +156,21 @@ ENDisCompatibleWithFeature
 
 
 BEGINfreeInstance
+	int i;
 CODESTARTfreeInstance
 	free(pData->jsonRoot);
+	for(i = 0 ; i < pData->nSel ; ++i) {
+		free(pData->sel[i].id);
+		free(pData->sel[i].param);
+	}
+	free(pData->sel);
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	free(pWrkrData->idx.elems);
+	free(pWrkrData->idx.params);
+	free(pWrkrData->valbuf);
 ENDfreeWrkrInstance
 
 
@@ -127,6 +178,43 @@ static inline void
 setInstParamDefaults(instanceData *pData)
 {
 	pData->jsonRoot = NULL;
+	pData->sel = NULL;
+	pData->nSel = 0;
+}
+
+
+/* set up the selection from the "sd" array. Each entry is either an
+ * SD-ID ("origin") or an SD-ID and param name ("origin!ip"), that is the
+ * path below $!rfc5424-sd the config references.
+ */
+static rsRetVal
+setSelection(instanceData *pData, struct cnfarray *ar)
+{
+	sdSel_t *sel;
+	uchar *p;
+	int i;
+	DEFiRet;
+
+	CHKmalloc(pData->sel = calloc(ar->nmemb, sizeof(sdSel_t)));
+	for(i = 0 ; i < ar->nmemb ; ++i) {
+		sel = pData->sel + pData->nSel;
+		CHKmalloc(sel->id = (uchar*) es_str2cstr(ar->arr[i], NULL));
+		++pData->nSel;
+		for(p = sel->id ; *p ; ++p)
+			*p = tolower(*p);
+		if((p = (uchar*) strchr((char*)sel->id, '!')) != NULL) {
+			*p = '\0';
+			CHKmalloc(sel->param = (uchar*) strdup((char*)p + 1));
+		}
+		if(sel->id[0] == '\0' || (sel->param != NULL && sel->param[0] == '\0')) {
+			errmsg.LogError(0, RS_RET_INVALID_PARAMS, "mmpstrucdata: invalid "
+					"entry %d in parameter \"sd\", must be \"sd-id\" "
+					"or \"sd-id!param\"", i + 1);
+			ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+		}
+	}
+finalize_it:
+	RETiRet;
 }
 
 BEGINnewActInst
@@ -148,6 +236,8 @@ CODESTARTnewActInst
 			continue;
 		if(!strcmp(actpblk.descr[i].name, "jsonroot")) {
 			pData->jsonRoot = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "sd")) {
+			CHKiRet(setSelection(pData, pvals[i].val.d.ar));
 		} else {
 			dbgprintf("mmpstrucdata: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
@@ -172,92 +262,74 @@ CODESTARTtryResume
 ENDtryResume
 
 
+/* Structured data is processed in two steps: first, we index the SD-ELEMENTs
+ * and SD-PARAMs, that is we validate the structured data and record where
+ * ids, names and values are located inside the message. Nothing is copied
+ * in that step. Then, only the selected elements and params are turned
+ * into json. Values without escapes are taken directly from the message.
+ */
 static inline rsRetVal
-parsePARAM_VALUE(uchar *sdbuf, int lenbuf, int *curridx, uchar *fieldbuf)
+growIndex(void **ppArr, int *pMax, const size_t lenEntry)
 {
-	int i, j;
+	void *pNew;
+	const int newMax = (*pMax == 0) ? 8 : *pMax * 2;
 	DEFiRet;
-dbgprintf("DDDD: parsePARAM_VALUE\n");
-	i = *curridx;
-	j = 0;
-	while(i < lenbuf && sdbuf[i] != '"') {
-		if(sdbuf[i] == '\\') {
-			if(++i == lenbuf) {
-				fieldbuf[j++] = '\\';
-			} else {
-				if(sdbuf[i] == '"') {
-					fieldbuf[j++] = '"';
-				} else if(sdbuf[i] == '\\') {
-					fieldbuf[j++] = '\\';
-				} else if(sdbuf[i] == ']') {
-					fieldbuf[j++] = '"';
-				} else {
-					fieldbuf[j++] = '\\';
-					fieldbuf[j++] = sdbuf[i];
-				}
-				++i;
-			}
-		} else {
-		fieldbuf[j++] = sdbuf[i++];
-		}
-	}
-	fieldbuf[j] = '\0';
-	*curridx = i;
-dbgprintf("DDDD: parsePARAM_VALUE: '%s'\n", fieldbuf);
+
+	CHKmalloc(pNew = realloc(*ppArr, newMax * lenEntry));
+	*ppArr = pNew;
+	*pMax = newMax;
+finalize_it:
 	RETiRet;
 }
 
 
-static rsRetVal
-parseSD_NAME(uchar *sdbuf, int lenbuf, int *curridx, uchar *namebuf)
+/* SD-NAME as of RFC5424: up to 32 printable chars except '=', ' ', ']', '"' */
+static inline int
+scanSD_NAME(const uchar *const sdbuf, const int lenbuf, int i)
 {
-	int i, j;
-	DEFiRet;
-dbgprintf("DDDD: parseSD_NAME %s\n", sdbuf+*curridx);
-	i = *curridx;
-	for(j = 0 ; i < lenbuf && j < 32; ++j) {
-		if(   sdbuf[i] == '=' || sdbuf[i] == '"'
-		   || sdbuf[i] == ']' || sdbuf[i] == ' ')
-			break;
-		namebuf[j] = tolower(sdbuf[i]);
+	const int iStart = i;
+	while(   i < lenbuf && i - iStart < 32
+	      && sdbuf[i] != '=' && sdbuf[i] != '"'
+	      && sdbuf[i] != ']' && sdbuf[i] != ' ')
 		++i;
-	}
-	namebuf[j] = '\0';
-dbgprintf("DDDD: parseSD_NAME, NAME: '%s'\n", namebuf);
-	*curridx = i;
-	RETiRet;
+	return i;
 }
 
 
 static inline rsRetVal
-parseSD_PARAM(instanceData *pData, uchar *sdbuf, int lenbuf, int *curridx, struct json_object *jroot)
+indexSD_PARAM(sdIndex_t *const idx, const uchar *const sdbuf, const int lenbuf, int *const curridx)
 {
+	sdParam_t *param;
 	int i;
-	uchar pName[33];
-	uchar pVal[32*1024];
-	struct json_object *jval;
 	DEFiRet;
-dbgprintf("DDDD: parseSD_PARAM %s\n", sdbuf+*curridx);
-	
+
+	if(idx->nParams == idx->maxParams)
+		CHKiRet(growIndex((void**) &idx->params, &idx->maxParams, sizeof(sdParam_t)));
+	param = idx->params + idx->nParams;
+
 	i = *curridx;
-	CHKiRet(parseSD_NAME(sdbuf, lenbuf, &i, pName));
-	if(sdbuf[i] != '=') {
+	param->nameOff = i;
+	i = scanSD_NAME(sdbuf, lenbuf, i);
+	param->nameLen = i - param->nameOff;
+	if(i + 1 >= lenbuf || sdbuf[i] != '=' || sdbuf[i+1] != '"') {
 		ABORT_FINALIZE(RS_RET_STRUC_DATA_INVLD);
 	}
-	++i;
-	if(sdbuf[i] != '"') {
-		ABORT_FINALIZE(RS_RET_STRUC_DATA_INVLD);
+	i += 2;
+	param->valOff = i;
+	param->bEscaped = 0;
+	while(i < lenbuf && sdbuf[i] != '"') {
+		if(sdbuf[i] == '\\') {
+			param->bEscaped = 1;
+			++i;
+		}
+		++i;
 	}
-	++i;
-	CHKiRet(parsePARAM_VALUE(sdbuf, lenbuf, &i, pVal));
-	if(sdbuf[i] != '"') {
+	if(i >= lenbuf) {
 		ABORT_FINALIZE(RS_RET_STRUC_DATA_INVLD);
 	}
-	++i;
-
-	jval = json_object_new_string((char*)pVal);
-	json_object_object_add(jroot, (char*)pName, jval);
-
+	param->valLen = i - param->valOff;
+	++i; /* eat '"' */
+	++idx->nParams;
 	*curridx = i;
 finalize_it:
 	RETiRet;
@@ -265,23 +337,24 @@ finalize_it:
 
 
 static inline rsRetVal
-parseSD_ELEMENT(instanceData *pData, uchar *sdbuf, int lenbuf, int *curridx, struct json_object *jroot)
+indexSD_ELEMENT(sdIndex_t *const idx, const uchar *const sdbuf, const int lenbuf, int *const curridx)
 {
+	sdElem_t *elem;
 	int i;
-	uchar sd_id[33];
-	struct json_object *json;
 	DEFiRet;
-dbgprintf("DDDD: parseSD_ELEMENT: %s\n", sdbuf+*curridx);
-	
+
 	i = *curridx;
 	if(sdbuf[i] != '[') {
 		ABORT_FINALIZE(RS_RET_STRUC_DATA_INVLD);
 	}
 	++i; /* eat '[' */
-
-	CHKiRet(parseSD_NAME(sdbuf, lenbuf, &i, sd_id));
-	json =  json_object_new_object();
-
+	if(idx->nElems == idx->maxElems)
+		CHKiRet(growIndex((void**) &idx->elems, &idx->maxElems, sizeof(sdElem_t)));
+	elem = idx->elems + idx->nElems;
+	elem->idOff = i;
+	i = scanSD_NAME(sdbuf, lenbuf, i);
+	elem->idLen = i - elem->idOff;
+	elem->firstParam = idx->nParams;
 	while(i < lenbuf) {
 		if(sdbuf[i] == ']') {
 			break;
@@ -291,69 +364,179 @@ dbgprintf("DDDD: parseSD_ELEMENT: %s\n", sdbuf+*curridx);
 		++i;
 		while(i < lenbuf && sdbuf[i] == ' ')
 			++i;
-		CHKiRet(parseSD_PARAM(pData, sdbuf, lenbuf, &i, json));
-dbgprintf("DDDD: done parseSD_PARAM, in loop, i:%d, lenbuf:%d, rest: %s\n", i, lenbuf, sdbuf+i);
+		CHKiRet(indexSD_PARAM(idx, sdbuf, lenbuf, &i));
 	}
-
-	if(sdbuf[i] != ']') {
-		DBGPRINTF("mmpstrucdata: SD-ELEMENT does not terminate with "
-		          "']': '%s'\n", sdbuf+i);
+	if(i >= lenbuf) {
+		DBGPRINTF("mmpstrucdata: SD-ELEMENT does not terminate with ']'\n");
 		ABORT_FINALIZE(RS_RET_STRUC_DATA_INVLD);
 	}
 	++i; /* eat ']' */
+	elem->nParams = idx->nParams - elem->firstParam;
+	++idx->nElems;
 	*curridx = i;
-	json_object_object_add(jroot, (char*)sd_id, json);
-dbgprintf("DDDD: SD_ELEMENT: json: '%s'\n", json_object_get_string(json));
-dbgprintf("DDDD: SD_ELEMENT: jroot '%s'\n", json_object_get_string(json));
 finalize_it:
-dbgprintf("DDDD: parseSD_ELEMENT iRet:%d, i:%d, *curridx:%d\n", iRet, i, *curridx);
 	RETiRet;
 }
 
+
+static rsRetVal
+indexSD(sdIndex_t *const idx, const uchar *const sdbuf, const int lenbuf)
+{
+	int i = 0;
+	DEFiRet;
+
+	idx->nElems = 0;
+	idx->nParams = 0;
+	while(i < lenbuf) {
+		CHKiRet(indexSD_ELEMENT(idx, sdbuf, lenbuf, &i));
+	}
+finalize_it:
+	RETiRet;
+}
+
+
+/* copy a name, lower-cased, into namebuf (size 33) */
+static inline uchar *
+getLowerName(const uchar *const sdbuf, const int off, const int len, uchar *const namebuf)
+{
+	int j;
+	for(j = 0 ; j < len ; ++j)
+		namebuf[j] = tolower(sdbuf[off+j]);
+	namebuf[j] = '\0';
+	return namebuf;
+}
+
+
+/* create the json string for a param value, unescaping it if needed */
+static rsRetVal
+getParamValue(wrkrInstanceData_t *const pWrkrData, const uchar *const sdbuf,
+	const sdParam_t *const param, struct json_object **const pjval)
+{
+	const uchar *const val = sdbuf + param->valOff;
+	uchar *pNew;
+	int i, j;
+	DEFiRet;
+
+	if(!param->bEscaped) {
+		*pjval = json_object_new_string_len((char*)val, param->valLen);
+		FINALIZE;
+	}
+
+	/* an escaped value never grows */
+	if(param->valLen > pWrkrData->lenValbuf) {
+		CHKmalloc(pNew = realloc(pWrkrData->valbuf, param->valLen));
+		pWrkrData->valbuf = pNew;
+		pWrkrData->lenValbuf = param->valLen;
+	}
+	for(i = j = 0 ; i < param->valLen ; ++i) {
+		if(val[i] == '\\' && i + 1 < param->valLen
+		   && (val[i+1] == '"' || val[i+1] == '\\' || val[i+1] == ']')) {
+			++i;
+		}
+		pWrkrData->valbuf[j++] = val[i];
+	}
+	*pjval = json_object_new_string_len((char*)pWrkrData->valbuf, j);
+finalize_it:
+	RETiRet;
+}
+
+
+/* check if the param of an SD-ELEMENT with selection state selElem
+ * shall be added to the json tree.
+ */
+static inline int
+isParamSelected(instanceData *const pData, const int selElem, const uchar *const sd_id,
+	const uchar *const name)
+{
+	int i;
+
+	if(selElem == SEL_ELEM_ALL)
+		return 1;
+	for(i = 0 ; i < pData->nSel ; ++i) {
+		if(   pData->sel[i].param != NULL
+		   && !strcmp((char*)pData->sel[i].param, (char*)name)
+		   && !strcmp((char*)pData->sel[i].id, (char*)sd_id))
+			return 1;
+	}
+	return 0;
+}
+
+
+static inline int
+getElemSelection(instanceData *const pData, const uchar *const sd_id)
+{
+	int i;
+	int sel = SEL_ELEM_NONE;
+
+	if(pData->sel == NULL)
+		return SEL_ELEM_ALL;
+	for(i = 0 ; i < pData->nSel ; ++i) {
+		if(!strcmp((char*)pData->sel[i].id, (char*)sd_id)) {
+			if(pData->sel[i].param == NULL)
+				return SEL_ELEM_ALL;
+			sel = SEL_ELEM_PARAMS;
+		}
+	}
+	return sel;
+}
+
+
 static inline rsRetVal
-parse_sd(instanceData *pData, msg_t *pMsg)
+parse_sd(wrkrInstanceData_t *const pWrkrData, msg_t *const pMsg)
 {
-#if 0
-	uchar fieldbuf[32*1024];
-	uchar fieldname[512];
-	struct json_object *json;
-	struct json_object *jval;
-	int field;
-	uchar *buf;
-#endif
-	struct json_object *json, *jroot;
+	instanceData *const pData = pWrkrData->pData;
+	sdIndex_t *const idx = &pWrkrData->idx;
+	struct json_object *json = NULL, *jroot, *jelem, *jval;
+	const sdElem_t *elem;
+	const sdParam_t *param;
 	uchar *sdbuf;
+	uchar sd_id[33];
+	uchar name[33];
 	int lenbuf;
-	int i = 0;
+	int selElem;
+	int i, j;
 	DEFiRet;
 
-#if 0
-	if(lenMsg < (int) sizeof(fieldbuf)) {
-		buf = fieldbuf;
-	} else {
-		CHKmalloc(buf = malloc(lenMsg+1));
+	MsgGetStructuredData(pMsg, &sdbuf,&lenbuf);
+	if(lenbuf == 1 && sdbuf[0] == '-') {
+		DBGPRINTF("mmpstrucdata: message does not have structured data\n");
+		FINALIZE;
 	}
-#endif
+	CHKiRet(indexSD(idx, sdbuf, lenbuf));
 
-dbgprintf("DDDD: parse_sd\n");
 	json =  json_object_new_object();
 	if(json == NULL) {
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
-	MsgGetStructuredData(pMsg, &sdbuf,&lenbuf);
-	while(i < lenbuf) {
-		CHKiRet(parseSD_ELEMENT(pData, sdbuf, lenbuf, &i, json));
-dbgprintf("DDDD: parse_sd, i:%d\n", i);
+	for(i = 0 ; i < idx->nElems ; ++i) {
+		elem = idx->elems + i;
+		getLowerName(sdbuf, elem->idOff, elem->idLen, sd_id);
+		if((selElem = getElemSelection(pData, sd_id)) == SEL_ELEM_NONE)
+			continue;
+		if((jelem = json_object_new_object()) == NULL) {
+			ABORT_FINALIZE(RS_RET_ERR);
+		}
+		json_object_object_add(json, (char*)sd_id, jelem);
+		for(j = 0 ; j < elem->nParams ; ++j) {
+			param = idx->params + elem->firstParam + j;
+			getLowerName(sdbuf, param->nameOff, param->nameLen, name);
+			if(!isParamSelected(pData, selElem, sd_id, name))
+				continue;
+			CHKiRet(getParamValue(pWrkrData, sdbuf, param, &jval));
+			json_object_object_add(jelem, (char*)name, jval);
+		}
 	}
-dbgprintf("DDDD: json: '%s'\n", json_object_get_string(json));
 
 	jroot =  json_object_new_object();
 	if(jroot == NULL) {
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
 	json_object_object_add(jroot, "rfc5424-sd", json);
+	json = NULL; /* now owned by jroot */
  	msgAddJSON(pMsg, pData->jsonRoot, jroot);
 finalize_it:
+	if(json != NULL)
+		json_object_put(json);
 	RETiRet;
 }
 
@@ -361,18 +544,15 @@ finalize_it:
 BEGINdoAction
 	msg_t *pMsg;
 CODESTARTdoAction
-dbgprintf("DDDD: enter mmpstrucdata\n");
 	pMsg = (msg_t*) ppString[0];
 	if(!MsgHasStructuredData(pMsg)) {
 		DBGPRINTF("mmpstrucdata: message does not have structured data\n");
 		FINALIZE;
 	}
-dbgprintf("DDDD: parse mmpstrucdata\n");
 	/* don't check return code - we never want rsyslog to retry
 	 * or suspend this action!
 	 */
-	parse_sd(pWrkrData->pData, pMsg);
-dbgprintf("DDDD: done parse mmpstrucdata\n");
+	parse_sd(pWrkrData, pMsg);
 finalize_it:
 ENDdoAction
 
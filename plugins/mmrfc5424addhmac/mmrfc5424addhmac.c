@@ -55,6 +55,11 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <openssl/hmac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/evp.h>
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
 #include "conf.h"
 #include "syslogd-types.h"
 #include "srUtils.h"
@@ -70,6 +75,36 @@ MODULE_CNFNAME("mmrfc5424addhmac")
 DEFobjCurrIf(errmsg);
 DEF_OMOD_STATIC_DATA
 
+/* HMAC_CTX is deprecated since openssl 3.0, where EVP_MAC replaces it. The
+ * older API is only used for versions that lack EVP_MAC.
+ */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX hmacCtx_t;
+#else
+typedef HMAC_CTX hmacCtx_t;
+#endif
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+/* older openssl versions have no opaque HMAC_CTX, provide the newer API */
+static inline HMAC_CTX *
+HMAC_CTX_new(void)
+{
+	HMAC_CTX *ctx;
+	if((ctx = malloc(sizeof(HMAC_CTX))) != NULL)
+		HMAC_CTX_init(ctx);
+	return ctx;
+}
+
+static inline void
+HMAC_CTX_free(HMAC_CTX *ctx)
+{
+	if(ctx != NULL) {
+		HMAC_CTX_cleanup(ctx);
+		free(ctx);
+	}
+}
+#endif
+
 /* config variables */
 
 typedef struct _instanceData {
@@ -78,10 +113,14 @@ typedef struct _instanceData {
 	uchar *sdid;	/* SD-ID to be used to persist the hmac */
 	int16_t sdidLen;
 	const EVP_MD *algo;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	EVP_MAC *mac;
+#endif
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	hmacCtx_t *ctx;	/* keyed once, reset to the keyed state for each message */
 } wrkrInstanceData_t;
 
 struct modConfData_s {
@@ -133,8 +172,89 @@ CODESTARTcreateInstance
 ENDcreateInstance
 
 
+/* The key setup (hashing the ipad and opad blocks) is done only once
+ * per worker. For each message, hmacCompute() starts from a copy of the
+ * keyed state (EVP_MAC) or restores it via HMAC_Init_ex() without key and
+ * digest (HMAC_CTX).
+ */
+static void
+hmacCtxFree(hmacCtx_t *ctx)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	EVP_MAC_CTX_free(ctx);
+#else
+	HMAC_CTX_free(ctx);
+#endif
+}
+
+static rsRetVal
+hmacCtxNew(instanceData *pData, hmacCtx_t **pCtx)
+{
+	hmacCtx_t *ctx = NULL;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	OSSL_PARAM params[2];
+#endif
+	DEFiRet;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	CHKmalloc(ctx = EVP_MAC_CTX_new(pData->mac));
+	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+						     (char*) EVP_MD_get0_name(pData->algo), 0);
+	params[1] = OSSL_PARAM_construct_end();
+	if(!EVP_MAC_init(ctx, pData->key, pData->keylen, params))
+		ABORT_FINALIZE(RS_RET_CRYPROV_ERR);
+#else
+	CHKmalloc(ctx = HMAC_CTX_new());
+	if(!HMAC_Init_ex(ctx, pData->key, pData->keylen, pData->algo, NULL))
+		ABORT_FINALIZE(RS_RET_CRYPROV_ERR);
+#endif
+	*pCtx = ctx;
+	ctx = NULL;
+
+finalize_it:
+	if(ctx != NULL)
+		hmacCtxFree(ctx);
+	RETiRet;
+}
+
+static rsRetVal
+hmacCompute(hmacCtx_t *ctx, uchar *buf, int len, uchar *hash, unsigned int *pHashlen)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	EVP_MAC_CTX *ctxMsg;
+	size_t hashlen;
+#endif
+	DEFiRet;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	CHKmalloc(ctxMsg = EVP_MAC_CTX_dup(ctx));
+	if(   !EVP_MAC_update(ctxMsg, buf, len)
+	   || !EVP_MAC_final(ctxMsg, hash, &hashlen, EVP_MAX_MD_SIZE)) {
+		EVP_MAC_CTX_free(ctxMsg);
+		ABORT_FINALIZE(RS_RET_CRYPROV_ERR);
+	}
+	EVP_MAC_CTX_free(ctxMsg);
+	*pHashlen = (unsigned int) hashlen;
+#else
+	if(   !HMAC_Init_ex(ctx, NULL, 0, NULL, NULL)
+	   || !HMAC_Update(ctx, buf, len)
+	   || !HMAC_Final(ctx, hash, pHashlen))
+		ABORT_FINALIZE(RS_RET_CRYPROV_ERR);
+#endif
+
+finalize_it:
+	RETiRet;
+}
+
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->ctx = NULL;
+	if(hmacCtxNew(pData, &pWrkrData->ctx) != RS_RET_OK) {
+		errmsg.LogError(0, RS_RET_CRYPROV_ERR, "mmrfc5424addhmac: "
+				"cannot initialize HMAC context");
+		ABORT_FINALIZE(RS_RET_CRYPROV_ERR);
+	}
+finalize_it:
 ENDcreateWrkrInstance
 
 
@@ -145,11 +265,18 @@ ENDisCompatibleWithFeature
 
 BEGINfreeInstance
 CODESTARTfreeInstance
+	free(pData->key);
+	free(pData->sdid);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	EVP_MAC_free(pData->mac);
+#endif
 ENDfreeInstance
 
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	if(pWrkrData->ctx != NULL)
+		hmacCtxFree(pWrkrData->ctx);
 ENDfreeWrkrInstance
 
 
@@ -157,6 +284,10 @@ static inline void
 setInstParamDefaults(instanceData *pData)
 {
 	pData->key = NULL;
+	pData->sdid = NULL;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	pData->mac = NULL;
+#endif
 }
 
 BEGINnewActInst
@@ -199,6 +330,13 @@ CODESTARTnewActInst
 			  "param '%s'\n", actpblk.descr[i].name);
 		}
 	}
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	if((pData->mac = EVP_MAC_fetch(NULL, "HMAC", NULL)) == NULL) {
+		errmsg.LogError(0, RS_RET_CRYPROV_ERR, "mmrfc5424addhmac: "
+				"HMAC not available in openssl - cannot continue");
+		ABORT_FINALIZE(RS_RET_CRYPROV_ERR);
+	}
+#endif
 
 CODE_STD_FINALIZERnewActInst
 	cnfparamvalsDestruct(pvals, &actpblk);
@@ -310,27 +448,32 @@ done:
 }
 
 static inline rsRetVal
-hashMsg(instanceData *pData, msg_t *pMsg)
+hashMsg(wrkrInstanceData_t *pWrkrData, msg_t *pMsg)
 {
+	instanceData *pData = pWrkrData->pData;
 	uchar *pRawMsg;
 	int lenRawMsg;
-	uchar *sdbuf;
-	rs_size_t sdlen;
 	unsigned int hashlen;
 	uchar hash[EVP_MAX_MD_SIZE];
 	uchar hashPrintable[2*EVP_MAX_MD_SIZE+1];
-	uchar newsd[64*1024];	/* we assume this is sufficient... */
+	uchar *newsd = NULL;
 	int lenNewsd;
 	DEFiRet;
 
-	MsgGetStructuredData(pMsg, &sdbuf, &sdlen);
 	getRawMsg(pMsg, &pRawMsg, &lenRawMsg);
- 	HMAC(pData->algo, pData->key, pData->keylen,
-	     pRawMsg, lenRawMsg, hash, &hashlen);
+	if(hmacCompute(pWrkrData->ctx, pRawMsg, lenRawMsg, hash, &hashlen) != RS_RET_OK) {
+		DBGPRINTF("mmrfc5424addhmac: error computing HMAC\n");
+		ABORT_FINALIZE(RS_RET_CRYPROV_ERR);
+	}
 	hexify(hash, hashlen, hashPrintable);
-	lenNewsd = snprintf((char*)newsd, sizeof(newsd), "[%s hash=\"%s\"]",
+	/* "[" sdid " hash=\"" hash "\"]" */
+	lenNewsd = pData->sdidLen + 2 * hashlen + 10;
+	CHKmalloc(newsd = malloc(lenNewsd + 1));
+	lenNewsd = snprintf((char*)newsd, lenNewsd + 1, "[%s hash=\"%s\"]",
 		            (char*)pData->sdid, (char*)hashPrintable);
 	MsgAddToStructuredData(pMsg, newsd, lenNewsd);
+finalize_it:
+	free(newsd);
 	RETiRet;
 }
 
@@ -342,7 +485,7 @@ CODESTARTdoAction
 	pMsg = (msg_t*) ppString[0];
 	if(   msgGetProtocolVersion(pMsg) == MSG_RFC5424_PROTOCOL
 	   && !isHmacPresent(pData, pMsg)) {
-		hashMsg(pData, pMsg);
+		hashMsg(pWrkrData, pMsg);
 	} else {
 		if(Debug) {
 			uchar *pRawMsg;
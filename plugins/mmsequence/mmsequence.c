@@ -43,7 +43,8 @@
 #include "template.h"
 #include "module-template.h"
 #include "errmsg.h"
-#include "hashtable.h"
+#include "hashmap.h"
+#include "atomic.h"
 
 #define JSON_VAR_NAME "$!mmsequence"
 
@@ -70,6 +71,7 @@ typedef struct _instanceData {
 	int step;
 	unsigned int seed;
 	int value;
+	int *pCounter;	/* counter in key mode, shared by all instances with this key */
 	char *pszKey;
 	char *pszVar;
 } instanceData;
@@ -101,11 +103,14 @@ static struct cnfparamblk actpblk =
 	  actpdescr
 	};
 
-/* table for key-counter pairs */	
-static struct hashtable *ght;
+/* table for key-counter pairs. As the key is fixed per instance, it is
+ * only accessed when the config is loaded; at runtime each instance
+ * directly works on its counter.
+ */
+static hashmap_t *ght;
 static pthread_mutex_t ght_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-static pthread_mutex_t inst_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t mutCounter; /* only used if we have no atomic builtins */
 	
 BEGINbeginCnfLoad
 CODESTARTbeginCnfLoad
@@ -165,6 +170,40 @@ setInstParamDefaults(instanceData *pData)
 	pData->pszVar = JSON_VAR_NAME;
 }
 
+static int *
+getCounter(hashmap_t *ht, char *str, int initial) {
+	int *pCounter;
+	char *pStr;
+
+	pCounter = hashmapSearch(ht, str);
+	if(pCounter) {
+		return pCounter;
+	}
+
+	/* counter is not found for the str, so add new entry and
+	   return the counter */
+	if(NULL == (pStr = strdup(str))) {
+		DBGPRINTF("mmsequence: memory allocation for key failed\n");
+		return NULL;
+	}
+
+	if(NULL == (pCounter = (int*)malloc(sizeof(*pCounter)))) {
+		DBGPRINTF("mmsequence: memory allocation for value failed\n");
+		free(pStr);
+		return NULL;
+	}
+	*pCounter = initial;
+
+	if(hashmapInsert(ht, pStr, pCounter) != RS_RET_OK) {
+		DBGPRINTF("mmsequence: inserting element into hashtable failed\n");
+		free(pStr);
+		free(pCounter);
+		return NULL;
+	}
+	return pCounter;
+}
+
+
 BEGINnewActInst
 	struct cnfparamvals *pvals;
 	int i;
@@ -251,13 +290,20 @@ CODESTARTnewActInst
 			ABORT_FINALIZE(RS_RET_ERR);
 		}
 		if (ght == NULL) {
-			if(NULL == (ght = create_hashtable(100, hash_from_string, key_equals_string, NULL))) {
+			if(hashmapConstruct(&ght, 100, 0, hashmapHashString, hashmapKeyEqualsString,
+					    free, NULL) != RS_RET_OK) {
 				pthread_mutex_unlock(&ght_mutex);
 				DBGPRINTF("mmsequence: error creating hash table!\n");
 				ABORT_FINALIZE(RS_RET_ERR);
 			}
 		}
+		pData->pCounter = getCounter(ght, pData->pszKey, pData->valueTo);
 		pthread_mutex_unlock(&ght_mutex);
+		if(pData->pCounter == NULL) {
+			errmsg.LogError(0, RS_RET_NOT_FOUND,
+					"mmsequence: unable to fetch the counter from hash");
+			ABORT_FINALIZE(RS_RET_NOT_FOUND);
+		}
 		break;
 	default:
 		errmsg.LogError(0, RS_RET_INVLD_MODE,
@@ -278,37 +324,24 @@ BEGINtryResume
 CODESTARTtryResume
 ENDtryResume
 
-static int *
-getCounter(struct hashtable *ht, char *str, int initial) {
-	int *pCounter;
-	char *pStr;
-
-	pCounter = hashtable_search(ht, str);
-	if(pCounter) {
-		return pCounter;
-	}
-
-	/* counter is not found for the str, so add new entry and
-	   return the counter */
-	if(NULL == (pStr = strdup(str))) {
-		DBGPRINTF("mmsequence: memory allocation for key failed\n");
-		return NULL;
-	}
-
-	if(NULL == (pCounter = (int*)malloc(sizeof(*pCounter)))) {
-		DBGPRINTF("mmsequence: memory allocation for value failed\n");
-		free(pStr);
-		return NULL;
-	}
-	*pCounter = initial;
+/* advance a counter by step, wrapping around at valueTo. This is done
+ * lock-free, so that many workers can share the counter.
+ */
+static inline int
+nextValue(instanceData *pData, int *pCounter)
+{
+	int oldVal, newVal;
 
-	if(!hashtable_insert(ht, pStr, pCounter)) {
-		DBGPRINTF("mmsequence: inserting element into hashtable failed\n");
-		free(pStr);
-		free(pCounter);
-		return NULL;
-	}
-	return pCounter;
+	do {
+		oldVal = (int) ATOMIC_FETCH_32BIT(pCounter, &mutCounter);
+		if (oldVal >= pData->valueTo - pData->step
+				|| oldVal < pData->valueFrom ) {
+			newVal = pData->valueFrom;
+		} else {
+			newVal = oldVal + pData->step;
+		}
+	} while(!ATOMIC_CAS(pCounter, oldVal, newVal, &mutCounter));
+	return newVal;
 }
 
 
@@ -316,7 +349,6 @@ BEGINdoAction
 	msg_t *pMsg;
 	struct json_object *json;
 	int val = 0;
-	int *pCounter;
 	instanceData *pData;
 CODESTARTdoAction
 	pData = pWrkrData->pData;
@@ -328,40 +360,10 @@ CODESTARTdoAction
 				(pData->valueTo - pData->valueFrom));
 		break;
 	case mmSequencePerInstance:
-		if (!pthread_mutex_lock(&inst_mutex)) {
-			if (pData->value >= pData->valueTo - pData->step) {
-				pData->value = pData->valueFrom;
-			} else {
-				pData->value += pData->step;
-			}
-			val = pData->value;
-			pthread_mutex_unlock(&inst_mutex);
-		} else {
-			errmsg.LogError(0, RS_RET_ERR,
-					"mmsequence: mutex lock has failed!");
-		}
+		val = nextValue(pData, &pData->value);
 		break;
 	case mmSequencePerKey:
-		if (!pthread_mutex_lock(&ght_mutex)) {
-			pCounter = getCounter(ght, pData->pszKey, pData->valueTo);
-			if(pCounter) {
-				if (*pCounter >= pData->valueTo - pData->step
-						|| *pCounter < pData->valueFrom ) {
-					*pCounter = pData->valueFrom;
-				} else {
-					*pCounter += pData->step;
-				}
-				val = *pCounter;
-			} else {
-				errmsg.LogError(0, RS_RET_NOT_FOUND,
-						"mmsequence: unable to fetch the counter from hash");
-			}
-			pthread_mutex_unlock(&ght_mutex);
-		} else {
-			errmsg.LogError(0, RS_RET_ERR,
-					"mmsequence: mutex lock has failed!");
-		}
-		
+		val = nextValue(pData, pData->pCounter);
 		break;
 	default:
 		errmsg.LogError(0, RS_RET_NOT_IMPLEMENTED,
@@ -397,6 +399,7 @@ ENDparseSelectorAct
 BEGINmodExit
 CODESTARTmodExit
 	objRelease(errmsg, CORE_COMPONENT);
+	DESTROY_ATOMIC_HELPER_MUT(mutCounter);
 ENDmodExit
 
 
@@ -416,4 +419,5 @@ CODESTARTmodInit
 CODEmodInit_QueryRegCFSLineHdlr
 	DBGPRINTF("mmsequence: module compiled with rsyslog version %s.\n", VERSION);
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	INIT_ATOMIC_HELPER_MUT(mutCounter);
 ENDmodInit
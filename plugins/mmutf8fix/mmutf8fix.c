@@ -205,6 +205,33 @@ doCC(instanceData *pData, uchar *msg, int lenMsg)
 	}
 }
 
+/* US-ASCII is by far the most frequent case. So we check for it 32 bytes
+ * at a time (four 64-bit words, done in plain C so that it works on all
+ * platforms) and run only the non-ASCII parts through the UTF-8 state
+ * machine in doUTF8(). Returns the index of the first block that contains
+ * a non-ASCII byte, or of the remaining bytes at the end of the message.
+ */
+#define NON_ASCII_MASK 0x8080808080808080ULL
+static inline int
+skipASCII(const uchar *msg, int lenMsg, int i)
+{
+	uint64_t v[4];
+
+	while(i + (int) sizeof(v) <= lenMsg) {
+		memcpy(v, msg + i, sizeof(v));
+		if((v[0] | v[1] | v[2] | v[3]) & NON_ASCII_MASK)
+			break;
+		i += sizeof(v);
+	}
+	while(i + (int) sizeof(v[0]) <= lenMsg) {
+		memcpy(v, msg + i, sizeof(v[0]));
+		if(v[0] & NON_ASCII_MASK)
+			break;
+		i += sizeof(v[0]);
+	}
+	return i;
+}
+
 /* fix an invalid multibyte sequence */
 static inline void
 fixInvldMBSeq(instanceData *pData, uchar *msg, int lenMsg, int strtIdx, int *endIdx, int8_t seqLen)
@@ -225,6 +252,7 @@ doUTF8(instanceData *pData, uchar *msg, int lenMsg)
 	int8_t seqLen, bytesLeft = 0;
 	uint32_t codepoint;
 	int strtIdx, endIdx;
+	sbool bSkipASCII = 1;
 	int i;
 
 	for(i = 0 ; i < lenMsg ; ++i) {
@@ -250,9 +278,17 @@ doUTF8(instanceData *pData, uchar *msg, int lenMsg)
 			}
 		} else {
 			if((c & 0x80) == 0) {
-				/* 1-byte sequence, US-ASCII */
-				; /* nothing to do, all well */
-			} else if((c & 0xe0) == 0xc0) {
+				/* 1-byte sequence, US-ASCII. If it is the first one
+				 * after non-ASCII data, quickly skip all that follow.
+				 */
+				if(bSkipASCII) {
+					i = skipASCII(msg, lenMsg, i + 1) - 1;
+					bSkipASCII = 0;
+				}
+				continue;
+			}
+			bSkipASCII = 1;
+			if((c & 0xe0) == 0xc0) {
 				/* 2-byte sequence */
 				/* 0xc0 and 0xc1 are illegal */
 				if(c == 0xc0 || c == 0xc1) {
@@ -292,7 +328,7 @@ BEGINdoAction
 CODESTARTdoAction
 	pMsg = (msg_t*) ppString[0];
 	lenMsg = getMSGLen(pMsg);
-	msg = getMSG(pMsg);
+	msg = getMSGForWrite(pMsg);
 	if(pWrkrData->pData->mode == MODE_CC) {
 		doCC(pWrkrData->pData, msg, lenMsg);
 	} else {
@@ -30,6 +30,7 @@
 #include <string.h>
 #include <curl/curl.h>
 #include <curl/easy.h>
+#include <curl/multi.h>
 #include <assert.h>
 #include <signal.h>
 #include <errno.h>
@@ -47,6 +48,7 @@
 #include "statsobj.h"
 #include "cfsysline.h"
 #include "unicode-helper.h"
+#include "zlibw.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -56,22 +58,62 @@ MODULE_CNFNAME("omelasticsearch")
 DEF_OMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
 DEFobjCurrIf(statsobj)
+DEFobjCurrIf(zlibw)
+
+static sbool bZlibwLoaded = 0;
 
 statsobj_t *indexStats;
 STATSCOUNTER_DEF(indexSubmit, mutIndexSubmit)
 STATSCOUNTER_DEF(indexHTTPFail, mutIndexHTTPFail)
 STATSCOUNTER_DEF(indexHTTPReqFail, mutIndexHTTPReqFail)
 STATSCOUNTER_DEF(indexESFail, mutIndexESFail)
+STATSCOUNTER_DEF(indexRetry, mutIndexRetry)
+/* bulk mode item results, by status */
+STATSCOUNTER_DEF(indexRespSuccess, mutIndexRespSuccess)
+STATSCOUNTER_DEF(indexRespConflict, mutIndexRespConflict)
+STATSCOUNTER_DEF(indexRespBad, mutIndexRespBad)
+STATSCOUNTER_DEF(indexRespBulkRejection, mutIndexRespBulkRejection)
+STATSCOUNTER_DEF(indexRespUnavailable, mutIndexRespUnavailable)
+STATSCOUNTER_DEF(indexRespOther, mutIndexRespOther)
 
 /* REST API for elasticsearch hits this URL:
  * http://<hostName>:<restPort>/<searchIndex>/<searchType>
  */
 typedef struct curl_slist HEADER;
+
+/* request body compression (Content-Encoding) */
+#define ES_CMPR_NONE	0
+#define ES_CMPR_GZIP	1
+#define ES_CMPR_DEFLATE	2
+
+#define DFLT_SERVER_EJECT_TIME	30
+
+/* state of a server, shared by all workers. Requests are balanced
+ * round-robin over the healthy servers; a server that fails is ejected
+ * for server.ejecttime seconds and probed before it is used again.
+ */
+typedef struct esServer_s {
+	time_t ttEjectedUntil;	/* unhealthy, not selected before then; 0 if healthy */
+	statsobj_t *stats;
+	STATSCOUNTER_DEF(ctrRequests, mutCtrRequests)
+	STATSCOUNTER_DEF(ctrFailed, mutCtrFailed)
+	STATSCOUNTER_DEF(ctrEjected, mutCtrEjected)
+} esServer_t;
+
 typedef struct _instanceData {
 	int port;
 	int fdErrFile;		/* error file fd or -1 if not open */
 	pthread_mutex_t mutErrFile;
-	uchar *server;
+	uchar **servers;
+	int numServers;
+	esServer_t *srvState;	/* numServers entries */
+	int ejectTime;		/* seconds a failed server is not used */
+	unsigned iNextWrkr;	/* start server of the next worker, spreads the load */
+	pthread_mutex_t mutSrv;	/* guards srvState[].ttEjectedUntil and iNextWrkr */
+	int maxInflight;	/* bulk requests in flight per worker, 0 - not pipelined */
+	size_t maxBytes;	/* max size of a bulk request, 0 - unlimited */
+	int compression;	/* ES_CMPR_* */
+	int compressionLevel;
 	uchar *uid;
 	uchar *pwd;
 	uchar *searchIndex;
@@ -88,13 +130,45 @@ typedef struct _instanceData {
 	sbool bulkmode;
 	sbool asyncRepl;
         sbool useHttps;
+	int iNumTpls;		/* number of templates per message, for commitBatch() */
 } instanceData;
 
+/* pipelined mode: each worker has maxInflight request slots. A slot with
+ * ES_REQ_RETRY state holds a request that failed (completely or for some
+ * of its items) and is sent again before new data is accepted. So memory
+ * is bounded and, if no slot is free and nothing is in flight, the action
+ * is suspended until the servers are usable again.
+ */
+#define ES_REQ_FREE	0
+#define ES_REQ_INFLIGHT	1
+#define ES_REQ_RETRY	2
+#define ES_MAX_ITEM_RETRIES	5	/* items rejected by ES with 429/5xx */
+#define ES_DRAIN_TIMEOUT	10	/* seconds to wait for outstanding requests on shutdown */
+
+typedef struct esReq_s {
+	CURL *curl;
+	int state;
+	char *body;		/* bulk request data, NULL if slot is free */
+	size_t lenBody;
+	uchar *cmprBody;	/* compressed body as sent, if compression is on */
+	size_t lenCmprBody;
+	int nmemb;		/* number of messages in body */
+	int nTries;		/* number of times items were rejected by ES */
+	int iServer;		/* server of the current request */
+	uchar *url;		/* URL used for the current request, not owned */
+	char *reply;
+	int replyLen;
+} esReq_t;
+
 typedef struct wrkrInstanceData {
 	instanceData *pData;
 	int replyLen;
 	char *reply;
-	CURL	*curlHandle;	/* libcurl session handle */
+	CURL	*curlHandle;	/* libcurl session handle of the current server */
+	CURL	**srvCurl;	/* one keep-alive handle per server */
+	int iServer;		/* current server */
+	int iURLServer;		/* server restURL was built for, -1 if none */
+	unsigned iNextServer;	/* round-robin over servers */
 	HEADER	*postHeader;	/* json POST request info */
 	uchar *restURL;		/* last used URL for error reporting */
 	struct {
@@ -102,15 +176,25 @@ typedef struct wrkrInstanceData {
 		int nmemb;	/* number of messages in batch (for statistics counting) */
 		uchar *currTpl1;
 		uchar *currTpl2;
+		es_str_t *retry;	/* items ES asked us to send again, NULL if none */
+		int nRetry;
+		sbool bMayRetry;	/* may items be retried after the current request? */
 	} batch;
+	struct {
+		CURLM *multi;
+		esReq_t *reqs;		/* maxInflight slots, NULL if not pipelined */
+		int nInflight;
+		uchar **urls;		/* bulk URL for each server */
+	} pipeline;
 } wrkrInstanceData_t;
 
 
 /* tables for interfacing with the v6 config system */
 /* action (instance) parameters */
 static struct cnfparamdescr actpdescr[] = {
-	{ "server", eCmdHdlrGetWord, 0 },
+	{ "server", eCmdHdlrArray, 0 },
 	{ "serverport", eCmdHdlrInt, 0 },
+	{ "server.ejecttime", eCmdHdlrInt, 0 },
 	{ "uid", eCmdHdlrGetWord, 0 },
 	{ "pwd", eCmdHdlrGetWord, 0 },
 	{ "searchindex", eCmdHdlrGetWord, 0 },
@@ -127,6 +211,10 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "template", eCmdHdlrGetWord, 0 },
 	{ "dynbulkid", eCmdHdlrBinary, 0 },
 	{ "bulkid", eCmdHdlrGetWord, 0 },
+	{ "pipeline.maxinflight", eCmdHdlrInt, 0 },
+	{ "maxbytes", eCmdHdlrSize, 0 },
+	{ "compression", eCmdHdlrGetWord, 0 },
+	{ "compression.level", eCmdHdlrInt, 0 },
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -135,17 +223,26 @@ static struct cnfparamblk actpblk =
 	};
 
 static rsRetVal curlSetup(wrkrInstanceData_t *pWrkrData, instanceData *pData);
+static void setCurlKeepAlive(CURL *handle);
+static rsRetVal pipelineSetup(wrkrInstanceData_t *pWrkrData, instanceData *pData);
+static void pipelineDestruct(wrkrInstanceData_t *pWrkrData);
+static rsRetVal submitBatch(wrkrInstanceData_t *pWrkrData);
 
 BEGINcreateInstance
 CODESTARTcreateInstance
 	pData->fdErrFile = -1;
 	pthread_mutex_init(&pData->mutErrFile, NULL);
+	pthread_mutex_init(&pData->mutSrv, NULL);
 ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
 dbgprintf("omelasticsearch: createWrkrInstance\n");
 	pWrkrData->restURL = NULL;
+	pWrkrData->iURLServer = -1;
+	pthread_mutex_lock(&pData->mutSrv);
+	pWrkrData->iNextServer = pData->iNextWrkr++;
+	pthread_mutex_unlock(&pData->mutSrv);
 	if(pData->bulkmode) {
 		pWrkrData->batch.currTpl1 = NULL;
 		pWrkrData->batch.currTpl2 = NULL;
@@ -156,6 +253,8 @@ dbgprintf("omelasticsearch: createWrkrInstance\n");
 		}
 	}
 	CHKiRet(curlSetup(pWrkrData, pWrkrData->pData));
+	if(pData->bulkmode && pData->maxInflight > 0)
+		CHKiRet(pipelineSetup(pWrkrData, pData));
 finalize_it:
 dbgprintf("DDDD: createWrkrInstance,pData %p/%p, pWrkrData %p\n", pData, pWrkrData->pData, pWrkrData);
 ENDcreateWrkrInstance
@@ -167,11 +266,22 @@ CODESTARTisCompatibleWithFeature
 ENDisCompatibleWithFeature
 
 BEGINfreeInstance
+	int i;
 CODESTARTfreeInstance
 	if(pData->fdErrFile != -1)
 		close(pData->fdErrFile);
 	pthread_mutex_destroy(&pData->mutErrFile);
-	free(pData->server);
+	pthread_mutex_destroy(&pData->mutSrv);
+	if(pData->srvState != NULL) {
+		for(i = 0 ; i < pData->numServers ; ++i) {
+			if(pData->srvState[i].stats != NULL)
+				statsobj.Destruct(&pData->srvState[i].stats);
+		}
+		free(pData->srvState);
+	}
+	for(i = 0 ; i < pData->numServers ; ++i)
+		free(pData->servers[i]);
+	free(pData->servers);
 	free(pData->uid);
 	free(pData->pwd);
 	free(pData->searchIndex);
@@ -184,24 +294,34 @@ CODESTARTfreeInstance
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
+	int i;
 CODESTARTfreeWrkrInstance
+	pipelineDestruct(pWrkrData);
+	if(pWrkrData->srvCurl != NULL) {
+		for(i = 0 ; i < pWrkrData->pData->numServers ; ++i) {
+			if(pWrkrData->srvCurl[i] != NULL)
+				curl_easy_cleanup(pWrkrData->srvCurl[i]);
+		}
+		free(pWrkrData->srvCurl);
+		pWrkrData->srvCurl = NULL;
+	}
+	pWrkrData->curlHandle = NULL;
 	if(pWrkrData->postHeader) {
 		curl_slist_free_all(pWrkrData->postHeader);
 		pWrkrData->postHeader = NULL;
 	}
-	if(pWrkrData->curlHandle) {
-		curl_easy_cleanup(pWrkrData->curlHandle);
-		pWrkrData->curlHandle = NULL;
-	}
 	free(pWrkrData->restURL);
 ENDfreeWrkrInstance
 
 BEGINdbgPrintInstInfo
+	int i;
 CODESTARTdbgPrintInstInfo
 	dbgprintf("omelasticsearch\n");
 	dbgprintf("\ttemplate='%s'\n", pData->tplName);
-	dbgprintf("\tserver='%s'\n", pData->server);
+	for(i = 0 ; i < pData->numServers ; ++i)
+		dbgprintf("\tserver='%s'\n", pData->servers[i]);
 	dbgprintf("\tserverport=%d\n", pData->port);
+	dbgprintf("\tserver.ejecttime=%d\n", pData->ejectTime);
 	dbgprintf("\tuid='%s'\n", pData->uid == NULL ? (uchar*)"(not configured)" : pData->uid);
 	dbgprintf("\tpwd=(%sconfigured)\n", pData->pwd == NULL ? "not " : "");
 	dbgprintf("\tsearch index='%s'\n", pData->searchIndex);
@@ -214,6 +334,9 @@ CODESTARTdbgPrintInstInfo
 	dbgprintf("\tasync replication=%d\n", pData->asyncRepl);
         dbgprintf("\tuse https=%d\n", pData->useHttps);
 	dbgprintf("\tbulkmode=%d\n", pData->bulkmode);
+	dbgprintf("\tpipeline.maxinflight=%d\n", pData->maxInflight);
+	dbgprintf("\tmaxbytes=%lld\n", (long long) pData->maxBytes);
+	dbgprintf("\tcompression=%d, level %d\n", pData->compression, pData->compressionLevel);
 	dbgprintf("\terrorfile='%s'\n", pData->errorFile == NULL ?
 		(uchar*)"(not configured)" : pData->errorFile);
 	dbgprintf("\tdynbulkid=%d\n", pData->dynBulkId);
@@ -226,7 +349,7 @@ ENDdbgPrintInstInfo
  * Newly creates an estr for this purpose.
  */
 static rsRetVal
-setBaseURL(instanceData *pData, es_str_t **url)
+setBaseURL(instanceData *pData, int iServer, es_str_t **url)
 {
 	char portBuf[64];
 	int r;
@@ -240,7 +363,8 @@ setBaseURL(instanceData *pData, es_str_t **url)
 	else {
 		r = es_addBuf(url, "http://", sizeof("http://")-1);
 	}
-	if(r == 0) r = es_addBuf(url, (char*)pData->server, strlen((char*)pData->server));
+	if(r == 0) r = es_addBuf(url, (char*)pData->servers[iServer],
+				 strlen((char*)pData->servers[iServer]));
 	if(r == 0) r = es_addChar(url, ':');
 	if(r == 0) r = es_addBuf(url, portBuf, strlen(portBuf));
 	if(r == 0) r = es_addChar(url, '/');
@@ -249,7 +373,7 @@ setBaseURL(instanceData *pData, es_str_t **url)
 
 
 static inline rsRetVal
-checkConn(wrkrInstanceData_t *pWrkrData)
+checkConn(wrkrInstanceData_t *pWrkrData, int iServer)
 {
 	es_str_t *url;
 	CURL *curl = NULL;
@@ -257,7 +381,7 @@ checkConn(wrkrInstanceData_t *pWrkrData)
 	char *cstr;
 	DEFiRet;
 
-	setBaseURL(pWrkrData->pData, &url);
+	setBaseURL(pWrkrData->pData, iServer, &url);
 	curl = curl_easy_init();
 	if(curl == NULL) {
 		DBGPRINTF("omelasticsearch: checkConn() curl_easy_init() failed\n");
@@ -292,10 +416,117 @@ finalize_it:
 }
 
 
+/* CODE FOR THE SERVER POOL */
+
+/* take a failed server out of rotation for server.ejecttime seconds */
+static void
+ejectServer(instanceData *const pData, const int iServer)
+{
+	esServer_t *const pSrv = &pData->srvState[iServer];
+	sbool bWasHealthy;
+
+	STATSCOUNTER_INC(pSrv->ctrFailed, pSrv->mutCtrFailed);
+	pthread_mutex_lock(&pData->mutSrv);
+	bWasHealthy = (pSrv->ttEjectedUntil == 0);
+	pSrv->ttEjectedUntil = time(NULL) + pData->ejectTime;
+	pthread_mutex_unlock(&pData->mutSrv);
+	if(bWasHealthy) {
+		STATSCOUNTER_INC(pSrv->ctrEjected, pSrv->mutCtrEjected);
+		errmsg.LogError(0, RS_RET_SUSPENDED, "omelasticsearch: server %s:%d failed, "
+				"not used for %d seconds", pData->servers[iServer],
+				pData->port, pData->ejectTime);
+	}
+}
+
+
+/* put a server back into rotation after it was probed successfully */
+static void
+restoreServer(instanceData *const pData, const int iServer)
+{
+	esServer_t *const pSrv = &pData->srvState[iServer];
+	sbool bWasEjected;
+
+	pthread_mutex_lock(&pData->mutSrv);
+	bWasEjected = (pSrv->ttEjectedUntil != 0);
+	pSrv->ttEjectedUntil = 0;
+	pthread_mutex_unlock(&pData->mutSrv);
+	if(bWasEjected) {
+		errmsg.LogError(0, NO_ERRCODE, "omelasticsearch: server %s:%d is "
+				"usable again", pData->servers[iServer], pData->port);
+	}
+}
+
+
+/* check if a server may be used. Once its ejection time is over, the first
+ * worker to notice probes it; the others skip it until the result is known,
+ * as the probe pushes the ejection time forward.
+ */
+static int
+serverUsable(wrkrInstanceData_t *const pWrkrData, const int iServer)
+{
+	instanceData *const pData = pWrkrData->pData;
+	esServer_t *const pSrv = &pData->srvState[iServer];
+	time_t ttNow;
+	int bUsable;
+	int bProbe = 0;
+
+	pthread_mutex_lock(&pData->mutSrv);
+	bUsable = (pSrv->ttEjectedUntil == 0);
+	if(!bUsable) {
+		ttNow = time(NULL);
+		if(pSrv->ttEjectedUntil <= ttNow) {
+			pSrv->ttEjectedUntil = ttNow + pData->ejectTime;
+			bProbe = 1;
+		}
+	}
+	pthread_mutex_unlock(&pData->mutSrv);
+
+	if(bProbe) {
+		if(checkConn(pWrkrData, iServer) == RS_RET_OK) {
+			restoreServer(pData, iServer);
+			bUsable = 1;
+		} else {
+			DBGPRINTF("omelasticsearch: server %s still fails\n",
+				  pData->servers[iServer]);
+		}
+	}
+	return bUsable;
+}
+
+
+/* select the next usable server, round-robin. Returns -1 if there is none. */
+static int
+selectServer(wrkrInstanceData_t *const pWrkrData)
+{
+	const int numServers = pWrkrData->pData->numServers;
+	int iServer;
+	int i;
+
+	for(i = 0 ; i < numServers ; ++i) {
+		iServer = pWrkrData->iNextServer++ % numServers;
+		if(serverUsable(pWrkrData, iServer))
+			return iServer;
+	}
+	return -1;
+}
+
+
+/* we can resume if any of the servers responds. Ejected servers are probed
+ * as well, so that a single-server setup does not wait for the ejection
+ * time to pass.
+ */
 BEGINtryResume
+	int i;
 CODESTARTtryResume
 	DBGPRINTF("omelasticsearch: tryResume called\n");
-	iRet = checkConn(pWrkrData);
+	iRet = RS_RET_SUSPENDED;
+	for(i = 0 ; i < pWrkrData->pData->numServers ; ++i) {
+		if(checkConn(pWrkrData, i) == RS_RET_OK) {
+			restoreServer(pWrkrData->pData, i);
+			iRet = RS_RET_OK;
+			break;
+		}
+	}
 ENDtryResume
 
 
@@ -367,20 +598,19 @@ getIndexTypeAndParent(instanceData *pData, uchar **tpls,
 }
 
 
+/* build the REST URL for the given server. The caller must free it. */
 static rsRetVal
-setCurlURL(wrkrInstanceData_t *pWrkrData, instanceData *pData, uchar **tpls)
+buildURL(instanceData *pData, int iServer, uchar **tpls, uchar **ppURL)
 {
-	char authBuf[1024];
 	uchar *searchIndex;
 	uchar *searchType;
 	uchar *parent;
 	uchar *bulkId;
 	es_str_t *url;
-	int rLocal;
 	int r;
 	DEFiRet;
 
-	setBaseURL(pData, &url);
+	setBaseURL(pData, iServer, &url);
 
 	if(pData->bulkmode) {
 		r = es_addBuf(&url, "_bulk", sizeof("_bulk")-1);
@@ -405,12 +635,26 @@ setCurlURL(wrkrInstanceData_t *pWrkrData, instanceData *pData, uchar **tpls)
 		if(r == 0) r = es_addBuf(&url, "parent=", sizeof("parent=")-1);
 		if(r == 0) r = es_addBuf(&url, (char*)parent, ustrlen(parent));
 	}
+	if(r != 0) {
+		es_deleteStr(url);
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
 
-	free(pWrkrData->restURL);
-	pWrkrData->restURL = (uchar*)es_str2cstr(url, NULL);
-	curl_easy_setopt(pWrkrData->curlHandle, CURLOPT_URL, pWrkrData->restURL);
+	*ppURL = (uchar*)es_str2cstr(url, NULL);
 	es_deleteStr(url);
-	DBGPRINTF("omelasticsearch: using REST URL: '%s'\n", pWrkrData->restURL);
+	if(*ppURL == NULL)
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal
+setCurlAuth(CURL *curl, instanceData *pData)
+{
+	char authBuf[1024];
+	int rLocal;
+	DEFiRet;
 
 	if(pData->uid != NULL) {
 		rLocal = snprintf(authBuf, sizeof(authBuf), "%s:%s", pData->uid,
@@ -421,14 +665,31 @@ setCurlURL(wrkrInstanceData_t *pWrkrData, instanceData *pData, uchar **tpls)
 				rLocal);
 			ABORT_FINALIZE(RS_RET_ERR);
 		}
-		curl_easy_setopt(pWrkrData->curlHandle, CURLOPT_USERPWD, authBuf);
-		curl_easy_setopt(pWrkrData->curlHandle, CURLOPT_PROXYAUTH, CURLAUTH_ANY);
+		curl_easy_setopt(curl, CURLOPT_USERPWD, authBuf);
+		curl_easy_setopt(curl, CURLOPT_PROXYAUTH, CURLAUTH_ANY);
 	}
 finalize_it:
 	RETiRet;
 }
 
 
+static rsRetVal
+setCurlURL(wrkrInstanceData_t *pWrkrData, instanceData *pData, uchar **tpls)
+{
+	DEFiRet;
+
+	free(pWrkrData->restURL);
+	pWrkrData->restURL = NULL;
+	CHKiRet(buildURL(pData, pWrkrData->iServer, tpls, &pWrkrData->restURL));
+	pWrkrData->iURLServer = pWrkrData->iServer;
+	curl_easy_setopt(pWrkrData->curlHandle, CURLOPT_URL, pWrkrData->restURL);
+	DBGPRINTF("omelasticsearch: using REST URL: '%s'\n", pWrkrData->restURL);
+	CHKiRet(setCurlAuth(pWrkrData->curlHandle, pData));
+finalize_it:
+	RETiRet;
+}
+
+
 /* this method does not directly submit but builds a batch instead. It
  * may submit, if we have dynamic index/type and the current type or
  * index changes.
@@ -442,6 +703,7 @@ buildBatch(wrkrInstanceData_t *pWrkrData, uchar *message, uchar **tpls)
 	uchar *searchType;
 	uchar *parent;
 	uchar *bulkId = NULL;
+	size_t lenItem;
 	DEFiRet;
 #	define META_STRT "{\"index\":{\"_index\": \""
 #	define META_TYPE "\",\"_type\":\""
@@ -450,6 +712,27 @@ buildBatch(wrkrInstanceData_t *pWrkrData, uchar *message, uchar **tpls)
 #	define META_END  "\"}}\n"
 
 	getIndexTypeAndParent(pWrkrData->pData, tpls, &searchIndex, &searchType, &parent, &bulkId);
+
+	/* if this item would make the request too large, send what we have so far.
+	 * A single item larger than maxbytes is sent on its own.
+	 */
+	if(pWrkrData->pData->maxBytes > 0 && pWrkrData->batch.nmemb > 0) {
+		lenItem = sizeof(META_STRT)-1 + ustrlen(searchIndex) + sizeof(META_TYPE)-1
+			+ ustrlen(searchType) + sizeof(META_END)-1 + length + 1;
+		if(parent != NULL)
+			lenItem += sizeof(META_PARENT)-1 + ustrlen(parent);
+		if(bulkId != NULL)
+			lenItem += sizeof(META_ID)-1 + ustrlen(bulkId);
+		if(es_strlen(pWrkrData->batch.data) + lenItem > pWrkrData->pData->maxBytes) {
+			DBGPRINTF("omelasticsearch: batch reached maxbytes, submitting %d "
+				  "messages\n", pWrkrData->batch.nmemb);
+			CHKiRet(submitBatch(pWrkrData));
+			es_emptyStr(pWrkrData->batch.data);
+			pWrkrData->batch.nmemb = 0;
+			iRet = RS_RET_PREVIOUS_COMMITTED;
+		}
+	}
+
 	r = es_addBuf(&pWrkrData->batch.data, META_STRT, sizeof(META_STRT)-1);
 	if(r == 0) r = es_addBuf(&pWrkrData->batch.data, (char*)searchIndex,
 				 ustrlen(searchIndex));
@@ -472,7 +755,8 @@ buildBatch(wrkrInstanceData_t *pWrkrData, uchar *message, uchar **tpls)
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
 	++pWrkrData->batch.nmemb;
-	iRet = RS_RET_DEFER_COMMIT;
+	if(iRet != RS_RET_PREVIOUS_COMMITTED)
+		iRet = RS_RET_DEFER_COMMIT;
 
 finalize_it:
 	RETiRet;
@@ -484,7 +768,7 @@ finalize_it:
  * needs to be closed, HUP must be sent.
  */
 static inline rsRetVal
-writeDataError(wrkrInstanceData_t *pWrkrData, instanceData *pData, cJSON **pReplyRoot, uchar *reqmsg)
+writeDataError(uchar *restURL, instanceData *pData, cJSON **pReplyRoot, uchar *reqmsg)
 {
 	char *rendered = NULL;
 	cJSON *errRoot;
@@ -516,7 +800,7 @@ writeDataError(wrkrInstanceData_t *pWrkrData, instanceData *pData, cJSON **pRepl
 		}
 	}
 	if((req=cJSON_CreateObject()) == NULL) ABORT_FINALIZE(RS_RET_ERR);
-	cJSON_AddItemToObject(req, "url", cJSON_CreateString((char*)pWrkrData->restURL));
+	cJSON_AddItemToObject(req, "url", cJSON_CreateString((char*)restURL));
 	cJSON_AddItemToObject(req, "postdata", cJSON_CreateString((char*)reqmsg));
 
 	if((errRoot=cJSON_CreateObject()) == NULL) ABORT_FINALIZE(RS_RET_ERR);
@@ -544,48 +828,288 @@ finalize_it:
 }
 
 
-static inline rsRetVal
-checkResultBulkmode(wrkrInstanceData_t *pWrkrData, cJSON *root)
+/* Bulk replies are not parsed into a cJSON tree: for large batches that
+ * tree is several times the size of the reply, while all we need is the
+ * status of each entry of "items". So the reply text is scanned once and
+ * each entry is looked at as we come across it. The full tree is only
+ * built if something needs to go to the error file.
+ */
+static inline const char *
+jsonSkipWs(const char *p)
 {
-	int i;
-	int numitems;
-	cJSON *items;
-	cJSON *item;
-	cJSON *create;
-	cJSON *ok;
+	while(*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+		++p;
+	return p;
+}
+
+
+/* p points to the opening quote, returns the position after the closing one */
+static const char *
+jsonSkipString(const char *p)
+{
+	for(++p ; *p != '"' ; ++p) {
+		if(*p == '\0')
+			return NULL;
+		if(*p == '\\' && *++p == '\0')
+			return NULL;
+	}
+	return p + 1;
+}
+
+
+/* skip a value of any type, including nested objects and arrays */
+static const char *
+jsonSkipValue(const char *p)
+{
+	int depth = 0;
+
+	if(*p == '"')
+		return jsonSkipString(p);
+	if(*p != '{' && *p != '[') { /* number or literal */
+		while(*p != '\0' && *p != ',' && *p != '}' && *p != ']'
+		      && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+			++p;
+		return p;
+	}
+	while(1) {
+		switch(*p) {
+		case '\0':
+			return NULL;
+		case '"':
+			if((p = jsonSkipString(p)) == NULL)
+				return NULL;
+			continue;
+		case '{':
+		case '[':
+			++depth;
+			break;
+		case '}':
+		case ']':
+			if(--depth == 0)
+				return p + 1;
+			break;
+		default:
+			break;
+		}
+		++p;
+	}
+}
+
+
+/* read a member name and the colon. On return, *pp points to the value. */
+static rsRetVal
+jsonReadKey(const char **pp, const char **pKey, int *pLenKey)
+{
+	const char *p = *pp;
+	const char *pEnd;
 	DEFiRet;
 
-	items = cJSON_GetObjectItem(root, "items");
-	if(items == NULL || items->type != cJSON_Array) {
-		DBGPRINTF("omelasticsearch: error in elasticsearch reply: "
-			  "bulkmode insert does not return array, reply is: %s\n",
-			  pWrkrData->reply);
+	if(*p != '"' || (pEnd = jsonSkipString(p)) == NULL)
 		ABORT_FINALIZE(RS_RET_DATAFAIL);
-	}
-	numitems = cJSON_GetArraySize(items);
-DBGPRINTF("omelasticsearch: %d items in reply\n", numitems);
-	for(i = 0 ; i < numitems ; ++i) {
-		item = cJSON_GetArrayItem(items, i);
-		if(item == NULL)  {
-			DBGPRINTF("omelasticsearch: error in elasticsearch reply: "
-				  "cannot obtain reply array item %d\n", i);
+	*pKey = p + 1;
+	*pLenKey = pEnd - p - 2;
+	p = jsonSkipWs(pEnd);
+	if(*p != ':')
+		ABORT_FINALIZE(RS_RET_DATAFAIL);
+	*pp = jsonSkipWs(p + 1);
+finalize_it:
+	RETiRet;
+}
+
+#define JSON_KEY_IS(key, lenKey, name) \
+	((lenKey) == sizeof(name)-1 && !strncmp((key), (name), sizeof(name)-1))
+
+
+/* skip the remaining members of an object, *pp must point behind a value */
+static rsRetVal
+jsonSkipMembers(const char **pp)
+{
+	const char *p = jsonSkipWs(*pp);
+	const char *key;
+	int lenKey;
+	DEFiRet;
+
+	while(*p == ',') {
+		p = jsonSkipWs(p + 1);
+		CHKiRet(jsonReadKey(&p, &key, &lenKey));
+		if((p = jsonSkipValue(p)) == NULL)
 			ABORT_FINALIZE(RS_RET_DATAFAIL);
+		p = jsonSkipWs(p);
+	}
+	if(*p != '}')
+		ABORT_FINALIZE(RS_RET_DATAFAIL);
+	*pp = p + 1;
+finalize_it:
+	RETiRet;
+}
+
+
+/* position *pp just behind the '[' of the top-level "items" array */
+static rsRetVal
+bulkReplyFindItems(const char **pp)
+{
+	const char *p = jsonSkipWs(*pp);
+	const char *key;
+	int lenKey;
+	DEFiRet;
+
+	if(*p != '{')
+		ABORT_FINALIZE(RS_RET_DATAFAIL);
+	p = jsonSkipWs(p + 1);
+	while(*p == '"') {
+		CHKiRet(jsonReadKey(&p, &key, &lenKey));
+		if(JSON_KEY_IS(key, lenKey, "items") && *p == '[') {
+			*pp = p + 1;
+			FINALIZE;
 		}
-		create = cJSON_GetObjectItem(item, "create");
-		if(create == NULL || create->type != cJSON_Object) {
-			DBGPRINTF("omelasticsearch: error in elasticsearch reply: "
-				  "cannot obtain 'create' item for #%d\n", i);
+		if((p = jsonSkipValue(p)) == NULL)
 			ABORT_FINALIZE(RS_RET_DATAFAIL);
+		p = jsonSkipWs(p);
+		if(*p == ',')
+			p = jsonSkipWs(p + 1);
+	}
+	DBGPRINTF("omelasticsearch: error in elasticsearch reply: "
+		  "bulkmode insert does not return array\n");
+	ABORT_FINALIZE(RS_RET_DATAFAIL);
+finalize_it:
+	RETiRet;
+}
+
+
+/* read the next entry of the "items" array, which looks like
+ * {"index":{..., "status":201, ...}}. *pStatus is 0 if there is no status
+ * (ES before 1.0, which has "ok" instead). Returns RS_RET_NO_MORE_DATA at
+ * the end of the array.
+ */
+static rsRetVal
+bulkReplyNextItem(const char **pp, int *pStatus, sbool *pbFailed)
+{
+	const char *p = jsonSkipWs(*pp);
+	const char *key;
+	int lenKey;
+	int status = 0;
+	sbool bOk = 0;
+	sbool bError = 0;
+	DEFiRet;
+
+	if(*p == ',')
+		p = jsonSkipWs(p + 1);
+	if(*p == ']') {
+		*pp = p + 1;
+		ABORT_FINALIZE(RS_RET_NO_MORE_DATA);
+	}
+	if(*p != '{')
+		ABORT_FINALIZE(RS_RET_DATAFAIL);
+	p = jsonSkipWs(p + 1);
+	CHKiRet(jsonReadKey(&p, &key, &lenKey)); /* "index", "create", ... */
+	if(*p != '{')
+		ABORT_FINALIZE(RS_RET_DATAFAIL);
+	p = jsonSkipWs(p + 1);
+	while(*p == '"') {
+		CHKiRet(jsonReadKey(&p, &key, &lenKey));
+		if(JSON_KEY_IS(key, lenKey, "status")) {
+			status = atoi(p);
+		} else if(JSON_KEY_IS(key, lenKey, "ok")) {
+			bOk = !strncmp(p, "true", 4);
+		} else if(JSON_KEY_IS(key, lenKey, "error")) {
+			bError = strncmp(p, "null", 4) && strncmp(p, "false", 5);
 		}
-		ok = cJSON_GetObjectItem(create, "ok");
-		if(ok == NULL || ok->type != cJSON_True) {
+		if((p = jsonSkipValue(p)) == NULL)
+			ABORT_FINALIZE(RS_RET_DATAFAIL);
+		p = jsonSkipWs(p);
+		if(*p == ',')
+			p = jsonSkipWs(p + 1);
+	}
+	if(*p != '}')
+		ABORT_FINALIZE(RS_RET_DATAFAIL);
+	++p;
+	CHKiRet(jsonSkipMembers(&p));
+
+	*pp = p;
+	*pStatus = status;
+	*pbFailed = bError || ((status == 0) ? !bOk : (status < 200 || status >= 300));
+finalize_it:
+	RETiRet;
+}
+
+
+static inline void
+countItemStatus(const int status, const sbool bFailed)
+{
+	if(!bFailed) {
+		STATSCOUNTER_INC(indexRespSuccess, mutIndexRespSuccess);
+	} else if(status == 409) {
+		STATSCOUNTER_INC(indexRespConflict, mutIndexRespConflict);
+	} else if(status == 429) {
+		STATSCOUNTER_INC(indexRespBulkRejection, mutIndexRespBulkRejection);
+	} else if(status == 503) {
+		STATSCOUNTER_INC(indexRespUnavailable, mutIndexRespUnavailable);
+	} else if(status >= 400 && status < 500) {
+		STATSCOUNTER_INC(indexRespBad, mutIndexRespBad);
+	} else {
+		STATSCOUNTER_INC(indexRespOther, mutIndexRespOther);
+	}
+}
+
+
+/* Check a bulk reply against the request body (two lines per item). Items
+ * that failed with a temporary error (429, 503) are collected into
+ * *ppRetry if bMayRetry is set. Returns RS_RET_DATAFAIL if any other item
+ * failed or the reply could not be understood; in the latter case nothing
+ * is selected for retry.
+ */
+static rsRetVal
+checkBulkReply(const char *reply, const char *body, const sbool bMayRetry,
+	       es_str_t **ppRetry, int *pnRetry)
+{
+	const char *p = reply;
+	const char *pItem = body;
+	const char *pEnd;
+	int status;
+	sbool bFailed;
+	sbool bErr = 0;
+	int numitems = 0;
+	DEFiRet;
+
+	*ppRetry = NULL;
+	*pnRetry = 0;
+	if(reply == NULL)
+		ABORT_FINALIZE(RS_RET_DATAFAIL);
+	CHKiRet(bulkReplyFindItems(&p));
+	while(*pItem != '\0') {
+		if(bulkReplyNextItem(&p, &status, &bFailed) != RS_RET_OK) {
 			DBGPRINTF("omelasticsearch: error in elasticsearch reply: "
-				  "item %d, prop ok (%p) not ok\n", i, ok);
+				  "cannot obtain reply array item %d\n", numitems);
 			ABORT_FINALIZE(RS_RET_DATAFAIL);
 		}
+		++numitems;
+		if((pEnd = strchr(pItem, '\n')) != NULL)
+			pEnd = strchr(pEnd + 1, '\n');
+		pEnd = (pEnd == NULL) ? pItem + strlen(pItem) : pEnd + 1;
+		countItemStatus(status, bFailed);
+		if(bFailed && bMayRetry && (status == 429 || status == 503)) {
+			if(*ppRetry == NULL)
+				CHKmalloc(*ppRetry = es_newStr(pEnd - pItem));
+			if(es_addBuf(ppRetry, (char*) pItem, pEnd - pItem) != 0)
+				ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+			++*pnRetry;
+		} else if(bFailed) {
+			DBGPRINTF("omelasticsearch: item %d failed with status %d\n",
+				  numitems - 1, status);
+			bErr = 1;
+		}
+		pItem = pEnd;
 	}
+	DBGPRINTF("omelasticsearch: %d items in reply, %d to be retried\n", numitems, *pnRetry);
+	if(bErr)
+		iRet = RS_RET_DATAFAIL;
 
 finalize_it:
+	if(iRet != RS_RET_OK && !bErr && *ppRetry != NULL) {
+		es_deleteStr(*ppRetry);
+		*ppRetry = NULL;
+		*pnRetry = 0;
+	}
 	RETiRet;
 }
 
@@ -593,19 +1117,22 @@ finalize_it:
 static inline rsRetVal
 checkResult(wrkrInstanceData_t *pWrkrData, uchar *reqmsg)
 {
-	cJSON *root;
+	cJSON *root = NULL;
 	cJSON *ok;
 	DEFiRet;
 
-	root = cJSON_Parse(pWrkrData->reply);
-	if(root == NULL) {
-		DBGPRINTF("omelasticsearch: could not parse JSON result \n");
-		ABORT_FINALIZE(RS_RET_ERR);
-	}
-
 	if(pWrkrData->pData->bulkmode) {
-		iRet = checkResultBulkmode(pWrkrData, root);
+		iRet = checkBulkReply(pWrkrData->reply, (char*) reqmsg, pWrkrData->batch.bMayRetry,
+				      &pWrkrData->batch.retry, &pWrkrData->batch.nRetry);
+		/* the error file needs the reply as JSON */
+		if(iRet == RS_RET_DATAFAIL && (root = cJSON_Parse(pWrkrData->reply)) == NULL)
+			root = cJSON_CreateString((pWrkrData->reply == NULL) ? "" : pWrkrData->reply);
 	} else {
+		root = cJSON_Parse(pWrkrData->reply);
+		if(root == NULL) {
+			DBGPRINTF("omelasticsearch: could not parse JSON result \n");
+			ABORT_FINALIZE(RS_RET_ERR);
+		}
 		ok = cJSON_GetObjectItem(root, "ok");
 		if(ok == NULL || ok->type != cJSON_True) {
 			iRet = RS_RET_DATAFAIL;
@@ -617,7 +1144,7 @@ checkResult(wrkrInstanceData_t *pWrkrData, uchar *reqmsg)
 	 */
 	if(iRet == RS_RET_DATAFAIL) {
 		STATSCOUNTER_INC(indexESFail, mutIndexESFail);
-		writeDataError(pWrkrData, pWrkrData->pData, &root, reqmsg);
+		writeDataError(pWrkrData->restURL, pWrkrData->pData, &root, reqmsg);
 		iRet = RS_RET_OK; /* we have handled the problem! */
 	}
 
@@ -631,36 +1158,126 @@ finalize_it:
 }
 
 
+/* compress a request body in one go, in gzip or zlib ("deflate") format as
+ * required for the Content-Encoding. The caller must free *ppOut.
+ */
+static rsRetVal
+compressBody(instanceData *pData, const char *data, size_t len, uchar **ppOut, size_t *pLenOut)
+{
+	z_stream zstrm;
+	uchar *out = NULL;
+	size_t lenOut;
+	int zRet;
+	DEFiRet;
+
+	/* worst case expansion as in zlib's compressBound(), plus gzip header/trailer */
+	lenOut = len + (len >> 12) + (len >> 14) + (len >> 25) + 13 + 18;
+	CHKmalloc(out = malloc(lenOut));
+	memset(&zstrm, 0, sizeof(zstrm));
+	zRet = zlibw.DeflateInit2(&zstrm, pData->compressionLevel, Z_DEFLATED,
+		(pData->compression == ES_CMPR_GZIP) ? 31 : 15, 8, Z_DEFAULT_STRATEGY);
+	if(zRet != Z_OK) {
+		DBGPRINTF("omelasticsearch: error %d returned from zlib/deflateInit2()\n", zRet);
+		ABORT_FINALIZE(RS_RET_ZLIB_ERR);
+	}
+	zstrm.next_in = (Bytef*) data;
+	zstrm.avail_in = len;
+	zstrm.next_out = out;
+	zstrm.avail_out = lenOut;
+	zRet = zlibw.Deflate(&zstrm, Z_FINISH);
+	zlibw.DeflateEnd(&zstrm);
+	if(zRet != Z_STREAM_END) {
+		DBGPRINTF("omelasticsearch: error %d returned from zlib/deflate()\n", zRet);
+		ABORT_FINALIZE(RS_RET_ZLIB_ERR);
+	}
+	DBGPRINTF("omelasticsearch: request body compressed from %lld to %lld bytes\n",
+		  (long long) len, (long long) zstrm.total_out);
+	*ppOut = out;
+	*pLenOut = zstrm.total_out;
+	out = NULL;
+
+finalize_it:
+	free(out);
+	RETiRet;
+}
+
+
+/* pick the next usable server and make its handle the current one. The
+ * URL only needs to be set if it is dynamic or the handle is new to it.
+ */
+static rsRetVal
+useServer(wrkrInstanceData_t *pWrkrData, uchar **tpls)
+{
+	instanceData *const pData = pWrkrData->pData;
+	int iServer;
+	DEFiRet;
+
+	if((iServer = selectServer(pWrkrData)) == -1) {
+		DBGPRINTF("omelasticsearch: no usable server left\n");
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	pWrkrData->iServer = iServer;
+	pWrkrData->curlHandle = pWrkrData->srvCurl[iServer];
+	if(pData->dynSrchIdx || pData->dynSrchType || pData->dynParent
+	   || pWrkrData->iURLServer != iServer)
+		CHKiRet(setCurlURL(pWrkrData, pData, tpls));
+finalize_it:
+	RETiRet;
+}
+
+
+/* post a request. If the server cannot be reached, it is ejected and the
+ * request goes to the next one; we suspend only if none is left.
+ */
 static rsRetVal
 curlPost(wrkrInstanceData_t *pWrkrData, uchar *message, int msglen, uchar **tpls, int nmsgs)
 {
 	CURLcode code;
-	CURL *curl = pWrkrData->curlHandle;
+	CURL *curl;
+	uchar *cmprBody = NULL;
+	size_t lenCmpr;
+	sbool bDone = 0;
 	DEFiRet;
 
 	pWrkrData->reply = NULL;
-	pWrkrData->replyLen = 0;
-
-	if(pWrkrData->pData->dynSrchIdx || pWrkrData->pData->dynSrchType || pWrkrData->pData->dynParent)
-		CHKiRet(setCurlURL(pWrkrData, pWrkrData->pData, tpls));
-
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, pWrkrData);
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, (char *)message);
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, msglen);
-	code = curl_easy_perform(curl);
-	switch (code) {
-		case CURLE_COULDNT_RESOLVE_HOST:
-		case CURLE_COULDNT_RESOLVE_PROXY:
-		case CURLE_COULDNT_CONNECT:
-		case CURLE_WRITE_ERROR:
-			STATSCOUNTER_INC(indexHTTPReqFail, mutIndexHTTPReqFail);
-			indexHTTPFail += nmsgs;
-			DBGPRINTF("omelasticsearch: we are suspending ourselfs due "
-				  "to failure %lld of curl_easy_perform()\n",
-				  (long long) code);
-			ABORT_FINALIZE(RS_RET_SUSPENDED);
-		default:
-			break;
+	if(pWrkrData->pData->compression != ES_CMPR_NONE)
+		CHKiRet(compressBody(pWrkrData->pData, (char*) message, msglen, &cmprBody, &lenCmpr));
+
+	while(!bDone) {
+		CHKiRet(useServer(pWrkrData, tpls));
+		curl = pWrkrData->curlHandle;
+		pWrkrData->reply = NULL;
+		pWrkrData->replyLen = 0;
+
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, pWrkrData);
+		if(cmprBody != NULL) {
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDS, (char *)cmprBody);
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long) lenCmpr);
+		} else {
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDS, (char *)message);
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, msglen);
+		}
+		code = curl_easy_perform(curl);
+		STATSCOUNTER_INC(pWrkrData->pData->srvState[pWrkrData->iServer].ctrRequests,
+				 pWrkrData->pData->srvState[pWrkrData->iServer].mutCtrRequests);
+		switch (code) {
+			case CURLE_COULDNT_RESOLVE_HOST:
+			case CURLE_COULDNT_RESOLVE_PROXY:
+			case CURLE_COULDNT_CONNECT:
+			case CURLE_WRITE_ERROR:
+				STATSCOUNTER_INC(indexHTTPReqFail, mutIndexHTTPReqFail);
+				indexHTTPFail += nmsgs;
+				DBGPRINTF("omelasticsearch: failure %lld of curl_easy_perform() "
+					  "for server %s, trying next one\n",
+					  (long long) code, pWrkrData->pData->servers[pWrkrData->iServer]);
+				ejectServer(pWrkrData->pData, pWrkrData->iServer);
+				free(pWrkrData->reply);
+				pWrkrData->reply = NULL;
+				break;
+			default:
+				bDone = 1;
+				break;
+		}
 	}
 
 	DBGPRINTF("omelasticsearch: pWrkrData replyLen = '%d'\n", pWrkrData->replyLen);
@@ -671,10 +1288,380 @@ curlPost(wrkrInstanceData_t *pWrkrData, uchar *message, int msglen, uchar **tpls
 
 	CHKiRet(checkResult(pWrkrData, message));
 finalize_it:
+	free(cmprBody);
 	free(pWrkrData->reply);
+	pWrkrData->reply = NULL;
+	RETiRet;
+}
+
+/* CODE FOR PIPELINED MODE */
+
+/* append reply data received by curl; one extra byte is always reserved
+ * for the terminating NUL.
+ */
+static size_t
+addReplyData(char **ppReply, int *pReplyLen, char *p, size_t len)
+{
+	char *buf;
+	size_t newlen;
+
+	newlen = *pReplyLen + len;
+	if((buf = realloc(*ppReply, newlen + 1)) == NULL) {
+		DBGPRINTF("omelasticsearch: realloc failed in curlResult\n");
+		return 0; /* abort due to failure */
+	}
+	memcpy(buf + *pReplyLen, p, len);
+	*pReplyLen = newlen;
+	*ppReply = buf;
+	return len;
+}
+
+
+static size_t
+curlResultReq(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	esReq_t *pReq = (esReq_t*) userdata;
+	return addReplyData(&pReq->reply, &pReq->replyLen, (char*) ptr, size*nmemb);
+}
+
+
+static void
+pipelineFreeReq(esReq_t *pReq)
+{
+	free(pReq->body);
+	pReq->body = NULL;
+	free(pReq->cmprBody);
+	pReq->cmprBody = NULL;
+	free(pReq->reply);
+	pReq->reply = NULL;
+	pReq->state = ES_REQ_FREE;
+}
+
+
+/* check the bulk reply of a pipelined request. Items to be retried replace
+ * the request body, everything else that failed goes to the error file,
+ * as in non-pipelined mode.
+ */
+static void
+pipelineCheckReply(wrkrInstanceData_t *pWrkrData, esReq_t *pReq)
+{
+	cJSON *root;
+	es_str_t *retry;
+	int nRetry;
+
+	pReq->reply[pReq->replyLen] = '\0';
+	DBGPRINTF("omelasticsearch: pipelined reply: '%s'\n", pReq->reply);
+	if(checkBulkReply(pReq->reply, pReq->body, pReq->nTries < ES_MAX_ITEM_RETRIES,
+			  &retry, &nRetry) != RS_RET_OK) {
+		STATSCOUNTER_INC(indexESFail, mutIndexESFail);
+		if((root = cJSON_Parse(pReq->reply)) == NULL)
+			root = cJSON_CreateString(pReq->reply);
+		writeDataError(pReq->url, pWrkrData->pData, &root, (uchar*) pReq->body);
+		if(root != NULL)
+			cJSON_Delete(root);
+	}
+
+	pipelineFreeReq(pReq);
+	if(retry != NULL) {
+		pReq->body = es_str2cstr(retry, NULL);
+		pReq->lenBody = es_strlen(retry);
+		pReq->nmemb = nRetry;
+		++pReq->nTries;
+		indexRetry += nRetry;
+		es_deleteStr(retry);
+		if(pReq->body != NULL)
+			pReq->state = ES_REQ_RETRY;
+	}
+}
+
+
+/* process a request that curl has finished */
+static void
+pipelineReqDone(wrkrInstanceData_t *pWrkrData, esReq_t *pReq, CURLcode code)
+{
+	long httpStatus = 0;
+
+	if(code != CURLE_OK) {
+		STATSCOUNTER_INC(indexHTTPReqFail, mutIndexHTTPReqFail);
+		indexHTTPFail += pReq->nmemb;
+		DBGPRINTF("omelasticsearch: pipelined request to '%s' failed: %s\n",
+			  pReq->url, curl_easy_strerror(code));
+		ejectServer(pWrkrData->pData, pReq->iServer);
+		pReq->state = ES_REQ_RETRY;
+		free(pReq->reply);
+		pReq->reply = NULL;
+		return;
+	}
+
+	curl_easy_getinfo(pReq->curl, CURLINFO_RESPONSE_CODE, &httpStatus);
+	if(httpStatus == 429 || httpStatus >= 500 || pReq->reply == NULL) {
+		/* the whole request was rejected, try it again as is */
+		DBGPRINTF("omelasticsearch: pipelined request to '%s' returned "
+			  "HTTP status %ld\n", pReq->url, httpStatus);
+		STATSCOUNTER_INC(indexHTTPReqFail, mutIndexHTTPReqFail);
+		indexRetry += pReq->nmemb;
+		pReq->state = ES_REQ_RETRY;
+		free(pReq->reply);
+		pReq->reply = NULL;
+		return;
+	}
+	pipelineCheckReply(pWrkrData, pReq);
+}
+
+
+/* let curl do its work and handle all requests that completed */
+static void
+pipelineReap(wrkrInstanceData_t *pWrkrData)
+{
+	esReq_t *pReq;
+	CURLMsg *msg;
+	CURLcode code;
+	int nRunning;
+	int nLeft;
+
+	curl_multi_perform(pWrkrData->pipeline.multi, &nRunning);
+	while((msg = curl_multi_info_read(pWrkrData->pipeline.multi, &nLeft)) != NULL) {
+		if(msg->msg != CURLMSG_DONE)
+			continue;
+		code = msg->data.result; /* must be obtained before handle is removed */
+		curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**) &pReq);
+		curl_multi_remove_handle(pWrkrData->pipeline.multi, msg->easy_handle);
+		--pWrkrData->pipeline.nInflight;
+		pipelineReqDone(pWrkrData, pReq, code);
+	}
+}
+
+
+/* (re-)send the request in a slot to the next usable server */
+static rsRetVal
+pipelineSubmit(wrkrInstanceData_t *pWrkrData, esReq_t *pReq)
+{
+	instanceData *pData = pWrkrData->pData;
+	DEFiRet;
+
+	if((pReq->iServer = selectServer(pWrkrData)) == -1) {
+		pReq->state = ES_REQ_RETRY;
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	STATSCOUNTER_INC(pData->srvState[pReq->iServer].ctrRequests,
+			 pData->srvState[pReq->iServer].mutCtrRequests);
+	pReq->url = pWrkrData->pipeline.urls[pReq->iServer];
+	pReq->reply = NULL;
+	pReq->replyLen = 0;
+	curl_easy_setopt(pReq->curl, CURLOPT_URL, pReq->url);
+	if(pData->compression != ES_CMPR_NONE) {
+		/* the plain body is kept, as we need it to pick items for retry */
+		if(pReq->cmprBody == NULL) {
+			iRet = compressBody(pData, pReq->body, pReq->lenBody,
+					    &pReq->cmprBody, &pReq->lenCmprBody);
+			if(iRet != RS_RET_OK) {
+				pReq->state = ES_REQ_RETRY;
+				FINALIZE;
+			}
+		}
+		curl_easy_setopt(pReq->curl, CURLOPT_POSTFIELDS, pReq->cmprBody);
+		curl_easy_setopt(pReq->curl, CURLOPT_POSTFIELDSIZE, (long) pReq->lenCmprBody);
+	} else {
+		curl_easy_setopt(pReq->curl, CURLOPT_POSTFIELDS, pReq->body);
+		curl_easy_setopt(pReq->curl, CURLOPT_POSTFIELDSIZE, (long) pReq->lenBody);
+	}
+	if(curl_multi_add_handle(pWrkrData->pipeline.multi, pReq->curl) != CURLM_OK) {
+		DBGPRINTF("omelasticsearch: curl_multi_add_handle failed\n");
+		pReq->state = ES_REQ_RETRY;
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	pReq->state = ES_REQ_INFLIGHT;
+	++pWrkrData->pipeline.nInflight;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* obtain a free slot for a new request. Requests waiting for a retry are
+ * resent first. If all slots wait for a retry, the servers are obviously
+ * not usable and we suspend.
+ */
+static rsRetVal
+pipelineGetSlot(wrkrInstanceData_t *pWrkrData, esReq_t **ppReq)
+{
+	esReq_t *const reqs = pWrkrData->pipeline.reqs;
+	const int maxInflight = pWrkrData->pData->maxInflight;
+	int i;
+	DEFiRet;
+
+	pipelineReap(pWrkrData);
+	for(i = 0 ; i < maxInflight ; ++i) {
+		if(reqs[i].state == ES_REQ_RETRY)
+			pipelineSubmit(pWrkrData, &reqs[i]);
+	}
+
+	while(1) {
+		for(i = 0 ; i < maxInflight ; ++i) {
+			if(reqs[i].state == ES_REQ_FREE) {
+				*ppReq = &reqs[i];
+				FINALIZE;
+			}
+		}
+		if(pWrkrData->pipeline.nInflight == 0) {
+			DBGPRINTF("omelasticsearch: all pipelined requests wait for retry, "
+				  "suspending\n");
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+		curl_multi_wait(pWrkrData->pipeline.multi, NULL, 0, 1000, NULL);
+		pipelineReap(pWrkrData);
+	}
+
+finalize_it:
 	RETiRet;
 }
 
+
+/* hand over the current batch to the pipeline */
+static rsRetVal
+pipelinePost(wrkrInstanceData_t *pWrkrData)
+{
+	esReq_t *pReq;
+	DEFiRet;
+
+	if(pWrkrData->batch.nmemb == 0)
+		FINALIZE;
+	CHKiRet(pipelineGetSlot(pWrkrData, &pReq));
+	CHKmalloc(pReq->body = es_str2cstr(pWrkrData->batch.data, NULL));
+	pReq->lenBody = es_strlen(pWrkrData->batch.data);
+	pReq->nmemb = pWrkrData->batch.nmemb;
+	pReq->nTries = 0;
+	/* if this fails, the slot is in retry state and the data is still ours */
+	pipelineSubmit(pWrkrData, pReq);
+	pipelineReap(pWrkrData);
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal
+pipelineSetup(wrkrInstanceData_t *pWrkrData, instanceData *pData)
+{
+	esReq_t *pReq;
+	int i;
+	DEFiRet;
+
+	CHKmalloc(pWrkrData->pipeline.urls = calloc(pData->numServers, sizeof(uchar*)));
+	for(i = 0 ; i < pData->numServers ; ++i)
+		CHKiRet(buildURL(pData, i, NULL, &pWrkrData->pipeline.urls[i]));
+	CHKmalloc(pWrkrData->pipeline.multi = curl_multi_init());
+	CHKmalloc(pWrkrData->pipeline.reqs = calloc(pData->maxInflight, sizeof(esReq_t)));
+	for(i = 0 ; i < pData->maxInflight ; ++i) {
+		pReq = &pWrkrData->pipeline.reqs[i];
+		CHKmalloc(pReq->curl = curl_easy_init());
+		curl_easy_setopt(pReq->curl, CURLOPT_HTTPHEADER, pWrkrData->postHeader);
+		curl_easy_setopt(pReq->curl, CURLOPT_WRITEFUNCTION, curlResultReq);
+		curl_easy_setopt(pReq->curl, CURLOPT_WRITEDATA, pReq);
+		curl_easy_setopt(pReq->curl, CURLOPT_PRIVATE, pReq);
+		curl_easy_setopt(pReq->curl, CURLOPT_POST, 1);
+		setCurlKeepAlive(pReq->curl);
+		CHKiRet(setCurlAuth(pReq->curl, pData));
+	}
+	DBGPRINTF("omelasticsearch: pipelined mode, %d requests in flight, %d servers\n",
+		  pData->maxInflight, pData->numServers);
+
+finalize_it:
+	if(iRet != RS_RET_OK)
+		pipelineDestruct(pWrkrData);
+	RETiRet;
+}
+
+
+/* wait a while for outstanding requests to complete, then drop everything */
+static void
+pipelineDestruct(wrkrInstanceData_t *pWrkrData)
+{
+	esReq_t *pReq;
+	const time_t ttDeadline = time(NULL) + ES_DRAIN_TIMEOUT;
+	int nLost = 0;
+	int i;
+
+	if(pWrkrData->pipeline.reqs != NULL) {
+		while(pWrkrData->pipeline.nInflight > 0 && time(NULL) < ttDeadline) {
+			curl_multi_wait(pWrkrData->pipeline.multi, NULL, 0, 1000, NULL);
+			pipelineReap(pWrkrData);
+		}
+		for(i = 0 ; i < pWrkrData->pData->maxInflight ; ++i) {
+			pReq = &pWrkrData->pipeline.reqs[i];
+			if(pReq->state != ES_REQ_FREE)
+				nLost += pReq->nmemb;
+			if(pReq->state == ES_REQ_INFLIGHT)
+				curl_multi_remove_handle(pWrkrData->pipeline.multi, pReq->curl);
+			if(pReq->curl != NULL)
+				curl_easy_cleanup(pReq->curl);
+			pipelineFreeReq(pReq);
+		}
+		free(pWrkrData->pipeline.reqs);
+		pWrkrData->pipeline.reqs = NULL;
+		if(nLost > 0) {
+			errmsg.LogError(0, RS_RET_ERR, "omelasticsearch: %d messages could "
+				"not be delivered to elasticsearch before shutdown and are "
+				"lost", nLost);
+		}
+	}
+	if(pWrkrData->pipeline.multi != NULL) {
+		curl_multi_cleanup(pWrkrData->pipeline.multi);
+		pWrkrData->pipeline.multi = NULL;
+	}
+	if(pWrkrData->pipeline.urls != NULL) {
+		for(i = 0 ; i < pWrkrData->pData->numServers ; ++i)
+			free(pWrkrData->pipeline.urls[i]);
+		free(pWrkrData->pipeline.urls);
+		pWrkrData->pipeline.urls = NULL;
+	}
+}
+
+
+/* send the current batch, either blocking or via the pipeline */
+static rsRetVal
+submitBatch(wrkrInstanceData_t *pWrkrData)
+{
+	char *cstr = NULL;
+	int nmemb;
+	int nTries;
+	DEFiRet;
+
+	if(pWrkrData->pipeline.reqs != NULL) {
+		/* the reply is processed asynchronously, during later transactions */
+		CHKiRet(pipelinePost(pWrkrData));
+		FINALIZE;
+	}
+
+	CHKmalloc(cstr = es_str2cstr(pWrkrData->batch.data, NULL));
+	nmemb = pWrkrData->batch.nmemb;
+	for(nTries = 0 ; ; ++nTries) {
+		dbgprintf("omelasticsearch: submitting batch: '%s'\n", cstr);
+		pWrkrData->batch.bMayRetry = (nTries < ES_MAX_ITEM_RETRIES);
+		CHKiRet(curlPost(pWrkrData, (uchar*) cstr, strlen(cstr), NULL, nmemb));
+		if(pWrkrData->batch.retry == NULL)
+			break;
+		/* send again only what ES rejected temporarily, after a short backoff */
+		free(cstr);
+		cstr = es_str2cstr(pWrkrData->batch.retry, NULL);
+		nmemb = pWrkrData->batch.nRetry;
+		es_deleteStr(pWrkrData->batch.retry);
+		pWrkrData->batch.retry = NULL;
+		if(cstr == NULL)
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		indexRetry += nmemb;
+		srSleep(0, 100000 << nTries);
+	}
+finalize_it:
+	if(pWrkrData->batch.retry != NULL) {
+		es_deleteStr(pWrkrData->batch.retry);
+		pWrkrData->batch.retry = NULL;
+	}
+	free(cstr);
+	RETiRet;
+}
+
+
 BEGINbeginTransaction
 CODESTARTbeginTransaction
 dbgprintf("omelasticsearch: beginTransaction, pWrkrData %p, pData %p\n", pWrkrData, pWrkrData->pData);
@@ -688,83 +1675,106 @@ finalize_it:
 ENDbeginTransaction
 
 
-BEGINdoAction
-CODESTARTdoAction
-	STATSCOUNTER_INC(indexSubmit, mutIndexSubmit);
-	if(pWrkrData->pData->bulkmode) {
-		CHKiRet(buildBatch(pWrkrData, ppString[0], ppString));
-	} else {
-		CHKiRet(curlPost(pWrkrData, ppString[0], strlen((char*)ppString[0]),
-		                 ppString, 1));
+/* We get the whole batch at once. In bulkmode, the batch may be sent in
+ * several requests (maxbytes), so if a later request fails, only the
+ * messages not yet sent are retried. Without bulkmode, each message
+ * is posted on its own and rejected messages are reported as failed.
+ */
+BEGINcommitBatch
+	instanceData *const pData = pWrkrData->pData;
+	uchar *tpls[CONF_OMOD_NUMSTRINGS_MAXSIZE];
+	unsigned i;
+	unsigned nSent = 0; /* messages [0..nSent) are in submitted requests */
+	int j;
+	rsRetVal localRet;
+CODESTARTcommitBatch
+	for(i = 0 ; i < nParams ; ++i) {
+		for(j = 0 ; j < pData->iNumTpls ; ++j)
+			tpls[j] = actParam(pParams, pData->iNumTpls, i, j).param;
+		STATSCOUNTER_INC(indexSubmit, mutIndexSubmit);
+		if(pData->bulkmode) {
+			localRet = buildBatch(pWrkrData, tpls[0], tpls);
+			if(localRet == RS_RET_PREVIOUS_COMMITTED) {
+				for( ; nSent < i ; ++nSent)
+					pResults[nSent] = RS_RET_OK;
+			} else if(localRet == RS_RET_SUSPENDED) {
+				ABORT_FINALIZE(RS_RET_SUSPENDED);
+			} else if(localRet != RS_RET_DEFER_COMMIT) {
+				pResults[i] = localRet;
+			}
+		} else {
+			localRet = curlPost(pWrkrData, tpls[0], strlen((char*)tpls[0]), tpls, 1);
+			if(localRet == RS_RET_SUSPENDED)
+				ABORT_FINALIZE(RS_RET_SUSPENDED);
+			pResults[i] = localRet;
+			nSent = i + 1;
+		}
 	}
-finalize_it:
-dbgprintf("omelasticsearch: result doAction: %d (bulkmode %d)\n", iRet, pWrkrData->pData->bulkmode);
-ENDdoAction
-
 
-BEGINendTransaction
-	char *cstr = NULL;
-CODESTARTendTransaction
-dbgprintf("omelasticsearch: endTransaction init\n");
-	/* End Transaction only if batch data is not empty */
-	if (pWrkrData->batch.data != NULL ) {
-		cstr = es_str2cstr(pWrkrData->batch.data, NULL);
-		dbgprintf("omelasticsearch: endTransaction, batch: '%s'\n", cstr);
-		CHKiRet(curlPost(pWrkrData, (uchar*) cstr, strlen(cstr), NULL, pWrkrData->batch.nmemb));
-	}
-	else
-		dbgprintf("omelasticsearch: endTransaction, pWrkrData->batch.data is NULL, nothing to send. \n");
+	if(pData->bulkmode && pWrkrData->batch.nmemb > 0)
+		CHKiRet(submitBatch(pWrkrData));
+	for( ; nSent < nParams ; ++nSent) {
+		if(pResults[nSent] == RS_RET_SUSPENDED)
+			pResults[nSent] = RS_RET_OK;
+	}
 finalize_it:
-	free(cstr);
-dbgprintf("omelasticsearch: endTransaction done with %d\n", iRet);
-ENDendTransaction
+	dbgprintf("omelasticsearch: commitBatch done with %d, %u of %u messages sent\n",
+		  iRet, nSent, nParams);
+ENDcommitBatch
 
 /* elasticsearch POST result string ... useful for debugging */
 size_t
 curlResult(void *ptr, size_t size, size_t nmemb, void *userdata)
 {
-	char *p = (char *)ptr;
 	wrkrInstanceData_t *pWrkrData = (wrkrInstanceData_t*) userdata;
-	char *buf;
-	size_t newlen;
+	return addReplyData(&pWrkrData->reply, &pWrkrData->replyLen, (char*) ptr, size*nmemb);
+}
 
-	newlen = pWrkrData->replyLen + size*nmemb;
-	if((buf = realloc(pWrkrData->reply, newlen + 1)) == NULL) {
-		DBGPRINTF("omelasticsearch: realloc failed in curlResult\n");
-		return 0; /* abort due to failure */
-	}
-	memcpy(buf+pWrkrData->replyLen, p, size*nmemb);
-	pWrkrData->replyLen = newlen;
-	pWrkrData->reply = buf;
-	return size*nmemb;
+
+/* idle connections are kept open between requests, let TCP keep them alive */
+static void
+setCurlKeepAlive(CURL *handle)
+{
+#if LIBCURL_VERSION_NUM >= 0x071900
+	curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+#else
+	(void) handle;
+#endif
 }
 
 
+/* each worker has its own handle for each server, so that connections to
+ * all servers are reused across requests.
+ */
 static rsRetVal
 curlSetup(wrkrInstanceData_t *pWrkrData, instanceData *pData)
 {
 	HEADER *header;
 	CURL *handle;
-
-	handle = curl_easy_init();
-	if (handle == NULL) {
-		return RS_RET_OBJ_CREATION_FAILED;
-	}
+	int i;
 
 	header = curl_slist_append(NULL, "Content-Type: text/json; charset=utf-8");
-	curl_easy_setopt(handle, CURLOPT_HTTPHEADER, header);
-
-	curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, curlResult);
-	curl_easy_setopt(handle, CURLOPT_POST, 1);
-
-	pWrkrData->curlHandle = handle;
+	if(pData->compression == ES_CMPR_GZIP)
+		header = curl_slist_append(header, "Content-Encoding: gzip");
+	else if(pData->compression == ES_CMPR_DEFLATE)
+		header = curl_slist_append(header, "Content-Encoding: deflate");
 	pWrkrData->postHeader = header;
 
-	if(    pData->bulkmode
-	   || (pData->dynSrchIdx == 0 && pData->dynSrchType == 0 && pData->dynParent == 0)) {
-		/* in this case, we know no tpls are involved in the request-->NULL OK! */
-		setCurlURL(pWrkrData, pData, NULL);
+	if((pWrkrData->srvCurl = calloc(pData->numServers, sizeof(CURL*))) == NULL)
+		return RS_RET_OUT_OF_MEMORY;
+	for(i = 0 ; i < pData->numServers ; ++i) {
+		handle = curl_easy_init();
+		if (handle == NULL) {
+			return RS_RET_OBJ_CREATION_FAILED;
+		}
+		curl_easy_setopt(handle, CURLOPT_HTTPHEADER, header);
+		curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, curlResult);
+		curl_easy_setopt(handle, CURLOPT_POST, 1);
+		setCurlKeepAlive(handle);
+		pWrkrData->srvCurl[i] = handle;
 	}
+	pWrkrData->iServer = 0;
+	pWrkrData->curlHandle = pWrkrData->srvCurl[0];
 
 	if(Debug) {
 		if(pData->dynSrchIdx == 0 && pData->dynSrchType == 0 && pData->dynParent == 0)
@@ -778,7 +1788,15 @@ curlSetup(wrkrInstanceData_t *pWrkrData, instanceData *pData)
 static inline void
 setInstParamDefaults(instanceData *pData)
 {
-	pData->server = NULL;
+	pData->servers = NULL;
+	pData->numServers = 0;
+	pData->srvState = NULL;
+	pData->ejectTime = DFLT_SERVER_EJECT_TIME;
+	pData->iNextWrkr = 0;
+	pData->maxInflight = 0;
+	pData->maxBytes = 0;
+	pData->compression = ES_CMPR_NONE;
+	pData->compressionLevel = Z_DEFAULT_COMPRESSION;
 	pData->port = 9200;
 	pData->uid = NULL;
 	pData->pwd = NULL;
@@ -798,10 +1816,46 @@ setInstParamDefaults(instanceData *pData)
 	pData->bulkId = NULL;
 }
 
+/* set up the server state and per-server stats counters */
+static rsRetVal
+setupServerStats(instanceData *const pData)
+{
+	esServer_t *pSrv;
+	uchar ctrName[512];
+	int i;
+	DEFiRet;
+
+	CHKmalloc(pData->srvState = calloc(pData->numServers, sizeof(esServer_t)));
+	for(i = 0 ; i < pData->numServers ; ++i) {
+		pSrv = &pData->srvState[i];
+		snprintf((char*)ctrName, sizeof(ctrName), "omelasticsearch %s:%d",
+			 pData->servers[i], pData->port);
+		ctrName[sizeof(ctrName)-1] = '\0'; /* be on the save side */
+		CHKiRet(statsobj.Construct(&pSrv->stats));
+		CHKiRet(statsobj.SetName(pSrv->stats, ctrName));
+		STATSCOUNTER_INIT(pSrv->ctrRequests, pSrv->mutCtrRequests);
+		CHKiRet(statsobj.AddCounter(pSrv->stats, UCHAR_CONSTANT("requests"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pSrv->ctrRequests));
+		STATSCOUNTER_INIT(pSrv->ctrFailed, pSrv->mutCtrFailed);
+		CHKiRet(statsobj.AddCounter(pSrv->stats, UCHAR_CONSTANT("failed.requests"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pSrv->ctrFailed));
+		STATSCOUNTER_INIT(pSrv->ctrEjected, pSrv->mutCtrEjected);
+		CHKiRet(statsobj.AddCounter(pSrv->stats, UCHAR_CONSTANT("ejected"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pSrv->ctrEjected));
+		CHKiRet(statsobj.ConstructFinalize(pSrv->stats));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 BEGINnewActInst
 	struct cnfparamvals *pvals;
 	int i;
+	int j;
 	int iNumTpls;
+	char *cstr;
 CODESTARTnewActInst
 	if((pvals = nvlstGetParams(lst, &actpblk, NULL)) == NULL) {
 		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
@@ -814,11 +1868,18 @@ CODESTARTnewActInst
 		if(!pvals[i].bUsed)
 			continue;
 		if(!strcmp(actpblk.descr[i].name, "server")) {
-			pData->server = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+			CHKmalloc(pData->servers = calloc(pvals[i].val.d.ar->nmemb, sizeof(uchar*)));
+			for(j = 0 ; j < pvals[i].val.d.ar->nmemb ; ++j) {
+				CHKmalloc(pData->servers[j] =
+					(uchar*)es_str2cstr(pvals[i].val.d.ar->arr[j], NULL));
+				++pData->numServers;
+			}
 		} else if(!strcmp(actpblk.descr[i].name, "errorfile")) {
 			pData->errorFile = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "serverport")) {
 			pData->port = (int) pvals[i].val.d.n, NULL;
+		} else if(!strcmp(actpblk.descr[i].name, "server.ejecttime")) {
+			pData->ejectTime = (int) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "uid")) {
 			pData->uid = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "pwd")) {
@@ -849,6 +1910,27 @@ CODESTARTnewActInst
 			pData->dynBulkId = pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "bulkid")) {
 			pData->bulkId = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "pipeline.maxinflight")) {
+			pData->maxInflight = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "maxbytes")) {
+			pData->maxBytes = (size_t) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "compression.level")) {
+			pData->compressionLevel = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "compression")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(!strcasecmp(cstr, "gzip")) {
+				pData->compression = ES_CMPR_GZIP;
+			} else if(!strcasecmp(cstr, "deflate")) {
+				pData->compression = ES_CMPR_DEFLATE;
+			} else if(!strcasecmp(cstr, "none")) {
+				pData->compression = ES_CMPR_NONE;
+			} else {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "omelasticsearch: invalid value "
+					"for 'compression' parameter (given is '%s')", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+			}
+			free(cstr);
 		} else {
 			dbgprintf("omelasticsearch: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
@@ -879,6 +1961,16 @@ CODESTARTnewActInst
 			"name for parent template given - action definition invalid");
 		ABORT_FINALIZE(RS_RET_CONFIG_ERROR);
 	}
+	if(pData->compression != ES_CMPR_NONE && !bZlibwLoaded) {
+		CHKiRet(objUse(zlibw, LM_ZLIBW_FILENAME));
+		bZlibwLoaded = 1;
+	}
+	if(pData->maxInflight > 0 && !pData->bulkmode) {
+		errmsg.LogError(0, RS_RET_CONFIG_ERROR,
+			"omelasticsearch: \"pipeline.maxinflight\" requires bulkmode "
+			"- action definition invalid");
+		ABORT_FINALIZE(RS_RET_CONFIG_ERROR);
+	}
 	if(pData->dynBulkId && pData->bulkId == NULL) {
 		errmsg.LogError(0, RS_RET_CONFIG_ERROR,
 			"omelasticsearch: requested dynamic bulkid, but no "
@@ -892,6 +1984,7 @@ CODESTARTnewActInst
 	if(pData->dynParent) ++iNumTpls;
 	if(pData->dynBulkId) ++iNumTpls;
 	DBGPRINTF("omelasticsearch: requesting %d templates\n", iNumTpls);
+	pData->iNumTpls = iNumTpls;
 	CODE_STD_STRING_REQUESTnewActInst(iNumTpls)
 
 	CHKiRet(OMSRsetEntry(*ppOMSR, 0, (uchar*)strdup((pData->tplName == NULL) ?
@@ -971,8 +2064,12 @@ CODESTARTnewActInst
 		}
 	}
 
-	if(pData->server == NULL)
-		pData->server = (uchar*) strdup("localhost");
+	if(pData->servers == NULL) {
+		CHKmalloc(pData->servers = malloc(sizeof(uchar*)));
+		CHKmalloc(pData->servers[0] = (uchar*) strdup("localhost"));
+		pData->numServers = 1;
+	}
+	CHKiRet(setupServerStats(pData));
 	if(pData->searchIndex == NULL)
 		pData->searchIndex = (uchar*) strdup("system");
 	if(pData->searchType == NULL)
@@ -1007,18 +2104,18 @@ BEGINmodExit
 CODESTARTmodExit
 	curl_global_cleanup();
 	statsobj.Destruct(&indexStats);
+	if(bZlibwLoaded)
+		objRelease(zlibw, LM_ZLIBW_FILENAME);
 	objRelease(errmsg, CORE_COMPONENT);
         objRelease(statsobj, CORE_COMPONENT);
 ENDmodExit
 
 BEGINqueryEtryPt
 CODESTARTqueryEtryPt
-CODEqueryEtryPt_STD_OMOD_QUERIES
+CODEqueryEtryPt_STD_OMODBATCH_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
-CODEqueryEtryPt_IsCompatibleWithFeature_IF_OMOD_QUERIES
 CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
 CODEqueryEtryPt_doHUP
-CODEqueryEtryPt_TXIF_OMOD_QUERIES /* we support the transactional interface! */
 ENDqueryEtryPt
 
 
@@ -1049,6 +2146,27 @@ CODEmodInit_QueryRegCFSLineHdlr
 	STATSCOUNTER_INIT(indexESFail, mutIndexESFail);
 	CHKiRet(statsobj.AddCounter(indexStats, (uchar *)"failed.es",
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &indexESFail));
+	STATSCOUNTER_INIT(indexRetry, mutIndexRetry);
+	CHKiRet(statsobj.AddCounter(indexStats, (uchar *)"retries",
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &indexRetry));
+	STATSCOUNTER_INIT(indexRespSuccess, mutIndexRespSuccess);
+	CHKiRet(statsobj.AddCounter(indexStats, (uchar *)"response.success",
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &indexRespSuccess));
+	STATSCOUNTER_INIT(indexRespConflict, mutIndexRespConflict);
+	CHKiRet(statsobj.AddCounter(indexStats, (uchar *)"response.conflict",
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &indexRespConflict));
+	STATSCOUNTER_INIT(indexRespBad, mutIndexRespBad);
+	CHKiRet(statsobj.AddCounter(indexStats, (uchar *)"response.bad",
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &indexRespBad));
+	STATSCOUNTER_INIT(indexRespBulkRejection, mutIndexRespBulkRejection);
+	CHKiRet(statsobj.AddCounter(indexStats, (uchar *)"response.bulkrejection",
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &indexRespBulkRejection));
+	STATSCOUNTER_INIT(indexRespUnavailable, mutIndexRespUnavailable);
+	CHKiRet(statsobj.AddCounter(indexStats, (uchar *)"response.unavailable",
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &indexRespUnavailable));
+	STATSCOUNTER_INIT(indexRespOther, mutIndexRespOther);
+	CHKiRet(statsobj.AddCounter(indexStats, (uchar *)"response.other",
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &indexRespOther));
 	CHKiRet(statsobj.ConstructFinalize(indexStats));
 ENDmodInit
 
@@ -63,15 +63,20 @@ MODULE_TYPE_NOKEEP
 DEF_OMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
 
+#define DFLT_BLOCK_SIZE (64*1024)
+#define MAX_FILE_COUNT 64
+
 /* global data */
 static struct hashtable *files;		/* holds all file objects that we know */
-static pthread_mutex_t mutDoAct = PTHREAD_MUTEX_INITIALIZER;
 
 typedef struct configSettings_s {
 	uchar *fileName;	
 	uchar *hdfsHost;	
 	uchar *dfltTplName;	/* default template name to use */
 	int hdfsPort;
+	int64 blockSize;	/* size of the client-side write buffer */
+	int iFlushInterval;	/* max seconds data may stay buffered, 0 = flush at end of each batch */
+	int nFiles;		/* number of files to spread the data over */
 } configSettings_t;
 static configSettings_t cs;
 
@@ -86,16 +91,43 @@ typedef struct {
 } file_t;
 
 
-typedef struct _instanceData {
+/* An output buffer. Each one writes to its own file. If more than one
+ * file is configured, the action's workers are distributed over the
+ * buffers, so that HDFS writes can be done concurrently.
+ */
+typedef struct {
 	file_t *pFile;
-	uchar ioBuf[64*1024];
-	unsigned offsBuf;
+	uchar *ioBuf;
+	size_t offsBuf;
+	time_t tFirstData;	/* when was the oldest unwritten data added? */
+	pthread_mutex_t mut;
+} outBuf_t;
+
+typedef struct _instanceData {
+	outBuf_t *bufs;
+	int nBufs;
+	int nWrkrs;		/* workers created so far, used to assign buffers */
+	size_t blockSize;
+	int iFlushInterval;
+	pthread_mutex_t mutWrkrs;
+	struct _instanceData *next;	/* all instances, needed for timed flushes and HUP */
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	outBuf_t *pBuf;
 } wrkrInstanceData_t;
 
+/* list of all instances plus the flusher thread, which writes out
+ * data that has been buffered for longer than the flush interval.
+ */
+static instanceData *pInstRoot = NULL;
+static pthread_mutex_t mutInstList = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t condFlusher = PTHREAD_COND_INITIALIZER;
+static pthread_t flusherTid;
+static sbool bFlusherRunning = 0;
+static sbool bFlusherTerm = 0;
+
 /* forward definitions (down here, need data types) */
 static inline rsRetVal fileClose(file_t *pFile);
 
@@ -108,7 +140,10 @@ ENDisCompatibleWithFeature
 
 BEGINdbgPrintInstInfo
 CODESTARTdbgPrintInstInfo
-	printf("omhdfs: file:%s", pData->pFile->name);
+	printf("omhdfs: file:%s", pData->bufs[0].pFile->name);
+	if(pData->nBufs > 1)
+		printf(" (+%d more)", pData->nBufs - 1);
+	printf(", block size %zu, flush interval %d", pData->blockSize, pData->iFlushInterval);
 ENDdbgPrintInstInfo
 
 
@@ -244,15 +279,13 @@ fileObjDestruct4Hashtable(void *ptr)
 }
 
 
-static inline rsRetVal
-fileOpen(file_t *pFile)
+/* open the file, caller must hold the file mutex (if there is one) */
+static rsRetVal
+fileOpenLocked(file_t *pFile)
 {
 	DEFiRet;
 
 	assert(pFile->fh == NULL);
-	if(pFile->nUsers > 1)
-		d_pthread_mutex_lock(&pFile->mut);
-
 	DBGPRINTF("omhdfs: try to connect to HDFS at host '%s', port %d\n",
 		  pFile->hdfsHost, pFile->hdfsPort);
 	pFile->fs = hdfsConnect(pFile->hdfsHost, pFile->hdfsPort);
@@ -284,6 +317,18 @@ fileOpen(file_t *pFile)
 	}
 
 finalize_it:
+	RETiRet;
+}
+
+
+static inline rsRetVal
+fileOpen(file_t *pFile)
+{
+	DEFiRet;
+
+	if(pFile->nUsers > 1)
+		d_pthread_mutex_lock(&pFile->mut);
+	iRet = fileOpenLocked(pFile);
 	if(pFile->nUsers > 1)
 		d_pthread_mutex_unlock(&pFile->mut);
 	RETiRet;
@@ -291,28 +336,31 @@ finalize_it:
 
 
 /* Note: lenWrite is reset to zero on successful write! */
-static inline rsRetVal
+static rsRetVal
 fileWrite(file_t *pFile, uchar *buf, size_t *lenWrite)
 {
+	int bLocked = 0;
 	DEFiRet;
 
 	if(*lenWrite == 0)
 		FINALIZE;
 
-	if(pFile->nUsers > 1)
+	if(pFile->nUsers > 1) {
 		d_pthread_mutex_lock(&pFile->mut);
+		bLocked = 1;
+	}
 
 	/* open file if not open. This must be done *here* and while mutex-protected
 	 * because of HUP handling (which is async to normal processing!).
 	 */
 	if(pFile->fh == NULL) {
-		fileOpen(pFile);
+		fileOpenLocked(pFile);
 		if(pFile->fh == NULL) {
 			ABORT_FINALIZE(RS_RET_SUSPENDED);
 		}
 	}
 
-dbgprintf("XXXXX: omhdfs writing %u bytes\n", *lenWrite);
+	DBGPRINTF("omhdfs: writing %zu bytes to %s\n", *lenWrite, pFile->name);
 	tSize num_written_bytes = hdfsWrite(pFile->fs, pFile->fh, buf, *lenWrite);
 	if((unsigned) num_written_bytes != *lenWrite) {
 		errmsg.LogError(errno, RS_RET_ERR_HDFS_WRITE,
@@ -324,6 +372,8 @@ dbgprintf("XXXXX: omhdfs writing %u bytes\n", *lenWrite);
 	*lenWrite = 0;
 
 finalize_it:
+	if(bLocked)
+		d_pthread_mutex_unlock(&pFile->mut);
 	RETiRet;
 }
 
@@ -358,49 +408,209 @@ finalize_it:
  * Note that we must check of some new data arrived is large than our
  * buffer. In that case, the new data will written with its own
  * write operation.
+ * The caller must hold the buffer mutex.
  */
 static inline rsRetVal
-addData(instanceData *pData, uchar *buf)
+addData(instanceData *pData, outBuf_t *pBuf, uchar *buf)
 {
-	unsigned len;
+	size_t len;
 	DEFiRet;
 
 	len = strlen((char*)buf);
-	if(pData->offsBuf + len < sizeof(pData->ioBuf)) {
-		/* new data fits into remaining buffer */
-		memcpy((char*) pData->ioBuf + pData->offsBuf, buf, len);
-		pData->offsBuf += len;
-	} else {
-dbgprintf("XXXXX: not enough room, need to flush\n");
-		CHKiRet(fileWrite(pData->pFile, pData->ioBuf, &pData->offsBuf));
-		if(len >= sizeof(pData->ioBuf)) {
-			CHKiRet(fileWrite(pData->pFile, buf, &len));
-		} else {
-			memcpy((char*) pData->ioBuf + pData->offsBuf, buf, len);
-			pData->offsBuf += len;
+	if(pBuf->offsBuf + len >= pData->blockSize) {
+		DBGPRINTF("omhdfs: not enough room in buffer for %s, need to flush\n",
+			  pBuf->pFile->name);
+		CHKiRet(fileWrite(pBuf->pFile, pBuf->ioBuf, &pBuf->offsBuf));
+		if(len >= pData->blockSize) {
+			CHKiRet(fileWrite(pBuf->pFile, buf, &len));
+			len = 0;
 		}
 	}
+	if(len > 0) {
+		if(pBuf->offsBuf == 0)
+			pBuf->tFirstData = time(NULL);
+		memcpy((char*) pBuf->ioBuf + pBuf->offsBuf, buf, len);
+		pBuf->offsBuf += len;
+	}
 
 	iRet = RS_RET_DEFER_COMMIT;
 finalize_it:
 	RETiRet;
 }
 
+
+/* write out buffered data if it is due: if no flush interval is set, this
+ * is the case at the end of each batch, otherwise when the oldest data has
+ * been in the buffer for the flush interval (or tNow is 0, which forces
+ * the write). The caller must hold the buffer mutex.
+ */
+static rsRetVal
+flushBuf(instanceData *pData, outBuf_t *pBuf, time_t tNow)
+{
+	DEFiRet;
+
+	if(pBuf->offsBuf == 0)
+		FINALIZE;
+	if(tNow != 0 && pData->iFlushInterval != 0
+	   && tNow - pBuf->tFirstData < pData->iFlushInterval)
+		FINALIZE;
+	DBGPRINTF("omhdfs: flushing %zu buffered bytes for %s\n", pBuf->offsBuf,
+		  pBuf->pFile->name);
+	iRet = fileWrite(pBuf->pFile, pBuf->ioBuf, &pBuf->offsBuf);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* the flusher thread. It wakes up once a second and writes all buffers
+ * whose data is older than the flush interval. That way, data does not
+ * linger in memory when message flow is slow.
+ */
+static void *
+flusher(void __attribute__((unused)) *arg)
+{
+	instanceData *pData;
+	struct timespec t;
+	time_t tNow;
+	int i;
+
+	d_pthread_mutex_lock(&mutInstList);
+	while(!bFlusherTerm) {
+		timeoutComp(&t, 1000);
+		pthread_cond_timedwait(&condFlusher, &mutInstList, &t);
+		if(bFlusherTerm)
+			break;
+		tNow = time(NULL);
+		for(pData = pInstRoot ; pData != NULL ; pData = pData->next) {
+			if(pData->iFlushInterval == 0)
+				continue; /* flushed at end of batch */
+			for(i = 0 ; i < pData->nBufs ; ++i) {
+				d_pthread_mutex_lock(&pData->bufs[i].mut);
+				flushBuf(pData, &pData->bufs[i], tNow);
+				d_pthread_mutex_unlock(&pData->bufs[i].mut);
+			}
+		}
+	}
+	d_pthread_mutex_unlock(&mutInstList);
+	return NULL;
+}
+
+
+/* add an instance to the instance list and start the flusher, if needed */
+static rsRetVal
+registerInstance(instanceData *pData)
+{
+	int r;
+	DEFiRet;
+
+	d_pthread_mutex_lock(&mutInstList);
+	pData->next = pInstRoot;
+	pInstRoot = pData;
+	if(pData->iFlushInterval > 0 && !bFlusherRunning) {
+		r = pthread_create(&flusherTid, NULL, flusher, NULL);
+		if(r != 0) {
+			errmsg.LogError(r, RS_RET_ERR, "omhdfs: cannot start flusher thread, "
+					"buffered data will only be written when more data arrives");
+		} else {
+			bFlusherRunning = 1;
+		}
+	}
+	d_pthread_mutex_unlock(&mutInstList);
+	RETiRet;
+}
+
+
+static void
+unregisterInstance(instanceData *pData)
+{
+	instanceData **ppPrev;
+
+	d_pthread_mutex_lock(&mutInstList);
+	for(ppPrev = &pInstRoot ; *ppPrev != NULL ; ppPrev = &(*ppPrev)->next) {
+		if(*ppPrev == pData) {
+			*ppPrev = pData->next;
+			break;
+		}
+	}
+	d_pthread_mutex_unlock(&mutInstList);
+}
+
+
+/* obtain the file object for a given name, creating it if it does not
+ * yet exist. Returns RS_RET_SUSPENDED if the file could not be opened
+ * right now, which the caller should treat as a warning only.
+ */
+static rsRetVal
+getFileObj(uchar *name, file_t **ppFile)
+{
+	file_t *pFile;
+	uchar *keybuf;
+	rsRetVal localRet = RS_RET_OK;
+	int r;
+	DEFiRet;
+
+	pFile = hashtable_search(files, name);
+	if(pFile == NULL) {
+		/* we need a new file object, this one not seen before */
+		CHKiRet(fileObjConstruct(&pFile));
+		CHKmalloc(pFile->name = ustrdup(name));
+		CHKmalloc(keybuf = ustrdup(name));
+		CHKmalloc(pFile->hdfsHost = strdup((cs.hdfsHost == NULL) ? "default" : (char*) cs.hdfsHost));
+		pFile->hdfsPort = cs.hdfsPort;
+		fileOpen(pFile);
+		if(pFile->fh == NULL){
+			errmsg.LogError(0, RS_RET_ERR_HDFS_OPEN, "omhdfs: failed to open %s - "
+				    	"retrying later", pFile->name);
+			localRet = RS_RET_SUSPENDED;
+		}
+		r = hashtable_insert(files, keybuf, pFile);
+		if(r == 0)
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	fileObjAddUser(pFile);
+	*ppFile = pFile;
+	iRet = localRet;
+
+finalize_it:
+	RETiRet;
+}
+
 BEGINcreateInstance
 CODESTARTcreateInstance
-	pData->pFile = NULL;
+	pData->bufs = NULL;
+	pData->nBufs = 0;
+	pData->nWrkrs = 0;
+	pData->next = NULL;
+	pthread_mutex_init(&pData->mutWrkrs, NULL);
 ENDcreateInstance
 
 
+/* workers are assigned to the output buffers round-robin */
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pthread_mutex_lock(&pData->mutWrkrs);
+	pWrkrData->pBuf = &pData->bufs[pData->nWrkrs++ % pData->nBufs];
+	pthread_mutex_unlock(&pData->mutWrkrs);
+	DBGPRINTF("omhdfs: worker %p writes to %s\n", pWrkrData, pWrkrData->pBuf->pFile->name);
 ENDcreateWrkrInstance
 
 
+/* Note: file objects are owned by the files hashtable and are
+ * destroyed in modExit.
+ */
 BEGINfreeInstance
+	int i;
 CODESTARTfreeInstance
-	if(pData->pFile != NULL)
-		fileObjDestruct(&pData->pFile);
+	unregisterInstance(pData);
+	for(i = 0 ; i < pData->nBufs ; ++i) {
+		if(pData->bufs[i].pFile != NULL)
+			flushBuf(pData, &pData->bufs[i], 0);
+		free(pData->bufs[i].ioBuf);
+		pthread_mutex_destroy(&pData->bufs[i].mut);
+	}
+	free(pData->bufs);
+	pthread_mutex_destroy(&pData->mutWrkrs);
 ENDfreeInstance
 
 
@@ -410,17 +620,17 @@ ENDfreeWrkrInstance
 
 
 BEGINtryResume
-	instanceData *pData = pWrkrData->pData;
+	outBuf_t *pBuf = pWrkrData->pBuf;
 CODESTARTtryResume
-	pthread_mutex_lock(&mutDoAct);
-	fileClose(pData->pFile);
-	fileOpen(pData->pFile);
-	if(pData->pFile->fh == NULL){
+	pthread_mutex_lock(&pBuf->mut);
+	fileClose(pBuf->pFile);
+	fileOpen(pBuf->pFile);
+	if(pBuf->pFile->fh == NULL){
 		dbgprintf("omhdfs: tried to resume file %s, but still no luck...\n",
-			  pData->pFile->name);
+			  pBuf->pFile->name);
 		iRet = RS_RET_SUSPENDED;
 	}
-	pthread_mutex_unlock(&mutDoAct);
+	pthread_mutex_unlock(&pBuf->mut);
 ENDtryResume
 
 
@@ -433,11 +643,11 @@ ENDbeginTransaction
 BEGINdoAction
 	instanceData *pData = pWrkrData->pData;
 CODESTARTdoAction
-	DBGPRINTF("omhdfs: action to to write to %s\n", pData->pFile->name);
-	pthread_mutex_lock(&mutDoAct);
-	iRet = addData(pData, ppString[0]);
+	DBGPRINTF("omhdfs: action to to write to %s\n", pWrkrData->pBuf->pFile->name);
+	pthread_mutex_lock(&pWrkrData->pBuf->mut);
+	iRet = addData(pData, pWrkrData->pBuf, ppString[0]);
 	DBGPRINTF("omhdfs: done doAction\n");
-	pthread_mutex_unlock(&mutDoAct);
+	pthread_mutex_unlock(&pWrkrData->pBuf->mut);
 ENDdoAction
 
 
@@ -445,19 +655,20 @@ BEGINendTransaction
 	instanceData *pData = pWrkrData->pData;
 CODESTARTendTransaction
 dbgprintf("omhdfs: endTransaction\n");
-	pthread_mutex_lock(&mutDoAct);
-	if(pData->offsBuf != 0) {
-		DBGPRINTF("omhdfs: data unwritten at end of transaction, persisting...\n");
-		iRet = fileWrite(pData->pFile, pData->ioBuf, &pData->offsBuf);
-	}
-	pthread_mutex_unlock(&mutDoAct);
+	/* with a flush interval, data is intentionally kept across batches,
+	 * so that HDFS sees large writes. The flusher thread takes care of
+	 * data that is not written here.
+	 */
+	pthread_mutex_lock(&pWrkrData->pBuf->mut);
+	iRet = flushBuf(pData, pWrkrData->pBuf, time(NULL));
+	pthread_mutex_unlock(&pWrkrData->pBuf->mut);
 ENDendTransaction
 
 
 BEGINparseSelectorAct
-	file_t *pFile;
-	int r;
-	uchar *keybuf;
+	uchar fname[MAXFNAME];
+	rsRetVal localRet;
+	int i;
 CODESTARTparseSelectorAct
 
 	/* first check if this config line is actually for us */
@@ -477,28 +688,38 @@ CODESTARTparseSelectorAct
 		ABORT_FINALIZE(RS_RET_FILE_NOT_SPECIFIED);
 	}
 
-	pFile = hashtable_search(files, cs.fileName);
-	if(pFile == NULL) {
-		/* we need a new file object, this one not seen before */
-		CHKiRet(fileObjConstruct(&pFile));
-		CHKmalloc(pFile->name = cs.fileName);
-		CHKmalloc(keybuf = ustrdup(cs.fileName));
-		cs.fileName = NULL; /* re-set, data passed to file object */
-		CHKmalloc(pFile->hdfsHost = strdup((cs.hdfsHost == NULL) ? "default" : (char*) cs.hdfsHost));
-		pFile->hdfsPort = cs.hdfsPort;
-		fileOpen(pFile);
-		if(pFile->fh == NULL){
-			errmsg.LogError(0, RS_RET_ERR_HDFS_OPEN, "omhdfs: failed to open %s - "
-				    	"retrying later", pFile->name);
+	if(cs.blockSize < 1024) {
+		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "omhdfs: block size %lld too small, "
+				"using %d instead", (long long) cs.blockSize, DFLT_BLOCK_SIZE);
+		cs.blockSize = DFLT_BLOCK_SIZE;
+	}
+	if(cs.nFiles < 1 || cs.nFiles > MAX_FILE_COUNT) {
+		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "omhdfs: file count %d invalid, must be "
+				"between 1 and %d - using 1", cs.nFiles, MAX_FILE_COUNT);
+		cs.nFiles = 1;
+	}
+	pData->blockSize = (size_t) cs.blockSize;
+	pData->iFlushInterval = (cs.iFlushInterval < 0) ? 0 : cs.iFlushInterval;
+
+	CHKmalloc(pData->bufs = calloc(cs.nFiles, sizeof(outBuf_t)));
+	for(i = 0 ; i < cs.nFiles ; ++i) {
+		pthread_mutex_init(&pData->bufs[i].mut, NULL);
+		++pData->nBufs;
+		CHKmalloc(pData->bufs[i].ioBuf = malloc(pData->blockSize));
+		/* with more than one file, each one gets a numeric suffix */
+		if(cs.nFiles == 1)
+			snprintf((char*)fname, sizeof(fname), "%s", (char*)cs.fileName);
+		else
+			snprintf((char*)fname, sizeof(fname), "%s.%d", (char*)cs.fileName, i);
+		localRet = getFileObj(fname, &pData->bufs[i].pFile);
+		if(localRet == RS_RET_SUSPENDED)
 			iRet = RS_RET_SUSPENDED;
-		}
-		r = hashtable_insert(files, keybuf, pFile);
-		if(r == 0)
-			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		else
+			CHKiRet(localRet);
 	}
-	fileObjAddUser(pFile);
-	pData->pFile = pFile;
-	pData->offsBuf = 0;
+	CHKiRet(registerInstance(pData));
+	free(cs.fileName);
+	cs.fileName = NULL; /* re-set, name has been passed to the file objects */
 
 CODE_STD_FINALIZERparseSelectorAct
 ENDparseSelectorAct
@@ -507,8 +728,22 @@ ENDparseSelectorAct
 BEGINdoHUP
     file_t *pFile;
     struct hashtable_itr *itr;
+    instanceData *pInst;
+    int i;
 CODESTARTdoHUP
 	DBGPRINTF("omhdfs: HUP received (file count %d)\n", hashtable_count(files));
+	/* write out everything that is buffered, so that it goes into the
+	 * files we are about to close.
+	 */
+	d_pthread_mutex_lock(&mutInstList);
+	for(pInst = pInstRoot ; pInst != NULL ; pInst = pInst->next) {
+		for(i = 0 ; i < pInst->nBufs ; ++i) {
+			d_pthread_mutex_lock(&pInst->bufs[i].mut);
+			flushBuf(pInst, &pInst->bufs[i], 0);
+			d_pthread_mutex_unlock(&pInst->bufs[i].mut);
+		}
+	}
+	d_pthread_mutex_unlock(&mutInstList);
 	/* Iterator constructor only returns a valid iterator if
 	* the hashtable is not empty */
 	itr = hashtable_iterator(files);
@@ -534,12 +769,23 @@ static rsRetVal resetConfigVariables(uchar __attribute__((unused)) *pp, void __a
 	cs.fileName = NULL;
 	free(cs.dfltTplName);
 	cs.dfltTplName = NULL;
+	cs.blockSize = DFLT_BLOCK_SIZE;
+	cs.iFlushInterval = 0;
+	cs.nFiles = 1;
 	return RS_RET_OK;
 }
 
 
 BEGINmodExit
 CODESTARTmodExit
+	if(bFlusherRunning) {
+		d_pthread_mutex_lock(&mutInstList);
+		bFlusherTerm = 1;
+		pthread_cond_signal(&condFlusher);
+		d_pthread_mutex_unlock(&mutInstList);
+		pthread_join(flusherTid, NULL);
+		bFlusherRunning = 0;
+	}
 	objRelease(errmsg, CORE_COMPONENT);
 	if(files != NULL)
 		hashtable_destroy(files, 1); /* 1 => free all values automatically */
@@ -561,6 +807,8 @@ CODESTARTmodInit
 	*ipIFVersProvided = CURR_MOD_IF_VERSION;
 CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	cs.blockSize = DFLT_BLOCK_SIZE;
+	cs.nFiles = 1;
 	CHKmalloc(files = create_hashtable(20, hash_from_string, key_equals_string,
 			                   fileObjDestruct4Hashtable));
 
@@ -568,6 +816,9 @@ CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(regCfSysLineHdlr((uchar *)"omhdfshost", 0, eCmdHdlrGetWord, NULL, &cs.hdfsHost, NULL));
 	CHKiRet(regCfSysLineHdlr((uchar *)"omhdfsport", 0, eCmdHdlrInt, NULL, &cs.hdfsPort, NULL));
 	CHKiRet(regCfSysLineHdlr((uchar *)"omhdfsdefaulttemplate", 0, eCmdHdlrGetWord, NULL, &cs.dfltTplName, NULL));
+	CHKiRet(regCfSysLineHdlr((uchar *)"omhdfsblocksize", 0, eCmdHdlrSize, NULL, &cs.blockSize, NULL));
+	CHKiRet(regCfSysLineHdlr((uchar *)"omhdfsflushinterval", 0, eCmdHdlrInt, NULL, &cs.iFlushInterval, NULL));
+	CHKiRet(regCfSysLineHdlr((uchar *)"omhdfsfilecount", 0, eCmdHdlrInt, NULL, &cs.nFiles, NULL));
 	CHKiRet(omsdRegCFSLineHdlr((uchar *)"resetconfigvariables", 1, eCmdHdlrCustomHandler, resetConfigVariables, NULL, STD_LOADABLE_MODULE_ID));
 	DBGPRINTF("omhdfs: module compiled with rsyslog version %s.\n", VERSION);
 CODEmodInit_QueryRegCFSLineHdlr
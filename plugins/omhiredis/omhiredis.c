@@ -48,6 +48,13 @@ MODULE_CNFNAME("omhiredis")
 DEF_OMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
 
+#define OMHIREDIS_MODE_TEMPLATE 0
+#define OMHIREDIS_MODE_QUEUE 1
+
+#define REDIS_CLUSTER_SLOTS 16384
+/* max number of values in a single LPUSH/RPUSH, larger groups are split */
+#define MAX_PUSH_VALUES 4096
+
 /*  our instance data.
  *  this will be accessable 
  *  via pData */
@@ -55,19 +62,62 @@ typedef struct _instanceData {
 	uchar *server; /*  redis server address */
 	int port; /*  redis port */
 	uchar *tplName; /*  template name */
+	int mode; /*  OMHIREDIS_MODE_* */
+	uchar *key; /*  key to push to (queue mode), template name if dynakey */
+	sbool dynaKey; /*  is key a template name? */
+	sbool bRPush; /*  use RPUSH instead of LPUSH */
+	sbool bCluster; /*  route keys to the owning Redis Cluster node */
 } instanceData;
 
+/*  a redis server we are (or may be) connected to. Without cluster
+ *  mode, there is just one: the configured server. */
+typedef struct redisNode_s {
+	char *host;
+	int port;
+	redisContext *conn;
+} redisNode_t;
+
+/*  all values of a transaction for the same key. They are sent with
+ *  a single variadic LPUSH/RPUSH. */
+typedef struct keyGroup_s {
+	char *key;
+	size_t lenKey;
+	int iNode; /*  node the command was sent to */
+	int nValues;
+	int maxValues;
+	char **values;
+	size_t *lenValues;
+	int nCmds; /*  commands sent for this group */
+	sbool bMoved; /*  got a MOVED/ASK reply, must be resent */
+} keyGroup_t;
+
 typedef struct wrkrInstanceData {
 	instanceData *pData;
 	redisContext *conn; /*  redis connection */
 	redisReply **replies; /* array to hold replies from redis */
 	int count; /*  count of command sent for current batch */
+	/*  queue mode */
+	redisNode_t *nodes;
+	int nNodes;
+	short *slotMap; /*  slot -> index into nodes, cluster mode only */
+	keyGroup_t *groups;
+	int nGroups;
+	int maxGroups;
+	int iLastGroup; /*  cache for the common case of consecutive equal keys */
+	sbool bSlotsLoaded; /*  slotMap obtained from cluster? */
+	const char **argv; /*  command buffer for redisAppendCommandArgv */
+	size_t *argvlen;
 } wrkrInstanceData_t;
 
 static struct cnfparamdescr actpdescr[] = {
 	{ "server", eCmdHdlrGetWord, 0 },
 	{ "serverport", eCmdHdlrInt, 0 },
-	{ "template", eCmdHdlrGetWord, 1 }
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "mode", eCmdHdlrGetWord, 0 },
+	{ "key", eCmdHdlrGetWord, 0 },
+	{ "dynakey", eCmdHdlrBinary, 0 },
+	{ "queue.push", eCmdHdlrGetWord, 0 },
+	{ "cluster", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk actpblk = {
 	CNFPARAMBLK_VERSION,
@@ -82,6 +132,30 @@ ENDcreateInstance
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
 	pWrkrData->conn = NULL; /* Connect later */
+	pWrkrData->nodes = NULL;
+	pWrkrData->nNodes = 0;
+	pWrkrData->slotMap = NULL;
+	pWrkrData->groups = NULL;
+	pWrkrData->nGroups = 0;
+	pWrkrData->maxGroups = 0;
+	pWrkrData->iLastGroup = 0;
+	pWrkrData->bSlotsLoaded = 0;
+	pWrkrData->argv = NULL;
+	pWrkrData->argvlen = NULL;
+	if(pWrkrData->pData->mode == OMHIREDIS_MODE_QUEUE) {
+		CHKmalloc(pWrkrData->argv = malloc((MAX_PUSH_VALUES + 2) * sizeof(char*)));
+		CHKmalloc(pWrkrData->argvlen = malloc((MAX_PUSH_VALUES + 2) * sizeof(size_t)));
+		CHKmalloc(pWrkrData->nodes = calloc(1, sizeof(redisNode_t)));
+		CHKmalloc(pWrkrData->nodes[0].host = strdup((pWrkrData->pData->server == NULL) ?
+			"127.0.0.1" : (char*) pWrkrData->pData->server));
+		pWrkrData->nodes[0].port = pWrkrData->pData->port;
+		pWrkrData->nNodes = 1;
+		if(pWrkrData->pData->bCluster) {
+			/* all slots initially go to the seed node */
+			CHKmalloc(pWrkrData->slotMap = calloc(REDIS_CLUSTER_SLOTS, sizeof(short)));
+		}
+	}
+finalize_it:
 ENDcreateWrkrInstance
 
 BEGINisCompatibleWithFeature
@@ -99,6 +173,30 @@ static void closeHiredis(wrkrInstanceData_t *pWrkrData)
 	}
 }
 
+static void closeNode(redisNode_t *node)
+{
+	if(node->conn != NULL) {
+		redisFree(node->conn);
+		node->conn = NULL;
+	}
+}
+
+/*  release the values collected for the current transaction. The
+ *  group array and key buffers are kept for the next one. */
+static void resetGroups(wrkrInstanceData_t *pWrkrData)
+{
+	int i, j;
+
+	for(i = 0 ; i < pWrkrData->nGroups ; ++i) {
+		for(j = 0 ; j < pWrkrData->groups[i].nValues ; ++j)
+			free(pWrkrData->groups[i].values[j]);
+		pWrkrData->groups[i].nValues = 0;
+		pWrkrData->groups[i].bMoved = 0;
+	}
+	pWrkrData->nGroups = 0;
+	pWrkrData->iLastGroup = 0;
+}
+
 /*  Free our instance data.
  *  TODO: free **replies */
 BEGINfreeInstance
@@ -106,11 +204,29 @@ CODESTARTfreeInstance
 	if (pData->server != NULL) {
 		free(pData->server);
 	}
+	free(pData->tplName);
+	free(pData->key);
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
+	int i;
 CODESTARTfreeWrkrInstance
 	closeHiredis(pWrkrData);
+	resetGroups(pWrkrData);
+	for(i = 0 ; i < pWrkrData->maxGroups ; ++i) {
+		free(pWrkrData->groups[i].key);
+		free(pWrkrData->groups[i].values);
+		free(pWrkrData->groups[i].lenValues);
+	}
+	free(pWrkrData->groups);
+	for(i = 0 ; i < pWrkrData->nNodes ; ++i) {
+		closeNode(&pWrkrData->nodes[i]);
+		free(pWrkrData->nodes[i].host);
+	}
+	free(pWrkrData->nodes);
+	free(pWrkrData->slotMap);
+	free(pWrkrData->argv);
+	free(pWrkrData->argvlen);
 ENDfreeWrkrInstance
 
 BEGINdbgPrintInstInfo
@@ -132,13 +248,318 @@ static rsRetVal initHiredis(wrkrInstanceData_t *pWrkrData, int bSilent)
 	struct timeval timeout = { 1, 500000 }; /* 1.5 seconds */
 	pWrkrData->conn = redisConnectWithTimeout(server, pWrkrData->pData->port,
 			timeout);
-	if (pWrkrData->conn->err) {
+	if (pWrkrData->conn == NULL || pWrkrData->conn->err) {
 		if(!bSilent)
 			errmsg.LogError(0, RS_RET_SUSPENDED,
 				"can not initialize redis handle");
+		closeHiredis(pWrkrData);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+finalize_it:
+	RETiRet;
+}
+
+/*  connect to a node, if not already connected */
+static rsRetVal connectNode(redisNode_t *node, int bSilent)
+{
+	struct timeval timeout = { 1, 500000 }; /* 1.5 seconds */
+	DEFiRet;
+
+	if(node->conn != NULL)
+		FINALIZE;
+	DBGPRINTF("omhiredis: trying connect to '%s' at port %d\n", node->host, node->port);
+	node->conn = redisConnectWithTimeout(node->host, node->port, timeout);
+	if(node->conn == NULL || node->conn->err) {
+		if(!bSilent)
+			errmsg.LogError(0, RS_RET_SUSPENDED, "omhiredis: can not connect "
+				"to redis at %s:%d", node->host, node->port);
+		closeNode(node);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+finalize_it:
+	RETiRet;
+}
+
+/*  Redis Cluster key hash slot: CRC16 (XMODEM) of the key, or of the
+ *  part inside the first non-empty {...} hash tag, modulo 16384. */
+static int keySlot(const char *key, size_t len)
+{
+	size_t start, end;
+	uint16_t crc = 0;
+	int i;
+
+	for(start = 0 ; start < len && key[start] != '{' ; ++start)
+		/* search hash tag */;
+	if(start < len) {
+		for(end = start + 1 ; end < len && key[end] != '}' ; ++end)
+			/* search end of tag */;
+		if(end < len && end != start + 1) {
+			key += start + 1;
+			len = end - start - 1;
+		}
+	}
+	while(len-- > 0) {
+		crc ^= (uint16_t) ((unsigned char) *key++) << 8;
+		for(i = 0 ; i < 8 ; ++i)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc & (REDIS_CLUSTER_SLOTS - 1);
+}
+
+/*  find the node with the given address or add it */
+static rsRetVal getNode(wrkrInstanceData_t *pWrkrData, const char *host, int port, int *piNode)
+{
+	redisNode_t *newNodes;
+	int i;
+	DEFiRet;
+
+	for(i = 0 ; i < pWrkrData->nNodes ; ++i) {
+		if(pWrkrData->nodes[i].port == port && !strcmp(pWrkrData->nodes[i].host, host))
+			break;
+	}
+	if(i == pWrkrData->nNodes) {
+		CHKmalloc(newNodes = realloc(pWrkrData->nodes, (i + 1) * sizeof(redisNode_t)));
+		pWrkrData->nodes = newNodes;
+		CHKmalloc(newNodes[i].host = strdup(host));
+		newNodes[i].port = port;
+		newNodes[i].conn = NULL;
+		++pWrkrData->nNodes;
+	}
+	*piNode = i;
+finalize_it:
+	RETiRet;
+}
+
+/*  (re)load the slot to node mapping with CLUSTER SLOTS, asking the
+ *  first node we can connect to. */
+static rsRetVal refreshSlots(wrkrInstanceData_t *pWrkrData, int bSilent)
+{
+	redisReply *reply = NULL;
+	redisReply *range, *master;
+	long long slot;
+	int iNode;
+	size_t i;
+	int n;
+	DEFiRet;
+
+	for(n = 0 ; n < pWrkrData->nNodes ; ++n) {
+		if(connectNode(&pWrkrData->nodes[n], 1) != RS_RET_OK)
+			continue;
+		reply = redisCommand(pWrkrData->nodes[n].conn, "CLUSTER SLOTS");
+		if(reply != NULL && reply->type == REDIS_REPLY_ARRAY)
+			break;
+		if(reply == NULL) {
+			closeNode(&pWrkrData->nodes[n]);
+		} else {
+			freeReplyObject(reply);
+			reply = NULL;
+		}
+	}
+	if(reply == NULL) {
+		if(!bSilent)
+			errmsg.LogError(0, RS_RET_SUSPENDED, "omhiredis: can not obtain "
+				"cluster slot map from any node");
 		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
+
+	/* each entry: start slot, end slot, master [host, port, ...], replicas... */
+	for(i = 0 ; i < reply->elements ; ++i) {
+		range = reply->element[i];
+		if(   range->type != REDIS_REPLY_ARRAY || range->elements < 3
+		   || range->element[2]->type != REDIS_REPLY_ARRAY
+		   || range->element[2]->elements < 2)
+			continue;
+		master = range->element[2];
+		CHKiRet(getNode(pWrkrData, master->element[0]->str,
+				(int) master->element[1]->integer, &iNode));
+		for(slot = range->element[0]->integer ;
+		    slot <= range->element[1]->integer && slot < REDIS_CLUSTER_SLOTS ; ++slot)
+			pWrkrData->slotMap[slot] = (short) iNode;
+	}
+	DBGPRINTF("omhiredis: cluster slot map loaded, %d nodes known\n", pWrkrData->nNodes);
+
+finalize_it:
+	if(reply != NULL)
+		freeReplyObject(reply);
+	RETiRet;
+}
+
+/*  add a value to the group of its key, creating the group if needed */
+static rsRetVal addToGroup(wrkrInstanceData_t *pWrkrData, const char *key, const char *value)
+{
+	const size_t lenKey = strlen(key);
+	keyGroup_t *grp;
+	keyGroup_t *newGroups;
+	char **newValues;
+	size_t *newLens;
+	int i;
+	DEFiRet;
+
+	i = pWrkrData->iLastGroup;
+	if(   i >= pWrkrData->nGroups
+	   || pWrkrData->groups[i].lenKey != lenKey
+	   || memcmp(pWrkrData->groups[i].key, key, lenKey)) {
+		for(i = 0 ; i < pWrkrData->nGroups ; ++i) {
+			if(   pWrkrData->groups[i].lenKey == lenKey
+			   && !memcmp(pWrkrData->groups[i].key, key, lenKey))
+				break;
+		}
+	}
+	if(i == pWrkrData->nGroups) {
+		if(i == pWrkrData->maxGroups) {
+			CHKmalloc(newGroups = realloc(pWrkrData->groups, (i + 1) * sizeof(keyGroup_t)));
+			pWrkrData->groups = newGroups;
+			memset(&newGroups[i], 0, sizeof(keyGroup_t));
+			++pWrkrData->maxGroups;
+		}
+		grp = &pWrkrData->groups[i];
+		free(grp->key);
+		CHKmalloc(grp->key = strdup(key));
+		grp->lenKey = lenKey;
+		grp->nValues = 0;
+		grp->bMoved = 0;
+		++pWrkrData->nGroups;
+	}
+	pWrkrData->iLastGroup = i;
+	grp = &pWrkrData->groups[i];
+
+	if(grp->nValues == grp->maxValues) {
+		const int newMax = (grp->maxValues == 0) ? 16 : 2 * grp->maxValues;
+		/* argv also holds command and key, so we reserve two extra entries */
+		CHKmalloc(newValues = realloc(grp->values, (newMax + 2) * sizeof(char*)));
+		grp->values = newValues;
+		CHKmalloc(newLens = realloc(grp->lenValues, (newMax + 2) * sizeof(size_t)));
+		grp->lenValues = newLens;
+		grp->maxValues = newMax;
+	}
+	CHKmalloc(grp->values[grp->nValues] = strdup(value));
+	grp->lenValues[grp->nValues] = strlen(value);
+	++grp->nValues;
+finalize_it:
+	RETiRet;
+}
+
+/*  queue the push commands for a group on the connection of the node
+ *  owning its key. Large groups are split into several commands. */
+static rsRetVal appendGroup(wrkrInstanceData_t *pWrkrData, keyGroup_t *grp)
+{
+	instanceData *pData = pWrkrData->pData;
+	redisNode_t *node;
+	int iVal, n;
+	DEFiRet;
+
+	grp->iNode = pData->bCluster ? pWrkrData->slotMap[keySlot(grp->key, grp->lenKey)] : 0;
+	grp->nCmds = 0;
+	node = &pWrkrData->nodes[grp->iNode];
+	CHKiRet(connectNode(node, 0));
+
+	pWrkrData->argv[0] = pData->bRPush ? "RPUSH" : "LPUSH";
+	pWrkrData->argvlen[0] = 5;
+	pWrkrData->argv[1] = grp->key;
+	pWrkrData->argvlen[1] = grp->lenKey;
+	for(iVal = 0 ; iVal < grp->nValues ; iVal += n) {
+		n = grp->nValues - iVal;
+		if(n > MAX_PUSH_VALUES)
+			n = MAX_PUSH_VALUES;
+		memcpy(pWrkrData->argv + 2, grp->values + iVal, n * sizeof(char*));
+		memcpy(pWrkrData->argvlen + 2, grp->lenValues + iVal, n * sizeof(size_t));
+		if(redisAppendCommandArgv(node->conn, n + 2, pWrkrData->argv,
+					  pWrkrData->argvlen) != REDIS_OK) {
+			errmsg.LogError(0, RS_RET_SUSPENDED, "omhiredis: %s", node->conn->errstr);
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+		++grp->nCmds;
+	}
+finalize_it:
+	RETiRet;
+}
+
+/*  read the replies to the commands of a group */
+static rsRetVal readGroupReplies(wrkrInstanceData_t *pWrkrData, keyGroup_t *grp,
+	int *pbMoved, int *pbDataErr)
+{
+	redisNode_t *node = &pWrkrData->nodes[grp->iNode];
+	redisReply *reply;
+	int i;
+	DEFiRet;
+
+	grp->bMoved = 0;
+	for(i = 0 ; i < grp->nCmds ; ++i) {
+		if(redisGetReply(node->conn, (void**) &reply) != REDIS_OK) {
+			errmsg.LogError(0, RS_RET_SUSPENDED, "omhiredis: %s", node->conn->errstr);
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+		if(reply->type == REDIS_REPLY_ERROR) {
+			if(   pWrkrData->pData->bCluster
+			   && (!strncmp(reply->str, "MOVED ", 6) || !strncmp(reply->str, "ASK ", 4))) {
+				DBGPRINTF("omhiredis: key '%s': %s\n", grp->key, reply->str);
+				grp->bMoved = 1;
+				*pbMoved = 1;
+			} else {
+				errmsg.LogError(0, RS_RET_DATAFAIL, "omhiredis: push to key '%s' "
+					"failed: %s", grp->key, reply->str);
+				*pbDataErr = 1;
+			}
+		}
+		freeReplyObject(reply);
+	}
+finalize_it:
+	RETiRet;
+}
+
+/*  send the groups of the current transaction (or only those that were
+ *  redirected) and collect all replies. Commands to different nodes are
+ *  pipelined in parallel, as all are appended before the first reply is
+ *  read. */
+static rsRetVal sendGroups(wrkrInstanceData_t *pWrkrData, int bOnlyMoved, int *pbMoved)
+{
+	int bDataErr = 0;
+	int i;
+	DEFiRet;
+
+	*pbMoved = 0;
+	for(i = 0 ; i < pWrkrData->nGroups ; ++i) {
+		if(bOnlyMoved && !pWrkrData->groups[i].bMoved)
+			continue;
+		CHKiRet(appendGroup(pWrkrData, &pWrkrData->groups[i]));
+	}
+	for(i = 0 ; i < pWrkrData->nGroups ; ++i) {
+		if(bOnlyMoved && !pWrkrData->groups[i].bMoved)
+			continue;
+		CHKiRet(readGroupReplies(pWrkrData, &pWrkrData->groups[i], pbMoved, &bDataErr));
+	}
+	if(bDataErr)
+		iRet = RS_RET_DATAFAIL;
+
 finalize_it:
+	if(iRet == RS_RET_SUSPENDED) {
+		/* replies still pending on the other connections, so start over */
+		for(i = 0 ; i < pWrkrData->nNodes ; ++i)
+			closeNode(&pWrkrData->nodes[i]);
+	}
+	RETiRet;
+}
+
+/*  the queue mode commit: one variadic push per key */
+static rsRetVal commitQueue(wrkrInstanceData_t *pWrkrData)
+{
+	int bMoved;
+	DEFiRet;
+
+	if(pWrkrData->nGroups == 0)
+		FINALIZE;
+	if(pWrkrData->pData->bCluster && !pWrkrData->bSlotsLoaded)
+		CHKiRet(refreshSlots(pWrkrData, 0));
+	CHKiRet(sendGroups(pWrkrData, 0, &bMoved));
+	if(bMoved) {
+		/* slots were moved to other nodes, reload map and retry once */
+		CHKiRet(refreshSlots(pWrkrData, 0));
+		CHKiRet(sendGroups(pWrkrData, 1, &bMoved));
+		if(bMoved)
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+finalize_it:
+	resetGroups(pWrkrData);
 	RETiRet;
 }
 
@@ -174,8 +595,14 @@ finalize_it:
  *  try to restablish our connection to redis */
 BEGINtryResume
 CODESTARTtryResume
-	if(pWrkrData->conn == NULL)
+	if(pWrkrData->pData->mode == OMHIREDIS_MODE_QUEUE) {
+		if(pWrkrData->pData->bCluster)
+			iRet = refreshSlots(pWrkrData, 1);
+		else
+			iRet = connectNode(&pWrkrData->nodes[0], 1);
+	} else if(pWrkrData->conn == NULL) {
 		iRet = initHiredis(pWrkrData, 0);
+	}
 ENDtryResume
 
 /*  begin a transaction.
@@ -186,14 +613,21 @@ BEGINbeginTransaction
 CODESTARTbeginTransaction
 	dbgprintf("omhiredis: beginTransaction called\n");
 	pWrkrData->count = 0;
+	resetGroups(pWrkrData); /* leftovers of a failed transaction */
 ENDbeginTransaction
 
-/*  call writeHiredis for this log line,
- *  which appends it as a command to the
- *  current pipeline */
+/*  in template mode, call writeHiredis for this
+ *  log line, which appends it as a command to the
+ *  current pipeline. in queue mode, just remember
+ *  the message, it is pushed on commit. */
 BEGINdoAction
 CODESTARTdoAction
-	CHKiRet(writeHiredis(ppString[0], pWrkrData));
+	if(pWrkrData->pData->mode == OMHIREDIS_MODE_QUEUE) {
+		CHKiRet(addToGroup(pWrkrData, pWrkrData->pData->dynaKey ?
+			(char*) ppString[1] : (char*) pWrkrData->pData->key, (char*) ppString[0]));
+	} else {
+		CHKiRet(writeHiredis(ppString[0], pWrkrData));
+	}
 	iRet = RS_RET_DEFER_COMMIT;
 finalize_it:
 ENDdoAction
@@ -208,6 +642,10 @@ BEGINendTransaction
 CODESTARTendTransaction
 	dbgprintf("omhiredis: endTransaction called\n");
 	int i;
+	if(pWrkrData->pData->mode == OMHIREDIS_MODE_QUEUE) {
+		iRet = commitQueue(pWrkrData);
+		FINALIZE;
+	}
 	pWrkrData->replies = malloc ( sizeof ( redisReply* ) * pWrkrData->count );
 	for ( i = 0; i < pWrkrData->count; i++ ) {
 		redisGetReply ( pWrkrData->conn, (void *)&pWrkrData->replies[i] );
@@ -215,6 +653,7 @@ CODESTARTendTransaction
 		freeReplyObject ( pWrkrData->replies[i] );
 	}
 	free ( pWrkrData->replies );
+finalize_it:
 ENDendTransaction
 
 /*  set defaults. note server is set to NULL 
@@ -227,6 +666,11 @@ setInstParamDefaults(instanceData *pData)
 	pData->server = NULL;
 	pData->port = 6379;
 	pData->tplName = NULL;
+	pData->mode = OMHIREDIS_MODE_TEMPLATE;
+	pData->key = NULL;
+	pData->dynaKey = 0;
+	pData->bRPush = 0;
+	pData->bCluster = 0;
 }
 
 /*  here is where the work to set up a new instance
@@ -243,7 +687,6 @@ CODESTARTnewActInst
 	CHKiRet(createInstance(&pData));
 	setInstParamDefaults(pData);
 
-	CODE_STD_STRING_REQUESTnewActInst(1)
 	for(i = 0 ; i < actpblk.nParams ; ++i) {
 		if(!pvals[i].bUsed)
 			continue;
@@ -254,20 +697,65 @@ CODESTARTnewActInst
 			pData->port = (int) pvals[i].val.d.n, NULL;
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "mode")) {
+			if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"template", sizeof("template")-1)) {
+				pData->mode = OMHIREDIS_MODE_TEMPLATE;
+			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"queue", sizeof("queue")-1)) {
+				pData->mode = OMHIREDIS_MODE_QUEUE;
+			} else {
+				errmsg.LogError(0, RS_RET_INVLD_MODE, "omhiredis: invalid mode, "
+					"must be \"template\" or \"queue\"");
+				ABORT_FINALIZE(RS_RET_INVLD_MODE);
+			}
+		} else if(!strcmp(actpblk.descr[i].name, "key")) {
+			pData->key = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "dynakey")) {
+			pData->dynaKey = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "queue.push")) {
+			if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"lpush", sizeof("lpush")-1)) {
+				pData->bRPush = 0;
+			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"rpush", sizeof("rpush")-1)) {
+				pData->bRPush = 1;
+			} else {
+				errmsg.LogError(0, RS_RET_INVALID_PARAMS, "omhiredis: invalid "
+					"queue.push, must be \"lpush\" or \"rpush\"");
+				ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+			}
+		} else if(!strcmp(actpblk.descr[i].name, "cluster")) {
+			pData->bCluster = (sbool) pvals[i].val.d.n;
 		} else {
 			dbgprintf("omhiredis: program error, non-handled "
 				"param '%s'\n", actpblk.descr[i].name);
 		}
 	}
 
-	if(pData->tplName == NULL) {
-		dbgprintf("omhiredis: action requires a template name");
-		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+	if(pData->mode == OMHIREDIS_MODE_QUEUE) {
+		if(pData->key == NULL) {
+			errmsg.LogError(0, RS_RET_MISSING_CNFPARAMS, "omhiredis: queue mode "
+				"requires a key");
+			ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+		}
+		/* template 0 is the value pushed, 1 the key if it is dynamic */
+		CODE_STD_STRING_REQUESTnewActInst(pData->dynaKey ? 2 : 1)
+		CHKiRet(OMSRsetEntry(*ppOMSR, 0, (uchar*)strdup((pData->tplName == NULL) ?
+			"RSYSLOG_ForwardFormat" : (char*)pData->tplName), OMSR_NO_RQD_TPL_OPTS));
+		if(pData->dynaKey)
+			CHKiRet(OMSRsetEntry(*ppOMSR, 1, (uchar*)strdup((char*)pData->key), OMSR_NO_RQD_TPL_OPTS));
+	} else {
+		if(pData->tplName == NULL) {
+			dbgprintf("omhiredis: action requires a template name");
+			ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+		}
+		if(pData->bCluster) {
+			errmsg.LogError(0, RS_RET_INVALID_PARAMS, "omhiredis: cluster mode "
+				"is only supported in queue mode");
+			ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+		}
+		CODE_STD_STRING_REQUESTnewActInst(1)
+		/* template string 0 is just a regular string */
+		CHKiRet(OMSRsetEntry(*ppOMSR, 0, (uchar*)strdup((char*)pData->tplName), OMSR_NO_RQD_TPL_OPTS));
 	}
 
-	/* template string 0 is just a regular string */
-	OMSRsetEntry(*ppOMSR, 0,(uchar*)pData->tplName, OMSR_NO_RQD_TPL_OPTS);
-
 CODE_STD_FINALIZERnewActInst
 	cnfparamvalsDestruct(pvals, &actpblk);
 ENDnewActInst
@@ -33,13 +33,17 @@
 #include <assert.h>
 #include <signal.h>
 #include <errno.h>
+#include <ctype.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <json.h>
 #include "conf.h"
 #include "syslogd-types.h"
 #include "srUtils.h"
 #include "template.h"
 #include "module-template.h"
 #include "errmsg.h"
+#include "msg.h"
 #include <systemd/sd-journal.h>
 
 MODULE_TYPE_OUTPUT
@@ -52,12 +56,35 @@ DEF_OMOD_STATIC_DATA
 
 /* config variables */
 
+#define MAX_FIELDNAME_LEN 64	/* journald limit for field names */
+
+/* the standard fields we add from the message object. In subtree mode,
+ * they are only added if the subtree does not provide them.
+ */
+#define STDFLD_MESSAGE		0x01
+#define STDFLD_PRIORITY		0x02
+#define STDFLD_FACILITY		0x04
+#define STDFLD_IDENTIFIER	0x08
+#define STDFLD_ALL		0x0f
 
 typedef struct _instanceData {
+	uchar *tplName;		/* JSON template to use, NULL if none */
+	msgPropDescr_t *pSubtree; /* JSON subtree to use, NULL if none */
 } instanceData;
 
+/* The journal entry is built in a single buffer, each field being
+ * "NAME=value". The iovec is filled only after all fields are added,
+ * as the buffer may be moved by realloc() while we build it.
+ */
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	struct iovec *iov;
+	size_t *offsFld;	/* offsets of the fields inside buf */
+	int nFlds;
+	int sizeFlds;
+	char *buf;
+	size_t lenBuf;
+	size_t sizeBuf;
 } wrkrInstanceData_t;
 
 struct modConfData_s {
@@ -66,6 +93,17 @@ struct modConfData_s {
 static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
 static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current exec process */
 
+/* action (instance) parameters */
+static struct cnfparamdescr actpdescr[] = {
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "subtree", eCmdHdlrGetWord, 0 }
+};
+static struct cnfparamblk actpblk =
+	{ CNFPARAMBLK_VERSION,
+	  sizeof(actpdescr)/sizeof(struct cnfparamdescr),
+	  actpdescr
+	};
+
 BEGINbeginCnfLoad
 CODESTARTbeginCnfLoad
 	loadModConf = pModConf;
@@ -97,6 +135,13 @@ ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->iov = NULL;
+	pWrkrData->offsFld = NULL;
+	pWrkrData->nFlds = 0;
+	pWrkrData->sizeFlds = 0;
+	pWrkrData->buf = NULL;
+	pWrkrData->lenBuf = 0;
+	pWrkrData->sizeBuf = 0;
 ENDcreateWrkrInstance
 
 
@@ -107,28 +152,82 @@ ENDisCompatibleWithFeature
 
 BEGINfreeInstance
 CODESTARTfreeInstance
+	free(pData->tplName);
+	if(pData->pSubtree != NULL) {
+		msgPropDescrDestruct(pData->pSubtree);
+		free(pData->pSubtree);
+	}
 ENDfreeInstance
 
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	free(pWrkrData->iov);
+	free(pWrkrData->offsFld);
+	free(pWrkrData->buf);
 ENDfreeWrkrInstance
 
 
+static inline void
+setInstParamDefaults(instanceData *pData)
+{
+	pData->tplName = NULL;
+	pData->pSubtree = NULL;
+}
+
+
 BEGINnewActInst
+	struct cnfparamvals *pvals;
+	char *cstr;
+	int i;
 CODESTARTnewActInst
-	/* Note: we currently do not have any parameters, so we do not need
-	 * the lst ptr. However, we will most probably need params in the 
-	 * future.
-	 */
-	(void) lst; /* prevent compiler warning */
-	DBGPRINTF("newActInst (mmjournal)\n");
-	CODE_STD_STRING_REQUESTnewActInst(1)
-	CHKiRet(OMSRsetEntry(*ppOMSR, 0, NULL, OMSR_TPL_AS_MSG));
+	DBGPRINTF("newActInst (omjournal)\n");
+	if((pvals = nvlstGetParams(lst, &actpblk, NULL)) == NULL) {
+		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+	}
+
 	CHKiRet(createInstance(&pData));
-	/*setInstParamDefaults(pData);*/
+	setInstParamDefaults(pData);
+
+	for(i = 0 ; i < actpblk.nParams ; ++i) {
+		if(!pvals[i].bUsed)
+			continue;
+		if(!strcmp(actpblk.descr[i].name, "template")) {
+			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "subtree")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			CHKmalloc(pData->pSubtree = calloc(1, sizeof(msgPropDescr_t)));
+			if(   (cstr[0] != '$' || (cstr[1] != '!' && cstr[1] != '.' && cstr[1] != '/'))
+			   || msgPropDescrFill(pData->pSubtree, (uchar*) cstr, strlen(cstr)) != RS_RET_OK) {
+				errmsg.LogError(0, RS_RET_INVALID_PARAMS, "omjournal: subtree '%s' "
+						"is not a JSON variable (like $!journal)", cstr);
+				free(pData->pSubtree);
+				pData->pSubtree = NULL;
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+			}
+			free(cstr);
+		} else {
+			DBGPRINTF("omjournal: program error, non-handled param '%s'\n",
+				  actpblk.descr[i].name);
+		}
+	}
+
+	if(pData->tplName != NULL && pData->pSubtree != NULL) {
+		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "omjournal: template and subtree "
+				"are mutually exclusive");
+		ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+	}
+
+	CODE_STD_STRING_REQUESTnewActInst(1)
+	if(pData->tplName == NULL) {
+		CHKiRet(OMSRsetEntry(*ppOMSR, 0, NULL, OMSR_TPL_AS_MSG));
+	} else {
+		CHKiRet(OMSRsetEntry(*ppOMSR, 0, (uchar*)strdup((char*)pData->tplName),
+				     OMSR_TPL_AS_JSON));
+	}
 CODE_STD_FINALIZERnewActInst
-/*	cnfparamvalsDestruct(pvals, &actpblk);*/
+	cnfparamvalsDestruct(pvals, &actpblk);
 ENDnewActInst
 
 
@@ -141,26 +240,185 @@ BEGINtryResume
 CODESTARTtryResume
 ENDtryResume
 
-BEGINdoAction
-	msg_t *pMsg;
+/* make room for one more field of the given maximum size */
+static rsRetVal
+prepareField(wrkrInstanceData_t *pWrkrData, size_t lenFld)
+{
+	int newFlds;
+	size_t newSize;
+	size_t *newOffs;
+	char *newBuf;
+	DEFiRet;
+
+	if(pWrkrData->nFlds == pWrkrData->sizeFlds) {
+		newFlds = (pWrkrData->sizeFlds == 0) ? 16 : 2 * pWrkrData->sizeFlds;
+		CHKmalloc(newOffs = realloc(pWrkrData->offsFld, newFlds * sizeof(size_t)));
+		pWrkrData->offsFld = newOffs;
+		free(pWrkrData->iov);
+		pWrkrData->iov = NULL;
+		CHKmalloc(pWrkrData->iov = malloc(newFlds * sizeof(struct iovec)));
+		pWrkrData->sizeFlds = newFlds;
+	}
+	if(pWrkrData->lenBuf + lenFld > pWrkrData->sizeBuf) {
+		newSize = 2 * pWrkrData->sizeBuf;
+		if(newSize < pWrkrData->lenBuf + lenFld)
+			newSize = pWrkrData->lenBuf + lenFld + 1024;
+		CHKmalloc(newBuf = realloc(pWrkrData->buf, newSize));
+		pWrkrData->buf = newBuf;
+		pWrkrData->sizeBuf = newSize;
+	}
+
+finalize_it:
+	if(iRet != RS_RET_OK)
+		pWrkrData->sizeFlds = 0; /* iov is gone, so we must re-alloc next time */
+	RETiRet;
+}
+
+
+/* add a field with a name that is known to be valid */
+static rsRetVal
+addField(wrkrInstanceData_t *pWrkrData, const char *name, const char *val, size_t lenVal)
+{
+	size_t lenName;
+	char *p;
+	DEFiRet;
+
+	lenName = strlen(name);
+	CHKiRet(prepareField(pWrkrData, lenName + 1 + lenVal));
+	p = pWrkrData->buf + pWrkrData->lenBuf;
+	memcpy(p, name, lenName);
+	p[lenName] = '=';
+	memcpy(p + lenName + 1, val, lenVal);
+	pWrkrData->offsFld[pWrkrData->nFlds] = pWrkrData->lenBuf;
+	pWrkrData->iov[pWrkrData->nFlds].iov_len = lenName + 1 + lenVal;
+	pWrkrData->lenBuf += lenName + 1 + lenVal;
+	++pWrkrData->nFlds;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* Add the members of a JSON object as journal fields. Names are mapped to
+ * what journald accepts: upper case letters, digits and underscores, not
+ * starting with an underscore (those are trusted fields) and at most 64
+ * characters. Non-string values are added in their JSON representation.
+ * The standard fields found are flagged in *pFound.
+ */
+static rsRetVal
+addJSONFields(wrkrInstanceData_t *pWrkrData, struct json_object *json, int *pFound)
+{
+	struct json_object_iter it;
+	char name[MAX_FIELDNAME_LEN+1];
+	const char *key;
+	const char *val;
+	int i;
+	DEFiRet;
+
+	json_object_object_foreachC(json, it) {
+		if(it.val == NULL)
+			continue;
+		key = it.key;
+		while(*key == '_')
+			++key;
+		for(i = 0 ; key[i] != '\0' && i < MAX_FIELDNAME_LEN ; ++i) {
+			name[i] = isalnum((unsigned char)key[i]) ?
+				toupper((unsigned char)key[i]) : '_';
+		}
+		name[i] = '\0';
+		if(i == 0 || isdigit((unsigned char)name[0])) {
+			DBGPRINTF("omjournal: field '%s' can not be mapped to a "
+				  "journal field name, ignored\n", it.key);
+			continue;
+		}
+		if(!strcmp(name, "MESSAGE"))
+			*pFound |= STDFLD_MESSAGE;
+		else if(!strcmp(name, "PRIORITY"))
+			*pFound |= STDFLD_PRIORITY;
+		else if(!strcmp(name, "SYSLOG_FACILITY"))
+			*pFound |= STDFLD_FACILITY;
+		else if(!strcmp(name, "SYSLOG_IDENTIFIER"))
+			*pFound |= STDFLD_IDENTIFIER;
+		val = json_object_get_string(it.val);
+		CHKiRet(addField(pWrkrData, name, val, strlen(val)));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* add the standard fields that have not yet been set */
+static rsRetVal
+addStdFields(wrkrInstanceData_t *pWrkrData, msg_t *pMsg, int found)
+{
+	char numBuf[16];
+	uchar *msg;
 	uchar *tag;
 	int lenTag;
 	int sev;
-	int r;
-CODESTARTdoAction
-	pMsg = (msg_t*) ppString[0];
-	MsgGetSeverity(pMsg, &sev);
-	getTAG(pMsg, &tag, &lenTag);
+	DEFiRet;
+
 	/* we can use more properties here, but let's see if there
 	 * is some real user interest. We can always add later...
 	 */
-	r = sd_journal_send("MESSAGE=%s", getMSG(pMsg),
-                "PRIORITY=%d", sev,
-		"SYSLOG_FACILITY=%d", pMsg->iFacility,
-		"SYSLOG_IDENTIFIER=%s", tag,
-                NULL);
+	if(!(found & STDFLD_MESSAGE)) {
+		msg = getMSG(pMsg);
+		CHKiRet(addField(pWrkrData, "MESSAGE", (char*)msg, strlen((char*)msg)));
+	}
+	if(!(found & STDFLD_PRIORITY)) {
+		MsgGetSeverity(pMsg, &sev);
+		CHKiRet(addField(pWrkrData, "PRIORITY", numBuf,
+				 snprintf(numBuf, sizeof(numBuf), "%d", sev)));
+	}
+	if(!(found & STDFLD_FACILITY)) {
+		CHKiRet(addField(pWrkrData, "SYSLOG_FACILITY", numBuf,
+				 snprintf(numBuf, sizeof(numBuf), "%d", pMsg->iFacility)));
+	}
+	if(!(found & STDFLD_IDENTIFIER)) {
+		getTAG(pMsg, &tag, &lenTag);
+		CHKiRet(addField(pWrkrData, "SYSLOG_IDENTIFIER", (char*)tag, lenTag));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* The entry is passed to journald as an iovec, one element per field.
+ * This avoids format string processing and copies inside libsystemd
+ * and permits an arbitrary number of fields.
+ */
+BEGINdoAction
+	instanceData *pData = pWrkrData->pData;
+	struct json_object *json;
+	int found = 0;
+	int i;
+	int r;
+CODESTARTdoAction
+	pWrkrData->nFlds = 0;
+	pWrkrData->lenBuf = 0;
+	if(pData->tplName != NULL) {
+		json = (struct json_object*) ppString[0];
+		CHKiRet(addJSONFields(pWrkrData, json, &found));
+	} else {
+		if(pData->pSubtree != NULL
+		   && msgGetJSONPropJSON((msg_t*) ppString[0], pData->pSubtree, &json) == RS_RET_OK
+		   && json_object_get_type(json) == json_type_object) {
+			CHKiRet(addJSONFields(pWrkrData, json, &found));
+		}
+		CHKiRet(addStdFields(pWrkrData, (msg_t*) ppString[0], found));
+	}
+
+	if(pWrkrData->nFlds == 0)
+		FINALIZE;
+	for(i = 0 ; i < pWrkrData->nFlds ; ++i)
+		pWrkrData->iov[i].iov_base = pWrkrData->buf + pWrkrData->offsFld[i];
+	r = sd_journal_sendv(pWrkrData->iov, pWrkrData->nFlds);
 	/* FIXME: think about what to do with errors ;) */
-	(void) r; /* prevent compiler warning */
+	if(r < 0)
+		DBGPRINTF("omjournal: sd_journal_sendv failed: %d\n", r);
+finalize_it:
 ENDdoAction
 
 
@@ -38,6 +38,7 @@
 #include <signal.h>
 #include <errno.h>
 #include <time.h>
+#include <ctype.h>
 #include <dbi/dbi.h>
 #include "dirty.h"
 #include "syslogd-types.h"
@@ -74,10 +75,18 @@ typedef struct _instanceData {
 	unsigned uLastDBErrno;	/* last errno returned by libdbi or 0 if all is well */
 	uchar	*tplName;       /* format template to use */
 	int txSupport;		/* transaction support */
+	int batchMaxRows;	/* max rows per multi-row INSERT, 1 means no batching */
+	int batchMaxBytes;	/* max size of a multi-row INSERT statement */
+	sbool bBackslashEsc;	/* backend uses backslash escapes inside strings (MySQL) */
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	uchar *sqlBuf;		/* multi-row INSERT under construction */
+	size_t lenSqlBuf;	/* bytes used in sqlBuf */
+	size_t maxSqlBuf;	/* size of sqlBuf */
+	size_t lenPrefix;	/* length of the "INSERT ... VALUES" part of sqlBuf */
+	int nRows;		/* number of rows in sqlBuf */
 } wrkrInstanceData_t;
 
 typedef struct configSettings_s {
@@ -122,7 +131,9 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "uid", eCmdHdlrGetWord, 1 },
 	{ "pwd", eCmdHdlrGetWord, 1 },
 	{ "driver", eCmdHdlrGetWord, 1 },
-	{ "template", eCmdHdlrGetWord, 0 }
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "batch.maxrows", eCmdHdlrPositiveInt, 0 },
+	{ "batch.maxbytes", eCmdHdlrSize, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -168,6 +179,11 @@ ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->sqlBuf = NULL;
+	pWrkrData->lenSqlBuf = 0;
+	pWrkrData->maxSqlBuf = 0;
+	pWrkrData->lenPrefix = 0;
+	pWrkrData->nRows = 0;
 ENDcreateWrkrInstance
 
 
@@ -202,6 +218,7 @@ ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	free(pWrkrData->sqlBuf);
 ENDfreeWrkrInstance
 
 BEGINdbgPrintInstInfo
@@ -300,9 +317,12 @@ finalize_it:
 
 
 /* The following function writes the current log entry
- * to an established database connection.
+ * to an established database connection. On failure, the connection is
+ * re-established and the statement retried once. If it then fails on a
+ * live connection, the server rejected it and RS_RET_DATAFAIL is returned,
+ * as further retries would not help.
  */
-rsRetVal writeDB(uchar *psz, instanceData *pData)
+static rsRetVal writeDB(uchar *psz, instanceData *pData)
 {
 	DEFiRet;
 	dbi_result dbiRes = NULL;
@@ -321,8 +341,10 @@ rsRetVal writeDB(uchar *psz, instanceData *pData)
 		closeConn(pData); /* close the current handle */
 		CHKiRet(initConn(pData, 0)); /* try to re-open */
 		if((dbiRes = dbi_conn_query(pData->conn, (const char*)psz)) == NULL) { /* re-try insert */
-			/* we failed, giving up for now */
 			reportDBError(pData, 0);
+			if(dbi_conn_ping(pData->conn) == 1)
+				ABORT_FINALIZE(RS_RET_DATAFAIL);
+			/* we failed, giving up for now */
 			closeConn(pData); /* free ressources */
 			ABORT_FINALIZE(RS_RET_SUSPENDED);
 		}
@@ -340,6 +362,168 @@ finalize_it:
 }
 
 
+/* write a single row and record its result. A row that was rejected by
+ * the server is marked as failed, only connection errors are returned.
+ */
+static rsRetVal
+writeRow(instanceData *pData, uchar *psz, rsRetVal *const pResult)
+{
+	DEFiRet;
+
+	iRet = writeDB(psz, pData);
+	if(iRet == RS_RET_OK || iRet == RS_RET_DATAFAIL) {
+		*pResult = iRet;
+		iRet = RS_RET_OK;
+	}
+	RETiRet;
+}
+
+
+/* Check if a statement has the form "INSERT ... VALUES (<row>)", so that
+ * it can be merged with others into a multi-row INSERT. On success,
+ * *lenPrefix is the length of the part up to and including VALUES and
+ * [offsRow, offsRow + lenRow) is the row tuple including its parenthesis.
+ * We do not try to understand SQL. The VALUES keyword must come before any
+ * quoted text and the parenthesis opened after it must be closed at the end
+ * of the statement (trailing blanks and ';' are ignored), which rules out
+ * things like ON DUPLICATE KEY UPDATE clauses.
+ */
+static int
+splitInsert(instanceData *pData, const uchar *sql, size_t len,
+	size_t *lenPrefix, size_t *offsRow, size_t *lenRow)
+{
+	size_t i;
+	int depth;
+	uchar quote;
+
+	while(len > 0 && (isspace(sql[len-1]) || sql[len-1] == ';'))
+		--len;
+	for(i = 0 ; i < len && isspace(sql[i]) ; ++i)
+		/* just skip */;
+	if(len - i < 6 || strncasecmp((char*)sql + i, "insert", 6))
+		return 0;
+
+	for( ; i + 6 <= len ; ++i) {
+		if(sql[i] == '\'' || sql[i] == '"' || sql[i] == '`')
+			return 0;
+		if(   !strncasecmp((char*)sql + i, "values", 6)
+		   && isspace(sql[i-1]) && (i + 6 == len || !isalnum(sql[i+6])))
+			break;
+	}
+	if(i + 6 > len)
+		return 0;
+	*lenPrefix = i + 6;
+
+	for(i += 6 ; i < len && isspace(sql[i]) ; ++i)
+		/* just skip */;
+	if(i == len || sql[i] != '(')
+		return 0;
+	*offsRow = i;
+
+	depth = 0;
+	quote = '\0';
+	for( ; i < len ; ++i) {
+		if(quote != '\0') {
+			if(sql[i] == '\\' && pData->bBackslashEsc)
+				++i;
+			else if(sql[i] == quote)
+				quote = '\0'; /* a doubled quote simply re-opens the string */
+		} else if(sql[i] == '\'' || sql[i] == '"' || sql[i] == '`') {
+			quote = sql[i];
+		} else if(sql[i] == '(') {
+			++depth;
+		} else if(sql[i] == ')') {
+			if(--depth == 0)
+				break;
+		}
+	}
+	if(i + 1 != len)
+		return 0;
+	*lenRow = len - *offsRow;
+	return 1;
+}
+
+
+/* add a row to the multi-row INSERT under construction. The statement
+ * prefix is taken from the first row.
+ */
+static rsRetVal
+addRow(wrkrInstanceData_t *pWrkrData, const uchar *sql,
+	const size_t lenPrefix, const size_t offsRow, const size_t lenRow)
+{
+	size_t lenNeeded;
+	uchar *newBuf;
+	DEFiRet;
+
+	lenNeeded = pWrkrData->lenSqlBuf + lenRow + 2;
+	if(pWrkrData->nRows == 0)
+		lenNeeded += lenPrefix + 1;
+	if(lenNeeded > pWrkrData->maxSqlBuf) {
+		CHKmalloc(newBuf = realloc(pWrkrData->sqlBuf, lenNeeded + 1024));
+		pWrkrData->sqlBuf = newBuf;
+		pWrkrData->maxSqlBuf = lenNeeded + 1024;
+	}
+
+	if(pWrkrData->nRows == 0) {
+		memcpy(pWrkrData->sqlBuf, sql, lenPrefix);
+		pWrkrData->sqlBuf[lenPrefix] = ' ';
+		pWrkrData->lenSqlBuf = lenPrefix + 1;
+		pWrkrData->lenPrefix = lenPrefix;
+	} else {
+		pWrkrData->sqlBuf[pWrkrData->lenSqlBuf++] = ',';
+	}
+	memcpy(pWrkrData->sqlBuf + pWrkrData->lenSqlBuf, sql + offsRow, lenRow);
+	pWrkrData->lenSqlBuf += lenRow;
+	pWrkrData->sqlBuf[pWrkrData->lenSqlBuf] = '\0';
+	++pWrkrData->nRows;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* write the multi-row INSERT for messages [iFirst, iEnd). If the server
+ * rejects it, we fall back to inserting the rows of this statement one by
+ * one, so that a single bad row does not take the others with it.
+ */
+static rsRetVal
+flushRows(wrkrInstanceData_t *pWrkrData, actWrkrIParams_t *const pParams,
+	const unsigned iFirst, const unsigned iEnd, rsRetVal *const pResults)
+{
+	instanceData *const pData = pWrkrData->pData;
+	dbi_result dbiRes;
+	unsigned i;
+	DEFiRet;
+
+	if(pWrkrData->nRows == 0)
+		FINALIZE;
+	pWrkrData->nRows = 0;
+
+	if(iEnd - iFirst > 1) {
+		if(pData->conn == NULL) {
+			CHKiRet(initConn(pData, 0));
+		}
+		if((dbiRes = dbi_conn_query(pData->conn, (const char*)pWrkrData->sqlBuf)) != NULL) {
+			dbi_result_free(dbiRes);
+			pData->uLastDBErrno = 0;
+			for(i = iFirst ; i < iEnd ; ++i)
+				pResults[i] = RS_RET_OK;
+			FINALIZE;
+		}
+		DBGPRINTF("omlibdbi: multi-row insert of %u rows failed, "
+			  "falling back to single-row inserts\n", iEnd - iFirst);
+		reportDBError(pData, 1);
+	}
+
+	for(i = iFirst ; i < iEnd ; ++i) {
+		CHKiRet(writeRow(pData, actParam(pParams, 1, i, 0).param, &pResults[i]));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 BEGINtryResume
 CODESTARTtryResume
 	if(pWrkrData->pData->conn == NULL) {
@@ -369,18 +553,42 @@ finalize_it:
 ENDbeginTransaction
 /* end transaction */
 
-BEGINdoAction
-CODESTARTdoAction
+/* Consecutive INSERTs with identical "INSERT ... VALUES" part are merged
+ * into multi-row statements (if batch.maxrows > 1). Statements that can
+ * not be merged are written as they are, in order.
+ */
+BEGINcommitBatch
+	instanceData *const pData = pWrkrData->pData;
+	actWrkrIParams_t *iparam;
+	size_t lenPrefix, offsRow, lenRow;
+	unsigned iFirst = 0; /* first message of the multi-row INSERT under construction */
+	unsigned i;
+CODESTARTcommitBatch
 	pthread_mutex_lock(&mutDoAct);
-	CHKiRet(writeDB(ppString[0], pWrkrData->pData));
-#	if HAVE_DBI_TXSUPP
-	if (pData->txSupport == 1) {
-		iRet = RS_RET_DEFER_COMMIT;
+	pWrkrData->nRows = 0;
+	for(i = 0 ; i < nParams ; ++i) {
+		iparam = &actParam(pParams, 1, i, 0);
+		if(   pData->batchMaxRows <= 1
+		   || !splitInsert(pData, iparam->param, iparam->lenStr, &lenPrefix, &offsRow, &lenRow)) {
+			CHKiRet(flushRows(pWrkrData, pParams, iFirst, i, pResults));
+			CHKiRet(writeRow(pData, iparam->param, &pResults[i]));
+			iFirst = i + 1;
+			continue;
+		}
+		if(   pWrkrData->nRows > 0
+		   && (   pWrkrData->nRows == pData->batchMaxRows
+		       || pWrkrData->lenSqlBuf + lenRow + 1 > (size_t) pData->batchMaxBytes
+		       || lenPrefix != pWrkrData->lenPrefix
+		       || memcmp(iparam->param, pWrkrData->sqlBuf, lenPrefix))) {
+			CHKiRet(flushRows(pWrkrData, pParams, iFirst, i, pResults));
+			iFirst = i;
+		}
+		CHKiRet(addRow(pWrkrData, iparam->param, lenPrefix, offsRow, lenRow));
 	}
-#	endif
+	CHKiRet(flushRows(pWrkrData, pParams, iFirst, nParams, pResults));
 finalize_it:
 	pthread_mutex_unlock(&mutDoAct);
-ENDdoAction
+ENDcommitBatch
 
 /* transaction support 2013-03 */
 BEGINendTransaction
@@ -475,6 +683,27 @@ static inline void
 setInstParamDefaults(instanceData *pData)
 {
 	pData->tplName = NULL;
+	pData->batchMaxRows = 1;
+	pData->batchMaxBytes = 64 * 1024;
+	pData->bBackslashEsc = 0;
+}
+
+
+/* multi-row INSERTs are only used with backends known to support them */
+static void
+checkBatchSupport(instanceData *pData)
+{
+	if(pData->batchMaxRows <= 1)
+		return;
+	if(!strcmp((char*)pData->drvrName, "mysql")) {
+		pData->bBackslashEsc = 1;
+	} else if(   strcmp((char*)pData->drvrName, "pgsql")
+		  && strcmp((char*)pData->drvrName, "sqlite3")) {
+		errmsg.LogError(0, RS_RET_PARAM_ERROR, "omlibdbi: multi-row inserts are "
+				"not supported with driver '%s', batch.maxrows ignored",
+				pData->drvrName);
+		pData->batchMaxRows = 1;
+	}
 }
 
 
@@ -505,11 +734,16 @@ CODESTARTnewActInst
 			pData->drvrName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "batch.maxrows")) {
+			pData->batchMaxRows = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "batch.maxbytes")) {
+			pData->batchMaxBytes = (int) pvals[i].val.d.n;
 		} else {
 			dbgprintf("omlibdbi: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
 		}
 	}
+	checkBatchSupport(pData);
 
 	tplToUse = (pData->tplName == NULL) ? (uchar*)strdup((char*)getDfltTpl()) : pData->tplName;
 	CHKiRet(OMSRsetEntry(*ppOMSR, 0, tplToUse, OMSR_RQD_TPL_OPT_SQL));
@@ -529,6 +763,7 @@ CODE_STD_STRING_REQUESTparseSelectorAct(1)
 
 	/* ok, if we reach this point, we have something for us */
 	CHKiRet(createInstance(&pData));
+	setInstParamDefaults(pData);
 	/* no create the instance based on what we currently have */
 	if(cs.drvrName == NULL) {
 		errmsg.LogError(0, RS_RET_NO_DRIVERNAME, "omlibdbi: no db driver name given - action can not be created");
@@ -569,7 +804,7 @@ ENDmodExit
 
 BEGINqueryEtryPt
 CODESTARTqueryEtryPt
-CODEqueryEtryPt_STD_OMOD_QUERIES
+CODEqueryEtryPt_STD_OMODBATCH_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
 CODEqueryEtryPt_STD_CONF2_QUERIES
 CODEqueryEtryPt_STD_CONF2_setModCnf_QUERIES
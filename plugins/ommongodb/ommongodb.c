@@ -57,9 +57,13 @@ DEF_OMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
 DEFobjCurrIf(datetime)
 
+/* limits for a single batch insert. The server accepts at most 1000
+ * documents per insert and a wire message of 48MB; we stay well below.
+ */
+#define MONGO_MAX_BATCH_DOCS 1000
+#define MONGO_MAX_BATCH_BYTES (16 * 1024 * 1024)
+
 typedef struct _instanceData {
-	mongo_sync_connection *conn;
-	struct json_tokener *json_tokener; /* only if (tplName != NULL) */
 	uchar *server;
 	int port;
         uchar *db;
@@ -68,11 +72,18 @@ typedef struct _instanceData {
 	uchar *pwd;
 	uchar *dbNcoll;
 	uchar *tplName;
-	int bErrMsgPermitted;	/* only one errmsg permitted per connection */
+	sbool bOrdered;		/* stop batch insert at first failing document? */
+	int writeConcernW;	/* "w" of the write concern, 0 = unacknowledged */
+	int writeConcernTimeout;/* wtimeout in ms, 0 = none */
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	mongo_sync_connection *conn;
+	int bErrMsgPermitted;	/* only one errmsg permitted per connection */
+	bson *docs[MONGO_MAX_BATCH_DOCS]; /* documents of the current batch */
+	int nDocs;
+	size_t lenDocs;		/* total BSON size of docs */
 } wrkrInstanceData_t;
 
 
@@ -85,7 +96,10 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "collection", eCmdHdlrGetWord, 0 },
 	{ "uid", eCmdHdlrGetWord, 0 },
 	{ "pwd", eCmdHdlrGetWord, 0 },
-	{ "template", eCmdHdlrGetWord, 0 }
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "bulk.ordered", eCmdHdlrBinary, 0 },
+	{ "writeconcern.w", eCmdHdlrNonNegInt, 0 },
+	{ "writeconcern.wtimeout", eCmdHdlrNonNegInt, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -93,14 +107,15 @@ static struct cnfparamblk actpblk =
 	  actpdescr
 	};
 
-static pthread_mutex_t mutDoAct = PTHREAD_MUTEX_INITIALIZER;
-
 BEGINcreateInstance
 CODESTARTcreateInstance
 ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->conn = NULL;
+	pWrkrData->nDocs = 0;
+	pWrkrData->lenDocs = 0;
 ENDcreateWrkrInstance
 
 BEGINisCompatibleWithFeature
@@ -113,20 +128,30 @@ CODESTARTisCompatibleWithFeature
 		iRet = RS_RET_OK;
 ENDisCompatibleWithFeature
 
-static void closeMongoDB(instanceData *pData)
+static void closeMongoDB(wrkrInstanceData_t *pWrkrData)
 {
-	if(pData->conn != NULL) {
-                mongo_sync_disconnect(pData->conn);
-		pData->conn = NULL;
+	if(pWrkrData->conn != NULL) {
+                mongo_sync_disconnect(pWrkrData->conn);
+		pWrkrData->conn = NULL;
 	}
 }
 
 
+/* discard the documents of the current batch */
+static void
+freeBatch(wrkrInstanceData_t *pWrkrData)
+{
+	int i;
+
+	for(i = 0 ; i < pWrkrData->nDocs ; ++i)
+		bson_free(pWrkrData->docs[i]);
+	pWrkrData->nDocs = 0;
+	pWrkrData->lenDocs = 0;
+}
+
+
 BEGINfreeInstance
 CODESTARTfreeInstance
-	closeMongoDB(pData);
-	if (pData->json_tokener != NULL)
-		json_tokener_free(pData->json_tokener);
 	free(pData->server);
 	free(pData->db);
 	free(pData->collection);
@@ -138,6 +163,8 @@ ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	freeBatch(pWrkrData);
+	closeMongoDB(pWrkrData);
 ENDfreeWrkrInstance
 
 
@@ -151,15 +178,16 @@ ENDdbgPrintInstInfo
 /* report error that occured during *last* operation
  */
 static void
-reportMongoError(instanceData *pData)
+reportMongoError(wrkrInstanceData_t *pWrkrData)
 {
 	char errStr[1024];
 	gchar *err;
 	int eno;
 
-	if(pData->bErrMsgPermitted) {
+	if(pWrkrData->bErrMsgPermitted) {
 		eno = errno;
-		if(mongo_sync_cmd_get_last_error(pData->conn, (gchar*)pData->db, &err) == TRUE) {
+		if(   pWrkrData->conn != NULL
+		   && mongo_sync_cmd_get_last_error(pWrkrData->conn, (gchar*)pWrkrData->pData->db, &err) == TRUE) {
 			errmsg.LogError(0, RS_RET_ERR, "ommongodb: error: %s", err);
 		} else {
 			DBGPRINTF("ommongodb: we had an error, but can not obtain specifics, "
@@ -167,7 +195,7 @@ reportMongoError(instanceData *pData)
 			errmsg.LogError(0, RS_RET_ERR, "ommongodb: error: %s",
 				rs_strerror_r(eno, errStr, sizeof(errStr)));
 		}
-		pData->bErrMsgPermitted = 0;
+		pWrkrData->bErrMsgPermitted = 0;
 	}
 }
 
@@ -176,18 +204,19 @@ reportMongoError(instanceData *pData)
  * MySQL connection.
  * Initially added 2004-10-28 mmeckelein
  */
-static rsRetVal initMongoDB(instanceData *pData, int bSilent)
+static rsRetVal initMongoDB(wrkrInstanceData_t *pWrkrData, int bSilent)
 {
+	instanceData *pData = pWrkrData->pData;
 	char *server;
 	DEFiRet;
 
 	server = (pData->server == NULL) ? "127.0.0.1" : (char*) pData->server;
 	DBGPRINTF("ommongodb: trying connect to '%s' at port %d\n", server, pData->port);
         
-	pData->conn = mongo_sync_connect(server, pData->port, TRUE);
-	if(pData->conn == NULL) {
+	pWrkrData->conn = mongo_sync_connect(server, pData->port, TRUE);
+	if(pWrkrData->conn == NULL) {
 		if(!bSilent) {
-			reportMongoError(pData);
+			reportMongoError(pWrkrData);
 			dbgprintf("ommongodb: can not initialize MongoDB handle");
 		}
                 ABORT_FINALIZE(RS_RET_SUSPENDED);
@@ -200,15 +229,15 @@ static rsRetVal initMongoDB(instanceData *pData, int bSilent)
 	  if(!pData->uid || !pData->pwd) {
 	    dbgprintf("ommongodb: authentication requires uid and pwd attributes set; skipping");
 	  }
-	  else if(!mongo_sync_cmd_authenticate(pData->conn, (const gchar*)pData->db,
+	  else if(!mongo_sync_cmd_authenticate(pWrkrData->conn, (const gchar*)pData->db,
 	  	  			(const gchar*)pData->uid, (const gchar*)pData->pwd)) {
 	    if(!bSilent) {
-	      reportMongoError(pData);
+	      reportMongoError(pWrkrData);
 	      dbgprintf("ommongodb: could not authenticate %s against '%s'", pData->uid, pData->db);
 	    }
 
 	    /* no point in continuing with an unauthenticated connection */
-	    closeMongoDB(pData);	 
+	    closeMongoDB(pWrkrData);	 
 	    ABORT_FINALIZE(RS_RET_SUSPENDED);
 	  }
 	  else {
@@ -457,25 +486,166 @@ error:
 	return NULL;
 }
 
+/* send an unordered batch insert. libmongo-client has no API for this,
+ * so we build the regular insert packet and set the ContinueOnError flag,
+ * which is the first field of OP_INSERT, ourselves. With it, the server
+ * inserts all valid documents of the batch even if some of them fail.
+ */
+static gboolean
+insertUnordered(wrkrInstanceData_t *pWrkrData)
+{
+	mongo_connection *conn = (mongo_connection*) pWrkrData->conn;
+	mongo_packet *p;
+	const guint8 *data;
+	guint8 *flagged = NULL;
+	gint32 lenData;
+	gboolean ok = FALSE;
+
+	p = mongo_wire_cmd_insert_n(mongo_connection_get_requestid(conn) + 1,
+		(gchar*) pWrkrData->pData->dbNcoll, pWrkrData->nDocs,
+		(const bson**) pWrkrData->docs);
+	if(p == NULL)
+		goto done;
+	if((lenData = mongo_wire_packet_get_data(p, &data)) < 4)
+		goto done;
+	if((flagged = malloc(lenData)) == NULL)
+		goto done;
+	memcpy(flagged, data, lenData);
+	flagged[0] |= 0x01; /* ContinueOnError, int32 little endian */
+	if(!mongo_wire_packet_set_data(p, flagged, lenData))
+		goto done;
+	ok = mongo_packet_send(conn, p);
+
+done:
+	free(flagged);
+	if(p != NULL)
+		mongo_wire_packet_free(p);
+	return ok;
+}
+
+
+/* wait for the configured write concern. This is a single getlasterror
+ * round-trip for the whole batch. An error reported by the server is a
+ * problem with the data (e.g. a duplicate key), retrying would not help,
+ * except if the write concern timed out.
+ */
+static rsRetVal
+checkWriteConcern(wrkrInstanceData_t *pWrkrData)
+{
+	instanceData *pData = pWrkrData->pData;
+	bson *cmd = NULL;
+	bson *reply = NULL;
+	bson_cursor *c = NULL;
+	mongo_packet *p = NULL;
+	const gchar *err;
+	gboolean bTimeout = FALSE;
+	DEFiRet;
+
+	cmd = bson_build(BSON_TYPE_INT32, "getlasterror", 1,
+			 BSON_TYPE_INT32, "w", pData->writeConcernW,
+			 BSON_TYPE_INT32, "wtimeout", pData->writeConcernTimeout,
+			 BSON_TYPE_NONE);
+	if(cmd == NULL)
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	bson_finish(cmd);
+	if((p = mongo_sync_cmd_custom(pWrkrData->conn, (gchar*) pData->db, cmd)) == NULL) {
+		dbgprintf("ommongodb: getlasterror failed\n");
+		reportMongoError(pWrkrData);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	if(!mongo_wire_reply_packet_get_nth_document(p, 1, &reply))
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	bson_finish(reply);
+
+	if((c = bson_find(reply, "err")) != NULL && bson_cursor_type(c) == BSON_TYPE_STRING) {
+		bson_cursor_get_string(c, &err);
+		bson_cursor_free(c);
+		if((c = bson_find(reply, "wtimeout")) != NULL)
+			bson_cursor_get_boolean(c, &bTimeout);
+		if(bTimeout) {
+			dbgprintf("ommongodb: write concern timed out: %s\n", err);
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+		errmsg.LogError(0, RS_RET_DATAFAIL, "ommongodb: batch insert of %d documents "
+			"failed%s: %s", pWrkrData->nDocs,
+			pData->bOrdered ? ", remaining documents of batch discarded" : "", err);
+		ABORT_FINALIZE(RS_RET_DATAFAIL);
+	}
+
+finalize_it:
+	if(c != NULL)
+		bson_cursor_free(c);
+	if(reply != NULL)
+		bson_free(reply);
+	if(p != NULL)
+		mongo_wire_packet_free(p);
+	if(cmd != NULL)
+		bson_free(cmd);
+	RETiRet;
+}
+
+
+/* send the documents collected so far with a single insert */
+static rsRetVal
+flushBatch(wrkrInstanceData_t *pWrkrData)
+{
+	gboolean ok;
+	DEFiRet;
+
+	if(pWrkrData->nDocs == 0)
+		FINALIZE;
+
+	if(pWrkrData->conn == NULL) {
+		CHKiRet(initMongoDB(pWrkrData, 0));
+	}
+
+	DBGPRINTF("ommongodb: inserting batch of %d documents, %zu bytes\n",
+		  pWrkrData->nDocs, pWrkrData->lenDocs);
+	if(pWrkrData->pData->bOrdered) {
+		ok = mongo_sync_cmd_insert_n(pWrkrData->conn, (gchar*) pWrkrData->pData->dbNcoll,
+					     pWrkrData->nDocs, (const bson**) pWrkrData->docs);
+	} else {
+		ok = insertUnordered(pWrkrData);
+	}
+	if(!ok) {
+		dbgprintf("ommongodb: insert error\n");
+		reportMongoError(pWrkrData);
+		closeMongoDB(pWrkrData);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	if(pWrkrData->pData->writeConcernW > 0)
+		CHKiRet(checkWriteConcern(pWrkrData));
+	pWrkrData->bErrMsgPermitted = 1;
+
+finalize_it:
+	/* on failure, the core hands us the batch again */
+	freeBatch(pWrkrData);
+	RETiRet;
+}
+
+
 BEGINtryResume
 CODESTARTtryResume
-	if(pWrkrData->pData->conn == NULL) {
-		iRet = initMongoDB(pWrkrData->pData, 1);
+	if(pWrkrData->conn == NULL) {
+		iRet = initMongoDB(pWrkrData, 1);
 	}
 ENDtryResume
 
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+	freeBatch(pWrkrData); /* leftovers of a failed transaction */
+ENDbeginTransaction
+
+/* Documents are built straight from the message (default format) or
+ * from the JSON object the core creates for the template, and are
+ * collected until the transaction ends or a batch limit is reached.
+ */
 BEGINdoAction
 	bson *doc = NULL;
-	instanceData *pData;
+	size_t lenDoc;
+	int bPrevCommitted = 0;
 CODESTARTdoAction
-	pthread_mutex_lock(&mutDoAct);
-	pData = pWrkrData->pData;
-	/* see if we are ready to proceed */
-	if(pData->conn == NULL) {
-		CHKiRet(initMongoDB(pData, 0));
-	}
-
-	if(pData->tplName == NULL) {
+	if(pWrkrData->pData->tplName == NULL) {
 		doc = getDefaultBSON((msg_t*)ppString[0]);
 	} else {
 		doc = BSONFromJSONObject((struct json_object *)ppString[0]);
@@ -485,20 +655,27 @@ CODESTARTdoAction
 		/* FIXME: is this a correct return code? */
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
-	if(mongo_sync_cmd_insert(pData->conn, (char*)pData->dbNcoll, doc, NULL)) {
-		pData->bErrMsgPermitted = 1;
-	} else {
-		dbgprintf("ommongodb: insert error\n");
-		reportMongoError(pData);
-		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	lenDoc = bson_size(doc);
+	if(   pWrkrData->nDocs == MONGO_MAX_BATCH_DOCS
+	   || (pWrkrData->nDocs > 0 && pWrkrData->lenDocs + lenDoc > MONGO_MAX_BATCH_BYTES)) {
+		CHKiRet(flushBatch(pWrkrData));
+		bPrevCommitted = 1;
 	}
+	pWrkrData->docs[pWrkrData->nDocs++] = doc;
+	pWrkrData->lenDocs += lenDoc;
+	doc = NULL;
+	iRet = bPrevCommitted ? RS_RET_PREVIOUS_COMMITTED : RS_RET_DEFER_COMMIT;
 
 finalize_it:
-	pthread_mutex_unlock(&mutDoAct);
 	if(doc != NULL)
 		bson_free(doc);
 ENDdoAction
 
+BEGINendTransaction
+CODESTARTendTransaction
+	iRet = flushBatch(pWrkrData);
+ENDendTransaction
+
 
 static inline void
 setInstParamDefaults(instanceData *pData)
@@ -510,6 +687,9 @@ setInstParamDefaults(instanceData *pData)
 	pData->uid = NULL;
 	pData->pwd = NULL;
 	pData->tplName = NULL;
+	pData->bOrdered = 1;
+	pData->writeConcernW = 0;
+	pData->writeConcernTimeout = 0;
 }
 
 BEGINnewActInst
@@ -542,6 +722,12 @@ CODESTARTnewActInst
 			pData->pwd = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "bulk.ordered")) {
+			pData->bOrdered = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "writeconcern.w")) {
+			pData->writeConcernW = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "writeconcern.wtimeout")) {
+			pData->writeConcernTimeout = (int) pvals[i].val.d.n;
 		} else {
 			dbgprintf("ommongodb: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
@@ -553,7 +739,6 @@ CODESTARTnewActInst
 	} else {
 		CHKiRet(OMSRsetEntry(*ppOMSR, 0, ustrdup(pData->tplName),
 				     OMSR_TPL_AS_JSON));
-		CHKmalloc(pData->json_tokener = json_tokener_new());
 	}
 
 	if(pData->db == NULL)
@@ -603,6 +788,7 @@ CODESTARTqueryEtryPt
 CODEqueryEtryPt_STD_OMOD_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
 CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
+CODEqueryEtryPt_TXIF_OMOD_QUERIES /* we support the transactional interface! */
 ENDqueryEtryPt
 
 BEGINmodInit()
@@ -616,6 +802,10 @@ CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
 	CHKiRet(objUse(datetime, CORE_COMPONENT));
 	INITChkCoreFeature(bCoreSupportsBatching, CORE_FEATURE_BATCHING);
+	if(!bCoreSupportsBatching) {
+		errmsg.LogError(0, NO_ERRCODE, "ommongodb: rsyslog core too old");
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
 	DBGPRINTF("ommongodb: module compiled with rsyslog version %s.\n", VERSION);
 
 	/* check if the rsyslog core supports parameter passing code */
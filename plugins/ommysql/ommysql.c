@@ -33,6 +33,7 @@
 #include <signal.h>
 #include <errno.h>
 #include <time.h>
+#include <ctype.h>
 #include <mysql.h>
 #include "conf.h"
 #include "syslogd-types.h"
@@ -62,14 +63,31 @@ typedef struct _instanceData {
 	uchar   *configfile;			/* MySQL Client Configuration File */
 	uchar   *configsection;		/* MySQL Client Configuration Section */
 	uchar	*tplName;			/* format template to use */
+	uchar	*stmt;				/* prepared statement, NULL if not in prepared mode */
+	sbool	bMultiRow;			/* combine INSERTs of a transaction into multi-row INSERTs? */
+	size_t	maxBytes;			/* max size of multi-row INSERT, 0 = max_allowed_packet */
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
 	MYSQL	*hmysql;			/* handle to MySQL */
 	unsigned uLastMySQLErrno;		/* last errno returned by MySQL or 0 if all is well */
+	MYSQL_STMT *hstmt;			/* prepared statement (prepared mode) */
+	unsigned nStmtParams;			/* number of placeholders in hstmt */
+	MYSQL_BIND *binds;			/* bind buffers for hstmt */
+	unsigned long *bindLens;		/* value lengths for binds */
+	uchar	*rowBuf;			/* multi-row INSERT being built */
+	size_t	lenRowBuf;			/* current length of rowBuf, 0 = empty */
+	size_t	sizeRowBuf;			/* allocated size of rowBuf */
+	size_t	lenRowPrefix;			/* length of "INSERT ... VALUES " part in rowBuf */
+	size_t	maxPacket;			/* max length of a multi-row INSERT */
 } wrkrInstanceData_t;
 
+/* used if we cannot obtain max_allowed_packet from the server. This is the
+ * server default of MySQL versions before 5.6.6.
+ */
+#define DFLT_MAX_PACKET (1024 * 1024)
+
 typedef struct configSettings_s {
 	int iSrvPort;				/* database server port */
 	uchar *pszMySQLConfigFile;	/* MySQL Client Configuration File */
@@ -87,7 +105,10 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "serverport", eCmdHdlrInt, 0 },
 	{ "mysqlconfig.file", eCmdHdlrGetWord, 0 },
 	{ "mysqlconfig.section", eCmdHdlrGetWord, 0 },
-	{ "template", eCmdHdlrGetWord, 0 }
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "statement", eCmdHdlrString, 0 },
+	{ "multirow", eCmdHdlrBinary, 0 },
+	{ "maxbytes", eCmdHdlrSize, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -110,6 +131,13 @@ ENDcreateInstance
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
 	pWrkrData->hmysql = NULL;
+	pWrkrData->hstmt = NULL;
+	pWrkrData->binds = NULL;
+	pWrkrData->bindLens = NULL;
+	pWrkrData->rowBuf = NULL;
+	pWrkrData->lenRowBuf = 0;
+	pWrkrData->sizeRowBuf = 0;
+	pWrkrData->maxPacket = DFLT_MAX_PACKET;
 ENDcreateWrkrInstance
 
 
@@ -126,6 +154,14 @@ ENDisCompatibleWithFeature
  */
 static void closeMySQL(wrkrInstanceData_t *pWrkrData)
 {
+	if(pWrkrData->hstmt != NULL) {
+		mysql_stmt_close(pWrkrData->hstmt);
+		pWrkrData->hstmt = NULL;
+	}
+	free(pWrkrData->binds);
+	pWrkrData->binds = NULL;
+	free(pWrkrData->bindLens);
+	pWrkrData->bindLens = NULL;
 	if(pWrkrData->hmysql != NULL) {	/* just to be on the safe side... */
 		mysql_close(pWrkrData->hmysql);	
 		pWrkrData->hmysql = NULL;
@@ -137,12 +173,14 @@ CODESTARTfreeInstance
 	free(pData->configfile);
 	free(pData->configsection);
 	free(pData->tplName);
+	free(pData->stmt);
 ENDfreeInstance
 
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
 	closeMySQL(pWrkrData);
+	free(pWrkrData->rowBuf);
 ENDfreeWrkrInstance
 
 
@@ -181,6 +219,69 @@ static void reportDBError(wrkrInstanceData_t *pWrkrData, int bSilent)
 }
 
 
+/* obtain the size limit for multi-row INSERTs. The server refuses
+ * statements larger than max_allowed_packet, so we must stay below it.
+ */
+static void
+getMaxPacket(wrkrInstanceData_t *pWrkrData)
+{
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+	long long maxPacket = 0;
+
+	if(mysql_query(pWrkrData->hmysql, "SELECT @@max_allowed_packet") == 0) {
+		if((res = mysql_store_result(pWrkrData->hmysql)) != NULL) {
+			if((row = mysql_fetch_row(res)) != NULL && row[0] != NULL)
+				maxPacket = strtoll(row[0], NULL, 10);
+			mysql_free_result(res);
+		}
+	}
+	if(maxPacket <= 0) {
+		dbgprintf("ommysql: could not obtain max_allowed_packet, using %d\n", DFLT_MAX_PACKET);
+		maxPacket = DFLT_MAX_PACKET;
+	}
+	pWrkrData->maxPacket = (size_t) maxPacket;
+	if(pWrkrData->pData->maxBytes != 0 && pWrkrData->pData->maxBytes < pWrkrData->maxPacket)
+		pWrkrData->maxPacket = pWrkrData->pData->maxBytes;
+	dbgprintf("ommysql: multi-row INSERTs limited to %zu bytes\n", pWrkrData->maxPacket);
+}
+
+
+/* prepare the configured statement on a freshly opened connection. The
+ * statement is parsed once per connection; afterwards each message only
+ * transmits the values of its placeholders.
+ */
+static rsRetVal
+prepareStmt(wrkrInstanceData_t *pWrkrData, int bSilent)
+{
+	const char *stmt = (const char*) pWrkrData->pData->stmt;
+	DEFiRet;
+
+	if((pWrkrData->hstmt = mysql_stmt_init(pWrkrData->hmysql)) == NULL) {
+		reportDBError(pWrkrData, bSilent);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	if(mysql_stmt_prepare(pWrkrData->hstmt, stmt, strlen(stmt)) != 0) {
+		if(bSilent) {
+			dbgprintf("ommysql: cannot prepare statement '%s': %s\n",
+				  stmt, mysql_stmt_error(pWrkrData->hstmt));
+		} else {
+			errmsg.LogError(0, RS_RET_SUSPENDED, "ommysql: cannot prepare statement "
+				"'%s': %s", stmt, mysql_stmt_error(pWrkrData->hstmt));
+		}
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	pWrkrData->nStmtParams = (unsigned) mysql_stmt_param_count(pWrkrData->hstmt);
+	CHKmalloc(pWrkrData->binds = calloc(pWrkrData->nStmtParams + 1, sizeof(MYSQL_BIND)));
+	CHKmalloc(pWrkrData->bindLens = calloc(pWrkrData->nStmtParams + 1, sizeof(unsigned long)));
+
+finalize_it:
+	if(iRet != RS_RET_OK)
+		closeMySQL(pWrkrData);
+	RETiRet;
+}
+
+
 /* The following function is responsible for initializing a
  * MySQL connection.
  * Initially added 2004-10-28 mmeckelein
@@ -224,6 +325,10 @@ static rsRetVal initMySQL(wrkrInstanceData_t *pWrkrData, int bSilent)
 			ABORT_FINALIZE(RS_RET_SUSPENDED);
 		}
 		mysql_autocommit(pWrkrData->hmysql, 0);
+		if(pData->bMultiRow)
+			getMaxPacket(pWrkrData);
+		if(pData->stmt != NULL)
+			CHKiRet(prepareStmt(pWrkrData, bSilent));
 	}
 
 finalize_it:
@@ -267,6 +372,170 @@ finalize_it:
 }
 
 
+/* execute the prepared statement with the values of one message. The
+ * template delivers one array element per placeholder, all are bound
+ * as strings and converted by the server as needed.
+ */
+static rsRetVal
+execStmt(wrkrInstanceData_t *pWrkrData, uchar **values)
+{
+	unsigned nValues;
+	unsigned i;
+	int bRetried = 0;
+	DEFiRet;
+
+	for(nValues = 0 ; values[nValues] != NULL ; ++nValues)
+		/* just count */;
+
+	if(pWrkrData->hmysql == NULL)
+		CHKiRet(initMySQL(pWrkrData, 0));
+
+	while(1) {
+		if(nValues != pWrkrData->nStmtParams) {
+			errmsg.LogError(0, RS_RET_DATAFAIL, "ommysql: template provides %u values, "
+				"but statement has %u placeholders - message discarded",
+				nValues, pWrkrData->nStmtParams);
+			ABORT_FINALIZE(RS_RET_DATAFAIL);
+		}
+		for(i = 0 ; i < nValues ; ++i) {
+			pWrkrData->bindLens[i] = strlen((char*) values[i]);
+			pWrkrData->binds[i].buffer_type = MYSQL_TYPE_STRING;
+			pWrkrData->binds[i].buffer = values[i];
+			pWrkrData->binds[i].buffer_length = pWrkrData->bindLens[i];
+			pWrkrData->binds[i].length = &pWrkrData->bindLens[i];
+		}
+		if(   mysql_stmt_bind_param(pWrkrData->hstmt, pWrkrData->binds) == 0
+		   && mysql_stmt_execute(pWrkrData->hstmt) == 0)
+			break; /* done */
+		if(bRetried) {
+			/* we failed, giving up for now */
+			reportDBError(pWrkrData, 0);
+			closeMySQL(pWrkrData); /* free ressources */
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+		/* error occured, try to re-init connection and retry */
+		dbgprintf("ommysql: statement execution failed: %s\n",
+			  mysql_stmt_error(pWrkrData->hstmt));
+		closeMySQL(pWrkrData);
+		CHKiRet(initMySQL(pWrkrData, 0));
+		bRetried = 1;
+	}
+
+finalize_it:
+	if(iRet == RS_RET_OK) {
+		pWrkrData->uLastMySQLErrno = 0; /* reset error for error supression */
+	}
+	RETiRet;
+}
+
+
+/* check if psz is a plain "INSERT ... VALUES (...)" statement. If so,
+ * return the offset of the opening parenthesis of the value list and the
+ * length of the statement without trailing semicolon and whitespace.
+ * Returns 0 if the statement cannot be combined with others.
+ */
+static int
+splitInsert(const uchar *psz, size_t *pLenPrefix, size_t *pLenStmt)
+{
+	const uchar *p;
+	size_t len;
+
+	if(strncasecmp((char*) psz, "insert", sizeof("insert") - 1))
+		return 0;
+	for(p = psz ; *p != '\0' ; ++p) {
+		if(   (*p == 'v' || *p == 'V')
+		   && (p[-1] == ' ' || p[-1] == '\t' || p[-1] == '\n' || p[-1] == ')')
+		   && !strncasecmp((char*) p, "values", sizeof("values") - 1)) {
+			p += sizeof("values") - 1;
+			while(isspace(*p))
+				++p;
+			if(*p != '(')
+				return 0;
+			break;
+		}
+	}
+	if(*p == '\0')
+		return 0;
+	*pLenPrefix = p - psz;
+
+	len = strlen((char*) p) + *pLenPrefix;
+	while(len > *pLenPrefix && (isspace(psz[len-1]) || psz[len-1] == ';'))
+		--len;
+	if(psz[len-1] != ')')
+		return 0;
+	*pLenStmt = len;
+	return 1;
+}
+
+
+/* send the multi-row INSERT built so far, if any */
+static rsRetVal
+multiRowFlush(wrkrInstanceData_t *pWrkrData)
+{
+	DEFiRet;
+
+	if(pWrkrData->lenRowBuf == 0)
+		FINALIZE;
+	pWrkrData->rowBuf[pWrkrData->lenRowBuf] = '\0';
+	pWrkrData->lenRowBuf = 0;
+	CHKiRet(writeMySQL(pWrkrData, pWrkrData->rowBuf));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* add a statement to the current multi-row INSERT. Statements are combined
+ * as long as they insert into the same table and columns (that is, have an
+ * identical part up to the value list) and the result stays within
+ * max_allowed_packet. Everything else is sent on its own.
+ */
+static rsRetVal
+multiRowAdd(wrkrInstanceData_t *pWrkrData, uchar *psz)
+{
+	size_t lenPrefix, lenStmt, lenValues, lenNeeded;
+	uchar *newBuf;
+	DEFiRet;
+
+	if(!splitInsert(psz, &lenPrefix, &lenStmt)) {
+		CHKiRet(multiRowFlush(pWrkrData));
+		CHKiRet(writeMySQL(pWrkrData, psz));
+		FINALIZE;
+	}
+	lenValues = lenStmt - lenPrefix;
+
+	if(   pWrkrData->lenRowBuf != 0
+	   && (   lenPrefix != pWrkrData->lenRowPrefix
+	       || memcmp(pWrkrData->rowBuf, psz, lenPrefix)
+	       || pWrkrData->lenRowBuf + 1 + lenValues >= pWrkrData->maxPacket)) {
+		CHKiRet(multiRowFlush(pWrkrData));
+	}
+
+	lenNeeded = (pWrkrData->lenRowBuf == 0) ? lenStmt + 1
+						: pWrkrData->lenRowBuf + 1 + lenValues + 1;
+	if(lenNeeded > pWrkrData->sizeRowBuf) {
+		if(lenNeeded < 2 * pWrkrData->sizeRowBuf)
+			lenNeeded = 2 * pWrkrData->sizeRowBuf;
+		CHKmalloc(newBuf = realloc(pWrkrData->rowBuf, lenNeeded));
+		pWrkrData->rowBuf = newBuf;
+		pWrkrData->sizeRowBuf = lenNeeded;
+	}
+
+	if(pWrkrData->lenRowBuf == 0) {
+		memcpy(pWrkrData->rowBuf, psz, lenStmt);
+		pWrkrData->lenRowBuf = lenStmt;
+		pWrkrData->lenRowPrefix = lenPrefix;
+	} else {
+		pWrkrData->rowBuf[pWrkrData->lenRowBuf++] = ',';
+		memcpy(pWrkrData->rowBuf + pWrkrData->lenRowBuf, psz + lenPrefix, lenValues);
+		pWrkrData->lenRowBuf += lenValues;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 BEGINtryResume
 CODESTARTtryResume
 	if(pWrkrData->hmysql == NULL) {
@@ -276,6 +545,7 @@ ENDtryResume
 
 BEGINbeginTransaction
 CODESTARTbeginTransaction
+	pWrkrData->lenRowBuf = 0; /* discard leftovers of a failed transaction */
 	CHKiRet(writeMySQL(pWrkrData, (uchar*)"START TRANSACTION"));
 finalize_it:
 ENDbeginTransaction
@@ -283,17 +553,25 @@ ENDbeginTransaction
 BEGINdoAction
 CODESTARTdoAction
 	dbgprintf("\n");
-	CHKiRet(writeMySQL(pWrkrData, ppString[0]));
+	if(pWrkrData->pData->stmt != NULL) {
+		CHKiRet(execStmt(pWrkrData, (uchar**) ppString[0]));
+	} else if(pWrkrData->pData->bMultiRow) {
+		CHKiRet(multiRowAdd(pWrkrData, ppString[0]));
+	} else {
+		CHKiRet(writeMySQL(pWrkrData, ppString[0]));
+	}
 	iRet = RS_RET_DEFER_COMMIT;
 finalize_it:
 ENDdoAction
 
 BEGINendTransaction
 CODESTARTendTransaction
+	CHKiRet(multiRowFlush(pWrkrData));
 	if(mysql_commit(pWrkrData->hmysql) != 0)	{	
 		dbgprintf("mysql server error: transaction not committed\n");		
 		iRet = RS_RET_SUSPENDED;
 	}
+finalize_it:
 ENDendTransaction
 
 
@@ -304,6 +582,9 @@ setInstParamDefaults(instanceData *pData)
 	pData->configfile = NULL;
 	pData->configsection = NULL;
 	pData->tplName = NULL;
+	pData->stmt = NULL;
+	pData->bMultiRow = 0;
+	pData->maxBytes = 0;
 }
 
 
@@ -350,13 +631,34 @@ CODESTARTnewActInst
 			pData->configsection = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "statement")) {
+			pData->stmt = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "multirow")) {
+			pData->bMultiRow = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "maxbytes")) {
+			pData->maxBytes = (size_t) pvals[i].val.d.n;
 		} else {
 			dbgprintf("ommysql: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
 		}
 	}
 
-	if(pData->tplName == NULL) {
+	if(pData->stmt != NULL) {
+		/* values are bound, not pasted into SQL, so no escaping is needed */
+		if(pData->tplName == NULL) {
+			errmsg.LogError(0, RS_RET_MISSING_CNFPARAMS, "ommysql: \"statement\" "
+				"requires a template with one entry per placeholder");
+			ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+		}
+		if(pData->bMultiRow) {
+			errmsg.LogError(0, NO_ERRCODE, "ommysql: \"multirow\" is ignored "
+				"when \"statement\" is given");
+			pData->bMultiRow = 0;
+		}
+		CHKiRet(OMSRsetEntry(*ppOMSR, 0,
+			(uchar*) strdup((char*) pData->tplName),
+			OMSR_TPL_AS_ARRAY));
+	} else if(pData->tplName == NULL) {
 		CHKiRet(OMSRsetEntry(*ppOMSR, 0, (uchar*) strdup(" StdDBFmt"),
 			OMSR_RQD_TPL_OPT_SQL));
 	} else {
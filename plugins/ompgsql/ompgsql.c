@@ -58,16 +58,27 @@ DEF_OMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
 
 typedef struct _instanceData {
-	PGconn	*f_hpgsql;			/* handle to PgSQL */
 	char	f_dbsrv[MAXHOSTNAMELEN+1];	/* IP or hostname of DB server*/ 
+	char	f_dbport[8];			/* port of DB server, empty for default */
 	char	f_dbname[_DB_MAXDBLEN+1];	/* DB name */
 	char	f_dbuid[_DB_MAXUNAMELEN+1];	/* DB user */
 	char	f_dbpwd[_DB_MAXPWDLEN+1];	/* DB user's password */
-	ConnStatusType	eLastPgSQLStatus; 	/* last status from postgres */
+	uchar	*tplName;			/* format template to use */
+	uchar	*copyStmt;			/* COPY ... FROM STDIN statement, NULL if not in copy mode */
+	uchar	*copyTplName;			/* template for the COPY rows */
 } instanceData;
 
+/* Each worker has its own connection. In copy mode, a COPY FROM STDIN is
+ * started at the beginning of each transaction, every message is sent as
+ * a row of it and the COPY is ended on commit. So a whole transaction
+ * needs a single round-trip instead of one per message.
+ */
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	PGconn	*f_hpgsql;			/* handle to PgSQL */
+	ConnStatusType	eLastPgSQLStatus; 	/* last status from postgres */
+	sbool	bInCopy;			/* COPY in progress? */
+	int	nCopyRows;			/* rows sent in current COPY */
 } wrkrInstanceData_t;
 
 typedef struct configSettings_s {
@@ -75,14 +86,31 @@ typedef struct configSettings_s {
 } configSettings_t;
 static configSettings_t __attribute__((unused)) cs;
 
-static pthread_mutex_t mutDoAct = PTHREAD_MUTEX_INITIALIZER;
+/* tables for interfacing with the v6 config system */
+/* action (instance) parameters */
+static struct cnfparamdescr actpdescr[] = {
+	{ "server", eCmdHdlrGetWord, 1 },
+	{ "db", eCmdHdlrGetWord, 1 },
+	{ "uid", eCmdHdlrGetWord, 1 },
+	{ "pwd", eCmdHdlrGetWord, 1 },
+	{ "serverport", eCmdHdlrInt, 0 },
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "copy.statement", eCmdHdlrString, 0 },
+	{ "copy.template", eCmdHdlrGetWord, 0 }
+};
+static struct cnfparamblk actpblk =
+	{ CNFPARAMBLK_VERSION,
+	  sizeof(actpdescr)/sizeof(struct cnfparamdescr),
+	  actpdescr
+	};
+
 
 BEGINinitConfVars		/* (re)set config variables to default values */
 CODESTARTinitConfVars 
 ENDinitConfVars
 
 
-static rsRetVal writePgSQL(uchar *psz, instanceData *pData);
+static rsRetVal writePgSQL(uchar *psz, wrkrInstanceData_t *pWrkrData);
 
 BEGINcreateInstance
 CODESTARTcreateInstance
@@ -90,6 +118,8 @@ ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->f_hpgsql = NULL;
+	pWrkrData->bInCopy = 0;
 ENDcreateWrkrInstance
 
 
@@ -103,23 +133,27 @@ ENDisCompatibleWithFeature
 /* The following function is responsible for closing a
  * PgSQL connection.
  */
-static void closePgSQL(instanceData *pData)
+static void closePgSQL(wrkrInstanceData_t *pWrkrData)
 {
-	assert(pData != NULL);
+	assert(pWrkrData != NULL);
 
-	if(pData->f_hpgsql != NULL) {	/* just to be on the safe side... */
-		PQfinish(pData->f_hpgsql);
-		pData->f_hpgsql = NULL;
+	if(pWrkrData->f_hpgsql != NULL) {	/* just to be on the safe side... */
+		PQfinish(pWrkrData->f_hpgsql);
+		pWrkrData->f_hpgsql = NULL;
 	}
+	pWrkrData->bInCopy = 0;
 }
 
 BEGINfreeInstance
 CODESTARTfreeInstance
-	closePgSQL(pData);
+	free(pData->tplName);
+	free(pData->copyStmt);
+	free(pData->copyTplName);
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	closePgSQL(pWrkrData);
 ENDfreeWrkrInstance
 
 BEGINdbgPrintInstInfo
@@ -132,26 +166,26 @@ ENDdbgPrintInstInfo
  * We check if we have a valid handle. If not, we simply
  * report an error, but can not be specific. RGerhards, 2007-01-30
  */
-static void reportDBError(instanceData *pData, int bSilent)
+static void reportDBError(wrkrInstanceData_t *pWrkrData, int bSilent)
 {
 	char errMsg[512];
 	ConnStatusType ePgSQLStatus;
 
-	assert(pData != NULL);
+	assert(pWrkrData != NULL);
 	bSilent=0;
 
 	/* output log message */
 	errno = 0;
-	if(pData->f_hpgsql == NULL) {
+	if(pWrkrData->f_hpgsql == NULL) {
 		errmsg.LogError(0, NO_ERRCODE, "unknown DB error occured - could not obtain PgSQL handle");
 	} else { /* we can ask pgsql for the error description... */
-		ePgSQLStatus = PQstatus(pData->f_hpgsql);
+		ePgSQLStatus = PQstatus(pWrkrData->f_hpgsql);
 		snprintf(errMsg, sizeof(errMsg)/sizeof(char), "db error (%d): %s\n", ePgSQLStatus,
-				PQerrorMessage(pData->f_hpgsql));
-		if(bSilent || ePgSQLStatus == pData->eLastPgSQLStatus)
+				PQerrorMessage(pWrkrData->f_hpgsql));
+		if(bSilent || ePgSQLStatus == pWrkrData->eLastPgSQLStatus)
 			dbgprintf("pgsql, DBError(silent): %s\n", errMsg);
 		else {
-			pData->eLastPgSQLStatus = ePgSQLStatus;
+			pWrkrData->eLastPgSQLStatus = ePgSQLStatus;
 			errmsg.LogError(0, NO_ERRCODE, "%s", errMsg);
 		}
 	}
@@ -163,12 +197,13 @@ static void reportDBError(instanceData *pData, int bSilent)
 /* The following function is responsible for initializing a
  * PgSQL connection.
  */
-static rsRetVal initPgSQL(instanceData *pData, int bSilent)
+static rsRetVal initPgSQL(wrkrInstanceData_t *pWrkrData, int bSilent)
 {
+	instanceData *pData;
 	DEFiRet;
 
-	assert(pData != NULL);
-	assert(pData->f_hpgsql == NULL);
+	assert(pWrkrData->f_hpgsql == NULL);
+	pData = pWrkrData->pData;
 
 	dbgprintf("host=%s dbname=%s uid=%s\n",pData->f_dbsrv,pData->f_dbname,pData->f_dbuid);
 
@@ -178,10 +213,12 @@ static rsRetVal initPgSQL(instanceData *pData, int bSilent)
 	const char *PgConnectionOptions = "-c standard_conforming_strings=on";
 
 	/* Connect to database */
-	if((pData->f_hpgsql=PQsetdbLogin(pData->f_dbsrv, NULL, PgConnectionOptions, NULL,
+	if((pWrkrData->f_hpgsql=PQsetdbLogin(pData->f_dbsrv,
+				(pData->f_dbport[0] == '\0') ? NULL : pData->f_dbport,
+				PgConnectionOptions, NULL,
 				pData->f_dbname, pData->f_dbuid, pData->f_dbpwd)) == NULL) {
-		reportDBError(pData, bSilent);
-		closePgSQL(pData); /* ignore any error we may get */
+		reportDBError(pWrkrData, bSilent);
+		closePgSQL(pWrkrData); /* ignore any error we may get */
 		iRet = RS_RET_SUSPENDED;
 	}
 
@@ -194,16 +231,19 @@ static rsRetVal initPgSQL(instanceData *pData, int bSilent)
  * rgerhards, 2009-04-17
  */
 static inline int
-tryExec(uchar *pszCmd, instanceData *pData)
+tryExec(uchar *pszCmd, wrkrInstanceData_t *pWrkrData)
 {
 	PGresult *pgRet;
 	ExecStatusType execState;
 	int bHadError = 0;
 
 	/* try insert */
-	pgRet = PQexec(pData->f_hpgsql, (char*)pszCmd);
+	pgRet = PQexec(pWrkrData->f_hpgsql, (char*)pszCmd);
 	execState = PQresultStatus(pgRet);
-	if(execState != PGRES_COMMAND_OK && execState != PGRES_TUPLES_OK) {
+	if(execState == PGRES_COPY_IN) {
+		pWrkrData->bInCopy = 1;
+		pWrkrData->nCopyRows = 0;
+	} else if(execState != PGRES_COMMAND_OK && execState != PGRES_TUPLES_OK) {
 		dbgprintf("postgres query execution failed: %s\n", PQresStatus(PQresultStatus(pgRet)));
 		bHadError = 1;
 	}
@@ -221,44 +261,115 @@ tryExec(uchar *pszCmd, instanceData *pData)
  * before my patch. -- rgerhards, 2009-04-17
  */
 static rsRetVal
-writePgSQL(uchar *psz, instanceData *pData)
+writePgSQL(uchar *psz, wrkrInstanceData_t *pWrkrData)
 {
 	int bHadError = 0;
 	DEFiRet;
 
 	assert(psz != NULL);
-	assert(pData != NULL);
+	assert(pWrkrData != NULL);
 
 	dbgprintf("writePgSQL: %s\n", psz);
 
-	bHadError = tryExec(psz, pData); /* try insert */
+	if(pWrkrData->f_hpgsql == NULL)
+		CHKiRet(initPgSQL(pWrkrData, 0));
+	bHadError = tryExec(psz, pWrkrData); /* try insert */
 
-	if(bHadError || (PQstatus(pData->f_hpgsql) != CONNECTION_OK)) {
+	if(bHadError || (PQstatus(pWrkrData->f_hpgsql) != CONNECTION_OK)) {
 		/* error occured, try to re-init connection and retry */
-		closePgSQL(pData); /* close the current handle */
-		CHKiRet(initPgSQL(pData, 0)); /* try to re-open */
-		bHadError = tryExec(psz, pData); /* retry */
-		if(bHadError || (PQstatus(pData->f_hpgsql) != CONNECTION_OK)) {
+		closePgSQL(pWrkrData); /* close the current handle */
+		CHKiRet(initPgSQL(pWrkrData, 0)); /* try to re-open */
+		bHadError = tryExec(psz, pWrkrData); /* retry */
+		if(bHadError || (PQstatus(pWrkrData->f_hpgsql) != CONNECTION_OK)) {
 			/* we failed, giving up for now */
-			reportDBError(pData, 0);
-			closePgSQL(pData); /* free ressources */
+			reportDBError(pWrkrData, 0);
+			closePgSQL(pWrkrData); /* free ressources */
 			ABORT_FINALIZE(RS_RET_SUSPENDED);
 		}
 	}
 
 finalize_it:
 	if(iRet == RS_RET_OK) {
-		pData->eLastPgSQLStatus = CONNECTION_OK; /* reset error for error supression */
+		pWrkrData->eLastPgSQLStatus = CONNECTION_OK; /* reset error for error supression */
+	}
+
+	RETiRet;
+}
+
+
+/* send one row of a COPY. The row template need not contain the line
+ * terminator, we add it if missing.
+ */
+static rsRetVal
+writeCopyRow(uchar *psz, wrkrInstanceData_t *pWrkrData)
+{
+	const size_t len = strlen((char*) psz);
+	DEFiRet;
+
+	if(!pWrkrData->bInCopy) {
+		/* connection was lost during the transaction */
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	if(   PQputCopyData(pWrkrData->f_hpgsql, (char*) psz, len) != 1
+	   || (len > 0 && psz[len-1] != '\n' && PQputCopyData(pWrkrData->f_hpgsql, "\n", 1) != 1)) {
+		reportDBError(pWrkrData, 0);
+		closePgSQL(pWrkrData);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	++pWrkrData->nCopyRows;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* end the COPY and check its outcome. If the server rejected the data
+ * (e.g. a malformed row), the whole COPY is rolled back. Retrying would
+ * not help in that case, so this is reported as a permanent failure.
+ */
+static rsRetVal
+endCopy(wrkrInstanceData_t *pWrkrData)
+{
+	PGresult *pgRet;
+	sbool bDataErr = 0;
+	DEFiRet;
+
+	if(!pWrkrData->bInCopy)
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	pWrkrData->bInCopy = 0;
+	if(PQputCopyEnd(pWrkrData->f_hpgsql, NULL) != 1) {
+		reportDBError(pWrkrData, 0);
+		closePgSQL(pWrkrData);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	while((pgRet = PQgetResult(pWrkrData->f_hpgsql)) != NULL) {
+		if(PQresultStatus(pgRet) != PGRES_COMMAND_OK) {
+			dbgprintf("ompgsql: COPY failed: %s\n", PQresultErrorMessage(pgRet));
+			bDataErr = 1;
+		}
+		PQclear(pgRet);
+	}
+	if(PQstatus(pWrkrData->f_hpgsql) != CONNECTION_OK) {
+		reportDBError(pWrkrData, 0);
+		closePgSQL(pWrkrData);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
+	if(bDataErr) {
+		errmsg.LogError(0, RS_RET_DATAFAIL, "ompgsql: COPY rejected by server, %d rows "
+			"discarded: %s", pWrkrData->nCopyRows, PQerrorMessage(pWrkrData->f_hpgsql));
+		ABORT_FINALIZE(RS_RET_DATAFAIL);
+	}
+	dbgprintf("ompgsql: COPY of %d rows done\n", pWrkrData->nCopyRows);
 
+finalize_it:
 	RETiRet;
 }
 
 
 BEGINtryResume
 CODESTARTtryResume
-	if(pWrkrData->pData->f_hpgsql == NULL) {
-		iRet = initPgSQL(pWrkrData->pData, 1);
+	if(pWrkrData->f_hpgsql == NULL) {
+		iRet = initPgSQL(pWrkrData, 1);
 		if(iRet == RS_RET_OK) {
 			/* the code above seems not to actually connect to the database. As such, we do a
 			 * dummy statement (a pointless select...) to verify the connection and return
@@ -266,7 +377,7 @@ CODESTARTtryResume
 			 * PostgreSQL expert, so any patch that does the desired result in a more
 			 * intelligent way is highly welcome. -- rgerhards, 2009-12-16
 			 */
-			iRet = writePgSQL((uchar*)"select 'a' as a", pWrkrData->pData);
+			iRet = writePgSQL((uchar*)"select 'a' as a", pWrkrData);
 		}
 
 	}
@@ -276,31 +387,124 @@ ENDtryResume
 BEGINbeginTransaction
 CODESTARTbeginTransaction
 	dbgprintf("ompgsql: beginTransaction\n");
-	if(pWrkrData->pData->f_hpgsql == NULL)
-	       initPgSQL(pWrkrData->pData, 0);
-	iRet = writePgSQL((uchar*) "begin", pWrkrData->pData); /* TODO: make user-configurable */
+	if(pWrkrData->pData->copyStmt != NULL) {
+		/* a COPY is a transaction of its own */
+		iRet = writePgSQL(pWrkrData->pData->copyStmt, pWrkrData);
+		if(iRet == RS_RET_OK && !pWrkrData->bInCopy) {
+			errmsg.LogError(0, RS_RET_ERR, "ompgsql: copy.statement '%s' did not "
+				"start a COPY FROM STDIN", pWrkrData->pData->copyStmt);
+			iRet = RS_RET_DISABLE_ACTION;
+		}
+	} else {
+		iRet = writePgSQL((uchar*) "begin", pWrkrData); /* TODO: make user-configurable */
+	}
 ENDbeginTransaction
 
 
 BEGINdoAction
 CODESTARTdoAction
-	pthread_mutex_lock(&mutDoAct);
 	dbgprintf("\n");
-	CHKiRet(writePgSQL(ppString[0], pWrkrData->pData));
-	if(bCoreSupportsBatching)
-		iRet = RS_RET_DEFER_COMMIT;
+	if(pWrkrData->pData->copyStmt != NULL) {
+		CHKiRet(writeCopyRow(ppString[0], pWrkrData));
+	} else {
+		CHKiRet(writePgSQL(ppString[0], pWrkrData));
+	}
+	iRet = RS_RET_DEFER_COMMIT;
 finalize_it:
-	pthread_mutex_unlock(&mutDoAct);
 ENDdoAction
 
 
 BEGINendTransaction
 CODESTARTendTransaction
-	iRet = writePgSQL((uchar*) "commit;", pWrkrData->pData); /* TODO: make user-configurable */
+	if(pWrkrData->pData->copyStmt != NULL) {
+		iRet = endCopy(pWrkrData);
+	} else {
+		iRet = writePgSQL((uchar*) "commit;", pWrkrData); /* TODO: make user-configurable */
+	}
 dbgprintf("ompgsql: endTransaction\n");
 ENDendTransaction
 
 
+static inline void
+setInstParamDefaults(instanceData *pData)
+{
+	pData->f_dbport[0] = '\0';
+	pData->tplName = NULL;
+	pData->copyStmt = NULL;
+	pData->copyTplName = NULL;
+}
+
+
+/* note: like ommysql, we use the fixed-size buffers inside the config object
+ * to avoid changing the legacy plumbing.
+ */
+BEGINnewActInst
+	struct cnfparamvals *pvals;
+	int i;
+	char *cstr;
+CODESTARTnewActInst
+	if((pvals = nvlstGetParams(lst, &actpblk, NULL)) == NULL) {
+		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+	}
+
+	CHKiRet(createInstance(&pData));
+	setInstParamDefaults(pData);
+
+	CODE_STD_STRING_REQUESTnewActInst(1)
+	for(i = 0 ; i < actpblk.nParams ; ++i) {
+		if(!pvals[i].bUsed)
+			continue;
+		if(!strcmp(actpblk.descr[i].name, "server")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			strncpy(pData->f_dbsrv, cstr, sizeof(pData->f_dbsrv) - 1);
+			free(cstr);
+		} else if(!strcmp(actpblk.descr[i].name, "serverport")) {
+			snprintf(pData->f_dbport, sizeof(pData->f_dbport), "%d", (int) pvals[i].val.d.n);
+		} else if(!strcmp(actpblk.descr[i].name, "db")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			strncpy(pData->f_dbname, cstr, sizeof(pData->f_dbname) - 1);
+			free(cstr);
+		} else if(!strcmp(actpblk.descr[i].name, "uid")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			strncpy(pData->f_dbuid, cstr, sizeof(pData->f_dbuid) - 1);
+			free(cstr);
+		} else if(!strcmp(actpblk.descr[i].name, "pwd")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			strncpy(pData->f_dbpwd, cstr, sizeof(pData->f_dbpwd) - 1);
+			free(cstr);
+		} else if(!strcmp(actpblk.descr[i].name, "template")) {
+			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "copy.statement")) {
+			pData->copyStmt = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "copy.template")) {
+			pData->copyTplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else {
+			dbgprintf("ompgsql: program error, non-handled "
+			  "param '%s'\n", actpblk.descr[i].name);
+		}
+	}
+
+	if(pData->copyStmt != NULL) {
+		/* rows are data, not SQL - so no SQL escaping is requested */
+		if(pData->tplName != NULL) {
+			errmsg.LogError(0, NO_ERRCODE, "ompgsql: \"template\" is ignored in copy "
+				"mode, use \"copy.template\" for the row format");
+		}
+		CHKiRet(OMSRsetEntry(*ppOMSR, 0, (uchar*) strdup((pData->copyTplName == NULL) ?
+			" StdPgSQLCopyFmt" : (char*) pData->copyTplName), OMSR_NO_RQD_TPL_OPTS));
+	} else {
+		if(pData->copyTplName != NULL) {
+			errmsg.LogError(0, NO_ERRCODE, "ompgsql: \"copy.template\" is ignored "
+				"without \"copy.statement\"");
+		}
+		CHKiRet(OMSRsetEntry(*ppOMSR, 0, (uchar*) strdup((pData->tplName == NULL) ?
+			" StdPgSQLFmt" : (char*) pData->tplName), OMSR_RQD_TPL_OPT_SQL));
+	}
+CODE_STD_FINALIZERnewActInst
+	cnfparamvalsDestruct(pvals, &actpblk);
+ENDnewActInst
+
+
 BEGINparseSelectorAct
 	int iPgSQLPropErr = 0;
 CODESTARTparseSelectorAct
@@ -323,6 +527,7 @@ CODE_STD_STRING_REQUESTparseSelectorAct(1)
 	/* ok, if we reach this point, we have something for us */
 	if((iRet = createInstance(&pData)) != RS_RET_OK)
 		goto finalize_it;
+	setInstParamDefaults(pData);
 
 
 	/* sur5r 2007-10-18: added support for PgSQL
@@ -377,6 +582,7 @@ BEGINqueryEtryPt
 CODESTARTqueryEtryPt
 CODEqueryEtryPt_STD_OMOD_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
+CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
 CODEqueryEtryPt_TXIF_OMOD_QUERIES /* we support the transactional interface! */
 ENDqueryEtryPt
 
@@ -388,13 +594,12 @@ INITLegCnfVars
 CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
 	INITChkCoreFeature(bCoreSupportsBatching, CORE_FEATURE_BATCHING);
-
-#	warning: transaction support missing for v8
-	bCoreSupportsBatching= 0;
-	DBGPRINTF("ompgsql: transactions are not yet supported on v8\n");
+	if(!bCoreSupportsBatching) {
+		errmsg.LogError(0, NO_ERRCODE, "ompgsql: rsyslog core too old");
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
 
 	DBGPRINTF("ompgsql: module compiled with rsyslog version %s.\n", VERSION);
-	DBGPRINTF("ompgsql: %susing transactional output interface.\n", bCoreSupportsBatching ? "" : "not ");
 ENDmodInit
 /* vi:set ai:
  */
@@ -36,6 +36,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <wait.h>
+#include <poll.h>
 #include <pthread.h>
 #include "conf.h"
 #include "syslogd-types.h"
@@ -54,6 +55,16 @@ MODULE_CNFNAME("omprog")
 DEF_OMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
 
+#define MAX_PROCESSES 1024
+
+/* how to select the child process for the next write */
+#define DISPATCH_ROUNDROBIN 0
+#define DISPATCH_LEASTBUSY 1
+
+/* how messages are delimited on the child's stdin */
+#define FRAMING_TRADITIONAL 0	/* as the template renders them */
+#define FRAMING_OCTET_COUNTED 1	/* "<length> <msg>", like RFC 6587 */
+
 typedef struct _instanceData {
 	uchar *szBinary;	/* name of binary to call */
 	char **aParams;		/* Optional Parameters for binary command */
@@ -61,16 +72,30 @@ typedef struct _instanceData {
 	int iParams;		/* Holds the count of parameters if set*/
 	int bForceSingleInst;	/* only a single wrkr instance of program permitted? */
 	uchar *outputFileName;	/* name of file for std[out/err] or NULL if to discard */
+	int nProcesses;		/* number of child processes per worker */
+	int dispatchMode;	/* DISPATCH_* */
+	int framing;		/* FRAMING_* */
+	sbool bBatch;		/* write a whole batch with a single write? */
 	pthread_mutex_t mut;	/* make sure only one instance is active */
 } instanceData;
 
-typedef struct wrkrInstanceData {
-	instanceData *pData;
+/* a single child process of the pool */
+typedef struct child_s {
 	pid_t pid;		/* pid of currently running process */
-	int fdOutput;		/* it's fd (-1 if closed) */
 	int fdPipeOut;		/* file descriptor to write to */
 	int fdPipeIn;		/* fd we receive messages from the program (if we want to) */
 	int bIsRunning;		/* is binary currently running? 0-no, 1-yes */
+} child_t;
+
+typedef struct wrkrInstanceData {
+	instanceData *pData;
+	child_t *children;	/* the process pool, pData->nProcesses entries */
+	struct pollfd *pollfds;	/* work area for least-busy dispatching */
+	int iNextChild;		/* round-robin position */
+	int fdOutput;		/* it's fd (-1 if closed) */
+	uchar *wrBuf;		/* data to be written (a single message or a batch) */
+	size_t lenWrBuf;
+	size_t sizeWrBuf;
 } wrkrInstanceData_t;
 
 typedef struct configSettings_s {
@@ -85,7 +110,11 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "binary", eCmdHdlrString, CNFPARAM_REQUIRED },
 	{ "output", eCmdHdlrString, 0 },
 	{ "forcesingleinstance", eCmdHdlrBinary, 0 },
-	{ "template", eCmdHdlrGetWord, 0 }
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "processes", eCmdHdlrPositiveInt, 0 },
+	{ "dispatch", eCmdHdlrGetWord, 0 },
+	{ "batch", eCmdHdlrBinary, 0 },
+	{ "framing", eCmdHdlrGetWord, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -106,11 +135,23 @@ CODESTARTcreateInstance
 ENDcreateInstance
 
 BEGINcreateWrkrInstance
+	int i;
 CODESTARTcreateWrkrInstance
-	pWrkrData->fdPipeIn = -1;
-	pWrkrData->fdPipeOut = -1;
 	pWrkrData->fdOutput = -1;
-	pWrkrData->bIsRunning = 0;
+	pWrkrData->iNextChild = 0;
+	pWrkrData->wrBuf = NULL;
+	pWrkrData->lenWrBuf = 0;
+	pWrkrData->sizeWrBuf = 0;
+	pWrkrData->pollfds = NULL;
+	CHKmalloc(pWrkrData->children = malloc(pData->nProcesses * sizeof(child_t)));
+	for(i = 0 ; i < pData->nProcesses ; ++i) {
+		pWrkrData->children[i].fdPipeIn = -1;
+		pWrkrData->children[i].fdPipeOut = -1;
+		pWrkrData->children[i].bIsRunning = 0;
+	}
+	if(pData->dispatchMode == DISPATCH_LEASTBUSY)
+		CHKmalloc(pWrkrData->pollfds = malloc(pData->nProcesses * sizeof(struct pollfd)));
+finalize_it:
 ENDcreateWrkrInstance
 
 
@@ -135,8 +176,26 @@ CODESTARTfreeInstance
 	}
 ENDfreeInstance
 
+/* Closing the pipes signals EOF to the children, which are expected
+ * to terminate on it. We do not wait for them, as a misbehaving program
+ * would otherwise block rsyslog shutdown.
+ */
 BEGINfreeWrkrInstance
+	int i;
 CODESTARTfreeWrkrInstance
+	if(pWrkrData->children != NULL) {
+		for(i = 0 ; i < pWrkrData->pData->nProcesses ; ++i) {
+			if(pWrkrData->children[i].fdPipeOut != -1)
+				close(pWrkrData->children[i].fdPipeOut);
+			if(pWrkrData->children[i].fdPipeIn != -1)
+				close(pWrkrData->children[i].fdPipeIn);
+		}
+		free(pWrkrData->children);
+	}
+	if(pWrkrData->fdOutput != -1)
+		close(pWrkrData->fdOutput);
+	free(pWrkrData->pollfds);
+	free(pWrkrData->wrBuf);
 ENDfreeWrkrInstance
 
 
@@ -190,18 +249,18 @@ done:	return;
  * if so, properly handle it.
  */
 static void
-checkProgramOutput(wrkrInstanceData_t *__restrict__ const pWrkrData)
+checkProgramOutput(wrkrInstanceData_t *__restrict__ const pWrkrData, child_t *__restrict__ const pChild)
 {
 	char buf[4096];
 	ssize_t r;
 
-dbgprintf("omprog: checking prog output, fd %d\n", pWrkrData->fdPipeIn);
-	if(pWrkrData->fdPipeIn == -1)
+dbgprintf("omprog: checking prog output, fd %d\n", pChild->fdPipeIn);
+	if(pChild->fdPipeIn == -1)
 		goto done;
 
 	do {
 memset(buf, 0, sizeof(buf));
-		r = read(pWrkrData->fdPipeIn, buf, sizeof(buf));
+		r = read(pChild->fdPipeIn, buf, sizeof(buf));
 dbgprintf("omprog: read state %lld, data '%s'\n", (long long) r, buf);
 		if(r > 0)
 			writeProgramOutput(pWrkrData, buf, r);
@@ -216,7 +275,7 @@ done:	return;
  * after fork).
  */
 static void
-execBinary(wrkrInstanceData_t *pWrkrData, int fdStdin, int fdStdOutErr)
+execBinary(instanceData *pData, int fdStdin, int fdStdOutErr)
 {
 	int i, iRet;
 	struct sigaction sigAct;
@@ -231,7 +290,7 @@ execBinary(wrkrInstanceData_t *pWrkrData, int fdStdin, int fdStdOutErr)
 		 * gets some more widespread use...
 		 */
 	}
-	if(pWrkrData->pData->outputFileName == NULL) {
+	if(pData->outputFileName == NULL) {
 		close(fdStdOutErr);
 	} else {
 		close(1);
@@ -269,7 +328,7 @@ execBinary(wrkrInstanceData_t *pWrkrData, int fdStdin, int fdStdOutErr)
 	alarm(0);
 
 	/* finally exec child */
-	iRet = execve((char*)pWrkrData->pData->szBinary, pWrkrData->pData->aParams, newenviron);
+	iRet = execve((char*)pData->szBinary, pData->aParams, newenviron);
 	if(iRet == -1) {
 		/* Note: this will go to stdout of the **child**, so rsyslog will never
 		 * see it except when stdout is captured. If we use the plugin interface,
@@ -277,7 +336,7 @@ execBinary(wrkrInstanceData_t *pWrkrData, int fdStdin, int fdStdOutErr)
 		 */
 		rs_strerror_r(errno, errStr, sizeof(errStr));
 		DBGPRINTF("omprog: failed to execute binary '%s': %s\n",
-			  pWrkrData->pData->szBinary, errStr); 
+			  pData->szBinary, errStr); 
 	}
 	
 	/* we should never reach this point, but if we do, we terminate */
@@ -289,7 +348,7 @@ execBinary(wrkrInstanceData_t *pWrkrData, int fdStdin, int fdStdOutErr)
  * rgerhards, 2009-04-01
  */
 static rsRetVal
-openPipe(wrkrInstanceData_t *pWrkrData)
+openPipe(wrkrInstanceData_t *pWrkrData, child_t *pChild)
 {
 	int pipestdin[2];
 	int pipestdout[2];
@@ -313,31 +372,32 @@ openPipe(wrkrInstanceData_t *pWrkrData)
 	if(cpid == -1) {
 		ABORT_FINALIZE(RS_RET_ERR_FORK);
 	}
-	pWrkrData->pid = cpid;
+	pChild->pid = cpid;
 
 	if(cpid == 0) {    
 		/* we are now the child, just exec the binary. */
 		close(pipestdin[1]); /* close those pipe "ports" that */
 		close(pipestdout[0]); /* we don't need */
-		execBinary(pWrkrData, pipestdin[0], pipestdout[1]);
+		execBinary(pWrkrData->pData, pipestdin[0], pipestdout[1]);
 		/*NO CODE HERE - WILL NEVER BE REACHED!*/
 	}
 
 	DBGPRINTF("omprog: child has pid %d\n", (int) cpid);
 	if(pWrkrData->pData->outputFileName != NULL) {
-		pWrkrData->fdPipeIn = dup(pipestdout[0]);
+		pChild->fdPipeIn = dup(pipestdout[0]);
 		/* we need to set our fd to be non-blocking! */
-		flags = fcntl(pWrkrData->fdPipeIn, F_GETFL);
+		flags = fcntl(pChild->fdPipeIn, F_GETFL);
 		flags |= O_NONBLOCK;
-		fcntl(pWrkrData->fdPipeIn, F_SETFL, flags);
+		fcntl(pChild->fdPipeIn, F_SETFL, flags);
 	} else {
-		pWrkrData->fdPipeIn = -1;
+		pChild->fdPipeIn = -1;
 	}
 	close(pipestdin[0]);
+	close(pipestdout[0]);
 	close(pipestdout[1]);
-	pWrkrData->pid = cpid;
-	pWrkrData->fdPipeOut = pipestdin[1];
-	pWrkrData->bIsRunning = 1;
+	pChild->pid = cpid;
+	pChild->fdPipeOut = pipestdin[1];
+	pChild->bIsRunning = 1;
 finalize_it:
 	RETiRet;
 }
@@ -346,16 +406,16 @@ finalize_it:
 /* clean up after a terminated child
  */
 static inline rsRetVal
-cleanup(wrkrInstanceData_t *pWrkrData)
+cleanup(wrkrInstanceData_t *pWrkrData, child_t *pChild)
 {
 	int status;
 	int ret;
 	char errStr[1024];
 	DEFiRet;
 
-	assert(pWrkrData->bIsRunning == 1);
-	ret = waitpid(pWrkrData->pid, &status, 0);
-	if(ret != pWrkrData->pid) {
+	assert(pChild->bIsRunning == 1);
+	ret = waitpid(pChild->pid, &status, 0);
+	if(ret != pChild->pid) {
 		/* if waitpid() fails, we can not do much - try to ignore it... */
 		DBGPRINTF("omprog: waitpid() returned state %d[%s], future malfunction may happen\n", ret,
 			   rs_strerror_r(errno, errStr, sizeof(errStr)));
@@ -372,22 +432,17 @@ cleanup(wrkrInstanceData_t *pWrkrData)
 		}
 	}
 
-	checkProgramOutput(pWrkrData); /* try to catch any late messages */
+	checkProgramOutput(pWrkrData, pChild); /* try to catch any late messages */
 
-	if(pWrkrData->fdOutput != -1) {
-		close(pWrkrData->fdOutput);
-		pWrkrData->fdOutput = -1;
-	}
-	if(pWrkrData->fdPipeIn != -1) {
-		close(pWrkrData->fdPipeIn);
-		pWrkrData->fdPipeIn = -1;
+	if(pChild->fdPipeIn != -1) {
+		close(pChild->fdPipeIn);
+		pChild->fdPipeIn = -1;
 	}
-	if(pWrkrData->fdPipeOut != -1) {
-		close(pWrkrData->fdPipeOut);
-		pWrkrData->fdPipeOut = -1;
+	if(pChild->fdPipeOut != -1) {
+		close(pChild->fdPipeOut);
+		pChild->fdPipeOut = -1;
 	}
-	pWrkrData->bIsRunning = 0;
-	pWrkrData->bIsRunning = 0;
+	pChild->bIsRunning = 0;
 	RETiRet;
 }
 
@@ -395,12 +450,12 @@ cleanup(wrkrInstanceData_t *pWrkrData)
 /* try to restart the binary when it has stopped.
  */
 static inline rsRetVal
-tryRestart(wrkrInstanceData_t *pWrkrData)
+tryRestart(wrkrInstanceData_t *pWrkrData, child_t *pChild)
 {
 	DEFiRet;
-	assert(pWrkrData->bIsRunning == 0);
+	assert(pChild->bIsRunning == 0);
 
-	iRet = openPipe(pWrkrData);
+	iRet = openPipe(pWrkrData, pChild);
 	RETiRet;
 }
 
@@ -410,28 +465,27 @@ tryRestart(wrkrInstanceData_t *pWrkrData)
  * own action queue.
  */
 static rsRetVal
-writePipe(wrkrInstanceData_t *pWrkrData, uchar *szMsg)
+writePipe(wrkrInstanceData_t *pWrkrData, child_t *pChild, uchar *buf, size_t lenWrite)
 {
-	int lenWritten;
-	int lenWrite;
-	int writeOffset;
+	ssize_t lenWritten;
+	size_t writeOffset;
 	char errStr[1024];
 	DEFiRet;
 	
-	lenWrite = strlen((char*)szMsg);
 	writeOffset = 0;
 
 	do {
-		checkProgramOutput(pWrkrData);
-dbgprintf("omprog: writing to prog (fd %d): %s\n", pWrkrData->fdPipeOut, szMsg);
-		lenWritten = write(pWrkrData->fdPipeOut, ((char*)szMsg)+writeOffset, lenWrite);
+		checkProgramOutput(pWrkrData, pChild);
+		DBGPRINTF("omprog: writing %zu bytes to prog (fd %d)\n", lenWrite - writeOffset,
+			  pChild->fdPipeOut);
+		lenWritten = write(pChild->fdPipeOut, ((char*)buf)+writeOffset, lenWrite - writeOffset);
 		if(lenWritten == -1) {
 			switch(errno) {
 			case EPIPE:
 				DBGPRINTF("omprog: program '%s' terminated, trying to restart\n",
 					  pWrkrData->pData->szBinary);
-				CHKiRet(cleanup(pWrkrData));
-				CHKiRet(tryRestart(pWrkrData));
+				CHKiRet(cleanup(pWrkrData, pChild));
+				CHKiRet(tryRestart(pWrkrData, pChild));
 				break;
 			default:
 				DBGPRINTF("omprog: error %d writing to pipe: %s\n", errno,
@@ -442,35 +496,150 @@ dbgprintf("omprog: writing to prog (fd %d): %s\n", pWrkrData->fdPipeOut, szMsg);
 		} else {
 			writeOffset += lenWritten;
 		}
-	} while(lenWritten != lenWrite);
+	} while(writeOffset < lenWrite);
 
-	checkProgramOutput(pWrkrData);
+	checkProgramOutput(pWrkrData, pChild);
 
 finalize_it:
 	RETiRet;
 }
 
 
-BEGINdoAction
-	instanceData *pData;
-CODESTARTdoAction
-dbgprintf("DDDD:omprog processing message\n");
-	pData = pWrkrData->pData;
+/* select the child process to write to next. Children that are not
+ * running are (re)started first. In least-busy mode, we prefer a child
+ * whose pipe can take data right now, starting at the round-robin
+ * position so that load is spread evenly among idle children. If all
+ * pipes are full, we wait until the first one drains.
+ */
+static child_t *
+selectChild(wrkrInstanceData_t *pWrkrData)
+{
+	instanceData *pData = pWrkrData->pData;
+	struct pollfd *pfds = pWrkrData->pollfds;
+	int idx;
+	int i;
+	int nValid;
+	int r;
+
+	for(i = 0 ; i < pData->nProcesses ; ++i) {
+		if(pWrkrData->children[i].bIsRunning == 0)
+			openPipe(pWrkrData, &pWrkrData->children[i]);
+	}
+
+	idx = pWrkrData->iNextChild;
+	pWrkrData->iNextChild = (idx + 1) % pData->nProcesses;
+	if(pData->dispatchMode != DISPATCH_LEASTBUSY || pData->nProcesses == 1)
+		goto done;
+
+	nValid = 0;
+	for(i = 0 ; i < pData->nProcesses ; ++i) {
+		pfds[i].fd = pWrkrData->children[(idx + i) % pData->nProcesses].fdPipeOut;
+		pfds[i].events = POLLOUT;
+		pfds[i].revents = 0;
+		if(pfds[i].fd != -1)
+			++nValid;
+	}
+	if(nValid == 0)
+		goto done;
+	r = poll(pfds, pData->nProcesses, 0);
+	if(r == 0)
+		r = poll(pfds, pData->nProcesses, -1);
+	/* on error, we simply stick with round-robin */
+	for(i = 0 ; r > 0 && i < pData->nProcesses ; ++i) {
+		if(pfds[i].revents != 0) {
+			idx = (idx + i) % pData->nProcesses;
+			break;
+		}
+	}
+done:
+	DBGPRINTF("omprog: selected child %d (pid %d)\n", idx, (int) pWrkrData->children[idx].pid);
+	return &pWrkrData->children[idx];
+}
+
+
+/* add a message to the write buffer, applying the configured framing */
+static rsRetVal
+addToWrBuf(wrkrInstanceData_t *pWrkrData, uchar *szMsg)
+{
+	char hdr[32];
+	size_t lenHdr;
+	size_t lenMsg;
+	size_t newSize;
+	uchar *newBuf;
+	DEFiRet;
+
+	lenMsg = strlen((char*)szMsg);
+	if(pWrkrData->pData->framing == FRAMING_OCTET_COUNTED)
+		lenHdr = snprintf(hdr, sizeof(hdr), "%zu ", lenMsg);
+	else
+		lenHdr = 0;
+
+	if(pWrkrData->lenWrBuf + lenHdr + lenMsg > pWrkrData->sizeWrBuf) {
+		newSize = 2 * pWrkrData->sizeWrBuf;
+		if(newSize < pWrkrData->lenWrBuf + lenHdr + lenMsg)
+			newSize = pWrkrData->lenWrBuf + lenHdr + lenMsg + 4096;
+		CHKmalloc(newBuf = realloc(pWrkrData->wrBuf, newSize));
+		pWrkrData->wrBuf = newBuf;
+		pWrkrData->sizeWrBuf = newSize;
+	}
+	memcpy(pWrkrData->wrBuf + pWrkrData->lenWrBuf, hdr, lenHdr);
+	memcpy(pWrkrData->wrBuf + pWrkrData->lenWrBuf + lenHdr, szMsg, lenMsg);
+	pWrkrData->lenWrBuf += lenHdr + lenMsg;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* write the buffered data to one child and reset the buffer */
+static rsRetVal
+flushWrBuf(wrkrInstanceData_t *pWrkrData)
+{
+	instanceData *pData = pWrkrData->pData;
+	DEFiRet;
+
+	if(pWrkrData->lenWrBuf == 0)
+		FINALIZE;
+
 	if(pData->bForceSingleInst)
 		pthread_mutex_lock(&pData->mut);
-	if(pWrkrData->bIsRunning == 0) {
-		openPipe(pWrkrData);
-	}
-	
-	iRet = writePipe(pWrkrData, ppString[0]);
+	iRet = writePipe(pWrkrData, selectChild(pWrkrData), pWrkrData->wrBuf, pWrkrData->lenWrBuf);
+	if(pData->bForceSingleInst)
+		pthread_mutex_unlock(&pData->mut);
+	pWrkrData->lenWrBuf = 0;
 
 	if(iRet != RS_RET_OK)
 		iRet = RS_RET_SUSPENDED;
-	if(pData->bForceSingleInst)
-		pthread_mutex_unlock(&pData->mut);
+finalize_it:
+	RETiRet;
+}
+
+
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+	/* a retried batch is re-submitted as a whole */
+	pWrkrData->lenWrBuf = 0;
+ENDbeginTransaction
+
+
+BEGINdoAction
+CODESTARTdoAction
+	CHKiRet(addToWrBuf(pWrkrData, ppString[0]));
+	if(pWrkrData->pData->bBatch) {
+		iRet = RS_RET_DEFER_COMMIT;
+	} else {
+		iRet = flushWrBuf(pWrkrData);
+	}
+finalize_it:
 ENDdoAction
 
 
+BEGINendTransaction
+CODESTARTendTransaction
+	iRet = flushWrBuf(pWrkrData);
+ENDendTransaction
+
+
 static inline void
 setInstParamDefaults(instanceData *pData)
 {
@@ -479,6 +648,10 @@ setInstParamDefaults(instanceData *pData)
 	pData->outputFileName = NULL;
 	pData->iParams = 0;
 	pData->bForceSingleInst = 0;
+	pData->nProcesses = 1;
+	pData->dispatchMode = DISPATCH_ROUNDROBIN;
+	pData->framing = FRAMING_TRADITIONAL;
+	pData->bBatch = 0;
 }
 
 BEGINnewActInst
@@ -586,15 +759,56 @@ CODESTARTnewActInst
 			pData->bForceSingleInst = (int) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "processes")) {
+			pData->nProcesses = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "dispatch")) {
+			if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"roundrobin", sizeof("roundrobin")-1)) {
+				pData->dispatchMode = DISPATCH_ROUNDROBIN;
+			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"leastbusy", sizeof("leastbusy")-1)) {
+				pData->dispatchMode = DISPATCH_LEASTBUSY;
+			} else {
+				char *cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+				errmsg.LogError(0, RS_RET_INVLD_MODE, "omprog: invalid dispatch mode '%s', "
+						"must be 'roundrobin' or 'leastbusy'", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_INVLD_MODE);
+			}
+		} else if(!strcmp(actpblk.descr[i].name, "batch")) {
+			pData->bBatch = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "framing")) {
+			if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"traditional", sizeof("traditional")-1)) {
+				pData->framing = FRAMING_TRADITIONAL;
+			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"octet-counted", sizeof("octet-counted")-1)) {
+				pData->framing = FRAMING_OCTET_COUNTED;
+			} else {
+				char *cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+				errmsg.LogError(0, RS_RET_INVLD_MODE, "omprog: invalid framing '%s', "
+						"must be 'traditional' or 'octet-counted'", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_INVLD_MODE);
+			}
 		} else {
 			dbgprintf("omprog: program error, non-handled param '%s'\n", actpblk.descr[i].name);
 		}
 	}
 
+	if(pData->nProcesses > MAX_PROCESSES) {
+		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "omprog: processes=%d too large, "
+				"using maximum of %d", pData->nProcesses, MAX_PROCESSES);
+		pData->nProcesses = MAX_PROCESSES;
+	}
+	if(pData->bForceSingleInst && pData->nProcesses > 1) {
+		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "omprog: forceSingleInstance does "
+				"not permit a process pool, using processes=1");
+		pData->nProcesses = 1;
+	}
+
 	CHKiRet(OMSRsetEntry(*ppOMSR, 0, (uchar*)strdup((pData->tplName == NULL) ? 
 						"RSYSLOG_FileFormat" : (char*)pData->tplName),
 						OMSR_NO_RQD_TPL_OPTS));
-	DBGPRINTF("omprog: bForceSingleInst %d\n", pData->bForceSingleInst);
+	DBGPRINTF("omprog: bForceSingleInst %d, processes %d, dispatch %d, batch %d, framing %d\n",
+		  pData->bForceSingleInst, pData->nProcesses, pData->dispatchMode,
+		  pData->bBatch, pData->framing);
 CODE_STD_FINALIZERnewActInst
 	cnfparamvalsDestruct(pvals, &actpblk);
 ENDnewActInst
@@ -616,6 +830,7 @@ CODE_STD_STRING_REQUESTparseSelectorAct(1)
 	}
 
 	CHKiRet(createInstance(&pData));
+	setInstParamDefaults(pData);
 
 	if(cs.szBinary == NULL) {
 		errmsg.LogError(0, RS_RET_CONF_RQRD_PARAM_MISSING,
@@ -644,6 +859,7 @@ ENDmodExit
 BEGINqueryEtryPt
 CODESTARTqueryEtryPt
 CODEqueryEtryPt_STD_OMOD_QUERIES
+CODEqueryEtryPt_TXIF_OMOD_QUERIES /* we support the transactional interface! */
 CODEqueryEtryPt_STD_OMOD8_QUERIES
 CODEqueryEtryPt_STD_CONF2_CNFNAME_QUERIES 
 CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
@@ -53,8 +53,6 @@ MODULE_CNFNAME("omrabbitmq")
 DEF_OMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
 
-static pthread_mutex_t mutDoAct = PTHREAD_MUTEX_INITIALIZER;
-
 typedef struct _instanceData {
 	/* here you need to define all action-specific data. A record of type 
 	 * instanceData will be handed over to each instance of the action. Keep
@@ -62,7 +60,6 @@ typedef struct _instanceData {
 	 * inside rsyslog.conf, and this is what keeps them apart. Do NOT use
 	 * static data for this!
 	 */
-	amqp_connection_state_t conn;
 	amqp_basic_properties_t props;
 	uchar *host;
 	int port;
@@ -72,10 +69,28 @@ typedef struct _instanceData {
 	uchar *exchange;
 	uchar *routing_key;
 	uchar *tplName;
+	int nChannels;		/* number of channels each worker publishes on */
+	sbool bConfirms;	/* use publisher confirms? */
 } instanceData;
 
+/* Publisher confirm state of a channel. Delivery tags are assigned by the
+ * broker in publish order, starting at 1 on each channel. We remember
+ * which tags of the current batch have been acknowledged.
+ */
+typedef struct amqpChannel_s {
+	uint64_t nextTag;	/* tag of the next message published */
+	uint64_t firstTag;	/* first tag of the current batch */
+	uchar *acked;		/* acked[tag - firstTag] != 0: confirmed */
+	size_t sizeAcked;
+	sbool bNacked;		/* broker rejected a message of this batch */
+} amqpChannel_t;
+
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	amqp_connection_state_t conn;
+	amqpChannel_t *channels;	/* index 0 is AMQP channel 1 */
+	int iNextChannel;	/* round-robin index for publishing */
+	int nPublished;		/* messages published in the current batch */
 } wrkrInstanceData_t;
 
 
@@ -89,7 +104,9 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "password", eCmdHdlrGetWord, 0 },
 	{ "exchange", eCmdHdlrGetWord, 0 },
 	{ "routing_key", eCmdHdlrGetWord, 0 },
-	{ "template", eCmdHdlrGetWord, 0 }
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "channels", eCmdHdlrPositiveInt, 0 },
+	{ "publisher.confirms", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk actpblk =
 	{
@@ -176,15 +193,28 @@ cstring_bytes(const char *str)
 }
 
 
+/*
+ * Close the connection. If bGraceful is not set, the connection is known to
+ * be broken and we do not try to talk to the broker any longer (which could
+ * block for a long time).
+ */
 static void
-closeAMQPConnection(instanceData *pData)
+closeAMQPConnection(wrkrInstanceData_t *pWrkrData, int bGraceful)
 {
-	if (pData->conn != NULL) {
-		die_on_amqp_error(amqp_channel_close(pData->conn, 1, AMQP_REPLY_SUCCESS), "amqp_channel_close");
-		die_on_amqp_error(amqp_connection_close(pData->conn, AMQP_REPLY_SUCCESS), "amqp_connection_close");
-		die_on_error(amqp_destroy_connection(pData->conn), "amqp_destroy_connection");
+	int i;
+
+	if (pWrkrData->conn != NULL) {
+		if (bGraceful) {
+			for (i = 0 ; i < pWrkrData->pData->nChannels ; ++i) {
+				die_on_amqp_error(amqp_channel_close(pWrkrData->conn, i + 1,
+					AMQP_REPLY_SUCCESS), "amqp_channel_close");
+			}
+			die_on_amqp_error(amqp_connection_close(pWrkrData->conn, AMQP_REPLY_SUCCESS),
+				"amqp_connection_close");
+		}
+		die_on_error(amqp_destroy_connection(pWrkrData->conn), "amqp_destroy_connection");
 
-		pData->conn = NULL;
+		pWrkrData->conn = NULL;
 	}
 }
 
@@ -193,33 +223,159 @@ closeAMQPConnection(instanceData *pData)
  * Initialize RabbitMQ connection
  */
 static rsRetVal
-initRabbitMQ(instanceData *pData)
+initRabbitMQ(wrkrInstanceData_t *pWrkrData)
 {
+	instanceData *pData = pWrkrData->pData;
+	amqp_connection_state_t conn;
 	int sockfd;
+	int i;
 	DEFiRet;
 
 	DBGPRINTF("omrabbitmq: trying connect to '%s' at port %d\n", pData->host, pData->port);
         
-	pData->conn = amqp_new_connection();
+	conn = amqp_new_connection();
+	pWrkrData->conn = conn;
 
 	if (die_on_error(sockfd = amqp_open_socket((char*) pData->host, pData->port), "Opening socket")) {
-		pData->conn = NULL;
 		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
 
-	amqp_set_sockfd(pData->conn, sockfd);
+	amqp_set_sockfd(conn, sockfd);
 
-	if (die_on_amqp_error(amqp_login(pData->conn, (char*) pData->vhost, 0, 131072, 0, AMQP_SASL_METHOD_PLAIN, pData->user, pData->password),
+	if (die_on_amqp_error(amqp_login(conn, (char*) pData->vhost, 0, 131072, 0, AMQP_SASL_METHOD_PLAIN, pData->user, pData->password),
 		"Logging in")) {
-		pData->conn = NULL;
 		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
 
-	amqp_channel_open(pData->conn, 1);
+	for (i = 0 ; i < pData->nChannels ; ++i) {
+		amqp_channel_open(conn, i + 1);
+		if (die_on_amqp_error(amqp_get_rpc_reply(conn), "Opening channel")) {
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+		if (pData->bConfirms) {
+			amqp_confirm_select(conn, i + 1);
+			if (die_on_amqp_error(amqp_get_rpc_reply(conn), "Enabling publisher confirms")) {
+				ABORT_FINALIZE(RS_RET_SUSPENDED);
+			}
+		}
+		/* a new channel starts a new delivery tag sequence */
+		pWrkrData->channels[i].nextTag = 1;
+		pWrkrData->channels[i].firstTag = 1;
+	}
 
-	if (die_on_amqp_error(amqp_get_rpc_reply(pData->conn), "Opening channel")) {
-		pData->conn = NULL;
-		ABORT_FINALIZE(RS_RET_SUSPENDED);
+finalize_it:
+	if (iRet != RS_RET_OK) {
+		closeAMQPConnection(pWrkrData, 0);
+	}
+	RETiRet;
+}
+
+
+/*
+ * Start a new batch: all tags from now on belong to it.
+ */
+static void
+startBatch(wrkrInstanceData_t *pWrkrData)
+{
+	amqpChannel_t *ch;
+	int i;
+
+	for (i = 0 ; i < pWrkrData->pData->nChannels ; ++i) {
+		ch = &pWrkrData->channels[i];
+		ch->firstTag = ch->nextTag;
+		ch->bNacked = 0;
+		if (ch->acked != NULL)
+			memset(ch->acked, 0, ch->sizeAcked);
+	}
+	pWrkrData->nPublished = 0;
+}
+
+
+/*
+ * Record an ack or nack for a channel. With "multiple", all tags up to and
+ * including the given one are covered.
+ */
+static void
+recordConfirm(amqpChannel_t *ch, uint64_t tag, amqp_boolean_t multiple, int bNack)
+{
+	uint64_t first, t;
+
+	if (tag < ch->firstTag || tag >= ch->nextTag) {
+		DBGPRINTF("omrabbitmq: ignoring confirm for tag %llu outside of batch\n",
+			  (unsigned long long) tag);
+		return;
+	}
+	first = multiple ? ch->firstTag : tag;
+	for (t = first ; t <= tag ; ++t)
+		ch->acked[t - ch->firstTag] = 1;
+	if (bNack)
+		ch->bNacked = 1;
+}
+
+
+/*
+ * Wait until the broker confirmed all messages of the batch on all
+ * channels. This is the only point where we wait for the broker, so a
+ * batch needs just one round-trip, no matter how many messages it has.
+ */
+static rsRetVal
+waitConfirms(wrkrInstanceData_t *pWrkrData)
+{
+	amqp_frame_t frame;
+	amqpChannel_t *ch;
+	amqp_basic_ack_t *ack;
+	amqp_basic_nack_t *nack;
+	uint64_t t;
+	int nPending;
+	int i;
+	DEFiRet;
+
+	while (1) {
+		nPending = 0;
+		for (i = 0 ; i < pWrkrData->pData->nChannels ; ++i) {
+			ch = &pWrkrData->channels[i];
+			for (t = ch->firstTag ; t < ch->nextTag ; ++t) {
+				if (!ch->acked[t - ch->firstTag])
+					++nPending;
+			}
+		}
+		if (nPending == 0)
+			break;
+
+		amqp_maybe_release_buffers(pWrkrData->conn);
+		if (die_on_error(amqp_simple_wait_frame(pWrkrData->conn, &frame), "waiting for confirms")) {
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+		if (frame.frame_type != AMQP_FRAME_METHOD)
+			continue;
+		if (frame.channel < 1 || frame.channel > pWrkrData->pData->nChannels)
+			continue;
+		ch = &pWrkrData->channels[frame.channel - 1];
+		switch (frame.payload.method.id) {
+		case AMQP_BASIC_ACK_METHOD:
+			ack = (amqp_basic_ack_t *) frame.payload.method.decoded;
+			recordConfirm(ch, ack->delivery_tag, ack->multiple, 0);
+			break;
+		case AMQP_BASIC_NACK_METHOD:
+			nack = (amqp_basic_nack_t *) frame.payload.method.decoded;
+			recordConfirm(ch, nack->delivery_tag, nack->multiple, 1);
+			break;
+		case AMQP_CHANNEL_CLOSE_METHOD:
+		case AMQP_CONNECTION_CLOSE_METHOD:
+			errmsg.LogError(0, RS_RET_SUSPENDED, "omrabbitmq: broker closed "
+				"channel %d while waiting for confirms", frame.channel);
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		default:
+			break;
+		}
+	}
+
+	for (i = 0 ; i < pWrkrData->pData->nChannels ; ++i) {
+		if (pWrkrData->channels[i].bNacked) {
+			errmsg.LogError(0, RS_RET_SUSPENDED, "omrabbitmq: broker rejected "
+				"messages on channel %d, batch will be retried", i + 1);
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
 	}
 
 finalize_it:
@@ -234,6 +390,11 @@ ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->conn = NULL;
+	pWrkrData->iNextChannel = 0;
+	pWrkrData->nPublished = 0;
+	CHKmalloc(pWrkrData->channels = calloc(pWrkrData->pData->nChannels, sizeof(amqpChannel_t)));
+finalize_it:
 ENDcreateWrkrInstance
 
 
@@ -254,7 +415,6 @@ CODESTARTfreeInstance
 	 * in instance data must be cleaned up here. Prime examples are
 	 * malloc()ed memory, file & database handles and the like.
 	 */
-	closeAMQPConnection(pData);
 	free(pData->host);
 	free(pData->vhost);
 	free(pData->user);
@@ -266,7 +426,14 @@ ENDfreeInstance
 
 
 BEGINfreeWrkrInstance
+	int i;
 CODESTARTfreeWrkrInstance
+	closeAMQPConnection(pWrkrData, 1);
+	if (pWrkrData->channels != NULL) {
+		for (i = 0 ; i < pWrkrData->pData->nChannels ; ++i)
+			free(pWrkrData->channels[i].acked);
+		free(pWrkrData->channels);
+	}
 ENDfreeWrkrInstance
 
 BEGINdbgPrintInstInfo
@@ -281,11 +448,12 @@ CODESTARTdbgPrintInstInfo
 	dbgprintf("\texchange='%s'\n", pData->exchange);
 	dbgprintf("\trouting_key='%s'\n", pData->routing_key);
 	dbgprintf("\ttemplate='%s'\n", pData->tplName);
+	dbgprintf("\tchannels=%d\n", pData->nChannels);
+	dbgprintf("\tpublisher.confirms=%d\n", pData->bConfirms);
 ENDdbgPrintInstInfo
 
 
 BEGINtryResume
-	instanceData *pData = pWrkrData->pData;
 CODESTARTtryResume
 	/* this is called when an action has been suspended and the
 	 * rsyslog core tries to resume it. The action must then
@@ -309,51 +477,84 @@ CODESTARTtryResume
 	 * not always be the case.
 	 */
 
-	pthread_mutex_lock(&mutDoAct);
-	if (pData->conn == NULL) {
-		iRet = initRabbitMQ(pData);
+	if (pWrkrData->conn == NULL) {
+		iRet = initRabbitMQ(pWrkrData);
 	}
-	pthread_mutex_unlock(&mutDoAct);
 
 ENDtryResume
 
 
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+	startBatch(pWrkrData);
+ENDbeginTransaction
+
+
 BEGINdoAction
 	instanceData *pData = pWrkrData->pData;
+	amqpChannel_t *ch;
+	amqp_bytes_t body_bytes;
+	uchar *newAcked;
+	size_t idx;
 CODESTARTdoAction
-	/* this is where you receive the message and need to carry out the
-	 * action. Data is provided in ppString[i] where 0 <= i <= num of strings
-	 * requested.
-	 * Return RS_RET_OK if all goes well, RS_RET_SUSPENDED if the action can
-	 * currently not complete, or an error code or RS_RET_DISABLED. The later
-	 * two should only be returned if there is no hope that the action can be
-	 * restored unless an rsyslog restart (prime example is an invalid config).
-	 * Error code or RS_RET_DISABLED permanently disables the action, up to
-	 * the next restart.
+	/* Messages are published without waiting; with publisher confirms,
+	 * endTransaction() waits for all of them at once. If the connection
+	 * broke during a batch, messages published earlier in it may or may
+	 * not have reached the broker. So we do not silently reconnect in the
+	 * middle of a batch, but suspend and let the core retry it as a whole.
 	 */
+	if (pWrkrData->conn == NULL) {
+		if (pWrkrData->nPublished > 0) {
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+		CHKiRet(initRabbitMQ(pWrkrData));
+		startBatch(pWrkrData);
+	}
 
-	amqp_bytes_t body_bytes;
-
-	pthread_mutex_lock(&mutDoAct);
-	if (pData->conn == NULL) {
-		CHKiRet(initRabbitMQ(pData));
+	ch = &pWrkrData->channels[pWrkrData->iNextChannel];
+	if (pData->bConfirms) {
+		idx = ch->nextTag - ch->firstTag;
+		if (idx >= ch->sizeAcked) {
+			CHKmalloc(newAcked = realloc(ch->acked, 2 * idx + 64));
+			memset(newAcked + ch->sizeAcked, 0, 2 * idx + 64 - ch->sizeAcked);
+			ch->acked = newAcked;
+			ch->sizeAcked = 2 * idx + 64;
+		}
 	}
 
 	body_bytes = amqp_cstring_bytes((char *)ppString[0]);
 
-	if (die_on_error(amqp_basic_publish(pData->conn, 1,
+	if (die_on_error(amqp_basic_publish(pWrkrData->conn, pWrkrData->iNextChannel + 1,
 			cstring_bytes((char *) pData->exchange),
 			cstring_bytes((char *) pData->routing_key),
 			0, 0, &pData->props, body_bytes), "amqp_basic_publish")) {
-		closeAMQPConnection(pData);
+		closeAMQPConnection(pWrkrData, 0);
 		ABORT_FINALIZE(RS_RET_SUSPENDED);
 	}
+	++ch->nextTag;
+	++pWrkrData->nPublished;
+	pWrkrData->iNextChannel = (pWrkrData->iNextChannel + 1) % pData->nChannels;
+	iRet = RS_RET_DEFER_COMMIT;
 
 finalize_it:
-	pthread_mutex_unlock(&mutDoAct);
 ENDdoAction
 
 
+BEGINendTransaction
+CODESTARTendTransaction
+	if (pWrkrData->pData->bConfirms && pWrkrData->nPublished > 0) {
+		if (pWrkrData->conn == NULL) {
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+		if ((iRet = waitConfirms(pWrkrData)) != RS_RET_OK) {
+			closeAMQPConnection(pWrkrData, 0);
+		}
+	}
+	pWrkrData->nPublished = 0;
+finalize_it:
+ENDendTransaction
+
+
 static inline void
 setInstParamDefaults(instanceData *pData)
 {
@@ -365,6 +566,8 @@ setInstParamDefaults(instanceData *pData)
 	pData->exchange = NULL;
 	pData->routing_key = NULL;
 	pData->tplName = NULL;
+	pData->nChannels = 1;
+	pData->bConfirms = 1;
 }
 
 
@@ -401,6 +604,10 @@ CODESTARTnewActInst
 			pData->routing_key = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if (!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if (!strcmp(actpblk.descr[i].name, "channels")) {
+			pData->nChannels = (int) pvals[i].val.d.n;
+		} else if (!strcmp(actpblk.descr[i].name, "publisher.confirms")) {
+			pData->bConfirms = (sbool) pvals[i].val.d.n;
 		} else {
 			dbgprintf("omrabbitmq: program error, non-handled param '%s'\n", actpblk.descr[i].name);
 		}
@@ -476,6 +683,7 @@ CODESTARTqueryEtryPt
 	CODEqueryEtryPt_STD_OMOD_QUERIES
 	CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
 	CODEqueryEtryPt_STD_OMOD8_QUERIES
+	CODEqueryEtryPt_TXIF_OMOD_QUERIES /* we support the transactional interface! */
 ENDqueryEtryPt
 
 
@@ -484,4 +692,9 @@ CODESTARTmodInit
 	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
 CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	INITChkCoreFeature(bCoreSupportsBatching, CORE_FEATURE_BATCHING);
+	if (!bCoreSupportsBatching) {
+		errmsg.LogError(0, NO_ERRCODE, "omrabbitmq: rsyslog core too old");
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
 ENDmodInit
@@ -14,6 +14,13 @@
  *       loss is pretty unlikely in usual cases).
  *
  *
+ * Each worker instance may keep a pool of RELP sessions (pool.size). Every
+ * transaction (batch) is sent over one session, the next batch goes to the
+ * next session. So ordering is kept within a batch, but not across batches
+ * if the pool has more than one session. If a session fails, the batch
+ * continues on the next working one; messages not yet acked on the failed
+ * session are retransmitted by librelp once that session is re-established.
+ *
  * File begun on 2008-03-13 by RGerhards
  *
  * Copyright 2008-2014 Adiscon GmbH.
@@ -66,6 +73,7 @@ DEFobjCurrIf(glbl)
 
 #define DFLT_ENABLE_TLS 0
 #define DFLT_ENABLE_TLSZIP 0
+#define DFLT_POOL_SIZE 1
 
 static relpEngine_t *pRelpEngine;	/* our relp engine */
 
@@ -88,14 +96,33 @@ typedef struct _instanceData {
 		int nmemb;
 		uchar **name;
 	} permittedPeers;
+	int poolSize;		/**< number of RELP sessions per worker instance */
+	struct {
+		int nmemb;
+		uchar **target;
+		uchar **port;	/* NULL entries mean "use port parameter" */
+	} poolTargets;
 } instanceData;
 
-typedef struct wrkrInstanceData {
-	instanceData *pData;
+struct wrkrInstanceData;
+
+/* a single RELP session of a worker instance's pool */
+typedef struct relpConn_s {
+	struct wrkrInstanceData *pWrkrData;
+	uchar *target;	/* points into instanceData, not to be freed */
+	uchar *port;	/* dito */
 	int bInitialConnect; /* is this the initial connection request of our module? (0-no, 1-yes) */
 	int bIsConnected; /* currently connected to server? 0 - no, 1 - yes */
-	relpClt_t *pRelpClt; /* relp client for this instance */
+	relpClt_t *pRelpClt; /* relp client for this session */
 	unsigned nSent; /* number msgs sent - for rebind support */
+} relpConn_t;
+
+typedef struct wrkrInstanceData {
+	instanceData *pData;
+	int nConns;		/* number of sessions in pool */
+	relpConn_t *conns;	/* the session pool */
+	relpConn_t *pCurr;	/* session used for current transaction, NULL if none */
+	int iNext;		/* index of session to try first for next transaction */
 } wrkrInstanceData_t;
 
 typedef struct configSettings_s {
@@ -103,12 +130,12 @@ typedef struct configSettings_s {
 } configSettings_t;
 static configSettings_t __attribute__((unused)) cs;
 
-static rsRetVal doCreateRelpClient(wrkrInstanceData_t *pWrkrData);
+static rsRetVal doCreateRelpClient(relpConn_t *pConn);
 
 /* tables for interfacing with the v6 config system */
 /* action (instance) parameters */
 static struct cnfparamdescr actpdescr[] = {
-	{ "target", eCmdHdlrGetWord, 1 },
+	{ "target", eCmdHdlrGetWord, 0 },
 	{ "tls", eCmdHdlrBinary, 0 },
 	{ "tls.compression", eCmdHdlrBinary, 0 },
 	{ "tls.prioritystring", eCmdHdlrString, 0 },
@@ -121,7 +148,9 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "rebindinterval", eCmdHdlrInt, 0 },
 	{ "windowsize", eCmdHdlrInt, 0 },
 	{ "timeout", eCmdHdlrInt, 0 },
-	{ "template", eCmdHdlrGetWord, 0 }
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "pool.size", eCmdHdlrPositiveInt, 0 },
+	{ "pool.targets", eCmdHdlrArray, 0 }
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -137,22 +166,21 @@ ENDinitConfVars
  * if it is unspecified. So far, we use 514 as default (what probably
  * is not a really bright idea, but kept for backward compatibility).
  */
-static uchar *getRelpPt(instanceData *pData)
+static uchar *getRelpPt(uchar *port)
 {
-	assert(pData != NULL);
-	if(pData->port == NULL)
+	if(port == NULL)
 		return((uchar*)"514");
 	else
-		return(pData->port);
+		return(port);
 }
 
 static void
 onErr(void *pUsr, char *objinfo, char* errmesg, __attribute__((unused)) relpRetVal errcode)
 {
-	wrkrInstanceData_t *pWrkrData = (wrkrInstanceData_t*) pUsr;
+	relpConn_t *pConn = (relpConn_t*) pUsr;
 	errmsg.LogError(0, RS_RET_RELP_AUTH_FAIL, "omrelp[%s:%s]: error '%s', object "
 			" '%s' - action may not work as intended",
-			pWrkrData->pData->target, pWrkrData->pData->port, errmesg, objinfo);
+			pConn->target, getRelpPt(pConn->port), errmesg, objinfo);
 }
 
 static void
@@ -166,58 +194,61 @@ onGenericErr(char *objinfo, char* errmesg, __attribute__((unused)) relpRetVal er
 static void
 onAuthErr(void *pUsr, char *authinfo, char* errmesg, __attribute__((unused)) relpRetVal errcode)
 {
-	instanceData *pData = ((wrkrInstanceData_t*) pUsr)->pData;
+	relpConn_t *pConn = (relpConn_t*) pUsr;
+	instanceData *pData = pConn->pWrkrData->pData;
 	errmsg.LogError(0, RS_RET_RELP_AUTH_FAIL, "omrelp[%s:%s]: authentication error '%s', peer "
-			"is '%s' - DISABLING action", pData->target, pData->port, errmesg, authinfo);
+			"is '%s' - DISABLING action", pConn->target, getRelpPt(pConn->port),
+			errmesg, authinfo);
 	pData->bHadAuthFail = 1;
 }
 
 static rsRetVal
-doCreateRelpClient(wrkrInstanceData_t *pWrkrData)
+doCreateRelpClient(relpConn_t *pConn)
 {
 	int i;
 	instanceData *pData;
 	DEFiRet;
 
-	pData = pWrkrData->pData;
-	if(relpEngineCltConstruct(pRelpEngine, &pWrkrData->pRelpClt) != RELP_RET_OK)
+	pData = pConn->pWrkrData->pData;
+	if(relpEngineCltConstruct(pRelpEngine, &pConn->pRelpClt) != RELP_RET_OK)
 		ABORT_FINALIZE(RS_RET_RELP_ERR);
-	if(relpCltSetTimeout(pWrkrData->pRelpClt, pData->timeout) != RELP_RET_OK)
+	if(relpCltSetTimeout(pConn->pRelpClt, pData->timeout) != RELP_RET_OK)
 		ABORT_FINALIZE(RS_RET_RELP_ERR);
-	if(relpCltSetWindowSize(pWrkrData->pRelpClt, pData->sizeWindow) != RELP_RET_OK)
+	if(relpCltSetWindowSize(pConn->pRelpClt, pData->sizeWindow) != RELP_RET_OK)
 		ABORT_FINALIZE(RS_RET_RELP_ERR);
-	if(relpCltSetUsrPtr(pWrkrData->pRelpClt, pWrkrData) != RELP_RET_OK)
+	if(relpCltSetUsrPtr(pConn->pRelpClt, pConn) != RELP_RET_OK)
 		ABORT_FINALIZE(RS_RET_RELP_ERR);
 	if(pData->bEnableTLS) {
-		if(relpCltEnableTLS(pWrkrData->pRelpClt) != RELP_RET_OK)
+		if(relpCltEnableTLS(pConn->pRelpClt) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
 		if(pData->bEnableTLSZip) {
-			if(relpCltEnableTLSZip(pWrkrData->pRelpClt) != RELP_RET_OK)
+			if(relpCltEnableTLSZip(pConn->pRelpClt) != RELP_RET_OK)
 				ABORT_FINALIZE(RS_RET_RELP_ERR);
 		}
-		if(relpCltSetGnuTLSPriString(pWrkrData->pRelpClt, (char*) pData->pristring) != RELP_RET_OK)
+		if(relpCltSetGnuTLSPriString(pConn->pRelpClt, (char*) pData->pristring) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
-		if(relpCltSetAuthMode(pWrkrData->pRelpClt, (char*) pData->authmode) != RELP_RET_OK) {
+		if(relpCltSetAuthMode(pConn->pRelpClt, (char*) pData->authmode) != RELP_RET_OK) {
 			errmsg.LogError(0, RS_RET_RELP_ERR,
 					"omrelp: invalid auth mode '%s'\n", pData->authmode);
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
 		}
-		if(relpCltSetCACert(pWrkrData->pRelpClt, (char*) pData->caCertFile) != RELP_RET_OK)
+		if(relpCltSetCACert(pConn->pRelpClt, (char*) pData->caCertFile) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
-		if(relpCltSetOwnCert(pWrkrData->pRelpClt, (char*) pData->myCertFile) != RELP_RET_OK)
+		if(relpCltSetOwnCert(pConn->pRelpClt, (char*) pData->myCertFile) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
-		if(relpCltSetPrivKey(pWrkrData->pRelpClt, (char*) pData->myPrivKeyFile) != RELP_RET_OK)
+		if(relpCltSetPrivKey(pConn->pRelpClt, (char*) pData->myPrivKeyFile) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
 		for(i = 0 ; i <  pData->permittedPeers.nmemb ; ++i) {
-			relpCltAddPermittedPeer(pWrkrData->pRelpClt, (char*)pData->permittedPeers.name[i]);
+			relpCltAddPermittedPeer(pConn->pRelpClt, (char*)pData->permittedPeers.name[i]);
 		}
 	}
 	if(glbl.GetSourceIPofLocalClient() == NULL) {	/* ar Do we have a client IP set? */
-		if(relpCltSetClientIP(pWrkrData->pRelpClt, glbl.GetSourceIPofLocalClient()) != RELP_RET_OK)
+		if(relpCltSetClientIP(pConn->pRelpClt, glbl.GetSourceIPofLocalClient()) != RELP_RET_OK)
 			ABORT_FINALIZE(RS_RET_RELP_ERR);
 	}
-	pWrkrData->bInitialConnect = 1;
-	pWrkrData->nSent = 0;
+	pConn->bInitialConnect = 1;
+	pConn->bIsConnected = 0;
+	pConn->nSent = 0;
 finalize_it:
 	RETiRet;
 }
@@ -236,12 +267,32 @@ CODESTARTcreateInstance
 	pData->myCertFile = NULL;
 	pData->myPrivKeyFile = NULL;
 	pData->permittedPeers.nmemb = 0;
+	pData->poolSize = DFLT_POOL_SIZE;
+	pData->poolTargets.nmemb = 0;
 ENDcreateInstance
 
 BEGINcreateWrkrInstance
+	int i;
 CODESTARTcreateWrkrInstance
-	pWrkrData->pRelpClt = NULL;
-	iRet = doCreateRelpClient(pWrkrData);
+	pWrkrData->pCurr = NULL;
+	pWrkrData->iNext = 0;
+	pWrkrData->nConns = pData->poolSize;
+	CHKmalloc(pWrkrData->conns = calloc(pWrkrData->nConns, sizeof(relpConn_t)));
+	for(i = 0 ; i < pWrkrData->nConns ; ++i) {
+		pWrkrData->conns[i].pWrkrData = pWrkrData;
+		if(pData->poolTargets.nmemb > 0) {
+			/* spread sessions evenly over the configured targets */
+			pWrkrData->conns[i].target = pData->poolTargets.target[i % pData->poolTargets.nmemb];
+			pWrkrData->conns[i].port = pData->poolTargets.port[i % pData->poolTargets.nmemb];
+			if(pWrkrData->conns[i].port == NULL)
+				pWrkrData->conns[i].port = pData->port;
+		} else {
+			pWrkrData->conns[i].target = pData->target;
+			pWrkrData->conns[i].port = pData->port;
+		}
+		CHKiRet(doCreateRelpClient(&pWrkrData->conns[i]));
+	}
+finalize_it:
 ENDcreateWrkrInstance
 
 BEGINfreeInstance
@@ -258,12 +309,24 @@ CODESTARTfreeInstance
 	for(i = 0 ; i <  pData->permittedPeers.nmemb ; ++i) {
 		free(pData->permittedPeers.name[i]);
 	}
+	for(i = 0 ; i <  pData->poolTargets.nmemb ; ++i) {
+		free(pData->poolTargets.target[i]);
+		free(pData->poolTargets.port[i]);
+	}
+	free(pData->poolTargets.target);
+	free(pData->poolTargets.port);
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
+	int i;
 CODESTARTfreeWrkrInstance
-	if(pWrkrData->pRelpClt != NULL)
-		relpEngineCltDestruct(pRelpEngine, &pWrkrData->pRelpClt);
+	if(pWrkrData->conns != NULL) {
+		for(i = 0 ; i < pWrkrData->nConns ; ++i) {
+			if(pWrkrData->conns[i].pRelpClt != NULL)
+				relpEngineCltDestruct(pRelpEngine, &pWrkrData->conns[i].pRelpClt);
+		}
+		free(pWrkrData->conns);
+	}
 ENDfreeWrkrInstance
 
 static inline void
@@ -283,11 +346,52 @@ setInstParamDefaults(instanceData *pData)
 	pData->myCertFile = NULL;
 	pData->myPrivKeyFile = NULL;
 	pData->permittedPeers.nmemb = 0;
+	pData->poolSize = DFLT_POOL_SIZE;
+	pData->poolTargets.nmemb = 0;
+	pData->poolTargets.target = NULL;
+	pData->poolTargets.port = NULL;
+}
+
+
+/* add a "host", "host:port" or "[ipv6-addr]:port" entry to the pool's
+ * target list.
+ */
+static rsRetVal
+addPoolTarget(instanceData *pData, int idx, char *entry)
+{
+	char *host = entry;
+	char *port = NULL;
+	char *p;
+	DEFiRet;
+
+	if(*host == '[') {
+		++host;
+		if((p = strchr(host, ']')) == NULL) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "omrelp: invalid pool target "
+				"'%s' - missing ']'", entry);
+			ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+		}
+		*p++ = '\0';
+		if(*p == ':')
+			port = p + 1;
+	} else if((p = strchr(host, ':')) != NULL && strchr(p + 1, ':') == NULL) {
+		/* exactly one colon: host:port. Otherwise it is a plain IPv6 address */
+		*p = '\0';
+		port = p + 1;
+	}
+
+	CHKmalloc(pData->poolTargets.target[idx] = (uchar*) strdup(host));
+	if(port != NULL && *port != '\0') {
+		CHKmalloc(pData->poolTargets.port[idx] = (uchar*) strdup(port));
+	}
+finalize_it:
+	RETiRet;
 }
 
 
 BEGINnewActInst
 	struct cnfparamvals *pvals;
+	char *entry;
 	int i,j;
 CODESTARTnewActInst
 	if((pvals = nvlstGetParams(lst, &actpblk, NULL)) == NULL) {
@@ -333,11 +437,35 @@ CODESTARTnewActInst
 			for(j = 0 ; j <  pvals[i].val.d.ar->nmemb ; ++j) {
 				pData->permittedPeers.name[j] = (uchar*)es_str2cstr(pvals[i].val.d.ar->arr[j], NULL);
 			}
+		} else if(!strcmp(actpblk.descr[i].name, "pool.size")) {
+			pData->poolSize = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "pool.targets")) {
+			CHKmalloc(pData->poolTargets.target =
+				calloc(pvals[i].val.d.ar->nmemb, sizeof(uchar*)));
+			CHKmalloc(pData->poolTargets.port =
+				calloc(pvals[i].val.d.ar->nmemb, sizeof(uchar*)));
+			pData->poolTargets.nmemb = pvals[i].val.d.ar->nmemb;
+			for(j = 0 ; j <  pvals[i].val.d.ar->nmemb ; ++j) {
+				CHKmalloc(entry = es_str2cstr(pvals[i].val.d.ar->arr[j], NULL));
+				iRet = addPoolTarget(pData, j, entry);
+				free(entry);
+				CHKiRet(iRet);
+			}
 		} else {
 			dbgprintf("omrelp: program error, non-handled "
 			  "param '%s'\n", actpblk.descr[i].name);
 		}
 	}
+
+	if(pData->target == NULL && pData->poolTargets.nmemb == 0) {
+		errmsg.LogError(0, RS_RET_PARAM_ERROR, "omrelp: either \"target\" or "
+			"\"pool.targets\" must be given");
+		ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+	}
+	if(pData->poolSize < pData->poolTargets.nmemb) {
+		/* make sure every target gets at least one session */
+		pData->poolSize = pData->poolTargets.nmemb;
+	}
 	
 	CODE_STD_STRING_REQUESTnewActInst(1)
 
@@ -365,35 +493,35 @@ ENDSetShutdownImmdtPtr
 
 BEGINdbgPrintInstInfo
 CODESTARTdbgPrintInstInfo
-	dbgprintf("RELP/%s", pData->target);
+	dbgprintf("RELP/%s", (pData->target == NULL) ? pData->poolTargets.target[0] : pData->target);
 ENDdbgPrintInstInfo
 
 
 /* try to connect to server
  * rgerhards, 2008-03-21
  */
-static rsRetVal doConnect(wrkrInstanceData_t *pWrkrData)
+static rsRetVal doConnect(relpConn_t *pConn)
 {
 	DEFiRet;
 
-	if(pWrkrData->bInitialConnect) {
-		iRet = relpCltConnect(pWrkrData->pRelpClt, glbl.GetDefPFFamily(),
-				      pWrkrData->pData->port, pWrkrData->pData->target);
+	if(pConn->bInitialConnect) {
+		iRet = relpCltConnect(pConn->pRelpClt, glbl.GetDefPFFamily(),
+				      getRelpPt(pConn->port), pConn->target);
 		if(iRet == RELP_RET_OK)
-			pWrkrData->bInitialConnect = 0;
+			pConn->bInitialConnect = 0;
 	} else {
-		iRet = relpCltReconnect(pWrkrData->pRelpClt);
+		iRet = relpCltReconnect(pConn->pRelpClt);
 	}
 
 	if(iRet == RELP_RET_OK) {
-		pWrkrData->bIsConnected = 1;
+		pConn->bIsConnected = 1;
 	} else if(iRet == RELP_RET_ERR_NO_TLS) {
 		errmsg.LogError(0, RS_RET_RELP_NO_TLS, "Could not connect, librelp does NOT "
 				"does not support TLS (most probably GnuTLS lib "
 				"is too old)!");
 		ABORT_FINALIZE(RS_RET_RELP_NO_TLS);
 	} else {
-		pWrkrData->bIsConnected = 0;
+		pConn->bIsConnected = 0;
 		iRet = RS_RET_SUSPENDED;
 	}
 
@@ -402,23 +530,66 @@ finalize_it:
 }
 
 
+/* select the session to use for the next batch. We go round-robin over the
+ * pool, skipping sessions that can not be (re)connected. Only if no session
+ * at all is usable, the action is suspended.
+ */
+static rsRetVal
+selectConn(wrkrInstanceData_t *pWrkrData)
+{
+	relpConn_t *pConn;
+	int i;
+	DEFiRet;
+
+	pWrkrData->pCurr = NULL;
+	for(i = 0 ; i < pWrkrData->nConns ; ++i) {
+		pConn = &pWrkrData->conns[(pWrkrData->iNext + i) % pWrkrData->nConns];
+		if(!pConn->bIsConnected) {
+			iRet = doConnect(pConn);
+			if(iRet == RS_RET_SUSPENDED)
+				continue;
+			CHKiRet(iRet);
+		}
+		pWrkrData->pCurr = pConn;
+		pWrkrData->iNext = (pWrkrData->iNext + i + 1) % pWrkrData->nConns;
+		FINALIZE;
+	}
+	ABORT_FINALIZE(RS_RET_SUSPENDED);
+
+finalize_it:
+	RETiRet;
+}
+
+
 BEGINtryResume
+	int i;
+	int bAnyConnected = 0;
 CODESTARTtryResume
 	if(pWrkrData->pData->bHadAuthFail) {
 		ABORT_FINALIZE(RS_RET_DISABLE_ACTION);
 	}
-	iRet = doConnect(pWrkrData);
+	/* try to bring back all sessions, so that the full pool is used again */
+	for(i = 0 ; i < pWrkrData->nConns ; ++i) {
+		if(!pWrkrData->conns[i].bIsConnected) {
+			iRet = doConnect(&pWrkrData->conns[i]);
+			if(iRet != RS_RET_OK && iRet != RS_RET_SUSPENDED)
+				FINALIZE;
+		}
+		if(pWrkrData->conns[i].bIsConnected)
+			bAnyConnected = 1;
+	}
+	iRet = bAnyConnected ? RS_RET_OK : RS_RET_SUSPENDED;
 finalize_it:
 ENDtryResume
 
 static inline rsRetVal
-doRebind(wrkrInstanceData_t *pWrkrData)
+doRebind(relpConn_t *pConn)
 {
 	DEFiRet;
 	DBGPRINTF("omrelp: destructing relp client due to rebindInterval\n");
-	CHKiRet(relpEngineCltDestruct(pRelpEngine, &pWrkrData->pRelpClt));
-	pWrkrData->bIsConnected = 0;
-	CHKiRet(doCreateRelpClient(pWrkrData));
+	CHKiRet(relpEngineCltDestruct(pRelpEngine, &pConn->pRelpClt));
+	pConn->bIsConnected = 0;
+	CHKiRet(doCreateRelpClient(pConn));
 finalize_it:
 	RETiRet;
 }
@@ -426,10 +597,8 @@ finalize_it:
 BEGINbeginTransaction
 CODESTARTbeginTransaction
 dbgprintf("omrelp: beginTransaction\n");
-	if(!pWrkrData->bIsConnected) {
-		CHKiRet(doConnect(pWrkrData));
-	}
-	relpCltHintBurstBegin(pWrkrData->pRelpClt);
+	CHKiRet(selectConn(pWrkrData));
+	relpCltHintBurstBegin(pWrkrData->pCurr->pRelpClt);
 finalize_it:
 ENDbeginTransaction
 
@@ -438,13 +607,9 @@ BEGINdoAction
 	size_t lenMsg;
 	relpRetVal ret;
 	instanceData *pData;
+	relpConn_t *pConn;
 CODESTARTdoAction
 	pData = pWrkrData->pData;
-	dbgprintf(" %s:%s/RELP\n", pData->target, getRelpPt(pData));
-
-	if(!pWrkrData->bIsConnected) {
-		CHKiRet(doConnect(pWrkrData));
-	}
 
 	pMsg = ppString[0];
 	lenMsg = strlen((char*) pMsg); /* TODO: don't we get this? */
@@ -453,17 +618,45 @@ CODESTARTdoAction
 	if((int) lenMsg > glbl.GetMaxLine())
 		lenMsg = glbl.GetMaxLine();
 
+	if(pWrkrData->pCurr == NULL || !pWrkrData->pCurr->bIsConnected) {
+		CHKiRet(selectConn(pWrkrData));
+		relpCltHintBurstBegin(pWrkrData->pCurr->pRelpClt);
+	}
+	pConn = pWrkrData->pCurr;
+	dbgprintf(" %s:%s/RELP\n", pConn->target, getRelpPt(pConn->port));
+
 	/* forward */
-	ret = relpCltSendSyslog(pWrkrData->pRelpClt, (uchar*) pMsg, lenMsg);
+	ret = relpCltSendSyslog(pConn->pRelpClt, (uchar*) pMsg, lenMsg);
 	if(ret != RELP_RET_OK) {
-		/* error! */
-		dbgprintf("error forwarding via relp, suspending\n");
-		ABORT_FINALIZE(RS_RET_SUSPENDED);
+		/* error! Continue the batch on the next session of the pool; the
+		 * failed session keeps its unacked messages and retransmits them
+		 * once it is re-established.
+		 */
+		dbgprintf("error forwarding via relp session %s:%s, trying next one\n",
+			  pConn->target, getRelpPt(pConn->port));
+		pConn->bIsConnected = 0;
+		relpCltHintBurstEnd(pConn->pRelpClt);
+		pWrkrData->pCurr = NULL;
+		if(pWrkrData->nConns == 1)
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		CHKiRet(selectConn(pWrkrData));
+		pConn = pWrkrData->pCurr;
+		relpCltHintBurstBegin(pConn->pRelpClt);
+		ret = relpCltSendSyslog(pConn->pRelpClt, (uchar*) pMsg, lenMsg);
+		if(ret != RELP_RET_OK) {
+			dbgprintf("error forwarding via relp, suspending\n");
+			pConn->bIsConnected = 0;
+			relpCltHintBurstEnd(pConn->pRelpClt);
+			pWrkrData->pCurr = NULL;
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
 	}
 
 	if(pData->rebindInterval != 0 &&
-	   (++pWrkrData->nSent >= pData->rebindInterval)) {
-	   	doRebind(pWrkrData);
+	   (++pConn->nSent >= pData->rebindInterval)) {
+		relpCltHintBurstEnd(pConn->pRelpClt);
+		pWrkrData->pCurr = NULL;
+	   	doRebind(pConn);
 	}
 finalize_it:
 	if(pData->bHadAuthFail)
@@ -482,7 +675,10 @@ ENDdoAction
 BEGINendTransaction
 CODESTARTendTransaction
 	dbgprintf("omrelp: endTransaction\n");
-	relpCltHintBurstEnd(pWrkrData->pRelpClt);
+	if(pWrkrData->pCurr != NULL) {
+		relpCltHintBurstEnd(pWrkrData->pCurr->pRelpClt);
+		pWrkrData->pCurr = NULL;
+	}
 ENDendTransaction
 
 BEGINparseSelectorAct
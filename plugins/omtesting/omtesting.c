@@ -19,6 +19,22 @@
  * Must be specified exactly as above. Keep in mind milliseconds are a millionth
  * of a second!
  *
+ * action(type="omtesting" mode="sink" ...)
+ *
+ * A benchmark sink for load testing queues, retries and worker autoscaling
+ * without a real backend. It is transactional and simulates:
+ * - per-transaction latency: "latency" (ms) is the fixed value, the mean
+ *   ("latency.distribution"="exponential") or the median ("lognormal", with
+ *   shape "latency.sigma")
+ * - failures: with probability "failure.rate" a transaction fails. Of these,
+ *   the share "failure.partial" fails in the middle of the batch, the rest
+ *   at commit
+ * - backpressure: only "backpressure.rate" messages per second are accepted,
+ *   commits beyond that are rejected (and thus retried)
+ * What was received is recorded in the statsobj named by "statsname".
+ * Ordering is checked via the "msgnum:" field that the testbench tools
+ * (tcpflood & friends) generate.
+ *
  * NOTE: read comments in module-template.h to understand how this file
  *       works!
  *
@@ -50,11 +66,16 @@
 #include <ctype.h>
 #include <assert.h>
 #include <pthread.h>
+#include <math.h>
+#include <sys/time.h>
 #include "dirty.h"
 #include "syslogd-types.h"
 #include "module-template.h"
 #include "conf.h"
 #include "cfsysline.h"
+#include "errmsg.h"
+#include "statsobj.h"
+#include "unicode-helper.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -63,9 +84,13 @@ MODULE_CNFNAME("omtesting")
 /* internal structures
  */
 DEF_OMOD_STATIC_DATA
+DEFobjCurrIf(errmsg)
+DEFobjCurrIf(statsobj)
+
+typedef enum { LAT_FIXED, LAT_EXPONENTIAL, LAT_LOGNORMAL } latencyDist_t;
 
 typedef struct _instanceData {
-	enum { MD_SLEEP, MD_FAIL, MD_RANDFAIL, MD_ALWAYS_SUSPEND }
+	enum { MD_SLEEP, MD_FAIL, MD_RANDFAIL, MD_ALWAYS_SUSPEND, MD_SINK }
 		mode;
 	int	bEchoStdout;
 	int	iWaitSeconds;
@@ -78,12 +103,57 @@ typedef struct _instanceData {
 	 			 * to work properly together with multiple worker instances.
 				 */
 	pthread_mutex_t mut;
+	/* sink mode */
+	uchar	*tplName;
+	uchar	*statsName;
+	int	iLatency;	/* ms */
+	latencyDist_t latencyDist;
+	double	latencySigma;
+	double	failRate;
+	double	failPartial;
+	int	iBackpressureRate; /* msgs/s, 0 - unlimited */
+	double	bpTokens;	/* token bucket for backpressure, guarded by mut */
+	double	bpLast;
+	long long maxSeq;	/* highest msgnum seen, guarded by mut */
+	statsobj_t *stats;
+	STATSCOUNTER_DEF(ctrReceived, mutCtrReceived)
+	STATSCOUNTER_DEF(ctrCommitted, mutCtrCommitted)
+	STATSCOUNTER_DEF(ctrTx, mutCtrTx)
+	STATSCOUNTER_DEF(ctrTxFailed, mutCtrTxFailed)
+	STATSCOUNTER_DEF(ctrTxPartial, mutCtrTxPartial)
+	STATSCOUNTER_DEF(ctrBackpressure, mutCtrBackpressure)
+	STATSCOUNTER_DEF(ctrOrder, mutCtrOrder)
+	STATSCOUNTER_DEF(ctrGaps, mutCtrGaps)
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	/* sink mode transaction state */
+	unsigned seed;
+	int	nInTx;		/* messages received in current transaction */
+	int	iFailAt;	/* fail at this message of the transaction, -1 - do not */
+	int	bFailCommit;
+	int	nLastTx;	/* size of last committed transaction */
 } wrkrInstanceData_t;
 
+/* action (instance) parameters */
+static struct cnfparamdescr actpdescr[] = {
+	{ "mode", eCmdHdlrGetWord, CNFPARAM_REQUIRED },
+	{ "template", eCmdHdlrGetWord, 0 },
+	{ "statsname", eCmdHdlrGetWord, 0 },
+	{ "latency", eCmdHdlrNonNegInt, 0 },
+	{ "latency.distribution", eCmdHdlrGetWord, 0 },
+	{ "latency.sigma", eCmdHdlrGetWord, 0 },
+	{ "failure.rate", eCmdHdlrGetWord, 0 },
+	{ "failure.partial", eCmdHdlrGetWord, 0 },
+	{ "backpressure.rate", eCmdHdlrNonNegInt, 0 }
+};
+static struct cnfparamblk actpblk =
+	{ CNFPARAMBLK_VERSION,
+	  sizeof(actpdescr)/sizeof(struct cnfparamdescr),
+	  actpdescr
+	};
+
 typedef struct configSettings_s {
 	int bEchoStdout;	/* echo non-failed messages to stdout */
 } configSettings_t;
@@ -104,6 +174,8 @@ ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->seed = (unsigned) time(NULL) ^ (unsigned) (uintptr_t) pWrkrData;
+	pWrkrData->iFailAt = -1;
 ENDcreateWrkrInstance
 
 
@@ -188,6 +260,174 @@ static rsRetVal doRandFail(void)
 }
 
 
+/* ---------- sink mode ---------- */
+
+static double
+nowSecs(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* uniform in (0,1) */
+static double
+sinkRand(wrkrInstanceData_t *pWrkrData)
+{
+	return (rand_r(&pWrkrData->seed) + 1.0) / ((double) RAND_MAX + 2.0);
+}
+
+/* draw the latency of one transaction in microseconds */
+static long
+sinkLatency(wrkrInstanceData_t *pWrkrData)
+{
+	instanceData *pData = pWrkrData->pData;
+	double u, v;
+	double lat;
+
+	switch(pData->latencyDist) {
+	case LAT_EXPONENTIAL:
+		lat = -pData->iLatency * log(sinkRand(pWrkrData));
+		break;
+	case LAT_LOGNORMAL: /* Box-Muller for the normal deviate */
+		u = sinkRand(pWrkrData);
+		v = sinkRand(pWrkrData);
+		lat = pData->iLatency * exp(pData->latencySigma
+			* sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v));
+		break;
+	case LAT_FIXED:
+	default:
+		lat = pData->iLatency;
+		break;
+	}
+	return (long) (lat * 1000.0);
+}
+
+/* check the msgnum: field for ordering violations and gaps */
+static void
+sinkCheckOrder(instanceData *pData, uchar *psz)
+{
+	char *p;
+	long long seq;
+
+	if((p = strstr((char*) psz, "msgnum:")) == NULL)
+		return;
+	seq = strtoll(p + sizeof("msgnum:") - 1, NULL, 10);
+	pthread_mutex_lock(&pData->mut);
+	if(seq <= pData->maxSeq) {
+		STATSCOUNTER_INC(pData->ctrOrder, pData->mutCtrOrder);
+	} else {
+		if(pData->maxSeq >= 0 && seq > pData->maxSeq + 1)
+			STATSCOUNTER_INC(pData->ctrGaps, pData->mutCtrGaps);
+		pData->maxSeq = seq;
+	}
+	pthread_mutex_unlock(&pData->mut);
+}
+
+/* token bucket with one second of burst. Returns 1 if nMsgs may be accepted. */
+static int
+sinkAccept(instanceData *pData, int nMsgs)
+{
+	double now;
+	int bOK;
+
+	if(pData->iBackpressureRate == 0)
+		return 1;
+	pthread_mutex_lock(&pData->mut);
+	now = nowSecs();
+	pData->bpTokens += (now - pData->bpLast) * pData->iBackpressureRate;
+	if(pData->bpTokens > pData->iBackpressureRate)
+		pData->bpTokens = pData->iBackpressureRate;
+	pData->bpLast = now;
+	bOK = pData->bpTokens >= nMsgs;
+	if(bOK)
+		pData->bpTokens -= nMsgs;
+	pthread_mutex_unlock(&pData->mut);
+	return bOK;
+}
+
+static void
+sinkBeginTx(wrkrInstanceData_t *pWrkrData)
+{
+	instanceData *pData = pWrkrData->pData;
+
+	pWrkrData->nInTx = 0;
+	pWrkrData->iFailAt = -1;
+	pWrkrData->bFailCommit = 0;
+	if(pData->failRate > 0 && sinkRand(pWrkrData) < pData->failRate) {
+		/* the batch size is not yet known, so we use the last one */
+		if(pData->failPartial > 0 && sinkRand(pWrkrData) < pData->failPartial)
+			pWrkrData->iFailAt = rand_r(&pWrkrData->seed) % (pWrkrData->nLastTx + 1);
+		else
+			pWrkrData->bFailCommit = 1;
+	}
+}
+
+static rsRetVal
+sinkDoAction(wrkrInstanceData_t *pWrkrData, uchar *psz)
+{
+	instanceData *pData = pWrkrData->pData;
+	DEFiRet;
+
+	if(pWrkrData->nInTx == pWrkrData->iFailAt) {
+		STATSCOUNTER_INC(pData->ctrTxPartial, pData->mutCtrTxPartial);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	STATSCOUNTER_INC(pData->ctrReceived, pData->mutCtrReceived);
+	sinkCheckOrder(pData, psz);
+	++pWrkrData->nInTx;
+	iRet = RS_RET_DEFER_COMMIT;
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+sinkCommit(wrkrInstanceData_t *pWrkrData)
+{
+	instanceData *pData = pWrkrData->pData;
+	struct timeval tvSelectTimeout;
+	long lat;
+	DEFiRet;
+
+	if(pWrkrData->nInTx == 0)
+		FINALIZE;
+	lat = sinkLatency(pWrkrData);
+	if(lat > 0) {
+		tvSelectTimeout.tv_sec = lat / 1000000;
+		tvSelectTimeout.tv_usec = lat % 1000000;
+		select(0, NULL, NULL, NULL, &tvSelectTimeout);
+	}
+	if(pWrkrData->bFailCommit) {
+		STATSCOUNTER_INC(pData->ctrTxFailed, pData->mutCtrTxFailed);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	if(!sinkAccept(pData, pWrkrData->nInTx)) {
+		STATSCOUNTER_INC(pData->ctrBackpressure, pData->mutCtrBackpressure);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	STATSCOUNTER_INC(pData->ctrTx, pData->mutCtrTx);
+	STATSCOUNTER_ADD(pData->ctrCommitted, pData->mutCtrCommitted, pWrkrData->nInTx);
+	pWrkrData->nLastTx = pWrkrData->nInTx;
+finalize_it:
+	pWrkrData->nInTx = 0;
+	RETiRet;
+}
+
+
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+	if(pWrkrData->pData->mode == MD_SINK)
+		sinkBeginTx(pWrkrData);
+ENDbeginTransaction
+
+
+BEGINendTransaction
+CODESTARTendTransaction
+	if(pWrkrData->pData->mode == MD_SINK)
+		iRet = sinkCommit(pWrkrData);
+ENDendTransaction
+
+
 BEGINtryResume
 CODESTARTtryResume
 	dbgprintf("omtesting tryResume() called\n");
@@ -203,6 +443,9 @@ CODESTARTtryResume
 			break;
 		case MD_ALWAYS_SUSPEND:
 			iRet = RS_RET_SUSPENDED;
+			break;
+		case MD_SINK: /* the backend is always reachable */
+			break;
 	}
 	pthread_mutex_unlock(&pWrkrData->pData->mut);
 	dbgprintf("omtesting tryResume() returns iRet %d\n", iRet);
@@ -214,6 +457,10 @@ BEGINdoAction
 CODESTARTdoAction
 	dbgprintf("omtesting received msg '%s'\n", ppString[0]);
 	pData = pWrkrData->pData;
+	if(pData->mode == MD_SINK) {
+		iRet = sinkDoAction(pWrkrData, ppString[0]);
+		FINALIZE;
+	}
 	pthread_mutex_lock(&pData->mut);
 	switch(pData->mode) {
 		case MD_SLEEP:
@@ -228,6 +475,8 @@ CODESTARTdoAction
 		case MD_ALWAYS_SUSPEND:
 			iRet = RS_RET_SUSPENDED;
 			break;
+		case MD_SINK: /* handled above */
+			break;
 	}
 
 	if(iRet == RS_RET_OK && pData->bEchoStdout) {
@@ -235,12 +484,17 @@ CODESTARTdoAction
 		fflush(stdout);
 	}
 	pthread_mutex_unlock(&pData->mut);
+finalize_it:
 	dbgprintf(":omtesting: end doAction(), iRet %d\n", iRet);
 ENDdoAction
 
 
 BEGINfreeInstance
 CODESTARTfreeInstance
+	if(pData->stats != NULL)
+		statsobj.Destruct(&pData->stats);
+	free(pData->tplName);
+	free(pData->statsName);
 	pthread_mutex_destroy(&pData->mut);
 ENDfreeInstance
 
@@ -250,6 +504,128 @@ CODESTARTfreeWrkrInstance
 ENDfreeWrkrInstance
 
 
+/* parse a probability, must be in [0,1] */
+static rsRetVal
+getProbability(struct cnfparamvals *pval, const char *name, double *pVal)
+{
+	char *cstr;
+	char *end;
+	DEFiRet;
+
+	cstr = es_str2cstr(pval->val.d.estr, NULL);
+	*pVal = strtod(cstr, &end);
+	if(*end != '\0' || *pVal < 0 || *pVal > 1) {
+		errmsg.LogError(0, RS_RET_PARAM_ERROR, "omtesting: %s must be a "
+			"number between 0 and 1, not '%s'", name, cstr);
+		iRet = RS_RET_PARAM_ERROR;
+	}
+	free(cstr);
+	RETiRet;
+}
+
+static rsRetVal
+sinkCreateStats(instanceData *pData)
+{
+	DEFiRet;
+
+	CHKiRet(statsobj.Construct(&pData->stats));
+	CHKiRet(statsobj.SetName(pData->stats, (pData->statsName == NULL) ?
+		UCHAR_CONSTANT("omtesting") : pData->statsName));
+#	define ADD_CTR(name, ctr, mut) \
+		STATSCOUNTER_INIT(pData->ctr, pData->mut); \
+		CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT(name), \
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pData->ctr));
+	ADD_CTR("received", ctrReceived, mutCtrReceived);
+	ADD_CTR("committed", ctrCommitted, mutCtrCommitted);
+	ADD_CTR("transactions", ctrTx, mutCtrTx);
+	ADD_CTR("failed.commit", ctrTxFailed, mutCtrTxFailed);
+	ADD_CTR("failed.partial", ctrTxPartial, mutCtrTxPartial);
+	ADD_CTR("rejected.backpressure", ctrBackpressure, mutCtrBackpressure);
+	ADD_CTR("ordering.violations", ctrOrder, mutCtrOrder);
+	ADD_CTR("sequence.gaps", ctrGaps, mutCtrGaps);
+#	undef ADD_CTR
+	CHKiRet(statsobj.ConstructFinalize(pData->stats));
+finalize_it:
+	RETiRet;
+}
+
+BEGINnewActInst
+	struct cnfparamvals *pvals;
+	char *cstr;
+	int i;
+CODESTARTnewActInst
+	if((pvals = nvlstGetParams(lst, &actpblk, NULL)) == NULL) {
+		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+	}
+
+	CHKiRet(createInstance(&pData));
+	pData->mode = MD_SINK;
+	pData->iLatency = 0;
+	pData->latencyDist = LAT_FIXED;
+	pData->latencySigma = 0.5;
+	pData->maxSeq = -1;
+	pData->bpLast = nowSecs();
+
+	CODE_STD_STRING_REQUESTnewActInst(1)
+	for(i = 0 ; i < actpblk.nParams ; ++i) {
+		if(!pvals[i].bUsed)
+			continue;
+		if(!strcmp(actpblk.descr[i].name, "mode")) {
+			if(es_strbufcmp(pvals[i].val.d.estr, (uchar*)"sink", sizeof("sink")-1)) {
+				cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "omtesting: mode '%s' "
+					"is not supported with action(), only 'sink' is - use "
+					"the legacy :omtesting: syntax for the other modes", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+			}
+		} else if(!strcmp(actpblk.descr[i].name, "template")) {
+			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "statsname")) {
+			pData->statsName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "latency")) {
+			pData->iLatency = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "latency.distribution")) {
+			if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"fixed", sizeof("fixed")-1)) {
+				pData->latencyDist = LAT_FIXED;
+			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"exponential", sizeof("exponential")-1)) {
+				pData->latencyDist = LAT_EXPONENTIAL;
+			} else if(!es_strbufcmp(pvals[i].val.d.estr, (uchar*)"lognormal", sizeof("lognormal")-1)) {
+				pData->latencyDist = LAT_LOGNORMAL;
+			} else {
+				cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "omtesting: invalid "
+					"latency.distribution '%s', must be fixed, exponential "
+					"or lognormal", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+			}
+		} else if(!strcmp(actpblk.descr[i].name, "latency.sigma")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			pData->latencySigma = strtod(cstr, NULL);
+			free(cstr);
+		} else if(!strcmp(actpblk.descr[i].name, "failure.rate")) {
+			CHKiRet(getProbability(&pvals[i], "failure.rate", &pData->failRate));
+		} else if(!strcmp(actpblk.descr[i].name, "failure.partial")) {
+			CHKiRet(getProbability(&pvals[i], "failure.partial", &pData->failPartial));
+		} else if(!strcmp(actpblk.descr[i].name, "backpressure.rate")) {
+			pData->iBackpressureRate = (int) pvals[i].val.d.n;
+			pData->bpTokens = pData->iBackpressureRate;
+		} else {
+			dbgprintf("omtesting: program error, non-handled "
+			  "param '%s'\n", actpblk.descr[i].name);
+		}
+	}
+
+	CHKiRet(sinkCreateStats(pData));
+	CHKiRet(OMSRsetEntry(*ppOMSR, 0, (uchar*)strdup((pData->tplName == NULL) ?
+						"RSYSLOG_FileFormat" : (char*)pData->tplName),
+						OMSR_NO_RQD_TPL_OPTS));
+CODE_STD_FINALIZERnewActInst
+	cnfparamvalsDestruct(pvals, &actpblk);
+ENDnewActInst
+
+
 BEGINparseSelectorAct
 	int i;
 	uchar szBuf[1024];
@@ -337,6 +713,8 @@ ENDparseSelectorAct
 
 BEGINmodExit
 CODESTARTmodExit
+	objRelease(statsobj, CORE_COMPONENT);
+	objRelease(errmsg, CORE_COMPONENT);
 ENDmodExit
 
 
@@ -344,7 +722,8 @@ BEGINqueryEtryPt
 CODESTARTqueryEtryPt
 CODEqueryEtryPt_STD_OMOD_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
-CODEqueryEtryPt_STD_CONF2_CNFNAME_QUERIES 
+CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
+CODEqueryEtryPt_TXIF_OMOD_QUERIES
 ENDqueryEtryPt
 
 
@@ -353,6 +732,8 @@ CODESTARTmodInit
 INITLegCnfVars
 	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
 CODEmodInit_QueryRegCFSLineHdlr
+	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 	CHKiRet(omsdRegCFSLineHdlr((uchar *)"actionomtestingechostdout", 0, eCmdHdlrBinary, NULL,
 				   &cs.bEchoStdout, STD_LOADABLE_MODULE_ID));
 	/* we seed the random-number generator in any case... */
@@ -50,8 +50,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <stdint.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <sys/socket.h>
 #include <fnmatch.h>
 #include <assert.h>
 #include <errno.h>
@@ -92,6 +94,34 @@ DEFobjCurrIf(errmsg)
 DEFobjCurrIf(glbl)
 DEFobjCurrIf(net)
 
+#ifdef HAVE_SENDMMSG
+/* max number of packets we gather for a single sendmmsg() call */
+#define SPOOF_BATCH_MAX 256
+/* max UDP payload that fits into an IPv4 datagram */
+#define SPOOF_MAX_PAYLOAD (65535 - LIBNET_IPV4_H - LIBNET_UDP_H)
+
+/* a target address with the pre-built headers for it. Only the source
+ * address and port, lengths, fragment offset, ID and checksums need to
+ * be filled in per packet.
+ */
+typedef struct spoofTarget_s {
+	struct sockaddr_in addr;
+	uchar hdrTpl[LIBNET_IPV4_H+LIBNET_UDP_H];
+} spoofTarget_t;
+
+/* a single IP packet, either a complete datagram or a fragment of it */
+typedef struct spoofPkt_s {
+	struct iovec iov[2];	/* headers, payload */
+	uchar hdr[LIBNET_IPV4_H+LIBNET_UDP_H];
+	unsigned iMsg;		/* message inside the batch this packet belongs to */
+} spoofPkt_t;
+
+/* per-message send state during a batch */
+#define SPOOF_MSG_PENDING 0
+#define SPOOF_MSG_SENDING 1
+#define SPOOF_MSG_SENT 2
+#endif
+
 typedef struct _instanceData {
 	uchar 	*tplName;	/* name of assigned template */
 	uchar	*host;
@@ -110,6 +140,17 @@ typedef struct wrkrInstanceData {
 	int	*pSockArray;		/* sockets to use for UDP */
 	struct addrinfo *f_addr;
 	char errbuf[LIBNET_ERRBUF_SIZE];
+#	ifdef HAVE_SENDMMSG
+	int sockRaw;		/* raw socket for batched sending */
+	spoofTarget_t *targets;	/* IPv4 addresses of the target, with header templates */
+	int nTargets;
+	spoofPkt_t *pkts;	/* packets gathered for the next sendmmsg() */
+	struct mmsghdr *mmh;
+	unsigned nPkts;
+	uchar *msgState;	/* SPOOF_MSG_* for each message of the batch */
+	unsigned sizeMsgState;
+	u_short ipID;		/* IP ID of the next datagram */
+#	endif
 } wrkrInstanceData_t;
 
 #define DFLT_SOURCE_PORT_START 32000
@@ -230,6 +271,15 @@ closeUDPSockets(wrkrInstanceData_t *pWrkrData)
 		freeaddrinfo(pWrkrData->f_addr);
 		pWrkrData->f_addr = NULL;
 	}
+#	ifdef HAVE_SENDMMSG
+	if(pWrkrData->sockRaw != -1) {
+		close(pWrkrData->sockRaw);
+		pWrkrData->sockRaw = -1;
+	}
+	free(pWrkrData->targets);
+	pWrkrData->targets = NULL;
+	pWrkrData->nTargets = 0;
+#	endif
 	RETiRet;
 }
 
@@ -322,6 +372,17 @@ BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
 	pWrkrData->libnet_handle = NULL;
 	pWrkrData->sourcePort = pData->sourcePortStart;
+#	ifdef HAVE_SENDMMSG
+	pWrkrData->sockRaw = -1;
+	pWrkrData->targets = NULL;
+	pWrkrData->nTargets = 0;
+	pWrkrData->pkts = NULL;
+	pWrkrData->mmh = NULL;
+	pWrkrData->nPkts = 0;
+	pWrkrData->msgState = NULL;
+	pWrkrData->sizeMsgState = 0;
+	pWrkrData->ipID = (u_short) getpid();
+#	endif
 ENDcreateWrkrInstance
 
 BEGINisCompatibleWithFeature
@@ -345,6 +406,11 @@ CODESTARTfreeWrkrInstance
 	closeUDPSockets(pWrkrData);
 	if(pWrkrData->libnet_handle != NULL)
 		libnet_destroy(pWrkrData->libnet_handle);
+#	ifdef HAVE_SENDMMSG
+	free(pWrkrData->pkts);
+	free(pWrkrData->mmh);
+	free(pWrkrData->msgState);
+#	endif
 ENDfreeWrkrInstance
 
 
@@ -526,6 +592,279 @@ finalize_it:
 }
 
 
+#ifdef HAVE_SENDMMSG
+static inline void
+put16(uchar *p, unsigned v)
+{
+	p[0] = (v >> 8) & 0xff;
+	p[1] = v & 0xff;
+}
+
+
+/* ones-complement sum as used by the IP and UDP checksums. The addresses
+ * are already in network byte order, so we can sum their bytes as is.
+ */
+static uint32_t
+csumAdd(uint32_t sum, const uchar *p, size_t len)
+{
+	while(len > 1) {
+		sum += (p[0] << 8) | p[1];
+		p += 2;
+		len -= 2;
+	}
+	if(len == 1)
+		sum += p[0] << 8;
+	return sum;
+}
+
+static uint16_t
+csumFold(uint32_t sum)
+{
+	while(sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t) ~sum;
+}
+
+
+/* build the header templates for all IPv4 target addresses */
+static rsRetVal
+buildTargets(wrkrInstanceData_t *pWrkrData)
+{
+	struct addrinfo *r;
+	spoofTarget_t *pTarget;
+	int n;
+	DEFiRet;
+
+	n = 0;
+	for(r = pWrkrData->f_addr ; r != NULL ; r = r->ai_next)
+		++n;
+	CHKmalloc(pWrkrData->targets = calloc(n, sizeof(spoofTarget_t)));
+	pWrkrData->nTargets = 0;
+	for(r = pWrkrData->f_addr ; r != NULL ; r = r->ai_next) {
+		if(r->ai_family != AF_INET)
+			continue; /* spoofing is only supported for IPv4 */
+		pTarget = &pWrkrData->targets[pWrkrData->nTargets++];
+		memcpy(&pTarget->addr, r->ai_addr, sizeof(struct sockaddr_in));
+		/* IPv4 header, no options */
+		pTarget->hdrTpl[0] = 0x45;	/* version, header length */
+		pTarget->hdrTpl[8] = 64;	/* TTL */
+		pTarget->hdrTpl[9] = IPPROTO_UDP;
+		memcpy(pTarget->hdrTpl + 16, &pTarget->addr.sin_addr.s_addr, 4);
+		/* UDP header, destination port is already in network byte order */
+		memcpy(pTarget->hdrTpl + LIBNET_IPV4_H + 2, &pTarget->addr.sin_port, 2);
+	}
+	if(pWrkrData->nTargets == 0) {
+		DBGPRINTF("omudpspoof: no IPv4 address for target '%s'\n", pWrkrData->pData->host);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* send all gathered packets to the target via sendmmsg(). If a packet
+ * could not be sent, its message is set back to pending, so that the
+ * caller can try the next target address.
+ */
+static void
+flushPkts(wrkrInstanceData_t *pWrkrData, spoofTarget_t *pTarget)
+{
+	struct mmsghdr *const mmh = pWrkrData->mmh;
+	spoofPkt_t *pPkt;
+	unsigned j, k;
+	int nSent;
+	char errStr[1024];
+
+	for(j = 0 ; j < pWrkrData->nPkts ; ++j) {
+		memset(&mmh[j], 0, sizeof(struct mmsghdr));
+		mmh[j].msg_hdr.msg_name = &pTarget->addr;
+		mmh[j].msg_hdr.msg_namelen = sizeof(pTarget->addr);
+		mmh[j].msg_hdr.msg_iov = pWrkrData->pkts[j].iov;
+		mmh[j].msg_hdr.msg_iovlen = 2;
+	}
+
+	j = 0;
+	while(j < pWrkrData->nPkts) {
+		nSent = sendmmsg(pWrkrData->sockRaw, mmh + j, pWrkrData->nPkts - j, 0);
+		if(nSent <= 0) {
+			DBGPRINTF("omudpspoof: sendmmsg() error: %s\n",
+				  rs_strerror_r(errno, errStr, sizeof(errStr)));
+			pWrkrData->msgState[pWrkrData->pkts[j].iMsg] = SPOOF_MSG_PENDING;
+			++j;
+			continue;
+		}
+		for(k = j ; k < j + nSent ; ++k) {
+			pPkt = &pWrkrData->pkts[k];
+			if(mmh[k].msg_len != pPkt->iov[0].iov_len + pPkt->iov[1].iov_len)
+				pWrkrData->msgState[pPkt->iMsg] = SPOOF_MSG_PENDING;
+		}
+		j += nSent;
+	}
+	pWrkrData->nPkts = 0;
+}
+
+
+/* add a packet; the ID and frag offset are set by the caller */
+static spoofPkt_t *
+addPkt(wrkrInstanceData_t *pWrkrData, spoofTarget_t *pTarget, unsigned iMsg,
+	const uchar *payload, size_t lenPayload, size_t lenHdr)
+{
+	spoofPkt_t *pPkt;
+
+	if(pWrkrData->nPkts == SPOOF_BATCH_MAX)
+		flushPkts(pWrkrData, pTarget);
+	pPkt = &pWrkrData->pkts[pWrkrData->nPkts++];
+	pPkt->iMsg = iMsg;
+	pPkt->iov[0].iov_base = pPkt->hdr;
+	pPkt->iov[0].iov_len = lenHdr;
+	pPkt->iov[1].iov_base = (void*) payload;
+	pPkt->iov[1].iov_len = lenPayload;
+	put16(pPkt->hdr + 2, lenHdr + lenPayload);	/* IP total length */
+	return pPkt;
+}
+
+
+/* build the packets for one message. The fragmentation logic is the
+ * same as in UDPSend(), but the headers are derived from the target's
+ * template instead of being built by libnet each time.
+ */
+static void
+buildMsgPkts(wrkrInstanceData_t *pWrkrData, spoofTarget_t *pTarget, unsigned iMsg,
+	uchar *pszSourcename, const uchar *msg, size_t len)
+{
+	spoofPkt_t *pPkt;
+	struct in_addr srcAddr;
+	unsigned maxPktLen, pktLen;
+	unsigned msgOffs, hdrOffs;
+	uint32_t sum;
+	u_short ipID;
+	int i;
+
+	if(len > SPOOF_MAX_PAYLOAD) {
+		DBGPRINTF("omudpspoof: msg with length %d truncated to %d: '%.768s'\n",
+			  (int) len, SPOOF_MAX_PAYLOAD, msg);
+		len = SPOOF_MAX_PAYLOAD;
+	}
+	if(pWrkrData->sourcePort++ >= pWrkrData->pData->sourcePortEnd){
+		pWrkrData->sourcePort = pWrkrData->pData->sourcePortStart;
+	}
+	/* an invalid source is left at 0.0.0.0, which makes the kernel fill in ours */
+	if(inet_pton(AF_INET, (char*)pszSourcename, &srcAddr) != 1)
+		srcAddr.s_addr = 0;
+	ipID = pWrkrData->ipID++;
+
+	maxPktLen = (pWrkrData->pData->mtu - LIBNET_IPV4_H) & ~0x07;
+	if(len > (maxPktLen - LIBNET_UDP_H)) {
+		hdrOffs = IP_MF;
+		pktLen = maxPktLen - LIBNET_UDP_H;
+	} else {
+		hdrOffs = 0;
+		pktLen = len;
+	}
+
+	/* first packet: IP and UDP header */
+	pPkt = addPkt(pWrkrData, pTarget, iMsg, msg, pktLen, LIBNET_IPV4_H+LIBNET_UDP_H);
+	memcpy(pPkt->hdr, pTarget->hdrTpl, sizeof(pTarget->hdrTpl));
+	put16(pPkt->hdr + 2, LIBNET_IPV4_H + LIBNET_UDP_H + pktLen);
+	put16(pPkt->hdr + 4, ipID);
+	put16(pPkt->hdr + 6, hdrOffs);
+	memcpy(pPkt->hdr + 12, &srcAddr.s_addr, 4);
+	put16(pPkt->hdr + 10, csumFold(csumAdd(0, pPkt->hdr, LIBNET_IPV4_H)));
+	put16(pPkt->hdr + LIBNET_IPV4_H, pWrkrData->sourcePort);
+	put16(pPkt->hdr + LIBNET_IPV4_H + 4, LIBNET_UDP_H + len);
+	/* UDP checksum: pseudo header, UDP header and the complete payload */
+	sum = csumAdd(0, pPkt->hdr + 12, 8);	/* source and destination address */
+	sum += IPPROTO_UDP + LIBNET_UDP_H + len;
+	sum = csumAdd(sum, pPkt->hdr + LIBNET_IPV4_H, LIBNET_UDP_H);
+	sum = csumAdd(sum, msg, len);
+	i = csumFold(sum);
+	put16(pPkt->hdr + LIBNET_IPV4_H + 6, (i == 0) ? 0xffff : i);
+
+	/* remaining fragments: IP header only */
+	for(msgOffs = pktLen ; msgOffs < len ; msgOffs += pktLen) {
+		if((len - msgOffs) > maxPktLen) {
+			hdrOffs = IP_MF + (msgOffs + LIBNET_UDP_H)/8;
+			pktLen = maxPktLen;
+		} else {
+			hdrOffs = (msgOffs + LIBNET_UDP_H)/8;
+			pktLen = len - msgOffs;
+		}
+		pPkt = addPkt(pWrkrData, pTarget, iMsg, msg + msgOffs, pktLen, LIBNET_IPV4_H);
+		memcpy(pPkt->hdr, pTarget->hdrTpl, LIBNET_IPV4_H);
+		put16(pPkt->hdr + 2, LIBNET_IPV4_H + pktLen);
+		put16(pPkt->hdr + 4, ipID);
+		put16(pPkt->hdr + 6, hdrOffs);
+		memcpy(pPkt->hdr + 12, &srcAddr.s_addr, 4);
+		put16(pPkt->hdr + 10, csumFold(csumAdd(0, pPkt->hdr, LIBNET_IPV4_H)));
+	}
+}
+
+
+/* Send a whole batch via the raw socket. Each message is tried on the
+ * target addresses in order until it could be sent, like UDPSend() does.
+ * If a message could not be sent at all, the action is suspended (and
+ * the batch retried).
+ */
+static rsRetVal
+UDPSendBatch(wrkrInstanceData_t *pWrkrData, actWrkrIParams_t *const pParams, const unsigned nParams)
+{
+	uchar *newState;
+	unsigned i;
+	unsigned nFailed;
+	int t;
+	int iMaxLine;
+	size_t l;
+	DEFiRet;
+
+	if(pWrkrData->pkts == NULL) {
+		CHKmalloc(pWrkrData->pkts = calloc(SPOOF_BATCH_MAX, sizeof(spoofPkt_t)));
+		CHKmalloc(pWrkrData->mmh = calloc(SPOOF_BATCH_MAX, sizeof(struct mmsghdr)));
+	}
+	if(nParams > pWrkrData->sizeMsgState) {
+		CHKmalloc(newState = realloc(pWrkrData->msgState, nParams));
+		pWrkrData->msgState = newState;
+		pWrkrData->sizeMsgState = nParams;
+	}
+	memset(pWrkrData->msgState, SPOOF_MSG_PENDING, nParams);
+
+	nFailed = nParams;
+	iMaxLine = glbl.GetMaxLine();
+	for(t = 0 ; t < pWrkrData->nTargets ; ++t) {
+		pWrkrData->nPkts = 0;
+		for(i = 0 ; i < nParams ; ++i) {
+			if(pWrkrData->msgState[i] != SPOOF_MSG_PENDING)
+				continue;
+			pWrkrData->msgState[i] = SPOOF_MSG_SENDING;
+			l = actParam(pParams, 2, i, 0).lenStr;
+			if((int) l > iMaxLine)
+				l = iMaxLine;
+			buildMsgPkts(pWrkrData, &pWrkrData->targets[t], i,
+				     actParam(pParams, 2, i, 1).param,
+				     actParam(pParams, 2, i, 0).param, l);
+		}
+		flushPkts(pWrkrData, &pWrkrData->targets[t]);
+		nFailed = 0;
+		for(i = 0 ; i < nParams ; ++i) {
+			if(pWrkrData->msgState[i] == SPOOF_MSG_SENDING)
+				pWrkrData->msgState[i] = SPOOF_MSG_SENT;
+			else if(pWrkrData->msgState[i] == SPOOF_MSG_PENDING)
+				++nFailed;
+		}
+		if(nFailed == 0)
+			FINALIZE;
+	}
+
+	DBGPRINTF("omudpspoof: %u of %u messages could not be sent, suspending\n",
+		  nFailed, nParams);
+	ABORT_FINALIZE(RS_RET_SUSPENDED);
+
+finalize_it:
+	RETiRet;
+}
+#endif /* #ifdef HAVE_SENDMMSG */
+
+
 /* try to resume connection if it is not ready
  * rgerhards, 2007-08-02
  */
@@ -541,6 +880,21 @@ static rsRetVal doTryResume(wrkrInstanceData_t *pWrkrData)
 		FINALIZE;
 	pData = pWrkrData->pData;
 
+#	ifdef HAVE_SENDMMSG
+	if(pWrkrData->sockRaw == -1) {
+		/* IPPROTO_RAW implies IP_HDRINCL, we build the IP headers ourselves */
+		pWrkrData->sockRaw = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
+		if(pWrkrData->sockRaw == -1) {
+			if(pData->bReportLibnetInitErr) {
+				errmsg.LogError(errno, RS_RET_ERR_LIBNET_INIT, "omudpsoof: error "
+				                "creating raw socket - are you running as root?");
+				pData->bReportLibnetInitErr = 0;
+			}
+			ABORT_FINALIZE(RS_RET_ERR_LIBNET_INIT);
+		}
+	}
+	DBGPRINTF("omudpspoof: raw socket ok\n");
+#	else
 	if(pWrkrData->libnet_handle == NULL) {
 		/* Initialize the libnet library.  Root priviledges are required.
 		 * this initializes a IPv4 socket to use for forging UDP packets.
@@ -560,6 +914,7 @@ static rsRetVal doTryResume(wrkrInstanceData_t *pWrkrData)
 		}
 	}
 	DBGPRINTF("omudpspoof: libnit_init() ok\n");
+#	endif
 	pData->bReportLibnetInitErr = 1;
 
 	/* The remote address is not yet known and needs to be obtained */
@@ -576,7 +931,10 @@ static rsRetVal doTryResume(wrkrInstanceData_t *pWrkrData)
 	}
 	DBGPRINTF("%s found, resuming.\n", pData->host);
 	pWrkrData->f_addr = res;
-	pWrkrData->pSockArray = net.create_udp_socket((uchar*)pData->host, NULL, 0, 0);
+#	ifdef HAVE_SENDMMSG
+	CHKiRet(buildTargets(pWrkrData));
+#	endif
+	pWrkrData->pSockArray = net.create_udp_socket((uchar*)pData->host, NULL, 0, 0, 0);
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
@@ -584,6 +942,11 @@ finalize_it:
 			freeaddrinfo(pWrkrData->f_addr);
 			pWrkrData->f_addr = NULL;
 		}
+#		ifdef HAVE_SENDMMSG
+		free(pWrkrData->targets);
+		pWrkrData->targets = NULL;
+		pWrkrData->nTargets = 0;
+#		endif
 		iRet = RS_RET_SUSPENDED;
 	}
 
@@ -596,26 +959,45 @@ CODESTARTtryResume
 	iRet = doTryResume(pWrkrData);
 ENDtryResume
 
-BEGINdoAction
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+	iRet = doTryResume(pWrkrData);
+ENDbeginTransaction
+
+
+/* The whole batch is handed over at once. With sendmmsg() available,
+ * the datagrams are built from per-target header templates and sent via
+ * a raw socket in as few system calls as possible. Otherwise, libnet
+ * is used to send each message individually.
+ */
+BEGINcommitTransaction
+#	ifndef HAVE_SENDMMSG
 	char *psz; /* temporary buffering */
 	unsigned l;
 	int iMaxLine;
-CODESTARTdoAction
+	unsigned i;
+#	endif
+CODESTARTcommitTransaction
 	CHKiRet(doTryResume(pWrkrData));
 
-	DBGPRINTF(" %s:%s/omudpspoof, src '%s', msg strt '%.256s'\n", pWrkrData->pData->host,
-		  getFwdPt(pWrkrData->pData), ppString[1], ppString[0]);
+	DBGPRINTF(" %s:%s/omudpspoof, %u messages\n", pWrkrData->pData->host,
+		  getFwdPt(pWrkrData->pData), nParams);
 
+#	ifdef HAVE_SENDMMSG
+	CHKiRet(UDPSendBatch(pWrkrData, pParams, nParams));
+#	else
 	iMaxLine = glbl.GetMaxLine();
-	psz = (char*) ppString[0];
-	l = strlen((char*) psz);
-	if((int) l > iMaxLine)
-		l = iMaxLine;
-
-	CHKiRet(UDPSend(pWrkrData, ppString[1], psz, l));
+	for(i = 0 ; i < nParams ; ++i) {
+		psz = (char*) actParam(pParams, 2, i, 0).param;
+		l = actParam(pParams, 2, i, 0).lenStr;
+		if((int) l > iMaxLine)
+			l = iMaxLine;
+		CHKiRet(UDPSend(pWrkrData, actParam(pParams, 2, i, 1).param, psz, l));
+	}
+#	endif
 
 finalize_it:
-ENDdoAction
+ENDcommitTransaction
 
 
 static inline void
@@ -754,7 +1136,7 @@ ENDmodExit
 
 BEGINqueryEtryPt
 CODESTARTqueryEtryPt
-CODEqueryEtryPt_STD_OMOD_QUERIES
+CODEqueryEtryPt_STD_OMODTX_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
 CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
 CODEqueryEtryPt_STD_CONF2_QUERIES
@@ -4,6 +4,12 @@
  * NOTE: read comments in module-template.h to understand how this file
  *       works!
  *
+ * Messages are sent in batches: all messages of a transaction are handed
+ * to the kernel with a single sendmmsg() call (if available). If multiple
+ * sockets are configured, the messages are distributed round-robin over
+ * them, which permits the receiver to use more than one socket (and thus
+ * more than one input thread).
+ *
  * Copyright 2010-2013 Adiscon GmbH.
  *
  * This file is part of rsyslog.
@@ -34,6 +40,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include "conf.h"
 #include "srUtils.h"
 #include "template.h"
@@ -56,16 +63,32 @@ DEFobjCurrIf(glbl)
 
 #define INVLD_SOCK -1
 
+#ifdef HAVE_SENDMMSG
+typedef struct mmsghdr uxMsg_t;
+#else
+/* stand-in for struct mmsghdr on systems without sendmmsg() */
+typedef struct uxMsg_s {
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+} uxMsg_t;
+#endif
+
 typedef struct _instanceData {
 	permittedPeers_t *pPermPeers;
-	uchar *sockName;
-	int sock;
-	struct sockaddr_un addr;
+	uchar *tplName;
+	uchar **sockNames;	/* destination sockets, used round-robin */
+	struct sockaddr_un *addrs;
+	unsigned nAddrs;
 } instanceData;
 
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	int sock;
+	unsigned nextAddr;	/* next destination for round-robin */
+	struct iovec *iov;	/* messages of the current batch */
+	uxMsg_t *msgs;		/* headers for the current batch */
+	unsigned maxMsgs;	/* size of iov and msgs */
 } wrkrInstanceData_t;
 
 /* config data */
@@ -93,8 +116,16 @@ struct modConfData_s {
 static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
 static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current exec process */
 
-
-static pthread_mutex_t mutDoAct = PTHREAD_MUTEX_INITIALIZER;
+/* action (instance) parameters */
+static struct cnfparamdescr actpdescr[] = {
+	{ "socket", eCmdHdlrArray, CNFPARAM_REQUIRED },
+	{ "template", eCmdHdlrGetWord, 0 }
+};
+static struct cnfparamblk actpblk =
+	{ CNFPARAMBLK_VERSION,
+	  sizeof(actpdescr)/sizeof(struct cnfparamdescr),
+	  actpdescr
+	};
 
 BEGINinitConfVars		/* (re)set config variables to default values */
 CODESTARTinitConfVars 
@@ -103,9 +134,6 @@ CODESTARTinitConfVars
 ENDinitConfVars
 
 
-static rsRetVal doTryResume(instanceData *pData);
-
-
 /* this function gets the default template. It coordinates action between
  * old-style and new-style configuration parts.
  */
@@ -144,18 +172,50 @@ finalize_it:
 }
 
 
-static inline rsRetVal
-closeSocket(instanceData *pData)
+static inline void
+closeSocket(wrkrInstanceData_t *pWrkrData)
+{
+	if(pWrkrData->sock != INVLD_SOCK) {
+		close(pWrkrData->sock);
+		pWrkrData->sock = INVLD_SOCK;
+	}
+}
+
+
+/* set up the address of destination socket number idx */
+static rsRetVal
+setSockAddr(instanceData *pData, const unsigned idx, uchar *sockName)
 {
 	DEFiRet;
-	if(pData->sock != INVLD_SOCK) {
-		close(pData->sock);
-		pData->sock = INVLD_SOCK;
+
+	if(strlen((char*)sockName) >= sizeof(pData->addrs[idx].sun_path)) {
+		errmsg.LogError(0, RS_RET_PARAM_ERROR, "omuxsock: socket name '%s' "
+				"is too long", sockName);
+		free(sockName);
+		ABORT_FINALIZE(RS_RET_PARAM_ERROR);
 	}
+	pData->sockNames[idx] = sockName;
+	memset(&pData->addrs[idx], 0, sizeof(pData->addrs[idx]));
+	pData->addrs[idx].sun_family = AF_UNIX;
+	strcpy(pData->addrs[idx].sun_path, (char*)sockName);
+
+finalize_it:
 	RETiRet;
 }
 
 
+/* allocate the destination table for nAddrs sockets */
+static rsRetVal
+allocSockAddrs(instanceData *pData, const unsigned nAddrs)
+{
+	DEFiRet;
+	CHKmalloc(pData->sockNames = calloc(nAddrs, sizeof(uchar*)));
+	CHKmalloc(pData->addrs = calloc(nAddrs, sizeof(struct sockaddr_un)));
+	pData->nAddrs = nAddrs;
+finalize_it:
+	RETiRet;
+}
+
 
 
 BEGINbeginCnfLoad
@@ -225,11 +285,15 @@ ENDfreeCnf
 
 BEGINcreateInstance
 CODESTARTcreateInstance
-	pData->sock = INVLD_SOCK;
 ENDcreateInstance
 
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
+	pWrkrData->sock = INVLD_SOCK;
+	pWrkrData->nextAddr = 0;
+	pWrkrData->iov = NULL;
+	pWrkrData->msgs = NULL;
+	pWrkrData->maxMsgs = 0;
 ENDcreateWrkrInstance
 
 
@@ -241,50 +305,49 @@ ENDisCompatibleWithFeature
 
 
 BEGINfreeInstance
+	unsigned i;
 CODESTARTfreeInstance
 	/* final cleanup */
-	closeSocket(pData);
-	free(pData->sockName);
+	if(pData->sockNames != NULL) {
+		for(i = 0 ; i < pData->nAddrs ; ++i)
+			free(pData->sockNames[i]);
+		free(pData->sockNames);
+	}
+	free(pData->addrs);
+	free(pData->tplName);
 ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	closeSocket(pWrkrData);
+	free(pWrkrData->iov);
+	free(pWrkrData->msgs);
 ENDfreeWrkrInstance
 
 
 BEGINdbgPrintInstInfo
+	unsigned i;
 CODESTARTdbgPrintInstInfo
-	DBGPRINTF("%s", pData->sockName);
+	for(i = 0 ; i < pData->nAddrs ; ++i)
+		DBGPRINTF("%s%s", (i == 0) ? "" : ", ", pData->sockNames[i]);
 ENDdbgPrintInstInfo
 
 
-/* Send a message via UDP
- * rgehards, 2007-12-20
+/* open our (unbound) sending socket. Destinations are given per message.
  */
-static rsRetVal sendMsg(instanceData *pData, char *msg, size_t len)
+static rsRetVal
+openSocket(wrkrInstanceData_t *pWrkrData)
 {
 	DEFiRet;
-	unsigned lenSent = 0;
+	assert(pWrkrData->sock == INVLD_SOCK);
 
-	if(pData->sock == INVLD_SOCK) {
-		CHKiRet(doTryResume(pData));
-	}
-
-	if(pData->sock != INVLD_SOCK) {
-		/* we need to track if we have success sending to the remote
-		 * peer. Success is indicated by at least one sendto() call
-		 * succeeding. We track this be bSendSuccess. We can not simply
-		 * rely on lsent, as a call might initially work, but a later
-		 * call fails. Then, lsent has the error status, even though
-		 * the sendto() succeeded. -- rgerhards, 2007-06-22
-		 */
-		lenSent = sendto(pData->sock, msg, len, 0, &pData->addr, sizeof(pData->addr));
-		if(lenSent == len) {
-			int eno = errno;
-			char errStr[1024];
-			DBGPRINTF("omuxsock suspending: sendto(), socket %d, error: %d = %s.\n",
-				pData->sock, eno, rs_strerror_r(eno, errStr, sizeof(errStr)));
-		}
+	if((pWrkrData->sock = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
+		char errStr[1024];
+		int eno = errno;
+		DBGPRINTF("error %d creating AF_UNIX/SOCK_DGRAM: %s.\n",
+			eno, rs_strerror_r(eno, errStr, sizeof(errStr)));
+		pWrkrData->sock = INVLD_SOCK;
+		ABORT_FINALIZE(RS_RET_NO_SOCKET);
 	}
 
 finalize_it:
@@ -292,83 +355,149 @@ finalize_it:
 }
 
 
-/* open socket to remote system
+/* try to resume connection if it is not ready
  */
-static inline rsRetVal
-openSocket(instanceData *pData)
+static rsRetVal
+doTryResume(wrkrInstanceData_t *pWrkrData)
 {
 	DEFiRet;
-	assert(pData->sock == INVLD_SOCK);
 
-	if((pData->sock = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
-		char errStr[1024];
-		int eno = errno;
-		DBGPRINTF("error %d creating AF_UNIX/SOCK_DGRAM: %s.\n",
-			eno, rs_strerror_r(eno, errStr, sizeof(errStr)));
-		pData->sock = INVLD_SOCK;
-		ABORT_FINALIZE(RS_RET_NO_SOCKET);
-		
+	if(pWrkrData->sock != INVLD_SOCK)
+		FINALIZE;
+	DBGPRINTF("omuxsock trying to resume\n");
+	iRet = openSocket(pWrkrData);
+	if(iRet != RS_RET_OK) {
+		iRet = RS_RET_SUSPENDED;
 	}
 
-	/* set up server address structure */
-	memset(&pData->addr, 0, sizeof(pData->addr));
-        pData->addr.sun_family = AF_UNIX;
-        strcpy(pData->addr.sun_path, (char*)pData->sockName);
-
 finalize_it:
-	if(iRet != RS_RET_OK) {
-		closeSocket(pData);
-	}
 	RETiRet;
 }
 
 
+/* send n datagrams, returns the number of datagrams sent or -1 if the
+ * first one could not be sent (errno is set in this case).
+ */
+static int
+sendDatagrams(const int sock, uxMsg_t *const msgs, const unsigned n)
+{
+#	ifdef HAVE_SENDMMSG
+	return sendmmsg(sock, msgs, n, 0);
+#	else
+	unsigned i;
+	ssize_t lenSent;
+
+	for(i = 0 ; i < n ; ++i) {
+		lenSent = sendmsg(sock, &msgs[i].msg_hdr, 0);
+		if(lenSent < 0)
+			return (i == 0) ? -1 : (int) i;
+		msgs[i].msg_len = (unsigned) lenSent;
+	}
+	return (int) n;
+#	endif
+}
 
-/* try to resume connection if it is not ready
+
+/* Send a batch of datagrams. Each message is assigned the next destination
+ * socket in round-robin order. If a destination does not accept a message
+ * (e.g. the receiver is not running), the message is tried on the next
+ * destination. If no destination accepts it, we suspend; the messages
+ * sent so far are reported as done and will not be retried.
  */
-static rsRetVal doTryResume(instanceData *pData)
+static rsRetVal
+sendBatch(wrkrInstanceData_t *pWrkrData, const unsigned nMsgs, rsRetVal *const pResults)
 {
+	instanceData *const pData = pWrkrData->pData;
+	uxMsg_t *const msgs = pWrkrData->msgs;
+	struct sockaddr_un *addr;
+	unsigned i, k;
+	unsigned nTries = 0;
+	int nSent;
+	int eno;
+	char errStr[1024];
 	DEFiRet;
 
-	DBGPRINTF("omuxsock trying to resume\n");
-	closeSocket(pData);
-	iRet = openSocket(pData);
+	for(i = 0 ; i < nMsgs ; ++i) {
+		memset(&msgs[i], 0, sizeof(uxMsg_t));
+		msgs[i].msg_hdr.msg_name = &pData->addrs[pWrkrData->nextAddr];
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_un);
+		msgs[i].msg_hdr.msg_iov = &pWrkrData->iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		if(++pWrkrData->nextAddr == pData->nAddrs)
+			pWrkrData->nextAddr = 0;
+	}
 
-	if(iRet != RS_RET_OK) {
-		iRet = RS_RET_SUSPENDED;
+	i = 0;
+	while(i < nMsgs) {
+		nSent = sendDatagrams(pWrkrData->sock, msgs + i, nMsgs - i);
+		if(nSent > 0) {
+			for(k = i ; k < i + nSent ; ++k)
+				pResults[k] = RS_RET_OK;
+			i += nSent;
+			nTries = 0;
+			continue;
+		}
+		eno = errno;
+		if(eno == EINTR)
+			continue;
+		addr = (struct sockaddr_un*) msgs[i].msg_hdr.msg_name;
+		DBGPRINTF("omuxsock: sending to %s failed: %d = %s\n", addr->sun_path,
+			eno, rs_strerror_r(eno, errStr, sizeof(errStr)));
+		if(++nTries >= pData->nAddrs) {
+			DBGPRINTF("omuxsock: no destination accepts messages, suspending\n");
+			closeSocket(pWrkrData);
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+		/* try this message on the next destination */
+		if(++addr == pData->addrs + pData->nAddrs)
+			addr = pData->addrs;
+		msgs[i].msg_hdr.msg_name = addr;
 	}
 
+finalize_it:
 	RETiRet;
 }
 
 
 BEGINtryResume
 CODESTARTtryResume
-	iRet = doTryResume(pWrkrData->pData);
+	iRet = doTryResume(pWrkrData);
 ENDtryResume
 
-BEGINdoAction
-	char *psz = NULL; /* temporary buffering */
-	register unsigned l;
-	int iMaxLine;
-CODESTARTdoAction
-	pthread_mutex_lock(&mutDoAct);
-	CHKiRet(doTryResume(pWrkrData->pData));
 
-	iMaxLine = glbl.GetMaxLine();
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+	iRet = doTryResume(pWrkrData);
+ENDbeginTransaction
 
-	DBGPRINTF(" omuxsock:%s\n", pWrkrData->pData->sockName);
 
-	psz = (char*) ppString[0];
-	l = strlen((char*) psz);
-	if((int) l > iMaxLine)
-		l = iMaxLine;
+BEGINcommitBatch
+	const unsigned iMaxLine = (unsigned) glbl.GetMaxLine();
+	actWrkrIParams_t *iparam;
+	unsigned i;
+CODESTARTcommitBatch
+	CHKiRet(doTryResume(pWrkrData));
 
-	CHKiRet(sendMsg(pWrkrData->pData, psz, l));
+	if(nParams > pWrkrData->maxMsgs) {
+		struct iovec *iov;
+		uxMsg_t *msgs;
+		CHKmalloc(iov = realloc(pWrkrData->iov, sizeof(struct iovec) * nParams));
+		pWrkrData->iov = iov;
+		CHKmalloc(msgs = realloc(pWrkrData->msgs, sizeof(uxMsg_t) * nParams));
+		pWrkrData->msgs = msgs;
+		pWrkrData->maxMsgs = nParams;
+	}
+
+	for(i = 0 ; i < nParams ; ++i) {
+		iparam = &actParam(pParams, 1, i, 0);
+		pWrkrData->iov[i].iov_base = iparam->param;
+		pWrkrData->iov[i].iov_len = (iparam->lenStr > iMaxLine) ? iMaxLine : iparam->lenStr;
+	}
+
+	iRet = sendBatch(pWrkrData, nParams, pResults);
 
 finalize_it:
-	pthread_mutex_unlock(&mutDoAct);
-ENDdoAction
+ENDcommitBatch
 
 
 BEGINparseSelectorAct
@@ -394,13 +523,58 @@ CODE_STD_STRING_REQUESTparseSelectorAct(1)
 		ABORT_FINALIZE(RS_RET_NO_SOCK_CONFIGURED);
 	}
 
-	pData->sockName = cs.sockName;
+	CHKiRet(allocSockAddrs(pData, 1));
+	iRet = setSockAddr(pData, 0, cs.sockName);
 	cs.sockName = NULL; /* pData is now owner and will fee it */
+	CHKiRet(iRet);
 
 CODE_STD_FINALIZERparseSelectorAct
 ENDparseSelectorAct
 
 
+BEGINnewActInst
+	struct cnfparamvals *pvals;
+	uchar *sockName;
+	int i, j;
+CODESTARTnewActInst
+	if((pvals = nvlstGetParams(lst, &actpblk, NULL)) == NULL) {
+		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
+	}
+
+	CHKiRet(createInstance(&pData));
+
+	for(i = 0 ; i < actpblk.nParams ; ++i) {
+		if(!pvals[i].bUsed)
+			continue;
+		if(!strcmp(actpblk.descr[i].name, "socket")) {
+			CHKiRet(allocSockAddrs(pData, pvals[i].val.d.ar->nmemb));
+			for(j = 0 ; j < pvals[i].val.d.ar->nmemb ; ++j) {
+				CHKmalloc(sockName = (uchar*)es_str2cstr(pvals[i].val.d.ar->arr[j], NULL));
+				CHKiRet(setSockAddr(pData, j, sockName));
+			}
+		} else if(!strcmp(actpblk.descr[i].name, "template")) {
+			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else {
+			dbgprintf("omuxsock: program error, non-handled "
+			  "param '%s'\n", actpblk.descr[i].name);
+		}
+	}
+
+	if(pData->nAddrs == 0) {
+		errmsg.LogError(0, RS_RET_NO_SOCK_CONFIGURED, "omuxsock: no output socket "
+				"configured");
+		ABORT_FINALIZE(RS_RET_NO_SOCK_CONFIGURED);
+	}
+
+	CODE_STD_STRING_REQUESTnewActInst(1)
+	CHKiRet(OMSRsetEntry(*ppOMSR, 0, ustrdup((pData->tplName == NULL) ?
+		getDfltTpl() : pData->tplName), OMSR_NO_RQD_TPL_OPTS));
+
+CODE_STD_FINALIZERnewActInst
+	cnfparamvalsDestruct(pvals, &actpblk);
+ENDnewActInst
+
+
 /* a common function to free our configuration variables - used both on exit
  * and on $ResetConfig processing. -- rgerhards, 2008-05-16
  */
@@ -426,10 +600,11 @@ ENDmodExit
 
 BEGINqueryEtryPt
 CODESTARTqueryEtryPt
-CODEqueryEtryPt_STD_OMOD_QUERIES
+CODEqueryEtryPt_STD_OMODBATCH_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
 CODEqueryEtryPt_STD_CONF2_QUERIES
 CODEqueryEtryPt_STD_CONF2_setModCnf_QUERIES
+CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
 ENDqueryEtryPt
 
 
@@ -33,6 +33,7 @@
 #include <signal.h>
 #include <errno.h>
 #include <unistd.h>
+#include <arpa/inet.h>
 #include "conf.h"
 #include "syslogd-types.h"
 #include "srUtils.h"
@@ -58,6 +59,15 @@ static pthread_mutex_t mutDoAct = PTHREAD_MUTEX_INITIALIZER;
 #define ACTION_CONNECT 1
 #define ACTION_BIND    2
 
+/* batch modes: in multipart mode, each message of a transaction becomes
+   one frame of a single multipart zmq message. In framed mode, all
+   messages are packed into one zmq message, each one preceeded by its
+   length as 4-byte unsigned integer in network byte order.
+*/
+#define BATCH_NONE      0
+#define BATCH_MULTIPART 1
+#define BATCH_FRAMED    2
+
 
 /* ----------------------------------------------------------------------------
  * structs to describe sockets
@@ -95,11 +105,23 @@ typedef struct _instanceData {
     int     reconnectIVLMax;
     int     ipv4Only;
     int     affinity;
+    int     batchMode;
     uchar*  tplName;
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	struct {
+		int nmemb;		/* number of messages in current batch */
+		int maxFrames;		/* allocated size of frames (multipart mode) */
+		struct {
+			char   *buf;
+			size_t  len;
+		} *frames;
+		char   *buf;		/* framed mode buffer, handed over to libzmq */
+		size_t  len;
+		size_t  size;
+	} batch;
 } wrkrInstanceData_t;
 
 
@@ -148,6 +170,7 @@ static struct cnfparamdescr actpdescr[] = {
     { "ipv4Only",            eCmdHdlrInt,     0 },
     { "affinity",            eCmdHdlrInt,     0 },
     { "globalWorkerThreads", eCmdHdlrInt,     0 },
+    { "batchMode",           eCmdHdlrGetWord, 0 },
     { "template",            eCmdHdlrGetWord, 1 }
 };
 
@@ -189,6 +212,18 @@ static int getSocketAction(char* name) {
     return action;
 }
 
+static int getBatchMode(char* name) {
+    int mode = -1;
+    if(!strcmp(name, "none")) {
+        mode = BATCH_NONE;
+    } else if(!strcmp(name, "multipart")) {
+        mode = BATCH_MULTIPART;
+    } else if(!strcmp(name, "framed")) {
+        mode = BATCH_FRAMED;
+    }
+    return mode;
+}
+
 /* closeZMQ will destroy the context and 
  * associated socket
  */
@@ -279,6 +314,111 @@ rsRetVal writeZMQ(uchar* msg, instanceData* pData) {
     RETiRet;
 }
 
+/* free callback for buffers passed to libzmq via zmq_msg_init_data() */
+static void freeZMQBuf(void* data, void __attribute__((unused)) *hint) {
+    free(data);
+}
+
+/* add a message to the current batch. The template buffer is owned by
+   the action, so it is copied once; the copy is later handed to libzmq
+   without any further copying.
+*/
+static rsRetVal addToBatch(wrkrInstanceData_t* pWrkrData, uchar* msg) {
+    size_t len = strlen((char*)msg);
+    size_t newSize;
+    char* newBuf;
+    uint32_t lenNet;
+    DEFiRet;
+
+    if(pWrkrData->pData->batchMode == BATCH_MULTIPART) {
+        if(pWrkrData->batch.nmemb == pWrkrData->batch.maxFrames) {
+            int newMax = (pWrkrData->batch.maxFrames == 0) ? 64 : 2 * pWrkrData->batch.maxFrames;
+            void* newFrames;
+            CHKmalloc(newFrames = realloc(pWrkrData->batch.frames,
+                                          newMax * sizeof(*pWrkrData->batch.frames)));
+            pWrkrData->batch.frames = newFrames;
+            pWrkrData->batch.maxFrames = newMax;
+        }
+        CHKmalloc(newBuf = MALLOC(len + 1));
+        memcpy(newBuf, msg, len);
+        pWrkrData->batch.frames[pWrkrData->batch.nmemb].buf = newBuf;
+        pWrkrData->batch.frames[pWrkrData->batch.nmemb].len = len;
+    } else {
+        if(pWrkrData->batch.len + len + 4 > pWrkrData->batch.size) {
+            newSize = 2 * (pWrkrData->batch.len + len + 4);
+            if(newSize < 16384)
+                newSize = 16384;
+            CHKmalloc(newBuf = realloc(pWrkrData->batch.buf, newSize));
+            pWrkrData->batch.buf = newBuf;
+            pWrkrData->batch.size = newSize;
+        }
+        lenNet = htonl((uint32_t) len);
+        memcpy(pWrkrData->batch.buf + pWrkrData->batch.len, &lenNet, 4);
+        memcpy(pWrkrData->batch.buf + pWrkrData->batch.len + 4, msg, len);
+        pWrkrData->batch.len += len + 4;
+    }
+    ++pWrkrData->batch.nmemb;
+finalize_it:
+    RETiRet;
+}
+
+/* discard whatever is left in the batch buffers */
+static void resetBatch(wrkrInstanceData_t* pWrkrData) {
+    int i;
+    if(pWrkrData->pData->batchMode == BATCH_MULTIPART) {
+        for(i = 0 ; i < pWrkrData->batch.nmemb ; ++i)
+            free(pWrkrData->batch.frames[i].buf);
+    }
+    pWrkrData->batch.nmemb = 0;
+    pWrkrData->batch.len = 0;
+}
+
+/* send the current batch as one (multipart) zmq message. Buffers are
+   passed to libzmq via zmq_msg_init_data(), so libzmq frees them once
+   they have been sent.
+*/
+static rsRetVal sendBatch(wrkrInstanceData_t* pWrkrData) {
+    instanceData* pData = pWrkrData->pData;
+    zmq_msg_t msg;
+    int i;
+    int nFrames;
+    DEFiRet;
+
+    if(pWrkrData->batch.nmemb == 0)
+        FINALIZE;
+
+    if(NULL == pData->socket)
+        CHKiRet(initZMQ(pData));
+
+    if(pData->batchMode == BATCH_MULTIPART) {
+        nFrames = pWrkrData->batch.nmemb;
+        for(i = 0 ; i < nFrames ; ++i) {
+            zmq_msg_init_data(&msg, pWrkrData->batch.frames[i].buf,
+                              pWrkrData->batch.frames[i].len, freeZMQBuf, NULL);
+            pWrkrData->batch.frames[i].buf = NULL; /* now owned by msg */
+            if(zmq_msg_send(&msg, pData->socket, (i < nFrames - 1) ? ZMQ_SNDMORE : 0) == -1) {
+                errmsg.LogError(0, NO_ERRCODE, "omzmq3: send of batch (%d messages) failed: %s",
+                                nFrames, zmq_strerror(errno));
+                zmq_msg_close(&msg);
+                ABORT_FINALIZE(RS_RET_SUSPENDED);
+            }
+        }
+    } else {
+        zmq_msg_init_data(&msg, pWrkrData->batch.buf, pWrkrData->batch.len, freeZMQBuf, NULL);
+        pWrkrData->batch.buf = NULL; /* now owned by msg */
+        pWrkrData->batch.size = 0;
+        if(zmq_msg_send(&msg, pData->socket, 0) == -1) {
+            errmsg.LogError(0, NO_ERRCODE, "omzmq3: send of batch (%d messages) failed: %s",
+                            pWrkrData->batch.nmemb, zmq_strerror(errno));
+            zmq_msg_close(&msg);
+            ABORT_FINALIZE(RS_RET_SUSPENDED);
+        }
+    }
+ finalize_it:
+    resetBatch(pWrkrData);
+    RETiRet;
+}
+
 static inline void
 setInstParamDefaults(instanceData* pData) {
     pData->description     = NULL;
@@ -303,6 +443,7 @@ setInstParamDefaults(instanceData* pData) {
     pData->reconnectIVLMax = -1;
     pData->ipv4Only        = -1;
     pData->affinity        =  1;
+    pData->batchMode       = BATCH_NONE;
 }
 
 
@@ -341,6 +482,9 @@ ENDfreeInstance
 
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
+	resetBatch(pWrkrData);
+	free(pWrkrData->batch.frames);
+	free(pWrkrData->batch.buf);
 ENDfreeWrkrInstance
 
 
@@ -352,14 +496,35 @@ CODESTARTtryResume
 	pthread_mutex_unlock(&mutDoAct);
 ENDtryResume
 
+BEGINbeginTransaction
+CODESTARTbeginTransaction
+	/* a retried batch starts from scratch */
+	resetBatch(pWrkrData);
+ENDbeginTransaction
+
 BEGINdoAction
 	instanceData *pData = pWrkrData->pData;
 CODESTARTdoAction
-	pthread_mutex_lock(&mutDoAct);
-	iRet = writeZMQ(ppString[0], pData);
-	pthread_mutex_unlock(&mutDoAct);
+	if(pData->batchMode != BATCH_NONE) {
+		CHKiRet(addToBatch(pWrkrData, ppString[0]));
+		iRet = RS_RET_DEFER_COMMIT;
+	} else {
+		pthread_mutex_lock(&mutDoAct);
+		iRet = writeZMQ(ppString[0], pData);
+		pthread_mutex_unlock(&mutDoAct);
+	}
+finalize_it:
 ENDdoAction
 
+BEGINendTransaction
+CODESTARTendTransaction
+	if(pWrkrData->pData->batchMode != BATCH_NONE) {
+		pthread_mutex_lock(&mutDoAct);
+		iRet = sendBatch(pWrkrData);
+		pthread_mutex_unlock(&mutDoAct);
+	}
+ENDendTransaction
+
 
 BEGINnewActInst
     struct cnfparamvals *pvals;
@@ -420,6 +585,10 @@ CODESTARTnewActInst
             pData->affinity = (int) pvals[i].val.d.n;
         } else if (!strcmp(actpblk.descr[i].name, "globalWorkerThreads")) {
             s_workerThreads = (int) pvals[i].val.d.n;
+        } else if (!strcmp(actpblk.descr[i].name, "batchMode")) {
+            char *mode = es_str2cstr(pvals[i].val.d.estr, NULL);
+            pData->batchMode = getBatchMode(mode);
+            free(mode);
         } else {
             errmsg.LogError(0, NO_ERRCODE, "omzmq3: program error, non-handled "
                             "param '%s'\n", actpblk.descr[i].name);
@@ -443,6 +612,11 @@ CODESTARTnewActInst
         errmsg.LogError(0, RS_RET_CONFIG_ERROR, "omzmq3: unknown socket action");
         ABORT_FINALIZE(RS_RET_CONFIG_ERROR);
     }
+    if (pData->batchMode == -1) {
+        errmsg.LogError(0, RS_RET_CONFIG_ERROR, "omzmq3: unknown batchMode, must be "
+                        "\"none\", \"multipart\" or \"framed\"");
+        ABORT_FINALIZE(RS_RET_CONFIG_ERROR);
+    }
 
     CODE_STD_FINALIZERnewActInst
     cnfparamvalsDestruct(pvals, &actpblk);
@@ -479,6 +653,7 @@ CODESTARTqueryEtryPt
 	CODEqueryEtryPt_STD_OMOD_QUERIES
 	CODEqueryEtryPt_STD_CONF2_OMOD_QUERIES
 	CODEqueryEtryPt_STD_OMOD8_QUERIES
+	CODEqueryEtryPt_TXIF_OMOD_QUERIES /* we support the transactional interface! */
 ENDqueryEtryPt
 
 BEGINmodInit()
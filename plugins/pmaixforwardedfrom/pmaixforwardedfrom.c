@@ -76,6 +76,7 @@ CODESTARTparse
 	dbgprintf("Message will now be parsed by fix AIX Forwarded From parser.\n");
 	assert(pMsg != NULL);
 	assert(pMsg->pszRawMsg != NULL);
+	MsgRawUnshare(pMsg); /* we may modify the raw message in place */
 	lenMsg = pMsg->iLenRawMsg - pMsg->offAfterPRI; /* note: offAfterPRI is already the number of PRI chars (do not add one!) */
 	p2parse = pMsg->pszRawMsg + pMsg->offAfterPRI; /* point to start of text, after PRI */
 
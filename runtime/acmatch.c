@@ -0,0 +1,227 @@
+/* acmatch.c
+ * Multi-pattern string matching based on the Aho-Corasick algorithm.
+ * This is used to evaluate chains of "contains" and "startswith" filters
+ * over the same property with a single pass over the property value.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "rsyslog.h"
+#include "acmatch.h"
+
+
+rsRetVal
+acmatchConstruct(acmatch_t **ppThis, sbool bFoldCase)
+{
+	acmatch_t *pThis;
+	DEFiRet;
+
+	CHKmalloc(pThis = calloc(1, sizeof(acmatch_t)));
+	pThis->bFoldCase = bFoldCase;
+	*ppThis = pThis;
+finalize_it:
+	RETiRet;
+}
+
+
+/* add a pattern. The pattern is copied. Must be called before
+ * acmatchFinalize().
+ */
+rsRetVal
+acmatchAddPattern(acmatch_t *pThis, const uchar *pat, size_t len, unsigned id, sbool bAnchored)
+{
+	struct acmatch_pattern_s *newpatterns;
+	struct acmatch_pattern_s *p;
+	size_t i;
+	DEFiRet;
+
+	assert(!pThis->bFinalized);
+	if(id >= ACMATCH_MAX_IDS || len == 0)
+		ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+	if(pThis->nPatterns == pThis->maxPatterns) {
+		pThis->maxPatterns = (pThis->maxPatterns == 0) ? 16 : 2 * pThis->maxPatterns;
+		CHKmalloc(newpatterns = realloc(pThis->patterns,
+			sizeof(struct acmatch_pattern_s) * pThis->maxPatterns));
+		pThis->patterns = newpatterns;
+	}
+	p = pThis->patterns + pThis->nPatterns;
+	CHKmalloc(p->pat = malloc(len));
+	for(i = 0 ; i < len ; ++i)
+		p->pat[i] = pThis->bFoldCase ? tolower(pat[i]) : pat[i];
+	p->len = len;
+	p->id = id;
+	p->bAnchored = bAnchored;
+	p->nextInState = -1;
+	++pThis->nPatterns;
+	pThis->allIds |= ((uint64_t) 1) << id;
+finalize_it:
+	RETiRet;
+}
+
+
+/* build the DFA. After this, no more patterns can be added. */
+rsRetVal
+acmatchFinalize(acmatch_t *pThis)
+{
+	struct acmatch_pattern_s *p;
+	int *fail = NULL;
+	int *queue = NULL;
+	int maxStates;
+	int i, c;
+	size_t j;
+	int s, t, next;
+	int qHead, qTail;
+	DEFiRet;
+
+	assert(!pThis->bFinalized);
+	/* first map bytes to classes. Class 0 is for all bytes not used in
+	 * any pattern. When folding case, upper and lower case share a class,
+	 * so the input needs no conversion while matching.
+	 */
+	memset(pThis->classOf, 0, sizeof(pThis->classOf));
+	pThis->nClasses = 1;
+	maxStates = 1;
+	for(i = 0 ; i < pThis->nPatterns ; ++i) {
+		p = pThis->patterns + i;
+		maxStates += p->len;
+		for(j = 0 ; j < p->len ; ++j) {
+			c = p->pat[j];
+			if(pThis->classOf[c] == 0) {
+				pThis->classOf[c] = pThis->nClasses;
+				if(pThis->bFoldCase)
+					pThis->classOf[toupper(c)] = pThis->nClasses;
+				++pThis->nClasses;
+			}
+		}
+	}
+
+	CHKmalloc(pThis->delta = calloc(maxStates * pThis->nClasses, sizeof(uint32_t)));
+	CHKmalloc(pThis->outFirst = malloc(maxStates * sizeof(int)));
+	CHKmalloc(pThis->dictLink = malloc(maxStates * sizeof(int)));
+	CHKmalloc(pThis->matchHead = malloc(maxStates * sizeof(int)));
+	CHKmalloc(fail = calloc(maxStates, sizeof(int)));
+	CHKmalloc(queue = malloc(maxStates * sizeof(int)));
+	for(s = 0 ; s < maxStates ; ++s)
+		pThis->outFirst[s] = pThis->dictLink[s] = -1;
+
+	/* build the trie. As the root is never a target, a zero transition
+	 * means "no transition" at this stage.
+	 */
+	pThis->nStates = 1;
+	for(i = 0 ; i < pThis->nPatterns ; ++i) {
+		p = pThis->patterns + i;
+		s = 0;
+		for(j = 0 ; j < p->len ; ++j) {
+			c = pThis->classOf[p->pat[j]];
+			if(pThis->delta[s * pThis->nClasses + c] == 0)
+				pThis->delta[s * pThis->nClasses + c] = pThis->nStates++;
+			s = pThis->delta[s * pThis->nClasses + c];
+		}
+		p->nextInState = pThis->outFirst[s];
+		pThis->outFirst[s] = i;
+	}
+
+	/* compute failure links breadth first and turn the trie into a DFA */
+	qHead = qTail = 0;
+	for(c = 0 ; c < pThis->nClasses ; ++c) {
+		next = pThis->delta[c];
+		if(next != 0) {
+			fail[next] = 0;
+			queue[qTail++] = next;
+		}
+	}
+	while(qHead < qTail) {
+		s = queue[qHead++];
+		t = fail[s];
+		pThis->dictLink[s] = (pThis->outFirst[t] != -1) ? t : pThis->dictLink[t];
+		for(c = 0 ; c < pThis->nClasses ; ++c) {
+			next = pThis->delta[s * pThis->nClasses + c];
+			if(next != 0) {
+				fail[next] = pThis->delta[t * pThis->nClasses + c];
+				queue[qTail++] = next;
+			} else {
+				pThis->delta[s * pThis->nClasses + c] = pThis->delta[t * pThis->nClasses + c];
+			}
+		}
+	}
+	for(s = 0 ; s < pThis->nStates ; ++s)
+		pThis->matchHead[s] = (pThis->outFirst[s] != -1) ? s : pThis->dictLink[s];
+	pThis->bFinalized = 1;
+	DBGPRINTF("acmatch %p: %d patterns, %d states, %d byte classes\n",
+		  pThis, pThis->nPatterns, pThis->nStates, pThis->nClasses);
+
+finalize_it:
+	free(fail);
+	free(queue);
+	RETiRet;
+}
+
+
+/* scan buf and return the bitmask of the ids of all patterns found */
+uint64_t
+acmatchExec(const acmatch_t *const pThis, const uchar *const buf, const size_t len)
+{
+	const uint32_t *const delta = pThis->delta;
+	const int nClasses = pThis->nClasses;
+	const struct acmatch_pattern_s *p;
+	uint64_t found = 0;
+	uint32_t s = 0;
+	size_t i;
+	int t, k;
+
+	assert(pThis->bFinalized);
+	for(i = 0 ; i < len ; ++i) {
+		s = delta[s * nClasses + pThis->classOf[buf[i]]];
+		for(t = pThis->matchHead[s] ; t != -1 ; t = pThis->dictLink[t]) {
+			for(k = pThis->outFirst[t] ; k != -1 ; k = p->nextInState) {
+				p = pThis->patterns + k;
+				if(!p->bAnchored || p->len == i + 1)
+					found |= ((uint64_t) 1) << p->id;
+			}
+		}
+		if(found == pThis->allIds)
+			break; /* nothing more to find */
+	}
+	return found;
+}
+
+
+void
+acmatchDestruct(acmatch_t **ppThis)
+{
+	acmatch_t *pThis = *ppThis;
+	int i;
+
+	if(pThis == NULL)
+		return;
+	for(i = 0 ; i < pThis->nPatterns ; ++i)
+		free(pThis->patterns[i].pat);
+	free(pThis->patterns);
+	free(pThis->delta);
+	free(pThis->outFirst);
+	free(pThis->dictLink);
+	free(pThis->matchHead);
+	free(pThis);
+	*ppThis = NULL;
+}
@@ -0,0 +1,65 @@
+/* acmatch.h
+ * Multi-pattern string matching (Aho-Corasick).
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_ACMATCH_H
+#define INCLUDED_ACMATCH_H
+#include <stdint.h>
+
+#define ACMATCH_MAX_IDS 64	/* pattern ids must be in range 0..63 */
+
+struct acmatch_pattern_s {
+	uchar *pat;
+	size_t len;
+	unsigned id;
+	sbool bAnchored;	/* match only at the beginning of the string */
+	int nextInState;	/* next pattern ending in the same state, -1 if none */
+};
+
+/* A matcher is built by adding patterns and then finalizing it, which
+ * creates a DFA. Each pattern has an id, which need not be unique (a match
+ * of any of the patterns with the same id reports that id). To keep the
+ * DFA small, the input bytes are mapped to classes, with all bytes that
+ * do not occur in any pattern sharing a single class.
+ */
+struct acmatch_s {
+	sbool bFoldCase;	/* case-insensitive matching? */
+	sbool bFinalized;
+	int nPatterns;
+	int maxPatterns;
+	struct acmatch_pattern_s *patterns;
+	uint64_t allIds;	/* bitmask of all ids in use */
+	int nClasses;
+	int nStates;
+	uint8_t classOf[256];
+	uint32_t *delta;	/* transitions, nStates x nClasses */
+	int *matchHead;		/* first state with output on the suffix chain, -1 if none */
+	int *outFirst;		/* first pattern ending in this state, -1 if none */
+	int *dictLink;		/* next state with output on the suffix chain, -1 if none */
+};
+
+/* prototypes */
+rsRetVal acmatchConstruct(acmatch_t **ppThis, sbool bFoldCase);
+rsRetVal acmatchAddPattern(acmatch_t *pThis, const uchar *pat, size_t len, unsigned id, sbool bAnchored);
+rsRetVal acmatchFinalize(acmatch_t *pThis);
+uint64_t acmatchExec(const acmatch_t *pThis, const uchar *buf, size_t len);
+void acmatchDestruct(acmatch_t **ppThis);
+
+#endif /* #ifndef INCLUDED_ACMATCH_H */
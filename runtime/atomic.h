@@ -54,6 +54,8 @@
 #	define ATOMIC_CAS(data, oldVal, newVal, phlpmut) __sync_bool_compare_and_swap(data, (oldVal), (newVal))
 #	define ATOMIC_CAS_time_t(data, oldVal, newVal, phlpmut) __sync_bool_compare_and_swap(data, (oldVal), (newVal))
 #	define ATOMIC_CAS_VAL(data, oldVal, newVal, phlpmut) __sync_val_compare_and_swap(data, (oldVal), (newVal));
+#	define ATOMIC_ADD_AND_FETCH_int(data, val, phlpmut) __sync_add_and_fetch(data, val)
+#	define ATOMIC_MEMORY_BARRIER() __sync_synchronize()
 
 	/* functions below are not needed if we have atomics */
 #	define DEF_ATOMIC_HELPER_MUT(x)
@@ -181,6 +183,15 @@
 		(*data) -= val;
 		pthread_mutex_unlock(phlpmut);
 	}
+
+	static inline int
+	ATOMIC_ADD_AND_FETCH_int(int *data, int val, pthread_mutex_t *phlpmut) {
+		int r;
+		pthread_mutex_lock(phlpmut);
+		r = ((*data) += val);
+		pthread_mutex_unlock(phlpmut);
+		return(r);
+	}
 #	define DEF_ATOMIC_HELPER_MUT(x)  pthread_mutex_t x
 #	define INIT_ATOMIC_HELPER_MUT(x) pthread_mutex_init(&(x), NULL)
 #	define DESTROY_ATOMIC_HELPER_MUT(x) pthread_mutex_destroy(&(x))
@@ -194,8 +205,11 @@
  */
 #ifdef HAVE_ATOMIC_BUILTINS_64BIT
 #	define ATOMIC_INC_uint64(data, phlpmut) ((void) __sync_fetch_and_add(data, 1))
+#	define ATOMIC_ADD_uint64(data, val, phlpmut) ((void) __sync_fetch_and_add(data, val))
+#	define ATOMIC_SUB_uint64(data, val, phlpmut) ((void) __sync_fetch_and_sub(data, val))
 #	define ATOMIC_DEC_unit64(data, phlpmut) ((void) __sync_sub_and_fetch(data, 1))
 #	define ATOMIC_INC_AND_FETCH_uint64(data, phlpmut) __sync_fetch_and_add(data, 1)
+#	define ATOMIC_CAS_uint64(data, oldVal, newVal, phlpmut) __sync_bool_compare_and_swap(data, (oldVal), (newVal))
 
 #	define DEF_ATOMIC_HELPER_MUT64(x)
 #	define INIT_ATOMIC_HELPER_MUT64(x)
@@ -211,6 +225,16 @@
 		--(*(data)); \
 		pthread_mutex_unlock(phlpmut); \
 	}
+#	define ATOMIC_ADD_uint64(data, val, phlpmut)  { \
+		pthread_mutex_lock(phlpmut); \
+		*(data) += (val); \
+		pthread_mutex_unlock(phlpmut); \
+	}
+#	define ATOMIC_SUB_uint64(data, val, phlpmut)  { \
+		pthread_mutex_lock(phlpmut); \
+		*(data) -= (val); \
+		pthread_mutex_unlock(phlpmut); \
+	}
 
 	static inline unsigned
 	ATOMIC_INC_AND_FETCH_uint64(uint64 *data, pthread_mutex_t *phlpmut) {
@@ -221,6 +245,20 @@
 		return(val);
 	}
 
+	static inline int
+	ATOMIC_CAS_uint64(uint64 *data, uint64 oldVal, uint64 newVal, pthread_mutex_t *phlpmut) {
+		int bSuccess;
+		pthread_mutex_lock(phlpmut);
+		if(*data == oldVal) {
+			*data = newVal;
+			bSuccess = 1;
+		} else {
+			bSuccess = 0;
+		}
+		pthread_mutex_unlock(phlpmut);
+		return(bSuccess);
+	}
+
 #	define DEF_ATOMIC_HELPER_MUT64(x)  pthread_mutex_t x
 #	define INIT_ATOMIC_HELPER_MUT64(x) pthread_mutex_init(&(x), NULL)
 #	define DESTROY_ATOMIC_HELPER_MUT64(x) pthread_mutex_destroy(&(x))
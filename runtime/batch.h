@@ -66,6 +66,7 @@ struct batch_s {
 	int maxElem;		/* maximum number of elements that this batch supports */
 	int nElem;		/* actual number of element in this entry */
 	int nElemDeq;		/* actual number of elements dequeued (and thus to be deleted) - see comment above! */
+	int64 nBytesDeq;	/* estimated memory size of the dequeued elements (for queue.maxmemory) */
 	qDeqID	deqID;		/* ID of dequeue operation that generated this batch */
 	batch_obj_t *pElem;	/* batch elements */
 	batch_state_t *eltState;/* state (array!) for individual objects.
@@ -85,6 +86,43 @@ batchNumMsgs(const batch_t * const pBatch) {
 }
 
 
+/* software pipelining for loops over a batch. Messages are usually written
+ * by an input thread on another core, so the first access to each of them
+ * is a cache miss. Call batchPrefetchStart() before the loop and
+ * batchPrefetch() for each element i: it prefetches the msg object of
+ * element i + 2*BATCH_PREFETCH_DIST and the raw message of element
+ * i + BATCH_PREFETCH_DIST, whose msg object is in the cache by then.
+ */
+#define BATCH_PREFETCH_DIST 4
+#if defined(__GNUC__)
+#	define BATCH_PREFETCH(p) __builtin_prefetch(p)
+#else
+#	define BATCH_PREFETCH(p)
+#endif
+
+/* the hot part of msg_t spans two cache lines */
+static inline void
+batchPrefetchMsg(const msg_t * const pMsg) {
+	BATCH_PREFETCH(pMsg);
+	BATCH_PREFETCH((const char*) pMsg + 64);
+}
+
+static inline void
+batchPrefetchStart(const batch_t * const pBatch) {
+	int i;
+	for(i = 0 ; i < 2 * BATCH_PREFETCH_DIST && i < pBatch->nElem ; ++i)
+		batchPrefetchMsg(pBatch->pElem[i].pMsg);
+}
+
+static inline void
+batchPrefetch(const batch_t * const pBatch, const int i) {
+	if(i + 2 * BATCH_PREFETCH_DIST < pBatch->nElem)
+		batchPrefetchMsg(pBatch->pElem[i + 2 * BATCH_PREFETCH_DIST].pMsg);
+	if(i + BATCH_PREFETCH_DIST < pBatch->nElem)
+		BATCH_PREFETCH(pBatch->pElem[i + BATCH_PREFETCH_DIST].pMsg->pszRawMsg);
+}
+
+
 /* set the status of the i-th batch element. Note that once the status is
  * DISC, it will never be reset. So this function can NOT be used to initialize
  * the state table. -- rgerhards, 2010-06-10
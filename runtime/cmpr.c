@@ -0,0 +1,712 @@
+/* The cmpr object.
+ *
+ * This is a generic compression layer. It hides the individual
+ * compression libraries behind a common buffer-to-buffer interface, so
+ * that streams, network senders and receivers as well as disk queues can
+ * use any of the supported algorithms. zstd and lz4 are only available if
+ * rsyslog was build with the respective libraries.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <strings.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#include <lz4frame.h>
+#endif
+
+#include "rsyslog.h"
+#include "module-template.h"
+#include "obj.h"
+#include "errmsg.h"
+#include "cmpr.h"
+
+MODULE_TYPE_LIB
+MODULE_TYPE_NOKEEP
+
+/* static data */
+DEFobjStaticHelpers
+DEFobjCurrIf(errmsg)
+
+#ifdef HAVE_LZ4
+#define LZ4_CHUNK (64 * 1024)	/* max input we pass to LZ4F_compressUpdate() at once */
+#endif
+
+struct cmprCtx_s {
+	int algo;
+	sbool bDecompress;
+	sbool bEnded;		/* a frame has just been finished, no data since then */
+	z_stream zstrm;
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx *zstdC;
+	ZSTD_DCtx *zstdD;
+#endif
+#ifdef HAVE_LZ4
+	LZ4F_cctx *lz4C;
+	LZ4F_dctx *lz4D;
+	LZ4F_preferences_t lz4Prefs;
+	sbool bLz4FrameOpen;	/* frame header written, frame not yet ended */
+	uchar *pLz4Buf;		/* compressed data not yet handed to the caller */
+	size_t lenLz4BufAlloc;
+	size_t lenLz4Buf;
+	size_t iLz4BufRd;
+#endif
+};
+
+static struct {
+	const char *pszName;
+	int algo;
+} algoNames[] = {
+	{ "gzip", CMPR_ALGO_GZIP },
+	{ "zlib", CMPR_ALGO_ZLIB },
+	{ "zstd", CMPR_ALGO_ZSTD },
+	{ "lz4",  CMPR_ALGO_LZ4 },
+	{ NULL, CMPR_ALGO_NONE }
+};
+
+
+/* ------------------------------ methods ------------------------------ */
+
+static rsRetVal
+GetAlgo(const uchar *pszName, int *pAlgo)
+{
+	int i;
+	DEFiRet;
+
+	for(i = 0 ; algoNames[i].pszName != NULL ; ++i) {
+		if(!strcasecmp((char*)pszName, algoNames[i].pszName)) {
+			*pAlgo = algoNames[i].algo;
+			FINALIZE;
+		}
+	}
+	ABORT_FINALIZE(RS_RET_CMPR_ALGO_UNSUPPORTED);
+
+finalize_it:
+	RETiRet;
+}
+
+
+static const char *
+GetAlgoName(int algo)
+{
+	int i;
+
+	for(i = 0 ; algoNames[i].pszName != NULL ; ++i) {
+		if(algoNames[i].algo == algo)
+			return algoNames[i].pszName;
+	}
+	return "none";
+}
+
+
+static int
+IsSupported(int algo)
+{
+	switch(algo) {
+	case CMPR_ALGO_GZIP:
+	case CMPR_ALGO_ZLIB:
+		return 1;
+#ifdef HAVE_ZSTD
+	case CMPR_ALGO_ZSTD:
+		return 1;
+#endif
+#ifdef HAVE_LZ4
+	case CMPR_ALGO_LZ4:
+		return 1;
+#endif
+	default:
+		return 0;
+	}
+}
+
+
+#ifdef HAVE_ZSTD
+/* read a (zstd) dictionary file into memory */
+static rsRetVal
+readDictFile(const uchar *pszDictFile, uchar **ppDict, size_t *pLenDict)
+{
+	struct stat statBuf;
+	uchar *pDict = NULL;
+	ssize_t lenRead;
+	int fd = -1;
+	DEFiRet;
+
+	if((fd = open((char*)pszDictFile, O_RDONLY | O_CLOEXEC)) == -1 || fstat(fd, &statBuf) == -1) {
+		errmsg.LogError(errno, RS_RET_FILE_NOT_FOUND, "compression dictionary '%s' "
+				"could not be opened", pszDictFile);
+		ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
+	}
+	CHKmalloc(pDict = MALLOC(statBuf.st_size + 1));
+	lenRead = read(fd, pDict, statBuf.st_size);
+	if(lenRead != statBuf.st_size) {
+		errmsg.LogError(errno, RS_RET_READ_ERR, "error reading compression dictionary '%s'",
+				pszDictFile);
+		ABORT_FINALIZE(RS_RET_READ_ERR);
+	}
+	*ppDict = pDict;
+	*pLenDict = statBuf.st_size;
+	pDict = NULL;
+
+finalize_it:
+	if(fd != -1)
+		close(fd);
+	free(pDict);
+	RETiRet;
+}
+#endif
+
+
+static rsRetVal
+Destruct(cmprCtx_t **ppThis)
+{
+	cmprCtx_t *pThis = *ppThis;
+
+	if(pThis == NULL)
+		return RS_RET_OK;
+	switch(pThis->algo) {
+	case CMPR_ALGO_GZIP:
+	case CMPR_ALGO_ZLIB:
+		if(pThis->bDecompress)
+			inflateEnd(&pThis->zstrm);
+		else
+			deflateEnd(&pThis->zstrm);
+		break;
+#ifdef HAVE_ZSTD
+	case CMPR_ALGO_ZSTD:
+		ZSTD_freeCCtx(pThis->zstdC);
+		ZSTD_freeDCtx(pThis->zstdD);
+		break;
+#endif
+#ifdef HAVE_LZ4
+	case CMPR_ALGO_LZ4:
+		if(pThis->lz4C != NULL)
+			LZ4F_freeCompressionContext(pThis->lz4C);
+		if(pThis->lz4D != NULL)
+			LZ4F_freeDecompressionContext(pThis->lz4D);
+		free(pThis->pLz4Buf);
+		break;
+#endif
+	default:
+		break;
+	}
+	free(pThis);
+	*ppThis = NULL;
+	return RS_RET_OK;
+}
+
+
+/* construct a compression or decompression context. Level -1 means the
+ * default level of the algorithm. Dictionaries are only supported by zstd
+ * (and must, of course, be identical on both sides).
+ */
+static rsRetVal
+Construct(cmprCtx_t **ppThis, int algo, sbool bDecompress, int level, const uchar *pszDictFile)
+{
+	cmprCtx_t *pThis = NULL;
+	int zRet;
+#	ifdef HAVE_ZSTD
+	uchar *pDict = NULL;
+	size_t lenDict = 0;
+	size_t zstdRet;
+#	endif
+	DEFiRet;
+
+	if(!IsSupported(algo)) {
+		errmsg.LogError(0, RS_RET_CMPR_ALGO_UNSUPPORTED, "compression algorithm '%s' is not "
+				"supported by this build of rsyslog", GetAlgoName(algo));
+		ABORT_FINALIZE(RS_RET_CMPR_ALGO_UNSUPPORTED);
+	}
+	if(pszDictFile != NULL && algo != CMPR_ALGO_ZSTD) {
+		errmsg.LogError(0, RS_RET_CMPR_ALGO_UNSUPPORTED, "compression dictionaries are only "
+				"supported with zstd, not with '%s'", GetAlgoName(algo));
+		ABORT_FINALIZE(RS_RET_CMPR_ALGO_UNSUPPORTED);
+	}
+
+	CHKmalloc(pThis = calloc(1, sizeof(cmprCtx_t)));
+	pThis->algo = algo;
+	pThis->bDecompress = bDecompress;
+	pThis->bEnded = 1; /* no data yet */
+
+	switch(algo) {
+	case CMPR_ALGO_GZIP:
+	case CMPR_ALGO_ZLIB:
+		pThis->zstrm.zalloc = Z_NULL;
+		pThis->zstrm.zfree = Z_NULL;
+		pThis->zstrm.opaque = Z_NULL;
+		if(bDecompress) {
+			/* 15+32: auto-detect gzip and zlib format */
+			zRet = inflateInit2(&pThis->zstrm, 15 + 32);
+		} else {
+			zRet = deflateInit2(&pThis->zstrm, (level < 0) ? Z_DEFAULT_COMPRESSION : level,
+					    Z_DEFLATED, (algo == CMPR_ALGO_GZIP) ? 31 : 15, 9,
+					    Z_DEFAULT_STRATEGY);
+		}
+		if(zRet != Z_OK) {
+			DBGPRINTF("cmpr: error %d returned from zlib init\n", zRet);
+			pThis->algo = CMPR_ALGO_NONE; /* nothing to clean up */
+			ABORT_FINALIZE(RS_RET_ZLIB_ERR);
+		}
+		break;
+#ifdef HAVE_ZSTD
+	case CMPR_ALGO_ZSTD:
+		if(pszDictFile != NULL)
+			CHKiRet(readDictFile(pszDictFile, &pDict, &lenDict));
+		if(bDecompress) {
+			CHKmalloc(pThis->zstdD = ZSTD_createDCtx());
+			if(pDict != NULL) {
+				zstdRet = ZSTD_DCtx_loadDictionary(pThis->zstdD, pDict, lenDict);
+				if(ZSTD_isError(zstdRet)) {
+					errmsg.LogError(0, RS_RET_CMPR_ERR, "zstd: error loading dictionary "
+							"'%s': %s", pszDictFile, ZSTD_getErrorName(zstdRet));
+					ABORT_FINALIZE(RS_RET_CMPR_ERR);
+				}
+			}
+		} else {
+			CHKmalloc(pThis->zstdC = ZSTD_createCCtx());
+			if(level >= 0)
+				ZSTD_CCtx_setParameter(pThis->zstdC, ZSTD_c_compressionLevel, level);
+			if(pDict != NULL) {
+				zstdRet = ZSTD_CCtx_loadDictionary(pThis->zstdC, pDict, lenDict);
+				if(ZSTD_isError(zstdRet)) {
+					errmsg.LogError(0, RS_RET_CMPR_ERR, "zstd: error loading dictionary "
+							"'%s': %s", pszDictFile, ZSTD_getErrorName(zstdRet));
+					ABORT_FINALIZE(RS_RET_CMPR_ERR);
+				}
+			}
+		}
+		break;
+#endif
+#ifdef HAVE_LZ4
+	case CMPR_ALGO_LZ4:
+		if(bDecompress) {
+			if(LZ4F_isError(LZ4F_createDecompressionContext(&pThis->lz4D, LZ4F_VERSION)))
+				ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		} else {
+			if(LZ4F_isError(LZ4F_createCompressionContext(&pThis->lz4C, LZ4F_VERSION)))
+				ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+			memset(&pThis->lz4Prefs, 0, sizeof(pThis->lz4Prefs));
+			pThis->lz4Prefs.compressionLevel = (level < 0) ? 0 : level;
+			pThis->lenLz4BufAlloc = LZ4F_compressBound(LZ4_CHUNK, &pThis->lz4Prefs)
+						+ LZ4F_HEADER_SIZE_MAX;
+			CHKmalloc(pThis->pLz4Buf = MALLOC(pThis->lenLz4BufAlloc));
+		}
+		break;
+#endif
+	default:
+		break;
+	}
+
+	*ppThis = pThis;
+	pThis = NULL;
+
+finalize_it:
+#	ifdef HAVE_ZSTD
+	free(pDict); /* zstd keeps its own copy */
+#	endif
+	if(pThis != NULL)
+		Destruct(&pThis);
+	RETiRet;
+}
+
+
+static rsRetVal
+processZlib(cmprCtx_t *pThis, const uchar **ppIn, size_t *pLenIn, uchar **ppOut, size_t *pLenOut, int op)
+{
+	int zRet;
+	DEFiRet;
+
+	pThis->zstrm.next_in = (Bytef*) *ppIn;
+	pThis->zstrm.avail_in = *pLenIn;
+	pThis->zstrm.next_out = *ppOut;
+	pThis->zstrm.avail_out = *pLenOut;
+	if(pThis->bDecompress) {
+		do {
+			zRet = inflate(&pThis->zstrm, Z_SYNC_FLUSH);
+			if(zRet == Z_STREAM_END) {
+				/* gzip files may consist of multiple members */
+				inflateReset(&pThis->zstrm);
+			} else if(zRet != Z_OK && zRet != Z_BUF_ERROR) {
+				DBGPRINTF("cmpr: error %d returned from zlib/inflate()\n", zRet);
+				ABORT_FINALIZE(RS_RET_ZLIB_ERR);
+			}
+		} while(zRet == Z_STREAM_END && pThis->zstrm.avail_in > 0 && pThis->zstrm.avail_out > 0);
+	} else {
+		zRet = deflate(&pThis->zstrm, (op == CMPR_OP_FINISH) ? Z_FINISH
+					      : (op == CMPR_OP_FLUSH) ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+		if(zRet == Z_STREAM_END) {
+			deflateReset(&pThis->zstrm); /* new data goes into a new member */
+			pThis->bEnded = 1;
+		} else if(zRet != Z_OK && zRet != Z_BUF_ERROR) {
+			DBGPRINTF("cmpr: error %d returned from zlib/deflate()\n", zRet);
+			ABORT_FINALIZE(RS_RET_ZLIB_ERR);
+		}
+	}
+
+finalize_it:
+	*ppIn = (const uchar*) pThis->zstrm.next_in;
+	*pLenIn = pThis->zstrm.avail_in;
+	*ppOut = pThis->zstrm.next_out;
+	*pLenOut = pThis->zstrm.avail_out;
+	RETiRet;
+}
+
+
+#ifdef HAVE_ZSTD
+static rsRetVal
+processZstd(cmprCtx_t *pThis, const uchar **ppIn, size_t *pLenIn, uchar **ppOut, size_t *pLenOut, int op)
+{
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	ZSTD_EndDirective mode;
+	size_t zstdRet;
+	DEFiRet;
+
+	in.src = *ppIn;
+	in.size = *pLenIn;
+	in.pos = 0;
+	out.dst = *ppOut;
+	out.size = *pLenOut;
+	out.pos = 0;
+	if(pThis->bDecompress) {
+		do {
+			zstdRet = ZSTD_decompressStream(pThis->zstdD, &out, &in);
+			if(ZSTD_isError(zstdRet)) {
+				DBGPRINTF("cmpr: zstd decompression error: %s\n", ZSTD_getErrorName(zstdRet));
+				ABORT_FINALIZE(RS_RET_CMPR_ERR);
+			}
+		} while(in.pos < in.size && out.pos < out.size);
+	} else {
+		mode = (op == CMPR_OP_FINISH) ? ZSTD_e_end
+		     : (op == CMPR_OP_FLUSH) ? ZSTD_e_flush : ZSTD_e_continue;
+		do {
+			zstdRet = ZSTD_compressStream2(pThis->zstdC, &out, &in, mode);
+			if(ZSTD_isError(zstdRet)) {
+				DBGPRINTF("cmpr: zstd compression error: %s\n", ZSTD_getErrorName(zstdRet));
+				ABORT_FINALIZE(RS_RET_CMPR_ERR);
+			}
+		} while(out.pos < out.size
+			&& (in.pos < in.size || (mode != ZSTD_e_continue && zstdRet != 0)));
+		if(mode == ZSTD_e_end && zstdRet == 0)
+			pThis->bEnded = 1;
+	}
+
+finalize_it:
+	*ppIn += in.pos;
+	*pLenIn -= in.pos;
+	*ppOut += out.pos;
+	*pLenOut -= out.pos;
+	RETiRet;
+}
+#endif
+
+
+#ifdef HAVE_LZ4
+/* hand out as much of the staged compressed data as fits */
+static void
+lz4Drain(cmprCtx_t *pThis, uchar **ppOut, size_t *pLenOut)
+{
+	size_t lenCopy;
+
+	lenCopy = pThis->lenLz4Buf - pThis->iLz4BufRd;
+	if(lenCopy > *pLenOut)
+		lenCopy = *pLenOut;
+	memcpy(*ppOut, pThis->pLz4Buf + pThis->iLz4BufRd, lenCopy);
+	pThis->iLz4BufRd += lenCopy;
+	*ppOut += lenCopy;
+	*pLenOut -= lenCopy;
+	if(pThis->iLz4BufRd == pThis->lenLz4Buf)
+		pThis->lenLz4Buf = pThis->iLz4BufRd = 0;
+}
+
+
+/* The lz4 frame API needs an output buffer that can hold the worst case
+ * result of each call. So we compress into our own staging buffer and
+ * copy from there into whatever the caller provides.
+ */
+static rsRetVal
+processLz4(cmprCtx_t *pThis, const uchar **ppIn, size_t *pLenIn, uchar **ppOut, size_t *pLenOut, int op)
+{
+	size_t lenIn;
+	size_t lenOut;
+	size_t lz4Ret;
+	sbool bOpDone;
+	DEFiRet;
+
+	if(pThis->bDecompress) {
+		while(*pLenOut > 0) {
+			lenIn = *pLenIn;
+			lenOut = *pLenOut;
+			lz4Ret = LZ4F_decompress(pThis->lz4D, *ppOut, &lenOut, *ppIn, &lenIn, NULL);
+			if(LZ4F_isError(lz4Ret)) {
+				DBGPRINTF("cmpr: lz4 decompression error: %s\n", LZ4F_getErrorName(lz4Ret));
+				ABORT_FINALIZE(RS_RET_CMPR_ERR);
+			}
+			*ppIn += lenIn;
+			*pLenIn -= lenIn;
+			*ppOut += lenOut;
+			*pLenOut -= lenOut;
+			if(lenIn == 0 && lenOut == 0)
+				break; /* need more input */
+		}
+		FINALIZE;
+	}
+
+	bOpDone = (op == CMPR_OP_RUN);
+	while(1) {
+		lz4Drain(pThis, ppOut, pLenOut);
+		if(pThis->lenLz4Buf > 0)
+			break; /* caller's buffer is full */
+		if(*pLenIn > 0) {
+			if(!pThis->bLz4FrameOpen) {
+				lz4Ret = LZ4F_compressBegin(pThis->lz4C, pThis->pLz4Buf, pThis->lenLz4BufAlloc,
+							    &pThis->lz4Prefs);
+				pThis->bLz4FrameOpen = 1;
+			} else {
+				lenIn = (*pLenIn > LZ4_CHUNK) ? LZ4_CHUNK : *pLenIn;
+				lz4Ret = LZ4F_compressUpdate(pThis->lz4C, pThis->pLz4Buf, pThis->lenLz4BufAlloc,
+							     *ppIn, lenIn, NULL);
+				if(!LZ4F_isError(lz4Ret)) {
+					*ppIn += lenIn;
+					*pLenIn -= lenIn;
+				}
+			}
+		} else if(!bOpDone) {
+			lz4Ret = 0;
+			if(pThis->bLz4FrameOpen) {
+				if(op == CMPR_OP_FINISH) {
+					lz4Ret = LZ4F_compressEnd(pThis->lz4C, pThis->pLz4Buf,
+								  pThis->lenLz4BufAlloc, NULL);
+					pThis->bLz4FrameOpen = 0;
+				} else {
+					lz4Ret = LZ4F_flush(pThis->lz4C, pThis->pLz4Buf,
+							    pThis->lenLz4BufAlloc, NULL);
+				}
+			}
+			bOpDone = 1;
+		} else {
+			break;
+		}
+		if(LZ4F_isError(lz4Ret)) {
+			DBGPRINTF("cmpr: lz4 compression error: %s\n", LZ4F_getErrorName(lz4Ret));
+			ABORT_FINALIZE(RS_RET_CMPR_ERR);
+		}
+		pThis->lenLz4Buf = lz4Ret;
+		pThis->iLz4BufRd = 0;
+	}
+
+finalize_it:
+	RETiRet;
+}
+#endif
+
+
+static rsRetVal
+Process(cmprCtx_t *pThis, const uchar **ppIn, size_t *pLenIn, uchar **ppOut, size_t *pLenOut, int op)
+{
+	DEFiRet;
+
+	assert(pThis != NULL);
+	if(*pLenIn > 0) {
+		pThis->bEnded = 0;
+	} else if(op != CMPR_OP_RUN && pThis->bEnded && !pThis->bDecompress) {
+		FINALIZE; /* nothing to flush, and we do not want to emit an empty frame */
+	}
+
+	switch(pThis->algo) {
+	case CMPR_ALGO_GZIP:
+	case CMPR_ALGO_ZLIB:
+		CHKiRet(processZlib(pThis, ppIn, pLenIn, ppOut, pLenOut, op));
+		break;
+#ifdef HAVE_ZSTD
+	case CMPR_ALGO_ZSTD:
+		CHKiRet(processZstd(pThis, ppIn, pLenIn, ppOut, pLenOut, op));
+		break;
+#endif
+#ifdef HAVE_LZ4
+	case CMPR_ALGO_LZ4:
+		CHKiRet(processLz4(pThis, ppIn, pLenIn, ppOut, pLenOut, op));
+		break;
+#endif
+	default:
+		ABORT_FINALIZE(RS_RET_CMPR_ALGO_UNSUPPORTED);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* compress a single buffer, see cmpr.h */
+static rsRetVal
+CompressBuf(int algo, int level, const uchar *pIn, size_t lenIn, uchar *pOut, size_t *pLenOut)
+{
+	uLongf lenZ;
+#ifdef HAVE_ZSTD
+	size_t r;
+#endif
+#ifdef HAVE_LZ4
+	int lenLz4;
+#endif
+	DEFiRet;
+
+	switch(algo) {
+	case CMPR_ALGO_ZLIB:
+		lenZ = *pLenOut;
+		if(compress2(pOut, &lenZ, pIn, lenIn, level == -1 ? Z_DEFAULT_COMPRESSION : level) != Z_OK)
+			ABORT_FINALIZE(RS_RET_CMPR_ERR);
+		*pLenOut = lenZ;
+		break;
+#ifdef HAVE_ZSTD
+	case CMPR_ALGO_ZSTD:
+		r = ZSTD_compress(pOut, *pLenOut, pIn, lenIn, level == -1 ? 1 : level);
+		if(ZSTD_isError(r))
+			ABORT_FINALIZE(RS_RET_CMPR_ERR);
+		*pLenOut = r;
+		break;
+#endif
+#ifdef HAVE_LZ4
+	case CMPR_ALGO_LZ4:
+		/* the level is the acceleration here, 1 is the default */
+		if(lenIn > LZ4_MAX_INPUT_SIZE)
+			ABORT_FINALIZE(RS_RET_CMPR_ERR);
+		lenLz4 = LZ4_compress_fast((const char*) pIn, (char*) pOut, (int) lenIn,
+					   (*pLenOut > INT_MAX) ? INT_MAX : (int) *pLenOut,
+					   level < 1 ? 1 : level);
+		if(lenLz4 <= 0)
+			ABORT_FINALIZE(RS_RET_CMPR_ERR);
+		*pLenOut = lenLz4;
+		break;
+#endif
+	default:
+		ABORT_FINALIZE(RS_RET_CMPR_ALGO_UNSUPPORTED);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* decompress a single buffer, see cmpr.h */
+static rsRetVal
+DecompressBuf(int algo, const uchar *pIn, size_t lenIn, uchar *pOut, size_t lenOut)
+{
+	uLongf lenZ;
+	DEFiRet;
+
+	switch(algo) {
+	case CMPR_ALGO_ZLIB:
+		lenZ = lenOut;
+		if(uncompress(pOut, &lenZ, pIn, lenIn) != Z_OK || lenZ != lenOut)
+			ABORT_FINALIZE(RS_RET_CMPR_ERR);
+		break;
+#ifdef HAVE_ZSTD
+	case CMPR_ALGO_ZSTD:
+		if(ZSTD_decompress(pOut, lenOut, pIn, lenIn) != lenOut)
+			ABORT_FINALIZE(RS_RET_CMPR_ERR);
+		break;
+#endif
+#ifdef HAVE_LZ4
+	case CMPR_ALGO_LZ4:
+		if(lenIn > INT_MAX || lenOut > INT_MAX
+		   || LZ4_decompress_safe((const char*) pIn, (char*) pOut, (int) lenIn, (int) lenOut) != (int) lenOut)
+			ABORT_FINALIZE(RS_RET_CMPR_ERR);
+		break;
+#endif
+	default:
+		ABORT_FINALIZE(RS_RET_CMPR_ALGO_UNSUPPORTED);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* queryInterface function
+ */
+BEGINobjQueryInterface(cmpr)
+CODESTARTobjQueryInterface(cmpr)
+	if(pIf->ifVersion != cmprCURR_IF_VERSION) { /* check for current version, increment on each change */
+		ABORT_FINALIZE(RS_RET_INTERFACE_NOT_SUPPORTED);
+	}
+
+	pIf->GetAlgo = GetAlgo;
+	pIf->GetAlgoName = GetAlgoName;
+	pIf->IsSupported = IsSupported;
+	pIf->Construct = Construct;
+	pIf->Destruct = Destruct;
+	pIf->Process = Process;
+	pIf->CompressBuf = CompressBuf;
+	pIf->DecompressBuf = DecompressBuf;
+finalize_it:
+ENDobjQueryInterface(cmpr)
+
+
+/* Initialize the cmpr class. Must be called as the very first method
+ * before anything else is called inside this class.
+ */
+BEGINAbstractObjClassInit(cmpr, 1, OBJ_IS_LOADABLE_MODULE) /* class, version */
+	/* request objects we use */
+	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+ENDObjClassInit(cmpr)
+
+
+/* Exit the cmpr class.
+ */
+BEGINObjClassExit(cmpr, OBJ_IS_LOADABLE_MODULE) /* class, version */
+CODESTARTObjClassExit(cmpr)
+	objRelease(errmsg, CORE_COMPONENT);
+ENDObjClassExit(cmpr)
+
+
+/* --------------- here now comes the plumbing that makes as a library module --------------- */
+
+
+BEGINmodExit
+CODESTARTmodExit
+	cmprClassExit();
+ENDmodExit
+
+
+BEGINqueryEtryPt
+CODESTARTqueryEtryPt
+CODEqueryEtryPt_STD_LIB_QUERIES
+ENDqueryEtryPt
+
+
+BEGINmodInit()
+CODESTARTmodInit
+	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
+
+	CHKiRet(cmprClassInit(pModInfo));
+ENDmodInit
+/* vi:set ai:
+ */
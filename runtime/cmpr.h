@@ -0,0 +1,79 @@
+/* The cmpr object. It provides a generic, buffer-to-buffer interface to
+ * the compression algorithms supported by rsyslog (deflate in gzip and
+ * zlib format, zstd and lz4), so that users need not know about the
+ * individual libraries. Like zlibw, it also enables the rsyslog core to
+ * be build without any compression libraries.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_CMPR_H
+#define INCLUDED_CMPR_H
+
+/* compression algorithms */
+#define CMPR_ALGO_NONE	0
+#define CMPR_ALGO_GZIP	1	/* deflate, gzip format (files) */
+#define CMPR_ALGO_ZLIB	2	/* deflate, zlib format (network streams) */
+#define CMPR_ALGO_ZSTD	3
+#define CMPR_ALGO_LZ4	4
+
+/* operations for Process() */
+#define CMPR_OP_RUN	0	/* process data, the algorithm may keep some of it buffered */
+#define CMPR_OP_FLUSH	1	/* everything passed in so far must be decodable by the receiver */
+#define CMPR_OP_FINISH	2	/* end the current frame (gzip member); compression only */
+
+typedef struct cmprCtx_s cmprCtx_t;
+
+/* Process() consumes input from *ppIn and writes output to *ppOut. Both
+ * pointers are advanced and the lengths decremented by what was consumed
+ * and produced. If the output buffer was filled up completely
+ * (*pLenOut == 0 on return), there may be more output pending and Process()
+ * must be called again with the same operation and a fresh output buffer.
+ * Otherwise, all input has been processed.
+ * CompressBuf() and DecompressBuf() do not need a context. They work on
+ * raw blocks without any framing (no gzip), so the caller must keep the
+ * uncompressed length: DecompressBuf() fails unless it produces exactly
+ * lenOut octets. CompressBuf() is given the output buffer size in
+ * *pLenOut and fails with RS_RET_CMPR_ERR if the result does not fit.
+ */
+BEGINinterface(cmpr) /* name must also be changed in ENDinterface macro! */
+	rsRetVal (*GetAlgo)(const uchar *pszName, int *pAlgo);
+	const char* (*GetAlgoName)(int algo);
+	int (*IsSupported)(int algo);
+	rsRetVal (*Construct)(cmprCtx_t **ppThis, int algo, sbool bDecompress, int level, const uchar *pszDictFile);
+	rsRetVal (*Destruct)(cmprCtx_t **ppThis);
+	rsRetVal (*Process)(cmprCtx_t *pThis, const uchar **ppIn, size_t *pLenIn,
+			    uchar **ppOut, size_t *pLenOut, int op);
+	/* v2: one-shot compression of small, self-contained buffers */
+	rsRetVal (*CompressBuf)(int algo, int level, const uchar *pIn, size_t lenIn,
+				uchar *pOut, size_t *pLenOut);
+	rsRetVal (*DecompressBuf)(int algo, const uchar *pIn, size_t lenIn, uchar *pOut, size_t lenOut);
+ENDinterface(cmpr)
+#define cmprCURR_IF_VERSION 2 /* increment whenever you change the interface structure! */
+/* interface changes:
+ * v2 - CompressBuf(), DecompressBuf()
+ */
+
+
+/* prototypes */
+PROTOTYPEObj(cmpr);
+
+/* the name of our library binary */
+#define LM_CMPR_FILENAME "lmcmpr"
+
+#endif /* #ifndef INCLUDED_CMPR_H */
@@ -27,9 +27,11 @@
 #include "config.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
 #include <ctype.h>
 #include <assert.h>
+#include <pthread.h>
 #ifdef HAVE_SYS_TIME_H
 #	include <sys/time.h>
 #endif
@@ -41,6 +43,7 @@
 #include "srUtils.h"
 #include "stringbuf.h"
 #include "errmsg.h"
+#include "glbl.h"
 
 /* static data */
 DEFobjStaticHelpers
@@ -49,6 +52,52 @@ DEFobjCurrIf(errmsg)
 /* the following table of ten powers saves us some computation */
 static const int tenPowers[6] = { 1, 10, 100, 1000, 10000, 100000 };
 
+/* incremented whenever the timezone may have changed (on HUP). Updated by
+ * the main thread only, readers can live with seeing it a bit late.
+ */
+static volatile unsigned tzGeneration = 0;
+
+/* Per-thread memo for timestamp conversions.
+ * The RFC3164 part holds the last timestamp parsed by the fast path. In a
+ * burst, many messages carry the same timestamp, so if the text is the
+ * same as last time, we take the decoded values from the memo and save
+ * the month name lookup and all the checks. This is not done for RFC3339:
+ * there, the memo lookup costs more than the SWAR decode.
+ * The local time part holds the broken-down local time of the start of
+ * the current local hour, so that timeval2syslogTime() needs to call
+ * localtime_r() at most twice per hour (and after a timezone change).
+ */
+typedef struct tsMemo_s {
+	uchar prefix3164[15];	/* "Mmm dd HH:MM:SS" */
+	sbool bValid3164;
+	struct syslogTime time3164;
+	sbool bValidLocal;
+	unsigned tzGenLocal;	/* tzGeneration the local time part was computed for */
+	time_t hourStart;	/* UNIX time of the start of the local hour */
+	time_t validUntil;	/* end of the local hour or of the UTC hour, if earlier */
+	struct syslogTime timeLocal; /* minute, second and secfrac not used */
+} tsMemo_t;
+static pthread_key_t keyTSMemo;
+static sbool bTSMemoActive = 0;
+
+static inline tsMemo_t *
+getTSMemo(void)
+{
+	tsMemo_t *pMemo;
+
+	if(!bTSMemoActive)
+		return NULL;
+	if((pMemo = (tsMemo_t*) pthread_getspecific(keyTSMemo)) == NULL) {
+		if((pMemo = calloc(1, sizeof(tsMemo_t))) == NULL)
+			return NULL;
+		if(pthread_setspecific(keyTSMemo, pMemo) != 0) {
+			free(pMemo);
+			return NULL;
+		}
+	}
+	return pMemo;
+}
+
 /* ------------------------------ methods ------------------------------ */
 
 
@@ -62,8 +111,25 @@ timeval2syslogTime(struct timeval *tp, struct syslogTime *t)
 	struct tm tmBuf;
 	long lBias;
 	time_t secs;
+	tsMemo_t *const pMemo = getTSMemo();
 
 	secs = tp->tv_sec;
+	if(   pMemo != NULL && pMemo->bValidLocal && pMemo->tzGenLocal == tzGeneration
+	   && secs >= pMemo->hourStart && secs < pMemo->validUntil) {
+		/* still in the same local hour: only minute and second change. UTC
+		 * offset changes happen at the start of a local hour (e.g. Lord Howe
+		 * Island) or of a UTC hour (e.g. Chatham Islands), so we never use
+		 * the memo across either.
+		 */
+		*t = pMemo->timeLocal;
+		t->minute = (secs - pMemo->hourStart) / 60;
+		t->second = (secs - pMemo->hourStart) % 60;
+		t->secfrac = tp->tv_usec;
+		return;
+	}
+
+	if(pMemo != NULL)
+		pMemo->tzGenLocal = tzGeneration;
 	tm = localtime_r(&secs, &tmBuf);
 
 	t->year = tm->tm_year + 1900;
@@ -93,6 +159,46 @@ timeval2syslogTime(struct timeval *tp, struct syslogTime *t)
 	t->OffsetHour = lBias / 3600;
 	t->OffsetMinute = (lBias % 3600) / 60;
 	t->timeType = TIME_TYPE_RFC5424; /* we have a high precision timestamp */
+
+	if(pMemo != NULL) {
+		/* a leap second (if the tz database knows about them) is not cached */
+		pMemo->bValidLocal = (tm->tm_sec < 60);
+		pMemo->hourStart = secs - tm->tm_min * 60 - tm->tm_sec;
+		pMemo->validUntil = secs - secs % 3600 + (secs % 3600 < 0 ? 0 : 3600);
+		if(pMemo->validUntil > pMemo->hourStart + 3600)
+			pMemo->validUntil = pMemo->hourStart + 3600;
+		pMemo->timeLocal = *t;
+	}
+}
+
+/* obtain the current time. If the user permitted it, we use the coarse
+ * real time clock, which is considerably cheaper than gettimeofday() but
+ * only has a resolution of the kernel tick (usually 1 to 4ms).
+ */
+static inline int
+getTimeval(struct timeval *const tp)
+{
+#	ifdef CLOCK_REALTIME_COARSE
+	struct timespec ts;
+
+	if(glblCoarseClock && clock_gettime(CLOCK_REALTIME_COARSE, &ts) == 0) {
+		tp->tv_sec = ts.tv_sec;
+		tp->tv_usec = ts.tv_nsec / 1000;
+		return 0;
+	}
+#	endif
+	return gettimeofday(tp, NULL);
+}
+
+
+/* must be called when the timezone may have changed. Makes sure that the
+ * C library and our local time memos pick up the new settings.
+ */
+void
+datetimeTZChanged(void)
+{
+	tzset();
+	++tzGeneration;
 }
 
 /**
@@ -125,7 +231,7 @@ static void getCurrTime(struct syslogTime *t, time_t *ttSeconds)
 		 */
 		gettimeofday(&tp, &tz);
 #	else
-		gettimeofday(&tp, NULL);
+		getTimeval(&tp);
 #	endif
 	if(ttSeconds != NULL)
 		*ttSeconds = tp.tv_sec;
@@ -145,7 +251,7 @@ getTime(time_t *ttSeconds)
 {
 	struct timeval tp;
 
-	if(gettimeofday(&tp, NULL) == -1)
+	if(getTimeval(&tp) == -1)
 		return -1;
 
 	if(ttSeconds != NULL)
@@ -198,6 +304,221 @@ srSLMGParseInt32(uchar** ppsz, int *pLenStr)
 }
 
 
+/* The timestamp fast paths below handle the by far most common forms of
+ * RFC3339 and RFC3164 timestamps. They check the fixed-position digits
+ * and delimiters 8 bytes at a time. On anything unusual they return
+ * RS_RET_INVLD_TIME without touching anything, and the caller continues
+ * with the generic parser, which also knows about all the malformed
+ * variants we accept. If a fast path succeeds, the result is exactly
+ * what the generic parser would have produced.
+ */
+static inline uint64_t
+load8(const uchar *const p)
+{
+	uint64_t w;
+	memcpy(&w, p, sizeof(w));
+	return w;
+}
+
+/* check if all bytes of w selected by mask (0xff per byte) are ASCII digits */
+static inline int
+isDigits8(uint64_t w, const uint64_t mask)
+{
+	const uint64_t ones = 0x0101010101010101ull;
+	const uint64_t high = 0x8080808080808080ull;
+
+	w &= mask;
+	if(w & high)
+		return 0;
+	/* no carries/borrows between bytes now: b + 0x46 has bit 7 set if
+	 * b > '9', (b | 0x80) - 0x30 has bit 7 cleared if b < '0'.
+	 */
+	return (((w + 0x46 * ones) | ~((w | high) - 0x30 * ones)) & high & mask) == 0;
+}
+
+#define DIGIT(c) ((c) - '0')
+#define DIGITS2(p) (DIGIT((p)[0]) * 10 + DIGIT((p)[1]))
+
+/* e.g. 2014-06-18T10:11:12.123456+02:00 */
+static inline rsRetVal
+ParseTIMESTAMP3339Fast(struct syslogTime *const pTime, uchar **const ppszTS, int *const pLenStr)
+{
+	/* "YYYY-MM-DDTHH:MM" */
+	static const uchar digitMask[16] = { 0xff, 0xff, 0xff, 0xff, 0, 0xff, 0xff, 0,
+					     0xff, 0xff, 0, 0xff, 0xff, 0, 0xff, 0xff };
+	static const uchar delimMask[16] = { 0, 0, 0, 0, 0xff, 0, 0, 0xff,
+					     0, 0, 0xff, 0, 0, 0xff, 0, 0 };
+	static const uchar delims[16] = { 0, 0, 0, 0, '-', 0, 0, '-',
+					  0, 0, 'T', 0, 0, ':', 0, 0 };
+	const uchar *const p = *ppszTS;
+	const int lenStr = *pLenStr;
+	int i;
+	int month, day, hour, minute, second;
+	int secfrac = 0;
+	int secfracPrecision = 0;
+	int OffsetHour = 0, OffsetMinute = 0;
+	char OffsetMode;
+
+	if(lenStr < 20)
+		return RS_RET_INVLD_TIME;
+	if(   (load8(p) & load8(delimMask)) != load8(delims)
+	   || (load8(p+8) & load8(delimMask+8)) != load8(delims+8)
+	   || !isDigits8(load8(p), load8(digitMask))
+	   || !isDigits8(load8(p+8), load8(digitMask+8))
+	   || p[16] != ':' || !isdigit(p[17]) || !isdigit(p[18]))
+		return RS_RET_INVLD_TIME;
+
+	month = DIGITS2(p+5);
+	day = DIGITS2(p+8);
+	hour = DIGITS2(p+11);
+	minute = DIGITS2(p+14);
+	second = DIGITS2(p+17);
+	if(   month < 1 || month > 12 || day < 1 || day > 31
+	   || hour > 23 || minute > 59 || second > 60)
+		return RS_RET_INVLD_TIME;
+
+	i = 19;
+	if(p[i] == '.') {
+		for(++i ; i < lenStr && isdigit(p[i]) ; ++i) {
+			secfrac = secfrac * 10 + DIGIT(p[i]);
+			++secfracPrecision;
+		}
+		/* no digits or more than int can hold: leave to the generic parser */
+		if(secfracPrecision == 0 || secfracPrecision > 9 || i == lenStr)
+			return RS_RET_INVLD_TIME;
+	}
+
+	OffsetMode = p[i];
+	if(OffsetMode == 'Z') {
+		++i;
+	} else if(OffsetMode == '+' || OffsetMode == '-') {
+		if(   lenStr - i < 6 || !isdigit(p[i+1]) || !isdigit(p[i+2]) || p[i+3] != ':'
+		   || !isdigit(p[i+4]) || !isdigit(p[i+5]))
+			return RS_RET_INVLD_TIME;
+		OffsetHour = DIGITS2(p+i+1);
+		OffsetMinute = DIGITS2(p+i+4);
+		if(OffsetHour > 23 || OffsetMinute > 59)
+			return RS_RET_INVLD_TIME;
+		i += 6;
+	} else {
+		return RS_RET_INVLD_TIME;
+	}
+
+	if(i < lenStr) {
+		if(p[i] != ' ')
+			return RS_RET_INVLD_TIME;
+		++i;
+	}
+
+	*ppszTS += i;
+	*pLenStr -= i;
+	pTime->timeType = 2;
+	pTime->year = DIGITS2(p) * 100 + DIGITS2(p+2);
+	pTime->month = month;
+	pTime->day = day;
+	pTime->hour = hour;
+	pTime->minute = minute;
+	pTime->second = second;
+	pTime->secfrac = secfrac;
+	pTime->secfracPrecision = secfracPrecision;
+	pTime->OffsetMode = OffsetMode;
+	pTime->OffsetHour = OffsetHour;
+	pTime->OffsetMinute = OffsetMinute;
+	return RS_RET_OK;
+}
+
+
+/* e.g. "Jun 18 10:11:12" or "Jun  8 10:11:12" */
+static inline rsRetVal
+ParseTIMESTAMP3164Fast(struct syslogTime *const pTime, uchar **const ppszTS, int *const pLenStr)
+{
+	/* "HH:MM:SS" */
+	static const uchar digitMask[8] = { 0xff, 0xff, 0, 0xff, 0xff, 0, 0xff, 0xff };
+	static const uchar delimMask[8] = { 0, 0, 0xff, 0, 0, 0xff, 0, 0 };
+	static const uchar delims[8] = { 0, 0, ':', 0, 0, ':', 0, 0 };
+	const uchar *const p = *ppszTS;
+	const int lenStr = *pLenStr;
+	tsMemo_t *const pMemo = getTSMemo();
+	int i;
+	int month, day, hour, minute, second;
+
+	if(lenStr < 15 || p[3] != ' ' || p[6] != ' ')
+		return RS_RET_INVLD_TIME;
+	if(pMemo != NULL && pMemo->bValid3164 && !memcmp(p, pMemo->prefix3164, 15)) {
+		month = pMemo->time3164.month;
+		day = pMemo->time3164.day;
+		hour = pMemo->time3164.hour;
+		minute = pMemo->time3164.minute;
+		second = pMemo->time3164.second;
+		goto done_prefix;
+	}
+	/* case-insensitive, as the generic parser (|0x20 only folds letters
+	 * onto the lower case letters we compare with)
+	 */
+	switch(((p[0] | 0x20) << 16) | ((p[1] | 0x20) << 8) | (p[2] | 0x20)) {
+	case ('j'<<16)|('a'<<8)|'n': month = 1; break;
+	case ('f'<<16)|('e'<<8)|'b': month = 2; break;
+	case ('m'<<16)|('a'<<8)|'r': month = 3; break;
+	case ('a'<<16)|('p'<<8)|'r': month = 4; break;
+	case ('m'<<16)|('a'<<8)|'y': month = 5; break;
+	case ('j'<<16)|('u'<<8)|'n': month = 6; break;
+	case ('j'<<16)|('u'<<8)|'l': month = 7; break;
+	case ('a'<<16)|('u'<<8)|'g': month = 8; break;
+	case ('s'<<16)|('e'<<8)|'p': month = 9; break;
+	case ('o'<<16)|('c'<<8)|'t': month = 10; break;
+	case ('n'<<16)|('o'<<8)|'v': month = 11; break;
+	case ('d'<<16)|('e'<<8)|'c': month = 12; break;
+	default: return RS_RET_INVLD_TIME;
+	}
+
+	if(p[4] == ' ' && isdigit(p[5]))
+		day = DIGIT(p[5]);
+	else if(isdigit(p[4]) && isdigit(p[5]))
+		day = DIGITS2(p+4);
+	else
+		return RS_RET_INVLD_TIME;
+
+	if(   (load8(p+7) & load8(delimMask)) != load8(delims)
+	   || !isDigits8(load8(p+7), load8(digitMask)))
+		return RS_RET_INVLD_TIME;
+	hour = DIGITS2(p+7);
+	minute = DIGITS2(p+10);
+	second = DIGITS2(p+13);
+	if(day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+		return RS_RET_INVLD_TIME;
+	if(pMemo != NULL) {
+		memcpy(pMemo->prefix3164, p, 15);
+		pMemo->time3164.month = month;
+		pMemo->time3164.day = day;
+		pMemo->time3164.hour = hour;
+		pMemo->time3164.minute = minute;
+		pMemo->time3164.second = second;
+		pMemo->bValid3164 = 1;
+	}
+
+done_prefix:
+	/* a year, trailing colon etc. are left to the generic parser */
+	i = 15;
+	if(i < lenStr) {
+		if(p[i] != ' ')
+			return RS_RET_INVLD_TIME;
+		++i;
+	}
+
+	*ppszTS += i;
+	*pLenStr -= i;
+	pTime->timeType = 1;
+	pTime->month = month;
+	pTime->day = day;
+	pTime->hour = hour;
+	pTime->minute = minute;
+	pTime->second = second;
+	pTime->secfracPrecision = 0;
+	pTime->secfrac = 0;
+	return RS_RET_OK;
+}
+
+
 /**
  * Parse a TIMESTAMP-3339.
  * updates the parse pointer position. The pTime parameter
@@ -232,6 +553,9 @@ ParseTIMESTAMP3339(struct syslogTime *pTime, uchar** ppszTS, int *pLenStr)
 	assert(ppszTS != NULL);
 	assert(pszTS != NULL);
 
+	if(ParseTIMESTAMP3339Fast(pTime, ppszTS, pLenStr) == RS_RET_OK)
+		FINALIZE;
+
 	lenStr = *pLenStr;
 	year = srSLMGParseInt32(&pszTS, &lenStr);
 
@@ -384,6 +708,10 @@ ParseTIMESTAMP3164(struct syslogTime *pTime, uchar** ppszTS, int *pLenStr)
 	assert(pszTS != NULL);
 	assert(pTime != NULL);
 	assert(pLenStr != NULL);
+
+	if(ParseTIMESTAMP3164Fast(pTime, ppszTS, pLenStr) == RS_RET_OK)
+		FINALIZE;
+
 	lenStr = *pLenStr;
 
 	/* If we look at the month (Jan, Feb, Mar, Apr, May, Jun, Jul, Aug, Sep, Oct, Nov, Dec),
@@ -1026,6 +1354,9 @@ ENDobjQueryInterface(datetime)
 BEGINAbstractObjClassInit(datetime, 1, OBJ_IS_CORE_MODULE) /* class, version */
 	/* request objects we use */
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	/* the timestamp memo is an optimization only, so we can live without it */
+	if(pthread_key_create(&keyTSMemo, free) == 0)
+		bTSMemoActive = 1;
 ENDObjClassInit(datetime)
 
 /* vi:set ai:
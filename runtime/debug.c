@@ -56,6 +56,7 @@
 #include "atomic.h"
 #include "cfsysline.h"
 #include "obj.h"
+#include "trace.h"
 
 
 /* static data (some time to be replaced) */
@@ -834,6 +835,9 @@ sigsegvHdlr(int signum)
 
 	dbgprintf("\n\n\n\nSignal %d%s occured, execution must be terminated.\n\n\n\n", signum, signame);
 
+	/* the trace ring is our only post-mortem information if not debugging */
+	trcDumpToFile();
+
 	if(bAbortTrace) {
 		dbgPrintAllDebugInfo();
 		dbgprintf("If the call trace is empty, you may want to ./configure --enable-rtinst\n");
@@ -1190,6 +1194,7 @@ static void sigusr2Hdlr(int __attribute__((unused)) signum)
 {
 	dbgprintf("SIGUSR2 received, dumping debug information\n");
 	dbgPrintAllDebugInfo();
+	trcDumpToFile();
 }
 
 /* support system to set debug options at runtime */
@@ -7,6 +7,15 @@
  * In any case, even the initial implementaton is far faster than what we had
  * before. -- rgerhards, 2011-06-06
  *
+ * The cache is split into stripes, each with its own lock, hash table and
+ * LRU list, so that lookups for different addresses rarely contend. Entries
+ * expire after dnscache.ttl seconds and the least recently used entries are
+ * evicted if a stripe holds more than its share of dnscache.maxentries.
+ * If dnscache.resolverthreads is set, reverse lookups are done by a pool of
+ * resolver threads. Until the result is available, lookups return the IP
+ * address as name (optionally after waiting up to dnscache.maxwait ms), so
+ * that a slow DNS server does no longer stall a whole batch.
+ *
  * Copyright 2011-2013 by Rainer Gerhards and Adiscon GmbH.
  *
  * This file is part of the rsyslog runtime library.
@@ -34,6 +43,12 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#if HAVE_SYS_PRCTL_H
+#  include <sys/prctl.h>
+#endif
 
 #include "syslogd-types.h"
 #include "glbl.h"
@@ -41,9 +56,12 @@
 #include "obj.h"
 #include "unicode-helper.h"
 #include "net.h"
-#include "hashtable.h"
+#include "hashmap.h"
 #include "prop.h"
 #include "dnscache.h"
+#include "srUtils.h"
+
+#define DNSCACHE_NSTRIPES 16 /* must be a power of 2 */
 
 /* module data structures */
 struct dnscache_entry_s {
@@ -52,14 +70,36 @@ struct dnscache_entry_s {
 	prop_t *fqdnLowerCase;
 	prop_t *localName; /* only local name, without domain part (if configured so) */
 	prop_t *ip;
-	struct dnscache_entry_s *next;
+	struct dnscache_entry_s *next;	/* resolver queue link */
+	struct dnscache_entry_s *lruPrev;
+	struct dnscache_entry_s *lruNext;
+	time_t validUntil;	/* 0 - never expires */
+	rsRetVal resolveRet;	/* result of the last (async) resolution */
 	unsigned nUsed;
+	unsigned nWaiters;	/* lookups waiting for the resolver; entry must not be evicted */
+	sbool bPending;		/* queued for or being resolved by the resolver pool */
 };
 typedef struct dnscache_entry_s dnscache_entry_t;
-struct dnscache_s {
-	pthread_rwlock_t rwlock;
-	struct hashtable *ht;
+typedef struct dnscache_stripe_s {
+	pthread_mutex_t mut;
+	pthread_cond_t resolved;	/* the resolver pool completed an entry of this stripe */
+	hashmap_t *ht;		/* key is the entry's addr */
+	dnscache_entry_t *lruHead;	/* most recently used */
+	dnscache_entry_t *lruTail;	/* least recently used */
 	unsigned nEntries;
+} dnscache_stripe_t;
+struct dnscache_s {
+	dnscache_stripe_t stripe[DNSCACHE_NSTRIPES];
+	/* resolver pool */
+	pthread_mutex_t mutRslvr;
+	pthread_cond_t workAvail;
+	dnscache_entry_t *pQHead;
+	dnscache_entry_t *pQTail;
+	int nQueued;
+	pthread_t *thrdIDs;
+	int nThrds;
+	sbool bPoolTried;	/* pool start was attempted (we try once only) */
+	sbool bShutdown;
 };
 typedef struct dnscache_s dnscache_t;
 
@@ -76,11 +116,11 @@ static prop_t *staticErrValue;
 /* Our hash function.
  * TODO: check how well it performs on socket addresses!
  */
-unsigned int
-hash_from_key_fn(void *k) 
+static unsigned
+hash_from_key_fn(const void *k)
 {
     int len;
-    uchar *rkey = (uchar*) k; /* we treat this as opaque bytes */
+    const uchar *rkey = (const uchar*) k; /* we treat this as opaque bytes */
     unsigned hashval = 1;
 
     len = SALEN((struct sockaddr*)k);
@@ -90,8 +130,22 @@ hash_from_key_fn(void *k)
     return hashval;
 }
 
+/* select the stripe for an address. The hash map mixes the hash value
+ * on its own, so using it here as well does not hurt the distribution
+ * inside the stripes.
+ */
+static inline dnscache_stripe_t *
+getStripe(struct sockaddr_storage *addr)
+{
+	unsigned h = hash_from_key_fn(addr);
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+	return &dnsCache.stripe[h & (DNSCACHE_NSTRIPES - 1)];
+}
+
 static int
-key_equals_fn(void *key1, void *key2)
+key_equals_fn(const void *key1, const void *key2)
 {
 	return (SALEN((struct sockaddr*)key1) == SALEN((struct sockaddr*) key2) 
 		   && !memcmp(key1, key2, SALEN((struct sockaddr*) key1)));
@@ -118,14 +172,25 @@ entryDestruct(dnscache_entry_t *etry)
 rsRetVal
 dnscacheInit(void)
 {
+	int i;
 	DEFiRet;
-	if((dnsCache.ht = create_hashtable(100, hash_from_key_fn, key_equals_fn,
-				(void(*)(void*))entryDestruct)) == NULL) {
-		DBGPRINTF("dnscache: error creating hash table!\n");
-		ABORT_FINALIZE(RS_RET_ERR); // TODO: make this degrade, but run!
+	for(i = 0 ; i < DNSCACHE_NSTRIPES ; ++i) {
+		CHKiRet(hashmapConstruct(&dnsCache.stripe[i].ht, 100, 0, hash_from_key_fn, key_equals_fn,
+					 NULL, (void(*)(void*))entryDestruct));
+		dnsCache.stripe[i].lruHead = NULL;
+		dnsCache.stripe[i].lruTail = NULL;
+		dnsCache.stripe[i].nEntries = 0;
+		pthread_mutex_init(&dnsCache.stripe[i].mut, NULL);
+		pthread_cond_init(&dnsCache.stripe[i].resolved, NULL);
 	}
-	dnsCache.nEntries = 0;
-	pthread_rwlock_init(&dnsCache.rwlock, NULL);
+	pthread_mutex_init(&dnsCache.mutRslvr, NULL);
+	pthread_cond_init(&dnsCache.workAvail, NULL);
+	dnsCache.pQHead = dnsCache.pQTail = NULL;
+	dnsCache.nQueued = 0;
+	dnsCache.thrdIDs = NULL;
+	dnsCache.nThrds = 0;
+	dnsCache.bPoolTried = 0;
+	dnsCache.bShutdown = 0;
 	CHKiRet(objGetObjInterface(&obj)); /* this provides the root pointer for all other queries */
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
@@ -142,10 +207,28 @@ finalize_it:
 rsRetVal
 dnscacheDeinit(void)
 {
+	int i;
 	DEFiRet;
+
+	/* stop resolver pool. Entries still queued are owned by the hash
+	 * tables, so they are destructed below.
+	 */
+	pthread_mutex_lock(&dnsCache.mutRslvr);
+	dnsCache.bShutdown = 1;
+	pthread_cond_broadcast(&dnsCache.workAvail);
+	pthread_mutex_unlock(&dnsCache.mutRslvr);
+	for(i = 0 ; i < dnsCache.nThrds ; ++i)
+		pthread_join(dnsCache.thrdIDs[i], NULL);
+	free(dnsCache.thrdIDs);
+	pthread_cond_destroy(&dnsCache.workAvail);
+	pthread_mutex_destroy(&dnsCache.mutRslvr);
+
 	prop.Destruct(&staticErrValue);
-	hashtable_destroy(dnsCache.ht, 1); /* 1 => free all values automatically */
-	pthread_rwlock_destroy(&dnsCache.rwlock);
+	for(i = 0 ; i < DNSCACHE_NSTRIPES ; ++i) {
+		hashmapDestruct(&dnsCache.stripe[i].ht); /* destructs all entries */
+		pthread_cond_destroy(&dnsCache.stripe[i].resolved);
+		pthread_mutex_destroy(&dnsCache.stripe[i].mut);
+	}
 	objRelease(glbl, CORE_COMPONENT);
 	objRelease(errmsg, CORE_COMPONENT);
 	objRelease(prop, CORE_COMPONENT);
@@ -154,9 +237,89 @@ dnscacheDeinit(void)
 
 
 static inline dnscache_entry_t*
-findEntry(struct sockaddr_storage *addr)
+findEntry(dnscache_stripe_t *stripe, struct sockaddr_storage *addr)
+{
+	return((dnscache_entry_t*) hashmapSearch(stripe->ht, addr));
+}
+
+
+/* LRU list handling. All of this must be called with the stripe locked. */
+static inline void
+lruUnlink(dnscache_stripe_t *stripe, dnscache_entry_t *etry)
+{
+	if(etry->lruPrev == NULL)
+		stripe->lruHead = etry->lruNext;
+	else
+		etry->lruPrev->lruNext = etry->lruNext;
+	if(etry->lruNext == NULL)
+		stripe->lruTail = etry->lruPrev;
+	else
+		etry->lruNext->lruPrev = etry->lruPrev;
+}
+
+static inline void
+lruPushHead(dnscache_stripe_t *stripe, dnscache_entry_t *etry)
+{
+	etry->lruPrev = NULL;
+	etry->lruNext = stripe->lruHead;
+	if(stripe->lruHead == NULL)
+		stripe->lruTail = etry;
+	else
+		stripe->lruHead->lruPrev = etry;
+	stripe->lruHead = etry;
+}
+
+static inline void
+lruTouch(dnscache_stripe_t *stripe, dnscache_entry_t *etry)
 {
-	return((dnscache_entry_t*) hashtable_search(dnsCache.ht, addr));
+	if(stripe->lruHead != etry) {
+		lruUnlink(stripe, etry);
+		lruPushHead(stripe, etry);
+	}
+}
+
+
+/* remove an entry from the cache and destruct it. Must be called with the
+ * stripe locked. The entry must not be pending or waited for. Note that
+ * the properties handed out to messages are reference-counted, so they
+ * stay valid.
+ */
+static void
+removeEntry(dnscache_stripe_t *stripe, dnscache_entry_t *etry)
+{
+	lruUnlink(stripe, etry);
+	hashmapRemove(stripe->ht, &etry->addr);
+	--stripe->nEntries;
+	entryDestruct(etry);
+}
+
+
+/* insert a new entry and evict least recently used ones if the stripe
+ * is over its limit. Must be called with the stripe locked.
+ */
+static rsRetVal
+insertEntry(dnscache_stripe_t *stripe, dnscache_entry_t *etry)
+{
+	dnscache_entry_t *victim;
+	dnscache_entry_t *prev;
+	unsigned maxEntries;
+	DEFiRet;
+
+	CHKiRet(hashmapInsert(stripe->ht, &etry->addr, etry));
+	lruPushHead(stripe, etry);
+	++stripe->nEntries;
+
+	if(glblDNSCacheMaxEntries > 0) {
+		maxEntries = (glblDNSCacheMaxEntries + DNSCACHE_NSTRIPES - 1) / DNSCACHE_NSTRIPES;
+		for(victim = stripe->lruTail ; victim != NULL && stripe->nEntries > maxEntries ; victim = prev) {
+			prev = victim->lruPrev;
+			if(victim != etry && !victim->bPending && victim->nWaiters == 0)
+				removeEntry(stripe, victim);
+		}
+	}
+
+finalize_it:
+	RETiRet;
 }
 
 
@@ -255,9 +418,11 @@ done:	return;
  * there is a user-configurabel option that will tell us if
  * we should abort. For this, the return value tells the caller if the
  * message should be processed (1) or discarded (0).
+ * If bNoDNS is set, only the IP address is obtained and used as name,
+ * this is the placeholder while the resolver pool works on the entry.
  */
 static rsRetVal
-resolveAddr(struct sockaddr_storage *addr, dnscache_entry_t *etry)
+resolveAddr(struct sockaddr_storage *addr, dnscache_entry_t *etry, const sbool bNoDNS)
 {
 	DEFiRet;
 	int error;
@@ -275,7 +440,7 @@ resolveAddr(struct sockaddr_storage *addr, dnscache_entry_t *etry)
 		ABORT_FINALIZE(RS_RET_INVALID_SOURCE);
 	}
 
-	if(!glbl.GetDisableDNS()) {
+	if(!bNoDNS && !glbl.GetDisableDNS()) {
 		sigemptyset(&nmask);
 		sigaddset(&nmask, SIGHUP);
 		pthread_sigmask(SIG_BLOCK, &nmask, &omask);
@@ -347,7 +512,7 @@ finalize_it:
 	/* we need to create the inputName property (only once during our lifetime) */
 	prop.CreateStringProp(&etry->ip, (uchar*)szIP, strlen(szIP));
 
-        if(error || glbl.GetDisableDNS()) {
+        if(error || bNoDNS || glbl.GetDisableDNS()) {
                 dbgprintf("Host name for your address (%s) unknown\n", szIP);
 		prop.AddRef(etry->ip);
 		etry->fqdn = etry->ip;
@@ -361,49 +526,200 @@ finalize_it:
 }
 
 
-static inline rsRetVal
-addEntry(struct sockaddr_storage *addr, dnscache_entry_t **pEtry)
+static inline time_t
+entryValidUntil(const time_t now)
 {
-	int r;
-	struct sockaddr_storage *keybuf;
-	dnscache_entry_t *etry = NULL;
-	DEFiRet;
-
-	CHKmalloc(etry = MALLOC(sizeof(dnscache_entry_t)));
-	CHKiRet(resolveAddr(addr, etry));
-	memcpy(&etry->addr, addr, SALEN((struct sockaddr*) addr));
-	etry->nUsed = 0;
-	*pEtry = etry;
+	return (glblDNSCacheTTL > 0) ? now + glblDNSCacheTTL : 0;
+}
 
-	CHKmalloc(keybuf = malloc(sizeof(struct sockaddr_storage)));
-	memcpy(keybuf, addr, sizeof(struct sockaddr_storage));
 
-	pthread_rwlock_unlock(&dnsCache.rwlock); /* release read lock */
-	pthread_rwlock_wrlock(&dnsCache.rwlock); /* and re-aquire for writing */
-	r = hashtable_insert(dnsCache.ht, keybuf, *pEtry);
-	if(r == 0) {
-		DBGPRINTF("dnscache: inserting element failed\n");
+/* This is a resolver thread of the pool. It takes entries from the queue,
+ * resolves them without holding any cache lock and then replaces the
+ * placeholder properties by the real ones.
+ */
+static void*
+resolverThread(void __attribute__((unused)) *pPtr)
+{
+	dnscache_entry_t *etry;
+	dnscache_entry_t rslvd;
+	dnscache_stripe_t *stripe;
+	rsRetVal localRet;
+
+	dbgOutputTID((char*)"rs:dns-resolver");
+#	if HAVE_PRCTL && defined PR_SET_NAME
+	if(prctl(PR_SET_NAME, (char*)"rs:dns-resolver", 0, 0, 0) != 0) {
+		DBGPRINTF("prctl failed, not setting thread name for '%s'\n", "dns resolver");
+	}
+#	endif
+
+	pthread_mutex_lock(&dnsCache.mutRslvr);
+	while(1) { /* loop broken inside */
+		if(dnsCache.bShutdown)
+			break;
+		if(dnsCache.pQHead == NULL) {
+			pthread_cond_wait(&dnsCache.workAvail, &dnsCache.mutRslvr);
+			continue;
+		}
+		etry = dnsCache.pQHead;
+		dnsCache.pQHead = etry->next;
+		if(dnsCache.pQHead == NULL)
+			dnsCache.pQTail = NULL;
+		--dnsCache.nQueued;
+		pthread_mutex_unlock(&dnsCache.mutRslvr);
+
+		/* a pending entry is never evicted, and addr never changes, so we
+		 * can access it without lock.
+		 */
+		memset(&rslvd, 0, sizeof(rslvd));
+		localRet = resolveAddr(&etry->addr, &rslvd, 0);
+
+		stripe = getStripe(&etry->addr);
+		pthread_mutex_lock(&stripe->mut);
+		prop.Destruct(&etry->fqdn);
+		prop.Destruct(&etry->fqdnLowerCase);
+		prop.Destruct(&etry->localName);
+		prop.Destruct(&etry->ip);
+		etry->fqdn = rslvd.fqdn;
+		etry->fqdnLowerCase = rslvd.fqdnLowerCase;
+		etry->localName = rslvd.localName;
+		etry->ip = rslvd.ip;
+		etry->resolveRet = localRet;
+		etry->validUntil = entryValidUntil(time(NULL));
+		etry->bPending = 0;
+		pthread_cond_broadcast(&stripe->resolved);
+		pthread_mutex_unlock(&stripe->mut);
+
+		pthread_mutex_lock(&dnsCache.mutRslvr);
 	}
-	pthread_rwlock_unlock(&dnsCache.rwlock);
-	pthread_rwlock_rdlock(&dnsCache.rwlock); /* we need this again */
+	pthread_mutex_unlock(&dnsCache.mutRslvr);
 
-finalize_it:
-	if(iRet != RS_RET_OK && etry != NULL) {
-		/* Note: sub-fields cannot be populated in this case */
-		free(etry);
+	return NULL; /* to keep pthreads happy */
+}
+
+
+/* check if we shall use the resolver pool, starting it on first use (we
+ * can not do that on init, as the config is not yet loaded by then).
+ * *pbQueueFull tells if the pool is so far behind that no more requests
+ * should be queued. Pending entries can not be evicted, so we must not let
+ * them grow without bound if DNS is slow and many senders show up.
+ */
+static int
+useResolverPool(sbool *const pbQueueFull)
+{
+	int i;
+	int nThrds;
+	int bUsePool;
+
+	*pbQueueFull = 0;
+	if(glblDNSCacheResolvers <= 0 || glbl.GetDisableDNS())
+		return 0;
+
+	/* this is called on cache misses only, so the lock does not hurt */
+	pthread_mutex_lock(&dnsCache.mutRslvr);
+	if(!dnsCache.bPoolTried) {
+		nThrds = glblDNSCacheResolvers;
+		if((dnsCache.thrdIDs = calloc(nThrds, sizeof(pthread_t))) != NULL) {
+			for(i = 0 ; i < nThrds ; ++i) {
+				if(pthread_create(&dnsCache.thrdIDs[dnsCache.nThrds],
+#ifdef HAVE_PTHREAD_SETSCHEDPARAM
+						  &default_thread_attr,
+#else
+						  NULL,
+#endif
+						  resolverThread, NULL) == 0) {
+					++dnsCache.nThrds;
+				} else {
+					DBGPRINTF("dnscache: could not create resolver thread %d\n", i);
+				}
+			}
+		}
+		if(dnsCache.nThrds == 0)
+			errmsg.LogError(0, RS_RET_ERR, "dnscache: could not start resolver threads, "
+					"doing DNS lookups synchronously");
+		else
+			DBGPRINTF("dnscache: resolver pool started with %d threads\n", dnsCache.nThrds);
+		dnsCache.bPoolTried = 1;
 	}
-	RETiRet;
+	bUsePool = dnsCache.nThrds > 0;
+	if(glblDNSCacheMaxEntries > 0 && dnsCache.nQueued >= glblDNSCacheMaxEntries / 2)
+		*pbQueueFull = 1;
+	pthread_mutex_unlock(&dnsCache.mutRslvr);
+	return bUsePool;
 }
 
 
-/* validate if an entry is still valid and, if not, re-query it.
- * In the initial implementation, this is a dummy!
- * TODO: implement!
+/* hand an entry over to the resolver pool. Must be called with the
+ * stripe locked.
  */
-static inline rsRetVal
-validateEntry(dnscache_entry_t __attribute__((unused)) *etry, struct sockaddr_storage __attribute__((unused)) *addr)
+static void
+queueForResolver(dnscache_entry_t *etry)
+{
+	etry->bPending = 1;
+	etry->next = NULL;
+	pthread_mutex_lock(&dnsCache.mutRslvr);
+	if(dnsCache.pQTail == NULL)
+		dnsCache.pQHead = etry;
+	else
+		dnsCache.pQTail->next = etry;
+	dnsCache.pQTail = etry;
+	++dnsCache.nQueued;
+	pthread_cond_signal(&dnsCache.workAvail);
+	pthread_mutex_unlock(&dnsCache.mutRslvr);
+}
+
+
+/* create a new cache entry for addr. Must be called with the stripe locked.
+ * In synchronous mode, the lock is released while resolving, so someone else
+ * may have added the entry in the mean time. We then use theirs.
+ * If the resolver pool is overloaded, an entry with the IP as name is
+ * returned, but not added to the cache. The caller must destruct it
+ * (*pbUncached is set).
+ */
+static rsRetVal
+addEntry(dnscache_stripe_t *stripe, struct sockaddr_storage *addr, const time_t now,
+	 dnscache_entry_t **pEtry, sbool *const pbUncached)
 {
-	return RS_RET_OK;
+	dnscache_entry_t *etry = NULL;
+	dnscache_entry_t *other;
+	sbool bQueueFull;
+	const int bAsync = useResolverPool(&bQueueFull);
+	DEFiRet;
+
+	CHKmalloc(etry = calloc(1, sizeof(dnscache_entry_t)));
+	memcpy(&etry->addr, addr, SALEN((struct sockaddr*) addr));
+	if(bAsync) {
+		/* only obtains the IP, so no need to release the lock */
+		CHKiRet(resolveAddr(addr, etry, 1));
+	} else {
+		pthread_mutex_unlock(&stripe->mut);
+		iRet = resolveAddr(addr, etry, 0);
+		pthread_mutex_lock(&stripe->mut);
+		CHKiRet(iRet);
+		if((other = findEntry(stripe, addr)) != NULL) {
+			entryDestruct(etry);
+			etry = NULL;
+			*pEtry = other;
+			FINALIZE;
+		}
+	}
+	etry->resolveRet = RS_RET_OK;
+	if(bAsync && bQueueFull) {
+		DBGPRINTF("dnscache: resolver queue full, using IP as name\n");
+		*pEtry = etry;
+		*pbUncached = 1;
+		FINALIZE;
+	}
+	etry->validUntil = entryValidUntil(now);
+	CHKiRet(insertEntry(stripe, etry));
+	*pEtry = etry;
+	if(bAsync)
+		queueForResolver(etry);
+	etry = NULL; /* now owned by the cache */
+
+finalize_it:
+	if(etry != NULL && *pbUncached == 0)
+		entryDestruct(etry);
+	RETiRet;
 }
 
 
@@ -416,17 +732,45 @@ rsRetVal
 dnscacheLookup(struct sockaddr_storage *addr, prop_t **fqdn, prop_t **fqdnLowerCase,
 	       prop_t **localName, prop_t **ip)
 {
+	dnscache_stripe_t *const stripe = getStripe(addr);
 	dnscache_entry_t *etry;
+	struct timespec tTimeout;
+	time_t now = 0;
+	sbool bQueueFull;
+	sbool bUncached = 0;
 	DEFiRet;
 
-	pthread_rwlock_rdlock(&dnsCache.rwlock); /* TODO: optimize this! */
-	etry = findEntry(addr);
+	if(glblDNSCacheTTL > 0)
+		now = time(NULL);
+	pthread_mutex_lock(&stripe->mut);
+	etry = findEntry(stripe, addr);
 	dbgprintf("dnscache: entry %p found\n", etry);
-	if(etry == NULL) {
-		CHKiRet(addEntry(addr, &etry));
-	} else {
-		CHKiRet(validateEntry(etry, addr));
+	if(etry != NULL && etry->validUntil != 0 && now >= etry->validUntil && !etry->bPending) {
+		if(useResolverPool(&bQueueFull)) {
+			/* keep using the old names until the new ones are known */
+			if(!bQueueFull)
+				queueForResolver(etry);
+		} else if(etry->nWaiters == 0) {
+			removeEntry(stripe, etry);
+			etry = NULL;
+		}
 	}
+	if(etry == NULL)
+		CHKiRet(addEntry(stripe, addr, now, &etry, &bUncached));
+
+	if(etry->bPending && glblDNSCacheMaxWait > 0) {
+		timeoutComp(&tTimeout, glblDNSCacheMaxWait);
+		++etry->nWaiters;
+		while(etry->bPending) {
+			if(pthread_cond_timedwait(&stripe->resolved, &stripe->mut, &tTimeout) == ETIMEDOUT)
+				break;
+		}
+		--etry->nWaiters;
+	}
+	CHKiRet(etry->resolveRet);
+	if(!bUncached)
+		lruTouch(stripe, etry);
+
 	prop.AddRef(etry->ip);
 	*ip = etry->ip;
 	if(fqdn != NULL) {
@@ -443,7 +787,9 @@ dnscacheLookup(struct sockaddr_storage *addr, prop_t **fqdn, prop_t **fqdnLowerC
 	}
 
 finalize_it:
-	pthread_rwlock_unlock(&dnsCache.rwlock);
+	if(bUncached)
+		entryDestruct(etry);
+	pthread_mutex_unlock(&stripe->mut);
 	if(iRet != RS_RET_OK && iRet != RS_RET_ADDRESS_UNKNOWN) {
 		DBGPRINTF("dnscacheLookup failed with iRet %d\n", iRet);
 		prop.AddRef(staticErrValue);
@@ -47,6 +47,10 @@
 #include "action.h"
 #include "rainerscript.h"
 #include "net.h"
+#include "regexp.h"
+#include "trace.h"
+#include "pipestats.h"
+#include "memacct.h"
 
 /* some defaults */
 #ifndef DFLT_NETSTRM_DRVR
@@ -71,6 +75,21 @@ int bProcessInternalMessages = 1;	/* Should rsyslog itself process internal mess
 					 * 1 - yes
 					 * 0 - send them to libstdlog (e.g. to push to journal)
 					 */
+int glblRegexEngine = RSREGEX_POSIX;	/* engine for re_match(), re_extract() and ereregex filters */
+int glblRulesetBatchExec = 0;	/* execute rulesets statement by statement over the whole batch? */
+int glblRulesetProfile = 0;	/* record per-statement execution profiles? */
+int glblNetstrmDrvrKTLS = 0;	/* offload TLS record processing to the kernel, if possible? */
+int glblStrmAsyncWriters = 2;	/* number of threads in the shared stream writer pool */
+int glblParserCacheSelection = 0;	/* try the parser that last succeeded for an input/sender first? */
+int glblCoarseClock = 0;	/* use the cheap, tick-resolution clock for reception timestamps? */
+int glblDNSCacheTTL = 86400;	/* seconds until a dnscache entry is re-resolved, 0 - never */
+int glblDNSCacheMaxEntries = 100000;	/* max number of dnscache entries, 0 - unlimited */
+int glblDNSCacheResolvers = 0;	/* number of async resolver threads, 0 - resolve synchronously */
+int glblDNSCacheMaxWait = 0;	/* max ms to wait for an async resolution before using the IP */
+int glblRatelimitTokenBucket = 0;	/* input ratelimiters use a token bucket instead of a fixed window? */
+int glblMsgPoolPrealloc = 0;	/* number of msg objects to pre-allocate, 0 - none */
+int glblMsgPoolHugePages = 0;	/* back pre-allocated msg objects with huge pages? */
+int glblMsgPoolMlock = 0;	/* lock pre-allocated msg objects into memory? */
 static uchar *pszWorkDir = NULL;
 static uchar *stdlog_chanspec = NULL;
 static int bOptimizeUniProc = 1;	/* enable uniprocessor optimizations */
@@ -135,8 +154,28 @@ static struct cnfparamdescr cnfparamdescr[] = {
 	{ "parser.escape8bitcharactersonreceive", eCmdHdlrBinary, 0},
 	{ "parser.escapecontrolcharactertab", eCmdHdlrBinary, 0},
 	{ "parser.escapecontrolcharacterscstyle", eCmdHdlrBinary, 0 },
+	{ "parser.cacheselection", eCmdHdlrBinary, 0 },
+	{ "timestamp.coarseclock", eCmdHdlrBinary, 0 },
+	{ "dnscache.ttl", eCmdHdlrNonNegInt, 0 },
+	{ "dnscache.maxentries", eCmdHdlrNonNegInt, 0 },
+	{ "dnscache.resolverthreads", eCmdHdlrNonNegInt, 0 },
+	{ "dnscache.maxwait", eCmdHdlrNonNegInt, 0 },
+	{ "ratelimit.tokenbucket", eCmdHdlrBinary, 0 },
 	{ "stdlog.channelspec", eCmdHdlrString, 0 },
-	{ "processinternalmessages", eCmdHdlrBinary, 0 }
+	{ "processinternalmessages", eCmdHdlrBinary, 0 },
+	{ "regex.engine", eCmdHdlrGetWord, 0 },
+	{ "ruleset.batchexec", eCmdHdlrBinary, 0 },
+	{ "ruleset.profile", eCmdHdlrBinary, 0 },
+	{ "netstreamdriver.ktls", eCmdHdlrBinary, 0 },
+	{ "stream.asyncwriters", eCmdHdlrPositiveInt, 0 },
+	{ "trace.categories", eCmdHdlrString, 0 },
+	{ "trace.file", eCmdHdlrGetWord, 0 },
+	{ "trace.records", eCmdHdlrNonNegInt, 0 },
+	{ "pipeline.sampling", eCmdHdlrNonNegInt, 0 },
+	{ "memory.limit", eCmdHdlrSize, 0 },
+	{ "msgpool.prealloc", eCmdHdlrNonNegInt, 0 },
+	{ "msgpool.hugepages", eCmdHdlrBinary, 0 },
+	{ "msgpool.mlock", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk paramblk =
 	{ CNFPARAMBLK_VERSION,
@@ -686,6 +725,8 @@ void
 glblProcessCnf(struct cnfobj *o)
 {
 	int i;
+	int engine;
+	char *cstr;
 
 	cnfparamvals = nvlstGetParams(o->nvlst, &paramblk, cnfparamvals);
 	dbgprintf("glbl param blk after glblProcessCnf:\n");
@@ -705,6 +746,20 @@ glblProcessCnf(struct cnfobj *o)
 				es_str2cstr(cnfparamvals[i].val.d.estr, NULL);
 			stdlog_hdl = stdlog_open("rsyslogd", 0, STDLOG_SYSLOG,
 					(char*) stdlog_chanspec);
+		} else if(!strcmp(paramblk.descr[i].name, "regex.engine")) {
+			/* needed immediately, as regexes are compiled while parsing */
+			cstr = es_str2cstr(cnfparamvals[i].val.d.estr, NULL);
+			engine = regexpEngineByName(cstr);
+			if(engine == -1) {
+				errmsg.LogError(0, RS_RET_INVALID_VALUE, "invalid regex.engine "
+					"\"%s\" - using posix", cstr);
+				engine = RSREGEX_POSIX;
+			}
+			glblRegexEngine = engine;
+			free(cstr);
+		} else if(!strcmp(paramblk.descr[i].name, "ruleset.profile")) {
+			/* needed before the rulesets are optimized */
+			glblRulesetProfile = (int) cnfparamvals[i].val.d.n;
 		}
 	}
 }
@@ -787,6 +842,12 @@ glblDoneLoadCnf(void)
 			bActionReportSuspensionCont = (int) cnfparamvals[i].val.d.n;
 		} else if(!strcmp(paramblk.descr[i].name, "maxmessagesize")) {
 			iMaxLine = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "ruleset.batchexec")) {
+			glblRulesetBatchExec = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "netstreamdriver.ktls")) {
+			glblNetstrmDrvrKTLS = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "stream.asyncwriters")) {
+			glblStrmAsyncWriters = (int) cnfparamvals[i].val.d.n;
 		} else if(!strcmp(paramblk.descr[i].name, "debug.onshutdown")) {
 			glblDebugOnShutdown = (int) cnfparamvals[i].val.d.n;
 			errmsg.LogError(0, RS_RET_OK, "debug: onShutdown set to %d", glblDebugOnShutdown);
@@ -804,6 +865,41 @@ glblDoneLoadCnf(void)
 			bEscapeTab = (int) cnfparamvals[i].val.d.n;
 		} else if(!strcmp(paramblk.descr[i].name, "parser.escapecontrolcharacterscstyle")) {
 			bParserEscapeCCCStyle = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "parser.cacheselection")) {
+			glblParserCacheSelection = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "timestamp.coarseclock")) {
+			glblCoarseClock = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "dnscache.ttl")) {
+			glblDNSCacheTTL = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "dnscache.maxentries")) {
+			glblDNSCacheMaxEntries = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "dnscache.resolverthreads")) {
+			glblDNSCacheResolvers = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "dnscache.maxwait")) {
+			glblDNSCacheMaxWait = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "ratelimit.tokenbucket")) {
+			glblRatelimitTokenBucket = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "trace.categories")) {
+			cstr = (uchar*) es_str2cstr(cnfparamvals[i].val.d.estr, NULL);
+			if(trcSetCategories((char*) cstr) != RS_RET_OK) {
+				errmsg.LogError(0, RS_RET_INVALID_VALUE, "invalid trace.categories "
+					"'%s', valid are: queue, action, net, all, none", cstr);
+			}
+			free(cstr);
+		} else if(!strcmp(paramblk.descr[i].name, "trace.file")) {
+			trcSetFile(es_str2cstr(cnfparamvals[i].val.d.estr, NULL));
+		} else if(!strcmp(paramblk.descr[i].name, "trace.records")) {
+			trcSetRecords((unsigned) cnfparamvals[i].val.d.n);
+		} else if(!strcmp(paramblk.descr[i].name, "pipeline.sampling")) {
+			pipestatsRate = (unsigned) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "memory.limit")) {
+			memacctLimit = cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "msgpool.prealloc")) {
+			glblMsgPoolPrealloc = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "msgpool.hugepages")) {
+			glblMsgPoolHugePages = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "msgpool.mlock")) {
+			glblMsgPoolMlock = (int) cnfparamvals[i].val.d.n;
 		} else if(!strcmp(paramblk.descr[i].name, "debug.logfile")) {
 			if(pszAltDbgFileName == NULL) {
 				pszAltDbgFileName = es_str2cstr(cnfparamvals[i].val.d.estr, NULL);
@@ -39,6 +39,21 @@
 
 extern pid_t glbl_ourpid;
 extern int bProcessInternalMessages;
+extern int glblRegexEngine;
+extern int glblRulesetBatchExec;
+extern int glblRulesetProfile;
+extern int glblNetstrmDrvrKTLS;
+extern int glblStrmAsyncWriters;
+extern int glblParserCacheSelection;
+extern int glblCoarseClock;
+extern int glblDNSCacheTTL;
+extern int glblDNSCacheMaxEntries;
+extern int glblDNSCacheResolvers;
+extern int glblDNSCacheMaxWait;
+extern int glblRatelimitTokenBucket;
+extern int glblMsgPoolPrealloc;
+extern int glblMsgPoolHugePages;
+extern int glblMsgPoolMlock;
 extern stdlog_channel_t stdlog_hdl;
 
 /* interfaces */
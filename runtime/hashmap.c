@@ -0,0 +1,414 @@
+/* hashmap.c
+ * An open-addressing hash map for the hot lookups of the rsyslog core and
+ * plugins. In contrast to the chained hashtable (hashtable.c), there is no
+ * per-entry allocation and no pointer chasing: the stored hash values are
+ * kept in one contiguous array and the entries (value plus key) in a second
+ * one. A lookup compares the stored hash first and calls the key compare
+ * only on a full 32 bit hash match. Small fixed-size keys (like a pid) can
+ * be stored inline, which saves the key allocation as well.
+ *
+ * Collisions are resolved by Robin Hood hashing: on insert, an entry that
+ * is farther from its home slot takes the place of an entry that is closer
+ * to its own. This keeps probe sequences short, and lets a lookup for a
+ * missing key stop early. Deletion shifts the following entries back, so
+ * there are no tombstones. The load is kept at or below 50%: higher loads
+ * save little memory (a slot is just 4 bytes of hash plus value and key)
+ * but the varying probe lengths cost branch mispredictions on every lookup.
+ *
+ * The map is not thread-safe, callers must provide locking as needed.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "rsyslog.h"
+#include "hashmap.h"
+
+#define HASH_USED 0x80000000u /* stored hashes have this bit set, 0 is an empty slot */
+
+struct hashmap_s {
+	uint32_t *hashes;	/* capacity entries, 0 - slot empty */
+	uchar *entries;		/* capacity entries of entSize bytes: value ptr, then key */
+	unsigned capacity;	/* always a power of 2 */
+	unsigned count;
+	size_t keyLen;		/* 0 - pointer keys */
+	size_t entSize;
+	uchar *tmp;		/* scratch space for two entries, used by insert */
+	unsigned (*hashFn)(const void *key);
+	int (*eqFn)(const void *key1, const void *key2);
+	void (*keyDestruct)(void *key);
+	void (*valDestruct)(void *val);
+};
+
+#define ENTRY(pThis, idx) ((pThis)->entries + (size_t)(idx) * (pThis)->entSize)
+#define ENTRY_VAL(ent) (*(void**)(ent))
+#define ENTRY_KEYDATA(ent) ((ent) + sizeof(void*))
+
+
+/* return the key pointer as passed to the hash and compare functions */
+static inline const void *
+entryKey(const hashmap_t *const pThis, uchar *const ent)
+{
+	return pThis->keyLen ? (const void*) ENTRY_KEYDATA(ent) : *(void**)ENTRY_KEYDATA(ent);
+}
+
+
+/* the user's hash function need not spread the bits well (e.g. a pid is used
+ * as is), but we take the slot from the low bits. So we mix (the finalizer
+ * of MurmurHash3).
+ */
+static inline uint32_t
+hashKey(const hashmap_t *const pThis, const void *const key)
+{
+	uint32_t h;
+	size_t i;
+
+	if(pThis->hashFn != NULL) {
+		h = pThis->hashFn(key);
+	} else { /* FNV-1a over inline key bytes */
+		h = 2166136261u;
+		for(i = 0 ; i < pThis->keyLen ; ++i)
+			h = (h ^ ((const uchar*)key)[i]) * 16777619u;
+	}
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h | HASH_USED;
+}
+
+
+static inline int
+keyEquals(const hashmap_t *const pThis, const void *const key, uchar *const ent)
+{
+	if(pThis->eqFn != NULL)
+		return pThis->eqFn(key, entryKey(pThis, ent));
+	return !memcmp(key, ENTRY_KEYDATA(ent), pThis->keyLen);
+}
+
+
+/* distance of the entry in slot idx from its home slot */
+static inline unsigned
+probeDist(const hashmap_t *const pThis, const unsigned idx)
+{
+	return (idx - pThis->hashes[idx]) & (pThis->capacity - 1);
+}
+
+
+/* find the slot of key, -1 if not found */
+static inline int
+findSlot(hashmap_t *const pThis, const void *const key)
+{
+	const unsigned mask = pThis->capacity - 1;
+	const uint32_t h = hashKey(pThis, key);
+	unsigned idx = h & mask;
+	unsigned dist = 0;
+
+	while(pThis->hashes[idx] != 0 && probeDist(pThis, idx) >= dist) {
+		if(pThis->hashes[idx] == h && keyEquals(pThis, key, ENTRY(pThis, idx)))
+			return (int) idx;
+		idx = (idx + 1) & mask;
+		++dist;
+	}
+	return -1;
+}
+
+
+/* place an entry, given as hash and entry data. The data buffer is used as
+ * scratch space (it is one of the two entries of pThis->tmp). Capacity must
+ * have been checked by the caller.
+ */
+static void
+placeEntry(hashmap_t *const pThis, uint32_t h, uchar *ent)
+{
+	const unsigned mask = pThis->capacity - 1;
+	uchar *swap = (ent == pThis->tmp) ? pThis->tmp + pThis->entSize : pThis->tmp;
+	uchar *t;
+	uint32_t th;
+	unsigned idx = h & mask;
+	unsigned dist = 0;
+	unsigned d;
+
+	while(pThis->hashes[idx] != 0) {
+		d = probeDist(pThis, idx);
+		if(d < dist) { /* "rich" entry: take its place and carry it on */
+			th = pThis->hashes[idx];
+			pThis->hashes[idx] = h;
+			h = th;
+			memcpy(swap, ENTRY(pThis, idx), pThis->entSize);
+			memcpy(ENTRY(pThis, idx), ent, pThis->entSize);
+			t = ent; ent = swap; swap = t;
+			dist = d;
+		}
+		idx = (idx + 1) & mask;
+		++dist;
+	}
+	pThis->hashes[idx] = h;
+	memcpy(ENTRY(pThis, idx), ent, pThis->entSize);
+}
+
+
+/* allocate the arrays for a new capacity and move all entries over */
+static rsRetVal
+resize(hashmap_t *const pThis, const unsigned newCapacity)
+{
+	uint32_t *const oldHashes = pThis->hashes;
+	uchar *const oldEntries = pThis->entries;
+	const unsigned oldCapacity = pThis->capacity;
+	uint32_t *hashes;
+	uchar *entries = NULL;
+	unsigned i;
+	DEFiRet;
+
+	CHKmalloc(hashes = calloc(newCapacity, sizeof(uint32_t)));
+	if((entries = malloc((size_t) newCapacity * pThis->entSize)) == NULL) {
+		free(hashes);
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	pThis->hashes = hashes;
+	pThis->entries = entries;
+	pThis->capacity = newCapacity;
+	for(i = 0 ; i < oldCapacity ; ++i) {
+		if(oldHashes[i] != 0) {
+			memcpy(pThis->tmp, oldEntries + (size_t)i * pThis->entSize, pThis->entSize);
+			placeEntry(pThis, oldHashes[i], pThis->tmp);
+		}
+	}
+	free(oldHashes);
+	free(oldEntries);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* remove the entry in slot idx, shifting back the following ones */
+static void
+removeAt(hashmap_t *const pThis, unsigned idx)
+{
+	const unsigned mask = pThis->capacity - 1;
+	unsigned next;
+
+	if(pThis->keyLen == 0 && pThis->keyDestruct != NULL)
+		pThis->keyDestruct(*(void**)ENTRY_KEYDATA(ENTRY(pThis, idx)));
+	next = (idx + 1) & mask;
+	while(pThis->hashes[next] != 0 && probeDist(pThis, next) != 0) {
+		pThis->hashes[idx] = pThis->hashes[next];
+		memcpy(ENTRY(pThis, idx), ENTRY(pThis, next), pThis->entSize);
+		idx = next;
+		next = (next + 1) & mask;
+	}
+	pThis->hashes[idx] = 0;
+	--pThis->count;
+}
+
+
+rsRetVal
+hashmapConstruct(hashmap_t **ppThis, unsigned initSize, size_t keyLen,
+	unsigned (*hashFn)(const void *key), int (*eqFn)(const void *key1, const void *key2),
+	void (*keyDestruct)(void *key), void (*valDestruct)(void *val))
+{
+	hashmap_t *pThis = NULL;
+	unsigned capacity;
+	DEFiRet;
+
+	assert(keyLen > 0 || (hashFn != NULL && eqFn != NULL));
+	/* capacity for initSize entries at our max load of 50% */
+	for(capacity = 16 ; capacity < 2 * initSize && capacity < 0x40000000u ; capacity <<= 1)
+		/* just search */;
+
+	CHKmalloc(pThis = calloc(1, sizeof(hashmap_t)));
+	pThis->keyLen = keyLen;
+	pThis->entSize = sizeof(void*) + ((keyLen == 0) ? sizeof(void*)
+			 : (keyLen + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*));
+	pThis->hashFn = hashFn;
+	pThis->eqFn = eqFn;
+	pThis->keyDestruct = keyDestruct;
+	pThis->valDestruct = valDestruct;
+	CHKmalloc(pThis->tmp = malloc(2 * pThis->entSize));
+	CHKmalloc(pThis->hashes = calloc(capacity, sizeof(uint32_t)));
+	CHKmalloc(pThis->entries = malloc((size_t) capacity * pThis->entSize));
+	pThis->capacity = capacity;
+	*ppThis = pThis;
+	pThis = NULL;
+
+finalize_it:
+	if(pThis != NULL) {
+		free(pThis->hashes);
+		free(pThis->tmp);
+		free(pThis);
+	}
+	RETiRet;
+}
+
+
+void
+hashmapDestruct(hashmap_t **ppThis)
+{
+	hashmap_t *const pThis = *ppThis;
+	unsigned i;
+	uchar *ent;
+
+	if(pThis == NULL)
+		return;
+	for(i = 0 ; i < pThis->capacity ; ++i) {
+		if(pThis->hashes[i] == 0)
+			continue;
+		ent = ENTRY(pThis, i);
+		if(pThis->keyLen == 0 && pThis->keyDestruct != NULL)
+			pThis->keyDestruct(*(void**)ENTRY_KEYDATA(ent));
+		if(pThis->valDestruct != NULL)
+			pThis->valDestruct(ENTRY_VAL(ent));
+	}
+	free(pThis->hashes);
+	free(pThis->entries);
+	free(pThis->tmp);
+	free(pThis);
+	*ppThis = NULL;
+}
+
+
+void *
+hashmapSearch(hashmap_t *pThis, const void *key)
+{
+	const int idx = findSlot(pThis, key);
+	return (idx < 0) ? NULL : ENTRY_VAL(ENTRY(pThis, idx));
+}
+
+
+/* insert a new entry. The key must not already be present. */
+rsRetVal
+hashmapInsert(hashmap_t *pThis, void *key, void *val)
+{
+	DEFiRet;
+
+	if(pThis->count + 1 > pThis->capacity / 2) /* max load 50% */
+		CHKiRet(resize(pThis, pThis->capacity * 2));
+	ENTRY_VAL(pThis->tmp) = val;
+	if(pThis->keyLen == 0)
+		*(void**)ENTRY_KEYDATA(pThis->tmp) = key;
+	else
+		memcpy(ENTRY_KEYDATA(pThis->tmp), key, pThis->keyLen);
+	placeEntry(pThis, hashKey(pThis, key), pThis->tmp);
+	++pThis->count;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* remove the entry for key and return its value (NULL if not found). Pointer
+ * keys are destructed, the value is not.
+ */
+void *
+hashmapRemove(hashmap_t *pThis, const void *key)
+{
+	const int idx = findSlot(pThis, key);
+	void *val;
+
+	if(idx < 0)
+		return NULL;
+	val = ENTRY_VAL(ENTRY(pThis, idx));
+	removeAt(pThis, idx);
+	return val;
+}
+
+
+unsigned
+hashmapCount(hashmap_t *pThis)
+{
+	return pThis->count;
+}
+
+
+/* hash function for string keys (the same as hash_from_string() of the
+ * hashtable), to be passed to hashmapConstruct().
+ */
+unsigned
+hashmapHashString(const void *key)
+{
+	const uchar *p = (const uchar*) key;
+	unsigned h = 1;
+
+	while(*p)
+		h = h * 33 + *p++;
+	return h;
+}
+
+
+int
+hashmapKeyEqualsString(const void *key1, const void *key2)
+{
+	return !strcmp((const char*) key1, (const char*) key2);
+}
+
+
+unsigned
+hashmapHashStringNoCase(const void *key)
+{
+	const uchar *p = (const uchar*) key;
+	unsigned h = 1;
+
+	while(*p)
+		h = h * 33 + tolower(*p++);
+	return h;
+}
+
+
+int
+hashmapKeyEqualsStringNoCase(const void *key1, const void *key2)
+{
+	return !strcasecmp((const char*) key1, (const char*) key2);
+}
+
+
+/* call cb for each entry. If cb returns HASHMAP_REMOVE, the entry is removed
+ * from the map (the key is destructed, the value is up to cb). We start right
+ * after an empty slot: removing shifts entries back, but never across an
+ * empty slot, so each entry is visited exactly once.
+ */
+void
+hashmapIterate(hashmap_t *pThis, int (*cb)(const void *key, void *val, void *usrptr), void *usrptr)
+{
+	const unsigned mask = pThis->capacity - 1;
+	unsigned start;
+	unsigned idx;
+	uchar *ent;
+
+	for(start = 0 ; pThis->hashes[start] != 0 ; ++start)
+		/* just search - there is always an empty slot */;
+	idx = (start + 1) & mask;
+	while(idx != start) {
+		if(pThis->hashes[idx] == 0) {
+			idx = (idx + 1) & mask;
+			continue;
+		}
+		ent = ENTRY(pThis, idx);
+		if(cb(entryKey(pThis, ent), ENTRY_VAL(ent), usrptr) == HASHMAP_REMOVE)
+			removeAt(pThis, idx); /* check idx again, a following entry may be there now */
+		else
+			idx = (idx + 1) & mask;
+	}
+}
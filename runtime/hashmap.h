@@ -0,0 +1,56 @@
+/* hashmap.h
+ * An open-addressing hash map (Robin Hood hashing with backward shift
+ * deletion). See hashmap.c for details.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_HASHMAP_H
+#define INCLUDED_HASHMAP_H
+#include <stdint.h>
+
+typedef struct hashmap_s hashmap_t;
+
+/* return values of the hashmapIterate() callback */
+#define HASHMAP_KEEP	0
+#define HASHMAP_REMOVE	1
+
+/* keyLen > 0 selects inline keys: keyLen bytes are copied into the map on
+ * insert. hashFn and eqFn may then be NULL, in which case the key bytes are
+ * hashed and compared. keyLen == 0 selects pointer keys: the map stores the
+ * pointer and keyDestruct (if not NULL) is called when the entry is removed.
+ * hashFn and eqFn are required in that case. valDestruct (if not NULL) is
+ * called for all values still inside the map on destruction.
+ */
+rsRetVal hashmapConstruct(hashmap_t **ppThis, unsigned initSize, size_t keyLen,
+	unsigned (*hashFn)(const void *key), int (*eqFn)(const void *key1, const void *key2),
+	void (*keyDestruct)(void *key), void (*valDestruct)(void *val));
+void hashmapDestruct(hashmap_t **ppThis);
+void *hashmapSearch(hashmap_t *pThis, const void *key);
+rsRetVal hashmapInsert(hashmap_t *pThis, void *key, void *val);
+void *hashmapRemove(hashmap_t *pThis, const void *key);
+unsigned hashmapCount(hashmap_t *pThis);
+void hashmapIterate(hashmap_t *pThis, int (*cb)(const void *key, void *val, void *usrptr), void *usrptr);
+/* hash and compare functions for pointer keys that are C strings */
+unsigned hashmapHashString(const void *key);
+int hashmapKeyEqualsString(const void *key1, const void *key2);
+/* the same, but case-insensitive (ASCII) */
+unsigned hashmapHashStringNoCase(const void *key);
+int hashmapKeyEqualsStringNoCase(const void *key1, const void *key2);
+
+#endif /* #ifndef INCLUDED_HASHMAP_H */
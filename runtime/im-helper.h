@@ -27,11 +27,109 @@
  */
 #ifndef	IM_HELPER_H_INCLUDED
 #define	IM_HELPER_H_INCLUDED 1
+#include <sys/time.h>
+#include "dirty.h"
+#include "ratelimit.h"
 
 
+/* Input-side batching. Inputs usually obtain several messages at once, e.g.
+ * with a single read(). Submitting them one by one means one enqueue (and
+ * possibly one wakeup of the queue workers) per message. An imBatch_t
+ * collects messages and submits them to the queue as a single batch when
+ * - it is full (count bound),
+ * - its first message is waiting for longer than iMaxDelay ms (time bound),
+ * - the input calls imBatchFlush(). This MUST be done before the input
+ *   blocks waiting for new data, as messages are held back otherwise.
+ * An imBatch_t must only be used by a single thread.
+ */
+#define IM_BATCH_DFLT_DELAY 100	/* default time bound in ms */
+
+typedef struct imBatch_s {
+	multi_submit_t multiSub;
+	int iMaxDelay;		/* max ms the first message may wait, 0 - no time bound */
+	long long tFirst;	/* ms, time the first message of the batch was added */
+} imBatch_t;
+
+static inline long long
+imBatchTimeMs(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static inline rsRetVal
+imBatchConstruct(imBatch_t *const pBatch, const int nMaxElem, const int iMaxDelay)
+{
+	DEFiRet;
+	CHKmalloc(pBatch->multiSub.ppMsgs = MALLOC(nMaxElem * sizeof(msg_t*)));
+	pBatch->multiSub.maxElem = nMaxElem;
+	pBatch->multiSub.nElem = 0;
+	pBatch->iMaxDelay = iMaxDelay;
+	pBatch->tFirst = 0;
+finalize_it:
+	RETiRet;
+}
+
+/* submit all messages collected so far */
+static inline rsRetVal
+imBatchFlush(imBatch_t *const pBatch)
+{
+	return multiSubmitFlush(&pBatch->multiSub);
+}
+
+/* flush and free the batch. May be called on a batch that was not (or not
+ * successfully) constructed, if it was zeroed before.
+ */
+static inline void
+imBatchDestruct(imBatch_t *const pBatch)
+{
+	if(pBatch->multiSub.ppMsgs == NULL)
+		return;
+	multiSubmitFlush(&pBatch->multiSub);
+	free(pBatch->multiSub.ppMsgs);
+	pBatch->multiSub.ppMsgs = NULL;
+}
+
+/* add a message to the batch. If ratelimiter is non-NULL, the message is
+ * rate-limited by it (the "messages lost" message is added to the batch as
+ * well).
+ */
+static inline rsRetVal
+imBatchAdd(imBatch_t *const pBatch, ratelimit_t *const ratelimiter, msg_t *const pMsg)
+{
+	multi_submit_t *const pMultiSub = &pBatch->multiSub;
+	const int nPrev = pMultiSub->nElem;
+	long long tNow;
+	DEFiRet;
+
+	if(ratelimiter == NULL) {
+		pMultiSub->ppMsgs[pMultiSub->nElem++] = pMsg;
+		if(pMultiSub->nElem == pMultiSub->maxElem)
+			CHKiRet(multiSubmitMsg2(pMultiSub));
+	} else {
+		CHKiRet(ratelimitAddMsg(ratelimiter, pMultiSub, pMsg));
+	}
+
+	if(pBatch->iMaxDelay > 0 && pMultiSub->nElem > 0) {
+		tNow = imBatchTimeMs();
+		if(nPrev == 0 || pMultiSub->nElem <= nPrev) {
+			pBatch->tFirst = tNow; /* a new batch was begun */
+		} else if(tNow - pBatch->tFirst >= pBatch->iMaxDelay || tNow < pBatch->tFirst) {
+			CHKiRet(multiSubmitMsg2(pMultiSub));
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+#ifndef IM_HELPER_NO_INSTANCES
 /* The following function provides a complete implementation to check a
  * ruleset and set the actual ruleset pointer. The macro assumes that
- * standard field names are used. A functon std_checkRuleset_genErrMsg()
+ * standard field names are used. Modules without instanceConf_t must
+ * define IM_HELPER_NO_INSTANCES before including this file. A functon std_checkRuleset_genErrMsg()
  * must be defined to generate error messages in case the ruleset cannot
  * be found.
  */
@@ -58,6 +156,7 @@ std_checkRuleset(modConfData_t *modConf, instanceConf_t *inst)
 finalize_it:
 	RETiRet;
 }
+#endif /* #ifndef IM_HELPER_NO_INSTANCES */
 
 #endif /* #ifndef IM_HELPER_H_INCLUDED */
 
@@ -8,11 +8,13 @@
  * records:
  * IV:<hex>   The initial vector used at block start. Also indicates start
  *            start of block.
+ * TAG:<hex>  The authentication tag of the block (GCM mode only). It is
+ *            written immediately before the END record.
  * END:<int>  The end offset of the block, as uint64_t in decimal notation.
  *            This is used during encryption to know when the current
  *            encryption block ends.
  * For the current implementation, there must always be an IV record
- * followed by an END record. Each records is LF-terminated. Record
+ * followed by an optional TAG and an END record. Each records is LF-terminated. Record
  * types can simply be extended in the future by specifying new 
  * types (like "IV") before the colon.
  * To identify a file as rsyslog encryption info file, it must start with
@@ -195,26 +197,21 @@ finalize_it:
 	RETiRet;
 }
 
+/* convert the hex string value of record rectype to binary. The
+ * value must be exactly lenbin bytes long.
+ */
 static rsRetVal
-eiGetIV(gcryfile gf, uchar *iv, size_t leniv)
+eiHex2Bin(char *rectype, char *value, uchar *bin, size_t lenbin)
 {
-	char rectype[EIF_MAX_RECTYPE_LEN+1];
-	char value[EIF_MAX_VALUE_LEN+1];
 	size_t valueLen;
 	unsigned short i, j;
 	unsigned char nibble;
 	DEFiRet;
 
-	CHKiRet(eiGetRecord(gf, rectype, value));
-	if(strcmp(rectype, "IV")) {
-		DBGPRINTF("no IV record found when expected, record type "
-			"seen is '%s'\n", rectype);
-		ABORT_FINALIZE(RS_RET_ERR);
-	}
 	valueLen = strlen(value);
-	if(valueLen/2 != leniv) {
-		DBGPRINTF("length of IV is %zd, expected %zd\n",
-			valueLen/2, leniv);
+	if(valueLen/2 != lenbin) {
+		DBGPRINTF("length of %s is %zd, expected %zd\n",
+			rectype, valueLen/2, lenbin);
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
 
@@ -224,18 +221,36 @@ eiGetIV(gcryfile gf, uchar *iv, size_t leniv)
 		else if(value[i] >= 'a' && value[i] <= 'f')
 			nibble = value[i] - 'a' + 10;
 		else {
-			DBGPRINTF("invalid IV '%s'\n", value);
+			DBGPRINTF("invalid %s '%s'\n", rectype, value);
 			ABORT_FINALIZE(RS_RET_ERR);
 		}
 		if(i % 2 == 0)
-			iv[j] = nibble << 4;
+			bin[j] = nibble << 4;
 		else
-			iv[j++] |= nibble;
+			bin[j++] |= nibble;
 	}
 finalize_it:
 	RETiRet;
 }
 
+static rsRetVal
+eiGetIV(gcryfile gf, uchar *iv, size_t leniv)
+{
+	char rectype[EIF_MAX_RECTYPE_LEN+1];
+	char value[EIF_MAX_VALUE_LEN+1];
+	DEFiRet;
+
+	CHKiRet(eiGetRecord(gf, rectype, value));
+	if(strcmp(rectype, "IV")) {
+		DBGPRINTF("no IV record found when expected, record type "
+			"seen is '%s'\n", rectype);
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	CHKiRet(eiHex2Bin(rectype, value, iv, leniv));
+finalize_it:
+	RETiRet;
+}
+
 static rsRetVal
 eiGetEND(gcryfile gf, off64_t *offs)
 {
@@ -244,6 +259,12 @@ eiGetEND(gcryfile gf, off64_t *offs)
 	DEFiRet;
 
 	CHKiRet(eiGetRecord(gf, rectype, value));
+	if(!strcmp(rectype, "TAG")) {
+		if(gf->tag == NULL)
+			CHKmalloc(gf->tag = malloc(RSGCRY_TAG_LEN));
+		CHKiRet(eiHex2Bin(rectype, value, gf->tag, RSGCRY_TAG_LEN));
+		CHKiRet(eiGetRecord(gf, rectype, value));
+	}
 	if(strcmp(rectype, "END")) {
 		DBGPRINTF("no END record found when expected, record type "
 			  "seen is '%s'\n", rectype);
@@ -286,7 +307,7 @@ finalize_it:
 }
 
 static rsRetVal
-eiWriteIV(gcryfile gf, uchar *iv)
+eiWriteHexRec(gcryfile gf, char *recHdr, size_t lenRecHdr, uchar *bin, size_t lenbin)
 {
 	static const char hexchars[16] =
 	   {'0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f'};
@@ -294,18 +315,52 @@ eiWriteIV(gcryfile gf, uchar *iv)
 	char hex[4096];
 	DEFiRet;
 
-	if(gf->blkLength > sizeof(hex)/2) {
-		DBGPRINTF("eiWriteIV: crypto block len way too large, aborting "
-			  "write");
+	if(lenbin > sizeof(hex)/2) {
+		DBGPRINTF("eiWriteHexRec: %s value way too large, aborting "
+			  "write", recHdr);
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
 
-	for(iSrc = iDst = 0 ; iSrc < gf->blkLength ; ++iSrc) {
-		hex[iDst++] = hexchars[iv[iSrc]>>4];
-		hex[iDst++] = hexchars[iv[iSrc]&0x0f];
+	for(iSrc = iDst = 0 ; iSrc < lenbin ; ++iSrc) {
+		hex[iDst++] = hexchars[bin[iSrc]>>4];
+		hex[iDst++] = hexchars[bin[iSrc]&0x0f];
 	}
 
-	iRet = eiWriteRec(gf, "IV:", 3, hex, gf->blkLength*2);
+	iRet = eiWriteRec(gf, recHdr, lenRecHdr, hex, lenbin*2);
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+eiWriteIV(gcryfile gf, uchar *iv)
+{
+	return eiWriteHexRec(gf, "IV:", 3, iv, gf->blkLength);
+}
+
+/* write the authentication tag of the current block, if the mode
+ * provides one. Must be called after the last data of the block has
+ * been encrypted.
+ */
+static rsRetVal
+eiWriteTag(gcryfile gf)
+{
+	uchar tag[RSGCRY_TAG_LEN];
+#	ifdef RSGCRY_HAVE_GCM
+	gcry_error_t gcryError;
+#	endif
+	DEFiRet;
+
+	if(!rsgcryModeHasTag(gf->ctx->mode))
+		FINALIZE;
+#	ifdef RSGCRY_HAVE_GCM
+	gcryError = gcry_cipher_gettag(gf->chd, tag, sizeof(tag));
+	if(gcryError) {
+		DBGPRINTF("gcry_cipher_gettag failed:  %s/%s\n",
+			gcry_strsource(gcryError), gcry_strerror(gcryError));
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+#	endif
+	iRet = eiWriteHexRec(gf, "TAG:", 4, tag, sizeof(tag));
 finalize_it:
 	RETiRet;
 }
@@ -323,10 +378,13 @@ eiClose(gcryfile gf, off64_t offsLogfile)
 	if(gf->openMode == 'w') {
 		/* 2^64 is 20 digits, so the snprintf buffer is large enough */
 		len = snprintf(offs, sizeof(offs), "%lld", (long long) offsLogfile);
+		eiWriteTag(gf);
 		eiWriteRec(gf, "END:", 4, offs, len);
 	}
 	gcry_cipher_close(gf->chd);
 	free(gf->readBuf);
+	free(gf->tag);
+	gf->tag = NULL;
 	close(gf->fd);
 	gf->fd = -1;
 	DBGPRINTF("encryption info file %s: closed\n", gf->eiName);
@@ -343,6 +401,8 @@ gcryfileGetBytesLeftInBlock(gcryfile gf, ssize_t *left)
 	if(gf->bytesToBlkEnd == 0) {
 		DBGPRINTF("libgcry: end of current crypto block\n");
 		gcry_cipher_close(gf->chd);
+		free(gf->tag);
+		gf->tag = NULL;
 		CHKiRet(rsgcryBlkBegin(gf));
 	}
 	*left = gf->bytesToBlkEnd;
@@ -617,7 +677,11 @@ rsgcryBlkBegin(gcryfile gf)
 		seedIV(gf, &iv);
 	}
 
-	gcryError = gcry_cipher_setiv(gf->chd, iv, gf->blkLength);
+	/* for CTR, libgcrypt ignores the IV - the counter must be set */
+	if(gf->ctx->mode == GCRY_CIPHER_MODE_CTR)
+		gcryError = gcry_cipher_setctr(gf->chd, iv, gf->blkLength);
+	else
+		gcryError = gcry_cipher_setiv(gf->chd, iv, gf->blkLength);
 	if (gcryError) {
 		DBGPRINTF("gcry_cipher_setiv failed:  %s/%s\n",
 			gcry_strsource(gcryError), gcry_strerror(gcryError));
@@ -642,6 +706,7 @@ rsgcryInitCrypt(gcryctx ctx, gcryfile *pgf, uchar *fname, char openMode)
 	CHKiRet(gcryfileConstruct(ctx, &gf, fname));
 	gf->openMode = openMode;
 	gf->blkLength = gcry_cipher_get_algo_blklen(ctx->algo);
+	gf->bStreamMode = rsgcryModeIsStream(ctx->mode);
 	CHKiRet(rsgcryBlkBegin(gf));
 	*pgf = gf;
 finalize_it:
@@ -659,7 +724,8 @@ rsgcryEncrypt(gcryfile pF, uchar *buf, size_t *len)
 	if(*len == 0)
 		FINALIZE;
 
-	addPadding(pF, buf, len);
+	if(!pF->bStreamMode)
+		addPadding(pF, buf, len);
 	gcryError = gcry_cipher_encrypt(pF->chd, buf, *len, NULL, 0);
 	if(gcryError) {
 		dbgprintf("gcry_cipher_encrypt failed:  %s/%s\n",
@@ -691,7 +757,19 @@ rsgcryDecrypt(gcryfile pF, uchar *buf, size_t *len)
 			gcry_strerror(gcryError));
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
-	removePadding(buf, len);
+	if(pF->bytesToBlkEnd == 0 && pF->tag != NULL) {
+#		ifdef RSGCRY_HAVE_GCM
+		gcryError = gcry_cipher_checktag(pF->chd, pF->tag, RSGCRY_TAG_LEN);
+		if(gcryError) {
+			DBGPRINTF("libgcry: crypto block authentication failed:  %s/%s\n",
+				gcry_strsource(gcryError),
+				gcry_strerror(gcryError));
+			ABORT_FINALIZE(RS_RET_CRY_AUTH_FAIL);
+		}
+#		endif
+	}
+	if(!pF->bStreamMode)
+		removePadding(buf, len);
 	// TODO: remove dbgprintf once things are sufficently stable -- rgerhards, 2013-05-16
 	dbgprintf("libgcry: decrypted, bytesToBlkEnd %lld, buffer is now '%50.50s'\n", (long long) pF->bytesToBlkEnd, buf);
 
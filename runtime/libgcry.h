@@ -23,6 +23,11 @@
 #include <stdint.h>
 #include <gcrypt.h>
 
+/* GCM (and gcry_cipher_gettag/checktag) were introduced in libgcrypt 1.6 */
+#if GCRYPT_VERSION_NUMBER >= 0x010600
+#	define RSGCRY_HAVE_GCM 1
+#endif
+
 struct gcryctx_s {
 	uchar *key;
 	size_t keyLen;
@@ -44,6 +49,8 @@ struct gcryfile_s {
 	int16_t readBufIdx;
 	int16_t readBufMaxIdx;
 	int8_t bDeleteOnClose; /* for queue support, similar to stream subsys */
+	int8_t bStreamMode; /* cipher mode works on any length, no padding needed */
+	uchar *tag; /* read mode: expected auth tag of current block, NULL if none */
 	ssize_t bytesToBlkEnd; /* number of bytes remaining in current crypto block
 				-1 means -> no end (still being writen to, queue files),
 				0 means -> end of block, new one must be started. */
@@ -69,6 +76,7 @@ rsRetVal gcryfileGetBytesLeftInBlock(gcryfile gf, ssize_t *left);
 #define RSGCRYE_EI_OPEN 1 	/* error opening .encinfo file */
 #define RSGCRYE_OOM 4	/* ran out of memory */
 
+#define RSGCRY_TAG_LEN 16 /* length of the GCM authentication tag */
 #define EIF_MAX_RECTYPE_LEN 31 /* max length of record types */
 #define EIF_MAX_VALUE_LEN 1023 /* max length of value types */
 #define RSGCRY_FILETYPE_NAME "rsyslog-enrcyption-info"
@@ -113,9 +121,41 @@ rsgcryModename2Mode(char *modename) {
 	if(!strcmp((char*)modename, "STREAM")) return GCRY_CIPHER_MODE_STREAM;
 	if(!strcmp((char*)modename, "OFB")) return GCRY_CIPHER_MODE_OFB;
 	if(!strcmp((char*)modename, "CTR")) return GCRY_CIPHER_MODE_CTR;
+#	ifdef RSGCRY_HAVE_GCM
+	if(!strcmp((char*)modename, "GCM")) return GCRY_CIPHER_MODE_GCM;
+#	endif
 #	ifdef GCRY_CIPHER_MODE_AESWRAP
 	if(!strcmp((char*)modename, "AESWRAP")) return GCRY_CIPHER_MODE_AESWRAP;
 #	endif
 	return GCRY_CIPHER_MODE_NONE;
 }
+
+/* modes which can encrypt data of any length, so there is no need
+ * to pad the data to the cipher block length.
+ */
+static inline int
+rsgcryModeIsStream(int mode) {
+	switch(mode) {
+	case GCRY_CIPHER_MODE_CFB:
+	case GCRY_CIPHER_MODE_STREAM:
+	case GCRY_CIPHER_MODE_OFB:
+	case GCRY_CIPHER_MODE_CTR:
+#	ifdef RSGCRY_HAVE_GCM
+	case GCRY_CIPHER_MODE_GCM:
+#	endif
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* modes which provide an authentication tag per crypto block */
+static inline int
+rsgcryModeHasTag(int __attribute__((unused)) mode) {
+#	ifdef RSGCRY_HAVE_GCM
+	return mode == GCRY_CIPHER_MODE_GCM;
+#	else
+	return 0;
+#	endif
+}
 #endif  /* #ifndef INCLUDED_LIBGCRY_H */
@@ -249,6 +249,9 @@ Decrypt(void *pF, uchar *rec, size_t *lenRec)
 {
 	DEFiRet;
 	iRet = rsgcryDecrypt(pF, rec, lenRec);
+	if(iRet == RS_RET_CRY_AUTH_FAIL)
+		errmsg.LogError(0, iRet, "lmcry_gcry: encrypted data failed "
+			"authentication - file was modified or is corrupt");
 
 	RETiRet;
 }
@@ -26,6 +26,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "module-template.h"
 #include "glbl.h"
@@ -47,7 +48,8 @@ static struct cnfparamdescr cnfpdescr[] = {
 	{ "sig.timestampservice", eCmdHdlrGetWord, 0 },
 	{ "sig.block.sizelimit", eCmdHdlrSize, 0 },
 	{ "sig.keeprecordhashes", eCmdHdlrBinary, 0 },
-	{ "sig.keeptreehashes", eCmdHdlrBinary, 0 }
+	{ "sig.keeptreehashes", eCmdHdlrBinary, 0 },
+	{ "sig.queue.size", eCmdHdlrPositiveInt, 0 }
 };
 static struct cnfparamblk pblk =
 	{ CNFPARAMBLK_VERSION,
@@ -56,6 +58,21 @@ static struct cnfparamblk pblk =
 	};
 
 
+/* requests for the signer thread */
+#define SIGREQ_OPEN	0
+#define SIGREQ_RECORD	1
+#define SIGREQ_CLOSE	2
+#define SIGQUEUE_DFLT_SIZE 10000
+
+struct lmsig_gt_req_s {
+	lmsig_gt_req_t *next;
+	lmsig_gt_file_t *pFile;
+	int type;
+	size_t len;
+	uchar data[];		/* record or, for SIGREQ_OPEN, file name */
+};
+
+
 static void
 errfunc(__attribute__((unused)) void *usrptr, uchar *emsg)
 {
@@ -68,16 +85,155 @@ errfunc(__attribute__((unused)) void *usrptr, uchar *emsg)
 BEGINobjConstruct(lmsig_gt)
 	pThis->ctx = rsgtCtxNew();
 	rsgtsetErrFunc(pThis->ctx, errfunc, NULL);
+	pthread_mutex_init(&pThis->mut, NULL);
+	pthread_cond_init(&pThis->condWork, NULL);
+	pthread_cond_init(&pThis->condSpace, NULL);
+	pThis->maxQueued = SIGQUEUE_DFLT_SIZE;
 ENDobjConstruct(lmsig_gt)
 
 
-/* destructor for the lmsig_gt object */
+/* destructor for the lmsig_gt object. The signer thread finishes all
+ * outstanding requests before it terminates.
+ */
 BEGINobjDestruct(lmsig_gt) /* be sure to specify the object type also in END and CODESTART macros! */
 CODESTARTobjDestruct(lmsig_gt)
+	if(pThis->bThrdStarted) {
+		pthread_mutex_lock(&pThis->mut);
+		pThis->bShutdown = 1;
+		pthread_cond_signal(&pThis->condWork);
+		pthread_mutex_unlock(&pThis->mut);
+		pthread_join(pThis->tid, NULL);
+	}
+	pthread_cond_destroy(&pThis->condWork);
+	pthread_cond_destroy(&pThis->condSpace);
+	pthread_mutex_destroy(&pThis->mut);
 	rsgtCtxDel(pThis->ctx);
 ENDobjDestruct(lmsig_gt)
 
 
+/* carry out a single request. Only called by the signer thread (or
+ * in sync mode with the mutex held), so requests are serialized.
+ * Note: we assume that the record is terminated by a \n.
+ * As of the GuardTime paper, \n is not part of the signed
+ * message, so the caller already subtracted one from the record size.
+ */
+static void
+processReq(lmsig_gt_t *pThis, lmsig_gt_req_t *req)
+{
+	switch(req->type) {
+	case SIGREQ_OPEN:
+		/* note: if gf is set to NULL, this auto-disables GT functions */
+		req->pFile->gf = rsgtCtxOpenFile(pThis->ctx, req->data);
+		sigblkInit(req->pFile->gf);
+		break;
+	case SIGREQ_RECORD:
+		sigblkAddRecord(req->pFile->gf, req->data, req->len);
+		break;
+	case SIGREQ_CLOSE:
+		rsgtfileDestruct(req->pFile->gf);
+		free(req->pFile);
+		break;
+	default:
+		DBGPRINTF("lmsig_gt: program error, invalid request type %d\n", req->type);
+		break;
+	}
+}
+
+
+/* the signer thread. It takes all queued requests at once and then
+ * processes them without holding the mutex.
+ */
+static void *
+signerThread(void *arg)
+{
+	lmsig_gt_t *pThis = (lmsig_gt_t*) arg;
+	lmsig_gt_req_t *batch;
+	lmsig_gt_req_t *req;
+	unsigned nRecs;
+
+	pthread_mutex_lock(&pThis->mut);
+	while(1) {
+		while(pThis->reqRoot == NULL && !pThis->bShutdown)
+			pthread_cond_wait(&pThis->condWork, &pThis->mut);
+		if(pThis->reqRoot == NULL)
+			break; /* shutdown requested and nothing left to do */
+		batch = pThis->reqRoot;
+		pThis->reqRoot = pThis->reqLast = NULL;
+		pthread_mutex_unlock(&pThis->mut);
+
+		nRecs = 0;
+		while(batch != NULL) {
+			req = batch;
+			batch = req->next;
+			if(req->type == SIGREQ_RECORD)
+				++nRecs;
+			processReq(pThis, req);
+			free(req);
+		}
+
+		pthread_mutex_lock(&pThis->mut);
+		pThis->nQueued -= nRecs;
+		pthread_cond_broadcast(&pThis->condSpace);
+	}
+	pthread_mutex_unlock(&pThis->mut);
+	return NULL;
+}
+
+
+/* hand a request over to the signer thread. The thread is started on
+ * the first request. If that fails, we fall back to processing requests
+ * inline (as it was done before the signer thread was introduced).
+ */
+static rsRetVal
+sigEnqueue(lmsig_gt_t *pThis, lmsig_gt_file_t *pFile, int type, const uchar *data, size_t len)
+{
+	lmsig_gt_req_t *req;
+	int r;
+	DEFiRet;
+
+	CHKmalloc(req = malloc(sizeof(lmsig_gt_req_t) + len + 1));
+	req->next = NULL;
+	req->pFile = pFile;
+	req->type = type;
+	req->len = len;
+	if(len > 0)
+		memcpy(req->data, data, len);
+	req->data[len] = '\0';
+
+	pthread_mutex_lock(&pThis->mut);
+	if(!pThis->bThrdStarted && !pThis->bSync) {
+		if((r = pthread_create(&pThis->tid, NULL, signerThread, pThis)) == 0) {
+			pThis->bThrdStarted = 1;
+		} else {
+			errmsg.LogError(r, RS_RET_SIGPROV_ERR, "lmsig_gt: could not start "
+				"signer thread, signing inline");
+			pThis->bSync = 1;
+		}
+	}
+	if(pThis->bSync) {
+		processReq(pThis, req);
+		free(req);
+	} else {
+		if(type == SIGREQ_RECORD) {
+			while(pThis->nQueued >= pThis->maxQueued)
+				pthread_cond_wait(&pThis->condSpace, &pThis->mut);
+			++pThis->nQueued;
+		}
+		if(pThis->reqRoot == NULL) {
+			pThis->reqRoot = req;
+			pthread_cond_signal(&pThis->condWork);
+		} else {
+			pThis->reqLast->next = req;
+		}
+		pThis->reqLast = req;
+	}
+	pthread_mutex_unlock(&pThis->mut);
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* apply all params from param block to us. This must be called
  * after construction, but before the OnFileOpen() entry point.
  * Defaults are expected to have been set during construction.
@@ -119,6 +275,8 @@ SetCnfParam(void *pT, struct nvlst *lst)
 			rsgtSetKeepRecordHashes(pThis->ctx, pvals[i].val.d.n);
 		} else if(!strcmp(pblk.descr[i].name, "sig.keeptreehashes")) {
 			rsgtSetKeepTreeHashes(pThis->ctx, pvals[i].val.d.n);
+		} else if(!strcmp(pblk.descr[i].name, "sig.queue.size")) {
+			pThis->maxQueued = (unsigned) pvals[i].val.d.n;
 		} else {
 			DBGPRINTF("lmsig_gt: program error, non-handled "
 			  "param '%s'\n", pblk.descr[i].name);
@@ -131,16 +289,26 @@ finalize_it:
 }
 
 
+/* Note: the signature file is opened by the signer thread, as a file
+ * may be re-opened while its previous close is still queued.
+ */
 static rsRetVal
 OnFileOpen(void *pT, uchar *fn, void *pGF)
 {
 	lmsig_gt_t *pThis = (lmsig_gt_t*) pT;
-	gtfile *pgf = (gtfile*) pGF;
+	lmsig_gt_file_t **ppFile = (lmsig_gt_file_t**) pGF;
+	lmsig_gt_file_t *pFile;
 	DEFiRet;
 	DBGPRINTF("lmsig_gt: onFileOpen: %s\n", fn);
-	/* note: if *pgf is set to NULL, this auto-disables GT functions */
-	*pgf = rsgtCtxOpenFile(pThis->ctx, fn);
-	sigblkInit(*pgf);
+	*ppFile = NULL; /* this auto-disables GT functions */
+	CHKmalloc(pFile = calloc(1, sizeof(lmsig_gt_file_t)));
+	pFile->pSig = pThis;
+	if((iRet = sigEnqueue(pThis, pFile, SIGREQ_OPEN, fn, strlen((char*)fn))) != RS_RET_OK) {
+		free(pFile);
+		FINALIZE;
+	}
+	*ppFile = pFile;
+finalize_it:
 	RETiRet;
 }
 
@@ -155,20 +323,28 @@ OnFileOpen(void *pT, uchar *fn, void *pGF)
 static rsRetVal
 OnRecordWrite(void *pF, uchar *rec, rs_size_t lenRec)
 {
+	lmsig_gt_file_t *pFile = (lmsig_gt_file_t*) pF;
 	DEFiRet;
 	DBGPRINTF("lmsig_gt: onRecordWrite (%d): %s\n", lenRec-1, rec);
-	sigblkAddRecord(pF, rec, lenRec-1);
+	if(pFile == NULL || lenRec < 1)
+		FINALIZE;
+	iRet = sigEnqueue(pFile->pSig, pFile, SIGREQ_RECORD, rec, lenRec-1);
 
+finalize_it:
 	RETiRet;
 }
 
 static rsRetVal
 OnFileClose(void *pF)
 {
+	lmsig_gt_file_t *pFile = (lmsig_gt_file_t*) pF;
 	DEFiRet;
 	DBGPRINTF("lmsig_gt: onFileClose\n");
-	rsgtfileDestruct(pF);
+	if(pFile == NULL)
+		FINALIZE;
+	iRet = sigEnqueue(pFile->pSig, pFile, SIGREQ_CLOSE, NULL, 0);
 
+finalize_it:
 	RETiRet;
 }
 
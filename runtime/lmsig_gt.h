@@ -20,6 +20,7 @@
  */
 #ifndef INCLUDED_LMSIG_GT_H
 #define INCLUDED_LMSIG_GT_H
+#include <pthread.h>
 #include "sigprov.h"
 #include "librsgt.h"
 
@@ -27,12 +28,39 @@
 #define lmsig_gtCURR_IF_VERSION sigprovCURR_IF_VERSION
 typedef sigprov_if_t lmsig_gt_if_t;
 
-/* the lmsig_gt object */
+typedef struct lmsig_gt_s lmsig_gt_t;
+typedef struct lmsig_gt_req_s lmsig_gt_req_t;
+
+/* per-file data, this is what omfile receives as file instance data.
+ * gf is only accessed by the signer thread.
+ */
+typedef struct lmsig_gt_file_s {
+	lmsig_gt_t *pSig;
+	gtfile gf;
+} lmsig_gt_file_t;
+
+/* the lmsig_gt object
+ * Hashing, tree building and timestamping is done by a signer thread, so
+ * that file writes do not wait for the timestamping service. Writers
+ * queue requests (file open, record, file close), which the signer
+ * processes in order and in batches. The number of queued records is
+ * bounded, writers block if the signer falls too far behind.
+ */
 struct lmsig_gt_s {
 	BEGINobjInstance; /* Data to implement generic object - MUST be the first data element! */
 	gtctx ctx;	/* librsgt context - contains all we need */
+	pthread_mutex_t mut;
+	pthread_cond_t condWork;	/* signaled when requests are queued */
+	pthread_cond_t condSpace;	/* signaled when the signer processed requests */
+	lmsig_gt_req_t *reqRoot;
+	lmsig_gt_req_t *reqLast;
+	unsigned nQueued;		/* queued records, including the batch in processing */
+	unsigned maxQueued;
+	sbool bThrdStarted;
+	sbool bSync;			/* no signer thread, process requests inline */
+	sbool bShutdown;
+	pthread_t tid;
 };
-typedef struct lmsig_gt_s lmsig_gt_t;
 
 /* prototypes */
 PROTOTYPEObj(lmsig_gt);
@@ -23,8 +23,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <json.h>
 #include <assert.h>
@@ -33,10 +36,12 @@
 #include "srUtils.h"
 #include "errmsg.h"
 #include "lookup.h"
+#include "lookupbin.h"
 #include "msg.h"
 #include "rsconf.h"
 #include "dirty.h"
 #include "unicode-helper.h"
+#include "atomic.h"
 
 /* definitions for objects we access */
 DEFobjStaticHelpers
@@ -44,7 +49,8 @@ DEFobjCurrIf(errmsg)
 DEFobjCurrIf(glbl)
 
 /* forward definitions */
-static rsRetVal lookupReadFile(lookup_t *pThis);
+static rsRetVal lookupReadFile(lookup_t *pThis, lookup_tab_t **ppTab);
+static void lookupTabDestruct(lookup_tab_t *pTab);
 
 /* static data */
 /* tables for interfacing with the v6 config system (as far as we need to) */
@@ -58,6 +64,92 @@ static struct cnfparamblk modpblk =
 	  modpdescr
 	};
 
+#ifdef HAVE_ATOMIC_BUILTINS
+/* Lookups do not lock. A reload builds the new table, publishes it by
+ * replacing the table pointer and frees the old table only after a grace
+ * period, that is after every lookup that may still use it has finished.
+ * To know when this is the case, each thread doing lookups has a reader
+ * slot with a counter that it increments on entry to and exit from a
+ * lookup (so it is odd while inside). The grace period is over as soon as
+ * every counter that was odd at the time of publishing has changed. Only
+ * the owning thread writes its slot, so lookups from many workers do not
+ * fight over a shared cache line like they did with the rwlock.
+ */
+typedef struct lookupReader_s lookupReader_t;
+struct lookupReader_s {
+	volatile unsigned seq;	/* odd while inside a lookup */
+	lookupReader_t *next;
+	char pad[64];	/* keeps the counters of different threads on different cache lines */
+};
+static pthread_key_t keyReader;
+static sbool bReaderKeyActive = 0;
+static pthread_mutex_t mutReaders = PTHREAD_MUTEX_INITIALIZER;
+static lookupReader_t *readers = NULL;	/* all registered reader slots */
+
+
+/* called on thread exit */
+static void
+readerDestruct(void *p)
+{
+	lookupReader_t *const rdr = (lookupReader_t*) p;
+	lookupReader_t **pp;
+
+	pthread_mutex_lock(&mutReaders);
+	for(pp = &readers ; *pp != NULL ; pp = &(*pp)->next) {
+		if(*pp == rdr) {
+			*pp = rdr->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mutReaders);
+	free(rdr);
+}
+
+
+/* get the reader slot of the current thread, register one on first use.
+ * Returns NULL if we are out of memory.
+ */
+static inline lookupReader_t *
+getReader(void)
+{
+	lookupReader_t *rdr;
+
+	if((rdr = pthread_getspecific(keyReader)) != NULL)
+		return rdr;
+	if((rdr = calloc(1, sizeof(lookupReader_t))) == NULL)
+		return NULL;
+	if(pthread_setspecific(keyReader, rdr) != 0) {
+		free(rdr);
+		return NULL;
+	}
+	pthread_mutex_lock(&mutReaders);
+	rdr->next = readers;
+	readers = rdr;
+	pthread_mutex_unlock(&mutReaders);
+	return rdr;
+}
+
+
+/* wait until no lookup can still use a table that has been replaced
+ * before this call.
+ */
+static void
+waitGracePeriod(void)
+{
+	lookupReader_t *rdr;
+	unsigned seq;
+
+	pthread_mutex_lock(&mutReaders);
+	ATOMIC_MEMORY_BARRIER(); /* pairs with the barrier on lookup entry */
+	for(rdr = readers ; rdr != NULL ; rdr = rdr->next) {
+		seq = rdr->seq;
+		while((seq & 1) && rdr->seq == seq)
+			srSleep(0, 1000); /* lookups are short, we will not be here long */
+	}
+	pthread_mutex_unlock(&mutReaders);
+}
+#endif /* #ifdef HAVE_ATOMIC_BUILTINS */
+
 
 /* create a new lookup table object AND include it in our list of
  * lookup tables.
@@ -68,30 +160,31 @@ lookupNew(lookup_t **ppThis)
 	lookup_t *pThis = NULL;
 	DEFiRet;
 
-	CHKmalloc(pThis = malloc(sizeof(lookup_t)));
+	CHKmalloc(pThis = calloc(1, sizeof(lookup_t)));
+#ifndef HAVE_ATOMIC_BUILTINS
 	pthread_rwlock_init(&pThis->rwlock, NULL);
-	pThis->name = NULL;
+#endif
 
 	if(loadConf->lu_tabs.root == NULL) {
 		loadConf->lu_tabs.root = pThis;
-		pThis->next = NULL;
 	} else {
-		pThis->next = loadConf->lu_tabs.last;
+		loadConf->lu_tabs.last->next = pThis;
 	}
 	loadConf->lu_tabs.last = pThis;
 
 	*ppThis = pThis;
 finalize_it:
-	if(iRet != RS_RET_OK) {
-		free(pThis);
-	}
 	RETiRet;
 }
 void
 lookupDestruct(lookup_t *pThis)
 {
+#ifndef HAVE_ATOMIC_BUILTINS
 	pthread_rwlock_destroy(&pThis->rwlock);
+#endif
+	lookupTabDestruct(pThis->tab);
 	free(pThis->name);
+	free(pThis->filename);
 	free(pThis);
 }
 
@@ -100,6 +193,70 @@ lookupInitCnf(lookup_tables_t *lu_tabs)
 {
 	lu_tabs->root = NULL;
 	lu_tabs->last = NULL;
+	/* name index; without it, lookupFindTable() walks the list */
+	if(hashmapConstruct(&lu_tabs->ht, 16, 0, hashmapHashString,
+	   hashmapKeyEqualsString, NULL, NULL) != RS_RET_OK)
+		lu_tabs->ht = NULL;
+}
+
+void
+lookupDestroyCnf(lookup_tables_t *lu_tabs)
+{
+	lookup_t *lu;
+	lookup_t *del;
+
+	hashmapDestruct(&lu_tabs->ht);
+	for(lu = lu_tabs->root ; lu != NULL ; ) {
+		del = lu;
+		lu = lu->next;
+		lookupDestruct(del);
+	}
+	lu_tabs->root = NULL;
+	lu_tabs->last = NULL;
+}
+
+
+static void
+lookupTabDestruct(lookup_tab_t *pTab)
+{
+	uint32_t i;
+
+	if(pTab == NULL)
+		return;
+	if(pTab->map != NULL) { /* compiled table, everything is inside the map */
+		munmap((void*) pTab->map, pTab->mapLen);
+		free(pTab);
+		return;
+	}
+	switch(pTab->type) {
+	case LOOKUP_TYPE_STRING:
+	case LOOKUP_TYPE_HASH:
+		if(pTab->d.strtab != NULL) {
+			for(i = 0 ; i < pTab->nmemb ; ++i) {
+				free(pTab->d.strtab[i].key);
+				free(pTab->d.strtab[i].val);
+			}
+		}
+		free(pTab->d.strtab);
+		hashmapDestruct(&pTab->ht);
+		break;
+	case LOOKUP_TYPE_ARRAY:
+		if(pTab->d.arr != NULL) {
+			for(i = 0 ; i < pTab->nmemb ; ++i)
+				free(pTab->d.arr[i]);
+		}
+		free(pTab->d.arr);
+		break;
+	case LOOKUP_TYPE_SPARSE_ARRAY:
+		if(pTab->d.inttab != NULL) {
+			for(i = 0 ; i < pTab->nmemb ; ++i)
+				free(pTab->d.inttab[i].val);
+		}
+		free(pTab->d.inttab);
+		break;
+	}
+	free(pTab->nomatch);
+	free(pTab);
 }
 
 
@@ -119,42 +276,135 @@ bs_arrcmp_strtab(const void *s1, const void *s2)
 {
 	return strcmp((char*)s1, (char*)((lookup_string_tab_etry_t*)s2)->key);
 }
+/* comparison function for qsort() of the integer key types */
+static int
+qs_arrcmp_inttab(const void *s1, const void *s2)
+{
+	const uint32_t k1 = ((lookup_intkey_etry_t*)s1)->key;
+	const uint32_t k2 = ((lookup_intkey_etry_t*)s2)->key;
+	return (k1 < k2) ? -1 : (k1 > k2);
+}
 
-rsRetVal
-lookupBuildTable(lookup_t *pThis, struct json_object *jroot)
+
+/* get the integer index of a table row. */
+static rsRetVal
+getIntIndex(lookup_t *pThis, struct json_object *jindex, uint32_t *pKey)
 {
-	//struct json_object *jversion, *jnomatch, *jtype, *jtab;
-	struct json_object *jtab;
+	int key;
+	DEFiRet;
+
+	if(jindex == NULL || (key = json_object_get_int(jindex)) < 0) {
+		errmsg.LogError(0, RS_RET_INVLD_LOOKUP_TAB,
+			"lookup table '%s': index '%s' is not a valid non-negative integer",
+			pThis->name, jindex == NULL ? "(missing)" : json_object_get_string(jindex));
+		ABORT_FINALIZE(RS_RET_INVLD_LOOKUP_TAB);
+	}
+	*pKey = (uint32_t) key;
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal
+lookupBuildTable(lookup_t *pThis, struct json_object *jroot, lookup_tab_t **ppTab)
+{
+	struct json_object *jnomatch, *jtype, *jtab;
 	struct json_object *jrow, *jindex, *jvalue;
+	lookup_tab_t *pTab = NULL;
+	lookup_intkey_etry_t *inttab = NULL;
+	const char *type;
+	uint32_t nmemb = 0;
 	uint32_t i;
-	uint32_t maxStrSize;
 	DEFiRet;
 
-#if 0 // enable when we continue to work on this module
-	jversion = json_object_object_get(jroot, "version");
+	CHKmalloc(pTab = calloc(1, sizeof(lookup_tab_t)));
 	jnomatch = json_object_object_get(jroot, "nomatch");
 	jtype = json_object_object_get(jroot, "type");
-#endif
 	jtab = json_object_object_get(jroot, "table");
-	pThis->nmemb = json_object_array_length(jtab);
-	CHKmalloc(pThis->d.strtab = malloc(pThis->nmemb * sizeof(lookup_string_tab_etry_t)));
-
-	maxStrSize = 0;
-	for(i = 0 ; i < pThis->nmemb ; ++i) {
-		jrow = json_object_array_get_idx(jtab, i);
-		jindex = json_object_object_get(jrow, "index");
-		jvalue = json_object_object_get(jrow, "value");
-		CHKmalloc(pThis->d.strtab[i].key = (uchar*) strdup(json_object_get_string(jindex)));
-		CHKmalloc(pThis->d.strtab[i].val = (uchar*) strdup(json_object_get_string(jvalue)));
-		maxStrSize += ustrlen(pThis->d.strtab[i].val);
+	type = (jtype == NULL) ? "string" : json_object_get_string(jtype);
+	if(!strcmp(type, "string")) {
+		pTab->type = LOOKUP_TYPE_STRING;
+	} else if(!strcmp(type, "hash")) {
+		pTab->type = LOOKUP_TYPE_HASH;
+	} else if(!strcmp(type, "array")) {
+		pTab->type = LOOKUP_TYPE_ARRAY;
+	} else if(!strcmp(type, "sparseArray")) {
+		pTab->type = LOOKUP_TYPE_SPARSE_ARRAY;
+	} else {
+		errmsg.LogError(0, RS_RET_INVLD_LOOKUP_TAB, "lookup table '%s': unknown type '%s'",
+				pThis->name, type);
+		ABORT_FINALIZE(RS_RET_INVLD_LOOKUP_TAB);
 	}
+	CHKmalloc(pTab->nomatch = (uchar*) strdup(jnomatch == NULL ? "" : json_object_get_string(jnomatch)));
+	if(jtab == NULL || !json_object_is_type(jtab, json_type_array)) {
+		errmsg.LogError(0, RS_RET_INVLD_LOOKUP_TAB, "lookup table '%s': no table array", pThis->name);
+		ABORT_FINALIZE(RS_RET_INVLD_LOOKUP_TAB);
+	}
+	pTab->nmemb = nmemb = json_object_array_length(jtab);
+
+	if(pTab->type == LOOKUP_TYPE_STRING || pTab->type == LOOKUP_TYPE_HASH) {
+		CHKmalloc(pTab->d.strtab = calloc(pTab->nmemb ? pTab->nmemb : 1, sizeof(lookup_string_tab_etry_t)));
+		for(i = 0 ; i < pTab->nmemb ; ++i) {
+			jrow = json_object_array_get_idx(jtab, i);
+			jindex = json_object_object_get(jrow, "index");
+			jvalue = json_object_object_get(jrow, "value");
+			CHKmalloc(pTab->d.strtab[i].key = (uchar*) strdup(json_object_get_string(jindex)));
+			CHKmalloc(pTab->d.strtab[i].val = (uchar*) strdup(json_object_get_string(jvalue)));
+		}
+		if(pTab->type == LOOKUP_TYPE_STRING) {
+			qsort(pTab->d.strtab, pTab->nmemb, sizeof(lookup_string_tab_etry_t), qs_arrcmp_strtab);
+		} else {
+			/* the keys are owned by strtab, the map only points to them */
+			CHKiRet(hashmapConstruct(&pTab->ht, pTab->nmemb, 0, hashmapHashString,
+						 hashmapKeyEqualsString, NULL, NULL));
+			for(i = 0 ; i < pTab->nmemb ; ++i) {
+				if(hashmapSearch(pTab->ht, pTab->d.strtab[i].key) == NULL) /* first one wins */
+					CHKiRet(hashmapInsert(pTab->ht, pTab->d.strtab[i].key, &pTab->d.strtab[i]));
+			}
+		}
+	} else {
+		CHKmalloc(inttab = calloc(pTab->nmemb ? pTab->nmemb : 1, sizeof(lookup_intkey_etry_t)));
+		for(i = 0 ; i < pTab->nmemb ; ++i) {
+			jrow = json_object_array_get_idx(jtab, i);
+			jindex = json_object_object_get(jrow, "index");
+			jvalue = json_object_object_get(jrow, "value");
+			CHKiRet(getIntIndex(pThis, jindex, &inttab[i].key));
+			CHKmalloc(inttab[i].val = (uchar*) strdup(json_object_get_string(jvalue)));
+		}
+		qsort(inttab, pTab->nmemb, sizeof(lookup_intkey_etry_t), qs_arrcmp_inttab);
+		if(pTab->type == LOOKUP_TYPE_SPARSE_ARRAY) {
+			pTab->d.inttab = inttab;
+			inttab = NULL;
+		} else {
+			for(i = 1 ; i < pTab->nmemb ; ++i) {
+				if(inttab[i].key != inttab[0].key + i) {
+					errmsg.LogError(0, RS_RET_INVLD_LOOKUP_TAB,
+						"lookup table '%s': type array requires consecutive "
+						"indexes, but %u follows %u", pThis->name,
+						(unsigned) inttab[i].key, (unsigned) inttab[i-1].key);
+					ABORT_FINALIZE(RS_RET_INVLD_LOOKUP_TAB);
+				}
+			}
+			CHKmalloc(pTab->d.arr = calloc(pTab->nmemb ? pTab->nmemb : 1, sizeof(uchar*)));
+			pTab->first = (pTab->nmemb == 0) ? 0 : inttab[0].key;
+			for(i = 0 ; i < pTab->nmemb ; ++i) {
+				pTab->d.arr[i] = inttab[i].val;
+				inttab[i].val = NULL;
+			}
+		}
+	}
+	DBGPRINTF("lookup table '%s': %u entries of type '%s' loaded\n", pThis->name,
+		  (unsigned) pTab->nmemb, type);
 
-	qsort(pThis->d.strtab, pThis->nmemb, sizeof(lookup_string_tab_etry_t), qs_arrcmp_strtab);
-dbgprintf("DDDD: table loaded (max size %u):\n", maxStrSize);
-for(i = 0 ; i < pThis->nmemb ; ++i)
-  dbgprintf("key: '%s', val: '%s'\n", pThis->d.strtab[i].key, pThis->d.strtab[i].val);
-
+	*ppTab = pTab;
+	pTab = NULL;
 finalize_it:
+	if(inttab != NULL) {
+		for(i = 0 ; i < nmemb ; ++i)
+			free(inttab[i].val);
+		free(inttab);
+	}
+	lookupTabDestruct(pTab);
 	RETiRet;
 }
 
@@ -169,6 +419,8 @@ lookupFindTable(uchar *name)
 {
 	lookup_t *curr;
 
+	if(loadConf->lu_tabs.ht != NULL)
+		return hashmapSearch(loadConf->lu_tabs.ht, name);
 	for(curr = loadConf->lu_tabs.root ; curr != NULL ; curr = curr->next) {
 		if(!ustrcmp(curr->name, name))
 			break;
@@ -185,30 +437,28 @@ lookupFindTable(uchar *name)
 static rsRetVal
 lookupReload(lookup_t *pThis)
 {
-	uint32_t i;
-	lookup_t newlu; /* dummy to be able to use support functions without 
-	                   affecting current settings. */
+	lookup_tab_t *newTab;
+	lookup_tab_t *oldTab;
 	DEFiRet;
 	
 	DBGPRINTF("reload requested for lookup table '%s'\n", pThis->name);
-	memset(&newlu, 0, sizeof(newlu));
-	CHKmalloc(newlu.name = ustrdup(pThis->name));
-	CHKmalloc(newlu.filename = ustrdup(pThis->filename));
-	CHKiRet(lookupReadFile(&newlu));
-	/* all went well, copy over data members */
+	CHKiRet(lookupReadFile(pThis, &newTab));
+	/* all went well, switch over to the new table */
+#ifdef HAVE_ATOMIC_BUILTINS
+	oldTab = pThis->tab;
+	ATOMIC_MEMORY_BARRIER(); /* new table must be complete before it is published */
+	pThis->tab = newTab;
+	waitGracePeriod();
+#else
 	pthread_rwlock_wrlock(&pThis->rwlock);
-	for(i = 0 ; i < pThis->nmemb ; ++i) {
-		free(pThis->d.strtab[i].key), /* we don't care about exec order of frees */
-		free(pThis->d.strtab[i].val);
-	}
-	free(pThis->d.strtab);
-	pThis->d.strtab = newlu.d.strtab; /* hand table AND ALL STRINGS over! */
+	oldTab = pThis->tab;
+	pThis->tab = newTab;
 	pthread_rwlock_unlock(&pThis->rwlock);
+#endif
+	lookupTabDestruct(oldTab);
 	errmsg.LogError(0, RS_RET_OK, "lookup table '%s' reloaded from file '%s'",
 			pThis->name, pThis->filename);
 finalize_it:
-	free(newlu.name);
-	free(newlu.filename);
 	RETiRet;
 }
 
@@ -224,6 +474,137 @@ lookupDoHUP()
 }
 
 
+/* convert the key for the integer key types. Returns 0 if it is not a
+ * number in range (which can never match).
+ */
+static inline int
+keyToUint(const uchar *key, uint32_t *pNum)
+{
+	uint64_t n = 0;
+
+	if(*key == '\0')
+		return 0;
+	for( ; *key ; ++key) {
+		if(*key < '0' || *key > '9')
+			return 0;
+		n = n * 10 + (*key - '0');
+		if(n > 0xffffffffu)
+			return 0;
+	}
+	*pNum = (uint32_t) n;
+	return 1;
+}
+
+
+/* lookupTabKey() for compiled tables. The offsets have been checked by
+ * lookupMapFile(), so we can use them as they are.
+ */
+static const uchar *
+lookupMappedKey(lookup_tab_t *pTab, const uchar *key)
+{
+	const lookupbin_hdr_t *const hdr = (const lookupbin_hdr_t*) pTab->map;
+	const lookupbin_etry_t *const tab = (const lookupbin_etry_t*) (pTab->map + hdr->tabOff);
+	const lookupbin_slot_t *slots;
+	uint32_t num;
+	uint32_t h, mask;
+	uint32_t lo, hi, mid;
+	int cmp;
+
+	switch(pTab->type) {
+	case LOOKUP_TYPE_STRING:
+		lo = 0;
+		hi = pTab->nmemb;
+		while(lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			cmp = strcmp((const char*) key, (const char*) pTab->map + tab[mid].key);
+			if(cmp == 0)
+				return pTab->map + tab[mid].val;
+			if(cmp < 0)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		break;
+	case LOOKUP_TYPE_HASH:
+		slots = (const lookupbin_slot_t*) (pTab->map + hdr->slotOff);
+		mask = hdr->nslots - 1;
+		h = lookupbinHash(key);
+		for(num = h & mask ; slots[num].idx != 0 ; num = (num + 1) & mask) {
+			if(slots[num].hash == h
+			   && !strcmp((const char*) key, (const char*) pTab->map + tab[slots[num].idx - 1].key))
+				return pTab->map + tab[slots[num].idx - 1].val;
+		}
+		break;
+	case LOOKUP_TYPE_ARRAY:
+		if(keyToUint(key, &num) && num >= pTab->first && num - pTab->first < pTab->nmemb)
+			return pTab->map + ((const uint32_t*) tab)[num - pTab->first];
+		break;
+	case LOOKUP_TYPE_SPARSE_ARRAY:
+		if(!keyToUint(key, &num) || pTab->nmemb == 0 || num < tab[0].key)
+			break;
+		lo = 0;
+		hi = pTab->nmemb - 1;
+		while(lo < hi) {
+			mid = lo + (hi - lo + 1) / 2;
+			if(tab[mid].key <= num)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+		return pTab->map + tab[lo].val;
+	}
+	return pTab->nomatch;
+}
+
+
+/* find the value for key in a table. Returns the nomatch value if there
+ * is none.
+ */
+static inline const uchar *
+lookupTabKey(lookup_tab_t *pTab, const uchar *key)
+{
+	lookup_string_tab_etry_t *etry;
+	lookup_intkey_etry_t *inttab;
+	uint32_t num;
+	uint32_t lo, hi, mid;
+
+	if(pTab->map != NULL)
+		return lookupMappedKey(pTab, key);
+	switch(pTab->type) {
+	case LOOKUP_TYPE_STRING:
+		etry = bsearch(key, pTab->d.strtab, pTab->nmemb, sizeof(lookup_string_tab_etry_t),
+			       bs_arrcmp_strtab);
+		if(etry != NULL)
+			return etry->val;
+		break;
+	case LOOKUP_TYPE_HASH:
+		if((etry = hashmapSearch(pTab->ht, key)) != NULL)
+			return etry->val;
+		break;
+	case LOOKUP_TYPE_ARRAY:
+		if(keyToUint(key, &num) && num >= pTab->first && num - pTab->first < pTab->nmemb)
+			return pTab->d.arr[num - pTab->first];
+		break;
+	case LOOKUP_TYPE_SPARSE_ARRAY:
+		/* the entry with the largest key <= num */
+		inttab = pTab->d.inttab;
+		if(!keyToUint(key, &num) || pTab->nmemb == 0 || num < inttab[0].key)
+			break;
+		lo = 0;
+		hi = pTab->nmemb - 1;
+		while(lo < hi) {
+			mid = lo + (hi - lo + 1) / 2;
+			if(inttab[mid].key <= num)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+		return inttab[lo].val;
+	}
+	return pTab->nomatch;
+}
+
+
 /* returns either a pointer to the value (read only!) or NULL
  * if either the key could not be found or an error occured.
  * Note that an estr_t object is returned. The caller is 
@@ -232,23 +613,132 @@ lookupDoHUP()
 es_str_t *
 lookupKey_estr(lookup_t *pThis, uchar *key)
 {
-	lookup_string_tab_etry_t *etry;
-	char *r;
+	lookup_tab_t *pTab;
+	const uchar *r;
 	es_str_t *estr;
-
+#ifdef HAVE_ATOMIC_BUILTINS
+	lookupReader_t *const rdr = getReader();
+
+	if(rdr == NULL)
+		return es_newStrFromCStr("", 0);
+	++rdr->seq;
+	ATOMIC_MEMORY_BARRIER(); /* seq must be visible before we load the table pointer */
+#else
 	pthread_rwlock_rdlock(&pThis->rwlock);
-	etry = bsearch(key, pThis->d.strtab, pThis->nmemb, sizeof(lookup_string_tab_etry_t), bs_arrcmp_strtab);
-	if(etry == NULL) {
-		r = ""; // TODO: use set default 
-	} else {
-		r = (char*)etry->val;
-	}
-	estr = es_newStrFromCStr(r, strlen(r));
+#endif
+	pTab = pThis->tab;
+	r = (pTab == NULL) ? UCHAR_CONSTANT("") : lookupTabKey(pTab, key); /* NULL: load failed */
+	estr = es_newStrFromCStr((char*)r, ustrlen(r));
+#ifdef HAVE_ATOMIC_BUILTINS
+	ATOMIC_MEMORY_BARRIER(); /* done with the table before we leave */
+	++rdr->seq;
+#else
 	pthread_rwlock_unlock(&pThis->rwlock);
+#endif
 	return estr;
 }
 
 
+/* check that a table section of n elements of size sz at off is
+ * inside the file.
+ */
+static inline int
+sectionOK(const size_t len, const uint32_t off, const uint32_t n, const size_t sz)
+{
+	return off % sizeof(uint32_t) == 0 && off >= sizeof(lookupbin_hdr_t)
+		&& (uint64_t) off + (uint64_t) n * sz <= len;
+}
+
+
+/* use a compiled table file. It is mmap()ed read-only and shared, so
+ * several instances using the same file share the memory as well. All
+ * offsets are checked once here, lookups follow them without checks.
+ */
+static rsRetVal
+lookupMapFile(lookup_t *pThis, int fd, size_t len, lookup_tab_t **ppTab)
+{
+	lookup_tab_t *pTab = NULL;
+	const lookupbin_hdr_t *hdr;
+	const lookupbin_etry_t *tab;
+	const lookupbin_slot_t *slots;
+	uint32_t nUsed;
+	uint32_t i;
+	int bOK;
+	int eno;
+	char errStr[1024];
+	void *map = MAP_FAILED;
+	DEFiRet;
+
+	if(len < sizeof(lookupbin_hdr_t) + 1) {
+		errmsg.LogError(0, RS_RET_INVLD_LOOKUP_TAB,
+			"lookup table file '%s' is truncated", pThis->filename);
+		ABORT_FINALIZE(RS_RET_INVLD_LOOKUP_TAB);
+	}
+	if((map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		eno = errno;
+		errmsg.LogError(0, RS_RET_IO_ERROR,
+			"lookup table file '%s' could not be mapped: %s",
+			pThis->filename, rs_strerror_r(eno, errStr, sizeof(errStr)));
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	hdr = (const lookupbin_hdr_t*) map;
+	if(hdr->bom != LOOKUPBIN_BOM || hdr->version != LOOKUPBIN_VERSION) {
+		errmsg.LogError(0, RS_RET_INVLD_LOOKUP_TAB,
+			"lookup table file '%s' was compiled for a different platform "
+			"or by an incompatible version of rslookuputil", pThis->filename);
+		ABORT_FINALIZE(RS_RET_INVLD_LOOKUP_TAB);
+	}
+
+	/* all strings end inside the file if its last byte is a NUL */
+	bOK = hdr->type <= LOOKUPBIN_TYPE_SPARSE_ARRAY && hdr->nomatch < len
+		&& ((const uchar*) map)[len - 1] == '\0'
+		&& sectionOK(len, hdr->tabOff, hdr->nmemb, (hdr->type == LOOKUPBIN_TYPE_ARRAY)
+			     ? sizeof(uint32_t) : sizeof(lookupbin_etry_t));
+	if(bOK && hdr->type == LOOKUPBIN_TYPE_HASH)
+		bOK = hdr->nslots > hdr->nmemb && (hdr->nslots & (hdr->nslots - 1)) == 0
+			&& sectionOK(len, hdr->slotOff, hdr->nslots, sizeof(lookupbin_slot_t));
+	tab = (const lookupbin_etry_t*) ((const uchar*) map + hdr->tabOff);
+	for(i = 0 ; bOK && i < hdr->nmemb ; ++i) {
+		if(hdr->type == LOOKUPBIN_TYPE_ARRAY)
+			bOK = ((const uint32_t*) tab)[i] < len;
+		else
+			bOK = tab[i].val < len && (hdr->type == LOOKUPBIN_TYPE_SPARSE_ARRAY || tab[i].key < len);
+	}
+	if(bOK && hdr->type == LOOKUPBIN_TYPE_HASH) {
+		/* a probe sequence must always end in an empty slot */
+		slots = (const lookupbin_slot_t*) ((const uchar*) map + hdr->slotOff);
+		for(nUsed = 0, i = 0 ; bOK && i < hdr->nslots ; ++i) {
+			bOK = slots[i].idx <= hdr->nmemb;
+			if(slots[i].idx != 0)
+				++nUsed;
+		}
+		bOK = bOK && nUsed < hdr->nslots;
+	}
+	if(!bOK) {
+		errmsg.LogError(0, RS_RET_INVLD_LOOKUP_TAB,
+			"lookup table file '%s' is corrupt", pThis->filename);
+		ABORT_FINALIZE(RS_RET_INVLD_LOOKUP_TAB);
+	}
+
+	CHKmalloc(pTab = calloc(1, sizeof(lookup_tab_t)));
+	pTab->type = (uint8_t) hdr->type;
+	pTab->nmemb = hdr->nmemb;
+	pTab->first = hdr->first;
+	pTab->nomatch = (uchar*) map + hdr->nomatch;
+	pTab->map = map;
+	pTab->mapLen = len;
+	DBGPRINTF("lookup table '%s': compiled table with %u entries of type %u mapped\n",
+		  pThis->name, (unsigned) pTab->nmemb, (unsigned) pTab->type);
+	*ppTab = pTab;
+	map = MAP_FAILED; /* now owned by pTab */
+
+finalize_it:
+	if(map != MAP_FAILED)
+		munmap(map, len);
+	RETiRet;
+}
+
+
 /* note: widely-deployed json_c 0.9 does NOT support incremental
  * parsing. In order to keep compatible with e.g. Ubuntu 12.04LTS,
  * we read the file into one big memory buffer and parse it at once.
@@ -257,14 +747,15 @@ lookupKey_estr(lookup_t *pThis, uchar *key)
  * will probably have other issues as well...).
  */
 static rsRetVal
-lookupReadFile(lookup_t *pThis)
+lookupReadFile(lookup_t *pThis, lookup_tab_t **ppTab)
 {
 	struct json_tokener *tokener = NULL;
 	struct json_object *json = NULL;
 	int eno = errno;
 	char errStr[1024];
 	char *iobuf = NULL;
-	int fd;
+	char magic[LOOKUPBIN_MAGIC_LEN];
+	int fd = -1;
 	ssize_t nread;
 	struct stat sb;
 	DEFiRet;
@@ -278,8 +769,6 @@ lookupReadFile(lookup_t *pThis)
 		ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
 	}
 
-	CHKmalloc(iobuf = malloc(sb.st_size));
-
 	if((fd = open((const char*) pThis->filename, O_RDONLY)) == -1) {
 		eno = errno;
 		errmsg.LogError(0, RS_RET_FILE_NOT_FOUND,
@@ -288,6 +777,15 @@ lookupReadFile(lookup_t *pThis)
 		ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
 	}
 
+	/* compiled tables (see lookupbin.h) are not read but mapped */
+	if(sb.st_size > LOOKUPBIN_MAGIC_LEN
+	   && pread(fd, magic, LOOKUPBIN_MAGIC_LEN, 0) == LOOKUPBIN_MAGIC_LEN
+	   && !memcmp(magic, LOOKUPBIN_MAGIC, LOOKUPBIN_MAGIC_LEN)) {
+		CHKiRet(lookupMapFile(pThis, fd, (size_t) sb.st_size, ppTab));
+		FINALIZE;
+	}
+
+	CHKmalloc(iobuf = malloc(sb.st_size));
 	tokener = json_tokener_new();
 	nread = read(fd, iobuf, sb.st_size);
 	if(nread != (ssize_t) sb.st_size) {
@@ -309,9 +807,11 @@ lookupReadFile(lookup_t *pThis)
 	iobuf = NULL; /* make sure no double-free */
 
 	/* got json object, now populate our own in-memory structure */
-	CHKiRet(lookupBuildTable(pThis, json));
+	CHKiRet(lookupBuildTable(pThis, json, ppTab));
 
 finalize_it:
+	if(fd != -1)
+		close(fd);
 	free(iobuf);
 	if(tokener != NULL)
 		json_tokener_free(tokener);
@@ -350,7 +850,12 @@ lookupProcessCnf(struct cnfobj *o)
 			  "param '%s'\n", modpblk.descr[i].name);
 		}
 	}
-	CHKiRet(lookupReadFile(lu));
+	/* index the name; the first table of a name wins, as in the list */
+	if(loadConf->lu_tabs.ht != NULL && lu->name != NULL
+	   && hashmapSearch(loadConf->lu_tabs.ht, lu->name) == NULL
+	   && hashmapInsert(loadConf->lu_tabs.ht, lu->name, lu) != RS_RET_OK)
+		hashmapDestruct(&loadConf->lu_tabs.ht);
+	CHKiRet(lookupReadFile(lu, &lu->tab));
 	DBGPRINTF("lookup table '%s' loaded from file '%s'\n", lu->name, lu->filename);
 
 finalize_it:
@@ -361,6 +866,18 @@ finalize_it:
 void
 lookupClassExit(void)
 {
+#ifdef HAVE_ATOMIC_BUILTINS
+	lookupReader_t *rdr;
+
+	if(bReaderKeyActive) {
+		pthread_key_delete(keyReader);
+		bReaderKeyActive = 0;
+	}
+	while((rdr = readers) != NULL) {
+		readers = rdr->next;
+		free(rdr);
+	}
+#endif
 	objRelease(glbl, CORE_COMPONENT);
 	objRelease(errmsg, CORE_COMPONENT);
 }
@@ -372,6 +889,11 @@ lookupClassInit(void)
 	CHKiRet(objGetObjInterface(&obj));
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+#ifdef HAVE_ATOMIC_BUILTINS
+	if(pthread_key_create(&keyReader, readerDestruct) != 0)
+		ABORT_FINALIZE(RS_RET_ERR);
+	bReaderKeyActive = 1;
+#endif
 finalize_it:
 	RETiRet;
 }
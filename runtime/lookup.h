@@ -21,10 +21,12 @@
 #ifndef INCLUDED_LOOKUP_H
 #define INCLUDED_LOOKUP_H
 #include <libestr.h>
+#include "hashmap.h"
 
 struct lookup_tables_s {
 	lookup_t *root;	/* the root of the template list */
 	lookup_t *last;	/* points to the last element of the template list */
+	hashmap_t *ht;	/* name -> table index for lookupFindTable(), NULL if not built */
 };
 
 struct lookup_string_tab_etry_s {
@@ -32,20 +34,49 @@ struct lookup_string_tab_etry_s {
 	uchar *val;
 };
 
+struct lookup_intkey_etry_s {
+	uint32_t key;
+	uchar *val;
+};
+
+/* table types */
+#define LOOKUP_TYPE_STRING 0	/* sorted array of string keys, binary search */
+#define LOOKUP_TYPE_HASH 1	/* string keys, hash table */
+#define LOOKUP_TYPE_ARRAY 2	/* consecutive integer keys, direct index */
+#define LOOKUP_TYPE_SPARSE_ARRAY 3 /* integer keys, value of the next lower key */
+
+/* the table data as read from the file. On reload, a new one is built and
+ * replaces the old one as a whole.
+ */
+struct lookup_tab_s {
+	uint8_t type;
+	uint32_t nmemb;
+	uchar *nomatch;		/* returned if the key is not found */
+	union {
+		lookup_string_tab_etry_t *strtab;	/* STRING and HASH */
+		lookup_intkey_etry_t *inttab;		/* SPARSE_ARRAY, sorted */
+		uchar **arr;				/* ARRAY, index key - first */
+	} d;
+	hashmap_t *ht;		/* HASH: key -> strtab entry */
+	uint32_t first;		/* ARRAY: key of arr[0] */
+	const uchar *map;	/* compiled table: the mmap()ed file (d and ht unused) */
+	size_t mapLen;
+};
+
 /* a single lookup table */
 struct lookup_s {
+	lookup_tab_t *tab;	/* current table data, see lookupKey_estr() for access */
+#ifndef HAVE_ATOMIC_BUILTINS
 	pthread_rwlock_t rwlock;	/* protect us in case of dynamic reloads */
+#endif
 	uchar *name;
 	uchar *filename;
-	uint32_t nmemb;
-	union {
-		lookup_string_tab_etry_t *strtab;
-	} d;
 	lookup_t *next;
 };
 
 /* prototypes */
 void lookupInitCnf(lookup_tables_t *lu_tabs);
+void lookupDestroyCnf(lookup_tables_t *lu_tabs);
 rsRetVal lookupProcessCnf(struct cnfobj *o);
 lookup_t *lookupFindTable(uchar *name);
 es_str_t * lookupKey_estr(lookup_t *pThis, uchar *key);
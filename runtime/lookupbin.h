@@ -0,0 +1,88 @@
+/* The compiled (binary) lookup table file format.
+ *
+ * Compiled tables are created from the JSON table files by rslookuputil and
+ * are used by lookup.c via mmap(), without any parsing. All integers are in
+ * host byte order (the bom field detects files from a different platform),
+ * all offsets are relative to the start of the file. Strings live in a pool
+ * at the end of the file, each one NUL-terminated. The file layout is:
+ *
+ * header
+ * table section, depending on the type:
+ *   string:      lookupbin_etry_t[nmemb], sorted by key (strcmp order)
+ *   hash:        lookupbin_etry_t[nmemb], followed at slotOff by
+ *                lookupbin_slot_t[nslots] (linear probing, nslots is a
+ *                power of 2 and larger than nmemb)
+ *   array:       uint32_t[nmemb], the value offsets for keys first..
+ *   sparseArray: lookupbin_etry_t[nmemb], key is the integer index,
+ *                sorted by it
+ * string pool
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_LOOKUPBIN_H
+#define INCLUDED_LOOKUPBIN_H
+#include <stdint.h>
+
+#define LOOKUPBIN_MAGIC "RSLOOKUP"
+#define LOOKUPBIN_MAGIC_LEN 8
+#define LOOKUPBIN_BOM 0x01020304u
+#define LOOKUPBIN_VERSION 1
+
+/* type values, the same as LOOKUP_TYPE_* */
+#define LOOKUPBIN_TYPE_STRING 0
+#define LOOKUPBIN_TYPE_HASH 1
+#define LOOKUPBIN_TYPE_ARRAY 2
+#define LOOKUPBIN_TYPE_SPARSE_ARRAY 3
+
+typedef struct lookupbin_hdr_s {
+	char magic[LOOKUPBIN_MAGIC_LEN];
+	uint32_t bom;
+	uint32_t version;
+	uint32_t type;
+	uint32_t nmemb;
+	uint32_t first;		/* array: index of the first element */
+	uint32_t nomatch;	/* offset of the nomatch string */
+	uint32_t tabOff;	/* offset of the table section */
+	uint32_t slotOff;	/* hash: offset of the slots */
+	uint32_t nslots;	/* hash: number of slots */
+	uint32_t reserved;
+} lookupbin_hdr_t;
+
+typedef struct lookupbin_etry_s {
+	uint32_t key;	/* string offset or, for sparseArray, the index itself */
+	uint32_t val;	/* string offset */
+} lookupbin_etry_t;
+
+typedef struct lookupbin_slot_s {
+	uint32_t hash;	/* lookupbinHash() of the key */
+	uint32_t idx;	/* entry index + 1, 0 - empty slot */
+} lookupbin_slot_t;
+
+/* the hash function of the format (FNV-1a), must never change */
+static inline uint32_t
+lookupbinHash(const unsigned char *key)
+{
+	uint32_t h = 2166136261u;
+
+	while(*key)
+		h = (h ^ *key++) * 16777619u;
+	return h;
+}
+
+#endif /* #ifndef INCLUDED_LOOKUPBIN_H */
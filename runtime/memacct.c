@@ -0,0 +1,86 @@
+/* memacct.c
+ * Approximate memory accounting, see memacct.h.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include "rsyslog.h"
+#include "obj.h"
+#include "statsobj.h"
+#include "unicode-helper.h"
+#include "memacct.h"
+
+static const char *catNames[MEMACCT_NCAT] =
+	{ "queues.bytes", "streams.bytes", "tcpsess.bytes", "imptcp.bytes", "dynafile.bytes" };
+
+/* static data */
+DEFobjStaticHelpers
+DEFobjCurrIf(statsobj)
+struct memacctCtr memacctBytes[MEMACCT_NCAT];
+int64 memacctLimit = 0;
+DEF_ATOMIC_HELPER_MUT64(mutMemacct);
+static statsobj_t *stats = NULL;
+
+/* create the statsobj, done after the config has been loaded */
+rsRetVal
+memacctActivate(void)
+{
+	int i;
+	DEFiRet;
+
+	if(stats != NULL)
+		FINALIZE;
+	CHKiRet(statsobj.Construct(&stats));
+	CHKiRet(statsobj.SetName(stats, UCHAR_CONSTANT("memory")));
+	for(i = 0 ; i < MEMACCT_NCAT ; ++i) {
+		CHKiRet(statsobj.AddCounter(stats, (uchar*) catNames[i],
+			ctrType_IntCtr, CTR_FLAG_NONE, &memacctBytes[i].val));
+	}
+	CHKiRet(statsobj.ConstructFinalize(stats));
+
+finalize_it:
+	if(iRet != RS_RET_OK && stats != NULL)
+		statsobj.Destruct(&stats);
+	RETiRet;
+}
+
+/* init function (must be called once) */
+rsRetVal
+memacctInit(void)
+{
+	DEFiRet;
+
+	INIT_ATOMIC_HELPER_MUT64(mutMemacct);
+	CHKiRet(objGetObjInterface(&obj)); /* this provides the root pointer for all other queries */
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
+finalize_it:
+	RETiRet;
+}
+
+/* deinit function (must be called once) */
+void
+memacctExit(void)
+{
+	if(stats != NULL)
+		statsobj.Destruct(&stats);
+	objRelease(statsobj, CORE_COMPONENT);
+	DESTROY_ATOMIC_HELPER_MUT64(mutMemacct);
+}
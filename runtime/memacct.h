@@ -0,0 +1,90 @@
+/* memacct.h
+ * Approximate memory accounting for the larger consumers of memory.
+ *
+ * Components that hold potentially large amounts of memory (queued
+ * messages, stream buffers, session buffers) report the bytes they hold
+ * here. The per-category totals are published as the "memory" statsobj
+ * (the per-queue values are in the queue's own stats, "memsize"). If a global
+ * memory limit is set (global(memory.limit=...)), queues check it on
+ * enqueue: disk-assisted queues spill to disk, all other in-memory
+ * queues discard new messages while the limit is exceeded. All values
+ * are estimates, not exact malloc() sizes.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_MEMACCT_H
+#define INCLUDED_MEMACCT_H
+#include "atomic.h"
+
+/* accounting categories */
+#define MEMACCT_QUEUES		0	/* messages in in-memory queues */
+#define MEMACCT_STREAMS		1	/* stream (file) I/O and zip buffers */
+#define MEMACCT_TCPSESS		2	/* tcps_sess (imtcp & co) message buffers */
+#define MEMACCT_IMPTCP		3	/* imptcp session buffers */
+#define MEMACCT_NTOTAL		4	/* categories up to here make up the total */
+#define MEMACCT_DYNAFILE	4	/* omfile dynafile cache, a subset of MEMACCT_STREAMS */
+#define MEMACCT_NCAT		5
+
+/* each counter lives on its own cache line, as they are updated by
+ * unrelated threads (the queue one for every enqueued message)
+ */
+struct memacctCtr {
+	uint64 val;
+	char pad[64 - sizeof(uint64)];
+};
+extern struct memacctCtr memacctBytes[MEMACCT_NCAT];
+extern int64 memacctLimit;	/* 0 - no limit */
+#ifndef HAVE_ATOMIC_BUILTINS_64BIT
+extern pthread_mutex_t mutMemacct;
+#endif
+
+static inline void
+memacctAdd(const int cat, const uint64 nBytes)
+{
+	ATOMIC_ADD_uint64(&memacctBytes[cat].val, nBytes, &mutMemacct);
+}
+
+static inline void
+memacctSub(const int cat, const uint64 nBytes)
+{
+	ATOMIC_SUB_uint64(&memacctBytes[cat].val, nBytes, &mutMemacct);
+}
+
+/* check if the global limit is exceeded. This is read without any
+ * synchronization, a slightly outdated total is fine for this purpose.
+ */
+static inline int
+memacctOverLimit(void)
+{
+	uint64 total = 0;
+	int i;
+
+	if(memacctLimit <= 0)
+		return 0;
+	for(i = 0 ; i < MEMACCT_NTOTAL ; ++i)
+		total += memacctBytes[i].val;
+	return (int64) total > memacctLimit;
+}
+
+/* prototypes */
+rsRetVal memacctInit(void);
+rsRetVal memacctActivate(void);
+void memacctExit(void);
+
+#endif /* #ifndef INCLUDED_MEMACCT_H */
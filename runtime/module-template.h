@@ -258,6 +258,27 @@ static rsRetVal commitTransaction(wrkrInstanceData_t __attribute__((unused)) *co
 	RETiRet;\
 }
 
+/* commitBatch()
+ * Like commitTransaction(), but the module also reports the result for
+ * each message in pResults, which the engine pre-sets to RS_RET_SUSPENDED.
+ * A module sets RS_RET_OK for each message it has delivered and any other
+ * error code for a message that failed permanently. If commitBatch()
+ * returns RS_RET_SUSPENDED, only the messages still marked RS_RET_SUSPENDED
+ * are retried after the action has been resumed, so a module can report
+ * a partially delivered batch without causing duplicates.
+ */
+#define BEGINcommitBatch \
+static rsRetVal commitBatch(wrkrInstanceData_t __attribute__((unused)) *const pWrkrData, \
+	actWrkrIParams_t *const pParams, const unsigned nParams, rsRetVal *const pResults)\
+{\
+	DEFiRet;
+
+#define CODESTARTcommitBatch /* currently empty, but may be extended */
+
+#define ENDcommitBatch \
+	RETiRet;\
+}
+
 /* endTransaction()
  * introduced in v4.3.3 -- rgerhards, 2009-04-27
  */
@@ -540,6 +561,27 @@ static rsRetVal queryEtryPt(uchar *name, rsRetVal (**pEtryPoint)())\
 		*pEtryPoint = tryResume;\
 	}
 
+/* the following definition is the standard block for queryEtryPt for output
+ * modules using the batch interface (commitBatch()).
+ */
+#define CODEqueryEtryPt_STD_OMODBATCH_QUERIES \
+	CODEqueryEtryPt_STD_MOD_QUERIES \
+	else if(!strcmp((char*) name, "beginTransaction")) {\
+		*pEtryPoint = beginTransaction;\
+	} else if(!strcmp((char*) name, "commitBatch")) {\
+		*pEtryPoint = commitBatch;\
+	} else if(!strcmp((char*) name, "dbgPrintInstInfo")) {\
+		*pEtryPoint = dbgPrintInstInfo;\
+	} else if(!strcmp((char*) name, "freeInstance")) {\
+		*pEtryPoint = freeInstance;\
+	} else if(!strcmp((char*) name, "parseSelectorAct")) {\
+		*pEtryPoint = parseSelectorAct;\
+	} else if(!strcmp((char*) name, "isCompatibleWithFeature")) {\
+		*pEtryPoint = isCompatibleWithFeature;\
+	} else if(!strcmp((char*) name, "tryResume")) {\
+		*pEtryPoint = tryResume;\
+	}
+
 /* standard queries for output module interface in rsyslog v8+ */
 #define CODEqueryEtryPt_STD_OMOD8_QUERIES \
 	else if(!strcmp((char*) name, "createWrkrInstance")) {\
@@ -688,7 +688,35 @@ doModInit(rsRetVal (*modInit)(int, int*, rsRetVal(**)(), rsRetVal(*)(), modInfo_
 				ABORT_FINALIZE(localRet);
 			}
 
-			if(pNew->mod.om.doAction == NULL && pNew->mod.om.commitTransaction == NULL) {
+			localRet = (*pNew->modQueryEtryPt)((uchar*)"commitBatch",
+				   &pNew->mod.om.commitBatch);
+			if(localRet == RS_RET_MODULE_ENTRY_POINT_NOT_FOUND) {
+				pNew->mod.om.commitBatch = NULL;
+			} else if(localRet != RS_RET_OK) {
+				ABORT_FINALIZE(localRet);
+			} else {
+				/* commitBatch() is commitTransaction() plus per-message results,
+				 * so we treat it the same way during the checks below.
+				 */
+				pNew->mod.om.commitTransaction = NULL;
+				if(pNew->mod.om.doAction != NULL){
+					errmsg.LogError(0, RS_RET_INVLD_OMOD,
+						"module %s provides both doAction() "
+						"and commitBatch() interface, using "
+						"commitBatch()", name);
+					pNew->mod.om.doAction = NULL;
+				}
+				if(pNew->mod.om.beginTransaction == dummyBeginTransaction){
+					errmsg.LogError(0, RS_RET_INVLD_OMOD,
+						"module %s provides commitBatch() "
+						"but does not provide beginTransaction() - "
+						"cannot load", name);
+					ABORT_FINALIZE(RS_RET_INVLD_OMOD);
+				}
+			}
+
+			if(pNew->mod.om.doAction == NULL && pNew->mod.om.commitTransaction == NULL
+			   && pNew->mod.om.commitBatch == NULL) {
 				errmsg.LogError(0, RS_RET_INVLD_OMOD,
 					"module %s does neither provide doAction() "
 					"nor commitTransaction() interface - cannot "
@@ -876,6 +904,8 @@ static void modPrintList(void)
 		case eMOD_OUT:
 			dbgprintf("Output Module Entry Points:\n");
 			dbgprintf("\tdoAction:           %p\n", pMod->mod.om.doAction);
+			dbgprintf("\tcommitTransaction:  %p\n", pMod->mod.om.commitTransaction);
+			dbgprintf("\tcommitBatch:        %p\n", pMod->mod.om.commitBatch);
 			dbgprintf("\tparseSelectorAct:   %p\n", pMod->mod.om.parseSelectorAct);
 			dbgprintf("\tnewActInst:         %p\n", (pMod->mod.om.newActInst == dummynewActInst) ?
 								    NULL :  pMod->mod.om.newActInst);
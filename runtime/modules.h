@@ -135,6 +135,8 @@ struct modInfo_s {
 			 */
 			rsRetVal (*beginTransaction)(void*);
 			rsRetVal (*commitTransaction)(void *const, actWrkrIParams_t *const, const unsigned);
+			rsRetVal (*commitBatch)(void *const, actWrkrIParams_t *const, const unsigned,
+						rsRetVal *const);
 			rsRetVal (*doAction)(uchar**, void*);
 			rsRetVal (*endTransaction)(void*);
 			rsRetVal (*parseSelectorAct)(uchar**, void**,omodStringRequest_t**);
@@ -35,7 +35,11 @@
 #include <string.h>
 #include <assert.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sched.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #if HAVE_SYSINFO_UPTIME
 #include <sys/sysinfo.h>
 #endif
@@ -60,6 +64,7 @@
 #include "regexp.h"
 #include "atomic.h"
 #include "unicode-helper.h"
+#include "strscan.h"
 #include "ruleset.h"
 #include "prop.h"
 #include "net.h"
@@ -70,8 +75,210 @@
 /* TODO: move the global variable root to the config object - had no time to to it
  * right now before vacation -- rgerhards, 2013-07-22
  */
-static pthread_rwlock_t glblVars_rwlock;
 struct json_object *global_var_root = NULL;
+static pthread_mutex_t mutGlblVars = PTHREAD_MUTEX_INITIALIZER; /* serializes writers */
+
+#ifdef HAVE_ATOMIC_BUILTINS
+/* Global variables are read-copy-update: global_var_root is never modified
+ * once published. A writer modifies a deep copy, publishes it by replacing
+ * the pointer and retires the old tree. Readers do not lock, they just pin
+ * the current generation in their per-thread reader slot. As json objects
+ * found in the tree are handed out to the caller, a pin is kept until the
+ * thread has finished its current batch (msgGlblVarsQuiesce()). A retired
+ * tree is freed by a later writer as soon as no slot pins a generation
+ * older than the one that replaced it. Writes are thus more expensive than
+ * before, but they are rare compared to reads, which no longer bounce the
+ * rwlock's cache line between all workers.
+ */
+typedef struct glblVarsReader_s glblVarsReader_t;
+struct glblVarsReader_s {
+	volatile unsigned gen;	/* pinned generation, 0 if none */
+	glblVarsReader_t *next;
+	char pad[64];	/* keeps the slots of different threads on different cache lines */
+};
+typedef struct glblVarsRetired_s glblVarsRetired_t;
+struct glblVarsRetired_s {
+	struct json_object *root;
+	unsigned gen;	/* generation that replaced root */
+	glblVarsRetired_t *next;
+};
+static volatile unsigned glblVarsGen = 1;
+static pthread_key_t keyGlblVarsReader;
+static sbool bGlblVarsKeyActive = 0;
+static glblVarsReader_t *glblVarsReaders = NULL;	/* protected by mutGlblVars */
+static glblVarsRetired_t *glblVarsRetired = NULL;	/* protected by mutGlblVars */
+
+
+/* called on thread exit */
+static void
+glblVarsReaderDestruct(void *p)
+{
+	glblVarsReader_t *const rdr = (glblVarsReader_t*) p;
+	glblVarsReader_t **pp;
+
+	pthread_mutex_lock(&mutGlblVars);
+	for(pp = &glblVarsReaders ; *pp != NULL ; pp = &(*pp)->next) {
+		if(*pp == rdr) {
+			*pp = rdr->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mutGlblVars);
+	free(rdr);
+}
+
+
+/* get the reader slot of the current thread, register one on first use.
+ * Returns NULL if we are out of memory.
+ */
+static inline glblVarsReader_t *
+glblVarsGetReader(void)
+{
+	glblVarsReader_t *rdr;
+
+	if(!bGlblVarsKeyActive)
+		return NULL;
+	if((rdr = pthread_getspecific(keyGlblVarsReader)) != NULL)
+		return rdr;
+	if((rdr = calloc(1, sizeof(glblVarsReader_t))) == NULL)
+		return NULL;
+	if(pthread_setspecific(keyGlblVarsReader, rdr) != 0) {
+		free(rdr);
+		return NULL;
+	}
+	pthread_mutex_lock(&mutGlblVars);
+	rdr->next = glblVarsReaders;
+	glblVarsReaders = rdr;
+	pthread_mutex_unlock(&mutGlblVars);
+	return rdr;
+}
+
+
+/* free all retired trees that can no longer be in use.
+ * Must be called with mutGlblVars locked.
+ */
+static void
+glblVarsReclaim(void)
+{
+	glblVarsReader_t *rdr;
+	glblVarsRetired_t **pp, *del;
+	unsigned gen;
+
+	ATOMIC_MEMORY_BARRIER(); /* pairs with the barrier in glblVarsReadBegin() */
+	for(pp = &glblVarsRetired ; *pp != NULL ; ) {
+		/* in use if some reader pinned an older generation (wrap-safe compare) */
+		for(rdr = glblVarsReaders ; rdr != NULL ; rdr = rdr->next) {
+			gen = rdr->gen;
+			if(gen != 0 && (int) (gen - (*pp)->gen) < 0)
+				break;
+		}
+		if(rdr == NULL) {
+			del = *pp;
+			*pp = del->next;
+			json_object_put(del->root);
+			free(del);
+		} else {
+			pp = &(*pp)->next;
+		}
+	}
+}
+#endif /* #ifdef HAVE_ATOMIC_BUILTINS */
+
+
+/* begin reading the global variables and return the current root.
+ * *pbPinned tells glblVarsReadEnd() if this call pinned the snapshot.
+ */
+static inline struct json_object *
+glblVarsReadBegin(int *pbPinned)
+{
+#ifdef HAVE_ATOMIC_BUILTINS
+	glblVarsReader_t *rdr;
+
+	*pbPinned = 0;
+	if((rdr = glblVarsGetReader()) != NULL) {
+		if(rdr->gen == 0) {
+			/* if already pinned, keep the older generation: pointers obtained
+			 * from it may still be in use by the caller */
+			rdr->gen = glblVarsGen;
+			ATOMIC_MEMORY_BARRIER();
+			*pbPinned = 1;
+		}
+		return global_var_root;
+	}
+#endif
+	pthread_mutex_lock(&mutGlblVars);
+	*pbPinned = -1; /* locked */
+	return global_var_root;
+}
+
+
+/* end reading the global variables. If bKeep is set, the caller may
+ * still use objects from the tree, so the pin is kept until the thread
+ * quiesces.
+ */
+static inline void
+glblVarsReadEnd(int bPinned, int bKeep)
+{
+	if(bPinned == -1) {
+		pthread_mutex_unlock(&mutGlblVars);
+		return;
+	}
+#ifdef HAVE_ATOMIC_BUILTINS
+	if(bPinned && !bKeep)
+		((glblVarsReader_t*) pthread_getspecific(keyGlblVarsReader))->gen = 0;
+#endif
+}
+
+
+/* the current thread does not use any objects from the global variable
+ * tree any longer. Called by the workers after each batch.
+ */
+void
+msgGlblVarsQuiesce(void)
+{
+#ifdef HAVE_ATOMIC_BUILTINS
+	glblVarsReader_t *rdr;
+
+	if(bGlblVarsKeyActive && (rdr = pthread_getspecific(keyGlblVarsReader)) != NULL)
+		rdr->gen = 0;
+#endif
+}
+
+
+/* publish a new global variable tree. Must be called with mutGlblVars
+ * locked. The old tree is freed once no reader can use it any longer.
+ */
+static void
+glblVarsPublish(struct json_object *newRoot)
+{
+	struct json_object *oldRoot = global_var_root;
+#ifdef HAVE_ATOMIC_BUILTINS
+	glblVarsRetired_t *ret;
+#endif
+
+	global_var_root = newRoot;
+#ifdef HAVE_ATOMIC_BUILTINS
+	ATOMIC_MEMORY_BARRIER(); /* the new root must be visible before the new generation */
+	if(++glblVarsGen == 0)
+		++glblVarsGen; /* 0 means "not pinned" */
+	if(oldRoot != NULL) {
+		if(bGlblVarsKeyActive && (ret = malloc(sizeof(glblVarsRetired_t))) != NULL) {
+			ret->root = oldRoot;
+			ret->gen = glblVarsGen;
+			ret->next = glblVarsRetired;
+			glblVarsRetired = ret;
+		} else if(bGlblVarsKeyActive) {
+			DBGPRINTF("msg: out of memory retiring global variable tree - leaked\n");
+		} else {
+			json_object_put(oldRoot); /* no lock-free readers exist */
+		}
+	}
+	glblVarsReclaim();
+#else
+	if(oldRoot != NULL)
+		json_object_put(oldRoot);
+#endif
+}
 
 /* static data */
 DEFobjStaticHelpers
@@ -322,25 +529,327 @@ static char *syslog_number_names[24] = { "0", "1", "2", "3", "4", "5", "6", "7",
 static pthread_mutex_t mutTrimCtr;	 /* mutex to handle malloc trim */
 #endif
 
+/* --------------- msg object pool -------------------- */
+/* malloc() and free() of msg objects are very visible in profiles under high
+ * load and, with many input threads, also fragment the malloc arenas. So we
+ * keep destructed objects in a small per-thread cache from which new ones are
+ * taken. Messages are usually constructed by input threads, but destructed by
+ * queue workers, so the caches exchange objects in batches with a global pool.
+ * The global pool is bounded; objects above that bound are really freed. The
+ * same is done for the small buffers used for the lazily formatted timestamp
+ * strings (pszRcvdAt3339 and friends).
+ * Optionally (global(msgpool.prealloc=...)), the msg object pool is seeded
+ * with a slab of pre-faulted, possibly huge page backed objects, so that a
+ * burst does not need to malloc and fault in fresh memory. Slab objects
+ * always go back to the global pool, as they can not be freed.
+ */
+#define MSGPOOL_CACHE_MAX 256	/* max objects in a per-thread cache */
+#define MSGPOOL_XFER 128	/* objects moved between cache and global pool at once */
+
+typedef struct msgPoolElt_s {
+	struct msgPoolElt_s *pNext;
+} msgPoolElt_t;
+
+typedef struct msgPool_s msgPool_t;
+typedef struct msgPoolCache_s {
+	msgPool_t *pPool;
+	msgPoolElt_t *pRoot;
+	int nElt;
+} msgPoolCache_t;
+
+struct msgPool_s {
+	size_t eltSize;
+	int nMax;		/* max objects in global pool */
+	pthread_key_t key;	/* per-thread cache */
+	pthread_mutex_t mut;	/* guards the global pool */
+	msgPoolElt_t *pRoot;
+	int nElt;
+	sbool bActive;		/* pool could be initialized? if not, we simply malloc */
+	char *pSlab;		/* pre-allocated objects, NULL if none */
+	size_t lenSlab;
+};
+
+/* largest timestamp string is RFC3339 with 32 chars */
+#define MSGPOOL_TSBUF_SIZE 33
+static msgPool_t msgPoolMsg;
+static msgPool_t msgPoolTSBuf;
+static msgPool_t msgPoolCold;
+
+static inline int
+msgPoolInSlab(const msgPool_t *const pPool, const void *const p)
+{
+	return (const char*) p >= pPool->pSlab && (const char*) p < pPool->pSlab + pPool->lenSlab;
+}
+
+/* move up to n elements from the cache to the global pool. Elements not
+ * accepted by the (full) global pool are freed.
+ */
+static void
+msgPoolFlush(msgPoolCache_t *pCache, int n)
+{
+	msgPool_t *pPool = pCache->pPool;
+	msgPoolElt_t *pElt;
+
+	pthread_mutex_lock(&pPool->mut);
+	while(n-- > 0 && pCache->pRoot != NULL) {
+		pElt = pCache->pRoot;
+		pCache->pRoot = pElt->pNext;
+		--pCache->nElt;
+		if(pPool->nElt < pPool->nMax || msgPoolInSlab(pPool, pElt)) {
+			pElt->pNext = pPool->pRoot;
+			pPool->pRoot = pElt;
+			++pPool->nElt;
+		} else {
+			free(pElt);
+		}
+	}
+	pthread_mutex_unlock(&pPool->mut);
+}
+
+/* called on thread termination */
+static void
+msgPoolCacheDestruct(void *pData)
+{
+	msgPoolCache_t *pCache = (msgPoolCache_t*) pData;
+
+	msgPoolFlush(pCache, pCache->nElt);
+	free(pCache);
+}
+
+static inline msgPoolCache_t *
+msgPoolGetCache(msgPool_t *pPool)
+{
+	msgPoolCache_t *pCache;
+
+	if(!pPool->bActive)
+		return NULL;
+	pCache = (msgPoolCache_t*) pthread_getspecific(pPool->key);
+	if(pCache == NULL) {
+		if((pCache = calloc(1, sizeof(msgPoolCache_t))) == NULL)
+			return NULL;
+		pCache->pPool = pPool;
+		if(pthread_setspecific(pPool->key, pCache) != 0) {
+			free(pCache);
+			return NULL;
+		}
+	}
+	return pCache;
+}
+
+static inline void *
+msgPoolAlloc(msgPool_t *pPool)
+{
+	msgPoolCache_t *pCache;
+	msgPoolElt_t *pElt;
+	int n;
+
+	if((pCache = msgPoolGetCache(pPool)) == NULL)
+		return MALLOC(pPool->eltSize);
+
+	if(pCache->pRoot == NULL && pPool->nElt > 0) {
+		/* refill from global pool (nElt is only a hint outside the mutex) */
+		pthread_mutex_lock(&pPool->mut);
+		for(n = 0 ; n < MSGPOOL_XFER && pPool->pRoot != NULL ; ++n) {
+			pElt = pPool->pRoot;
+			pPool->pRoot = pElt->pNext;
+			--pPool->nElt;
+			pElt->pNext = pCache->pRoot;
+			pCache->pRoot = pElt;
+			++pCache->nElt;
+		}
+		pthread_mutex_unlock(&pPool->mut);
+	}
+
+	if((pElt = pCache->pRoot) == NULL)
+		return MALLOC(pPool->eltSize);
+	pCache->pRoot = pElt->pNext;
+	--pCache->nElt;
+	return pElt;
+}
+
+static inline void
+msgPoolFree(msgPool_t *pPool, void *p)
+{
+	msgPoolCache_t *pCache;
+	msgPoolElt_t *pElt = (msgPoolElt_t*) p;
+
+	if(p == NULL)
+		return;
+	if((pCache = msgPoolGetCache(pPool)) == NULL) {
+		if(msgPoolInSlab(pPool, p)) {
+			pthread_mutex_lock(&pPool->mut);
+			pElt->pNext = pPool->pRoot;
+			pPool->pRoot = pElt;
+			++pPool->nElt;
+			pthread_mutex_unlock(&pPool->mut);
+		} else {
+			free(p);
+		}
+		return;
+	}
+	pElt->pNext = pCache->pRoot;
+	pCache->pRoot = pElt;
+	if(++pCache->nElt > MSGPOOL_CACHE_MAX)
+		msgPoolFlush(pCache, MSGPOOL_XFER);
+}
+
+static void
+msgPoolInit(msgPool_t *pPool, size_t eltSize, int nMax)
+{
+	pPool->eltSize = (eltSize < sizeof(msgPoolElt_t)) ? sizeof(msgPoolElt_t) : eltSize;
+	pPool->nMax = nMax;
+	pPool->pRoot = NULL;
+	pPool->nElt = 0;
+	pPool->pSlab = NULL;
+	pPool->lenSlab = 0;
+	pthread_mutex_init(&pPool->mut, NULL);
+	pPool->bActive = (pthread_key_create(&pPool->key, msgPoolCacheDestruct) == 0);
+	if(!pPool->bActive)
+		DBGPRINTF("msg: pthread_key_create failed, object pool disabled\n");
+}
+
+/* seed a pool with a slab of nElt objects, allocated via srAllocPages().
+ * The pool bound is raised accordingly. *pFlagsDone tells which of the
+ * memFlags could be honored.
+ */
+static rsRetVal
+msgPoolAddSlab(msgPool_t *pPool, int nElt, int memFlags, int *pFlagsDone)
+{
+	msgPoolElt_t *pElt;
+	size_t len;
+	char *pSlab;
+	int i;
+	DEFiRet;
+
+	len = pPool->eltSize * nElt;
+	CHKmalloc(pSlab = srAllocPages(&len, memFlags, pFlagsDone));
+	nElt = len / pPool->eltSize; /* use what rounding up gave us */
+	pthread_mutex_lock(&pPool->mut);
+	for(i = 0 ; i < nElt ; ++i) {
+		pElt = (msgPoolElt_t*) (pSlab + i * pPool->eltSize);
+		pElt->pNext = pPool->pRoot;
+		pPool->pRoot = pElt;
+	}
+	pPool->nElt += nElt;
+	pPool->nMax += nElt;
+	pPool->pSlab = pSlab;
+	pPool->lenSlab = len;
+	pthread_mutex_unlock(&pPool->mut);
+	DBGPRINTF("msg: pool seeded with a slab of %d objects, %llu bytes\n",
+		  nElt, (unsigned long long) len);
+
+finalize_it:
+	RETiRet;
+}
+
+/* pre-allocate nMsgs msg objects, done once after the config has been
+ * loaded. The slab is pre-faulted; memFlags may add SRPAGES_HUGE and
+ * SRPAGES_MLOCK. The slab lives until the process terminates.
+ */
+rsRetVal
+msgPoolActivate(int nMsgs, int memFlags, int *pFlagsDone)
+{
+	DEFiRet;
+
+	*pFlagsDone = memFlags | SRPAGES_PREFAULT;
+	if(nMsgs <= 0 || !msgPoolMsg.bActive || msgPoolMsg.pSlab != NULL)
+		FINALIZE;
+	CHKiRet(msgPoolAddSlab(&msgPoolMsg, nMsgs, memFlags | SRPAGES_PREFAULT, pFlagsDone));
+finalize_it:
+	RETiRet;
+}
+
+/* allocate a buffer for a lazily formatted timestamp string */
+static inline char *
+msgAllocTSBuf(void)
+{
+	return (char*) msgPoolAlloc(&msgPoolTSBuf);
+}
+
+
+/* --------------- cold msg extension -------------------- */
+/* Obtain the cold extension of a message, allocating it on first use.
+ * As this may happen concurrently from multiple action workers, the new
+ * extension is published via CAS (or under the message lock if we do not
+ * have atomics). Returns NULL if we are out of memory.
+ */
+static struct msgCold *
+msgGetCold(msg_t * const pM)
+{
+	struct msgCold *pCold;
+
+	if(pM->pCold != NULL)
+		return pM->pCold;
+	if((pCold = (struct msgCold*) msgPoolAlloc(&msgPoolCold)) == NULL)
+		return NULL;
+	memset(pCold, 0, sizeof(struct msgCold));
+#ifdef HAVE_ATOMIC_BUILTINS
+	if(!ATOMIC_CAS(&pM->pCold, (struct msgCold*) NULL, pCold, NULL)) {
+		/* some other thread was faster, use its extension */
+		msgPoolFree(&msgPoolCold, pCold);
+	}
+#else
+	MsgLock(pM);
+	if(pM->pCold == NULL)
+		pM->pCold = pCold;
+	else
+		msgPoolFree(&msgPoolCold, pCold);
+	MsgUnlock(pM);
+#endif
+	return pM->pCold;
+}
+
+static void
+msgDestructCold(struct msgCold *pCold)
+{
+	msgPoolFree(&msgPoolTSBuf, pCold->pszRcvdAt_MySQL);
+	msgPoolFree(&msgPoolTSBuf, pCold->pszRcvdAt_PgSQL);
+	msgPoolFree(&msgPoolTSBuf, pCold->pszTIMESTAMP_MySQL);
+	msgPoolFree(&msgPoolTSBuf, pCold->pszTIMESTAMP_PgSQL);
+	free(pCold->pszUUID);
+	msgPoolFree(&msgPoolCold, pCold);
+}
+
+
 /* some forward declarations */
 static int getAPPNAMELen(msg_t * const pM, sbool bLockMutex);
 static rsRetVal jsonPathFindParent(struct json_object *jroot, uchar *name, uchar *leaf, struct json_object **parent, int bCreate);
 static uchar * jsonPathGetLeaf(uchar *name, int lenName);
+static struct json_object *jsonPathLookup(struct json_object *jroot, msgPropDescr_t *pProp);
 static struct json_object *jsonDeepCopy(struct json_object *src);
+static void msgRawShareRelease(struct msgRawShare *pShare);
+static void msgLocalVarsDestruct(struct msgLocalVars *const pLV);
 
 
-/* the locking and unlocking implementations: */
+/* the locking and unlocking implementations:
+ * msg objects no longer carry their own mutex. The hot lazy fields (the
+ * timestamp formats) are published lock-free, see msgLazyFmt*() below.
+ * The remaining, rarely executed, critical sections (DNS resolution, TAG,
+ * APPNAME and PROCID emulation, JSON modifications, ...) use a small table
+ * of mutexes which is indexed by the message address. No code path holds
+ * the lock of more than one message, so stripe collisions can not deadlock.
+ */
+#define MSG_LOCK_STRIPES 64
+static pthread_mutex_t msgLockTab[MSG_LOCK_STRIPES];
+
+static inline pthread_mutex_t *
+msgLockFor(msg_t *pThis)
+{
+	uintptr_t h = (uintptr_t) pThis;
+	h ^= h >> 12;
+	return &msgLockTab[(h >> 6) % MSG_LOCK_STRIPES];
+}
 static inline void
 MsgLock(msg_t *pThis)
 {
 	/* DEV debug only! dbgprintf("MsgLock(0x%lx)\n", (unsigned long) pThis); */
-	pthread_mutex_lock(&pThis->mut);
+	pthread_mutex_lock(msgLockFor(pThis));
 }
 static inline void
 MsgUnlock(msg_t *pThis)
 {
 	/* DEV debug only! dbgprintf("MsgUnlock(0x%lx)\n", (unsigned long) pThis); */
-	pthread_mutex_unlock(&pThis->mut);
+	pthread_mutex_unlock(msgLockFor(pThis));
 }
 
 
@@ -418,7 +927,7 @@ finalize_it:
 }
 
 
-static inline void
+void
 getInputName(msg_t * const pM, uchar **ppsz, int *plen)
 {
 	BEGINfunc
@@ -432,7 +941,7 @@ getInputName(msg_t * const pM, uchar **ppsz, int *plen)
 }
 
 
-static inline uchar*
+uchar*
 getRcvFromIP(msg_t * const pM)
 {
 	uchar *psz;
@@ -661,7 +1170,7 @@ static inline rsRetVal msgBaseConstruct(msg_t **ppThis)
 	msg_t *pM;
 
 	assert(ppThis != NULL);
-	CHKmalloc(pM = MALLOC(sizeof(msg_t)));
+	CHKmalloc(pM = msgPoolAlloc(&msgPoolMsg));
 	objConstructSetObjInfo(pM); /* intialize object helper entities */
 
 	/* initialize members in ORDER they appear in structure (think "cache line"!) */
@@ -670,7 +1179,6 @@ static inline rsRetVal msgBaseConstruct(msg_t **ppThis)
 	pM->iRefCount = 1;
 	pM->iSeverity = -1;
 	pM->iFacility = -1;
-	pM->iLenPROGNAME = -1;
 	pM->offAfterPRI = 0;
 	pM->offMSG = -1;
 	pM->iProtocolVersion = 0;
@@ -680,17 +1188,13 @@ static inline rsRetVal msgBaseConstruct(msg_t **ppThis)
 	pM->iLenTAG = 0;
 	pM->iLenHOSTNAME = 0;
 	pM->pszRawMsg = NULL;
-	pM->pszHOSTNAME = NULL;
+	pM->pTAG = NULL;
+	pM->pHOSTNAME = NULL;
+	pM->pPROGNAME = NULL;
 	pM->pszRcvdAt3164 = NULL;
 	pM->pszRcvdAt3339 = NULL;
-	pM->pszRcvdAt_MySQL = NULL;
-        pM->pszRcvdAt_PgSQL = NULL;
-	pM->pszTIMESTAMP3164 = NULL;
-	pM->pszTIMESTAMP3339 = NULL;
-	pM->pszTIMESTAMP_MySQL = NULL;
-        pM->pszTIMESTAMP_PgSQL = NULL;
 	pM->pszStrucData = NULL;
-	pM->pCSAPPNAME = NULL;
+	pM->pAPPNAME = NULL;
 	pM->pCSPROCID = NULL;
 	pM->pCSMSGID = NULL;
 	pM->pInputName = NULL;
@@ -699,18 +1203,19 @@ static inline rsRetVal msgBaseConstruct(msg_t **ppThis)
 	pM->pRuleset = NULL;
 	pM->json = NULL;
 	pM->localvars = NULL;
-	pM->dfltTZ[0] = '\0';
+	pM->pLocalVars = NULL;
+	pM->pStages = NULL;
+	pM->iMemSize = 0;
 	memset(&pM->tRcvdAt, 0, sizeof(pM->tRcvdAt));
 	memset(&pM->tTIMESTAMP, 0, sizeof(pM->tTIMESTAMP));
-	pM->TAG.pszTAG = NULL;
-	pM->pszTimestamp3164[0] = '\0';
 	pM->pszTimestamp3339[0] = '\0';
 	pM->pszTIMESTAMP_SecFrac[0] = '\0';
 	pM->pszRcvdAt_SecFrac[0] = '\0';
 	pM->pszTIMESTAMP_Unix[0] = '\0';
 	pM->pszRcvdAt_Unix[0] = '\0';
-	pM->pszUUID = NULL;
-	pthread_mutex_init(&pM->mut, NULL);
+	pM->lazyInit = 0;
+	pM->pCold = NULL;
+	pM->pRawShare = NULL;
 
 	/* DEV debugging only! dbgprintf("msgConstruct\t0x%x, ref 1\n", (int)pM);*/
 
@@ -782,21 +1287,6 @@ msgConstructForDeserializer(msg_t **ppThis)
 }
 
 
-/* some free handlers for (slightly) complicated cases... All of them may be called
- * with an empty element.
- */
-static inline void freeTAG(msg_t *pThis)
-{
-	if(pThis->iLenTAG >= CONF_TAG_BUFSIZE)
-		free(pThis->TAG.pszTAG);
-}
-static inline void freeHOSTNAME(msg_t *pThis)
-{
-	if(pThis->iLenHOSTNAME >= CONF_HOSTNAME_BUFSIZE)
-		free(pThis->pszHOSTNAME);
-}
-
-
 BEGINobjDestruct(msg) /* be sure to specify the object type also in END and CODESTART macros! */
 	int currRefCount;
 #	if HAVE_MALLOC_TRIM
@@ -813,10 +1303,14 @@ CODESTARTobjDestruct(msg)
 	if(currRefCount == 0)
 	{
 		/* DEV Debugging Only! dbgprintf("msgDestruct\t0x%lx, RefCount now 0, doing DESTROY\n", (unsigned long)pThis); */
-		if(pThis->pszRawMsg != pThis->szRawMsg)
+		if(pThis->pRawShare != NULL)
+			msgRawShareRelease(pThis->pRawShare);
+		else if(pThis->pszRawMsg != pThis->szRawMsg)
 			free(pThis->pszRawMsg);
-		freeTAG(pThis);
-		freeHOSTNAME(pThis);
+		if(pThis->pTAG != NULL)
+			prop.Destruct(&pThis->pTAG);
+		if(pThis->pHOSTNAME != NULL)
+			prop.Destruct(&pThis->pHOSTNAME);
 		if(pThis->pInputName != NULL)
 			prop.Destruct(&pThis->pInputName);
 		if((pThis->msgFlags & NEEDS_DNSRESOL) == 0) {
@@ -827,17 +1321,13 @@ CODESTARTobjDestruct(msg)
 		}
 		if(pThis->pRcvFromIP != NULL)
 			prop.Destruct(&pThis->pRcvFromIP);
-		free(pThis->pszRcvdAt3164);
-		free(pThis->pszRcvdAt3339);
-		free(pThis->pszRcvdAt_MySQL);
-		free(pThis->pszRcvdAt_PgSQL);
-		free(pThis->pszTIMESTAMP_MySQL);
-		free(pThis->pszTIMESTAMP_PgSQL);
+		msgPoolFree(&msgPoolTSBuf, pThis->pszRcvdAt3164);
+		msgPoolFree(&msgPoolTSBuf, pThis->pszRcvdAt3339);
 		free(pThis->pszStrucData);
-		if(pThis->iLenPROGNAME >= CONF_PROGNAME_BUFSIZE)
-			free(pThis->PROGNAME.ptr);
-		if(pThis->pCSAPPNAME != NULL)
-			rsCStrDestruct(&pThis->pCSAPPNAME);
+		if(pThis->pPROGNAME != NULL)
+			prop.Destruct(&pThis->pPROGNAME);
+		if(pThis->pAPPNAME != NULL)
+			prop.Destruct(&pThis->pAPPNAME);
 		if(pThis->pCSPROCID != NULL)
 			rsCStrDestruct(&pThis->pCSPROCID);
 		if(pThis->pCSMSGID != NULL)
@@ -846,12 +1336,13 @@ CODESTARTobjDestruct(msg)
 			json_object_put(pThis->json);
 		if(pThis->localvars != NULL)
 			json_object_put(pThis->localvars);
-		if(pThis->pszUUID != NULL)
-			free(pThis->pszUUID);
+		msgLocalVarsDestruct(pThis->pLocalVars);
+		free(pThis->pStages);
+		if(pThis->pCold != NULL)
+			msgDestructCold(pThis->pCold);
 #	ifndef HAVE_ATOMIC_BUILTINS
 		MsgUnlock(pThis);
 # 	endif
-		pthread_mutex_destroy(&pThis->mut);
 		/* now we need to do our own optimization. Testing has shown that at least the glibc
 		 * malloc() subsystem returns memory to the OS far too late in our case. So we need
 		 * to help it a bit, by calling malloc_trim(), which will tell the alloc subsystem
@@ -872,6 +1363,10 @@ CODESTARTobjDestruct(msg)
 			}
 		}
 #		endif
+		/* finally, recycle the object itself (so the framework must not free it) */
+		obj.DestructObjSelf((obj_t*) pThis);
+		msgPoolFree(&msgPoolMsg, pThis);
+		pThis = NULL;
 	} else {
 #	ifndef HAVE_ATOMIC_BUILTINS
 		MsgUnlock(pThis);
@@ -881,110 +1376,513 @@ CODESTARTobjDestruct(msg)
 ENDobjDestruct(msg)
 
 
-/* The macros below are used in MsgDup(). I use macros
- * to keep the fuction code somewhat more readyble. It is my
- * replacement for inline functions in CPP
+/* Copy-on-write support for the raw message. Large raw messages (those
+ * that do not fit into szRawMsg) are shared between MsgDup()'ed messages
+ * instead of being copied. This makes forwarding to other rulesets (via
+ * omruleset or "call" of a ruleset with its own queue) cheap for large
+ * messages. Everything that modifies the raw message in place must call
+ * MsgRawUnshare() first. Modules that rewrite the MSG part in place
+ * obtain it via getMSGForWrite(), which does so.
  */
-#define tmpCOPYSZ(name) \
-	if(pOld->psz##name != NULL) { \
-		if((pNew->psz##name = srUtilStrDup(pOld->psz##name, pOld->iLen##name)) == NULL) {\
-			msgDestruct(&pNew);\
-			return NULL;\
-		}\
-		pNew->iLen##name = pOld->iLen##name;\
+struct msgRawShare {
+	uchar *buf;
+	int refCnt;
+	DEF_ATOMIC_HELPER_MUT(mutRefCnt);
+};
+
+static void
+msgRawShareRelease(struct msgRawShare *pShare)
+{
+	if(ATOMIC_DEC_AND_FETCH(&pShare->refCnt, &pShare->mutRefCnt) == 0) {
+		free(pShare->buf);
+		DESTROY_ATOMIC_HELPER_MUT(pShare->mutRefCnt);
+		free(pShare);
 	}
+}
 
-/* copy the CStr objects.
- * if the old value is NULL, we do not need to do anything because we
- * initialized the new value to NULL via calloc().
+/* let pNew reference the raw message of pOld. Returns 0 if the buffer
+ * could not be shared, the caller must then copy it.
+ * Must be called with the lock of the original message held.
  */
-#define tmpCOPYCSTR(name) \
-	if(pOld->pCS##name != NULL) {\
-		if(rsCStrConstructFromCStr(&(pNew->pCS##name), pOld->pCS##name) != RS_RET_OK) {\
-			msgDestruct(&pNew);\
-			return NULL;\
-		}\
+static int
+msgRawShareWith(msg_t *pOld, msg_t *pNew)
+{
+	struct msgRawShare *pShare;
+
+	if(pOld->pRawShare == NULL) {
+		if((pShare = malloc(sizeof(struct msgRawShare))) == NULL)
+			return 0;
+		pShare->buf = pOld->pszRawMsg;
+		pShare->refCnt = 1;
+		INIT_ATOMIC_HELPER_MUT(pShare->mutRefCnt);
+		pOld->pRawShare = pShare;
 	}
-/* Constructs a message object by duplicating another one.
- * Returns NULL if duplication failed. We do not need to lock the
- * message object here, because a fully-created msg object is never
- * allowed to be manipulated. For this, MsgDup() must be used, so MsgDup()
- * can never run into a situation where the message object is being
- * modified while its content is copied - it's forbidden by definition.
- * rgerhards, 2007-07-10
+	ATOMIC_INC(&pOld->pRawShare->refCnt, &pOld->pRawShare->mutRefCnt);
+	pNew->pRawShare = pOld->pRawShare;
+	pNew->pszRawMsg = pOld->pszRawMsg;
+	return 1;
+}
+
+/* make sure the raw message is private to pThis before it is modified in
+ * place. If the copy fails, the message is truncated to szRawMsg, much
+ * like MsgSetRawMsg() does.
  */
-msg_t* MsgDup(msg_t* pOld)
+void
+MsgRawUnshare(msg_t *pThis)
 {
-	msg_t* pNew;
-	rsRetVal localRet;
-
-	assert(pOld != NULL);
-
-	BEGINfunc
-	if(msgConstructWithTime(&pNew, &pOld->tTIMESTAMP, pOld->ttGenTime) != RS_RET_OK) {
-		return NULL;
-	}
+	struct msgRawShare *pShare;
+	uchar *pBuf;
 
-	/* now copy the message properties */
-	pNew->iRefCount = 1;
-	pNew->iSeverity = pOld->iSeverity;
-	pNew->iFacility = pOld->iFacility;
-	pNew->msgFlags = pOld->msgFlags;
-	pNew->iProtocolVersion = pOld->iProtocolVersion;
-	pNew->ttGenTime = pOld->ttGenTime;
-	pNew->offMSG = pOld->offMSG;
-	pNew->iLenRawMsg = pOld->iLenRawMsg;
-	pNew->iLenMSG = pOld->iLenMSG;
-	pNew->iLenTAG = pOld->iLenTAG;
-	pNew->iLenHOSTNAME = pOld->iLenHOSTNAME;
-	if((pOld->msgFlags & NEEDS_DNSRESOL)) {
-			localRet = msgSetFromSockinfo(pNew, pOld->rcvFrom.pfrominet);
-			if(localRet != RS_RET_OK) {
-				/* if something fails, we accept loss of this property, it is
-				 * better than losing the whole message.
-				 */
-				pNew->msgFlags &= ~NEEDS_DNSRESOL;
-				pNew->rcvFrom.pRcvFrom = NULL; /* make sure no dangling values */
-			}
+	if(pThis->pRawShare == NULL)
+		return;
+	MsgLock(pThis);
+	pShare = pThis->pRawShare;
+	if(ATOMIC_FETCH_32BIT(&pShare->refCnt, &pShare->mutRefCnt) == 1) {
+		/* we are the last user, take over the buffer. No one else can
+		 * obtain a new reference, as that requires a message holding
+		 * the share, which is only us (and we have the lock).
+		 */
+		DESTROY_ATOMIC_HELPER_MUT(pShare->mutRefCnt);
+		free(pShare);
 	} else {
-		if(pOld->rcvFrom.pRcvFrom != NULL) {
-			pNew->rcvFrom.pRcvFrom = pOld->rcvFrom.pRcvFrom;
-			prop.AddRef(pNew->rcvFrom.pRcvFrom);
-		}
-	}
-	if(pOld->pRcvFromIP != NULL) {
-		pNew->pRcvFromIP = pOld->pRcvFromIP;
-		prop.AddRef(pNew->pRcvFromIP);
-	}
-	if(pOld->pInputName != NULL) {
-		pNew->pInputName = pOld->pInputName;
-		prop.AddRef(pNew->pInputName);
-	}
-	if(pOld->iLenTAG > 0) {
-		if(pOld->iLenTAG < CONF_TAG_BUFSIZE) {
-			memcpy(pNew->TAG.szBuf, pOld->TAG.szBuf, pOld->iLenTAG + 1);
-		} else {
-			if((pNew->TAG.pszTAG = srUtilStrDup(pOld->TAG.pszTAG, pOld->iLenTAG)) == NULL) {
-				msgDestruct(&pNew);
-				return NULL;
-			}
-			pNew->iLenTAG = pOld->iLenTAG;
+		if((pBuf = MALLOC(pThis->iLenRawMsg + 1)) == NULL) {
+			pThis->iLenRawMsg = CONF_RAWMSG_BUFSIZE - 1;
+			pBuf = pThis->szRawMsg;
 		}
+		memcpy(pBuf, pShare->buf, pThis->iLenRawMsg);
+		pBuf[pThis->iLenRawMsg] = '\0';
+		pThis->pszRawMsg = pBuf;
+		if(pThis->offMSG + pThis->iLenMSG > pThis->iLenRawMsg)
+			pThis->iLenMSG = (pThis->offMSG < pThis->iLenRawMsg)
+				       ? pThis->iLenRawMsg - pThis->offMSG : 0;
+		msgRawShareRelease(pShare);
 	}
-	if(pOld->iLenRawMsg < CONF_RAWMSG_BUFSIZE) {
-		memcpy(pNew->szRawMsg, pOld->szRawMsg, pOld->iLenRawMsg + 1);
-		pNew->pszRawMsg = pNew->szRawMsg;
-	} else {
-		tmpCOPYSZ(RawMsg);
+	pThis->pRawShare = NULL;
+	MsgUnlock(pThis);
+}
+
+
+/* Pooled storage for message-local variables ($.xxx).
+ * Most configs only use simple top-level local variables, which are set
+ * and read during ruleset processing. Keeping them in a json-c tree means
+ * a lot of allocations for each message. So top-level names used in the
+ * config are assigned fixed slots at config load (msgLocalVarSlot()) and
+ * their values are kept in a slot array that is taken from a per-thread
+ * pool. The slot array is authoritative as long as the message has no
+ * localvars tree. When the tree is needed (sub-paths, the full "$." tree,
+ * plugins, serialization), the slot values are converted into it
+ * ("materialized") and from then on only the tree is used. Slot values are
+ * kept untouched until the message is destructed, so that a reader that
+ * still looks at them concurrently is safe.
+ */
+#define MSG_LOCALVAR_SLOTS 32
+struct msgLocalVars {
+	int nUsed;	/* slots 0..nUsed-1 may hold a value */
+	struct var val[MSG_LOCALVAR_SLOTS]; /* datatype 0 means "not set" */
+};
+static uchar *localVarSlotName[MSG_LOCALVAR_SLOTS];
+static int nLocalVarSlots = 0;
+static msgPool_t msgPoolLocalVars;
+
+/* obtain the slot for a local variable name (".xxx" or normalized "!xxx").
+ * Only called by the config parser, which also runs when a ruleset file is
+ * reloaded. A new slot is only used by the new script, which becomes visible
+ * to the workers after the slot name is stored. Returns -1 if the name is not eligible for
+ * a slot (root, sub-path) or all slots are taken.
+ */
+int
+msgLocalVarSlot(const uchar *const name)
+{
+	int i;
+
+	if(   (name[0] != '.' && name[0] != '!') || name[1] == '\0'
+	   || strchr((char*) name + 1, '!') != NULL)
+		return -1;
+	for(i = 0 ; i < nLocalVarSlots ; ++i)
+		if(!ustrcmp(localVarSlotName[i], name + 1))
+			return i;
+	if(nLocalVarSlots == MSG_LOCALVAR_SLOTS) {
+		DBGPRINTF("msg: no local variable slot left for '%s'\n", name);
+		return -1;
 	}
-	if(pOld->pszHOSTNAME == NULL) {
-		pNew->pszHOSTNAME = NULL;
-	} else {
-		if(pOld->iLenHOSTNAME < CONF_HOSTNAME_BUFSIZE) {
-			memcpy(pNew->szHOSTNAME, pOld->szHOSTNAME, pOld->iLenHOSTNAME + 1);
-			pNew->pszHOSTNAME = pNew->szHOSTNAME;
+	if((localVarSlotName[nLocalVarSlots] = ustrdup(name + 1)) == NULL)
+		return -1;
+	DBGPRINTF("msg: local variable '%s' uses slot %d\n", name, nLocalVarSlots);
+	return nLocalVarSlots++;
+}
+
+static inline void
+msgLocalVarClear(struct var *const v)
+{
+	if(v->datatype == 'S')
+		es_deleteStr(v->d.estr);
+	else if(v->datatype == 'J')
+		json_object_put(v->d.json);
+	v->datatype = 0;
+}
+
+static void
+msgLocalVarsDestruct(struct msgLocalVars *const pLV)
+{
+	int i;
+
+	if(pLV == NULL)
+		return;
+	for(i = 0 ; i < pLV->nUsed ; ++i)
+		msgLocalVarClear(&pLV->val[i]);
+	msgPoolFree(&msgPoolLocalVars, pLV);
+}
+
+/* convert a rainerscript value into a (new) json object */
+static struct json_object *
+msgVarToJSON(struct var *const v)
+{
+	struct json_object *json = NULL;
+	char *cstr;
+
+	switch(v->datatype) {
+	case 'S':/* string */
+		cstr = es_str2cstr(v->d.estr, NULL);
+		json = json_object_new_string(cstr);
+		free(cstr);
+		break;
+	case 'N':/* number (integer) */
+#ifdef HAVE_JSON_OBJECT_NEW_INT64
+		json = json_object_new_int64(v->d.n);
+#else /* HAVE_JSON_OBJECT_NEW_INT64 */
+		json = json_object_new_int((int) v->d.n);
+#endif /* HAVE_JSON_OBJECT_NEW_INT64 */
+		break;
+	case 'J':/* native JSON */
+		json = jsonDeepCopy(v->d.json);
+		break;
+	default:DBGPRINTF("msgVarToJSON: unsupported datatype %c\n",
+		v->datatype);
+		break;
+	}
+	return json;
+}
+
+/* build the localvars tree from the slot values, if there are any and the
+ * tree does not yet exist. Must be called with the message lock held.
+ */
+static void
+msgLocalVarsMaterialize(msg_t *const pM)
+{
+	struct msgLocalVars *const pLV = pM->pLocalVars;
+	struct json_object *jroot, *json;
+	int i;
+
+	if(pM->localvars != NULL || pLV == NULL)
+		return;
+	if((jroot = json_object_new_object()) == NULL)
+		return;
+	for(i = 0 ; i < pLV->nUsed ; ++i) {
+		if(pLV->val[i].datatype == 0)
+			continue;
+		if((json = msgVarToJSON(&pLV->val[i])) != NULL)
+			json_object_object_add(jroot, (char*) localVarSlotName[i], json);
+	}
+	pM->localvars = jroot;
+}
+
+/* return the localvars tree, materializing the slot values if required */
+static struct json_object *
+msgGetLocalVarsTree(msg_t *const pM)
+{
+	if(pM->localvars == NULL && pM->pLocalVars != NULL) {
+		MsgLock(pM);
+		msgLocalVarsMaterialize(pM);
+		MsgUnlock(pM);
+	}
+	return pM->localvars;
+}
+
+/* copy the slot values to a duplicated message. Must be called with the
+ * lock of the original message held.
+ */
+static void
+msgLocalVarsDup(msg_t *const pOld, msg_t *const pNew)
+{
+	struct msgLocalVars *const pLV = pOld->pLocalVars;
+	struct msgLocalVars *pNewLV;
+	struct var *v;
+	int i;
+
+	if((pNewLV = msgPoolAlloc(&msgPoolLocalVars)) == NULL) {
+		/* fall back to copying the tree */
+		msgLocalVarsMaterialize(pOld);
+		return;
+	}
+	pNewLV->nUsed = pLV->nUsed;
+	for(i = 0 ; i < pLV->nUsed ; ++i) {
+		v = &pNewLV->val[i];
+		v->datatype = pLV->val[i].datatype;
+		if(v->datatype == 'S') {
+			if((v->d.estr = es_strdup(pLV->val[i].d.estr)) == NULL)
+				v->datatype = 0;
+		} else if(v->datatype == 'J') {
+			if((v->d.json = jsonDeepCopy(pLV->val[i].d.json)) == NULL)
+				v->datatype = 0;
 		} else {
-			tmpCOPYSZ(HOSTNAME);
+			v->d = pLV->val[i].d;
+		}
+	}
+	pNew->pLocalVars = pNewLV;
+}
+
+/* set a local variable via its slot. The value of v is taken over for
+ * strings (v is reset so that varDelete() does not free it), JSON values
+ * are copied. If the message already has a localvars tree, the tree is
+ * updated instead.
+ */
+rsRetVal
+msgSetLocalVar(msg_t *const pM, const int slot, uchar *const varname, struct var *const v)
+{
+	struct msgLocalVars *pLV;
+	struct var *pVal;
+	int i;
+	DEFiRet;
+
+	if(slot < 0 || pM->localvars != NULL || (v->datatype != 'S' && v->datatype != 'N'
+	   && v->datatype != 'J')) {
+		iRet = msgSetJSONFromVar(pM, varname, v);
+		FINALIZE;
+	}
+
+	MsgLock(pM);
+	if((pLV = pM->pLocalVars) == NULL) {
+		if((pLV = msgPoolAlloc(&msgPoolLocalVars)) == NULL) {
+			MsgUnlock(pM);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		pLV->nUsed = 0;
+		pM->pLocalVars = pLV;
+	}
+	for(i = pLV->nUsed ; i <= slot ; ++i)
+		pLV->val[i].datatype = 0;
+	if(slot >= pLV->nUsed)
+		pLV->nUsed = slot + 1;
+	pVal = &pLV->val[slot];
+	msgLocalVarClear(pVal);
+	if(v->datatype == 'S') {
+		pVal->d.estr = v->d.estr;
+		v->datatype = 'N';
+		v->d.n = 0;
+		pVal->datatype = 'S';
+	} else if(v->datatype == 'J') {
+		if(v->d.json != NULL && (pVal->d.json = jsonDeepCopy(v->d.json)) != NULL)
+			pVal->datatype = 'J';
+	} else {
+		pVal->d.n = v->d.n;
+		pVal->datatype = 'N';
+	}
+	MsgUnlock(pM);
+
+finalize_it:
+	RETiRet;
+}
+
+/* unset a local variable via its slot, see msgSetLocalVar() */
+rsRetVal
+msgUnsetLocalVar(msg_t *const pM, const int slot, uchar *const varname)
+{
+	DEFiRet;
+
+	if(slot < 0 || pM->localvars != NULL) {
+		iRet = msgDelJSON(pM, varname);
+		FINALIZE;
+	}
+	MsgLock(pM);
+	if(pM->pLocalVars != NULL && slot < pM->pLocalVars->nUsed)
+		msgLocalVarClear(&pM->pLocalVars->val[slot]);
+	MsgUnlock(pM);
+
+finalize_it:
+	RETiRet;
+}
+
+/* obtain the value of a slot-based local variable. Strings are returned as
+ * a new copy, JSON values are borrowed from the message (as with
+ * msgGetJSONPropJSON()). A variable that is not set is returned as NULL
+ * JSON value. Returns RS_RET_NOT_FOUND if the variable is not kept in a
+ * slot, in which case the caller must use the localvars tree.
+ */
+rsRetVal
+msgGetLocalVar(msg_t *const pM, msgPropDescr_t *const pProp, struct var *const ret)
+{
+	struct msgLocalVars *const pLV = pM->pLocalVars;
+	const struct var *pVal;
+	DEFiRet;
+
+	if(pProp->localSlot < 0 || pM->localvars != NULL)
+		ABORT_FINALIZE(RS_RET_NOT_FOUND);
+	if(pLV == NULL || pProp->localSlot >= pLV->nUsed
+	   || (pVal = &pLV->val[pProp->localSlot])->datatype == 0) {
+		ret->datatype = 'J';
+		ret->d.json = NULL;
+		FINALIZE;
+	}
+	ret->datatype = pVal->datatype;
+	if(pVal->datatype == 'S') {
+		if((ret->d.estr = es_strdup(pVal->d.estr)) == NULL) {
+			ret->datatype = 'J';
+			ret->d.json = NULL;
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+	} else {
+		ret->d = pVal->d;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+/* same as msgGetLocalVar(), but return the value as a (newly allocated)
+ * string, as required by getJSONPropVal().
+ */
+static rsRetVal
+msgGetLocalVarStr(msg_t *const pM, msgPropDescr_t *const pProp, uchar **pRes, rs_size_t *buflen)
+{
+	struct msgLocalVars *const pLV = pM->pLocalVars;
+	const struct var *pVal;
+	char numbuf[32];
+	DEFiRet;
+
+	if(pProp->localSlot < 0 || pM->localvars != NULL)
+		ABORT_FINALIZE(RS_RET_NOT_FOUND);
+	*pRes = NULL;
+	if(pLV == NULL || pProp->localSlot >= pLV->nUsed)
+		FINALIZE;
+	pVal = &pLV->val[pProp->localSlot];
+	switch(pVal->datatype) {
+	case 'S':
+		*pRes = (uchar*) es_str2cstr(pVal->d.estr, NULL);
+		break;
+	case 'N':
+		snprintf(numbuf, sizeof(numbuf), "%lld", pVal->d.n);
+		*pRes = (uchar*) strdup(numbuf);
+		break;
+	case 'J':
+		*pRes = (uchar*) strdup(json_object_get_string(pVal->d.json));
+		break;
+	default:
+		break;
+	}
+	if(*pRes != NULL)
+		*buflen = (rs_size_t) ustrlen(*pRes);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* The macros below are used in MsgDup(). I use macros
+ * to keep the fuction code somewhat more readyble. It is my
+ * replacement for inline functions in CPP
+ */
+#define tmpCOPYSZ(name) \
+	if(pOld->psz##name != NULL) { \
+		if((pNew->psz##name = srUtilStrDup(pOld->psz##name, pOld->iLen##name)) == NULL) {\
+			msgDestruct(&pNew);\
+			return NULL;\
+		}\
+		pNew->iLen##name = pOld->iLen##name;\
+	}
+
+/* copy the CStr objects.
+ * if the old value is NULL, we do not need to do anything because we
+ * initialized the new value to NULL via calloc().
+ */
+#define tmpCOPYCSTR(name) \
+	if(pOld->pCS##name != NULL) {\
+		if(rsCStrConstructFromCStr(&(pNew->pCS##name), pOld->pCS##name) != RS_RET_OK) {\
+			msgDestruct(&pNew);\
+			return NULL;\
+		}\
+	}
+/* Constructs a message object by duplicating another one.
+ * Returns NULL if duplication failed. We do not need to lock the
+ * message object here, because a fully-created msg object is never
+ * allowed to be manipulated. For this, MsgDup() must be used, so MsgDup()
+ * can never run into a situation where the message object is being
+ * modified while its content is copied - it's forbidden by definition.
+ * rgerhards, 2007-07-10
+ */
+msg_t* MsgDup(msg_t* pOld)
+{
+	msg_t* pNew;
+	rsRetVal localRet;
+	int bShared;
+
+	assert(pOld != NULL);
+
+	BEGINfunc
+	if(msgConstructWithTime(&pNew, &pOld->tTIMESTAMP, pOld->ttGenTime) != RS_RET_OK) {
+		return NULL;
+	}
+
+	/* now copy the message properties */
+	pNew->iRefCount = 1;
+	pNew->iSeverity = pOld->iSeverity;
+	pNew->iFacility = pOld->iFacility;
+	pNew->msgFlags = pOld->msgFlags;
+	pNew->iProtocolVersion = pOld->iProtocolVersion;
+	pNew->ttGenTime = pOld->ttGenTime;
+	pNew->offMSG = pOld->offMSG;
+	pNew->iLenRawMsg = pOld->iLenRawMsg;
+	pNew->iLenMSG = pOld->iLenMSG;
+	pNew->iLenTAG = pOld->iLenTAG;
+	pNew->iLenHOSTNAME = pOld->iLenHOSTNAME;
+	if((pOld->msgFlags & NEEDS_DNSRESOL)) {
+			localRet = msgSetFromSockinfo(pNew, pOld->rcvFrom.pfrominet);
+			if(localRet != RS_RET_OK) {
+				/* if something fails, we accept loss of this property, it is
+				 * better than losing the whole message.
+				 */
+				pNew->msgFlags &= ~NEEDS_DNSRESOL;
+				pNew->rcvFrom.pRcvFrom = NULL; /* make sure no dangling values */
+			}
+	} else {
+		if(pOld->rcvFrom.pRcvFrom != NULL) {
+			pNew->rcvFrom.pRcvFrom = pOld->rcvFrom.pRcvFrom;
+			prop.AddRef(pNew->rcvFrom.pRcvFrom);
+		}
+	}
+	if(pOld->pRcvFromIP != NULL) {
+		pNew->pRcvFromIP = pOld->pRcvFromIP;
+		prop.AddRef(pNew->pRcvFromIP);
+	}
+	if(pOld->pInputName != NULL) {
+		pNew->pInputName = pOld->pInputName;
+		prop.AddRef(pNew->pInputName);
+	}
+	/* interned props are simply shared */
+	if(pOld->pTAG != NULL) {
+		pNew->pTAG = pOld->pTAG;
+		prop.AddRef(pNew->pTAG);
+	}
+	if(pOld->pHOSTNAME != NULL) {
+		pNew->pHOSTNAME = pOld->pHOSTNAME;
+		prop.AddRef(pNew->pHOSTNAME);
+	}
+	if(pOld->pPROGNAME != NULL) {
+		pNew->pPROGNAME = pOld->pPROGNAME;
+		prop.AddRef(pNew->pPROGNAME);
+	}
+	if(pOld->pAPPNAME != NULL) {
+		pNew->pAPPNAME = pOld->pAPPNAME;
+		prop.AddRef(pNew->pAPPNAME);
+	}
+	if(pOld->iLenRawMsg < CONF_RAWMSG_BUFSIZE) {
+		memcpy(pNew->szRawMsg, pOld->szRawMsg, pOld->iLenRawMsg + 1);
+		pNew->pszRawMsg = pNew->szRawMsg;
+	} else {
+		MsgLock(pOld);
+		bShared = msgRawShareWith(pOld, pNew);
+		MsgUnlock(pOld);
+		if(!bShared) {
+			tmpCOPYSZ(RawMsg);
 		}
 	}
 	if(pOld->pszStrucData == NULL) {
@@ -994,14 +1892,19 @@ msg_t* MsgDup(msg_t* pOld)
 		pNew->lenStrucData = pOld->lenStrucData;
 	}
 
-	tmpCOPYCSTR(APPNAME);
 	tmpCOPYCSTR(PROCID);
 	tmpCOPYCSTR(MSGID);
 
-	if(pOld->json != NULL)
-		pNew->json = jsonDeepCopy(pOld->json);
-	if(pOld->localvars != NULL)
-		pNew->localvars = jsonDeepCopy(pOld->localvars);
+	if(pOld->json != NULL || pOld->localvars != NULL || pOld->pLocalVars != NULL) {
+		MsgLock(pOld);
+		if(pOld->json != NULL)
+			pNew->json = jsonDeepCopy(pOld->json);
+		if(pOld->localvars == NULL && pOld->pLocalVars != NULL)
+			msgLocalVarsDup(pOld, pNew);
+		if(pOld->localvars != NULL)
+			pNew->localvars = jsonDeepCopy(pOld->localvars);
+		MsgUnlock(pOld);
+	}
 
 	/* we do not copy all other cache properties, as we do not even know
 	 * if they are needed once again. So we let them re-create if needed.
@@ -1045,11 +1948,14 @@ static rsRetVal MsgSerialize(msg_t *pThis, strm_t *pStrm)
 	objSerializeSCALAR(pStrm, tRcvdAt, SYSLOGTIME);
 	objSerializeSCALAR(pStrm, tTIMESTAMP, SYSLOGTIME);
 
-	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszTAG"), PROPTYPE_PSZ, (void*)
-		((pThis->iLenTAG < CONF_TAG_BUFSIZE) ? pThis->TAG.szBuf : pThis->TAG.pszTAG)));
+	if(pThis->pTAG != NULL)
+		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszTAG"), PROPTYPE_PSZ,
+			(void*) propGetSzStr(pThis->pTAG)));
 
 	objSerializePTR(pStrm, pszRawMsg, PSZ);
-	objSerializePTR(pStrm, pszHOSTNAME, PSZ);
+	if(pThis->pHOSTNAME != NULL)
+		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszHOSTNAME"), PROPTYPE_PSZ,
+			(void*) propGetSzStr(pThis->pHOSTNAME)));
 	getInputName(pThis, &psz, &len);
 	CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszInputName"), PROPTYPE_PSZ, (void*) psz));
 	psz = getRcvFrom(pThis); 
@@ -1062,16 +1968,19 @@ static rsRetVal MsgSerialize(msg_t *pThis, strm_t *pStrm)
 		psz = (uchar*) json_object_get_string(pThis->json);
 		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("json"), PROPTYPE_PSZ, (void*) psz));
 	}
-	if(pThis->localvars != NULL) {
+	if(msgGetLocalVarsTree(pThis) != NULL) {
 		psz = (uchar*) json_object_get_string(pThis->localvars);
 		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("localvars"), PROPTYPE_PSZ, (void*) psz));
 	}
 
-	objSerializePTR(pStrm, pCSAPPNAME, CSTR);
+	if(pThis->pAPPNAME != NULL)
+		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pCSAPPNAME"), PROPTYPE_PSZ,
+			(void*) propGetSzStr(pThis->pAPPNAME)));
 	objSerializePTR(pStrm, pCSPROCID, CSTR);
 	objSerializePTR(pStrm, pCSMSGID, CSTR);
 	
-	objSerializePTR(pStrm, pszUUID, PSZ);
+	if(pThis->pCold != NULL && pThis->pCold->pszUUID != NULL)
+		CHKiRet(obj.SerializeProp(pStrm, UCHAR_CONSTANT("pszUUID"), PROPTYPE_PSZ, (void*) pThis->pCold->pszUUID));
 
 	if(pThis->pRuleset != NULL) {
 		rulesetGetName(pThis->pRuleset);
@@ -1236,7 +2145,8 @@ MsgDeserialize(msg_t * const pMsg, strm_t *pStrm)
 		CHKiRet(objDeserializeProperty(pVar, pStrm));
 	}
 	if(isProp("pszUUID")) {
-		pMsg->pszUUID = ustrdup(rsCStrGetSzStrNoNULL(pVar->val.pStr));
+		if(msgGetCold(pMsg) != NULL)
+			pMsg->pCold->pszUUID = ustrdup(rsCStrGetSzStrNoNULL(pVar->val.pStr));
 		reinitVar(pVar);
 		CHKiRet(objDeserializeProperty(pVar, pStrm));
 	}
@@ -1261,6 +2171,336 @@ finalize_it:
 #undef isProp
 
 
+/* The following functions implement the compact binary message format that
+ * is used for disk queue records (the record framing itself is done by the
+ * queue). All integers are stored in network byte order. Strings are stored
+ * as a 4 octet length, followed by the string data and a terminating NUL
+ * octet, which is not included in the length. A length of 0xffffffff means
+ * the string is not present (and is not followed by any data).
+ * The field order must never be changed. If fields need to be added, the
+ * record version inside the queue must be incremented.
+ */
+#define BINREC_STR_ABSENT 0xffffffffu
+enum {	/* string fields in the order they appear in the record */
+	BINREC_TAG = 0,
+	BINREC_RAWMSG,
+	BINREC_HOSTNAME,
+	BINREC_INPUTNAME,
+	BINREC_RCVFROM,
+	BINREC_RCVFROMIP,
+	BINREC_STRUCDATA,
+	BINREC_JSON,
+	BINREC_LOCALVARS,
+	BINREC_APPNAME,
+	BINREC_PROCID,
+	BINREC_MSGID,
+	BINREC_UUID,
+	BINREC_RULESET,
+	BINREC_NSTR	/* must be last! */
+};
+#define BINREC_LEN_TIME 16
+#define BINREC_LEN_FIXED (2 + 2 + 2 + 4 + 8 + 2 * BINREC_LEN_TIME + 4)
+
+static inline uchar *
+binrecPut16(uchar *p, const uint16_t val)
+{
+	p[0] = (val >> 8) & 0xff;
+	p[1] = val & 0xff;
+	return p + 2;
+}
+
+static inline uchar *
+binrecPut32(uchar *p, const uint32_t val)
+{
+	p[0] = (val >> 24) & 0xff;
+	p[1] = (val >> 16) & 0xff;
+	p[2] = (val >> 8) & 0xff;
+	p[3] = val & 0xff;
+	return p + 4;
+}
+
+static inline uchar *
+binrecPut64(uchar *p, const uint64_t val)
+{
+	p = binrecPut32(p, (uint32_t) (val >> 32));
+	return binrecPut32(p, (uint32_t) (val & 0xffffffff));
+}
+
+static inline uchar *
+binrecPutTime(uchar *p, const struct syslogTime *const t)
+{
+	*p++ = t->timeType;
+	*p++ = t->month;
+	*p++ = t->day;
+	*p++ = t->hour;
+	*p++ = t->minute;
+	*p++ = t->second;
+	*p++ = t->secfracPrecision;
+	*p++ = t->OffsetMinute;
+	*p++ = t->OffsetHour;
+	*p++ = t->OffsetMode;
+	p = binrecPut16(p, (uint16_t) t->year);
+	return binrecPut32(p, (uint32_t) t->secfrac);
+}
+
+static inline uchar *
+binrecPutStr(uchar *p, const uchar *const psz, const size_t len)
+{
+	if(psz == NULL)
+		return binrecPut32(p, BINREC_STR_ABSENT);
+	p = binrecPut32(p, (uint32_t) len);
+	memcpy(p, psz, len);
+	p[len] = '\0';
+	return p + len + 1;
+}
+
+/* the getters check that the data is actually present inside the
+ * buffer, so a corrupt record can not make us read out of bounds.
+ */
+static inline rsRetVal
+binrecGet32(uchar **pp, const uchar *const pEnd, uint32_t *const pVal)
+{
+	uchar *p = *pp;
+	if(pEnd - p < 4)
+		return RS_RET_DISKREC_CORRUPT;
+	*pVal = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+	*pp = p + 4;
+	return RS_RET_OK;
+}
+
+static inline rsRetVal
+binrecGet16(uchar **pp, const uchar *const pEnd, uint16_t *const pVal)
+{
+	uchar *p = *pp;
+	if(pEnd - p < 2)
+		return RS_RET_DISKREC_CORRUPT;
+	*pVal = (uint16_t) ((p[0] << 8) | p[1]);
+	*pp = p + 2;
+	return RS_RET_OK;
+}
+
+static inline rsRetVal
+binrecGetTime(uchar **pp, const uchar *const pEnd, struct syslogTime *const t)
+{
+	uchar *p = *pp;
+	uint16_t year;
+	uint32_t secfrac;
+	DEFiRet;
+
+	if(pEnd - p < BINREC_LEN_TIME)
+		ABORT_FINALIZE(RS_RET_DISKREC_CORRUPT);
+	t->timeType = *p++;
+	t->month = *p++;
+	t->day = *p++;
+	t->hour = *p++;
+	t->minute = *p++;
+	t->second = *p++;
+	t->secfracPrecision = *p++;
+	t->OffsetMinute = *p++;
+	t->OffsetHour = *p++;
+	t->OffsetMode = *p++;
+	CHKiRet(binrecGet16(&p, pEnd, &year));
+	CHKiRet(binrecGet32(&p, pEnd, &secfrac));
+	t->year = (short) year;
+	t->secfrac = (int) secfrac;
+	*pp = p;
+
+finalize_it:
+	RETiRet;
+}
+
+static inline rsRetVal
+binrecGetStr(uchar **pp, const uchar *const pEnd, uchar **ppsz, uint32_t *const pLen)
+{
+	uchar *p;
+	DEFiRet;
+
+	CHKiRet(binrecGet32(pp, pEnd, pLen));
+	p = *pp;
+	if(*pLen == BINREC_STR_ABSENT) {
+		*ppsz = NULL;
+		FINALIZE;
+	}
+	if((size_t) (pEnd - p) < (size_t) *pLen + 1 || p[*pLen] != '\0')
+		ABORT_FINALIZE(RS_RET_DISKREC_CORRUPT);
+	*ppsz = p;
+	*pp = p + *pLen + 1;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* Serialize a message into the binary format. The buffer is allocated by
+ * us and must be freed by the caller. lenReserve octets are left unused
+ * at the start of the buffer, so that the caller can put its record
+ * header in front of the message data without copying it. *pLenBuf
+ * receives the overall length, including the reserved space.
+ */
+rsRetVal
+MsgSerializeBinary(msg_t *const pThis, const size_t lenReserve, uchar **ppBuf, size_t *const pLenBuf)
+{
+	uchar *str[BINREC_NSTR];
+	size_t lenStr[BINREC_NSTR];
+	uchar *pBuf;
+	uchar *p;
+	size_t lenBuf;
+	int len;
+	int i;
+	DEFiRet;
+
+	assert(pThis != NULL);
+	assert(ppBuf != NULL);
+
+	if(pThis->iLenTAG > 0) {
+		str[BINREC_TAG] = propGetSzStr(pThis->pTAG);
+		lenStr[BINREC_TAG] = pThis->iLenTAG;
+	} else {
+		str[BINREC_TAG] = NULL;
+	}
+	str[BINREC_RAWMSG] = pThis->pszRawMsg; lenStr[BINREC_RAWMSG] = pThis->iLenRawMsg;
+	str[BINREC_HOSTNAME] = (pThis->pHOSTNAME == NULL) ? NULL : propGetSzStr(pThis->pHOSTNAME);
+	lenStr[BINREC_HOSTNAME] = pThis->iLenHOSTNAME;
+	getInputName(pThis, &str[BINREC_INPUTNAME], &len); lenStr[BINREC_INPUTNAME] = len;
+	str[BINREC_RCVFROM] = getRcvFrom(pThis);
+	str[BINREC_RCVFROMIP] = getRcvFromIP(pThis);
+	str[BINREC_STRUCDATA] = pThis->pszStrucData;
+	str[BINREC_JSON] = (pThis->json == NULL) ? NULL
+			 : (uchar*) json_object_get_string(pThis->json);
+	str[BINREC_LOCALVARS] = (msgGetLocalVarsTree(pThis) == NULL) ? NULL
+			      : (uchar*) json_object_get_string(pThis->localvars);
+	str[BINREC_APPNAME] = (pThis->pAPPNAME == NULL) ? NULL : propGetSzStr(pThis->pAPPNAME);
+	str[BINREC_PROCID] = (pThis->pCSPROCID == NULL) ? NULL : rsCStrGetSzStrNoNULL(pThis->pCSPROCID);
+	str[BINREC_MSGID] = (pThis->pCSMSGID == NULL) ? NULL : rsCStrGetSzStrNoNULL(pThis->pCSMSGID);
+	str[BINREC_UUID] = (pThis->pCold == NULL) ? NULL : pThis->pCold->pszUUID;
+	str[BINREC_RULESET] = (pThis->pRuleset == NULL) ? NULL : rulesetGetName(pThis->pRuleset);
+	for(i = BINREC_RCVFROM ; i < BINREC_NSTR ; ++i) {
+		if(str[i] != NULL)
+			lenStr[i] = ustrlen(str[i]);
+	}
+
+	lenBuf = lenReserve + BINREC_LEN_FIXED;
+	for(i = 0 ; i < BINREC_NSTR ; ++i) {
+		lenBuf += 4;
+		if(str[i] != NULL)
+			lenBuf += lenStr[i] + 1;
+	}
+	CHKmalloc(pBuf = MALLOC(lenBuf));
+
+	p = pBuf + lenReserve;
+	p = binrecPut16(p, (uint16_t) pThis->iProtocolVersion);
+	p = binrecPut16(p, (uint16_t) pThis->iSeverity);
+	p = binrecPut16(p, (uint16_t) pThis->iFacility);
+	p = binrecPut32(p, (uint32_t) pThis->msgFlags);
+	p = binrecPut64(p, (uint64_t) pThis->ttGenTime);
+	p = binrecPutTime(p, &pThis->tRcvdAt);
+	p = binrecPutTime(p, &pThis->tTIMESTAMP);
+	p = binrecPut32(p, (uint32_t) pThis->offMSG);
+	for(i = 0 ; i < BINREC_NSTR ; ++i) {
+		p = binrecPutStr(p, str[i], lenStr[i]);
+	}
+	assert((size_t) (p - pBuf) == lenBuf);
+
+	*ppBuf = pBuf;
+	*pLenBuf = lenBuf;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* Deserialize a message from the binary format. pBuf points to the message
+ * data as created by MsgSerializeBinary() (without the caller's reserved
+ * space). The buffer is not modified and may be freed after the call.
+ * The message object must have been constructed by the caller.
+ */
+rsRetVal
+MsgDeserializeBinary(msg_t *const pMsg, uchar *const pBuf, const size_t lenBuf)
+{
+	uchar *str[BINREC_NSTR];
+	uint32_t lenStr[BINREC_NSTR];
+	uchar *p = pBuf;
+	uchar *pEnd = pBuf + lenBuf;
+	uint16_t protocolVersion, sev, fac;
+	uint32_t flags, offMSG;
+	uint32_t genTimeHi, genTimeLo;
+	prop_t *myProp;
+	prop_t *propRcvFrom = NULL;
+	prop_t *propRcvFromIP = NULL;
+	struct json_tokener *tokener;
+	int i;
+	DEFiRet;
+
+	CHKiRet(binrecGet16(&p, pEnd, &protocolVersion));
+	CHKiRet(binrecGet16(&p, pEnd, &sev));
+	CHKiRet(binrecGet16(&p, pEnd, &fac));
+	CHKiRet(binrecGet32(&p, pEnd, &flags));
+	CHKiRet(binrecGet32(&p, pEnd, &genTimeHi));
+	CHKiRet(binrecGet32(&p, pEnd, &genTimeLo));
+	CHKiRet(binrecGetTime(&p, pEnd, &pMsg->tRcvdAt));
+	CHKiRet(binrecGetTime(&p, pEnd, &pMsg->tTIMESTAMP));
+	CHKiRet(binrecGet32(&p, pEnd, &offMSG));
+	for(i = 0 ; i < BINREC_NSTR ; ++i) {
+		CHKiRet(binrecGetStr(&p, pEnd, &str[i], &lenStr[i]));
+	}
+
+	/* the record is sane, now populate the message */
+	setProtocolVersion(pMsg, protocolVersion);
+	pMsg->iSeverity = sev;
+	pMsg->iFacility = fac;
+	pMsg->msgFlags = flags;
+	pMsg->ttGenTime = (time_t) (((uint64_t) genTimeHi << 32) | genTimeLo);
+	if(str[BINREC_TAG] != NULL)
+		MsgSetTAG(pMsg, str[BINREC_TAG], lenStr[BINREC_TAG]);
+	if(str[BINREC_RAWMSG] != NULL)
+		MsgSetRawMsg(pMsg, (char*) str[BINREC_RAWMSG], lenStr[BINREC_RAWMSG]);
+	if(str[BINREC_HOSTNAME] != NULL)
+		MsgSetHOSTNAME(pMsg, str[BINREC_HOSTNAME], lenStr[BINREC_HOSTNAME]);
+	if(str[BINREC_INPUTNAME] != NULL) {
+		CHKiRet(prop.Construct(&myProp));
+		CHKiRet(prop.SetString(myProp, str[BINREC_INPUTNAME], lenStr[BINREC_INPUTNAME]));
+		CHKiRet(prop.ConstructFinalize(myProp));
+		MsgSetInputName(pMsg, myProp);
+		prop.Destruct(&myProp);
+	}
+	if(str[BINREC_RCVFROM] != NULL) {
+		MsgSetRcvFromStr(pMsg, str[BINREC_RCVFROM], lenStr[BINREC_RCVFROM], &propRcvFrom);
+		prop.Destruct(&propRcvFrom);
+	}
+	if(str[BINREC_RCVFROMIP] != NULL) {
+		MsgSetRcvFromIPStr(pMsg, str[BINREC_RCVFROMIP], lenStr[BINREC_RCVFROMIP], &propRcvFromIP);
+		prop.Destruct(&propRcvFromIP);
+	}
+	if(str[BINREC_STRUCDATA] != NULL)
+		MsgSetStructuredData(pMsg, (char*) str[BINREC_STRUCDATA]);
+	if(str[BINREC_JSON] != NULL) {
+		tokener = json_tokener_new();
+		pMsg->json = json_tokener_parse_ex(tokener, (char*) str[BINREC_JSON], lenStr[BINREC_JSON]);
+		json_tokener_free(tokener);
+	}
+	if(str[BINREC_LOCALVARS] != NULL) {
+		tokener = json_tokener_new();
+		pMsg->localvars = json_tokener_parse_ex(tokener, (char*) str[BINREC_LOCALVARS],
+							lenStr[BINREC_LOCALVARS]);
+		json_tokener_free(tokener);
+	}
+	if(str[BINREC_APPNAME] != NULL)
+		MsgSetAPPNAME(pMsg, (char*) str[BINREC_APPNAME]);
+	if(str[BINREC_PROCID] != NULL)
+		MsgSetPROCID(pMsg, (char*) str[BINREC_PROCID]);
+	if(str[BINREC_MSGID] != NULL)
+		MsgSetMSGID(pMsg, (char*) str[BINREC_MSGID]);
+	if(str[BINREC_UUID] != NULL && msgGetCold(pMsg) != NULL)
+		pMsg->pCold->pszUUID = ustrdup(str[BINREC_UUID]);
+	if(str[BINREC_RULESET] != NULL)
+		rulesetGetRuleset(runConf, &(pMsg->pRuleset), str[BINREC_RULESET]);
+	MsgSetMSGoffs(pMsg, offMSG);
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* Increment reference count - see description of the "msg"
  * structure for details. As a convenience to developers,
  * this method returns the msg pointer that is passed to it.
@@ -1305,10 +2545,10 @@ static rsRetVal aquirePROCIDFromTAG(msg_t * const pM)
 	if(pM->pCSPROCID != NULL)
 		return RS_RET_OK; /* we are already done ;) */
 
-	if(msgGetProtocolVersion(pM) != 0)
+	if(msgGetProtocolVersion(pM) != 0 || pM->iLenTAG == 0)
 		return RS_RET_OK; /* we can only emulate if we have legacy format */
 
-	pszTag = (uchar*) ((pM->iLenTAG < CONF_TAG_BUFSIZE) ? pM->TAG.szBuf : pM->TAG.pszTAG);
+	pszTag = propGetSzStr(pM->pTAG);
 
 	/* find first '['... */
 	i = 0;
@@ -1362,26 +2602,22 @@ static inline rsRetVal
 aquireProgramName(msg_t * const pM)
 {
 	int i;
-	uchar *pszTag, *pszProgName;
+	uchar *pszTag;
+	prop_t *pProgName = NULL;
 	DEFiRet;
 
 	assert(pM != NULL);
-	pszTag = (uchar*) ((pM->iLenTAG < CONF_TAG_BUFSIZE) ? pM->TAG.szBuf : pM->TAG.pszTAG);
+	pszTag = (pM->iLenTAG == 0) ? UCHAR_CONSTANT("") : propGetSzStr(pM->pTAG);
 	for(  i = 0
 	    ; (i < pM->iLenTAG) && isprint((int) pszTag[i])
 	      && (pszTag[i] != '\0') && (pszTag[i] != ':')
 	      && (pszTag[i] != '[')  && (pszTag[i] != '/')
 	    ; ++i)
 		; /* just search end of PROGNAME */
-	if(i < CONF_PROGNAME_BUFSIZE) {
-		pszProgName = pM->PROGNAME.szBuf;
-	} else {
-		CHKmalloc(pM->PROGNAME.ptr = malloc(i+1));
-		pszProgName = pM->PROGNAME.ptr;
-	}
-	memcpy((char*)pszProgName, (char*)pszTag, i);
-	pszProgName[i] = '\0';
-	pM->iLenPROGNAME = i;
+	CHKiRet(prop.InternStringProp(&pProgName, pszTag, i));
+	/* unlocked readers check pPROGNAME, so publish only the complete prop */
+	ATOMIC_MEMORY_BARRIER();
+	pM->pPROGNAME = pProgName;
 finalize_it:
 	RETiRet;
 }
@@ -1407,56 +2643,182 @@ char *getProtocolVersionString(msg_t * const pM)
 }
 
 #ifdef USE_LIBUUID
-/* note: libuuid seems not to be thread-safe, so we need
- * to get some safeguards in place.
+/* UUIDs are generated per thread, without any shared lock: each thread runs
+ * its own ChaCha20 keystream and takes random version 4 UUIDs from it. The
+ * key is obtained from libuuid, which is only called when a thread needs a
+ * (new) key. libuuid seems not to be thread-safe, so these calls are
+ * serialized by mutUUID. This is also the fallback if we can not get
+ * thread-local storage.
  */
-static void msgSetUUID(msg_t * const pM)
+#define UUIDGEN_REKEY_BLOCKS (1 << 20) /* 64MiB of keystream, then rekey */
+typedef struct msgUUIDGen_s {
+	uint32_t key[8];
+	uint64_t ctr;		/* block counter */
+	uint32_t buf[16];	/* current keystream block */
+	unsigned used;		/* bytes of buf already handed out */
+} msgUUIDGen_t;
+
+static pthread_mutex_t mutUUID = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t keyUUIDGen;
+static sbool bUUIDGenActive = 0;
+
+static void
+uuidGenLibuuid(uuid_t uuid)
+{
+	pthread_mutex_lock(&mutUUID);
+	uuid_generate(uuid);
+	pthread_mutex_unlock(&mutUUID);
+}
+
+static void
+uuidGenRekey(msgUUIDGen_t *const pGen)
+{
+	uuid_t rnd;
+
+	uuidGenLibuuid(rnd);
+	memcpy(pGen->key, rnd, sizeof(rnd));
+	uuidGenLibuuid(rnd);
+	memcpy(pGen->key + 4, rnd, sizeof(rnd));
+	pGen->ctr = 0;
+	pGen->used = sizeof(pGen->buf);
+}
+
+#define UUIDGEN_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define UUIDGEN_QR(a, b, c, d) \
+	a += b; d ^= a; d = UUIDGEN_ROTL(d, 16); \
+	c += d; b ^= c; b = UUIDGEN_ROTL(b, 12); \
+	a += b; d ^= a; d = UUIDGEN_ROTL(d, 8); \
+	c += d; b ^= c; b = UUIDGEN_ROTL(b, 7);
+
+/* compute the next ChaCha20 keystream block into pGen->buf */
+static void
+uuidGenBlock(msgUUIDGen_t *const pGen)
+{
+	uint32_t in[16];
+	uint32_t x[16];
+	int i;
+
+	if(pGen->ctr >= UUIDGEN_REKEY_BLOCKS)
+		uuidGenRekey(pGen);
+	in[0] = 0x61707865; in[1] = 0x3320646e; in[2] = 0x79622d32; in[3] = 0x6b206574;
+	memcpy(in + 4, pGen->key, sizeof(pGen->key));
+	in[12] = (uint32_t) pGen->ctr;
+	in[13] = (uint32_t) (pGen->ctr >> 32);
+	in[14] = in[15] = 0;
+	memcpy(x, in, sizeof(x));
+	for(i = 0 ; i < 10 ; ++i) {
+		UUIDGEN_QR(x[0], x[4], x[8], x[12]);
+		UUIDGEN_QR(x[1], x[5], x[9], x[13]);
+		UUIDGEN_QR(x[2], x[6], x[10], x[14]);
+		UUIDGEN_QR(x[3], x[7], x[11], x[15]);
+		UUIDGEN_QR(x[0], x[5], x[10], x[15]);
+		UUIDGEN_QR(x[1], x[6], x[11], x[12]);
+		UUIDGEN_QR(x[2], x[7], x[8], x[13]);
+		UUIDGEN_QR(x[3], x[4], x[9], x[14]);
+	}
+	for(i = 0 ; i < 16 ; ++i)
+		pGen->buf[i] = x[i] + in[i];
+	++pGen->ctr;
+	pGen->used = 0;
+}
+
+static inline msgUUIDGen_t *
+msgGetUUIDGen(void)
+{
+	msgUUIDGen_t *pGen;
+
+	if(!bUUIDGenActive)
+		return NULL;
+	pGen = (msgUUIDGen_t*) pthread_getspecific(keyUUIDGen);
+	if(pGen == NULL) {
+		if((pGen = calloc(1, sizeof(msgUUIDGen_t))) == NULL)
+			return NULL;
+		if(pthread_setspecific(keyUUIDGen, pGen) != 0) {
+			free(pGen);
+			return NULL;
+		}
+		uuidGenRekey(pGen);
+	}
+	return pGen;
+}
+
+/* generate a random (version 4) UUID */
+static void
+uuidGenerate(uuid_t uuid)
+{
+	msgUUIDGen_t *const pGen = msgGetUUIDGen();
+
+	if(pGen == NULL) {
+		uuidGenLibuuid(uuid);
+		return;
+	}
+	if(pGen->used + sizeof(uuid_t) > sizeof(pGen->buf))
+		uuidGenBlock(pGen);
+	memcpy(uuid, (uchar*) pGen->buf + pGen->used, sizeof(uuid_t));
+	pGen->used += sizeof(uuid_t);
+	uuid[6] = (uuid[6] & 0x0f) | 0x40; /* version 4 */
+	uuid[8] = (uuid[8] & 0x3f) | 0x80; /* RFC 4122 variant */
+}
+
+static void msgSetUUID(msg_t * const pM, struct msgCold * const pCold)
 {
 	size_t lenRes = sizeof(uuid_t) * 2 + 1;
 	char hex_char [] = "0123456789ABCDEF";
 	unsigned int byte_nbr;
 	uuid_t uuid;
-	static pthread_mutex_t mutUUID = PTHREAD_MUTEX_INITIALIZER;
+	uchar *pszUUID;
 
 	dbgprintf("[MsgSetUUID] START, lenRes %llu\n", (long long unsigned) lenRes);
 	assert(pM != NULL);
 
-	if((pM->pszUUID = (uchar*) MALLOC(lenRes)) == NULL) {
-		pM->pszUUID = (uchar *)"";
+	if((pszUUID = (uchar*) MALLOC(lenRes)) == NULL) {
+		pCold->pszUUID = (uchar *)"";
 	} else {
-		pthread_mutex_lock(&mutUUID);
-		uuid_generate(uuid);
-		pthread_mutex_unlock(&mutUUID);
+		uuidGenerate(uuid);
 		for (byte_nbr = 0; byte_nbr < sizeof (uuid_t); byte_nbr++) {
-			pM->pszUUID[byte_nbr * 2 + 0] = hex_char[uuid [byte_nbr] >> 4];
-			pM->pszUUID[byte_nbr * 2 + 1] = hex_char[uuid [byte_nbr] & 15];
+			pszUUID[byte_nbr * 2 + 0] = hex_char[uuid [byte_nbr] >> 4];
+			pszUUID[byte_nbr * 2 + 1] = hex_char[uuid [byte_nbr] & 15];
 		}
 
-		pM->pszUUID[lenRes-1] = '\0';
-		dbgprintf("[MsgSetUUID] UUID : %s LEN: %d \n", pM->pszUUID, (int)lenRes);
+		pszUUID[lenRes-1] = '\0';
+		dbgprintf("[MsgSetUUID] UUID : %s LEN: %d \n", pszUUID, (int)lenRes);
+		/* getUUID() checks for the UUID without holding the lock, so we
+		 * must only publish it once it is fully formatted.
+		 */
+#		ifdef HAVE_ATOMIC_BUILTINS
+		ATOMIC_MEMORY_BARRIER();
+#		endif
+		pCold->pszUUID = pszUUID;
 	}
 	dbgprintf("[MsgSetUUID] END\n");
 }
 
 void getUUID(msg_t * const pM, uchar **pBuf, int *piLen)
 {
+	struct msgCold *pCold;
+
 	dbgprintf("[getUUID] START\n");
 	if(pM == NULL) {
 		dbgprintf("[getUUID] pM is NULL\n");
 		*pBuf=	UCHAR_CONSTANT("");
 		*piLen = 0;
 	} else {
-		if(pM->pszUUID == NULL) {
+		if((pCold = msgGetCold(pM)) == NULL) {
+			*pBuf = UCHAR_CONSTANT("");
+			*piLen = 0;
+			return;
+		}
+		if(pCold->pszUUID == NULL) {
 			dbgprintf("[getUUID] pM->pszUUID is NULL\n");
 			MsgLock(pM);
 			/* re-query, things may have changed in the mean time... */
-			if(pM->pszUUID == NULL)
-				msgSetUUID(pM);
+			if(pCold->pszUUID == NULL)
+				msgSetUUID(pM, pCold);
 			MsgUnlock(pM);
 		} else { /* UUID already there we reuse it */
 			dbgprintf("[getUUID] pM->pszUUID already exists\n");
 		}
-		*pBuf = pM->pszUUID;
+		*pBuf = pCold->pszUUID;
 		*piLen = sizeof(uuid_t) * 2;
 	}
 	dbgprintf("[getUUID] END\n");
@@ -1509,6 +2871,17 @@ uchar *getMSG(msg_t * const pM)
 }
 
 
+/* get MSG for modifying it in place (without changing its length beyond
+ * getMSGLen(), see setMSGLen()). Unlike getMSG(), this makes sure the
+ * buffer is not shared with MsgDup()'ed messages.
+ */
+uchar *getMSGForWrite(msg_t * const pM)
+{
+	MsgRawUnshare(pM);
+	return getMSG(pM);
+}
+
+
 /* Get PRI value as integer */
 static int getPRIi(msg_t * const pM)
 {
@@ -1534,9 +2907,285 @@ getPRI(msg_t * const pM)
 }
 
 
+/* Lazily formatted timestamp strings.
+ * The formats are computed on first use and then cached inside the message.
+ * As multiple action workers may access the same message concurrently, the
+ * cache must be published safely. We do that without a lock:
+ * - heap-based formats are formatted into a private buffer, which is then
+ *   published with a CAS on the (still NULL) field pointer. If we lose the
+ *   race, we simply drop our buffer and use the winner's one.
+ * - formats with a buffer embedded in msg_t are first claimed via a bit in
+ *   pM->lazyInit. The claiming thread formats and then sets the matching
+ *   "ready" bit. Other threads wait for the ready bit (a few hundred ns at
+ *   most), readers of an already formatted string do not wait at all.
+ * Without atomic builtins we fall back to the striped message lock.
+ */
+#define MSG_LAZY_TS3164		0x01
+#define MSG_LAZY_TS3339		0x02
+#define MSG_LAZY_TSUNIX		0x04
+#define MSG_LAZY_TSSECFRAC	0x08
+#define MSG_LAZY_RCVDUNIX	0x10
+#define MSG_LAZY_RCVDSECFRAC	0x20
+#define MSG_LAZY_READY(bit)	((bit) << 8)
+
+/* Per-thread cache of formatted timestamps.
+ * Thousands of messages per second usually share the same second, so
+ * formatting each timestamp from scratch is mostly redundant work. Each
+ * thread caches, per format, the last string it rendered together with the
+ * (second-resolution) timestamp and UTC offset it was rendered for. On a
+ * hit, the cached string is copied; for RFC3339 only the fractional
+ * seconds are rendered per message, between the cached date/time prefix
+ * and the cached offset suffix.
+ */
+enum msgTSCacheIdx {
+	TSCACHE_3164 = 0,
+	TSCACHE_3164BUGGY,
+	TSCACHE_3339,
+	TSCACHE_MYSQL,
+	TSCACHE_PGSQL,
+	TSCACHE_UNIX,
+	TSCACHE_NFMTS
+};
+
+typedef struct msgTSCacheEnt_s {
+	struct syslogTime ts;	/* timestamp the strings belong to (secfrac ignored) */
+	sbool bValid;
+	int lenStr;
+	char szStr[MSGPOOL_TSBUF_SIZE];	/* formatted string; for RFC3339, the prefix up to the seconds */
+	char szSuffix[8];		/* RFC3339 only: offset part */
+} msgTSCacheEnt_t;
+
+typedef struct msgTSCache_s {
+	msgTSCacheEnt_t ent[TSCACHE_NFMTS];
+} msgTSCache_t;
+
+static pthread_key_t keyTSCache;
+static sbool bTSCacheActive = 0;
+
+static inline int
+msgTSSameSecond(struct syslogTime *a, struct syslogTime *b)
+{
+	return    a->second == b->second
+	       && a->minute == b->minute
+	       && a->hour == b->hour
+	       && a->day == b->day
+	       && a->month == b->month
+	       && a->year == b->year
+	       && a->OffsetMode == b->OffsetMode
+	       && a->OffsetHour == b->OffsetHour
+	       && a->OffsetMinute == b->OffsetMinute;
+}
+
+static inline msgTSCache_t *
+msgGetTSCache(void)
+{
+	msgTSCache_t *pCache;
+
+	if(!bTSCacheActive)
+		return NULL;
+	pCache = (msgTSCache_t*) pthread_getspecific(keyTSCache);
+	if(pCache == NULL) {
+		if((pCache = calloc(1, sizeof(msgTSCache_t))) == NULL)
+			return NULL;
+		if(pthread_setspecific(keyTSCache, pCache) != 0) {
+			free(pCache);
+			return NULL;
+		}
+	}
+	return pCache;
+}
+
+/* (re)fill a cache entry for timestamp ts */
+static void
+msgTSCacheFill(msgTSCacheEnt_t *pEnt, struct syslogTime *ts, enum msgTSCacheIdx idx)
+{
+	char szTmp[MSGPOOL_TSBUF_SIZE];
+	struct syslogTime tsNoFrac;
+
+	switch(idx) {
+	case TSCACHE_3164:
+		pEnt->lenStr = datetime.formatTimestamp3164(ts, pEnt->szStr, 0) - 1;
+		break;
+	case TSCACHE_3164BUGGY:
+		pEnt->lenStr = datetime.formatTimestamp3164(ts, pEnt->szStr, 1) - 1;
+		break;
+	case TSCACHE_3339:
+		/* format without fractional part and split at the end of the seconds */
+		tsNoFrac = *ts;
+		tsNoFrac.secfracPrecision = 0;
+		datetime.formatTimestamp3339(&tsNoFrac, szTmp);
+		memcpy(pEnt->szStr, szTmp, 19);
+		pEnt->szStr[19] = '\0';
+		pEnt->lenStr = 19;
+		strcpy(pEnt->szSuffix, szTmp + 19);
+		break;
+	case TSCACHE_MYSQL:
+		pEnt->lenStr = datetime.formatTimestampToMySQL(ts, pEnt->szStr) - 1;
+		break;
+	case TSCACHE_PGSQL:
+		pEnt->lenStr = datetime.formatTimestampToPgSQL(ts, pEnt->szStr);
+		break;
+	case TSCACHE_UNIX:
+		datetime.formatTimestampUnix(ts, pEnt->szStr);
+		pEnt->lenStr = strlen(pEnt->szStr);
+		break;
+	case TSCACHE_NFMTS:
+	default:
+		break;
+	}
+	pEnt->ts = *ts;
+	pEnt->bValid = 1;
+}
+
+static inline void
+msgFmtTSCached(msgTSCache_t *pCache, struct syslogTime *ts, enum msgTSCacheIdx idx, char *pBuf)
+{
+	msgTSCacheEnt_t *pEnt = &pCache->ent[idx];
+	int iBuf;
+
+	if(!pEnt->bValid || !msgTSSameSecond(&pEnt->ts, ts))
+		msgTSCacheFill(pEnt, ts, idx);
+	memcpy(pBuf, pEnt->szStr, pEnt->lenStr);
+	iBuf = pEnt->lenStr;
+	if(idx == TSCACHE_3339) {
+		if(ts->secfracPrecision > 0) {
+			pBuf[iBuf++] = '.';
+			iBuf += datetime.formatTimestampSecFrac(ts, pBuf + iBuf);
+		}
+		strcpy(pBuf + iBuf, pEnt->szSuffix);
+	} else {
+		pBuf[iBuf] = '\0';
+	}
+}
+
+static inline void
+msgFmtTS(struct syslogTime *ts, enum tplFormatTypes eFmt, char *pBuf)
+{
+	msgTSCache_t *pCache;
+	enum msgTSCacheIdx idx;
+
+	switch(eFmt) {
+	case tplFmtMySQLDate:
+		idx = TSCACHE_MYSQL;
+		break;
+	case tplFmtPgSQLDate:
+		idx = TSCACHE_PGSQL;
+		break;
+	case tplFmtRFC3339Date:
+		idx = TSCACHE_3339;
+		break;
+	case tplFmtUnixDate:
+		idx = TSCACHE_UNIX;
+		break;
+	case tplFmtSecFrac:
+		/* nothing to share, changes with every message */
+		datetime.formatTimestampSecFrac(ts, pBuf);
+		return;
+	case tplFmtRFC3164BuggyDate:
+		idx = TSCACHE_3164BUGGY;
+		break;
+	case tplFmtDefault:
+	case tplFmtRFC3164Date:
+	default:
+		idx = TSCACHE_3164;
+		break;
+	}
+
+	if((pCache = msgGetTSCache()) != NULL) {
+		msgFmtTSCached(pCache, ts, idx, pBuf);
+		return;
+	}
+
+	/* no cache available, format directly */
+	switch(idx) {
+	case TSCACHE_MYSQL:
+		datetime.formatTimestampToMySQL(ts, pBuf);
+		break;
+	case TSCACHE_PGSQL:
+		datetime.formatTimestampToPgSQL(ts, pBuf);
+		break;
+	case TSCACHE_3339:
+		datetime.formatTimestamp3339(ts, pBuf);
+		break;
+	case TSCACHE_UNIX:
+		datetime.formatTimestampUnix(ts, pBuf);
+		break;
+	case TSCACHE_3164BUGGY:
+		datetime.formatTimestamp3164(ts, pBuf, 1);
+		break;
+	case TSCACHE_3164:
+	case TSCACHE_NFMTS:
+	default:
+		datetime.formatTimestamp3164(ts, pBuf, 0);
+		break;
+	}
+}
+
+/* obtain a format that is cached in a heap buffer (*ppField) */
+static char *
+msgLazyFmtAlloc(msg_t * const pM, char **ppField, struct syslogTime *ts, enum tplFormatTypes eFmt)
+{
+	char *pBuf;
+
+	if(*ppField != NULL)
+		return *ppField;
+#ifdef HAVE_ATOMIC_BUILTINS
+	if((pBuf = msgAllocTSBuf()) == NULL)
+		return "";
+	msgFmtTS(ts, eFmt, pBuf);
+	if(!ATOMIC_CAS(ppField, (char*) NULL, pBuf, NULL)) {
+		/* some other thread was faster, use its result */
+		msgPoolFree(&msgPoolTSBuf, pBuf);
+	}
+	pBuf = *ppField;
+#else
+	MsgLock(pM);
+	if(*ppField == NULL) {
+		if((*ppField = msgAllocTSBuf()) == NULL) {
+			MsgUnlock(pM);
+			return "";
+		}
+		msgFmtTS(ts, eFmt, *ppField);
+	}
+	pBuf = *ppField;
+	MsgUnlock(pM);
+#endif
+	return pBuf;
+}
+
+/* obtain a format that is cached in a buffer embedded in msg_t */
+static char *
+msgLazyFmtEmbedded(msg_t * const pM, int bit, char *pBuf, struct syslogTime *ts, enum tplFormatTypes eFmt)
+{
+#ifdef HAVE_ATOMIC_BUILTINS
+	if(pM->lazyInit & MSG_LAZY_READY(bit)) {
+		ATOMIC_MEMORY_BARRIER(); /* pairs with the barrier of setting the ready bit */
+		return pBuf;
+	}
+	if((ATOMIC_STORE_INT_TO_INT(pM->lazyInit, bit) & bit) == 0) {
+		/* we own the claim */
+		msgFmtTS(ts, eFmt, pBuf);
+		ATOMIC_STORE_INT_TO_INT(pM->lazyInit, MSG_LAZY_READY(bit));
+	} else {
+		while((ATOMIC_FETCH_32BIT(&pM->lazyInit, NULL) & MSG_LAZY_READY(bit)) == 0)
+			sched_yield();
+	}
+#else
+	MsgLock(pM);
+	if((pM->lazyInit & bit) == 0) {
+		msgFmtTS(ts, eFmt, pBuf);
+		pM->lazyInit |= bit | MSG_LAZY_READY(bit);
+	}
+	MsgUnlock(pM);
+#endif
+	return pBuf;
+}
+
+
 char *
 getTimeReported(msg_t * const pM, enum tplFormatTypes eFmt)
 {
+	struct msgCold *pCold;
 	BEGINfunc
 	if(pM == NULL)
 		return "";
@@ -1545,147 +3194,55 @@ getTimeReported(msg_t * const pM, enum tplFormatTypes eFmt)
 	case tplFmtDefault:
 	case tplFmtRFC3164Date:
 	case tplFmtRFC3164BuggyDate:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP3164 == NULL) {
-			pM->pszTIMESTAMP3164 = pM->pszTimestamp3164;
-			datetime.formatTimestamp3164(&pM->tTIMESTAMP, pM->pszTIMESTAMP3164,
-						     (eFmt == tplFmtRFC3164BuggyDate));
-		}
-		MsgUnlock(pM);
-		return(pM->pszTIMESTAMP3164);
+		return msgLazyFmtEmbedded(pM, MSG_LAZY_TS3164, pM->pszTimestamp3164, &pM->tTIMESTAMP, eFmt);
 	case tplFmtMySQLDate:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP_MySQL == NULL) {
-			if((pM->pszTIMESTAMP_MySQL = MALLOC(15)) == NULL) {
-				MsgUnlock(pM);
-				return "";
-			}
-			datetime.formatTimestampToMySQL(&pM->tTIMESTAMP, pM->pszTIMESTAMP_MySQL);
-		}
-		MsgUnlock(pM);
-		return(pM->pszTIMESTAMP_MySQL);
-        case tplFmtPgSQLDate:
-                MsgLock(pM);
-                if(pM->pszTIMESTAMP_PgSQL == NULL) {
-                        if((pM->pszTIMESTAMP_PgSQL = MALLOC(21)) == NULL) {
-                                MsgUnlock(pM);
-                                return "";
-                        }
-                        datetime.formatTimestampToPgSQL(&pM->tTIMESTAMP, pM->pszTIMESTAMP_PgSQL);
-                }
-                MsgUnlock(pM);
-                return(pM->pszTIMESTAMP_PgSQL);
+		if((pCold = msgGetCold(pM)) == NULL)
+			return "";
+		return msgLazyFmtAlloc(pM, &pCold->pszTIMESTAMP_MySQL, &pM->tTIMESTAMP, eFmt);
+	case tplFmtPgSQLDate:
+		if((pCold = msgGetCold(pM)) == NULL)
+			return "";
+		return msgLazyFmtAlloc(pM, &pCold->pszTIMESTAMP_PgSQL, &pM->tTIMESTAMP, eFmt);
 	case tplFmtRFC3339Date:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP3339 == NULL) {
-			pM->pszTIMESTAMP3339 = pM->pszTimestamp3339;
-			datetime.formatTimestamp3339(&pM->tTIMESTAMP, pM->pszTIMESTAMP3339);
-		}
-		MsgUnlock(pM);
-		return(pM->pszTIMESTAMP3339);
+		return msgLazyFmtEmbedded(pM, MSG_LAZY_TS3339, pM->pszTimestamp3339, &pM->tTIMESTAMP, eFmt);
 	case tplFmtUnixDate:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP_Unix[0] == '\0') {
-			datetime.formatTimestampUnix(&pM->tTIMESTAMP, pM->pszTIMESTAMP_Unix);
-		}
-		MsgUnlock(pM);
-		return(pM->pszTIMESTAMP_Unix);
+		return msgLazyFmtEmbedded(pM, MSG_LAZY_TSUNIX, pM->pszTIMESTAMP_Unix, &pM->tTIMESTAMP, eFmt);
 	case tplFmtSecFrac:
-		if(pM->pszTIMESTAMP_SecFrac[0] == '\0') {
-			MsgLock(pM);
-			/* re-check, may have changed while we did not hold lock */
-			if(pM->pszTIMESTAMP_SecFrac[0] == '\0') {
-				datetime.formatTimestampSecFrac(&pM->tTIMESTAMP, pM->pszTIMESTAMP_SecFrac);
-			}
-			MsgUnlock(pM);
-		}
-		return(pM->pszTIMESTAMP_SecFrac);
+		return msgLazyFmtEmbedded(pM, MSG_LAZY_TSSECFRAC, pM->pszTIMESTAMP_SecFrac,
+					  &pM->tTIMESTAMP, eFmt);
 	}
 	ENDfunc
 	return "INVALID eFmt OPTION!";
 }
 
-static char *getTimeGenerated(msg_t * const pM, enum tplFormatTypes eFmt)
+char *getTimeGenerated(msg_t * const pM, enum tplFormatTypes eFmt)
 {
+	struct msgCold *pCold;
 	BEGINfunc
 	if(pM == NULL)
 		return "";
 
 	switch(eFmt) {
 	case tplFmtDefault:
-		MsgLock(pM);
-		if(pM->pszRcvdAt3164 == NULL) {
-			if((pM->pszRcvdAt3164 = MALLOC(16)) == NULL) {
-				MsgUnlock(pM);
-				return "";
-			}
-			datetime.formatTimestamp3164(&pM->tRcvdAt, pM->pszRcvdAt3164, 0);
-		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt3164);
+		return msgLazyFmtAlloc(pM, &pM->pszRcvdAt3164, &pM->tRcvdAt, eFmt);
 	case tplFmtMySQLDate:
-		MsgLock(pM);
-		if(pM->pszRcvdAt_MySQL == NULL) {
-			if((pM->pszRcvdAt_MySQL = MALLOC(15)) == NULL) {
-				MsgUnlock(pM);
-				return "";
-			}
-			datetime.formatTimestampToMySQL(&pM->tRcvdAt, pM->pszRcvdAt_MySQL);
-		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt_MySQL);
-        case tplFmtPgSQLDate:
-                MsgLock(pM);
-                if(pM->pszRcvdAt_PgSQL == NULL) {
-                        if((pM->pszRcvdAt_PgSQL = MALLOC(21)) == NULL) {
-                                MsgUnlock(pM);
-                                return "";
-                        }
-                        datetime.formatTimestampToPgSQL(&pM->tRcvdAt, pM->pszRcvdAt_PgSQL);
-                }
-                MsgUnlock(pM);
-                return(pM->pszRcvdAt_PgSQL);
+		if((pCold = msgGetCold(pM)) == NULL)
+			return "";
+		return msgLazyFmtAlloc(pM, &pCold->pszRcvdAt_MySQL, &pM->tRcvdAt, eFmt);
+	case tplFmtPgSQLDate:
+		if((pCold = msgGetCold(pM)) == NULL)
+			return "";
+		return msgLazyFmtAlloc(pM, &pCold->pszRcvdAt_PgSQL, &pM->tRcvdAt, eFmt);
 	case tplFmtRFC3164Date:
 	case tplFmtRFC3164BuggyDate:
-		MsgLock(pM);
-		if(pM->pszRcvdAt3164 == NULL) {
-			if((pM->pszRcvdAt3164 = MALLOC(16)) == NULL) {
-					MsgUnlock(pM);
-					return "";
-				}
-			datetime.formatTimestamp3164(&pM->tRcvdAt, pM->pszRcvdAt3164,
-						     (eFmt == tplFmtRFC3164BuggyDate));
-		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt3164);
+		return msgLazyFmtAlloc(pM, &pM->pszRcvdAt3164, &pM->tRcvdAt, eFmt);
 	case tplFmtRFC3339Date:
-		MsgLock(pM);
-		if(pM->pszRcvdAt3339 == NULL) {
-			if((pM->pszRcvdAt3339 = MALLOC(33)) == NULL) {
-				MsgUnlock(pM);
-				return "";
-			}
-			datetime.formatTimestamp3339(&pM->tRcvdAt, pM->pszRcvdAt3339);
-		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt3339);
+		return msgLazyFmtAlloc(pM, &pM->pszRcvdAt3339, &pM->tRcvdAt, eFmt);
 	case tplFmtUnixDate:
-		MsgLock(pM);
-		if(pM->pszRcvdAt_Unix[0] == '\0') {
-			datetime.formatTimestampUnix(&pM->tRcvdAt, pM->pszRcvdAt_Unix);
-		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt_Unix);
+		return msgLazyFmtEmbedded(pM, MSG_LAZY_RCVDUNIX, pM->pszRcvdAt_Unix, &pM->tRcvdAt, eFmt);
 	case tplFmtSecFrac:
-		if(pM->pszRcvdAt_SecFrac[0] == '\0') {
-			MsgLock(pM);
-			/* re-check, may have changed while we did not hold lock */
-			if(pM->pszRcvdAt_SecFrac[0] == '\0') {
-				datetime.formatTimestampSecFrac(&pM->tRcvdAt, pM->pszRcvdAt_SecFrac);
-			}
-			MsgUnlock(pM);
-		}
-		return(pM->pszRcvdAt_SecFrac);
+		return msgLazyFmtEmbedded(pM, MSG_LAZY_RCVDSECFRAC, pM->pszRcvdAt_SecFrac,
+					  &pM->tRcvdAt, eFmt);
 	}
 	ENDfunc
 	return "INVALID eFmt OPTION!";
@@ -1709,7 +3266,7 @@ static inline char *getSeverity(msg_t * const pM)
 }
 
 
-static inline char *getSeverityStr(msg_t * const pM)
+char *getSeverityStr(msg_t * const pM)
 {
 	char *name = NULL;
 
@@ -1741,7 +3298,7 @@ static inline char *getFacility(msg_t * const pM)
 	return name;
 }
 
-static inline char *getFacilityStr(msg_t * const pM)
+char *getFacilityStr(msg_t * const pM)
 {
         char *name = NULL;
 
@@ -1798,14 +3355,7 @@ rsRetVal MsgSetAPPNAME(msg_t *__restrict__ const pMsg, const char* pszAPPNAME)
 {
 	DEFiRet;
 	assert(pMsg != NULL);
-	if(pMsg->pCSAPPNAME == NULL) {
-		/* we need to obtain the object first */
-		CHKiRet(rsCStrConstruct(&pMsg->pCSAPPNAME));
-	}
-	/* if we reach this point, we have the object */
-	iRet = rsCStrSetSzStr(pMsg->pCSAPPNAME, (uchar*) pszAPPNAME);
-
-finalize_it:
+	iRet = prop.InternStringProp(&pMsg->pAPPNAME, (uchar*) pszAPPNAME, strlen(pszAPPNAME));
 	RETiRet;
 }
 
@@ -1908,7 +3458,7 @@ static inline char *getParseSuccess(msg_t * const pM)
 
 /* al, 2011-07-26: LockMsg to avoid race conditions
  */
-static inline char *getMSGID(msg_t * const pM)
+char *getMSGID(msg_t * const pM)
 {
 	if (pM->pCSMSGID == NULL) {
 		return "-"; 
@@ -1921,6 +3471,25 @@ static inline char *getMSGID(msg_t * const pM)
 	}
 }
 
+/* get the age (in microseconds) of a latency probe message, that is the
+ * time since it was received. As reception time is wallclock time, the
+ * result is nonsense if the clock was stepped in between; negative ages
+ * are returned as 0. -- rgerhards, 2014-07-09
+ */
+uint64 MsgGetProbeAge(msg_t * const pMsg)
+{
+	struct timeval tv;
+	uint64 tRcvd;
+	uint64 tNow;
+
+	gettimeofday(&tv, NULL);
+	tNow = (uint64) tv.tv_sec * 1000000 + tv.tv_usec;
+	tRcvd = (uint64) pMsg->ttGenTime * 1000000;
+	if(pMsg->tRcvdAt.secfracPrecision == 6)
+		tRcvd += pMsg->tRcvdAt.secfrac;
+	return (tNow > tRcvd) ? tNow - tRcvd : 0;
+}
+
 /* rgerhards 2012-03-15: set parser success (an integer, acutally bool)
  */
 void MsgSetParseSuccess(msg_t * const pMsg, int bSuccess)
@@ -1943,27 +3512,16 @@ void MsgSetRuleset(msg_t * const pMsg, ruleset_t *pRuleset)
  */
 void MsgSetTAG(msg_t *__restrict__ const pMsg, const uchar* pszBuf, const size_t lenBuf)
 {
-	uchar *pBuf;
 	assert(pMsg != NULL);
 
-	freeTAG(pMsg);
-
-	pMsg->iLenTAG = lenBuf;
-	if(pMsg->iLenTAG < CONF_TAG_BUFSIZE) {
-		/* small enough: use fixed buffer (faster!) */
-		pBuf = pMsg->TAG.szBuf;
-	} else {
-		if((pBuf = (uchar*) MALLOC(pMsg->iLenTAG + 1)) == NULL) {
-			/* truncate message, better than completely loosing it... */
-			pBuf = pMsg->TAG.szBuf;
-			pMsg->iLenTAG = CONF_TAG_BUFSIZE - 1;
-		} else {
-			pMsg->TAG.pszTAG = pBuf;
-		}
+	if(lenBuf == 0 || prop.InternStringProp(&pMsg->pTAG, pszBuf, lenBuf) != RS_RET_OK) {
+		/* out of memory: better lose the TAG than the whole message */
+		if(pMsg->pTAG != NULL)
+			prop.Destruct(&pMsg->pTAG);
+		pMsg->iLenTAG = 0;
+		return;
 	}
-
-	memcpy(pBuf, pszBuf, pMsg->iLenTAG);
-	pBuf[pMsg->iLenTAG] = '\0'; /* this also works with truncation! */
+	pMsg->iLenTAG = lenBuf;
 }
 
 
@@ -2018,7 +3576,7 @@ getTAG(msg_t * const pM, uchar **ppBuf, int *piLen)
 			*ppBuf = UCHAR_CONSTANT("");
 			*piLen = 0;
 		} else {
-			*ppBuf = (pM->iLenTAG < CONF_TAG_BUFSIZE) ? pM->TAG.szBuf : pM->TAG.pszTAG;
+			*ppBuf = propGetSzStr(pM->pTAG);
 			*piLen = pM->iLenTAG;
 		}
 	}
@@ -2030,7 +3588,7 @@ int getHOSTNAMELen(msg_t * const pM)
 	if(pM == NULL)
 		return 0;
 	else
-		if(pM->pszHOSTNAME == NULL) {
+		if(pM->pHOSTNAME == NULL) {
 			resolveDNS(pM);
 			if(pM->rcvFrom.pRcvFrom == NULL)
 				return 0;
@@ -2046,7 +3604,7 @@ char *getHOSTNAME(msg_t * const pM)
 	if(pM == NULL)
 		return "";
 	else
-		if(pM->pszHOSTNAME == NULL) {
+		if(pM->pHOSTNAME == NULL) {
 			resolveDNS(pM);
 			if(pM->rcvFrom.pRcvFrom == NULL) {
 				return "";
@@ -2057,7 +3615,7 @@ char *getHOSTNAME(msg_t * const pM)
 				return (char*) psz;
 			}
 		} else {
-			return (char*) pM->pszHOSTNAME;
+			return (char*) propGetSzStr(pM->pHOSTNAME);
 		}
 }
 
@@ -2116,19 +3674,18 @@ MsgGetStructuredData(msg_t * const pM, uchar **pBuf, rs_size_t *len)
  */
 uchar *getProgramName(msg_t * const pM, sbool bLockMutex)
 {
-	if(pM->iLenPROGNAME == -1) {
+	if(pM->pPROGNAME == NULL) {
 		if(bLockMutex == LOCK_MUTEX) {
 			MsgLock(pM);
 			/* need to re-check, things may have change in between! */
-			if(pM->iLenPROGNAME == -1)
+			if(pM->pPROGNAME == NULL)
 				aquireProgramName(pM);
 			MsgUnlock(pM);
 		} else {
 			aquireProgramName(pM);
 		}
 	}
-	return (pM->iLenPROGNAME < CONF_PROGNAME_BUFSIZE) ? pM->PROGNAME.szBuf
-						       : pM->PROGNAME.ptr;
+	return (pM->pPROGNAME == NULL) ? UCHAR_CONSTANT("") : propGetSzStr(pM->pPROGNAME);
 }
 
 
@@ -2140,12 +3697,16 @@ uchar *getProgramName(msg_t * const pM, sbool bLockMutex)
 static void tryEmulateAPPNAME(msg_t * const pM)
 {
 	assert(pM != NULL);
-	if(pM->pCSAPPNAME != NULL)
+	if(pM->pAPPNAME != NULL)
 		return; /* we are already done */
 
 	if(msgGetProtocolVersion(pM) == 0) {
-		/* only then it makes sense to emulate */
-		MsgSetAPPNAME(pM, (char*)getProgramName(pM, MUTEX_ALREADY_LOCKED));
+		/* only then it makes sense to emulate - we can share the PROGNAME prop */
+		getProgramName(pM, MUTEX_ALREADY_LOCKED);
+		if(pM->pPROGNAME != NULL) {
+			prop.AddRef(pM->pPROGNAME);
+			pM->pAPPNAME = pM->pPROGNAME;
+		}
 	}
 }
 
@@ -2157,12 +3718,12 @@ static void tryEmulateAPPNAME(msg_t * const pM)
  */
 static inline void prepareAPPNAME(msg_t * const pM, sbool bLockMutex)
 {
-	if(pM->pCSAPPNAME == NULL) {
+	if(pM->pAPPNAME == NULL) {
 		if(bLockMutex == LOCK_MUTEX)
 			MsgLock(pM);
 
 		/* re-query as things might have changed during locking */
-		if(pM->pCSAPPNAME == NULL)
+		if(pM->pAPPNAME == NULL)
 			tryEmulateAPPNAME(pM);
 
 		if(bLockMutex == LOCK_MUTEX)
@@ -2180,10 +3741,10 @@ char *getAPPNAME(msg_t * const pM, sbool bLockMutex)
 	if(bLockMutex == LOCK_MUTEX)
 		MsgLock(pM);
 	prepareAPPNAME(pM, MUTEX_ALREADY_LOCKED);
-	if(pM->pCSAPPNAME == NULL)
+	if(pM->pAPPNAME == NULL)
 		pszRet = UCHAR_CONSTANT("");
 	else 
-		pszRet = rsCStrGetSzStrNoNULL(pM->pCSAPPNAME);
+		pszRet = propGetSzStr(pM->pAPPNAME);
 	if(bLockMutex == LOCK_MUTEX)
 		MsgUnlock(pM);
 	return (char*)pszRet;
@@ -2195,7 +3756,7 @@ static int getAPPNAMELen(msg_t * const pM, sbool bLockMutex)
 {
 	assert(pM != NULL);
 	prepareAPPNAME(pM, bLockMutex);
-	return (pM->pCSAPPNAME == NULL) ? 0 : rsCStrLen(pM->pCSAPPNAME);
+	return (pM->pAPPNAME == NULL) ? 0 : pM->pAPPNAME->len;
 }
 
 /* rgerhards 2008-09-10: set pszInputName in msg object. This calls AddRef()
@@ -2218,8 +3779,18 @@ void MsgSetInputName(msg_t *pThis, prop_t *inputName)
  */
 void MsgSetDfltTZ(msg_t *pThis, char *tz)
 {
-	strncpy(pThis->dfltTZ, tz, 7);
-	pThis->dfltTZ[7] = '\0'; /* ensure 0-Term in case of overflow! */
+	if(tz[0] == '\0' && pThis->pCold == NULL)
+		return; /* nothing to do, "no default TZ" is the initial state */
+	if(msgGetCold(pThis) == NULL)
+		return;
+	strncpy(pThis->pCold->dfltTZ, tz, 7);
+	pThis->pCold->dfltTZ[7] = '\0'; /* ensure 0-Term in case of overflow! */
+}
+
+/* Get default TZ, "" if none is set */
+char *MsgGetDfltTZ(msg_t *pThis)
+{
+	return (pThis->pCold == NULL) ? "" : pThis->pCold->dfltTZ;
 }
 
 
@@ -2326,20 +3897,13 @@ void MsgSetHOSTNAME(msg_t *pThis, uchar* pszHOSTNAME, int lenHOSTNAME)
 {
 	assert(pThis != NULL);
 
-	freeHOSTNAME(pThis);
-
-	pThis->iLenHOSTNAME = lenHOSTNAME;
-	if(pThis->iLenHOSTNAME < CONF_HOSTNAME_BUFSIZE) {
-		/* small enough: use fixed buffer (faster!) */
-		pThis->pszHOSTNAME = pThis->szHOSTNAME;
-	} else if((pThis->pszHOSTNAME = (uchar*) MALLOC(pThis->iLenHOSTNAME + 1)) == NULL) {
-		/* truncate message, better than completely loosing it... */
-		pThis->pszHOSTNAME = pThis->szHOSTNAME;
-		pThis->iLenHOSTNAME = CONF_HOSTNAME_BUFSIZE - 1;
+	if(prop.InternStringProp(&pThis->pHOSTNAME, pszHOSTNAME, lenHOSTNAME) != RS_RET_OK) {
+		if(pThis->pHOSTNAME != NULL)
+			prop.Destruct(&pThis->pHOSTNAME);
+		pThis->iLenHOSTNAME = 0;
+		return;
 	}
-
-	memcpy(pThis->pszHOSTNAME, pszHOSTNAME, pThis->iLenHOSTNAME);
-	pThis->pszHOSTNAME[pThis->iLenHOSTNAME] = '\0'; /* this also works with truncation! */
+	pThis->iLenHOSTNAME = lenHOSTNAME;
 }
 
 
@@ -2381,6 +3945,7 @@ rsRetVal MsgReplaceMSG(msg_t *pThis, uchar* pszMSG, int lenMSG)
 	ISOBJ_TYPE_assert(pThis, msg);
 	assert(pszMSG != NULL);
 
+	MsgRawUnshare(pThis);
 	lenNew = pThis->iLenRawMsg + lenMSG - pThis->iLenMSG;
 	if(lenMSG > pThis->iLenMSG && lenNew >= CONF_RAWMSG_BUFSIZE) {
 		/*  we have lost our "bet" and need to alloc a new buffer ;) */
@@ -2409,8 +3974,12 @@ finalize_it:
 void MsgSetRawMsg(msg_t *pThis, char* pszRawMsg, size_t lenMsg)
 {
 	assert(pThis != NULL);
-	if(pThis->pszRawMsg != pThis->szRawMsg)
+	if(pThis->pRawShare != NULL) {
+		msgRawShareRelease(pThis->pRawShare);
+		pThis->pRawShare = NULL;
+	} else if(pThis->pszRawMsg != pThis->szRawMsg) {
 		free(pThis->pszRawMsg);
+	}
 
 	pThis->iLenRawMsg = lenMsg;
 	if(pThis->iLenRawMsg < CONF_RAWMSG_BUFSIZE) {
@@ -2526,10 +4095,9 @@ static uchar *getNOW(eNOWType eNow, struct syslogTime *t)
 rsRetVal
 getJSONPropVal(msg_t * const pMsg, msgPropDescr_t *pProp, uchar **pRes, rs_size_t *buflen, unsigned short *pbMustBeFreed)
 {
-	uchar *leaf;
 	struct json_object *jroot;
-	struct json_object *parent;
 	struct json_object *field;
+	int bPinned = 0;
 	DEFiRet;
 
 	if(*pbMustBeFreed)
@@ -2539,10 +4107,14 @@ getJSONPropVal(msg_t * const pMsg, msgPropDescr_t *pProp, uchar **pRes, rs_size_
 	if(pProp->id == PROP_CEE) {
 		jroot = pMsg->json;
 	} else if(pProp->id == PROP_LOCAL_VAR) {
-		jroot = pMsg->localvars;
+		if(msgGetLocalVarStr(pMsg, pProp, pRes, buflen) == RS_RET_OK) {
+			if(*pRes != NULL)
+				*pbMustBeFreed = 1;
+			FINALIZE;
+		}
+		jroot = msgGetLocalVarsTree(pMsg);
 	} else if(pProp->id == PROP_GLOBAL_VAR) {
-		pthread_rwlock_rdlock(&glblVars_rwlock);
-		jroot = global_var_root;
+		jroot = glblVarsReadBegin(&bPinned);
 	} else {
 		DBGPRINTF("msgGetJSONPropVal; invalid property id %d\n",
 			  pProp->id);
@@ -2550,13 +4122,7 @@ getJSONPropVal(msg_t * const pMsg, msgPropDescr_t *pProp, uchar **pRes, rs_size_
 	}
 	if(jroot == NULL) goto finalize_it;
 
-	if(!strcmp((char*)pProp->name, "!")) {
-		field = jroot;
-	} else {
-		leaf = jsonPathGetLeaf(pProp->name, pProp->nameLen);
-		CHKiRet(jsonPathFindParent(jroot, pProp->name, leaf, &parent, 1));
-		field = json_object_object_get(parent, (char*)leaf);
-	}
+	field = jsonPathLookup(jroot, pProp);
 	if(field != NULL) {
 		*pRes = (uchar*) strdup(json_object_get_string(field));
 		*buflen = (int) ustrlen(*pRes);
@@ -2565,7 +4131,7 @@ getJSONPropVal(msg_t * const pMsg, msgPropDescr_t *pProp, uchar **pRes, rs_size_
 
 finalize_it:
 	if(pProp->id == PROP_GLOBAL_VAR)
-		pthread_rwlock_unlock(&glblVars_rwlock);
+		glblVarsReadEnd(bPinned, 0);
 	if(*pRes == NULL) {
 		/* could not find any value, so set it to empty */
 		*pRes = (unsigned char*)"";
@@ -2580,17 +4146,15 @@ rsRetVal
 msgGetJSONPropJSON(msg_t * const pMsg, msgPropDescr_t *pProp, struct json_object **pjson)
 {
 	struct json_object *jroot;
-	uchar *leaf;
-	struct json_object *parent;
+	int bPinned = 0;
 	DEFiRet;
 
 	if(pProp->id == PROP_CEE) {
 		jroot = pMsg->json;
 	} else if(pProp->id == PROP_LOCAL_VAR) {
-		jroot = pMsg->localvars;
+		jroot = msgGetLocalVarsTree(pMsg);
 	} else if(pProp->id == PROP_GLOBAL_VAR) {
-		pthread_rwlock_rdlock(&glblVars_rwlock);
-		jroot = global_var_root;
+		jroot = glblVarsReadBegin(&bPinned);
 	} else {
 		DBGPRINTF("msgGetJSONPropJSON; invalid property id %d\n",
 			  pProp->id);
@@ -2602,24 +4166,79 @@ msgGetJSONPropJSON(msg_t * const pMsg, msgPropDescr_t *pProp, struct json_object
 		ABORT_FINALIZE(RS_RET_NOT_FOUND);
 	}
 
-	if(!strcmp((char*)pProp->name, "!")) {
-		*pjson = jroot;
-		FINALIZE;
-	}
-	leaf = jsonPathGetLeaf(pProp->name, pProp->nameLen);
-	CHKiRet(jsonPathFindParent(jroot, pProp->name, leaf, &parent, 1));
-	*pjson = json_object_object_get(parent, (char*)leaf);
+	*pjson = jsonPathLookup(jroot, pProp);
 	if(*pjson == NULL) {
 		ABORT_FINALIZE(RS_RET_NOT_FOUND);
 	}
 
 finalize_it:
 	if(pProp->id == PROP_GLOBAL_VAR)
-		pthread_rwlock_unlock(&glblVars_rwlock);
+		glblVarsReadEnd(bPinned, iRet == RS_RET_OK); /* caller uses *pjson */
 	RETiRet;
 }
 
 
+/* check if the backslash at p[0] starts a valid JSON escape sequence.
+ * In escapeAll == RSFALSE mode, such sequences are kept as is, so that
+ * previously escaped strings are not escaped a second time.
+ */
+static inline int
+jsonIsEscSeq(const uchar *const p, const size_t len)
+{
+	uchar nc;
+
+	if(len < 2)
+		return 0;
+	nc = p[1];
+	return    nc == '"' || nc == '/' || nc == '\\' || nc == 'b' || nc == 'f'
+	       || nc == 'n' || nc == 'r' || nc == 't' || nc == 'u';
+}
+
+
+/* write the JSON escape sequence for c (which must be a character that
+ * strscanJSONPlain() stops at) to buf (at least 6 bytes) and return its
+ * length. We use the RFC4627-defined special sequences where possible.
+ */
+static inline int
+jsonEscSeq(char *const buf, unsigned char c)
+{
+	int j;
+
+	buf[0] = '\\';
+	switch(c) {
+	case '\"':
+		buf[1] = '"';
+		return 2;
+	case '\\':
+		buf[1] = '\\';
+		return 2;
+	case '\010':
+		buf[1] = 'b';
+		return 2;
+	case '\014':
+		buf[1] = 'f';
+		return 2;
+	case '\n':
+		buf[1] = 'n';
+		return 2;
+	case '\r':
+		buf[1] = 'r';
+		return 2;
+	case '\t':
+		buf[1] = 't';
+		return 2;
+	default:
+		/* TODO : proper Unicode encoding (see header comment) */
+		buf[1] = 'u';
+		for(j = 0 ; j < 4 ; ++j) {
+			buf[5-j] = hexdigit[c % 16];
+			c = c / 16;
+		}
+		return 6;
+	}
+}
+
+
 /* Encode a JSON value and add it to provided string. Note that 
  * the string object may be NULL. In this case, it is created
  * if and only if escaping is needed. if escapeAll is false, previously
@@ -2628,97 +4247,136 @@ finalize_it:
 static rsRetVal
 jsonAddVal(uchar *pSrc, unsigned buflen, es_str_t **dst, int escapeAll)
 {
-	unsigned char c;
 	es_size_t i;
-	char numbuf[4];
-	unsigned ni;
-	unsigned char nc;
-	int j;
+	size_t span;
+	char seq[6];
 	DEFiRet;
 
 	for(i = 0 ; i < buflen ; ++i) {
-		c = pSrc[i];
-		if(   (c >= 0x23 && c <= 0x5b)
-		   || (c >= 0x5d /* && c <= 0x10FFFF*/)
-		   || c == 0x20 || c == 0x21) {
-			/* no need to escape */
+		/* copy the run of characters that need no escaping in bulk */
+		span = strscanJSONPlain(pSrc + i, buflen - i);
+		if(span > 0) {
 			if(*dst != NULL)
-				es_addChar(dst, c);
-		} else {
-			if(*dst == NULL) {
-				if(i == 0) {
-					/* we hope we have only few escapes... */
-					*dst = es_newStr(buflen+10);
-				} else {
-					*dst = es_newStrFromBuf((char*)pSrc, i);
-				}
-				if(*dst == NULL) {
-					ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
-				}
-			}
-			/* we must escape, try RFC4627-defined special sequences first */
-			switch(c) {
-			case '\0':
-				es_addBuf(dst, "\\u0000", 6);
-				break;
-			case '\"':
-				es_addBuf(dst, "\\\"", 2);
-				break;
-			case '/':
-				es_addBuf(dst, "\\/", 2);
-				break;
-			case '\\':
-				if (escapeAll == RSFALSE) {
-					ni = i + 1;
-					if (ni <= buflen) {
-						nc = pSrc[ni];
-
-						/* Attempt to not double encode */
-						if (   nc == '"' || nc == '/' || nc == '\\' || nc == 'b' || nc == 'f'
-							|| nc == 'n' || nc == 'r' || nc == 't' || nc == 'u') {
-
-							es_addChar(dst, c);
-							es_addChar(dst, nc);
-							i = ni;
-							break;
-						}
-					}
-				}
-
-				es_addBuf(dst, "\\\\", 2);
-				break;
-			case '\010':
-				es_addBuf(dst, "\\b", 2);
-				break;
-			case '\014':
-				es_addBuf(dst, "\\f", 2);
-				break;
-			case '\n':
-				es_addBuf(dst, "\\n", 2);
-				break;
-			case '\r':
-				es_addBuf(dst, "\\r", 2);
-				break;
-			case '\t':
-				es_addBuf(dst, "\\t", 2);
-				break;
-			default:
-				/* TODO : proper Unicode encoding (see header comment) */
-				for(j = 0 ; j < 4 ; ++j) {
-					numbuf[3-j] = hexdigit[c % 16];
-					c = c / 16;
-				}
-				es_addBuf(dst, "\\u", 2);
-				es_addBuf(dst, numbuf, 4);
+				es_addBuf(dst, (char*) pSrc + i, span);
+			i += span;
+			if(i == buflen)
 				break;
+		}
+		if(*dst == NULL) {
+			if(i == 0) {
+				/* we hope we have only few escapes... */
+				*dst = es_newStr(buflen+10);
+			} else {
+				*dst = es_newStrFromBuf((char*)pSrc, i);
+			}
+			if(*dst == NULL) {
+				ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 			}
 		}
+		if(   pSrc[i] == '\\' && escapeAll == RSFALSE
+		   && jsonIsEscSeq(pSrc + i, buflen - i)) {
+			/* Attempt to not double encode */
+			es_addBuf(dst, (char*) pSrc + i, 2);
+			++i;
+		} else {
+			es_addBuf(dst, seq, jsonEscSeq(seq, pSrc[i]));
+		}
 	}
 finalize_it:
 	RETiRet;
 }
 
 
+/* return the length of the JSON-escaped form of pSrc[0..len) */
+size_t
+jsonEscapedLen(const uchar *const pSrc, const size_t len, const int escapeAll)
+{
+	size_t i;
+	size_t span;
+	size_t lenOut = 0;
+	char seq[6];
+
+	for(i = 0 ; i < len ; ++i) {
+		span = strscanJSONPlain(pSrc + i, len - i);
+		lenOut += span;
+		i += span;
+		if(i == len)
+			break;
+		if(pSrc[i] == '\\' && escapeAll == RSFALSE && jsonIsEscSeq(pSrc + i, len - i)) {
+			lenOut += 2;
+			++i;
+		} else {
+			lenOut += jsonEscSeq(seq, pSrc[i]);
+		}
+	}
+	return lenOut;
+}
+
+
+/* write the JSON-escaped form of pSrc[0..len) to pDst, which must have
+ * room for jsonEscapedLen() bytes. Returns the number of bytes written.
+ */
+size_t
+jsonEscapeRender(uchar *const pDst, const uchar *const pSrc, const size_t len, const int escapeAll)
+{
+	uchar *p = pDst;
+	size_t i;
+	size_t span;
+
+	for(i = 0 ; i < len ; ++i) {
+		span = strscanJSONPlain(pSrc + i, len - i);
+		memcpy(p, pSrc + i, span);
+		p += span;
+		i += span;
+		if(i == len)
+			break;
+		if(pSrc[i] == '\\' && escapeAll == RSFALSE && jsonIsEscSeq(pSrc + i, len - i)) {
+			*p++ = pSrc[i++];
+			*p++ = pSrc[i];
+		} else {
+			p += jsonEscSeq((char*) p, pSrc[i]);
+		}
+	}
+	return p - pDst;
+}
+
+
+/* Return the exact size of the JSON field ("name":"value") that
+ * jsonFieldRender() creates for the provided value of template entry pTpe.
+ */
+size_t
+jsonFieldLen(struct templateEntry *const pTpe, const uchar *const pSrc, const size_t len)
+{
+	return pTpe->lenFieldName + 5
+	       + jsonEscapedLen(pSrc, len, pTpe->data.field.options.bJSONf ? RSTRUE : RSFALSE);
+}
+
+
+/* Render the value pSrc[0..len) of template entry pTpe as JSON field into
+ * pDst, which must have room for jsonFieldLen() bytes. This creates the
+ * same output as jsonField(), but without any intermediate copies.
+ * Returns the number of bytes written.
+ */
+size_t
+jsonFieldRender(struct templateEntry *const pTpe, uchar *const pDst,
+		const uchar *const pSrc, const size_t len)
+{
+	const int escapeAll = pTpe->data.field.options.bJSONf ? RSTRUE : RSFALSE;
+	uchar *p = pDst;
+
+	*p++ = '"';
+	if(pTpe->lenFieldName > 0) {
+		memcpy(p, pTpe->fieldName, pTpe->lenFieldName);
+		p += pTpe->lenFieldName;
+	}
+	memcpy(p, "\":\"", 3);
+	p += 3;
+	p += jsonEscapeRender(p, pSrc, len, escapeAll);
+	*p++ = '"';
+	return p - pDst;
+}
+
+
 /* encode a property in JSON escaped format. This is a helper
  * to MsgGetProp. It needs to update all provided parameters.
  * Note: Code is borrowed from libee (my own code, so ASL 2.0
@@ -2839,9 +4497,11 @@ finalize_it:
 #define RET_OUT_OF_MEMORY { *pbMustBeFreed = 0;\
 	*pPropLen = sizeof("**OUT OF MEMORY**") - 1; \
 	return(UCHAR_CONSTANT("**OUT OF MEMORY**"));}
-uchar *MsgGetProp(msg_t *__restrict__ const pMsg, struct templateEntry *__restrict__ const pTpe,
+static uchar *
+msgGetPropImpl(msg_t *__restrict__ const pMsg, struct templateEntry *__restrict__ const pTpe,
                  msgPropDescr_t *pProp, rs_size_t *__restrict__ const pPropLen,
-		 unsigned short *__restrict__ const pbMustBeFreed, struct syslogTime * const ttNow)
+		 unsigned short *__restrict__ const pbMustBeFreed, struct syslogTime * const ttNow,
+		 sbool *__restrict__ const pbJSONf)
 {
 	uchar *pRes; /* result pointer */
 	rs_size_t bufLen = -1; /* length of string or -1, if not known */
@@ -3696,11 +5356,17 @@ uchar *MsgGetProp(msg_t *__restrict__ const pMsg, struct templateEntry *__restri
 	} else if(pTpe->data.field.options.bJSON) {
 		jsonEncode(&pRes, pbMustBeFreed, &bufLen, RSTRUE);
 	} else if(pTpe->data.field.options.bJSONf) {
-		jsonField(pTpe, &pRes, pbMustBeFreed, &bufLen, RSTRUE);
+		if(pbJSONf == NULL)
+			jsonField(pTpe, &pRes, pbMustBeFreed, &bufLen, RSTRUE);
+		else
+			*pbJSONf = 1;
 	} else if(pTpe->data.field.options.bJSONr) {
 		jsonEncode(&pRes, pbMustBeFreed, &bufLen, RSFALSE);
 	} else if(pTpe->data.field.options.bJSONfr) {
-		jsonField(pTpe, &pRes, pbMustBeFreed, &bufLen, RSFALSE);
+		if(pbJSONf == NULL)
+			jsonField(pTpe, &pRes, pbMustBeFreed, &bufLen, RSFALSE);
+		else
+			*pbJSONf = 1;
 	}
 
 	*pPropLen = (bufLen == -1) ? ustrlen(pRes) : bufLen;
@@ -3710,6 +5376,30 @@ uchar *MsgGetProp(msg_t *__restrict__ const pMsg, struct templateEntry *__restri
 }
 
 
+uchar *MsgGetProp(msg_t *__restrict__ const pMsg, struct templateEntry *__restrict__ const pTpe,
+                 msgPropDescr_t *pProp, rs_size_t *__restrict__ const pPropLen,
+		 unsigned short *__restrict__ const pbMustBeFreed, struct syslogTime * const ttNow)
+{
+	return msgGetPropImpl(pMsg, pTpe, pProp, pPropLen, pbMustBeFreed, ttNow, NULL);
+}
+
+
+/* same as MsgGetProp(), but if the property is to be formatted as JSON
+ * field (jsonf, jsonfr options), this final step is left to the caller,
+ * which is told so by setting *pbJSONf to 1. This permits the caller to
+ * render the field directly into its output buffer, see jsonFieldLen()
+ * and jsonFieldRender().
+ */
+uchar *MsgGetPropDeferJSONf(msg_t *__restrict__ const pMsg, struct templateEntry *__restrict__ const pTpe,
+                 msgPropDescr_t *pProp, rs_size_t *__restrict__ const pPropLen,
+		 unsigned short *__restrict__ const pbMustBeFreed, struct syslogTime * const ttNow,
+		 sbool *__restrict__ const pbJSONf)
+{
+	*pbJSONf = 0;
+	return msgGetPropImpl(pMsg, pTpe, pProp, pPropLen, pbMustBeFreed, ttNow, pbJSONf);
+}
+
+
 /* This function can be used as a generic way to set properties.
  * We have to handle a lot of legacy, so our return value is not always
  * 100% correct (called functions do not always provide one, should
@@ -3807,6 +5497,63 @@ MsgGetSeverity(msg_t * const pMsg, int *piSeverity)
 }
 
 
+/* estimate the memory a JSON tree occupies. json-c does not tell us, so
+ * we assume a fixed overhead per node (object, hash entry) plus the size
+ * of names and string values.
+ */
+#define JSON_NODE_OVERHEAD 64
+static size_t
+jsonMemSize(struct json_object *const json)
+{
+	struct json_object_iter it;
+	size_t size = JSON_NODE_OVERHEAD;
+	int i, n;
+
+	if(json == NULL)
+		return 0;
+	switch(json_object_get_type(json)) {
+	case json_type_object:
+		json_object_object_foreachC(json, it) {
+			size += JSON_NODE_OVERHEAD + strlen(it.key) + 1 + jsonMemSize(it.val);
+		}
+		break;
+	case json_type_array:
+		n = json_object_array_length(json);
+		for(i = 0 ; i < n ; ++i)
+			size += sizeof(void*) + jsonMemSize(json_object_array_get_idx(json, i));
+		break;
+	case json_type_string:
+		size += json_object_get_string_len(json) + 1;
+		break;
+	default:
+		break;
+	}
+	return size;
+}
+
+/* get the (approximate) memory a message occupies, used by the queue
+ * memory accounting. The estimate is computed on first use and then kept:
+ * a queue must subtract exactly what it added, but the message may be
+ * modified while it is queued (an action queue receives the message while
+ * the ruleset still runs). That also means the message is only walked by
+ * the thread that enqueues it. MsgResetMemSize() requests a new estimate
+ * once the message has left its last queue, e.g. after parsing.
+ */
+int64
+MsgGetMemSize(msg_t *const pM)
+{
+	size_t size;
+
+	if(pM->iMemSize == 0) {
+		size = sizeof(msg_t) + pM->iLenRawMsg + jsonMemSize(pM->json);
+		if(pM->pCold != NULL)
+			size += sizeof(struct msgCold);
+		pM->iMemSize = (size > UINT_MAX) ? UINT_MAX : (unsigned) size;
+	}
+	return pM->iMemSize;
+}
+
+
 static uchar *
 jsonPathGetLeaf(uchar *name, int lenName)
 {
@@ -3825,6 +5572,63 @@ jsonPathGetLeaf(uchar *name, int lenName)
 }
 
 
+/* compile a JSON property name (already normalized to start with '!')
+ * into its path segments. Segments are split at '!'; empty segments are
+ * skipped, just as the string-based path walker does. Pointers and
+ * segment strings share a single allocation, pathSeg is NULL if the name
+ * refers to the root.
+ */
+static rsRetVal
+jsonPathCompile(msgPropDescr_t *pProp)
+{
+	uchar *name = pProp->name;
+	uchar *pBuf;
+	int i, iSeg, nSeg;
+	DEFiRet;
+
+	pProp->pathSeg = NULL;
+	nSeg = 0;
+	for(i = 1 ; i < pProp->nameLen ; ++i)
+		if(name[i] != '!' && name[i-1] == '!')
+			++nSeg;
+	pProp->nPathSeg = nSeg;
+	if(nSeg == 0)
+		FINALIZE;
+
+	CHKmalloc(pProp->pathSeg = malloc(nSeg * sizeof(uchar*) + pProp->nameLen + 1));
+	pBuf = (uchar*) (pProp->pathSeg + nSeg);
+	memcpy(pBuf, name, pProp->nameLen + 1);
+	for(i = 1, iSeg = 0 ; i < pProp->nameLen ; ++i) {
+		if(pBuf[i] == '!')
+			pBuf[i] = '\0';
+		else if(pBuf[i-1] == '!' || pBuf[i-1] == '\0')
+			pProp->pathSeg[iSeg++] = pBuf + i;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* find the JSON object described by a precompiled property path. This
+ * is a read-only operation: missing or non-container intermediate nodes
+ * mean the property does not exist. Returns NULL if not found.
+ */
+static struct json_object *
+jsonPathLookup(struct json_object *jroot, msgPropDescr_t *pProp)
+{
+	struct json_object *json = jroot;
+	int i;
+
+	for(i = 0 ; json != NULL && i < pProp->nPathSeg ; ++i) {
+		if(json_object_get_type(json) != json_type_object)
+			return NULL;
+		json = json_object_object_get(json, (char*)pProp->pathSeg[i]);
+	}
+	return json;
+}
+
+
 static rsRetVal
 jsonPathFindNext(struct json_object *root, uchar *namestart, uchar **name, uchar *leaf,
 		 struct json_object **found, int bCreate)
@@ -3895,26 +5699,16 @@ jsonMerge(struct json_object *existing, struct json_object *json)
 rsRetVal
 jsonFind(struct json_object *jroot, msgPropDescr_t *pProp, struct json_object **jsonres)
 {
-	uchar *leaf;
-	struct json_object *parent;
 	struct json_object *field;
 	DEFiRet;
 
 	if(jroot == NULL) {
 		field = NULL;
-		goto finalize_it;
-	}
-
-	if(!strcmp((char*)pProp->name, "!")) {
-		field = jroot;
 	} else {
-		leaf = jsonPathGetLeaf(pProp->name, pProp->nameLen);
-		CHKiRet(jsonPathFindParent(jroot, pProp->name, leaf, &parent, 0));
-		field = json_object_object_get(parent, (char*)leaf);
+		field = jsonPathLookup(jroot, pProp);
 	}
 	*jsonres = field;
 
-finalize_it:
 	RETiRet;
 }
 
@@ -3924,6 +5718,7 @@ msgAddJSON(msg_t * const pM, uchar *name, struct json_object *json)
 	/* TODO: error checks! This is a quick&dirty PoC! */
 	struct json_object **pjroot;
 	struct json_object *parent, *leafnode;
+	struct json_object *glblRoot = NULL;
 	uchar *leaf;
 	DEFiRet;
 
@@ -3931,10 +5726,12 @@ msgAddJSON(msg_t * const pM, uchar *name, struct json_object *json)
 	if(name[0] == '!') {
 		pjroot = &pM->json;
 	} else if(name[0] == '.') {
+		msgLocalVarsMaterialize(pM);
 		pjroot = &pM->localvars;
-	} else { /* globl var */
-		pthread_rwlock_wrlock(&glblVars_rwlock);
-		pjroot = &global_var_root;
+	} else { /* globl var - modify a copy, see glblVarsPublish() */
+		pthread_mutex_lock(&mutGlblVars);
+		glblRoot = jsonDeepCopy(global_var_root);
+		pjroot = &glblRoot;
 	}
 
 	if(name[1] == '\0') { /* full tree? */
@@ -3985,8 +5782,13 @@ msgAddJSON(msg_t * const pM, uchar *name, struct json_object *json)
 	}
 
 finalize_it:
-	if(name[0] == '/')
-		pthread_rwlock_unlock(&glblVars_rwlock);
+	if(name[0] == '/') {
+		if(iRet == RS_RET_OK)
+			glblVarsPublish(glblRoot);
+		else if(glblRoot != NULL)
+			json_object_put(glblRoot);
+		pthread_mutex_unlock(&mutGlblVars);
+	}
 	MsgUnlock(pM);
 	RETiRet;
 }
@@ -3997,6 +5799,7 @@ msgDelJSON(msg_t * const pM, uchar *name)
 {
 	struct json_object **jroot;
 	struct json_object *parent, *leafnode;
+	struct json_object *glblRoot = NULL;
 	uchar *leaf;
 	DEFiRet;
 
@@ -4005,10 +5808,12 @@ msgDelJSON(msg_t * const pM, uchar *name)
 	if(name[0] == '!') {
 		jroot = &pM->json;
 	} else if(name[0] == '.') {
+		msgLocalVarsMaterialize(pM);
 		jroot = &pM->localvars;
-	} else { /* globl var */
-		pthread_rwlock_wrlock(&glblVars_rwlock);
-		jroot = &global_var_root;
+	} else { /* globl var - modify a copy, see glblVarsPublish() */
+		pthread_mutex_lock(&mutGlblVars);
+		glblRoot = jsonDeepCopy(global_var_root);
+		jroot = &glblRoot;
 	}
 	if(jroot == NULL) {
 		DBGPRINTF("msgDelJSONVar; jroot empty in unset for property %s\n",
@@ -4023,6 +5828,11 @@ msgDelJSON(msg_t * const pM, uchar *name)
 		DBGPRINTF("unsetting JSON root object\n");
 		json_object_put(*jroot);
 		*jroot = NULL;
+		if(name[0] == '.') {
+			/* slot values must not become visible again */
+			msgLocalVarsDestruct(pM->pLocalVars);
+			pM->pLocalVars = NULL;
+		}
 	} else {
 		if(*jroot == NULL) {
 			/* now we need a root obj */
@@ -4043,8 +5853,13 @@ msgDelJSON(msg_t * const pM, uchar *name)
 	}
 
 finalize_it:
-	if(name[0] == '/')
-		pthread_rwlock_unlock(&glblVars_rwlock);
+	if(name[0] == '/') {
+		if(iRet == RS_RET_OK)
+			glblVarsPublish(glblRoot);
+		else if(glblRoot != NULL)
+			json_object_put(glblRoot);
+		pthread_mutex_unlock(&mutGlblVars);
+	}
 	MsgUnlock(pM);
 	RETiRet;
 }
@@ -4103,29 +5918,14 @@ done:	return dst;
 rsRetVal
 msgSetJSONFromVar(msg_t * const pMsg, uchar *varname, struct var *v)
 {
-	struct json_object *json = NULL;
-	char *cstr;
+	struct json_object *json;
 	DEFiRet;
-	switch(v->datatype) {
-	case 'S':/* string */
-		cstr = es_str2cstr(v->d.estr, NULL);
-		json = json_object_new_string(cstr);
-		free(cstr);
-		break;
-	case 'N':/* number (integer) */
-#ifdef HAVE_JSON_OBJECT_NEW_INT64
-		json = json_object_new_int64(v->d.n);
-#else /* HAVE_JSON_OBJECT_NEW_INT64 */
-		json = json_object_new_int((int) v->d.n);
-#endif /* HAVE_JSON_OBJECT_NEW_INT64 */
-		break;
-	case 'J':/* native JSON */
-		json = jsonDeepCopy(v->d.json);
-		break;
-	default:DBGPRINTF("msgSetJSONFromVar: unsupported datatype %c\n",
-		v->datatype);
+	if(v->datatype != 'S' && v->datatype != 'N' && v->datatype != 'J') {
+		DBGPRINTF("msgSetJSONFromVar: unsupported datatype %c\n",
+			v->datatype);
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
+	json = msgVarToJSON(v);
 
 	msgAddJSON(pMsg, varname, json);
 finalize_it:
@@ -4173,11 +5973,20 @@ msgPropDescrFill(msgPropDescr_t *pProp, uchar *name, int nameLen)
 	  	/* in these cases, we need the field name for later processing */
 		/* normalize name: remove $ if present */
 		offs = (name[0] == '$') ? 1 : 0;
-		pProp->name = ustrdup(name + offs);
+		CHKmalloc(pProp->name = ustrdup(name + offs));
 		pProp->nameLen = nameLen - offs;
 		/* we patch the root name, so that support functions do not need to
 		 * check for different root chars. */
 		pProp->name[0] = '!';
+		if((iRet = jsonPathCompile(pProp)) != RS_RET_OK) {
+			free(pProp->name);
+			FINALIZE;
+		}
+		pProp->localSlot = (id == PROP_LOCAL_VAR) ? msgLocalVarSlot(pProp->name) : -1;
+	} else {
+		pProp->pathSeg = NULL;
+		pProp->nPathSeg = 0;
+		pProp->localSlot = -1;
 	}
 	pProp->id = id;
 finalize_it:
@@ -4190,8 +5999,10 @@ msgPropDescrDestruct(msgPropDescr_t *pProp)
 	if(pProp != NULL) {
 		if(pProp->id == PROP_CEE ||
 		   pProp->id == PROP_LOCAL_VAR ||
-		   pProp->id == PROP_GLOBAL_VAR)
+		   pProp->id == PROP_GLOBAL_VAR) {
 			free(pProp->name);
+			free(pProp->pathSeg);
+		}
 	}
 }
 
@@ -4204,7 +6015,10 @@ rsRetVal msgQueryInterface(void) { return RS_RET_NOT_IMPLEMENTED; }
  * rgerhards, 2008-01-04
  */
 BEGINObjClassInit(msg, 1, OBJ_IS_CORE_MODULE)
-	pthread_rwlock_init(&glblVars_rwlock, NULL);
+	int i;
+#	ifdef HAVE_ATOMIC_BUILTINS
+	bGlblVarsKeyActive = (pthread_key_create(&keyGlblVarsReader, glblVarsReaderDestruct) == 0);
+#	endif
 
 	/* request objects we use */
 	CHKiRet(objUse(datetime, CORE_COMPONENT));
@@ -4218,6 +6032,16 @@ BEGINObjClassInit(msg, 1, OBJ_IS_CORE_MODULE)
 #	if HAVE_MALLOC_TRIM
 	INIT_ATOMIC_HELPER_MUT(mutTrimCtr);
 #	endif
+	msgPoolInit(&msgPoolMsg, sizeof(msg_t), 4096);
+	msgPoolInit(&msgPoolTSBuf, MSGPOOL_TSBUF_SIZE, 16384);
+	msgPoolInit(&msgPoolCold, sizeof(struct msgCold), 4096);
+	msgPoolInit(&msgPoolLocalVars, sizeof(struct msgLocalVars), 1024);
+	bTSCacheActive = (pthread_key_create(&keyTSCache, free) == 0);
+#	ifdef USE_LIBUUID
+	bUUIDGenActive = (pthread_key_create(&keyUUIDGen, free) == 0);
+#	endif
+	for(i = 0 ; i < MSG_LOCK_STRIPES ; ++i)
+		pthread_mutex_init(&msgLockTab[i], NULL);
 ENDObjClassInit(msg)
 /* vim:set ai:
  */
@@ -56,49 +56,55 @@
  * adding new fields. You need to initialize them in
  * msgBaseConstruct(). That function header comment also describes
  * why this is the case.
+ *
+ * The structure is laid out for cache efficiency: the fields used by
+ * (almost) every filter and action come first, so that they share as
+ * few cache lines as possible. Properties that are only rarely used are
+ * kept in a separate extension (struct msgCold), which is only allocated
+ * when one of them is actually needed.
  */
+struct msgCold {
+	char	*pszRcvdAt_MySQL;	/* rcvdAt as MySQL formatted string (always 14 charcters) */
+	char	*pszRcvdAt_PgSQL;	/* rcvdAt as PgSQL formatted string (always 21 characters) */
+	char	*pszTIMESTAMP_MySQL;	/* TIMESTAMP as MySQL formatted string (always 14 charcters) */
+	char	*pszTIMESTAMP_PgSQL;	/* TIMESTAMP as PgSQL formatted string (always 21 characters) */
+	uchar	*pszUUID;		/* The message's UUID */
+	char	dfltTZ[8];		/* 7 chars max, less overhead than ptr! */
+};
+
 struct msg {
 	BEGINobjInstance;	/* Data to implement generic object - MUST be the first data element! */
+	/* hot part, used during filter evaluation and by the default templates */
 	flowControl_t flowCtlType; /**< type of flow control we can apply, for enqueueing, needs not to be persisted because
 				        once data has entered the queue, this property is no longer needed. */
-	pthread_mutex_t mut;
 	int	iRefCount;	/* reference counter (0 = unused) */
-	sbool	bParseSuccess;	/* set to reflect state of last executed higher level parser */
 	short	iSeverity;	/* the severity 0..7 */
 	short	iFacility;	/* Facility code 0 .. 23*/
 	short	offAfterPRI;	/* offset, at which raw message WITHOUT PRI part starts in pszRawMsg */
 	short	offMSG;		/* offset at which the MSG part starts in pszRawMsg */
-	short	iProtocolVersion;/* protocol version of message received 0 - legacy, 1 syslog-protocol) */
 	int	msgFlags;	/* flags associated with this message */
 	int	iLenRawMsg;	/* length of raw message */
 	int	iLenMSG;	/* Length of the MSG part */
 	int	iLenTAG;	/* Length of the TAG part */
-	int	iLenHOSTNAME;	/* Length of HOSTNAME */
-	int	iLenPROGNAME;	/* Length of PROGNAME (-1 = not yet set) */
 	uchar	*pszRawMsg;	/* message as it was received on the wire. This is important in case we
 				 * need to preserve cryptographic verifiers.  */
-	uchar	*pszHOSTNAME;	/* HOSTNAME from syslog message */
-	char *pszRcvdAt3164;	/* time as RFC3164 formatted string (always 15 charcters) */
-	char *pszRcvdAt3339;	/* time as RFC3164 formatted string (32 charcters at most) */
-	char *pszRcvdAt_MySQL;	/* rcvdAt as MySQL formatted string (always 14 charcters) */
-        char *pszRcvdAt_PgSQL;  /* rcvdAt as PgSQL formatted string (always 21 characters) */
-	char *pszTIMESTAMP3164;	/* TIMESTAMP as RFC3164 formatted string (always 15 charcters) */
-	char *pszTIMESTAMP3339;	/* TIMESTAMP as RFC3339 formatted string (32 charcters at most) */
-	char *pszTIMESTAMP_MySQL;/* TIMESTAMP as MySQL formatted string (always 14 charcters) */
-        char *pszTIMESTAMP_PgSQL;/* TIMESTAMP as PgSQL formatted string (always 21 characters) */
-	uchar *pszStrucData;    /* STRUCTURED-DATA */
-	uint16_t lenStrucData;	/* (cached) length of STRUCTURED-DATA */
-	cstr_t *pCSAPPNAME;	/* APP-NAME */
-	cstr_t *pCSPROCID;	/* PROCID */
-	cstr_t *pCSMSGID;	/* MSGID */
+	ruleset_t *pRuleset;	/* ruleset to be used for processing this message */
+	/* the following props are interned, so messages with the same values share them */
+	prop_t	*pTAG;		/* TAG, NULL if not set */
+	prop_t	*pHOSTNAME;	/* HOSTNAME from syslog message */
+	int	iLenHOSTNAME;	/* Length of HOSTNAME */
+	prop_t	*pPROGNAME;	/* PROGNAME, NULL = not yet set */
+	short	iProtocolVersion;/* protocol version of message received 0 - legacy, 1 syslog-protocol) */
+	sbool	bParseSuccess;	/* set to reflect state of last executed higher level parser */
+	int	lazyInit;	/* claim/ready bits for lazily formatted embedded strings, see msg.c */
 	prop_t *pInputName;	/* input name property */
-	prop_t *pRcvFromIP;	/* IP of system message was received from */
 	union {
 		prop_t *pRcvFrom;/* name of system message was received from */
 		struct sockaddr_storage *pfrominet; /* unresolved name */
 	} rcvFrom;
-
-	ruleset_t *pRuleset;	/* ruleset to be used for processing this message */
+	prop_t *pRcvFromIP;	/* IP of system message was received from */
+	struct json_object *json;
+	struct json_object *localvars;
 	time_t ttGenTime;	/* time msg object was generated, same as tRcvdAt, but a Unix timestamp.
 				   While this field looks redundant, it is required because a Unix timestamp
 				   is used at later processing stages (namely in the output arena). Thanks to
@@ -108,27 +114,26 @@ struct msg {
 				   it obviously is solved in way or another...). */
 	struct syslogTime tRcvdAt;/* time the message entered this program */
 	struct syslogTime tTIMESTAMP;/* (parsed) value of the timestamp */
-	struct json_object *json;
-	struct json_object *localvars;
+	char *pszRcvdAt3164;	/* time as RFC3164 formatted string (always 15 charcters) */
+	char *pszRcvdAt3339;	/* time as RFC3164 formatted string (32 charcters at most) */
+	uchar *pszStrucData;    /* STRUCTURED-DATA */
+	uint16_t lenStrucData;	/* (cached) length of STRUCTURED-DATA */
+	prop_t *pAPPNAME;	/* APP-NAME (interned) */
+	cstr_t *pCSPROCID;	/* PROCID */
+	cstr_t *pCSMSGID;	/* MSGID */
+	struct msgCold *pCold;	/* rarely used properties, NULL until first needed */
+	struct msgRawShare *pRawShare;	/* if non-NULL, pszRawMsg is shared with MsgDup()'ed messages */
+	struct msgLocalVars *pLocalVars;	/* pooled slot storage for $.xxx, used while localvars is NULL */
+	struct msgStages *pStages;	/* stage timestamps if sampled for pipestats, else NULL */
+	unsigned iMemSize;	/* memory estimate for queue accounting, 0 - not yet computed */
 	/* some fixed-size buffers to save malloc()/free() for frequently used fields (from the default templates) */
 	uchar szRawMsg[CONF_RAWMSG_BUFSIZE];	/* most messages are small, and these are stored here (without malloc/free!) */
-	uchar szHOSTNAME[CONF_HOSTNAME_BUFSIZE];
-	union {
-		uchar	*ptr;	/* pointer to progname value */
-		uchar	szBuf[CONF_PROGNAME_BUFSIZE];
-	} PROGNAME;
-	union {
-		uchar	*pszTAG;	/* pointer to tag value */
-		uchar	szBuf[CONF_TAG_BUFSIZE];
-	} TAG;
-	char pszTimestamp3164[CONST_LEN_TIMESTAMP_3164 + 1];
+	char pszTimestamp3164[CONST_LEN_TIMESTAMP_3164 + 1]; /* used by the traditional default templates */
 	char pszTimestamp3339[CONST_LEN_TIMESTAMP_3339 + 1];
 	char pszTIMESTAMP_SecFrac[7]; /* Note: a pointer is 64 bits/8 char, so this is actually fewer than a pointer! */
 	char pszRcvdAt_SecFrac[7];	     /* same as above. Both are fractional seconds for their respective timestamp */
 	char pszTIMESTAMP_Unix[12]; /* almost as small as a pointer! */
 	char pszRcvdAt_Unix[12];
-	char dfltTZ[8];	    /* 7 chars max, less overhead than ptr! */
-	uchar *pszUUID; /* The message's UUID */
 };
 
 
@@ -144,6 +149,10 @@ struct msg {
 #define NEEDS_DNSRESOL	0x040	/* fromhost address is unresolved and must be locked up via DNS reverse lookup first */
 #define NEEDS_ACLCHK_U	0x080	/* check UDP ACLs after DNS resolution has been done in main queue consumer */
 #define NO_PRI_IN_RAW	0x100	/* rawmsg does not include a PRI (Solaris!), but PRI is already set correctly in the msg object */
+#define PROBE_MSG	0x200	/* latency probe (see imdiag): only measured, never passed to an output */
+#define PARSE_IN_INPUT	0x400	/* preprocess (ACL check, parse) on submit, in the input's thread */
+#define PACKED_MSG	0x800	/* queue internal: object only carries a compressed message record (see queue.c) */
+#define DISCARD_MSG	0x1000	/* set by a message modification action: stop processing the message (see execAct()) */
 
 /* (syslog) protocol types */
 #define MSG_LEGACY_PROTOCOL 0
@@ -153,6 +162,7 @@ struct msg {
  */
 PROTOTYPEObjClassInit(msg);
 rsRetVal msgConstruct(msg_t **ppThis);
+rsRetVal msgPoolActivate(int nMsgs, int memFlags, int *pFlagsDone);
 rsRetVal msgConstructWithTime(msg_t **ppThis, struct syslogTime *stTime, time_t ttGenTime);
 rsRetVal msgConstructForDeserializer(msg_t **ppThis);
 rsRetVal msgConstructFinalizer(msg_t *pThis);
@@ -162,12 +172,14 @@ msg_t *MsgAddRef(msg_t *pM);
 void setProtocolVersion(msg_t *pM, int iNewVersion);
 void MsgSetInputName(msg_t *pMsg, prop_t*);
 void MsgSetDfltTZ(msg_t *pThis, char *tz);
+char *MsgGetDfltTZ(msg_t *pThis);
 rsRetVal MsgSetAPPNAME(msg_t *pMsg, const char* pszAPPNAME);
 rsRetVal MsgSetPROCID(msg_t *pMsg, const char* pszPROCID);
 rsRetVal MsgSetMSGID(msg_t *pMsg, const char* pszMSGID);
 void MsgSetParseSuccess(msg_t *pMsg, int bSuccess);
 void MsgSetTAG(msg_t *pMsg, const uchar* pszBuf, const size_t lenBuf);
 void MsgSetRuleset(msg_t *pMsg, ruleset_t*);
+uint64 MsgGetProbeAge(msg_t *pMsg);
 rsRetVal MsgSetFlowControlType(msg_t *pMsg, flowControl_t eFlowCtl);
 rsRetVal MsgSetStructuredData(msg_t *const pMsg, const char* pszStrucData);
 rsRetVal MsgAddToStructuredData(msg_t *pMsg, uchar *toadd, rs_size_t len);
@@ -183,19 +195,37 @@ void MsgSetMSGoffs(msg_t *pMsg, short offs);
 void MsgSetRawMsgWOSize(msg_t *pMsg, char* pszRawMsg);
 void MsgSetRawMsg(msg_t *pMsg, char* pszRawMsg, size_t lenMsg);
 rsRetVal MsgReplaceMSG(msg_t *pThis, uchar* pszMSG, int lenMSG);
+void MsgRawUnshare(msg_t *pThis);
 uchar *MsgGetProp(msg_t *pMsg, struct templateEntry *pTpe, msgPropDescr_t *pProp,
 		  rs_size_t *pPropLen, unsigned short *pbMustBeFreed, struct syslogTime *ttNow);
+uchar *MsgGetPropDeferJSONf(msg_t *pMsg, struct templateEntry *pTpe, msgPropDescr_t *pProp,
+		  rs_size_t *pPropLen, unsigned short *pbMustBeFreed, struct syslogTime *ttNow,
+		  sbool *pbJSONf);
+size_t jsonFieldLen(struct templateEntry *pTpe, const uchar *pSrc, size_t len);
+size_t jsonFieldRender(struct templateEntry *pTpe, uchar *pDst, const uchar *pSrc, size_t len);
+size_t jsonEscapedLen(const uchar *pSrc, size_t len, int escapeAll);
+size_t jsonEscapeRender(uchar *pDst, const uchar *pSrc, size_t len, int escapeAll);
 uchar *getRcvFrom(msg_t *pM);
 void getTAG(msg_t *pM, uchar **ppBuf, int *piLen);
 char *getTimeReported(msg_t *pM, enum tplFormatTypes eFmt);
+char *getTimeGenerated(msg_t *pM, enum tplFormatTypes eFmt);
+char *getSeverityStr(msg_t *pM);
+char *getFacilityStr(msg_t *pM);
+char *getMSGID(msg_t *pM);
+void getInputName(msg_t *pM, uchar **ppsz, int *plen);
+uchar *getRcvFromIP(msg_t *pM);
 char *getPRI(msg_t *pMsg);
 void getRawMsg(msg_t *pM, uchar **pBuf, int *piLen);
 rsRetVal msgAddJSON(msg_t *pM, uchar *name, struct json_object *json);
 rsRetVal MsgGetSeverity(msg_t *pThis, int *piSeverity);
+int64 MsgGetMemSize(msg_t *pM);
 rsRetVal MsgDeserialize(msg_t *pMsg, strm_t *pStrm);
+rsRetVal MsgSerializeBinary(msg_t *pThis, size_t lenReserve, uchar **ppBuf, size_t *pLenBuf);
+rsRetVal MsgDeserializeBinary(msg_t *pMsg, uchar *pBuf, size_t lenBuf);
 
 /* TODO: remove these five (so far used in action.c) */
 uchar *getMSG(msg_t *pM);
+uchar *getMSGForWrite(msg_t *pM);
 char *getHOSTNAME(msg_t *pM);
 char *getPROCID(msg_t *pM, sbool bLockMutex);
 char *getAPPNAME(msg_t *pM, sbool bLockMutex);
@@ -209,9 +239,14 @@ uchar *getRcvFrom(msg_t *pM);
 rsRetVal propNameToID(uchar *pName, propid_t *pPropID);
 uchar *propIDToName(propid_t propID);
 rsRetVal msgGetJSONPropJSON(msg_t *pMsg, msgPropDescr_t *pProp, struct json_object **pjson);
+void msgGlblVarsQuiesce(void);
 rsRetVal getJSONPropVal(msg_t *pMsg, msgPropDescr_t *pProp, uchar **pRes, rs_size_t *buflen, unsigned short *pbMustBeFreed);
 rsRetVal msgSetJSONFromVar(msg_t *pMsg, uchar *varname, struct var *var);
 rsRetVal msgDelJSON(msg_t *pMsg, uchar *varname);
+int msgLocalVarSlot(const uchar *name);
+rsRetVal msgSetLocalVar(msg_t *pM, int slot, uchar *varname, struct var *v);
+rsRetVal msgUnsetLocalVar(msg_t *pM, int slot, uchar *varname);
+rsRetVal msgGetLocalVar(msg_t *pM, msgPropDescr_t *pProp, struct var *ret);
 rsRetVal jsonFind(struct json_object *jroot, msgPropDescr_t *pProp, struct json_object **jsonres);
 
 rsRetVal msgPropDescrFill(msgPropDescr_t *pProp, uchar *name, int nameLen);
@@ -246,6 +281,17 @@ MsgSetRawMsgSize(msg_t *pMsg, size_t newLen)
 }
 
 
+/* discard the cached memory estimate, so that the next MsgGetMemSize()
+ * computes it anew. This must only be done while no queue accounts for
+ * the message (see MsgGetMemSize()).
+ */
+static inline void
+MsgResetMemSize(msg_t *pMsg)
+{
+	pMsg->iMemSize = 0;
+}
+
+
 /* get the ruleset that is associated with the ruleset.
  * May be NULL. -- rgerhards, 2009-10-27
  */
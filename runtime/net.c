@@ -71,6 +71,7 @@
 #include "net.h"
 #include "dnscache.h"
 #include "prop.h"
+#include "hashmap.h"
 
 #ifdef OS_SOLARIS
 #	define	s6_addr32	_S6_un._S6_u32
@@ -101,6 +102,39 @@ struct AllowedSenders *pAllowedSenders_GSS = NULL;
 static struct AllowedSenders *pLastAllowedSenders_GSS = NULL;
 #endif
 
+/* the search index for an allowed sender list. IP-based entries are kept in
+ * a path-compressed binary (radix) trie per address family, so checking an
+ * address costs O(prefix length) no matter how many entries the list has.
+ * Entries that do not fit into the trie (hostname wildcards and IPv6
+ * addresses with a scope id) are still checked by walking the list. As
+ * hostname checks only depend on the name, their results are cached.
+ * The index is built while the list is built and read-only after startup,
+ * except for the name cache, which has its own mutex.
+ */
+typedef struct aclTrieNode_s aclTrieNode_t;
+struct aclTrieNode_s {
+	uint8_t key[16];	/* prefix in network byte order, bits beyond len are zero */
+	uint8_t len;		/* prefix length in bits */
+	sbool bTerminal;	/* prefix is an ACL entry (and not just a branch point) */
+	aclTrieNode_t *child[2];
+};
+
+typedef struct aclIdx_s {
+	aclTrieNode_t *root4;
+	aclTrieNode_t *root6;
+	int nNames;		/* number of hostname entries */
+	int nScoped;		/* number of IPv6 entries with scope id */
+	pthread_mutex_t mutNameCache;
+	hashmap_t *nameCache;	/* sender hostname -> result + 1 */
+} aclIdx_t;
+#define ACL_NAMECACHE_MAX 4096
+
+static aclIdx_t aclIdx_UDP = { NULL, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER, NULL };
+static aclIdx_t aclIdx_TCP = { NULL, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER, NULL };
+#ifdef USE_GSSAPI
+static aclIdx_t aclIdx_GSS = { NULL, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER, NULL };
+#endif
+
 int     ACLAddHostnameOnFail = 0; /* add hostname to acl when DNS resolving has failed */
 int     ACLDontResolve = 0;       /* add hostname to acl instead of resolving it to IP(s) */
 
@@ -132,6 +166,22 @@ setAllowRoot(struct AllowedSenders **ppAllowRoot, uchar *pszType)
 finalize_it:
 	RETiRet;
 }
+/* returns the ACL search index for the provided type or NULL if the
+ * type is invalid.
+ */
+static inline aclIdx_t *
+getAclIdx(uchar *pszType)
+{
+	if(!strcmp((char*)pszType, "UDP"))
+		return &aclIdx_UDP;
+	else if(!strcmp((char*)pszType, "TCP"))
+		return &aclIdx_TCP;
+#ifdef USE_GSSAPI
+	else if(!strcmp((char*)pszType, "GSS"))
+		return &aclIdx_GSS;
+#endif
+	return NULL;
+}
 /* re-initializes (sets to NULL) the correct allow root pointer
  * rgerhards, 2009-01-12
  */
@@ -518,6 +568,194 @@ static inline void MaskIP4 (struct in_addr  *addr, uint8_t bits) {
 #define SIN6(sa) ((struct sockaddr_in6 *)(void*)(sa))
 
 
+/* ACL radix trie. Keys are addresses in network byte order, so bit 0
+ * is the most significant bit of the first byte.
+ */
+static inline int
+aclTrieGetBit(const uint8_t *key, unsigned bit)
+{
+	return (key[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+/* returns the number of leading bits (max maxBits) both keys have in common */
+static unsigned
+aclTrieCommonBits(const uint8_t *key1, const uint8_t *key2, unsigned maxBits)
+{
+	unsigned i;
+	unsigned bits;
+	uint8_t diff;
+
+	for(i = 0 ; i * 8 < maxBits ; ++i) {
+		if((diff = key1[i] ^ key2[i]) != 0) {
+			for(bits = i * 8 ; !(diff & 0x80) ; diff <<= 1)
+				++bits;
+			return (bits < maxBits) ? bits : maxBits;
+		}
+	}
+	return maxBits;
+}
+
+static aclTrieNode_t *
+aclTrieNewNode(const uint8_t *key, unsigned len, sbool bTerminal)
+{
+	aclTrieNode_t *pNode;
+	unsigned i;
+
+	if((pNode = calloc(1, sizeof(aclTrieNode_t))) == NULL)
+		return NULL;
+	memcpy(pNode->key, key, (len + 7) / 8);
+	if(len % 8) /* clear bits beyond the prefix */
+		pNode->key[len / 8] &= (uint8_t) (0xff << (8 - len % 8));
+	for(i = (len + 7) / 8 ; i < sizeof(pNode->key) ; ++i)
+		pNode->key[i] = 0;
+	pNode->len = (uint8_t) len;
+	pNode->bTerminal = bTerminal;
+	return pNode;
+}
+
+/* add prefix key/len to the trie. The key must already be masked. */
+static rsRetVal
+aclTrieInsert(aclTrieNode_t **ppRoot, const uint8_t *key, unsigned len)
+{
+	aclTrieNode_t **ppNode = ppRoot;
+	aclTrieNode_t *pNode;
+	aclTrieNode_t *pNew;
+	aclTrieNode_t *pLeaf;
+	unsigned common;
+	DEFiRet;
+
+	while(1) {
+		if((pNode = *ppNode) == NULL) {
+			CHKmalloc(*ppNode = aclTrieNewNode(key, len, 1));
+			FINALIZE;
+		}
+		common = aclTrieCommonBits(pNode->key, key, (pNode->len < len) ? pNode->len : len);
+		if(common == pNode->len) {
+			if(len == pNode->len) {
+				pNode->bTerminal = 1;
+				FINALIZE;
+			}
+			ppNode = &pNode->child[aclTrieGetBit(key, pNode->len)];
+			continue;
+		}
+		/* we need to split the node */
+		if(common == len) {
+			/* the new prefix is a parent of the node */
+			CHKmalloc(pNew = aclTrieNewNode(key, len, 1));
+			pNew->child[aclTrieGetBit(pNode->key, len)] = pNode;
+		} else {
+			/* both differ in bit "common": add a branch point */
+			CHKmalloc(pNew = aclTrieNewNode(key, common, 0));
+			if((pLeaf = aclTrieNewNode(key, len, 1)) == NULL) {
+				free(pNew);
+				ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+			}
+			pNew->child[aclTrieGetBit(pNode->key, common)] = pNode;
+			pNew->child[aclTrieGetBit(key, common)] = pLeaf;
+		}
+		*ppNode = pNew;
+		FINALIZE;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+/* check if any prefix in the trie matches key (keyLen bits long) */
+static int
+aclTrieMatch(aclTrieNode_t *pNode, const uint8_t *key, unsigned keyLen)
+{
+	while(pNode != NULL) {
+		if(aclTrieCommonBits(pNode->key, key, pNode->len) < pNode->len)
+			return 0;
+		if(pNode->bTerminal)
+			return 1;
+		if(pNode->len >= keyLen)
+			return 0;
+		pNode = pNode->child[aclTrieGetBit(key, pNode->len)];
+	}
+	return 0;
+}
+
+static void
+aclTrieDestruct(aclTrieNode_t *pNode)
+{
+	if(pNode == NULL)
+		return;
+	aclTrieDestruct(pNode->child[0]);
+	aclTrieDestruct(pNode->child[1]);
+	free(pNode);
+}
+
+/* returns 1 if the entry is checked via the trie, 0 if via the list */
+static inline int
+aclEntryInTrie(struct AllowedSenders *pEntry)
+{
+	if(F_ISSET(pEntry->allowedSender.flags, ADDR_NAME))
+		return 0;
+	if(pEntry->allowedSender.addr.NetAddr->sa_family == AF_INET)
+		return 1;
+	return pEntry->allowedSender.addr.NetAddr->sa_family == AF_INET6
+	       && SIN6(pEntry->allowedSender.addr.NetAddr)->sin6_scope_id == 0;
+}
+
+/* add a new list entry to the search index */
+static rsRetVal
+aclIdxAdd(aclIdx_t *pIdx, struct AllowedSenders *pEntry)
+{
+	DEFiRet;
+
+	if(F_ISSET(pEntry->allowedSender.flags, ADDR_NAME)) {
+		++pIdx->nNames;
+	} else if(!aclEntryInTrie(pEntry)) {
+		++pIdx->nScoped;
+	} else if(pEntry->allowedSender.addr.NetAddr->sa_family == AF_INET) {
+		CHKiRet(aclTrieInsert(&pIdx->root4,
+			(uint8_t*) &SIN(pEntry->allowedSender.addr.NetAddr)->sin_addr,
+			pEntry->SignificantBits));
+	} else {
+		CHKiRet(aclTrieInsert(&pIdx->root6,
+			SIN6(pEntry->allowedSender.addr.NetAddr)->sin6_addr.s6_addr,
+			pEntry->SignificantBits));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+static void
+aclIdxClear(aclIdx_t *pIdx)
+{
+	aclTrieDestruct(pIdx->root4);
+	aclTrieDestruct(pIdx->root6);
+	pIdx->root4 = pIdx->root6 = NULL;
+	pIdx->nNames = pIdx->nScoped = 0;
+	pthread_mutex_lock(&pIdx->mutNameCache);
+	if(pIdx->nameCache != NULL)
+		hashmapDestruct(&pIdx->nameCache);
+	pthread_mutex_unlock(&pIdx->mutNameCache);
+}
+
+/* check the sender address against the tries. Like MaskCmp(), this
+ * matches IPv4 entries for v4-mapped IPv6 senders.
+ */
+static inline int
+aclIdxMatchAddr(aclIdx_t *pIdx, struct sockaddr *pFrom)
+{
+	switch(pFrom->sa_family) {
+	case AF_INET:
+		return aclTrieMatch(pIdx->root4, (uint8_t*) &SIN(pFrom)->sin_addr, 32);
+	case AF_INET6:
+		if(aclTrieMatch(pIdx->root6, SIN6(pFrom)->sin6_addr.s6_addr, 128))
+			return 1;
+		return IN6_IS_ADDR_V4MAPPED(&SIN6(pFrom)->sin6_addr)
+		       && aclTrieMatch(pIdx->root4, SIN6(pFrom)->sin6_addr.s6_addr + 12, 32);
+	default:
+		return 0;
+	}
+}
+
+
 /* This is a cancel-safe getnameinfo() version, because we learned
  * (via drd/valgrind) that getnameinfo() seems to have some issues
  * when being cancelled, at least if the module was dlloaded.
@@ -546,7 +784,7 @@ mygetnameinfo(const struct sockaddr *sa, socklen_t salen,
  * rgerhards, 2007-07-17
  */
 static rsRetVal AddAllowedSenderEntry(struct AllowedSenders **ppRoot, struct AllowedSenders **ppLast,
-		     		      struct NetAddr *iAllow, uint8_t iSignificantBits)
+		     		      aclIdx_t *pIdx, struct NetAddr *iAllow, uint8_t iSignificantBits)
 {
 	struct AllowedSenders *pEntry = NULL;
 
@@ -561,6 +799,10 @@ static rsRetVal AddAllowedSenderEntry(struct AllowedSenders **ppRoot, struct All
 	memcpy(&(pEntry->allowedSender), iAllow, sizeof (struct NetAddr));
 	pEntry->pNext = NULL;
 	pEntry->SignificantBits = iSignificantBits;
+	if(aclIdxAdd(pIdx, pEntry) != RS_RET_OK) {
+		free(pEntry);
+		return RS_RET_OUT_OF_MEMORY;
+	}
 	
 	/* enqueue */
 	if(*ppRoot == NULL) {
@@ -602,6 +844,7 @@ clearAllowedSenders(uchar *pszType)
 	 * all kinds of interesting things) -- rgerhards, 2009-01-12
 	 */
 	reinitAllowRoot(pszType);
+	aclIdxClear(getAclIdx(pszType));
 }
 
 
@@ -616,7 +859,7 @@ clearAllowedSenders(uchar *pszType)
  * added (all addresses from that host).
  */
 static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedSenders **ppLast,
-		     		 struct NetAddr *iAllow, uint8_t iSignificantBits)
+		     		 aclIdx_t *pIdx, struct NetAddr *iAllow, uint8_t iSignificantBits)
 {
 	DEFiRet;
 
@@ -665,7 +908,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 			ABORT_FINALIZE(RS_RET_ERR);
 		}
 		/* OK, entry constructed, now lets add it to the ACL list */
-		iRet = AddAllowedSenderEntry(ppRoot, ppLast, iAllow, iSignificantBits);
+		iRet = AddAllowedSenderEntry(ppRoot, ppLast, pIdx, iAllow, iSignificantBits);
 	} else {
 		/* we need to process a hostname ACL */
 		if(glbl.GetDisableDNS()) {
@@ -694,7 +937,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 				
 				if (ACLAddHostnameOnFail) {
 				        errmsg.LogError(0, NO_ERRCODE, "Adding hostname \"%s\" to ACL as a wildcard entry.", iAllow->addr.HostWildcard);
-				        iRet = AddAllowedSenderEntry(ppRoot, ppLast, iAllow, iSignificantBits);
+				        iRet = AddAllowedSenderEntry(ppRoot, ppLast, pIdx, iAllow, iSignificantBits);
 					FINALIZE;
 				} else {
 				        errmsg.LogError(0, NO_ERRCODE, "Hostname \"%s\" WON\'T be added to ACL.", iAllow->addr.HostWildcard);
@@ -712,7 +955,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 					}
 					memcpy(allowIP.addr.NetAddr, res->ai_addr, res->ai_addrlen);
 					
-					if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, &allowIP, iSignificantBits))
+					if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, pIdx, &allowIP, iSignificantBits))
 						!= RS_RET_OK)
 						FINALIZE;
 					break;
@@ -735,7 +978,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 							&(SIN6(res->ai_addr)->sin6_addr.s6_addr32[3]),
 							sizeof (in_addr_t));
 
-						if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, &allowIP,
+						if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, pIdx, &allowIP,
 								iSignificantBits))
 							!= RS_RET_OK)
 							FINALIZE;
@@ -749,7 +992,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 						}
 						memcpy(allowIP.addr.NetAddr, res->ai_addr, res->ai_addrlen);
 						
-						if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, &allowIP,
+						if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, pIdx, &allowIP,
 								iSignificantBits))
 							!= RS_RET_OK)
 							FINALIZE;
@@ -763,7 +1006,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 			 * For this, we already have everything ready and just need
 			 * to pass it along...
 			 */
-			iRet =  AddAllowedSenderEntry(ppRoot, ppLast, iAllow, iSignificantBits);
+			iRet =  AddAllowedSenderEntry(ppRoot, ppLast, pIdx, iAllow, iSignificantBits);
 		}
 	}
 
@@ -833,6 +1076,7 @@ rsRetVal addAllowedSenderLine(char* pName, uchar** ppRestOfConfLine)
 {
 	struct AllowedSenders **ppRoot;
 	struct AllowedSenders **ppLast;
+	aclIdx_t *pIdx;
 	rsParsObj *pPars;
 	rsRetVal iRet;
 	struct NetAddr *uIP = NULL;
@@ -845,13 +1089,16 @@ rsRetVal addAllowedSenderLine(char* pName, uchar** ppRestOfConfLine)
 	if(!strcasecmp(pName, "udp")) {
 		ppRoot = &pAllowedSenders_UDP;
 		ppLast = &pLastAllowedSenders_UDP;
+		pIdx = &aclIdx_UDP;
 	} else if(!strcasecmp(pName, "tcp")) {
 		ppRoot = &pAllowedSenders_TCP;
 		ppLast = &pLastAllowedSenders_TCP;
+		pIdx = &aclIdx_TCP;
 #ifdef USE_GSSAPI
 	} else if(!strcasecmp(pName, "gss")) {
 		ppRoot = &pAllowedSenders_GSS;
 		ppLast = &pLastAllowedSenders_GSS;
+		pIdx = &aclIdx_GSS;
 #endif
 	} else {
 		errmsg.LogError(0, RS_RET_ERR, "Invalid protocol '%s' in allowed sender "
@@ -879,7 +1126,7 @@ rsRetVal addAllowedSenderLine(char* pName, uchar** ppRestOfConfLine)
 			rsParsDestruct(pPars);
 			return(iRet);
 		}
-		if((iRet = AddAllowedSender(ppRoot, ppLast, uIP, iBits)) != RS_RET_OK) {
+		if((iRet = AddAllowedSender(ppRoot, ppLast, pIdx, uIP, iBits)) != RS_RET_OK) {
 		        if(iRet == RS_RET_NOENTRY) {
 			        errmsg.LogError(0, iRet, "Error %d adding allowed sender entry "
 					    "- ignoring.", iRet);
@@ -991,6 +1238,10 @@ static int isAllowedSender2(uchar *pszType, struct sockaddr *pFrom, const char *
 {
 	struct AllowedSenders *pAllow;
 	struct AllowedSenders *pAllowRoot = NULL;
+	aclIdx_t *pIdx;
+	void *pCached;
+	char *pszKey;
+	int bUseCache;
 	int bNeededDNS = 0;	/* partial check because we could not resolve DNS? */
 	int ret;
 
@@ -1001,20 +1252,55 @@ static int isAllowedSender2(uchar *pszType, struct sockaddr *pFrom, const char *
 
 	if(pAllowRoot == NULL)
 		return 1; /* checking disabled, everything is valid! */
+
+	pIdx = getAclIdx(pszType);
+	if(aclIdxMatchAddr(pIdx, pFrom))
+		return 1;
+	if(pIdx->nNames == 0 && pIdx->nScoped == 0)
+		return 0; /* the trie covers all entries */
+	if(pIdx->nNames > 0 && !bChkDNS && pIdx->nScoped == 0)
+		return 2;
+
+	/* if only hostname entries are left, the result just depends on the name */
+	bUseCache = bChkDNS && pszFromHost != NULL && pIdx->nScoped == 0;
+	if(bUseCache) {
+		pthread_mutex_lock(&pIdx->mutNameCache);
+		pCached = (pIdx->nameCache == NULL) ? NULL : hashmapSearch(pIdx->nameCache, pszFromHost);
+		pthread_mutex_unlock(&pIdx->mutNameCache);
+		if(pCached != NULL)
+			return (int) ((intptr_t) pCached - 1);
+	}
 	
-	/* now we loop through the list of allowed senders. As soon as
+	/* now we loop through the remaining allowed senders. As soon as
 	 * we find a match, we return back (indicating allowed). We loop
 	 * until we are out of allowed senders. If so, we fall through the
 	 * loop and the function's terminal return statement will indicate
 	 * that the sender is disallowed.
 	 */
 	for(pAllow = pAllowRoot ; pAllow != NULL ; pAllow = pAllow->pNext) {
+		if(aclEntryInTrie(pAllow))
+			continue;
 		ret = MaskCmp (&(pAllow->allowedSender), pAllow->SignificantBits, pFrom, pszFromHost, bChkDNS);
-		if(ret == 1)
-			return 1;
-		else if(ret == 2)
+		if(ret == 1) {
+			bNeededDNS = 1;
+			break;
+		} else if(ret == 2)
 			bNeededDNS = 2;
 	}
+
+	if(bUseCache) {
+		pthread_mutex_lock(&pIdx->mutNameCache);
+		if(pIdx->nameCache == NULL)
+			hashmapConstruct(&pIdx->nameCache, 64, 0, hashmapHashString,
+					 hashmapKeyEqualsString, free, NULL);
+		if(pIdx->nameCache != NULL && hashmapCount(pIdx->nameCache) < ACL_NAMECACHE_MAX
+		   && hashmapSearch(pIdx->nameCache, pszFromHost) == NULL
+		   && (pszKey = strdup(pszFromHost)) != NULL) {
+			if(hashmapInsert(pIdx->nameCache, pszKey, (void*) (intptr_t) (bNeededDNS + 1)) != RS_RET_OK)
+				free(pszKey);
+		}
+		pthread_mutex_unlock(&pIdx->mutNameCache);
+	}
 	return bNeededDNS;
 }
 
@@ -1190,8 +1476,12 @@ void closeUDPListenSockets(int *pSockArr)
  * bIsServer indicates if a server socket should be created
  * 1 - server, 0 - client
  * param rcvbuf indicates desired rcvbuf size; 0 means OS default
+ * param bReusePort requests SO_REUSEPORT, so that multiple sockets can be
+ * bound to the same address and the kernel distributes packets among them.
+ * If the platform does not support it, an error is logged and the sockets
+ * are not created.
  */
-int *create_udp_socket(uchar *hostname, uchar *pszPort, int bIsServer, int rcvbuf)
+int *create_udp_socket(uchar *hostname, uchar *pszPort, int bIsServer, int rcvbuf, int bReusePort)
 {
         struct addrinfo hints, *res, *r;
         int error, maxs, *s, *socks, on = 1;
@@ -1265,6 +1555,20 @@ int *create_udp_socket(uchar *hostname, uchar *pszPort, int bIsServer, int rcvbu
 			*s = -1;
 			continue;
 		}
+		if(bReusePort) {
+#			ifdef SO_REUSEPORT
+			if(setsockopt(*s, SOL_SOCKET, SO_REUSEPORT, (char *) &on, sizeof(on)) < 0) {
+				errmsg.LogError(errno, NO_ERRCODE, "setsockopt(REUSEPORT)");
+#			else
+			{
+				errmsg.LogError(0, RS_RET_NOT_IMPLEMENTED, "SO_REUSEPORT is not "
+					"supported on this platform");
+#			endif
+				close(*s);
+				*s = -1;
+				continue;
+			}
+		}
 
 		/* We need to enable BSD compatibility. Otherwise an attacker
 		 * could flood our log files by sending us tons of ICMP errors.
@@ -235,6 +235,42 @@ Send(netstrm_t *pThis, uchar *pBuf, ssize_t *pLenBuf)
 	RETiRet;
 }
 
+/* send an I/O vector. Works like Send(), but gathers the data from
+ * iovcnt buffers. On exit, pLenSent contains the number of octets
+ * actually written, which may be less than the total.
+ */
+static rsRetVal
+SendV(netstrm_t *pThis, struct iovec *iov, int iovcnt, ssize_t *pLenSent)
+{
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, netstrm);
+	iRet = pThis->Drvr.SendV(pThis->pDrvrData, iov, iovcnt, pLenSent);
+	RETiRet;
+}
+
+/* set the address the next Connect() shall use instead of resolving the
+ * host name itself. The host name is still needed, e.g. for TLS name
+ * checks.
+ */
+static rsRetVal
+SetConnectAddr(netstrm_t *pThis, struct sockaddr *pAddr, socklen_t lenAddr)
+{
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, netstrm);
+	iRet = pThis->Drvr.SetConnectAddr(pThis->pDrvrData, pAddr, lenAddr);
+	RETiRet;
+}
+
+/* set TCP options (NSD_TCPOPT_*) for the next Connect() */
+static rsRetVal
+SetTcpOpts(netstrm_t *pThis, int opts)
+{
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, netstrm);
+	iRet = pThis->Drvr.SetTcpOpts(pThis->pDrvrData, opts);
+	RETiRet;
+}
+
 /* Enable Keep-Alive handling for those drivers that support it.
  * rgerhards, 2009-06-02
  */
@@ -341,6 +377,9 @@ CODESTARTobjQueryInterface(netstrm)
 	pIf->AbortDestruct = AbortDestruct;
 	pIf->Rcv = Rcv;
 	pIf->Send = Send;
+	pIf->SendV = SendV;
+	pIf->SetConnectAddr = SetConnectAddr;
+	pIf->SetTcpOpts = SetTcpOpts;
 	pIf->Connect = Connect;
 	pIf->LstnInit = LstnInit;
 	pIf->AcceptConnReq = AcceptConnReq;
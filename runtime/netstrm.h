@@ -71,12 +71,21 @@ BEGINinterface(netstrm) /* name must also be changed in ENDinterface macro! */
 	 */
 	/* v4 */
 	rsRetVal (*EnableKeepAlive)(netstrm_t *pThis);
+	/* v7 */
+	rsRetVal (*SendV)(netstrm_t *pThis, struct iovec *iov, int iovcnt, ssize_t *pLenSent);
+	/* v8 */
+	rsRetVal (*SetConnectAddr)(netstrm_t *pThis, struct sockaddr *pAddr, socklen_t lenAddr);
+	/* v9 */
+	rsRetVal (*SetTcpOpts)(netstrm_t *pThis, int opts);
 ENDinterface(netstrm)
-#define netstrmCURR_IF_VERSION 6 /* increment whenever you change the interface structure! */
+#define netstrmCURR_IF_VERSION 9 /* increment whenever you change the interface structure! */
 /* interface version 3 added GetRemAddr()
  * interface version 4 added EnableKeepAlive() -- rgerhards, 2009-06-02
  * interface version 5 changed return of CheckConnection from void to rsRetVal -- alorbach, 2012-09-06
  * interface version 6 changed signature of GetRemoteIP() -- rgerhards, 2013-01-21
+ * interface version 7 added SendV()
+ * interface version 8 added SetConnectAddr()
+ * interface version 9 added SetTcpOpts()
  * */
 
 /* prototypes */
@@ -173,6 +173,26 @@ GetDrvrPermPeers(netstrms_t *pThis)
 }
 
 
+/* set the TCP Fast Open queue length for listeners (0 = off) */
+static rsRetVal
+SetDrvrFastOpen(netstrms_t *pThis, int iQLen)
+{
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, netstrms);
+	pThis->iFastOpen = iQLen;
+	RETiRet;
+}
+/* return the TCP Fast Open queue length, same calling conventions
+ * as GetDrvrPermPeers().
+ */
+static int
+GetDrvrFastOpen(netstrms_t *pThis)
+{
+	ISOBJ_TYPE_assert(pThis, netstrms);
+	return pThis->iFastOpen;
+}
+
+
 /* set the driver auth mode -- rgerhards, 2008-05-19 */
 static rsRetVal
 SetDrvrAuthMode(netstrms_t *pThis, uchar *mode)
@@ -274,6 +294,8 @@ CODESTARTobjQueryInterface(netstrms)
 	pIf->GetDrvrAuthMode = GetDrvrAuthMode;
 	pIf->SetDrvrPermPeers = SetDrvrPermPeers;
 	pIf->GetDrvrPermPeers = GetDrvrPermPeers;
+	pIf->SetDrvrFastOpen = SetDrvrFastOpen;
+	pIf->GetDrvrFastOpen = GetDrvrFastOpen;
 finalize_it:
 ENDobjQueryInterface(netstrms)
 
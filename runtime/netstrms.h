@@ -34,6 +34,7 @@ struct netstrms_s {
 	int iDrvrMode;		/**< current default driver mode */
 	uchar *pszDrvrAuthMode;	/**< current driver authentication mode */
 	permittedPeers_t *pPermPeers;/**< current driver's permitted peers */
+	int iFastOpen;		/**< TCP Fast Open queue length for listeners, 0 = off */
 
 	nsd_if_t Drvr;		/**< our stream driver */
 };
@@ -52,8 +53,12 @@ BEGINinterface(netstrms) /* name must also be changed in ENDinterface macro! */
 	int      (*GetDrvrMode)(netstrms_t *pThis);
 	uchar*   (*GetDrvrAuthMode)(netstrms_t *pThis);
 	permittedPeers_t* (*GetDrvrPermPeers)(netstrms_t *pThis);
+	/* v2 */
+	rsRetVal (*SetDrvrFastOpen)(netstrms_t *pThis, int iQLen);
+	int      (*GetDrvrFastOpen)(netstrms_t *pThis);
 ENDinterface(netstrms)
-#define netstrmsCURR_IF_VERSION 1 /* increment whenever you change the interface structure! */
+#define netstrmsCURR_IF_VERSION 2 /* increment whenever you change the interface structure! */
+/* interface version 2 added SetDrvrFastOpen() and GetDrvrFastOpen() */
 
 /* prototypes */
 PROTOTYPEObj(netstrms);
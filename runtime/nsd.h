@@ -26,6 +26,7 @@
 #define INCLUDED_NSD_H
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 /**
  * The following structure is a set of descriptors that need to be processed.
@@ -79,14 +80,27 @@ BEGINinterface(nsd) /* name must also be changed in ENDinterface macro! */
 	 */
 	/* v5 */
 	rsRetVal (*EnableKeepAlive)(nsd_t *pThis);
+	/* v8 */
+	rsRetVal (*SendV)(nsd_t *pThis, struct iovec *iov, int iovcnt, ssize_t *pLenSent);
+	/* v9 */
+	rsRetVal (*SetConnectAddr)(nsd_t *pThis, struct sockaddr *pAddr, socklen_t lenAddr);
+	/* v10 */
+	rsRetVal (*SetTcpOpts)(nsd_t *pThis, int opts); /* NSD_TCPOPT_* flags, for the next Connect() */
 ENDinterface(nsd)
-#define nsdCURR_IF_VERSION 7 /* increment whenever you change the interface structure! */
+#define nsdCURR_IF_VERSION 10 /* increment whenever you change the interface structure! */
 /* interface version 4 added GetRemAddr()
  * interface version 5 added EnableKeepAlive() -- rgerhards, 2009-06-02
  * interface version 6 changed return of CheckConnection from void to rsRetVal -- alorbach, 2012-09-06
  * interface version 7 changed signature ofGetRempoteIP() -- rgerhards, 2013-01-21
+ * interface version 8 added SendV()
+ * interface version 9 added SetConnectAddr(): Connect() uses a pre-resolved address
+ * interface version 10 added SetTcpOpts()
  */
 
+/* options for SetTcpOpts(). Drivers ignore what they (or the OS) do not support. */
+#define NSD_TCPOPT_FASTOPEN	0x01	/* client side TCP Fast Open */
+#define NSD_TCPOPT_ZEROCOPY	0x02	/* MSG_ZEROCOPY for large SendV() calls */
+
 /* interface  for the select call */
 BEGINinterface(nsdsel) /* name must also be changed in ENDinterface macro! */
 	rsRetVal (*Construct)(nsdsel_t **ppThis);
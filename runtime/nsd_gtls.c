@@ -37,6 +37,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
 
 #include "rsyslog.h"
 #include "syslogd-types.h"
@@ -47,10 +49,30 @@
 #include "errmsg.h"
 #include "net.h"
 #include "datetime.h"
+#include "statsobj.h"
 #include "nsd_ptcp.h"
 #include "nsdsel_gtls.h"
 #include "nsd_gtls.h"
 #include "unicode-helper.h"
+#include "glbl.h"
+
+/* kernel TLS offload needs the kernel's crypto_info structures and a GnuTLS
+ * that lets us extract the record keys (gnutls_record_get_state).
+ */
+#if defined(HAVE_LINUX_TLS_H) && GNUTLS_VERSION_NUMBER >= 0x030400
+#	define GTLS_HAVE_KTLS 1
+#	include <netinet/tcp.h>
+#	include <linux/tls.h>
+#	ifndef SOL_TLS
+#		define SOL_TLS 282
+#	endif
+#	ifndef TCP_ULP
+#		define TCP_ULP 31
+#	endif
+#	if GNUTLS_VERSION_NUMBER >= 0x030703
+#		include <gnutls/socket.h>
+#	endif
+#endif
 
 /* things to move to some better place/functionality - TODO */
 #define CRLFILE "crl.pem"
@@ -62,6 +84,11 @@ GCRY_THREAD_OPTION_PTHREAD_IMPL;
 MODULE_TYPE_LIB
 MODULE_TYPE_KEEP
 
+/* forward definitions */
+#ifdef GTLS_HAVE_KTLS
+static ssize_t gtlsKTLSRecv(nsd_gtls_t *pThis);
+#endif
+
 /* static data */
 DEFobjStaticHelpers
 DEFobjCurrIf(errmsg)
@@ -69,6 +96,7 @@ DEFobjCurrIf(glbl)
 DEFobjCurrIf(net)
 DEFobjCurrIf(datetime)
 DEFobjCurrIf(nsd_ptcp)
+DEFobjCurrIf(statsobj)
 
 static int bGlblSrvrInitDone = 0;	/**< 0 - server global init not yet done, 1 - already done */
 
@@ -87,6 +115,43 @@ static pthread_mutex_t mutGtlsStrerror; /**< a mutex protecting the potentially
 /* ------------------------------ GnuTLS specifics ------------------------------ */
 static gnutls_certificate_credentials xcred;
 
+#if GNUTLS_VERSION_NUMBER >= 0x020a00
+#	define GTLS_HAVE_TICKETS 1
+static gnutls_datum_t ticketKey = { NULL, 0 };	/**< server session ticket key, per process */
+#endif
+
+/* TLS session resumption. As a server, we hand out session tickets and
+ * keep a small session cache for those clients that do not support tickets.
+ * As a client, we remember the last session per target host and port, so
+ * that a reconnect (as omfwd does after connection loss) can resume the
+ * session instead of doing a full handshake. Both caches are simple
+ * direct-mapped tables; on collision, the older entry is simply replaced.
+ * rgerhards, 2014-06-12
+ */
+#define GTLS_SESSCACHE_SIZE 256		/* number of cache slots */
+#define GTLS_SESSCACHE_EXPIRE 3600	/* max age of a cached session, in seconds */
+typedef struct gtlsCache_s {
+	pthread_mutex_t mut;
+	struct {
+		gnutls_datum_t key;
+		gnutls_datum_t data;
+		time_t tStored;
+	} slot[GTLS_SESSCACHE_SIZE];
+} gtlsCache_t;
+static gtlsCache_t srvCache;	/**< server side session cache (keyed by session id) */
+static gtlsCache_t cltCache;	/**< client side session cache (keyed by "host:port") */
+
+/* handshake statistics */
+static struct {
+	statsobj_t *stats;
+	STATSCOUNTER_DEF(ctrSrvFull, mutCtrSrvFull)
+	STATSCOUNTER_DEF(ctrSrvResumed, mutCtrSrvResumed)
+	STATSCOUNTER_DEF(ctrCltFull, mutCtrCltFull)
+	STATSCOUNTER_DEF(ctrCltResumed, mutCtrCltResumed)
+	STATSCOUNTER_DEF(ctrKtlsTx, mutCtrKtlsTx)
+	STATSCOUNTER_DEF(ctrKtlsRx, mutCtrKtlsRx)
+} hsStats;
+
 #ifdef DEBUG
 #if 0 /* uncomment, if needed some time again -- DEV Debug only */
 /* This defines a log function to be provided to GnuTLS. It hopefully
@@ -510,7 +575,12 @@ gtlsRecordRecv(nsd_gtls_t *pThis)
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, nsd_gtls);
-	lenRcvd = gnutls_record_recv(pThis->sess, pThis->pszRcvBuf, NSD_GTLS_MAX_RCVBUF);
+#	ifdef GTLS_HAVE_KTLS
+	if(pThis->ktlsMode & GTLS_KTLS_RX)
+		lenRcvd = gtlsKTLSRecv(pThis);
+	else
+#	endif
+		lenRcvd = gnutls_record_recv(pThis->sess, pThis->pszRcvBuf, NSD_GTLS_MAX_RCVBUF);
 	if(lenRcvd >= 0) {
 		pThis->lenRcvBuf = lenRcvd;
 		pThis->ptrRcvBuf = 0;
@@ -572,6 +642,440 @@ finalize_it:
 }
 
 
+/* ---------- session cache ---------- */
+
+static inline unsigned
+gtlsCacheHash(gnutls_datum_t *pKey)
+{
+	unsigned h = 2166136261u; /* FNV-1a */
+	unsigned i;
+
+	for(i = 0 ; i < pKey->size ; ++i) {
+		h ^= pKey->data[i];
+		h *= 16777619u;
+	}
+	return h % GTLS_SESSCACHE_SIZE;
+}
+
+static inline int
+gtlsCacheKeyEq(gnutls_datum_t *pKey1, gnutls_datum_t *pKey2)
+{
+	return pKey1->size == pKey2->size && !memcmp(pKey1->data, pKey2->data, pKey1->size);
+}
+
+/* must be called with the cache mutex locked */
+static inline void
+gtlsCacheFreeSlot(gtlsCache_t *pCache, unsigned i)
+{
+	free(pCache->slot[i].key.data);
+	free(pCache->slot[i].data.data);
+	pCache->slot[i].key.data = NULL;
+	pCache->slot[i].key.size = 0;
+	pCache->slot[i].data.data = NULL;
+	pCache->slot[i].data.size = 0;
+}
+
+/* store a copy of the session data; an existing entry in the same slot is replaced.
+ * returns 0 on success, -1 if out of memory.
+ */
+static int
+gtlsCacheStore(gtlsCache_t *pCache, gnutls_datum_t *pKey, gnutls_datum_t *pData)
+{
+	unsigned char *pKeyBuf;
+	unsigned char *pDataBuf;
+	unsigned i;
+
+	if(pKey->size == 0 || pData->size == 0)
+		return -1;
+	if((pKeyBuf = malloc(pKey->size)) == NULL)
+		return -1;
+	if((pDataBuf = malloc(pData->size)) == NULL) {
+		free(pKeyBuf);
+		return -1;
+	}
+	memcpy(pKeyBuf, pKey->data, pKey->size);
+	memcpy(pDataBuf, pData->data, pData->size);
+
+	i = gtlsCacheHash(pKey);
+	pthread_mutex_lock(&pCache->mut);
+	gtlsCacheFreeSlot(pCache, i);
+	pCache->slot[i].key.data = pKeyBuf;
+	pCache->slot[i].key.size = pKey->size;
+	pCache->slot[i].data.data = pDataBuf;
+	pCache->slot[i].data.size = pData->size;
+	pCache->slot[i].tStored = time(NULL);
+	pthread_mutex_unlock(&pCache->mut);
+	return 0;
+}
+
+/* fetch a copy of the session data. The copy is allocated via gnutls_malloc(),
+ * as this is what GnuTLS expects from a db retrieve function. The caller must
+ * free it via gnutls_free(). Returns 0 if found, -1 otherwise.
+ */
+static int
+gtlsCacheFetch(gtlsCache_t *pCache, gnutls_datum_t *pKey, gnutls_datum_t *pData)
+{
+	unsigned i;
+	int r = -1;
+
+	pData->data = NULL;
+	pData->size = 0;
+	i = gtlsCacheHash(pKey);
+	pthread_mutex_lock(&pCache->mut);
+	if(pCache->slot[i].key.data != NULL && gtlsCacheKeyEq(&pCache->slot[i].key, pKey)) {
+		if(time(NULL) - pCache->slot[i].tStored > GTLS_SESSCACHE_EXPIRE) {
+			gtlsCacheFreeSlot(pCache, i);
+		} else if((pData->data = gnutls_malloc(pCache->slot[i].data.size)) != NULL) {
+			memcpy(pData->data, pCache->slot[i].data.data, pCache->slot[i].data.size);
+			pData->size = pCache->slot[i].data.size;
+			r = 0;
+		}
+	}
+	pthread_mutex_unlock(&pCache->mut);
+	return r;
+}
+
+static int
+gtlsCacheRemove(gtlsCache_t *pCache, gnutls_datum_t *pKey)
+{
+	unsigned i;
+	int r = -1;
+
+	i = gtlsCacheHash(pKey);
+	pthread_mutex_lock(&pCache->mut);
+	if(pCache->slot[i].key.data != NULL && gtlsCacheKeyEq(&pCache->slot[i].key, pKey)) {
+		gtlsCacheFreeSlot(pCache, i);
+		r = 0;
+	}
+	pthread_mutex_unlock(&pCache->mut);
+	return r;
+}
+
+static void
+gtlsCacheInit(gtlsCache_t *pCache)
+{
+	memset(pCache->slot, 0, sizeof(pCache->slot));
+	pthread_mutex_init(&pCache->mut, NULL);
+}
+
+static void
+gtlsCacheExit(gtlsCache_t *pCache)
+{
+	unsigned i;
+
+	for(i = 0 ; i < GTLS_SESSCACHE_SIZE ; ++i)
+		gtlsCacheFreeSlot(pCache, i);
+	pthread_mutex_destroy(&pCache->mut);
+}
+
+/* the GnuTLS db callbacks for the server side cache */
+static int
+gtlsDbStore(void *ptr, gnutls_datum_t key, gnutls_datum_t data)
+{
+	return gtlsCacheStore((gtlsCache_t*) ptr, &key, &data);
+}
+
+static gnutls_datum_t
+gtlsDbRetrieve(void *ptr, gnutls_datum_t key)
+{
+	gnutls_datum_t data;
+	gtlsCacheFetch((gtlsCache_t*) ptr, &key, &data);
+	return data;
+}
+
+static int
+gtlsDbRemove(void *ptr, gnutls_datum_t key)
+{
+	return gtlsCacheRemove((gtlsCache_t*) ptr, &key);
+}
+
+/* build the client cache key for a connection target. Returns -1 if the
+ * key does not fit into the buffer, in which case resumption is not tried.
+ */
+static int
+gtlsCltCacheKey(char *pszBuf, size_t lenBuf, uchar *host, uchar *port, gnutls_datum_t *pKey)
+{
+	int len;
+
+	len = snprintf(pszBuf, lenBuf, "%s:%s", (char*)host, (char*)port);
+	if(len < 0 || (size_t) len >= lenBuf)
+		return -1;
+	pKey->data = (unsigned char*) pszBuf;
+	pKey->size = len;
+	return 0;
+}
+
+
+/* count a completed handshake in our statistics. Must only be called
+ * after the handshake has successfully completed.
+ */
+void
+gtlsCountHandshake(nsd_gtls_t *pThis)
+{
+	const int bResumed = gnutls_session_is_resumed(pThis->sess);
+
+	dbgprintf("GnuTLS %s handshake completed (%s)\n", pThis->bIsInitiator ? "client" : "server",
+		  bResumed ? "resumed" : "full");
+	if(pThis->bIsInitiator) {
+		if(bResumed) {
+			STATSCOUNTER_INC(hsStats.ctrCltResumed, hsStats.mutCtrCltResumed);
+		} else {
+			STATSCOUNTER_INC(hsStats.ctrCltFull, hsStats.mutCtrCltFull);
+		}
+	} else {
+		if(bResumed) {
+			STATSCOUNTER_INC(hsStats.ctrSrvResumed, hsStats.mutCtrSrvResumed);
+		} else {
+			STATSCOUNTER_INC(hsStats.ctrSrvFull, hsStats.mutCtrSrvFull);
+		}
+	}
+}
+
+
+/* ---------- kernel TLS offload ---------- */
+
+#ifdef GTLS_HAVE_KTLS
+/* fill a kernel crypto_info structure for an AES-GCM cipher. For TLS 1.2,
+ * GnuTLS hands us only the implicit part of the nonce (the salt) and the
+ * kernel generates the explicit part from the sequence number. For TLS 1.3,
+ * the full static IV is salt + iv.
+ */
+#define GTLS_KTLS_FILL_GCM(ci, CIPHER) \
+	if(key.size != TLS_CIPHER_##CIPHER##_KEY_SIZE || iv.size < TLS_CIPHER_##CIPHER##_SALT_SIZE) \
+		return -1; \
+	ci.info.version = tlsVers; \
+	ci.info.cipher_type = TLS_CIPHER_##CIPHER; \
+	if(tlsVers == TLS_1_2_VERSION) { \
+		memcpy(ci.iv, seq, TLS_CIPHER_##CIPHER##_IV_SIZE); \
+	} else { \
+		if(iv.size != TLS_CIPHER_##CIPHER##_SALT_SIZE + TLS_CIPHER_##CIPHER##_IV_SIZE) \
+			return -1; \
+		memcpy(ci.iv, iv.data + TLS_CIPHER_##CIPHER##_SALT_SIZE, TLS_CIPHER_##CIPHER##_IV_SIZE); \
+	} \
+	memcpy(ci.salt, iv.data, TLS_CIPHER_##CIPHER##_SALT_SIZE); \
+	memcpy(ci.rec_seq, seq, TLS_CIPHER_##CIPHER##_REC_SEQ_SIZE); \
+	memcpy(ci.key, key.data, TLS_CIPHER_##CIPHER##_KEY_SIZE); \
+	lenCi = sizeof(ci);
+
+/* hand the current keys for one direction to the kernel.
+ * returns 0 on success, -1 if not possible (unsupported cipher, kernel error)
+ */
+static int
+gtlsKTLSSetKey(nsd_gtls_t *pThis, int sock, int bRead)
+{
+	gnutls_datum_t iv;
+	gnutls_datum_t key;
+	unsigned char seq[8];
+	unsigned short tlsVers;
+	union {
+		struct tls12_crypto_info_aes_gcm_128 aes128;
+		struct tls12_crypto_info_aes_gcm_256 aes256;
+	} ci;
+	socklen_t lenCi;
+	int r;
+
+	switch(gnutls_protocol_get_version(pThis->sess)) {
+		case GNUTLS_TLS1_2:
+			tlsVers = TLS_1_2_VERSION;
+			break;
+#		if GNUTLS_VERSION_NUMBER >= 0x030603
+		case GNUTLS_TLS1_3:
+			tlsVers = TLS_1_3_VERSION;
+			break;
+#		endif
+		default:
+			return -1;
+	}
+
+	if(gnutls_record_get_state(pThis->sess, bRead, NULL, &iv, &key, seq) != 0)
+		return -1;
+
+	memset(&ci, 0, sizeof(ci));
+	switch(gnutls_cipher_get(pThis->sess)) {
+		case GNUTLS_CIPHER_AES_128_GCM:
+			GTLS_KTLS_FILL_GCM(ci.aes128, AES_GCM_128)
+			break;
+		case GNUTLS_CIPHER_AES_256_GCM:
+			GTLS_KTLS_FILL_GCM(ci.aes256, AES_GCM_256)
+			break;
+		default:
+			return -1;
+	}
+
+	r = setsockopt(sock, SOL_TLS, bRead ? TLS_RX : TLS_TX, &ci, lenCi);
+	if(r != 0)
+		dbgprintf("GnuTLS kTLS: kernel refused %s key, errno %d\n", bRead ? "rx" : "tx", errno);
+	memset(&ci, 0, sizeof(ci)); /* do not leave key material on the stack */
+	return r == 0 ? 0 : -1;
+}
+#undef GTLS_KTLS_FILL_GCM
+
+
+/* receive from a kTLS socket. The kernel has already decrypted the data, but
+ * tells us the record type via a control message. Non-data records are
+ * alerts (which we treat as end of session) and post-handshake messages like
+ * TLS 1.3 session tickets (which we skip). Note that a TLS 1.3 KeyUpdate
+ * cannot be handled; the connection will then fail and be re-established.
+ * The return value follows gnutls_record_recv() semantics.
+ */
+static ssize_t
+gtlsKTLSRecv(nsd_gtls_t *pThis)
+{
+	int sock;
+	ssize_t lenRcvd;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	unsigned char recType;
+	char cbuf[CMSG_SPACE(sizeof(unsigned char))];
+
+	if(nsd_ptcp.GetSock(pThis->pTcp, &sock) != RS_RET_OK)
+		return GNUTLS_E_PULL_ERROR;
+
+	while(1) { /* loop broken inside */
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = pThis->pszRcvBuf;
+		iov.iov_len = NSD_GTLS_MAX_RCVBUF;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cbuf;
+		msg.msg_controllen = sizeof(cbuf);
+		lenRcvd = recvmsg(sock, &msg, 0);
+		if(lenRcvd < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				return GNUTLS_E_AGAIN;
+			if(errno == EINTR)
+				return GNUTLS_E_INTERRUPTED;
+			dbgprintf("GnuTLS kTLS recvmsg error %d\n", errno);
+			return GNUTLS_E_PULL_ERROR;
+		}
+		if(lenRcvd == 0)
+			return 0;
+
+		recType = 23; /* application data if no cmsg is present */
+		cmsg = CMSG_FIRSTHDR(&msg);
+		if(cmsg != NULL && cmsg->cmsg_level == SOL_TLS && cmsg->cmsg_type == TLS_GET_RECORD_TYPE)
+			recType = *((unsigned char*) CMSG_DATA(cmsg));
+
+		if(recType == 23)
+			return lenRcvd;
+		if(recType == 21) {
+			dbgprintf("GnuTLS kTLS: received alert, closing session\n");
+			return 0;
+		}
+		dbgprintf("GnuTLS kTLS: skipping non-data record of type %d\n", recType);
+	}
+}
+
+
+/* send a close_notify alert on a kTLS socket. GnuTLS cannot do this any
+ * longer, as its record state is stale once the kernel encrypts.
+ */
+static void
+gtlsKTLSSendCloseNotify(nsd_gtls_t *pThis)
+{
+	int sock;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	unsigned char alert[2] = { 1, 0 }; /* warning, close_notify */
+	char cbuf[CMSG_SPACE(sizeof(unsigned char))];
+
+	if(nsd_ptcp.GetSock(pThis->pTcp, &sock) != RS_RET_OK)
+		return;
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = alert;
+	iov.iov_len = sizeof(alert);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+	*((unsigned char*) CMSG_DATA(cmsg)) = 21; /* alert */
+	if(sendmsg(sock, &msg, MSG_DONTWAIT) < 0)
+		dbgprintf("GnuTLS kTLS: could not send close_notify, errno %d\n", errno);
+}
+#endif /* #ifdef GTLS_HAVE_KTLS */
+
+
+/* try to move record encryption/decryption into the kernel once the
+ * handshake is done. If enabled but not possible (old kernel, unsupported
+ * cipher, data already buffered inside GnuTLS), the session simply stays
+ * on the userspace path. Must be called after a successful handshake.
+ */
+void
+gtlsTryKTLS(nsd_gtls_t *pThis)
+{
+#ifdef GTLS_HAVE_KTLS
+	int sock;
+
+	if(!glblNetstrmDrvrKTLS)
+		return;
+#	if GNUTLS_VERSION_NUMBER >= 0x030703
+	if(gnutls_transport_is_ktls_enabled(pThis->sess) != 0) {
+		dbgprintf("GnuTLS already offloads this session to kTLS\n");
+		return;
+	}
+#	endif
+	if(nsd_ptcp.GetSock(pThis->pTcp, &sock) != RS_RET_OK)
+		return;
+	if(setsockopt(sock, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) {
+		dbgprintf("GnuTLS kTLS: TLS ULP not available (errno %d), using userspace TLS\n", errno);
+		return;
+	}
+	if(gtlsKTLSSetKey(pThis, sock, 0) == 0) {
+		pThis->ktlsMode |= GTLS_KTLS_TX;
+		STATSCOUNTER_INC(hsStats.ctrKtlsTx, hsStats.mutCtrKtlsTx);
+	}
+	/* records GnuTLS has already read from the socket can not be handed over */
+	if(gnutls_record_check_pending(pThis->sess) == 0 && gtlsKTLSSetKey(pThis, sock, 1) == 0) {
+		pThis->ktlsMode |= GTLS_KTLS_RX;
+		STATSCOUNTER_INC(hsStats.ctrKtlsRx, hsStats.mutCtrKtlsRx);
+	}
+	dbgprintf("GnuTLS kTLS: session %p offload mode %d\n", pThis, pThis->ktlsMode);
+#else
+	if(glblNetstrmDrvrKTLS)
+		dbgprintf("GnuTLS kTLS requested, but not supported by this build\n");
+#endif
+}
+
+
+/* set up the handshake statistics object */
+static rsRetVal
+gtlsStatsInit(void)
+{
+	DEFiRet;
+
+	CHKiRet(statsobj.Construct(&hsStats.stats));
+	CHKiRet(statsobj.SetName(hsStats.stats, UCHAR_CONSTANT("nsd_gtls")));
+	STATSCOUNTER_INIT(hsStats.ctrSrvFull, hsStats.mutCtrSrvFull);
+	CHKiRet(statsobj.AddCounter(hsStats.stats, UCHAR_CONSTANT("server.handshakes.full"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &hsStats.ctrSrvFull));
+	STATSCOUNTER_INIT(hsStats.ctrSrvResumed, hsStats.mutCtrSrvResumed);
+	CHKiRet(statsobj.AddCounter(hsStats.stats, UCHAR_CONSTANT("server.handshakes.resumed"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &hsStats.ctrSrvResumed));
+	STATSCOUNTER_INIT(hsStats.ctrCltFull, hsStats.mutCtrCltFull);
+	CHKiRet(statsobj.AddCounter(hsStats.stats, UCHAR_CONSTANT("client.handshakes.full"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &hsStats.ctrCltFull));
+	STATSCOUNTER_INIT(hsStats.ctrCltResumed, hsStats.mutCtrCltResumed);
+	CHKiRet(statsobj.AddCounter(hsStats.stats, UCHAR_CONSTANT("client.handshakes.resumed"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &hsStats.ctrCltResumed));
+	STATSCOUNTER_INIT(hsStats.ctrKtlsTx, hsStats.mutCtrKtlsTx);
+	CHKiRet(statsobj.AddCounter(hsStats.stats, UCHAR_CONSTANT("ktls.tx"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &hsStats.ctrKtlsTx));
+	STATSCOUNTER_INIT(hsStats.ctrKtlsRx, hsStats.mutCtrKtlsRx);
+	CHKiRet(statsobj.AddCounter(hsStats.stats, UCHAR_CONSTANT("ktls.rx"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &hsStats.ctrKtlsRx));
+	CHKiRet(statsobj.ConstructFinalize(hsStats.stats));
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* globally initialize GnuTLS */
 static rsRetVal
 gtlsGlblInit(void)
@@ -585,6 +1089,8 @@ gtlsGlblInit(void)
 	gcry_control (GCRYCTL_SET_THREAD_CBS, &gcry_threads_pthread);
 	#endif
 	CHKgnutls(gnutls_global_init());
+	gtlsCacheInit(&srvCache);
+	gtlsCacheInit(&cltCache);
 	
 	/* X509 stuff */
 	CHKgnutls(gnutls_certificate_allocate_credentials(&xcred));
@@ -636,6 +1142,17 @@ gtlsInitSession(nsd_gtls_t *pThis)
 	/* request client certificate if any.  */
 	gnutls_certificate_server_set_request( session, GNUTLS_CERT_REQUEST);
 
+	/* permit session resumption, via tickets (if we have a key) and our session cache */
+#	ifdef GTLS_HAVE_TICKETS
+	if(ticketKey.data != NULL)
+		CHKgnutls(gnutls_session_ticket_enable_server(session, &ticketKey));
+#	endif
+	gnutls_db_set_retrieve_function(session, gtlsDbRetrieve);
+	gnutls_db_set_store_function(session, gtlsDbStore);
+	gnutls_db_set_remove_function(session, gtlsDbRemove);
+	gnutls_db_set_ptr(session, &srvCache);
+	gnutls_db_set_cache_expiration(session, GTLS_SESSCACHE_EXPIRE);
+
 	pThis->sess = session;
 
 finalize_it:
@@ -658,6 +1175,16 @@ gtlsGlblInitLstn(void)
 		/*CHKgnutls(gnutls_certificate_set_x509_crl_file(xcred, CRLFILE, GNUTLS_X509_FMT_PEM));*/
 		bGlblSrvrInitDone = 1; /* we are all set now */
 
+#		ifdef GTLS_HAVE_TICKETS
+		/* session tickets are a nice-to-have; if we cannot get a key, clients
+		 * can still resume via the session cache.
+		 */
+		if(gnutls_session_ticket_key_generate(&ticketKey) != 0) {
+			dbgprintf("GnuTLS could not generate session ticket key, tickets disabled\n");
+			ticketKey.data = NULL;
+		}
+#		endif
+
 		/* now we need to add our certificate */
 		CHKiRet(gtlsAddOurCert());
 	}
@@ -1101,6 +1628,15 @@ static rsRetVal
 gtlsGlblExit(void)
 {
 	DEFiRet;
+#	ifdef GTLS_HAVE_TICKETS
+	if(ticketKey.data != NULL) {
+		memset(ticketKey.data, 0, ticketKey.size);
+		gnutls_free(ticketKey.data);
+		ticketKey.data = NULL;
+	}
+#	endif
+	gtlsCacheExit(&srvCache);
+	gtlsCacheExit(&cltCache);
 	/* X509 stuff */
 	gnutls_certificate_free_credentials(xcred);
 	gnutls_global_deinit(); /* we are done... */
@@ -1119,6 +1655,12 @@ gtlsEndSess(nsd_gtls_t *pThis)
 	DEFiRet;
 
 	if(pThis->bHaveSess) {
+#		ifdef GTLS_HAVE_KTLS
+		if(pThis->ktlsMode & GTLS_KTLS_TX) {
+			if(pThis->bIsInitiator)
+				gtlsKTLSSendCloseNotify(pThis);
+		} else
+#		endif
 		if(pThis->bIsInitiator) {
 			gnuRet = gnutls_bye(pThis->sess, GNUTLS_SHUT_RDWR);
 			while(gnuRet == GNUTLS_E_INTERRUPTED || gnuRet == GNUTLS_E_AGAIN) {
@@ -1291,6 +1833,22 @@ SetSock(nsd_t *pNsd, int sock)
 }
 
 
+/* Provide access to the underlying OS socket. This is needed by
+ * callers that drive the socket via their own event loop (imptcp).
+ * Note that in TLS mode, "readable" on the socket does not mean
+ * that Rcv() will return data, and vice versa data may still be
+ * buffered while the socket is not readable. So Rcv() must be
+ * called until it returns RS_RET_RETRY.
+ */
+static rsRetVal
+GetSock(nsd_t *pNsd, int *pSock)
+{
+	nsd_gtls_t *pThis = (nsd_gtls_t*) pNsd;
+	ISOBJ_TYPE_assert((pThis), nsd_gtls);
+	return nsd_ptcp.GetSock(pThis->pTcp, pSock);
+}
+
+
 /* abort a connection. This is meant to be called immediately
  * before the Destruct call. -- rgerhards, 2008-03-24
  */
@@ -1425,8 +1983,10 @@ AcceptConnReq(nsd_t *pNsd, nsd_t **ppNew)
 		pNew->rtryCall = gtlsRtry_handshake;
 		dbgprintf("GnuTLS handshake does not complete immediately - setting to retry (this is OK and normal)\n");
 	} else if(gnuRet == 0) {
+		gtlsCountHandshake(pNew);
 		/* we got a handshake, now check authorization */
 		CHKiRet(gtlsChkPeerAuth(pNew));
+		gtlsTryKTLS(pNew);
 	} else {
 		uchar *pGnuErr = gtlsStrerror(gnuRet);
 		errmsg.LogError(0, RS_RET_TLS_HANDSHAKE_ERR, 
@@ -1448,6 +2008,41 @@ finalize_it:
 }
 
 
+/* continue a handshake that did not complete in AcceptConnReq(). This
+ * is usually done by nsdsel_gtls, but callers that do not use the
+ * select driver (like imptcp with its epoll loop) only call Rcv(), so
+ * it is done from there.
+ */
+static rsRetVal
+gtlsRetryHandshake(nsd_gtls_t *pThis)
+{
+	int gnuRet;
+	uchar *pGnuErr;
+	DEFiRet;
+
+	gnuRet = gnutls_handshake(pThis->sess);
+	if(gnuRet == GNUTLS_E_AGAIN || gnuRet == GNUTLS_E_INTERRUPTED) {
+		ABORT_FINALIZE(RS_RET_RETRY);
+	} else if(gnuRet != 0) {
+		pGnuErr = gtlsStrerror(gnuRet);
+		errmsg.LogError(0, RS_RET_TLS_HANDSHAKE_ERR,
+			"gnutls returned error on handshake: %s\n", pGnuErr);
+		free(pGnuErr);
+		pThis->rtryCall = gtlsRtry_None;
+		ABORT_FINALIZE(RS_RET_TLS_HANDSHAKE_ERR);
+	}
+
+	pThis->rtryCall = gtlsRtry_None;
+	gtlsCountHandshake(pThis);
+	/* we got a handshake, now check authorization */
+	CHKiRet(gtlsChkPeerAuth(pThis));
+	gtlsTryKTLS(pThis);
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* receive data from a tcp socket
  * The lenBuf parameter must contain the max buffer size on entry and contains
  * the number of octets read on exit. This function
@@ -1488,6 +2083,9 @@ Rcv(nsd_t *pNsd, uchar *pBuf, ssize_t *pLenBuf)
 
 	/* --- in TLS mode now --- */
 
+	if(pThis->rtryCall == gtlsRtry_handshake)
+		CHKiRet(gtlsRetryHandshake(pThis));
+
 	/* Buffer logic applies only if we are in TLS mode. Here we 
 	 * assume that we will switch from plain to TLS, but never back. This
 	 * assumption may be unsafe, but it is the model for the time being and I
@@ -1562,6 +2160,12 @@ Send(nsd_t *pNsd, uchar *pBuf, ssize_t *pLenBuf)
 	}
 
 	/* in TLS mode now */
+	if(pThis->ktlsMode & GTLS_KTLS_TX) {
+		/* the kernel encrypts, so this is a plain socket write */
+		CHKiRet(nsd_ptcp.Send(pThis->pTcp, pBuf, pLenBuf));
+		FINALIZE;
+	}
+
 	while(1) { /* loop broken inside */
 		iSent = gnutls_record_send(pThis->sess, pBuf, *pLenBuf);
 		if(iSent >= 0) {
@@ -1579,6 +2183,69 @@ finalize_it:
 	RETiRet;
 }
 
+/* send an I/O vector. In plain and kTLS mode, this is a single writev().
+ * Otherwise, as much data as fits is gathered into one TLS record, so
+ * that many small frames do not result in many small records. On exit,
+ * pLenSent contains the number of octets actually written.
+ */
+static rsRetVal
+SendV(nsd_t *pNsd, struct iovec *iov, int iovcnt, ssize_t *pLenSent)
+{
+	nsd_gtls_t *pThis = (nsd_gtls_t*) pNsd;
+	uchar recBuf[16*1024]; /* max TLS record payload */
+	ssize_t lenRec;
+	size_t lenCopy;
+	int i;
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, nsd_gtls);
+
+	if(pThis->bAbortConn)
+		ABORT_FINALIZE(RS_RET_CONNECTION_ABORTREQ);
+
+	if(pThis->iMode == 0 || (pThis->ktlsMode & GTLS_KTLS_TX)) {
+		CHKiRet(nsd_ptcp.SendV(pThis->pTcp, iov, iovcnt, pLenSent));
+		FINALIZE;
+	}
+
+	if(iovcnt == 1 || iov[0].iov_len >= sizeof(recBuf)) {
+		/* nothing to gain from copying */
+		*pLenSent = iov[0].iov_len;
+		CHKiRet(Send(pNsd, iov[0].iov_base, pLenSent));
+		FINALIZE;
+	}
+
+	for(lenRec = 0, i = 0 ; i < iovcnt && lenRec < (ssize_t) sizeof(recBuf) ; ++i) {
+		lenCopy = iov[i].iov_len;
+		if(lenCopy > sizeof(recBuf) - lenRec)
+			lenCopy = sizeof(recBuf) - lenRec;
+		memcpy(recBuf + lenRec, iov[i].iov_base, lenCopy);
+		lenRec += lenCopy;
+	}
+	*pLenSent = lenRec;
+	CHKiRet(Send(pNsd, recBuf, pLenSent));
+
+finalize_it:
+	RETiRet;
+}
+
+/* set a pre-resolved connect address - this is handled by the ptcp layer */
+static rsRetVal
+SetConnectAddr(nsd_t *pNsd, struct sockaddr *pAddr, socklen_t lenAddr)
+{
+	nsd_gtls_t *pThis = (nsd_gtls_t*) pNsd;
+	return nsd_ptcp.SetConnectAddr(pThis->pTcp, pAddr, lenAddr);
+}
+
+/* TCP options are handled by the ptcp layer. Zero-copy does not apply, as
+ * GnuTLS sends from its own (encrypted) buffers.
+ */
+static rsRetVal
+SetTcpOpts(nsd_t *pNsd, int opts)
+{
+	nsd_gtls_t *pThis = (nsd_gtls_t*) pNsd;
+	return nsd_ptcp.SetTcpOpts(pThis->pTcp, opts & ~NSD_TCPOPT_ZEROCOPY);
+}
+
 /* Enable KEEPALIVE handling on the socket.
  * rgerhards, 2009-06-02
  */
@@ -1602,6 +2269,11 @@ Connect(nsd_t *pNsd, int family, uchar *port, uchar *host)
 	int gnuRet;
 	/* TODO: later? static const int cert_type_priority[3] = { GNUTLS_CRT_X509, GNUTLS_CRT_OPENPGP, 0 };*/
 	static const int cert_type_priority[2] = { GNUTLS_CRT_X509, 0 };
+	char szCacheKey[512];
+	gnutls_datum_t cacheKey;
+	gnutls_datum_t sessData;
+	int bHaveCacheKey;
+	int bTriedResume = 0;
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, nsd_gtls);
@@ -1648,9 +2320,22 @@ Connect(nsd_t *pNsd, int family, uchar *port, uchar *host)
 	 */
 	CHKmalloc(pThis->pszConnectHost = (uchar*)strdup((char*)host));
 
+	/* if we talked to this peer before, try to resume that session */
+	bHaveCacheKey = (gtlsCltCacheKey(szCacheKey, sizeof(szCacheKey), host, port, &cacheKey) == 0);
+	if(bHaveCacheKey && gtlsCacheFetch(&cltCache, &cacheKey, &sessData) == 0) {
+		gnuRet = gnutls_session_set_data(pThis->sess, sessData.data, sessData.size);
+		gnutls_free(sessData.data);
+		if(gnuRet == 0)
+			bTriedResume = 1;
+		else
+			dbgprintf("GnuTLS could not set cached session data, error %d - doing full handshake\n",
+				  gnuRet);
+	}
+
 	/* and perform the handshake */
 	CHKgnutls(gnutls_handshake(pThis->sess));
 	dbgprintf("GnuTLS handshake succeeded\n");
+	gtlsCountHandshake(pThis);
 
 	/* now check if the remote peer is permitted to talk to us - ideally, we 
 	 * should do this during the handshake, but GnuTLS does not yet provide 
@@ -1658,8 +2343,19 @@ Connect(nsd_t *pNsd, int family, uchar *port, uchar *host)
 	 */
 	CHKiRet(gtlsChkPeerAuth(pThis));
 
+	/* remember the session for the next connect to this peer */
+	if(bHaveCacheKey && gnutls_session_get_data2(pThis->sess, &sessData) == 0) {
+		gtlsCacheStore(&cltCache, &cacheKey, &sessData);
+		gnutls_free(sessData.data);
+	}
+
+	gtlsTryKTLS(pThis);
+
 finalize_it:
 	if(iRet != RS_RET_OK) {
+		/* do not try to resume a session that did not work out */
+		if(bTriedResume)
+			gtlsCacheRemove(&cltCache, &cacheKey);
 		if(pThis->bHaveSess) {
 			gnutls_deinit(pThis->sess);
 			pThis->bHaveSess = 0;
@@ -1689,8 +2385,12 @@ CODESTARTobjQueryInterface(nsd_gtls)
 	pIf->AcceptConnReq = AcceptConnReq;
 	pIf->Rcv = Rcv;
 	pIf->Send = Send;
+	pIf->SendV = SendV;
+	pIf->SetConnectAddr = SetConnectAddr;
+	pIf->SetTcpOpts = SetTcpOpts;
 	pIf->Connect = Connect;
 	pIf->SetSock = SetSock;
+	pIf->GetSock = GetSock;
 	pIf->SetMode = SetMode;
 	pIf->SetAuthMode = SetAuthMode;
 	pIf->SetPermPeers =SetPermPeers;
@@ -1707,9 +2407,12 @@ ENDobjQueryInterface(nsd_gtls)
  */
 BEGINObjClassExit(nsd_gtls, OBJ_IS_LOADABLE_MODULE) /* CHANGE class also in END MACRO! */
 CODESTARTObjClassExit(nsd_gtls)
+	if(hsStats.stats != NULL)
+		statsobj.Destruct(&hsStats.stats);
 	gtlsGlblExit();	/* shut down GnuTLS */
 
 	/* release objects we no longer need */
+	objRelease(statsobj, CORE_COMPONENT);
 	objRelease(nsd_ptcp, LM_NSD_PTCP_FILENAME);
 	objRelease(net, LM_NET_FILENAME);
 	objRelease(glbl, CORE_COMPONENT);
@@ -1729,9 +2432,11 @@ BEGINObjClassInit(nsd_gtls, 1, OBJ_IS_LOADABLE_MODULE) /* class, version */
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
 	CHKiRet(objUse(net, LM_NET_FILENAME));
 	CHKiRet(objUse(nsd_ptcp, LM_NSD_PTCP_FILENAME));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 
 	/* now do global TLS init stuff */
 	CHKiRet(gtlsGlblInit());
+	CHKiRet(gtlsStatsInit());
 ENDObjClassInit(nsd_gtls)
 
 
@@ -32,6 +32,9 @@ typedef enum {
 	gtlsRtry_recv = 2
 } gtlsRtryCall_t;		/**< IDs of calls that needs to be retried */
 
+#define GTLS_KTLS_TX 1	/* kernel encrypts outgoing records */
+#define GTLS_KTLS_RX 2	/* kernel decrypts incoming records */
+
 typedef nsd_if_t nsd_gtls_if_t; /* we just *implement* this interface */
 
 /* the nsd_gtls object */
@@ -63,6 +66,7 @@ struct nsd_gtls_s {
 	char *pszRcvBuf;
 	int lenRcvBuf;		/**< -1: empty, 0: connection closed, 1..NSD_GTLS_MAX_RCVBUF-1: data of that size present */
 	int ptrRcvBuf;		/**< offset for next recv operation if 0 < lenRcvBuf < NSD_GTLS_MAX_RCVBUF */
+	int ktlsMode;		/**< GTLS_KTLS_* flags: directions handled by kernel TLS */
 };
 
 /* interface is defined in nsd.h, we just implement it! */
@@ -74,6 +78,8 @@ PROTOTYPEObj(nsd_gtls);
 uchar *gtlsStrerror(int error);
 rsRetVal gtlsChkPeerAuth(nsd_gtls_t *pThis);
 rsRetVal gtlsRecordRecv(nsd_gtls_t *pThis);
+void gtlsCountHandshake(nsd_gtls_t *pThis);
+void gtlsTryKTLS(nsd_gtls_t *pThis);
 static inline rsRetVal gtlsHasRcvInBuffer(nsd_gtls_t *pThis) {
 	/* we have a valid receive buffer one such is allocated and 
 	 * NOT exhausted!
@@ -37,6 +37,17 @@
 #include <fnmatch.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef __linux__
+#	include <linux/errqueue.h>
+#endif
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#	define HAVE_ZEROCOPY 1
+#endif
 
 #include "syslogd-types.h"
 #include "module-template.h"
@@ -459,6 +470,16 @@ LstnInit(netstrms_t *pNS, void *pUsr, rsRetVal(*fAddLstn)(void*,netstrm_t*),
                         continue;
                 }
 
+#		ifdef TCP_FASTOPEN
+		if(netstrms.GetDrvrFastOpen(pNS) > 0) {
+			int qlen = netstrms.GetDrvrFastOpen(pNS);
+			if(setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) < 0) {
+				errmsg.LogError(errno, NO_ERRCODE, "TCP setsockopt(TCP_FASTOPEN) failed, "
+						"TCP Fast Open not enabled for port %s", pLstnPort);
+			}
+		}
+#		endif
+
 		if(listen(sock, iSessMax / 10 + 5) < 0) {
 			/* If the listen fails, it most probably fails because we ask
 			 * for a too-large backlog. So in this case we first set back
@@ -586,6 +607,147 @@ finalize_it:
 }
 
 
+#ifdef HAVE_ZEROCOPY
+/* MSG_ZEROCOPY: the kernel sends directly from our buffers, which thus
+ * must not be touched until it reports completion via the socket error
+ * queue. Our callers reuse their buffers as soon as we return, so we wait
+ * for the completion of each zero-copy send. That costs a round-trip (the
+ * kernel releases the pages when the data is acked), so this only pays
+ * off for large buffers on fast links. If the kernel tells us it had to
+ * copy anyway (e.g. loopback), we stop using zero-copy for the connection.
+ */
+#define ZEROCOPY_MIN_BYTES	(32 * 1024)	/* below that, copying is cheaper */
+#define ZEROCOPY_TIMEOUT	1000		/* ms to wait for a completion before re-checking */
+static rsRetVal
+zeroCopyWaitDone(nsd_ptcp_t *pThis)
+{
+	char ctrl[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct sock_extended_err *serr;
+	struct pollfd pfd;
+	const uint32_t lastSent = pThis->zcSent - 1;
+	sbool bDone = 0;
+	int err;
+	socklen_t lenErr;
+	DEFiRet;
+
+	while(!bDone) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+		if(recvmsg(pThis->sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				ABORT_FINALIZE(RS_RET_IO_ERROR);
+			/* the error queue signals POLLERR when a completion arrives */
+			pfd.fd = pThis->sock;
+			pfd.events = 0;
+			if(poll(&pfd, 1, ZEROCOPY_TIMEOUT) == -1 && errno != EINTR)
+				ABORT_FINALIZE(RS_RET_IO_ERROR);
+			if(pfd.revents & (POLLHUP | POLLNVAL))
+				ABORT_FINALIZE(RS_RET_IO_ERROR);
+			if(pfd.revents & POLLERR) {
+				/* not a completion, but a real socket error? */
+				lenErr = sizeof(err);
+				if(getsockopt(pThis->sock, SOL_SOCKET, SO_ERROR, &err, &lenErr) == 0 && err != 0)
+					ABORT_FINALIZE(RS_RET_IO_ERROR);
+			}
+			continue;
+		}
+		for(cm = CMSG_FIRSTHDR(&msg) ; cm != NULL ; cm = CMSG_NXTHDR(&msg, cm)) {
+			serr = (struct sock_extended_err*) CMSG_DATA(cm);
+			if(serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+				if(serr->ee_errno != 0)
+					ABORT_FINALIZE(RS_RET_IO_ERROR);
+				continue;
+			}
+			/* [ee_info, ee_data] is the range of completed sends (wraps) */
+			if((int32_t) (serr->ee_data - lastSent) >= 0)
+				bDone = 1;
+			if(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+				DBGPRINTF("nsd_ptcp: kernel copied zero-copy data, disabling "
+					  "zero-copy for socket %d\n", pThis->sock);
+				pThis->bZeroCopy = 0;
+			}
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+#endif /* #ifdef HAVE_ZEROCOPY */
+
+
+/* send an I/O vector with a single writev(). Otherwise works like Send().
+ * Note that at most IOV_MAX elements are written per call, so the caller
+ * must be prepared to get back less than the total.
+ */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+static rsRetVal
+SendV(nsd_t *pNsd, struct iovec *iov, int iovcnt, ssize_t *pLenSent)
+{
+	nsd_ptcp_t *pThis = (nsd_ptcp_t*) pNsd;
+	ssize_t written;
+#	ifdef HAVE_ZEROCOPY
+	struct msghdr msg;
+	size_t lenTotal;
+	int i;
+#	endif
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, nsd_ptcp);
+
+	if(iovcnt > IOV_MAX)
+		iovcnt = IOV_MAX;
+#	ifdef HAVE_ZEROCOPY
+	if(pThis->bZeroCopy) {
+		for(lenTotal = 0, i = 0 ; i < iovcnt ; ++i)
+			lenTotal += iov[i].iov_len;
+		if(lenTotal >= ZEROCOPY_MIN_BYTES) {
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov;
+			msg.msg_iovlen = iovcnt;
+			written = sendmsg(pThis->sock, &msg, MSG_ZEROCOPY);
+			if(written != -1) {
+				++pThis->zcSent;
+				CHKiRet(zeroCopyWaitDone(pThis));
+				*pLenSent = written;
+				FINALIZE;
+			} else if(errno == ENOBUFS) {
+				/* out of optmem for zero-copy, fall back to a regular send */
+				DBGPRINTF("nsd_ptcp: zero-copy send failed with ENOBUFS, copying\n");
+			} else {
+				goto send_error;
+			}
+		}
+	}
+#	endif
+
+	written = writev(pThis->sock, iov, iovcnt);
+#	ifdef HAVE_ZEROCOPY
+send_error:
+#	endif
+
+	if(written == -1) {
+		switch(errno) {
+			case EAGAIN:
+			case EINTR:
+				/* this is fine, just retry... */
+				written = 0;
+				break;
+			default:
+				ABORT_FINALIZE(RS_RET_IO_ERROR);
+				break;
+		}
+	}
+
+	*pLenSent = written;
+finalize_it:
+	RETiRet;
+}
+
+
 /* Enable KEEPALIVE handling on the socket.
  * rgerhards, 2009-06-02
  */
@@ -614,6 +776,51 @@ finalize_it:
 }
 
 
+/* set the TCP options to apply on the next Connect() */
+static rsRetVal
+SetTcpOpts(nsd_t *pNsd, int opts)
+{
+	nsd_ptcp_t *pThis = (nsd_ptcp_t*) pNsd;
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, nsd_ptcp);
+	pThis->tcpOpts = opts;
+	RETiRet;
+}
+
+
+/* apply the configured TCP options to a new client socket. Everything is
+ * optional: if the OS does not support an option, we continue without.
+ */
+static void
+applyTcpOpts(nsd_ptcp_t *pThis)
+{
+	int on = 1;
+
+	if(pThis->tcpOpts & NSD_TCPOPT_FASTOPEN) {
+#		ifdef TCP_FASTOPEN_CONNECT
+		/* connect() returns immediately, the SYN is sent with the first data */
+		if(setsockopt(pThis->sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on)) != 0)
+			DBGPRINTF("nsd_ptcp: TCP_FASTOPEN_CONNECT not available, errno %d\n", errno);
+#		else
+		DBGPRINTF("nsd_ptcp: TCP Fast Open not supported on this platform\n");
+#		endif
+	}
+	pThis->bZeroCopy = 0;
+	pThis->zcSent = 0;
+	if(pThis->tcpOpts & NSD_TCPOPT_ZEROCOPY) {
+#		ifdef HAVE_ZEROCOPY
+		if(setsockopt(pThis->sock, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0)
+			pThis->bZeroCopy = 1;
+		else
+			DBGPRINTF("nsd_ptcp: SO_ZEROCOPY not available, errno %d\n", errno);
+#		else
+		DBGPRINTF("nsd_ptcp: MSG_ZEROCOPY not supported on this platform\n");
+#		endif
+	}
+	(void) on;
+}
+
+
 /* open a connection to a remote host (server).
  * rgerhards, 2008-03-19
  */
@@ -630,6 +837,18 @@ Connect(nsd_t *pNsd, int family, uchar *port, uchar *host)
 	assert(host != NULL);
 	assert(pThis->sock == -1);
 
+	if(pThis->lenConnAddr != 0) {
+		/* the caller already resolved the host for us */
+		if((pThis->sock = socket(pThis->connAddr.ss_family, SOCK_STREAM, 0)) == -1) {
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+		applyTcpOpts(pThis);
+		if(connect(pThis->sock, (struct sockaddr*) &pThis->connAddr, pThis->lenConnAddr) != 0) {
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+		FINALIZE;
+	}
+
 	memset(&hints, 0, sizeof(hints));
 	hints.ai_family = family;
 	hints.ai_socktype = SOCK_STREAM;
@@ -641,12 +860,14 @@ Connect(nsd_t *pNsd, int family, uchar *port, uchar *host)
 	if((pThis->sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) == -1) {
 		ABORT_FINALIZE(RS_RET_IO_ERROR);
 	}
+	applyTcpOpts(pThis);
 
 	if(connect(pThis->sock, res->ai_addr, res->ai_addrlen) != 0) {
 		ABORT_FINALIZE(RS_RET_IO_ERROR);
 	}
 
 finalize_it:
+	pThis->lenConnAddr = 0;
 	if(res != NULL)
                freeaddrinfo(res);
 		
@@ -658,6 +879,25 @@ finalize_it:
 }
 
 
+/* set a pre-resolved address (including port) to be used by the next
+ * Connect() call instead of resolving the host name.
+ */
+static rsRetVal
+SetConnectAddr(nsd_t *pNsd, struct sockaddr *pAddr, socklen_t lenAddr)
+{
+	nsd_ptcp_t *pThis = (nsd_ptcp_t*) pNsd;
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, nsd_ptcp);
+
+	if(lenAddr > sizeof(pThis->connAddr))
+		ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+	memcpy(&pThis->connAddr, pAddr, lenAddr);
+	pThis->lenConnAddr = lenAddr;
+finalize_it:
+	RETiRet;
+}
+
+
 /* get the remote hostname. The returned hostname must be freed by the
  * caller.
  * rgerhards, 2008-04-24
@@ -747,6 +987,9 @@ CODESTARTobjQueryInterface(nsd_ptcp)
 	pIf->SetPermPeers = SetPermPeers;
 	pIf->Rcv = Rcv;
 	pIf->Send = Send;
+	pIf->SendV = SendV;
+	pIf->SetConnectAddr = SetConnectAddr;
+	pIf->SetTcpOpts = SetTcpOpts;
 	pIf->LstnInit = LstnInit;
 	pIf->AcceptConnReq = AcceptConnReq;
 	pIf->Connect = Connect;
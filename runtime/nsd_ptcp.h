@@ -34,6 +34,11 @@ struct nsd_ptcp_s {
 	uchar *pRemHostName; /**< host name of remote peer (currently used in server mode, only) */
 	struct sockaddr_storage remAddr; /**< remote addr as sockaddr - used for legacy ACL code */
 	int sock;	/**< the socket we use for regular, single-socket, operations */
+	struct sockaddr_storage connAddr; /**< pre-resolved address for next Connect() */
+	socklen_t lenConnAddr;	/**< 0 if none is set */
+	int tcpOpts;		/**< NSD_TCPOPT_* to apply on Connect() */
+	sbool bZeroCopy;	/**< MSG_ZEROCOPY is active on this connection */
+	uint32_t zcSent;	/**< number of MSG_ZEROCOPY sends (kernel counts them, too) */
 };
 
 /* interface is defined in nsd.h, we just implement it! */
@@ -142,8 +142,10 @@ doRetry(nsd_gtls_t *pNsd)
 			gnuRet = gnutls_handshake(pNsd->sess);
 			if(gnuRet == 0) {
 				pNsd->rtryCall = gtlsRtry_None; /* we are done */
+				gtlsCountHandshake(pNsd);
 				/* we got a handshake, now check authorization */
 				CHKiRet(gtlsChkPeerAuth(pNsd));
+				gtlsTryKTLS(pNsd);
 			}
 			break;
 		case gtlsRtry_recv:
@@ -29,6 +29,8 @@
 #include <ctype.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #ifdef USE_NETZIP
 #include <zlib.h>
 #endif
@@ -44,6 +46,8 @@
 #include "unicode-helper.h"
 #include "dirty.h"
 #include "cfsysline.h"
+#include "statsobj.h"
+#include "atomic.h"
 
 /* some defines */
 #define DEFUPRI		(LOG_USER|LOG_NOTICE)
@@ -54,9 +58,26 @@ DEFobjCurrIf(glbl)
 DEFobjCurrIf(errmsg)
 DEFobjCurrIf(datetime)
 DEFobjCurrIf(ruleset)
+DEFobjCurrIf(statsobj)
 
 /* static data */
 
+/* The parser selection cache (global parser.cacheSelection). For a given
+ * parser list, input and sender, it remembers which parser succeeded last,
+ * so that this parser can be tried first. This assumes that a sender
+ * sends all its messages in the same format, which is why the cache must
+ * be enabled explicitely. Each entry is a single word, so that it can be
+ * read and written without locking: the upper 24 bits are the upper bits
+ * of the key hash, the lower 8 bits are the index of the parser in the
+ * list plus one (0 = entry unused).
+ */
+#define PARSER_CACHE_SIZE 4096	/* must be a power of 2 */
+#define PARSER_CACHE_MAXIDX 254
+static uint32_t parserCache[PARSER_CACHE_SIZE];
+static statsobj_t *parserCacheStats = NULL;
+static statsctr_pt_t ctrCacheHits;	/* per-thread, as all inputs update them */
+static statsctr_pt_t ctrCacheMisses;
+
 static char hexdigit[16] =
 	{'0', '1', '2', '3', '4', '5', '6', '7', '8',
 	 '9', 'A', 'B', 'C', 'D', 'E', 'F' };
@@ -532,6 +553,62 @@ ParsePRI(msg_t *pMsg)
 }
 
 
+/* set up the statistics of the parser selection cache, if it is enabled.
+ * Called when the config is activated.
+ */
+rsRetVal
+parserActivateCache(void)
+{
+	DEFiRet;
+
+	if(!glblParserCacheSelection || parserCacheStats != NULL)
+		FINALIZE;
+	CHKiRet(statsobj.Construct(&parserCacheStats));
+	CHKiRet(statsobj.SetName(parserCacheStats, UCHAR_CONSTANT("parser.cache")));
+	CHKiRet(statsobj.AddCounter(parserCacheStats, UCHAR_CONSTANT("hits"),
+		ctrType_IntCtrPerThread, CTR_FLAG_NONE, &ctrCacheHits));
+	CHKiRet(statsobj.AddCounter(parserCacheStats, UCHAR_CONSTANT("misses"),
+		ctrType_IntCtrPerThread, CTR_FLAG_NONE, &ctrCacheMisses));
+	CHKiRet(statsobj.ConstructFinalize(parserCacheStats));
+finalize_it:
+	RETiRet;
+}
+
+
+/* compute the parser cache key for a message: the parser list, the input
+ * and the sender (without doing a DNS lookup).
+ */
+static inline uint32_t
+parserCacheHash(const parserList_t *const pParserList, msg_t *const pMsg)
+{
+	uint32_t hash = 2166136261u; /* FNV-1a */
+	const uchar *p;
+	int len;
+	int i;
+	struct sockaddr_storage *pAddr;
+
+#	define HASH_BYTES(buf, n) \
+		for(i = 0 ; i < (int) (n) ; ++i) \
+			hash = (hash ^ ((const uchar*)(buf))[i]) * 16777619u
+	HASH_BYTES(&pParserList, sizeof(pParserList));
+	getInputName(pMsg, (uchar**) &p, &len);
+	HASH_BYTES(p, len);
+	if(pMsg->msgFlags & NEEDS_DNSRESOL) {
+		pAddr = pMsg->rcvFrom.pfrominet;
+		if(pAddr->ss_family == AF_INET) {
+			HASH_BYTES(&((struct sockaddr_in*) pAddr)->sin_addr, sizeof(struct in_addr));
+		} else if(pAddr->ss_family == AF_INET6) {
+			HASH_BYTES(&((struct sockaddr_in6*) pAddr)->sin6_addr, sizeof(struct in6_addr));
+		}
+	} else if(pMsg->pRcvFromIP != NULL) {
+		p = getRcvFromIP(pMsg);
+		HASH_BYTES(p, ustrlen(p));
+	}
+#	undef HASH_BYTES
+	return hash;
+}
+
+
 /* Parse a received message. The object's rawmsg property is taken and
  * parsed according to the relevant standards. This can later be
  * extended to support configured parsers.
@@ -546,10 +623,16 @@ ParseMsg(msg_t *pMsg)
 	sbool bIsSanitized;
 	sbool bPRIisParsed;
 	static int iErrMsgRateLimiter = 0;
+	uint32_t *pCacheEnt = NULL;
+	uint32_t hash = 0;
+	uint32_t cacheEnt;
+	int idxCached = -1;
+	int idx;
 	DEFiRet;
 
 	if(pMsg->iLenRawMsg == 0)
 		ABORT_FINALIZE(RS_RET_EMPTY_MSG);
+	MsgRawUnshare(pMsg); /* sanitizing and some parsers modify it in place */
 
 #	ifdef USE_NETZIP
 	CHKiRet(uncompressMessage(pMsg));
@@ -576,22 +659,67 @@ ParseMsg(msg_t *pMsg)
 
 	bIsSanitized = RSFALSE;
 	bPRIisParsed = RSFALSE;
+#	define PREPARE_FOR_PARSER(pParser) \
+		if((pParser)->bDoSanitazion && bIsSanitized == RSFALSE) { \
+			CHKiRet(SanitizeMsg(pMsg)); \
+			if((pParser)->bDoPRIParsing && bPRIisParsed == RSFALSE) { \
+				CHKiRet(ParsePRI(pMsg)); \
+				bPRIisParsed = RSTRUE; \
+			} \
+			bIsSanitized = RSTRUE; \
+		}
+
+	/* if we know which parser succeeded last for this input and sender,
+	 * try it first. If it fails, we walk the whole list below.
+	 */
+	if(glblParserCacheSelection && pParserList->pNext != NULL) {
+		hash = parserCacheHash(pParserList, pMsg);
+		pCacheEnt = parserCache + (hash & (PARSER_CACHE_SIZE - 1));
+		cacheEnt = *pCacheEnt;
+		if((cacheEnt & 0xff) != 0 && (cacheEnt & ~0xffu) == (hash & ~0xffu)) {
+			idxCached = (cacheEnt & 0xff) - 1;
+			for(idx = 0 ; pParserList != NULL && idx < idxCached ; ++idx)
+				pParserList = pParserList->pNext;
+			if(pParserList != NULL) {
+				pParser = pParserList->pParser;
+				PREPARE_FOR_PARSER(pParser);
+				localRet = pParser->pModule->mod.pm.parse(pMsg);
+				DBGPRINTF("Parser '%s' (cached) returned %d\n", pParser->pName, localRet);
+			} else {
+				idxCached = -1; /* stale entry */
+				localRet = RS_RET_COULD_NOT_PARSE;
+			}
+			pParserList = ruleset.GetParserList(ourConf, pMsg);
+			if(pParserList == NULL)
+				pParserList = pDfltParsLst;
+			if(localRet != RS_RET_COULD_NOT_PARSE) {
+				STATSCOUNTER_PT_INC(ctrCacheHits);
+				pParserList = NULL; /* done, skip the walk */
+			} else {
+				STATSCOUNTER_PT_INC(ctrCacheMisses);
+			}
+		} else {
+			STATSCOUNTER_PT_INC(ctrCacheMisses);
+		}
+	}
+
+	idx = 0;
 	while(pParserList != NULL) {
 		pParser = pParserList->pParser;
-		if(pParser->bDoSanitazion && bIsSanitized == RSFALSE) {
-			CHKiRet(SanitizeMsg(pMsg));
-			if(pParser->bDoPRIParsing && bPRIisParsed == RSFALSE) {
-				CHKiRet(ParsePRI(pMsg));
-				bPRIisParsed = RSTRUE;
+		if(idx != idxCached) { /* the cached parser already failed */
+			PREPARE_FOR_PARSER(pParser);
+			localRet = pParser->pModule->mod.pm.parse(pMsg);
+			DBGPRINTF("Parser '%s' returned %d\n", pParser->pName, localRet);
+			if(localRet != RS_RET_COULD_NOT_PARSE) {
+				if(pCacheEnt != NULL && idx <= PARSER_CACHE_MAXIDX)
+					*pCacheEnt = (hash & ~0xffu) | (idx + 1);
+				break;
 			}
-			bIsSanitized = RSTRUE;
 		}
-		localRet = pParser->pModule->mod.pm.parse(pMsg);
-		DBGPRINTF("Parser '%s' returned %d\n", pParser->pName, localRet);
-		if(localRet != RS_RET_COULD_NOT_PARSE)
-			break;
 		pParserList = pParserList->pNext;
+		++idx;
 	}
+#	undef PREPARE_FOR_PARSER
 
 	/* We need to log a warning message and drop the message if we did not find a parser.
 	 * Note that we log at most the first 1000 message, as this may very well be a problem
@@ -734,7 +862,10 @@ BEGINObjClassExit(parser, OBJ_IS_CORE_MODULE) /* class, version */
 	objRelease(glbl, CORE_COMPONENT);
 	objRelease(errmsg, CORE_COMPONENT);
 	objRelease(datetime, CORE_COMPONENT);
+	if(parserCacheStats != NULL)
+		statsobj.Destruct(&parserCacheStats);
 	objRelease(ruleset, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
 ENDObjClassExit(parser)
 
 
@@ -748,6 +879,9 @@ BEGINObjClassInit(parser, 1, OBJ_IS_CORE_MODULE) /* class, version */
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
 	CHKiRet(objUse(datetime, CORE_COMPONENT));
 	CHKiRet(objUse(ruleset, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
+	STATSCOUNTER_PT_INIT(ctrCacheHits);
+	STATSCOUNTER_PT_INIT(ctrCacheMisses);
 
 	InitParserList(&pParsLstRoot);
 	InitParserList(&pDfltParsLst);
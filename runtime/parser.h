@@ -62,6 +62,7 @@ ENDinterface(parser)
 #define parserCURR_IF_VERSION 1 /* increment whenever you change the interface above! */
 
 void printParserList(parserList_t *pList);
+rsRetVal parserActivateCache(void);
 
 /* prototypes */
 PROTOTYPEObj(parser);
@@ -0,0 +1,191 @@
+/* pipestats.c
+ * Sampled per-stage pipeline timing, see pipestats.h.
+ *
+ * The durations published are:
+ *   receive - from reception (msg generation) until submit to the queue
+ *   queue   - waiting in the main (ruleset) queue
+ *   parse   - parsing, ACL checks and DNS resolution
+ *   ruleset - ruleset execution (including direct mode actions)
+ *   commit  - from the start of ruleset execution until an action
+ *             committed the message, this includes the time spent in
+ *             action queues. The start of the ruleset is used (and not
+ *             its end) so that direct mode actions, which commit while
+ *             the ruleset is still running, can be measured as well.
+ *             With multiple actions, each commit is one sample.
+ * Messages in disk queues lose their stage timestamps, as these are not
+ * serialized.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "rsyslog.h"
+#include "obj.h"
+#include "msg.h"
+#include "statsobj.h"
+#include "unicode-helper.h"
+#include "pipestats.h"
+
+#define HIST_RECEIVE	0
+#define HIST_QUEUE	1
+#define HIST_PARSE	2
+#define HIST_RULESET	3
+#define HIST_COMMIT	4
+#define HIST_COUNT	5
+static const char *histNames[HIST_COUNT] =
+	{ "receive", "queue", "parse", "ruleset", "commit" };
+
+static struct {
+	pthread_mutex_t mut;
+	statshist_t hist;
+} hists[HIST_COUNT];
+
+/* static data */
+DEFobjStaticHelpers
+DEFobjCurrIf(statsobj)
+unsigned pipestatsRate = 0;
+static unsigned sampleCtr;
+static statsobj_t *stats = NULL;
+STATSCOUNTER_DEF(ctrSampled, mutCtrSampled)
+
+
+static void
+histRecord(const int idx, const uint64 tStart, const uint64 tEnd)
+{
+	if(tStart == 0 || tEnd < tStart)
+		return; /* stage not seen, e.g. message went through a disk queue */
+	pthread_mutex_lock(&hists[idx].mut);
+	statshistRecord(&hists[idx].hist, tEnd - tStart);
+	pthread_mutex_unlock(&hists[idx].mut);
+}
+
+/* decide if the message is to be sampled and, if so, record its submit
+ * time. The sample counter is intentionally not synchronized: a lost
+ * update just changes the sampling a tiny bit, but keeps inputs from
+ * contending on it.
+ */
+void
+pipestatsSubmit(msg_t *const pMsg)
+{
+	if(pipestatsRate == 0 || stats == NULL || pMsg->pStages != NULL)
+		return;
+	if(++sampleCtr % pipestatsRate != 0)
+		return;
+	if((pMsg->pStages = calloc(1, sizeof(struct msgStages))) == NULL)
+		return;
+	pMsg->pStages->ts[PIPESTAGE_SUBMIT] = pipestatsNow();
+	STATSCOUNTER_INC(ctrSampled, mutCtrSampled);
+}
+
+/* called when the ruleset has been processed. The stages up to here are
+ * complete and are recorded.
+ */
+void
+pipestatsRulesetDone(msg_t *const pMsg)
+{
+	struct msgStages *const pStages = pMsg->pStages;
+	uint64 tRcvd;
+
+	if(pStages == NULL)
+		return;
+	pStages->ts[PIPESTAGE_RULESET] = pipestatsNow();
+	tRcvd = (uint64) pMsg->ttGenTime * 1000000;
+	if(pMsg->tRcvdAt.secfracPrecision == 6)
+		tRcvd += pMsg->tRcvdAt.secfrac;
+	histRecord(HIST_RECEIVE, tRcvd, pStages->ts[PIPESTAGE_SUBMIT]);
+	histRecord(HIST_QUEUE, pStages->ts[PIPESTAGE_SUBMIT], pStages->ts[PIPESTAGE_DEQUEUE]);
+	histRecord(HIST_PARSE, pStages->ts[PIPESTAGE_DEQUEUE], pStages->ts[PIPESTAGE_PARSE]);
+	histRecord(HIST_RULESET, pStages->ts[PIPESTAGE_PARSE], pStages->ts[PIPESTAGE_RULESET]);
+}
+
+/* called by an action that committed a sampled message. tParsed is the
+ * PIPESTAGE_PARSE timestamp of the message, that is the start of ruleset
+ * execution (the action remembers it, as the message itself may be gone
+ * by the time of the commit).
+ */
+void
+pipestatsCommitted(const uint64 tParsed)
+{
+	histRecord(HIST_COMMIT, tParsed, pipestatsNow());
+}
+
+
+/* create the statsobj, done after the config has been loaded */
+rsRetVal
+pipestatsActivate(void)
+{
+	uchar ctrName[64];
+	int i;
+	DEFiRet;
+
+	if(pipestatsRate == 0 || stats != NULL)
+		FINALIZE;
+	CHKiRet(statsobj.Construct(&stats));
+	CHKiRet(statsobj.SetName(stats, UCHAR_CONSTANT("pipeline")));
+	STATSCOUNTER_INIT(ctrSampled, mutCtrSampled);
+	CHKiRet(statsobj.AddCounter(stats, UCHAR_CONSTANT("sampled"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &ctrSampled));
+	for(i = 0 ; i < HIST_COUNT ; ++i) {
+		snprintf((char*) ctrName, sizeof(ctrName), "%s.us.p50", histNames[i]);
+		CHKiRet(statsobj.AddCounter(stats, ctrName,
+			ctrType_IntCtr, CTR_FLAG_NONE, &hists[i].hist.ctrP50));
+		snprintf((char*) ctrName, sizeof(ctrName), "%s.us.p99", histNames[i]);
+		CHKiRet(statsobj.AddCounter(stats, ctrName,
+			ctrType_IntCtr, CTR_FLAG_NONE, &hists[i].hist.ctrP99));
+		snprintf((char*) ctrName, sizeof(ctrName), "%s.us.max", histNames[i]);
+		CHKiRet(statsobj.AddCounter(stats, ctrName,
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &hists[i].hist.ctrMax));
+	}
+	CHKiRet(statsobj.ConstructFinalize(stats));
+
+finalize_it:
+	if(iRet != RS_RET_OK && stats != NULL)
+		statsobj.Destruct(&stats);
+	RETiRet;
+}
+
+/* init function (must be called once) */
+rsRetVal
+pipestatsInit(void)
+{
+	int i;
+	DEFiRet;
+
+	for(i = 0 ; i < HIST_COUNT ; ++i)
+		pthread_mutex_init(&hists[i].mut, NULL);
+	CHKiRet(objGetObjInterface(&obj)); /* this provides the root pointer for all other queries */
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
+finalize_it:
+	RETiRet;
+}
+
+/* deinit function (must be called once) */
+void
+pipestatsExit(void)
+{
+	int i;
+
+	if(stats != NULL)
+		statsobj.Destruct(&stats);
+	for(i = 0 ; i < HIST_COUNT ; ++i)
+		pthread_mutex_destroy(&hists[i].mut);
+	objRelease(statsobj, CORE_COMPONENT);
+}
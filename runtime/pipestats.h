@@ -0,0 +1,66 @@
+/* pipestats.h
+ * Definitions for sampled per-stage pipeline timing.
+ *
+ * If enabled via global(pipeline.sampling=N), one message in N gets a
+ * small side structure (msg_t.pStages) that records when it passed the
+ * stages of the pipeline. The stage durations are aggregated into
+ * histograms which are published via the "pipeline" statsobj.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_PIPESTATS_H
+#define INCLUDED_PIPESTATS_H
+#include <sys/time.h>
+
+/* the timestamps recorded in the message */
+#define PIPESTAGE_SUBMIT	0	/* submitted to the main (ruleset) queue */
+#define PIPESTAGE_DEQUEUE	1	/* dequeued by a main queue worker */
+#define PIPESTAGE_PARSE		2	/* parsed (and ACL checked) */
+#define PIPESTAGE_RULESET	3	/* ruleset processed */
+#define PIPESTAGE_NSTAMPS	4
+
+struct msgStages {
+	uint64 ts[PIPESTAGE_NSTAMPS];	/* microseconds since the epoch */
+};
+
+/* 1 in pipestatsRate messages is sampled, 0 - disabled */
+extern unsigned pipestatsRate;
+
+static inline uint64
+pipestatsNow(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* record that a sampled message passed a stage */
+#define PIPESTATS_STAMP(pMsg, stage) \
+	if((pMsg)->pStages != NULL) \
+		(pMsg)->pStages->ts[stage] = pipestatsNow()
+
+/* prototypes */
+rsRetVal pipestatsInit(void);
+rsRetVal pipestatsActivate(void);
+void pipestatsExit(void);
+void pipestatsSubmit(msg_t *pMsg);
+void pipestatsRulesetDone(msg_t *pMsg);
+void pipestatsCommitted(uint64 tParsed);
+
+#endif /* #ifndef INCLUDED_PIPESTATS_H */
@@ -35,6 +35,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "rsyslog.h"
 #include "obj.h"
@@ -46,6 +47,26 @@
 /* static data */
 DEFobjStaticHelpers
 
+/* The intern table. It maps strings to shared props, so that messages
+ * with frequently repeated values (HOSTNAME, TAG, ...) all reference a
+ * single copy. The table holds one reference to each of its props. To keep
+ * memory bounded (think of spoofed hostnames), each bucket keeps at most
+ * PROP_INTERN_DEPTH entries. If a new entry needs to be added to a full
+ * bucket, its least recently used entry is dropped. As such, interning is
+ * a best-effort operation: two props with the same string may exist, and
+ * callers must not use pointer inequality to conclude strings differ.
+ */
+#define PROP_INTERN_BUCKETS 8192 /* must be a power of 2 */
+#define PROP_INTERN_DEPTH 8
+#define PROP_INTERN_LOCKS 64 /* must be a power of 2 */
+typedef struct propInternEntry_s {
+	prop_t *pProp;
+	unsigned hash;
+	struct propInternEntry_s *next;
+} propInternEntry_t;
+static propInternEntry_t *internTab[PROP_INTERN_BUCKETS];
+static pthread_mutex_t internLocks[PROP_INTERN_LOCKS];
+
 
 /* Standard-Constructor
  */
@@ -75,17 +96,21 @@ ENDobjDestruct(prop)
  */
 static rsRetVal SetString(prop_t *pThis, const uchar *psz, const int len)
 {
+	uchar *pBuf;
 	DEFiRet;
 	ISOBJ_TYPE_assert(pThis, prop);
 	if(pThis->len >= CONF_PROP_BUFSIZE)
 		free(pThis->szVal.psz);
 	pThis->len = len;
 	if(len < CONF_PROP_BUFSIZE) {
-		memcpy(pThis->szVal.sz, psz, len + 1);
+		pBuf = pThis->szVal.sz;
 	} else {
 		CHKmalloc(pThis->szVal.psz = MALLOC(len + 1));
-		memcpy(pThis->szVal.psz, psz, len + 1);
+		pBuf = pThis->szVal.psz;
 	}
+	/* psz need not be '\0'-terminated, so we terminate ourselves */
+	memcpy(pBuf, psz, len);
+	pBuf[len] = '\0';
 
 finalize_it:
 	RETiRet;
@@ -186,6 +211,81 @@ finalize_it:
 }
 
 
+/* obtain the shared prop for the provided string from the intern
+ * table (see there). The semantics are those of CreateOrReuseStringProp():
+ * if *ppThis already contains the string, nothing happens. Otherwise, the
+ * current property (if any) is destructed and *ppThis receives a new
+ * reference to the interned property. psz need not be '\0'-terminated.
+ */
+rsRetVal InternStringProp(prop_t **ppThis, const uchar *psz, const int len)
+{
+	unsigned hash;
+	int i;
+	propInternEntry_t *pEntry, *pPrev, **ppBucket;
+	pthread_mutex_t *pMut;
+	prop_t *pProp = NULL;
+	DEFiRet;
+	assert(ppThis != NULL);
+
+	if(   *ppThis != NULL && (*ppThis)->len == len
+	   && !memcmp(propGetSzStr(*ppThis), psz, len))
+		FINALIZE; /* we already have this value */
+
+	hash = 2166136261u; /* FNV-1a */
+	for(i = 0 ; i < len ; ++i)
+		hash = (hash ^ psz[i]) * 16777619u;
+	ppBucket = &internTab[hash & (PROP_INTERN_BUCKETS - 1)];
+	pMut = &internLocks[hash & (PROP_INTERN_LOCKS - 1)];
+
+	pthread_mutex_lock(pMut);
+	for(pPrev = NULL, pEntry = *ppBucket, i = 0 ; pEntry != NULL
+	    ; pPrev = pEntry, pEntry = pEntry->next, ++i) {
+		if(   pEntry->hash == hash && pEntry->pProp->len == len
+		   && !memcmp(propGetSzStr(pEntry->pProp), psz, len))
+			break;
+	}
+	if(pEntry != NULL) {
+		if(pPrev != NULL) { /* move to front, keeps hot entries from being dropped */
+			pPrev->next = pEntry->next;
+			pEntry->next = *ppBucket;
+			*ppBucket = pEntry;
+		}
+		pProp = pEntry->pProp;
+		AddRef(pProp);
+	} else {
+		if(i >= PROP_INTERN_DEPTH) {
+			/* bucket full, drop the least recently used entry (the last one) */
+			for(pPrev = *ppBucket ; pPrev->next->next != NULL ; pPrev = pPrev->next)
+				/* just search */;
+			propDestruct(&pPrev->next->pProp);
+			pEntry = pPrev->next; /* re-use entry */
+			pPrev->next = NULL;
+		} else if((pEntry = malloc(sizeof(propInternEntry_t))) == NULL) {
+			pthread_mutex_unlock(pMut);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		if((iRet = CreateStringProp(&pProp, psz, len)) != RS_RET_OK) {
+			free(pEntry);
+			pthread_mutex_unlock(pMut);
+			FINALIZE;
+		}
+		AddRef(pProp); /* one for the table, one for the caller */
+		pEntry->pProp = pProp;
+		pEntry->hash = hash;
+		pEntry->next = *ppBucket;
+		*ppBucket = pEntry;
+	}
+	pthread_mutex_unlock(pMut);
+
+	if(*ppThis != NULL)
+		propDestruct(ppThis);
+	*ppThis = pProp;
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* debugprint for the prop object */
 BEGINobjDebugPrint(prop) /* be sure to specify the object type also in END and CODESTART macros! */
 CODESTARTobjDebugPrint(prop)
@@ -217,6 +317,7 @@ CODESTARTobjQueryInterface(prop)
 	pIf->AddRef = AddRef;
 	pIf->CreateStringProp = CreateStringProp;
 	pIf->CreateOrReuseStringProp = CreateOrReuseStringProp;
+	pIf->InternStringProp = InternStringProp;
 
 finalize_it:
 ENDobjQueryInterface(prop)
@@ -226,7 +327,21 @@ ENDobjQueryInterface(prop)
  * rgerhards, 2009-04-06
  */
 BEGINObjClassExit(prop, OBJ_IS_CORE_MODULE) /* class, version */
+	propInternEntry_t *pEntry, *pDel;
+	int i;
+CODESTARTObjClassExit(prop)
 //	objRelease(errmsg, CORE_COMPONENT);
+	for(i = 0 ; i < PROP_INTERN_BUCKETS ; ++i) {
+		for(pEntry = internTab[i] ; pEntry != NULL ; ) {
+			pDel = pEntry;
+			pEntry = pEntry->next;
+			propDestruct(&pDel->pProp);
+			free(pDel);
+		}
+		internTab[i] = NULL;
+	}
+	for(i = 0 ; i < PROP_INTERN_LOCKS ; ++i)
+		pthread_mutex_destroy(&internLocks[i]);
 ENDObjClassExit(prop)
 
 
@@ -235,9 +350,13 @@ ENDObjClassExit(prop)
  * rgerhards, 2008-02-19
  */
 BEGINObjClassInit(prop, 1, OBJ_IS_CORE_MODULE) /* class, version */
+	int i;
 	/* request objects we use */
 //	CHKiRet(objUse(errmsg, CORE_COMPONENT));
 
+	for(i = 0 ; i < PROP_INTERN_LOCKS ; ++i)
+		pthread_mutex_init(&internLocks[i], NULL);
+
 	/* set our own handlers */
 	OBJSetMethodHandler(objMethod_DEBUGPRINT, propDebugPrint);
 	OBJSetMethodHandler(objMethod_CONSTRUCTION_FINALIZER, propConstructFinalize);
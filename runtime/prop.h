@@ -48,8 +48,12 @@ BEGINinterface(prop) /* name must also be changed in ENDinterface macro! */
 	rsRetVal (*AddRef)(prop_t *pThis);
 	rsRetVal (*CreateStringProp)(prop_t **ppThis, const uchar* psz, const int len);
 	rsRetVal (*CreateOrReuseStringProp)(prop_t **ppThis, const uchar *psz, const int len);
+	rsRetVal (*InternStringProp)(prop_t **ppThis, const uchar *psz, const int len);
 ENDinterface(prop)
-#define propCURR_IF_VERSION 1 /* increment whenever you change the interface structure! */
+#define propCURR_IF_VERSION 2 /* increment whenever you change the interface structure! */
+/* Changes
+ * v2, 2014-06-??: added InternStringProp()
+ */
 
 
 /* get classic c-style string */
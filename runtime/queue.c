@@ -37,6 +37,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 #include <signal.h>
 #include <pthread.h>
@@ -44,7 +45,11 @@
 #include <unistd.h>
 #include <sys/stat.h>	 /* required for HP UX */
 #include <time.h>
+#include <sys/time.h>
 #include <errno.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 
 #include "rsyslog.h"
 #include "queue.h"
@@ -54,16 +59,18 @@
 #include "wtp.h"
 #include "wti.h"
 #include "msg.h"
+#include "prop.h"
 #include "atomic.h"
 #include "errmsg.h"
 #include "datetime.h"
 #include "unicode-helper.h"
 #include "statsobj.h"
+#include "trace.h"
+#include "rsprobe.h"
+#include "memacct.h"
 #include "parserif.h"
-
-#ifdef OS_SOLARIS
-#	include <sched.h>
-#endif
+#include "cmpr.h"
+#include "parser.h"
 
 /* static data */
 DEFobjStaticHelpers
@@ -72,6 +79,11 @@ DEFobjCurrIf(strm)
 DEFobjCurrIf(errmsg)
 DEFobjCurrIf(datetime)
 DEFobjCurrIf(statsobj)
+DEFobjCurrIf(cmpr)
+DEFobjCurrIf(parser)
+
+static sbool bCmprIfLoaded = 0;	/* cmpr interface is only obtained if actually used */
+static sbool bParserIfLoaded = 0; /* parser interface, only needed for property shard keys */
 
 /* forward-definitions */
 static inline rsRetVal doEnqSingleObj(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg);
@@ -80,13 +92,22 @@ static rsRetVal RateLimiter(qqueue_t *pThis);
 static int qqueueChkStopWrkrDA(qqueue_t *pThis);
 static rsRetVal GetDeqBatchSize(qqueue_t *pThis, int *pVal);
 static rsRetVal ConsumerDA(qqueue_t *pThis, wti_t *pWti);
+static rsRetVal qqueueEnqMsgDeferSync(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg, uint64 *pSyncPos);
+static void qqueueWaitGroupSync(qqueue_t *pThis, uint64 syncPos);
 static rsRetVal batchProcessed(qqueue_t *pThis, wti_t *pWti);
 static rsRetVal qqueueMultiEnqObjNonDirect(qqueue_t *pThis, multi_submit_t *pMultiSub);
 static rsRetVal qqueueMultiEnqObjDirect(qqueue_t *pThis, multi_submit_t *pMultiSub);
+static rsRetVal qqueueMultiEnqObjSharded(qqueue_t *pThis, multi_submit_t *pMultiSub);
+static rsRetVal StartShards(qqueue_t *pThis);
+static void DestructShards(qqueue_t *pThis);
+#ifdef HAVE_LOCKFREE_QUEUE
+static rsRetVal qqueueMultiEnqObjLockFree(qqueue_t *pThis, multi_submit_t *pMultiSub);
+#endif
 static rsRetVal qAddDirect(qqueue_t *pThis, msg_t *pMsg);
 static rsRetVal qDestructDirect(qqueue_t __attribute__((unused)) *pThis);
 static rsRetVal qConstructDirect(qqueue_t __attribute__((unused)) *pThis);
 static rsRetVal qDestructDisk(qqueue_t *pThis);
+static rsRetVal qDeqDiskFromStrm(qqueue_t *pThis, strm_t *pStrm, msg_t **ppMsg);
 rsRetVal qqueueSetSpoolDir(qqueue_t *pThis, uchar *pszSpoolDir, int lenSpoolDir);
 
 /* some constants for queuePersist () */
@@ -99,28 +120,57 @@ static struct cnfparamdescr cnfpdescr[] = {
 	{ "queue.spooldirectory", eCmdHdlrGetWord, 0 },
 	{ "queue.size", eCmdHdlrSize, 0 },
 	{ "queue.dequeuebatchsize", eCmdHdlrInt, 0 },
+	{ "queue.mindequeuebatchsize", eCmdHdlrInt, 0 },
+	{ "queue.adaptivebatchsize", eCmdHdlrBinary, 0 },
+	{ "queue.maxbatchtime", eCmdHdlrInt, 0 },
+	{ "queue.shards", eCmdHdlrInt, 0 },
+	{ "queue.shardkey", eCmdHdlrGetWord, 0 },
+	{ "queue.ordered", eCmdHdlrBinary, 0 },
+	{ "queue.lanes", eCmdHdlrInt, 0 },
+	{ "queue.lanekey", eCmdHdlrGetWord, 0 },
 	{ "queue.maxdiskspace", eCmdHdlrSize, 0 },
 	{ "queue.highwatermark", eCmdHdlrInt, 0 },
 	{ "queue.lowwatermark", eCmdHdlrInt, 0 },
 	{ "queue.fulldelaymark", eCmdHdlrInt, 0 },
 	{ "queue.lightdelaymark", eCmdHdlrInt, 0 },
 	{ "queue.discardmark", eCmdHdlrInt, 0 },
+	{ "queue.maxmemory", eCmdHdlrSize, 0 },
+	{ "queue.highwatermarkbytes", eCmdHdlrSize, 0 },
+	{ "queue.lowwatermarkbytes", eCmdHdlrSize, 0 },
+	{ "queue.fulldelaymarkbytes", eCmdHdlrSize, 0 },
+	{ "queue.lightdelaymarkbytes", eCmdHdlrSize, 0 },
+	{ "queue.discardmarkbytes", eCmdHdlrSize, 0 },
 	{ "queue.discardseverity", eCmdHdlrFacility, 0 },
 	{ "queue.checkpointinterval", eCmdHdlrInt, 0 },
 	{ "queue.syncqueuefiles", eCmdHdlrBinary, 0 },
+	{ "queue.binaryformat", eCmdHdlrBinary, 0 },
+	{ "queue.syncinterval", eCmdHdlrInt, 0 },
+	{ "queue.syncmaxbytes", eCmdHdlrSize, 0 },
+	{ "queue.mmap", eCmdHdlrBinary, 0 },
+	{ "queue.residencystats", eCmdHdlrBinary, 0 },
+	{ "queue.hugepages", eCmdHdlrBinary, 0 },
+	{ "queue.prefault", eCmdHdlrBinary, 0 },
+	{ "queue.mlock", eCmdHdlrBinary, 0 },
+	{ "queue.targetresidency", eCmdHdlrPositiveInt, 0 },
 	{ "queue.type", eCmdHdlrQueueType, 0 },
 	{ "queue.workerthreads", eCmdHdlrInt, 0 },
+	{ "queue.da.workerthreads", eCmdHdlrPositiveInt, 0 },
 	{ "queue.timeoutshutdown", eCmdHdlrInt, 0 },
 	{ "queue.timeoutactioncompletion", eCmdHdlrInt, 0 },
 	{ "queue.timeoutenqueue", eCmdHdlrInt, 0 },
 	{ "queue.timeoutworkerthreadshutdown", eCmdHdlrInt, 0 },
 	{ "queue.workerthreadminimummessages", eCmdHdlrInt, 0 },
+	{ "queue.workerthreadcpuset", eCmdHdlrGetWord, 0 },
 	{ "queue.maxfilesize", eCmdHdlrSize, 0 },
 	{ "queue.saveonshutdown", eCmdHdlrBinary, 0 },
 	{ "queue.dequeueslowdown", eCmdHdlrInt, 0 },
 	{ "queue.dequeuetimebegin", eCmdHdlrInt, 0 },
 	{ "queue.dequeuetimeend", eCmdHdlrInt, 0 },
-	{ "queue.cry.provider", eCmdHdlrGetWord, 0 }
+	{ "queue.cry.provider", eCmdHdlrGetWord, 0 },
+	{ "queue.compression.algorithm", eCmdHdlrGetWord, 0 },
+	{ "queue.compression.level", eCmdHdlrInt, 0 },
+	{ "queue.compression.dictionary", eCmdHdlrString, 0 },
+	{ "queue.compression.threshold", eCmdHdlrSize, 0 }
 };
 static struct cnfparamblk pblk =
 	{ CNFPARAMBLK_VERSION,
@@ -191,7 +241,7 @@ static inline rsRetVal tdlPop(qqueue_t *pQueue)
  * structure, populates it with the values provided and links the new
  * element into the correct place inside the list.
  */
-static inline rsRetVal tdlAdd(qqueue_t *pQueue, qDeqID deqID, int nElemDeq)
+static inline rsRetVal tdlAdd(qqueue_t *pQueue, qDeqID deqID, int nElemDeq, int64 nBytesDeq)
 {
 	toDeleteLst_t *pNew;
 	toDeleteLst_t *pPrev;
@@ -203,6 +253,7 @@ static inline rsRetVal tdlAdd(qqueue_t *pQueue, qDeqID deqID, int nElemDeq)
 	CHKmalloc(pNew = MALLOC(sizeof(toDeleteLst_t)));
 	pNew->deqID = deqID;
 	pNew->nElemDeq = nElemDeq;
+	pNew->nBytesDeq = nBytesDeq;
 
 	/* now find right spot */
 	for(  pPrev = pQueue->toDeleteLst
@@ -244,6 +295,9 @@ getQueueTypeName(queueType_t t)
 	case QUEUETYPE_DIRECT: 
 		r = "Direct";
 		break;
+	case QUEUETYPE_LOCKFREE: 
+		r = "LockFree";
+		break;
 	default:
 		r = "invalid/unknown queue mode";
 		break;
@@ -259,17 +313,37 @@ qqueueDbgPrint(qqueue_t *pThis)
 		(pThis->pszFilePrefix == NULL) ? "[NONE]" : (char*)pThis->pszFilePrefix);
 	dbgoprint((obj_t*) pThis, "queue.size: %d\n", pThis->iMaxQueueSize);
 	dbgoprint((obj_t*) pThis, "queue.dequeuebatchsize: %d\n", pThis->iDeqBatchSize);
+	dbgoprint((obj_t*) pThis, "queue.mindequeuebatchsize: %d\n", pThis->iMinDeqBatchSize);
+	dbgoprint((obj_t*) pThis, "queue.adaptivebatchsize: %d\n", pThis->bAdaptiveBatch);
+	dbgoprint((obj_t*) pThis, "queue.maxbatchtime: %d\n", pThis->iMaxBatchTime);
 	dbgoprint((obj_t*) pThis, "queue.maxdiskspace: %lld\n", pThis->sizeOnDiskMax);
 	dbgoprint((obj_t*) pThis, "queue.highwatermark: %d\n", pThis->iHighWtrMrk);
 	dbgoprint((obj_t*) pThis, "queue.lowwatermark: %d\n", pThis->iLowWtrMrk);
 	dbgoprint((obj_t*) pThis, "queue.fulldelaymark: %d\n", pThis->iFullDlyMrk);
 	dbgoprint((obj_t*) pThis, "queue.lightdelaymark: %d\n", pThis->iLightDlyMrk);
 	dbgoprint((obj_t*) pThis, "queue.discardmark: %d\n", pThis->iDiscardMrk);
+	dbgoprint((obj_t*) pThis, "queue.maxmemory: %lld\n", pThis->iMaxMemory);
+	dbgoprint((obj_t*) pThis, "queue.highwatermarkbytes: %lld\n", pThis->iHighWtrMrkBytes);
+	dbgoprint((obj_t*) pThis, "queue.lowwatermarkbytes: %lld\n", pThis->iLowWtrMrkBytes);
+	dbgoprint((obj_t*) pThis, "queue.fulldelaymarkbytes: %lld\n", pThis->iFullDlyMrkBytes);
+	dbgoprint((obj_t*) pThis, "queue.lightdelaymarkbytes: %lld\n", pThis->iLightDlyMrkBytes);
+	dbgoprint((obj_t*) pThis, "queue.discardmarkbytes: %lld\n", pThis->iDiscardMrkBytes);
 	dbgoprint((obj_t*) pThis, "queue.discardseverity: %d\n", pThis->iDiscardSeverity);
 	dbgoprint((obj_t*) pThis, "queue.checkpointinterval: %d\n", pThis->iPersistUpdCnt);
 	dbgoprint((obj_t*) pThis, "queue.syncqueuefiles: %d\n", pThis->bSyncQueueFiles);
+	dbgoprint((obj_t*) pThis, "queue.binaryformat: %d\n", pThis->bBinaryFormat);
+	dbgoprint((obj_t*) pThis, "queue.syncinterval: %d\n", pThis->iSyncInterval);
+	dbgoprint((obj_t*) pThis, "queue.syncmaxbytes: %lld\n", pThis->iSyncMaxBytes);
+	dbgoprint((obj_t*) pThis, "queue.mmap: %d\n", pThis->bMmap);
+	dbgoprint((obj_t*) pThis, "queue.residencystats: %d\n", pThis->bResidencyStats);
+	dbgoprint((obj_t*) pThis, "queue.hugepages/prefault/mlock: %d/%d/%d\n",
+		  !!(pThis->iMemFlags & SRPAGES_HUGE), !!(pThis->iMemFlags & SRPAGES_PREFAULT),
+		  !!(pThis->iMemFlags & SRPAGES_MLOCK));
+	dbgoprint((obj_t*) pThis, "queue.targetresidency: %d\n", pThis->iTargetResidency);
+	dbgoprint((obj_t*) pThis, "queue.lanes: %d\n", pThis->iNumLanes);
 	dbgoprint((obj_t*) pThis, "queue.type: %d [%s]\n", pThis->qType, getQueueTypeName(pThis->qType));
 	dbgoprint((obj_t*) pThis, "queue.workerthreads: %d\n", pThis->iNumWorkerThreads);
+	dbgoprint((obj_t*) pThis, "queue.da.workerthreads: %d\n", pThis->iDAWorkerThreads);
 	dbgoprint((obj_t*) pThis, "queue.timeoutshutdown: %d\n", pThis->toQShutdown);
 	dbgoprint((obj_t*) pThis, "queue.timeoutactioncompletion: %d\n", pThis->toActShutdown);
 	dbgoprint((obj_t*) pThis, "queue.timeoutenqueue: %d\n", pThis->toEnq);
@@ -278,6 +352,8 @@ qqueueDbgPrint(qqueue_t *pThis)
 	dbgoprint((obj_t*) pThis, "queue.maxfilesize: %lld\n", pThis->iMaxFileSize);
 	dbgoprint((obj_t*) pThis, "queue.saveonshutdown: %d\n", pThis->bSaveOnShutdown);
 	dbgoprint((obj_t*) pThis, "queue.dequeueslowdown: %d\n", pThis->iDeqSlowdown);
+	dbgoprint((obj_t*) pThis, "linger: min %d elements, max %dms\n", pThis->iLingerMin,
+		  pThis->iLingerTime);
 	dbgoprint((obj_t*) pThis, "queue.dequeuetimebegin: %d\n", pThis->iDeqtWinFromHr);
 	dbgoprint((obj_t*) pThis, "queuedequeuetimend.: %d\n", pThis->iDeqtWinToHr);
 }
@@ -305,6 +381,209 @@ getLogicalQueueSize(qqueue_t *pThis)
 }
 
 
+/* estimate the memory a message occupies while it sits inside an in-memory
+ * queue: the msg object, the raw message and the JSON tree. Note that the
+ * value must be the same at enqueue and dequeue time, so msg.c computes it
+ * once and keeps it (see MsgGetMemSize()).
+ */
+static inline int64
+qqueueMsgMemSize(msg_t *pMsg)
+{
+	return MsgGetMemSize(pMsg);
+}
+
+
+/* check if the memory used by the queue is at or above a byte-based mark.
+ * A mark of zero means the mark is not active. As with the size checks,
+ * the result may be outdated if the mutex is not locked, which is acceptable
+ * for watermark checks.
+ */
+static inline int
+qqueueMemAboveMrk(qqueue_t *pThis, int64 mrk)
+{
+	return mrk > 0 && (int64) pThis->iMemSize >= mrk;
+}
+
+
+/* get the current (if possible monotonic) time in microseconds, used for
+ * measurements only.
+ */
+static inline uint64
+qqueueTimeUs(void)
+{
+	struct timespec t;
+#	if _POSIX_TIMERS <= 0
+	struct timeval tv;
+#	endif
+
+#	if _POSIX_TIMERS > 0
+#	ifdef CLOCK_MONOTONIC
+	clock_gettime(CLOCK_MONOTONIC, &t);
+#	else
+	clock_gettime(CLOCK_REALTIME, &t);
+#	endif
+#	else
+	gettimeofday(&tv, NULL);
+	t.tv_sec = tv.tv_sec;
+	t.tv_nsec = tv.tv_usec * 1000;
+#	endif
+	return (uint64) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+
+/* get the current time for the residency stats. If we do not gather them,
+ * 0 is returned without querying the clock, so that inactive stats do not
+ * cost us a system call per message. A zero enqueue time is never used as
+ * sample. The residency controller needs the times even if impstats is
+ * not active.
+ */
+static inline uint64
+qqueueResTime(qqueue_t *pThis)
+{
+	if(!pThis->bResidencyStats || (!GatherStats && pThis->iTargetResidency == 0))
+		return 0;
+	return qqueueTimeUs();
+}
+
+
+/* add the residency of the element dequeued last to the residency histogram.
+ * The histogram is log2-bucketed, so recording is just a couple of shifts.
+ * Must be called with the queue mutex locked.
+ */
+static inline void
+qqueueResRecord(qqueue_t *pThis, uint64 tNow)
+{
+	uint64 tRes;
+	int i;
+
+	if(pThis->tDeqEnq == 0 || tNow == 0)
+		return;
+	tRes = (tNow > pThis->tDeqEnq) ? tNow - pThis->tDeqEnq : 0;
+	for(i = 0 ; i < QUEUE_RES_BUCKETS - 1 && (tRes >> i) != 0 ; ++i)
+		/*JUST SEARCH*/;
+	++pThis->resHist.bucket[i];
+	++pThis->resHist.nSamples;
+	if(tRes > pThis->ctrResMax)
+		pThis->ctrResMax = tRes;
+	pThis->resCtl.sumRes += tRes;
+	++pThis->resCtl.nRes;
+}
+
+
+/* compute the value below which pct percent of the samples are. As we only
+ * know buckets, the upper bound of the bucket is returned.
+ */
+static inline intctr_t
+qqueueResPercentile(qqueue_t *pThis, int pct)
+{
+	uint64 nNeeded;
+	uint64 nSeen = 0;
+	int i;
+
+	nNeeded = (pThis->resHist.nSamples * pct + 99) / 100;
+	for(i = 0 ; i < QUEUE_RES_BUCKETS - 1 ; ++i) {
+		nSeen += pThis->resHist.bucket[i];
+		if(nSeen >= nNeeded)
+			break;
+	}
+	return (i == 0) ? 0 : ((intctr_t) 1 << i) - 1;
+}
+
+
+/* update the residency percentile counters after a batch has been dequeued.
+ * To make the counters follow the current situation and not the whole
+ * lifetime of the queue, all buckets are halved whenever a certain number
+ * of samples has been collected. Must be called with the queue mutex locked.
+ */
+#define QUEUE_RES_DECAY_SAMPLES 65536
+static inline void
+qqueueResUpdate(qqueue_t *pThis)
+{
+	int i;
+
+	if(pThis->resHist.nSamples == 0)
+		return;
+	if(pThis->resHist.nSamples >= QUEUE_RES_DECAY_SAMPLES) {
+		pThis->resHist.nSamples = 0;
+		for(i = 0 ; i < QUEUE_RES_BUCKETS ; ++i) {
+			pThis->resHist.bucket[i] /= 2;
+			pThis->resHist.nSamples += pThis->resHist.bucket[i];
+		}
+		if(pThis->resHist.nSamples == 0)
+			return;
+	}
+	pThis->ctrResP50 = qqueueResPercentile(pThis, 50);
+	pThis->ctrResP99 = qqueueResPercentile(pThis, 99);
+}
+
+
+/* residency controller: once per interval, compare the average residency
+ * of the messages dequeued during the interval with queue.targetResidency.
+ * Above the target, one more worker is permitted - unless the worker added
+ * last did not increase the total throughput (it only added contention),
+ * in which case it is retired again. Below half the target, a worker is
+ * retired. The band in between and a hold time after each change provide
+ * the hysteresis. The actual start/stop is done by the wtp, see
+ * wtpSetWorkerCap(). Must be called with the queue mutex locked.
+ */
+#define QUEUE_RESCTL_INTERVAL 1000000 /* us */
+#define QUEUE_RESCTL_HOLD 2	/* intervals to wait after each change */
+static inline void
+qqueueResCtl(qqueue_t *pThis, uint64 tNow)
+{
+	uint64 avgRes;
+	uint64 thru;
+	uint64 target;
+	int nWrkr;
+	int dir = 0;
+
+	if(pThis->iTargetResidency == 0 || tNow == 0
+	   || tNow - pThis->resCtl.tLast < QUEUE_RESCTL_INTERVAL)
+		return;
+
+	nWrkr = ATOMIC_FETCH_32BIT(&pThis->pWtpReg->iCurNumWrkThrd, &pThis->pWtpReg->mutCurNumWrkThrd);
+	if(nWrkr < 1)
+		nWrkr = 1;
+	avgRes = (pThis->resCtl.nRes == 0) ? 0 : pThis->resCtl.sumRes / pThis->resCtl.nRes;
+	thru = pThis->resCtl.nRes * 1000000 / (tNow - pThis->resCtl.tLast) / nWrkr;
+	target = (uint64) pThis->iTargetResidency * 1000;
+
+	if(pThis->resCtl.nHold > 0) {
+		--pThis->resCtl.nHold;
+	} else if(avgRes > target) {
+		if(   pThis->resCtl.lastDir > 0 && nWrkr > 1
+		   && thru * nWrkr <= pThis->resCtl.thruPrev * (nWrkr - 1) * 105 / 100) {
+			dir = -1; /* more workers do not help */
+		} else if(pThis->resCtl.nCap < pThis->iNumWorkerThreads) {
+			dir = 1;
+		}
+	} else if(avgRes < target / 2 && pThis->resCtl.nCap > 1) {
+		dir = -1;
+	}
+
+	if(dir != 0) {
+		pThis->resCtl.nCap += dir;
+		pThis->resCtl.nHold = QUEUE_RESCTL_HOLD;
+		pThis->ctrResCtlWorkers = pThis->resCtl.nCap;
+		wtpSetWorkerCap(pThis->pWtpReg, pThis->resCtl.nCap);
+		if(dir > 0) {
+			++pThis->ctrResCtlAdded;
+			wtpAdviseMaxWorkers(pThis->pWtpReg, pThis->resCtl.nCap);
+		} else {
+			++pThis->ctrResCtlRetired;
+		}
+		DBGOPRINT((obj_t*) pThis, "residency controller: avg residency %llu us, "
+			  "%llu msgs/s per worker, now %d worker(s)\n", (unsigned long long) avgRes,
+			  (unsigned long long) thru, pThis->resCtl.nCap);
+	}
+	pThis->resCtl.lastDir = dir;
+	pThis->resCtl.thruPrev = thru;
+	pThis->resCtl.sumRes = 0;
+	pThis->resCtl.nRes = 0;
+	pThis->resCtl.tLast = tNow;
+}
+
+
 
 /* This function drains the queue in cases where this needs to be done. The most probable
  * reason is a HUP which needs to discard data (because the queue is configured to be lossy).
@@ -324,12 +603,14 @@ static inline void queueDrain(qqueue_t *pThis)
 	DBGOPRINT((obj_t*) pThis, "queue (type %d) will lose %d messages, destroying...\n", pThis->qType, pThis->iQueueSize);
 	/* iQueueSize is not decremented by qDel(), so we need to do it ourselves */
 	while(ATOMIC_DEC_AND_FETCH(&pThis->iQueueSize, &pThis->mutQueueSize) > 0) {
-		pThis->qDeq(pThis, &pMsg);
+		while(pThis->qDeq(pThis, &pMsg) == RS_RET_RETRY)
+			/* lockFree slot not yet published, wait for the producer */;
 		if(pMsg != NULL) {
 			msgDestruct(&pMsg);
 		}
 		pThis->qDel(pThis);
 	}
+	pThis->iMemSize = 0;
 	ENDfunc
 }
 
@@ -350,12 +631,19 @@ qqueueAdviseMaxWorkers(qqueue_t *pThis)
 	ISOBJ_TYPE_assert(pThis, qqueue);
 
 	if(!pThis->bEnqOnly) {
-		if(pThis->bIsDA && getLogicalQueueSize(pThis) >= pThis->iHighWtrMrk) {
+		if(pThis->bIsDA && (getLogicalQueueSize(pThis) >= pThis->iHighWtrMrk
+				    || qqueueMemAboveMrk(pThis, pThis->iHighWtrMrkBytes)
+				    || (getLogicalQueueSize(pThis) > 0 && memacctOverLimit()))) {
 			DBGOPRINT((obj_t*) pThis, "(re)activating DA worker\n");
 			wtpAdviseMaxWorkers(pThis->pWtpDA, 1); /* disk queues have always one worker */
 		}
 		if(getLogicalQueueSize(pThis) == 0) {
 			iMaxWorkers = 0;
+		} else if(pThis->iTargetResidency > 0) {
+			iMaxWorkers = pThis->resCtl.nCap; /* the residency controller decides */
+		} else if(pThis->qType == QUEUETYPE_DISK && pThis->iNumWorkerThreads > 1) {
+			/* parallel DA drain: one more worker for each full batch */
+			iMaxWorkers = getLogicalQueueSize(pThis) / pThis->iDeqBatchSize + 1;
 		} else if(pThis->qType == QUEUETYPE_DISK || pThis->iMinMsgsPerWrkr == 0) {
 			iMaxWorkers = 1;
 		} else {
@@ -403,8 +691,12 @@ StartDA(qqueue_t *pThis)
 
 	ISOBJ_TYPE_assert(pThis, qqueue);
 
-	/* create message queue */
-	CHKiRet(qqueueConstruct(&pThis->pqDA, QUEUETYPE_DISK , 1, 0, pThis->pConsumer));
+	/* create message queue. By default, it has a single worker, so that
+	 * messages are drained from disk in order. With more workers, batches
+	 * are processed in parallel and thus may be out of order.
+	 */
+	CHKiRet(qqueueConstruct(&pThis->pqDA, QUEUETYPE_DISK,
+		(pThis->iDAWorkerThreads > 1) ? pThis->iDAWorkerThreads : 1, 0, pThis->pConsumer));
 
 	/* give it a name */
 	snprintf((char*) pszDAQName, sizeof(pszDAQName)/sizeof(uchar), "%s[DA]", obj.GetName((obj_t*) pThis));
@@ -423,6 +715,14 @@ StartDA(qqueue_t *pThis)
 	CHKiRet(qqueueSetSpoolDir(pThis->pqDA, pThis->pszSpoolDir, pThis->lenSpoolDir));
 	CHKiRet(qqueueSetiPersistUpdCnt(pThis->pqDA, pThis->iPersistUpdCnt));
 	CHKiRet(qqueueSetbSyncQueueFiles(pThis->pqDA, pThis->bSyncQueueFiles));
+	CHKiRet(qqueueSetbBinaryFormat(pThis->pqDA, pThis->bBinaryFormat));
+	CHKiRet(qqueueSetiSyncInterval(pThis->pqDA, pThis->iSyncInterval));
+	CHKiRet(qqueueSetiSyncMaxBytes(pThis->pqDA, pThis->iSyncMaxBytes));
+	CHKiRet(qqueueSetbMmap(pThis->pqDA, pThis->bMmap));
+	pThis->pqDA->iCmprAlgo = pThis->iCmprAlgo;
+	pThis->pqDA->iCmprLevel = pThis->iCmprLevel;
+	if(pThis->pszCmprDict != NULL)
+		CHKmalloc(pThis->pqDA->pszCmprDict = ustrdup(pThis->pszCmprDict));
 	CHKiRet(qqueueSettoActShutdown(pThis->pqDA, pThis->toActShutdown));
 	CHKiRet(qqueueSettoEnq(pThis->pqDA, pThis->toEnq));
 	CHKiRet(qqueueSetiDeqtWinFromHr(pThis->pqDA, pThis->iDeqtWinFromHr));
@@ -512,6 +812,42 @@ finalize_it:
  * queue instance object.
  */
 
+/* allocate the storage of FixedArray and LockFree queues. With
+ * queue.hugepages, queue.prefault or queue.mlock it is mapped via
+ * srAllocPages(), so that large queues do not suffer from page faults and
+ * TLB misses when a burst first touches them. If not all of these could
+ * be honored, we tell the user (if bReport is set) but carry on.
+ */
+static void *
+qAllocStorage(qqueue_t *pThis, size_t *pLen, const sbool bReport)
+{
+	void *p;
+	int flagsDone;
+
+	if(pThis->iMemFlags == 0)
+		return MALLOC(*pLen);
+	if((p = srAllocPages(pLen, pThis->iMemFlags, &flagsDone)) == NULL)
+		return NULL;
+	if(bReport && flagsDone != pThis->iMemFlags) {
+		errmsg.LogError(0, NO_ERRCODE, "queue \"%s\": storage is not%s%s; check "
+				"vm.nr_hugepages and the memlock limit",
+				obj.GetName((obj_t*) pThis),
+				((pThis->iMemFlags & ~flagsDone) & SRPAGES_HUGE) ? " in huge pages" : "",
+				((pThis->iMemFlags & ~flagsDone) & SRPAGES_MLOCK) ? " locked" : "");
+	}
+	return p;
+}
+
+static void
+qFreeStorage(qqueue_t *pThis, void *p, size_t len)
+{
+	if(pThis->iMemFlags == 0)
+		free(p);
+	else
+		srFreePages(p, len);
+}
+
+
 /* -------------------- fixed array -------------------- */
 static rsRetVal qConstructFixedArray(qqueue_t *pThis)
 {
@@ -522,9 +858,15 @@ static rsRetVal qConstructFixedArray(qqueue_t *pThis)
 	if(pThis->iMaxQueueSize == 0)
 		ABORT_FINALIZE(RS_RET_QSIZE_ZERO);
 
-	if((pThis->tVars.farray.pBuf = MALLOC(sizeof(void *) * pThis->iMaxQueueSize)) == NULL) {
+	pThis->tVars.farray.lenBuf = sizeof(void *) * pThis->iMaxQueueSize;
+	if((pThis->tVars.farray.pBuf = qAllocStorage(pThis, &pThis->tVars.farray.lenBuf, 1)) == NULL) {
 		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
+	if(pThis->bResidencyStats) {
+		pThis->tVars.farray.lenEnqTime = sizeof(uint64) * pThis->iMaxQueueSize;
+		CHKmalloc(pThis->tVars.farray.pEnqTime =
+			qAllocStorage(pThis, &pThis->tVars.farray.lenEnqTime, 0));
+	}
 
 	pThis->tVars.farray.deqhead = 0;
 	pThis->tVars.farray.head = 0;
@@ -544,7 +886,9 @@ static rsRetVal qDestructFixedArray(qqueue_t *pThis)
 	ASSERT(pThis != NULL);
 
 	queueDrain(pThis); /* discard any remaining queue entries */
-	free(pThis->tVars.farray.pBuf);
+	qFreeStorage(pThis, pThis->tVars.farray.pBuf, pThis->tVars.farray.lenBuf);
+	if(pThis->tVars.farray.pEnqTime != NULL)
+		qFreeStorage(pThis, pThis->tVars.farray.pEnqTime, pThis->tVars.farray.lenEnqTime);
 
 	RETiRet;
 }
@@ -556,6 +900,8 @@ static rsRetVal qAddFixedArray(qqueue_t *pThis, msg_t* in)
 
 	ASSERT(pThis != NULL);
 	pThis->tVars.farray.pBuf[pThis->tVars.farray.tail] = in;
+	if(pThis->tVars.farray.pEnqTime != NULL)
+		pThis->tVars.farray.pEnqTime[pThis->tVars.farray.tail] = qqueueResTime(pThis);
 	pThis->tVars.farray.tail++;
 	if (pThis->tVars.farray.tail == pThis->iMaxQueueSize)
 		pThis->tVars.farray.tail = 0;
@@ -570,6 +916,8 @@ static rsRetVal qDeqFixedArray(qqueue_t *pThis, msg_t **out)
 
 	ASSERT(pThis != NULL);
 	*out = (void*) pThis->tVars.farray.pBuf[pThis->tVars.farray.deqhead];
+	if(pThis->tVars.farray.pEnqTime != NULL)
+		pThis->tDeqEnq = pThis->tVars.farray.pEnqTime[pThis->tVars.farray.deqhead];
 
 	pThis->tVars.farray.deqhead++;
 	if (pThis->tVars.farray.deqhead == pThis->iMaxQueueSize)
@@ -634,6 +982,7 @@ static rsRetVal qAddLinkedList(qqueue_t *pThis, msg_t* pMsg)
 
 	pEntry->pNext = NULL;
 	pEntry->pMsg = pMsg;
+	pEntry->tEnq = qqueueResTime(pThis);
 
 	if(pThis->tVars.linklist.pDelRoot == NULL) {
 		pThis->tVars.linklist.pDelRoot = pThis->tVars.linklist.pDeqRoot = pThis->tVars.linklist.pLast = pEntry;
@@ -658,6 +1007,7 @@ static rsRetVal qDeqLinkedList(qqueue_t *pThis, msg_t **ppMsg)
 
 	pEntry = pThis->tVars.linklist.pDeqRoot;
 	*ppMsg = pEntry->pMsg;
+	pThis->tDeqEnq = pEntry->tEnq;
 	pThis->tVars.linklist.pDeqRoot = pEntry->pNext;
 
 	RETiRet;
@@ -683,6 +1033,313 @@ static rsRetVal qDelLinkedList(qqueue_t *pThis)
 }
 
 
+/* -------------------- linked list with priority lanes -------------------- */
+/* This is a linked list queue, where elements are sorted into lanes when they
+ * are enqueued. Lane 0 has the highest priority, and dequeue always takes the
+ * oldest element of the highest priority non-empty lane. So urgent messages
+ * do not need to wait behind a large backlog of less important ones. Inside
+ * a lane, order is preserved.
+ * Deletion must happen in dequeue order, so dequeued elements are moved to the
+ * regular list, from which qDelLinkedList() removes them.
+ */
+
+/* get the severity of a message. If the message is not yet parsed, we only
+ * extract the PRI, which is all we need here (full parsing is still done by
+ * the main queue consumer).
+ */
+static inline int
+qqueueMsgSeverity(msg_t *pMsg)
+{
+	uchar *p;
+	int pri;
+	int i;
+
+	if(!(pMsg->msgFlags & NEEDS_PARSING))
+		return pMsg->iSeverity;
+	p = pMsg->pszRawMsg;
+	if(pMsg->iLenRawMsg < 3 || p[0] != '<')
+		return pMsg->iSeverity;
+	pri = 0;
+	for(i = 1 ; i < 5 && i < pMsg->iLenRawMsg && isdigit(p[i]) ; ++i)
+		pri = pri * 10 + p[i] - '0';
+	if(i == 1 || i == pMsg->iLenRawMsg || p[i] != '>')
+		return pMsg->iSeverity;
+	return pri & 0x07;
+}
+
+
+/* select the lane for a message. By default, severities are evenly spread
+ * over the lanes. If a lane property is configured, its (numerical) value is
+ * used as lane number instead. Values that are not numbers or are out of range
+ * go to the lowest priority lane.
+ */
+static inline int
+qqueueGetLane(qqueue_t *pThis, msg_t *pMsg)
+{
+	uchar *pszVal;
+	rs_size_t lenVal;
+	unsigned short bMustBeFreed = 0;
+	char *pEnd;
+	long lane;
+
+	if(pThis->pLaneProp == NULL)
+		return qqueueMsgSeverity(pMsg) * pThis->iNumLanes / 8;
+
+	pszVal = MsgGetProp(pMsg, NULL, pThis->pLaneProp, &lenVal, &bMustBeFreed, NULL);
+	lane = strtol((char*) pszVal, &pEnd, 10);
+	if(pEnd == (char*) pszVal || lane < 0 || lane >= pThis->iNumLanes)
+		lane = pThis->iNumLanes - 1;
+	if(bMustBeFreed)
+		free(pszVal);
+	return (int) lane;
+}
+
+
+static rsRetVal qConstructLanes(qqueue_t *pThis)
+{
+	int i;
+	DEFiRet;
+
+	CHKiRet(qConstructLinkedList(pThis));
+	for(i = 0 ; i < QUEUE_MAX_LANES ; ++i) {
+		pThis->tVars.linklist.pLaneRoot[i] = NULL;
+		pThis->tVars.linklist.pLaneLast[i] = NULL;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal qAddLanes(qqueue_t *pThis, msg_t* pMsg)
+{
+	qLinkedList_t *pEntry;
+	int lane;
+	DEFiRet;
+
+	CHKmalloc((pEntry = (qLinkedList_t*) MALLOC(sizeof(qLinkedList_t))));
+
+	pEntry->pNext = NULL;
+	pEntry->pMsg = pMsg;
+	pEntry->tEnq = qqueueResTime(pThis);
+
+	lane = qqueueGetLane(pThis, pMsg);
+	if(pThis->tVars.linklist.pLaneRoot[lane] == NULL) {
+		pThis->tVars.linklist.pLaneRoot[lane] = pEntry;
+	} else {
+		pThis->tVars.linklist.pLaneLast[lane]->pNext = pEntry;
+	}
+	pThis->tVars.linklist.pLaneLast[lane] = pEntry;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* note: the dequeued element is appended to the regular list, so
+ * that qDelLinkedList() can delete it later.
+ */
+static rsRetVal qDeqLanes(qqueue_t *pThis, msg_t **ppMsg)
+{
+	qLinkedList_t *pEntry;
+	int lane;
+	DEFiRet;
+
+	for(lane = 0 ; lane < pThis->iNumLanes ; ++lane) {
+		if(pThis->tVars.linklist.pLaneRoot[lane] != NULL)
+			break;
+	}
+	if(lane == pThis->iNumLanes) {
+		*ppMsg = NULL; /* may happen during queueDrain() */
+		FINALIZE;
+	}
+
+	pEntry = pThis->tVars.linklist.pLaneRoot[lane];
+	pThis->tVars.linklist.pLaneRoot[lane] = pEntry->pNext;
+	if(pEntry->pNext == NULL)
+		pThis->tVars.linklist.pLaneLast[lane] = NULL;
+
+	pEntry->pNext = NULL;
+	if(pThis->tVars.linklist.pDelRoot == NULL) {
+		pThis->tVars.linklist.pDelRoot = pEntry;
+	} else {
+		pThis->tVars.linklist.pLast->pNext = pEntry;
+	}
+	pThis->tVars.linklist.pLast = pEntry;
+
+	*ppMsg = pEntry->pMsg;
+	pThis->tDeqEnq = pEntry->tEnq;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* -------------------- lock free ring buffer -------------------- */
+#ifdef HAVE_LOCKFREE_QUEUE
+/* This is a bounded multi-producer ring buffer, based on per-slot sequence
+ * numbers (the idea is well-known, e.g. from Dmitry Vyukov's bounded MPMC
+ * queue). Producers reserve a slot via CAS on the enqueue position and then
+ * publish it by updating the slot sequence, so inputs do not need to acquire
+ * the queue mutex for the common case (see qqueueMultiEnqObjLockFree()).
+ * Dequeue and delete happen under the queue mutex, exactly like for the
+ * fixed array. We need that as we keep the logical/physical dequeue split,
+ * which is required for re-enqueueing unprocessed batch elements.
+ * The ring is sized a bit larger than iMaxQueueSize, because the fill
+ * level check of lock-free producers is done before the slot is reserved,
+ * so a few more elements than the max queue size may be in flight.
+ */
+#define LOCKFREE_RING_SLACK 1024
+
+static rsRetVal qConstructLockFree(qqueue_t *pThis)
+{
+	uint64 nSlots;
+	uint64 i;
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+
+	if(pThis->iMaxQueueSize == 0)
+		ABORT_FINALIZE(RS_RET_QSIZE_ZERO);
+
+	for(nSlots = 1 ; nSlots < (uint64) pThis->iMaxQueueSize + LOCKFREE_RING_SLACK ; nSlots <<= 1)
+		/*JUST SEARCH*/;
+
+	pThis->tVars.lfring.lenSlots = sizeof(qLockFreeSlot_t) * nSlots;
+	CHKmalloc(pThis->tVars.lfring.pSlots = qAllocStorage(pThis, &pThis->tVars.lfring.lenSlots, 1));
+	for(i = 0 ; i < nSlots ; ++i) {
+		pThis->tVars.lfring.pSlots[i].seq = i;
+		pThis->tVars.lfring.pSlots[i].pMsg = NULL;
+		pThis->tVars.lfring.pSlots[i].tEnq = 0;
+	}
+	pThis->tVars.lfring.mask = nSlots - 1;
+	pThis->tVars.lfring.enqPos = 0;
+	pThis->tVars.lfring.deqPos = 0;
+	pThis->tVars.lfring.delPos = 0;
+	INIT_ATOMIC_HELPER_MUT64(pThis->mutLFRing);
+
+	qqueueChkIsDA(pThis);
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal qDestructLockFree(qqueue_t *pThis)
+{
+	DEFiRet;
+	
+	ASSERT(pThis != NULL);
+
+	queueDrain(pThis); /* discard any remaining queue entries */
+	if(pThis->tVars.lfring.pSlots != NULL)
+		qFreeStorage(pThis, pThis->tVars.lfring.pSlots, pThis->tVars.lfring.lenSlots);
+	DESTROY_ATOMIC_HELPER_MUT64(pThis->mutLFRing);
+
+	RETiRet;
+}
+
+
+/* add to the ring. This function may be called without the queue mutex
+ * being held. Note that a full ring is not expected to happen, as the
+ * callers check the fill level before (and we have some slack). If it
+ * happens nevertheless, we discard the message just like a full queue
+ * with zero enqueue timeout does.
+ */
+static rsRetVal qAddLockFree(qqueue_t *pThis, msg_t* pMsg)
+{
+	qLockFreeSlot_t *pSlot;
+	uint64 pos;
+	int64 diff;
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+
+	pos = pThis->tVars.lfring.enqPos;
+	while(1) {
+		pSlot = &pThis->tVars.lfring.pSlots[pos & pThis->tVars.lfring.mask];
+		diff = (int64) (pSlot->seq - pos);
+		if(diff == 0) {
+			if(ATOMIC_CAS_uint64(&pThis->tVars.lfring.enqPos, pos, pos + 1, &pThis->mutLFRing))
+				break; /* slot is ours */
+		} else if(diff < 0) {
+			DBGOPRINT((obj_t*) pThis, "lockFree ring is full, discarding message\n");
+			TRACE(TRC_QUEUE, "queue %p: lockFree ring full, message discarded", (intptr_t) pThis);
+			STATSCOUNTER_INC(pThis->ctrFDscrd, pThis->mutCtrFDscrd);
+			msgDestruct(&pMsg);
+			ABORT_FINALIZE(RS_RET_QUEUE_FULL);
+		}
+		/* some other producer was faster, so try again */
+		pos = pThis->tVars.lfring.enqPos;
+	}
+
+	pSlot->pMsg = pMsg;
+	pSlot->tEnq = qqueueResTime(pThis);
+	ATOMIC_MEMORY_BARRIER(); /* message must be visible before slot is published */
+	pSlot->seq = pos + 1;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* dequeue from the ring; must be called with the queue mutex locked.
+ * The queue size guarantees that the slot is reserved by a producer, but
+ * it may be that this producer has not yet published it (if another producer
+ * that came later was faster). That window is just a couple of instructions,
+ * so we spin for a few rounds. If the slot is still not ready, we return
+ * RS_RET_RETRY, so that the caller can wait without holding the queue mutex
+ * (see DequeueConsumableElements()).
+ */
+#define LOCKFREE_DEQ_SPIN 16
+static rsRetVal qDeqLockFree(qqueue_t *pThis, msg_t **out)
+{
+	qLockFreeSlot_t *pSlot;
+	uint64 pos;
+	int i;
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+	pos = pThis->tVars.lfring.deqPos;
+	pSlot = &pThis->tVars.lfring.pSlots[pos & pThis->tVars.lfring.mask];
+	for(i = 0 ; pSlot->seq != pos + 1 ; ++i) {
+		if(i == LOCKFREE_DEQ_SPIN)
+			ABORT_FINALIZE(RS_RET_RETRY);
+		sched_yield();
+	}
+	ATOMIC_MEMORY_BARRIER();
+	*out = pSlot->pMsg;
+	pThis->tDeqEnq = pSlot->tEnq;
+	pThis->tVars.lfring.deqPos = pos + 1;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* delete from the ring, this frees the slot for producers. Must be called
+ * with the queue mutex locked.
+ */
+static rsRetVal qDelLockFree(qqueue_t *pThis)
+{
+	qLockFreeSlot_t *pSlot;
+	uint64 pos;
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+
+	pos = pThis->tVars.lfring.delPos;
+	pSlot = &pThis->tVars.lfring.pSlots[pos & pThis->tVars.lfring.mask];
+	pSlot->pMsg = NULL;
+	ATOMIC_MEMORY_BARRIER();
+	pSlot->seq = pos + pThis->tVars.lfring.mask + 1;
+	pThis->tVars.lfring.delPos = pos + 1;
+
+	RETiRet;
+}
+#endif /* #ifdef HAVE_LOCKFREE_QUEUE */
+
+
 /* -------------------- disk  -------------------- */
 
 
@@ -743,42 +1400,414 @@ finalize_it:
 }
 
 
-/* The method loads the persistent queue information.
- * rgerhards, 2008-01-11
+/* Disk queue segment index (.qx file). For each completed queue file
+ * ("segment"), the index records how many records and octets it contains.
+ * It is only appended to when the writer starts or completes a segment,
+ * which is rare enough to not matter for enqueue performance. If a disk
+ * queue was not shut down cleanly, there is no (or just an outdated) .qi
+ * file. In the no .qi case, the index permits to locate the remaining queue
+ * files and set up size accounting without reading them. Only the segment
+ * that was being written at the time of the crash needs to be scanned.
+ * The index is a text file with one entry per line:
+ *   s <filenum>                     writer started to use a segment
+ *   c <filenum> <records> <octets>  segment has been completed
+ * Entries of segments that have already been deleted are removed by
+ * compacting the index from time to time.
  */
-static rsRetVal 
-qqueueTryLoadPersistedInfo(qqueue_t *pThis)
-{
-	DEFiRet;
-	strm_t *psQIF = NULL;
-	struct stat stat_buf;
+#define QUEUE_IDX_COMPACT_INTERVAL 1024 /* compact after that many appends */
 
-	ISOBJ_TYPE_assert(pThis, qqueue);
+typedef struct qIdxEntry_s {
+	int iFNum;
+	int64 nRecs;
+	int64 nBytes;
+} qIdxEntry_t;
 
-	/* check if the file exists */
-	if(stat((char*) pThis->pszQIFNam, &stat_buf) == -1) {
-		if(errno == ENOENT) {
-			DBGOPRINT((obj_t*) pThis, "clean startup, no .qi file found\n");
-			ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
-		} else {
-			DBGOPRINT((obj_t*) pThis, "error %d trying to access .qi file\n", errno);
-			ABORT_FINALIZE(RS_RET_IO_ERROR);
+static rsRetVal qqueueIdxCompact(qqueue_t *pThis);
+
+/* check if a queue segment file exists. If so, its size is returned
+ * in *pSize (if pSize is not NULL).
+ */
+static int
+qqueueSegmentExists(qqueue_t *pThis, int iFNum, off_t *pSize)
+{
+	uchar *pszFName = NULL;
+	struct stat stat_buf;
+	int bExists = 0;
+
+	if(genFileName(&pszFName, pThis->pszSpoolDir, pThis->lenSpoolDir, pThis->pszFilePrefix,
+		       pThis->lenFilePrefix, iFNum, pThis->tVars.disk.pWrite->iFileNumDigits) == RS_RET_OK) {
+		if(stat((char*) pszFName, &stat_buf) == 0) {
+			bExists = 1;
+			if(pSize != NULL)
+				*pSize = stat_buf.st_size;
 		}
 	}
+	free(pszFName);
+	return bExists;
+}
 
-	/* If we reach this point, we have a .qi file */
+/* write an index line to an already open index file */
+static rsRetVal
+qqueueIdxWriteLn(qqueue_t *pThis, int fd, char cType, int iFNum, int64 nRecs, int64 nBytes)
+{
+	char ln[128];
+	int len;
+	DEFiRet;
 
-	CHKiRet(strm.Construct(&psQIF));
-	CHKiRet(strm.SettOperationsMode(psQIF, STREAMMODE_READ));
-	CHKiRet(strm.SetsType(psQIF, STREAMTYPE_FILE_SINGLE));
-	CHKiRet(strm.SetFName(psQIF, pThis->pszQIFNam, pThis->lenQIFNam));
-	CHKiRet(strm.ConstructFinalize(psQIF));
+	if(cType == 'c') {
+		len = snprintf(ln, sizeof(ln), "c %d %lld %lld\n", iFNum, (long long) nRecs, (long long) nBytes);
+	} else {
+		len = snprintf(ln, sizeof(ln), "s %d\n", iFNum);
+	}
+	if(write(fd, ln, len) != len) {
+		DBGOPRINT((obj_t*) pThis, "error %d writing index file\n", errno);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
 
-	/* first, we try to read the property bag for ourselfs */
-	CHKiRet(obj.DeserializePropBag((obj_t*) pThis, psQIF));
-	
-	/* then the stream objects (same order as when persisted!) */
-	CHKiRet(obj.Deserialize(&pThis->tVars.disk.pWrite, (uchar*) "strm", psQIF,
+finalize_it:
+	RETiRet;
+}
+
+/* append an entry to the index. Errors are not fatal for the queue,
+ * they just mean that unclean shutdown recovery may not be possible.
+ */
+static rsRetVal
+qqueueIdxAppend(qqueue_t *pThis, char cType, int iFNum, int64 nRecs, int64 nBytes)
+{
+	int fd;
+	DEFiRet;
+
+	fd = open((char*) pThis->pszIdxFNam, O_WRONLY | O_CREAT | O_APPEND | O_NOCTTY | O_CLOEXEC,
+		  S_IRUSR | S_IWUSR);
+	if(fd == -1) {
+		DBGOPRINT((obj_t*) pThis, "error %d opening index file '%s'\n", errno, pThis->pszIdxFNam);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	iRet = qqueueIdxWriteLn(pThis, fd, cType, iFNum, nRecs, nBytes);
+	if(pThis->bSyncQueueFiles)
+		fsync(fd);
+	close(fd);
+
+	if(++pThis->tVars.disk.nIdxUpd >= QUEUE_IDX_COMPACT_INTERVAL)
+		qqueueIdxCompact(pThis);
+
+finalize_it:
+	RETiRet;
+}
+
+/* read the index. Returns the completed segments in the order they were
+ * recorded and the number of the segment most recently started by the
+ * writer (-1 if there is none). Entries are NOT checked against the file
+ * system. A partially written last line (crash!) is ignored.
+ */
+static rsRetVal
+qqueueIdxRead(qqueue_t *pThis, qIdxEntry_t **ppEntries, int *pnEntries, int *piLastStarted)
+{
+	FILE *fp;
+	char ln[128];
+	qIdxEntry_t *pEntries = NULL;
+	qIdxEntry_t *pNew;
+	int nEntries = 0;
+	int nMax = 0;
+	int iFNum;
+	long long nRecs, nBytes;
+	DEFiRet;
+
+	*piLastStarted = -1;
+	if((fp = fopen((char*) pThis->pszIdxFNam, "r")) == NULL) {
+		ABORT_FINALIZE((errno == ENOENT) ? RS_RET_FILE_NOT_FOUND : RS_RET_IO_ERROR);
+	}
+	while(fgets(ln, sizeof(ln), fp) != NULL) {
+		if(ln[strlen(ln) - 1] != '\n')
+			continue; /* incomplete line */
+		if(sscanf(ln, "c %d %lld %lld", &iFNum, &nRecs, &nBytes) == 3) {
+			if(nEntries == nMax) {
+				nMax = (nMax == 0) ? 64 : nMax * 2;
+				CHKmalloc(pNew = realloc(pEntries, nMax * sizeof(qIdxEntry_t)));
+				pEntries = pNew;
+			}
+			pEntries[nEntries].iFNum = iFNum;
+			pEntries[nEntries].nRecs = nRecs;
+			pEntries[nEntries].nBytes = nBytes;
+			++nEntries;
+		} else if(sscanf(ln, "s %d", &iFNum) == 1) {
+			*piLastStarted = iFNum;
+		}
+	}
+
+	*ppEntries = pEntries;
+	*pnEntries = nEntries;
+	pEntries = NULL;
+
+finalize_it:
+	if(fp != NULL)
+		fclose(fp);
+	free(pEntries);
+	RETiRet;
+}
+
+/* (re-)write the index with the provided entries. The new index is
+ * written to a temporary file first, so that a crash during the write
+ * does not destroy the previous one.
+ */
+static rsRetVal
+qqueueIdxWrite(qqueue_t *pThis, qIdxEntry_t *pEntries, int nEntries, int iStarted)
+{
+	char szTmpName[MAXFNAME];
+	int fd = -1;
+	int i;
+	DEFiRet;
+
+	snprintf(szTmpName, sizeof(szTmpName), "%s.tmp", (char*) pThis->pszIdxFNam);
+	fd = open(szTmpName, O_WRONLY | O_CREAT | O_TRUNC | O_NOCTTY | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if(fd == -1) {
+		DBGOPRINT((obj_t*) pThis, "error %d creating index file '%s'\n", errno, szTmpName);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	for(i = 0 ; i < nEntries ; ++i) {
+		CHKiRet(qqueueIdxWriteLn(pThis, fd, 'c', pEntries[i].iFNum, pEntries[i].nRecs,
+					 pEntries[i].nBytes));
+	}
+	if(iStarted != -1)
+		CHKiRet(qqueueIdxWriteLn(pThis, fd, 's', iStarted, 0, 0));
+	if(pThis->bSyncQueueFiles)
+		fsync(fd);
+	close(fd);
+	fd = -1;
+	if(rename(szTmpName, (char*) pThis->pszIdxFNam) != 0) {
+		DBGOPRINT((obj_t*) pThis, "error %d renaming index file '%s'\n", errno, szTmpName);
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	}
+	pThis->tVars.disk.nIdxUpd = 0;
+
+finalize_it:
+	if(fd != -1) {
+		close(fd);
+		unlink(szTmpName);
+	}
+	RETiRet;
+}
+
+/* remove entries of segments that no longer exist from the index */
+static rsRetVal
+qqueueIdxCompact(qqueue_t *pThis)
+{
+	qIdxEntry_t *pEntries = NULL;
+	int nEntries;
+	int iStarted;
+	int i, j;
+	DEFiRet;
+
+	if(pThis->tVars.disk.pWrite == NULL) /* may be NULL if we had a startup failure! */
+		FINALIZE;
+	CHKiRet(qqueueIdxRead(pThis, &pEntries, &nEntries, &iStarted));
+	for(i = j = 0 ; i < nEntries ; ++i) {
+		if(qqueueSegmentExists(pThis, pEntries[i].iFNum, NULL))
+			pEntries[j++] = pEntries[i];
+	}
+	DBGOPRINT((obj_t*) pThis, "compacting index, %d of %d entries remain\n", j, nEntries);
+	CHKiRet(qqueueIdxWrite(pThis, pEntries, j, iStarted));
+
+finalize_it:
+	free(pEntries);
+	RETiRet;
+}
+
+/* count the records inside a segment by reading it. If the segment ends
+ * in an incomplete record (which is to be expected after a crash), it is
+ * truncated after the last complete one. That way, the dequeue side does
+ * not run into a partial record that continues in the next file.
+ */
+static rsRetVal
+qqueueIdxScanSegment(qqueue_t *pThis, int iFNum, int64 *pnRecs, int64 *pnBytes)
+{
+	uchar *pszFName = NULL;
+	strm_t *pStrm = NULL;
+	msg_t *pMsg;
+	off_t size;
+	int64 nRecs = 0;
+	int64 nBytes = 0;
+	DEFiRet;
+
+	if(!qqueueSegmentExists(pThis, iFNum, &size))
+		FINALIZE;
+	CHKiRet(genFileName(&pszFName, pThis->pszSpoolDir, pThis->lenSpoolDir, pThis->pszFilePrefix,
+			    pThis->lenFilePrefix, iFNum, pThis->tVars.disk.pWrite->iFileNumDigits));
+	CHKiRet(strm.Construct(&pStrm));
+	CHKiRet(strm.SettOperationsMode(pStrm, STREAMMODE_READ));
+	CHKiRet(strm.SetsType(pStrm, STREAMTYPE_FILE_SINGLE));
+	CHKiRet(strm.SetFName(pStrm, pszFName, ustrlen(pszFName)));
+	CHKiRet(strm.ConstructFinalize(pStrm));
+
+	while(qDeqDiskFromStrm(pThis, pStrm, &pMsg) == RS_RET_OK) {
+		msgDestruct(&pMsg);
+		++nRecs;
+		CHKiRet(strm.GetCurrOffset(pStrm, &nBytes));
+	}
+
+	if(nBytes < size) {
+		errmsg.LogError(0, NO_ERRCODE, "%s: queue file '%s' ends in an incomplete record, "
+				"truncating it to %lld octets", obj.GetName((obj_t*) pThis), pszFName,
+				(long long) nBytes);
+		if(truncate((char*) pszFName, nBytes) != 0) {
+			DBGOPRINT((obj_t*) pThis, "error %d truncating '%s'\n", errno, pszFName);
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+	}
+
+finalize_it:
+	*pnRecs = nRecs;
+	*pnBytes = nBytes;
+	if(pStrm != NULL)
+		strm.Destruct(&pStrm);
+	free(pszFName);
+	RETiRet;
+}
+
+/* apply the queue's compression settings to one of its disk streams */
+static rsRetVal
+qqueueSetStrmCmpr(qqueue_t *pThis, strm_t *pStrm)
+{
+	DEFiRet;
+
+	if(pThis->iCmprAlgo == CMPR_ALGO_NONE)
+		FINALIZE;
+	CHKiRet(strm.SetiCmprAlgo(pStrm, pThis->iCmprAlgo));
+	if(pThis->iCmprLevel >= 0)
+		CHKiRet(strm.SetiZipLevel(pStrm, pThis->iCmprLevel));
+	if(pThis->pszCmprDict != NULL) {
+		uchar *pszDict;
+		CHKmalloc(pszDict = ustrdup(pThis->pszCmprDict));
+		CHKiRet(strm.SetpszCmprDict(pStrm, pszDict));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* try to recover the queue state from the index after an unclean
+ * shutdown (no .qi file present). The queue streams must already have
+ * been constructed, but not yet been opened. The longest run of
+ * consecutive, still existing segments that ends with the most recently
+ * written one is used. Reading starts at the begin of the oldest of
+ * them, so some messages may be processed twice. This is in line with
+ * our general philosophy: better duplicate than lose messages.
+ * Encrypted and compressed queues are not supported, as their files can
+ * not be truncated at a record boundary.
+ * Returns RS_RET_FILE_NOT_FOUND if there is nothing to recover.
+ */
+static rsRetVal
+qqueueTryRecoverFromIdx(qqueue_t *pThis)
+{
+	qIdxEntry_t *pEntries = NULL;
+	int nEntries;
+	int iLastStarted;
+	int iFirst;
+	int iTail;
+	int iWrite;
+	int i;
+	int64 nRecs = 0;
+	int64 nBytes = 0;
+	int64 nTailRecs;
+	int64 nTailBytes;
+	DEFiRet;
+
+	if(pThis->useCryprov || pThis->iCmprAlgo != CMPR_ALGO_NONE) {
+		DBGOPRINT((obj_t*) pThis, "encrypted or compressed queue, index based "
+			  "recovery not supported\n");
+		ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
+	}
+	CHKiRet(qqueueIdxRead(pThis, &pEntries, &nEntries, &iLastStarted));
+
+	iTail = (nEntries > 0) ? pEntries[nEntries-1].iFNum + 1 : -1;
+	if(iTail < iLastStarted)
+		iTail = iLastStarted;
+	if(iTail < 0)
+		ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
+
+	iFirst = nEntries;
+	if(nEntries > 0 && pEntries[nEntries-1].iFNum + 1 == iTail) {
+		while(iFirst > 0 && qqueueSegmentExists(pThis, pEntries[iFirst-1].iFNum, NULL)
+		      && (iFirst == nEntries || pEntries[iFirst-1].iFNum + 1 == pEntries[iFirst].iFNum))
+			--iFirst;
+	}
+	for(i = iFirst ; i < nEntries ; ++i) {
+		nRecs += pEntries[i].nRecs;
+		nBytes += pEntries[i].nBytes;
+	}
+	CHKiRet(qqueueIdxScanSegment(pThis, iTail, &nTailRecs, &nTailBytes));
+	nRecs += nTailRecs;
+	nBytes += nTailBytes;
+
+	if(nRecs == 0) {
+		DBGOPRINT((obj_t*) pThis, "index present, but no records to recover\n");
+		unlink((char*) pThis->pszIdxFNam);
+		ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
+	}
+
+	/* a partially written segment is considered completed, we continue
+	 * writing in a new one (an empty one has been truncated to zero size).
+	 */
+	iWrite = (nTailRecs > 0) ? iTail + 1 : iTail;
+	strmSetCurrFileNum(pThis->tVars.disk.pWrite, iWrite);
+	strmSetCurrFileNum(pThis->tVars.disk.pReadDeq, (iFirst < nEntries) ? pEntries[iFirst].iFNum : iTail);
+	strmSetCurrFileNum(pThis->tVars.disk.pReadDel, (iFirst < nEntries) ? pEntries[iFirst].iFNum : iTail);
+	pThis->iQueueSize = (int) nRecs;
+	pThis->tVars.disk.sizeOnDisk = nBytes;
+
+	/* the index now must only describe what we have recovered */
+	qqueueIdxWrite(pThis, pEntries + iFirst, nEntries - iFirst, -1);
+	if(nTailRecs > 0)
+		qqueueIdxAppend(pThis, 'c', iTail, nTailRecs, nTailBytes);
+
+	errmsg.LogError(0, NO_ERRCODE, "%s: queue was not shut down cleanly, recovered %lld messages "
+			"(%lld octets) in %d files from index, reading starts at file %d",
+			obj.GetName((obj_t*) pThis), (long long) nRecs, (long long) nBytes,
+			nEntries - iFirst + (nTailRecs > 0 ? 1 : 0), strmGetCurrFileNum(pThis->tVars.disk.pReadDeq));
+
+finalize_it:
+	free(pEntries);
+	RETiRet;
+}
+
+
+/* The method loads the persistent queue information.
+ * rgerhards, 2008-01-11
+ */
+static rsRetVal 
+qqueueTryLoadPersistedInfo(qqueue_t *pThis)
+{
+	DEFiRet;
+	strm_t *psQIF = NULL;
+	struct stat stat_buf;
+
+	ISOBJ_TYPE_assert(pThis, qqueue);
+
+	/* check if the file exists */
+	if(stat((char*) pThis->pszQIFNam, &stat_buf) == -1) {
+		if(errno == ENOENT) {
+			DBGOPRINT((obj_t*) pThis, "clean startup, no .qi file found\n");
+			ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
+		} else {
+			DBGOPRINT((obj_t*) pThis, "error %d trying to access .qi file\n", errno);
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+	}
+
+	/* If we reach this point, we have a .qi file */
+
+	CHKiRet(strm.Construct(&psQIF));
+	CHKiRet(strm.SettOperationsMode(psQIF, STREAMMODE_READ));
+	CHKiRet(strm.SetsType(psQIF, STREAMTYPE_FILE_SINGLE));
+	CHKiRet(strm.SetFName(psQIF, pThis->pszQIFNam, pThis->lenQIFNam));
+	CHKiRet(strm.ConstructFinalize(psQIF));
+
+	/* first, we try to read the property bag for ourselfs */
+	CHKiRet(obj.DeserializePropBag((obj_t*) pThis, psQIF));
+	
+	/* then the stream objects (same order as when persisted!) */
+	CHKiRet(obj.Deserialize(&pThis->tVars.disk.pWrite, (uchar*) "strm", psQIF,
 			       (rsRetVal(*)(obj_t*,void*))qqueueLoadPersStrmInfoFixup, pThis));
 	CHKiRet(obj.Deserialize(&pThis->tVars.disk.pReadDel, (uchar*) "strm", psQIF,
 			       (rsRetVal(*)(obj_t*,void*))qqueueLoadPersStrmInfoFixup, pThis));
@@ -795,6 +1824,10 @@ qqueueTryLoadPersistedInfo(qqueue_t *pThis)
 		CHKiRet(strm.Setcryprov(pThis->tVars.disk.pReadDel, &pThis->cryprov));
 		CHKiRet(strm.SetcryprovData(pThis->tVars.disk.pReadDel, pThis->cryprovData));
 	}
+	/* compression must be known before seeking, as offsets refer to uncompressed data */
+	CHKiRet(qqueueSetStrmCmpr(pThis, pThis->tVars.disk.pWrite));
+	CHKiRet(qqueueSetStrmCmpr(pThis, pThis->tVars.disk.pReadDel));
+	CHKiRet(qqueueSetStrmCmpr(pThis, pThis->tVars.disk.pReadDeq));
 
 	CHKiRet(strm.SeekCurrOffs(pThis->tVars.disk.pWrite));
 	CHKiRet(strm.SeekCurrOffs(pThis->tVars.disk.pReadDel));
@@ -805,6 +1838,9 @@ qqueueTryLoadPersistedInfo(qqueue_t *pThis)
 	 */
 	pThis->bNeedDelQIF = 1;
 
+	/* this is also a good time to get rid of outdated index entries */
+	qqueueIdxCompact(pThis);
+
 finalize_it:
 	if(psQIF != NULL)
 		strm.Destruct(&psQIF);
@@ -829,9 +1865,11 @@ static rsRetVal qConstructDisk(qqueue_t *pThis)
 {
 	DEFiRet;
 	int bRestarted = 0;
+	struct timespec tStart, tEnd;
 
 	ASSERT(pThis != NULL);
 
+	timeoutComp(&tStart, 0);
 	/* and now check if there is some persistent information that needs to be read in */
 	iRet = qqueueTryLoadPersistedInfo(pThis);
 	if(iRet == RS_RET_OK)
@@ -852,6 +1890,7 @@ static rsRetVal qConstructDisk(qqueue_t *pThis)
 			CHKiRet(strm.Setcryprov(pThis->tVars.disk.pWrite, &pThis->cryprov));
 			CHKiRet(strm.SetcryprovData(pThis->tVars.disk.pWrite, pThis->cryprovData));
 		}
+		CHKiRet(qqueueSetStrmCmpr(pThis, pThis->tVars.disk.pWrite));
 		CHKiRet(strm.ConstructFinalize(pThis->tVars.disk.pWrite));
 
 		CHKiRet(strm.Construct(&pThis->tVars.disk.pReadDeq));
@@ -864,6 +1903,7 @@ static rsRetVal qConstructDisk(qqueue_t *pThis)
 			CHKiRet(strm.Setcryprov(pThis->tVars.disk.pReadDeq, &pThis->cryprov));
 			CHKiRet(strm.SetcryprovData(pThis->tVars.disk.pReadDeq, pThis->cryprovData));
 		}
+		CHKiRet(qqueueSetStrmCmpr(pThis, pThis->tVars.disk.pReadDeq));
 		CHKiRet(strm.ConstructFinalize(pThis->tVars.disk.pReadDeq));
 
 		CHKiRet(strm.Construct(&pThis->tVars.disk.pReadDel));
@@ -877,11 +1917,20 @@ static rsRetVal qConstructDisk(qqueue_t *pThis)
 			CHKiRet(strm.Setcryprov(pThis->tVars.disk.pReadDel, &pThis->cryprov));
 			CHKiRet(strm.SetcryprovData(pThis->tVars.disk.pReadDel, pThis->cryprovData));
 		}
+		CHKiRet(qqueueSetStrmCmpr(pThis, pThis->tVars.disk.pReadDel));
 		CHKiRet(strm.ConstructFinalize(pThis->tVars.disk.pReadDel));
 
 		CHKiRet(strm.SetFName(pThis->tVars.disk.pWrite,   pThis->pszFilePrefix, pThis->lenFilePrefix));
 		CHKiRet(strm.SetFName(pThis->tVars.disk.pReadDeq, pThis->pszFilePrefix, pThis->lenFilePrefix));
 		CHKiRet(strm.SetFName(pThis->tVars.disk.pReadDel, pThis->pszFilePrefix, pThis->lenFilePrefix));
+
+		/* without a .qi file, we may still have data from an unclean shutdown */
+		iRet = qqueueTryRecoverFromIdx(pThis);
+		if(iRet != RS_RET_OK && iRet != RS_RET_FILE_NOT_FOUND) {
+			DBGOPRINT((obj_t*) pThis, "error %d recovering from index, doing clean startup\n",
+				  iRet);
+		}
+		iRet = RS_RET_OK;
 	}
 
 	/* now we set (and overwrite in case of a persisted restart) some parameters which
@@ -892,6 +1941,24 @@ static rsRetVal qConstructDisk(qqueue_t *pThis)
 	CHKiRet(strm.SetiMaxFileSize(pThis->tVars.disk.pWrite, pThis->iMaxFileSize));
 	CHKiRet(strm.SetiMaxFileSize(pThis->tVars.disk.pReadDeq, pThis->iMaxFileSize));
 	CHKiRet(strm.SetiMaxFileSize(pThis->tVars.disk.pReadDel, pThis->iMaxFileSize));
+	CHKiRet(strm.SetbDeferSync(pThis->tVars.disk.pWrite, pThis->bGroupSync));
+	/* in mmap mode, the files are preallocated at their full size when being
+	 * created and the dequeue side reads them via mappings. Deletion is
+	 * unchanged: files are removed as soon as they are fully dequeued.
+	 */
+	CHKiRet(strm.SetbPreallocate(pThis->tVars.disk.pWrite, pThis->bMmap));
+	CHKiRet(strm.SetbMmap(pThis->tVars.disk.pReadDeq, pThis->bMmap));
+
+	timeoutComp(&tEnd, 0);
+	pThis->ctrRecoveryTime = (tEnd.tv_sec - tStart.tv_sec) * 1000
+			       + (tEnd.tv_nsec - tStart.tv_nsec) / 1000000;
+	if(pThis->iQueueSize > 0) {
+		/* restoretime is set when these messages have been dequeued */
+		pThis->bRestoring = 1;
+		pThis->tRestoreStart = tStart;
+	}
+	DBGOPRINT((obj_t*) pThis, "disk queue state set up in %d ms, %d messages\n",
+		  pThis->ctrRecoveryTime, pThis->iQueueSize);
 
 finalize_it:
 	RETiRet;
@@ -905,6 +1972,7 @@ static rsRetVal qDestructDisk(qqueue_t *pThis)
 	ASSERT(pThis != NULL);
 
 	free(pThis->pszQIFNam);
+	free(pThis->pszIdxFNam);
 	if(pThis->tVars.disk.pWrite != NULL)
 		strm.Destruct(&pThis->tVars.disk.pWrite);
 	if(pThis->tVars.disk.pReadDeq != NULL)
@@ -915,19 +1983,175 @@ static rsRetVal qDestructDisk(qqueue_t *pThis)
 	RETiRet;
 }
 
+/* Binary disk record support. A binary record consists of a fixed-size
+ * header followed by the message data as created by MsgSerializeBinary().
+ * The header is:
+ *   1 octet  magic (QUEUE_DISKREC_MAGIC)
+ *   1 octet  record format version
+ *   4 octets length of the message data (network byte order)
+ *   4 octets CRC32 of the message data (network byte order)
+ * A text-format record (as written by objSerialize()) always begins with
+ * '<', so the first octet tells us which format a record is in. That way,
+ * queue files written by previous versions (or with binary format turned
+ * off) can still be read, even if both formats are mixed in one file.
+ */
+#define QUEUE_DISKREC_MAGIC 0xb5
+#define QUEUE_DISKREC_VERSION 1
+#define QUEUE_DISKREC_HDRLEN 10
+#define QUEUE_DISKREC_MAXLEN (256 * 1024 * 1024) /* sanity limit for the length field */
+
+static inline void
+diskrecPut32(uchar *p, const uint32_t val)
+{
+	p[0] = (val >> 24) & 0xff;
+	p[1] = (val >> 16) & 0xff;
+	p[2] = (val >> 8) & 0xff;
+	p[3] = val & 0xff;
+}
+
+static inline uint32_t
+diskrecGet32(const uchar *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+/* write a message as binary record. The header is placed into space
+ * reserved by the serializer, so that the record can be written
+ * with a single call.
+ */
+static rsRetVal
+qAddDiskBinary(qqueue_t *pThis, msg_t *pMsg)
+{
+	uchar *pBuf = NULL;
+	size_t lenBuf;
+	size_t lenData;
+	DEFiRet;
+
+	CHKiRet(MsgSerializeBinary(pMsg, QUEUE_DISKREC_HDRLEN, &pBuf, &lenBuf));
+	lenData = lenBuf - QUEUE_DISKREC_HDRLEN;
+	pBuf[0] = QUEUE_DISKREC_MAGIC;
+	pBuf[1] = QUEUE_DISKREC_VERSION;
+	diskrecPut32(pBuf + 2, (uint32_t) lenData);
+	diskrecPut32(pBuf + 6, rsCRC32(0, pBuf + QUEUE_DISKREC_HDRLEN, lenData));
+
+	CHKiRet(strm.RecordBegin(pThis->tVars.disk.pWrite));
+	CHKiRet(strm.Write(pThis->tVars.disk.pWrite, pBuf, lenBuf));
+	CHKiRet(strm.RecordEnd(pThis->tVars.disk.pWrite));
+
+finalize_it:
+	free(pBuf);
+	RETiRet;
+}
+
+/* skip forward to the next binary record after a record with an insane
+ * length field. As we cannot know where the broken record ends, we scan
+ * for the next magic octet and put it back, so that the next dequeue starts
+ * there. Should the magic octet also occur inside the data, this results in
+ * one more corrupt record, which is then detected by the usual checks.
+ * If there is no further magic octet, the stream is left at its end.
+ */
+static rsRetVal
+qDeqDiskResync(strm_t *pStrm)
+{
+	uchar c;
+	DEFiRet;
+
+	do {
+		CHKiRet(strm.ReadChar(pStrm, &c));
+	} while(c != QUEUE_DISKREC_MAGIC);
+	CHKiRet(strm.UnreadChar(pStrm, c));
+
+finalize_it:
+	RETiRet;
+}
+
+/* read a binary record. The magic octet has already been consumed by the
+ * caller. If the record is corrupted (which is detected via the version,
+ * length or CRC), RS_RET_DISKREC_CORRUPT is returned. In that case, the
+ * stream is positioned at the start of the next record, so that the caller
+ * can continue with it: if the length is sane, the record data is consumed,
+ * otherwise we resync on the next magic octet.
+ */
+static rsRetVal
+qDeqDiskBinary(qqueue_t *pThis, strm_t *pStrm, msg_t **ppMsg)
+{
+	uchar hdr[QUEUE_DISKREC_HDRLEN - 1];
+	uchar *pBuf = NULL;
+	uint32_t lenData;
+	uint32_t crc;
+	msg_t *pMsg = NULL;
+	DEFiRet;
+
+	CHKiRet(strm.Read(pStrm, hdr, sizeof(hdr)));
+	lenData = diskrecGet32(hdr + 1);
+	if(lenData > QUEUE_DISKREC_MAXLEN) {
+		errmsg.LogError(0, RS_RET_DISKREC_CORRUPT, "%s: disk queue record with invalid "
+			"length %u - queue file is probably corrupt, skipping to next record",
+			obj.GetName((obj_t*) pThis), (unsigned) lenData);
+		if(qDeqDiskResync(pStrm) != RS_RET_OK)
+			DBGOPRINT((obj_t*) pThis, "no further binary record found after corrupt one\n");
+		ABORT_FINALIZE(RS_RET_DISKREC_CORRUPT);
+	}
+	CHKmalloc(pBuf = MALLOC(lenData));
+	CHKiRet(strm.Read(pStrm, pBuf, lenData));
+	if(hdr[0] != QUEUE_DISKREC_VERSION) {
+		errmsg.LogError(0, RS_RET_DISKREC_CORRUPT, "%s: disk queue record with invalid "
+			"version %d - queue file is probably corrupt, record discarded",
+			obj.GetName((obj_t*) pThis), hdr[0]);
+		ABORT_FINALIZE(RS_RET_DISKREC_CORRUPT);
+	}
+	crc = rsCRC32(0, pBuf, lenData);
+	if(crc != diskrecGet32(hdr + 5)) {
+		errmsg.LogError(0, RS_RET_DISKREC_CORRUPT, "%s: disk queue record with invalid "
+			"checksum, record discarded", obj.GetName((obj_t*) pThis));
+		ABORT_FINALIZE(RS_RET_DISKREC_CORRUPT);
+	}
+
+	CHKiRet(msgConstructForDeserializer(&pMsg));
+	CHKiRet(MsgDeserializeBinary(pMsg, pBuf, lenData));
+	*ppMsg = pMsg;
+	pMsg = NULL;
+
+finalize_it:
+	if(pMsg != NULL)
+		msgDestruct(&pMsg);
+	free(pBuf);
+	RETiRet;
+}
+
 static rsRetVal qAddDisk(qqueue_t *pThis, msg_t* pMsg)
 {
 	DEFiRet;
 	number_t nWriteCount;
+	int iFNum;
 
 	ASSERT(pThis != NULL);
 
+	iFNum = strmGetCurrFileNum(pThis->tVars.disk.pWrite);
+	if(!pThis->tVars.disk.bIdxStarted) {
+		qqueueIdxAppend(pThis, 's', iFNum, 0, 0);
+		pThis->tVars.disk.bIdxStarted = 1;
+	}
 	CHKiRet(strm.SetWCntr(pThis->tVars.disk.pWrite, &nWriteCount));
-	CHKiRet((objSerialize(pMsg))(pMsg, pThis->tVars.disk.pWrite));
+	if(pThis->bBinaryFormat) {
+		CHKiRet(qAddDiskBinary(pThis, pMsg));
+	} else {
+		CHKiRet((objSerialize(pMsg))(pMsg, pThis->tVars.disk.pWrite));
+	}
 	CHKiRet(strm.Flush(pThis->tVars.disk.pWrite));
 	CHKiRet(strm.SetWCntr(pThis->tVars.disk.pWrite, NULL)); /* no more counting for now... */
 
 	pThis->tVars.disk.sizeOnDisk += nWriteCount;
+	pThis->gsync.written += nWriteCount;
+	pThis->tVars.disk.segRecs++;
+	pThis->tVars.disk.segBytes += nWriteCount;
+	if(strmGetCurrFileNum(pThis->tVars.disk.pWrite) != iFNum) {
+		/* the segment has been completed (records never span files) */
+		qqueueIdxAppend(pThis, 'c', iFNum, pThis->tVars.disk.segRecs, pThis->tVars.disk.segBytes);
+		pThis->tVars.disk.segRecs = 0;
+		pThis->tVars.disk.segBytes = 0;
+		pThis->tVars.disk.bIdxStarted = 0;
+	}
 
 	/* we have enqueued the user element to disk. So we now need to destruct
 	 * the in-memory representation. The instance will be re-created upon
@@ -943,15 +2167,91 @@ finalize_it:
 }
 
 
-static rsRetVal qDeqDisk(qqueue_t *pThis, msg_t **ppMsg)
+/* read the next record from a queue file stream */
+static rsRetVal qDeqDiskFromStrm(qqueue_t *pThis, strm_t *pStrm, msg_t **ppMsg)
 {
+	uchar c;
 	DEFiRet;
-	iRet = objDeserializeWithMethods(ppMsg, (uchar*) "msg", 3, pThis->tVars.disk.pReadDeq, NULL,
-		NULL, msgConstructForDeserializer, NULL, MsgDeserialize);
+
+	/* check which format the record is in */
+	CHKiRet(strm.ReadChar(pStrm, &c));
+	if(c == QUEUE_DISKREC_MAGIC) {
+		iRet = qDeqDiskBinary(pThis, pStrm, ppMsg);
+	} else {
+		CHKiRet(strm.UnreadChar(pStrm, c));
+		iRet = objDeserializeWithMethods(ppMsg, (uchar*) "msg", 3, pStrm, NULL,
+			NULL, msgConstructForDeserializer, NULL, MsgDeserialize);
+	}
+
+finalize_it:
 	RETiRet;
 }
 
 
+static rsRetVal qDeqDisk(qqueue_t *pThis, msg_t **ppMsg)
+{
+	return qDeqDiskFromStrm(pThis, pThis->tVars.disk.pReadDeq, ppMsg);
+}
+
+
+/* Group commit: wait until the disk queue data up to syncPos (as octets
+ * written, see gsync.written) has been synced. If no sync is in progress,
+ * the caller becomes the group leader: it waits up to the sync interval
+ * for other writers to join (or until syncmaxbytes are pending), then
+ * syncs everything written so far with a single call. Other writers just
+ * wait for the leader to finish. This function must be called WITHOUT the
+ * queue mutex being held.
+ */
+static void
+qqueueWaitGroupSync(qqueue_t *pThis, uint64 syncPos)
+{
+	struct timespec t;
+	uint64 syncedTo;
+	int nWaiters = 0;
+	int iCancelStateSave;
+	int fd;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+	pthread_mutex_lock(&pThis->gsync.mut);
+	if(syncPos > pThis->gsync.requested) {
+		pThis->gsync.requested = syncPos;
+		if(pThis->gsync.requested - pThis->gsync.synced >= (uint64) pThis->iSyncMaxBytes)
+			pthread_cond_signal(&pThis->gsync.condReq);
+	}
+	while(pThis->gsync.synced < syncPos) {
+		if(pThis->gsync.bActive) {
+			++nWaiters;
+			pthread_cond_wait(&pThis->gsync.condDone, &pThis->gsync.mut);
+			continue;
+		}
+		/* we are the leader, so collect a group */
+		pThis->gsync.bActive = 1;
+		timeoutComp(&t, pThis->iSyncInterval);
+		while(pThis->gsync.requested - pThis->gsync.synced < (uint64) pThis->iSyncMaxBytes
+		      && !pThis->bShutdownImmediate) {
+			if(pthread_cond_timedwait(&pThis->gsync.condReq, &pThis->gsync.mut, &t) == ETIMEDOUT)
+				break;
+		}
+		pthread_mutex_unlock(&pThis->gsync.mut);
+
+		d_pthread_mutex_lock(pThis->mut);
+		syncedTo = pThis->gsync.written;
+		fd = strmGroupSyncBegin(pThis->tVars.disk.pWrite);
+		d_pthread_mutex_unlock(pThis->mut);
+		strmGroupSyncEnd(fd);
+
+		pthread_mutex_lock(&pThis->gsync.mut);
+		DBGOPRINT((obj_t*) pThis, "group commit synced %lld octets\n",
+			  (long long) (syncedTo - pThis->gsync.synced));
+		pThis->gsync.synced = syncedTo;
+		pThis->gsync.bActive = 0;
+		pthread_cond_broadcast(&pThis->gsync.condDone);
+	}
+	pthread_mutex_unlock(&pThis->gsync.mut);
+	pthread_setcancelstate(iCancelStateSave, NULL);
+}
+
+
 /* -------------------- direct (no queueing) -------------------- */
 static rsRetVal qConstructDirect(qqueue_t __attribute__((unused)) *pThis)
 {
@@ -989,6 +2289,7 @@ static rsRetVal qAddDirectWithWti(qqueue_t *pThis, msg_t* pMsg, wti_t *pWti)
 	singleBatch.pElem = &batchObj;
 	singleBatch.eltState = &batchState;
 	iRet = pThis->pConsumer(pThis->pAction, &singleBatch, pWti);
+	msgGlblVarsQuiesce();
 	msgDestruct(&pMsg);
 
 	RETiRet;
@@ -1014,6 +2315,119 @@ qAddDirect(qqueue_t *pThis, msg_t* pMsg)
 /* --------------- end type-specific handlers -------------------- */
 
 
+/* In-memory compression of large messages (queue.compression.threshold).
+ * A message may be shared with other queues and may even be modified by
+ * the ruleset while it sits in an action queue, so it can not be compressed
+ * in place. Instead, it is serialized in the binary disk record format and
+ * compressed, and a "packed" message object that carries only the result
+ * is queued in its place. The original is released, so its memory is
+ * freed as soon as nobody else uses it. Packed messages are unpacked by
+ * the consumer after dequeue, outside of the queue lock. The packed object
+ * keeps the severity, so discard marks and severity lanes still work.
+ * Its pszRawMsg holds the uncompressed record length (4 octets), followed
+ * by the compressed record.
+ */
+#define QUEUE_PACK_HDRLEN 4
+
+static msg_t *
+qqueuePackMsg(qqueue_t *pThis, msg_t *pMsg)
+{
+	uchar *pRec = NULL;
+	uchar *pBuf = NULL;
+	uchar *pNewBuf;
+	size_t lenRec;
+	size_t lenCmpr;
+	msg_t *pPacked;
+
+	/* unresolved senders would require DNS lookups during serialization */
+	if(   (pMsg->msgFlags & (PACKED_MSG | NEEDS_DNSRESOL))
+	   || MsgGetMemSize(pMsg) - (int64) sizeof(msg_t) < pThis->iCmprThreshold)
+		return pMsg;
+
+	if(MsgSerializeBinary(pMsg, 0, &pRec, &lenRec) != RS_RET_OK || lenRec > QUEUE_DISKREC_MAXLEN)
+		goto done;
+	if((pBuf = MALLOC(QUEUE_PACK_HDRLEN + lenRec)) == NULL)
+		goto done;
+	lenCmpr = lenRec - 1; /* only worth it if it gets smaller */
+	if(cmpr.CompressBuf(pThis->iMemCmprAlgo, pThis->iCmprLevel, pRec, lenRec,
+			    pBuf + QUEUE_PACK_HDRLEN, &lenCmpr) != RS_RET_OK)
+		goto done;
+	diskrecPut32(pBuf, (uint32_t) lenRec);
+	if((pNewBuf = realloc(pBuf, QUEUE_PACK_HDRLEN + lenCmpr)) != NULL)
+		pBuf = pNewBuf;
+
+	if(msgConstructForDeserializer(&pPacked) != RS_RET_OK)
+		goto done;
+	pPacked->msgFlags = PACKED_MSG;
+	pPacked->iSeverity = pMsg->iSeverity;
+	pPacked->iFacility = pMsg->iFacility;
+	pPacked->flowCtlType = pMsg->flowCtlType;
+	pPacked->pszRawMsg = pBuf;
+	pPacked->iLenRawMsg = QUEUE_PACK_HDRLEN + lenCmpr;
+	pBuf = NULL;
+	msgDestruct(&pMsg);
+	pMsg = pPacked;
+
+done:
+	free(pRec);
+	free(pBuf);
+	return pMsg;
+}
+
+
+/* unpack the packed messages of a dequeued batch, see qqueuePackMsg().
+ * Elements that can not be unpacked are discarded. Must be called without
+ * the queue mutex held.
+ */
+static void
+qqueueUnpackBatch(qqueue_t *pThis, batch_t *pBatch)
+{
+	msg_t *pPacked;
+	msg_t *pMsg;
+	uchar *pRec;
+	uint32_t lenRec;
+	rsRetVal localRet;
+	int i;
+
+	if(pThis->iCmprThreshold <= 0)
+		return;
+
+	for(i = 0 ; i < pBatch->nElem ; ++i) {
+		pPacked = pBatch->pElem[i].pMsg;
+		if(!(pPacked->msgFlags & PACKED_MSG))
+			continue;
+		pMsg = NULL;
+		lenRec = diskrecGet32(pPacked->pszRawMsg);
+		if((pRec = MALLOC(lenRec)) == NULL) {
+			localRet = RS_RET_OUT_OF_MEMORY;
+		} else {
+			localRet = cmpr.DecompressBuf(pThis->iMemCmprAlgo, pPacked->pszRawMsg + QUEUE_PACK_HDRLEN,
+						      pPacked->iLenRawMsg - QUEUE_PACK_HDRLEN, pRec, lenRec);
+			if(localRet == RS_RET_OK)
+				localRet = msgConstructForDeserializer(&pMsg);
+			if(localRet == RS_RET_OK)
+				localRet = MsgDeserializeBinary(pMsg, pRec, lenRec);
+			free(pRec);
+		}
+		if(localRet != RS_RET_OK) {
+			errmsg.LogError(0, localRet, "%s: could not unpack compressed message, "
+					"message discarded", obj.GetName((obj_t*) pThis));
+			if(pMsg != NULL)
+				msgDestruct(&pMsg);
+			/* the packed message stays in place as a placeholder, so that
+			 * the batch is deleted from the queue store as dequeued. All
+			 * consumers skip DISC elements.
+			 */
+			pBatch->eltState[i] = BATCH_STATE_DISC;
+			continue;
+		}
+		pMsg->flowCtlType = pPacked->flowCtlType;
+		pBatch->pElem[i].pMsg = pMsg;
+		msgDestruct(&pPacked);
+	}
+}
+
+
 /* generic code to add a queue entry
  * We use some specific code to most efficiently support direct mode
  * queues. This is justified in spite of the gain and the need to do some
@@ -1022,13 +2436,21 @@ qAddDirect(qqueue_t *pThis, msg_t* pMsg)
 static rsRetVal
 qqueueAdd(qqueue_t *pThis, msg_t *pMsg)
 {
+	int64 memSize = 0;
 	DEFiRet;
 
 	ASSERT(pThis != NULL);
 
+	/* the message may be gone after qAdd(), so obtain its size before */
+	if(pThis->qType != QUEUETYPE_DIRECT && pThis->qType != QUEUETYPE_DISK)
+		memSize = qqueueMsgMemSize(pMsg);
 	CHKiRet(pThis->qAdd(pThis, pMsg));
 
 	if(pThis->qType != QUEUETYPE_DIRECT) {
+		if(memSize != 0) {
+			ATOMIC_ADD_uint64(&pThis->iMemSize, memSize, &pThis->mutMemSize);
+			memacctAdd(MEMACCT_QUEUES, memSize);
+		}
 		ATOMIC_INC(&pThis->iQueueSize, &pThis->mutQueueSize);
 		DBGOPRINT((obj_t*) pThis, "qqueueAdd: entry added, size now log %d, phys %d entries\n",
 			  getLogicalQueueSize(pThis), getPhysicalQueueSize(pThis));
@@ -1054,11 +2476,14 @@ qqueueDeq(qqueue_t *pThis, msg_t **ppMsg)
 	 * losing the whole process because it loops... -- rgerhards, 2008-01-03
 	 */
 	iRet = pThis->qDeq(pThis, ppMsg);
+	if(iRet == RS_RET_RETRY)
+		FINALIZE; /* nothing dequeued, see qDeqLockFree() */
 	ATOMIC_INC(&pThis->nLogDeq, &pThis->mutLogDeq);
 
 //	DBGOPRINT((obj_t*) pThis, "entry deleted, size now log %d, phys %d entries\n",
 //		  getLogicalQueueSize(pThis), getPhysicalQueueSize(pThis));
 
+finalize_it:
 	RETiRet;
 }
 
@@ -1094,13 +2519,16 @@ tryShutdownWorkersWithinQueueTimeout(qqueue_t *pThis)
 		wtpSetState(pThis->pWtpDA, wtpState_SHUTDOWN_IMMEDIATE);
 		wtpAdviseMaxWorkers(pThis->pWtpDA, 1);
 		DBGOPRINT((obj_t*) pThis, "awoke DA worker, told it to shut down.\n");
+		d_pthread_mutex_unlock(pThis->mut);
 
-		/* also tell the DA queue worker to shut down, so that it already knows... */
+		/* also tell the DA queue worker to shut down, so that it already knows...
+		 * Its idle state is guarded by the DA queue's own mutex, not ours.
+		 */
+		d_pthread_mutex_lock(pThis->pqDA->mut);
 		wtpSetState(pThis->pqDA->pWtpReg, wtpState_SHUTDOWN);
 		wtpAdviseMaxWorkers(pThis->pqDA->pWtpReg, 1); /* awake its lone worker */
+		d_pthread_mutex_unlock(pThis->pqDA->mut);
 		DBGOPRINT((obj_t*) pThis, "awoke DA queue regular worker, told it to shut down when done.\n");
-
-		d_pthread_mutex_unlock(pThis->mut);
 	}
 
 
@@ -1328,15 +2756,26 @@ rsRetVal qqueueConstruct(qqueue_t **ppThis, queueType_t qType, int iWorkerThread
 	/* set some water marks so that we have useful defaults if none are set specifically */
 	pThis->iFullDlyMrk  = -1;
 	pThis->iLightDlyMrk = -1;
+	pThis->iHighWtrMrkBytes = -1;
+	pThis->iLowWtrMrkBytes = -1;
+	pThis->iDiscardMrkBytes = -1;
+	pThis->iFullDlyMrkBytes = -1;
+	pThis->iLightDlyMrkBytes = -1;
 	pThis->iMaxFileSize = 1024 * 1024; /* default is 1 MiB */
 	pThis->iQueueSize = 0;
 	pThis->nLogDeq = 0;
 	pThis->useCryprov = 0;
+	pThis->iCmprAlgo = CMPR_ALGO_NONE;
+	pThis->iCmprLevel = -1;
+	pThis->iCmprThreshold = 0;
+	pThis->iMemCmprAlgo = CMPR_ALGO_NONE;
 	pThis->iMaxQueueSize = iMaxQueueSize;
 	pThis->pConsumer = pConsumer;
 	pThis->iNumWorkerThreads = iWorkerThreads;
 	pThis->iDeqtWinToHr = 25; /* disable time-windowed dequeuing by default */
 	pThis->iDeqBatchSize = 8; /* conservative default, should still provide good performance */
+	pThis->bBinaryFormat = 1;
+	pThis->iSyncMaxBytes = 1024 * 1024;
 
 	pThis->pszFilePrefix = NULL;
 	pThis->qType = qType;
@@ -1344,6 +2783,7 @@ rsRetVal qqueueConstruct(qqueue_t **ppThis, queueType_t qType, int iWorkerThread
 
 	INIT_ATOMIC_HELPER_MUT(pThis->mutQueueSize);
 	INIT_ATOMIC_HELPER_MUT(pThis->mutLogDeq);
+	INIT_ATOMIC_HELPER_MUT64(pThis->mutMemSize);
 
 finalize_it:
 	OBJCONSTRUCT_CHECK_SUCCESS_AND_CLEANUP
@@ -1436,7 +2876,8 @@ static int qqueueChkDiscardMsg(qqueue_t *pThis, int iQueueSize, msg_t *pMsg)
 
 	ISOBJ_TYPE_assert(pThis, qqueue);
 
-	if(pThis->iDiscardMrk > 0 && iQueueSize >= pThis->iDiscardMrk) {
+	if(   (pThis->iDiscardMrk > 0 && iQueueSize >= pThis->iDiscardMrk)
+	   || qqueueMemAboveMrk(pThis, pThis->iDiscardMrkBytes)) {
 		iRetLocal = MsgGetSeverity(pMsg, &iSeverity);
 		if(iRetLocal == RS_RET_OK && iSeverity >= pThis->iDiscardSeverity) {
 			DBGOPRINT((obj_t*) pThis, "queue nearly full (%d entries), discarded severity %d message\n",
@@ -1458,10 +2899,11 @@ finalize_it:
 /* Finally remove n elements from the queue store.
  */
 static inline rsRetVal
-DoDeleteBatchFromQStore(qqueue_t *pThis, int nElem)
+DoDeleteBatchFromQStore(qqueue_t *pThis, int nElem, int64 nBytes)
 {
 	int i;
 	off64_t bytesDel;
+	struct timespec tNow;
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, qqueue);
@@ -1491,6 +2933,18 @@ DoDeleteBatchFromQStore(qqueue_t *pThis, int nElem)
 
 	/* iQueueSize is not decremented by qDel(), so we need to do it ourselves */
 	ATOMIC_SUB(&pThis->iQueueSize, nElem, &pThis->mutQueueSize);
+	if(pThis->bRestoring && pThis->iQueueSize == 0) {
+		timeoutComp(&tNow, 0);
+		pThis->ctrRestoreTime = (tNow.tv_sec - pThis->tRestoreStart.tv_sec) * 1000
+				      + (tNow.tv_nsec - pThis->tRestoreStart.tv_nsec) / 1000000;
+		pThis->bRestoring = 0;
+		DBGOPRINT((obj_t*) pThis, "messages restored at startup dequeued within %d ms\n",
+			  pThis->ctrRestoreTime);
+	}
+	if(nBytes != 0) {
+		ATOMIC_SUB_uint64(&pThis->iMemSize, nBytes, &pThis->mutMemSize);
+		memacctSub(MEMACCT_QUEUES, nBytes);
+	}
 	ATOMIC_SUB(&pThis->nLogDeq, nElem, &pThis->mutLogDeq);
 	DBGPRINTF("doDeleteBatch: delete batch from store, new sizes: log %d, phys %d\n",
 		  getLogicalQueueSize(pThis), getPhysicalQueueSize(pThis));
@@ -1515,22 +2969,22 @@ DeleteBatchFromQStore(qqueue_t *pThis, batch_t *pBatch)
 
 	pTdl = tdlPeek(pThis); /* get current head element */
 	if(pTdl == NULL) { /* to-delete list empty */
-		DoDeleteBatchFromQStore(pThis, pBatch->nElem);
+		DoDeleteBatchFromQStore(pThis, pBatch->nElem, pBatch->nBytesDeq);
 	} else if(pBatch->deqID == pThis->deqIDDel) {
 		deqIDDel = pThis->deqIDDel;
 		pTdl = tdlPeek(pThis);
 		while(pTdl != NULL && deqIDDel == pTdl->deqID) {
-			DoDeleteBatchFromQStore(pThis, pTdl->nElemDeq);
+			DoDeleteBatchFromQStore(pThis, pTdl->nElemDeq, pTdl->nBytesDeq);
 			tdlPop(pThis);
 			++deqIDDel;
 			pTdl = tdlPeek(pThis);
 		}
 		/* old entries deleted, now delete current ones... */
-		DoDeleteBatchFromQStore(pThis, pBatch->nElem);
+		DoDeleteBatchFromQStore(pThis, pBatch->nElem, pBatch->nBytesDeq);
 	} else {
 		/* can not delete, insert into to-delete list */
 		DBGPRINTF("not at head of to-delete list, enqueue %d\n", (int) pBatch->deqID);
-		CHKiRet(tdlAdd(pThis, pBatch->deqID, pBatch->nElem));
+		CHKiRet(tdlAdd(pThis, pBatch->deqID, pBatch->nElem, pBatch->nBytesDeq));
 	}
 
 finalize_it:
@@ -1575,6 +3029,7 @@ DeleteProcessedBatch(qqueue_t *pThis, batch_t *pBatch)
 
 	iRet = DeleteBatchFromQStore(pThis, pBatch);
 
+	pBatch->nBytesDeq = 0;
 	pBatch->nElem = pBatch->nElemDeq = 0; /* reset batch */ // TODO: more fine init, new fields! 2010-06-14
 
 	RETiRet;
@@ -1597,6 +3052,7 @@ DequeueConsumableElements(qqueue_t *pThis, wti_t *pWti, int *piRemainingQueueSiz
 	int nDiscarded;
 	int nDeleted;
 	int iQueueSize;
+	uint64 tNow;
 	msg_t *pMsg;
 	rsRetVal localRet;
 	DEFiRet;
@@ -1604,12 +3060,36 @@ DequeueConsumableElements(qqueue_t *pThis, wti_t *pWti, int *piRemainingQueueSiz
 	nDeleted = pWti->batch.nElemDeq;
 	DeleteProcessedBatch(pThis, &pWti->batch);
 
+	/* one clock query per batch is sufficiently precise for residency stats */
+	tNow = qqueueResTime(pThis);
+
 	nDequeued = nDiscarded = 0;
 	if(pThis->qType == QUEUETYPE_DISK) {
 		pThis->tVars.disk.deqFileNumIn = strmGetCurrFileNum(pThis->tVars.disk.pReadDeq);
 	}
-	while((iQueueSize = getLogicalQueueSize(pThis)) > 0 && nDequeued < pThis->iDeqBatchSize) {
-		CHKiRet(qqueueDeq(pThis, &pMsg));
+	while((iQueueSize = getLogicalQueueSize(pThis)) > 0 && nDequeued < pThis->iDeqBatchSizeCurr) {
+		localRet = qqueueDeq(pThis, &pMsg);
+		if(localRet == RS_RET_RETRY) {
+			/* lockFree slot not yet published. If we already have some
+			 * work, we process it. Otherwise we wait for the producer,
+			 * but without blocking the other users of the queue mutex.
+			 */
+			if(nDequeued > 0)
+				break;
+			d_pthread_mutex_unlock(pThis->mut);
+			sched_yield();
+			d_pthread_mutex_lock(pThis->mut);
+			continue;
+		} else if(localRet == RS_RET_DISKREC_CORRUPT) {
+			/* already reported, there is nothing we can do but drop it */
+			++nDiscarded;
+			continue;
+		} else if(localRet != RS_RET_OK) {
+			ABORT_FINALIZE(localRet);
+		}
+		if(pThis->qType != QUEUETYPE_DISK)
+			pWti->batch.nBytesDeq += qqueueMsgMemSize(pMsg);
+		qqueueResRecord(pThis, tNow);
 
 		/* check if we should discard this element */
 		localRet = qqueueChkDiscardMsg(pThis, pThis->iQueueSize, pMsg);
@@ -1631,6 +3111,11 @@ DequeueConsumableElements(qqueue_t *pThis, wti_t *pWti, int *piRemainingQueueSiz
 		pThis->tVars.disk.deqFileNumOut = strmGetCurrFileNum(pThis->tVars.disk.pReadDeq);
 	}
 
+	if(tNow != 0) {
+		qqueueResUpdate(pThis);
+		qqueueResCtl(pThis, tNow);
+	}
+
 	/* it is sufficient to persist only when the bulk of work is done */
 	qqueueChkPersist(pThis, nDequeued+nDiscarded+nDeleted);
 
@@ -1638,6 +3123,9 @@ DequeueConsumableElements(qqueue_t *pThis, wti_t *pWti, int *piRemainingQueueSiz
 	pWti->batch.nElemDeq = nDequeued + nDiscarded;
 	pWti->batch.deqID = getNextDeqID(pThis);
 	*piRemainingQueueSize = iQueueSize;
+	TRACE(TRC_QUEUE, "queue %p: dequeued %d, discarded %d, %d remaining",
+	      (intptr_t) pThis, nDequeued, nDiscarded, iQueueSize);
+	RS_PROBE(queue_deq, (char*) ((obj_t*) pThis)->pszName, nDequeued, nDiscarded, iQueueSize);
 finalize_it:
 	RETiRet;
 }
@@ -1665,11 +3153,12 @@ DequeueConsumable(qqueue_t *pThis, wti_t *pWti)
 	 * now that we dequeue batches of pointers, this is much less an issue...
 	 * rgerhards, 2009-04-22
 	 */
-	if(iQueueSize < pThis->iFullDlyMrk / 2 || glbl.GetGlobalInputTermState() == 1) {
+	if(   (iQueueSize < pThis->iFullDlyMrk / 2 && !qqueueMemAboveMrk(pThis, pThis->iFullDlyMrkBytes / 2))
+	   || glbl.GetGlobalInputTermState() == 1) {
 		pthread_cond_broadcast(&pThis->belowFullDlyWtrMrk);
 	}
 
-	if(iQueueSize < pThis->iLightDlyMrk / 2) {
+	if(iQueueSize < pThis->iLightDlyMrk / 2 && !qqueueMemAboveMrk(pThis, pThis->iLightDlyMrkBytes / 2)) {
 		pthread_cond_broadcast(&pThis->belowLightDlyWtrMrk);
 	}
 
@@ -1808,6 +3297,22 @@ finalize_it:
 }
 
 
+/* delete a batch that was stolen from shard pVictim (see StealBatch()) and
+ * do the same accounting as for a batch of the shard's own workers. Must
+ * be called without the victim's mutex being held.
+ */
+static void
+DeleteStolenBatch(qqueue_t *pVictim, wti_t *pWti)
+{
+	d_pthread_mutex_lock(pVictim->mut);
+	DeleteProcessedBatch(pVictim, &pWti->batch);
+	qqueueChkPersist(pVictim, pWti->batch.nElemDeq);
+	pthread_cond_signal(&pVictim->notFull);
+	d_pthread_mutex_unlock(pVictim->mut);
+	pWti->pqStealSrc = NULL;
+}
+
+
 /* This is called when a batch is processed and the worker does not
  * ask for another batch (e.g. because it is to be terminated)
  * Note that we must not be terminated while we delete a processed
@@ -1829,29 +3334,180 @@ batchProcessed(qqueue_t *pThis, wti_t *pWti)
 	int iCancelStateSave;
 	/* at this spot, we must not be cancelled */
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
-	DeleteProcessedBatch(pThis, &pWti->batch);
-	qqueueChkPersist(pThis, pWti->batch.nElemDeq);
+	if(pWti->pqStealSrc != NULL) {
+		/* we were cancelled while processing a batch stolen from a
+		 * sibling shard, so it must be deleted from that shard.
+		 */
+		DeleteStolenBatch(pWti->pqStealSrc, pWti);
+	} else {
+		DeleteProcessedBatch(pThis, &pWti->batch);
+		qqueueChkPersist(pThis, pWti->batch.nElemDeq);
+	}
+	wtiArenaReset(pWti);
 	pthread_setcancelstate(iCancelStateSave, NULL);
 
 	RETiRet;
 }
 
 
+/* Try to steal a batch from a sibling shard. This is called by the worker
+ * of a shard when its own shard has run empty. The own queue mutex must be
+ * locked when we are called. It is released while we deal with the sibling
+ * and locked again before we return. Siblings are only trylock'ed, so a
+ * shard that is currently busy is simply skipped. The stolen batch is
+ * processed right here and deleted from the sibling it came from.
+ * Returns RS_RET_IDLE if there was nothing to steal and the consumer's
+ * return code otherwise, just like ConsumerReg() does.
+ */
+static rsRetVal
+StealBatch(qqueue_t *pThis, wti_t *pWti)
+{
+	qqueue_t *pParent = pThis->pqShardParent;
+	qqueue_t *pVictim;
+	int iCancelStateSave;
+	int bStolen = 0;
+	rsRetVal localRet;
+	int i;
+	DEFiRet;
+
+	/* an idle dequeue may still hold discarded elements of our own shard */
+	if(pWti->batch.nElemDeq != 0 || pThis->bShutdownImmediate)
+		ABORT_FINALIZE(RS_RET_IDLE);
+
+	d_pthread_mutex_unlock(pThis->mut);
+	for(i = 1 ; i < pParent->iNumShards && !bStolen ; ++i) {
+		pVictim = pParent->ppShards[(pThis->iShardIdx + i) % pParent->iNumShards];
+		/* quick check without the mutex, we do not steal less than a
+		 * batch - the shard's own workers can handle that.
+		 */
+		if(pVictim->bShutdownImmediate || getLogicalQueueSize(pVictim) < pVictim->iDeqBatchSizeCurr)
+			continue;
+		if(pthread_mutex_trylock(pVictim->mut) != 0)
+			continue;
+		localRet = DequeueConsumable(pVictim, pWti);
+		if(localRet != RS_RET_OK || pWti->batch.nElem == 0) {
+			DeleteProcessedBatch(pVictim, &pWti->batch);
+			d_pthread_mutex_unlock(pVictim->mut);
+			continue;
+		}
+		pWti->pqStealSrc = pVictim;
+		d_pthread_mutex_unlock(pVictim->mut);
+		bStolen = 1;
+		qqueueUnpackBatch(pVictim, &pWti->batch);
+
+		DBGOPRINT((obj_t*) pThis, "stole batch of %d messages from shard %d\n",
+			  pWti->batch.nElem, pVictim->iShardIdx);
+		STATSCOUNTER_ADD(pThis->ctrStolen, pThis->mutCtrStolen, pWti->batch.nElem);
+		STATSCOUNTER_ADD(pParent->ctrStolen, pParent->mutCtrStolen, pWti->batch.nElem);
+
+		/* at this spot, we may be cancelled */
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &iCancelStateSave);
+		pWti->pbShutdownImmediate = &pVictim->bShutdownImmediate;
+		iRet = pThis->pConsumer(pThis->pAction, &pWti->batch, pWti);
+		if(iRet == RS_RET_OK && pThis->iDeqSlowdown) {
+			srSleep(pThis->iDeqSlowdown / 1000000, pThis->iDeqSlowdown % 1000000);
+		}
+		pthread_setcancelstate(iCancelStateSave, NULL);
+		if(iRet != RS_RET_OK) {
+			DBGOPRINT((obj_t*) pThis, "consumer returned error %d for batch stolen "
+				  "from shard %d\n", iRet, pVictim->iShardIdx);
+		}
+
+		/* the batch belongs to the victim, so it is deleted there in any case */
+		DeleteStolenBatch(pVictim, pWti);
+	}
+	d_pthread_mutex_lock(pThis->mut);
+
+	if(!bStolen)
+		iRet = RS_RET_IDLE;
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* This is the queue consumer in the regular (non-DA) case. It is 
  * protected by the queue mutex, but MUST release it as soon as possible.
  * rgerhards, 2008-01-21
  */
+/* adapt the batch size after a batch has been processed. We grow quickly
+ * while there is a backlog of at least a full batch, because then per-batch
+ * overhead (most importantly action commits) counts. If the queue runs
+ * (almost) empty or a batch takes longer than the configured max time, the
+ * size is reduced, so that messages are not held back in large batches.
+ * Must be called with the queue mutex locked.
+ */
+static inline void
+qqueueAdaptBatchSize(qqueue_t *pThis, int nElem, uint64 tProc)
+{
+	int iCurr = pThis->iDeqBatchSizeCurr;
+	int iQueueSize = getLogicalQueueSize(pThis);
+
+	if(pThis->iMaxBatchTime > 0 && tProc > (uint64) pThis->iMaxBatchTime * 1000) {
+		iCurr /= 2;
+	} else if(nElem >= iCurr && iQueueSize >= iCurr) {
+		iCurr *= 2;
+	} else if(iQueueSize < iCurr / 4) {
+		iCurr -= iCurr / 4;
+	}
+	if(iCurr > pThis->iDeqBatchSize)
+		iCurr = pThis->iDeqBatchSize;
+	if(iCurr < pThis->iMinDeqBatchSize)
+		iCurr = pThis->iMinDeqBatchSize;
+
+	if(iCurr != pThis->iDeqBatchSizeCurr) {
+		DBGOPRINT((obj_t*) pThis, "adaptive batch size now %d (last batch %d elements, "
+			  "%lld us, queue size %d)\n", iCurr, nElem, (long long) tProc, iQueueSize);
+		pThis->iDeqBatchSizeCurr = iCurr;
+	}
+}
+
+
+/* linger: if there is some, but not enough work for a decent batch, wait a
+ * bounded time for more to arrive. This trades a little latency for fewer,
+ * larger batches, which matters for outputs that pay a round-trip per
+ * commit. We do not linger when shutting down, as we then want to drain
+ * quickly. Must be called with the queue mutex locked; the wait releases it,
+ * so inputs are not stalled.
+ */
+static void
+qqueueLinger(qqueue_t *pThis)
+{
+	struct timespec t;
+	int iQueueSize;
+
+	iQueueSize = getLogicalQueueSize(pThis);
+	if(   pThis->iLingerTime <= 0 || iQueueSize == 0 || iQueueSize >= pThis->iLingerMin
+	   || pThis->pWtpReg->wtpState != wtpState_RUNNING)
+		return;
+
+	timeoutComp(&t, pThis->iLingerTime);
+	while(   getLogicalQueueSize(pThis) < pThis->iLingerMin
+	      && pThis->pWtpReg->wtpState == wtpState_RUNNING) {
+		if(pthread_cond_timedwait(&pThis->lingerDone, pThis->mut, &t) != 0)
+			break; /* timeout, use what we have */
+	}
+	DBGOPRINT((obj_t*) pThis, "lingered for batch, queue size now %d\n", getLogicalQueueSize(pThis));
+}
+
+
 static rsRetVal
 ConsumerReg(qqueue_t *pThis, wti_t *pWti)
 {
 	int iCancelStateSave;
 	int bNeedReLock = 0;	/**< do we need to lock the mutex again? */
+	uint64 tStart = 0;
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, qqueue);
 	ISOBJ_TYPE_assert(pWti, wti);
 
+	qqueueLinger(pThis);
 	iRet = DequeueForConsumer(pThis, pWti);
+	if(iRet == RS_RET_IDLE && pThis->pqShardParent != NULL && !pThis->pqShardParent->bShardOrdered) {
+		iRet = StealBatch(pThis, pWti);
+		FINALIZE;
+	}
 	if(iRet == RS_RET_FILE_NOT_FOUND) {
 		/* This is a fatal condition and means the queue is almost unusable */
 		d_pthread_mutex_unlock(pThis->mut);
@@ -1867,12 +3523,15 @@ ConsumerReg(qqueue_t *pThis, wti_t *pWti)
 	/* we now have a non-idle batch of work, so we can release the queue mutex and process it */
 	d_pthread_mutex_unlock(pThis->mut);
 	bNeedReLock = 1;
+	qqueueUnpackBatch(pThis, &pWti->batch);
 
 	/* at this spot, we may be cancelled */
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &iCancelStateSave);
 
 
 	pWti->pbShutdownImmediate = &pThis->bShutdownImmediate;
+	if(pThis->bAdaptiveBatch)
+		tStart = qqueueTimeUs();
 	CHKiRet(pThis->pConsumer(pThis->pAction, &pWti->batch, pWti));
 
 	/* we now need to check if we should deliberately delay processing a bit
@@ -1893,8 +3552,11 @@ finalize_it:
 	          getLogicalQueueSize(pThis), getPhysicalQueueSize(pThis));
 
 	/* now we are done, but potentially need to re-aquire the mutex */
-	if(bNeedReLock)
+	if(bNeedReLock) {
 		d_pthread_mutex_lock(pThis->mut);
+		if(tStart != 0)
+			qqueueAdaptBatchSize(pThis, pWti->batch.nElem, qqueueTimeUs() - tStart);
+	}
 
 	RETiRet;
 }
@@ -1915,6 +3577,7 @@ ConsumerDA(qqueue_t *pThis, wti_t *pWti)
 	int i;
 	int iCancelStateSave;
 	int bNeedReLock = 0;	/**< do we need to lock the mutex again? */
+	uint64 syncPos = 0;
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, qqueue);
@@ -1925,13 +3588,17 @@ ConsumerDA(qqueue_t *pThis, wti_t *pWti)
 	/* we now have a non-idle batch of work, so we can release the queue mutex and process it */
 	d_pthread_mutex_unlock(pThis->mut);
 	bNeedReLock = 1;
+	qqueueUnpackBatch(pThis, &pWti->batch);
 
 	/* at this spot, we may be cancelled */
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &iCancelStateSave);
 
 	/* iterate over returned results and enqueue them in DA queue */
 	for(i = 0 ; i < pWti->batch.nElem && !pThis->bShutdownImmediate ; i++) {
-		iRet = qqueueEnqMsg(pThis->pqDA, eFLOWCTL_NO_DELAY, MsgAddRef(pWti->batch.pElem[i].pMsg));
+		if(pWti->batch.eltState[i] == BATCH_STATE_DISC)
+			continue; /* could not be unpacked */
+		iRet = qqueueEnqMsgDeferSync(pThis->pqDA, eFLOWCTL_NO_DELAY,
+					     MsgAddRef(pWti->batch.pElem[i].pMsg), &syncPos);
 		if(iRet != RS_RET_OK) {
 			if(iRet == RS_RET_ERR_QUEUE_EMERGENCY) {
 				/* Queue emergency error occured */
@@ -1976,6 +3643,10 @@ finalize_it:
 		DBGOPRINT((obj_t*) pThis, "ConsumerDA:qqueueEnqMsg returns with iRet %d\n", iRet);
 	}
 
+	/* the batch must not be deleted before it is on stable storage */
+	if(syncPos != 0)
+		qqueueWaitGroupSync(pThis->pqDA, syncPos);
+
 	/* now we are done, but potentially need to re-aquire the mutex */
 	if(bNeedReLock)
 		d_pthread_mutex_lock(pThis->mut);
@@ -1997,7 +3668,9 @@ qqueueChkStopWrkrDA(qqueue_t *pThis)
 	if(pThis->bEnqOnly) {
 		iRet = RS_RET_TERMINATE_WHEN_IDLE;
 	}
-	if(getPhysicalQueueSize(pThis) <= pThis->iLowWtrMrk) {
+	if(getPhysicalQueueSize(pThis) <= pThis->iLowWtrMrk
+	   && (pThis->iLowWtrMrkBytes <= 0 || (int64) pThis->iMemSize <= pThis->iLowWtrMrkBytes)
+	   && !memacctOverLimit()) {
 		iRet = RS_RET_TERMINATE_NOW;
 	}
 
@@ -2027,6 +3700,8 @@ ChkStopWrkrReg(qqueue_t *pThis)
 
 
 /* return the configured "deq max at once" interval
+ * Note: with adaptive batch sizes, this is the upper bound, which is what
+ * the workers need to size their batch buffers.
  * rgerhards, 2009-04-22
  */
 static rsRetVal
@@ -2041,6 +3716,152 @@ if(pThis->pqParent != NULL) // TODO: check why we actually do this!
 }
 
 
+/* --------------- code for sharded queues -------------------- */
+
+/* A sharded queue does not hold any messages itself. It is split into
+ * iNumShards sub-queues ("shards"), each with its own mutex and its own
+ * worker thread pool, so that inputs and workers no longer serialize on a
+ * single queue mutex. Inputs select the shard by a hash of the submitting
+ * thread, of the sender or of a message property. Workers whose shard runs
+ * empty steal batches from their siblings (see StealBatch()).
+ * In ordered mode (queue.ordered), each shard has a single worker and
+ * nothing is stolen. So all messages with the same shard key are processed
+ * in order, while different keys are processed in parallel.
+ */
+
+/* helper to scale a per-queue mark down to a single shard. Unset (-1) or
+ * zero marks are passed on, so that qqueueStart() computes the defaults.
+ */
+#define SHARD_MRK(mrk, n) (((mrk) > 0) ? ((mrk) / (n) > 0 ? (mrk) / (n) : 1) : (mrk))
+
+/* create and start the shards of a sharded queue. The shards inherit all
+ * settings of the parent, with sizes and marks split evenly among them.
+ */
+static rsRetVal
+StartShards(qqueue_t *pThis)
+{
+	qqueue_t *pShard;
+	uchar pszShardName[128];
+	int nShards = pThis->iNumShards;
+	int nWrkr;
+	int i;
+	DEFiRet;
+
+	ISOBJ_TYPE_assert(pThis, qqueue);
+
+	CHKmalloc(pThis->ppShards = calloc(nShards, sizeof(qqueue_t*)));
+	if(pThis->bShardOrdered)
+		nWrkr = 1; /* a second worker could overtake the first one */
+	else
+		nWrkr = (pThis->iNumWorkerThreads + nShards - 1) / nShards;
+	for(i = 0 ; i < nShards ; ++i) {
+		CHKiRet(qqueueConstruct(&pThis->ppShards[i], pThis->qType, nWrkr,
+					pThis->iMaxQueueSize / nShards, pThis->pConsumer));
+		pShard = pThis->ppShards[i];
+		snprintf((char*) pszShardName, sizeof(pszShardName), "%s[shard%d]",
+			 obj.GetName((obj_t*) pThis), i);
+		obj.SetName((obj_t*) pShard, pszShardName);
+
+		/* as the created queue is the same object class, we take the
+		 * liberty to access its properties directly.
+		 */
+		pShard->pqShardParent = pThis;
+		pShard->iShardIdx = i;
+		pShard->pAction = pThis->pAction;
+		pShard->iDeqBatchSize = pThis->iDeqBatchSize;
+		pShard->bAdaptiveBatch = pThis->bAdaptiveBatch;
+		pShard->iMinDeqBatchSize = pThis->iMinDeqBatchSize;
+		pShard->iMaxBatchTime = pThis->iMaxBatchTime;
+		pShard->iLingerMin = pThis->iLingerMin;
+		pShard->iLingerTime = pThis->iLingerTime;
+		pShard->iMinMsgsPerWrkr = pThis->iMinMsgsPerWrkr;
+		pShard->iHighWtrMrk = SHARD_MRK(pThis->iHighWtrMrk, nShards);
+		pShard->iLowWtrMrk = SHARD_MRK(pThis->iLowWtrMrk, nShards);
+		pShard->iDiscardMrk = SHARD_MRK(pThis->iDiscardMrk, nShards);
+		pShard->iFullDlyMrk = SHARD_MRK(pThis->iFullDlyMrk, nShards);
+		pShard->iLightDlyMrk = SHARD_MRK(pThis->iLightDlyMrk, nShards);
+		pShard->iMaxMemory = SHARD_MRK(pThis->iMaxMemory, nShards);
+		pShard->iHighWtrMrkBytes = SHARD_MRK(pThis->iHighWtrMrkBytes, nShards);
+		pShard->iLowWtrMrkBytes = SHARD_MRK(pThis->iLowWtrMrkBytes, nShards);
+		pShard->iDiscardMrkBytes = SHARD_MRK(pThis->iDiscardMrkBytes, nShards);
+		pShard->iFullDlyMrkBytes = SHARD_MRK(pThis->iFullDlyMrkBytes, nShards);
+		pShard->iLightDlyMrkBytes = SHARD_MRK(pThis->iLightDlyMrkBytes, nShards);
+		pShard->iDiscardSeverity = pThis->iDiscardSeverity;
+		pShard->bResidencyStats = pThis->bResidencyStats;
+		pShard->iMemFlags = pThis->iMemFlags;
+		pShard->iNumLanes = pThis->iNumLanes;
+		pShard->iCmprThreshold = pThis->iCmprThreshold;
+		pShard->iMemCmprAlgo = pThis->iMemCmprAlgo;
+		pShard->iCmprLevel = pThis->iCmprLevel;
+		pShard->pLaneProp = pThis->pLaneProp; /* shared, owned by parent */
+#		ifdef HAVE_PTHREAD_SETAFFINITY_NP
+		pShard->pCpuSet = pThis->pCpuSet; /* shared, owned by parent */
+#		endif
+		pShard->toQShutdown = pThis->toQShutdown;
+		pShard->toActShutdown = pThis->toActShutdown;
+		pShard->toWrkShutdown = pThis->toWrkShutdown;
+		pShard->toEnq = pThis->toEnq;
+		pShard->iDeqSlowdown = pThis->iDeqSlowdown;
+		pShard->iDeqtWinFromHr = pThis->iDeqtWinFromHr;
+		pShard->iDeqtWinToHr = pThis->iDeqtWinToHr;
+		CHKiRet(qqueueStart(pShard));
+	}
+
+	DBGOPRINT((obj_t*) pThis, "started %d shards with %d worker(s) each\n", nShards, nWrkr);
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		errmsg.LogError(0, iRet, "queue \"%s\": error starting shards",
+				obj.GetName((obj_t*) pThis));
+	}
+	RETiRet;
+}
+
+
+/* shut down and destruct all shards of a sharded queue. The workers of ALL
+ * shards are shut down before the first shard is destructed, because workers
+ * may access sibling shards while stealing.
+ */
+static void
+DestructShards(qqueue_t *pThis)
+{
+	int i;
+
+	for(i = 0 ; i < pThis->iNumShards ; ++i) {
+		if(pThis->ppShards[i] != NULL && pThis->ppShards[i]->pWtpReg != NULL) {
+			ShutdownWorkers(pThis->ppShards[i]);
+		}
+	}
+	for(i = 0 ; i < pThis->iNumShards ; ++i) {
+		if(pThis->ppShards[i] != NULL && pThis->ppShards[i]->pWtpReg != NULL) {
+			wtpDestruct(&pThis->ppShards[i]->pWtpReg);
+		}
+	}
+	for(i = 0 ; i < pThis->iNumShards ; ++i) {
+		if(pThis->ppShards[i] != NULL) {
+			qqueueDestruct(&pThis->ppShards[i]);
+		}
+	}
+	free(pThis->ppShards);
+	pThis->ppShards = NULL;
+}
+
+/* --------------- end code for sharded queues -------------------- */
+
+
+/* compute the default for a memory based mark, pct is the percentage
+ * of queue.maxmemory to use. Explicitly set marks are kept, as long as
+ * they are not above queue.maxmemory (if that is set).
+ */
+static int64
+qqueueMemMrkDflt(qqueue_t *pThis, int64 mrk, int pct)
+{
+	if(mrk >= 0 && (pThis->iMaxMemory == 0 || mrk <= pThis->iMaxMemory))
+		return mrk;
+	return (pThis->iMaxMemory / 100) * pct;
+}
+
+
 /* start up the queue - it must have been constructed and parameters defined
  * before.
  */
@@ -2067,6 +3888,68 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 		pThis->lenSpoolDir = ustrlen(pThis->pszSpoolDir);
 	}
+#ifndef HAVE_LOCKFREE_QUEUE
+	if(pThis->qType == QUEUETYPE_LOCKFREE) {
+		errmsg.LogError(0, RS_RET_QTYPE_UNSUPPORTED, "queue \"%s\": queue type "
+				"lockFree is not supported on this platform (no 64 bit "
+				"atomic instructions), using FixedArray instead",
+				obj.GetName((obj_t*) pThis));
+		pThis->qType = QUEUETYPE_FIXED_ARRAY;
+	}
+#endif
+
+	if(pThis->bShardOrdered && pThis->iNumShards <= 1)
+		pThis->iNumShards = pThis->iNumWorkerThreads;
+	if(pThis->iNumShards > 1) {
+		if(   pThis->qType == QUEUETYPE_DISK || pThis->qType == QUEUETYPE_DIRECT
+		   || pThis->pszFilePrefix != NULL) {
+			errmsg.LogError(0, RS_RET_QTYPE_UNSUPPORTED, "queue \"%s\": queue.shards "
+					"is only supported for pure in-memory queues, sharding "
+					"disabled", obj.GetName((obj_t*) pThis));
+			pThis->iNumShards = 0;
+		} else if(pThis->iNumShards > pThis->iNumWorkerThreads) {
+			errmsg.LogError(0, RS_RET_CONF_PARSE_WARNING, "queue \"%s\": queue.shards "
+					"%d is larger than queue.workerthreads %d, reduced to %d",
+					obj.GetName((obj_t*) pThis), pThis->iNumShards,
+					pThis->iNumWorkerThreads, pThis->iNumWorkerThreads);
+			pThis->iNumShards = pThis->iNumWorkerThreads;
+		}
+		if(pThis->iNumShards > 1 && pThis->iTargetResidency > 0) {
+			errmsg.LogError(0, RS_RET_QTYPE_UNSUPPORTED, "queue \"%s\": "
+					"queue.targetresidency is not supported for sharded "
+					"queues, ignored", obj.GetName((obj_t*) pThis));
+			pThis->iTargetResidency = 0;
+		}
+		if(pThis->iNumShards > 1 && pThis->bShardOrdered && pThis->iNumLanes > 1) {
+			errmsg.LogError(0, RS_RET_QTYPE_UNSUPPORTED, "queue \"%s\": "
+					"queue.lanes reorders messages and can not be used "
+					"with queue.ordered, lanes disabled",
+					obj.GetName((obj_t*) pThis));
+			pThis->iNumLanes = 0;
+		}
+	}
+	if(pThis->bShardOrdered && pThis->iNumShards <= 1 && pThis->iNumWorkerThreads > 1) {
+		errmsg.LogError(0, RS_RET_CONF_PARSE_WARNING, "queue \"%s\": queue.ordered "
+				"requires a sharded queue, using a single worker thread",
+				obj.GetName((obj_t*) pThis));
+		pThis->iNumWorkerThreads = 1;
+	}
+
+	if(pThis->iNumLanes > 1) {
+		if(pThis->qType != QUEUETYPE_LINKEDLIST) {
+			errmsg.LogError(0, RS_RET_QTYPE_UNSUPPORTED, "queue \"%s\": queue.lanes "
+					"is only supported for linkedList queues, lanes "
+					"disabled", obj.GetName((obj_t*) pThis));
+			pThis->iNumLanes = 0;
+		} else if(pThis->iNumLanes > QUEUE_MAX_LANES) {
+			errmsg.LogError(0, RS_RET_CONF_PARSE_WARNING, "queue \"%s\": queue.lanes "
+					"%d is larger than the maximum of %d, reduced to %d",
+					obj.GetName((obj_t*) pThis), pThis->iNumLanes,
+					QUEUE_MAX_LANES, QUEUE_MAX_LANES);
+			pThis->iNumLanes = QUEUE_MAX_LANES;
+		}
+	}
+
 	/* set type-specific handlers and other very type-specific things
 	 * (we can not totally hide it...)
 	 */
@@ -2086,7 +3969,27 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 			pThis->qDeq = qDeqLinkedList;
 			pThis->qDel = qDelLinkedList;
 			pThis->MultiEnq = qqueueMultiEnqObjNonDirect;
+			if(pThis->iNumLanes > 1) {
+				pThis->qConstruct = qConstructLanes;
+				pThis->qAdd = qAddLanes;
+				pThis->qDeq = qDeqLanes;
+			}
+			break;
+#ifdef HAVE_LOCKFREE_QUEUE
+		case QUEUETYPE_LOCKFREE:
+			pThis->qConstruct = qConstructLockFree;
+			pThis->qDestruct = qDestructLockFree;
+			pThis->qAdd = qAddLockFree;
+			pThis->qDeq = qDeqLockFree;
+			pThis->qDel = qDelLockFree;
+			pThis->MultiEnq = qqueueMultiEnqObjLockFree;
 			break;
+#else
+		case QUEUETYPE_LOCKFREE:
+			/* already remapped to FixedArray above */
+			assert(0);
+			break;
+#endif
 		case QUEUETYPE_DISK:
 			pThis->qConstruct = qConstructDisk;
 			pThis->qDestruct = qDestructDisk;
@@ -2094,14 +3997,31 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 			pThis->qDeq = qDeqDisk;
 			pThis->qDel = NULL; /* delete for disk handled via special code! */
 			pThis->MultiEnq = qqueueMultiEnqObjNonDirect;
-			/* special handling */
-			pThis->iNumWorkerThreads = 1; /* we need exactly one worker */
+			/* special handling: a pure disk queue has exactly one worker. The
+			 * disk part of a DA queue may have more (queue.da.workerthreads).
+			 * Dequeue happens under the queue mutex in any case and processed
+			 * batches are deleted in dequeue order via the to-delete list, so
+			 * the queue files stay consistent; only the processing order is lost.
+			 */
+			if(pThis->pqParent == NULL || pThis->iNumWorkerThreads < 1)
+				pThis->iNumWorkerThreads = 1;
 			/* pre-construct file name for .qi file */
 			pThis->lenQIFNam = snprintf((char*)pszQIFNam, sizeof(pszQIFNam) / sizeof(uchar),
 				"%s/%s.qi", (char*) pThis->pszSpoolDir, (char*)pThis->pszFilePrefix);
 			pThis->pszQIFNam = ustrdup(pszQIFNam);
 			DBGOPRINT((obj_t*) pThis, ".qi file name is '%s', len %d\n", pThis->pszQIFNam,
 				(int) pThis->lenQIFNam);
+			pThis->lenIdxFNam = snprintf((char*)pszQIFNam, sizeof(pszQIFNam) / sizeof(uchar),
+				"%s/%s.qx", (char*) pThis->pszSpoolDir, (char*)pThis->pszFilePrefix);
+			pThis->pszIdxFNam = ustrdup(pszQIFNam);
+			if(pThis->bSyncQueueFiles && pThis->iSyncInterval > 0) {
+				pThis->bGroupSync = 1;
+				pthread_mutex_init(&pThis->gsync.mut, NULL);
+				pthread_cond_init(&pThis->gsync.condReq, NULL);
+				pthread_cond_init(&pThis->gsync.condDone, NULL);
+				DBGOPRINT((obj_t*) pThis, "group commit enabled, sync interval %dms, "
+					  "max %lld bytes\n", pThis->iSyncInterval, pThis->iSyncMaxBytes);
+			}
 			break;
 		case QUEUETYPE_DIRECT:
 			pThis->qConstruct = qConstructDirect;
@@ -2116,8 +4036,19 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 			break;
 	}
 
+	if(pThis->iNumShards > 1) {
+		/* the messages live in the shards, we only dispatch */
+		pThis->qConstruct = qConstructDirect;
+		pThis->qDestruct = qDestructDirect;
+		pThis->qAdd = NULL;
+		pThis->qDeq = NULL;
+		pThis->qDel = NULL;
+		pThis->MultiEnq = qqueueMultiEnqObjSharded;
+	}
+
 	if(pThis->iMaxQueueSize < 100
-	   && (pThis->qType == QUEUETYPE_LINKEDLIST || pThis->qType == QUEUETYPE_FIXED_ARRAY)) {
+	   && (pThis->qType == QUEUETYPE_LINKEDLIST || pThis->qType == QUEUETYPE_FIXED_ARRAY
+	       || pThis->qType == QUEUETYPE_LOCKFREE)) {
 		errmsg.LogError(0, RS_RET_OK_WARN, "Note: queue.size=\"%d\" is very "
 			"low and can lead to unpredictable results. See also "
 			"http://www.rsyslog.com/lower-bound-for-queue-sizes/",
@@ -2214,10 +4145,71 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 		}
 	}
 
+	/* the memory based marks work the same way, but they are only used for
+	 * in-memory queues. If queue.maxmemory is set, marks not set explicitly
+	 * are derived from it just like the size based ones. Without it, only
+	 * the explicitly given marks are active.
+	 */
+	if(pThis->qType == QUEUETYPE_DISK || pThis->qType == QUEUETYPE_DIRECT) {
+		pThis->iMaxMemory = 0;
+		pThis->bResidencyStats = 0; /* we do not persist enqueue times */
+		if(pThis->iTargetResidency > 0) {
+			errmsg.LogError(0, RS_RET_QTYPE_UNSUPPORTED, "queue \"%s\": "
+					"queue.targetresidency is only supported for in-memory "
+					"queues, ignored", obj.GetName((obj_t*) pThis));
+			pThis->iTargetResidency = 0;
+		}
+		pThis->iHighWtrMrkBytes = pThis->iLowWtrMrkBytes = pThis->iDiscardMrkBytes = 0;
+		pThis->iFullDlyMrkBytes = pThis->iLightDlyMrkBytes = 0;
+	} else {
+		pThis->iHighWtrMrkBytes = qqueueMemMrkDflt(pThis, pThis->iHighWtrMrkBytes, 90);
+		pThis->iLowWtrMrkBytes = qqueueMemMrkDflt(pThis, pThis->iLowWtrMrkBytes, 70);
+		if(pThis->iHighWtrMrkBytes > 0 && pThis->iLowWtrMrkBytes > pThis->iHighWtrMrkBytes)
+			pThis->iLowWtrMrkBytes = (pThis->iHighWtrMrkBytes / 100) * 70;
+		pThis->iFullDlyMrkBytes = qqueueMemMrkDflt(pThis, pThis->iFullDlyMrkBytes, 97);
+		pThis->iLightDlyMrkBytes = qqueueMemMrkDflt(pThis, pThis->iLightDlyMrkBytes, 70);
+		pThis->iDiscardMrkBytes = qqueueMemMrkDflt(pThis, pThis->iDiscardMrkBytes, 98);
+		if(pThis->iTargetResidency > 0)
+			pThis->bResidencyStats = 1; /* the controller needs the enqueue times */
+	}
+
 	if(pThis->iMaxQueueSize > 0 && pThis->iDeqBatchSize > pThis->iMaxQueueSize) {
 		pThis->iDeqBatchSize = pThis->iMaxQueueSize;
 	}
 
+	/* the adaptive batch size starts at the max and moves between the bounds.
+	 * Disk queues (also DA) always process at full size, as their dequeue
+	 * cost does not depend that much on the batch size.
+	 */
+	if(pThis->qType == QUEUETYPE_DISK || pThis->qType == QUEUETYPE_DIRECT)
+		pThis->bAdaptiveBatch = 0;
+	if(pThis->bAdaptiveBatch) {
+		if(pThis->iMinDeqBatchSize < 1) {
+			pThis->iMinDeqBatchSize = pThis->iDeqBatchSize / 16;
+			if(pThis->iMinDeqBatchSize < 1)
+				pThis->iMinDeqBatchSize = 1;
+		}
+		if(pThis->iMinDeqBatchSize > pThis->iDeqBatchSize) {
+			errmsg.LogError(0, RS_RET_CONF_PARSE_WARNING, "queue \"%s\": "
+					"queue.minDequeueBatchSize %d is larger than "
+					"queue.dequeueBatchSize %d, set to the latter",
+					obj.GetName((obj_t*) pThis), pThis->iMinDeqBatchSize,
+					pThis->iDeqBatchSize);
+			pThis->iMinDeqBatchSize = pThis->iDeqBatchSize;
+		}
+	}
+	pThis->iDeqBatchSizeCurr = pThis->iDeqBatchSize;
+
+	/* lingering for a batch larger than we can dequeue makes no sense. The
+	 * lockfree enqueue does not take the mutex, so it can not wake a
+	 * lingering worker; we do not support lingering there.
+	 */
+	if(pThis->iLingerMin > pThis->iDeqBatchSize)
+		pThis->iLingerMin = pThis->iDeqBatchSize;
+	if(   pThis->iLingerMin < 2 || pThis->qType == QUEUETYPE_DIRECT
+	   || pThis->qType == QUEUETYPE_LOCKFREE)
+		pThis->iLingerTime = 0;
+
 	/* finalize some initializations that could not yet be done because it is
 	 * influenced by properties which might have been set after queueConstruct ()
 	 */
@@ -2232,6 +4224,7 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 
 	pthread_mutex_init(&pThis->mutThrdMgmt, NULL);
 	pthread_cond_init (&pThis->notFull, NULL);
+	pthread_cond_init (&pThis->lingerDone, NULL);
 	pthread_cond_init (&pThis->belowFullDlyWtrMrk, NULL);
 	pthread_cond_init (&pThis->belowLightDlyWtrMrk, NULL);
 
@@ -2246,6 +4239,8 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 		wrk = pThis->iHighWtrMrk - (pThis->iHighWtrMrk / 100) * 50; /* 50% of high water mark */
 		if(wrk < pThis->iFullDlyMrk)
 			pThis->iFullDlyMrk = wrk;
+		if(pThis->iHighWtrMrkBytes > 0 && pThis->iHighWtrMrkBytes / 2 < pThis->iFullDlyMrkBytes)
+			pThis->iFullDlyMrkBytes = pThis->iHighWtrMrkBytes / 2;
 	}
 
 	DBGOPRINT((obj_t*) pThis, "params: type %d, enq-only %d, disk assisted %d, spoolDir '%s', maxFileSz %lld, "
@@ -2263,6 +4258,19 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	if(pThis->qType == QUEUETYPE_DIRECT)
 		FINALIZE;	/* with direct queues, we are already finished... */
 
+	if(pThis->iNumShards > 1) {
+		/* all workers and almost all statistics live in the shards */
+		CHKiRet(StartShards(pThis));
+		/* the parent only reports the total of batches stolen between shards */
+		CHKiRet(statsobj.Construct(&pThis->statsobj));
+		CHKiRet(statsobj.SetName(pThis->statsobj, obj.GetName((obj_t*)pThis)));
+		STATSCOUNTER_INIT(pThis->ctrStolen, pThis->mutCtrStolen);
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("stolen"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrStolen));
+		CHKiRet(statsobj.ConstructFinalize(pThis->statsobj));
+		FINALIZE;
+	}
+
 	/* create worker thread pools for regular and DA operation.
 	 */
 	lenBuf = snprintf((char*)pszBuf, sizeof(pszBuf), "%s:Reg", obj.GetName((obj_t*) pThis));
@@ -2278,6 +4286,17 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	CHKiRet(wtpSettoWrkShutdown	(pThis->pWtpReg, pThis->toWrkShutdown));
 	CHKiRet(wtpSetpUsr		(pThis->pWtpReg, pThis));
 	CHKiRet(wtpConstructFinalize	(pThis->pWtpReg));
+	if(pThis->iTargetResidency > 0) {
+		/* start small, the residency controller adds workers as needed */
+		pThis->resCtl.nCap = 1;
+		pThis->resCtl.tLast = qqueueTimeUs();
+		pThis->ctrResCtlWorkers = 1;
+		wtpSetWorkerCap(pThis->pWtpReg, 1);
+	}
+#	ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	if(pThis->pCpuSet != NULL)
+		wtpSetCpuSet(pThis->pWtpReg, pThis->pCpuSet);
+#	endif
 
 	/* set up DA system if we have a disk-assisted queue */
 	if(pThis->bIsDA)
@@ -2299,9 +4318,9 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("size"),
 		ctrType_Int, CTR_FLAG_NONE, &pThis->iQueueSize));
 
-	STATSCOUNTER_INIT(pThis->ctrEnqueued, pThis->mutCtrEnqueued);
+	STATSCOUNTER_PT_INIT(pThis->ctrEnqueued);
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("enqueued"),
-		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrEnqueued));
+		ctrType_IntCtrPerThread, CTR_FLAG_RESETTABLE, &pThis->ctrEnqueued));
 
 	STATSCOUNTER_INIT(pThis->ctrFull, pThis->mutCtrFull);
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("full"),
@@ -2313,11 +4332,62 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	STATSCOUNTER_INIT(pThis->ctrNFDscrd, pThis->mutCtrNFDscrd);
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("discarded.nf"),
 		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrNFDscrd));
+	STATSCOUNTER_INIT(pThis->ctrMemDscrd, pThis->mutCtrMemDscrd);
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("discarded.memlimit"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrMemDscrd));
 
 	pThis->ctrMaxqsize = 0; /* no mutex needed, thus no init call */
 	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("maxqsize"),
 		ctrType_Int, CTR_FLAG_NONE, &pThis->ctrMaxqsize));
 
+	if(pThis->qType != QUEUETYPE_DISK) {
+		/* iMemSize is a dual-use counter: no init, no mutex! */
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("memsize"),
+			ctrType_IntCtr, CTR_FLAG_NONE, &pThis->iMemSize));
+	}
+
+	if(pThis->qType == QUEUETYPE_DISK) {
+		/* set once by the constructor, so no mutex needed, thus no init call */
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("recoverytime"),
+			ctrType_Int, CTR_FLAG_NONE, &pThis->ctrRecoveryTime));
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("persisttime"),
+			ctrType_Int, CTR_FLAG_NONE, &pThis->ctrPersistTime));
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("restoretime"),
+			ctrType_Int, CTR_FLAG_NONE, &pThis->ctrRestoreTime));
+	}
+
+	if(pThis->bAdaptiveBatch && pThis->iNumShards <= 1) {
+		/* iDeqBatchSizeCurr is a dual-use counter: no init, no mutex! */
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("batchsize"),
+			ctrType_Int, CTR_FLAG_NONE, &pThis->iDeqBatchSizeCurr));
+	}
+
+	if(pThis->bResidencyStats && pThis->iNumShards <= 1) {
+		/* updated under the queue mutex, so no init call */
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("residency.p50"),
+			ctrType_IntCtr, CTR_FLAG_NONE, &pThis->ctrResP50));
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("residency.p99"),
+			ctrType_IntCtr, CTR_FLAG_NONE, &pThis->ctrResP99));
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("residency.max"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrResMax));
+	}
+
+	if(pThis->iTargetResidency > 0) {
+		/* updated under the queue mutex, so no init call */
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("workers.target"),
+			ctrType_Int, CTR_FLAG_NONE, &pThis->ctrResCtlWorkers));
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("workers.added"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrResCtlAdded));
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("workers.retired"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrResCtlRetired));
+	}
+
+	if(pThis->pqShardParent != NULL) {
+		STATSCOUNTER_INIT(pThis->ctrStolen, pThis->mutCtrStolen);
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("stolen"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrStolen));
+	}
+
 	CHKiRet(statsobj.ConstructFinalize(pThis->statsobj));
 
 finalize_it:
@@ -2358,6 +4428,7 @@ static rsRetVal qqueuePersist(qqueue_t *pThis, int bIsCheckpoint)
 			unlink((char*)pThis->pszQIFNam);
 			pThis->bNeedDelQIF = 0;
 		}
+		unlink((char*)pThis->pszIdxFNam);
 		/* indicate spool file needs to be deleted */
 		if(pThis->tVars.disk.pReadDel != NULL) /* may be NULL if we had a startup failure! */
 			CHKiRet(strm.SetbDeleteOnClose(pThis->tVars.disk.pReadDel, 1));
@@ -2380,6 +4451,11 @@ static rsRetVal qqueuePersist(qqueue_t *pThis, int bIsCheckpoint)
 	CHKiRet(obj.BeginSerializePropBag(psQIF, (obj_t*) pThis));
 	objSerializeSCALAR(psQIF, iQueueSize, INT);
 	objSerializeSCALAR(psQIF, tVars.disk.sizeOnDisk, INT64);
+	objSerializeSCALAR(psQIF, tVars.disk.segRecs, INT64);
+	objSerializeSCALAR(psQIF, tVars.disk.segBytes, INT64);
+	if(pThis->ctrPersistTime > 0) {
+		objSerializeSCALAR(psQIF, ctrPersistTime, INT);
+	}
 	CHKiRet(obj.EndSerialize(psQIF));
 
 	/* now persist the stream info */
@@ -2458,8 +4534,10 @@ DoSaveOnShutdown(qqueue_t *pThis)
 	DBGOPRINT((obj_t*) pThis, "bSaveOnShutdown set, restarting DA worker...\n");
 	pThis->bShutdownImmediate = 0; /* would termiante the DA worker! */
 	pThis->iLowWtrMrk = 0;
+	d_pthread_mutex_lock(pThis->mut); /* wtpAdviseMaxWorkers() needs it */
 	wtpSetState(pThis->pWtpDA, wtpState_SHUTDOWN);	/* shutdown worker (only) when done (was _IMMEDIATE!) */
 	wtpAdviseMaxWorkers(pThis->pWtpDA, 1);		/* restart DA worker */
+	d_pthread_mutex_unlock(pThis->mut);
 
 	DBGOPRINT((obj_t*) pThis, "waiting for DA worker to terminate...\n");
 	timeoutComp(&tTimeout, QUEUE_TIMEOUT_ETERNAL);
@@ -2476,22 +4554,110 @@ DoSaveOnShutdown(qqueue_t *pThis)
 }
 
 
+/* shut down all workers of a queue and persist it, if bSaveOnShutdown is
+ * set. This is the first part of the destructor. It is a separate function
+ * so that it can be done for many queues in parallel at shutdown, see
+ * qqueueShutdownParallel(). Calling it more than once is harmless.
+ */
+static rsRetVal
+qqueueShutdown(qqueue_t *pThis)
+{
+	struct timespec tStart, tEnd;
+	DEFiRet;
+
+	if(!pThis->bQueueStarted || pThis->bShutdownDone)
+		FINALIZE;
+	pThis->bShutdownDone = 1;
+	timeoutComp(&tStart, 0);
+
+	if(pThis->ppShards != NULL)
+		DestructShards(pThis);
+
+	/* shut down all workers
+	 * We do not need to shutdown workers when we are in enqueue-only mode or we are a
+	 * direct queue - because in both cases we have none... ;)
+	 * with a child! -- rgerhards, 2008-01-28
+	 */
+	if(pThis->qType != QUEUETYPE_DIRECT && !pThis->bEnqOnly && pThis->pqParent == NULL
+	   && pThis->pWtpReg != NULL)
+		ShutdownWorkers(pThis);
+
+	if(pThis->bIsDA && getPhysicalQueueSize(pThis) > 0 && pThis->bSaveOnShutdown) {
+		CHKiRet(DoSaveOnShutdown(pThis));
+		/* the DA queue records the time in its .qi file, so that it can
+		 * be reported as stat after the restart.
+		 */
+		timeoutComp(&tEnd, 0);
+		if(pThis->pqDA != NULL) {
+			pThis->pqDA->ctrPersistTime = (tEnd.tv_sec - tStart.tv_sec) * 1000
+						    + (tEnd.tv_nsec - tStart.tv_nsec) / 1000000;
+			if(pThis->pqDA->ctrPersistTime == 0)
+				pThis->pqDA->ctrPersistTime = 1; /* 0 means "not persisted" */
+			DBGOPRINT((obj_t*) pThis, "queue persisted within %d ms\n",
+				  pThis->pqDA->ctrPersistTime);
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+static void *
+qqueueShutdownThrd(void *arg)
+{
+	qqueueShutdown((qqueue_t*) arg);
+	return NULL;
+}
+
+
+/* shut down and persist (see qqueueShutdown()) a number of queues in
+ * parallel, one thread per queue. With many action queues, doing this
+ * sequentially in the destructors can take so long that the shutdown
+ * times out. The queues must be independent of each other, that is no
+ * queue in the set may still be fed by a worker of another one.
+ */
+rsRetVal
+qqueueShutdownParallel(qqueue_t **ppQueues, int nQueues)
+{
+	pthread_t *tids;
+	sbool *bStarted;
+	int i;
+	DEFiRet;
+
+	if(nQueues == 0)
+		FINALIZE;
+	tids = calloc(nQueues, sizeof(pthread_t));
+	bStarted = calloc(nQueues, sizeof(sbool));
+	if(tids == NULL || bStarted == NULL) {
+		/* the destructors will do it sequentially */
+		free(tids);
+		free(bStarted);
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	for(i = 0 ; i < nQueues ; ++i) {
+		if(pthread_create(&tids[i], NULL, qqueueShutdownThrd, ppQueues[i]) == 0)
+			bStarted[i] = 1;
+		else
+			qqueueShutdown(ppQueues[i]);
+	}
+	for(i = 0 ; i < nQueues ; ++i) {
+		if(bStarted[i])
+			pthread_join(tids[i], NULL);
+	}
+	free(tids);
+	free(bStarted);
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* destructor for the queue object */
 BEGINobjDestruct(qqueue) /* be sure to specify the object type also in END and CODESTART macros! */
 CODESTARTobjDestruct(qqueue)
 	if(pThis->bQueueStarted) {
-		/* shut down all workers
-		 * We do not need to shutdown workers when we are in enqueue-only mode or we are a
-		 * direct queue - because in both cases we have none... ;)
-		 * with a child! -- rgerhards, 2008-01-28
-		 */
-		if(pThis->qType != QUEUETYPE_DIRECT && !pThis->bEnqOnly && pThis->pqParent == NULL
-		   && pThis->pWtpReg != NULL)
-			ShutdownWorkers(pThis);
-
-		if(pThis->bIsDA && getPhysicalQueueSize(pThis) > 0 && pThis->bSaveOnShutdown) {
-			CHKiRet(DoSaveOnShutdown(pThis));
-		}
+		CHKiRet(qqueueShutdown(pThis));
 
 		/* finally destruct our (regular) worker thread pool
 		 * Note: currently pWtpReg is never NULL, but if we optimize our logic, this may happen,
@@ -2538,11 +4704,18 @@ CODESTARTobjDestruct(qqueue)
 		}
 		pthread_mutex_destroy(&pThis->mutThrdMgmt);
 		pthread_cond_destroy(&pThis->notFull);
+		pthread_cond_destroy(&pThis->lingerDone);
 		pthread_cond_destroy(&pThis->belowFullDlyWtrMrk);
 		pthread_cond_destroy(&pThis->belowLightDlyWtrMrk);
 
 		DESTROY_ATOMIC_HELPER_MUT(pThis->mutQueueSize);
 		DESTROY_ATOMIC_HELPER_MUT(pThis->mutLogDeq);
+		DESTROY_ATOMIC_HELPER_MUT64(pThis->mutMemSize);
+		if(pThis->bGroupSync) {
+			pthread_mutex_destroy(&pThis->gsync.mut);
+			pthread_cond_destroy(&pThis->gsync.condReq);
+			pthread_cond_destroy(&pThis->gsync.condDone);
+		}
 
 		/* type-specific destructor */
 		iRet = pThis->qDestruct(pThis);
@@ -2550,6 +4723,19 @@ CODESTARTobjDestruct(qqueue)
 
 	free(pThis->pszFilePrefix);
 	free(pThis->pszSpoolDir);
+	free(pThis->pszCmprDict);
+	if(pThis->pLaneProp != NULL && pThis->pqShardParent == NULL) {
+		msgPropDescrDestruct(pThis->pLaneProp);
+		free(pThis->pLaneProp);
+	}
+	if(pThis->pShardProp != NULL) {
+		msgPropDescrDestruct(pThis->pShardProp);
+		free(pThis->pShardProp);
+	}
+#	ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	if(pThis->pqShardParent == NULL)
+		free(pThis->pCpuSet);
+#	endif
 	if(pThis->useCryprov) {
 		pThis->cryprov.Destruct(&pThis->cryprovData);
 		obj.ReleaseObj(__FILE__, pThis->cryprovNameFull+2, pThis->cryprovNameFull,
@@ -2639,11 +4825,25 @@ doEnqSingleObj(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
 	int err;
 	struct timespec t;
 
-	STATSCOUNTER_INC(pThis->ctrEnqueued, pThis->mutCtrEnqueued);
+	STATSCOUNTER_PT_INC(pThis->ctrEnqueued);
 	/* first check if we need to discard this message (which will cause CHKiRet() to exit)
 	 */
 	CHKiRet(qqueueChkDiscardMsg(pThis, pThis->iQueueSize, pMsg));
 
+	/* global memory limit: DA queues spill to disk instead (see
+	 * qqueueAdviseMaxWorkers()), other in-memory queues discard. Waiting
+	 * would not help, as the memory is most probably held by some other
+	 * queue. An empty queue still accepts messages, so that the pipeline
+	 * keeps moving and the queues that hold the memory can drain.
+	 */
+	if(   !pThis->bIsDA && pThis->qType != QUEUETYPE_DISK && pThis->qType != QUEUETYPE_DIRECT
+	   && pThis->iQueueSize > 0 && memacctOverLimit()) {
+		DBGOPRINT((obj_t*) pThis, "doEnqSingleObject: global memory limit exceeded, discarding\n");
+		STATSCOUNTER_INC(pThis->ctrMemDscrd, pThis->mutCtrMemDscrd);
+		msgDestruct(&pMsg);
+		ABORT_FINALIZE(RS_RET_QUEUE_FULL);
+	}
+
 	/* handle flow control
 	 * There are two different flow control mechanisms: basic and advanced flow control.
 	 * Basic flow control has always been implemented and protects the queue structures
@@ -2665,7 +4865,8 @@ doEnqSingleObj(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
 	 * It's a side effect, but a good one ;) -- rgerhards, 2008-03-14
 	 */
 	if(flowCtlType == eFLOWCTL_FULL_DELAY) {
-		while(pThis->iQueueSize >= pThis->iFullDlyMrk&& ! glbl.GetGlobalInputTermState()) {
+		while(   (pThis->iQueueSize >= pThis->iFullDlyMrk || qqueueMemAboveMrk(pThis, pThis->iFullDlyMrkBytes))
+		      && ! glbl.GetGlobalInputTermState()) {
 			/* We have a problem during shutdown if we block eternally. In that
 			 * case, the the input thread cannot be terminated. So we wake up
 			 * from time to time to check for termination.
@@ -2693,7 +4894,7 @@ doEnqSingleObj(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
 			DBGPRINTF("wti worker in full delay timed out, checking termination...\n");
 		}
 	} else if(flowCtlType == eFLOWCTL_LIGHT_DELAY && !glbl.GetGlobalInputTermState()) {
-		if(pThis->iQueueSize >= pThis->iLightDlyMrk) {
+		if(pThis->iQueueSize >= pThis->iLightDlyMrk || qqueueMemAboveMrk(pThis, pThis->iLightDlyMrkBytes)) {
 			DBGOPRINT((obj_t*) pThis, "doEnqSingleObject: LightDelay mark reached for light "
 			          "delayable message - blocking a bit.\n");
 			timeoutComp(&t, 1000); /* 1000 millisconds = 1 second TODO: make configurable */
@@ -2713,12 +4914,16 @@ doEnqSingleObj(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
 	 * the queue to become ready or drop the new message. -- rgerhards, 2008-03-14
 	 */
 	while(   (pThis->iMaxQueueSize > 0 && pThis->iQueueSize >= pThis->iMaxQueueSize)
+	      || (pThis->iQueueSize > 0 && qqueueMemAboveMrk(pThis, pThis->iMaxMemory))
 	      || ((pThis->qType == QUEUETYPE_DISK || pThis->bIsDA) && pThis->sizeOnDiskMax != 0
 	      	  && pThis->tVars.disk.sizeOnDisk > pThis->sizeOnDiskMax)) {
 		STATSCOUNTER_INC(pThis->ctrFull, pThis->mutCtrFull);
+		TRACE(TRC_QUEUE, "queue %p: full, size %d, max %d, timeout %dms",
+		      (intptr_t) pThis, pThis->iQueueSize, pThis->iMaxQueueSize, pThis->toEnq);
 		if(pThis->toEnq == 0 || pThis->bEnqOnly) {
 			DBGOPRINT((obj_t*) pThis, "doEnqSingleObject: queue FULL - configured for immediate discarding QueueSize=%d "
-				"MaxQueueSize=%d sizeOnDisk=%lld sizeOnDiskMax=%lld\n", pThis->iQueueSize, pThis->iMaxQueueSize,
+				"MaxQueueSize=%d MemSize=%lld MaxMemory=%lld sizeOnDisk=%lld sizeOnDiskMax=%lld\n",
+				pThis->iQueueSize, pThis->iMaxQueueSize, (long long) pThis->iMemSize, pThis->iMaxMemory,
 				pThis->tVars.disk.sizeOnDisk, pThis->sizeOnDiskMax); 
 			STATSCOUNTER_INC(pThis->ctrFDscrd, pThis->mutCtrFDscrd);
 			msgDestruct(&pMsg);
@@ -2732,6 +4937,8 @@ doEnqSingleObj(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
 			timeoutComp(&t, pThis->toEnq);
 			if(pthread_cond_timedwait(&pThis->notFull, pThis->mut, &t) != 0) {
 				DBGOPRINT((obj_t*) pThis, "doEnqSingleObject: cond timeout, dropping message!\n");
+				TRACE(TRC_QUEUE, "queue %p: still full after timeout, message discarded",
+				      (intptr_t) pThis);
 				STATSCOUNTER_INC(pThis->ctrFDscrd, pThis->mutCtrFDscrd);
 				msgDestruct(&pMsg);
 				ABORT_FINALIZE(RS_RET_QUEUE_FULL);
@@ -2743,6 +4950,9 @@ doEnqSingleObj(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
 	/* and finally enqueue the message */
 	CHKiRet(qqueueAdd(pThis, pMsg));
 	STATSCOUNTER_SETMAX_NOMUT(pThis->ctrMaxqsize, pThis->iQueueSize);
+	if(pThis->iQueueSize == pThis->iLingerMin)
+		pthread_cond_broadcast(&pThis->lingerDone);
+	RS_PROBE(queue_enq, (char*) ((obj_t*) pThis)->pszName, pThis->iQueueSize);
 
 finalize_it:
 	RETiRet;
@@ -2766,11 +4976,17 @@ qqueueMultiEnqObjNonDirect(qqueue_t *pThis, multi_submit_t *pMultiSub)
 	int iCancelStateSave;
 	int i;
 	rsRetVal localRet;
+	uint64 syncPos = 0;
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, qqueue);
 	assert(pMultiSub != NULL);
 
+	if(pThis->iCmprThreshold > 0) {
+		for(i = 0 ; i < pMultiSub->nElem ; ++i)
+			pMultiSub->ppMsgs[i] = qqueuePackMsg(pThis, pMultiSub->ppMsgs[i]);
+	}
+
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
 	d_pthread_mutex_lock(pThis->mut);
 	for(i = 0 ; i < pMultiSub->nElem ; ++i) {
@@ -2781,10 +4997,14 @@ qqueueMultiEnqObjNonDirect(qqueue_t *pThis, multi_submit_t *pMultiSub)
 	qqueueChkPersist(pThis, pMultiSub->nElem);
 
 finalize_it:
+	if(pThis->bGroupSync)
+		syncPos = pThis->gsync.written;
 	/* make sure at least one worker is running. */
 	qqueueAdviseMaxWorkers(pThis);
 	/* and release the mutex */
 	d_pthread_mutex_unlock(pThis->mut);
+	if(syncPos != 0)
+		qqueueWaitGroupSync(pThis, syncPos);
 	pthread_setcancelstate(iCancelStateSave, NULL);
 	DBGOPRINT((obj_t*) pThis, "MultiEnqObj advised worker start\n");
 
@@ -2809,26 +5029,372 @@ qqueueMultiEnqObjDirect(qqueue_t *pThis, multi_submit_t *pMultiSub)
 finalize_it:
 	RETiRet;
 }
-/* ------------------------------ END multi-enqueue functions ------------------------------ */
+#ifdef HAVE_LOCKFREE_QUEUE
+/* check if a message can be enqueued into a lockFree queue without
+ * acquiring the queue mutex. This is the case as long as none of the
+ * watermarks is reached that may require discarding, flow control
+ * delays or DA mode. If one is reached, the caller must use the regular
+ * (mutex-protected) enqueue path, which provides just the same semantics
+ * as for the other queue types. The fill level is read without
+ * synchronization, which is OK for the same reasons as outlined in
+ * qqueueChkDiscardMsg().
+ */
+static inline int
+canEnqLockFree(qqueue_t *pThis, flowControl_t flowCtlType)
+{
+	const int iQueueSize = pThis->iQueueSize;
+
+	if(pThis->bIsDA || pThis->bEnqOnly)
+		return 0;
+	if(iQueueSize >= pThis->iMaxQueueSize)
+		return 0;
+	if(pThis->iDiscardMrk > 0 && iQueueSize >= pThis->iDiscardMrk)
+		return 0;
+	if(flowCtlType == eFLOWCTL_FULL_DELAY && iQueueSize >= pThis->iFullDlyMrk)
+		return 0;
+	if(flowCtlType == eFLOWCTL_LIGHT_DELAY && iQueueSize >= pThis->iLightDlyMrk)
+		return 0;
+	if(   qqueueMemAboveMrk(pThis, pThis->iMaxMemory)
+	   || qqueueMemAboveMrk(pThis, pThis->iDiscardMrkBytes)
+	   || (flowCtlType == eFLOWCTL_FULL_DELAY && qqueueMemAboveMrk(pThis, pThis->iFullDlyMrkBytes))
+	   || (flowCtlType == eFLOWCTL_LIGHT_DELAY && qqueueMemAboveMrk(pThis, pThis->iLightDlyMrkBytes)))
+		return 0;
+	if(memacctOverLimit())
+		return 0; /* doEnqSingleObj() applies the global limit */
+	return 1;
+}
 
 
-/* enqueue a new user data element 
- * Enqueues the new element and awakes worker thread.
+/* enqueue a single message without holding the queue mutex. We need to
+ * tell the caller if workers must be advised. This is the case if the queue
+ * was (logically) empty before, because then all workers may be idle, and
+ * when we cross a iMinMsgsPerWrkr boundary (additional worker needed). Note
+ * that we must use our own, atomically obtained, queue size for this check:
+ * that guarantees that at least the first producer after the queue went
+ * empty wakes up the workers. Advising is then done under the mutex, so there
+ * is no lost wakeup race with workers going idle.
  */
-rsRetVal
-qqueueEnqMsg(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
+static inline rsRetVal
+doEnqSingleObjLockFree(qqueue_t *pThis, msg_t *pMsg, int *pbNeedAdvise)
 {
+	int iQueueSize;
+	int iLogSize;
+	int64 memSize;
 	DEFiRet;
+
+	memSize = qqueueMsgMemSize(pMsg);
+	CHKiRet(qAddLockFree(pThis, pMsg));
+	STATSCOUNTER_PT_INC(pThis->ctrEnqueued);
+	ATOMIC_ADD_uint64(&pThis->iMemSize, memSize, &pThis->mutMemSize);
+	memacctAdd(MEMACCT_QUEUES, memSize);
+	iQueueSize = ATOMIC_ADD_AND_FETCH_int(&pThis->iQueueSize, 1, &pThis->mutQueueSize);
+	STATSCOUNTER_SETMAX_NOMUT(pThis->ctrMaxqsize, iQueueSize);
+
+	iLogSize = iQueueSize - ATOMIC_FETCH_32BIT(&pThis->nLogDeq, &pThis->mutLogDeq);
+	if(   iLogSize <= 1
+	   || (pThis->iNumWorkerThreads > 1 && pThis->iMinMsgsPerWrkr > 0 && iLogSize % pThis->iMinMsgsPerWrkr == 0)) {
+		*pbNeedAdvise = 1;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* multi-enqueue for the lockFree queue type. We enqueue without the mutex
+ * for as long as we can. As soon as a watermark is hit, we enqueue the
+ * remaining messages via the regular, mutex-protected code path.
+ */
+static rsRetVal
+qqueueMultiEnqObjLockFree(qqueue_t *pThis, multi_submit_t *pMultiSub)
+{
 	int iCancelStateSave;
+	int i;
+	int bNeedAdvise = 0;
+	rsRetVal localRet = RS_RET_OK;
+	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, qqueue);
+	assert(pMultiSub != NULL);
+
+	if(pThis->iCmprThreshold > 0) {
+		for(i = 0 ; i < pMultiSub->nElem ; ++i)
+			pMultiSub->ppMsgs[i] = qqueuePackMsg(pThis, pMultiSub->ppMsgs[i]);
+	}
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+	for(i = 0 ; i < pMultiSub->nElem ; ++i) {
+		if(!canEnqLockFree(pThis, pMultiSub->ppMsgs[i]->flowCtlType))
+			break;
+		localRet = doEnqSingleObjLockFree(pThis, pMultiSub->ppMsgs[i], &bNeedAdvise);
+		if(localRet != RS_RET_OK && localRet != RS_RET_QUEUE_FULL)
+			ABORT_FINALIZE(localRet);
+	}
+
+	if(i < pMultiSub->nElem) {
+		/* slow path for the rest of the batch */
+		d_pthread_mutex_lock(pThis->mut);
+		for( ; i < pMultiSub->nElem ; ++i) {
+			localRet = doEnqSingleObj(pThis, pMultiSub->ppMsgs[i]->flowCtlType, (void*)pMultiSub->ppMsgs[i]);
+			if(localRet != RS_RET_OK && localRet != RS_RET_QUEUE_FULL)
+				break;
+		}
+		qqueueAdviseMaxWorkers(pThis);
+		d_pthread_mutex_unlock(pThis->mut);
+		bNeedAdvise = 0;
+		if(localRet != RS_RET_OK && localRet != RS_RET_QUEUE_FULL)
+			ABORT_FINALIZE(localRet);
+	}
+
+finalize_it:
+	if(bNeedAdvise) {
+		d_pthread_mutex_lock(pThis->mut);
+		qqueueAdviseMaxWorkers(pThis);
+		d_pthread_mutex_unlock(pThis->mut);
+		DBGOPRINT((obj_t*) pThis, "MultiEnqObjLockFree advised worker start\n");
+	}
+	pthread_setcancelstate(iCancelStateSave, NULL);
+
+	RETiRet;
+}
+
+
+/* single-message enqueue for the lockFree queue type, see
+ * qqueueMultiEnqObjLockFree() for details.
+ */
+static rsRetVal
+qqueueEnqMsgLockFree(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
+{
+	int iCancelStateSave;
+	int bNeedAdvise = 0;
+	DEFiRet;
+
+	if(pThis->iCmprThreshold > 0)
+		pMsg = qqueuePackMsg(pThis, pMsg);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+	if(canEnqLockFree(pThis, flowCtlType)) {
+		iRet = doEnqSingleObjLockFree(pThis, pMsg, &bNeedAdvise);
+		if(bNeedAdvise) {
+			d_pthread_mutex_lock(pThis->mut);
+			qqueueAdviseMaxWorkers(pThis);
+			d_pthread_mutex_unlock(pThis->mut);
+		}
+	} else {
+		d_pthread_mutex_lock(pThis->mut);
+		iRet = doEnqSingleObj(pThis, flowCtlType, pMsg);
+		if(iRet == RS_RET_OK)
+			qqueueChkPersist(pThis, 1);
+		qqueueAdviseMaxWorkers(pThis);
+		d_pthread_mutex_unlock(pThis->mut);
+	}
+	pthread_setcancelstate(iCancelStateSave, NULL);
+
+	RETiRet;
+}
+#endif /* #ifdef HAVE_LOCKFREE_QUEUE */
+
+
+/* hash the sender of a message for shard selection. We must not trigger
+ * a DNS lookup here, so for unresolved messages the raw address is used.
+ */
+static inline unsigned
+getSenderHash(msg_t *pMsg)
+{
+	struct sockaddr_storage *addr;
+	uchar *p;
+	int len;
+	unsigned hash = 2166136261u; /* FNV-1a */
+
+	if(pMsg->msgFlags & NEEDS_DNSRESOL) {
+		addr = pMsg->rcvFrom.pfrominet;
+		if(addr->ss_family == AF_INET) {
+			p = (uchar*) &((struct sockaddr_in*) addr)->sin_addr;
+			len = sizeof(struct in_addr);
+		} else if(addr->ss_family == AF_INET6) {
+			p = (uchar*) &((struct sockaddr_in6*) addr)->sin6_addr;
+			len = sizeof(struct in6_addr);
+		} else {
+			return 0;
+		}
+	} else if(pMsg->pRcvFromIP != NULL) {
+		p = propGetSzStr(pMsg->pRcvFromIP);
+		len = pMsg->pRcvFromIP->len;
+	} else if(pMsg->rcvFrom.pRcvFrom != NULL) {
+		p = propGetSzStr(pMsg->rcvFrom.pRcvFrom);
+		len = pMsg->rcvFrom.pRcvFrom->len;
+	} else {
+		return 0;
+	}
+
+	while(len-- > 0)
+		hash = (hash ^ *p++) * 16777619u;
+	return hash;
+}
+
+
+/* hash the submitting thread for shard selection */
+static inline unsigned
+getThreadHash(void)
+{
+	unsigned long id = (unsigned long) pthread_self();
+	id ^= id >> 16;
+	return (unsigned) (id * 2654435761u);
+}
+
+
+/* hash the value of the shard key property. Most useful properties (like
+ * hostname) are only available once the message is parsed, which for main
+ * and ruleset queues usually happens after dequeue. So we parse here, in the
+ * submitting thread, and the queue worker later finds the message parsed.
+ * If parsing fails, the worker will retry and discard the message.
+ */
+static inline unsigned
+getPropHash(qqueue_t *pThis, msg_t *pMsg)
+{
+	uchar *pszVal;
+	uchar *p;
+	rs_size_t lenVal;
+	unsigned short bMustBeFreed = 0;
+	unsigned hash = 2166136261u;
+
+	if(pMsg->msgFlags & NEEDS_PARSING)
+		parser.ParseMsg(pMsg);
+	pszVal = MsgGetProp(pMsg, NULL, pThis->pShardProp, &lenVal, &bMustBeFreed, NULL);
+	for(p = pszVal ; lenVal-- > 0 ; )
+		hash = (hash ^ *p++) * 16777619u;
+	if(bMustBeFreed)
+		free(pszVal);
+	return hash;
+}
+
+
+static inline int
+getShardIdx(qqueue_t *pThis, msg_t *pMsg)
+{
+	if(pThis->pShardProp != NULL)
+		return getPropHash(pThis, pMsg) % pThis->iNumShards;
+	return (pThis->bShardBySender ? getSenderHash(pMsg) : getThreadHash()) % pThis->iNumShards;
+}
+
+
+/* check if a shard has more work waiting than its own workers can take
+ * in one round. If so, wake up a worker of an idle sibling, which will find
+ * its own shard empty and steal from the busy one. All sizes are read without
+ * the mutex, this is a heuristic only. Must be called without any queue
+ * mutex being held.
+ */
+static inline void
+ShardChkBalance(qqueue_t *pThis, qqueue_t *pShard)
+{
+	qqueue_t *pSibling;
+	int i;
+
+	if(pThis->bShardOrdered)
+		return; /* siblings do not steal */
+	if(getLogicalQueueSize(pShard) <= pShard->iDeqBatchSize * pShard->iNumWorkerThreads)
+		return;
+
+	for(i = 1 ; i < pThis->iNumShards ; ++i) {
+		pSibling = pThis->ppShards[(pShard->iShardIdx + i) % pThis->iNumShards];
+		if(getLogicalQueueSize(pSibling) == 0 && pSibling->pWtpReg != NULL) {
+			d_pthread_mutex_lock(pSibling->mut);
+			wtpAdviseMaxWorkers(pSibling->pWtpReg, 1);
+			d_pthread_mutex_unlock(pSibling->mut);
+			break;
+		}
+	}
+}
+
+
+/* multi-enqueue for sharded queues. With the thread key, the whole batch goes
+ * to a single shard. With the sender or a property key, runs of consecutive
+ * messages for the same shard are submitted together, which keeps the order.
+ */
+static rsRetVal
+qqueueMultiEnqObjSharded(qqueue_t *pThis, multi_submit_t *pMultiSub)
+{
+	qqueue_t *pShard;
+	multi_submit_t subRun;
+	int iCancelStateSave;
+	int iStart, iEnd;
+	int idx, idxNext;
+	rsRetVal localRet;
+	DEFiRet;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+	if(!pThis->bShardBySender && pThis->pShardProp == NULL) {
+		pShard = pThis->ppShards[getThreadHash() % pThis->iNumShards];
+		iRet = pShard->MultiEnq(pShard, pMultiSub);
+		ShardChkBalance(pThis, pShard);
+		FINALIZE;
+	}
+
+	if(pMultiSub->nElem == 0)
+		FINALIZE;
+	idxNext = getShardIdx(pThis, pMultiSub->ppMsgs[0]);
+	for(iStart = 0 ; iStart < pMultiSub->nElem ; iStart = iEnd) {
+		idx = idxNext;
+		for(iEnd = iStart + 1 ; iEnd < pMultiSub->nElem ; ++iEnd) {
+			idxNext = getShardIdx(pThis, pMultiSub->ppMsgs[iEnd]);
+			if(idxNext != idx)
+				break;
+		}
+		subRun.ppMsgs = pMultiSub->ppMsgs + iStart;
+		subRun.nElem = subRun.maxElem = iEnd - iStart;
+		pShard = pThis->ppShards[idx];
+		localRet = pShard->MultiEnq(pShard, &subRun);
+		if(localRet != RS_RET_OK)
+			iRet = localRet;
+		ShardChkBalance(pThis, pShard);
+	}
+
+finalize_it:
+	pthread_setcancelstate(iCancelStateSave, NULL);
+	RETiRet;
+}
+
+
+/* single-message enqueue for sharded queues */
+static rsRetVal
+qqueueEnqMsgSharded(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
+{
+	qqueue_t *pShard;
+	int iCancelStateSave;
+	DEFiRet;
+
+	pShard = pThis->ppShards[getShardIdx(pThis, pMsg)];
+	iRet = qqueueEnqMsg(pShard, flowCtlType, pMsg);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+	ShardChkBalance(pThis, pShard);
+	pthread_setcancelstate(iCancelStateSave, NULL);
+
+	RETiRet;
+}
+/* ------------------------------ END multi-enqueue functions ------------------------------ */
+
+
+/* enqueue a single message, but do not wait for a group commit to cover
+ * it. Instead, if group commit is active, the position that must be synced
+ * is stored in *pSyncPos (which is left untouched otherwise). That way,
+ * callers enqueueing many messages need to wait only once. This function
+ * does not handle sharded and lockFree queues.
+ */
+static rsRetVal
+qqueueEnqMsgDeferSync(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg, uint64 *pSyncPos)
+{
+	DEFiRet;
+	int iCancelStateSave;
 
+	if(pThis->iCmprThreshold > 0)
+		pMsg = qqueuePackMsg(pThis, pMsg);
 	if(pThis->qType != QUEUETYPE_DIRECT) {
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
 		d_pthread_mutex_lock(pThis->mut);
 	}
 
 	CHKiRet(doEnqSingleObj(pThis, flowCtlType, pMsg));
+	if(pThis->bGroupSync)
+		*pSyncPos = pThis->gsync.written;
 
 	qqueueChkPersist(pThis, 1);
 
@@ -2846,6 +5412,34 @@ finalize_it:
 }
 
 
+/* enqueue a new user data element 
+ * Enqueues the new element and awakes worker thread. With group commit,
+ * we return only after the element has been synced to disk.
+ */
+rsRetVal
+qqueueEnqMsg(qqueue_t *pThis, flowControl_t flowCtlType, msg_t *pMsg)
+{
+	uint64 syncPos = 0;
+	DEFiRet;
+
+	ISOBJ_TYPE_assert(pThis, qqueue);
+
+	if(pThis->ppShards != NULL)
+		return qqueueEnqMsgSharded(pThis, flowCtlType, pMsg);
+
+#ifdef HAVE_LOCKFREE_QUEUE
+	if(pThis->qType == QUEUETYPE_LOCKFREE)
+		return qqueueEnqMsgLockFree(pThis, flowCtlType, pMsg);
+#endif
+
+	iRet = qqueueEnqMsgDeferSync(pThis, flowCtlType, pMsg, &syncPos);
+	if(syncPos != 0)
+		qqueueWaitGroupSync(pThis, syncPos);
+
+	RETiRet;
+}
+
+
 /* are any queue params set at all? 1 - yes, 0 - no
  * We need to evaluate the param block for this function, which is somewhat
  * inefficient. HOWEVER, this is only done during config load, so we really
@@ -2864,6 +5458,114 @@ queueCnfParamsSet(struct nvlst *lst)
 }
 
 
+/* set a message property as shard key. Parsing may be needed to obtain
+ * the property, so this also loads the parser interface.
+ */
+static rsRetVal
+qqueueSetShardProp(qqueue_t *pThis, uchar *pszProp)
+{
+	msgPropDescr_t *pProp = NULL;
+	DEFiRet;
+
+	if(!bParserIfLoaded) {
+		CHKiRet(objUse(parser, CORE_COMPONENT));
+		bParserIfLoaded = 1;
+	}
+	CHKmalloc(pProp = calloc(1, sizeof(msgPropDescr_t)));
+	CHKiRet(msgPropDescrFill(pProp, pszProp, ustrlen(pszProp)));
+	if(pThis->pShardProp != NULL) {
+		msgPropDescrDestruct(pThis->pShardProp);
+		free(pThis->pShardProp);
+	}
+	pThis->pShardProp = pProp;
+	pProp = NULL;
+
+finalize_it:
+	free(pProp);
+	RETiRet;
+}
+
+
+/* load the cmpr interface. It is only loaded if some queue actually uses
+ * compression. Returns 0 (after reporting the problem) if that fails.
+ */
+static int
+qqueueLoadCmpr(qqueue_t *pThis)
+{
+	rsRetVal localRet;
+
+	if(!bCmprIfLoaded) {
+		localRet = objUse(cmpr, LM_CMPR_FILENAME);
+		if(localRet != RS_RET_OK) {
+			errmsg.LogError(0, localRet, "error on queue '%s', could not load "
+					"compression module - compression disabled",
+					obj.GetName((obj_t*) pThis));
+			return 0;
+		}
+		bCmprIfLoaded = 1;
+	}
+	return 1;
+}
+
+
+/* set the compression algorithm for queue files by name. */
+static void
+qqueueSetCmprAlgo(qqueue_t *pThis, uchar *pszAlgo)
+{
+	int algo;
+
+	if(!qqueueLoadCmpr(pThis))
+		return;
+	if(cmpr.GetAlgo(pszAlgo, &algo) != RS_RET_OK || !cmpr.IsSupported(algo)) {
+		errmsg.LogError(0, RS_RET_CMPR_ALGO_UNSUPPORTED, "error on queue '%s', compression "
+				"algorithm '%s' is not supported - compression disabled",
+				obj.GetName((obj_t*) pThis), pszAlgo);
+		return;
+	}
+	pThis->iCmprAlgo = algo;
+}
+
+
+/* check and set up in-memory compression (queue.compression.threshold).
+ * It uses queue.compression.algorithm, if given, and lz4 otherwise (or
+ * zlib, if this build has no lz4). gzip is just zlib with a file header,
+ * so zlib is used instead. If in-memory compression can not be used,
+ * the threshold is reset to 0.
+ */
+static void
+qqueueSetMemCmpr(qqueue_t *pThis)
+{
+	const char *pszReason = NULL;
+
+	if(pThis->qType == QUEUETYPE_DIRECT || pThis->qType == QUEUETYPE_DISK) {
+		pszReason = "is only supported for in-memory queues";
+	} else if(pThis->pLaneProp != NULL) {
+		pszReason = "can not be used with a lane key property";
+	} else if(!qqueueLoadCmpr(pThis)) {
+		pThis->iCmprThreshold = 0;
+		return;
+	}
+	if(pszReason != NULL) {
+		errmsg.LogError(0, RS_RET_PARAM_ERROR, "error on queue '%s', "
+				"queue.compression.threshold %s - ignored",
+				obj.GetName((obj_t*) pThis), pszReason);
+		pThis->iCmprThreshold = 0;
+		return;
+	}
+
+	if(pThis->iCmprAlgo == CMPR_ALGO_NONE) {
+		pThis->iMemCmprAlgo = cmpr.IsSupported(CMPR_ALGO_LZ4) ? CMPR_ALGO_LZ4 : CMPR_ALGO_ZLIB;
+	} else if(pThis->iCmprAlgo == CMPR_ALGO_GZIP) {
+		pThis->iMemCmprAlgo = CMPR_ALGO_ZLIB;
+	} else {
+		pThis->iMemCmprAlgo = pThis->iCmprAlgo;
+	}
+	DBGPRINTF("queue '%s': compressing messages of %lld bytes and more with %s\n",
+		  obj.GetName((obj_t*) pThis), (long long) pThis->iCmprThreshold,
+		  cmpr.GetAlgoName(pThis->iMemCmprAlgo));
+}
+
+
 static inline rsRetVal
 initCryprov(qqueue_t *pThis, struct nvlst *lst)
 {
@@ -2917,6 +5619,7 @@ rsRetVal
 qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 {
 	int i;
+	char *cstr;
 	struct cnfparamvals *pvals;
 
 	pvals = nvlstGetParams(lst, &pblk, NULL);
@@ -2932,6 +5635,17 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 			pThis->lenFilePrefix = es_strlen(pvals[i].val.d.estr);
 		} else if(!strcmp(pblk.descr[i].name, "queue.cry.provider")) {
 			pThis->cryprovName = (uchar*) es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(pblk.descr[i].name, "queue.compression.algorithm")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			qqueueSetCmprAlgo(pThis, (uchar*) cstr);
+			free(cstr);
+		} else if(!strcmp(pblk.descr[i].name, "queue.compression.level")) {
+			pThis->iCmprLevel = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.compression.dictionary")) {
+			free(pThis->pszCmprDict);
+			pThis->pszCmprDict = (uchar*) es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(pblk.descr[i].name, "queue.compression.threshold")) {
+			pThis->iCmprThreshold = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.spooldirectory")) {
 			free(pThis->pszSpoolDir);
 			pThis->pszSpoolDir = (uchar*) es_str2cstr(pvals[i].val.d.estr, NULL);
@@ -2946,6 +5660,60 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 			pThis->iMaxQueueSize = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.dequeuebatchsize")) {
 			pThis->iDeqBatchSize = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.mindequeuebatchsize")) {
+			pThis->iMinDeqBatchSize = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.adaptivebatchsize")) {
+			pThis->bAdaptiveBatch = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.maxbatchtime")) {
+			pThis->iMaxBatchTime = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.shards")) {
+			pThis->iNumShards = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.shardkey")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(!strcasecmp(cstr, "thread")) {
+				pThis->bShardBySender = 0;
+			} else if(!strcasecmp(cstr, "sender")) {
+				pThis->bShardBySender = 1;
+			} else if(qqueueSetShardProp(pThis, (uchar*) cstr) != RS_RET_OK) {
+				parser_errmsg("queue.shardkey \"%s\" is invalid, must be "
+					      "\"thread\", \"sender\" or a property name - "
+					      "using \"thread\"", cstr);
+			}
+			free(cstr);
+		} else if(!strcmp(pblk.descr[i].name, "queue.ordered")) {
+			pThis->bShardOrdered = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.lanes")) {
+			pThis->iNumLanes = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.lanekey")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(strcasecmp(cstr, "severity")) {
+				pThis->pLaneProp = calloc(1, sizeof(msgPropDescr_t));
+				if(   pThis->pLaneProp == NULL
+				   || msgPropDescrFill(pThis->pLaneProp, (uchar*) cstr, strlen(cstr)) != RS_RET_OK) {
+					parser_errmsg("queue.lanekey \"%s\" is invalid, must be "
+						      "\"severity\" or a property name - using "
+						      "\"severity\"", cstr);
+					free(pThis->pLaneProp);
+					pThis->pLaneProp = NULL;
+				}
+			}
+			free(cstr);
+		} else if(!strcmp(pblk.descr[i].name, "queue.workerthreadcpuset")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+#			ifdef HAVE_PTHREAD_SETAFFINITY_NP
+			free(pThis->pCpuSet);
+			if(   (pThis->pCpuSet = malloc(sizeof(cpu_set_t))) == NULL
+			   || srParseCpuSet((uchar*) cstr, pThis->pCpuSet) != RS_RET_OK) {
+				parser_errmsg("queue.workerthreadcpuset \"%s\" is invalid, must be "
+					      "a cpu list like \"0-3,8\" or \"node:<n>\" - ignored", cstr);
+				free(pThis->pCpuSet);
+				pThis->pCpuSet = NULL;
+			}
+#			else
+			parser_errmsg("queue.workerthreadcpuset is not supported on this "
+				      "platform - ignored");
+#			endif
+			free(cstr);
 		} else if(!strcmp(pblk.descr[i].name, "queue.maxdiskspace")) {
 			pThis->sizeOnDiskMax = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.highwatermark")) {
@@ -2958,16 +5726,51 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 			pThis->iLightDlyMrk = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.discardmark")) {
 			pThis->iDiscardMrk = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.maxmemory")) {
+			pThis->iMaxMemory = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.highwatermarkbytes")) {
+			pThis->iHighWtrMrkBytes = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.lowwatermarkbytes")) {
+			pThis->iLowWtrMrkBytes = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.fulldelaymarkbytes")) {
+			pThis->iFullDlyMrkBytes = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.lightdelaymarkbytes")) {
+			pThis->iLightDlyMrkBytes = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.discardmarkbytes")) {
+			pThis->iDiscardMrkBytes = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.discardseverity")) {
 			pThis->iDiscardSeverity = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.checkpointinterval")) {
 			pThis->iPersistUpdCnt = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.syncqueuefiles")) {
 			pThis->bSyncQueueFiles = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.binaryformat")) {
+			pThis->bBinaryFormat = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.syncinterval")) {
+			pThis->iSyncInterval = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.syncmaxbytes")) {
+			pThis->iSyncMaxBytes = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.mmap")) {
+			pThis->bMmap = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.residencystats")) {
+			pThis->bResidencyStats = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.hugepages")) {
+			if(pvals[i].val.d.n)
+				pThis->iMemFlags |= SRPAGES_HUGE;
+		} else if(!strcmp(pblk.descr[i].name, "queue.prefault")) {
+			if(pvals[i].val.d.n)
+				pThis->iMemFlags |= SRPAGES_PREFAULT;
+		} else if(!strcmp(pblk.descr[i].name, "queue.mlock")) {
+			if(pvals[i].val.d.n)
+				pThis->iMemFlags |= SRPAGES_MLOCK;
+		} else if(!strcmp(pblk.descr[i].name, "queue.targetresidency")) {
+			pThis->iTargetResidency = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.type")) {
 			pThis->qType = (queueType_t) pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.workerthreads")) {
 			pThis->iNumWorkerThreads = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.da.workerthreads")) {
+			pThis->iDAWorkerThreads = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.timeoutshutdown")) {
 			pThis->toQShutdown = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.timeoutactioncompletion")) {
@@ -3014,13 +5817,105 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 		initCryprov(pThis, lst);
 	}
 
+	if(pThis->iCmprThreshold > 0)
+		qqueueSetMemCmpr(pThis);
+
+	if(pThis->pszFilePrefix == NULL && pThis->iCmprAlgo != CMPR_ALGO_NONE && pThis->iCmprThreshold == 0) {
+		errmsg.LogError(0, RS_RET_QUEUE_CRY_DISK_ONLY, "error on queue '%s', compression can "
+				"only be set for disk or disk assisted queue - ignored",
+				obj.GetName((obj_t*) pThis));
+		pThis->iCmprAlgo = CMPR_ALGO_NONE;
+	}
+
 	cnfparamvalsDestruct(pvals, &pblk);
 	return RS_RET_OK;
 }
 
 
+/* get the number of messages in the queue (including all shards) for
+ * informational purposes like worker autoscaling. This is done without
+ * locking, so the result may already be outdated when it is returned.
+ */
+int
+qqueueGetApproxSize(qqueue_t *pThis)
+{
+	int i;
+	int nMsgs;
+
+	if(pThis->iNumShards > 1 && pThis->ppShards != NULL) {
+		for(i = 0, nMsgs = 0 ; i < pThis->iNumShards ; ++i)
+			nMsgs += getLogicalQueueSize(pThis->ppShards[i]);
+		return nMsgs;
+	}
+	return getLogicalQueueSize(pThis);
+}
+
+
+/* get the light delay flow control state of the queue (QUEUE_FLOWCTL_*).
+ * This is for inputs that implement their own backpressure instead of
+ * being blocked inside the enqueue. For a sharded queue, the state of
+ * its most loaded shard is returned. Like qqueueGetApproxSize(), this is
+ * done without locking and thus just a hint.
+ */
+int
+qqueueGetFlowCtlState(qqueue_t *pThis)
+{
+	int i;
+	int state;
+	int shardState;
+
+	if(pThis->qType == QUEUETYPE_DIRECT)
+		return QUEUE_FLOWCTL_OK;
+	if(pThis->iNumShards > 1 && pThis->ppShards != NULL) {
+		for(i = 0, state = QUEUE_FLOWCTL_OK ; i < pThis->iNumShards ; ++i) {
+			shardState = qqueueGetFlowCtlState(pThis->ppShards[i]);
+			if(shardState > state)
+				state = shardState;
+		}
+		return state;
+	}
+	if(pThis->iQueueSize >= pThis->iLightDlyMrk || qqueueMemAboveMrk(pThis, pThis->iLightDlyMrkBytes))
+		return QUEUE_FLOWCTL_DELAY;
+	if(pThis->iQueueSize < pThis->iLightDlyMrk / 2 && !qqueueMemAboveMrk(pThis, pThis->iLightDlyMrkBytes / 2))
+		return QUEUE_FLOWCTL_OK;
+	return QUEUE_FLOWCTL_HIGH;
+}
+
+
+/* limit the number of regular workers to nWrkr (0 means the configured
+ * maximum). For sharded queues, the limit is split over the shards. If the
+ * limit was raised, workers are started right away if there is work to do.
+ */
+void
+qqueueSetWorkerCap(qqueue_t *pThis, int nWrkr)
+{
+	qqueue_t *pQ;
+	int nCap;
+	int i;
+
+	if(pThis->qType == QUEUETYPE_DIRECT)
+		return;
+	for(i = 0 ; i < ((pThis->iNumShards > 1) ? pThis->iNumShards : 1) ; ++i) {
+		pQ = (pThis->iNumShards > 1) ? pThis->ppShards[i] : pThis;
+		if(pQ == NULL || pQ->pWtpReg == NULL)
+			continue;
+		nCap = (pThis->iNumShards > 1) ? (nWrkr + pThis->iNumShards - 1) / pThis->iNumShards : nWrkr;
+		wtpSetWorkerCap(pQ->pWtpReg, nCap);
+		d_pthread_mutex_lock(pQ->mut);
+		if(getLogicalQueueSize(pQ) > 0)
+			wtpAdviseMaxWorkers(pQ->pWtpReg, (pQ->iMinMsgsPerWrkr > 0)
+				? getLogicalQueueSize(pQ) / pQ->iMinMsgsPerWrkr + 1 : 1);
+		d_pthread_mutex_unlock(pQ->mut);
+	}
+}
+
+
 /* some simple object access methods */
 DEFpropSetMeth(qqueue, bSyncQueueFiles, int)
+DEFpropSetMeth(qqueue, bBinaryFormat, int)
+DEFpropSetMeth(qqueue, iSyncInterval, int)
+DEFpropSetMeth(qqueue, iSyncMaxBytes, int64)
+DEFpropSetMeth(qqueue, bMmap, int)
 DEFpropSetMeth(qqueue, iPersistUpdCnt, int)
 DEFpropSetMeth(qqueue, iDeqtWinFromHr, int)
 DEFpropSetMeth(qqueue, iDeqtWinToHr, int)
@@ -3040,7 +5935,10 @@ DEFpropSetMeth(qqueue, iMinMsgsPerWrkr, int)
 DEFpropSetMeth(qqueue, bSaveOnShutdown, int)
 DEFpropSetMeth(qqueue, pAction, action_t*)
 DEFpropSetMeth(qqueue, iDeqSlowdown, int)
+DEFpropSetMeth(qqueue, iLingerMin, int)
+DEFpropSetMeth(qqueue, iLingerTime, int)
 DEFpropSetMeth(qqueue, iDeqBatchSize, int)
+DEFpropSetMeth(qqueue, iNumShards, int)
 DEFpropSetMeth(qqueue, sizeOnDiskMax, int64)
 
 
@@ -3061,6 +5959,12 @@ static rsRetVal qqueueSetProperty(qqueue_t *pThis, var_t *pProp)
 		pThis->iQueueSize = pProp->val.num;
  	} else if(isProp("tVars.disk.sizeOnDisk")) {
 		pThis->tVars.disk.sizeOnDisk = pProp->val.num;
+ 	} else if(isProp("tVars.disk.segRecs")) {
+		pThis->tVars.disk.segRecs = pProp->val.num;
+ 	} else if(isProp("tVars.disk.segBytes")) {
+		pThis->tVars.disk.segBytes = pProp->val.num;
+ 	} else if(isProp("ctrPersistTime")) {
+		pThis->ctrPersistTime = pProp->val.num;
  	} else if(isProp("qType")) {
 		if(pThis->qType != pProp->val.num)
 			ABORT_FINALIZE(RS_RET_QTYPE_MISMATCH);
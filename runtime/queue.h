@@ -37,6 +37,7 @@ typedef struct toDeleteLst_s toDeleteLst_t;
 struct toDeleteLst_s {
 	qDeqID	deqID;
 	int	nElemDeq;	/* numbe of elements that were dequeued and as such must now be discarded */
+	int64	nBytesDeq;	/* estimated memory size of these elements */
 	struct toDeleteLst_s *pNext;
 };
 
@@ -46,15 +47,44 @@ typedef enum {
 	QUEUETYPE_FIXED_ARRAY = 0,/* a simple queue made out of a fixed (initially malloced) array fast but memoryhog */
 	QUEUETYPE_LINKEDLIST = 1, /* linked list used as buffer, lower fixed memory overhead but slower */
 	QUEUETYPE_DISK = 2, 	  /* disk files used as buffer */
-	QUEUETYPE_DIRECT = 3 	  /* no queuing happens, consumer is directly called */
+	QUEUETYPE_DIRECT = 3, 	  /* no queuing happens, consumer is directly called */
+	QUEUETYPE_LOCKFREE = 4	  /* bounded ring buffer, inputs may enqueue without the queue mutex */
 } queueType_t;
 
+/* the lockFree queue type requires real atomic instructions, the mutex
+ * emulation in atomic.h would defeat its purpose.
+ */
+#if defined(HAVE_ATOMIC_BUILTINS) && defined(HAVE_ATOMIC_BUILTINS_64BIT)
+#	define HAVE_LOCKFREE_QUEUE 1
+#endif
+
+/* slot for the lockFree ring buffer. The sequence number tells the state
+ * of the slot in respect to a given ring position pos:
+ *   seq == pos       -> slot is free and can be filled by a producer
+ *   seq == pos + 1   -> slot contains a message that can be dequeued
+ *   seq == pos + cap -> slot was deleted and is free for the next round
+ */
+typedef struct qLockFreeSlot_s {
+	volatile uint64 seq;
+	msg_t *pMsg;
+	uint64 tEnq;		/* enqueue time, for residency stats */
+} qLockFreeSlot_t;
+
 /* list member definition for linked list types of queues: */
 typedef struct qLinkedList_S {
 	struct qLinkedList_S *pNext;
 	msg_t *pMsg;
+	uint64 tEnq;		/* enqueue time, for residency stats */
 } qLinkedList_t;
 
+/* number of buckets in the residency histogram. Bucket i holds residency
+ * times (in microseconds) below 2^i, the last one everything above.
+ */
+#define QUEUE_RES_BUCKETS 32
+
+/* max number of priority lanes of a linked list queue */
+#define QUEUE_MAX_LANES 8
+
 
 /* the queue object */
 struct queue_s {
@@ -65,22 +95,68 @@ struct queue_s {
 	sbool	bEnqOnly;	/* does queue run in enqueue-only mode (1) or not (0)? */
 	sbool	bSaveOnShutdown;/* persists everthing on shutdown (if DA!)? 1-yes, 0-no */
 	sbool	bQueueStarted;	/* has queueStart() been called on this queue? 1-yes, 0-no */
+	sbool	bShutdownDone;	/* workers shut down and queue persisted, see qqueueShutdown() */
 	int	iQueueSize;	/* Current number of elements in the queue */
 	int	iMaxQueueSize;	/* how large can the queue grow? */
+	uint64	iMemSize;	/* estimated memory used by queued messages (in-memory queues only) */
+	int64	iMaxMemory;	/* how much memory may the queue use? 0 - unlimited */
 	int 	iNumWorkerThreads;/* number of worker threads to use */
 	int 	iCurNumWrkThrd;/* current number of active worker threads */
 	int	iMinMsgsPerWrkr;/* minimum nbr of msgs per worker thread, if more, a new worker is started until max wrkrs */
+	int	iDAWorkerThreads;/* workers for our DA disk queue, more than one gives up ordering */
 	wtp_t	*pWtpDA;
 	wtp_t	*pWtpReg;
 	action_t *pAction;	/* for action queues, ptr to action object; for main queues unused */
 	int	iUpdsSincePersist;/* nbr of queue updates since the last persist call */
 	int	iPersistUpdCnt;	/* persits queue info after this nbr of updates - 0 -> persist only on shutdown */
 	sbool	bSyncQueueFiles;/* if working with files, sync them after each write? */
+	sbool	bBinaryFormat;	/* write disk records in compact binary format (else legacy text)? */
+	int	iSyncInterval;	/* group commit: max time (ms) to collect writes for one sync, 0 - sync every write */
+	int64	iSyncMaxBytes;	/* group commit: sync immediately once this many bytes are pending */
+	sbool	bGroupSync;	/* is group commit active? (disk queues with bSyncQueueFiles only) */
+	sbool	bMmap;		/* read queue files via mmap and preallocate them? */
+	int	iCmprAlgo;	/* compression algorithm for queue files (CMPR_ALGO_*) */
+	int	iCmprLevel;	/* compression level, -1 for algorithm default */
+	uchar	*pszCmprDict;	/* compression dictionary file, NULL if none */
+	int64	iCmprThreshold;	/* in-memory queues: compress messages at least this large, 0 - off */
+	int	iMemCmprAlgo;	/* algorithm for in-memory compression (CMPR_ALGO_*) */
+	sbool	bResidencyStats;/* gather enqueue-to-dequeue residency stats (in-memory queues only)? */
+	int	iMemFlags;	/* SRPAGES_* for FixedArray/LockFree storage, 0 - plain malloc */
+	uint64	tDeqEnq;	/* enqueue time of the element dequeued last (set by qDeq handlers) */
+	struct {
+		uint64 bucket[QUEUE_RES_BUCKETS];
+		uint64 nSamples;/* sum of all buckets */
+	} resHist;		/* residency histogram, guarded by queue mutex */
+	int	iTargetResidency;/* ms; if > 0, the number of workers is controlled to meet it */
+	struct {
+		uint64 tLast;	/* start of the current interval (us) */
+		uint64 sumRes;	/* sum of the residencies seen in this interval (us) */
+		uint64 nRes;	/* number of residency samples in this interval */
+		uint64 thruPrev;/* msgs per worker and second in the previous interval */
+		int nCap;	/* number of workers currently permitted */
+		int nHold;	/* intervals to wait before the next change */
+		int lastDir;	/* last change: +1 added a worker, -1 retired one, 0 none */
+	} resCtl;		/* residency controller, guarded by queue mutex */
+	struct {
+		pthread_mutex_t mut;
+		pthread_cond_t condReq;	/* tells the group leader the group is full */
+		pthread_cond_t condDone;/* a sync has completed */
+		uint64 written;		/* octets written so far (guarded by queue mutex, not this one!) */
+		uint64 requested;	/* highest position a writer waits to be synced */
+		uint64 synced;		/* position up to which data has been synced */
+		sbool bActive;		/* is a group leader currently collecting or syncing? */
+	} gsync;
 	int	iHighWtrMrk;	/* high water mark for disk-assisted memory queues */
 	int	iLowWtrMrk;	/* low water mark for disk-assisted memory queues */
 	int	iDiscardMrk;	/* if the queue is above this mark, low-severity messages are discarded */
 	int	iFullDlyMrk;	/* if the queue is above this mark, FULL_DELAYable message are put on hold */
 	int	iLightDlyMrk;	/* if the queue is above this mark, LIGHT_DELAYable message are put on hold */
+	/* the same marks, but for the memory used (only active if iMaxMemory is set) */
+	int64	iHighWtrMrkBytes;
+	int64	iLowWtrMrkBytes;
+	int64	iDiscardMrkBytes;
+	int64	iFullDlyMrkBytes;
+	int64	iLightDlyMrkBytes;
 	int	iDiscardSeverity;/* messages of this severity above are discarded on too-full queue */
 	sbool	bNeedDelQIF;	/* does the QIF file need to be deleted when queue becomes empty? */
 	int	toQShutdown;	/* timeout for regular queue shutdown in ms */
@@ -89,8 +165,14 @@ struct queue_s {
 	toDeleteLst_t *toDeleteLst;/* this queue's to-delete list */
 	int	toEnq;		/* enqueue timeout */
 	int	iDeqBatchSize;	/* max number of elements that shall be dequeued at once */
+	int	iDeqBatchSizeCurr;/* current batch size, below iDeqBatchSize only if adaptive */
+	sbool	bAdaptiveBatch;	/* adapt batch size to queue depth and processing time? */
+	int	iMinDeqBatchSize;/* lower bound for adaptive batch size */
+	int	iMaxBatchTime;	/* adaptive batch size: max desired processing time per batch (ms), 0 - none */
 	/* rate limiting settings (will be expanded) */
 	int	iDeqSlowdown; /* slow down dequeue by specified nbr of microseconds */
+	int	iLingerMin;	/* wait for at least this many elements before dequeueing... */
+	int	iLingerTime;	/* ...but for at most this many ms (0 - do not linger) */
 	/* end rate limiting */
 	/* dequeue time window settings (may also be expanded) */
 	int iDeqtWinFromHr;	/* begin of dequeue time window (hour only) */
@@ -122,6 +204,7 @@ struct queue_s {
 	pthread_mutex_t mutThrdMgmt; /* mutex for the queue's thread management */
 	pthread_mutex_t *mut; /* mutex for enqueing and dequeueing messages */
 	pthread_cond_t notFull;
+	pthread_cond_t lingerDone; /* iLingerMin elements are available */
 	pthread_cond_t belowFullDlyWtrMrk; /* below eFLOWCTL_FULL_DELAY watermark */
 	pthread_cond_t belowLightDlyWtrMrk; /* below eFLOWCTL_FULL_DELAY watermark */
 	int bThrdStateChanged;		/* at least one thread state has changed if 1 */
@@ -137,6 +220,8 @@ struct queue_s {
 	size_t lenFilePrefix;
 	uchar *pszQIFNam;	/* full .qi file name, based on parts above */
 	size_t lenQIFNam;
+	uchar *pszIdxFNam;	/* full .qx (segment index) file name */
+	size_t lenIdxFNam;
 	int iNumberFiles;	/* how many files make up the queue? */
 	int64 iMaxFileSize;	/* max size for a single queue file */
 	int64 sizeOnDiskMax;    /* maximum size on disk allowed */
@@ -146,23 +231,56 @@ struct queue_s {
 	struct queue_s *pqDA;	/* queue for disk-assisted modes */
 	struct queue_s *pqParent;/* pointer to the parent (if this is a child queue) */
 	int	bDAEnqOnly;	/* EnqOnly setting for DA queue */
+	int	iNumShards;	/* number of shards the queue is split into, 0 or 1 means not sharded */
+	sbool	bShardBySender;	/* select shard by sender (1) or by submitting thread (0)? */
+	msgPropDescr_t *pShardProp;/* select shard by this property (overrides the above), else NULL */
+	sbool	bShardOrdered;	/* one worker per shard, no stealing: keeps the order per shard key */
+	struct queue_s **ppShards;/* shard sub-queues (only for sharded queues, else NULL) */
+	struct queue_s *pqShardParent;/* sharded queue this shard belongs to (if this is a shard) */
+	int	iShardIdx;	/* index of this shard inside the parent's ppShards array */
+	int	iNumLanes;	/* number of priority lanes (linked list only), 0 or 1 means no lanes */
+	msgPropDescr_t *pLaneProp;/* property that selects the lane, NULL - select by severity */
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	cpu_set_t *pCpuSet;	/* cpus for the regular workers, NULL - any (shards share the parent's) */
+#endif
 	/* now follow queueing mode specific data elements */
 	//union {			/* different data elements based on queue type (qType) */
 	struct {			/* different data elements based on queue type (qType) */
 		struct {
 			long deqhead, head, tail;
 			void** pBuf;		/* the queued user data structure */
+			uint64 *pEnqTime;	/* enqueue times (only if bResidencyStats) */
+			size_t lenBuf;		/* allocated sizes, needed if iMemFlags != 0 */
+			size_t lenEnqTime;
 		} farray;
+		struct {
+			qLockFreeSlot_t *pSlots;
+			size_t lenSlots;	/* allocated size, needed if iMemFlags != 0 */
+			uint64 mask;		/* ring capacity - 1 (capacity is a power of two) */
+			volatile uint64 enqPos;	/* next position to fill, shared by all producers */
+			uint64 deqPos;		/* next position to dequeue (mutex protected) */
+			uint64 delPos;		/* next position to delete (mutex protected) */
+		} lfring;
 		struct {
 			qLinkedList_t *pDeqRoot;
 			qLinkedList_t *pDelRoot;
 			qLinkedList_t *pLast;
+			/* in lanes mode, new elements are kept in per lane lists. On
+			 * dequeue, they are moved to the end of the main list, which
+			 * then only holds dequeued elements (pDeqRoot is unused).
+			 */
+			qLinkedList_t *pLaneRoot[QUEUE_MAX_LANES];
+			qLinkedList_t *pLaneLast[QUEUE_MAX_LANES];
 		} linklist;
 		struct {
 			int64 sizeOnDisk; /* current amount of disk space used */
 			int64 deqOffs; /* offset after dequeue batch - used for file deleter */
 			int deqFileNumIn; /* same for the circular file numbers, mainly for  */
 			int deqFileNumOut;/* deleting finished files */
+			int64 segRecs;	  /* records in current write segment (for the index) */
+			int64 segBytes;	  /* octets in current write segment (for the index) */
+			int nIdxUpd;	  /* index appends since last compaction */
+			sbool bIdxStarted;/* current write segment recorded in index? */
 			strm_t *pWrite;   /* current file to be written */
 			strm_t *pReadDeq; /* current file for dequeueing */
 			strm_t *pReadDel; /* current file for deleting */
@@ -175,13 +293,30 @@ struct queue_s {
 	uchar 	*cryprovNameFull;/* full internal crypto provider name */
 	DEF_ATOMIC_HELPER_MUT(mutQueueSize);
 	DEF_ATOMIC_HELPER_MUT(mutLogDeq);
+	DEF_ATOMIC_HELPER_MUT64(mutLFRing);
+	DEF_ATOMIC_HELPER_MUT64(mutMemSize);
 	/* for statistics subsystem */
 	statsobj_t *statsobj;
-	STATSCOUNTER_DEF(ctrEnqueued, mutCtrEnqueued);
+	STATSCOUNTER_PT_DEF(ctrEnqueued);	/* per-thread, all inputs update it */
 	STATSCOUNTER_DEF(ctrFull, mutCtrFull);
 	STATSCOUNTER_DEF(ctrFDscrd, mutCtrFDscrd);
 	STATSCOUNTER_DEF(ctrNFDscrd, mutCtrNFDscrd);
+	STATSCOUNTER_DEF(ctrMemDscrd, mutCtrMemDscrd);
+	STATSCOUNTER_DEF(ctrStolen, mutCtrStolen);
 	int ctrMaxqsize; /* NOT guarded by a mutex */
+	int ctrRecoveryTime; /* ms needed to recover disk queue state at startup, set once */
+	int ctrPersistTime; /* ms the previous shutdown needed to persist the queue (from .qi) */
+	int ctrRestoreTime; /* ms until the messages restored at startup were dequeued, set once */
+	sbool bRestoring;	/* messages restored at startup not yet all dequeued? */
+	struct timespec tRestoreStart;
+	/* residency percentiles in microseconds, guarded by queue mutex */
+	intctr_t ctrResP50;
+	intctr_t ctrResP99;
+	intctr_t ctrResMax;
+	/* residency controller decisions, guarded by queue mutex */
+	int ctrResCtlWorkers;
+	intctr_t ctrResCtlAdded;
+	intctr_t ctrResCtlRetired;
 };
 
 
@@ -192,8 +327,14 @@ struct queue_s {
  */
 #define QUEUE_TIMEOUT_ETERNAL 24 * 60 * 60 * 1000
 
+/* flow control state as returned by qqueueGetFlowCtlState() */
+#define QUEUE_FLOWCTL_OK	0	/* below the light delay low watermark (half the mark) */
+#define QUEUE_FLOWCTL_HIGH	1	/* between low watermark and light delay mark */
+#define QUEUE_FLOWCTL_DELAY	2	/* light delay mark reached, delayable inputs would block */
+
 /* prototypes */
 rsRetVal qqueueDestruct(qqueue_t **ppThis);
+rsRetVal qqueueShutdownParallel(qqueue_t **ppQueues, int nQueues);
 rsRetVal qqueueEnqMsg(qqueue_t *pThis, flowControl_t flwCtlType, msg_t *pMsg);
 rsRetVal qqueueStart(qqueue_t *pThis);
 rsRetVal qqueueSetMaxFileSize(qqueue_t *pThis, size_t iMaxFileSize);
@@ -205,10 +346,17 @@ rsRetVal qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst);
 void qqueueSetDefaultsRulesetQueue(qqueue_t *pThis);
 void qqueueSetDefaultsActionQueue(qqueue_t *pThis);
 void qqueueDbgPrint(qqueue_t *pThis);
+int qqueueGetApproxSize(qqueue_t *pThis);
+int qqueueGetFlowCtlState(qqueue_t *pThis);
+void qqueueSetWorkerCap(qqueue_t *pThis, int nWrkr);
 
 PROTOTYPEObjClassInit(qqueue);
 PROTOTYPEpropSetMeth(qqueue, iPersistUpdCnt, int);
 PROTOTYPEpropSetMeth(qqueue, bSyncQueueFiles, int);
+PROTOTYPEpropSetMeth(qqueue, bBinaryFormat, int);
+PROTOTYPEpropSetMeth(qqueue, iSyncInterval, int);
+PROTOTYPEpropSetMeth(qqueue, iSyncMaxBytes, int64);
+PROTOTYPEpropSetMeth(qqueue, bMmap, int);
 PROTOTYPEpropSetMeth(qqueue, iDeqtWinFromHr, int);
 PROTOTYPEpropSetMeth(qqueue, iDeqtWinToHr, int);
 PROTOTYPEpropSetMeth(qqueue, toQShutdown, long);
@@ -225,8 +373,11 @@ PROTOTYPEpropSetMeth(qqueue, iNumWorkerThreads, int);
 PROTOTYPEpropSetMeth(qqueue, bSaveOnShutdown, int);
 PROTOTYPEpropSetMeth(qqueue, pAction, action_t*);
 PROTOTYPEpropSetMeth(qqueue, iDeqSlowdown, int);
+PROTOTYPEpropSetMeth(qqueue, iLingerMin, int);
+PROTOTYPEpropSetMeth(qqueue, iLingerTime, int);
 PROTOTYPEpropSetMeth(qqueue, sizeOnDiskMax, int64);
 PROTOTYPEpropSetMeth(qqueue, iDeqBatchSize, int);
+PROTOTYPEpropSetMeth(qqueue, iNumShards, int);
 #define qqueueGetID(pThis) ((unsigned long) pThis)
 
 #endif /* #ifndef QUEUE_H_INCLUDED */
@@ -24,6 +24,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <sys/time.h>
 
 #include "rsyslog.h"
 #include "errmsg.h"
@@ -34,6 +36,9 @@
 #include "msg.h"
 #include "rsconf.h"
 #include "dirty.h"
+#include "glbl.h"
+#include "atomic.h"
+#include "hashmap.h"
 
 /* definitions for objects we access */
 DEFobjStaticHelpers
@@ -44,6 +49,88 @@ DEFobjCurrIf(parser)
 
 /* static data */
 
+/* the keyed limiter spreads its keys over this many shards, each with its
+ * own lock and map, so that concurrent checks for different keys rarely
+ * contend. Must be a power of 2.
+ */
+#define KEYED_SHARDS 16
+
+typedef struct ratelimit_shard_s {
+	pthread_mutex_t mut;
+	hashmap_t *map;		/* key string -> uint64_t token bucket state */
+	uint64_t lastSweep;	/* ns */
+	unsigned missed;	/* messages dropped since the last report */
+	char pad[64];		/* keeps the locks of different shards on different cache lines */
+} ratelimit_shard_t;
+
+struct ratelimit_keyed_s {
+	char *name;
+	uint64_t period;	/* interval in ns */
+	uint64_t emission;	/* ns per token */
+	unsigned maxKeysPerShard;
+	ratelimit_shard_t shards[KEYED_SHARDS];
+};
+
+
+/* the clock for the token buckets. It must not jump, so we prefer a
+ * monotonic clock, and the coarse one where available: it is much cheaper
+ * and its resolution (a few ms) is fine for ratelimiting.
+ */
+static inline uint64_t
+getMonoNs(void)
+{
+#if _POSIX_TIMERS > 0
+	struct timespec t;
+#	if defined(CLOCK_MONOTONIC_COARSE)
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &t);
+#	elif defined(CLOCK_MONOTONIC)
+	clock_gettime(CLOCK_MONOTONIC, &t);
+#	else
+	clock_gettime(CLOCK_REALTIME, &t);
+#	endif
+	return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000000000 + (uint64_t) tv.tv_usec * 1000;
+#endif
+}
+
+
+/* The token bucket is implemented as "virtual scheduling" (GCRA), which
+ * behaves exactly like a bucket of burst tokens refilled at burst tokens
+ * per period, but needs a single word of state: the time at which the
+ * bucket will be full again (0 or any time in the past - it is full now).
+ * Each message moves that time one emission interval (period/burst) ahead,
+ * a message is dropped if that would put it more than period ahead of now.
+ * There is no refill rounding, so even slow rates with a coarse clock are
+ * exact. Returns the new state, *pOK tells if the message is within the
+ * limit. This is a pure function, so that it can be used in a
+ * compare-and-swap loop.
+ */
+static inline uint64_t
+tbTake(const uint64_t state, const uint64_t now, const uint64_t emission,
+	const uint64_t period, int *const pOK)
+{
+	const uint64_t tFull = (state > now) ? state : now;
+
+	if(tFull + emission - now > period) {
+		*pOK = 0;
+		return state;
+	}
+	*pOK = 1;
+	return tFull + emission;
+}
+
+
+/* is a token bucket in this state full by now? */
+static inline int
+tbIsFull(const uint64_t state, const uint64_t now)
+{
+	return state <= now;
+}
+
+
 /* generate a "repeated n times" message */
 static inline msg_t *
 ratelimitGenRepMsg(ratelimit_t *ratelimit)
@@ -125,6 +212,68 @@ tellLostCnt(ratelimit_t *ratelimit)
 	}
 }
 
+/* token bucket ratelimiting: up to burst messages at once, and burst
+ * messages per interval on average. Unlike the fixed window of
+ * withinRatelimit(), this does not permit a double burst at the window
+ * border, and it does not need the message time. If the ratelimiter is
+ * thread-safe, the state is updated by compare-and-swap where possible,
+ * so that concurrent submitters do not serialize on the mutex.
+ * returns 1 if message is within rate limit, 0 otherwise.
+ */
+static int
+withinTokenBucket(ratelimit_t *ratelimit)
+{
+	const uint64_t now = getMonoNs();
+	const uint64_t period = (uint64_t) ratelimit->interval * 1000000000;
+	const uint64_t emission = period / ratelimit->burst;
+	uint64_t oldState;
+	uint64_t newState;
+	unsigned lost;
+	int ret;
+	uchar msgbuf[1024];
+
+#ifdef HAVE_ATOMIC_BUILTINS_64BIT
+	if(ratelimit->bThreadSafe) {
+		do {
+			oldState = *((volatile uint64_t*) &ratelimit->tbState);
+			newState = tbTake(oldState, now, emission, period, &ret);
+		} while(!ATOMIC_CAS_uint64(&ratelimit->tbState, oldState, newState, &ratelimit->mut));
+	} else {
+		ratelimit->tbState = tbTake(ratelimit->tbState, now, emission, period, &ret);
+	}
+#else
+	if(ratelimit->bThreadSafe)
+		pthread_mutex_lock(&ratelimit->mut);
+	oldState = ratelimit->tbState;
+	newState = tbTake(oldState, now, emission, period, &ret);
+	ratelimit->tbState = newState;
+	if(ratelimit->bThreadSafe)
+		pthread_mutex_unlock(&ratelimit->mut);
+#endif
+
+	if(ret == 0) {
+		if(ATOMIC_INC_AND_FETCH_unsigned(&ratelimit->missed, &ratelimit->mut) == 0) {
+			snprintf((char*)msgbuf, sizeof(msgbuf),
+			         "%s: begin to drop messages due to rate-limiting",
+				 ratelimit->name);
+			logmsgInternal(RS_RET_RATE_LIMITED, LOG_SYSLOG|LOG_INFO, msgbuf, 0);
+		}
+	} else if(ratelimit->missed != 0) {
+		/* we are accepting messages again, report the loss (once) */
+		do {
+			lost = ratelimit->missed;
+		} while(lost != 0 && !ATOMIC_CAS((int*) &ratelimit->missed, (int) lost, 0, &ratelimit->mut));
+		if(lost != 0) {
+			snprintf((char*)msgbuf, sizeof(msgbuf),
+				 "%s: %u messages lost due to rate-limiting",
+				 ratelimit->name, lost);
+			logmsgInternal(RS_RET_RATE_LIMITED, LOG_SYSLOG|LOG_INFO, msgbuf, 0);
+		}
+	}
+	return ret;
+}
+
+
 /* Linux-like ratelimiting, modelled after the linux kernel
  * returns 1 if message is within rate limit and shall be 
  * processed, 0 otherwise.
@@ -214,7 +363,8 @@ ratelimitMsg(ratelimit_t *ratelimit, msg_t *pMsg, msg_t **ppRepMsg)
 	/* Only the messages having severity level at or below the
 	 * treshold (the value is >=) are subject to ratelimiting. */
 	if(ratelimit->interval && (pMsg->iSeverity >= ratelimit->severity)) {
-		if(withinRatelimit(ratelimit, pMsg->ttGenTime) == 0) {
+		if((ratelimit->bTokenBucket ? withinTokenBucket(ratelimit)
+		    : withinRatelimit(ratelimit, pMsg->ttGenTime)) == 0) {
 			msgDestruct(&pMsg);
 			ABORT_FINALIZE(RS_RET_DISCARDMSG);
 		}
@@ -318,6 +468,8 @@ ratelimitSetLinuxLike(ratelimit_t *ratelimit, unsigned short interval, unsigned
 	ratelimit->done = 0;
 	ratelimit->missed = 0;
 	ratelimit->begin = 0;
+	ratelimit->bTokenBucket = glblRatelimitTokenBucket;
+	ratelimit->tbState = 0;
 }
 
 
@@ -368,6 +520,148 @@ ratelimitDestruct(ratelimit_t *ratelimit)
 	free(ratelimit);
 }
 
+
+/* keyed ratelimiter: one token bucket per key (e.g. a hostname), for
+ * limiting individual sources that share an input. Buckets are created on
+ * first use and removed once they are full again, as a full bucket is the
+ * same as none. The number of keys is bounded by maxKeys (0 - unlimited);
+ * if a shard is full, new keys are not limited (we fail open rather than
+ * drop messages of unrelated sources).
+ */
+rsRetVal
+ratelimitKeyedNew(ratelimit_keyed_t **ppThis, const char *name, unsigned interval,
+	unsigned burst, unsigned maxKeys)
+{
+	ratelimit_keyed_t *pThis = NULL;
+	int i;
+	DEFiRet;
+
+	if(interval == 0 || burst == 0)
+		ABORT_FINALIZE(RS_RET_INVALID_PARAMS);
+	CHKmalloc(pThis = calloc(1, sizeof(ratelimit_keyed_t)));
+	CHKmalloc(pThis->name = strdup(name == NULL ? "ratelimit" : name));
+	pThis->period = (uint64_t) interval * 1000000000;
+	pThis->emission = pThis->period / burst;
+	pThis->maxKeysPerShard = (maxKeys + KEYED_SHARDS - 1) / KEYED_SHARDS;
+	for(i = 0 ; i < KEYED_SHARDS ; ++i) {
+		pthread_mutex_init(&pThis->shards[i].mut, NULL);
+		CHKiRet(hashmapConstruct(&pThis->shards[i].map, 64, 0, hashmapHashString,
+			hashmapKeyEqualsString, free, free));
+	}
+	*ppThis = pThis;
+
+finalize_it:
+	if(iRet != RS_RET_OK && pThis != NULL)
+		ratelimitKeyedDestruct(pThis);
+	RETiRet;
+}
+
+
+static int
+keyedSweepCB(const void __attribute__((unused)) *key, void *val, void *usrptr)
+{
+	if(tbIsFull(*((uint64_t*) val), *((uint64_t*) usrptr))) {
+		free(val);
+		return HASHMAP_REMOVE;
+	}
+	return HASHMAP_KEEP;
+}
+
+/* drop idle keys of a shard and report its losses. Must be called
+ * with the shard locked. Returns the number of lost messages.
+ */
+static unsigned
+keyedSweep(ratelimit_shard_t *shard, uint64_t now)
+{
+	unsigned lost;
+
+	hashmapIterate(shard->map, keyedSweepCB, &now);
+	shard->lastSweep = now;
+	lost = shard->missed;
+	shard->missed = 0;
+	return lost;
+}
+
+
+/* check if a message for key is within its rate limit.
+ * returns 1 if so, 0 if it shall be dropped.
+ */
+int
+ratelimitKeyedCheck(ratelimit_keyed_t *pThis, const uchar *key)
+{
+	const uint64_t now = getMonoNs();
+	ratelimit_shard_t *shard;
+	uint64_t *pState;
+	char *keyCopy;
+	unsigned h;
+	unsigned lost = 0;
+	int ret = 1;
+	uchar msgbuf[1024];
+
+	/* the map uses the low hash bits, so mix before picking the shard */
+	h = hashmapHashString(key);
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	shard = &pThis->shards[h & (KEYED_SHARDS - 1)];
+
+	pthread_mutex_lock(&shard->mut);
+	/* sweep once per interval, and a full shard at most once per second
+	 * (it may be full of active keys, then sweeping is just expensive) */
+	if(now - shard->lastSweep >= pThis->period
+	   || (pThis->maxKeysPerShard != 0 && hashmapCount(shard->map) >= pThis->maxKeysPerShard
+	       && now - shard->lastSweep >= 1000000000))
+		lost = keyedSweep(shard, now);
+
+	if((pState = hashmapSearch(shard->map, key)) == NULL) {
+		if(pThis->maxKeysPerShard != 0 && hashmapCount(shard->map) >= pThis->maxKeysPerShard)
+			goto done; /* fail open, see above */
+		if((pState = malloc(sizeof(uint64_t))) == NULL)
+			goto done;
+		if((keyCopy = strdup((const char*) key)) == NULL) {
+			free(pState);
+			goto done;
+		}
+		*pState = 0;
+		if(hashmapInsert(shard->map, keyCopy, pState) != RS_RET_OK) {
+			free(keyCopy);
+			free(pState);
+			goto done;
+		}
+	}
+	*pState = tbTake(*pState, now, pThis->emission, pThis->period, &ret);
+	if(ret == 0)
+		++shard->missed;
+done:
+	pthread_mutex_unlock(&shard->mut);
+
+	if(lost != 0) {
+		snprintf((char*)msgbuf, sizeof(msgbuf),
+			 "%s: %u messages lost due to rate-limiting", pThis->name, lost);
+		logmsgInternal(RS_RET_RATE_LIMITED, LOG_SYSLOG|LOG_INFO, msgbuf, 0);
+	}
+	return ret;
+}
+
+
+void
+ratelimitKeyedDestruct(ratelimit_keyed_t *pThis)
+{
+	int i;
+
+	if(pThis == NULL)
+		return;
+	for(i = 0 ; i < KEYED_SHARDS ; ++i) {
+		if(pThis->shards[i].map != NULL) {
+			hashmapDestruct(&pThis->shards[i].map);
+			pthread_mutex_destroy(&pThis->shards[i].mut);
+		}
+	}
+	free(pThis->name);
+	free(pThis);
+}
+
+
 void
 ratelimitModExit(void)
 {
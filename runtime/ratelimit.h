@@ -30,6 +30,12 @@ struct ratelimit_s {
 	unsigned done;
 	unsigned missed;
 	time_t begin;
+	/* token bucket mode (ratelimit.tokenbucket): burst tokens, refilled
+	 * at burst per interval. The state is one word, so that thread-safe
+	 * limiters can update it by compare-and-swap.
+	 */
+	sbool bTokenBucket;
+	uint64_t tbState;	/**< monotonic time (ns) at which the bucket is full again */
 	/* support for "last message repeated n times */
 	int bReduceRepeatMsgs; /**< shall we do "last message repeated n times" processing? */
 	unsigned nsupp;		/**< nbr of msgs suppressed */
@@ -49,6 +55,10 @@ rsRetVal ratelimitMsg(ratelimit_t *ratelimit, msg_t *pMsg, msg_t **ppRep);
 rsRetVal ratelimitAddMsg(ratelimit_t *ratelimit, multi_submit_t *pMultiSub, msg_t *pMsg);
 void ratelimitDestruct(ratelimit_t *pThis);
 int ratelimitChecked(ratelimit_t *ratelimit);
+rsRetVal ratelimitKeyedNew(ratelimit_keyed_t **ppThis, const char *name, unsigned interval,
+	unsigned burst, unsigned maxKeys);
+int ratelimitKeyedCheck(ratelimit_keyed_t *pThis, const uchar *key);
+void ratelimitKeyedDestruct(ratelimit_keyed_t *pThis);
 rsRetVal ratelimitModInit(void);
 void ratelimitModExit(void);
 
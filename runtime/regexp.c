@@ -3,7 +3,7 @@
  * Module begun 2008-03-05 by Rainer Gerhards, based on some code
  * from syslogd.c
  *
- * Copyright 2008-2012 Adiscon GmbH.
+ * Copyright 2008-2014 Adiscon GmbH.
  *
  * This file is part of the rsyslog runtime library.
  *
@@ -25,7 +25,13 @@
 #include "config.h"
 #include <regex.h>
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
+#ifdef HAVE_PCRE2
+#	define PCRE2_CODE_UNIT_WIDTH 8
+#	include <pcre2.h>
+#endif
 
 #include "rsyslog.h"
 #include "module-template.h"
@@ -39,8 +45,184 @@ MODULE_TYPE_NOKEEP
 DEFobjStaticHelpers
 
 
+struct rsregex_s {
+	int engine;
+	regex_t posix;		/* RSREGEX_POSIX */
+#ifdef HAVE_PCRE2
+	pcre2_code *code;	/* RSREGEX_PCRE2 */
+	sbool bJIT;		/* code was JIT-compiled */
+#endif
+};
+
+#ifdef HAVE_PCRE2
+/* PCRE2 match data is kept per thread, so that the workers can match
+ * concurrently without allocating it for each call. It grows to the
+ * largest number of pairs requested on that thread.
+ */
+struct matchDataCache_s {
+	pcre2_match_data *md;
+	uint32_t nPairs;
+};
+static pthread_key_t keyMatchData;
+static sbool bMatchDataKey = 0;
+
+static void
+matchDataCacheDestruct(void *const p)
+{
+	struct matchDataCache_s *const cache = (struct matchDataCache_s*) p;
+	pcre2_match_data_free(cache->md);
+	free(cache);
+}
+
+static pcre2_match_data *
+getMatchData(const uint32_t nPairs)
+{
+	struct matchDataCache_s *cache;
+
+	if((cache = pthread_getspecific(keyMatchData)) == NULL) {
+		if((cache = calloc(1, sizeof(struct matchDataCache_s))) == NULL)
+			return NULL;
+		if(pthread_setspecific(keyMatchData, cache) != 0) {
+			free(cache);
+			return NULL;
+		}
+	}
+	if(cache->nPairs < nPairs) {
+		pcre2_match_data_free(cache->md);
+		cache->md = pcre2_match_data_create(nPairs, NULL);
+		cache->nPairs = (cache->md == NULL) ? 0 : nPairs;
+	}
+	return cache->md;
+}
+#endif /* #ifdef HAVE_PCRE2 */
+
+
 /* ------------------------------ methods ------------------------------ */
 
+/* compile a regex for the given engine. cflags are the regcomp() flags;
+ * for PCRE2, REG_ICASE and REG_NEWLINE are mapped to the corresponding
+ * options and the pattern is always PCRE syntax.
+ */
+static rsRetVal
+rsregComp(rsregex_t **ppRe, const char *regex, int cflags, int engine)
+{
+	rsregex_t *pRe;
+#ifdef HAVE_PCRE2
+	uint32_t options;
+	int errcode;
+	PCRE2_SIZE erroffs;
+	PCRE2_UCHAR errbuf[256];
+#endif
+	DEFiRet;
+
+	CHKmalloc(pRe = calloc(1, sizeof(rsregex_t)));
+	pRe->engine = engine;
+	switch(engine) {
+	case RSREGEX_POSIX:
+		if(regcomp(&pRe->posix, regex, cflags) != 0)
+			ABORT_FINALIZE(RS_RET_ERR);
+		break;
+#ifdef HAVE_PCRE2
+	case RSREGEX_PCRE2:
+		if(!bMatchDataKey)
+			ABORT_FINALIZE(RS_RET_NOT_IMPLEMENTED);
+		options = 0;
+		if(cflags & REG_ICASE)
+			options |= PCRE2_CASELESS;
+		if(cflags & REG_NEWLINE)
+			options |= PCRE2_MULTILINE;
+		pRe->code = pcre2_compile((PCRE2_SPTR) regex, PCRE2_ZERO_TERMINATED,
+					  options, &errcode, &erroffs, NULL);
+		if(pRe->code == NULL) {
+			pcre2_get_error_message(errcode, errbuf, sizeof(errbuf));
+			DBGPRINTF("regexp: pcre2 cannot compile '%s' at offset %zu: %s\n",
+				  regex, (size_t) erroffs, (char*) errbuf);
+			ABORT_FINALIZE(RS_RET_ERR);
+		}
+		/* if JIT is not available, the interpreter is used */
+		pRe->bJIT = (pcre2_jit_compile(pRe->code, PCRE2_JIT_COMPLETE) == 0);
+		DBGPRINTF("regexp: pcre2 compiled '%s', JIT %d\n", regex, pRe->bJIT);
+		break;
+#endif
+	default:
+		ABORT_FINALIZE(RS_RET_NOT_IMPLEMENTED);
+	}
+	*ppRe = pRe;
+
+finalize_it:
+	if(iRet != RS_RET_OK)
+		free(pRe);
+	RETiRet;
+}
+
+
+/* match string against pRe, semantics as of regexec() with no eflags.
+ * pRe may be NULL (regex could not be compiled), which never matches.
+ */
+static int
+rsregExec(rsregex_t *pRe, const char *string, size_t nmatch, regmatch_t pmatch[])
+{
+#ifdef HAVE_PCRE2
+	pcre2_match_data *md;
+	PCRE2_SIZE *ovector;
+	size_t i;
+	int rc;
+#endif
+
+	if(pRe == NULL)
+		return REG_NOMATCH;
+	if(pRe->engine == RSREGEX_POSIX)
+		return regexec(&pRe->posix, string, nmatch, pmatch, 0);
+#ifdef HAVE_PCRE2
+	if((md = getMatchData(nmatch == 0 ? 1 : nmatch)) == NULL)
+		return REG_ESPACE;
+	/* note: pcre2_jit_match() does not support PCRE2_ZERO_TERMINATED */
+	if(pRe->bJIT)
+		rc = pcre2_jit_match(pRe->code, (PCRE2_SPTR) string, strlen(string),
+				     0, 0, md, NULL);
+	else
+		rc = pcre2_match(pRe->code, (PCRE2_SPTR) string, strlen(string),
+				 0, 0, md, NULL);
+	if(rc == PCRE2_ERROR_NOMATCH)
+		return REG_NOMATCH;
+	if(rc < 0) {
+		DBGPRINTF("regexp: pcre2 match error %d\n", rc);
+		return REG_ESPACE;
+	}
+	if(rc == 0)
+		rc = (int) nmatch; /* more groups than pairs, the ones we need are set */
+	ovector = pcre2_get_ovector_pointer(md);
+	for(i = 0 ; i < nmatch ; ++i) {
+		if((int) i < rc && ovector[2*i] != PCRE2_UNSET) {
+			pmatch[i].rm_so = (regoff_t) ovector[2*i];
+			pmatch[i].rm_eo = (regoff_t) ovector[2*i+1];
+		} else {
+			pmatch[i].rm_so = pmatch[i].rm_eo = -1;
+		}
+	}
+	return 0;
+#else
+	return REG_NOMATCH; /* cannot happen, rsregComp() does not accept other engines */
+#endif
+}
+
+
+static void
+rsregFree(rsregex_t **ppRe)
+{
+	rsregex_t *const pRe = *ppRe;
+
+	if(pRe == NULL)
+		return;
+	if(pRe->engine == RSREGEX_POSIX)
+		regfree(&pRe->posix);
+#ifdef HAVE_PCRE2
+	else
+		pcre2_code_free(pRe->code);
+#endif
+	free(pRe);
+	*ppRe = NULL;
+}
 
 
 /* queryInterface function
@@ -61,6 +243,9 @@ CODESTARTobjQueryInterface(regexp)
 	pIf->regexec = regexec;
 	pIf->regerror = regerror;
 	pIf->regfree = regfree;
+	pIf->rsregComp = rsregComp;
+	pIf->rsregExec = rsregExec;
+	pIf->rsregFree = rsregFree;
 finalize_it:
 ENDobjQueryInterface(regexp)
 
@@ -73,6 +258,11 @@ BEGINAbstractObjClassInit(regexp, 1, OBJ_IS_LOADABLE_MODULE) /* class, version *
 	/* request objects we use */
 
 	/* set our own handlers */
+#ifdef HAVE_PCRE2
+	bMatchDataKey = (pthread_key_create(&keyMatchData, matchDataCacheDestruct) == 0);
+	if(!bMatchDataKey)
+		DBGPRINTF("regexp: pthread_key_create failed, pcre2 disabled\n");
+#endif
 ENDObjClassInit(regexp)
 
 
@@ -81,6 +271,10 @@ ENDObjClassInit(regexp)
 
 BEGINmodExit
 CODESTARTmodExit
+#ifdef HAVE_PCRE2
+	if(bMatchDataKey)
+		pthread_key_delete(keyMatchData);
+#endif
 ENDmodExit
 
 
@@ -2,7 +2,7 @@
  * purpose of this wrapper class is to enable rsyslogd core to be build without
  * regexp libraries.
  *
- * Copyright 2008-2012 Adiscon GmbH.
+ * Copyright 2008-2014 Adiscon GmbH.
  *
  * This file is part of the rsyslog runtime library.
  *
@@ -24,6 +24,14 @@
 #define INCLUDED_REGEXP_H
 
 #include <regex.h>
+#include <string.h>
+
+/* the regex engines that can be used with rsregComp() */
+#define RSREGEX_POSIX	0	/* regcomp()/regexec(), the default */
+#define RSREGEX_PCRE2	1	/* PCRE2 with JIT, only if built with --enable-pcre2 */
+
+/* a compiled regex for one of the engines */
+typedef struct rsregex_s rsregex_t;
 
 /* interfaces */
 BEGINinterface(regexp) /* name must also be changed in ENDinterface macro! */
@@ -31,8 +39,28 @@ BEGINinterface(regexp) /* name must also be changed in ENDinterface macro! */
 	int (*regexec)(const regex_t *preg, const char *string, size_t nmatch, regmatch_t pmatch[], int eflags);
 	size_t (*regerror)(int errcode, const regex_t *preg, char *errbuf, size_t errbuf_size);
 	void (*regfree)(regex_t *preg);
+	/* v2, engine-independent interface. rsregExec() returns like regexec() */
+	rsRetVal (*rsregComp)(rsregex_t **ppRe, const char *regex, int cflags, int engine);
+	int (*rsregExec)(rsregex_t *pRe, const char *string, size_t nmatch, regmatch_t pmatch[]);
+	void (*rsregFree)(rsregex_t **ppRe);
 ENDinterface(regexp)
-#define regexpCURR_IF_VERSION 1 /* increment whenever you change the interface structure! */
+#define regexpCURR_IF_VERSION 2 /* increment whenever you change the interface structure! */
+/* Changes:
+ * v2 - added rsregComp(), rsregExec() and rsregFree(), which support PCRE2
+ */
+
+/* map an engine name (as used in the config) to its RSREGEX_* id,
+ * returns -1 if the name is unknown.
+ */
+static inline int
+regexpEngineByName(const char *const name)
+{
+	if(!strcmp(name, "posix"))
+		return RSREGEX_POSIX;
+	if(!strcmp(name, "pcre2"))
+		return RSREGEX_PCRE2;
+	return -1;
+}
 
 
 /* prototypes */
@@ -32,6 +32,7 @@
 #include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
 #include "rsyslog.h"
 #include "obj.h"
@@ -58,6 +59,8 @@
 #include "smtradfile.h"
 #include "smfwd.h"
 #include "smtradfwd.h"
+#include "smrfc5424.h"
+#include "smjson.h"
 #include "parser.h"
 #include "outchannel.h"
 #include "threads.h"
@@ -84,7 +87,8 @@ rsconf_t *loadConf = NULL;/* the config currently being loaded (no concurrent co
 
 /* hardcoded standard templates (used for defaults) */
 static uchar template_DebugFormat[] = "\"Debug line with all properties:\nFROMHOST: '%FROMHOST%', fromhost-ip: '%fromhost-ip%', HOSTNAME: '%HOSTNAME%', PRI: %PRI%,\nsyslogtag '%syslogtag%', programname: '%programname%', APP-NAME: '%APP-NAME%', PROCID: '%PROCID%', MSGID: '%MSGID%',\nTIMESTAMP: '%TIMESTAMP%', STRUCTURED-DATA: '%STRUCTURED-DATA%',\nmsg: '%msg%'\nescaped msg: '%msg:::drop-cc%'\ninputname: %inputname% rawmsg: '%rawmsg%'\n$!:%$!%\n$.:%$.%\n$/:%$/%\n\n\"";
-static uchar template_SyslogProtocol23Format[] = "\"<%PRI%>1 %TIMESTAMP:::date-rfc3339% %HOSTNAME% %APP-NAME% %PROCID% %MSGID% %STRUCTURED-DATA% %msg%\n\"";
+static uchar template_SyslogProtocol23Format[] = "=RSYSLOG_SyslogProtocol23Format";
+static uchar template_JSONFormat[] = "=RSYSLOG_JSONFormat";
 static uchar template_TraditionalFileFormat[] = "=RSYSLOG_TraditionalFileFormat";
 static uchar template_FileFormat[] = "=RSYSLOG_FileFormat";
 static uchar template_ForwardFormat[] = "=RSYSLOG_ForwardFormat";
@@ -93,7 +97,12 @@ static uchar template_WallFmt[] = "\"\r\n\7Message from syslogd@%HOSTNAME% at %t
 static uchar template_StdUsrMsgFmt[] = "\" %syslogtag%%msg%\n\r\"";
 static uchar template_StdDBFmt[] = "\"insert into SystemEvents (Message, Facility, FromHost, Priority, DeviceReportedTime, ReceivedAt, InfoUnitID, SysLogTag) values ('%msg%', %syslogfacility%, '%HOSTNAME%', %syslogpriority%, '%timereported:::date-mysql%', '%timegenerated:::date-mysql%', %iut%, '%syslogtag%')\",SQL";
 static uchar template_StdPgSQLFmt[] = "\"insert into SystemEvents (Message, Facility, FromHost, Priority, DeviceReportedTime, ReceivedAt, InfoUnitID, SysLogTag) values ('%msg%', %syslogfacility%, '%HOSTNAME%', %syslogpriority%, '%timereported:::date-pgsql%', '%timegenerated:::date-pgsql%', %iut%, '%syslogtag%')\",STDSQL";
+/* row format for ompgsql's COPY mode, to be used with "COPY SystemEvents (Message, Facility,
+ * FromHost, Priority, DeviceReportedTime, ReceivedAt, InfoUnitID, SysLogTag) FROM STDIN CSV"
+ */
+static uchar template_StdPgSQLCopyFmt[] = "\"%msg:::csv%,%syslogfacility%,%HOSTNAME:::csv%,%syslogpriority%,%timereported:::date-pgsql%,%timegenerated:::date-pgsql%,%iut%,%syslogtag:::csv%\n\"";
 static uchar template_spoofadr[] = "\"%fromhost-ip%\"";
+static uchar template_omfwdPoolHashKey[] = "\"%hostname%\"";
 static uchar template_SysklogdFileFormat[] = "\"%TIMESTAMP% %HOSTNAME% %syslogtag%%msg:::sp-if-no-1st-sp%%msg%\n\"";
 static uchar template_StdJSONFmt[] = "\"{\\\"message\\\":\\\"%msg:::json%\\\",\\\"fromhost\\\":\\\"%HOSTNAME:::json%\\\",\\\"facility\\\":\\\"%syslogfacility-text%\\\",\\\"priority\\\":\\\"%syslogpriority-text%\\\",\\\"timereported\\\":\\\"%timereported:::date-rfc3339%\\\",\\\"timegenerated\\\":\\\"%timegenerated:::date-rfc3339%\\\"}\"";
 /* end templates */
@@ -123,10 +132,12 @@ BEGINobjConstruct(rsconf) /* be sure to specify the object type also in END macr
 	pThis->templates.root = NULL;
 	pThis->templates.last = NULL;
 	pThis->templates.lastStatic = NULL;
+	pThis->templates.ht = NULL;
 	pThis->actions.nbrActions = 0;
 	lookupInitCnf(&pThis->lu_tabs);
 	CHKiRet(llInit(&pThis->rulesets.llRulesets, rulesetDestructForLinkedList,
 			rulesetKeyDestruct, strcasecmp));
+	rulesetInitIndex(pThis);
 	/* queue params */
 	pThis->globals.mainQ.iMainMsgQueueSize = 100000;
 	pThis->globals.mainQ.iMainMsgQHighWtrMark = 80000;
@@ -190,8 +201,10 @@ BEGINobjDestruct(rsconf) /* be sure to specify the object type also in END and C
 CODESTARTobjDestruct(rsconf)
 	freeCnf(pThis);
 	tplDeleteAll(pThis);
+	lookupDestroyCnf(&pThis->lu_tabs);
 	free(pThis->globals.mainQ.pszMainMsgQFName);
 	free(pThis->globals.pszConfDAGFile);
+	hashmapDestruct(&pThis->rulesets.ht);
 	llDestroy(&(pThis->rulesets.llRulesets));
 ENDobjDestruct(rsconf)
 
@@ -291,6 +304,19 @@ finalize_it:
 /*------------------------------ interface to flex/bison parser ------------------------------*/
 extern int yylineno;
 
+/* state for parsing ruleset files (cnfParseScriptFile()): only statements
+ * are accepted and collected in scriptOnlyRoot.
+ */
+static int bScriptOnly = 0;
+static struct cnfstmt *scriptOnlyRoot = NULL;
+static int iParseErrs = 0; /* errors reported via parser_errmsg() */
+
+int
+cnfIsScriptOnly(void)
+{
+	return bScriptOnly;
+}
+
 void
 parser_warnmsg(char *fmt, ...)
 {
@@ -312,6 +338,7 @@ parser_errmsg(char *fmt, ...)
 	va_list ap;
 	char errBuf[1024];
 
+	++iParseErrs;
 	va_start(ap, fmt);
 	if(vsnprintf(errBuf, sizeof(errBuf), fmt, ap) == sizeof(errBuf))
 		errBuf[sizeof(errBuf)-1] = '\0';
@@ -334,6 +361,14 @@ void cnfDoObj(struct cnfobj *o)
 
 	dbgprintf("cnf:global:obj: ");
 	cnfobjPrint(o);
+	if(bScriptOnly) {
+		parser_errmsg("%s() objects are not permitted in ruleset files",
+			      cnfobjType2str(o->objType));
+		if(o->objType == CNFOBJ_RULESET)
+			cnfstmtDestructLst(o->script);
+		cnfobjDestruct(o);
+		return;
+	}
 	switch(o->objType) {
 	case CNFOBJ_GLOBAL:
 		glblProcessCnf(o);
@@ -378,12 +413,21 @@ void cnfDoObj(struct cnfobj *o)
 void cnfDoScript(struct cnfstmt *script)
 {
 	dbgprintf("cnf:global:script\n");
+	if(bScriptOnly) {
+		scriptOnlyRoot = scriptAddStmt(scriptOnlyRoot, script);
+		return;
+	}
 	ruleset.AddScript(ruleset.GetCurrent(loadConf), script);
 }
 
 void cnfDoCfsysline(char *ln)
 {
 	DBGPRINTF("cnf:global:cfsysline: %s\n", ln);
+	if(bScriptOnly) {
+		parser_errmsg("$-directives are not permitted in ruleset files");
+		free(ln);
+		return;
+	}
 	/* the legacy system needs the "$" stripped */
 	conf.cfsysline((uchar*) ln+1);
 	free(ln);
@@ -408,6 +452,42 @@ void cnfDoBSDHost(char *ln)
 			"solution (Block '%s')", ln);
 	free(ln);
 }
+
+/* parse a ruleset file (ruleset() "file" parameter). Such a file contains
+ * statements only, everything else can not be changed while rsyslogd is
+ * running and is rejected. Any error makes the whole file fail, so that a
+ * broken file never replaces a working script. On success, the (not yet
+ * optimized) statements are returned in *pScript.
+ */
+rsRetVal
+cnfParseScriptFile(uchar *fn, struct cnfstmt **pScript)
+{
+	int r;
+	DEFiRet;
+
+	bScriptOnly = 1;
+	scriptOnlyRoot = NULL;
+	iParseErrs = 0;
+	if(cnfSetLexFile((char*)fn) != 0) {
+		errmsg.LogError(errno, RS_RET_FILE_NOT_FOUND,
+				"ruleset file '%s' could not be read", fn);
+		ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
+	}
+	r = yyparse();
+	tellLexEndParsing();
+	if(r != 0 || iParseErrs != 0) {
+		errmsg.LogError(0, RS_RET_CONF_PARSE_ERROR, "ruleset file '%s' has "
+				"errors, it is not used", fn);
+		cnfstmtDestructLst(scriptOnlyRoot);
+		ABORT_FINALIZE(RS_RET_CONF_PARSE_ERROR);
+	}
+	*pScript = scriptOnlyRoot;
+
+finalize_it:
+	scriptOnlyRoot = NULL;
+	bScriptOnly = 0;
+	RETiRet;
+}
 /*------------------------------ end interface to flex/bison parser ------------------------------*/
 
 
@@ -746,6 +826,7 @@ activate(rsconf_t *cnf)
 	CHKiRet(dropPrivileges(cnf));
 
 	tellModulesActivateConfig();
+	CHKiRet(parserActivateCache());
 	startInputModules();
 	CHKiRet(activateActions());
 	CHKiRet(activateRulesetQueues());
@@ -837,6 +918,9 @@ static rsRetVal setMainMsgQueType(void __attribute__((unused)) *pVal, uchar *psz
 	} else if (!strcasecmp((char *) pszType, "direct")) {
 		loadConf->globals.mainQ.MainMsgQueType = QUEUETYPE_DIRECT;
 		DBGPRINTF("main message queue type set to DIRECT (no queueing at all)\n");
+	} else if (!strcasecmp((char *) pszType, "lockfree")) {
+		loadConf->globals.mainQ.MainMsgQueType = QUEUETYPE_LOCKFREE;
+		DBGPRINTF("main message queue type set to LOCKFREE\n");
 	} else {
 		errmsg.LogError(0, RS_RET_INVALID_PARAMS, "unknown mainmessagequeuetype parameter: %s", (char *) pszType);
 		iRet = RS_RET_INVALID_PARAMS;
@@ -983,6 +1067,8 @@ loadBuildInModules()
 	CHKiRet(regBuildInModule(modInitsmtradfile, UCHAR_CONSTANT("builtin:smtradfile"), NULL));
 	CHKiRet(regBuildInModule(modInitsmfwd, UCHAR_CONSTANT("builtin:smfwd"), NULL));
 	CHKiRet(regBuildInModule(modInitsmtradfwd, UCHAR_CONSTANT("builtin:smtradfwd"), NULL));
+	CHKiRet(regBuildInModule(modInitsmrfc5424, UCHAR_CONSTANT("builtin:smrfc5424"), NULL));
+	CHKiRet(regBuildInModule(modInitsmjson, UCHAR_CONSTANT("builtin:smjson"), NULL));
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
@@ -1128,6 +1214,8 @@ initLegacyConf(void)
 	tplAddLine(ourConf, "RSYSLOG_DebugFormat", &pTmp);
 	pTmp = template_SyslogProtocol23Format;
 	tplAddLine(ourConf, "RSYSLOG_SyslogProtocol23Format", &pTmp);
+	pTmp = template_JSONFormat;
+	tplAddLine(ourConf, "RSYSLOG_JSONFormat", &pTmp);
 	pTmp = template_FileFormat; /* new format for files with high-precision stamp */
 	tplAddLine(ourConf, "RSYSLOG_FileFormat", &pTmp);
 	pTmp = template_TraditionalFileFormat;
@@ -1146,8 +1234,12 @@ initLegacyConf(void)
 	tplAddLine(ourConf, "RSYSLOG_SysklogdFileFormat", &pTmp);
         pTmp = template_StdPgSQLFmt;
         tplAddLine(ourConf, " StdPgSQLFmt", &pTmp);
+        pTmp = template_StdPgSQLCopyFmt;
+        tplAddLine(ourConf, " StdPgSQLCopyFmt", &pTmp);
         pTmp = template_StdJSONFmt;
         tplAddLine(ourConf, " StdJSONFmt", &pTmp);
+        pTmp = template_omfwdPoolHashKey;
+        tplAddLine(ourConf, "RSYSLOG_omfwdPoolHashKeyTpl", &pTmp);
         pTmp = template_spoofadr;
         tplLastStaticInit(ourConf, tplAddLine(ourConf, "RSYSLOG_omudpspoofDfltSourceTpl", &pTmp));
 
@@ -1187,6 +1279,16 @@ validateConf(void)
 }
 
 
+/* milliseconds, for load phase timing */
+static inline long long
+loadTimeMs(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
 /* Load a configuration. This will do all necessary steps to create
  * the in-memory representation of the configuration, including support
  * for multiple configuration languages.
@@ -1199,8 +1301,10 @@ load(rsconf_t **cnf, uchar *confFile)
 {
 	int iNbrActions;
 	int r;
+	long long tStart, tParse, tOptimize, tModules, tEnd;
 	DEFiRet;
 
+	tStart = loadTimeMs();
 	CHKiRet(rsconfConstruct(&loadConf));
 ourConf = loadConf; // TODO: remove, once ourConf is gone!
 
@@ -1208,6 +1312,7 @@ ourConf = loadConf; // TODO: remove, once ourConf is gone!
 	CHKiRet(initLegacyConf());
 
 	/* open the configuration file */
+	tParse = loadTimeMs();
 	r = cnfSetLexFile((char*)confFile);
 	if(r == 0) {
 		r = yyparse();
@@ -1226,15 +1331,29 @@ ourConf = loadConf; // TODO: remove, once ourConf is gone!
 		ABORT_FINALIZE(RS_RET_NO_ACTIONS);
 	}
 	tellLexEndParsing();
+	rulesetLoadFileAll(loadConf);
 	DBGPRINTF("Number of actions in this configuration: %d\n", iActionNbr);
+	tOptimize = loadTimeMs();
 	rulesetOptimizeAll(loadConf);
 
+	tModules = loadTimeMs();
 	tellCoreConfigLoadDone();
 	tellModulesConfigLoadDone();
 
 	tellModulesCheckConfig();
 	CHKiRet(validateConf());
 
+	/* report where config load time went, helps with very large configs */
+	tEnd = loadTimeMs();
+	if(iConfigVerify)
+		errmsg.LogMsg(0, RS_RET_OK, LOG_INFO, "config loaded in %lld ms: "
+			"init %lld, parse %lld, optimize %lld, modules %lld",
+			tEnd - tStart, tParse - tStart, tOptimize - tParse,
+			tModules - tOptimize, tEnd - tModules);
+	DBGPRINTF("config loaded in %lld ms: init %lld, parse %lld, optimize %lld, "
+		"modules %lld\n", tEnd - tStart, tParse - tStart, tOptimize - tParse,
+		tModules - tOptimize, tEnd - tModules);
+
 	/* we are done checking the config - now validate if we should actually run or not.
 	 * If not, terminate. -- rgerhards, 2008-07-25
 	 * TODO: iConfigVerify -- should it be pulled from the config, or leave as is (option)?
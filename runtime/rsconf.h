@@ -118,6 +118,7 @@ struct templates_s {
 	struct template *root;	/* the root of the template list */
 	struct template *last;	/* points to the last element of the template list */
 	struct template *lastStatic; /* last static element of the template list */
+	hashmap_t *ht;		/* name -> template index for tplFind(), NULL if not built */
 };
 
 
@@ -128,6 +129,7 @@ struct actions_s {
 
 struct rulesets_s {
 	linkedList_t llRulesets; /* this is NOT a pointer - no typo here ;) */
+	hashmap_t *ht; /* name -> ruleset index (case-insensitive), NULL if not built */
 
 	/* support for legacy rsyslog.conf format */
 	ruleset_t *pCurr; /* currently "active" ruleset */
@@ -172,6 +174,8 @@ ENDinterface(rsconf)
 
 /* prototypes */
 PROTOTYPEObj(rsconf);
+struct cnfstmt;
+rsRetVal cnfParseScriptFile(uchar *fn, struct cnfstmt **pScript);
 
 /* globally-visible external data */
 extern rsconf_t *runConf;/* the currently running config */
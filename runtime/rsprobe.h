@@ -0,0 +1,59 @@
+/* rsprobe.h
+ * Static (USDT) tracepoints for use with perf, bpftrace, SystemTap & co.
+ *
+ * If rsyslog is configured with --enable-usdt, RS_PROBE(name, ...) places
+ * a systemd-style <sys/sdt.h> probe "rsyslog:name" into the binary. A
+ * probe is a single nop as long as no tracer is attached; its arguments
+ * must thus be cheap to compute (plain fields, no function calls), as
+ * they are evaluated unconditionally. Without --enable-usdt, the macro
+ * expands to nothing at all.
+ *
+ * Probes and their arguments:
+ *   queue_enq(name, size)                        doEnqSingleObj(), after enqueue
+ *   queue_deq(name, nDequeued, nDiscarded, size) DequeueConsumableElements()
+ *   action_commit(name, nbr, nMsgs, iRet)        actionCommit()
+ *   action_suspend(name, nbr, seconds)           actionSuspend()
+ *   action_resume(name, nbr, iRet)               actionTryResume()
+ *   tcp_accept(srv, sess)                        tcpsrv SessAccept()
+ *   tcp_close(srv, sess)                         tcpsrv closeSess()
+ *   udp_batch(sock, nMsgs)                       imudp processSocket()
+ * Strings are NUL-terminated char pointers (queue names may be NULL).
+ *
+ * Example:
+ *   bpftrace -e 'usdt:/usr/sbin/rsyslogd:rsyslog:queue_deq
+ *                { @[str(arg0)] = hist(arg1); }'
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_RSPROBE_H
+#define INCLUDED_RSPROBE_H
+
+#ifdef ENABLE_USDT
+#	include <sys/sdt.h>
+	/* pick DTRACE_PROBEn based on the number of arguments */
+#	define RS_PROBE_N_(_0, _1, _2, _3, _4, _5, N, ...) N
+#	define RS_PROBE_SEL_(name, ...) \
+		RS_PROBE_N_(__VA_ARGS__, DTRACE_PROBE5, DTRACE_PROBE4, DTRACE_PROBE3, \
+			    DTRACE_PROBE2, DTRACE_PROBE1, _rs_probe_needs_args)
+#	define RS_PROBE(name, ...) RS_PROBE_SEL_(name, 0, ##__VA_ARGS__)(rsyslog, name, ##__VA_ARGS__)
+#else
+#	define RS_PROBE(name, ...)
+#endif
+
+#endif /* #ifndef INCLUDED_RSPROBE_H */
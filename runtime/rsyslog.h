@@ -45,9 +45,6 @@
 #define CONF_TAG_MAXSIZE		512	/* a value that is deemed far too large for any valid TAG */
 #define CONF_HOSTNAME_MAXSIZE		512	/* a value that is deemed far too large for any valid HOSTNAME */
 #define CONF_RAWMSG_BUFSIZE		101
-#define CONF_TAG_BUFSIZE		32
-#define CONF_PROGNAME_BUFSIZE		16
-#define CONF_HOSTNAME_BUFSIZE		32
 #define CONF_PROP_BUFSIZE		16	/* should be close to sizeof(ptr) or lighly above it */
 #define CONF_IPARAMS_BUFSIZE		16	/* initial size of iparams array in wti (is automatically extended) */
 #define	CONF_MIN_SIZE_FOR_COMPRESS	60 	/* config param: minimum message size to try compression. The smaller
@@ -389,6 +386,12 @@ enum rsRetVal_				/** return value. All methods return this if not specified oth
 
 	/* up to 2400 reserved for 7.5 & 7.6 */
 	RS_RET_INVLD_OMOD = -2400, /**< invalid output module, does not provide proper interfaces */
+	RS_RET_QTYPE_UNSUPPORTED = -2401, /**< queue type not supported on this platform */
+	RS_RET_DISKREC_CORRUPT = -2402, /**< a binary disk queue record is corrupt */
+	RS_RET_CMPR_ERR = -2403, /**< error during (de)compression (generic compression layer) */
+	RS_RET_CMPR_ALGO_UNSUPPORTED = -2404, /**< compression algorithm unknown or not supported by this build */
+	RS_RET_INVLD_LOOKUP_TAB = -2405, /**< lookup table file has invalid content (e.g. unknown type) */
+	RS_RET_CRY_AUTH_FAIL = -2406, /**< crypto block failed authentication (tampered or corrupt file) */
 
 	/* RainerScript error messages (range 1000.. 1999) */
 	RS_RET_SYSVAR_NOT_FOUND = 1001, /**< system variable could not be found (maybe misspelled) */
@@ -33,6 +33,10 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <ctype.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/stat.h>
 
 #include "rsyslog.h"
 #include "obj.h"
@@ -49,17 +53,42 @@
 #include "srUtils.h"
 #include "modules.h"
 #include "wti.h"
+#include "glbl.h"
 #include "dirty.h" /* for main ruleset queue creation */
+#include "hashmap.h"
 
 /* static data */
 DEFobjStaticHelpers
 DEFobjCurrIf(errmsg)
 DEFobjCurrIf(parser)
+DEFobjCurrIf(statsobj)
+
+/* Scripts replaced by a ruleset reload (see rulesetLoadFile()) are read by
+ * the workers without locks. Each thread pins the generation that is current
+ * when it begins processBatch() in its per-thread slot. A reload retires the
+ * old script with a new generation, and the script is freed as soon as no
+ * slot pins an older one.
+ */
+typedef struct rulesetPin_s rulesetPin_t;
+struct rulesetPin_s {
+	volatile unsigned gen;	/* pinned generation, 0 if none */
+	rulesetPin_t *next;
+	char pad[64];	/* keeps the slots of different threads on different cache lines */
+};
+static pthread_mutex_t mutRetired = PTHREAD_MUTEX_INITIALIZER; /* protects pins and retired scripts */
+static volatile unsigned scriptGen = 1;
+static pthread_key_t keyPin;
+static sbool bPinKeyActive = 0;
+static sbool bPinFailed = 0;	/* a batch ran unpinned, keep retired scripts until shutdown */
+static rulesetPin_t *pins = NULL;
+static int nRetired = 0;	/* written under mutRetired, read without as a hint */
 
 /* tables for interfacing with the v6 config system (as far as we need to) */
 static struct cnfparamdescr rspdescr[] = {
 	{ "name", eCmdHdlrString, CNFPARAM_REQUIRED },
-	{ "parser", eCmdHdlrArray, 0 }
+	{ "parser", eCmdHdlrArray, 0 },
+	{ "file", eCmdHdlrGetWord, 0 },
+	{ "latencystats", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk rspblk =
 	{ CNFPARAMBLK_VERSION,
@@ -69,6 +98,7 @@ static struct cnfparamblk rspblk =
 
 /* forward definitions */
 static rsRetVal processBatch(batch_t *pBatch, wti_t *pWti);
+static void rulesetReclaimRetired(rsconf_t *conf);
 static rsRetVal scriptExec(struct cnfstmt *root, msg_t *pMsg, wti_t *pWti);
 
 
@@ -91,6 +121,8 @@ scriptIterateAllActions(struct cnfstmt *root, rsRetVal (*pFunc)(void*, void*), v
 {
 	struct cnfstmt *stmt;
 	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		if(stmt->bInlined)
+			continue; /* done in called ruleset, just like a call */
 		switch(stmt->nodetype) {
 		case S_NOP:
 		case S_STOP:
@@ -120,6 +152,14 @@ scriptIterateAllActions(struct cnfstmt *root, rsRetVal (*pFunc)(void*, void*), v
 			scriptIterateAllActions(stmt->d.s_propfilt.t_then,
 						pFunc, pParam);
 			break;
+		case S_MULTIMATCH:
+			scriptIterateAllActions(stmt->d.s_mm.stmts,
+						pFunc, pParam);
+			break;
+		case S_PRIDISPATCH:
+			scriptIterateAllActions(stmt->d.s_pd.stmts,
+						pFunc, pParam);
+			break;
 		default:
 			dbgprintf("error: unknown stmt type %u during iterateAll\n",
 				(unsigned) stmt->nodetype);
@@ -184,6 +224,315 @@ activateRulesetQueues()
 }
 
 
+/* collect the queues to shut down, see shutdownAllQueues() */
+typedef struct queueSet_s {
+	qqueue_t **ppQueues;
+	int nQueues;
+	int maxQueues;
+} queueSet_t;
+
+static rsRetVal
+queueSetAdd(queueSet_t *pSet, qqueue_t *pQueue)
+{
+	qqueue_t **ppNew;
+	DEFiRet;
+
+	if(pQueue == NULL || pQueue->qType == QUEUETYPE_DIRECT)
+		FINALIZE;
+	if(pSet->nQueues == pSet->maxQueues) {
+		CHKmalloc(ppNew = realloc(pSet->ppQueues,
+			  (pSet->maxQueues + 16) * sizeof(qqueue_t*)));
+		pSet->ppQueues = ppNew;
+		pSet->maxQueues += 16;
+	}
+	pSet->ppQueues[pSet->nQueues++] = pQueue;
+
+finalize_it:
+	RETiRet;
+}
+
+DEFFUNC_llExecFunc(doCollectRulesetQueue)
+{
+	return queueSetAdd((queueSet_t*) pParam, ((ruleset_t*) pData)->pQueue);
+}
+
+static rsRetVal
+doCollectActionQueue(void *pData, void *pParam)
+{
+	return queueSetAdd((queueSet_t*) pParam, ((action_t*) pData)->pQueue);
+}
+
+/* shut down (and persist, if configured) all ruleset and action queues
+ * in parallel, so that a restart with many filled queues does not take
+ * the sum of their individual shutdown times. Ruleset queues feed the
+ * action queues, so they are done first. The queue objects themselves
+ * are destructed later, as usual. The main queue must already be gone.
+ */
+rsRetVal
+shutdownAllQueues(rsconf_t *conf)
+{
+	queueSet_t set;
+	DEFiRet;
+
+	memset(&set, 0, sizeof(set));
+	llExecFunc(&(conf->rulesets.llRulesets), doCollectRulesetQueue, &set);
+	DBGPRINTF("shutting down %d ruleset queues in parallel\n", set.nQueues);
+	qqueueShutdownParallel(set.ppQueues, set.nQueues);
+
+	set.nQueues = 0;
+	iterateAllActions(conf, doCollectActionQueue, &set);
+	DBGPRINTF("shutting down %d action queues in parallel\n", set.nQueues);
+	qqueueShutdownParallel(set.ppQueues, set.nQueues);
+
+	free(set.ppQueues);
+	RETiRet;
+}
+
+
+/* ---------- statement profiling (global ruleset.profile) ---------- */
+
+static inline uint64
+rulesetTimeUs(void)
+{
+	struct timespec t;
+#	if _POSIX_TIMERS <= 0
+	struct timeval tv;
+#	endif
+
+#	if _POSIX_TIMERS > 0
+#	ifdef CLOCK_MONOTONIC
+	clock_gettime(CLOCK_MONOTONIC, &t);
+#	else
+	clock_gettime(CLOCK_REALTIME, &t);
+#	endif
+#	else
+	gettimeofday(&tv, NULL);
+	t.tv_sec = tv.tv_sec;
+	t.tv_nsec = tv.tv_usec * 1000;
+#	endif
+	return (uint64) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+/* count an execution of stmt, returns 1 if it shall be timed */
+static inline int
+stmtprofHit(struct cnfstmt *const stmt)
+{
+	struct cnfstmtprof *const prof = stmt->prof;
+	return ATOMIC_INC_AND_FETCH_uint64(&prof->ctrHits, &prof->mutCtrHits)
+		% RULESET_PROFILE_SAMPLE == 0;
+}
+
+static inline void
+stmtprofPassed(struct cnfstmt *const stmt)
+{
+	if(stmt->prof != NULL)
+		ATOMIC_INC_uint64(&stmt->prof->ctrPassed, &stmt->prof->mutCtrPassed);
+}
+
+static inline void
+stmtprofTime(struct cnfstmt *const stmt, const uint64 tStart)
+{
+	struct cnfstmtprof *const prof = stmt->prof;
+	ATOMIC_INC_uint64(&prof->ctrSampled, &prof->mutCtrSampled);
+	ATOMIC_ADD_uint64(&prof->ctrSampledUs, rulesetTimeUs() - tStart, &prof->mutCtrSampledUs);
+}
+
+static const char *
+stmtprofTypeName(const unsigned nodetype)
+{
+	switch(nodetype) {
+	case S_STOP:		return "stop";
+	case S_ACT:		return "action";
+	case S_SET:		return "set";
+	case S_UNSET:		return "unset";
+	case S_CALL:		return "call";
+	case S_IF:		return "if";
+	case S_PRIFILT:		return "prifilt";
+	case S_PROPFILT:	return "propfilt";
+	case S_MULTIMATCH:	return "multimatch";
+	case S_PRIDISPATCH:	return "pridispatch";
+	default:		return "unknown";
+	}
+}
+
+static inline sbool
+stmtprofIsFilter(const unsigned nodetype)
+{
+	return nodetype == S_IF || nodetype == S_PRIFILT || nodetype == S_PROPFILT;
+}
+
+/* set up the profile of a single statement and register its counters */
+static rsRetVal
+stmtprofSetup(ruleset_t *const pRuleset, struct cnfstmt *const stmt)
+{
+	struct cnfstmtprof *prof;
+	struct cnfstmtprof *p;
+	uchar name[1024];
+	uchar ctrName[1100];
+	size_t lenName;
+	int nDups = 0;
+	DEFiRet;
+
+	snprintf((char*) name, sizeof(name), "%s:%d:%s",
+		 (stmt->cnffn == NULL) ? "-" : (char*) stmt->cnffn, stmt->lineno,
+		 stmtprofTypeName(stmt->nodetype));
+	/* multiple statements of the same type on one line are told apart
+	 * by a sequence number
+	 */
+	lenName = strlen((char*) name);
+	for(p = pRuleset->profRoot ; p != NULL ; p = p->next) {
+		if(   !strncmp((char*) p->pszName, (char*) name, lenName)
+		   && (p->pszName[lenName] == '\0' || p->pszName[lenName] == '#'))
+			++nDups;
+	}
+	if(nDups > 0)
+		snprintf((char*) name + lenName, sizeof(name) - lenName, "#%d", nDups + 1);
+
+	CHKmalloc(prof = calloc(1, sizeof(struct cnfstmtprof)));
+	if((prof->pszName = ustrdup(name)) == NULL) {
+		free(prof);
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	prof->next = pRuleset->profRoot;
+	pRuleset->profRoot = prof;
+	STATSCOUNTER_INIT(prof->ctrHits, prof->mutCtrHits);
+	STATSCOUNTER_INIT(prof->ctrPassed, prof->mutCtrPassed);
+	STATSCOUNTER_INIT(prof->ctrSampled, prof->mutCtrSampled);
+	STATSCOUNTER_INIT(prof->ctrSampledUs, prof->mutCtrSampledUs);
+
+	snprintf((char*) ctrName, sizeof(ctrName), "%s.hits", name);
+	CHKiRet(statsobj.AddCounter(pRuleset->profStats, ctrName, ctrType_IntCtr,
+		CTR_FLAG_RESETTABLE, &prof->ctrHits));
+	if(stmtprofIsFilter(stmt->nodetype)) {
+		snprintf((char*) ctrName, sizeof(ctrName), "%s.passed", name);
+		CHKiRet(statsobj.AddCounter(pRuleset->profStats, ctrName, ctrType_IntCtr,
+			CTR_FLAG_RESETTABLE, &prof->ctrPassed));
+	}
+	snprintf((char*) ctrName, sizeof(ctrName), "%s.sampled", name);
+	CHKiRet(statsobj.AddCounter(pRuleset->profStats, ctrName, ctrType_IntCtr,
+		CTR_FLAG_RESETTABLE, &prof->ctrSampled));
+	snprintf((char*) ctrName, sizeof(ctrName), "%s.sampled.us", name);
+	CHKiRet(statsobj.AddCounter(pRuleset->profStats, ctrName, ctrType_IntCtr,
+		CTR_FLAG_RESETTABLE, &prof->ctrSampledUs));
+	stmt->prof = prof;
+
+finalize_it:
+	RETiRet;
+}
+
+/* set up the profiles of all statements in a script (subtree) */
+static rsRetVal
+stmtprofSetupAll(ruleset_t *const pRuleset, struct cnfstmt *const root)
+{
+	struct cnfstmt *stmt;
+	DEFiRet;
+
+	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		if(stmt->nodetype == S_NOP)
+			continue;
+		CHKiRet(stmtprofSetup(pRuleset, stmt));
+		switch(stmt->nodetype) {
+		case S_IF:
+			CHKiRet(stmtprofSetupAll(pRuleset, stmt->d.s_if.t_then));
+			CHKiRet(stmtprofSetupAll(pRuleset, stmt->d.s_if.t_else));
+			break;
+		case S_PRIFILT:
+			CHKiRet(stmtprofSetupAll(pRuleset, stmt->d.s_prifilt.t_then));
+			CHKiRet(stmtprofSetupAll(pRuleset, stmt->d.s_prifilt.t_else));
+			break;
+		case S_PROPFILT:
+			CHKiRet(stmtprofSetupAll(pRuleset, stmt->d.s_propfilt.t_then));
+			break;
+		case S_MULTIMATCH:
+			CHKiRet(stmtprofSetupAll(pRuleset, stmt->d.s_mm.stmts));
+			break;
+		case S_PRIDISPATCH:
+			CHKiRet(stmtprofSetupAll(pRuleset, stmt->d.s_pd.stmts));
+			break;
+		default:
+			break;
+		}
+	}
+finalize_it:
+	RETiRet;
+}
+
+/* create the profile stats object of a ruleset, named "profile <ruleset>" */
+static rsRetVal
+rulesetProfileSetup(ruleset_t *const pRuleset)
+{
+	uchar name[256];
+	DEFiRet;
+
+	snprintf((char*) name, sizeof(name), "profile %s",
+		 (pRuleset->pszName == NULL) ? "[ruleset]" : (char*) pRuleset->pszName);
+	CHKiRet(statsobj.Construct(&pRuleset->profStats));
+	CHKiRet(statsobj.SetName(pRuleset->profStats, name));
+	CHKiRet(stmtprofSetupAll(pRuleset, pRuleset->root));
+	CHKiRet(statsobj.ConstructFinalize(pRuleset->profStats));
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		errmsg.LogError(0, iRet, "error setting up the profile for ruleset '%s', "
+			"profiling may be incomplete", pRuleset->pszName);
+	}
+	RETiRet;
+}
+
+/* create the probe latency stats object of a ruleset, named "ruleset <ruleset>" */
+static rsRetVal
+rulesetLatencySetup(ruleset_t *const pRuleset)
+{
+	uchar name[256];
+	DEFiRet;
+
+	snprintf((char*) name, sizeof(name), "ruleset %s",
+		 (pRuleset->pszName == NULL) ? "[ruleset]" : (char*) pRuleset->pszName);
+	CHKiRet(statsobj.Construct(&pRuleset->latStats));
+	CHKiRet(statsobj.SetName(pRuleset->latStats, name));
+	CHKiRet(statsobj.AddCounter(pRuleset->latStats, UCHAR_CONSTANT("probe.latency.p50"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &pRuleset->histProbe.ctrP50));
+	CHKiRet(statsobj.AddCounter(pRuleset->latStats, UCHAR_CONSTANT("probe.latency.p99"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &pRuleset->histProbe.ctrP99));
+	CHKiRet(statsobj.AddCounter(pRuleset->latStats, UCHAR_CONSTANT("probe.latency.max"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pRuleset->histProbe.ctrMax));
+	CHKiRet(statsobj.ConstructFinalize(pRuleset->latStats));
+
+finalize_it:
+	RETiRet;
+}
+
+/* helper for rulesetDumpProfileAll(), dumps a single ruleset */
+DEFFUNC_llExecFunc(doRulesetDumpProfile)
+{
+	ruleset_t *const pRuleset = (ruleset_t*) pData;
+	struct cnfstmtprof *prof;
+
+	for(prof = pRuleset->profRoot ; prof != NULL ; prof = prof->next) {
+		errmsg.LogMsg(0, RS_RET_OK, LOG_INFO, "profile ruleset '%s' %s: hits=%llu "
+			"passed=%llu sampled=%llu sampled.us=%llu", pRuleset->pszName,
+			prof->pszName, (unsigned long long) prof->ctrHits,
+			(unsigned long long) prof->ctrPassed,
+			(unsigned long long) prof->ctrSampled,
+			(unsigned long long) prof->ctrSampledUs);
+	}
+	return RS_RET_OK;
+}
+
+/* emit the statement profiles of all rulesets as internal messages,
+ * done on HUP if profiling is enabled.
+ */
+void
+rulesetDumpProfileAll(rsconf_t *conf)
+{
+	if(!glblRulesetProfile)
+		return;
+	llExecFunc(&(conf->rulesets.llRulesets), doRulesetDumpProfile, NULL);
+}
+
+/* ---------- END statement profiling ---------- */
+
+
 static rsRetVal
 execAct(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
 {
@@ -195,6 +544,11 @@ execAct(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
 
 	DBGPRINTF("executing action %d\n", stmt->d.act->iActionNbr);
 	stmt->d.act->submitToActQ(stmt->d.act, pWti, pMsg);
+	if(pMsg->msgFlags & DISCARD_MSG) {
+		/* consumed by a message modification action, like "stop" */
+		pMsg->msgFlags &= ~DISCARD_MSG;
+		ABORT_FINALIZE(RS_RET_DISCARDMSG);
+	}
 	if(iRet != RS_RET_DISCARDMSG) {
 		/* note: we ignore the error code here, as we do NEVER want to
 		 * stop script execution due to action return code
@@ -206,21 +560,26 @@ finalize_it:
 }
 
 static rsRetVal
-execSet(struct cnfstmt *stmt, msg_t *pMsg)
+execSet(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
 {
 	struct var result;
 	DEFiRet;
-	cnfexprEval(stmt->d.s_set.expr, &result, pMsg);
-	msgSetJSONFromVar(pMsg, stmt->d.s_set.varname, &result);
+	if(stmt->d.s_set.prog != NULL)
+		cnfprogEval(stmt->d.s_set.prog, &result, pMsg);
+	else
+		cnfexprEval(stmt->d.s_set.expr, &result, pMsg);
+	msgSetLocalVar(pMsg, stmt->d.s_set.localSlot, stmt->d.s_set.varname, &result);
 	varDelete(&result);
+	wtiTplCacheInvalidate(pWti);
 	RETiRet;
 }
 
 static rsRetVal
-execUnset(struct cnfstmt *stmt, msg_t *pMsg)
+execUnset(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
 {
 	DEFiRet;
-	msgDelJSON(pMsg, stmt->d.s_unset.varname);
+	msgUnsetLocalVar(pMsg, stmt->d.s_unset.localSlot, stmt->d.s_unset.varname);
+	wtiTplCacheInvalidate(pWti);
 	RETiRet;
 }
 
@@ -228,7 +587,9 @@ static rsRetVal
 execCall(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
 {
 	DEFiRet;
-	if(stmt->d.s_call.ruleset == NULL) {
+	if(stmt->d.s_call.dynRuleset != NULL) {
+		CHKiRet(scriptExec(stmt->d.s_call.dynRuleset->root, pMsg, pWti));
+	} else if(stmt->d.s_call.ruleset == NULL) {
 		CHKiRet(scriptExec(stmt->d.s_call.stmt, pMsg, pWti));
 	} else {
 		CHKmalloc(pMsg = MsgDup((msg_t*) pMsg));
@@ -250,9 +611,13 @@ execIf(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
 {
 	sbool bRet;
 	DEFiRet;
-	bRet = cnfexprEvalBool(stmt->d.s_if.expr, pMsg);
+	if(stmt->d.s_if.prog != NULL)
+		bRet = cnfprogEvalBool(stmt->d.s_if.prog, pMsg);
+	else
+		bRet = cnfexprEvalBool(stmt->d.s_if.expr, pMsg);
 	DBGPRINTF("if condition result is %d\n", bRet);
 	if(bRet) {
+		stmtprofPassed(stmt);
 		if(stmt->d.s_if.t_then != NULL)
 			CHKiRet(scriptExec(stmt->d.s_if.t_then, pMsg, pWti));
 	} else {
@@ -277,6 +642,7 @@ execPRIFILT(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
 
 	DBGPRINTF("PRIFILT condition result is %d\n", bRet);
 	if(bRet) {
+		stmtprofPassed(stmt);
 		if(stmt->d.s_prifilt.t_then != NULL)
 			CHKiRet(scriptExec(stmt->d.s_prifilt.t_then, pMsg, pWti));
 	} else {
@@ -387,12 +753,184 @@ execPROPFILT(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
 
 	bRet = evalPROPFILT(stmt, pMsg);
 	DBGPRINTF("PROPFILT condition result is %d\n", bRet);
-	if(bRet)
+	if(bRet) {
+		stmtprofPassed(stmt);
 		CHKiRet(scriptExec(stmt->d.s_propfilt.t_then, pMsg, pWti));
+	}
+finalize_it:
+	RETiRet;
+}
+
+/* A multi-match evaluates a whole chain of contains/startswith filters
+ * with a single scan of the property. If the message is modified while
+ * the chain executes, the property is scanned again for the remaining
+ * filters, so the result is the same as with individual evaluation.
+ */
+static rsRetVal
+execMultiMatch(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
+{
+	struct cnfstmt *sub;
+	uint64_t found;
+	unsigned gen;
+	unsigned i;
+	sbool bRet;
+	DEFiRet;
+
+	found = cnfstmtMultiMatch(stmt, pMsg);
+	gen = pWti->tplCache.gen;
+	for(sub = stmt->d.s_mm.stmts, i = 0 ; sub != NULL ; sub = sub->next, ++i) {
+		if(*pWti->pbShutdownImmediate) {
+			DBGPRINTF("execMultiMatch: ShutdownImmediate set, "
+				  "force terminating\n");
+			ABORT_FINALIZE(RS_RET_FORCE_TERM);
+		}
+		if(Debug) {
+			cnfstmtPrintOnly(sub, 2, 0);
+		}
+		if(pWti->tplCache.gen != gen) {
+			found = cnfstmtMultiMatch(stmt, pMsg);
+			gen = pWti->tplCache.gen;
+		}
+		bRet = (found >> i) & 1;
+		if(sub->nodetype == S_PROPFILT && sub->d.s_propfilt.isNegated)
+			bRet = !bRet;
+		if(sub->prof != NULL) {
+			stmtprofHit(sub);
+			if(bRet)
+				stmtprofPassed(sub);
+		}
+		if(sub->nodetype == S_PROPFILT) {
+			DBGPRINTF("PROPFILT condition result is %d\n", bRet);
+			if(bRet)
+				CHKiRet(scriptExec(sub->d.s_propfilt.t_then, pMsg, pWti));
+		} else {
+			DBGPRINTF("if condition result is %d\n", bRet);
+			if(bRet) {
+				if(sub->d.s_if.t_then != NULL)
+					CHKiRet(scriptExec(sub->d.s_if.t_then, pMsg, pWti));
+			} else {
+				if(sub->d.s_if.t_else != NULL)
+					CHKiRet(scriptExec(sub->d.s_if.t_else, pMsg, pWti));
+			}
+		}
+	}
 finalize_it:
 	RETiRet;
 }
 
+/* A PRI dispatch obtains the results of a whole chain of PRI filters
+ * with a single table lookup. As with a multi-match, the lookup is
+ * repeated if the message is modified while the chain executes.
+ */
+static rsRetVal
+execPriDispatch(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
+{
+	struct cnfstmt *sub;
+	uint64_t found;
+	unsigned gen;
+	unsigned i;
+	sbool bRet;
+	DEFiRet;
+
+	found = stmt->d.s_pd.tbl[PRIDISPATCH_IDX(pMsg->iFacility, pMsg->iSeverity)];
+	gen = pWti->tplCache.gen;
+	for(sub = stmt->d.s_pd.stmts, i = 0 ; sub != NULL ; sub = sub->next, ++i) {
+		if(*pWti->pbShutdownImmediate) {
+			DBGPRINTF("execPriDispatch: ShutdownImmediate set, "
+				  "force terminating\n");
+			ABORT_FINALIZE(RS_RET_FORCE_TERM);
+		}
+		if(pWti->tplCache.gen != gen) {
+			found = stmt->d.s_pd.tbl[PRIDISPATCH_IDX(pMsg->iFacility, pMsg->iSeverity)];
+			gen = pWti->tplCache.gen;
+		}
+		bRet = (found >> i) & 1;
+		if(Debug) {
+			cnfstmtPrintOnly(sub, 2, 0);
+			DBGPRINTF("PRIFILT condition result is %d\n", bRet);
+		}
+		if(sub->prof != NULL) {
+			stmtprofHit(sub);
+			if(bRet)
+				stmtprofPassed(sub);
+		}
+		if(bRet) {
+			if(sub->d.s_prifilt.t_then != NULL)
+				CHKiRet(scriptExec(sub->d.s_prifilt.t_then, pMsg, pWti));
+		} else {
+			if(sub->d.s_prifilt.t_else != NULL)
+				CHKiRet(scriptExec(sub->d.s_prifilt.t_else, pMsg, pWti));
+		}
+	}
+finalize_it:
+	RETiRet;
+}
+
+/* execute a single statement (including its subtree) for one message */
+static rsRetVal
+scriptExecStmt(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
+{
+	DEFiRet;
+
+	switch(stmt->nodetype) {
+	case S_NOP:
+		break;
+	case S_STOP:
+		ABORT_FINALIZE(RS_RET_DISCARDMSG);
+		break;
+	case S_ACT:
+		CHKiRet(execAct(stmt, pMsg, pWti));
+		break;
+	case S_SET:
+		CHKiRet(execSet(stmt, pMsg, pWti));
+		break;
+	case S_UNSET:
+		CHKiRet(execUnset(stmt, pMsg, pWti));
+		break;
+	case S_CALL:
+		CHKiRet(execCall(stmt, pMsg, pWti));
+		break;
+	case S_IF:
+		CHKiRet(execIf(stmt, pMsg, pWti));
+		break;
+	case S_PRIFILT:
+		CHKiRet(execPRIFILT(stmt, pMsg, pWti));
+		break;
+	case S_PROPFILT:
+		CHKiRet(execPROPFILT(stmt, pMsg, pWti));
+		break;
+	case S_MULTIMATCH:
+		CHKiRet(execMultiMatch(stmt, pMsg, pWti));
+		break;
+	case S_PRIDISPATCH:
+		CHKiRet(execPriDispatch(stmt, pMsg, pWti));
+		break;
+	default:
+		dbgprintf("error: unknown stmt type %u during exec\n",
+			(unsigned) stmt->nodetype);
+		break;
+	}
+finalize_it:
+	RETiRet;
+}
+
+/* execute a statement and record its profile */
+static rsRetVal
+scriptExecStmtProfiled(struct cnfstmt *stmt, msg_t *pMsg, wti_t *pWti)
+{
+	uint64 tStart;
+	DEFiRet;
+
+	if(stmtprofHit(stmt)) {
+		tStart = rulesetTimeUs();
+		iRet = scriptExecStmt(stmt, pMsg, pWti);
+		stmtprofTime(stmt, tStart);
+	} else {
+		iRet = scriptExecStmt(stmt, pMsg, pWti);
+	}
+	RETiRet;
+}
+
 /* The rainerscript execution engine. It is debatable if that would be better
  * contained in grammer/rainerscript.c, HOWEVER, that file focusses primarily
  * on the parsing and object creation part. So as an actual executor, it is
@@ -414,36 +952,185 @@ scriptExec(struct cnfstmt *root, msg_t *pMsg, wti_t *pWti)
 		if(Debug) {
 			cnfstmtPrintOnly(stmt, 2, 0);
 		}
+		if(stmt->prof == NULL) {
+			CHKiRet(scriptExecStmt(stmt, pMsg, pWti));
+		} else {
+			CHKiRet(scriptExecStmtProfiled(stmt, pMsg, pWti));
+		}
+	}
+finalize_it:
+	RETiRet;
+}
+
+
+/* Batch execution mode (global ruleset.batchexec). Here, each statement
+ * is executed for all messages of the batch before the next statement is
+ * started. active[i] tells if message i is still processed by the current
+ * branch of the script; a message is removed from it as soon as it is
+ * discarded (stop). So filters are evaluated in tight loops over the batch
+ * and each action receives all messages that passed its filters in a row.
+ */
+static rsRetVal scriptExecBatch(struct cnfstmt *root, batch_t *pBatch, sbool *active, wti_t *pWti);
+
+/* execute the then and else branches of a filter for the messages selected
+ * by the respective masks. Afterwards, messages discarded in a branch are
+ * removed from active. Note that each active message is in exactly one of
+ * the masks (messages without an else branch simply remain in elseMask).
+ */
+static rsRetVal
+execBatchBranches(struct cnfstmt *t_then, struct cnfstmt *t_else, batch_t *pBatch,
+	sbool *active, sbool *thenMask, sbool *elseMask, wti_t *pWti)
+{
+	int i;
+	DEFiRet;
+
+	if(t_then != NULL)
+		CHKiRet(scriptExecBatch(t_then, pBatch, thenMask, pWti));
+	if(t_else != NULL)
+		CHKiRet(scriptExecBatch(t_else, pBatch, elseMask, pWti));
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i)
+		active[i] = thenMask[i] | elseMask[i];
+finalize_it:
+	RETiRet;
+}
+
+/* evaluate a filter statement over the batch and execute its branches */
+static rsRetVal
+execBatchFilter(struct cnfstmt *stmt, batch_t *pBatch, sbool *active, wti_t *pWti)
+{
+	const int nElem = batchNumMsgs(pBatch);
+	sbool *thenMask = NULL;
+	sbool *elseMask;
+	struct cnfstmt *t_then, *t_else;
+	msg_t *pMsg;
+	sbool bRet = 0;
+	int i;
+	DEFiRet;
+
+	CHKmalloc(thenMask = malloc(2 * nElem * sizeof(sbool)));
+	elseMask = thenMask + nElem;
+	for(i = 0 ; i < nElem ; ++i) {
+		if(!active[i]) {
+			thenMask[i] = elseMask[i] = 0;
+			continue;
+		}
+		pMsg = pBatch->pElem[i].pMsg;
 		switch(stmt->nodetype) {
-		case S_NOP:
-			break;
-		case S_STOP:
-			ABORT_FINALIZE(RS_RET_DISCARDMSG);
-			break;
-		case S_ACT:
-			CHKiRet(execAct(stmt, pMsg, pWti));
+		case S_IF:
+			wtiTplCacheSetMsg(pWti, pMsg);
+			if(stmt->d.s_if.prog != NULL)
+				bRet = cnfprogEvalBool(stmt->d.s_if.prog, pMsg);
+			else
+				bRet = cnfexprEvalBool(stmt->d.s_if.expr, pMsg);
 			break;
-		case S_SET:
-			CHKiRet(execSet(stmt, pMsg));
+		case S_PRIFILT:
+			bRet = (stmt->d.s_prifilt.pmask[pMsg->iFacility] != TABLE_NOPRI) &&
+			       (stmt->d.s_prifilt.pmask[pMsg->iFacility] & (1<<pMsg->iSeverity));
 			break;
-		case S_UNSET:
-			CHKiRet(execUnset(stmt, pMsg));
+		case S_PROPFILT:
+			bRet = evalPROPFILT(stmt, pMsg);
 			break;
-		case S_CALL:
-			CHKiRet(execCall(stmt, pMsg, pWti));
+		}
+		thenMask[i] = bRet;
+		elseMask[i] = !bRet;
+		if(stmt->prof != NULL) {
+			stmtprofHit(stmt);
+			if(bRet)
+				stmtprofPassed(stmt);
+		}
+	}
+
+	switch(stmt->nodetype) {
+	case S_IF:
+		t_then = stmt->d.s_if.t_then;
+		t_else = stmt->d.s_if.t_else;
+		break;
+	case S_PRIFILT:
+		t_then = stmt->d.s_prifilt.t_then;
+		t_else = stmt->d.s_prifilt.t_else;
+		break;
+	default: /* S_PROPFILT */
+		t_then = stmt->d.s_propfilt.t_then;
+		t_else = NULL;
+		break;
+	}
+	CHKiRet(execBatchBranches(t_then, t_else, pBatch, active, thenMask, elseMask, pWti));
+
+finalize_it:
+	free(thenMask);
+	RETiRet;
+}
+
+/* execute a statement for each active message in turn. This is used for
+ * all statements that cannot be evaluated column-wise.
+ */
+static rsRetVal
+execBatchPerMsg(struct cnfstmt *stmt, batch_t *pBatch, sbool *active, wti_t *pWti)
+{
+	msg_t *pMsg;
+	rsRetVal localRet;
+	int i;
+	DEFiRet;
+
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+		if(!active[i])
+			continue;
+		if(*pWti->pbShutdownImmediate)
+			ABORT_FINALIZE(RS_RET_FORCE_TERM);
+		pMsg = pBatch->pElem[i].pMsg;
+		wtiTplCacheSetMsg(pWti, pMsg);
+		if(stmt->prof == NULL)
+			localRet = scriptExecStmt(stmt, pMsg, pWti);
+		else
+			localRet = scriptExecStmtProfiled(stmt, pMsg, pWti);
+		if(localRet == RS_RET_FORCE_TERM)
+			ABORT_FINALIZE(RS_RET_FORCE_TERM);
+		if(localRet != RS_RET_OK)
+			active[i] = 0; /* script execution for this message ends */
+	}
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+scriptExecBatch(struct cnfstmt *root, batch_t *pBatch, sbool *active, wti_t *pWti)
+{
+	struct cnfstmt *stmt;
+	DEFiRet;
+
+	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		if(*pWti->pbShutdownImmediate) {
+			DBGPRINTF("scriptExecBatch: ShutdownImmediate set, "
+				  "force terminating\n");
+			ABORT_FINALIZE(RS_RET_FORCE_TERM);
+		}
+		if(Debug) {
+			cnfstmtPrintOnly(stmt, 2, 0);
+		}
+		switch(stmt->nodetype) {
+		case S_NOP:
 			break;
 		case S_IF:
-			CHKiRet(execIf(stmt, pMsg, pWti));
-			break;
 		case S_PRIFILT:
-			CHKiRet(execPRIFILT(stmt, pMsg, pWti));
-			break;
 		case S_PROPFILT:
-			CHKiRet(execPROPFILT(stmt, pMsg, pWti));
+			CHKiRet(execBatchFilter(stmt, pBatch, active, pWti));
+			break;
+		case S_CALL:
+			if(stmt->d.s_call.dynRuleset != NULL) {
+				CHKiRet(scriptExecBatch(stmt->d.s_call.dynRuleset->root,
+					pBatch, active, pWti));
+			} else if(stmt->d.s_call.ruleset == NULL) {
+				CHKiRet(scriptExecBatch(stmt->d.s_call.stmt, pBatch, active, pWti));
+			} else {
+				CHKiRet(execBatchPerMsg(stmt, pBatch, active, pWti));
+			}
+			break;
+		case S_PRIDISPATCH:
+			/* a PRI filter is already cheap when done for the batch */
+			CHKiRet(scriptExecBatch(stmt->d.s_pd.stmts, pBatch, active, pWti));
 			break;
 		default:
-			dbgprintf("error: unknown stmt type %u during exec\n",
-				(unsigned) stmt->nodetype);
+			CHKiRet(execBatchPerMsg(stmt, pBatch, active, pWti));
 			break;
 		}
 	}
@@ -451,6 +1138,121 @@ finalize_it:
 	RETiRet;
 }
 
+/* process a batch in batch execution mode. Messages of the same ruleset
+ * are executed together, in the order the rulesets first appear in the
+ * batch.
+ */
+static rsRetVal
+processBatchColumnar(batch_t *pBatch, wti_t *pWti)
+{
+	const int nElem = batchNumMsgs(pBatch);
+	sbool *done = NULL;
+	sbool *active;
+	ruleset_t *pRuleset;
+	ruleset_t *pRulesetCurr;
+	int i, j;
+	DEFiRet;
+
+	if(nElem == 0)
+		FINALIZE;
+	CHKmalloc(done = calloc(2 * nElem, sizeof(sbool)));
+	active = done + nElem;
+	for(i = 0 ; i < nElem ; ++i)
+		done[i] = !batchIsValidElem(pBatch, i);
+	for(i = 0 ; i < nElem ; ++i) {
+		if(done[i])
+			continue;
+		pRulesetCurr = (pBatch->pElem[i].pMsg->pRuleset == NULL)
+				? ourConf->rulesets.pDflt : pBatch->pElem[i].pMsg->pRuleset;
+		for(j = 0 ; j < nElem ; ++j) {
+			pRuleset = (pBatch->pElem[j].pMsg->pRuleset == NULL)
+				? ourConf->rulesets.pDflt : pBatch->pElem[j].pMsg->pRuleset;
+			active[j] = !done[j] && pRuleset == pRulesetCurr;
+			done[j] |= active[j];
+		}
+		DBGPRINTF("processBATCH: executing ruleset %p over the batch\n", pRulesetCurr);
+		CHKiRet(scriptExecBatch(pRulesetCurr->root, pBatch, active, pWti));
+	}
+	for(i = 0 ; i < nElem ; ++i)
+		batchSetElemState(pBatch, i, BATCH_STATE_COMM);
+
+finalize_it:
+	free(done);
+	RETiRet;
+}
+
+
+/* called on thread exit */
+static void
+rulesetPinDestruct(void *p)
+{
+	rulesetPin_t *const pin = (rulesetPin_t*) p;
+	rulesetPin_t **pp;
+
+	pthread_mutex_lock(&mutRetired);
+	for(pp = &pins ; *pp != NULL ; pp = &(*pp)->next) {
+		if(*pp == pin) {
+			*pp = pin->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mutRetired);
+	free(pin);
+}
+
+
+/* get the pin slot of the current thread, register one on first use.
+ * If that is not possible, retired scripts are no longer freed while
+ * we run, as we could not tell if this thread still uses them.
+ */
+static inline rulesetPin_t *
+rulesetGetPin(void)
+{
+	rulesetPin_t *pin;
+
+	if(!bPinKeyActive)
+		return NULL;
+	if((pin = pthread_getspecific(keyPin)) != NULL)
+		return pin;
+	if((pin = calloc(1, sizeof(rulesetPin_t))) == NULL
+	   || pthread_setspecific(keyPin, pin) != 0) {
+		free(pin);
+		bPinFailed = 1;
+		return NULL;
+	}
+	pthread_mutex_lock(&mutRetired);
+	pin->next = pins;
+	pins = pin;
+	pthread_mutex_unlock(&mutRetired);
+	return pin;
+}
+
+
+/* record the latency of the probe messages (PROBE_MSG) in a batch whose
+ * execution phase is done, for all rulesets that have latency stats.
+ */
+static void
+rulesetProbeDone(batch_t *pBatch)
+{
+	ruleset_t *pRuleset;
+	msg_t *pMsg;
+	int i;
+
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+		if(!batchIsValidElem(pBatch, i))
+			continue;
+		pMsg = pBatch->pElem[i].pMsg;
+		if(!(pMsg->msgFlags & PROBE_MSG))
+			continue;
+		pRuleset = (pMsg->pRuleset == NULL) ? ourConf->rulesets.pDflt : pMsg->pRuleset;
+		if(pRuleset->latStats == NULL)
+			continue;
+		pthread_mutex_lock(&pRuleset->mutHist);
+		statshistRecord(&pRuleset->histProbe, MsgGetProbeAge(pMsg));
+		pthread_mutex_unlock(&pRuleset->mutHist);
+	}
+}
+
 
 /* Process (consume) a batch of messages. Calls the actions configured.
  * This is called by MAIN queues.
@@ -461,27 +1263,55 @@ processBatch(batch_t *pBatch, wti_t *pWti)
 	int i;
 	msg_t *pMsg;
 	ruleset_t *pRuleset;
+	rulesetPin_t *pin;
 	DEFiRet;
 
 	DBGPRINTF("processBATCH: batch of %d elements must be processed\n", pBatch->nElem);
 
+	if(nRetired != 0)
+		rulesetReclaimRetired(ourConf);
+	/* scripts may be replaced by a reload while we execute them. A nested
+	 * call (direct queue) keeps the pin of the outer batch.
+	 */
+	if((pin = rulesetGetPin()) != NULL) {
+		if(pin->gen == 0) {
+			pin->gen = scriptGen;
+			ATOMIC_MEMORY_BARRIER();
+		} else {
+			pin = NULL;
+		}
+	}
 	wtiResetExecState(pWti, pBatch);
 
 	/* execution phase */
-	for(i = 0 ; i < batchNumMsgs(pBatch) && !*(pWti->pbShutdownImmediate) ; ++i) {
-		pMsg = pBatch->pElem[i].pMsg;
-		DBGPRINTF("processBATCH: next msg %d: %.128s\n", i, pMsg->pszRawMsg);
-		pRuleset = (pMsg->pRuleset == NULL) ? ourConf->rulesets.pDflt : pMsg->pRuleset;
-		scriptExec(pRuleset->root, pMsg, pWti);
-		// TODO: think if we need a return state of scriptExec - most probably
-		// the answer is "no", as we need to process the batch in any case!
-		// TODO: we must refactor this!  flag messages as committed
-		batchSetElemState(pBatch, i, BATCH_STATE_COMM);
+	if(glblRulesetBatchExec) {
+		processBatchColumnar(pBatch, pWti);
+	} else {
+		batchPrefetchStart(pBatch);
+		for(i = 0 ; i < batchNumMsgs(pBatch) && !*(pWti->pbShutdownImmediate) ; ++i) {
+			batchPrefetch(pBatch, i);
+			if(!batchIsValidElem(pBatch, i))
+				continue; /* discarded before execution, e.g. by the parser */
+			pMsg = pBatch->pElem[i].pMsg;
+			DBGPRINTF("processBATCH: next msg %d: %.128s\n", i, pMsg->pszRawMsg);
+			pRuleset = (pMsg->pRuleset == NULL) ? ourConf->rulesets.pDflt : pMsg->pRuleset;
+			wtiTplCacheSetMsg(pWti, pMsg);
+			scriptExec(pRuleset->root, pMsg, pWti);
+			// TODO: think if we need a return state of scriptExec - most probably
+			// the answer is "no", as we need to process the batch in any case!
+			// TODO: we must refactor this!  flag messages as committed
+			batchSetElemState(pBatch, i, BATCH_STATE_COMM);
+		}
 	}
+	wtiTplCacheSetMsg(pWti, NULL);
+	if(GatherStats)
+		rulesetProbeDone(pBatch);
 
 	/* commit phase */
 	dbgprintf("END batch execution phase, entering to commit phase\n");
 	actionCommitAllDirect(pWti);
+	if(pin != NULL)
+		pin->gen = 0;
 
 	DBGPRINTF("processBATCH: batch of %d elements has been processed\n", pBatch->nElem);
 	RETiRet;
@@ -557,6 +1387,11 @@ rulesetGetRuleset(rsconf_t *conf, ruleset_t **ppRuleset, uchar *pszName)
 	assert(ppRuleset != NULL);
 	assert(pszName != NULL);
 
+	if(conf->rulesets.ht != NULL) {
+		if((*ppRuleset = hashmapSearch(conf->rulesets.ht, pszName)) == NULL)
+			ABORT_FINALIZE(RS_RET_NOT_FOUND);
+		FINALIZE;
+	}
 	CHKiRet(llFind(&(conf->rulesets.llRulesets), pszName, (void*) ppRuleset));
 
 finalize_it:
@@ -604,9 +1439,37 @@ finalize_it:
 BEGINobjConstruct(ruleset) /* be sure to specify the object type also in END macro! */
 	pThis->root = NULL;
 	pThis->last = NULL;
+	pthread_mutex_init(&pThis->mutHist, NULL);
 ENDobjConstruct(ruleset)
 
 
+/* add a ruleset to the name index. The key is the linked list's copy of
+ * the name, which lives as long as the index. Like llFind(), the first
+ * ruleset of a name wins. If we run out of memory, we drop the index and
+ * fall back to the linked list for good.
+ */
+static void
+rulesetHashAdd(rsconf_t *conf, uchar *keyName, ruleset_t *pThis)
+{
+	if(conf->rulesets.ht == NULL || hashmapSearch(conf->rulesets.ht, keyName) != NULL)
+		return;
+	if(hashmapInsert(conf->rulesets.ht, keyName, pThis) != RS_RET_OK)
+		hashmapDestruct(&conf->rulesets.ht);
+}
+
+
+/* set up the (still empty) ruleset name index. Ruleset names are
+ * case-insensitive, as with the linked list.
+ */
+void
+rulesetInitIndex(rsconf_t *conf)
+{
+	if(hashmapConstruct(&conf->rulesets.ht, 64, 0, hashmapHashStringNoCase,
+	   hashmapKeyEqualsStringNoCase, NULL, NULL) != RS_RET_OK)
+		conf->rulesets.ht = NULL;
+}
+
+
 /* ConstructionFinalizer
  * This also adds the rule set to the list of all known rulesets.
  */
@@ -623,6 +1486,7 @@ rulesetConstructFinalize(rsconf_t *conf, ruleset_t *pThis)
 	 */
 	CHKmalloc(keyName = ustrdup(pThis->pszName));
 	CHKiRet(llAppend(&(conf->rulesets.llRulesets), keyName, pThis));
+	rulesetHashAdd(conf, keyName, pThis);
 
 	/* and also the default, if so far none has been set */
 	if(conf->rulesets.pDflt == NULL)
@@ -635,6 +1499,8 @@ finalize_it:
 
 /* destructor for the ruleset object */
 BEGINobjDestruct(ruleset) /* be sure to specify the object type also in END and CODESTART macros! */
+	struct cnfstmtprof *prof;
+	struct rulesetRetired *retired;
 CODESTARTobjDestruct(ruleset)
 	DBGPRINTF("destructing ruleset %p, name %p\n", pThis, pThis->pszName);
 	if(pThis->pQueue != NULL) {
@@ -644,7 +1510,28 @@ CODESTARTobjDestruct(ruleset)
 		parser.DestructParserList(&pThis->pParserLst);
 	}
 	free(pThis->pszName);
+	free(pThis->pszFile);
 	cnfstmtDestructLst(pThis->root);
+	pthread_mutex_lock(&mutRetired);
+	while(pThis->retired != NULL) {
+		retired = pThis->retired;
+		pThis->retired = retired->next;
+		cnfstmtDestructLst(retired->root);
+		free(retired);
+		--nRetired;
+	}
+	pthread_mutex_unlock(&mutRetired);
+	if(pThis->profStats != NULL)
+		statsobj.Destruct(&pThis->profStats);
+	if(pThis->latStats != NULL)
+		statsobj.Destruct(&pThis->latStats);
+	pthread_mutex_destroy(&pThis->mutHist);
+	while(pThis->profRoot != NULL) {
+		prof = pThis->profRoot;
+		pThis->profRoot = prof->next;
+		free(prof->pszName);
+		free(prof);
+	}
 ENDobjDestruct(ruleset)
 
 
@@ -659,8 +1546,10 @@ destructAllActions(rsconf_t *conf)
 {
 	DEFiRet;
 
+	hashmapDestruct(&conf->rulesets.ht);
 	CHKiRet(llDestroy(&(conf->rulesets.llRulesets)));
 	CHKiRet(llInit(&(conf->rulesets.llRulesets), rulesetDestructForLinkedList, rulesetKeyDestruct, strcasecmp));
+	rulesetInitIndex(conf);
 	conf->rulesets.pDflt = NULL;
 
 finalize_it:
@@ -719,6 +1608,8 @@ rulesetOptimize(ruleset_t *pRuleset)
 			  pRuleset->pszName);
 		rulesetDebugPrint((ruleset_t*) pRuleset);
 	}
+	if(glblRulesetProfile)
+		rulesetProfileSetup(pRuleset);
 }
 
 /* helper for rulsetOptimizeAll(), optimizes a single ruleset */
@@ -727,7 +1618,15 @@ DEFFUNC_llExecFunc(doRulesetOptimizeAll)
 	rulesetOptimize((ruleset_t*) pData);
 	return RS_RET_OK;
 }
-/* optimize all rulesets
+/* helper for rulsetOptimizeAll(), inlines calls of a single ruleset */
+DEFFUNC_llExecFunc(doRulesetInlineCallsAll)
+{
+	cnfstmtInlineCalls(((ruleset_t*) pData)->root);
+	return RS_RET_OK;
+}
+/* optimize all rulesets. Calls are inlined only after all rulesets have
+ * been optimized, as inlining copies the called ruleset's statements. Inlined
+ * statements cannot be told apart in the profile, so profiling disables it.
  */
 rsRetVal
 rulesetOptimizeAll(rsconf_t *conf)
@@ -735,11 +1634,187 @@ rulesetOptimizeAll(rsconf_t *conf)
 	DEFiRet;
 	dbgprintf("begin ruleset optimization phase\n");
 	llExecFunc(&(conf->rulesets.llRulesets), doRulesetOptimizeAll, NULL);
+	if(!glblRulesetProfile)
+		llExecFunc(&(conf->rulesets.llRulesets), doRulesetInlineCallsAll, NULL);
 	dbgprintf("ruleset optimization phase finished.\n");
 	RETiRet;
 }
 
 
+/* ---------- reloadable rulesets ---------- */
+
+/* load the script of a ruleset from its file (ruleset() "file" parameter).
+ * At config load, this happens before the optimizer runs and the file
+ * replaces the statements given in the config, which then only serve as
+ * fallback if the file can not be loaded. On HUP (bRunning), the file is
+ * only loaded if it changed. The new script is optimized on its own and
+ * then swapped in; new batches use it, while batches that are already being
+ * processed finish with the old one. So the old script is retired with a
+ * new generation and freed once no thread is still in a batch that began
+ * before the swap (see rulesetReclaimRetired()). If anything goes wrong,
+ * the current script is kept.
+ */
+static rsRetVal
+rulesetLoadFile(ruleset_t *const pRuleset, const int bRunning)
+{
+	struct stat sb;
+	struct cnfstmt *script = NULL;
+	struct rulesetRetired *retired = NULL;
+	DEFiRet;
+
+	if(stat((char*) pRuleset->pszFile, &sb) != 0) {
+		errmsg.LogError(errno, RS_RET_FILE_NOT_FOUND, "ruleset '%s': file '%s' "
+			"can not be accessed, current statements are kept",
+			pRuleset->pszName, pRuleset->pszFile);
+		ABORT_FINALIZE(RS_RET_FILE_NOT_FOUND);
+	}
+	if(   bRunning && sb.st_mtime == pRuleset->fileMtime
+	   && sb.st_size == pRuleset->fileSize && sb.st_ino == pRuleset->fileIno) {
+		DBGPRINTF("ruleset '%s': file '%s' unchanged, not reloaded\n",
+			  pRuleset->pszName, pRuleset->pszFile);
+		FINALIZE;
+	}
+
+	if(bRunning)
+		CHKmalloc(retired = malloc(sizeof(struct rulesetRetired)));
+	CHKiRet(cnfParseScriptFile(pRuleset->pszFile, &script));
+	if(script == NULL) {
+		/* an empty file is valid and lets all messages pass unprocessed */
+		CHKmalloc(script = cnfstmtNew(S_NOP));
+	}
+
+	if(bRunning) {
+		cnfstmtOptimize(script);
+		if(!glblRulesetProfile)
+			cnfstmtInlineCalls(script);
+		retired->root = pRuleset->root;
+		/* the new script must be complete before a worker can pick it up */
+		ATOMIC_MEMORY_BARRIER();
+		pRuleset->root = script;
+		pthread_mutex_lock(&mutRetired);
+		/* batches pinning the new generation can not see the old script */
+		ATOMIC_MEMORY_BARRIER();
+		if(++scriptGen == 0)
+			++scriptGen; /* 0 means "not pinned" */
+		retired->gen = scriptGen;
+		retired->next = pRuleset->retired;
+		pRuleset->retired = retired;
+		++nRetired;
+		pthread_mutex_unlock(&mutRetired);
+		retired = NULL;
+	} else {
+		cnfstmtDestructLst(pRuleset->root);
+		pRuleset->root = script;
+	}
+	for(pRuleset->last = script ; pRuleset->last->next != NULL ; )
+		pRuleset->last = pRuleset->last->next;
+	pRuleset->fileMtime = sb.st_mtime;
+	pRuleset->fileSize = sb.st_size;
+	pRuleset->fileIno = sb.st_ino;
+
+	if(bRunning) {
+		errmsg.LogMsg(0, RS_RET_OK, LOG_INFO, "ruleset '%s' reloaded from '%s'",
+			      pRuleset->pszName, pRuleset->pszFile);
+		if(Debug)
+			rulesetDebugPrint(pRuleset);
+	}
+
+finalize_it:
+	free(retired);
+	RETiRet;
+}
+
+/* helper for rulesetLoadFileAll() and rulesetReloadAll() */
+DEFFUNC_llExecFunc(doRulesetLoadFile)
+{
+	ruleset_t *const pRuleset = (ruleset_t*) pData;
+
+	if(rulesetIsReloadable(pRuleset))
+		rulesetLoadFile(pRuleset, *(int*) pParam);
+	return RS_RET_OK; /* errors are reported, but must not stop the others */
+}
+
+/* load the scripts of all reloadable rulesets. Called once the config has
+ * been parsed, so that the files can use everything it defines.
+ */
+void
+rulesetLoadFileAll(rsconf_t *conf)
+{
+	int bRunning = 0;
+	llExecFunc(&(conf->rulesets.llRulesets), doRulesetLoadFile, &bRunning);
+}
+
+/* reload the scripts of all reloadable rulesets whose file changed, done
+ * on HUP. Must only be called from the main thread, as the config parser
+ * is not reentrant.
+ */
+void
+rulesetReloadAll(rsconf_t *conf)
+{
+	int bRunning = 1;
+	rulesetReclaimRetired(conf);
+	llExecFunc(&(conf->rulesets.llRulesets), doRulesetLoadFile, &bRunning);
+}
+
+/* check if some thread pinned a generation older than gen (wrap-safe
+ * compare). Must be called with mutRetired locked.
+ */
+static int
+rulesetGenInUse(const unsigned gen)
+{
+	rulesetPin_t *pin;
+	unsigned pinGen;
+
+	if(bPinFailed)
+		return 1;
+	ATOMIC_MEMORY_BARRIER(); /* pairs with the barrier in processBatch() */
+	for(pin = pins ; pin != NULL ; pin = pin->next) {
+		pinGen = pin->gen;
+		if(pinGen != 0 && (int) (pinGen - gen) < 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* helper for rulesetReclaimRetired(), called with mutRetired locked */
+DEFFUNC_llExecFunc(doRulesetReclaimRetired)
+{
+	ruleset_t *const pRuleset = (ruleset_t*) pData;
+	struct rulesetRetired **pp, *del;
+
+	for(pp = &pRuleset->retired ; *pp != NULL ; ) {
+		if(rulesetGenInUse((*pp)->gen)) {
+			pp = &(*pp)->next;
+			continue;
+		}
+		del = *pp;
+		*pp = del->next;
+		DBGPRINTF("ruleset '%s': freeing retired script %p\n", pRuleset->pszName, del->root);
+		cnfstmtDestructLst(del->root);
+		free(del);
+		--nRetired;
+	}
+	return RS_RET_OK;
+}
+
+/* free the retired scripts that no batch can still be executing, that is
+ * all threads have left the batches they were in when the scripts were
+ * replaced. This is tried before each batch as long as there are retired
+ * scripts, so one busy worker does not hold up the others.
+ */
+static void
+rulesetReclaimRetired(rsconf_t *conf)
+{
+	if(pthread_mutex_trylock(&mutRetired) != 0)
+		return;
+	if(nRetired != 0)
+		llExecFunc(&(conf->rulesets.llRulesets), doRulesetReclaimRetired, NULL);
+	pthread_mutex_unlock(&mutRetired);
+}
+
+/* ---------- END reloadable rulesets ---------- */
+
+
 /* Create a ruleset-specific "main" queue for this ruleset. If one is already
  * defined, an error message is emitted but nothing else is done.
  * Note: we use the main message queue parameters for queue creation and access
@@ -833,7 +1908,7 @@ rulesetProcessCnf(struct cnfobj *o)
 	rsRetVal localRet;
 	uchar *rsName = NULL;
 	uchar *parserName;
-	int nameIdx, parserIdx;
+	int nameIdx, parserIdx, fileIdx, latIdx;
 	ruleset_t *pRuleset;
 	struct cnfarray *ar;
 	int i;
@@ -863,7 +1938,15 @@ rulesetProcessCnf(struct cnfobj *o)
 	CHKiRet(rulesetConstructFinalize(loadConf, pRuleset));
 	addScript(pRuleset, o->script);
 
-	/* we have only two params, so we do NOT do the usual param loop */
+	/* we have only a few params, so we do NOT do the usual param loop */
+	fileIdx = cnfparamGetIdx(&rspblk, "file");
+	if(fileIdx != -1  && pvals[fileIdx].bUsed)
+		pRuleset->pszFile = (uchar*)es_str2cstr(pvals[fileIdx].val.d.estr, NULL);
+
+	latIdx = cnfparamGetIdx(&rspblk, "latencystats");
+	if(latIdx != -1  && pvals[latIdx].bUsed && pvals[latIdx].val.d.n)
+		CHKiRet(rulesetLatencySetup(pRuleset));
+
 	parserIdx = cnfparamGetIdx(&rspblk, "parser");
 	if(parserIdx != -1  && pvals[parserIdx].bUsed) {
 		ar = pvals[parserIdx].val.d.ar;
@@ -929,6 +2012,11 @@ ENDobjQueryInterface(ruleset)
 BEGINObjClassExit(ruleset, OBJ_IS_CORE_MODULE) /* class, version */
 	objRelease(errmsg, CORE_COMPONENT);
 	objRelease(parser, CORE_COMPONENT);
+	objRelease(statsobj, CORE_COMPONENT);
+	if(bPinKeyActive) {
+		pthread_key_delete(keyPin);
+		bPinKeyActive = 0;
+	}
 ENDObjClassExit(ruleset)
 
 
@@ -939,6 +2027,9 @@ ENDObjClassExit(ruleset)
 BEGINObjClassInit(ruleset, 1, OBJ_IS_CORE_MODULE) /* class, version */
 	/* request objects we use */
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
+	if(pthread_key_create(&keyPin, rulesetPinDestruct) == 0)
+		bPinKeyActive = 1;
 
 	/* set our own handlers */
 	OBJSetMethodHandler(objMethod_DEBUGPRINT, rulesetDebugPrint);
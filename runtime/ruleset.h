@@ -23,11 +23,36 @@
 #ifndef INCLUDED_RULESET_H
 #define INCLUDED_RULESET_H
 
+#include <sys/types.h>
 #include "queue.h"
 #include "linkedlist.h"
 #include "rsconf.h"
+#include "statsobj.h"
+
+/* execution profile of a single statement (global ruleset.profile).
+ * Execution time is measured only for every RULESET_PROFILE_SAMPLE'th
+ * execution; it includes the time spent in the statement's branches.
+ */
+#define RULESET_PROFILE_SAMPLE 64
+struct cnfstmtprof {
+	STATSCOUNTER_DEF(ctrHits, mutCtrHits);
+	STATSCOUNTER_DEF(ctrPassed, mutCtrPassed);	/* filters only: condition was true */
+	STATSCOUNTER_DEF(ctrSampled, mutCtrSampled);
+	STATSCOUNTER_DEF(ctrSampledUs, mutCtrSampledUs);
+	uchar *pszName;		/* <file>:<line>:<statement type> */
+	struct cnfstmtprof *next;
+};
 
 /* the ruleset object */
+/* a script that was replaced by a reload. Batches that were already being
+ * processed may still use it, so it is kept until they are done.
+ */
+struct rulesetRetired {
+	struct cnfstmt *root;
+	unsigned gen;		/* generation that replaced root */
+	struct rulesetRetired *next;
+};
+
 struct ruleset_s {
 	BEGINobjInstance;	/* Data to implement generic object - MUST be the first data element! */
 	uchar *pszName;		/* name of our ruleset */
@@ -35,6 +60,16 @@ struct ruleset_s {
 	struct cnfstmt *root;
 	struct cnfstmt *last;
 	parserList_t *pParserLst;/* list of parsers to use for this ruleset */
+	statsobj_t *profStats;	/* statement profiles, NULL if profiling is off */
+	struct cnfstmtprof *profRoot;
+	uchar *pszFile;		/* file the script is (re)loaded from, NULL if not reloadable */
+	time_t fileMtime;	/* identity of the file as last loaded */
+	off_t fileSize;
+	ino_t fileIno;
+	struct rulesetRetired *retired;
+	statsobj_t *latStats;	/* probe latency stats, NULL if not enabled */
+	pthread_mutex_t mutHist;/* guards histProbe */
+	statshist_t histProbe;	/* age (us) of latency probes when the ruleset is done with them */
 };
 
 /* interfaces */
@@ -99,13 +134,28 @@ rulesetHasQueue(ruleset_t *pRuleset)
 }
 
 
+/* returns 1 if the ruleset's script is loaded from a file and may be
+ * replaced on HUP, 0 if not
+ */
+static inline int
+rulesetIsReloadable(ruleset_t *pRuleset)
+{
+	return pRuleset->pszFile == NULL ? 0 : 1;
+}
+
+
 /* we will most probably convert this module back to traditional C
  * calling sequence, so here we go...
  */
 rsRetVal rulesetGetRuleset(rsconf_t *conf, ruleset_t **ppRuleset, uchar *pszName);
+void rulesetInitIndex(rsconf_t *conf);
 rsRetVal rulesetOptimizeAll(rsconf_t *conf);
+void rulesetDumpProfileAll(rsconf_t *conf);
+void rulesetLoadFileAll(rsconf_t *conf);
+void rulesetReloadAll(rsconf_t *conf);
 rsRetVal rulesetProcessCnf(struct cnfobj *o);
 rsRetVal activateRulesetQueues(void);
+rsRetVal shutdownAllQueues(rsconf_t *conf);
 
 /* Set a current rule set to already-known pointer */
 static inline void
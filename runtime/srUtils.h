@@ -92,6 +92,18 @@ int decodeSyslogName(uchar *name, syslogName_t *codetab);
 int getSubString(uchar **ppSrc,  char *pDst, size_t DstSize, char cSep);
 rsRetVal getFileSize(uchar *pszName, off_t *pSize);
 int containsGlobWildcard(char *str);
+uint32_t rsCRC32(uint32_t crc, const uchar *buf, size_t len);
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#include <sched.h>
+rsRetVal srParseCpuSet(const uchar *spec, cpu_set_t *pSet);
+#endif
+
+/* flags for srAllocPages() */
+#define SRPAGES_HUGE		0x01	/* use explicit huge pages, if available */
+#define SRPAGES_PREFAULT	0x02	/* fault in all pages right away */
+#define SRPAGES_MLOCK		0x04	/* lock the pages into memory */
+void *srAllocPages(size_t *pLen, int flags, int *pFlagsDone);
+void srFreePages(void *p, size_t len);
 
 /* mutex operations */
 /* some useful constants */
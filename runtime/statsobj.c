@@ -152,6 +152,7 @@ addCounter(statsobj_t *pThis, uchar *ctrName, statsCtrType_t ctrType, int8_t fla
 	ctr->prev = NULL;
 	CHKmalloc(ctr->name = ustrdup(ctrName));
 	ctr->flags = flags;
+	ctr->prevVal = 0;
 	ctr->ctrType = ctrType;
 	switch(ctrType) {
 	case ctrType_IntCtr:
@@ -160,6 +161,9 @@ addCounter(statsobj_t *pThis, uchar *ctrName, statsCtrType_t ctrType, int8_t fla
 	case ctrType_Int:
 		ctr->val.pInt = (int*) pCtr;
 		break;
+	case ctrType_IntCtrPerThread:
+		ctr->val.pPTCtr = (statsctr_pt_t*) pCtr;
+		break;
 	}
 	addCtrToList(pThis, ctr);
 
@@ -178,16 +182,77 @@ resetResettableCtr(ctr_t *pCtr, int8_t bResetCtrs)
 		case ctrType_Int:
 			*(pCtr->val.pInt) = 0;
 			break;
+		case ctrType_IntCtrPerThread:
+			break; /* already done by readPTCtr() */
 		}
 	}
 }
 
+/* read a per-thread counter, that is sum up its slots. If it shall be
+ * reset, we subtract what we have read instead of zeroing the slots, so
+ * that increments done while we read are not lost.
+ */
+static intctr_t
+readPTCtr(ctr_t *pCtr, int8_t bResetCtrs)
+{
+	statsctr_pt_t *const pPT = pCtr->val.pPTCtr;
+	const int bReset = bResetCtrs && (pCtr->flags & CTR_FLAG_RESETTABLE);
+	intctr_t val;
+	intctr_t sum = 0;
+	int i;
+
+	for(i = 0 ; i < STATSCTR_PT_SLOTS ; ++i) {
+		val = pPT->slot[i].val;
+		sum += val;
+		if(bReset && val != 0)
+			ATOMIC_SUB_uint64(&pPT->slot[i].val, val, &pPT->slot[i].mut);
+	}
+	return sum;
+}
+
+/* get the current value of a counter. Plain int counters are sign-extended,
+ * so they come out right when printed as (signed) long.
+ */
+static inline intctr_t
+getCtrVal(ctr_t *pCtr, int8_t bResetCtrs)
+{
+	switch(pCtr->ctrType) {
+	case ctrType_IntCtr:
+		return *(pCtr->val.pIntCtr);
+	case ctrType_Int:
+		return (intctr_t) (long long) *(pCtr->val.pInt);
+	case ctrType_IntCtrPerThread:
+		return readPTCtr(pCtr, bResetCtrs);
+	}
+	return 0;
+}
+
+/* read a counter for a stats line. Returns 0 if it shall not be emitted,
+ * which is the case in delta mode if it did not change since the last call.
+ */
+static inline int
+readCtrForLine(ctr_t *pCtr, int8_t flags, intctr_t *pVal)
+{
+	const int8_t bResetCtrs = flags & STATS_FLAG_RESET;
+
+	*pVal = getCtrVal(pCtr, bResetCtrs);
+	resetResettableCtr(pCtr, bResetCtrs);
+	if(flags & STATS_FLAG_DELTA) {
+		if(*pVal == pCtr->prevVal)
+			return 0;
+		pCtr->prevVal = *pVal;
+	}
+	return 1;
+}
+
 /* get all the object's countes together as CEE. */
 static rsRetVal
-getStatsLineCEE(statsobj_t *pThis, cstr_t **ppcstr, int cee_cookie, int8_t bResetCtrs)
+getStatsLineCEE(statsobj_t *pThis, cstr_t **ppcstr, int cee_cookie, int8_t flags, int *pnCtrs)
 {
 	cstr_t *pcstr;
 	ctr_t *pCtr;
+	intctr_t val;
+	int nCtrs = 0;
 	DEFiRet;
 
 	CHKiRet(cstrConstruct(&pcstr));
@@ -203,34 +268,25 @@ getStatsLineCEE(statsobj_t *pThis, cstr_t **ppcstr, int cee_cookie, int8_t bRese
 	rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT("\""), 1);
 	rsCStrAppendStr(pcstr, pThis->name);
 	rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT("\""), 1);
-	rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT(","), 1);
 
 	/* now add all counters to this line */
 	pthread_mutex_lock(&pThis->mutCtr);
 	for(pCtr = pThis->ctrRoot ; pCtr != NULL ; pCtr = pCtr->next) {
-		rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT("\""), 1);
+		if(!readCtrForLine(pCtr, flags, &val))
+			continue;
+		++nCtrs;
+		rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT(",\""), 2);
 		rsCStrAppendStr(pcstr, pCtr->name);
 		rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT("\""), 1);
 		cstrAppendChar(pcstr, ':');
-		switch(pCtr->ctrType) {
-		case ctrType_IntCtr:
-			rsCStrAppendInt(pcstr, *(pCtr->val.pIntCtr)); // TODO: OK?????
-			break;
-		case ctrType_Int:
-			rsCStrAppendInt(pcstr, *(pCtr->val.pInt));
-			break;
-		}
-		if (pCtr->next != NULL) {
-			cstrAppendChar(pcstr, ',');
-		} else {
-			cstrAppendChar(pcstr, '}');
-		}
-		resetResettableCtr(pCtr, bResetCtrs);
+		rsCStrAppendInt(pcstr, (long) val);
 	}
 	pthread_mutex_unlock(&pThis->mutCtr);
+	cstrAppendChar(pcstr, '}');
 
 	CHKiRet(cstrFinalize(pcstr));
 	*ppcstr = pcstr;
+	*pnCtrs = nCtrs;
 
 finalize_it:
 	RETiRet;
@@ -239,10 +295,12 @@ finalize_it:
 /* get all the object's countes together with object name as one line.
  */
 static rsRetVal
-getStatsLine(statsobj_t *pThis, cstr_t **ppcstr, int8_t bResetCtrs)
+getStatsLine(statsobj_t *pThis, cstr_t **ppcstr, int8_t flags, int *pnCtrs)
 {
 	cstr_t *pcstr;
 	ctr_t *pCtr;
+	intctr_t val;
+	int nCtrs = 0;
 	DEFiRet;
 
 	CHKiRet(cstrConstruct(&pcstr));
@@ -252,20 +310,114 @@ getStatsLine(statsobj_t *pThis, cstr_t **ppcstr, int8_t bResetCtrs)
 	/* now add all counters to this line */
 	pthread_mutex_lock(&pThis->mutCtr);
 	for(pCtr = pThis->ctrRoot ; pCtr != NULL ; pCtr = pCtr->next) {
+		if(!readCtrForLine(pCtr, flags, &val))
+			continue;
+		++nCtrs;
 		rsCStrAppendStr(pcstr, pCtr->name);
 		cstrAppendChar(pcstr, '=');
-		switch(pCtr->ctrType) {
-		case ctrType_IntCtr:
-			rsCStrAppendInt(pcstr, *(pCtr->val.pIntCtr)); // TODO: OK?????
+		rsCStrAppendInt(pcstr, (long) val);
+		cstrAppendChar(pcstr, ' ');
+	}
+	pthread_mutex_unlock(&pThis->mutCtr);
+
+	CHKiRet(cstrFinalize(pcstr));
+	*ppcstr = pcstr;
+	*pnCtrs = nCtrs;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* append a Prometheus label value, escaped as the format demands */
+static void
+appendPromLabel(cstr_t *pcstr, const uchar *val)
+{
+	for( ; *val != '\0' ; ++val) {
+		switch(*val) {
+		case '\\':
+			rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT("\\\\"), 2);
 			break;
-		case ctrType_Int:
-			rsCStrAppendInt(pcstr, *(pCtr->val.pInt));
+		case '"':
+			rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT("\\\""), 2);
 			break;
+		case '\n':
+			rsCStrAppendStrWithLen(pcstr, UCHAR_CONSTANT("\\n"), 2);
+			break;
+		default:
+			cstrAppendChar(pcstr, *val);
 		}
+	}
+}
+
+/* Get all counters in Prometheus text exposition (or OpenMetrics) format.
+ * Counter and object names are not valid metric names in general (they
+ * contain dots, blanks and whatever the user named an action), so all
+ * counters form a single "rsyslog_counter" family and all gauges (the int
+ * counters, like queue sizes) a "rsyslog_gauge" family, with the object and
+ * counter names as labels. A family must be exposed in one group, so we
+ * walk the objects once per family. Nothing is reset: scrapers expect
+ * counters to be monotonic (they do handle restarts, so resetcounters
+ * still works, but makes little sense with them).
+ */
+static rsRetVal
+getStatsPrometheus(cstr_t **ppcstr, int bOpenMetrics)
+{
+	static const struct {
+		const char *family;
+		const char *sample;
+		const char *type;
+		const char *help;
+	} families[2] = {
+		{ "rsyslog_counter", "rsyslog_counter_total", "counter", "rsyslog statistics counters" },
+		{ "rsyslog_gauge", "rsyslog_gauge", "gauge", "rsyslog statistics gauges" }
+	};
+	cstr_t *pcstr;
+	statsobj_t *o;
+	ctr_t *pCtr;
+	const char *typeName;
+	char numbuf[32];
+	int i;
+	int len;
+	DEFiRet;
+
+	CHKiRet(cstrConstruct(&pcstr));
+	for(i = 0 ; i < 2 ; ++i) {
+		/* in the text format, HELP and TYPE name the samples, in
+		 * OpenMetrics the family */
+		typeName = bOpenMetrics ? families[i].family : families[i].sample;
+		rsCStrAppendStr(pcstr, UCHAR_CONSTANT("# HELP "));
+		rsCStrAppendStr(pcstr, (uchar*) typeName);
+		cstrAppendChar(pcstr, ' ');
+		rsCStrAppendStr(pcstr, (uchar*) families[i].help);
+		rsCStrAppendStr(pcstr, UCHAR_CONSTANT("\n# TYPE "));
+		rsCStrAppendStr(pcstr, (uchar*) typeName);
 		cstrAppendChar(pcstr, ' ');
-		resetResettableCtr(pCtr, bResetCtrs);
+		rsCStrAppendStr(pcstr, (uchar*) families[i].type);
+		cstrAppendChar(pcstr, '\n');
+		for(o = objRoot ; o != NULL ; o = o->next) {
+			pthread_mutex_lock(&o->mutCtr);
+			for(pCtr = o->ctrRoot ; pCtr != NULL ; pCtr = pCtr->next) {
+				if((pCtr->ctrType == ctrType_Int) != (i == 1))
+					continue;
+				rsCStrAppendStr(pcstr, (uchar*) families[i].sample);
+				rsCStrAppendStr(pcstr, UCHAR_CONSTANT("{object=\""));
+				appendPromLabel(pcstr, o->name);
+				rsCStrAppendStr(pcstr, UCHAR_CONSTANT("\",counter=\""));
+				appendPromLabel(pcstr, pCtr->name);
+				rsCStrAppendStr(pcstr, UCHAR_CONSTANT("\"} "));
+				if(pCtr->ctrType == ctrType_Int)
+					len = snprintf(numbuf, sizeof(numbuf), "%d\n", *(pCtr->val.pInt));
+				else
+					len = snprintf(numbuf, sizeof(numbuf), "%llu\n",
+						       (unsigned long long) getCtrVal(pCtr, 0));
+				rsCStrAppendStrWithLen(pcstr, (uchar*) numbuf, len);
+			}
+			pthread_mutex_unlock(&o->mutCtr);
+		}
 	}
-	pthread_mutex_unlock(&pThis->mutCtr);
+	if(bOpenMetrics)
+		rsCStrAppendStr(pcstr, UCHAR_CONSTANT("# EOF\n"));
 
 	CHKiRet(cstrFinalize(pcstr));
 	*ppcstr = pcstr;
@@ -280,31 +432,49 @@ finalize_it:
  * submits each stats line to the callback. The callback has two parameters:
  * the first one is a caller-provided void*, the second one the cstr_t with the
  * line. If the callback reports an error, processing is stopped.
+ * flags are STATS_FLAG_*. With STATS_FLAG_DELTA, only counters that changed
+ * since the last delta call are included, and objects without any are
+ * skipped. Delta state is global, so only a single caller may use it.
+ * The Prometheus formats produce a single "line" for all objects, with
+ * newlines, and ignore the flags.
  */
 static rsRetVal
-getAllStatsLines(rsRetVal(*cb)(void*, cstr_t*), void *usrptr, statsFmtType_t fmt, int8_t bResetCtrs)
+getAllStatsLines(rsRetVal(*cb)(void*, cstr_t*), void *usrptr, statsFmtType_t fmt, int8_t flags)
 {
 	statsobj_t *o;
-	cstr_t *cstr;
+	cstr_t *cstr = NULL;
+	int nCtrs = 0;
 	DEFiRet;
 
+	if(fmt == statsFmt_Prometheus || fmt == statsFmt_OpenMetrics) {
+		CHKiRet(getStatsPrometheus(&cstr, fmt == statsFmt_OpenMetrics));
+		CHKiRet(cb(usrptr, cstr));
+		FINALIZE;
+	}
+
 	for(o = objRoot ; o != NULL ; o = o->next) {
 		switch(fmt) {
 		case statsFmt_Legacy:
-			CHKiRet(getStatsLine(o, &cstr, bResetCtrs));
+			CHKiRet(getStatsLine(o, &cstr, flags, &nCtrs));
 			break;
 		case statsFmt_CEE:
-			CHKiRet(getStatsLineCEE(o, &cstr, 1, bResetCtrs));
+			CHKiRet(getStatsLineCEE(o, &cstr, 1, flags, &nCtrs));
 			break;
 		case statsFmt_JSON:
-			CHKiRet(getStatsLineCEE(o, &cstr, 0, bResetCtrs));
+			CHKiRet(getStatsLineCEE(o, &cstr, 0, flags, &nCtrs));
 			break;
+		case statsFmt_Prometheus:
+		case statsFmt_OpenMetrics:
+			break; /* handled above, keep compiler happy */
 		}
-		CHKiRet(cb(usrptr, cstr));
+		if(nCtrs > 0 || !(flags & STATS_FLAG_DELTA))
+			CHKiRet(cb(usrptr, cstr));
 		rsCStrDestruct(&cstr);
 	}
 
 finalize_it:
+	if(cstr != NULL)
+		rsCStrDestruct(&cstr);
 	RETiRet;
 }
 
@@ -40,20 +40,48 @@ typedef uint64 intctr_t;
 /* counter types */
 typedef enum statsCtrType_e {
 	ctrType_IntCtr,
-	ctrType_Int
+	ctrType_Int,
+	ctrType_IntCtrPerThread	/* statsctr_pt_t, see below */
 } statsCtrType_t;
 
 /* stats line format types */
 typedef enum statsFmtType_e {
 	statsFmt_Legacy,
 	statsFmt_JSON,
-	statsFmt_CEE
+	statsFmt_CEE,
+	statsFmt_Prometheus,	/* text exposition format 0.0.4, one "line" for all objects */
+	statsFmt_OpenMetrics	/* OpenMetrics 1.0 text, one "line" for all objects */
 } statsFmtType_t;
 
 /* counter flags */
 #define CTR_FLAG_NONE 0
 #define CTR_FLAG_RESETTABLE 1
 
+/* flags for GetAllStatsLines() */
+#define STATS_FLAG_RESET 1	/* reset resettable counters after reading them */
+#define STATS_FLAG_DELTA 2	/* only counters changed since the last delta call */
+
+/* per-thread counter: for counters that many threads update for each
+ * message, a single intctr_t is a heavily contended cache line. This type
+ * spreads the updates over slots on separate cache lines, selected by the
+ * calling thread; the counter value is the sum of all slots, which is
+ * only computed when the stats are read. Threads may share a slot (there
+ * are fewer slots than threads), so slots are still updated atomically,
+ * but the operation is (almost always) uncontended.
+ * Use it only via the STATSCOUNTER_PT_* macros.
+ */
+#define STATSCTR_PT_SLOTS 16	/* must be a power of 2 */
+typedef struct statsctr_slot_s {
+	char pad[64 - sizeof(intctr_t)]; /* keeps val off the previous slot's (or field's) cache line */
+	intctr_t val;
+	DEF_ATOMIC_HELPER_MUT64(mut);
+} statsctr_slot_t;
+
+typedef struct statsctr_pt_s {
+	statsctr_slot_t slot[STATSCTR_PT_SLOTS];
+	char pad[64 - sizeof(intctr_t)]; /* keeps the last slot off the next field's cache line */
+} statsctr_pt_t;
+
 /* helper entity, the counter */
 typedef struct ctr_s {
 	uchar *name;
@@ -61,8 +89,10 @@ typedef struct ctr_s {
 	union {
 		intctr_t *pIntCtr;
 		int *pInt;
+		statsctr_pt_t *pPTCtr;
 	} val;
 	int8_t flags;
+	intctr_t prevVal;	/* value at the last STATS_FLAG_DELTA call */
 	struct ctr_s *next, *prev;
 } ctr_t;
 
@@ -87,16 +117,18 @@ BEGINinterface(statsobj) /* name must also be changed in ENDinterface macro! */
 	rsRetVal (*Destruct)(statsobj_t **ppThis);
 	rsRetVal (*SetName)(statsobj_t *pThis, uchar *name);
 	//rsRetVal (*GetStatsLine)(statsobj_t *pThis, cstr_t **ppcstr);
-	rsRetVal (*GetAllStatsLines)(rsRetVal(*cb)(void*, cstr_t*), void *usrptr, statsFmtType_t fmt, int8_t bResetCtr);
+	rsRetVal (*GetAllStatsLines)(rsRetVal(*cb)(void*, cstr_t*), void *usrptr, statsFmtType_t fmt, int8_t flags);
 	rsRetVal (*AddCounter)(statsobj_t *pThis, uchar *ctrName, statsCtrType_t ctrType, int8_t flags, void *pCtr);
 	rsRetVal (*EnableStats)(void);
 ENDinterface(statsobj)
-#define statsobjCURR_IF_VERSION 11 /* increment whenever you change the interface structure! */
+#define statsobjCURR_IF_VERSION 12 /* increment whenever you change the interface structure! */
 /* Changes
  * v2-v9 rserved for future use in "older" version branches
  * v10, 2012-04-01: GetAllStatsLines got fmt parameter
  * v11, 2013-09-07: - add "flags" to AddCounter API
  *                  - GetAllStatsLines got parameter telling if ctrs shall be reset
+ * v12, 2014-06-10: GetAllStatsLines reset parameter became STATS_FLAG_* flags,
+ *                  new formats statsFmt_Prometheus and statsFmt_OpenMetrics
  */
 
 
@@ -149,10 +181,54 @@ PROTOTYPEObj(statsobj);
 	if(GatherStats) \
 		ATOMIC_INC_uint64(&ctr, &mut);
 
+#define STATSCOUNTER_ADD(ctr, mut, val) \
+	if(GatherStats) \
+		ATOMIC_ADD_uint64(&ctr, val, &mut);
+
 #define STATSCOUNTER_DEC(ctr, mut) \
 	if(GatherStats) \
 		ATOMIC_DEC_uint64(&ctr, mut);
 
+/* per-thread counters, see statsctr_pt_t. They need no external mutex. */
+#define STATSCOUNTER_PT_DEF(ctr) \
+	statsctr_pt_t ctr;
+
+#define STATSCOUNTER_PT_INIT(ctr) \
+	statsctrPTInit(&(ctr));
+
+#define STATSCOUNTER_PT_INC(ctr) \
+	if(GatherStats) \
+		statsctrPTAdd(&(ctr), 1);
+
+#define STATSCOUNTER_PT_ADD(ctr, val) \
+	if(GatherStats) \
+		statsctrPTAdd(&(ctr), (val));
+
+static inline void
+statsctrPTInit(statsctr_pt_t *const pCtr)
+{
+	int i;
+	for(i = 0 ; i < STATSCTR_PT_SLOTS ; ++i) {
+		INIT_ATOMIC_HELPER_MUT64(pCtr->slot[i].mut);
+		pCtr->slot[i].val = 0;
+	}
+}
+
+/* pick the calling thread's slot. pthread_self() is cheap everywhere,
+ * but thread ids are usually aligned (often to pages), so the low bits
+ * must be mixed in.
+ */
+static inline void
+statsctrPTAdd(statsctr_pt_t *const pCtr, const intctr_t val)
+{
+	uint64 h = (uint64) (uintptr_t) pthread_self();
+	statsctr_slot_t *slot;
+
+	h *= 0x9e3779b97f4a7c15ull;
+	slot = &pCtr->slot[(h >> 32) & (STATSCTR_PT_SLOTS - 1)];
+	ATOMIC_ADD_uint64(&slot->val, val, &slot->mut);
+}
+
 /* the next macro works only if the variable is already guarded
  * by mutex (or the users risks a wrong result). It is assumed 
  * that there are not concurrent operations that modify the counter.
@@ -161,4 +237,67 @@ PROTOTYPEObj(statsobj);
 	if(GatherStats && ((newmax) > (ctr))) \
 		ctr = newmax;
 
+/* log2-bucketed histogram (e.g. of latencies). Bucket i holds values below
+ * 2^i, the last one everything above. It is published via the dual counters
+ * ctrP50, ctrP99 and ctrMax, which the owner registers with its statsobj
+ * (as ctrType_IntCtr). The owner must serialize statshistRecord() calls.
+ */
+#define STATSHIST_BUCKETS 32
+typedef struct statshist_s {
+	uint64 bucket[STATSHIST_BUCKETS];
+	uint64 nSamples;	/* sum of all buckets */
+	intctr_t ctrP50;
+	intctr_t ctrP99;
+	intctr_t ctrMax;
+} statshist_t;
+
+/* compute the value below which pct percent of the samples are. As we only
+ * know buckets, the upper bound of the bucket is returned.
+ */
+static inline intctr_t
+statshistPercentile(statshist_t *const pHist, const int pct)
+{
+	uint64 nNeeded;
+	uint64 nSeen = 0;
+	int i;
+
+	nNeeded = (pHist->nSamples * pct + 99) / 100;
+	for(i = 0 ; i < STATSHIST_BUCKETS - 1 ; ++i) {
+		nSeen += pHist->bucket[i];
+		if(nSeen >= nNeeded)
+			break;
+	}
+	return (i == 0) ? 0 : ((intctr_t) 1 << i) - 1;
+}
+
+/* add a sample to a histogram and update its percentile counters. Just as
+ * the queue residency stats, all buckets are halved whenever a certain
+ * number of samples has been collected, so that the counters follow the
+ * current situation.
+ */
+#define STATSHIST_DECAY_SAMPLES 65536
+static inline void
+statshistRecord(statshist_t *const pHist, const uint64 val)
+{
+	int i;
+
+	for(i = 0 ; i < STATSHIST_BUCKETS - 1 && (val >> i) != 0 ; ++i)
+		/*JUST SEARCH*/;
+	++pHist->bucket[i];
+	++pHist->nSamples;
+	if((intctr_t) val > pHist->ctrMax)
+		pHist->ctrMax = val;
+	if(pHist->nSamples >= STATSHIST_DECAY_SAMPLES) {
+		pHist->nSamples = 0;
+		for(i = 0 ; i < STATSHIST_BUCKETS ; ++i) {
+			pHist->bucket[i] /= 2;
+			pHist->nSamples += pHist->bucket[i];
+		}
+		if(pHist->nSamples == 0)
+			return;
+	}
+	pHist->ctrP50 = statshistPercentile(pHist, 50);
+	pHist->ctrP99 = statshistPercentile(pHist, 99);
+}
+
 #endif /* #ifndef INCLUDED_STATSOBJ_H */
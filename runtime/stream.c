@@ -47,6 +47,9 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>	 /* required for HP UX */
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include <errno.h>
 #include <pthread.h>
 
@@ -58,6 +61,8 @@
 #include "unicode-helper.h"
 #include "module-template.h"
 #include "cryprov.h"
+#include "cmpr.h"
+#include "memacct.h"
 #if HAVE_SYS_PRCTL_H
 #  include <sys/prctl.h>
 #endif
@@ -69,19 +74,72 @@
 #ifndef HAVE_LSEEK64
 #  define lseek64(fd, offset, whence) lseek(fd, offset, whence)
 #endif
+#ifndef IOV_MAX
+#  define IOV_MAX 16
+#endif
 
 /* static data */
 DEFobjStaticHelpers
 DEFobjCurrIf(zlibw)
+DEFobjCurrIf(cmpr)
+
+/* Asynchronous writes are carried out by a small, process-wide pool of writer
+ * threads instead of one dedicated thread per stream. Streams with filled
+ * buffers are put into the pool's work queue; partial buffers are written
+ * by the same threads once the stream's flush interval expires. The pool
+ * is started when the first async stream is constructed and stopped when
+ * the last one is destructed.
+ * Lock order: stream mutex first, then pool mutex.
+ */
+static struct {
+	pthread_mutex_t mut;
+	pthread_cond_t workAvail;	/* work queued, timer armed or shutdown requested */
+	pthread_cond_t streamIdle;	/* a stream is no longer busy */
+	pthread_cond_t stopped;		/* pool shutdown complete */
+	strm_t *pRoot;		/* all streams served by the pool */
+	strm_t *pQHead;		/* work queue */
+	strm_t *pQTail;
+	pthread_t *thrdIDs;
+	int nThrds;
+	int nStrms;
+	sbool bShutdown;
+} asyncWriters = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER, NULL, NULL, NULL, NULL, 0, 0, 0
+};
+
+/* a block to compress in parallel zip mode, see doZipWriteParallel() */
+typedef struct strmZipJob_s {
+	struct strmZipJob_s *pNext;	/* work queue link */
+	int *pnPending;		/* ptr to pending job counter of submitter */
+	int iZipLevel;
+	Bytef *pIn;
+	uLong lenIn;
+	Bytef *pOut;
+	uLong lenOutAlloc;
+	uLong lenOut;		/* size of generated gzip member */
+	rsRetVal iRet;
+} strmZipJob_t;
 
 /* forward definitions */
 static rsRetVal strmFlushInternal(strm_t *pThis, int bFlushZip);
 static rsRetVal strmWrite(strm_t *__restrict__ const pThis, const uchar *__restrict__ const pBuf, const size_t lenBuf);
 static rsRetVal strmCloseFile(strm_t *pThis);
 static void *asyncWriterThread(void *pPtr);
+static void asyncWriterEnqueue(strm_t *pThis);
+static void asyncWriterArmTimer(strm_t *pThis);
+static rsRetVal asyncWriterRegister(strm_t *pThis);
+static void asyncWriterUnregister(strm_t *pThis);
 static rsRetVal doZipWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf, int bFlush);
 static rsRetVal doZipFinish(strm_t *pThis);
+static rsRetVal doCmprFinish(strm_t *pThis);
+static rsRetVal doCmprWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf, int bFlush);
+static rsRetVal doZipWriteParallel(strm_t *pThis, uchar *pBuf, size_t lenBuf);
+static rsRetVal zipWorkersRegister(strm_t *pThis);
+static void zipWorkersUnregister(void);
 static rsRetVal strmPhysWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf);
+static rsRetVal syncFile(strm_t *pThis);
+static void strmUnmap(strm_t *pThis);
 static rsRetVal strmSeekCurrOffs(strm_t *pThis);
 
 
@@ -335,6 +393,24 @@ static rsRetVal strmOpenFile(strm_t *pThis)
 	CHKiRet(strmSetCurrFName(pThis));
 	
 	CHKiRet(doPhysOpen(pThis));
+#	if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+	if(pThis->bPreallocate && pThis->iMaxFileSize > 0 && pThis->tOperationsMode != STREAMMODE_READ) {
+		/* reserve the space for the whole file, so that it is not extended
+		 * chunk by chunk while we write. The file size is not changed, so
+		 * readers see only what actually has been written.
+		 */
+		if(fallocate(pThis->fd, FALLOC_FL_KEEP_SIZE, 0, pThis->iMaxFileSize) != 0) {
+			DBGOPRINT((obj_t*) pThis, "fallocate failed for file %d, errno %d - ignored\n",
+				  pThis->fd, errno);
+		}
+	}
+#	endif
+	if(pThis->bDeferSync && pThis->fdDir != -1 && pThis->tOperationsMode != STREAMMODE_READ) {
+		/* writes are not synced individually, so make sure the new directory
+		 * entry is persisted before we begin to report data as synced.
+		 */
+		fsync(pThis->fdDir);
+	}
 
 	pThis->iCurrOffs = 0;
 	if(pThis->tOperationsMode == STREAMMODE_WRITE_APPEND) {
@@ -343,6 +419,7 @@ static rsRetVal strmOpenFile(strm_t *pThis)
 		CHKiRet(getFileSize(pThis->pszCurrFName, &offset));
 		pThis->iCurrOffs = offset;
 	}
+	pThis->iPreallocEnd = pThis->iCurrOffs;
 
 	DBGOPRINT((obj_t*) pThis, "opened file '%s' for %s as %d\n", pThis->pszCurrFName,
 		  (pThis->tOperationsMode == STREAMMODE_READ) ? "READ" : "WRITE", pThis->fd);
@@ -371,9 +448,8 @@ strmWaitAsyncWriterDone(strm_t *pThis)
 {
 	BEGINfunc
 	if(pThis->bAsyncWrite) {
-		/* awake writer thread and make it write out everything */
+		/* buffers are already queued to the writer pool, we just wait for them */
 		while(pThis->iCnt > 0) {
-			pthread_cond_signal(&pThis->notEmpty);
 			d_pthread_cond_wait(&pThis->isEmpty, &pThis->mut);
 		}
 	}
@@ -406,6 +482,21 @@ static rsRetVal strmCloseFile(strm_t *pThis)
 		if(pThis->bAsyncWrite) {
 			strmWaitAsyncWriterDone(pThis);
 		}
+		if(pThis->pCmprCtx != NULL) {
+			doCmprFinish(pThis);
+		}
+		/* in group commit mode, some writes may not yet be synced. As the
+		 * descriptor goes away, we need to do that now.
+		 */
+		if(pThis->bSync && pThis->bDeferSync && pThis->fd != -1) {
+			syncFile(pThis);
+		}
+	}
+
+	/* in decompression mode, the next file starts a new compressed stream */
+	if(pThis->tOperationsMode == STREAMMODE_READ && pThis->pCmprCtx != NULL) {
+		cmpr.Destruct(&pThis->pCmprCtx);
+		pThis->lenCmprIn = pThis->iCmprInPtr = 0;
 	}
 
 	/* if we have a signature provider, we must make sure that the crypto
@@ -414,6 +505,8 @@ static rsRetVal strmCloseFile(strm_t *pThis)
 		strmOpenFile(pThis);
 	}
 
+	strmUnmap(pThis);
+
 	/* the file may already be closed (or never have opened), so guard
 	 * against this. -- rgerhards, 2010-03-19
 	 */
@@ -556,6 +649,180 @@ finalize_it:
 	RETiRet;
 }
 
+/* record buffer memory allocated for the stream. The stream keeps the
+ * sum, so that the destructor can report it as freed in one go.
+ */
+static inline void
+strmMemAcct(strm_t *const pThis, const size_t nBytes)
+{
+	pThis->memSize += nBytes;
+	memacctAdd(MEMACCT_STREAMS, nBytes);
+}
+
+
+/* release the memory mapping of a stream in mmap read mode (if any) and
+ * make pIOBuf point to our regular buffer again.
+ */
+static void
+strmUnmap(strm_t *pThis)
+{
+	if(pThis->pMmap == NULL)
+		return;
+	munmap(pThis->pMmap, pThis->lenMmap);
+	pThis->pMmap = NULL;
+	pThis->lenMmap = 0;
+	pThis->pIOBuf = pThis->pIOBufAlloc;
+	pThis->iBufPtr = pThis->iBufPtrMax = 0;
+}
+
+
+/* "read" the next buffer via a memory mapping of the current file. Instead
+ * of copying data into our buffer, pIOBuf is pointed directly into the
+ * mapping, and the buffer covers everything the file currently contains.
+ * If the file has grown since it was mapped, the mapping is renewed. As
+ * with read(), a length of 0 means EOF. The file position is kept in sync
+ * with what we handed out, so that seeking works as usual.
+ */
+static rsRetVal
+strmReadBufMmap(strm_t *pThis, long *pLenRead)
+{
+	struct stat statBuf;
+	off64_t pos;
+	void *pMap;
+	DEFiRet;
+
+	pos = lseek64(pThis->fd, 0, SEEK_CUR);
+	if(pos == -1 || fstat(pThis->fd, &statBuf) == -1)
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	if(pos >= statBuf.st_size) {
+		*pLenRead = 0;
+		FINALIZE;
+	}
+
+	if((size_t) statBuf.st_size > pThis->lenMmap) {
+		strmUnmap(pThis);
+		pMap = mmap(NULL, statBuf.st_size, PROT_READ, MAP_SHARED, pThis->fd, 0);
+		if(pMap == MAP_FAILED) {
+			DBGOPRINT((obj_t*) pThis, "file %d mmap of %lld bytes failed, errno %d\n",
+				  pThis->fd, (long long) statBuf.st_size, errno);
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+#		ifdef MADV_SEQUENTIAL
+		madvise(pMap, statBuf.st_size, MADV_SEQUENTIAL);
+#		endif
+		pThis->pMmap = pMap;
+		pThis->lenMmap = statBuf.st_size;
+	}
+
+	if(lseek64(pThis->fd, statBuf.st_size, SEEK_SET) != statBuf.st_size)
+		ABORT_FINALIZE(RS_RET_IO_ERROR);
+	pThis->pIOBuf = pThis->pMmap + pos;
+	*pLenRead = statBuf.st_size - pos;
+	DBGOPRINT((obj_t*) pThis, "file %d mapped %ld bytes\n", pThis->fd, *pLenRead);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* obtain the compression layer interface and buffers on first use. This is
+ * done lazily, as the compression properties may be set after the stream
+ * has been constructed (e.g. on deserialized queue streams).
+ */
+static rsRetVal
+strmCmprInit(strm_t *pThis)
+{
+	DEFiRet;
+
+	if(!pThis->bCmprIfLoaded) {
+		CHKiRet(objUse(cmpr, LM_CMPR_FILENAME));
+		pThis->bCmprIfLoaded = 1;
+	}
+	if(pThis->tOperationsMode == STREAMMODE_READ) {
+		if(pThis->pCmprInBuf == NULL) {
+			CHKmalloc(pThis->pCmprInBuf = MALLOC(pThis->sIOBufSize));
+			strmMemAcct(pThis, pThis->sIOBufSize);
+		}
+		if(pThis->pCmprCtx == NULL)
+			CHKiRet(cmpr.Construct(&pThis->pCmprCtx, pThis->iCmprAlgo, 1, -1, pThis->pszCmprDict));
+	} else {
+		if(pThis->pZipBuf == NULL) {
+			CHKmalloc(pThis->pZipBuf = (Bytef*) MALLOC(pThis->sIOBufSize));
+			strmMemAcct(pThis, pThis->sIOBufSize);
+		}
+		if(pThis->pCmprCtx == NULL)
+			CHKiRet(cmpr.Construct(&pThis->pCmprCtx, pThis->iCmprAlgo, 0,
+					       (pThis->iZipLevel == 0) ? -1 : pThis->iZipLevel, pThis->pszCmprDict));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* read the next buffer of decompressed data. Compressed data is read into
+ * pCmprInBuf (and decrypted, if needed) and then decompressed into pIOBuf.
+ * A length of 0 is returned on EOF.
+ */
+static rsRetVal
+strmReadBufCmpr(strm_t *pThis, long *pLenRead)
+{
+	const uchar *pIn;
+	size_t lenIn;
+	uchar *pOut;
+	size_t lenOut;
+	size_t toRead;
+	size_t actualDataLen;
+	ssize_t bytesLeft;
+	long iLenRaw;
+	sbool bEOF = 0;
+	DEFiRet;
+
+	CHKiRet(strmCmprInit(pThis));
+	*pLenRead = 0;
+	while(1) {
+		if(pThis->lenCmprIn == 0) {
+			if(pThis->cryprov == NULL) {
+				toRead = pThis->sIOBufSize;
+			} else {
+				CHKiRet(pThis->cryprov->GetBytesLeftInBlock(pThis->cryprovFileData, &bytesLeft));
+				if(bytesLeft == -1 || bytesLeft > (ssize_t) pThis->sIOBufSize)
+					toRead = pThis->sIOBufSize;
+				else
+					toRead = (size_t) bytesLeft;
+			}
+			iLenRaw = read(pThis->fd, pThis->pCmprInBuf, toRead);
+			if(iLenRaw < 0)
+				ABORT_FINALIZE(RS_RET_IO_ERROR);
+			if(iLenRaw == 0) {
+				bEOF = 1;
+			} else if(pThis->cryprov != NULL) {
+				actualDataLen = iLenRaw;
+				pThis->cryprov->Decrypt(pThis->cryprovFileData, pThis->pCmprInBuf, &actualDataLen);
+				iLenRaw = actualDataLen;
+			}
+			pThis->lenCmprIn = iLenRaw;
+			pThis->iCmprInPtr = 0;
+		}
+		pIn = pThis->pCmprInBuf + pThis->iCmprInPtr;
+		lenIn = pThis->lenCmprIn;
+		pOut = pThis->pIOBuf;
+		lenOut = pThis->sIOBufSize;
+		CHKiRet(cmpr.Process(pThis->pCmprCtx, &pIn, &lenIn, &pOut, &lenOut, CMPR_OP_RUN));
+		pThis->iCmprInPtr = pIn - pThis->pCmprInBuf;
+		pThis->lenCmprIn = lenIn;
+		if(lenOut < pThis->sIOBufSize || bEOF) {
+			*pLenRead = pThis->sIOBufSize - lenOut;
+			break;
+		}
+	}
+	DBGOPRINT((obj_t*) pThis, "file %d decompressed %ld bytes\n", pThis->fd, *pLenRead);
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* read the next buffer from disk
  * rgerhards, 2008-02-13
  */
@@ -578,6 +845,33 @@ strmReadBuf(strm_t *pThis, int *padBytes)
 		 * rgerhards, 2008-02-13
 		 */
 		CHKiRet(strmOpenFile(pThis));
+		if(pThis->iCmprAlgo != CMPR_ALGO_NONE) {
+			CHKiRet(strmReadBufCmpr(pThis, &iLenRead));
+			if(iLenRead == 0) {
+				CHKiRet(strmHandleEOF(pThis));
+			} else {
+				*padBytes = 0;
+				pThis->iBufPtrMax = iLenRead;
+				bRun = 0;
+			}
+			continue;
+		}
+		if(pThis->bMmap && pThis->cryprov == NULL) {
+			if(strmReadBufMmap(pThis, &iLenRead) == RS_RET_OK) {
+				if(iLenRead == 0) {
+					CHKiRet(strmHandleEOF(pThis));
+				} else {
+					*padBytes = 0;
+					pThis->iBufPtrMax = iLenRead;
+					bRun = 0;
+				}
+				continue;
+			}
+			/* we can continue without the mapping, just with lower performance */
+			DBGOPRINT((obj_t*) pThis, "mmap failed, switching to regular reads\n");
+			strmUnmap(pThis);
+			pThis->bMmap = 0;
+		}
 		if(pThis->cryprov == NULL) {
 			toRead = pThis->sIOBufSize;
 		} else {
@@ -675,6 +969,82 @@ static rsRetVal strmUnreadChar(strm_t *pThis, uchar c)
 	return RS_RET_OK;
 }
 
+/* read a block of exactly lenBuf octets from the stream. This is meant for
+ * binary records, where going through ReadChar() for each octet would be
+ * wasteful. If the stream ends before lenBuf octets are read, the error
+ * of the underlying read (usually RS_RET_EOF) is returned.
+ */
+static rsRetVal
+strmRead(strm_t *pThis, uchar *pBuf, size_t lenBuf)
+{
+	int padBytes = 0; /* in crypto mode, we may have some padding (non-data) bytes */
+	size_t lenCopy;
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+	ASSERT(pBuf != NULL);
+
+	if(lenBuf > 0 && pThis->iUngetC != -1) {
+		*pBuf++ = pThis->iUngetC;
+		++pThis->iCurrOffs;
+		pThis->iUngetC = -1;
+		--lenBuf;
+	}
+
+	while(lenBuf > 0) {
+		if(pThis->iBufPtr >= pThis->iBufPtrMax) {
+			CHKiRet(strmReadBuf(pThis, &padBytes));
+			pThis->iCurrOffs += padBytes;
+		}
+		lenCopy = pThis->iBufPtrMax - pThis->iBufPtr;
+		if(lenCopy > lenBuf)
+			lenCopy = lenBuf;
+		memcpy(pBuf, pThis->pIOBuf + pThis->iBufPtr, lenCopy);
+		pThis->iBufPtr += lenCopy;
+		pThis->iCurrOffs += lenCopy;
+		pBuf += lenCopy;
+		lenBuf -= lenCopy;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* append all octets up to (but not including) the next LF that are already
+ * present in the stream buffer to pStr. This permits ReadLine() to process
+ * whole line spans instead of going through ReadChar() for every single
+ * octet. No new buffer is read, so the caller continues with ReadChar(),
+ * which then returns the LF (or triggers the next read). Offsets are
+ * maintained exactly as ReadChar() would do.
+ */
+static inline rsRetVal
+strmAppendLineSpan(strm_t *pThis, cstr_t *pStr)
+{
+	uchar *pStart;
+	uchar *pLF;
+	size_t lenSpan;
+	DEFiRet;
+
+	if(pThis->iUngetC != -1 || pThis->iBufPtr >= pThis->iBufPtrMax)
+		FINALIZE; /* ReadChar() needs to handle these cases */
+
+	pStart = pThis->pIOBuf + pThis->iBufPtr;
+	lenSpan = pThis->iBufPtrMax - pThis->iBufPtr;
+	pLF = memchr(pStart, '\n', lenSpan);
+	if(pLF != NULL)
+		lenSpan = pLF - pStart;
+	if(lenSpan > 0) {
+		CHKiRet(rsCStrAppendStrWithLen(pStr, pStart, lenSpan));
+		pThis->iBufPtr += lenSpan;
+		pThis->iCurrOffs += lenSpan;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* read a 'paragraph' from a strm file.
  * A paragraph may be terminated by a LF, by a LFLF, or by LF<not whitespace> depending on the option set.
  * The termination LF characters are read, but are
@@ -709,6 +1079,7 @@ strmReadLine(strm_t *pThis, cstr_t **ppCStr, uint8_t mode, sbool bEscapeLF)
 		}
 		while(c != '\n') {
                 	CHKiRet(cstrAppendChar(*ppCStr, c));
+			CHKiRet(strmAppendLineSpan(pThis, *ppCStr));
                 	readCharRet = strmReadChar(pThis, &c);
                 	if(readCharRet == RS_RET_EOF) {/* end of file reached without \n? */
 				CHKiRet(rsCStrConstructFromCStr(&pThis->prevLineSegment, *ppCStr));
@@ -722,6 +1093,7 @@ strmReadLine(strm_t *pThis, cstr_t **ppCStr, uint8_t mode, sbool bEscapeLF)
 		while(finished == 0){
         		if(c != '\n') {
                 		CHKiRet(cstrAppendChar(*ppCStr, c));
+				CHKiRet(strmAppendLineSpan(pThis, *ppCStr));
                 		CHKiRet(strmReadChar(pThis, &c));
 				bPrevWasNL = 0;
 			} else {
@@ -753,6 +1125,7 @@ strmReadLine(strm_t *pThis, cstr_t **ppCStr, uint8_t mode, sbool bEscapeLF)
         			if(c != '\n') {
 				/* nothing in the buffer, and it's not a newline, add it to the buffer */
                				CHKiRet(cstrAppendChar(*ppCStr, c));
+					CHKiRet(strmAppendLineSpan(pThis, *ppCStr));
                				CHKiRet(strmReadChar(pThis, &c));
 				} else {
 					finished=1;  /* this is a blank line, a \n with nothing since the last complete record */
@@ -761,6 +1134,7 @@ strmReadLine(strm_t *pThis, cstr_t **ppCStr, uint8_t mode, sbool bEscapeLF)
 				if(bPrevWasNL) {
 					if ((c == ' ') || (c == '\t')){
                					CHKiRet(cstrAppendChar(*ppCStr, c));
+						CHKiRet(strmAppendLineSpan(pThis, *ppCStr));
                					CHKiRet(strmReadChar(pThis, &c));
 						bPrevWasNL = 0;
 					} else {
@@ -781,6 +1155,7 @@ strmReadLine(strm_t *pThis, cstr_t **ppCStr, uint8_t mode, sbool bEscapeLF)
 						}
 					} else {
 						CHKiRet(cstrAppendChar(*ppCStr, c));
+						CHKiRet(strmAppendLineSpan(pThis, *ppCStr));
 					}
                				CHKiRet(strmReadChar(pThis, &c));
 				}
@@ -836,6 +1211,9 @@ static rsRetVal strmConstructFinalize(strm_t *pThis)
 			 * We add another 128 bytes to take care of the gzip header and "all eventualities".
 			 */
 			CHKmalloc(pThis->pZipBuf = (Bytef*) MALLOC(sizeof(uchar) * (pThis->sIOBufSize + 128)));
+			strmMemAcct(pThis, pThis->sIOBufSize + 128);
+			if(pThis->iZipWorkers > 0)
+				CHKiRet(zipWorkersRegister(pThis));
 		}
 	}
 
@@ -863,25 +1241,19 @@ static rsRetVal strmConstructFinalize(strm_t *pThis)
 	if(pThis->bAsyncWrite) {
 		pthread_mutex_init(&pThis->mut, 0);
 		pthread_cond_init(&pThis->notFull, 0);
-		pthread_cond_init(&pThis->notEmpty, 0);
 		pthread_cond_init(&pThis->isEmpty, 0);
 		pThis->iCnt = pThis->iEnq = pThis->iDeq = 0;
 		for(i = 0 ; i < STREAM_ASYNC_NUMBUFS ; ++i) {
 			CHKmalloc(pThis->asyncBuf[i].pBuf = (uchar*) MALLOC(sizeof(uchar) * pThis->sIOBufSize));
+			strmMemAcct(pThis, pThis->sIOBufSize);
 		}
 		pThis->pIOBuf = pThis->asyncBuf[0].pBuf;
-		pThis->bStopWriter = 0;
-		if(pthread_create(&pThis->writerThreadID,
-#ifdef HAVE_PTHREAD_SETSCHEDPARAM
-			    	  &default_thread_attr,
-#else
-				  NULL,
-#endif
-				  asyncWriterThread, pThis) != 0)
-			DBGPRINTF("ERROR: stream %p cold not create writer thread\n", pThis);
+		CHKiRet(asyncWriterRegister(pThis));
 	} else {
 		/* we work synchronously, so we need to alloc a fixed pIOBuf */
 		CHKmalloc(pThis->pIOBuf = (uchar*) MALLOC(sizeof(uchar) * pThis->sIOBufSize));
+		pThis->pIOBufAlloc = pThis->pIOBuf;
+		strmMemAcct(pThis, pThis->sIOBufSize);
 	}
 
 finalize_it:
@@ -889,17 +1261,17 @@ finalize_it:
 }
 
 
-/* stop the writer thread (we MUST be runnnig asynchronously when this method
- * is called!). Note that the mutex must be locked! -- rgerhards, 2009-07-06
+/* detach the stream from the writer pool (we MUST be runnnig asynchronously when
+ * this method is called!). Note that the mutex must be locked! It is unlocked
+ * before we wait for the pool, as a pool thread may still need it.
+ * -- rgerhards, 2009-07-06
  */
 static inline void
 stopWriter(strm_t *pThis)
 {
 	BEGINfunc
-	pThis->bStopWriter = 1;
-	pthread_cond_signal(&pThis->notEmpty);
 	d_pthread_mutex_unlock(&pThis->mut);
-	pthread_join(pThis->writerThreadID, NULL);
+	asyncWriterUnregister(pThis);
 	ENDfunc
 }
 
@@ -922,7 +1294,6 @@ CODESTARTobjDestruct(strm)
 		stopWriter(pThis);
 		pthread_mutex_destroy(&pThis->mut);
 		pthread_cond_destroy(&pThis->notFull);
-		pthread_cond_destroy(&pThis->notEmpty);
 		pthread_cond_destroy(&pThis->isEmpty);
 		for(i = 0 ; i < STREAM_ASYNC_NUMBUFS ; ++i) {
 			free(pThis->asyncBuf[i].pBuf);
@@ -935,11 +1306,23 @@ CODESTARTobjDestruct(strm)
 	 * IMPORTANT: we MUST free this only AFTER the ansyncWriter has been stopped, else
 	 * we get random errors...
 	 */
+	if(pThis->pCmprCtx != NULL)
+		cmpr.Destruct(&pThis->pCmprCtx);
+	if(pThis->bCmprIfLoaded)
+		objRelease(cmpr, LM_CMPR_FILENAME);
+	free(pThis->pCmprInBuf);
+	free(pThis->pszCmprDict);
 	free(pThis->pszDir);
 	free(pThis->pZipBuf);
+	if(pThis->memSize != 0)
+		memacctSub(MEMACCT_STREAMS, pThis->memSize);
+	if(pThis->iZipLevel && pThis->iZipWorkers > 0)
+		zipWorkersUnregister();
+	for(i = 0 ; i < pThis->nZipJobsAlloc ; ++i)
+		free(pThis->pZipJobs[i].pOut);
+	free(pThis->pZipJobs);
 	free(pThis->pszCurrFName);
 	free(pThis->pszFName);
-	pThis->bStopWriter = 2; /* RG: use as flag for destruction */
 ENDobjDestruct(strm)
 
 
@@ -1048,6 +1431,52 @@ finalize_it:
 
 
 
+/* gathered write of an iovec array, with the same semantics as doWriteCall().
+ * Note that the iov array is modified in case of partial writes. On exit,
+ * *pLenWritten contains the number of bytes actually written.
+ */
+static rsRetVal
+doWritevCall(strm_t *pThis, struct iovec *iov, int iovcnt, size_t *pLenWritten)
+{
+	ssize_t iWritten;
+	size_t iTotalWritten;
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, strm);
+
+	iTotalWritten = 0;
+	while(iovcnt > 0) {
+		iWritten = writev(pThis->fd, iov, (iovcnt > IOV_MAX) ? IOV_MAX : iovcnt);
+		if(iWritten < 0) {
+			char errStr[1024];
+			int err = errno;
+			rs_strerror_r(err, errStr, sizeof(errStr));
+			DBGPRINTF("log file (%d) writev error %d: %s\n", pThis->fd, err, errStr);
+			if(err == EINTR)
+				continue;
+			ABORT_FINALIZE(RS_RET_IO_ERROR);
+		}
+		iTotalWritten += iWritten;
+		/* skip what was completely written, adjust a partially written element */
+		while(iovcnt > 0 && (size_t) iWritten >= iov->iov_len) {
+			iWritten -= iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+		if(iWritten > 0) {
+			iov->iov_base = (char*) iov->iov_base + iWritten;
+			iov->iov_len -= iWritten;
+		}
+	}
+
+	DBGOPRINT((obj_t*) pThis, "file %d writev wrote %lld bytes\n", pThis->fd,
+		  (long long) iTotalWritten);
+
+finalize_it:
+	*pLenWritten = iTotalWritten;
+	RETiRet;
+}
+
+
 /* write memory buffer to a stream object.
  */
 static inline rsRetVal
@@ -1057,7 +1486,11 @@ doWriteInternal(strm_t *pThis, uchar *pBuf, size_t lenBuf, int bFlush)
 
 	ASSERT(pThis != NULL);
 
-	if(pThis->iZipLevel) {
+	if(pThis->iCmprAlgo != CMPR_ALGO_NONE) {
+		CHKiRet(doCmprWrite(pThis, pBuf, lenBuf, bFlush));
+	} else if(pThis->iZipLevel && pThis->iZipWorkers > 0) {
+		CHKiRet(doZipWriteParallel(pThis, pBuf, lenBuf));
+	} else if(pThis->iZipLevel) {
 		CHKiRet(doZipWrite(pThis, pBuf, lenBuf, bFlush));
 	} else {
 		/* write without zipping */
@@ -1092,7 +1525,7 @@ doAsyncWriteInternal(strm_t *pThis, size_t lenBuf)
 
 	pThis->bDoTimedWait = 0; /* everything written, no need to timeout partial buffer writes */
 	if(++pThis->iCnt == 1)
-		pthread_cond_signal(&pThis->notEmpty);
+		asyncWriterEnqueue(pThis);
 
 	RETiRet;
 }
@@ -1132,83 +1565,287 @@ finalize_it:
 
 
 
-/* This is the writer thread for asynchronous mode.
+/* Service a stream on behalf of the writer pool: write out all queued buffers
+ * and, if the flush interval expired, the partial buffer as well. The caller
+ * has marked the stream busy, so no other pool thread touches it concurrently.
+ */
+static void
+asyncWriterServiceStrm(strm_t *pThis, sbool bFlushDue)
+{
+	int iDeq;
+
+	d_pthread_mutex_lock(&pThis->mut);
+	while(1) { /* loop broken inside */
+		while(pThis->iCnt > 0) {
+			iDeq = pThis->iDeq++ % STREAM_ASYNC_NUMBUFS;
+			/* now we can do the actual write in parallel */
+			d_pthread_mutex_unlock(&pThis->mut);
+			doWriteInternal(pThis, pThis->asyncBuf[iDeq].pBuf, pThis->asyncBuf[iDeq].lenBuf, 0); // TODO: flush state
+			// TODO: error check????? 2009-07-06
+			d_pthread_mutex_lock(&pThis->mut);
+
+			--pThis->iCnt;
+			pthread_cond_signal(&pThis->notFull);
+			if(pThis->iCnt == 0)
+				pthread_cond_broadcast(&pThis->isEmpty);
+		}
+		/* the flush must be done with all buffers free, because strmFlushInternal()
+		 * otherwise would wait for us to free one...
+		 */
+		if(bFlushDue && pThis->iBufPtr > 0) {
+			strmFlushInternal(pThis, 0);
+			bFlushDue = 0;
+			continue;
+		}
+		break;
+	}
+	d_pthread_mutex_unlock(&pThis->mut);
+}
+
+
+/* Scan the registered streams for expired flush timers. Streams that are due
+ * are put into the work queue. Returns the number of milliseconds until the
+ * next timer expires or -1 if no timer is armed. Pool mutex must be locked.
+ */
+static long
+asyncWriterCheckTimers(void)
+{
+	strm_t *pStrm;
+	long iTimeout;
+	long iMinTimeout = -1;
+
+	for(pStrm = asyncWriters.pRoot ; pStrm != NULL ; pStrm = pStrm->pAWNext) {
+		if(!pStrm->bAWTimerArmed)
+			continue;
+		iTimeout = timeoutVal(&pStrm->tAWDeadline);
+		if(iTimeout == 0) {
+			pStrm->bAWTimerArmed = 0;
+			pStrm->bAWFlushDue = 1;
+			if(pStrm->bAWBusy) {
+				pStrm->bAWPending = 1;
+			} else if(!pStrm->bAWQueued) {
+				pStrm->bAWQueued = 1;
+				pStrm->pAWQNext = NULL;
+				if(asyncWriters.pQTail == NULL)
+					asyncWriters.pQHead = pStrm;
+				else
+					asyncWriters.pQTail->pAWQNext = pStrm;
+				asyncWriters.pQTail = pStrm;
+			}
+		} else if(iMinTimeout == -1 || iTimeout < iMinTimeout) {
+			iMinTimeout = iTimeout;
+		}
+	}
+	return iMinTimeout;
+}
+
+
+/* This is a writer thread of the shared pool for asynchronous mode.
  * -- rgerhards, 2009-07-06
  */
 static void*
-asyncWriterThread(void *pPtr)
+asyncWriterThread(void __attribute__((unused)) *pPtr)
 {
-	int iDeq;
 	struct timespec t;
-	sbool bTimedOut = 0;
-	strm_t *pThis = (strm_t*) pPtr;
+	strm_t *pStrm;
+	sbool bFlushDue;
+	long iTimeout;
 	int err;
-	uchar thrdName[256] = "rs:";
-	ISOBJ_TYPE_assert(pThis, strm);
 
 	BEGINfunc
-	ustrncpy(thrdName+3, pThis->pszFName, sizeof(thrdName)-4);
-	dbgOutputTID((char*)thrdName);
+	dbgOutputTID((char*)"rs:strm-writer");
 #	if HAVE_PRCTL && defined PR_SET_NAME
-	if(prctl(PR_SET_NAME, (char*)thrdName, 0, 0, 0) != 0) {
+	if(prctl(PR_SET_NAME, (char*)"rs:strm-writer", 0, 0, 0) != 0) {
 		DBGPRINTF("prctl failed, not setting thread name for '%s'\n", "stream writer");
 	}
 #	endif
 
-	d_pthread_mutex_lock(&pThis->mut);
+	d_pthread_mutex_lock(&asyncWriters.mut);
 	while(1) { /* loop broken inside */
-		while(pThis->iCnt == 0) {
-			if(pThis->bStopWriter) {
-				pthread_cond_broadcast(&pThis->isEmpty);
-				d_pthread_mutex_unlock(&pThis->mut);
-				goto finalize_it; /* break main loop */
-			}
-			if(bTimedOut && pThis->iBufPtr > 0) {
-				/* if we timed out, we need to flush pending data */
-				strmFlushInternal(pThis, 0);
-				bTimedOut = 0;
-				d_pthread_mutex_unlock(&pThis->mut);
-				continue;
-			}
-			bTimedOut = 0;
-			timeoutComp(&t, pThis->iFlushInterval * 1000); /* *1000 millisconds */
-			if(pThis->bDoTimedWait) {
-				if((err = pthread_cond_timedwait(&pThis->notEmpty, &pThis->mut, &t)) != 0) {
-					bTimedOut = 1; /* simulate in any case */
-					if(err != ETIMEDOUT) {
-						char errStr[1024];
-						rs_strerror_r(err, errStr, sizeof(errStr));
-						DBGPRINTF("stream async writer timeout with error (%d): %s - ignoring\n",
-							   err, errStr);
-					}
-				}
-			} else {
-				d_pthread_cond_wait(&pThis->notEmpty, &pThis->mut);
+		if(asyncWriters.pQHead != NULL) {
+			pStrm = asyncWriters.pQHead;
+			asyncWriters.pQHead = pStrm->pAWQNext;
+			if(asyncWriters.pQHead == NULL)
+				asyncWriters.pQTail = NULL;
+			pStrm->bAWQueued = 0;
+			pStrm->bAWBusy = 1;
+			do {
+				pStrm->bAWPending = 0;
+				bFlushDue = pStrm->bAWFlushDue;
+				pStrm->bAWFlushDue = 0;
+				d_pthread_mutex_unlock(&asyncWriters.mut);
+				asyncWriterServiceStrm(pStrm, bFlushDue);
+				d_pthread_mutex_lock(&asyncWriters.mut);
+			} while(pStrm->bAWPending);
+			pStrm->bAWBusy = 0;
+			pthread_cond_broadcast(&asyncWriters.streamIdle);
+			continue;
+		}
+		if(asyncWriters.bShutdown)
+			break;
+		iTimeout = asyncWriterCheckTimers();
+		if(asyncWriters.pQHead != NULL)
+			continue;
+		if(iTimeout == -1) {
+			d_pthread_cond_wait(&asyncWriters.workAvail, &asyncWriters.mut);
+		} else {
+			timeoutComp(&t, iTimeout);
+			if((err = pthread_cond_timedwait(&asyncWriters.workAvail, &asyncWriters.mut, &t)) != 0
+			   && err != ETIMEDOUT) {
+				char errStr[1024];
+				rs_strerror_r(err, errStr, sizeof(errStr));
+				DBGPRINTF("stream async writer timeout with error (%d): %s - ignoring\n",
+					   err, errStr);
 			}
 		}
+	}
+	d_pthread_mutex_unlock(&asyncWriters.mut);
 
-		bTimedOut = 0; /* we may have timed out, but there *is* work to do... */
+	ENDfunc
+	return NULL; /* to keep pthreads happy */
+}
 
-		iDeq = pThis->iDeq++ % STREAM_ASYNC_NUMBUFS;
 
-		/* now we can do the actual write in parallel */
-		d_pthread_mutex_unlock(&pThis->mut);
-		doWriteInternal(pThis, pThis->asyncBuf[iDeq].pBuf, pThis->asyncBuf[iDeq].lenBuf, 0); // TODO: flush state
-		// TODO: error check????? 2009-07-06
-		d_pthread_mutex_lock(&pThis->mut);
+/* hand a stream with filled buffers over to the writer pool.
+ * Must be called with the stream mutex locked.
+ */
+static void
+asyncWriterEnqueue(strm_t *pThis)
+{
+	d_pthread_mutex_lock(&asyncWriters.mut);
+	if(pThis->bAWBusy) {
+		pThis->bAWPending = 1;
+	} else if(!pThis->bAWQueued) {
+		pThis->bAWQueued = 1;
+		pThis->pAWQNext = NULL;
+		if(asyncWriters.pQTail == NULL)
+			asyncWriters.pQHead = pThis;
+		else
+			asyncWriters.pQTail->pAWQNext = pThis;
+		asyncWriters.pQTail = pThis;
+		pthread_cond_signal(&asyncWriters.workAvail);
+	}
+	d_pthread_mutex_unlock(&asyncWriters.mut);
+}
 
-		--pThis->iCnt;
-		if(pThis->iCnt < STREAM_ASYNC_NUMBUFS) {
-			pthread_cond_signal(&pThis->notFull);
-			if(pThis->iCnt == 0)
-				pthread_cond_broadcast(&pThis->isEmpty);
+
+/* a partial buffer is pending: make sure it is written when the flush
+ * interval expires. Must be called with the stream mutex locked.
+ */
+static void
+asyncWriterArmTimer(strm_t *pThis)
+{
+	if(pThis->iFlushInterval <= 0)
+		return;
+	d_pthread_mutex_lock(&asyncWriters.mut);
+	timeoutComp(&pThis->tAWDeadline, pThis->iFlushInterval * 1000); /* *1000 millisconds */
+	pThis->bAWTimerArmed = 1;
+	pthread_cond_signal(&asyncWriters.workAvail);
+	d_pthread_mutex_unlock(&asyncWriters.mut);
+}
+
+
+/* add a stream to the writer pool, starting the pool if we are the first one */
+static rsRetVal
+asyncWriterRegister(strm_t *pThis)
+{
+	int i;
+	int nThrds;
+	DEFiRet;
+
+	d_pthread_mutex_lock(&asyncWriters.mut);
+	while(asyncWriters.bShutdown) /* a previous pool instance is still terminating */
+		d_pthread_cond_wait(&asyncWriters.stopped, &asyncWriters.mut);
+
+	if(asyncWriters.nThrds == 0) {
+		nThrds = (glblStrmAsyncWriters > 0) ? glblStrmAsyncWriters : 1;
+		CHKmalloc(asyncWriters.thrdIDs = calloc(nThrds, sizeof(pthread_t)));
+		for(i = 0 ; i < nThrds ; ++i) {
+			if(pthread_create(&asyncWriters.thrdIDs[asyncWriters.nThrds],
+#ifdef HAVE_PTHREAD_SETSCHEDPARAM
+					  &default_thread_attr,
+#else
+					  NULL,
+#endif
+					  asyncWriterThread, NULL) == 0) {
+				++asyncWriters.nThrds;
+			} else {
+				DBGPRINTF("ERROR: stream could not create writer thread %d\n", i);
+			}
+		}
+		if(asyncWriters.nThrds == 0) {
+			free(asyncWriters.thrdIDs);
+			asyncWriters.thrdIDs = NULL;
+			ABORT_FINALIZE(RS_RET_ERR);
 		}
+		DBGPRINTF("stream async writer pool started with %d threads\n", asyncWriters.nThrds);
 	}
-	d_pthread_mutex_unlock(&pThis->mut);
+
+	pThis->bAWQueued = pThis->bAWBusy = pThis->bAWPending = 0;
+	pThis->bAWFlushDue = pThis->bAWTimerArmed = 0;
+	pThis->pAWPrev = NULL;
+	pThis->pAWNext = asyncWriters.pRoot;
+	if(asyncWriters.pRoot != NULL)
+		asyncWriters.pRoot->pAWPrev = pThis;
+	asyncWriters.pRoot = pThis;
+	++asyncWriters.nStrms;
 
 finalize_it:
-	ENDfunc
-	return NULL; /* to keep pthreads happy */
+	d_pthread_mutex_unlock(&asyncWriters.mut);
+	RETiRet;
+}
+
+
+/* remove a stream from the writer pool. All data must already have been
+ * written. The pool is stopped if this was the last stream.
+ * Must be called WITHOUT the stream mutex locked.
+ */
+static void
+asyncWriterUnregister(strm_t *pThis)
+{
+	strm_t *pStrm;
+	strm_t *pPrev;
+	int i;
+
+	d_pthread_mutex_lock(&asyncWriters.mut);
+	/* a timer may just have fired, so we may still be queued */
+	if(pThis->bAWQueued) {
+		for(pPrev = NULL, pStrm = asyncWriters.pQHead ; pStrm != pThis ; pStrm = pStrm->pAWQNext)
+			pPrev = pStrm;
+		if(pPrev == NULL)
+			asyncWriters.pQHead = pThis->pAWQNext;
+		else
+			pPrev->pAWQNext = pThis->pAWQNext;
+		if(asyncWriters.pQTail == pThis)
+			asyncWriters.pQTail = pPrev;
+		pThis->bAWQueued = 0;
+	}
+	pThis->bAWTimerArmed = 0;
+	while(pThis->bAWBusy)
+		d_pthread_cond_wait(&asyncWriters.streamIdle, &asyncWriters.mut);
+
+	if(pThis->pAWPrev == NULL)
+		asyncWriters.pRoot = pThis->pAWNext;
+	else
+		pThis->pAWPrev->pAWNext = pThis->pAWNext;
+	if(pThis->pAWNext != NULL)
+		pThis->pAWNext->pAWPrev = pThis->pAWPrev;
+
+	if(--asyncWriters.nStrms == 0) {
+		asyncWriters.bShutdown = 1;
+		pthread_cond_broadcast(&asyncWriters.workAvail);
+		d_pthread_mutex_unlock(&asyncWriters.mut);
+		for(i = 0 ; i < asyncWriters.nThrds ; ++i)
+			pthread_join(asyncWriters.thrdIDs[i], NULL);
+		d_pthread_mutex_lock(&asyncWriters.mut);
+		free(asyncWriters.thrdIDs);
+		asyncWriters.thrdIDs = NULL;
+		asyncWriters.nThrds = 0;
+		asyncWriters.bShutdown = 0;
+		pthread_cond_broadcast(&asyncWriters.stopped);
+		DBGPRINTF("stream async writer pool stopped\n");
+	}
+	d_pthread_mutex_unlock(&asyncWriters.mut);
 }
 
 
@@ -1251,8 +1888,76 @@ syncFile(strm_t *pThis)
 finalize_it:
 	RETiRet;
 }
+
+/* Group commit support. In bDeferSync mode, the caller writes records while
+ * holding its own lock and later syncs all of them with a single call. To
+ * permit other writers to proceed during the (slow) sync, the sync is done
+ * on a duplicate of the file descriptor: strmGroupSyncBegin() must be called
+ * with the caller's lock held and returns the duplicate (or -1 if there is
+ * no file open), strmGroupSyncEnd() syncs and closes it and must be called
+ * without the lock. If the stream switches files in between, the old file
+ * was synced on close and the duplicate still refers to it, so nothing can
+ * be missed.
+ */
+int
+strmGroupSyncBegin(strm_t *pThis)
+{
+	if(pThis->fd == -1 || pThis->bIsTTY)
+		return -1;
+	return dup(pThis->fd);
+}
+
+void
+strmGroupSyncEnd(int fd)
+{
+	int ret;
+
+	if(fd == -1)
+		return;
+	ret = SYNCCALL(fd);
+	if(ret != 0) {
+		char errStr[1024];
+		int err = errno;
+		rs_strerror_r(err, errStr, sizeof(errStr));
+		DBGPRINTF("group sync failed for file %d with error (%d): %s - ignoring\n",
+			   fd, err, errStr);
+	}
+	close(fd);
+}
 #undef SYNCCALL
 
+
+/* make sure disk space is reserved for the next lenBuf octets. Space is
+ * allocated in extents of iPreallocExtent, so that the file system needs
+ * to update its metadata only once per extent and can place the file
+ * contiguously. The file size is not changed. If the file system does not
+ * support this, preallocation is turned off for the stream.
+ */
+static void
+strmPreallocExtent(strm_t *pThis, size_t lenBuf)
+{
+#	if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+	int64 iNewEnd;
+
+	if(pThis->iCurrOffs + (int64) lenBuf <= pThis->iPreallocEnd || pThis->bIsTTY)
+		return;
+	iNewEnd = ((pThis->iCurrOffs + lenBuf) / pThis->iPreallocExtent + 1) * pThis->iPreallocExtent;
+	if(pThis->iPreallocEnd < pThis->iCurrOffs)
+		pThis->iPreallocEnd = pThis->iCurrOffs;
+	if(fallocate(pThis->fd, FALLOC_FL_KEEP_SIZE, pThis->iPreallocEnd,
+		     iNewEnd - pThis->iPreallocEnd) != 0) {
+		DBGOPRINT((obj_t*) pThis, "fallocate failed for file %d, errno %d - "
+			  "preallocation disabled\n", pThis->fd, errno);
+		pThis->iPreallocExtent = 0;
+		return;
+	}
+	pThis->iPreallocEnd = iNewEnd;
+#	else
+	pThis->iPreallocExtent = 0;
+	(void) lenBuf;
+#	endif
+}
+
 /* physically write to the output file. the provided data is ready for
  * writing (e.g. zipped if we are requested to do that).
  * Note that if the write() API fails, we do not reset any pointers, but return
@@ -1276,6 +1981,9 @@ strmPhysWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf)
 	}
 	/* end crypto */
 
+	if(pThis->iPreallocExtent > 0)
+		strmPreallocExtent(pThis, lenBuf);
+
 	iWritten = lenBuf;
 	CHKiRet(doWriteCall(pThis, pBuf, &iWritten));
 
@@ -1284,7 +1992,7 @@ strmPhysWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf)
 	if(pThis->pUsrWCntr != NULL)
 		*pThis->pUsrWCntr += iWritten;
 
-	if(pThis->bSync) {
+	if(pThis->bSync && !pThis->bDeferSync) {
 		CHKiRet(syncFile(pThis));
 	}
 
@@ -1299,6 +2007,268 @@ finalize_it:
 }
 
 
+/* Parallel block compression ("pigz mode"). If iZipWorkers is set, each
+ * buffer handed to doZipWrite() is split into up to iZipWorkers+1 blocks.
+ * Every block is deflated independently into a complete gzip member on a
+ * process-wide pool of zip threads (the writing thread compresses blocks
+ * as well). The members are then written in order. A sequence of gzip
+ * members is a valid gzip file, so gunzip, zcat & friends read the result
+ * just fine. As each member is complete, the file is always readable up to
+ * the last written buffer, which means bVeryReliableZip is implied.
+ * Compression ratio is slightly lower than in streaming mode, as every
+ * block starts with an empty dictionary.
+ */
+#define STRM_ZIPBLOCK_MIN (32 * 1024)	/* smaller blocks are not worth the overhead */
+
+static struct {
+	pthread_mutex_t mut;
+	pthread_cond_t workAvail;
+	pthread_cond_t jobDone;
+	pthread_cond_t stopped;		/* pool shutdown complete */
+	strmZipJob_t *pQHead;
+	strmZipJob_t *pQTail;
+	pthread_t *thrdIDs;
+	int nThrds;
+	int nUsers;		/* streams in parallel zip mode */
+	sbool bShutdown;
+} zipWorkers = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER, NULL, NULL, NULL, 0, 0, 0
+};
+
+
+/* compress a single block into a complete gzip member */
+static void
+zipJobRun(strmZipJob_t *pJob)
+{
+	z_stream zstrm;
+	int zRet;
+
+	zstrm.zalloc = Z_NULL;
+	zstrm.zfree = Z_NULL;
+	zstrm.opaque = Z_NULL;
+	zRet = zlibw.DeflateInit2(&zstrm, pJob->iZipLevel, Z_DEFLATED, 31, 9, Z_DEFAULT_STRATEGY);
+	if(zRet != Z_OK) {
+		DBGPRINTF("error %d returned from zlib/deflateInit2()\n", zRet);
+		pJob->iRet = RS_RET_ZLIB_ERR;
+		return;
+	}
+	zstrm.next_in = pJob->pIn;
+	zstrm.avail_in = pJob->lenIn;
+	zstrm.next_out = pJob->pOut;
+	zstrm.avail_out = pJob->lenOutAlloc;
+	/* the output buffer is sized for the worst case, so one call must do */
+	zRet = zlibw.Deflate(&zstrm, Z_FINISH);
+	if(zRet == Z_STREAM_END) {
+		pJob->lenOut = pJob->lenOutAlloc - zstrm.avail_out;
+		pJob->iRet = RS_RET_OK;
+	} else {
+		DBGPRINTF("error %d returned from zlib/deflate() for parallel zip block\n", zRet);
+		pJob->iRet = RS_RET_ZLIB_ERR;
+	}
+	zlibw.DeflateEnd(&zstrm);
+}
+
+
+/* run one queued zip job and report its completion. Pool mutex must be
+ * locked and the queue must not be empty. The mutex is temporarily released.
+ */
+static void
+zipWorkersRunOne(void)
+{
+	strmZipJob_t *pJob;
+
+	pJob = zipWorkers.pQHead;
+	zipWorkers.pQHead = pJob->pNext;
+	if(zipWorkers.pQHead == NULL)
+		zipWorkers.pQTail = NULL;
+	d_pthread_mutex_unlock(&zipWorkers.mut);
+	zipJobRun(pJob);
+	d_pthread_mutex_lock(&zipWorkers.mut);
+	if(--(*pJob->pnPending) == 0)
+		pthread_cond_broadcast(&zipWorkers.jobDone);
+}
+
+
+static void*
+zipWorkerThread(void __attribute__((unused)) *pPtr)
+{
+	BEGINfunc
+	dbgOutputTID((char*)"rs:strm-zip");
+#	if HAVE_PRCTL && defined PR_SET_NAME
+	if(prctl(PR_SET_NAME, (char*)"rs:strm-zip", 0, 0, 0) != 0) {
+		DBGPRINTF("prctl failed, not setting thread name for '%s'\n", "stream zip");
+	}
+#	endif
+
+	d_pthread_mutex_lock(&zipWorkers.mut);
+	while(!zipWorkers.bShutdown) {
+		if(zipWorkers.pQHead == NULL)
+			d_pthread_cond_wait(&zipWorkers.workAvail, &zipWorkers.mut);
+		else
+			zipWorkersRunOne();
+	}
+	d_pthread_mutex_unlock(&zipWorkers.mut);
+
+	ENDfunc
+	return NULL; /* to keep pthreads happy */
+}
+
+
+/* register a stream in parallel zip mode. Makes sure the pool has at least
+ * the number of threads the stream asks for.
+ */
+static rsRetVal
+zipWorkersRegister(strm_t *pThis)
+{
+	pthread_t *thrdIDs;
+	DEFiRet;
+
+	d_pthread_mutex_lock(&zipWorkers.mut);
+	while(zipWorkers.bShutdown) /* a previous pool instance is still terminating */
+		d_pthread_cond_wait(&zipWorkers.stopped, &zipWorkers.mut);
+	if(zipWorkers.nThrds < pThis->iZipWorkers) {
+		CHKmalloc(thrdIDs = realloc(zipWorkers.thrdIDs, sizeof(pthread_t) * pThis->iZipWorkers));
+		zipWorkers.thrdIDs = thrdIDs;
+		while(zipWorkers.nThrds < pThis->iZipWorkers) {
+			if(pthread_create(&zipWorkers.thrdIDs[zipWorkers.nThrds],
+#ifdef HAVE_PTHREAD_SETSCHEDPARAM
+					  &default_thread_attr,
+#else
+					  NULL,
+#endif
+					  zipWorkerThread, NULL) != 0) {
+				DBGPRINTF("ERROR: stream could not create zip thread %d\n", zipWorkers.nThrds);
+				break; /* the writing thread compresses itself, so we can live with fewer */
+			}
+			++zipWorkers.nThrds;
+		}
+		DBGPRINTF("stream zip pool now has %d threads\n", zipWorkers.nThrds);
+	}
+	++zipWorkers.nUsers;
+
+finalize_it:
+	d_pthread_mutex_unlock(&zipWorkers.mut);
+	RETiRet;
+}
+
+
+/* unregister a stream from parallel zip mode. Stops the pool when the
+ * last user is gone.
+ */
+static void
+zipWorkersUnregister(void)
+{
+	int i;
+
+	d_pthread_mutex_lock(&zipWorkers.mut);
+	if(--zipWorkers.nUsers == 0 && zipWorkers.nThrds > 0) {
+		zipWorkers.bShutdown = 1;
+		pthread_cond_broadcast(&zipWorkers.workAvail);
+		d_pthread_mutex_unlock(&zipWorkers.mut);
+		for(i = 0 ; i < zipWorkers.nThrds ; ++i)
+			pthread_join(zipWorkers.thrdIDs[i], NULL);
+		d_pthread_mutex_lock(&zipWorkers.mut);
+		free(zipWorkers.thrdIDs);
+		zipWorkers.thrdIDs = NULL;
+		zipWorkers.nThrds = 0;
+		zipWorkers.bShutdown = 0;
+		pthread_cond_broadcast(&zipWorkers.stopped);
+		DBGPRINTF("stream zip pool stopped\n");
+	}
+	d_pthread_mutex_unlock(&zipWorkers.mut);
+}
+
+
+/* write a buffer as a sequence of independently compressed gzip members. */
+static rsRetVal
+doZipWriteParallel(strm_t *pThis, uchar *pBuf, size_t lenBuf)
+{
+	strmZipJob_t *pJobs;
+	size_t lenBlk;
+	uLong lenOutNeeded;
+	int nBlks;
+	int nPending;
+	int i;
+	DEFiRet;
+
+	if(lenBuf == 0)
+		FINALIZE;
+
+	nBlks = (lenBuf + STRM_ZIPBLOCK_MIN - 1) / STRM_ZIPBLOCK_MIN;
+	if(nBlks > pThis->iZipWorkers + 1)
+		nBlks = pThis->iZipWorkers + 1;
+	if(nBlks < 1)
+		nBlks = 1;
+	lenBlk = (lenBuf + nBlks - 1) / nBlks;
+
+	if(pThis->nZipJobsAlloc < nBlks) {
+		CHKmalloc(pJobs = realloc(pThis->pZipJobs, sizeof(strmZipJob_t) * nBlks));
+		memset(pJobs + pThis->nZipJobsAlloc, 0, sizeof(strmZipJob_t) * (nBlks - pThis->nZipJobsAlloc));
+		pThis->pZipJobs = pJobs;
+		pThis->nZipJobsAlloc = nBlks;
+	}
+	pJobs = pThis->pZipJobs;
+
+	for(i = 0 ; i < nBlks ; ++i) {
+		pJobs[i].pIn = (Bytef*) pBuf + i * lenBlk;
+		pJobs[i].lenIn = (i == nBlks - 1) ? lenBuf - i * lenBlk : lenBlk;
+		/* deflateBound() worst case plus gzip header and trailer */
+		lenOutNeeded = pJobs[i].lenIn + (pJobs[i].lenIn >> 12) + (pJobs[i].lenIn >> 14)
+			       + (pJobs[i].lenIn >> 25) + 64;
+		if(pJobs[i].lenOutAlloc < lenOutNeeded) {
+			free(pJobs[i].pOut);
+			pJobs[i].lenOutAlloc = 0;
+			CHKmalloc(pJobs[i].pOut = MALLOC(lenOutNeeded));
+			pJobs[i].lenOutAlloc = lenOutNeeded;
+		}
+		pJobs[i].iZipLevel = pThis->iZipLevel;
+		pJobs[i].pnPending = &nPending;
+		pJobs[i].iRet = RS_RET_OK;
+	}
+
+	/* hand all but the first block to the pool, we do the first one ourselves */
+	nPending = nBlks - 1;
+	if(nPending > 0) {
+		d_pthread_mutex_lock(&zipWorkers.mut);
+		for(i = 1 ; i < nBlks ; ++i) {
+			pJobs[i].pNext = NULL;
+			if(zipWorkers.pQTail == NULL)
+				zipWorkers.pQHead = &pJobs[i];
+			else
+				zipWorkers.pQTail->pNext = &pJobs[i];
+			zipWorkers.pQTail = &pJobs[i];
+		}
+		pthread_cond_broadcast(&zipWorkers.workAvail);
+		d_pthread_mutex_unlock(&zipWorkers.mut);
+	}
+
+	zipJobRun(&pJobs[0]);
+
+	if(nPending > 0) {
+		/* help out while our blocks are not yet done */
+		d_pthread_mutex_lock(&zipWorkers.mut);
+		while(nPending > 0) {
+			if(zipWorkers.pQHead != NULL)
+				zipWorkersRunOne();
+			else
+				d_pthread_cond_wait(&zipWorkers.jobDone, &zipWorkers.mut);
+		}
+		d_pthread_mutex_unlock(&zipWorkers.mut);
+	}
+
+	/* emit members in order */
+	for(i = 0 ; i < nBlks ; ++i) {
+		CHKiRet(pJobs[i].iRet);
+		if(pJobs[i].lenOut > 0)
+			CHKiRet(strmPhysWrite(pThis, (uchar*)pJobs[i].pOut, pJobs[i].lenOut));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* write the output buffer in zip mode
  * This means we compress it first and then do a physical write.
  * Note that we always do a full deflateInit ... deflate ... deflateEnd
@@ -1396,6 +2366,71 @@ finalize_it:
 done:	RETiRet;
 }
 
+
+/* compress a buffer via the generic compression layer and write the result.
+ * In "very reliable" mode, the frame is finished after each write, so that
+ * the file is always fully decodable. Otherwise, a flush makes sure all data
+ * written so far can be decompressed.
+ */
+static rsRetVal
+doCmprWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf, int bFlush)
+{
+	const uchar *pIn;
+	size_t lenIn;
+	uchar *pOut;
+	size_t lenOut;
+	int op;
+	DEFiRet;
+
+	CHKiRet(strmCmprInit(pThis));
+	if(pThis->bVeryReliableZip)
+		op = CMPR_OP_FINISH;
+	else
+		op = bFlush ? CMPR_OP_FLUSH : CMPR_OP_RUN;
+
+	pIn = pBuf;
+	lenIn = lenBuf;
+	do {
+		pOut = pThis->pZipBuf;
+		lenOut = pThis->sIOBufSize;
+		CHKiRet(cmpr.Process(pThis->pCmprCtx, &pIn, &lenIn, &pOut, &lenOut, op));
+		if(lenOut != pThis->sIOBufSize) {
+			CHKiRet(strmPhysWrite(pThis, pThis->pZipBuf, pThis->sIOBufSize - lenOut));
+		}
+	} while(lenOut == 0);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* end the current compressed frame and discard the compression context,
+ * to be called before closing the file. Each file thus becomes a self-contained
+ * compressed stream.
+ */
+static rsRetVal
+doCmprFinish(strm_t *pThis)
+{
+	const uchar *pIn = NULL;
+	size_t lenIn = 0;
+	uchar *pOut;
+	size_t lenOut;
+	DEFiRet;
+
+	do {
+		pOut = pThis->pZipBuf;
+		lenOut = pThis->sIOBufSize;
+		CHKiRet(cmpr.Process(pThis->pCmprCtx, &pIn, &lenIn, &pOut, &lenOut, CMPR_OP_FINISH));
+		if(lenOut != pThis->sIOBufSize) {
+			CHKiRet(strmPhysWrite(pThis, pThis->pZipBuf, pThis->sIOBufSize - lenOut));
+		}
+	} while(lenOut == 0);
+
+finalize_it:
+	cmpr.Destruct(&pThis->pCmprCtx);
+	RETiRet;
+}
+
 /* flush stream output buffer to persistent storage. This can be called at any time
  * and is automatically called when the output buffer is full.
  * rgerhards, 2008-01-10
@@ -1535,12 +2570,14 @@ static rsRetVal strmSeekCurrOffs(strm_t *pThis)
 
 	ISOBJ_TYPE_assert(pThis, strm);
 
-	if(pThis->cryprov == NULL || pThis->tOperationsMode != STREAMMODE_READ) {
+	if((pThis->cryprov == NULL && pThis->iCmprAlgo == CMPR_ALGO_NONE)
+	   || pThis->tOperationsMode != STREAMMODE_READ) {
 		iRet = strmSeek(pThis, pThis->iCurrOffs);
 		FINALIZE;
 	}
 
-	/* As the cryprov may use CBC or similiar things, we need to read skip data */
+	/* As the cryprov may use CBC or similiar things and offsets of compressed
+	 * streams refer to the decompressed data, we need to read skip data */
 	targetOffs = pThis->iCurrOffs;
 	pThis->iCurrOffs = 0;
 	DBGOPRINT((obj_t*) pThis, "encrypted, doing skip read of %lld bytes\n",
@@ -1660,11 +2697,11 @@ strmWrite(strm_t *__restrict__ const pThis, const uchar *__restrict__ const pBuf
 finalize_it:
 	if(pThis->bAsyncWrite) {
 		if(pThis->bDoTimedWait == 0) {
-			/* we potentially have a partial buffer, so re-activate the
-			 * writer thread that it can set and pick up timeouts.
+			/* we potentially have a partial buffer, so arm the flush
+			 * timer of the writer pool.
 			 */
 			pThis->bDoTimedWait = 1;
-			pthread_cond_signal(&pThis->notEmpty);
+			asyncWriterArmTimer(pThis);
 		}
 		d_pthread_mutex_unlock(&pThis->mut);
 	}
@@ -1673,6 +2710,74 @@ finalize_it:
 }
 
 
+/* write multiple records at once. If they fit into the stream buffer, they are
+ * simply copied to it. If not, the current buffer content and the records are
+ * written with a single writev() call, so that no intermediate buffer flushes
+ * and copies are needed. Zipped, encrypted and async-written streams need
+ * the data inside the stream buffer, so for them we use the regular write path.
+ */
+static rsRetVal
+strmWriteV(strm_t *pThis, struct iovec *iov, int iovcnt)
+{
+	struct iovec *iovAll = NULL;
+	size_t lenTotal;
+	size_t iWritten;
+	int i;
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+	if(pThis->bDisabled)
+		ABORT_FINALIZE(RS_RET_STREAM_DISABLED);
+
+	lenTotal = 0;
+	for(i = 0 ; i < iovcnt ; ++i)
+		lenTotal += iov[i].iov_len;
+
+	if(   pThis->iBufPtr + lenTotal <= pThis->sIOBufSize
+	   || pThis->bAsyncWrite || pThis->iZipLevel || pThis->iCmprAlgo != CMPR_ALGO_NONE
+	   || pThis->cryprov != NULL
+	   || pThis->sType == STREAMTYPE_FILE_CIRCULAR) {
+		for(i = 0 ; i < iovcnt ; ++i)
+			CHKiRet(strmWrite(pThis, iov[i].iov_base, iov[i].iov_len));
+		FINALIZE;
+	}
+
+	if(pThis->fd == -1)
+		CHKiRet(strmOpenFile(pThis));
+	if(pThis->bIsTTY) {
+		/* ttys need the recovery logic of the regular write path */
+		for(i = 0 ; i < iovcnt ; ++i)
+			CHKiRet(strmWrite(pThis, iov[i].iov_base, iov[i].iov_len));
+		FINALIZE;
+	}
+
+	CHKmalloc(iovAll = malloc((iovcnt + 1) * sizeof(struct iovec)));
+	iovAll[0].iov_base = pThis->pIOBuf;
+	iovAll[0].iov_len = pThis->iBufPtr;
+	memcpy(iovAll + 1, iov, iovcnt * sizeof(struct iovec));
+
+	if(pThis->iPreallocExtent > 0)
+		strmPreallocExtent(pThis, pThis->iBufPtr + lenTotal);
+	iRet = doWritevCall(pThis, iovAll, iovcnt + 1, &iWritten);
+	pThis->iCurrOffs += iWritten;
+	if(pThis->pUsrWCntr != NULL)
+		*pThis->pUsrWCntr += iWritten;
+	CHKiRet(iRet);
+	pThis->iBufPtr = 0;
+
+	if(pThis->bSync && !pThis->bDeferSync) {
+		CHKiRet(syncFile(pThis));
+	}
+	if(pThis->iSizeLimit != 0) {
+		CHKiRet(doSizeLimitProcessing(pThis));
+	}
+
+finalize_it:
+	free(iovAll);
+	RETiRet;
+}
+
+
 /* property set methods */
 /* simple ones first */
 DEFpropSetMeth(strm, iMaxFileSize, int64)
@@ -1683,6 +2788,13 @@ DEFpropSetMeth(strm, sType, strmType_t)
 DEFpropSetMeth(strm, iZipLevel, int)
 DEFpropSetMeth(strm, bVeryReliableZip, int)
 DEFpropSetMeth(strm, bSync, int)
+DEFpropSetMeth(strm, bDeferSync, int)
+DEFpropSetMeth(strm, bMmap, int)
+DEFpropSetMeth(strm, bPreallocate, int)
+DEFpropSetMeth(strm, iZipWorkers, int)
+DEFpropSetMeth(strm, iCmprAlgo, int)
+DEFpropSetMeth(strm, pszCmprDict, uchar*)
+DEFpropSetMeth(strm, iPreallocExtent, int64)
 DEFpropSetMeth(strm, sIOBufSize, size_t)
 DEFpropSetMeth(strm, iSizeLimit, off_t)
 DEFpropSetMeth(strm, iFlushInterval, int)
@@ -1886,6 +2998,9 @@ strmDup(strm_t *pThis, strm_t **ppNew)
 	pNew->iFileNumDigits = pThis->iFileNumDigits;
 	pNew->bDeleteOnClose = pThis->bDeleteOnClose;
 	pNew->iCurrOffs = pThis->iCurrOffs;
+	pNew->iCmprAlgo = pThis->iCmprAlgo;
+	if(pThis->pszCmprDict != NULL)
+		CHKmalloc(pNew->pszCmprDict = ustrdup(pThis->pszCmprDict));
 	
 	*ppNew = pNew;
 	pNew = NULL;
@@ -2018,6 +3133,8 @@ CODESTARTobjQueryInterface(strm)
 	pIf->Dup = strmDup;
 	pIf->SetWCntr = strmSetWCntr;
 	pIf->CheckFileChange = CheckFileChange;
+	pIf->Read = strmRead;
+	pIf->WriteV = strmWriteV;
 	/* set methods */
 	pIf->SetbDeleteOnClose = strmSetbDeleteOnClose;
 	pIf->SetiMaxFileSize = strmSetiMaxFileSize;
@@ -2029,6 +3146,13 @@ CODESTARTobjQueryInterface(strm)
 	pIf->SetiZipLevel = strmSetiZipLevel;
 	pIf->SetbVeryReliableZip = strmSetbVeryReliableZip;
 	pIf->SetbSync = strmSetbSync;
+	pIf->SetbDeferSync = strmSetbDeferSync;
+	pIf->SetbMmap = strmSetbMmap;
+	pIf->SetbPreallocate = strmSetbPreallocate;
+	pIf->SetiZipWorkers = strmSetiZipWorkers;
+	pIf->SetiCmprAlgo = strmSetiCmprAlgo;
+	pIf->SetpszCmprDict = strmSetpszCmprDict;
+	pIf->SetiPreallocExtent = strmSetiPreallocExtent;
 	pIf->SetsIOBufSize = strmSetsIOBufSize;
 	pIf->SetiSizeLimit = strmSetiSizeLimit;
 	pIf->SetiFlushInterval = strmSetiFlushInterval;
@@ -67,11 +67,13 @@
 
 #include <pthread.h>
 #include <stdint.h>
+#include <sys/uio.h>
 #include "obj-types.h"
 #include "glbl.h"
 #include "stream.h"
 #include "zlibw.h"
 #include "cryprov.h"
+#include "stringbuf.h"
 
 /* stream types */
 typedef enum {
@@ -109,7 +111,16 @@ typedef struct strm_s {
 	/* dynamic properties, valid only during file open, not to be persistet */
 	sbool bDisabled; /* should file no longer be written to? (currently set only if omfile file size limit fails) */
 	sbool bSync;	/* sync this file after every write? */
+	sbool bDeferSync; /* if bSync is set, leave syncing writes to the caller (group commit), sync only on close */
+	sbool bMmap;	/* read via memory mapping instead of read() calls (read mode only) */
+	sbool bPreallocate; /* preallocate disk space for iMaxFileSize when creating a file (write mode only) */
+	int64 iPreallocExtent; /* if > 0, preallocate disk space in extents of this size while writing */
+	int64 iPreallocEnd; /* offset up to which space has been preallocated for the current file */
+	uchar *pMmap;	/* current mapping in mmap mode, NULL if none */
+	size_t lenMmap;	/* size of current mapping */
+	uchar *pIOBufAlloc; /* our own IO buffer, pIOBuf points into the mapping in mmap mode */
 	size_t sIOBufSize;/* size of IO buffer */
+	size_t memSize;	/* buffer memory reported to memacct */
 	uchar *pszDir; /* Directory */
 	int lenDir;
 	int fd;		/* the file descriptor, -1 if closed */
@@ -123,16 +134,24 @@ typedef struct strm_s {
 	sbool bInRecord;	/* if 1, indicates that we are currently writing a not-yet complete record */
 	int iZipLevel;	/* zip level (0..9). If 0, zip is completely disabled */
 	Bytef *pZipBuf;
+	int iZipWorkers;	/* >0: compress blocks in parallel into independent gzip members */
+	struct strmZipJob_s *pZipJobs;	/* per-block state for parallel zip */
+	int nZipJobsAlloc;
+	int iCmprAlgo;		/* CMPR_ALGO_*: use generic compression layer; NONE: legacy zip via iZipLevel */
+	uchar *pszCmprDict;	/* compression dictionary file (zstd only), NULL if none */
+	struct cmprCtx_s *pCmprCtx;	/* (de)compression context for the current file */
+	uchar *pCmprInBuf;	/* read mode: compressed data read from file */
+	size_t lenCmprIn;	/* read mode: unprocessed octets in pCmprInBuf */
+	size_t iCmprInPtr;	/* read mode: next unprocessed octet in pCmprInBuf */
+	sbool bCmprIfLoaded;	/* did we obtain the cmpr interface? */
 	/* support for async flush procesing */
 	sbool bAsyncWrite;	/* do asynchronous writes (always if a flush interval is given) */
-	sbool bStopWriter;	/* shall writer thread terminate? */
-	sbool bDoTimedWait;	/* instruct writer thread to do a times wait to support flush timeouts */
+	sbool bDoTimedWait;	/* a partial buffer is pending, flush timeout is armed */
 	sbool bzInitDone; /* did we do an init of zstrm already? */
 	sbool bVeryReliableZip; /* shall we write interim headers to create a very reliable ZIP file? */
 	int iFlushInterval; /* flush in which interval - 0, no flushing */
 	pthread_mutex_t mut;/* mutex for flush in async mode */
 	pthread_cond_t notFull;
-	pthread_cond_t notEmpty;
 	pthread_cond_t isEmpty;
 	unsigned short iEnq;	/* this MUST be unsigned as we use module arithmetic (else invalid indexing happens!) */
 	unsigned short iDeq;	/* this MUST be unsigned as we use module arithmetic (else invalid indexing happens!) */
@@ -145,7 +164,16 @@ typedef struct strm_s {
 		uchar *pBuf;
 		size_t lenBuf;
 	} asyncBuf[STREAM_ASYNC_NUMBUFS];
-	pthread_t writerThreadID;
+	/* shared async writer pool bookkeeping -- protected by the pool mutex, NOT by mut */
+	struct strm_s *pAWNext;	/* list of all streams served by the writer pool */
+	struct strm_s *pAWPrev;
+	struct strm_s *pAWQNext;	/* next stream in pool work queue */
+	struct timespec tAWDeadline;	/* when a partial buffer must be written (if timer armed) */
+	sbool bAWQueued;	/* stream is in pool work queue */
+	sbool bAWBusy;		/* a pool thread currently works on this stream */
+	sbool bAWPending;	/* work arrived while a pool thread was busy with us */
+	sbool bAWFlushDue;	/* flush interval expired, partial buffer must be written */
+	sbool bAWTimerArmed;	/* flush timer is active */
 	/* support for omfile size-limiting commands, special counters, NOT persisted! */
 	off_t	iSizeLimit;	/* file size limit, 0 = no limit */
 	uchar	*pszSizeLimitCmd;	/* command to carry out when size limit is reached */
@@ -197,17 +225,71 @@ BEGINinterface(strm) /* name must also be changed in ENDinterface macro! */
 	/* v9 added  2013-04-04 */
 	INTERFACEpropSetMeth(strm, cryprov, cryprov_if_t*);
 	INTERFACEpropSetMeth(strm, cryprovData, void*);
+	/* v11 added */
+	rsRetVal (*Read)(strm_t *pThis, uchar *pBuf, size_t lenBuf);
+	/* v12 added */
+	INTERFACEpropSetMeth(strm, bDeferSync, int);
+	/* v13 added */
+	INTERFACEpropSetMeth(strm, bMmap, int);
+	INTERFACEpropSetMeth(strm, bPreallocate, int);
+	/* v14 added */
+	rsRetVal (*WriteV)(strm_t *pThis, struct iovec *iov, int iovcnt);
+	/* v15 added */
+	INTERFACEpropSetMeth(strm, iZipWorkers, int);
+	/* v16 added */
+	INTERFACEpropSetMeth(strm, iCmprAlgo, int);
+	INTERFACEpropSetMeth(strm, pszCmprDict, uchar*);
+	/* v17 added */
+	INTERFACEpropSetMeth(strm, iPreallocExtent, int64);
 ENDinterface(strm)
-#define strmCURR_IF_VERSION 10 /* increment whenever you change the interface structure! */
+#define strmCURR_IF_VERSION 17 /* increment whenever you change the interface structure! */
 /* V10, 2013-09-10: added new parameter bEscapeLF, changed mode to uint8_t (rgerhards) */
+/* V11: added Read() for block reads of binary records */
+/* V12: added bDeferSync property for group commit */
+/* V13: added bMmap and bPreallocate properties */
+/* V14: added WriteV() for gathered writes of multiple records */
+/* V15: added iZipWorkers property for parallel block compression */
+/* V16: added iCmprAlgo and pszCmprDict properties for the generic compression layer */
+/* V17: added iPreallocExtent property */
 
 static inline int
 strmGetCurrFileNum(strm_t *pStrm) {
 	return pStrm->iCurrFNum;
 }
 
+/* set the file number to start with. Must only be called before
+ * the stream has been opened.
+ */
+static inline void
+strmSetCurrFileNum(strm_t *pStrm, int iFNum) {
+	pStrm->iCurrFNum = iFNum;
+}
+
+/* get the position to resume reading a monitored file from. A trailing
+ * partial line that ReadLine() keeps back is not included, so it will be
+ * read again after resuming.
+ */
+static inline int64
+strmGetResumeOffs(strm_t *pStrm, int64 *pInode) {
+	*pInode = (int64) pStrm->inode;
+	return pStrm->iCurrOffs
+		- ((pStrm->prevLineSegment == NULL) ? 0 : cstrLen(pStrm->prevLineSegment));
+}
+
+/* set the position to resume reading from, as obtained by strmGetResumeOffs().
+ * Must only be called before the stream has been opened. CheckFileChange()
+ * and SeekCurrOffs() then work as for a deserialized stream.
+ */
+static inline void
+strmSetResumeOffs(strm_t *pStrm, int64 inode, int64 offs) {
+	pStrm->inode = (ino_t) inode;
+	pStrm->iCurrOffs = offs;
+}
+
 /* prototypes */
 PROTOTYPEObjClassInit(strm);
 rsRetVal strmMultiFileSeek(strm_t *pThis, int fileNum, off64_t offs, off64_t *bytesDel);
+int strmGroupSyncBegin(strm_t *pThis);
+void strmGroupSyncEnd(int fd);
 
 #endif /* #ifndef STREAM_H_INCLUDED */
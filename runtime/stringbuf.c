@@ -40,6 +40,7 @@
 #include "srUtils.h"
 #include "regexp.h"
 #include "obj.h"
+#include "glbl.h"
 
 uchar*  rsCStrGetSzStr(cstr_t *pThis);
 
@@ -51,6 +52,40 @@ uchar*  rsCStrGetSzStr(cstr_t *pThis);
 DEFobjCurrIf(obj)
 DEFobjCurrIf(regexp)
 
+/* ################################################################# *
+ * private members                                                   *
+ * ################################################################# */
+
+/* set up an (empty) buffer with room for iLen characters plus the
+ * terminating \0. Short strings use the inline buffer. Any previous
+ * buffer must already have been freed.
+ */
+static inline rsRetVal
+cstrAllocBuf(cstr_t *pThis, size_t iLen)
+{
+	DEFiRet;
+
+	if(iLen < sizeof(pThis->sbuf)) {
+		pThis->pBuf = pThis->sbuf;
+		pThis->iBufSize = sizeof(pThis->sbuf);
+	} else {
+		CHKmalloc(pThis->pBuf = (uchar*) MALLOC(sizeof(uchar) * (iLen + 1)));
+		pThis->iBufSize = iLen + 1;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+static inline void
+cstrFreeBuf(cstr_t *pThis)
+{
+	if(pThis->pBuf != pThis->sbuf)
+		free(pThis->pBuf);
+}
+
+
 /* ################################################################# *
  * public members                                                    *
  * ################################################################# */
@@ -89,14 +124,14 @@ rsRetVal rsCStrConstructFromszStr(cstr_t **ppThis, uchar *sz)
 
 	CHKiRet(rsCStrConstruct(&pThis));
 
-	pThis->iBufSize = pThis->iStrLen = strlen((char *) sz);
-	if((pThis->pBuf = (uchar*) MALLOC(sizeof(uchar) * pThis->iStrLen)) == NULL) {
+	pThis->iStrLen = strlen((char *) sz);
+	if(cstrAllocBuf(pThis, pThis->iStrLen) != RS_RET_OK) {
 		RSFREEOBJ(pThis);
 		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
 
-	/* we do NOT need to copy the \0! */
-	memcpy(pThis->pBuf, sz, pThis->iStrLen);
+	/* we copy the \0, so the string is already finalized */
+	memcpy(pThis->pBuf, sz, pThis->iStrLen + 1);
 
 	*ppThis = pThis;
 
@@ -126,12 +161,12 @@ static rsRetVal rsCStrConstructFromszStrv(cstr_t **ppThis, char *fmt, va_list ap
 
 	CHKiRet(rsCStrConstruct(&pThis));
 
-	pThis->iBufSize = pThis->iStrLen = len;
-	len++; /* account for the \0 written by vsnprintf */
-	if((pThis->pBuf = (uchar*) MALLOC(sizeof(uchar) * len)) == NULL) {
+	pThis->iStrLen = len;
+	if(cstrAllocBuf(pThis, pThis->iStrLen) != RS_RET_OK) {
 		RSFREEOBJ(pThis);
 		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
+	len++; /* account for the \0 written by vsnprintf */
 
 	vsnprintf((char*)pThis->pBuf, len, (char*)fmt, ap);
 	*ppThis = pThis;
@@ -167,14 +202,14 @@ rsRetVal cstrConstructFromESStr(cstr_t **ppThis, es_str_t *str)
 
 	CHKiRet(rsCStrConstruct(&pThis));
 
-	pThis->iBufSize = pThis->iStrLen = es_strlen(str);
-	if((pThis->pBuf = (uchar*) MALLOC(sizeof(uchar) * pThis->iStrLen)) == NULL) {
+	pThis->iStrLen = es_strlen(str);
+	if(cstrAllocBuf(pThis, pThis->iStrLen) != RS_RET_OK) {
 		RSFREEOBJ(pThis);
 		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
 
-	/* we do NOT need to copy the \0! */
 	memcpy(pThis->pBuf, es_getBufAddr(str), pThis->iStrLen);
+	pThis->pBuf[pThis->iStrLen] = '\0';
 
 	*ppThis = pThis;
 
@@ -196,14 +231,16 @@ rsRetVal rsCStrConstructFromCStr(cstr_t **ppThis, cstr_t *pFrom)
 
 	CHKiRet(rsCStrConstruct(&pThis));
 
-	pThis->iBufSize = pThis->iStrLen = pFrom->iStrLen;
-	if((pThis->pBuf = (uchar*) MALLOC(sizeof(uchar) * pThis->iStrLen)) == NULL) {
+	pThis->iStrLen = pFrom->iStrLen;
+	if(cstrAllocBuf(pThis, pThis->iStrLen) != RS_RET_OK) {
 		RSFREEOBJ(pThis);
 		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
 
 	/* copy properties */
-	memcpy(pThis->pBuf, pFrom->pBuf, pThis->iStrLen);
+	if(pThis->iStrLen > 0)
+		memcpy(pThis->pBuf, pFrom->pBuf, pThis->iStrLen);
+	pThis->pBuf[pThis->iStrLen] = '\0';
 
 	*ppThis = pThis;
 finalize_it:
@@ -215,7 +252,7 @@ void rsCStrDestruct(cstr_t **ppThis)
 {
 	cstr_t *pThis = *ppThis;
 
-	free(pThis->pBuf);
+	cstrFreeBuf(pThis);
 	free(pThis->pszBuf);
 	RSFREEOBJ(pThis);
 	*ppThis = NULL;
@@ -223,10 +260,11 @@ void rsCStrDestruct(cstr_t **ppThis)
 
 
 /* extend the string buffer if its size is insufficient.
- * Param iMinNeeded is the minumum free space needed. If it is larger
- * than the default alloc increment, space for at least this amount is
- * allocated. In practice, a bit more is allocated because we envision that
- * some more characters may be added after these.
+ * Param iMinNeeded is the minumum free space needed. Room for the
+ * terminating \0 is always added. Short strings live in the inline
+ * buffer; once they outgrow it, the buffer is doubled on each extension
+ * (but at least RS_STRINGBUF_ALLOC_INCREMENT is allocated), so that
+ * building a long string char by char does not realloc() all the time.
  * rgerhards, 2008-01-07
  * changed to utilized realloc() -- rgerhards, 2009-06-16
  */
@@ -238,21 +276,25 @@ rsCStrExtendBuf(cstr_t *pThis, size_t iMinNeeded)
 	DEFiRet;
 
 	/* first compute the new size needed */
-	if(iMinNeeded > RS_STRINGBUF_ALLOC_INCREMENT) {
-		/* we allocate "n" ALLOC_INCREMENTs. Usually, that should
-		 * leave some room after the absolutely needed one. It also
-		 * reduces memory fragmentation. Note that all of this are
-		 * integer operations (very important to understand what is
-		 * going on)! Parenthesis are for better readibility.
-		 */
-		iNewSize = (iMinNeeded / RS_STRINGBUF_ALLOC_INCREMENT + 1) * RS_STRINGBUF_ALLOC_INCREMENT;
-	} else {
-		iNewSize = pThis->iBufSize + RS_STRINGBUF_ALLOC_INCREMENT;
+	iNewSize = pThis->iStrLen + iMinNeeded + 1;
+	if(pThis->pBuf == NULL && iNewSize <= sizeof(pThis->sbuf)) {
+		pThis->pBuf = pThis->sbuf;
+		pThis->iBufSize = sizeof(pThis->sbuf);
+		FINALIZE;
 	}
-	iNewSize += pThis->iBufSize; /* add current size */
+	if(iNewSize < 2 * pThis->iBufSize)
+		iNewSize = 2 * pThis->iBufSize;
+	if(iNewSize < RS_STRINGBUF_ALLOC_INCREMENT)
+		iNewSize = RS_STRINGBUF_ALLOC_INCREMENT;
 
 	/* DEV debugging only: dbgprintf("extending string buffer, old %d, new %d\n", pThis->iBufSize, iNewSize); */
-	CHKmalloc(pNewBuf = (uchar*) realloc(pThis->pBuf, iNewSize * sizeof(uchar)));
+	if(pThis->pBuf == NULL || pThis->pBuf == pThis->sbuf) {
+		CHKmalloc(pNewBuf = (uchar*) MALLOC(iNewSize * sizeof(uchar)));
+		if(pThis->iStrLen > 0)
+			memcpy(pNewBuf, pThis->pBuf, pThis->iStrLen);
+	} else {
+		CHKmalloc(pNewBuf = (uchar*) realloc(pThis->pBuf, iNewSize * sizeof(uchar)));
+	}
 	pThis->iBufSize = iNewSize;
 	pThis->pBuf = pNewBuf;
 
@@ -273,8 +315,8 @@ rsRetVal rsCStrAppendStrWithLen(cstr_t *pThis, uchar* psz, size_t iStrLen)
 	rsCHECKVALIDOBJECT(pThis, OIDrsCStr);
 	assert(psz != NULL);
 
-	/* does the string fit? */
-	if(pThis->iStrLen + iStrLen > pThis->iBufSize) {  
+	/* does the string fit (including the \0)? */
+	if(pThis->iStrLen + iStrLen >= pThis->iBufSize) {  
 		CHKiRet(rsCStrExtendBuf(pThis, iStrLen)); /* need more memory! */
 	}
 
@@ -351,31 +393,35 @@ finalize_it:
  */
 rsRetVal rsCStrSetSzStr(cstr_t *pThis, uchar *pszNew)
 {
+	size_t len;
+	DEFiRet;
+
 	rsCHECKVALIDOBJECT(pThis, OIDrsCStr);
 
-	free(pThis->pBuf);
 	free(pThis->pszBuf);
+	pThis->pszBuf = NULL;
 	if(pszNew == NULL) {
+		cstrFreeBuf(pThis);
 		pThis->iStrLen = 0;
 		pThis->iBufSize = 0;
 		pThis->pBuf = NULL;
-		pThis->pszBuf = NULL;
 	} else {
-		pThis->iStrLen = strlen((char*)pszNew);
-		pThis->iBufSize = pThis->iStrLen;
-		pThis->pszBuf = NULL;
-
-		/* now save the new value */
-		if((pThis->pBuf = (uchar*) MALLOC(sizeof(uchar) * pThis->iStrLen)) == NULL) {
-			RSFREEOBJ(pThis);
-			return RS_RET_OUT_OF_MEMORY;
+		len = strlen((char*)pszNew);
+		/* keep the current buffer if it is large enough */
+		if(pThis->pBuf == NULL || len >= pThis->iBufSize) {
+			cstrFreeBuf(pThis);
+			pThis->pBuf = NULL;
+			pThis->iStrLen = 0;
+			pThis->iBufSize = 0;
+			CHKiRet(cstrAllocBuf(pThis, len));
 		}
-
-		/* we do NOT need to copy the \0! */
-		memcpy(pThis->pBuf, pszNew, pThis->iStrLen);
+		/* we copy the \0, so the string is already finalized */
+		memcpy(pThis->pBuf, pszNew, len + 1);
+		pThis->iStrLen = len;
 	}
 
-	return RS_RET_OK;
+finalize_it:
+	RETiRet;
 }
 
 /* Converts the CStr object to a classical sz string and returns that.
@@ -411,31 +457,40 @@ uchar*  rsCStrGetSzStr(cstr_t *pThis)
 
 	rsCHECKVALIDOBJECT(pThis, OIDrsCStr);
 
-	if(pThis->pBuf != NULL)
-		if(pThis->pszBuf == NULL) {
-			/* we do not yet have a usable sz version - so create it... */
-			if((pThis->pszBuf = MALLOC((pThis->iStrLen + 1) * sizeof(uchar))) == NULL) {
-				/* TODO: think about what to do - so far, I have no bright
-				 *       idea... rgerhards 2005-09-07
-				 */
-			}
-			else { /* we can create the sz String */
-				/* now copy it while doing a sanity check. The string might contain a
-				 * \0 byte. There is no way how a sz string can handle this. For
-				 * the time being, we simply replace it with space - something that
-				 * could definitely be improved (TODO).
-				 * 2005-09-15 rgerhards
-				 */
-				for(i = 0 ; i < pThis->iStrLen ; ++i) {
-					if(pThis->pBuf[i] == '\0')
-						pThis->pszBuf[i] = ' ';
-					else
-						pThis->pszBuf[i] = pThis->pBuf[i];
-				}
-				/* write terminator... */
-				pThis->pszBuf[i] = '\0';
-			}
+	if(pThis->pBuf == NULL)
+		return NULL;
+
+	/* usually, we can simply terminate the buffer in place (there is
+	 * always room for the \0). Only if the string contains \0 bytes we
+	 * need to create a copy with them replaced.
+	 */
+	if(memchr(pThis->pBuf, '\0', pThis->iStrLen) == NULL) {
+		pThis->pBuf[pThis->iStrLen] = '\0';
+		return pThis->pBuf;
+	}
+
+	free(pThis->pszBuf); /* may be outdated */
+	if((pThis->pszBuf = MALLOC((pThis->iStrLen + 1) * sizeof(uchar))) == NULL) {
+		/* TODO: think about what to do - so far, I have no bright
+		 *       idea... rgerhards 2005-09-07
+		 */
+	}
+	else { /* we can create the sz String */
+		/* now copy it while doing a sanity check. The string might contain a
+		 * \0 byte. There is no way how a sz string can handle this. For
+		 * the time being, we simply replace it with space - something that
+		 * could definitely be improved (TODO).
+		 * 2005-09-15 rgerhards
+		 */
+		for(i = 0 ; i < pThis->iStrLen ; ++i) {
+			if(pThis->pBuf[i] == '\0')
+				pThis->pszBuf[i] = ' ';
+			else
+				pThis->pszBuf[i] = pThis->pBuf[i];
 		}
+		/* write terminator... */
+		pThis->pszBuf[i] = '\0';
+	}
 
 	return(pThis->pszBuf);
 }
@@ -473,16 +528,24 @@ rsRetVal cstrConvSzStrAndDestruct(cstr_t *pThis, uchar **ppSz, int bRetNULL)
 		} else {
 			pRetBuf = NULL;
 		}
-	} else
+	} else if(pThis->pBuf == pThis->sbuf) {
+		/* the inline buffer goes away with the object */
+		CHKmalloc(pRetBuf = MALLOC(sizeof(uchar) * (pThis->iStrLen + 1)));
+		memcpy(pRetBuf, pThis->pBuf, pThis->iStrLen);
+		pRetBuf[pThis->iStrLen] = '\0';
+	} else {
 		pRetBuf = pThis->pBuf;
+		pRetBuf[pThis->iStrLen] = '\0'; /* we always have this space */
+	}
 	
 	*ppSz = pRetBuf;
 
 finalize_it:
 	/* We got it, now free the object ourselfs. Please note
 	 * that we can NOT use the rsCStrDestruct function as it would
-	 * also free the sz String buffer, which we pass on to the user.
+	 * also free the string buffer, which we pass on to the user.
 	 */
+	free(pThis->pszBuf);
 	RSFREEOBJ(pThis);
 	RETiRet;
 }
@@ -513,6 +576,8 @@ rsRetVal rsCStrTruncate(cstr_t *pThis, size_t nTrunc)
 		return RS_TRUNCAT_TOO_LARGE;
 	
 	pThis->iStrLen -= nTrunc;
+	if(pThis->pBuf != NULL)
+		pThis->pBuf[pThis->iStrLen] = '\0';
 
 	if(pThis->pszBuf != NULL) {
 		/* in this case, we adjust the psz representation
@@ -696,10 +761,13 @@ int rsCStrCaseInsensitveStartsWithSzStr(cstr_t *pCS1, uchar *psz, size_t iLenSz)
  * Arnaud Cornet/rgerhards: 2009-04-02: performance improvement by caching compiled regex
  * If a caller does not need the cached version, it must still provide memory for it
  * and must call rsCStrRegexDestruct() afterwards.
+ * EREs use the engine configured via global(regex.engine) (POSIX if it is
+ * not available in this build), BREs always use POSIX regex, as their
+ * syntax differs too much from PCRE.
  */
 rsRetVal rsCStrSzStrMatchRegex(cstr_t *pCS1, uchar *psz, int iType, void *rc)
 {
-	regex_t **cache = (regex_t**) rc;
+	rsregex_t **cache = (rsregex_t**) rc;
 	int ret;
 	DEFiRet;
 
@@ -709,10 +777,15 @@ rsRetVal rsCStrSzStrMatchRegex(cstr_t *pCS1, uchar *psz, int iType, void *rc)
 
 	if(objUse(regexp, LM_REGEXP_FILENAME) == RS_RET_OK) {
 		if (*cache == NULL) {
-			*cache = calloc(sizeof(regex_t), 1);
-			regexp.regcomp(*cache, (char*) rsCStrGetSzStr(pCS1), (iType == 1 ? REG_EXTENDED : 0) | REG_NOSUB);
+			if(regexp.rsregComp(cache, (char*) rsCStrGetSzStr(pCS1),
+				(iType == 1 ? REG_EXTENDED : 0) | REG_NOSUB,
+				(iType == 1) ? glblRegexEngine : RSREGEX_POSIX) == RS_RET_NOT_IMPLEMENTED) {
+				DBGPRINTF("regex engine %d not available, using POSIX\n", glblRegexEngine);
+				regexp.rsregComp(cache, (char*) rsCStrGetSzStr(pCS1),
+					REG_EXTENDED | REG_NOSUB, RSREGEX_POSIX);
+			}
 		}
-		ret = regexp.regexec(*cache, (char*) psz, 0, NULL, 0);
+		ret = regexp.rsregExec(*cache, (char*) psz, 0, NULL);
 		if(ret != 0)
 			ABORT_FINALIZE(RS_RET_NOT_FOUND);
 	} else {
@@ -730,15 +803,12 @@ finalize_it:
  */
 void rsCStrRegexDestruct(void *rc)
 {
-	regex_t **cache = rc;
+	rsregex_t **cache = rc;
 	
 	assert(cache != NULL);
-	assert(*cache != NULL);
 
 	if(objUse(regexp, LM_REGEXP_FILENAME) == RS_RET_OK) {
-		regexp.regfree(*cache);
-		free(*cache);
-		*cache = NULL;
+		regexp.rsregFree(cache);
 	}
 }
 
@@ -35,8 +35,15 @@
 #include <assert.h>
 #include <libestr.h>
 
+/* size of the inline buffer. Most cstr_t objects hold short values like
+ * APPNAME, PROCID or MSGID; these do not need a separate allocation.
+ */
+#define RS_CSTR_SBUF_SIZE 32
+
 /** 
  * The dynamic string buffer object.
+ * Once pBuf is non-NULL, it always has room for the terminating \0
+ * (iStrLen < iBufSize), so finalizing never needs to reallocate.
  */
 typedef struct cstr_s
 {	
@@ -44,9 +51,10 @@ typedef struct cstr_s
 	rsObjID OID;		/**< object ID */
 #endif
 	uchar *pBuf;		/**< pointer to the string buffer, may be NULL if string is empty */
-	uchar *pszBuf;		/**< pointer to the sz version of the string (after it has been created )*/
+	uchar *pszBuf;		/**< copy of the string, only if it contains \0 bytes (see rsCStrGetSzStr) */
 	size_t iBufSize;	/**< current maximum size of the string buffer */
 	size_t iStrLen;		/**< length of the string in characters. */
+	uchar sbuf[RS_CSTR_SBUF_SIZE]; /**< inline buffer, used as pBuf for short strings */
 } cstr_t;
 
 
@@ -76,7 +84,7 @@ static inline rsRetVal cstrAppendChar(cstr_t *pThis, uchar c)
 {
 	rsRetVal iRet = RS_RET_OK;
 
-	if(pThis->iStrLen >= pThis->iBufSize) {  
+	if(pThis->iStrLen + 1 >= pThis->iBufSize) {  
 		CHKiRet(rsCStrExtendBuf(pThis, 1)); /* need more memory! */
 	}
 
@@ -100,9 +108,13 @@ cstrFinalize(cstr_t *pThis)
 	rsRetVal iRet = RS_RET_OK;
 	
 	if(pThis->iStrLen > 0) {
-		/* terminate string only if one exists */
-		CHKiRet(cstrAppendChar(pThis, '\0'));
-		--pThis->iStrLen;	/* do NOT count the \0 byte */
+		/* terminate string only if one exists. There is always room
+		 * for the \0, the check is just for safety.
+		 */
+		if(pThis->iStrLen >= pThis->iBufSize) {
+			CHKiRet(rsCStrExtendBuf(pThis, 1));
+		}
+		pThis->pBuf[pThis->iStrLen] = '\0';
 	}
 
 finalize_it:
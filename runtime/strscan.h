@@ -0,0 +1,137 @@
+/* Fast scanners to find characters that need escaping.
+ *
+ * The escaping code (template escapes, JSON encoding) spends most of its
+ * time skipping over characters that do not need to be escaped. The
+ * scanners below return the length of the leading span that can be copied
+ * verbatim. Where the platform guarantees a vector unit (SSE2 on x86_64,
+ * NEON on ARM) 16 bytes are checked at a time, otherwise we fall back to a
+ * plain byte-by-byte loop.
+ *
+ * Copyright (C) 2014 by Rainer Gerhards and Adiscon GmbH
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_STRSCAN_H
+#define INCLUDED_STRSCAN_H
+
+#include <stddef.h>
+#if defined(__SSE2__)
+#	include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	include <arm_neon.h>
+#	define STRSCAN_NEON 1
+#endif
+
+#ifdef STRSCAN_NEON
+/* check if any lane of a NEON compare result is set */
+static inline int
+strscanNeonAny(const uint8x16_t m)
+{
+	const uint8x8_t r = vorr_u8(vget_low_u8(m), vget_high_u8(m));
+	return vget_lane_u64(vreinterpret_u64_u8(r), 0) != 0;
+}
+#endif
+
+
+/* return the number of leading bytes of p[0..len) that are none of
+ * c1, c2 and c3 (pass the same character multiple times if fewer
+ * are needed).
+ */
+static inline size_t
+strscanNotAnyOf3(const uchar *const p, const size_t len,
+		 const uchar c1, const uchar c2, const uchar c3)
+{
+	size_t i = 0;
+#if defined(__SSE2__)
+	const __m128i v1 = _mm_set1_epi8((char) c1);
+	const __m128i v2 = _mm_set1_epi8((char) c2);
+	const __m128i v3 = _mm_set1_epi8((char) c3);
+	__m128i v;
+	int mask;
+
+	for( ; i + 16 <= len ; i += 16) {
+		v = _mm_loadu_si128((const __m128i*) (p + i));
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, v1),
+			_mm_or_si128(_mm_cmpeq_epi8(v, v2), _mm_cmpeq_epi8(v, v3))));
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#elif defined(STRSCAN_NEON)
+	const uint8x16_t v1 = vdupq_n_u8(c1);
+	const uint8x16_t v2 = vdupq_n_u8(c2);
+	const uint8x16_t v3 = vdupq_n_u8(c3);
+	uint8x16_t v;
+
+	for( ; i + 16 <= len ; i += 16) {
+		v = vld1q_u8(p + i);
+		if(strscanNeonAny(vorrq_u8(vceqq_u8(v, v1),
+			vorrq_u8(vceqq_u8(v, v2), vceqq_u8(v, v3)))))
+			break; /* the scalar loop finds the exact position */
+	}
+#endif
+	for( ; i < len ; ++i) {
+		if(p[i] == c1 || p[i] == c2 || p[i] == c3)
+			break;
+	}
+	return i;
+}
+
+
+/* return the number of leading bytes of p[0..len) that do not need to
+ * be escaped inside a JSON string, that is everything but control
+ * characters, the double quote and the backslash.
+ */
+static inline size_t
+strscanJSONPlain(const uchar *const p, const size_t len)
+{
+	size_t i = 0;
+#if defined(__SSE2__)
+	const __m128i vquot = _mm_set1_epi8('"');
+	const __m128i vbslash = _mm_set1_epi8('\\');
+	const __m128i vctl = _mm_set1_epi8(0x1f);
+	__m128i v;
+	int mask;
+
+	for( ; i + 16 <= len ; i += 16) {
+		v = _mm_loadu_si128((const __m128i*) (p + i));
+		/* unsigned v <= 0x1f is the same as min(v, 0x1f) == v */
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, vctl), v),
+			_mm_or_si128(_mm_cmpeq_epi8(v, vquot), _mm_cmpeq_epi8(v, vbslash))));
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#elif defined(STRSCAN_NEON)
+	const uint8x16_t vquot = vdupq_n_u8('"');
+	const uint8x16_t vbslash = vdupq_n_u8('\\');
+	const uint8x16_t vspace = vdupq_n_u8(0x20);
+	uint8x16_t v;
+
+	for( ; i + 16 <= len ; i += 16) {
+		v = vld1q_u8(p + i);
+		if(strscanNeonAny(vorrq_u8(vcltq_u8(v, vspace),
+			vorrq_u8(vceqq_u8(v, vquot), vceqq_u8(v, vbslash)))))
+			break; /* the scalar loop finds the exact position */
+	}
+#endif
+	for( ; i < len ; ++i) {
+		if(p[i] < 0x20 || p[i] == '"' || p[i] == '\\')
+			break;
+	}
+	return i;
+}
+
+#endif /* #ifndef INCLUDED_STRSCAN_H */
@@ -0,0 +1,516 @@
+/* trace.c
+ * The binary trace ring.
+ *
+ * Each thread that records a trace entry gets its own ring of fixed-size
+ * records, so recording needs no locking at all: we just take a timestamp,
+ * copy the format pointer and the integer arguments and advance the head.
+ * Rings are kept on a global list and are never freed. When a thread
+ * terminates, its ring is flagged unused and handed to the next new thread.
+ * This permits the dump to walk the list without any locks, which is
+ * important as it is called from signal handlers (SIGUSR2 and, most
+ * importantly, the crash handler). For the same reason, the dump does its
+ * own formatting and only uses write() for output.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#if defined(HAVE_SYSCALL) && defined(HAVE_SYS_gettid)
+#	include <sys/syscall.h>
+#endif
+
+#include "rsyslog.h"
+#include "glbl.h"
+#include "atomic.h"
+#include "trace.h"
+
+/* make sure the compiler does not reorder the record stores around the
+ * head update. We do not need a CPU barrier: a dump either runs on the
+ * same thread (signal handler) or after the recording thread crashed.
+ */
+#define TRC_COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+#define TRC_DFLT_RECORDS 1024
+
+typedef struct trcRecord_s {
+	uint64_t ts;		/* CLOCK_MONOTONIC in ns, 0 - record not valid */
+	const char *fmt;
+	int64_t args[TRC_MAXARGS];
+	uint16_t cat;
+	uint16_t nargs;
+	uint32_t tid;		/* kept per record, as rings are reused */
+} trcRecord_t;
+
+typedef struct trcRing_s trcRing_t;
+struct trcRing_s {
+	trcRecord_t *recs;
+	unsigned mask;		/* number of records - 1, always a power of 2 */
+	volatile unsigned head;	/* number of records written so far (wraps) */
+	volatile int bInUse;
+	unsigned tid;
+	unsigned dumpPos;	/* used by trcDump() only */
+	unsigned dumpEnd;	/* used by trcDump() only */
+	trcRing_t *next;
+};
+
+unsigned trcCategories = TRC_ALL;
+static unsigned trcRecords = TRC_DFLT_RECORDS;
+static char *pszTrcFile = NULL;
+static trcRing_t * volatile trcRingRoot = NULL;
+static pthread_mutex_t mutTrcRings = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t keyTrcRing;
+static pthread_once_t onceTrcKey = PTHREAD_ONCE_INIT;
+static int bTrcKeyOK = 0;
+static int bTrcDumping = 0;
+
+
+/* thread termination: hand the ring over to the next new thread. The
+ * records are kept until then, so they are still in a dump.
+ */
+static void
+trcReleaseRing(void *arg)
+{
+	trcRing_t *const ring = (trcRing_t*) arg;
+	ring->bInUse = 0;
+}
+
+static void
+trcInitKey(void)
+{
+	bTrcKeyOK = (pthread_key_create(&keyTrcRing, trcReleaseRing) == 0);
+}
+
+
+static unsigned
+trcGetTid(void)
+{
+#	if defined(HAVE_SYSCALL) && defined(HAVE_SYS_gettid)
+	return (unsigned) syscall(SYS_gettid);
+#	else
+	return (unsigned) getpid();
+#	endif
+}
+
+
+/* obtain a ring for the current thread, either a released one or a new one.
+ * Returns NULL if we are out of memory, in which case the entry is simply
+ * not recorded.
+ */
+static trcRing_t *
+trcClaimRing(void)
+{
+	trcRing_t *ring;
+	unsigned nRecs;
+
+	pthread_mutex_lock(&mutTrcRings);
+	for(ring = trcRingRoot ; ring != NULL ; ring = ring->next) {
+		if(!ring->bInUse)
+			break;
+	}
+	if(ring == NULL) {
+		for(nRecs = 16 ; nRecs < trcRecords ; nRecs <<= 1)
+			/* just compute the next power of 2 */;
+		if((ring = calloc(1, sizeof(trcRing_t))) == NULL)
+			goto done;
+		if((ring->recs = calloc(nRecs, sizeof(trcRecord_t))) == NULL) {
+			free(ring);
+			ring = NULL;
+			goto done;
+		}
+		ring->mask = nRecs - 1;
+		ring->next = trcRingRoot;
+		TRC_COMPILER_BARRIER();
+		trcRingRoot = ring;
+	}
+	ring->tid = trcGetTid();
+	ring->bInUse = 1;
+	pthread_setspecific(keyTrcRing, ring);
+done:
+	pthread_mutex_unlock(&mutTrcRings);
+	return ring;
+}
+
+
+void
+trcAdd(unsigned cat, const char *fmt, const int64_t *args, unsigned nargs)
+{
+	trcRing_t *ring;
+	trcRecord_t *rec;
+	struct timespec ts;
+	unsigned i;
+
+	if(!bTrcKeyOK) {
+		pthread_once(&onceTrcKey, trcInitKey);
+		if(!bTrcKeyOK)
+			return;
+	}
+	if((ring = pthread_getspecific(keyTrcRing)) == NULL) {
+		if((ring = trcClaimRing()) == NULL)
+			return;
+	}
+
+	if(nargs > TRC_MAXARGS)
+		nargs = TRC_MAXARGS;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	rec = &ring->recs[ring->head & ring->mask];
+	rec->ts = 0;
+	TRC_COMPILER_BARRIER();
+	rec->fmt = fmt;
+	rec->cat = (uint16_t) cat;
+	rec->nargs = (uint16_t) nargs;
+	rec->tid = ring->tid;
+	for(i = 0 ; i < nargs ; ++i)
+		rec->args[i] = args[i];
+	TRC_COMPILER_BARRIER();
+	rec->ts = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec + 1;
+	ring->head = ring->head + 1;
+}
+
+
+/* set the enabled categories from a comma-delimited list like
+ * "queue,action". "all" and "none" are also permitted.
+ */
+rsRetVal
+trcSetCategories(const char *list)
+{
+	unsigned cats = 0;
+	const char *p;
+	size_t len;
+	DEFiRet;
+
+	for(p = list ; *p ; p += len) {
+		while(*p == ',' || *p == ' ')
+			++p;
+		for(len = 0 ; p[len] != '\0' && p[len] != ',' && p[len] != ' ' ; ++len)
+			/* just search end of name */;
+		if(len == 0)
+			continue;
+		if(len == 5 && !strncasecmp(p, "queue", len)) {
+			cats |= TRC_QUEUE;
+		} else if(len == 6 && !strncasecmp(p, "action", len)) {
+			cats |= TRC_ACTION;
+		} else if(len == 3 && !strncasecmp(p, "net", len)) {
+			cats |= TRC_NET;
+		} else if(len == 3 && !strncasecmp(p, "all", len)) {
+			cats |= TRC_ALL;
+		} else if(len == 4 && !strncasecmp(p, "none", len)) {
+			/* nothing to add */;
+		} else {
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		}
+	}
+	trcCategories = cats;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* set the dump file name. We take ownership of the string. */
+void
+trcSetFile(char *fn)
+{
+	free(pszTrcFile);
+	pszTrcFile = fn;
+}
+
+
+/* set the number of records per thread. Only affects rings created
+ * after this call.
+ */
+void
+trcSetRecords(unsigned nRecords)
+{
+	trcRecords = (nRecords == 0) ? TRC_DFLT_RECORDS : nRecords;
+}
+
+
+/* dump output handling. Everything below must be async-signal-safe, so
+ * we do not use stdio but a small buffer of our own.
+ */
+typedef struct trcOut_s {
+	int fd;
+	size_t len;
+	char buf[4096];
+} trcOut_t;
+
+static void
+trcFlush(trcOut_t *const out)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while(done < out->len) {
+		n = write(out->fd, out->buf + done, out->len - done);
+		if(n <= 0)
+			break; /* nothing we can do about it */
+		done += n;
+	}
+	out->len = 0;
+}
+
+static void
+trcPutc(trcOut_t *const out, const char c)
+{
+	if(out->len == sizeof(out->buf))
+		trcFlush(out);
+	out->buf[out->len++] = c;
+}
+
+static void
+trcPuts(trcOut_t *const out, const char *s)
+{
+	while(*s)
+		trcPutc(out, *s++);
+}
+
+static void
+trcPutUnsigned(trcOut_t *const out, uint64_t val, const unsigned base, int minDigits)
+{
+	char digits[24];
+	int i = 0;
+
+	do {
+		digits[i++] = "0123456789abcdef"[val % base];
+		val /= base;
+	} while(val != 0);
+	while(i < minDigits)
+		digits[i++] = '0';
+	while(i > 0)
+		trcPutc(out, digits[--i]);
+}
+
+static void
+trcPutSigned(trcOut_t *const out, const int64_t val)
+{
+	if(val < 0) {
+		trcPutc(out, '-');
+		trcPutUnsigned(out, -(uint64_t) val, 10, 1);
+	} else {
+		trcPutUnsigned(out, (uint64_t) val, 10, 1);
+	}
+}
+
+
+/* format a record according to its format string. We support %d, %i,
+ * %u, %x, %p and %c. Flags, width and precision are ignored. Unless a
+ * long length modifier is given, %u and %x are truncated to 32 bits,
+ * just like printf() would do.
+ */
+static void
+trcFormat(trcOut_t *const out, const trcRecord_t *const rec)
+{
+	const char *p;
+	unsigned iArg = 0;
+	int bLong;
+	uint64_t uval;
+
+	for(p = rec->fmt ; *p ; ++p) {
+		if(*p != '%') {
+			if(*p != '\n')
+				trcPutc(out, *p);
+			continue;
+		}
+		if(*++p == '%') {
+			trcPutc(out, '%');
+			continue;
+		}
+		while(*p != '\0' && strchr("-+ #0123456789.*", *p) != NULL)
+			++p;
+		bLong = 0;
+		while(*p != '\0' && strchr("hlLqjzt", *p) != NULL) {
+			if(*p != 'h')
+				bLong = 1;
+			++p;
+		}
+		if(*p == '\0')
+			break;
+		if(iArg >= rec->nargs) {
+			trcPuts(out, "<?>");
+			continue;
+		}
+		uval = (uint64_t) rec->args[iArg];
+		if(!bLong)
+			uval &= 0xffffffff;
+		switch(*p) {
+		case 'd':
+		case 'i':
+			trcPutSigned(out, rec->args[iArg]);
+			break;
+		case 'u':
+			trcPutUnsigned(out, uval, 10, 1);
+			break;
+		case 'x':
+		case 'X':
+			trcPutUnsigned(out, uval, 16, 1);
+			break;
+		case 'p':
+			trcPuts(out, "0x");
+			trcPutUnsigned(out, (uint64_t) rec->args[iArg], 16, 1);
+			break;
+		case 'c':
+			trcPutc(out, (char) rec->args[iArg]);
+			break;
+		default:
+			trcPuts(out, "<?>");
+			break;
+		}
+		++iArg;
+	}
+}
+
+static const char *
+trcCatName(const unsigned cat)
+{
+	switch(cat) {
+	case TRC_QUEUE:
+		return "queue ";
+	case TRC_ACTION:
+		return "action";
+	case TRC_NET:
+		return "net   ";
+	default:
+		return "?     ";
+	}
+}
+
+
+/* dump all rings to fd, merged in time order. Times are printed relative
+ * to the time of the dump. Concurrent dumps are not supported, a dump
+ * requested while another one is running is ignored.
+ */
+void
+trcDump(int fd)
+{
+	trcOut_t out;
+	trcRing_t *ring;
+	trcRing_t *minRing;
+	trcRecord_t *rec;
+	uint64_t now;
+	uint64_t minTs;
+	uint64_t delta;
+	struct timespec ts;
+	unsigned nRecs;
+
+#	ifdef HAVE_ATOMIC_BUILTINS
+	if(!ATOMIC_CAS(&bTrcDumping, 0, 1, NULL))
+		return;
+#	else
+	/* the mutex-based fallback is not async-signal-safe */
+	if(bTrcDumping)
+		return;
+	bTrcDumping = 1;
+#	endif
+	out.fd = fd;
+	out.len = 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec + 1;
+
+	trcPuts(&out, "rsyslogd trace dump, times in seconds relative to dump\n");
+	for(ring = trcRingRoot ; ring != NULL ; ring = ring->next) {
+		nRecs = ring->mask + 1;
+		ring->dumpEnd = ring->head;
+		ring->dumpPos = (ring->dumpEnd > nRecs) ? ring->dumpEnd - nRecs : 0;
+	}
+
+	while(1) {
+		minRing = NULL;
+		minTs = 0;
+		for(ring = trcRingRoot ; ring != NULL ; ring = ring->next) {
+			/* skip invalid records (being written or overwritten) */
+			while(ring->dumpPos != ring->dumpEnd
+			      && ring->recs[ring->dumpPos & ring->mask].ts == 0)
+				++ring->dumpPos;
+			if(ring->dumpPos == ring->dumpEnd)
+				continue;
+			rec = &ring->recs[ring->dumpPos & ring->mask];
+			if(minRing == NULL || rec->ts < minTs) {
+				minRing = ring;
+				minTs = rec->ts;
+			}
+		}
+		if(minRing == NULL)
+			break;
+		rec = &minRing->recs[minRing->dumpPos & minRing->mask];
+		if(rec->ts <= now) {
+			delta = now - rec->ts;
+			trcPutc(&out, '-');
+		} else {
+			delta = rec->ts - now;
+			trcPutc(&out, '+');
+		}
+		trcPutUnsigned(&out, delta / 1000000000, 10, 1);
+		trcPutc(&out, '.');
+		trcPutUnsigned(&out, (delta % 1000000000) / 1000, 10, 6);
+		trcPuts(&out, " T");
+		trcPutUnsigned(&out, rec->tid, 10, 1);
+		trcPutc(&out, ' ');
+		trcPuts(&out, trcCatName(rec->cat));
+		trcPutc(&out, ' ');
+		trcFormat(&out, rec);
+		trcPutc(&out, '\n');
+		++minRing->dumpPos;
+	}
+	trcPuts(&out, "end of trace dump\n");
+	trcFlush(&out);
+	bTrcDumping = 0;
+}
+
+
+/* dump to the configured file, or to <workdir>/rsyslogd.trace if none is
+ * configured. If there is no work directory either, we dump to stderr.
+ */
+void
+trcDumpToFile(void)
+{
+	char path[4096];
+	const char *fn;
+	const char *workDir;
+	size_t len;
+	int fd;
+
+	if(trcRingRoot == NULL)
+		return; /* nothing recorded */
+	if(pszTrcFile != NULL) {
+		fn = pszTrcFile;
+	} else if((workDir = (const char*) glblGetWorkDirRaw()) != NULL
+		  && (len = strlen(workDir)) < sizeof(path) - sizeof("/rsyslogd.trace")) {
+		memcpy(path, workDir, len);
+		memcpy(path + len, "/rsyslogd.trace", sizeof("/rsyslogd.trace"));
+		fn = path;
+	} else {
+		trcDump(STDERR_FILENO);
+		return;
+	}
+
+	fd = open(fn, O_WRONLY|O_CREAT|O_APPEND|O_NOCTTY|O_CLOEXEC, S_IRUSR|S_IWUSR);
+	if(fd == -1) {
+		trcDump(STDERR_FILENO);
+	} else {
+		trcDump(fd);
+		close(fd);
+	}
+}
@@ -0,0 +1,69 @@
+/* trace.h
+ * Definitions for the binary trace ring.
+ *
+ * The trace ring is a low-overhead alternative to DBGPRINTF() for
+ * production use. Each thread records fixed-size binary records into its
+ * own ring buffer; nothing is formatted or written until the rings are
+ * dumped (on SIGUSR2 or on a crash). Records hold a format string and up
+ * to TRC_MAXARGS integer arguments. As formatting is deferred, the format
+ * must be a string literal and the arguments must be integers (cast
+ * pointers to intptr_t): %s can not be supported, as the string may be
+ * long gone when we dump.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_TRACE_H
+#define INCLUDED_TRACE_H
+#include <stdint.h>
+
+/* trace categories, selected via global(trace.categories=...) */
+#define TRC_QUEUE	0x01
+#define TRC_ACTION	0x02
+#define TRC_NET		0x04
+#define TRC_ALL		(TRC_QUEUE | TRC_ACTION | TRC_NET)
+
+#define TRC_MAXARGS 5
+
+/* the enabled categories. This is read without any synchronization, it
+ * is just a hint for the TRACE macro.
+ */
+extern unsigned trcCategories;
+
+/* record a trace entry, e.g. TRACE(TRC_QUEUE, "dequeued %d msgs", n).
+ * At most TRC_MAXARGS arguments, all converted to int64_t.
+ */
+#ifdef DEBUGLESS
+#	define TRACE(cat, fmt, ...) {}
+#else
+#	define TRACE(cat, fmt, ...) \
+		if(trcCategories & (cat)) { \
+			const int64_t trcArgs_[] = { 0, ##__VA_ARGS__ }; \
+			trcAdd((cat), (fmt), trcArgs_ + 1, sizeof(trcArgs_) / sizeof(int64_t) - 1); \
+		}
+#endif
+
+/* prototypes */
+void trcAdd(unsigned cat, const char *fmt, const int64_t *args, unsigned nargs);
+rsRetVal trcSetCategories(const char *list);
+void trcSetFile(char *fn);
+void trcSetRecords(unsigned nRecords);
+void trcDump(int fd);
+void trcDumpToFile(void);
+
+#endif /* #ifndef INCLUDED_TRACE_H */
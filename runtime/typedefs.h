@@ -98,9 +98,13 @@ typedef struct outchannels_s outchannels_t;
 typedef struct modConfData_s modConfData_t;
 typedef struct instanceConf_s instanceConf_t;
 typedef struct ratelimit_s ratelimit_t;
+typedef struct ratelimit_keyed_s ratelimit_keyed_t;
 typedef struct lookup_string_tab_etry_s lookup_string_tab_etry_t;
 typedef struct lookup_tables_s lookup_tables_t;
 typedef struct lookup_s lookup_t;
+typedef struct lookup_tab_s lookup_tab_t;
+typedef struct lookup_intkey_etry_s lookup_intkey_etry_t;
+typedef struct acmatch_s acmatch_t;
 typedef struct action_s action_t;
 typedef int rs_size_t; /* we do never need more than 2Gig strings, signed permits to
 			* use -1 as a special flag. */
@@ -265,6 +269,9 @@ struct msgPropDescr_s {
 	propid_t id;
 	uchar *name;		/* name and lenName are only set for dynamic */
 	int nameLen;		/* properties (JSON) */
+	uchar **pathSeg;	/* JSON path, precompiled into its segments (leaf is last) */
+	int nPathSeg;		/* number of segments, 0 for the root ("!") */
+	int localSlot;		/* local var slot (see msgLocalVarSlot()), -1 if none */
 };
 
 #endif /* multi-include protection */
@@ -52,6 +52,7 @@ DEFobjStaticHelpers
 DEFobjCurrIf(glbl)
 
 pthread_key_t thrd_wti_key;
+static pthread_key_t thrd_arena_key; /* worker running on this thread (arena, property memo) */
 
 /* forward-definitions */
 
@@ -171,6 +172,7 @@ wtiCancelThrd(wti_t *pThis)
 
 /* Destructor */
 BEGINobjDestruct(wti) /* be sure to specify the object type also in END and CODESTART macros! */
+	int i;
 CODESTARTobjDestruct(wti)
 	/* actual destruction */
 	batchFree(&pThis->batch);
@@ -178,6 +180,12 @@ CODESTARTobjDestruct(wti)
 	pthread_cond_destroy(&pThis->pcondBusy);
 	DESTROY_ATOMIC_HELPER_MUT(pThis->mutIsRunning);
 	free(pThis->pszDbgHdr);
+	free(pThis->arena.pBuf);
+	for(i = 0 ; i < WTI_TPLCACHE_SLOTS ; ++i)
+		free(pThis->tplCache.ent[i].pBuf);
+	for(i = 0 ; i < WTI_PROPMEMO_SLOTS ; ++i)
+		if(pThis->propMemo[i].v.datatype == 'S')
+			es_deleteStr(pThis->propMemo[i].v.d.estr);
 ENDobjDestruct(wti)
 
 
@@ -186,6 +194,10 @@ ENDobjDestruct(wti)
 BEGINobjConstruct(wti) /* be sure to specify the object type also in END macro! */
 	INIT_ATOMIC_HELPER_MUT(pThis->mutIsRunning);
 	pthread_cond_init(&pThis->pcondBusy, NULL);
+	pThis->arena.pBuf = NULL;
+	pThis->arena.lenBuf = WTI_ARENA_INITSIZE;
+	pThis->arena.used = 0;
+	pThis->arena.lenOvfl = 0;
 ENDobjConstruct(wti)
 
 
@@ -261,6 +273,11 @@ doIdleProcessing(wti_t *pThis, wtp_t *pWtp, int *pbInactivityTOOccured)
 	BEGINfunc
 	DBGPRINTF("%s: worker IDLE, waiting for work.\n", wtiGetDbgHdr(pThis));
 
+	/* producers only signal workers that announced they are idle, see
+	 * wtpAdviseMaxWorkers(). Both sides hold pmutUsr, so no wakeup is lost.
+	 */
+	pThis->bIdle = 1;
+	++pWtp->nWrkrIdle;
 	if(pThis->bAlwaysRunning) {
 		/* never shut down any started worker */
 		d_pthread_cond_wait(&pThis->pcondBusy, pWtp->pmutUsr);
@@ -271,6 +288,10 @@ doIdleProcessing(wti_t *pThis, wtp_t *pWtp, int *pbInactivityTOOccured)
 			*pbInactivityTOOccured = 1; /* indicate we had a timeout */
 		}
 	}
+	if(pThis->bIdle) { /* else the waker already accounted for us */
+		pThis->bIdle = 0;
+		--pWtp->nWrkrIdle;
+	}
 	DBGOPRINT((obj_t*) pThis, "worker awoke from idle processing\n");
 	ENDfunc
 }
@@ -300,6 +321,7 @@ wtiWorker(wti_t *__restrict__ const pThis)
 	pthread_cleanup_push(wtiWorkerCancelCleanup, pThis);
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
 	DBGPRINTF("wti %p: worker starting\n", pThis);
+	pthread_setspecific(thrd_arena_key, pThis);
 	/* now we have our identity, on to real processing */
 
 	/* note: in this loop, the mutex is "never" unlocked. Of course,
@@ -332,6 +354,8 @@ wtiWorker(wti_t *__restrict__ const pThis)
 
 		/* try to execute and process whatever we have */
 		localRet = pWtp->pfDoWork(pWtp->pUsr, pThis);
+		msgGlblVarsQuiesce(); /* batch done, global variable snapshots no longer used */
+		wtiArenaReset(pThis); /* likewise for transient allocations, this includes stolen batches */
 
 		if(localRet == RS_RET_ERR_QUEUE_EMERGENCY) {
 			break;	/* end of loop */
@@ -346,6 +370,14 @@ wtiWorker(wti_t *__restrict__ const pThis)
 		}
 
 		bInactivityTOOccured = 0; /* reset for next run */
+
+		if(!pThis->bAlwaysRunning && wtpChkScaleDown(pWtp, pThis)) {
+			/* the batch is done, but must be deleted before we go away */
+			localRet = pWtp->pfObjProcessed(pWtp->pUsr, pThis);
+			DBGOPRINT((obj_t*) pThis, "terminating worker because of autoscaling "
+				  "cap, del iRet %d\n", localRet);
+			break;
+		}
 	}
 
 	d_pthread_mutex_unlock(pWtp->pmutUsr);
@@ -361,19 +393,32 @@ wtiWorker(wti_t *__restrict__ const pThis)
 				/* free iparam "cache" - we need to go through to max! */
 				for(j = 0 ; j < wrkrInfo->p.tx.maxIParams ; ++j) {
 					for(k = 0 ; k < pAction->iNumTpls ; ++k) {
-						free(actParam(wrkrInfo->p.tx.iparams,
-							      pAction->iNumTpls, j, k).param);
+						actionFreeTxIParam(pAction, &actParam(wrkrInfo->p.tx.iparams,
+								      pAction->iNumTpls, j, k));
 					}
 				}
 				free(wrkrInfo->p.tx.iparams);
 				wrkrInfo->p.tx.iparams = NULL;
 				wrkrInfo->p.tx.currIParam = 0;
 				wrkrInfo->p.tx.maxIParams = 0;
+				free(wrkrInfo->p.tx.results);
+				wrkrInfo->p.tx.results = NULL;
+				wrkrInfo->p.tx.maxResults = 0;
+				wrkrInfo->p.tx.bRetryPending = 0;
+			} else if(pAction->eParamPassing == ACT_STRING_PASSING) {
+				/* free the string buffers kept for reuse */
+				for(k = 0 ; k < pAction->iNumTpls ; ++k) {
+					free(wrkrInfo->p.nontx.actParams[k].param);
+					wtiInitIParam(&wrkrInfo->p.nontx.actParams[k]);
+				}
 			}
 			wrkrInfo->actWrkrData = NULL; /* re-init for next activation */
 		}
 	}
 
+	pthread_setspecific(thrd_arena_key, NULL);
+	wtiArenaReset(pThis);
+
 	/* indicate termination */
 	pthread_cleanup_pop(0); /* remove cleanup handler */
 	pthread_setcancelstate(iCancelStateSave, NULL);
@@ -444,6 +489,90 @@ wtiGetDummy(void)
 	return pWti;
 }
 
+/* return the queue worker running on the current thread, NULL if the
+ * thread is no queue worker.
+ */
+wti_t *
+wtiGetCurrWorker(void)
+{
+	return (wti_t*) pthread_getspecific(thrd_arena_key);
+}
+
+/* Allocate transient memory from the arena of the worker running on the
+ * current thread. The memory must be released with wtiArenaFree(), which
+ * is a no-op for arena memory; the arena itself is reset after each batch.
+ * If the calling thread is no queue worker, or the arena is exhausted, we
+ * fall back to malloc(). So callers may use this function everywhere, but
+ * must not keep the memory beyond the processing of the current message.
+ */
+void *
+wtiArenaAlloc(size_t len)
+{
+	wti_t *pWti;
+	wtiArena_t *pArena;
+	void *p;
+
+	pWti = (wti_t*) pthread_getspecific(thrd_arena_key);
+	if(pWti == NULL)
+		return malloc(len);
+	pArena = &pWti->arena;
+	len = (len + 7) & ~((size_t) 7); /* keep alignment */
+	if(pArena->pBuf == NULL) {
+		if((pArena->pBuf = malloc(pArena->lenBuf)) == NULL)
+			return malloc(len);
+	}
+	if(pArena->used + len > pArena->lenBuf) {
+		pArena->lenOvfl += len;
+		return malloc(len);
+	}
+	p = pArena->pBuf + pArena->used;
+	pArena->used += len;
+	return p;
+}
+
+void
+wtiArenaFree(void *p)
+{
+	wti_t *pWti;
+	wtiArena_t *pArena;
+
+	if(p == NULL)
+		return;
+	pWti = (wti_t*) pthread_getspecific(thrd_arena_key);
+	if(pWti != NULL) {
+		pArena = &pWti->arena;
+		if(   pArena->pBuf != NULL
+		   && (uchar*) p >= pArena->pBuf && (uchar*) p < pArena->pBuf + pArena->lenBuf)
+			return; /* arena memory, released on reset */
+	}
+	free(p);
+}
+
+/* Release all arena memory of the current batch. If the arena was too
+ * small for the last batch, it is grown (up to WTI_ARENA_MAXSIZE), so
+ * that the next batches can be served without malloc().
+ */
+void
+wtiArenaReset(wti_t * const pThis)
+{
+	wtiArena_t *const pArena = &pThis->arena;
+	size_t lenNew;
+
+	if(pArena->lenOvfl > 0 && pArena->lenBuf < WTI_ARENA_MAXSIZE) {
+		lenNew = pArena->lenBuf;
+		while(lenNew < pArena->lenBuf + pArena->lenOvfl && lenNew < WTI_ARENA_MAXSIZE)
+			lenNew *= 2;
+		if(lenNew > WTI_ARENA_MAXSIZE)
+			lenNew = WTI_ARENA_MAXSIZE;
+		DBGPRINTF("wti %p: growing arena from %zu to %zu bytes\n", pThis, pArena->lenBuf, lenNew);
+		free(pArena->pBuf);
+		pArena->pBuf = NULL; /* re-alloc on next use */
+		pArena->lenBuf = lenNew;
+	}
+	pArena->used = 0;
+	pArena->lenOvfl = 0;
+}
+
 /* dummy */
 rsRetVal wtiQueryInterface(void) { return RS_RET_NOT_IMPLEMENTED; }
 
@@ -454,6 +583,7 @@ CODESTARTObjClassExit(nsdsel_gtls)
 	/* release objects we no longer need */
 	objRelease(glbl, CORE_COMPONENT);
 	pthread_key_delete(thrd_wti_key);
+	pthread_key_delete(thrd_arena_key);
 ENDObjClassExit(wti)
 
 
@@ -466,6 +596,8 @@ BEGINObjClassInit(wti, 1, OBJ_IS_CORE_MODULE) /* one is the object version (most
 	/* request objects we use */
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
 	r = pthread_key_create(&thrd_wti_key, NULL);
+	if(r == 0)
+		r = pthread_key_create(&thrd_arena_key, NULL);
 	if(r != 0) {
 		dbgprintf("wti.c: pthread_key_create failed\n");
 		iRet = RS_RET_ERR;
@@ -23,10 +23,12 @@
 #define WTI_H_INCLUDED
 
 #include <pthread.h>
+#include <libestr.h>
 #include "wtp.h"
 #include "obj.h"
 #include "batch.h"
 #include "action.h"
+#include "rainerscript.h"
 
 
 #define ACT_STATE_RDY  0	/* action ready, waiting for new transaction */
@@ -46,11 +48,15 @@ typedef struct actWrkrInfo {
 		unsigned actState : 3;
 		unsigned bJustResumed : 1;
 	} flags;
+	uint64 tStageSample;	/* pipestats: parse time of oldest sampled msg not yet committed, 0 - none */
 	union {
 		struct {
 			actWrkrIParams_t *iparams;/* dynamically sized array for transactional outputs */
 			int currIParam;
 			int maxIParams;	/* current max */
+			rsRetVal *results;/* per-message results for commitBatch(), maxResults entries */
+			int maxResults;
+			sbool bRetryPending;/* iparams hold messages commitBatch() asked to retry */
 		} tx;
 		struct {
 			actWrkrIParams_t actParams[CONF_OMOD_NUMSTRINGS_MAXSIZE];
@@ -58,14 +64,73 @@ typedef struct actWrkrInfo {
 	} p; /* short name for "parameters" */
 } actWrkrInfo_t;
 
+/* batch-scoped bump arena for transient allocations (e.g. during
+ * expression evaluation). Memory obtained via wtiArenaAlloc() is valid
+ * until the current batch has been processed, see wtiArenaReset().
+ */
+#define WTI_ARENA_INITSIZE (16 * 1024)
+#define WTI_ARENA_MAXSIZE (1024 * 1024)
+typedef struct wtiArena_s {
+	uchar *pBuf;	/* allocated on first use */
+	size_t lenBuf;
+	size_t used;
+	size_t lenOvfl;	/* bytes that did not fit into the arena during this batch */
+} wtiArena_t;
+
+/* per-worker cache of rendered template strings. A template that is used
+ * by multiple actions is rendered only once per message (see action.c).
+ * An entry is valid only while its gen matches the cache's gen, which is
+ * bumped whenever a new message is started or the current one may have
+ * been modified.
+ */
+#define WTI_TPLCACHE_SLOTS 8
+typedef struct wtiTplCacheEntry_s {
+	uchar *pBuf;
+	size_t lenBuf;
+	uint32_t lenStr;
+	unsigned gen;
+} wtiTplCacheEntry_t;
+
+/* per-worker memo of message properties read by RainerScript. The slot
+ * of a property is assigned at config load (see cnfvarNew()). An entry is
+ * valid under the same rules as the template cache entries, so set and
+ * unset statements (which bump the gen) implicitly clear the memo.
+ */
+#define WTI_PROPMEMO_SLOTS 32
+typedef struct wtiPropMemoEntry_s {
+	unsigned gen;
+	struct var v;	/* v.datatype 0 if unused; an 'S' string is owned by the
+			 * memo, all other types are owned by the message */
+} wtiPropMemoEntry_t;
+
+/* per-worker memo of the last field() split. It records where the fields
+ * of a source string start, so that further field() calls on the same
+ * string and delimiter need not scan it from the beginning. Only strings
+ * that stay valid while the message is unmodified are memorized; the memo
+ * is valid under the same rules as the template cache entries.
+ */
+#define WTI_FIELDMEMO_MAXFLDS 64
+typedef struct wtiFieldMemo_s {
+	unsigned gen;
+	const uchar *buf;	/* source string, NULL if unused */
+	uint32_t len;
+	uchar delim;
+	sbool bEnd;		/* end of buf reached, all field starts are recorded */
+	int nFlds;		/* number of field starts recorded */
+	uint32_t fldStart[WTI_FIELDMEMO_MAXFLDS];
+} wtiFieldMemo_t;
+
 /* the worker thread instance class */
 struct wti_s {
 	BEGINobjInstance;
 	pthread_t thrdID; 	/* thread ID */
 	int bIsRunning;	/* is this thread currently running? (must be int for atomic op!) */
 	sbool bAlwaysRunning;	/* should this thread always run? */
+	sbool bScaledDown;	/* terminating because of the pool's autoscaling cap? */
+	sbool bIdle;		/* waiting on pcondBusy? (protected by pmutUsr in wtp) */
 	int *pbShutdownImmediate;/* end processing of this batch immediately if set to 1 */
 	wtp_t *pWtp; /* my worker thread pool (important if only the work thread instance is passed! */
+	qqueue_t *pqStealSrc; /* shard the current batch was stolen from, NULL if it is from our own queue */
 	batch_t batch; /* pointer to an object array meaningful for current user
 			  pointer (e.g. queue pUsr data elemt) */
 	uchar *pszDbgHdr;	/* header string for debug messages */
@@ -73,6 +138,14 @@ struct wti_s {
 				      (sized for max nbr of actions in config!) */
 	pthread_cond_t pcondBusy; /* condition to wake up the worker, protected by pmutUsr in wtp */
 	DEF_ATOMIC_HELPER_MUT(mutIsRunning);
+	wtiArena_t arena;	/* transient allocations of the current batch */
+	struct {
+		msg_t *pMsg;	/* message currently being executed, NULL if none */
+		unsigned gen;
+		wtiTplCacheEntry_t ent[WTI_TPLCACHE_SLOTS];
+	} tplCache;
+	wtiPropMemoEntry_t propMemo[WTI_PROPMEMO_SLOTS]; /* tied to tplCache.pMsg and gen */
+	wtiFieldMemo_t fieldMemo; /* tied to tplCache.pMsg and gen */
 	struct {
 		uint8_t bPrevWasSuspended;
 		uint8_t bDoAutoCommit; /* do a commit after each message
@@ -95,6 +168,10 @@ rsRetVal wtiSetState(wti_t * const pThis, sbool bNew);
 rsRetVal wtiWakeupThrd(wti_t * const pThis);
 sbool wtiGetState(wti_t * const pThis);
 wti_t *wtiGetDummy(void);
+wti_t *wtiGetCurrWorker(void);
+void *wtiArenaAlloc(size_t len);
+void wtiArenaFree(void *p);
+void wtiArenaReset(wti_t * const pThis);
 PROTOTYPEObjClassInit(wti);
 PROTOTYPEpropSetMeth(wti, pszDbgHdr, uchar*);
 PROTOTYPEpropSetMeth(wti, pWtp, wtp_t*);
@@ -205,10 +282,43 @@ wtiInitIParam(actWrkrIParams_t *piparams)
 	memset(piparams, 0, sizeof(actWrkrIParams_t));
 }
 
+/* string parameter buffers are kept for reuse by the next message. Only a
+ * buffer that grew beyond the high-water size (e.g. for a single huge
+ * message) is released, so that it does not stay allocated forever.
+ * A maxLen of 0 means buffers are never released.
+ */
+static inline void
+wtiTrimIParam(actWrkrIParams_t *piparam, const size_t maxLen)
+{
+	if(maxLen != 0 && piparam->lenBuf > maxLen) {
+		free(piparam->param);
+		piparam->param = NULL;
+		piparam->lenBuf = 0;
+		piparam->lenStr = 0;
+	}
+}
+
 static inline void
 wtiResetExecState(wti_t * const pWti, batch_t * const pBatch)
 {
 	pWti->execState.bPrevWasSuspended = 0;
 	pWti->execState.bDoAutoCommit = (batchNumMsgs(pBatch) == 1);
+	pWti->tplCache.pMsg = NULL;
+	++pWti->tplCache.gen;
+}
+
+/* set the message the template cache is valid for (NULL disables it) */
+static inline void
+wtiTplCacheSetMsg(wti_t * const pWti, msg_t * const pMsg)
+{
+	pWti->tplCache.pMsg = pMsg;
+	++pWti->tplCache.gen;
+}
+
+/* the current message may have been modified, drop all cached renderings */
+static inline void
+wtiTplCacheInvalidate(wti_t * const pWti)
+{
+	++pWti->tplCache.gen;
 }
 #endif /* #ifndef WTI_H_INCLUDED */
@@ -216,6 +216,59 @@ finalize_it:
 }
 
 
+/* Check if the calling worker shall terminate because the pool runs more
+ * workers than the current autoscaling cap permits. Must be called with the
+ * user mutex locked, so that only as many workers as are surplus decide to
+ * terminate. If so, the worker is flagged and counted as terminating until
+ * its cleanup has decremented the worker count.
+ */
+sbool
+wtpChkScaleDown(wtp_t *pThis, wti_t *pWti)
+{
+	int nLeaving;
+	int nCur;
+
+	if(pThis->iCapWorkerThreads == 0)
+		return 0;
+	/* order matters: a cleanup running in between makes us too cautious, never too eager */
+	nLeaving = ATOMIC_FETCH_32BIT(&pThis->nWrkrScaledDown, &pThis->mutCurNumWrkThrd);
+	nCur = ATOMIC_FETCH_32BIT(&pThis->iCurNumWrkThrd, &pThis->mutCurNumWrkThrd);
+	if(nCur - nLeaving <= pThis->iCapWorkerThreads)
+		return 0;
+	ATOMIC_INC(&pThis->nWrkrScaledDown, &pThis->mutCurNumWrkThrd);
+	pWti->bScaledDown = 1;
+	DBGPRINTF("%s: %d workers exceed cap %d, terminating one\n",
+		  wtpGetDbgHdr(pThis), nCur - nLeaving, pThis->iCapWorkerThreads);
+	return 1;
+}
+
+
+/* set the autoscaling cap on the number of running workers. 0 removes it.
+ * Surplus workers terminate after they have completed their current batch.
+ */
+void
+wtpSetWorkerCap(wtp_t *pThis, int nCap)
+{
+	ISOBJ_TYPE_assert(pThis, wtp);
+	if(nCap >= pThis->iNumWorkerThreads)
+		nCap = 0;
+	pThis->iCapWorkerThreads = nCap;
+}
+
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+/* restrict all workers started from now on to the given cpus. The set is
+ * owned by the caller and must live as long as the wtp.
+ */
+void
+wtpSetCpuSet(wtp_t *pThis, cpu_set_t *pSet)
+{
+	ISOBJ_TYPE_assert(pThis, wtp);
+	pThis->pCpuSet = pSet;
+}
+#endif
+
+
 #pragma GCC diagnostic ignored "-Wempty-body"
 /* Send a shutdown command to all workers and see if they terminate.
  * A timeout may be specified. This function may also be called with
@@ -310,6 +363,11 @@ wtpWrkrExecCleanup(wti_t *pWti)
 	/* the order of the next two statements is important! */
 	wtiSetState(pWti, WRKTHRD_STOPPED);
 	ATOMIC_DEC(&pThis->iCurNumWrkThrd, &pThis->mutCurNumWrkThrd);
+	/* and this must come after the worker count was decremented, see wtpChkScaleDown() */
+	if(pWti->bScaledDown) {
+		pWti->bScaledDown = 0;
+		ATOMIC_DEC(&pThis->nWrkrScaledDown, &pThis->mutCurNumWrkThrd);
+	}
 
 	DBGPRINTF("%s: Worker thread %lx, terminated, num workers now %d\n",
 		  wtpGetDbgHdr(pThis), (unsigned long) pWti,
@@ -386,6 +444,15 @@ wtpWorker(void *arg) /* the arg is actually a wti object, even though we are in
 	dbgOutputTID((char*)thrdName);
 #	endif
 
+#	ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	if(pThis->pCpuSet != NULL) {
+		if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), pThis->pCpuSet) != 0) {
+			DBGPRINTF("%s: could not set cpu affinity of worker, ignored\n",
+				  wtpGetDbgHdr(pThis));
+		}
+	}
+#	endif
+
 	pthread_cleanup_push(wtpWrkrExecCancelCleanup, pWti);
 	wtiWorker(pWti);
 	pthread_cleanup_pop(0);
@@ -451,6 +518,9 @@ finalize_it:
  * So the caller can assume that there is at least one worker re-checking if there is "work to do"
  * after this function call.
  * rgerhards, 2008-01-21
+ * Must be called with pmutUsr locked, as we need a consistent view of the
+ * idle workers. Busy workers are never signaled, they re-check for work
+ * anyhow after finishing their batch.
  */
 rsRetVal
 wtpAdviseMaxWorkers(wtp_t *pThis, int nMaxWrkr)
@@ -466,6 +536,8 @@ wtpAdviseMaxWorkers(wtp_t *pThis, int nMaxWrkr)
 
 	if(nMaxWrkr > pThis->iNumWorkerThreads) /* limit to configured maximum */
 		nMaxWrkr = pThis->iNumWorkerThreads;
+	if(pThis->iCapWorkerThreads > 0 && nMaxWrkr > pThis->iCapWorkerThreads)
+		nMaxWrkr = pThis->iCapWorkerThreads; /* limit to current autoscaling cap */
 
 	nMissing = nMaxWrkr - ATOMIC_FETCH_32BIT(&pThis->iCurNumWrkThrd, &pThis->mutCurNumWrkThrd);
 
@@ -476,10 +548,20 @@ wtpAdviseMaxWorkers(wtp_t *pThis, int nMaxWrkr)
 		for(i = 0 ; i < nMissing ; ++i) {
 			CHKiRet(wtpStartWrkr(pThis));
 		}
-	} else {
-		/* we have needed number of workers, but they may be sleeping */
-		for(i = 0, nRunning = 0; i < pThis->iNumWorkerThreads && nRunning < nMaxWrkr; ++i) {
-			if (wtiGetState(pThis->pWrkr[i]) != WRKTHRD_STOPPED) {
+	} else if(pThis->nWrkrIdle > 0) {
+		/* we have needed number of workers, but some may be sleeping. Workers
+		 * that are busy will look at the queue again anyhow, so we wake only
+		 * as many idle ones as are needed to have nMaxWrkr awake. If no
+		 * worker is idle (the common case under load), there is nothing to do.
+		 * Note: nWrkrIdle and bIdle are protected by pmutUsr, which our
+		 * callers hold.
+		 */
+		nRunning = ATOMIC_FETCH_32BIT(&pThis->iCurNumWrkThrd, &pThis->mutCurNumWrkThrd)
+			   - pThis->nWrkrIdle;
+		for(i = 0 ; i < pThis->iNumWorkerThreads && nRunning < nMaxWrkr ; ++i) {
+			if(pThis->pWrkr[i]->bIdle) {
+				pThis->pWrkr[i]->bIdle = 0;
+				--pThis->nWrkrIdle;
 				pthread_cond_signal(&pThis->pWrkr[i]->pcondBusy);
 				nRunning++;
 			}
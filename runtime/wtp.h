@@ -45,6 +45,12 @@ struct wtp_s {
 	wtpState_t wtpState;
 	int 	iNumWorkerThreads;/* number of worker threads to use */
 	int 	iCurNumWrkThrd;/* current number of active worker threads */
+	int	iCapWorkerThreads;/* autoscaling limit below iNumWorkerThreads, 0 = none */
+	int	nWrkrScaledDown;/* workers terminating because they exceed the cap */
+	int	nWrkrIdle;	/* workers waiting for work (protected by pmutUsr) */
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	cpu_set_t *pCpuSet;	/* cpus the workers run on, NULL = no restriction (not owned) */
+#endif
 	struct wti_s **pWrkr;/* array with control structure for the worker thread(s) associated with this wtp */
 	int	toWrkShutdown;	/* timeout for idle workers in ms, -1 means indefinite (0 is immediate) */
 	rsRetVal (*pConsumer)(void *); /* user-supplied consumer function for dewtpd messages */
@@ -77,6 +83,11 @@ rsRetVal wtpDestruct(wtp_t **ppThis);
 rsRetVal wtpAdviseMaxWorkers(wtp_t *pThis, int nMaxWrkr);
 rsRetVal wtpProcessThrdChanges(wtp_t *pThis);
 rsRetVal wtpChkStopWrkr(wtp_t *pThis, int bLockUsrMutex);
+sbool wtpChkScaleDown(wtp_t *pThis, wti_t *pWti);
+void wtpSetWorkerCap(wtp_t *pThis, int nCap);
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+void wtpSetCpuSet(wtp_t *pThis, cpu_set_t *pSet);
+#endif
 rsRetVal wtpSetState(wtp_t *pThis, wtpState_t iNewState);
 rsRetVal wtpWakeupAllWrkr(wtp_t *pThis);
 rsRetVal wtpCancelAll(wtp_t *pThis);
@@ -256,6 +256,79 @@ finalize_it:
 }
 
 
+/* Build the frame as an I/O vector instead of a contiguous buffer. This
+ * works like TCPSendBldFrame(), but the message is not copied: we just
+ * put the octet count header (in octet-counting mode) in front of it and
+ * the LF (in octet-stuffing mode, if needed) after it. szLenBuf is used
+ * to hold the header and must be provided by the caller. Returns the
+ * number of vector elements used (at most 2).
+ */
+static int
+TCPSendBldFrameV(tcpclt_t *pThis, char *msg, size_t len, struct iovec *iov,
+		 char *szLenBuf, size_t lenLenBuf)
+{
+	TCPFRAMINGMODE framingToUse;
+	int iovcnt = 0;
+
+	/* compressed records always need octet counting, see TCPSendBldFrame() */
+	framingToUse = (*msg == 'z') ? TCP_FRAMING_OCTET_COUNTING : pThis->tcp_framing;
+
+	if(framingToUse == TCP_FRAMING_OCTET_COUNTING) {
+		iov[iovcnt].iov_base = szLenBuf;
+		iov[iovcnt].iov_len = snprintf(szLenBuf, lenLenBuf, "%d ", (int) len);
+		++iovcnt;
+	}
+	iov[iovcnt].iov_base = msg;
+	iov[iovcnt].iov_len = len;
+	++iovcnt;
+	if(framingToUse == TCP_FRAMING_OCTET_STUFFING && msg[len-1] != '\n') {
+		iov[iovcnt].iov_base = (void*) "\n";
+		iov[iovcnt].iov_len = 1;
+		++iovcnt;
+	}
+	return iovcnt;
+}
+
+
+/* keep a copy of the frame given as I/O vector for resend on reconnect.
+ * If we can not alloc a new buffer, we silently ignore it. The worst that
+ * happens is that we lose our message recovery buffer - anything else would
+ * be worse, so don't try anything ;) -- rgerhards, 2008-03-12
+ */
+static void
+setPrevMsgV(tcpclt_t *pThis, struct iovec *iov, int iovcnt)
+{
+	size_t len;
+	size_t iOffs;
+	int i;
+
+	free(pThis->prevMsg);
+	for(len = 0, i = 0 ; i < iovcnt ; ++i)
+		len += iov[i].iov_len;
+	if((pThis->prevMsg = MALLOC(len)) != NULL) {
+		for(iOffs = 0, i = 0 ; i < iovcnt ; ++i) {
+			memcpy(pThis->prevMsg + iOffs, iov[i].iov_base, iov[i].iov_len);
+			iOffs += iov[i].iov_len;
+		}
+		pThis->lenPrevMsg = len;
+	}
+}
+
+
+/* send a complete frame via whatever send callback was set */
+static rsRetVal
+doSendFrame(tcpclt_t *pThis, void *pData, char *msg, size_t len)
+{
+	struct iovec iov;
+
+	if(pThis->sendFuncV == NULL)
+		return pThis->sendFunc(pData, msg, len);
+	iov.iov_base = msg;
+	iov.iov_len = len;
+	return pThis->sendFuncV(pData, &iov, 1);
+}
+
+
 /* Sends a TCP message. It is first checked if the
  * session is open and, if not, it is opened. Then the send
  * is tried. If it fails, one silent re-try is made. If the send
@@ -289,13 +362,23 @@ Send(tcpclt_t *pThis, void *pData, char *msg, size_t len)
 	int bDone = 0;
 	int retry = 0;
 	int bMsgMustBeFreed = 0;/* must msg be freed at end of function? 0 - no, 1 - yes */
+	struct iovec iov[2];
+	int iovcnt = 0;
+	char szLenBuf[16];
+	int i;
 
 	ISOBJ_TYPE_assert(pThis, tcpclt);
 	assert(pData != NULL);
 	assert(msg != NULL);
 	assert(len > 0);
 
-	CHKiRet(TCPSendBldFrame(pThis, &msg, &len, &bMsgMustBeFreed));
+	if(pThis->sendFuncV == NULL) {
+		CHKiRet(TCPSendBldFrame(pThis, &msg, &len, &bMsgMustBeFreed));
+	} else {
+		iovcnt = TCPSendBldFrameV(pThis, msg, len, iov, szLenBuf, sizeof(szLenBuf));
+		for(len = 0, i = 0 ; i < iovcnt ; ++i)
+			len += iov[i].iov_len;
+	}
 
 	if(pThis->iRebindInterval > 0  && ++pThis->iNumMsgs == pThis->iRebindInterval) {
 		/* we need to rebind, and use the retry logic for this*/
@@ -305,7 +388,10 @@ Send(tcpclt_t *pThis, void *pData, char *msg, size_t len)
 
 	while(!bDone) { /* loop is broken when send succeeds or error occurs */
 		CHKiRet(pThis->initFunc(pData));
-		iRet = pThis->sendFunc(pData, msg, len);
+		if(pThis->sendFuncV == NULL)
+			iRet = pThis->sendFunc(pData, msg, len);
+		else
+			iRet = pThis->sendFuncV(pData, iov, iovcnt);
 
 		if(iRet == RS_RET_OK || iRet == RS_RET_DEFER_COMMIT || iRet == RS_RET_PREVIOUS_COMMITTED) {
 			/* we are done, we also use this as indication that the previous
@@ -318,16 +404,12 @@ Send(tcpclt_t *pThis, void *pData, char *msg, size_t len)
 			 * However, if not requested, we do NOT need to do all the stuff needed for it.
 			 */
 			if(pThis->bResendLastOnRecon == 1) {
-				if(pThis->prevMsg != NULL)
-					free(pThis->prevMsg);
-				/* if we can not alloc a new buffer, we silently ignore it. The worst that
-				 * happens is that we lose our message recovery buffer - anything else would
-				 * be worse, so don't try anything ;) -- rgerhards, 2008-03-12
-				 */
-				if((pThis->prevMsg = MALLOC(len)) != NULL) {
-					memcpy(pThis->prevMsg, msg, len);
-					pThis->lenPrevMsg = len;
+				if(pThis->sendFuncV == NULL) {
+					iov[0].iov_base = msg;
+					iov[0].iov_len = len;
+					iovcnt = 1;
 				}
+				setPrevMsgV(pThis, iov, iovcnt);
 			}
 
 			/* we are done with this record */
@@ -342,7 +424,7 @@ Send(tcpclt_t *pThis, void *pData, char *msg, size_t len)
 				 */
 				if(pThis->prevMsg != NULL) {
 					CHKiRet(pThis->initFunc(pData));
-					CHKiRet(pThis->sendFunc(pData, pThis->prevMsg, pThis->lenPrevMsg));
+					CHKiRet(doSendFrame(pThis, pData, pThis->prevMsg, pThis->lenPrevMsg));
 				}
 			} else {
 				/* OK, max number of retries reached, nothing we can do */
@@ -358,6 +440,78 @@ finalize_it:
 }
 
 
+/* Sends a whole batch of messages. The frames are built as a single I/O
+ * vector (see TCPSendBldFrameV()) and handed to the batch send callback in
+ * one call, so that the driver can use a single writev() or TLS record for
+ * many messages instead of one send per message. Retry works like in Send():
+ * on failure, the session is re-established, the last frame of the previous
+ * batch is resent (if so configured) and the batch is retried once. After
+ * success, the last frame of this batch becomes the one to resend.
+ */
+static rsRetVal
+SendBatch(tcpclt_t *pThis, void *pData, struct iovec *msgs, int nMsgs)
+{
+	struct iovec *iov;
+	int iovcnt;
+	int iLastFrame = 0;
+	int retry;
+	int i;
+	DEFiRet;
+
+	ISOBJ_TYPE_assert(pThis, tcpclt);
+	assert(pData != NULL);
+	assert(pThis->sendFuncBatchV != NULL);
+
+	if(nMsgs == 0)
+		FINALIZE;
+
+	if(nMsgs > pThis->maxBatch) {
+		/* at most 3 vector elements per frame, see TCPSendBldFrameV() */
+		CHKmalloc(iov = realloc(pThis->batchIov, sizeof(struct iovec) * 3 * nMsgs));
+		pThis->batchIov = iov;
+		free(pThis->batchLenBufs);
+		pThis->maxBatch = 0;
+		CHKmalloc(pThis->batchLenBufs = MALLOC(TCPCLT_LENBUF_SIZE * nMsgs));
+		pThis->maxBatch = nMsgs;
+	}
+
+	iov = pThis->batchIov;
+	for(iovcnt = 0, i = 0 ; i < nMsgs ; ++i) {
+		assert(msgs[i].iov_len > 0);
+		iLastFrame = iovcnt;
+		iovcnt += TCPSendBldFrameV(pThis, msgs[i].iov_base, msgs[i].iov_len, iov + iovcnt,
+					   pThis->batchLenBufs + i * TCPCLT_LENBUF_SIZE, TCPCLT_LENBUF_SIZE);
+	}
+
+	if(pThis->iRebindInterval > 0) {
+		pThis->iNumMsgs += nMsgs;
+		if(pThis->iNumMsgs >= pThis->iRebindInterval) {
+			/* we need to rebind, and use the retry logic for this*/
+			CHKiRet(pThis->prepRetryFunc(pData)); /* try to recover */
+			pThis->iNumMsgs = 0;
+		}
+	}
+
+	for(retry = 0 ; ; ++retry) {
+		CHKiRet(pThis->initFunc(pData));
+		iRet = pThis->sendFuncBatchV(pData, iov, iovcnt);
+		if(iRet == RS_RET_OK || retry == 1)
+			break;
+		CHKiRet(pThis->prepRetryFunc(pData)); /* try to recover */
+		if(pThis->prevMsg != NULL) {
+			CHKiRet(pThis->initFunc(pData));
+			CHKiRet(doSendFrame(pThis, pData, pThis->prevMsg, pThis->lenPrevMsg));
+		}
+	}
+
+	if(iRet == RS_RET_OK && pThis->bResendLastOnRecon == 1)
+		setPrevMsgV(pThis, iov + iLastFrame, iovcnt - iLastFrame);
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* set functions */
 static rsRetVal
 SetResendLastOnRecon(tcpclt_t *pThis, int bResendLastOnRecon)
@@ -388,6 +542,20 @@ SetSendFrame(tcpclt_t *pThis, rsRetVal (*pCB)(void*, char*, size_t))
 	RETiRet;
 }
 static rsRetVal
+SetSendFrameV(tcpclt_t *pThis, rsRetVal (*pCB)(void*, struct iovec*, int))
+{
+	DEFiRet;
+	pThis->sendFuncV = pCB;
+	RETiRet;
+}
+static rsRetVal
+SetSendBatchV(tcpclt_t *pThis, rsRetVal (*pCB)(void*, struct iovec*, int))
+{
+	DEFiRet;
+	pThis->sendFuncBatchV = pCB;
+	RETiRet;
+}
+static rsRetVal
 SetFraming(tcpclt_t *pThis, TCPFRAMINGMODE framing)
 {
 	DEFiRet;
@@ -426,6 +594,8 @@ BEGINobjDestruct(tcpclt) /* be sure to specify the object type also in END and C
 CODESTARTobjDestruct(tcpclt)
 	if(pThis->prevMsg != NULL)
 		free(pThis->prevMsg);
+	free(pThis->batchIov);
+	free(pThis->batchLenBufs);
 ENDobjDestruct(tcpclt)
 
 
@@ -459,6 +629,9 @@ CODESTARTobjQueryInterface(tcpclt)
 	pIf->SetSendPrepRetry = SetSendPrepRetry;
 	pIf->SetFraming = SetFraming;
 	pIf->SetRebindInterval = SetRebindInterval;
+	pIf->SetSendFrameV = SetSendFrameV;
+	pIf->SendBatch = SendBatch;
+	pIf->SetSendBatchV = SetSendBatchV;
 
 finalize_it:
 ENDobjQueryInterface(tcpclt)
@@ -25,6 +25,7 @@
 #ifndef	TCPCLT_H_INCLUDED
 #define	TCPCLT_H_INCLUDED 1
 
+#include <sys/uio.h>
 #include "obj.h"
 
 /* the tcpclt object */
@@ -39,8 +40,15 @@ typedef struct tcpclt_s {
 	int iNumMsgs;		/* number of messages during current "rebind session" */
 	rsRetVal (*initFunc)(void*);
 	rsRetVal (*sendFunc)(void*, char*, size_t);
+	rsRetVal (*sendFuncV)(void*, struct iovec*, int); /* if set, used instead of sendFunc */
+	rsRetVal (*sendFuncBatchV)(void*, struct iovec*, int); /* sends a whole batch of frames */
 	rsRetVal (*prepRetryFunc)(void*);
+	/* frame buffers for SendBatch(), grown as needed */
+	struct iovec *batchIov;
+	char *batchLenBufs;	/* octet count headers, TCPCLT_LENBUF_SIZE per msg */
+	int maxBatch;		/* number of msgs the buffers can hold */
 } tcpclt_t;
+#define TCPCLT_LENBUF_SIZE 16
 
 
 /* interfaces */
@@ -58,8 +66,19 @@ BEGINinterface(tcpclt) /* name must also be changed in ENDinterface macro! */
 	rsRetVal (*SetFraming)(tcpclt_t*, TCPFRAMINGMODE framing);
 	/* v3, 2009-07-14*/
 	rsRetVal (*SetRebindInterval)(tcpclt_t*, int iRebindInterval);
+	/* v4 */
+	rsRetVal (*SetSendFrameV)(tcpclt_t*, rsRetVal (*)(void*, struct iovec*, int));
+	/* v5 */
+	rsRetVal (*SendBatch)(tcpclt_t *pThis, void *pData, struct iovec *msgs, int nMsgs);
+	rsRetVal (*SetSendBatchV)(tcpclt_t*, rsRetVal (*)(void*, struct iovec*, int));
 ENDinterface(tcpclt)
-#define tcpcltCURR_IF_VERSION 3 /* increment whenever you change the interface structure! */
+#define tcpcltCURR_IF_VERSION 5 /* increment whenever you change the interface structure! */
+/* Changes:
+ * v4 - SetSendFrameV() added: the frame is passed as I/O vector, so that
+ *      the message need not be copied to add the framing
+ * v5 - SendBatch() and SetSendBatchV() added: the frames of a whole batch
+ *      are passed as a single I/O vector to the send callback
+ */
 
 
 /* prototypes */
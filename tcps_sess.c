@@ -49,6 +49,7 @@
 #include "prop.h"
 #include "ratelimit.h"
 #include "debug.h"
+#include "memacct.h"
 
 
 /* static data */
@@ -70,7 +71,9 @@ BEGINobjConstruct(tcps_sess) /* be sure to specify the object type also in END m
 		pThis->bAtStrtOfFram = 1; /* indicate frame header expected */
 		pThis->eFraming = TCP_FRAMING_OCTET_STUFFING; /* just make sure... */
 		/* now allocate the message reception buffer */
-		CHKmalloc(pThis->pMsg = (uchar*) MALLOC(sizeof(uchar) * glbl.GetMaxLine() + 1));
+		pThis->lenMsgBuf = sizeof(uchar) * glbl.GetMaxLine() + 1;
+		CHKmalloc(pThis->pMsg = (uchar*) MALLOC(pThis->lenMsgBuf));
+		memacctAdd(MEMACCT_TCPSESS, pThis->lenMsgBuf);
 finalize_it:
 ENDobjConstruct(tcps_sess)
 
@@ -106,7 +109,10 @@ CODESTARTobjDestruct(tcps_sess)
 		CHKiRet(prop.Destruct(&pThis->fromHost));
 	if(pThis->fromHostIP != NULL)
 		CHKiRet(prop.Destruct(&pThis->fromHostIP));
-	free(pThis->pMsg);
+	if(pThis->pMsg != NULL) {
+		memacctSub(MEMACCT_TCPSESS, pThis->lenMsgBuf);
+		free(pThis->pMsg);
+	}
 ENDobjDestruct(tcps_sess)
 
 
@@ -437,6 +443,68 @@ processDataRcvd(tcps_sess_t *pThis, char c, struct syslogTime *stTime, time_t tt
 }
 
 
+/* Fast path for the body of a frame, called in state eInMsg only. Instead
+ * of running the state machine for each character, we locate the next frame
+ * delimiter via memchr() (or use the octet count) and copy everything in
+ * front of it in one go. The result is the same as with processDataRcvd(),
+ * including splitting of oversize messages.
+ * Returns the number of bytes consumed. 0 means the caller must use the
+ * per-character state machine (done for an invalid octet count).
+ */
+static inline size_t
+processDataRcvdBulk(tcps_sess_t *pThis, char *pData, size_t iLen, int iMaxLine,
+		    struct syslogTime *stTime, time_t ttGenTime, multi_submit_t *pMultiSub)
+{
+	char *const pStart = pData;
+	char *pStop;
+	char *pDelim = NULL;
+	size_t n;
+
+	if(pThis->eFraming == TCP_FRAMING_OCTET_COUNTING) {
+		if(pThis->iOctetsRemain < 1)
+			return 0;
+		pStop = pData + (((size_t) pThis->iOctetsRemain < iLen) ? (size_t) pThis->iOctetsRemain : iLen);
+	} else {
+		if(!pThis->pSrv->bDisableLFDelim)
+			pDelim = memchr(pData, '\n', iLen);
+		if(pThis->pSrv->addtlFrameDelim != TCPSRV_NO_ADDTL_DELIMITER) {
+			pStop = memchr(pData, pThis->pSrv->addtlFrameDelim,
+				       ((pDelim == NULL) ? iLen : (size_t) (pDelim - pData)));
+			if(pStop != NULL)
+				pDelim = pStop;
+		}
+		pStop = (pDelim == NULL) ? pData + iLen : pDelim;
+	}
+
+	while(pData < pStop) {
+		if(pThis->iMsg >= iMaxLine) {
+			DBGPRINTF("error: message received is larger than max msg size, we split it\n");
+			defaultDoSubmitMessage(pThis, stTime, ttGenTime, pMultiSub);
+		}
+		n = pStop - pData;
+		if(n > (size_t) (iMaxLine - pThis->iMsg))
+			n = iMaxLine - pThis->iMsg;
+		memcpy(pThis->pMsg + pThis->iMsg, pData, n);
+		pThis->iMsg += n;
+		pData += n;
+	}
+
+	if(pThis->eFraming == TCP_FRAMING_OCTET_COUNTING) {
+		pThis->iOctetsRemain -= pData - pStart;
+		if(pThis->iOctetsRemain < 1) {
+			defaultDoSubmitMessage(pThis, stTime, ttGenTime, pMultiSub);
+			pThis->inputState = eAtStrtFram;
+		}
+	} else if(pDelim != NULL) {
+		defaultDoSubmitMessage(pThis, stTime, ttGenTime, pMultiSub);
+		pThis->inputState = eAtStrtFram;
+		++pData; /* the delimiter itself */
+	}
+
+	return pData - pStart;
+}
+
+
 /* Processes the data received via a TCP session. If there
  * is no other way to handle it, data is discarded.
  * Input parameter data is the data received, iLen is its
@@ -461,6 +529,8 @@ DataRcvd(tcps_sess_t *pThis, char *pData, size_t iLen)
 	struct syslogTime stTime;
 	time_t ttGenTime;
 	char *pEnd;
+	size_t nUsed;
+	int iMaxLine;
 	DEFiRet;
 
 	ISOBJ_TYPE_assert(pThis, tcps_sess);
@@ -474,8 +544,15 @@ DataRcvd(tcps_sess_t *pThis, char *pData, size_t iLen)
 
 	 /* We now copy the message to the session buffer. */
 	pEnd = pData + iLen; /* this is one off, which is intensional */
+	iMaxLine = glbl.GetMaxLine();
 
 	while(pData < pEnd) {
+		if(   pThis->inputState == eInMsg
+		   && (nUsed = processDataRcvdBulk(pThis, pData, pEnd - pData, iMaxLine,
+						   &stTime, ttGenTime, &multiSub)) > 0) {
+			pData += nUsed;
+			continue;
+		}
 		CHKiRet(processDataRcvd(pThis, *pData++, &stTime, ttGenTime, &multiSub));
 	}
 	iRet = multiSubmitFlush(&multiSub);
@@ -45,6 +45,7 @@ struct tcps_sess_s {
 	int iOctetsRemain;	/* Number of Octets remaining in message */
 	TCPFRAMINGMODE eFraming;
 	uchar *pMsg;		/* message (fragment) received */
+	size_t lenMsgBuf;	/* allocated size of pMsg (for memory accounting) */
 	prop_t *fromHost;	/* host name we received messages from */
 	prop_t *fromHostIP;
 	void *pUsr;		/* a user-pointer */
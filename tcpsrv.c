@@ -74,6 +74,8 @@
 #include "ruleset.h"
 #include "ratelimit.h"
 #include "unicode-helper.h"
+#include "trace.h"
+#include "rsprobe.h"
 
 
 MODULE_TYPE_LIB
@@ -114,6 +116,21 @@ static struct wrkrInfo_s {
 	long long unsigned numCalled;	/* how often was this called */
 } wrkrInfo[4];
 static sbool bWrkrRunning; /* are the worker threads running? */
+
+/* If a server is configured with iNumWrkr > 0, it does not use the shared
+ * pool above. Instead, each of its workers waits on an nspoll instance of
+ * its own and processes the sessions pinned to it. The thread calling Run()
+ * then only handles the listeners and distributes new sessions round-robin,
+ * so there is no per-event handoff via wrkrMut.
+ */
+struct tcpsrvWrkr_s {
+	pthread_t tid;
+	tcpsrv_t *pSrv;
+	nspoll_t *pPoll;
+	sbool bThrdStarted;
+	volatile sbool bStop;		/* set to make the worker terminate */
+	long long unsigned numCalled;	/* how many events were processed */
+};
 static pthread_mutex_t wrkrMut;
 static pthread_cond_t wrkrIdle;
 static int wrkrMax = 4;
@@ -490,9 +507,12 @@ SessAccept(tcpsrv_t *pThis, tcpLstnPortList_t *pLstnInfo, tcps_sess_t **ppSess,
 	if(!pThis->bUsingEPoll)
 		pThis->pSessions[iSess] = pSess;
 	pSess = NULL; /* this is now also handed over */
+	TRACE(TRC_NET, "tcpsrv %p: session %p accepted", (intptr_t) pThis, (intptr_t) *ppSess);
+	RS_PROBE(tcp_accept, pThis, *ppSess);
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
+		TRACE(TRC_NET, "tcpsrv %p: session accept failed, iRet %d", (intptr_t) pThis, iRet);
 		if(pSess != NULL)
 			tcps_sess.Destruct(&pSess);
 		if(pNewStrm != NULL)
@@ -523,6 +543,8 @@ closeSess(tcpsrv_t *pThis, tcps_sess_t **ppSess, nspoll_t *pPoll) {
 	if(pPoll != NULL) {
 		CHKiRet(nspoll.Ctl(pPoll, (*ppSess)->pStrm, 0, *ppSess, NSDPOLL_IN, NSDPOLL_DEL));
 	}
+	TRACE(TRC_NET, "tcpsrv %p: closing session %p", (intptr_t) pThis, (intptr_t) *ppSess);
+	RS_PROBE(tcp_close, pThis, *ppSess);
 	pThis->pOnRegularClose(*ppSess);
 	tcps_sess.Destruct(ppSess);
 finalize_it:
@@ -718,6 +740,97 @@ finalize_it:
 }
 
 
+/* session worker for per-worker poll mode. We wake up once a second to
+ * check for termination, as only the Run() thread is interrupted by the core.
+ */
+static void *
+srvWrkr(void *myself)
+{
+	struct tcpsrvWrkr_s *me = (struct tcpsrvWrkr_s*) myself;
+	nsd_epworkset_t workset[128];
+	int numEntries;
+	int i;
+
+	while(!me->bStop && glbl.GetGlobalInputTermState() == 0) {
+		numEntries = sizeof(workset)/sizeof(nsd_epworkset_t);
+		if(nspoll.Wait(me->pPoll, 1000, &numEntries, workset) != RS_RET_OK)
+			continue;
+		for(i = 0 ; i < numEntries && glbl.GetGlobalInputTermState() == 0 ; ++i) {
+			processWorksetItem(me->pSrv, me->pPoll, workset[i].id, workset[i].pUsr);
+		}
+		me->numCalled += numEntries;
+	}
+	return NULL;
+}
+
+
+/* stop the per-worker poll workers of a server and free their resources */
+static void
+stopSrvWrkrs(tcpsrv_t *pThis)
+{
+	int i;
+
+	if(pThis->pWrkrs == NULL)
+		return;
+	for(i = 0 ; i < pThis->iNumWrkr ; ++i)
+		pThis->pWrkrs[i].bStop = 1;
+	for(i = 0 ; i < pThis->iNumWrkr ; ++i) {
+		if(pThis->pWrkrs[i].bThrdStarted) {
+			pthread_join(pThis->pWrkrs[i].tid, NULL);
+			DBGPRINTF("tcpsrv: info: session worker %d processed %llu events\n",
+				  i, pThis->pWrkrs[i].numCalled);
+		}
+		if(pThis->pWrkrs[i].pPoll != NULL)
+			nspoll.Destruct(&pThis->pWrkrs[i].pPoll);
+	}
+	free(pThis->pWrkrs);
+	pThis->pWrkrs = NULL;
+}
+
+
+/* start the per-worker poll workers of a server. Each one gets its own
+ * nspoll instance, using the same driver as the listeners.
+ */
+static rsRetVal
+startSrvWrkrs(tcpsrv_t *pThis)
+{
+	struct tcpsrvWrkr_s *pWrkr;
+	pthread_attr_t sessThrdAttr;
+	int i;
+	DEFiRet;
+
+	pthread_attr_init(&sessThrdAttr);
+	pthread_attr_setstacksize(&sessThrdAttr, 4096*1024);
+	CHKmalloc(pThis->pWrkrs = calloc(pThis->iNumWrkr, sizeof(struct tcpsrvWrkr_s)));
+	for(i = 0 ; i < pThis->iNumWrkr ; ++i) {
+		pWrkr = &pThis->pWrkrs[i];
+		pWrkr->pSrv = pThis;
+		CHKiRet(nspoll.Construct(&pWrkr->pPoll));
+		if(pThis->pszDrvrName != NULL)
+			CHKiRet(nspoll.SetDrvrName(pWrkr->pPoll, pThis->pszDrvrName));
+		CHKiRet(nspoll.ConstructFinalize(pWrkr->pPoll));
+	}
+
+	for(i = 0 ; i < pThis->iNumWrkr ; ++i) {
+		if(pthread_create(&pThis->pWrkrs[i].tid, &sessThrdAttr, srvWrkr, &pThis->pWrkrs[i]) != 0) {
+			char errStr[1024];
+			rs_strerror_r(errno, errStr, sizeof(errStr));
+			errmsg.LogError(0, NO_ERRCODE, "tcpsrv error creating session worker %d: "
+					"%s", i, errStr);
+			ABORT_FINALIZE(RS_RET_ERR);
+		}
+		pThis->pWrkrs[i].bThrdStarted = 1;
+	}
+	DBGPRINTF("tcpsrv: started %d session workers with own poll sets\n", pThis->iNumWrkr);
+
+finalize_it:
+	pthread_attr_destroy(&sessThrdAttr);
+	if(iRet != RS_RET_OK)
+		stopSrvWrkrs(pThis);
+	RETiRet;
+}
+
+
 /* This function is called to gather input.
  * This variant here is only used if we need to work with a netstream driver
  * that does not support epoll().
@@ -841,6 +954,7 @@ Run(tcpsrv_t *pThis)
 	int i;
 	nsd_epworkset_t workset[128]; /* 128 is currently fixed num of concurrent requests */
 	int numEntries;
+	int iNextWrkr = 0;
 	nspoll_t *pPoll = NULL;
 	rsRetVal localRet;
 
@@ -877,6 +991,11 @@ Run(tcpsrv_t *pThis)
 	/* flag that we are in epoll mode */
 	pThis->bUsingEPoll = RSTRUE;
 
+	if(pThis->iNumWrkr > 0 && startSrvWrkrs(pThis) != RS_RET_OK) {
+		errmsg.LogError(0, RS_RET_ERR, "tcpsrv: could not start session workers, "
+				"using shared worker pool instead");
+	}
+
 	/* Add the TCP listen sockets to the list of sockets to monitor */
 	for(i = 0 ; i < pThis->iLstnCurr ; ++i) {
 		DBGPRINTF("Trying to add listener %d, pUsr=%p\n", i, pThis->ppLstn);
@@ -897,7 +1016,16 @@ Run(tcpsrv_t *pThis)
 		if(localRet != RS_RET_OK)
 			continue;
 
-		processWorkset(pThis, pPoll, numEntries, workset);
+		if(pThis->pWrkrs != NULL) {
+			/* only listeners are in our set - hand new sessions to the workers */
+			for(i = 0 ; i < numEntries ; ++i) {
+				processWorksetItem(pThis, pThis->pWrkrs[iNextWrkr].pPoll,
+						   workset[i].id, workset[i].pUsr);
+				iNextWrkr = (iNextWrkr + 1) % pThis->iNumWrkr;
+			}
+		} else {
+			processWorkset(pThis, pPoll, numEntries, workset);
+		}
 	}
 
 	/* remove the tcp listen sockets from the epoll set */
@@ -906,6 +1034,7 @@ Run(tcpsrv_t *pThis)
 	}
 
 finalize_it:
+	stopSrvWrkrs(pThis);
 	if(pPoll != NULL)
 		nspoll.Destruct(&pPoll);
 	RETiRet;
@@ -924,6 +1053,8 @@ BEGINobjConstruct(tcpsrv) /* be sure to specify the object type also in END macr
 	pThis->ratelimitBurst = 10000;
 	pThis->bUseFlowControl = 1;
 	pThis->pszDrvrName = NULL;
+	pThis->iNumWrkr = 0;
+	pThis->pWrkrs = NULL;
 ENDobjConstruct(tcpsrv)
 
 
@@ -943,6 +1074,7 @@ tcpsrvConstructFinalize(tcpsrv_t *pThis)
 		CHKiRet(netstrms.SetDrvrAuthMode(pThis->pNS, pThis->pszDrvrAuthMode));
 	if(pThis->pPermPeers != NULL)
 		CHKiRet(netstrms.SetDrvrPermPeers(pThis->pNS, pThis->pPermPeers));
+	CHKiRet(netstrms.SetDrvrFastOpen(pThis->pNS, pThis->iFastOpen));
 	CHKiRet(netstrms.ConstructFinalize(pThis->pNS));
 
 	/* set up listeners */
@@ -1200,6 +1332,28 @@ finalize_it:
 	RETiRet;
 }
 
+/* set the number of session workers with their own poll set. 0 means
+ * the sessions are handled via the shared worker pool.
+ */
+static rsRetVal
+SetNumWrkr(tcpsrv_t *pThis, int nWrkr)
+{
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, tcpsrv);
+	pThis->iNumWrkr = nWrkr;
+	RETiRet;
+}
+
+/* set the TCP Fast Open queue length for our listeners, 0 disables it */
+static rsRetVal
+SetFastOpen(tcpsrv_t *pThis, int iQLen)
+{
+	DEFiRet;
+	ISOBJ_TYPE_assert(pThis, tcpsrv);
+	pThis->iFastOpen = iQLen;
+	RETiRet;
+}
+
 /* set the driver authentication mode -- rgerhards, 2008-05-19 */
 static rsRetVal
 SetDrvrAuthMode(tcpsrv_t *pThis, uchar *mode)
@@ -1303,6 +1457,8 @@ CODESTARTobjQueryInterface(tcpsrv)
 	pIf->SetDrvrMode = SetDrvrMode;
 	pIf->SetDrvrAuthMode = SetDrvrAuthMode;
 	pIf->SetDrvrName = SetDrvrName;
+	pIf->SetNumWrkr = SetNumWrkr;
+	pIf->SetFastOpen = SetFastOpen;
 	pIf->SetDrvrPermPeers = SetDrvrPermPeers;
 	pIf->SetCBIsPermittedHost = SetCBIsPermittedHost;
 	pIf->SetCBOpenLstnSocks = SetCBOpenLstnSocks;
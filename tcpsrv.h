@@ -69,6 +69,9 @@ struct tcpsrv_s {
 	tcpLstnPortList_t **ppLstnPort; /**< pointer to relevant listen port description */
 	int iLstnMax;		/**< max number of listeners supported */
 	int iSessMax;		/**< max number of sessions supported */
+	int iNumWrkr;		/**< number of session workers with own nspoll, 0 = use shared pool */
+	int iFastOpen;		/**< TCP Fast Open queue length for the listeners, 0 = off */
+	struct tcpsrvWrkr_s *pWrkrs; /**< these workers, only while running */
 	uchar dfltTZ[8];	/**< default TZ if none in timestamp; '\0' =No Default */
 	tcpLstnPortList_t *pLstnPorts;	/**< head pointer for listen ports */
 
@@ -153,8 +156,12 @@ BEGINinterface(tcpsrv) /* name must also be changed in ENDinterface macro! */
 	rsRetVal (*SetDfltTZ)(tcpsrv_t *pThis, uchar *dfltTZ);
 	/* added v15 -- rgerhards, 2013-09-17 */
 	rsRetVal (*SetDrvrName)(tcpsrv_t *pThis, uchar *pszName);
+	/* added v16 */
+	rsRetVal (*SetNumWrkr)(tcpsrv_t *pThis, int nWrkr);
+	/* added v17 */
+	rsRetVal (*SetFastOpen)(tcpsrv_t *pThis, int iQLen);
 ENDinterface(tcpsrv)
-#define tcpsrvCURR_IF_VERSION 15 /* increment whenever you change the interface structure! */
+#define tcpsrvCURR_IF_VERSION 17 /* increment whenever you change the interface structure! */
 /* change for v4:
  * - SetAddtlFrameDelim() added -- rgerhards, 2008-12-10
  * - SetInputName() added -- rgerhards, 2008-12-10
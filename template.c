@@ -46,6 +46,8 @@
 #include "rsconf.h"
 #include "msg.h"
 #include "unicode-helper.h"
+#include "strscan.h"
+#include "hashmap.h"
 
 /* static data */
 DEFobjCurrIf(obj)
@@ -132,6 +134,11 @@ finalize_it:
 }
 
 
+/* max number of property values tplToString() obtains before it checks
+ * the buffer size.
+ */
+#define TPL_MAX_VALS 32
+
 /* This functions converts a template into a string.
  *
  * The function takes a pointer to a template and a pointer to a msg object
@@ -149,11 +156,21 @@ tplToString(struct template *__restrict__ const pTpl,
 	    struct syslogTime *const ttNow)
 {
 	DEFiRet;
-	struct templateEntry *__restrict__ pTpe;
+	struct tplOp *pOp;
 	size_t iBuf;
+	size_t lenNeeded;
+	int iOp, iEnd;
+	int i, nVals;
+	struct {
+		uchar *pVal;
+		rs_size_t iLenVal;
+		unsigned short bMustBeFreed;
+		sbool bJSONf;	/* still needs to be rendered as JSON field */
+	} vals[TPL_MAX_VALS];
 	unsigned short bMustBeFreed = 0;
 	uchar *pVal;
 	rs_size_t iLenVal = 0;
+	rsRetVal localRet;
 
 	if(pTpl->pStrgen != NULL) {
 		CHKiRet(pTpl->pStrgen(pMsg, iparam));
@@ -175,50 +192,85 @@ tplToString(struct template *__restrict__ const pTpl,
 		FINALIZE;
 	}
 	
-	/* we have a "regular" template with template entries */
-
-	/* loop through the template. We obtain one value
-	 * and copy it over to our dynamic string buffer. Then, we
-	 * free the obtained value (if requested). We continue this
-	 * loop until we got hold of all values.
+	/* we have a "regular" template, so we process its compiled form. We
+	 * first obtain the values of up to TPL_MAX_VALS properties, so that
+	 * we know how much space they need together with the constants in
+	 * between them. That way, the buffer needs to be checked (and, if
+	 * need be, extended) only once for all of them. Then we copy over
+	 * and free the values (if requested). For the usual templates, this
+	 * means a single buffer check per message.
 	 */
-	pTpe = pTpl->pEntryRoot;
 	iBuf = 0;
-	while(pTpe != NULL) {
-		if(pTpe->eEntryType == CONSTANT) {
-			pVal = (uchar*) pTpe->data.constant.pConstant;
-			iLenVal = pTpe->data.constant.iLenConstant;
-			bMustBeFreed = 0;
-		} else 	if(pTpe->eEntryType == FIELD) {
-			pVal = (uchar*) MsgGetProp(pMsg, pTpe, &pTpe->data.field.msgProp,
-						   &iLenVal, &bMustBeFreed, ttNow);
+	iOp = 0;
+	while(iOp < pTpl->nOps) {
+		lenNeeded = 0;
+		nVals = 0;
+		for(iEnd = iOp ; iEnd < pTpl->nOps ; ++iEnd) {
+			pOp = &pTpl->pOps[iEnd];
+			if(pOp->pTpe == NULL) {
+				lenNeeded += pOp->lenConst;
+				continue;
+			}
+			if(nVals == TPL_MAX_VALS)
+				break;
+			vals[nVals].bJSONf = 0;
+			if(pOp->bJSONf)
+				pVal = (uchar*) MsgGetPropDeferJSONf(pMsg, pOp->pTpe,
+						   &pOp->pTpe->data.field.msgProp, &iLenVal,
+						   &bMustBeFreed, ttNow, &vals[nVals].bJSONf);
+			else
+				pVal = (uchar*) MsgGetProp(pMsg, pOp->pTpe, &pOp->pTpe->data.field.msgProp,
+							   &iLenVal, &bMustBeFreed, ttNow);
 			/* we now need to check if we should use SQL option. In this case,
 			 * we must go over the generated string and escape '\'' characters.
 			 * rgerhards, 2005-09-22: the option values below look somewhat misplaced,
 			 * but they are handled in this way because of legacy (don't break any
 			 * existing thing).
 			 */
-			if(pTpl->optFormatEscape == SQL_ESCAPE)
-				doEscape(&pVal, &iLenVal, &bMustBeFreed, SQL_ESCAPE);
-			else if(pTpl->optFormatEscape == JSON_ESCAPE)
-				doEscape(&pVal, &iLenVal, &bMustBeFreed, JSON_ESCAPE);
-			else if(pTpl->optFormatEscape == STDSQL_ESCAPE)
-				doEscape(&pVal, &iLenVal, &bMustBeFreed, STDSQL_ESCAPE);
-		}
-		/* got source, now copy over */
-		if(iLenVal > 0) { /* may be zero depending on property */
-			/* first, make sure buffer fits */
-			if(iBuf + iLenVal >= iparam->lenBuf) /* we reserve one char for the final \0! */
-				CHKiRet(ExtendBuf(iparam, iBuf + iLenVal + 1));
-
-			memcpy(iparam->param + iBuf, pVal, iLenVal);
-			iBuf += iLenVal;
+			if(pTpl->optFormatEscape != NO_ESCAPE)
+				doEscape(&pVal, &iLenVal, &bMustBeFreed, pTpl->optFormatEscape);
+			vals[nVals].pVal = pVal;
+			vals[nVals].iLenVal = iLenVal;
+			vals[nVals].bMustBeFreed = bMustBeFreed;
+			/* JSON fields are rendered later, but we need their exact size now */
+			lenNeeded += vals[nVals].bJSONf ? jsonFieldLen(pOp->pTpe, pVal, iLenVal)
+							: (size_t) iLenVal;
+			++nVals;
 		}
 
-		if(bMustBeFreed)
-			free(pVal);
-
-		pTpe = pTpe->pNext;
+		/* make sure buffer fits - we reserve one char for the final \0! */
+		if(iBuf + lenNeeded >= iparam->lenBuf)
+			localRet = ExtendBuf(iparam, iBuf + lenNeeded + 1);
+		else
+			localRet = RS_RET_OK;
+
+		for(i = 0 ; iOp < iEnd ; ++iOp) {
+			pOp = &pTpl->pOps[iOp];
+			if(pOp->pTpe == NULL) {
+				pVal = pOp->pConst;
+				iLenVal = pOp->lenConst;
+				bMustBeFreed = 0;
+			} else {
+				pVal = vals[i].pVal;
+				iLenVal = vals[i].iLenVal;
+				bMustBeFreed = vals[i].bMustBeFreed;
+				if(vals[i++].bJSONf) {
+					if(localRet == RS_RET_OK)
+						iBuf += jsonFieldRender(pOp->pTpe, iparam->param + iBuf,
+									pVal, iLenVal);
+					if(bMustBeFreed)
+						free(pVal);
+					continue;
+				}
+			}
+			if(localRet == RS_RET_OK && iLenVal > 0) { /* may be zero depending on property */
+				memcpy(iparam->param + iBuf, pVal, iLenVal);
+				iBuf += iLenVal;
+			}
+			if(bMustBeFreed)
+				free(pVal);
+		}
+		CHKiRet(localRet);
 	}
 
 	if(iBuf == iparam->lenBuf) {
@@ -231,8 +283,15 @@ tplToString(struct template *__restrict__ const pTpl,
 	}
 	iparam->param[iBuf] = '\0';
 	iparam->lenStr = iBuf;
-	
+
 finalize_it:
+	if(iRet != RS_RET_OK && iparam->param != NULL) {
+		/* do not leave a partial or stale string behind, as the
+		 * caller may still pass the buffer on to the action.
+		 */
+		iparam->param[0] = '\0';
+		iparam->lenStr = 0;
+	}
 	RETiRet;
 }
 
@@ -430,64 +489,75 @@ rsRetVal
 doEscape(uchar **pp, rs_size_t *pLen, unsigned short *pbMustBeFreed, int mode)
 {
 	DEFiRet;
-	uchar *p = NULL;
-	int iLen;
-	cstr_t *pStrB = NULL;
+	uchar *p;
+	uchar c1, c2;
+	uchar cEsc;
+	size_t iLen;
+	size_t i, n;
+	size_t nEsc;
 	uchar *pszGenerated;
+	uchar *pDst;
 
 	assert(pp != NULL);
 	assert(*pp != NULL);
 	assert(pLen != NULL);
 	assert(pbMustBeFreed != NULL);
 
-	/* first check if we need to do anything at all... */
-	if(mode == STDSQL_ESCAPE)
-		for(p = *pp ; *p && *p != '\'' ; ++p)
-			;
-	else if(mode == SQL_ESCAPE)
-		for(p = *pp ; *p && *p != '\'' && *p != '\\' ; ++p)
-			;
-	else if(mode == JSON_ESCAPE)
-		for(p = *pp ; *p && *p != '"' ; ++p)
-			;
-	/* when we get out of the loop, we are either at the
-	 * string terminator or the first character to escape */
-	if(p && *p == '\0')
-		FINALIZE; /* nothing to do in this case! */
+	switch(mode) {
+	case STDSQL_ESCAPE:
+		c1 = c2 = '\'';
+		cEsc = '\'';
+		break;
+	case SQL_ESCAPE:
+		c1 = '\'';
+		c2 = '\\';
+		cEsc = '\\';
+		break;
+	case JSON_ESCAPE:
+		c1 = c2 = '"';
+		cEsc = '\\';
+		break;
+	default:
+		FINALIZE; /* nothing to escape */
+	}
 
+	/* first check if we need to do anything at all... The scanner
+	 * skips the leading run of "clean" characters in bulk.
+	 */
 	p = *pp;
 	iLen = *pLen;
-	CHKiRet(cstrConstruct(&pStrB));
+	i = strscanNotAnyOf3(p, iLen, c1, c2, c2);
+	if(i == iLen)
+		FINALIZE; /* nothing to do in this case! */
 
-	while(*p) {
-		if((mode == SQL_ESCAPE || mode == STDSQL_ESCAPE) && *p == '\'') {
-			CHKiRet(cstrAppendChar(pStrB, (mode == STDSQL_ESCAPE) ? '\'' : '\\'));
-			iLen++;	/* reflect the extra character */
-		} else if((mode == SQL_ESCAPE) && *p == '\\') {
-			CHKiRet(cstrAppendChar(pStrB, '\\'));
-			iLen++;	/* reflect the extra character */
-		} else if((mode == JSON_ESCAPE) && *p == '"') {
-			CHKiRet(cstrAppendChar(pStrB, '\\'));
-			iLen++;	/* reflect the extra character */
-		}
-		CHKiRet(cstrAppendChar(pStrB, *p));
-		++p;
+	/* count what needs to be escaped, so that we know the final size */
+	for(nEsc = 0 ; i < iLen ; i += 1 + strscanNotAnyOf3(p + i + 1, iLen - i - 1, c1, c2, c2))
+		++nEsc;
+
+	CHKmalloc(pszGenerated = MALLOC(iLen + nEsc + 1));
+	pDst = pszGenerated;
+	for(i = 0 ; i < iLen ; ) {
+		n = strscanNotAnyOf3(p + i, iLen - i, c1, c2, c2);
+		memcpy(pDst, p + i, n);
+		pDst += n;
+		i += n;
+		if(i == iLen)
+			break;
+		*pDst++ = cEsc;
+		*pDst++ = p[i++];
 	}
-	CHKiRet(cstrFinalize(pStrB));
-	CHKiRet(cstrConvSzStrAndDestruct(pStrB, &pszGenerated, 0));
+	*pDst = '\0';
 
 	if(*pbMustBeFreed)
 		free(*pp); /* discard previous value */
 
 	*pp = pszGenerated;
-	*pLen = iLen;
+	*pLen = iLen + nEsc;
 	*pbMustBeFreed = 1;
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
 		doEmergencyEscape(*pp, mode);
-		if(pStrB != NULL)
-			cstrDestruct(&pStrB);
 	}
 
 	RETiRet;
@@ -523,6 +593,58 @@ struct templateEntry* tpeConstruct(struct template *pTpl)
 }
 
 
+/* (re)build the template name index from the template list. Only the
+ * first template of a name is indexed, just like tplFind() would find it.
+ * On failure, there is no index and tplFind() searches the list.
+ */
+static void
+tplHashRebuild(rsconf_t *conf)
+{
+	struct template *pTpl;
+	char *key;
+
+	if(hashmapConstruct(&conf->templates.ht, 256, 0, hashmapHashString,
+	   hashmapKeyEqualsString, free, NULL) != RS_RET_OK) {
+		conf->templates.ht = NULL;
+		return;
+	}
+	for(pTpl = conf->templates.root ; pTpl != NULL ; pTpl = pTpl->pNext) {
+		if(pTpl->pszName == NULL || pTpl->pszName[0] == '\0'
+		   || hashmapSearch(conf->templates.ht, pTpl->pszName) != NULL)
+			continue;
+		if((key = strdup(pTpl->pszName)) == NULL
+		   || hashmapInsert(conf->templates.ht, key, pTpl) != RS_RET_OK) {
+			free(key);
+			hashmapDestruct(&conf->templates.ht);
+			return;
+		}
+	}
+}
+
+
+/* add a template to the name index, must be called once its name is
+ * set. The index holds its own copy of the name, as invalid templates
+ * are made defunct by overwriting their name.
+ */
+static void
+tplHashAdd(rsconf_t *conf, struct template *pTpl)
+{
+	char *key;
+
+	if(conf->templates.ht == NULL) {
+		tplHashRebuild(conf);
+		return;
+	}
+	if(hashmapSearch(conf->templates.ht, pTpl->pszName) != NULL)
+		return; /* the first one wins */
+	if((key = strdup(pTpl->pszName)) == NULL
+	   || hashmapInsert(conf->templates.ht, key, pTpl) != RS_RET_OK) {
+		free(key);
+		hashmapDestruct(&conf->templates.ht);
+	}
+}
+
+
 /* Constructs a template list object. Returns pointer to it
  * or NULL (if it fails).
  */
@@ -535,6 +657,7 @@ tplConstruct(rsconf_t *conf)
 	
 	/* basic initialisation is done via calloc() - need to
 	 * initialize only values != 0. */
+	pTpl->iCacheSlot = -1;
 
 	if(conf->templates.last == NULL)	{
 		/* we are the first element! */
@@ -548,6 +671,88 @@ tplConstruct(rsconf_t *conf)
 }
 
 
+/* Compile the template entry list into the flat op array used by
+ * tplToString(). Adjacent constants are merged into one. This must be
+ * called after all entries have been added to the template.
+ */
+static rsRetVal
+tplCompile(struct template *pTpl)
+{
+	struct templateEntry *pTpe;
+	struct tplOp *pOp;
+	int nOps = 0;
+	int lenConst = 0;
+	int bPrevConst = 0;
+	uchar *pConst;
+	DEFiRet;
+
+	for(pTpe = pTpl->pEntryRoot ; pTpe != NULL ; pTpe = pTpe->pNext) {
+		if(pTpe->eEntryType == CONSTANT) {
+			if(!bPrevConst)
+				++nOps;
+			lenConst += pTpe->data.constant.iLenConstant;
+			bPrevConst = 1;
+		} else if(pTpe->eEntryType == FIELD) {
+			++nOps;
+			bPrevConst = 0;
+		}
+	}
+
+	CHKmalloc(pTpl->pOps = calloc(nOps + 1, sizeof(struct tplOp)));
+	CHKmalloc(pTpl->pConstBuf = malloc(lenConst + 1));
+	pConst = pTpl->pConstBuf;
+	pOp = NULL;
+	for(pTpe = pTpl->pEntryRoot ; pTpe != NULL ; pTpe = pTpe->pNext) {
+		if(pTpe->eEntryType == CONSTANT) {
+			if(pOp == NULL || pOp->pTpe != NULL) {
+				pOp = (pOp == NULL) ? pTpl->pOps : pOp + 1;
+				pOp->pConst = pConst;
+			}
+			memcpy(pConst, pTpe->data.constant.pConstant, pTpe->data.constant.iLenConstant);
+			pConst += pTpe->data.constant.iLenConstant;
+			pOp->lenConst += pTpe->data.constant.iLenConstant;
+		} else if(pTpe->eEntryType == FIELD) {
+			pOp = (pOp == NULL) ? pTpl->pOps : pOp + 1;
+			pOp->pTpe = pTpe;
+			/* JSON fields are rendered straight into the output buffer,
+			 * unless the template escapes the complete value afterwards.
+			 */
+			pOp->bJSONf = pTpl->optFormatEscape == NO_ESCAPE
+				&& (pTpe->data.field.options.bJSONf || pTpe->data.field.options.bJSONfr);
+		}
+	}
+	pTpl->nOps = nOps;
+	DBGPRINTF("template '%s' compiled into %d ops (%d entries)\n", pTpl->pszName,
+		  nOps, pTpl->tpenElements);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* Check if the rendering of a template depends on the message only. Templates
+ * that use the current system time or global variables (which may be modified
+ * concurrently) may render differently for each action and must not be shared
+ * via the worker's render cache.
+ */
+sbool
+tplIsCacheable(struct template *pTpl)
+{
+	struct templateEntry *pTpe;
+	propid_t id;
+
+	for(pTpe = pTpl->pEntryRoot ; pTpe != NULL ; pTpe = pTpe->pNext) {
+		if(pTpe->eEntryType != FIELD)
+			continue;
+		id = pTpe->data.field.msgProp.id;
+		if(   (id >= PROP_SYS_NOW && id <= PROP_SYS_MINUTE)
+		   || id == PROP_SYS_UPTIME || id == PROP_GLOBAL_VAR)
+			return 0;
+	}
+	return 1;
+}
+
+
 /* helper to tplAddLine. Parses a constant and generates
  * the necessary structure.
  * Paramter "bDoEscapes" is to support legacy vs. v6+ config system. In
@@ -1208,6 +1413,7 @@ struct template *tplAddLine(rsconf_t *conf, char* pName, uchar** ppRestOfConfLin
 		 */
 	}
 	memcpy(pTpl->pszName, pName, pTpl->iLenName + 1);
+	tplHashAdd(conf, pTpl);
 
 	/* now actually parse the line */
 	p = *ppRestOfConfLine;
@@ -1315,6 +1521,11 @@ struct template *tplAddLine(rsconf_t *conf, char* pName, uchar** ppRestOfConfLin
 
 	*ppRestOfConfLine = p;
 
+	if(tplCompile(pTpl) != RS_RET_OK) {
+		*pTpl->pszName = '\0'; /* make template defunct, see above */
+		return NULL;
+	}
+
 	return(pTpl);
 }
 
@@ -1869,6 +2080,7 @@ tplProcessCnf(struct cnfobj *o)
 	}
 	pTpl->pszName = name;
 	pTpl->iLenName = lenName;
+	tplHashAdd(loadConf, pTpl);
 	
 	switch(tplType) {
 	case T_STRING:	p = tplStr;
@@ -1909,6 +2121,8 @@ tplProcessCnf(struct cnfobj *o)
 	else if(o_json)
 		pTpl->optFormatEscape = JSON_ESCAPE;
 
+	CHKiRet(tplCompile(pTpl));
+
 finalize_it:
 	free(tplStr);
 	if(pvals != NULL)
@@ -1940,6 +2154,15 @@ struct template *tplFind(rsconf_t *conf, char *pName, int iLenName)
 
 	assert(pName != NULL);
 
+	if(conf->templates.ht != NULL) {
+		pTpl = hashmapSearch(conf->templates.ht, pName);
+		if(pTpl == NULL || (pTpl->iLenName == iLenName && !strcmp(pTpl->pszName, pName)))
+			return pTpl;
+		/* the hashed template has been made defunct after it was added,
+		 * but there may be a later one with the same name.
+		 */
+	}
+
 	pTpl = conf->templates.root;
 	while(pTpl != NULL &&
 	      !(pTpl->iLenName == iLenName &&
@@ -1964,6 +2187,8 @@ void tplDeleteAll(rsconf_t *conf)
 	struct templateEntry *pTpe, *pTpeDel;
 	BEGINfunc
 
+	if(conf->templates.ht != NULL)
+		hashmapDestruct(&conf->templates.ht);
 	pTpl = conf->templates.root;
 	while(pTpl != NULL) {
 		/* dbgprintf("Delete Template: Name='%s'\n ", pTpl->pszName == NULL? "NULL" : pTpl->pszName);*/
@@ -2000,6 +2225,8 @@ void tplDeleteAll(rsconf_t *conf)
 		pTplDel = pTpl;
 		pTpl = pTpl->pNext;
 		free(pTplDel->pszName);
+		free(pTplDel->pOps);
+		free(pTplDel->pConstBuf);
 		if(pTplDel->bHaveSubtree)
 			msgPropDescrDestruct(&pTplDel->subtree);
 		free(pTplDel);
@@ -2021,6 +2248,9 @@ void tplDeleteNew(rsconf_t *conf)
 	if(conf->templates.root == NULL || conf->templates.lastStatic == NULL)
 		return;
 
+	/* the index is rebuilt from the remaining templates on next add */
+	if(conf->templates.ht != NULL)
+		hashmapDestruct(&conf->templates.ht);
 	pTpl = conf->templates.lastStatic->pNext;
 	conf->templates.lastStatic->pNext = NULL;
 	conf->templates.last = conf->templates.lastStatic;
@@ -2058,6 +2288,8 @@ void tplDeleteNew(rsconf_t *conf)
 		pTplDel = pTpl;
 		pTpl = pTpl->pNext;
 		free(pTplDel->pszName);
+		free(pTplDel->pOps);
+		free(pTplDel->pConstBuf);
 		if(pTplDel->bHaveSubtree)
 			msgPropDescrDestruct(&pTplDel->subtree);
 		free(pTplDel);
@@ -45,6 +45,11 @@ struct template {
 	int tpenElements; /* number of elements in templateEntry list */
 	struct templateEntry *pEntryRoot;
 	struct templateEntry *pEntryLast;
+	struct tplOp *pOps;	/* compiled form of the entry list, see tplCompile() */
+	int nOps;
+	uchar *pConstBuf;	/* storage for the merged constants of pOps */
+	int nStrUses;		/* number of actions using this template for string passing */
+	int iCacheSlot;		/* slot in the worker's render cache, -1 if not cached */
 	char optFormatEscape;	/* in text fields, */
 #	define NO_ESCAPE 0	/* 0 - do not escape, */
 #	define SQL_ESCAPE 1	/* 1 - escape "the MySQL way"  */
@@ -128,6 +133,17 @@ struct templateEntry {
 };
 
 
+/* a compiled template operation: either insert a property or a constant.
+ * Adjacent constants of the entry list are merged into a single one.
+ */
+struct tplOp {
+	struct templateEntry *pTpe;	/* property entry, NULL for constants */
+	uchar *pConst;			/* constant text (if pTpe == NULL) */
+	int lenConst;
+	sbool bJSONf;			/* render as JSON field directly into the output */
+};
+
+
 /* interfaces */
 BEGINinterface(tpl) /* name must also be changed in ENDinterface macro! */
 ENDinterface(tpl)
@@ -147,6 +163,7 @@ void tplPrintList(rsconf_t *conf);
 void tplLastStaticInit(rsconf_t *conf, struct template *tpl);
 rsRetVal ExtendBuf(actWrkrIParams_t *const iparam, const size_t iMinSize);
 int tplRequiresDateCall(struct template *pTpl);
+sbool tplIsCacheable(struct template *pTpl);
 /* note: if a compiler warning for undefined type tells you to look at this
  * code line below, the actual cause is that you currently MUST include template.h
  * BEFORE msg.h, even if your code file does not actually need it.
@@ -0,0 +1,14 @@
+# Test for action.workerautoscale. Each commit of the sink takes 100ms,
+# so a single worker needs 30 seconds for the 3000 messages. With
+# autoscaling, a worker is added every second while the backlog stays,
+# so the sink must be done in well below that.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[action-autoscale.sh\]: test action worker autoscaling
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup action-autoscale.conf
+source $srcdir/diag.sh injectmsg 0 3000
+source $srcdir/diag.sh wait-stats ": omtesting: received=3000 committed=3000 " 15
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh exit
@@ -0,0 +1,21 @@
+# Test for resume backoff and the circuit breaker. The sender forwards to a
+# port where nobody listens at first, so its resume attempts fail and the
+# breaker opens. Once the receiver is started, the breaker's probe must
+# succeed and all messages held back must arrive.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[action-circuitbreaker.sh\]: test resume backoff and circuit breaker
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup action-circuitbreaker_sender.conf 2
+source $srcdir/diag.sh tcpflood -m1000
+./msleep 6000 # resume attempts at 1, 2 and 4 seconds
+source $srcdir/diag.sh stats-check ": fwd: .*suspended=[1-9][0-9]* .*breaker.opened=[1-9]"
+source $srcdir/diag.sh startup action-circuitbreaker_rcvr.conf
+# the backoff is capped at 4 seconds
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 1000 20
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 999
+source $srcdir/diag.sh exit
@@ -0,0 +1,53 @@
+# Test coalescing of duplicate messages (action.coalesce.*):
+#  - batch mode: every message is accounted for in the output, either on
+#    its own or in the $!coalesced count of the message that represents it
+#  - window mode: only the first message of each key is passed on, the
+#    duplicates after it are only counted
+#  - the count is set on a copy, other actions see the original
+#  - with a direct action queue, coalescing is ignored with a warning
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[action-coalesce.sh\]: test action.coalesce.template and action.coalesce.window
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup action-coalesce.conf
+./tcpflood -m500 -M "<13>Oct 15 12:00:00 host tag: dup keyA"
+./tcpflood -m500 -M "<13>Oct 15 12:00:00 host tag: dup keyB"
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+
+# batch mode: the counts must add up, and duplicates must have been dropped
+awk -F'|' '{ n[$1] += ($2 == "") ? 1 : $2; ++lines } END {
+	if(n[" dup keyA"] != 500 || n[" dup keyB"] != 500 || lines >= 1000) {
+		for(k in n) printf("%s: %d\n", k, n[k]);
+		printf("%d lines\n", lines);
+		exit 1 } }' rsyslog.out.batch.log
+if [ "$?" -ne "0" ]; then
+  echo "batch mode coalescing failed"
+  exit 1
+fi
+
+# window mode: one message per key, the count would only come with the
+# next message after the window, which never arrives
+cmp rsyslog.out.window.log $srcdir/resultdata/action-coalesce-window.log
+if [ ! $? -eq 0 ]; then
+  echo "window mode coalescing failed, output:"
+  cat rsyslog.out.window.log
+  exit 1
+fi
+
+# the other actions must see all messages, without $!coalesced
+if [ `grep -c "^ dup key[AB]|$" rsyslog.out.orig.log` -ne 1000 ]; then
+  echo "other actions did not get the original messages"
+  sort rsyslog.out.orig.log | uniq -c
+  exit 1
+fi
+if [ `grep -c "^ dup key[AB]|$" rsyslog.out.direct.log` -ne 1000 ]; then
+  echo "coalescing with a direct queue was not ignored"
+  sort rsyslog.out.direct.log | uniq -c
+  exit 1
+fi
+if [ `grep -c "requires a non-direct action queue" rsyslog.out.warn.log` -ne 1 ]; then
+  echo "missing warning for coalescing with a direct queue"
+  exit 1
+fi
+source $srcdir/diag.sh exit
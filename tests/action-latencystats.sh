@@ -0,0 +1,26 @@
+# Test for action.latencystats. The sink action needs 5ms per commit,
+# so the commit latency histogram must record that and the batch size
+# histogram the size of the transactions.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[action-latencystats.sh\]: test action latency and batch size stats
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup action-latencystats.conf
+source $srcdir/diag.sh injectmsg 0 5000
+source $srcdir/diag.sh wait-queueempty
+./msleep 2500 # let impstats emit at least once after processing
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 4999
+source $srcdir/diag.sh stats-check ": sink: .*commit.latency.p50=[0-9]+ commit.latency.p99=[0-9]+ commit.latency.max=[0-9]+ commit.batchsize.p50=[0-9]+ commit.batchsize.p99=[0-9]+ commit.batchsize.max=[0-9]+"
+# 5ms per commit must show up as at least 4096us (the histogram bucket)
+source $srcdir/diag.sh stats-check ": sink: .*commit.latency.max=([4-9][0-9]{3}|[0-9]{5,}) "
+source $srcdir/diag.sh stats-check ": sink: .*commit.batchsize.max=([2-9]|[1-9][0-9]+) "
+# the file action does not ask for the stats, so it must not have them
+grep ": file: .*commit.latency" rsyslog.out.stats.log > /dev/null
+if [ $? -eq 0 ]; then
+  echo "error: latency stats present for action without action.latencystats:"
+  cat rsyslog.out.stats.log
+  exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,26 @@
+# Test action lingering (action.minbatch, action.lingertime). Messages
+# arrive at a moderate rate; a sink whose queue worker lingers for 100
+# messages must commit far fewer transactions than one that does not. A
+# single late message must still be committed once the linger time is
+# over.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[action-linger.sh\]: test action lingering for larger batches
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup action-linger.conf
+source $srcdir/diag.sh tcpflood -m1000 -o500
+source $srcdir/diag.sh wait-stats ': linger: received=1000 committed=1000 '
+source $srcdir/diag.sh wait-stats ': plain: received=1000 committed=1000 '
+source $srcdir/diag.sh tcpflood -m1 -i1000
+source $srcdir/diag.sh wait-stats ': linger: received=1001 committed=1001 ' 10
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+txlinger=$(grep -o ': linger: received=1000 committed=1000 transactions=[0-9]*' rsyslog.out.stats.log | \
+	tail -n1 | cut -d= -f4)
+txplain=$(grep -o ': plain: received=1000 committed=1000 transactions=[0-9]*' rsyslog.out.stats.log | \
+	tail -n1 | cut -d= -f4)
+if [ "$txlinger" -gt 20 ] || [ "$txplain" -le $((2 * txlinger)) ]; then
+	echo "error: $txlinger transactions with lingering, $txplain without"
+	exit 1
+fi
+source $srcdir/diag.sh exit
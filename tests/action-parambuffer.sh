@@ -0,0 +1,21 @@
+# Test for action.parambuffermax. Messages of random size are written by
+# an action that releases its template buffers when they grew beyond 1k
+# and by one that keeps them. Both outputs must be complete and identical,
+# so buffer reuse after a large message must not leak stale data.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[action-parambuffer.sh\]: test template buffer reuse in actions
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup action-parambuffer.conf
+source $srcdir/diag.sh tcpflood -m5000 -r -d30000 -P129
+sleep 2 # due to large messages, we need this time for the tcp receiver to settle...
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 4999 -E
+source $srcdir/diag.sh seq-check2 0 4999 -E
+cmp rsyslog.out.log rsyslog2.out.log
+if [ $? -ne 0 ]; then
+  echo "error: outputs differ"
+  exit 1
+fi
+source $srcdir/diag.sh exit
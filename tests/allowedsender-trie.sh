@@ -0,0 +1,27 @@
+# Test AllowedSenders ACL checks with IP prefixes and hostname entries.
+# TCP permits the loopback network among other networks and names, so
+# all TCP messages must arrive. The UDP list only holds entries that are
+# close to, but do not cover 127.0.0.1, so all UDP messages must be
+# discarded and a warning emitted.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[allowedsender-trie.sh\]: test AllowedSenders prefix matching
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup allowedsender-trie.conf
+./tcpflood -t 127.0.0.1 -m100 -i1000 -Tudp
+source $srcdir/diag.sh tcpflood -m1000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 1000
+./msleep 500 # UDP is asynchronous, make sure nothing arrives late
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 999
+if ! grep -q 'UDP message from disallowed sender discarded' rsyslog.out.err.log; then
+	echo "error: no warning for disallowed UDP sender"
+	exit 1
+fi
+if grep -q 'TCP message from disallowed sender' rsyslog.out.err.log; then
+	echo "error: permitted TCP sender rejected"
+	cat rsyslog.out.err.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,36 @@
+# Test a config with thousands of templates, rulesets and actions. The
+# objects are looked up by name when the config is loaded; rulesets are
+# called with names in a different case than they are defined with. All
+# messages must be written by the right action with the right template,
+# and the check run must report the config load time.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[config-manyobjects.sh\]: test config with many named objects
+source $srcdir/diag.sh init
+awk 'BEGIN {
+	for(i = 0 ; i < 4000 ; ++i)
+		printf("template(name=\"t%d\" type=\"string\" string=\"t%d %%msg:F,58:2%%\\n\")\n", i, i)
+	for(i = 0 ; i < 1000 ; ++i)
+		printf("ruleset(name=\"RS%d\") {\n\taction(type=\"omfile\" file=\"rsyslog.out.log\" template=\"t%d\")\n}\n",
+			i, 4 * i + 3)
+	printf("ruleset(name=\"main\") {\n\tset $.r = cnum(field($msg, 58, 2)) %% 1000;\n")
+	for(i = 0 ; i < 1000 ; ++i)
+		printf("\tif $.r == %d then call rs%d\n", i, i)
+	printf("}\n")
+}' > work-manyobjects.conf
+source $srcdir/diag.sh config-check config-manyobjects.conf 0
+source $srcdir/diag.sh check-errmsg "config loaded in [0-9]+ ms"
+source $srcdir/diag.sh startup config-manyobjects.conf
+source $srcdir/diag.sh tcpflood -m3000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 3000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+awk 'BEGIN { for(n = 0 ; n < 3000 ; ++n) printf("t%d %8.8d\n", 4 * (n % 1000) + 3, n) }' | \
+	sort > rsyslog.out.expected.log
+sort rsyslog.out.log > rsyslog.out.sorted.log
+if ! cmp rsyslog.out.expected.log rsyslog.out.sorted.log; then
+	echo "error: output differs from expected"
+	diff rsyslog.out.expected.log rsyslog.out.sorted.log | head -20
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,38 @@
+# Test for queue.workerthreadcpuset and the imudp cpuset parameter. The
+# main queue workers and the imudp workers must be bound to cpu 0, and an
+# invalid cpu list must be reported.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[cpuset.sh\]: test cpu affinity of queue and imudp workers
+if [ ! -d /proc/self/task ]; then
+    exit 77 # needs Linux /proc to check the affinity, skip this test
+fi
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check cpuset-invalid.conf 0
+source $srcdir/diag.sh check-errmsg "queue.workerthreadcpuset \"4-x\" is invalid"
+source $srcdir/diag.sh startup cpuset.conf
+./tcpflood -t 127.0.0.1 -m1000 -Tudp
+./msleep 500 # UDP is asynchronous, give the listener time to pick up everything
+source $srcdir/diag.sh wait-queueempty
+nq=0
+nudp=0
+for task in /proc/`cat rsyslog.pid`/task/*; do
+	case `cat $task/comm` in
+	"rs:main Q"*)	nq=$((nq + 1)) ;;
+	"imudp(w"*)	nudp=$((nudp + 1)) ;;
+	*)		continue ;;
+	esac
+	if [ "`grep Cpus_allowed_list $task/status | cut -f2`" != "0" ]; then
+		echo "error: thread `cat $task/comm` not bound to cpu 0:"
+		grep Cpus_allowed_list $task/status
+		exit 1
+	fi
+done
+if [ $nq -eq 0 ] || [ $nudp -ne 2 ]; then
+	echo "error: workers not found: $nq queue worker(s), $nudp imudp worker(s)"
+	exit 1
+fi
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 999
+source $srcdir/diag.sh exit
@@ -0,0 +1,24 @@
+# Test the parallel drain of a disk-assisted queue. The action queue is
+# small, so a burst of messages goes to disk, which is then drained by
+# four workers. Messages may arrive out of order, but each must arrive
+# exactly once, and the queue files must be gone once everything has
+# been processed.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[daqueue-workers.sh\]: test DA queue with multiple disk workers
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup daqueue-workers.conf
+source $srcdir/diag.sh injectmsg 0 20000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 20000 60
+source $srcdir/diag.sh injectmsg 20000 100 # DA mode must be left cleanly
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+sort -n rsyslog.out.log > rsyslog.out.sorted.log
+mv rsyslog.out.sorted.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 20099
+if ls test-spool/actq.* > /dev/null 2>&1; then
+	echo "error: queue files left over although all messages were processed"
+	ls -l test-spool
+	exit 1
+fi
+source $srcdir/diag.sh exit
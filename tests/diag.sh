@@ -113,6 +113,10 @@ case $1 in
 		kill `cat rsyslog$2.pid`
 		# note: we do not wait for the actual termination!
 		;;
+   'issue-HUP') # send a HUP to rsyslogd. $2 is the instance.
+		kill -HUP `cat rsyslog$2.pid`
+		./msleep 1000 # give the main thread time to act on it
+		;;
    'shutdown-immediate') # shut rsyslogd down without emptying the queue. $2 is the instance.
 		kill `cat rsyslog.pid`
 		# note: we do not wait for the actual termination!
@@ -184,6 +188,71 @@ case $1 in
 		  exit 1
 		fi
 		;;
+   'stats-check') # check that the impstats output (rsyslog.out.stats.log) has a line matching regex $2
+		grep -E "$2" rsyslog.out.stats.log > /dev/null
+		if [ "$?" -ne "0" ]; then
+		  echo "error: no stats line matches '$2', stats output is:"
+		  cat rsyslog.out.stats.log
+		  exit 1
+		fi
+		;;
+   'wait-file-lines') # wait until file $2 has at least $3 lines, abort after $4 seconds (default 30)
+		for i in `seq 1 $((${4:-30} * 10))`; do
+			if [ -f $2 ] && [ `cat $2 | wc -l` -ge $3 ]; then
+				break
+			fi
+			./msleep 100
+		done
+		if [ ! -f $2 ] || [ `cat $2 | wc -l` -lt $3 ]; then
+		  echo "error: $2 did not reach $3 lines in time"
+		  exit 1
+		fi
+		;;
+   'wait-stats') # wait until the impstats output has a line matching regex $2, abort after $3 seconds (default 30)
+		for i in `seq 1 $((${3:-30} * 10))`; do
+			if grep -E "$2" rsyslog.out.stats.log > /dev/null 2>&1; then
+				break
+			fi
+			./msleep 100
+		done
+		source $srcdir/diag.sh stats-check "$2"
+		;;
+   'config-check') # do a config verification run for config file $2, stderr goes
+   		# to rsyslog.out.check.log. $3 is the expected exit code.
+		if [ -z "$3" ]; then
+		  echo "error: config-check needs the expected exit code"
+		  exit 1
+		fi
+		../tools/rsyslogd -u2 -N1 -M../runtime/.libs:../.libs -f$srcdir/testsuites/$2 2> rsyslog.out.check.log
+		RET=$?
+		if [ "$RET" -ne "$3" ]; then
+		  echo "error: config verification run returned $RET, output was:"
+		  cat rsyslog.out.check.log
+		  exit 1
+		fi
+		;;
+   'check-errmsg') # check that the last config-check reported a message matching regex $2
+		grep -E "$2" rsyslog.out.check.log > /dev/null
+		if [ "$?" -ne "0" ]; then
+		  echo "error: expected message '$2' not reported, output was:"
+		  cat rsyslog.out.check.log
+		  exit 1
+		fi
+		;;
+   'es-init') # clear the testbench index of the Elasticsearch on localhost:9200,
+   		# the test is skipped if there is none
+		if ! curl -s -o /dev/null http://localhost:9200/; then
+		  echo "no Elasticsearch on localhost:9200, skipping test"
+		  exit 77
+		fi
+		curl -s -XDELETE http://localhost:9200/rsyslog_testbench > /dev/null
+		;;
+   'es-getdata') # write the msgnum field of the docs in the testbench index to
+   		# rsyslog.out.log, $2 is the max number of docs (at most 10000)
+		curl -s -XPOST http://localhost:9200/rsyslog_testbench/_refresh > /dev/null
+		curl -s "http://localhost:9200/rsyslog_testbench/_search?size=$2" | \
+			grep -o '"msgnum":"[0-9]*"' | sed 's/.*:"\([0-9]*\)"/\1/' > rsyslog.out.log
+		;;
    'setzcat')   # find out name of zcat tool
 		if [ `uname` == SunOS ]; then
 		   ZCAT=gzcat
@@ -0,0 +1,81 @@
+# Test for corrupted binary disk queue records. We persist messages in
+# an action queue and then damage the header of two records: one gets
+# an invalid version, the other an insane length. Both records must be
+# reported and discarded, and all other records must still be processed.
+# We use an action queue, so that the error messages can be processed by
+# the main queue while the action queue is being dequeued.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[diskqueue-binfmt-corrupt.sh\]: test resync after corrupted disk queue records
+source $srcdir/diag.sh init
+
+QFILE=test-spool/actq.00000001
+echo 'action(type="omfile" file="rsyslog.out.log" template="outfmt"
+	 queue.type="disk" queue.filename="actq" queue.saveonshutdown="on"
+	 queue.timeoutshutdown="1" queue.dequeuebatchsize="1" queue.dequeueslowdown="10000")' > work-queuemode.conf
+source $srcdir/diag.sh startup diskqueue-binfmt-corrupt.conf
+source $srcdir/diag.sh injectmsg 0 1000
+source $srcdir/diag.sh wait-queueempty
+$srcdir/diag.sh shutdown-immediate
+$srcdir/diag.sh wait-shutdown
+ls -l test-spool
+if test ! -f $QFILE; then
+  echo "error: $QFILE does not exist where expected to do so!"
+  exit 1
+fi
+
+# walk the records (header: magic, version, 4 octets length, 4 octets CRC)
+# and damage records 900 and 950
+OFFS=0
+for i in `seq 0 949`; do
+	if [ `od -An -tu1 -j$OFFS -N1 $QFILE` -ne 181 ]; then
+		echo "error: no binary record at offset $OFFS (record $i)"
+		exit 1
+	fi
+	if [ $i -eq 900 ]; then
+		OFFS900=$OFFS
+	fi
+	LEN=`od -An -tu1 -j$((OFFS + 2)) -N4 $QFILE | awk '{print $1*16777216 + $2*65536 + $3*256 + $4}'`
+	OFFS=$((OFFS + 10 + LEN))
+done
+printf '\007' | dd of=$QFILE bs=1 seek=$((OFFS900 + 1)) conv=notrunc 2> /dev/null
+printf '\377\377\377\377' | dd of=$QFILE bs=1 seek=$((OFFS + 2)) conv=notrunc 2> /dev/null
+
+# restart and have the remaining records processed
+echo 'action(type="omfile" file="rsyslog.out.log" template="outfmt"
+	 queue.type="disk" queue.filename="actq")' > work-queuemode.conf
+source $srcdir/diag.sh startup diskqueue-binfmt-corrupt.conf
+# records are processed in order, so we are done once 949 is there
+for i in `seq 1 300`; do
+	if grep 00000949 rsyslog.out.log > /dev/null 2>&1; then
+		break
+	fi
+	./msleep 100
+done
+source $srcdir/diag.sh shutdown-when-empty
+$srcdir/diag.sh wait-shutdown
+
+grep "invalid version 7" rsyslog.out.errmsg.log > /dev/null
+if [ $? -ne 0 ]; then
+  echo "error: record with invalid version not reported"
+  cat rsyslog.out.errmsg.log
+  exit 1
+fi
+grep "invalid length 4294967295" rsyslog.out.errmsg.log > /dev/null
+if [ $? -ne 0 ]; then
+  echo "error: record with invalid length not reported"
+  cat rsyslog.out.errmsg.log
+  exit 1
+fi
+# everything up to the second damaged record must be there, except the first one.
+# We do not check the records after it, because the resync may hit another
+# (but detected) corrupt record if the magic octet happens to be in its data.
+for i in `seq 0 950`; do printf "%8.8d\n" $i; done | grep -v -e 00000900 -e 00000950 > rsyslog.out.expected.log
+sort -u rsyslog.out.log | head -949 > rsyslog.out.received.log
+cmp rsyslog.out.expected.log rsyslog.out.received.log
+if [ $? -ne 0 ]; then
+  echo "error: unexpected messages received, diff expected vs received:"
+  diff rsyslog.out.expected.log rsyslog.out.received.log | head -20
+  exit 1
+fi
+source $srcdir/diag.sh exit
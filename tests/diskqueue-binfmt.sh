@@ -0,0 +1,29 @@
+# Test for disk queue record format compatibility. We first persist
+# messages in the legacy text format, then restart with binary format
+# enabled. The new instance must process the old records as well as
+# the binary records it writes to the same queue files.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[diskqueue-binfmt.sh\]: test mixed text and binary disk queue records
+source $srcdir/diag.sh init
+
+# write the first half of the data in text format
+echo 'main_queue(queue.type="disk" queue.filename="mainq" queue.binaryformat="off"
+	   queue.timeoutshutdown="1" queue.saveonshutdown="on")' > work-queuemode.conf
+echo "*.*     :omtesting:sleep 0 1000" > work-delay.conf
+source $srcdir/diag.sh startup diskqueue-binfmt.conf
+source $srcdir/diag.sh injectmsg 0 5000
+$srcdir/diag.sh shutdown-immediate
+$srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh check-mainq-spool
+
+# restart in binary mode, add the second half and have everything processed
+echo 'main_queue(queue.type="disk" queue.filename="mainq" queue.binaryformat="on")' > work-queuemode.conf
+echo "#" > work-delay.conf
+source $srcdir/diag.sh startup diskqueue-binfmt.conf
+source $srcdir/diag.sh injectmsg 5000 5000
+source $srcdir/diag.sh shutdown-when-empty
+$srcdir/diag.sh wait-shutdown
+# duplicates are permitted due to the forced shutdown, see queue-persist-drvr.sh
+source $srcdir/diag.sh seq-check 0 9999 -d
+source $srcdir/diag.sh exit
@@ -0,0 +1,11 @@
+# Test for disk-only queue mode with group commit. Multiple senders
+# enqueue concurrently, so that their writes are covered by shared syncs.
+# This file is part of the rsyslog project, released  under GPLv3
+echo \[diskqueue-groupsync.sh\]: testing queue disk-only mode, group commit
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup diskqueue-groupsync.conf
+source $srcdir/diag.sh tcpflood -c4 -m10000
+source $srcdir/diag.sh shutdown-when-empty # shut down rsyslogd when done processing messages
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
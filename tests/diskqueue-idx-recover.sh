@@ -0,0 +1,34 @@
+# Test for recovering a disk queue after an unclean shutdown. The engine
+# is killed while messages are still in the queue, so no .qi file is
+# written. On restart, the queue state must be recovered via the segment
+# index (.qx file) and all messages be processed.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[diskqueue-idx-recover.sh\]: test disk queue recovery via segment index
+source $srcdir/diag.sh init
+
+echo 'main_queue(queue.type="disk" queue.filename="mainq" queue.maxfilesize="10k")' > work-queuemode.conf
+echo "*.*     :omtesting:sleep 0 1000" > work-delay.conf
+source $srcdir/diag.sh startup diskqueue-idx-recover.conf
+source $srcdir/diag.sh injectmsg 0 5000
+kill -9 `cat rsyslog.pid`
+rm -f rsyslog.pid
+./msleep 500
+ls -l test-spool
+if test -f test-spool/mainq.qi; then
+  echo "error: mainq.qi exists, but should not after the engine was killed"
+  exit 1
+fi
+if test ! -f test-spool/mainq.qx; then
+  echo "error: mainq.qx does not exist where expected to do so!"
+  exit 1
+fi
+
+# restart engine and have remaining data processed
+echo "#" > work-delay.conf
+source $srcdir/diag.sh startup diskqueue-idx-recover.conf
+source $srcdir/diag.sh shutdown-when-empty
+$srcdir/diag.sh wait-shutdown
+# duplicates are permitted due to the forced shutdown, see queue-persist-drvr.sh
+source $srcdir/diag.sh seq-check 0 4999 -d
+source $srcdir/diag.sh exit
@@ -0,0 +1,28 @@
+# Test for disk queues in mmap mode. Small queue files are used, so that
+# the reader needs to switch files and renew its mapping quite often. The
+# queue is persisted and read back after a restart, mixing old and new data.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[diskqueue-mmap.sh\]: test disk queue in mmap mode
+source $srcdir/diag.sh init
+
+echo 'main_queue(queue.type="disk" queue.filename="mainq" queue.mmap="on" queue.maxfilesize="64k"
+	   queue.timeoutshutdown="1" queue.saveonshutdown="on")' > work-queuemode.conf
+echo "*.*     :omtesting:sleep 0 1000" > work-delay.conf
+source $srcdir/diag.sh startup diskqueue-mmap.conf
+source $srcdir/diag.sh injectmsg 0 5000
+$srcdir/diag.sh shutdown-immediate
+$srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh check-mainq-spool
+
+# restart, add more data and have everything processed
+echo 'main_queue(queue.type="disk" queue.filename="mainq" queue.mmap="on" queue.maxfilesize="64k"
+	   queue.timeoutshutdown="10000")' > work-queuemode.conf
+echo "#" > work-delay.conf
+source $srcdir/diag.sh startup diskqueue-mmap.conf
+source $srcdir/diag.sh tcpflood -m5000 -i5000
+source $srcdir/diag.sh shutdown-when-empty
+$srcdir/diag.sh wait-shutdown
+# duplicates are permitted due to the forced shutdown, see queue-persist-drvr.sh
+source $srcdir/diag.sh seq-check 0 9999 -d
+source $srcdir/diag.sh exit
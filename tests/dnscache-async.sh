@@ -0,0 +1,33 @@
+# Test asynchronous reverse lookups in the dnscache. The first messages
+# may carry the IP address as hostname, as they do not wait for the
+# resolver pool. Once resolution is done, and also after the entry has
+# expired, messages must carry the resolved name. The IP address must
+# always be correct. The test needs 127.0.0.1 to resolve to a name.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[dnscache-async.sh\]: test asynchronous dnscache lookups
+name=$(getent hosts 127.0.0.1 | awk '{print $2}')
+if [ -z "$name" ]; then
+	echo "127.0.0.1 does not resolve to a name, skipping test"
+	exit 77
+fi
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup dnscache-async.conf
+source $srcdir/diag.sh tcpflood -m1000
+sleep 2 # resolution done and cache entry expired
+source $srcdir/diag.sh tcpflood -m1000 -i1000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 1999
+if grep -v ' 127\.0\.0\.1$' rsyslog.out.log | grep -q .; then
+	echo "error: wrong fromhost-ip:"
+	grep -v ' 127\.0\.0\.1$' rsyslog.out.log | head -3
+	exit 1
+fi
+awk -v name="$name" '{
+	if($1 >= 1000 && ($2 == "127.0.0.1" || index(name, $2) != 1)) {
+		print "error: message " $1 " has hostname " $2 ", expected " name
+		exit 1
+	}
+}' rsyslog.out.log || exit 1
+source $srcdir/diag.sh exit
@@ -0,0 +1,30 @@
+# Test the dynafile cache with many more files than cache entries. The
+# messages are spread round-robin over 100 files with a cache of 10, so
+# nearly every write evicts the least recently used entry. Each message
+# must end up in its own file, and no message may be lost.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[dynfile_cache_lru.sh\]: test dynafile cache eviction
+source $srcdir/diag.sh init
+rm -f rsyslog.out.dyn.*.log
+source $srcdir/diag.sh startup dynfile_cache_lru.conf
+source $srcdir/diag.sh tcpflood -m20000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ $(ls rsyslog.out.dyn.*.log | wc -l) -ne 100 ]; then
+	echo "error: expected 100 dynafiles"
+	ls rsyslog.out.dyn.*.log
+	exit 1
+fi
+for f in rsyslog.out.dyn.*.log; do
+	sfx=${f#rsyslog.out.dyn.}
+	sfx=${sfx%.log}
+	if grep -v "$sfx\$" $f; then
+		echo "error: messages above were written to the wrong file $f"
+		exit 1
+	fi
+done
+cat rsyslog.out.dyn.*.log > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 19999
+rm -f rsyslog.out.dyn.*.log
+source $srcdir/diag.sh exit
@@ -0,0 +1,28 @@
+# Test the process-wide shared dynafile cache. Two actions write to the
+# same 10 dynafiles through a shared cache of only 4 entries. Both
+# streams must be complete, and writes of the two actions must never be
+# mixed within a line.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[dynfile_shared_cache.sh\]: test shared dynafile cache
+source $srcdir/diag.sh init
+rm -f rsyslog.out.shared.*.log
+source $srcdir/diag.sh startup dynfile_shared_cache.conf
+source $srcdir/diag.sh tcpflood -m20000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ $(ls rsyslog.out.shared.*.log | wc -l) -ne 10 ]; then
+	echo "error: expected 10 dynafiles"
+	ls rsyslog.out.shared.*.log
+	exit 1
+fi
+if cat rsyslog.out.shared.*.log | grep -v '^[AB],[0-9]\{8\}$'; then
+	echo "error: lines above are garbled"
+	exit 1
+fi
+cat rsyslog.out.shared.*.log | sed -n 's/^A,//p' > rsyslog.out.log
+cat rsyslog.out.shared.*.log | sed -n 's/^B,//p' > rsyslog2.out.log
+source $srcdir/diag.sh seq-check 0 19999
+source $srcdir/diag.sh seq-check2 0 19999
+rm -f rsyslog.out.shared.*.log
+source $srcdir/diag.sh exit
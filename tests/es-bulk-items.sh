@@ -0,0 +1,27 @@
+# Test item-level evaluation of bulk replies in omelasticsearch. The
+# index maps field "num" as integer. 10 documents with a non-numeric value
+# must be rejected individually and go to the error file, while the other
+# 5000 documents of the same bulk requests must be indexed. Needs
+# Elasticsearch on localhost:9200, the test is skipped otherwise.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[es-bulk-items.sh\]: test omelasticsearch bulk reply items
+source $srcdir/diag.sh init
+source $srcdir/diag.sh es-init
+rm -f rsyslog.errorfile
+curl -s -XPUT http://localhost:9200/rsyslog_testbench -H 'Content-Type: application/json' \
+	-d '{"mappings":{"properties":{"num":{"type":"integer"}}}}' > /dev/null
+source $srcdir/diag.sh startup es-bulk-items.conf
+source $srcdir/diag.sh tcpflood -m5000
+./tcpflood -m10 -M "<129>Mar 10 01:00:00 172.20.245.8 tag msgnum:bad:"
+source $srcdir/diag.sh wait-stats ": omelasticsearch: .*response.success=5000 response.conflict=0 response.bad=10 "
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh es-getdata 10000
+source $srcdir/diag.sh seq-check 0 4999
+if [ ! -s rsyslog.errorfile ]; then
+	echo "error: rejected items were not written to the error file"
+	exit 1
+fi
+rm -f rsyslog.errorfile
+source $srcdir/diag.sh exit
@@ -0,0 +1,23 @@
+# Test omelasticsearch load balancing and failover. Of three servers,
+# 127.0.0.2 has no listener and must be ejected; the requests must be
+# balanced over the two server names of the local Elasticsearch, and no
+# document may be lost. Needs Elasticsearch on localhost:9200, the test
+# is skipped otherwise.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[es-failover.sh\]: test omelasticsearch load balancing and failover
+source $srcdir/diag.sh init
+source $srcdir/diag.sh es-init
+source $srcdir/diag.sh startup es-failover.conf
+source $srcdir/diag.sh injectmsg 0 10000
+source $srcdir/diag.sh wait-stats ": omelasticsearch: submitted=10000 "
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh es-getdata 10000
+sort -n rsyslog.out.log > rsyslog.out.sorted.log
+mv rsyslog.out.sorted.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh stats-check ": omelasticsearch 127.0.0.2:9200: .*ejected=[1-9]"
+source $srcdir/diag.sh stats-check ": omelasticsearch 127.0.0.1:9200: requests=[1-9]"
+source $srcdir/diag.sh stats-check ": omelasticsearch localhost:9200: requests=[1-9]"
+source $srcdir/diag.sh exit
@@ -0,0 +1,39 @@
+# Test byte-bounded bulk requests with compressed bodies in
+# omelasticsearch. Batches of 1000 messages must be split into bulk
+# requests of at most 16k, sent gzip compressed to an Elasticsearch
+# stand-in (miniessrv). All documents must arrive. An unsupported
+# compression must be reported.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[es-maxbytes.sh\]: test omelasticsearch maxbytes and compression
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check es-maxbytes-invalid.conf 1
+source $srcdir/diag.sh check-errmsg "invalid value for 'compression' parameter \(given is 'brotli'\)"
+./miniessrv 127.0.0.1 19200 rsyslog.out.log rsyslog.out.requests.log &
+BGPROCESS=$!
+source $srcdir/diag.sh startup es-maxbytes.conf
+source $srcdir/diag.sh injectmsg 0 10000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+kill $BGPROCESS
+wait $BGPROCESS
+sort -n rsyslog.out.log > rsyslog.out.sorted.log
+mv rsyslog.out.sorted.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 9999
+if grep -v "^host=localhost:19200 encoding=gzip " rsyslog.out.requests.log; then
+	echo "error: bulk requests above were not sent gzip compressed"
+	exit 1
+fi
+# each bulk item needs roughly 80 bytes, so 10000 items need at least 40
+# requests of 16k. Without the limit, 10 requests would be enough.
+nreq=$(cat rsyslog.out.requests.log | wc -l)
+if [ $nreq -lt 40 ]; then
+	echo "error: only $nreq bulk requests, maxbytes not honored"
+	exit 1
+fi
+if ! awk '{ sub(/body=/, "", $5); if($5 + 0 > 16384) { print "error: request of " $5 " bytes"; exit 1 } }' \
+	rsyslog.out.requests.log; then
+	exit 1
+fi
+source $srcdir/diag.sh exit
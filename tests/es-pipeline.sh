@@ -0,0 +1,31 @@
+# Test pipelined bulk requests in omelasticsearch. Up to four bulk
+# requests are kept in flight and distributed over two server names for
+# the same Elasticsearch stand-in (miniessrv). All documents must arrive,
+# and both server names must have received requests. A pipeline without
+# bulk mode must be reported.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[es-pipeline.sh\]: test omelasticsearch pipelined bulk mode
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check es-pipeline-invalid.conf 1
+source $srcdir/diag.sh check-errmsg '"pipeline.maxinflight" requires bulkmode'
+./miniessrv 127.0.0.1 19200 rsyslog.out.log rsyslog.out.requests.log &
+BGPROCESS=$!
+source $srcdir/diag.sh startup es-pipeline.conf
+source $srcdir/diag.sh injectmsg 0 10000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+kill $BGPROCESS
+wait $BGPROCESS
+sort -n rsyslog.out.log > rsyslog.out.sorted.log
+mv rsyslog.out.sorted.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 9999
+for host in 127.0.0.1:19200 localhost:19200; do
+	if ! grep -q "^host=$host " rsyslog.out.requests.log; then
+		echo "error: no bulk request sent to $host"
+		cat rsyslog.out.requests.log
+		exit 1
+	fi
+done
+source $srcdir/diag.sh exit
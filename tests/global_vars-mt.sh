@@ -0,0 +1,18 @@
+# Test concurrent writes and reads of global variables by several
+# workers. Every read must return a complete value that some worker set,
+# both for plain variables and for subtrees copied out of the tree.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[global_vars-mt.sh\]: testing global variables with multiple workers
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup global_vars-mt.conf
+source $srcdir/diag.sh injectmsg 0 40000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 39999
+if [ `grep -c -E "^[0-9]{8} [0-9]{8}$" rsyslog2.out.log` -ne 40000 ]; then
+  echo "invalid global variable values read:"
+  grep -v -E "^[0-9]{8} [0-9]{8}$" rsyslog2.out.log | head
+  exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,19 @@
+# Test parallel block compression in omfile. The output is written as
+# concatenated gzip members by four zip workers; it must be a valid gzip
+# file that contains all messages.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[gzipwr_parallel.sh\]: test parallel gzip block compression
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup gzipwr_parallel.conf
+source $srcdir/diag.sh tcpflood -m20000 -r -d5000 -P129
+sleep 1 # due to large messages, we need this time for the tcp receiver to settle...
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+gzip -t rsyslog.out.log
+if [ $? -ne 0 ]; then
+	echo "error: output is no valid gzip file"
+	exit 1
+fi
+source $srcdir/diag.sh gzip-seq-check 0 19999 -E
+source $srcdir/diag.sh exit
@@ -0,0 +1,242 @@
+/* A microbenchmark comparing the chained hashtable (runtime/hashtable.c)
+ * with the open-addressing hashmap (runtime/hashmap.c). Both are exercised
+ * with the key types of their main users: pids (imuxsock ratelimiters and
+ * pid cache) and strings (mmsequence and the like).
+ *
+ * Usage: hashbench [-n entries] [-l lookups]
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include "rsyslog.h"
+#include "hashtable.h"
+#include "hashmap.h"
+
+static int nEntries = 10000;
+static long nLookups = 10000000;
+static volatile long sink; /* keeps the compiler from optimizing lookups away */
+static int *order; /* lookup order, independent from insertion order */
+
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static unsigned int
+ht_hash_pid(void *k)
+{
+	return (unsigned) *((pid_t*) k);
+}
+
+static int
+ht_equals_pid(void *k1, void *k2)
+{
+	return *((pid_t*) k1) == *((pid_t*) k2);
+}
+
+static unsigned
+hm_hash_pid(const void *k)
+{
+	return (unsigned) *((const pid_t*) k);
+}
+
+static int
+hm_equals_pid(const void *k1, const void *k2)
+{
+	return *((const pid_t*) k1) == *((const pid_t*) k2);
+}
+
+
+static void
+report(const char *what, const char *impl, double t, long n)
+{
+	printf("%-18s %-10s %8.3fs  %7.1f ns/op\n", what, impl, t, t * 1e9 / n);
+}
+
+
+static void
+benchPids(pid_t *pids)
+{
+	struct hashtable *ht;
+	hashmap_t *hm;
+	pid_t *keybuf;
+	pid_t miss;
+	double t;
+	long i;
+	long sum;
+
+	/* insert */
+	t = now();
+	ht = create_hashtable(100, ht_hash_pid, ht_equals_pid, NULL);
+	for(i = 0 ; i < nEntries ; ++i) {
+		keybuf = malloc(sizeof(pid_t));
+		*keybuf = pids[i];
+		hashtable_insert(ht, keybuf, &pids[i]);
+	}
+	report("pid insert", "hashtable", now() - t, nEntries);
+	t = now();
+	hashmapConstruct(&hm, 100, sizeof(pid_t), hm_hash_pid, hm_equals_pid, NULL, NULL);
+	for(i = 0 ; i < nEntries ; ++i)
+		hashmapInsert(hm, &pids[i], &pids[i]);
+	report("pid insert", "hashmap", now() - t, nEntries);
+
+	/* successful lookups */
+	t = now();
+	for(sum = 0, i = 0 ; i < nLookups ; ++i)
+		sum += (hashtable_search(ht, &pids[order[i % nEntries]]) != NULL);
+	report("pid lookup hit", "hashtable", now() - t, nLookups);
+	sink = sum;
+	t = now();
+	for(sum = 0, i = 0 ; i < nLookups ; ++i)
+		sum += (hashmapSearch(hm, &pids[order[i % nEntries]]) != NULL);
+	report("pid lookup hit", "hashmap", now() - t, nLookups);
+	sink = sum;
+
+	/* failing lookups */
+	t = now();
+	for(sum = 0, i = 0 ; i < nLookups ; ++i) {
+		miss = -(pid_t)order[i % nEntries] - 1;
+		sum += (hashtable_search(ht, &miss) != NULL);
+	}
+	report("pid lookup miss", "hashtable", now() - t, nLookups);
+	sink = sum;
+	t = now();
+	for(sum = 0, i = 0 ; i < nLookups ; ++i) {
+		miss = -(pid_t)order[i % nEntries] - 1;
+		sum += (hashmapSearch(hm, &miss) != NULL);
+	}
+	report("pid lookup miss", "hashmap", now() - t, nLookups);
+	sink = sum;
+
+	hashtable_destroy(ht, 0);
+	hashmapDestruct(&hm);
+}
+
+
+static void
+benchStrings(char **strs)
+{
+	struct hashtable *ht;
+	hashmap_t *hm;
+	double t;
+	long i;
+	long sum;
+
+	t = now();
+	ht = create_hashtable(100, hash_from_string, key_equals_string, NULL);
+	for(i = 0 ; i < nEntries ; ++i)
+		hashtable_insert(ht, strdup(strs[i]), strs[i]);
+	report("string insert", "hashtable", now() - t, nEntries);
+	t = now();
+	hashmapConstruct(&hm, 100, 0, hashmapHashString, hashmapKeyEqualsString, free, NULL);
+	for(i = 0 ; i < nEntries ; ++i)
+		hashmapInsert(hm, strdup(strs[i]), strs[i]);
+	report("string insert", "hashmap", now() - t, nEntries);
+
+	t = now();
+	for(sum = 0, i = 0 ; i < nLookups ; ++i)
+		sum += (hashtable_search(ht, strs[order[i % nEntries]]) != NULL);
+	report("string lookup hit", "hashtable", now() - t, nLookups);
+	sink = sum;
+	t = now();
+	for(sum = 0, i = 0 ; i < nLookups ; ++i)
+		sum += (hashmapSearch(hm, strs[order[i % nEntries]]) != NULL);
+	report("string lookup hit", "hashmap", now() - t, nLookups);
+	sink = sum;
+
+	hashtable_destroy(ht, 0);
+	hashmapDestruct(&hm);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int opt;
+	int i;
+	pid_t *pids;
+	char **strs;
+	char buf[64];
+
+	while((opt = getopt(argc, argv, "n:l:")) != -1) {
+		switch (opt) {
+		case 'n':	nEntries = atoi(optarg);
+				break;
+		case 'l':	nLookups = atol(optarg);
+				break;
+		default:	printf("invalid option '%c' or value missing - terminating...\n", opt);
+				exit (1);
+				break;
+		}
+	}
+	if(nEntries < 1 || nLookups < 1) {
+		printf("entries and lookups must be positive\n");
+		exit(1);
+	}
+
+	/* pids are sparse and lookups come in no particular order. The lookup
+	 * order must differ from the insertion order, else the chained table
+	 * walks its (sequentially allocated) entries in memory order, which
+	 * is not what happens in practice.
+	 */
+	pids = malloc(nEntries * sizeof(pid_t));
+	strs = malloc(nEntries * sizeof(char*));
+	order = malloc(nEntries * sizeof(int));
+	srand(42);
+	for(i = 0 ; i < nEntries ; ++i) {
+		pids[i] = (pid_t) (i * 7 + 300);
+		snprintf(buf, sizeof(buf), "host%d.example.net/app%d", rand() % 100000, i);
+		strs[i] = strdup(buf);
+		order[i] = i;
+	}
+	for(i = nEntries - 1 ; i > 0 ; --i) {
+		int j = rand() % (i + 1);
+		pid_t tmp = pids[i];
+		pids[i] = pids[j];
+		pids[j] = tmp;
+		j = rand() % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	printf("%d entries, %ld lookups\n", nEntries, nLookups);
+	benchPids(pids);
+	benchStrings(strs);
+
+	for(i = 0 ; i < nEntries ; ++i)
+		free(strs[i]);
+	free(strs);
+	free(pids);
+	free(order);
+	return 0;
+}
@@ -0,0 +1,26 @@
+# Test omhdfs block buffering and parallel files. Without a Hadoop
+# configuration, the "default" file system is the local one, so the
+# output can be checked directly. Four workers write to four files with a
+# small block buffer and timed flushing. All messages must be written.
+# Invalid block size and file count values must be reported.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[hdfs-filecount.sh\]: test omhdfs block buffering and parallel files
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check hdfs-filecount-invalid.conf 0
+source $srcdir/diag.sh check-errmsg "block size 100 too small"
+source $srcdir/diag.sh check-errmsg "file count 0 invalid"
+rm -f rsyslog.out.hdfs.*
+source $srcdir/diag.sh startup hdfs-filecount.conf
+source $srcdir/diag.sh injectmsg 0 20000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ $(ls rsyslog.out.hdfs.[0-3] | wc -l) -ne 4 ]; then
+	echo "error: expected 4 output files"
+	ls -l rsyslog.out.hdfs.*
+	exit 1
+fi
+cat rsyslog.out.hdfs.[0-3] > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 19999
+rm -f rsyslog.out.hdfs.*
+source $srcdir/diag.sh exit
@@ -0,0 +1,30 @@
+# Test the omhiredis queue mode. Messages are pushed with RPUSH to two
+# lists selected by a dynamic key, in transactions of up to 500 messages,
+# to a Redis stand-in (miniredissrv). Both lists together must hold all
+# messages, each list in message order. A queue mode action without key
+# must be reported.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[hiredis-queue.sh\]: test omhiredis queue mode
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check hiredis-queue-invalid.conf 1
+source $srcdir/diag.sh check-errmsg "queue mode requires a key"
+./miniredissrv 127.0.0.1 16379 rsyslog.out.pushed.log &
+BGPROCESS=$!
+source $srcdir/diag.sh startup hiredis-queue.conf
+source $srcdir/diag.sh injectmsg 0 10000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.pushed.log 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+kill $BGPROCESS
+wait $BGPROCESS
+for key in rsyslog_testbench_0 rsyslog_testbench_1; do
+	grep "^$key " rsyslog.out.pushed.log | cut -d' ' -f2 > rsyslog.out.$key.log
+	if ! sort -c -g rsyslog.out.$key.log; then
+		echo "error: list $key is not in message order"
+		exit 1
+	fi
+done
+cat rsyslog.out.rsyslog_testbench_*.log | sort -n > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
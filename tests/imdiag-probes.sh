@@ -0,0 +1,21 @@
+# Test the imdiag latency probes. Canary messages are submitted every
+# 100ms into a ruleset with latency stats, whose action also records
+# them. Both must report probe latencies, while the canaries must never
+# reach the output, which only has the regular messages.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imdiag-probes.sh\]: test imdiag latency probes
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imdiag-probes.conf
+source $srcdir/diag.sh tcpflood -m1000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 1000
+source $srcdir/diag.sh wait-stats ': probeaction: .*probe\.latency\.max=[1-9]'
+source $srcdir/diag.sh wait-stats ': ruleset probes: .*probe\.latency\.p99=[1-9]'
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 999
+if grep -q 'probe\.latency' <(grep ': plainaction:' rsyslog.out.stats.log); then
+	echo "error: latency stats for action without action.latencyStats"
+	exit 1
+fi
+source $srcdir/diag.sh exit
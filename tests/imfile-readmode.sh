@@ -0,0 +1,42 @@
+# Test line reading in all imfile read modes. Mode 0 gets lines of very
+# different lengths, many of them larger than the stream buffer, so line
+# spans must be assembled across buffer boundaries. Mode 1 (paragraph)
+# and mode 2 (indented continuation lines) must join their records
+# exactly as before.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imfile-readmode.sh\]: test imfile read modes
+source $srcdir/diag.sh init
+rm -f rsyslog.input2 rsyslog.input3 rsyslog3.out.log stat-file2 stat-file3
+awk 'BEGIN { for(i = 0 ; i < 5000 ; ++i) {
+		len = (i * 37) % 9000
+		data = sprintf("%" len "s", "")
+		gsub(/ /, "x", data)
+		printf("msgnum:%8.8d:%d:%s\n", i, len, data)
+	} }' > rsyslog.input
+awk 'BEGIN { for(i = 0 ; i < 3000 ; ++i)
+		printf("msgnum:%8.8d:\nsecond line\n\n", i)
+	}' > rsyslog.input2
+awk 'BEGIN { for(i = 0 ; i < 3000 ; ++i)
+		printf("msgnum:%8.8d:\n  indented\n\tand tabbed\n", i)
+	print "end"
+	}' > rsyslog.input3
+source $srcdir/diag.sh startup imfile-readmode.conf
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 5000
+source $srcdir/diag.sh wait-file-lines rsyslog2.out.log 3000
+source $srcdir/diag.sh wait-file-lines rsyslog3.out.log 3000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 4999 -E
+if [ $(grep -c '^msgnum:[0-9]\{8\}:#012second line$' rsyslog2.out.log) -ne 3000 ]; then
+	echo "paragraph mode records not joined correctly"
+	head rsyslog2.out.log
+	exit 1
+fi
+if [ $(grep -c '^msgnum:[0-9]\{8\}:#012  indented#012	and tabbed$' rsyslog3.out.log) -ne 3000 ]; then
+	echo "indented mode records not joined correctly"
+	head rsyslog3.out.log
+	exit 1
+fi
+rm -f rsyslog.input2 rsyslog.input3 rsyslog3.out.log stat-file2 stat-file3
+source $srcdir/diag.sh exit
@@ -0,0 +1,22 @@
+# Test multi-line messages in imfile via startmsg.regex. Each record is a
+# start line followed by an indented line and a non-indented one (like a
+# Java stack trace with "Caused by:"). The last record has no following
+# start line and must be submitted by readTimeout while rsyslog runs.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imfile-startmsg-regex.sh\]: test imfile startmsg.regex
+source $srcdir/diag.sh init
+awk 'BEGIN { for(i = 0 ; i < 2000 ; ++i)
+		printf("msgnum:%8.8d:\n\tat some.Class.method\nCaused by: trouble\n", i)
+	}' > rsyslog.input
+source $srcdir/diag.sh startup imfile-startmsg-regex.conf
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 2000 10
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 1999
+if [ $(grep -c '^msgnum:[0-9]\{8\}:#012	at some.Class.method#012Caused by: trouble$' rsyslog2.out.log) -ne 2000 ]; then
+	echo "error: multi-line records not assembled correctly"
+	head rsyslog2.out.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
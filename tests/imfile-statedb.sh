@@ -0,0 +1,37 @@
+# Test the consolidated imfile state database. Three files are read, then
+# rsyslog is restarted and more data is appended. Reading must continue at
+# the stored positions (no duplicates, no gaps), and no per-file state
+# files may be written.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imfile-statedb.sh\]: test imfile state database
+source $srcdir/diag.sh init
+rm -f rsyslog.input.s[1-3]
+gen() { # $1 first msgnum, $2 count
+	awk -v s=$1 -v n=$2 'BEGIN { for(i = s ; i < s + n ; ++i) printf("msgnum:%8.8d:\n", i) }'
+}
+gen 0 3000 > rsyslog.input.s1
+gen 3000 3000 > rsyslog.input.s2
+gen 6000 3000 > rsyslog.input.s3
+source $srcdir/diag.sh startup imfile-statedb.conf
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 9000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ ! -s test-spool/imfile-state.db ]; then
+	echo "error: state database not written"
+	exit 1
+fi
+if ls test-spool | grep -q '^stat-db'; then
+	echo "error: per-file state files written despite state database"
+	ls -l test-spool
+	exit 1
+fi
+gen 9000 1000 >> rsyslog.input.s1
+gen 10000 1000 >> rsyslog.input.s3
+source $srcdir/diag.sh startup imfile-statedb.conf
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 11000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 10999
+rm -f rsyslog.input.s[1-3]
+source $srcdir/diag.sh exit
@@ -0,0 +1,27 @@
+# Test wildcard file names in imfile inotify mode. One matching file
+# exists at startup, two more are created while rsyslog runs. After the
+# close timeout expired, more data is appended to one of them, which must
+# be picked up again where reading stopped.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imfile-wildcards.sh\]: test imfile wildcard file names
+source $srcdir/diag.sh init
+rm -f rsyslog.input.w* stat-wild*
+gen() { # $1 first msgnum, $2 count
+	awk -v s=$1 -v n=$2 'BEGIN { for(i = s ; i < s + n ; ++i) printf("msgnum:%8.8d:\n", i) }'
+}
+gen 0 5000 > rsyslog.input.w1
+source $srcdir/diag.sh startup imfile-wildcards.conf
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 5000
+gen 5000 5000 > rsyslog.input.w2
+gen 10000 5000 > rsyslog.input.w3
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 15000
+rm -f rsyslog.input.w1 # gone files must be dropped without trouble
+sleep 3 # let closeTimeout close the idle files
+gen 15000 1000 >> rsyslog.input.w2
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 16000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 15999
+rm -f rsyslog.input.w* stat-wild*
+source $srcdir/diag.sh exit
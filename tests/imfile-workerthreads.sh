@@ -0,0 +1,26 @@
+# Test the imfile reader worker pool. Four files are read by four
+# workers. All messages must arrive, and the lines of each single file
+# must still be submitted in file order.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imfile-workerthreads.sh\]: test imfile reader worker threads
+source $srcdir/diag.sh init
+rm -f rsyslog.input.[1-4] stat-file-w[1-4]
+for i in 1 2 3 4; do
+	awk -v f=$i 'BEGIN { for(i = (f-1) * 20000 ; i < f * 20000 ; ++i)
+				printf("msgnum:%8.8d:\n", i) }' > rsyslog.input.$i
+done
+source $srcdir/diag.sh startup imfile-workerthreads.conf
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 80000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 79999
+# rsyslog2.out.log is in submission order: "<tag>:<msgnum>"
+awk -F: '{ if(($1 in last) && $2 + 0 <= last[$1]) bad = 1; last[$1] = $2 + 0 }
+	 END { exit bad }' rsyslog2.out.log
+if [ $? -ne 0 ]; then
+	echo "error: lines of a file were submitted out of order"
+	exit 1
+fi
+rm -f rsyslog.input.[1-4] stat-file-w[1-4]
+source $srcdir/diag.sh exit
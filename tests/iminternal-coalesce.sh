@@ -0,0 +1,42 @@
+# Test internal message handling with a direct main queue. Internal
+# messages emitted after startup must still be processed (they used to be
+# stored and never drained in this mode). 200 connections from a
+# disallowed sender each emit the same warning, which must be collapsed
+# into a "repeated" notice that is emitted when the next (different)
+# internal message, triggered by a HUP, arrives.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[iminternal-coalesce.sh\]: test internal message coalescing
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup iminternal-coalesce.conf
+for i in `seq 1 200`; do
+	(exec 3<>/dev/tcp/127.0.0.1/13514) 2>/dev/null
+done
+./msleep 1000
+source $srcdir/diag.sh issue-HUP
+i=0
+while ! grep -q 'rsyslogd was HUPed' rsyslog.out.log 2>/dev/null; do
+	./msleep 100
+	let "i++"
+	if [ $i -gt 100 ]; then
+		echo "error: internal message after startup not processed"
+		exit 1
+	fi
+done
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+nwarn=$(grep -c 'TCP message from disallowed sender' rsyslog.out.log)
+nrep=$(grep -o 'last internal message repeated [0-9]* times' rsyslog.out.log | \
+	awk '{ s += $5 } END { print s + 0 }')
+if [ "$nrep" -eq 0 ] || [ $((nwarn + nrep)) -ne 200 ]; then
+	echo "error: $nwarn warnings and $nrep repeats, expected 200 in total with repeats"
+	cat rsyslog.out.log
+	exit 1
+fi
+if [ "$(grep -n 'repeated' rsyslog.out.log | tail -n1 | cut -d: -f1)" -gt \
+     "$(grep -n 'rsyslogd was HUPed' rsyslog.out.log | cut -d: -f1)" ]; then
+	echo "error: repeat notice emitted after the following message"
+	cat rsyslog.out.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,29 @@
+# Test imjournal batching and the field allowlist. 1000 messages are
+# written to the journal via systemd-cat. All of them must arrive, and the
+# json tree must only contain the configured fields. Needs a readable
+# journal, so the test is skipped where there is none.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imjournal-fields.sh\]: test imjournal batching and field allowlist
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check imjournal-fields-invalid.conf 1
+source $srcdir/diag.sh check-errmsg "batchsize"
+if ! type systemd-cat >/dev/null 2>&1 || ! journalctl -n 0 >/dev/null 2>&1; then
+	echo "no usable journal, skipping runtime part"
+	exit 77
+fi
+rm -f imjournal.state
+source $srcdir/diag.sh startup imjournal-fields.conf
+./msleep 1000 # give imjournal time to seek to the journal end
+./inputfilegen 1000 | systemd-cat -t rsyslog-testbench
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 1000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 999
+if grep -q '"_PID"\|"_HOSTNAME"' rsyslog2.out.log; then
+	echo "error: fields outside the allowlist extracted"
+	head -3 rsyslog2.out.log
+	exit 1
+fi
+rm -f imjournal.state
+source $srcdir/diag.sh exit
@@ -0,0 +1,26 @@
+# Test imkmsg batch reading. A burst of records is written to /dev/kmsg;
+# all of them must be read and the new counters must be reported. As
+# /dev/kmsg needs root to write, and also holds records of previous
+# runs, each run uses a unique tag.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imkmsg-batch.sh\]: test imkmsg batch reading
+if [ ! -w /dev/kmsg ]; then
+    echo "/dev/kmsg not writable (not root?), skipping"
+    exit 77
+fi
+TAG=imkmsgtest$$`date +%s`
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imkmsg-batch.conf
+# one open per record, so that the kernel's per-writer rate limit does not hit
+for i in `seq 0 999`; do
+	printf "$TAG msgnum:%8.8d:\n" $i > /dev/kmsg
+done
+./msleep 2000 # give imkmsg and impstats time to catch up
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+grep "$TAG msgnum:" rsyslog.out.log | sed -e 's/.*msgnum:\([0-9]*\):.*/\1/' > rsyslog.out.tag.log
+mv rsyslog.out.tag.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 999
+source $srcdir/diag.sh stats-check 'imkmsg: submitted=[1-9][0-9]{3,} overruns=[0-9]+'
+source $srcdir/diag.sh exit
@@ -0,0 +1,67 @@
+# Test the impstats metrics endpoint and delta-only output. The counters
+# of a named action are scraped in Prometheus text format and in
+# OpenMetrics format, and must show the exact number of processed
+# messages. With deltaonly, the action must vanish from the stats log
+# once it no longer processes messages.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[impstats-prometheus.sh\]: test impstats metrics endpoint and deltaonly
+if ! hash curl 2>/dev/null; then
+	echo "curl not available, skipping test"
+	exit 77
+fi
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup impstats-prometheus.conf
+source $srcdir/diag.sh tcpflood -m5000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 5000
+./msleep 2500 # let the final count reach the stats log
+
+curl -s -o rsyslog.out.prom.log http://127.0.0.1:13516/metrics
+if ! grep -qx 'rsyslog_counter_total{object="promaction",counter="processed"} 5000' rsyslog.out.prom.log; then
+	echo "error: processed counter missing in Prometheus exposition"
+	cat rsyslog.out.prom.log
+	exit 1
+fi
+if ! grep -qx '# TYPE rsyslog_counter_total counter' rsyslog.out.prom.log ||
+   ! grep -qx '# TYPE rsyslog_gauge gauge' rsyslog.out.prom.log ||
+   grep -qx '# EOF' rsyslog.out.prom.log; then
+	echo "error: invalid Prometheus text exposition"
+	cat rsyslog.out.prom.log
+	exit 1
+fi
+
+curl -s -o rsyslog.out.om.log -H 'Accept: application/openmetrics-text; version=1.0.0' \
+	http://127.0.0.1:13516/metrics
+if ! grep -qx 'rsyslog_counter_total{object="promaction",counter="processed"} 5000' rsyslog.out.om.log ||
+   ! grep -qx '# TYPE rsyslog_counter counter' rsyslog.out.om.log ||
+   [ "$(tail -n1 rsyslog.out.om.log)" != "# EOF" ]; then
+	echo "error: invalid OpenMetrics exposition"
+	cat rsyslog.out.om.log
+	exit 1
+fi
+
+if [ "$(curl -s -o /dev/null -w '%{http_code}' http://127.0.0.1:13516/other)" != "404" ]; then
+	echo "error: unknown path not rejected"
+	exit 1
+fi
+
+# deltaonly: the last logged value is the total, and idle intervals
+# do not log the action again
+if [ "$(grep -o ': promaction: processed=[0-9]*' rsyslog.out.stats.log | tail -n1)" != \
+     ": promaction: processed=5000" ]; then
+	echo "error: last logged processed counter is not 5000"
+	grep ': promaction:' rsyslog.out.stats.log
+	exit 1
+fi
+before=$(grep -c ': promaction:' rsyslog.out.stats.log)
+./msleep 3000
+after=$(grep -c ': promaction:' rsyslog.out.stats.log)
+if [ "$before" -ne "$after" ]; then
+	echo "error: unchanged action emitted in deltaonly mode"
+	grep ': promaction:' rsyslog.out.stats.log
+	exit 1
+fi
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 4999
+source $srcdir/diag.sh exit
@@ -0,0 +1,23 @@
+# Test for the imptcp buffer pool. Sessions only hold a pool buffer while
+# they process data; a session with a partial frame keeps just that frame.
+# Messages of random size over many sessions must be received intact, an
+# idle session with a partial frame must show up as carry-over, and once
+# everything is done, no buffer may be held any longer.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imptcp-bufpool.sh\]: test imptcp session buffer pool
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imptcp-bufpool.conf
+source $srcdir/diag.sh tcpflood -c200 -m20000 -r -d2000
+# a session that stays idle in the middle of a frame
+exec 3<>/dev/tcp/127.0.0.1/13514
+printf "<167>Mar  1 01:00:00 172.20.245.8 tag msgnum:00020000:5:abcde" >&3
+source $srcdir/diag.sh wait-stats ": imptcp-bufpool: .*inuse=0 carryover.sessions=1 carryover.bytes=61$" 10
+printf "\n" >&3
+exec 3>&-
+source $srcdir/diag.sh wait-queueempty
+source $srcdir/diag.sh wait-stats ": imptcp-bufpool: gets=[0-9]+ allocs=[0-9]{1,2} inuse=0 carryover.sessions=0 carryover.bytes=0$" 10
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 20000 -E
+source $srcdir/diag.sh exit
@@ -0,0 +1,20 @@
+# Test imptcp per-session backpressure. A heavy sender floods a ruleset
+# whose queue is throttled by a slow action, while a few light senders
+# send alongside it. The heavy session must get paused, and no message
+# may be lost by pausing and resuming it.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imptcp-sessbackpressure.sh\]: test imptcp per-session backpressure
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imptcp-sessbackpressure.conf
+./tcpflood -c1 -m20000 -i0 &
+HEAVY=$!
+./tcpflood -c4 -m4000 -i20000 -o400
+wait $HEAVY
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+sort -n rsyslog.out.log > rsyslog.out.sorted.log
+mv rsyslog.out.sorted.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 23999
+source $srcdir/diag.sh stats-check 'imptcp\(\*/13514/IPv4\): .*sessions\.paused=[1-9]'
+source $srcdir/diag.sh exit
@@ -0,0 +1,25 @@
+# Test for imptcp epoll.sharded. With epoll.sharded.reuseport, each of the
+# four shards must have its own listener in addition to the main one, and
+# sessions spread over the shards must deliver all messages. An invalid
+# assignment mode must be reported.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imptcp-sharded.sh\]: test imptcp epoll sharding
+if [ ! -f /proc/net/tcp ]; then
+    exit 77 # needs Linux /proc to count the listeners, skip this test
+fi
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check imptcp-sharded-invalid.conf 0
+source $srcdir/diag.sh check-errmsg "epoll.sharded.assign"
+source $srcdir/diag.sh startup imptcp-sharded.conf
+# listening sockets (state 0A) on 127.0.0.1:13514
+nlstn=`grep -c -i "^ *[0-9]*: 0100007F:34CA 00000000:0000 0A " /proc/net/tcp`
+if [ $nlstn -ne 5 ]; then
+  echo "error: expected 5 listeners on port 13514, found $nlstn"
+  exit 1
+fi
+source $srcdir/diag.sh tcpflood -c100 -m20000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999
+source $srcdir/diag.sh exit
@@ -0,0 +1,25 @@
+# Test TLS in imptcp. Several TLS sessions are handled by the epoll
+# workers (with sharding enabled), while a plain TCP listener on another
+# port receives messages at the same time. All messages from both
+# listeners must arrive.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imptcp-tls.sh\]: test imptcp with TLS
+source $srcdir/diag.sh init
+echo \$DefaultNetstreamDriverCAFile $srcdir/tls-certs/ca.pem     >rsyslog.conf.tlscert
+echo \$DefaultNetstreamDriverCertFile $srcdir/tls-certs/cert.pem >>rsyslog.conf.tlscert
+echo \$DefaultNetstreamDriverKeyFile $srcdir/tls-certs/key.pem   >>rsyslog.conf.tlscert
+source $srcdir/diag.sh startup imptcp-tls.conf
+./tcpflood -p13515 -c5 -m10000 -i20000 &
+source $srcdir/diag.sh tcpflood -p13514 -c10 -m20000 -Ttls -Z$srcdir/tls-certs/cert.pem -z$srcdir/tls-certs/key.pem
+wait $!
+if [ $? -ne 0 ]; then
+	echo "error: tcpflood on plain listener failed"
+	exit 1
+fi
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+sort -n rsyslog.out.log > rsyslog.out.sorted.log
+mv rsyslog.out.sorted.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 29999
+source $srcdir/diag.sh exit
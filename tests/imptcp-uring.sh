@@ -0,0 +1,19 @@
+# Test for imptcp iomode="uring". Messages sent over many connections must
+# all be received through the io_uring backend.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imptcp-uring.sh\]: test imptcp io_uring backend
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imptcp-uring.conf
+./msleep 500 # the rings are set up when the input starts
+if grep "falling back to epoll" rsyslog2.out.log > /dev/null; then
+  echo "io_uring not available with this kernel, skipping"
+  source $srcdir/diag.sh shutdown-immediate
+  source $srcdir/diag.sh wait-shutdown
+  exit 77
+fi
+source $srcdir/diag.sh tcpflood -c50 -m20000 -r -d500
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999 -E
+source $srcdir/diag.sh exit
@@ -0,0 +1,15 @@
+# Test for the imtcp "workerthreads" module parameter. Sessions are pinned
+# to one of four session workers. Many sessions, some of them dropped and
+# re-established while data is sent, must deliver all messages, also when
+# messages span multiple reads.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imtcp-workerthreads.sh\]: test imtcp session worker threads
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imtcp-workerthreads.conf
+source $srcdir/diag.sh tcpflood -c50 -m50000 -r -d1000 -D
+sleep 2 # due to large messages, we need this time for the tcp receiver to settle...
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 49999 -E
+source $srcdir/diag.sh exit
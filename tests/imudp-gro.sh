@@ -0,0 +1,28 @@
+# Test for the imudp "gro" parameter. tcpflood sends groups of 16 messages
+# as one GSO datagram, which the kernel hands to the GRO-enabled listener
+# coalesced. imudp must split it into the original messages.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imudp-gro.sh\]: test imudp UDP_GRO receive
+if [ "`uname`" != "Linux" ]; then
+    exit 77 # UDP_GRO and UDP_SEGMENT are Linux only, skip this test
+fi
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imudp-gro.conf
+./tcpflood -t 127.0.0.1 -m800 -Tudp -G16 -o2000
+if [ $? -ne 0 ]; then
+  echo "sending with UDP_SEGMENT failed, kernel too old? skipping"
+  source $srcdir/diag.sh shutdown-immediate
+  source $srcdir/diag.sh wait-shutdown
+  exit 77
+fi
+./msleep 500 # UDP is asynchronous, give the listener time to pick up everything
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 799
+if [ `grep -c "UDP_GRO" rsyslog2.out.log` -ne 0 ]; then
+  echo "error: UDP_GRO could not be enabled:"
+  cat rsyslog2.out.log
+  exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,27 @@
+# Test the imudp listener prefilter (prefilter.*): datagrams matching
+# the PRI selector, a prefix, a contained string or a sender network are
+# dropped, similar ones that do not match must pass.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imudp-prefilter.sh\]: test imudp prefilter
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imudp-prefilter.conf
+./tcpflood -t 127.0.0.1 -m1 -Tudp -M "<15>Oct 15 12:00:00 host tag: drop-pri"
+./tcpflood -t 127.0.0.1 -m1 -Tudp -M "<14>Oct 15 12:00:00 host tag: keep-pri"
+./tcpflood -t 127.0.0.1 -m1 -Tudp -M "<13>Oct 15 12:00:00 spam tag: drop-prefix"
+./tcpflood -t 127.0.0.1 -m1 -Tudp -M "<13>Oct 15 12:00:00 host tag: keep-prefix spam"
+./tcpflood -t 127.0.0.1 -m1 -Tudp -M "<13>Oct 15 12:00:00 host tag: drop-contains DROPME"
+./tcpflood -t 127.0.0.1 -m1 -Tudp -M "<13>Oct 15 12:00:00 host tag: keep-contains DROPm"
+./tcpflood -t 127.0.0.1 -m1 -Tudp -M "<13>Oct 15 12:00:00 host tag: keep-from"
+# the second listener drops everything from the loopback network
+./tcpflood -t 127.0.0.1 -p13515 -m1 -Tudp -M "<13>Oct 15 12:00:00 host tag: drop-from"
+./msleep 500 # UDP is asynchronous, give the listeners time to pick up everything
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cmp rsyslog.out.log $srcdir/resultdata/imudp-prefilter.log
+if [ ! $? -eq 0 ]; then
+  echo "imudp-prefilter.sh failed, output:"
+  cat rsyslog.out.log
+  exit 1
+fi
+source $srcdir/diag.sh exit
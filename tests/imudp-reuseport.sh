@@ -0,0 +1,23 @@
+# Test for the imudp "reuseport" parameter. Each of the three workers must
+# bind its own socket to the listen port, and messages must be received
+# through them.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imudp-reuseport.sh\]: test imudp SO_REUSEPORT listeners
+if [ ! -f /proc/net/udp ]; then
+    exit 77 # needs Linux /proc to count the sockets, skip this test
+fi
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imudp-reuseport.conf
+# 13514 is 34CA in the local address column
+nsock=`grep -c -i "^ *[0-9]*: 0100007F:34CA " /proc/net/udp`
+if [ $nsock -ne 3 ]; then
+  echo "error: expected 3 sockets on port 13514, found $nsock"
+  exit 1
+fi
+./tcpflood -t 127.0.0.1 -m500 -Tudp -o2000
+./msleep 500 # UDP is asynchronous, give the listener time to pick up everything
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 499
+source $srcdir/diag.sh exit
@@ -0,0 +1,18 @@
+# Test for the imudp "ring.interface" parameter. Datagrams sent to the
+# listener must be read from the packet ring on the loopback interface
+# (which the ring.drops listener counter shows) and all be received.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imudp-ring.sh\]: test imudp packet ring receive path
+if [ "$EUID" -ne 0 ]; then
+    exit 77 # a packet ring needs CAP_NET_RAW, skip this test
+fi
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imudp-ring.conf
+./tcpflood -t 127.0.0.1 -m500 -Tudp -o2000
+./msleep 500 # UDP is asynchronous, give the listener time to pick up everything
+source $srcdir/diag.sh wait-stats ": imudp\([^)]*13514\): submitted=500 ring.drops=0" 5
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 499
+source $srcdir/diag.sh exit
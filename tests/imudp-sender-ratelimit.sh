@@ -0,0 +1,22 @@
+# Test the imudp per-sender rate limit. A single sender floods the
+# listener; only the burst plus what refills during the run may pass,
+# and the rest must be counted as dropped.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imudp-sender-ratelimit.sh\]: test imudp per-sender rate limiting
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imudp-sender-ratelimit.conf
+./tcpflood -t 127.0.0.1 -m2000 -Tudp -o2000
+./msleep 1500 # UDP is asynchronous, and we need a stats interval
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh stats-check 'imudp\(w0\): .*ratelimit\.sender\.dropped=[1-9]'
+NUMLINES=`wc -l < rsyslog.out.log`
+if [ $NUMLINES -gt 150 ]; then
+	echo "error: $NUMLINES messages passed, but the limit allows only about 110"
+	exit 1
+fi
+head -n100 rsyslog.out.log > rsyslog.out.burst.log
+mv rsyslog.out.burst.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 99
+source $srcdir/diag.sh exit
@@ -0,0 +1,23 @@
+# Test for the imudp sender cache. Two senders send concurrently, so their
+# datagrams interleave. Both must be kept in the cache, so there must only
+# be a few misses, and the sender properties taken from the cache must be
+# correct.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imudp-sendercache.sh\]: test imudp sender cache
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup imudp-sendercache.conf
+./tcpflood -t 127.0.0.1 -m1000 -Tudp -o2000 &
+./tcpflood -t 127.0.0.1 -m1000 -i1000 -Tudp -o2000
+wait
+./msleep 500 # UDP is asynchronous, give the listener time to pick up everything
+source $srcdir/diag.sh wait-stats ": imudp\(w0\): .*msgs.received=2000 sendercache.hits=[0-9]+ sendercache.misses=[1-9] " 5
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 1999
+if [ `grep -c "^127.0.0.1$" rsyslog2.out.log` -ne 2000 ]; then
+  echo "error: wrong sender properties:"
+  sort rsyslog2.out.log | uniq -c
+  exit 1
+fi
+source $srcdir/diag.sh exit
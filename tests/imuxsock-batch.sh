@@ -0,0 +1,29 @@
+# Test batched reception and the pid metadata cache in imuxsock. A single
+# logger process sends 2000 messages as fast as it can to a non-system
+# socket with annotation on. All messages must arrive, each one with the
+# command name of the sending process, which must mostly come from the
+# pid cache.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imuxsock-batch.sh\]: test imuxsock batching and pid cache
+logger --help 2>&1 | grep -q -- '--socket' || exit 77 # logger too old
+source $srcdir/diag.sh init
+./inputfilegen 2000 > rsyslog.input
+source $srcdir/diag.sh startup imuxsock-batch.conf
+logger -d -u testbench_socket -f rsyslog.input
+if [ $? -ne 0 ]; then
+	echo "error: logger failed"
+	exit 1
+fi
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 2000
+source $srcdir/diag.sh wait-stats ": imuxsock: submitted=2000 .*pidcache.hits=[1-9]"
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 1999
+if [ $(grep -c ' _COMM=logger' rsyslog2.out.log) -ne 2000 ]; then
+	echo "error: messages without (correct) process annotation"
+	head rsyslog2.out.log
+	exit 1
+fi
+rm -f testbench_socket
+source $srcdir/diag.sh exit
@@ -0,0 +1,30 @@
+# Test batched submission across several imuxsock sockets. Two loggers
+# send concurrently to two sockets, so batches hold messages from both;
+# all messages must arrive. Then single messages are sent with pauses:
+# the batch is not full, but must be flushed before imuxsock waits for
+# new data, so each message has to show up before the next one is sent.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[imuxsock-multisocket.sh\]: test imuxsock batches across sockets
+logger --help 2>&1 | grep -q -- '--socket' || exit 77 # logger too old
+source $srcdir/diag.sh init
+./inputfilegen 2000 > rsyslog.input
+awk '{ printf("msgnum:%8.8d:\n", NR + 1999) }' rsyslog.input > rsyslog.out.input2.log
+source $srcdir/diag.sh startup imuxsock-multisocket.conf
+logger -d -u testbench_socket -f rsyslog.input &
+logger -d -u testbench_socket2 -f rsyslog.out.input2.log
+wait
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 4000
+for n in 4000 4001 4002 4003 4004; do
+	logger -d -u testbench_socket2 "msgnum:$n:"
+	# wait-file-lines waits 1 second at most here
+	source $srcdir/diag.sh wait-file-lines rsyslog.out.log $((n + 1)) 1
+	./msleep 300
+done
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+sort -n rsyslog.out.log > rsyslog.out.sorted.log
+mv rsyslog.out.sorted.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 4004
+rm -f testbench_socket testbench_socket2
+source $srcdir/diag.sh exit
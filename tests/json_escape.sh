@@ -0,0 +1,8 @@
+echo ===============================================================================
+echo \[json_escape.sh\]: test for json escaping of properties
+$srcdir/killrsyslog.sh # kill rsyslogd if it runs for some reason
+
+./nettester -tjson_escape -iudp
+if [ "$?" -ne "0" ]; then
+  exit 1
+fi
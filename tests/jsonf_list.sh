@@ -0,0 +1,8 @@
+echo ===============================================================================
+echo \[jsonf_list.sh\]: test for properties formatted as JSON fields
+$srcdir/killrsyslog.sh # kill rsyslogd if it runs for some reason
+
+./nettester -tjsonf_list -iudp
+if [ "$?" -ne "0" ]; then
+  exit 1
+fi
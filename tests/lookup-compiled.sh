@@ -0,0 +1,81 @@
+# Test compiled lookup tables. Tables of all types are compiled with
+# rslookuputil, and a dump of each compiled table must contain every row.
+# Then the same lookups as in lookup-tables.sh are done on the memory
+# mapped tables, including a reload of a recompiled hash table on HUP.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[lookup-compiled.sh\]: test compiled lookup tables
+source $srcdir/diag.sh init
+# $1 is the prefix of the hash table values
+gen_hash_table() {
+	echo '{ "version": 1, "nomatch": "hnone", "type": "hash", "table": [' > rsyslog.lookup.hash.json
+	for i in 0 1 2; do
+		echo "{ \"index\": \"$i\", \"value\": \"$1$i\" }," >> rsyslog.lookup.hash.json
+	done
+	echo "{ \"index\": \"3\", \"value\": \"${1}3\" } ] }" >> rsyslog.lookup.hash.json
+}
+gen_hash_table h
+cat > rsyslog.lookup.string.json <<'TABLE'
+{ "version": 1, "nomatch": "snone", "type": "string", "table": [
+  { "index": "3", "value": "s3" }, { "index": "1", "value": "s1" },
+  { "index": "0", "value": "s0" }, { "index": "2", "value": "s2" } ] }
+TABLE
+awk 'BEGIN {
+	printf("{ \"version\": 1, \"nomatch\": \"anone\", \"type\": \"array\", \"table\": [")
+	for(i = 9 ; i >= 0 ; --i)
+		printf("{ \"index\": %d, \"value\": \"a%d\" }%s", i + 100, i + 100, i ? ", " : "")
+	printf("] }\n")
+}' > rsyslog.lookup.array.json
+cat > rsyslog.lookup.sparse.json <<'TABLE'
+{ "version": 1, "nomatch": "pnone", "type": "sparseArray", "table": [
+  { "index": 500, "value": "p500" }, { "index": 10, "value": "p10" },
+  { "index": 100, "value": "p100" } ] }
+TABLE
+# compile all tables, each dump must have all values of the source
+compile_tables() {
+	for t in $*; do
+		../tools/rslookuputil -o rsyslog.lookup.$t.bin rsyslog.lookup.$t.json
+		if [ $? -ne 0 ]; then
+			echo "error: rslookuputil could not compile the $t table"
+			exit 1
+		fi
+		../tools/rslookuputil -d rsyslog.lookup.$t.bin > rsyslog.out.dump.log
+		for v in $(grep -o '"value": "[^"]*"' rsyslog.lookup.$t.json | cut -d'"' -f4); do
+			if ! grep -q "\"$v\"" rsyslog.out.dump.log; then
+				echo "error: value $v missing in dump of compiled $t table"
+				cat rsyslog.out.dump.log
+				exit 1
+			fi
+		done
+	done
+}
+compile_tables hash string array sparse
+source $srcdir/diag.sh startup lookup-compiled.conf
+source $srcdir/diag.sh tcpflood -m1000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 1000
+gen_hash_table H
+compile_tables hash
+source $srcdir/diag.sh issue-HUP
+./msleep 1000 # the reload is done asynchronously
+source $srcdir/diag.sh tcpflood -m1000 -i1000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+awk 'BEGIN {
+	for(n = 0 ; n < 2000 ; ++n) {
+		k = n % 5
+		h = (k < 4) ? ((n < 1000 ? "h" : "H") k) : "hnone"
+		s = (k < 4) ? "s" k : "snone"
+		k = n % 15 + 98
+		a = (k >= 100 && k <= 109) ? "a" k : "anone"
+		p = (n < 10) ? "pnone" : (n < 100) ? "p10" : (n < 500) ? "p100" : "p500"
+		printf("%d %s %s %s %s\n", n, h, s, a, p)
+	}
+}' > rsyslog.out.expected.log
+sort -n rsyslog.out.log > rsyslog.out.sorted.log
+if ! cmp rsyslog.out.expected.log rsyslog.out.sorted.log; then
+	echo "error: lookup results are not as expected"
+	diff rsyslog.out.expected.log rsyslog.out.sorted.log | head
+	exit 1
+fi
+rm -f rsyslog.lookup.*.json rsyslog.lookup.*.bin
+source $srcdir/diag.sh exit
@@ -0,0 +1,61 @@
+# Test the lookup table types and reloading. Four main queue workers look
+# up every message in a string, hash, array and sparseArray table, each
+# with keys that are not in the table. Then the hash table file is
+# changed and reloaded on HUP; later messages must get the new values.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[lookup-tables.sh\]: test lookup table types and reload
+source $srcdir/diag.sh init
+# $1 is the prefix of the hash table values
+gen_hash_table() {
+	echo '{ "version": 1, "nomatch": "hnone", "type": "hash", "table": [' > rsyslog.lookup.hash.json
+	for i in 0 1 2; do
+		echo "{ \"index\": \"$i\", \"value\": \"$1$i\" }," >> rsyslog.lookup.hash.json
+	done
+	echo "{ \"index\": \"3\", \"value\": \"${1}3\" } ] }" >> rsyslog.lookup.hash.json
+}
+gen_hash_table h
+cat > rsyslog.lookup.string.json <<'TABLE'
+{ "version": 1, "nomatch": "snone", "type": "string", "table": [
+  { "index": "3", "value": "s3" }, { "index": "1", "value": "s1" },
+  { "index": "0", "value": "s0" }, { "index": "2", "value": "s2" } ] }
+TABLE
+awk 'BEGIN {
+	printf("{ \"version\": 1, \"nomatch\": \"anone\", \"type\": \"array\", \"table\": [")
+	for(i = 9 ; i >= 0 ; --i)
+		printf("{ \"index\": %d, \"value\": \"a%d\" }%s", i + 100, i + 100, i ? ", " : "")
+	printf("] }\n")
+}' > rsyslog.lookup.array.json
+cat > rsyslog.lookup.sparse.json <<'TABLE'
+{ "version": 1, "nomatch": "pnone", "type": "sparseArray", "table": [
+  { "index": 500, "value": "p500" }, { "index": 10, "value": "p10" },
+  { "index": 100, "value": "p100" } ] }
+TABLE
+source $srcdir/diag.sh startup lookup-tables.conf
+source $srcdir/diag.sh tcpflood -m1000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 1000
+gen_hash_table H
+source $srcdir/diag.sh issue-HUP
+./msleep 1000 # the reload is done asynchronously
+source $srcdir/diag.sh tcpflood -m1000 -i1000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+awk 'BEGIN {
+	for(n = 0 ; n < 2000 ; ++n) {
+		k = n % 5
+		h = (k < 4) ? ((n < 1000 ? "h" : "H") k) : "hnone"
+		s = (k < 4) ? "s" k : "snone"
+		k = n % 15 + 98
+		a = (k >= 100 && k <= 109) ? "a" k : "anone"
+		p = (n < 10) ? "pnone" : (n < 100) ? "p10" : (n < 500) ? "p100" : "p500"
+		printf("%d %s %s %s %s\n", n, h, s, a, p)
+	}
+}' > rsyslog.out.expected.log
+sort -n rsyslog.out.log > rsyslog.out.sorted.log
+if ! cmp rsyslog.out.expected.log rsyslog.out.sorted.log; then
+	echo "error: lookup results are not as expected"
+	diff rsyslog.out.expected.log rsyslog.out.sorted.log | head
+	exit 1
+fi
+rm -f rsyslog.lookup.*.json
+source $srcdir/diag.sh exit
@@ -0,0 +1,18 @@
+# Test memory accounting and the global memory limit. A slow action
+# queue fills with large messages until the total exceeds memory.limit,
+# after which it must discard (and count) new messages. A disk-assisted
+# action queue in the same config spills to disk instead and must not
+# lose any message. The "memory" counter set must report queue bytes.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[memory-limit.sh\]: test memory accounting and memory.limit
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup memory-limit.conf
+source $srcdir/diag.sh tcpflood -m3000 -d4000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 3000
+source $srcdir/diag.sh wait-stats ': lossy queue: .*discarded\.memlimit=[1-9][0-9]*'
+source $srcdir/diag.sh stats-check ': memory: queues\.bytes=[1-9][0-9]* streams\.bytes=[0-9]+ '
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 2999
+source $srcdir/diag.sh exit
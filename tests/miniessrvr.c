@@ -0,0 +1,349 @@
+/* A minimal Elasticsearch stand-in for the testbench.
+ *
+ * It accepts HTTP/1.1 keep-alive connections, answers every HEAD or GET
+ * with an empty JSON object and every POST with a successful _bulk reply
+ * that has one item per two non-empty body lines (action line plus
+ * document). Bodies with "Content-Encoding: gzip" or "deflate" are
+ * inflated first. The values of all "msgnum":"N" fields are written to
+ * outfile, one per line. If reqlog is given, one line per POST is written
+ * to it:
+ *   host=<Host header> encoding=<gzip|deflate|none> wire=<n> body=<n> items=<n>
+ * where wire is the size as received and body the inflated size.
+ *
+ * usage: miniessrv ip-addr port outfile [reqlog]
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * This file is part of rsyslog.
+ *
+ * Rsyslog is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Rsyslog is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Rsyslog.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * A copy of the GPL can be found in the file "COPYING" in this distribution.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <zlib.h>
+
+static FILE *fpOut;
+static FILE *fpReqLog = NULL;
+static pthread_mutex_t mutOut = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+errout(char *reason)
+{
+	perror(reason);
+	exit(1);
+}
+
+
+/* growable buffer for a connection's input and the inflated body */
+typedef struct {
+	char *buf;
+	size_t len;
+	size_t size;
+} buf_t;
+
+static int
+bufReserve(buf_t *b, size_t add)
+{
+	char *n;
+	size_t newSize;
+
+	if(b->len + add + 1 <= b->size)
+		return 0;
+	newSize = (b->size == 0) ? 16384 : b->size;
+	while(newSize < b->len + add + 1)
+		newSize *= 2;
+	if((n = realloc(b->buf, newSize)) == NULL)
+		return -1;
+	b->buf = n;
+	b->size = newSize;
+	return 0;
+}
+
+
+/* read more data into b, returns 0 on EOF or error */
+static ssize_t
+readMore(int fd, buf_t *b)
+{
+	ssize_t nRead;
+
+	if(bufReserve(b, 65536) != 0)
+		return 0;
+	nRead = read(fd, b->buf + b->len, 65536);
+	if(nRead <= 0)
+		return 0;
+	b->len += nRead;
+	b->buf[b->len] = '\0';
+	return nRead;
+}
+
+
+static int
+writeAll(int fd, const char *data, size_t len)
+{
+	ssize_t nWritten;
+
+	while(len > 0) {
+		nWritten = write(fd, data, len);
+		if(nWritten <= 0)
+			return -1;
+		data += nWritten;
+		len -= nWritten;
+	}
+	return 0;
+}
+
+
+/* copy the value of header name from the header block hdr (terminated by
+ * the empty line) into val. val is empty if there is no such header.
+ */
+static void
+getHeader(const char *hdr, const char *name, char *val, size_t lenVal)
+{
+	const char *p = hdr;
+	size_t lenName = strlen(name);
+	size_t i;
+
+	val[0] = '\0';
+	while((p = strstr(p, "\r\n")) != NULL) {
+		p += 2;
+		if(p[0] == '\r')
+			return;
+		if(!strncasecmp(p, name, lenName) && p[lenName] == ':') {
+			p += lenName + 1;
+			while(*p == ' ')
+				++p;
+			for(i = 0 ; i < lenVal - 1 && p[i] != '\r' ; ++i)
+				val[i] = p[i];
+			val[i] = '\0';
+			return;
+		}
+	}
+}
+
+
+static int
+inflateBody(const char *data, size_t len, buf_t *out)
+{
+	z_stream zstrm;
+	int zRet;
+
+	memset(&zstrm, 0, sizeof(zstrm));
+	/* 32 + MAX_WBITS: detect gzip and zlib format automatically */
+	if(inflateInit2(&zstrm, 32 + MAX_WBITS) != Z_OK)
+		return -1;
+	zstrm.next_in = (Bytef*) data;
+	zstrm.avail_in = len;
+	out->len = 0;
+	do {
+		if(bufReserve(out, 65536) != 0) {
+			inflateEnd(&zstrm);
+			return -1;
+		}
+		zstrm.next_out = (Bytef*) out->buf + out->len;
+		zstrm.avail_out = 65536;
+		zRet = inflate(&zstrm, Z_NO_FLUSH);
+		out->len = zstrm.total_out;
+	} while(zRet == Z_OK);
+	inflateEnd(&zstrm);
+	out->buf[out->len] = '\0';
+	return (zRet == Z_STREAM_END) ? 0 : -1;
+}
+
+
+/* write the msgnum values of a bulk body to the output file and return
+ * the number of bulk items.
+ */
+static int
+processBulk(const char *body, size_t len)
+{
+	const char *p = body;
+	const char *end = body + len;
+	const char *eol;
+	const char *m;
+	int nLines = 0;
+
+	pthread_mutex_lock(&mutOut);
+	while(p < end) {
+		if((eol = memchr(p, '\n', end - p)) == NULL)
+			eol = end;
+		if(eol > p)
+			++nLines;
+		for(m = p ; (m = strstr(m, "\"msgnum\":\"")) != NULL && m < eol ; ) {
+			m += sizeof("\"msgnum\":\"") - 1;
+			while(isdigit((unsigned char) *m))
+				fputc(*m++, fpOut);
+			fputc('\n', fpOut);
+		}
+		p = eol + 1;
+	}
+	fflush(fpOut);
+	pthread_mutex_unlock(&mutOut);
+	return nLines / 2;
+}
+
+
+static void *
+connHandler(void *arg)
+{
+	int fdc = (int) (long) arg;
+	buf_t in = { NULL, 0, 0 };
+	buf_t body = { NULL, 0, 0 };
+	buf_t reply = { NULL, 0, 0 };
+	char *hdrEnd;
+	size_t lenHdr;
+	size_t lenBody;
+	char method[16];
+	char hdrVal[256];
+	char host[256];
+	char encoding[32];
+	char sendBuf[128];
+	const char *data;
+	size_t lenData;
+	int nItems;
+	int i;
+
+	while(1) {
+		while((hdrEnd = strstr(in.buf == NULL ? "" : in.buf, "\r\n\r\n")) == NULL) {
+			if(readMore(fdc, &in) == 0)
+				goto done;
+		}
+		lenHdr = hdrEnd + 4 - in.buf;
+		if(sscanf(in.buf, "%15s", method) != 1)
+			goto done;
+		getHeader(in.buf, "Content-Length", hdrVal, sizeof(hdrVal));
+		lenBody = strtoul(hdrVal, NULL, 10);
+		getHeader(in.buf, "Expect", hdrVal, sizeof(hdrVal));
+		if(!strcasecmp(hdrVal, "100-continue")) {
+			if(writeAll(fdc, "HTTP/1.1 100 Continue\r\n\r\n", 25) != 0)
+				goto done;
+		}
+		while(in.len < lenHdr + lenBody) {
+			if(readMore(fdc, &in) == 0)
+				goto done;
+		}
+
+		if(strcmp(method, "POST")) {
+			snprintf(sendBuf, sizeof(sendBuf), "HTTP/1.1 200 OK\r\n"
+				"Content-Type: application/json\r\nContent-Length: 2\r\n\r\n%s",
+				strcmp(method, "HEAD") ? "{}" : "");
+			if(writeAll(fdc, sendBuf, strlen(sendBuf)) != 0)
+				goto done;
+		} else {
+			getHeader(in.buf, "Host", host, sizeof(host));
+			getHeader(in.buf, "Content-Encoding", encoding, sizeof(encoding));
+			data = in.buf + lenHdr;
+			lenData = lenBody;
+			if(encoding[0] != '\0') {
+				if(inflateBody(in.buf + lenHdr, lenBody, &body) != 0) {
+					fprintf(stderr, "miniessrv: can not inflate %s body\n", encoding);
+					goto done;
+				}
+				data = body.buf;
+				lenData = body.len;
+			}
+			nItems = processBulk(data, lenData);
+			if(fpReqLog != NULL) {
+				pthread_mutex_lock(&mutOut);
+				fprintf(fpReqLog, "host=%s encoding=%s wire=%lu body=%lu items=%d\n",
+					host, encoding[0] == '\0' ? "none" : encoding,
+					(unsigned long) lenBody, (unsigned long) lenData, nItems);
+				fflush(fpReqLog);
+				pthread_mutex_unlock(&mutOut);
+			}
+
+			reply.len = 0;
+			if(bufReserve(&reply, 64 + nItems * 32) != 0)
+				goto done;
+			reply.len = sprintf(reply.buf, "{\"took\":1,\"errors\":false,\"items\":[");
+			for(i = 0 ; i < nItems ; ++i)
+				reply.len += sprintf(reply.buf + reply.len, "%s{\"index\":{\"status\":201}}",
+					(i == 0) ? "" : ",");
+			reply.len += sprintf(reply.buf + reply.len, "]}");
+			snprintf(sendBuf, sizeof(sendBuf), "HTTP/1.1 200 OK\r\n"
+				"Content-Type: application/json\r\nContent-Length: %lu\r\n\r\n",
+				(unsigned long) reply.len);
+			if(   writeAll(fdc, sendBuf, strlen(sendBuf)) != 0
+			   || writeAll(fdc, reply.buf, reply.len) != 0)
+				goto done;
+		}
+
+		/* keep what the client already sent of its next request */
+		in.len -= lenHdr + lenBody;
+		memmove(in.buf, in.buf + lenHdr + lenBody, in.len);
+		in.buf[in.len] = '\0';
+	}
+
+done:
+	close(fdc);
+	free(in.buf);
+	free(body.buf);
+	free(reply.buf);
+	return NULL;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int fds;
+	int fdc;
+	int on = 1;
+	struct sockaddr_in srvAddr;
+	pthread_t thrd;
+	pthread_attr_t attr;
+
+	if(argc != 4 && argc != 5) {
+		fprintf(stderr, "usage: miniessrv ip-addr port outfile [reqlog]\n");
+		exit(1);
+	}
+
+	if((fpOut = fopen(argv[3], "w")) == NULL)
+		errout(argv[3]);
+	if(argc == 5 && (fpReqLog = fopen(argv[4], "w")) == NULL)
+		errout(argv[4]);
+	signal(SIGPIPE, SIG_IGN);
+
+	fds = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(fds, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&srvAddr, 0, sizeof(srvAddr));
+	srvAddr.sin_family = AF_INET;
+	srvAddr.sin_addr.s_addr = inet_addr(argv[1]);
+	srvAddr.sin_port = htons(atoi(argv[2]));
+	if(bind(fds, (struct sockaddr *)&srvAddr, sizeof(srvAddr)) != 0)
+		errout("bind");
+	if(listen(fds, 20) != 0) errout("listen");
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	while(1) {
+		if((fdc = accept(fds, NULL, NULL)) == -1)
+			continue;
+		if(pthread_create(&thrd, &attr, connHandler, (void*) (long) fdc) != 0)
+			close(fdc);
+	}
+	/* NOTREACHED */
+	return 0;
+}
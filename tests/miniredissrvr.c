@@ -0,0 +1,228 @@
+/* A minimal Redis stand-in for the testbench.
+ *
+ * It reads commands in RESP format from any number of connections. For
+ * LPUSH and RPUSH, one line "key value" per pushed value is written to
+ * outfile, in the order the values were sent, and the number of values
+ * is replied. PING is answered with PONG and CLUSTER with an error (no
+ * cluster support), everything else with OK.
+ *
+ * usage: miniredissrv ip-addr port outfile
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * This file is part of rsyslog.
+ *
+ * Rsyslog is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Rsyslog is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Rsyslog.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * A copy of the GPL can be found in the file "COPYING" in this distribution.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#define MAX_ARGS 8192
+
+static FILE *fpOut;
+static pthread_mutex_t mutOut = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+errout(char *reason)
+{
+	perror(reason);
+	exit(1);
+}
+
+
+/* parse a number terminated by CRLF at buf[*pOffs], behind the type
+ * character. Returns 0 if the line is incomplete.
+ */
+static int
+parseNum(const char *buf, size_t len, size_t *pOffs, long *pNum)
+{
+	const char *eol;
+
+	if(*pOffs + 1 >= len)
+		return 0;
+	if((eol = memchr(buf + *pOffs, '\n', len - *pOffs)) == NULL)
+		return 0;
+	*pNum = strtol(buf + *pOffs + 1, NULL, 10);
+	*pOffs = eol + 1 - buf;
+	return 1;
+}
+
+
+/* parse one command in RESP format at the start of buf. Returns the number
+ * of bytes it takes, 0 if it is incomplete and -1 if it is malformed.
+ */
+static long
+parseCmd(char *buf, size_t len, long *pNArgs, char **args, long *lens)
+{
+	size_t offs = 0;
+	long nArgs;
+	long i;
+
+	if(!parseNum(buf, len, &offs, &nArgs))
+		return 0;
+	if(buf[0] != '*' || nArgs < 1 || nArgs > MAX_ARGS)
+		return -1;
+	for(i = 0 ; i < nArgs ; ++i) {
+		if(offs < len && buf[offs] != '$')
+			return -1;
+		if(!parseNum(buf, len, &offs, &lens[i]))
+			return 0;
+		if(lens[i] < 0)
+			return -1;
+		if(offs + lens[i] + 2 > len)
+			return 0;
+		args[i] = buf + offs;
+		offs += lens[i] + 2;
+	}
+	*pNArgs = nArgs;
+	return (long) offs;
+}
+
+
+static int
+writeStr(int fd, const char *str)
+{
+	size_t len = strlen(str);
+	ssize_t nWritten;
+
+	while(len > 0) {
+		if((nWritten = write(fd, str, len)) <= 0)
+			return -1;
+		str += nWritten;
+		len -= nWritten;
+	}
+	return 0;
+}
+
+
+#define IS_CMD(i, name) (lens[i] == sizeof(name) - 1 && !strncasecmp(args[i], name, lens[i]))
+
+static void *
+connHandler(void *arg)
+{
+	int fdc = (int) (long) arg;
+	char *buf = NULL;
+	char *newBuf;
+	size_t len = 0;
+	size_t size = 0;
+	ssize_t nRead;
+	char **args;
+	long *lens;
+	long nArgs;
+	long lenCmd;
+	char reply[64];
+	long i;
+
+	args = malloc(MAX_ARGS * sizeof(char*));
+	lens = malloc(MAX_ARGS * sizeof(long));
+	if(args == NULL || lens == NULL)
+		goto done;
+	while(1) {
+		while((lenCmd = parseCmd(buf, len, &nArgs, args, lens)) == 0) {
+			if(size - len < 65536) {
+				if((newBuf = realloc(buf, size + 65536)) == NULL)
+					goto done;
+				buf = newBuf;
+				size += 65536;
+			}
+			if((nRead = read(fdc, buf + len, size - len)) <= 0)
+				goto done;
+			len += nRead;
+		}
+		if(lenCmd < 0) {
+			fprintf(stderr, "miniredissrv: malformed command\n");
+			goto done;
+		}
+
+		if((IS_CMD(0, "RPUSH") || IS_CMD(0, "LPUSH")) && nArgs >= 3) {
+			pthread_mutex_lock(&mutOut);
+			for(i = 2 ; i < nArgs ; ++i)
+				fprintf(fpOut, "%.*s %.*s\n", (int) lens[1], args[1],
+					(int) lens[i], args[i]);
+			fflush(fpOut);
+			pthread_mutex_unlock(&mutOut);
+			snprintf(reply, sizeof(reply), ":%ld\r\n", nArgs - 2);
+		} else if(IS_CMD(0, "PING")) {
+			strcpy(reply, "+PONG\r\n");
+		} else if(IS_CMD(0, "CLUSTER")) {
+			strcpy(reply, "-ERR This instance has cluster support disabled\r\n");
+		} else {
+			strcpy(reply, "+OK\r\n");
+		}
+		if(writeStr(fdc, reply) != 0)
+			break;
+
+		len -= lenCmd;
+		memmove(buf, buf + lenCmd, len);
+	}
+done:
+	close(fdc);
+	free(buf);
+	free(args);
+	free(lens);
+	return NULL;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int fds;
+	int fdc;
+	int on = 1;
+	struct sockaddr_in srvAddr;
+	pthread_t thrd;
+	pthread_attr_t attr;
+
+	if(argc != 4) {
+		fprintf(stderr, "usage: miniredissrv ip-addr port outfile\n");
+		exit(1);
+	}
+
+	if((fpOut = fopen(argv[3], "w")) == NULL)
+		errout(argv[3]);
+	signal(SIGPIPE, SIG_IGN);
+
+	fds = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(fds, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&srvAddr, 0, sizeof(srvAddr));
+	srvAddr.sin_family = AF_INET;
+	srvAddr.sin_addr.s_addr = inet_addr(argv[1]);
+	srvAddr.sin_port = htons(atoi(argv[2]));
+	if(bind(fds, (struct sockaddr *)&srvAddr, sizeof(srvAddr)) != 0)
+		errout("bind");
+	if(listen(fds, 20) != 0) errout("listen");
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	while(1) {
+		if((fdc = accept(fds, NULL, NULL)) == -1)
+			continue;
+		if(pthread_create(&thrd, &attr, connHandler, (void*) (long) fdc) != 0)
+			close(fdc);
+	}
+	/* NOTREACHED */
+	return 0;
+}
@@ -0,0 +1,29 @@
+# Test mmaggregate with several workers: the summaries of all intervals
+# together must account for every message, no matter which worker
+# aggregated it, and droporiginals must end processing of the aggregated
+# messages only.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmaggregate.sh\]: test mmaggregate interval sums across workers
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup mmaggregate.conf
+source $srcdir/diag.sh injectmsg 0 20000
+# a value that is not a number can not be aggregated and must pass
+./tcpflood -m1 -M "<13>Oct 15 12:00:00 host tag: msgnum:abc:"
+source $srcdir/diag.sh wait-queueempty
+./msleep 3000 # let the summary thread emit the last interval
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ "`cat rsyslog.out.log`" != "abc" ]; then
+  echo "only the message that could not be aggregated must pass, but got:"
+  head rsyslog.out.log
+  exit 1
+fi
+awk '{ c += $1; s += $2 } END { if(c != 20000 || s != 199990000) {
+	printf("summaries count %d messages with sum %.0f, expected 20000 and 199990000\n", c, s);
+	exit 1 } }' rsyslog2.out.log
+if [ "$?" -ne "0" ]; then
+  cat rsyslog2.out.log
+  exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,20 @@
+# Check IPv6 anonymization in mmanon rewrite mode, together with IPv4
+# addresses, messages without a colon and colon-separated non-addresses.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[mmanon_ipv6.sh\]: testing mmanon ipv6 anonymization
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup mmanon_ipv6.conf
+./tcpflood -m1 -M "<129>Mar 10 01:00:00 host tag: src=2001:db8:85a3:8d3:1319:8a2e:370:7348 dst=fe80::1"
+./tcpflood -m1 -M "<129>Mar 10 01:00:00 host tag: login from 192.168.10.20 at 12:30:45 ok"
+./tcpflood -m1 -M "<129>Mar 10 01:00:00 host tag: plain v4 10.1.2.3, no colon"
+./tcpflood -m1 -M "<129>Mar 10 01:00:00 host tag: mac 00:1b:44:11:3a:b7 stays"
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cmp rsyslog.out.log $srcdir/resultdata/mmanon_ipv6.log
+if [ ! $? -eq 0 ]; then
+	echo "unexpected mmanon results:"
+	cat rsyslog.out.log
+	exit 1
+fi;
+source $srcdir/diag.sh exit
@@ -0,0 +1,22 @@
+# Check that mmanon on a copy of a large message (made by "call" of a
+# ruleset with its own queue, which shares the raw message) does not
+# modify the original.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[mmanon_msgdup.sh\]: testing mmanon on a duplicated message
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup mmanon_msgdup.conf
+./tcpflood -m1000 -M "<129>Mar 10 01:00:00 host tag: client 192.168.10.20 connected via 2001:db8:85a3:8d3:1319:8a2e:370:7348 with a message that is long enough to be shared"
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ "`grep -c ' client 192.168.10.20 connected via 2001:db8:85a3:8d3:1319:8a2e:370:7348 ' rsyslog.out.log`" != "1000" ]; then
+	echo "original message was modified:"
+	sort rsyslog.out.log | uniq -c
+	exit 1
+fi
+if [ "`grep -c ' client 192.168.0.0 connected via 2001:db8:: ' rsyslog2.out.log`" != "1000" ]; then
+	echo "copy was not anonymized:"
+	sort rsyslog2.out.log | uniq -c
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,31 @@
+# Test the stats and summary output of mmcount. Four main queue workers
+# count messages locally and merge them periodically. Workers merge only
+# when they process a message, so marker messages are sent until all
+# counts have arrived. The totals must then be exact in both the impstats
+# counters (per severity) and the summary messages (per key value).
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmcount-stats.sh\]: test mmcount stats and summary output
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup mmcount-stats.conf
+source $srcdir/diag.sh tcpflood -m10000 -P167
+source $srcdir/diag.sh tcpflood -m5000 -i10000 -P164
+STATS_RE=': mmcount\(tag\): emerg=0 alert=0 crit=0 err=0 warning=5000 notice=[1-9][0-9]* info=0 debug=10000$'
+for i in `seq 1 30`; do
+	./msleep 1500
+	./tcpflood -m1 -i20000 -P165 > /dev/null
+	if grep -qE "$STATS_RE" rsyslog.out.stats.log && \
+	   tail -1 rsyslog2.out.log 2>/dev/null | grep '"g0": *5000' | grep '"g1": *5000' | \
+	   grep -q '"g2": *5000'; then
+		break
+	fi
+done
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh stats-check "$STATS_RE"
+if ! tail -1 rsyslog2.out.log | grep '"g0": *5000' | grep '"g1": *5000' | grep -q '"g2": *5000'; then
+	echo "error: summary message does not have the expected counts:"
+	tail -1 rsyslog2.out.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
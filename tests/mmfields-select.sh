@@ -0,0 +1,48 @@
+# Test field selection in mmfields and shared field() splits in
+# RainerScript. mmfields must add only the selected fields, and
+# field() calls on the same property must return the same values as a
+# fresh split, in any order and also beyond the first 64 fields. One
+# message is larger than 32KiB.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmfields-select.sh\]: test mmfields field selection and shared field splits
+source $srcdir/diag.sh init
+# $1 is the file name, $2 is 1 for the input and 0 for the expected result
+gendata() {
+	awk -v input=$2 'BEGIN {
+		pad = "x"
+		while(length(pad) < 40000)
+			pad = pad pad
+		for(n = 0 ; n < 1000 ; ++n) {
+			for(i = 2 ; i <= 100 ; ++i)
+				v[i] = "v" i "_" n
+			if(n == 999)
+				v[3] = v[3] substr(pad, 1, 40000)
+			if(input) {
+				printf("<167>Mar  1 01:00:00 172.20.245.8 tag msgnum:%8.8d:", n)
+				for(i = 2 ; i <= 100 ; ++i)
+					printf(",%s", v[i])
+				printf("\n")
+			} else {
+				printf("%8.8d %s %s %s %s %s %s\n", n, v[2], v[70], v[3], v[90], v[70], v[2])
+			}
+		}
+	}' > $1
+}
+gendata rsyslog.input 1
+gendata rsyslog.out.expected.log 0
+source $srcdir/diag.sh startup mmfields-select.conf
+source $srcdir/diag.sh tcpflood -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if ! cmp rsyslog.out.expected.log rsyslog.out.log; then
+	echo "error: field values are not as expected"
+	diff rsyslog.out.expected.log rsyslog.out.log | cut -c1-200 | head
+	exit 1
+fi
+if [ "$(grep -cE '^\{ *"f2": *"[^"]*", *"f70": *"[^"]*" *\}$' rsyslog2.out.log)" -ne 1000 ]; then
+	echo "error: mmfields added fields that were not selected:"
+	head -3 rsyslog2.out.log | cut -c1-200
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,39 @@
+# Test the fast parser of mmjsonparse. Each message is parsed once with
+# the fast parser and once with the json-c parser, each into its own
+# container. Both trees must be identical, including escaped strings,
+# nested objects and arrays. Malformed JSON must be rejected by the fast
+# parser, and invalid parameters must be reported.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmjsonparse-fast.sh\]: test mmjsonparse fast parser
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check mmjsonparse-fast-invalid.conf 1
+source $srcdir/diag.sh check-errmsg "invalid parser 'simd', must be 'json-c' or 'fast'"
+source $srcdir/diag.sh check-errmsg "container must be a JSON variable like"
+awk 'BEGIN {
+	for(i = 0 ; i < 1000 ; ++i) {
+		printf("<167>Mar  1 01:00:00 172.20.245.8 tag @cee:{\"num\":%d,", i);
+		printf("\"s\":\"q\\\" b\\\\ n\\n t\\t u\\u00e9\\u20ac\",");
+		printf("\"arr\":[1,2.5,-300,true,false,null,[]],");
+		printf("\"o\":{\"k\":\"v\",\"e\":{},\"n\":{\"x\":%d}}}\n", i);
+	}
+	for(i = 0 ; i < 10 ; ++i)
+		printf("<167>Mar  1 01:00:00 172.20.245.8 tag @cee:{\"broken\":\"x\",\n");
+}' > rsyslog.input
+source $srcdir/diag.sh startup mmjsonparse-fast.conf
+source $srcdir/diag.sh tcpflood -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 999
+if ! cmp rsyslog2.out.log rsyslog3.out.log; then
+	echo "error: fast parser result differs from json-c result"
+	diff rsyslog2.out.log rsyslog3.out.log | head
+	exit 1
+fi
+if [ "$(grep -c '^FAIL$' rsyslog4.out.log)" -ne 10 ] || \
+   [ "$(cat rsyslog4.out.log | wc -l)" -ne 10 ]; then
+	echo "error: malformed JSON not rejected by the fast parser"
+	cat rsyslog4.out.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,28 @@
+# Test the fields and prefilter parameters of mmnormalize. Only the
+# selected field may show up in the message, the other parsed ones must
+# be dropped. Messages without the prefilter string must not be
+# normalized at all, even though the rulebase has a rule matching them.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmnormalize-fields.sh\]: test mmnormalize fields and prefilter
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup mmnormalize-fields.conf
+source $srcdir/diag.sh tcpflood -m1000
+./tcpflood -M "<167>nomatch but catch-all rule"
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 999
+if grep -q '"host"\|"pri"' rsyslog2.out.log; then
+	echo "error: parsed fields that were not selected were added to the message"
+	exit 1
+fi
+if [ "$(cat rsyslog2.out.log | wc -l)" -ne 1000 ]; then
+	echo "error: JSON tree not written for every normalized message"
+	exit 1
+fi
+if [ "$(cat rsyslog3.out.log)" != "FAIL" ]; then
+	echo "error: message without the prefilter string was normalized:"
+	cat rsyslog3.out.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,41 @@
+# Test the sd parameter of mmpstrucdata. One action adds only a selected
+# SD-PARAM and a selected SD-ELEMENT, another one adds the full structured
+# data. The selected values must match the full ones, nothing else may be
+# added by the first action, and escapes must be handled correctly.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmpstrucdata-select.sh\]: test mmpstrucdata sd selection
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check mmpstrucdata-select-invalid.conf 1
+source $srcdir/diag.sh check-errmsg 'invalid entry 1 in parameter "sd"'
+# $1 is the file name, $2 is 1 for the input and 0 for the expected result
+gendata() {
+	awk -v input=$2 'BEGIN {
+		for(n = 0 ; n < 1000 ; ++n) {
+			if(input)
+				printf("<165>1 2003-10-11T22:14:15.003Z host app - ID47 " \
+				       "[origin ip=\"10.0.%d.%d\" software=\"x\\]y\\\"z\"]" \
+				       "[meta sequenceId=\"%d\"][exampleSDID@32473 iut=\"3\"] " \
+				       "msgnum:%8.8d:\n", n / 256, n % 256, n, n)
+			else
+				printf("%8.8d 10.0.%d.%d %d x]y\"z 3\n", n, n / 256, n % 256, n)
+		}
+	}' > $1
+}
+gendata rsyslog.input 1
+gendata rsyslog.out.expected.log 0
+source $srcdir/diag.sh startup mmpstrucdata-select.conf
+source $srcdir/diag.sh tcpflood -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if ! cmp rsyslog.out.expected.log rsyslog.out.log; then
+	echo "error: structured data values are not as expected"
+	diff rsyslog.out.expected.log rsyslog.out.log | head
+	exit 1
+fi
+if grep -q 'software\|examplesdid' rsyslog2.out.log; then
+	echo "error: mmpstrucdata added structured data that was not selected:"
+	head -3 rsyslog2.out.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
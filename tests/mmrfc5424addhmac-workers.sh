@@ -0,0 +1,39 @@
+# Test mmrfc5424addhmac with several workers, each of which reuses its
+# own keyed HMAC context. Every RFC5424 message must get an HMAC of its
+# raw message, which is checked against openssl for a sample of the
+# messages. A message that already carries the SD-ID must be left alone.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmrfc5424addhmac-workers.sh\]: test mmrfc5424addhmac with reused contexts
+if ! echo | openssl dgst -sha256 -hmac testkey > /dev/null 2>&1; then
+	echo "openssl command line tool not usable, skipping test"
+	exit 77
+fi
+source $srcdir/diag.sh init
+awk 'BEGIN {
+	for(n = 0 ; n < 1000 ; ++n)
+		printf("<165>1 2003-10-11T22:14:15.003Z host app %d ID%d - msgnum:%8.8d:\n",
+		       n, n % 7, n)
+	printf("<165>1 2003-10-11T22:14:15.003Z host app - - [hmac hash=\"given\"] msgnum:00001000:\n")
+}' > rsyslog.input
+source $srcdir/diag.sh startup mmrfc5424addhmac-workers.conf
+source $srcdir/diag.sh tcpflood -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ "$(grep -c '^[0-9]*|\[hmac hash="[0-9a-f]\{64\}"\]|' rsyslog.out.log)" -ne 1000 ]; then
+	echo "error: not every message got exactly one HMAC"
+	exit 1
+fi
+if ! grep -q '^00001000|\[hmac hash="given"\]|' rsyslog.out.log; then
+	echo "error: existing HMAC was modified or a second one was added"
+	grep '^00001000' rsyslog.out.log
+	exit 1
+fi
+grep '^[0-9]*0|' rsyslog.out.log | grep -v '^00001000' | while IFS='|' read num sd raw; do
+	hash=$(printf '%s' "$raw" | openssl dgst -sha256 -hmac testkey | sed 's/.*= *//')
+	if [ "$sd" != "[hmac hash=\"$hash\"]" ]; then
+		echo "error: wrong HMAC for message $num: $sd, expected $hash"
+		exit 1
+	fi
+done || exit 1
+source $srcdir/diag.sh exit
@@ -0,0 +1,19 @@
+# Test mmsequence counters under concurrency. Four main queue workers
+# advance an instance counter and a key counter that is shared by two
+# action instances. Each of them must hand out every value exactly once.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmsequence-concurrent.sh\]: test mmsequence with concurrent workers
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup mmsequence-concurrent.conf
+source $srcdir/diag.sh tcpflood -m20000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+seq 0 19999 > rsyslog.out.expected.log
+for col in 1 2 3; do
+	if ! cut -d, -f$col rsyslog.out.log | sort -n | cmp - rsyslog.out.expected.log; then
+		echo "error: column $col of the output is not a permutation of 0..19999"
+		exit 1
+	fi
+done
+source $srcdir/diag.sh exit
@@ -0,0 +1,47 @@
+# Test mmutf8fix in utf-8 mode with invalid sequences at all offsets
+# relative to the blocks in which US-ASCII runs are skipped. Valid multi-
+# byte characters must be kept, every byte of an invalid sequence must be
+# replaced, and pure US-ASCII messages must pass unchanged.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mmutf8fix-ascii-blocks.sh\]: test mmutf8fix with long US-ASCII runs
+source $srcdir/diag.sh init
+# $1 is the file name, $2 is 1 for the input and 0 for the expected result
+gendata() {
+	LC_ALL=C awk -v input=$2 'function run(c, n,   s) {
+		s = ""
+		while(n-- > 0)
+			s = s c
+		return s
+	}
+	BEGIN {
+		for(k = 0 ; k < 100 ; ++k) {
+			if(input)
+				printf("<167>Mar  1 01:00:00 172.20.245.8 tag msgnum:%8.8d:", k);
+			else
+				printf("%8.8d ", k);
+			printf("%s%s%s", run("a", k), input ? sprintf("%c", 255) : "?", run("b", 40));
+			printf("%c%c%s", 195, 169, run("c", k));
+			printf("%s%s\n", input ? sprintf("%c", 195) : "?", run("d", 70));
+		}
+		for(k = 100 ; k < 110 ; ++k) {
+			if(input)
+				printf("<167>Mar  1 01:00:00 172.20.245.8 tag msgnum:%8.8d:", k);
+			else
+				printf("%8.8d ", k);
+			printf("%s\n", run("x", k * 3));
+		}
+	}' > $1
+}
+gendata rsyslog.input 1
+gendata rsyslog.out.expected.log 0
+source $srcdir/diag.sh startup mmutf8fix-ascii-blocks.conf
+source $srcdir/diag.sh tcpflood -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if ! cmp rsyslog.out.expected.log rsyslog.out.log; then
+	echo "error: mmutf8fix output is not as expected"
+	diff rsyslog.out.expected.log rsyslog.out.log | head
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,23 @@
+# Test batched inserts in ommongodb. Transactions of up to 500 documents
+# are inserted unordered with an acknowledged write concern. All messages
+# must be stored. Needs a MongoDB on 127.0.0.1:27017 and the mongo shell,
+# the test is skipped otherwise.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[mongodb-bulk.sh\]: test ommongodb batch inserts
+MONGO=$(type -p mongosh mongo | head -1)
+if [ -z "$MONGO" ] || ! $MONGO --quiet --eval 'db.version()' > /dev/null 2>&1; then
+	echo "no MongoDB on 127.0.0.1:27017, skipping test"
+	exit 77
+fi
+source $srcdir/diag.sh init
+$MONGO --quiet rsyslog_testbench --eval 'db.log.drop()' > /dev/null
+source $srcdir/diag.sh startup mongodb-bulk.conf
+source $srcdir/diag.sh injectmsg 0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+$MONGO --quiet rsyslog_testbench \
+	--eval 'db.log.find({}, {msg: 1}).forEach(function(d) { print(d.msg); })' | \
+	sed -n 's/.*msgnum:\([0-9]*\):.*/\1/p' > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
@@ -0,0 +1,38 @@
+# Stress the lazily formatted message properties. Four actions, each
+# with its own queue and two workers, render every timestamp format of
+# the same messages at the same time, together with the emulated
+# APP-NAME and PROCID of legacy messages. All four outputs must be
+# identical, and as all messages carry the same timestamp, each format
+# must have a single value per message format.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[msg-lazyfmt-workers.sh\]: test lazy property formatting with many workers
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup msg-lazyfmt-workers.conf
+source $srcdir/diag.sh tcpflood -c4 -m25000 -y
+source $srcdir/diag.sh tcpflood -c4 -m25000 -i25000
+for i in 1 2 3 4; do
+	source $srcdir/diag.sh wait-file-lines rsyslog.out.$i.log 50000 60
+done
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+for i in 1 2 3 4; do
+	sort rsyslog.out.$i.log > rsyslog.out.sorted$i.log
+done
+for i in 2 3 4; do
+	if ! cmp rsyslog.out.sorted1.log rsyslog.out.sorted$i.log; then
+		echo "error: action $i rendered different properties than action 1"
+		diff rsyslog.out.sorted1.log rsyslog.out.sorted$i.log | head
+		exit 1
+	fi
+done
+awk -F, '{ k = ($1 < 25000) ? "rfc5424" : "legacy"
+	v = $2 "," $3 "," $4 "," $5 "," $6 "," $7
+	if((k in ts) && ts[k] != v) {
+		print "error: timestamp formats differ: " ts[k] " vs. " v
+		exit 1
+	}
+	ts[k] = v }' rsyslog.out.1.log || exit 1
+cut -d, -f1 rsyslog.out.sorted1.log > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 49999
+source $srcdir/diag.sh exit
@@ -0,0 +1,29 @@
+# Test the msggen traffic generator. Several threads send rate-limited
+# RFC5424 messages of varying size via TCP and JSON messages via a
+# local socket. The union of all threads must be one complete sequence
+# per target.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[msggen.sh\]: test multi-threaded msggen
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup msggen.conf
+../tools/msggen -t tcp:127.0.0.1:13514 -T4 -m2500 -r20000 -f 5424 -s uniform:60:400
+if [ $? -ne 0 ]; then
+	echo "error: msggen via TCP failed"
+	exit 1
+fi
+../tools/msggen -t uxsock:testbench_socket -T2 -m1000 -r5000 -f json
+if [ $? -ne 0 ]; then
+	echo "error: msggen via local socket failed"
+	exit 1
+fi
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+rm -f testbench_socket
+grep -o 'msgnum:[0-9]*' rsyslog2.out.log | cut -d: -f2 | sort -n > rsyslog.out.ux.log
+grep -o 'msgnum:[0-9]*' rsyslog.out.log | cut -d: -f2 | sort -n > rsyslog.out.tcp.log
+mv rsyslog.out.tcp.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 9999
+mv rsyslog.out.ux.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 1999
+source $srcdir/diag.sh exit
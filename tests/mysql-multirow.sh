@@ -0,0 +1,26 @@
+# Test multi-row INSERTs and prepared statements in ommysql. The
+# messages are first written with multirow="on" and a small maxbytes, so
+# that each transaction is split into several multi-row INSERTs, and then
+# through a prepared statement with bound values. Both runs must store
+# all messages. A statement without template must be reported.
+# This file is part of the rsyslog project, released under GPLv3
+echo ===============================================================================
+echo \[mysql-multirow.sh\]: test ommysql multi-row inserts and prepared statements
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check mysql-multirow-invalid.conf 1
+source $srcdir/diag.sh check-errmsg '"statement" requires a template'
+mysql --user=rsyslog --password=testbench < testsuites/mysql-truncate.sql
+source $srcdir/diag.sh startup mysql-multirow.conf
+source $srcdir/diag.sh injectmsg 0 5000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+mysql -s --user=rsyslog --password=testbench < testsuites/mysql-select-msg.sql > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 4999
+mysql --user=rsyslog --password=testbench < testsuites/mysql-truncate.sql
+source $srcdir/diag.sh startup mysql-statement.conf
+source $srcdir/diag.sh injectmsg 0 5000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+mysql -s --user=rsyslog --password=testbench < testsuites/mysql-select-msg.sql > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 4999
+source $srcdir/diag.sh exit
@@ -0,0 +1,29 @@
+# Test the asynchronous close of omfile. Twenty zipped dynafiles are
+# written through a cache of four, so files are constantly evicted and
+# reopened while their close is still pending. A static file with an
+# outchannel size limit is rotated by the closer thread at the same time.
+# Every message must end up exactly once in the files.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omfile-asyncclose.sh\]: test omfile asynchronous close and rotation
+source $srcdir/diag.sh init
+cat > rsyslog.out.rotate.sh <<'EOT'
+mv rsyslog.out.rot.log rsyslog.out.rot.`date +%s%N`.log
+EOT
+source $srcdir/diag.sh startup omfile-asyncclose.conf
+source $srcdir/diag.sh tcpflood -m20000 -f20 -P129
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+for i in `seq 0 19`; do
+	gunzip < rsyslog.out.$i.log
+done | sort -n > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 19999
+if [ `ls rsyslog.out.rot.*.log | wc -l` -lt 2 ]; then
+	echo "error: outchannel file was not rotated"
+	ls -l rsyslog.out.rot*
+	exit 1
+fi
+cat rsyslog.out.rot*.log | sort -n > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 19999
+rm -f rsyslog.out.rotate.sh
+source $srcdir/diag.sh exit
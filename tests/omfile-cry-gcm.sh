@@ -0,0 +1,49 @@
+# Test lmcry_gcry GCM and CTR modes. Both files must decrypt to the
+# original records; the CTR file must not contain padding, so it has
+# exactly the size of the plaintext. A modified GCM file must fail
+# authentication. GCM needs libgcrypt 1.6 or above.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omfile-cry-gcm.sh\]: test GCM and CTR log file encryption
+gcryver=$(libgcrypt-config --version 2>/dev/null)
+if [ -z "$gcryver" ] || [ "$(printf '1.6\n%s\n' "$gcryver" | sort -V | head -n1)" != "1.6" ]; then
+	echo "libgcrypt 1.6 or above needed for GCM, skipping test"
+	exit 77
+fi
+source $srcdir/diag.sh init
+mkdir test-logdir
+source $srcdir/diag.sh startup omfile-cry-gcm.conf
+source $srcdir/diag.sh tcpflood -m5000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+awk 'BEGIN { for(n = 0 ; n < 5000 ; ++n) printf("%8.8d\n", n) }' > rsyslog.out.expected.log
+
+for m in GCM CTR; do
+	f=test-logdir/$(echo $m | tr A-Z a-z).log
+	../tools/rscryutil -d -a AES128 -m $m -K 1234567890123456 $f \
+		> rsyslog.out.decrypted.log 2> rsyslog.out.err.log
+	if ! cmp rsyslog.out.expected.log rsyslog.out.decrypted.log; then
+		echo "error: $m file does not decrypt to the original data"
+		cat rsyslog.out.err.log
+		exit 1
+	fi
+	if grep -q 'failed authentication' rsyslog.out.err.log; then
+		echo "error: unmodified $m file failed authentication"
+		exit 1
+	fi
+done
+if [ $(wc -c < test-logdir/ctr.log) -ne $(wc -c < rsyslog.out.expected.log) ]; then
+	echo "error: CTR file is padded"
+	exit 1
+fi
+
+# flip one byte inside the first block
+printf '\377' | dd of=test-logdir/gcm.log bs=1 seek=100 conv=notrunc 2>/dev/null
+../tools/rscryutil -d -a AES128 -m GCM -K 1234567890123456 test-logdir/gcm.log \
+	> /dev/null 2> rsyslog.out.err.log
+if ! grep -q 'failed authentication' rsyslog.out.err.log; then
+	echo "error: modified GCM file passed authentication"
+	cat rsyslog.out.err.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,26 @@
+# Test omfile group sync and extent preallocation. Messages are written
+# with sync.group to four dynafiles and with a preallocated extent to a
+# static file. All messages must be written, and preallocation must not
+# show up in the file content. Combining sync.group with asyncwriting
+# must be reported.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omfile-groupsync.sh\]: test omfile group sync and preallocation
+source $srcdir/diag.sh init
+rm -f rsyslog.out.gsync.*.log
+source $srcdir/diag.sh config-check omfile-groupsync-invalid.conf 0
+source $srcdir/diag.sh check-errmsg "sync.group can not be used together with asyncwriting"
+source $srcdir/diag.sh startup omfile-groupsync.conf
+source $srcdir/diag.sh tcpflood -m10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+tr -d '\000' < rsyslog.out.log | cmp - rsyslog.out.log
+if [ $? -ne 0 ]; then
+	echo "error: preallocated space is part of the file content"
+	exit 1
+fi
+cat rsyslog.out.gsync.*.log > rsyslog2.out.log
+source $srcdir/diag.sh seq-check2 0 9999
+rm -f rsyslog.out.gsync.*.log
+source $srcdir/diag.sh exit
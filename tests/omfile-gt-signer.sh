@@ -0,0 +1,42 @@
+# Test log signing via the lmsig_gt signer thread. Messages are spread
+# over three dynafiles with small signature blocks and a small signer
+# queue, so writers regularly wait for the signer; the files are closed
+# and reopened by a HUP in between. The signature blocks must account
+# for every record, and if the publication server can be reached, the
+# files must verify. This needs access to the GuardTime services.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omfile-gt-signer.sh\]: test log signing with the signer thread
+if ! curl -s -o /dev/null http://stamper.guardtime.net/; then
+	echo "GuardTime timestamping service not reachable, skipping test"
+	exit 77
+fi
+source $srcdir/diag.sh init
+mkdir test-logdir
+source $srcdir/diag.sh startup omfile-gt-signer.conf
+source $srcdir/diag.sh tcpflood -m1500
+source $srcdir/diag.sh wait-file-lines rsyslog.out.count.log 1500
+source $srcdir/diag.sh issue-HUP
+source $srcdir/diag.sh tcpflood -m1500 -i1500
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cat test-logdir/gt*.log | sort -n > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 2999
+
+for f in test-logdir/gt0.log test-logdir/gt1.log test-logdir/gt2.log; do
+	nrecs=$(../tools/rsgtutil -B $f.gtsig | awk '/Record Count/ { s += $NF } END { print s + 0 }')
+	nlines=$(wc -l < $f)
+	if [ "$nrecs" -ne "$nlines" ]; then
+		echo "error: $f has $nlines records, but signature blocks cover $nrecs"
+		exit 1
+	fi
+done
+if curl -s -o /dev/null http://verify.guardtime.com/gt-controlpublications.bin; then
+	../tools/rsgtutil -t test-logdir/gt*.log > rsyslog.out.verify.log 2>&1
+	if grep -q error rsyslog.out.verify.log; then
+		echo "error: signature verification failed"
+		cat rsyslog.out.verify.log
+		exit 1
+	fi
+fi
+source $srcdir/diag.sh exit
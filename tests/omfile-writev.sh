@@ -0,0 +1,19 @@
+# Test gathered transaction writes in omfile. The same stream of messages
+# of random size is written once through a tiny I/O buffer, so that most
+# transactions are handed to writev(), and once through a large buffer.
+# Both files must be complete and identical.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omfile-writev.sh\]: test omfile gathered writes
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup omfile-writev.conf
+source $srcdir/diag.sh tcpflood -m20000 -r -d3000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999 -E
+cmp rsyslog.out.log rsyslog2.out.log
+if [ $? -ne 0 ]; then
+	echo "error: outputs differ"
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,30 @@
+# Test structured fields in omjournal. Each message is sent with extra
+# fields taken from a JSON subtree, one of them a unique id for this run.
+# journalctl must then find all messages by that id, with the msgnum
+# field intact. An invalid subtree must be reported. The runtime part
+# needs a readable journal and is skipped otherwise.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omjournal-fields.sh\]: test omjournal structured fields
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check omjournal-fields-invalid.conf 1
+source $srcdir/diag.sh check-errmsg "subtree 'journal' is not a JSON variable"
+if ! journalctl -n 0 >/dev/null 2>&1; then
+	echo "no usable journal, skipping runtime part"
+	exit 77
+fi
+export RSTEST_ID=rsyslog-testbench-$$-$RANDOM
+source $srcdir/diag.sh startup omjournal-fields.conf
+source $srcdir/diag.sh injectmsg 0 1000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+for i in `seq 1 50`; do # journald may need a moment to make the entries visible
+	if [ $(journalctl RSTEST_ID=$RSTEST_ID -o json | wc -l) -ge 1000 ]; then
+		break
+	fi
+	./msleep 100
+done
+journalctl RSTEST_ID=$RSTEST_ID -o json | grep -o '"MSGNUM" *: *"[0-9]*"' | \
+	sed 's/.*"\([0-9]*\)"$/\1/' > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 999
+source $srcdir/diag.sh exit
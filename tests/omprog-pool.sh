@@ -0,0 +1,35 @@
+# Test omprog process pools, batched writes and octet-counted framing.
+# The first action feeds a pool of four children with whole batches; each
+# child writes what it gets to its own file. The second action uses a
+# single child and octet-counted framing. All messages must arrive in
+# both cases, and the frames must carry the correct length.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omprog-pool.sh\]: test omprog process pools and framing
+source $srcdir/diag.sh init
+rm -f rsyslog.out.prog.* rsyslog.out.octet.*
+cat > rsyslog.omprog-child.sh <<'CHILD'
+#!/bin/sh
+cat > $1.$$
+CHILD
+chmod +x rsyslog.omprog-child.sh
+source $srcdir/diag.sh startup omprog-pool.conf
+source $srcdir/diag.sh injectmsg 0 20000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+./msleep 500 # let the children finish writing after their pipes were closed
+if [ $(ls rsyslog.out.prog.* | wc -l) -ne 4 ]; then
+	echo "error: expected output from 4 child processes"
+	ls -l rsyslog.out.prog.*
+	exit 1
+fi
+cat rsyslog.out.prog.* > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 19999
+if cat rsyslog.out.octet.* | grep -v '^9 [0-9]\{8\}$'; then
+	echo "error: lines above are not correctly octet-counted"
+	exit 1
+fi
+cat rsyslog.out.octet.* | sed 's/^9 //' > rsyslog2.out.log
+source $srcdir/diag.sh seq-check2 0 19999
+rm -f rsyslog.out.prog.* rsyslog.out.octet.* rsyslog.omprog-child.sh
+source $srcdir/diag.sh exit
@@ -0,0 +1,28 @@
+# Test the omtesting benchmark sink. A sink without failures must commit
+# every message exactly once and in order. A sink with random commit and
+# partial failures must see no sequence gaps, as failed transactions are
+# retried. A sink with backpressure must reject commits, but finally
+# commit everything. Also checks that invalid probabilities are rejected.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[omtesting-sink.sh\]: test omtesting sink mode
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check omtesting-sink-invalid.conf 0
+source $srcdir/diag.sh check-errmsg "omtesting: failure.rate must be a number between 0 and 1, not '1.5'"
+source $srcdir/diag.sh startup omtesting-sink.conf
+source $srcdir/diag.sh tcpflood -m5000
+source $srcdir/diag.sh wait-stats ': clean: received=5000 committed=5000 transactions=[0-9]+ failed.commit=0 failed.partial=0 rejected.backpressure=0 ordering.violations=0 sequence.gaps=0$'
+source $srcdir/diag.sh wait-stats ': slow: received=[0-9]+ committed=5000 transactions=[0-9]+ failed.commit=0 failed.partial=0 rejected.backpressure=[1-9][0-9]* ordering.violations=[0-9]+ sequence.gaps=0$'
+source $srcdir/diag.sh wait-queueempty
+./msleep 1500 # let the final counts of the flaky sink be emitted
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+# the flaky sink may see messages more than once, but must not miss any
+grep ': flaky: ' rsyslog.out.stats.log | tail -n1 | \
+	grep -qE ': flaky: received=([5-9][0-9]{3}|[0-9]{5,}) committed=[0-9]+ transactions=[0-9]+ failed.commit=[1-9][0-9]* failed.partial=[1-9][0-9]* rejected.backpressure=0 ordering.violations=[0-9]+ sequence.gaps=0$'
+if [ $? -ne 0 ]; then
+	echo "error: unexpected counters for flaky sink"
+	grep ': flaky: ' rsyslog.out.stats.log | tail -n1
+	exit 1
+fi
+source $srcdir/diag.sh exit
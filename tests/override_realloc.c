@@ -0,0 +1,49 @@
+/* A realloc() replacement for the testbench, to be loaded via LD_PRELOAD.
+ *
+ * It fails every request for at least RSYSLOG_TEST_REALLOC_FAIL bytes (a
+ * decimal number from the environment) with ENOMEM and passes everything
+ * else on to the real realloc(). Without the variable, nothing fails.
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * This file is part of rsyslog.
+ *
+ * Rsyslog is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Rsyslog is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Rsyslog.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * A copy of the GPL can be found in the file "COPYING" in this distribution.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dlfcn.h>
+
+void *
+realloc(void *ptr, size_t size)
+{
+	static void *(*realRealloc)(void*, size_t) = NULL;
+	static size_t failSize = 0;
+	const char *env;
+
+	if(realRealloc == NULL) {
+		realRealloc = (void *(*)(void*, size_t)) dlsym(RTLD_NEXT, "realloc");
+		env = getenv("RSYSLOG_TEST_REALLOC_FAIL");
+		failSize = (env == NULL) ? SIZE_MAX : strtoul(env, NULL, 10);
+	}
+	if(size >= failSize) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return realRealloc(ptr, size);
+}
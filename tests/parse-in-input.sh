@@ -0,0 +1,21 @@
+# Test the "parseininput" parameter of imptcp and imudp. Messages are
+# parsed by the input threads before they are enqueued; they must come
+# out exactly as if the main queue workers had parsed them.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[parse-in-input.sh\]: test parsing in imptcp and imudp input threads
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup parse-in-input.conf
+./tcpflood -c5 -m10000
+./tcpflood -t 127.0.0.1 -m1000 -i10000 -Tudp -o2000
+./msleep 500 # UDP is asynchronous, give the listener time to pick up everything
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if grep -v ',172.20.245.8,tag,167$' rsyslog.out.log; then
+	echo "error: above messages were not parsed correctly"
+	exit 1
+fi
+cut -d, -f1 rsyslog.out.log | sort -n > rsyslog.out.sorted.log
+mv rsyslog.out.sorted.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 10999
+source $srcdir/diag.sh exit
@@ -0,0 +1,28 @@
+# Test the parser selection cache. A parser chain of pmlastmsg, rfc5424
+# and rfc3164 first gets RFC5424 messages and then RFC3164 messages from
+# the same sender. After the first message of each kind, the cached parser
+# must be hit. When the format changes, the cached parser fails and the
+# whole chain must be walked again. All messages must be parsed by the
+# right parser.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[parser-cache.sh\]: test the parser selection cache
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup parser-cache.conf
+source $srcdir/diag.sh tcpflood -m5000 -y
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 5000
+source $srcdir/diag.sh tcpflood -m1000 -i5000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 6000
+source $srcdir/diag.sh wait-stats ": parser.cache: hits=5998 misses=2"
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+awk 'BEGIN {
+	for(n = 0 ; n < 6000 ; ++n)
+		printf("%8.8d %s\n", n, n < 5000 ? "1 tcpflood" : "0 tag")
+}' > rsyslog.out.expected.log
+if ! cmp rsyslog.out.expected.log rsyslog.out.log; then
+	echo "error: messages were not parsed by the right parser"
+	diff rsyslog.out.expected.log rsyslog.out.log | head
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -14,6 +14,8 @@ source $srcdir/diag.sh nettester parse-3164-buggyday udp
 source $srcdir/diag.sh nettester parse-3164-buggyday tcp
 source $srcdir/diag.sh nettester parse-nodate udp
 source $srcdir/diag.sh nettester parse-nodate tcp
+source $srcdir/diag.sh nettester parse-rfc3339 udp
+source $srcdir/diag.sh nettester parse-rfc3339 tcp
 # the following samples can only be run over UDP as they are so
 # malformed they break traditional syslog/tcp framing...
 source $srcdir/diag.sh nettester snare_ccoff_udp udp
@@ -34,6 +36,8 @@ source $srcdir/diag.sh nettester parse-3164-buggyday udp -4
 source $srcdir/diag.sh nettester parse-3164-buggyday tcp -4
 source $srcdir/diag.sh nettester parse-nodate udp -4
 source $srcdir/diag.sh nettester parse-nodate tcp -4
+source $srcdir/diag.sh nettester parse-rfc3339 udp -4
+source $srcdir/diag.sh nettester parse-rfc3339 tcp -4
 # UDP-only tests
 source $srcdir/diag.sh nettester snare_ccoff_udp udp -4
 source $srcdir/diag.sh nettester snare_ccoff_udp2 udp -4
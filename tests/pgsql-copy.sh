@@ -0,0 +1,17 @@
+# Test COPY based bulk loading in ompgsql. Each transaction is streamed
+# to the server as one COPY with the default CSV row format. All messages
+# must end up in the SystemEvents table.
+# This file is part of the rsyslog project, released under GPLv3
+echo ===============================================================================
+echo \[pgsql-copy.sh\]: test ompgsql COPY mode
+source $srcdir/diag.sh init
+export PGPASSWORD=testbench
+psql -h 127.0.0.1 -U rsyslog -d Syslog -c "truncate table SystemEvents" > /dev/null
+source $srcdir/diag.sh startup pgsql-copy.conf
+source $srcdir/diag.sh injectmsg 0 5000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+psql -h 127.0.0.1 -U rsyslog -d Syslog -t -A \
+	-c "select substring(Message,9,8) from SystemEvents" > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 4999
+source $srcdir/diag.sh exit
@@ -0,0 +1,17 @@
+# Test sampled pipeline stage timing. With pipeline.sampling="10", every
+# tenth submitted message is sampled (a few internal messages add to the
+# count). The stages a message must spend time in, the main queue and the
+# action commit, need to report non-zero durations.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[pipeline-sampling.sh\]: test sampled pipeline stage timing
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup pipeline-sampling.conf
+source $srcdir/diag.sh tcpflood -m5000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 5000
+source $srcdir/diag.sh wait-stats ': pipeline: sampled=5[0-1][0-9] '
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 4999
+source $srcdir/diag.sh stats-check ': pipeline: .* queue\.us\.max=[1-9][0-9]* .* commit\.us\.max=[1-9][0-9]*$'
+source $srcdir/diag.sh exit
@@ -0,0 +1,36 @@
+# Test the intern table for HOSTNAME, TAG, PROGRAMNAME and APP-NAME.
+# Every message has its own hostname and tag, many more than the table
+# holds. The messages are handed to an async ruleset (which duplicates
+# them) and to a forwarding action, which is suspended until the
+# receiver is started. So all messages pile up in the action queue and
+# partly go to disk, while their props are evicted from the table. Each
+# field must still come out as it was sent.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[prop-intern.sh\]: test interned message properties
+source $srcdir/diag.sh init
+awk 'BEGIN {
+	for(i = 0 ; i < 100000 ; ++i)
+		printf("<167>Mar  1 01:00:00 host-%d tag%d: msgnum:%8.8d:\n", i, i, i)
+}' > rsyslog.input
+source $srcdir/diag.sh startup prop-intern.conf
+source $srcdir/diag.sh tcpflood -I rsyslog.input
+source $srcdir/diag.sh wait-queueempty
+if ! ls test-spool/fwdq.* > /dev/null 2>&1; then
+	echo "error: the action queue did not go to disk"
+	exit 1
+fi
+./minitcpsrv 127.0.0.1 13515 rsyslog.out.fwd.log &
+BGPROCESS=$!
+source $srcdir/diag.sh wait-file-lines rsyslog.out.fwd.log 100000 120
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+wait $BGPROCESS
+awk -F, '{ n = $1 + 0
+	if($2 != "host-" n || $3 != "tag" n || $4 != "tag" n || $5 != "tag" n ":") {
+		print "error: wrong properties: " $0
+		exit 1
+	} }' rsyslog.out.fwd.log || exit 1
+cut -d, -f1 rsyslog.out.fwd.log | sort -n > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 99999
+source $srcdir/diag.sh exit
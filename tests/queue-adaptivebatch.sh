@@ -0,0 +1,20 @@
+# Test for adaptive dequeue batch sizes. The action is slow, so each batch
+# takes longer than queue.maxbatchtime and the batch size must shrink to
+# the configured minimum.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[queue-adaptivebatch.sh\]: test adaptive dequeue batch size
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup queue-adaptivebatch.conf
+source $srcdir/diag.sh injectmsg 0 1000
+source $srcdir/diag.sh shutdown-when-empty
+$srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 999
+grep 'main Q:' rsyslog.out.stats.log | tail -1 | grep 'batchsize=4 ' > /dev/null
+if [ $? -ne 0 ]; then
+  echo "error: batch size did not shrink to minimum:"
+  cat rsyslog.out.stats.log
+  exit 1
+fi
+rm -f rsyslog.out.stats.log
+source $srcdir/diag.sh exit
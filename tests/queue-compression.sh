@@ -0,0 +1,15 @@
+# Test in-memory compression of large messages in queues
+# (queue.compression.*). Messages above the threshold are packed while
+# queued and must come out unchanged, including the extra data.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[queue-compression.sh\]: test in-memory queue compression of large messages
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup queue-compression.conf
+source $srcdir/diag.sh tcpflood -m5000 -r -d8000 -P129
+sleep 2 # due to large messages, we need this time for the tcp receiver to settle...
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 4999 -E
+source $srcdir/diag.sh seq-check2 0 4999 -E
+source $srcdir/diag.sh exit
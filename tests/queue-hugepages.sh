@@ -0,0 +1,14 @@
+# Test huge page backed, pre-faulted and locked queue storage and msg
+# pool. Whether huge pages and mlock are actually available depends on
+# the system; if not, rsyslogd must fall back to normal pages and still
+# deliver all messages.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[queue-hugepages.sh\]: test huge page backed queues and msg pool
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup queue-hugepages.conf
+source $srcdir/diag.sh injectmsg 0 50000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 49999
+source $srcdir/diag.sh exit
@@ -0,0 +1,20 @@
+# Test for priority lanes. A backlog of debug messages is built up in the
+# main queue, then a few alert messages are sent. These must overtake the
+# backlog, as they are placed into the high priority lane.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[queue-lanes.sh\]: test priority lanes
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup queue-lanes.conf
+source $srcdir/diag.sh tcpflood -m2000
+source $srcdir/diag.sh tcpflood -m10 -i2000 -P129
+source $srcdir/diag.sh shutdown-when-empty
+$srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 2009
+# seq-check has kept the original order in work-presort
+LINE=`grep -n '^00002009$' work-presort | cut -d: -f1`
+if [ -z "$LINE" ] || [ "$LINE" -gt 1000 ]; then
+  echo "error: alert messages did not overtake the backlog (last at line $LINE)"
+  exit 1
+fi
+source $srcdir/diag.sh exit
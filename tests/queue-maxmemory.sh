@@ -0,0 +1,23 @@
+# Test for the memory based watermarks of in-memory queues. The queue
+# size (in messages) is large enough to never trigger DA mode, but the
+# memory based high watermark is low, so the queue must go to disk.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[queue-maxmemory.sh\]: test DA mode triggered by memory based watermark
+source $srcdir/diag.sh init
+
+echo 'main_queue(queue.type="linkedlist" queue.filename="mainq" queue.size="50000"
+	   queue.maxmemory="10m" queue.highwatermarkbytes="100k" queue.lowwatermarkbytes="20k"
+	   queue.timeoutshutdown="10000")' > work-queuemode.conf
+echo "*.*     :omtesting:sleep 0 1000" > work-delay.conf
+source $srcdir/diag.sh startup queue-maxmemory.conf
+source $srcdir/diag.sh injectmsg 0 2000
+ls -l test-spool
+if test ! -f test-spool/mainq.00000001; then
+  echo "error: queue did not go to disk, mainq.00000001 does not exist!"
+  exit 1
+fi
+source $srcdir/diag.sh shutdown-when-empty
+$srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 1999
+source $srcdir/diag.sh exit
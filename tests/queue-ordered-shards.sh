@@ -0,0 +1,37 @@
+# Test ordered sharding by a message property. Messages from eight
+# hosts are interleaved; the main queue and the action queue are both
+# sharded by hostname with queue.ordered="on" and run several workers.
+# Messages of each host must come out in the order they were sent. Also
+# checks that an unknown shard key property is rejected.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[queue-ordered-shards.sh\]: test ordered sharding by hostname
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check queue-ordered-shards-invalid.conf 0
+source $srcdir/diag.sh check-errmsg 'queue.shardkey "nosuchproperty" is invalid'
+awk 'BEGIN { for(n = 0 ; n < 20000 ; ++n)
+	printf("<13>Oct 15 10:00:00 host%d tag: msgnum:%8.8d:\n", n % 8, n) }' > rsyslog.input
+source $srcdir/diag.sh startup queue-ordered-shards.conf
+source $srcdir/diag.sh tcpflood -I rsyslog.input
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 20000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+awk '{	if(($1 in last) && $2 + 0 <= last[$1]) {
+		print "error: " $1 " message " $2 " after " last[$1]
+		err = 1
+	}
+	last[$1] = $2 + 0
+	++cnt[$1]
+     }
+     END {
+	for(h in cnt)
+		if(cnt[h] != 2500) {
+			print "error: " cnt[h] " messages for " h ", expected 2500"
+			err = 1
+		}
+	exit err
+     }' rsyslog.out.log
+if [ $? -ne 0 ]; then
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,45 @@
+# Test the parallel shutdown and persisting of action queues. Four
+# action queues are filled while their actions cannot deliver, then
+# rsyslogd is shut down and all queues are persisted concurrently. After
+# the restart, each queue must deliver all of its messages, and the new
+# persist/restore counters must be reported.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[queue-persist-parallel.sh\]: test parallel persisting of action queues
+source $srcdir/diag.sh init
+
+# first run: nobody listens on 13599, so everything stays in the queues
+for i in 1 2 3 4; do
+	echo "if \$msg contains \"msgnum:\" then action(type=\"omfwd\" target=\"127.0.0.1\" port=\"13599\" protocol=\"tcp\" action.resumeRetryCount=\"-1\" queue.type=\"linkedlist\" queue.filename=\"actq$i\" queue.saveonshutdown=\"on\" queue.timeoutshutdown=\"1\" queue.timeoutactioncompletion=\"1\")"
+done > work-actions.conf
+source $srcdir/diag.sh startup queue-persist-parallel.conf
+source $srcdir/diag.sh injectmsg 0 5000
+source $srcdir/diag.sh wait-queueempty
+$srcdir/diag.sh shutdown-immediate
+$srcdir/diag.sh wait-shutdown
+for i in 1 2 3 4; do
+	if [ ! -f test-spool/actq$i.qi ]; then
+		echo "error: action queue $i was not persisted"
+		ls -l test-spool
+		exit 1
+	fi
+done
+
+# second run: the restored queues are written to files
+for i in 1 2 3 4; do
+	echo "if \$msg contains \"msgnum:\" then action(type=\"omfile\" file=\"rsyslog.out.q$i.log\" template=\"outfmt\" queue.type=\"linkedlist\" queue.filename=\"actq$i\" queue.saveonshutdown=\"on\")"
+done > work-actions.conf
+source $srcdir/diag.sh startup queue-persist-parallel.conf
+for i in 1 2 3 4; do
+	source $srcdir/diag.sh wait-file-lines rsyslog.out.q$i.log 5000
+done
+source $srcdir/diag.sh wait-stats 'persisttime=[0-9]+'
+source $srcdir/diag.sh wait-stats 'restoretime=[0-9]+'
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+# as in queue-persist.sh, the forced shutdown may lead to duplicates
+for i in 1 2 3 4; do
+	mv rsyslog.out.q$i.log rsyslog.out.log
+	source $srcdir/diag.sh seq-check 0 4999 -d
+done
+source $srcdir/diag.sh exit
@@ -0,0 +1,26 @@
+# Test for the queue residency stats. Messages are slowed down by the
+# action, so they need to wait in the main queue. The residency
+# percentiles must show up in the impstats output.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[queue-residency.sh\]: test queue residency stats
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup queue-residency.conf
+source $srcdir/diag.sh injectmsg 0 1000
+source $srcdir/diag.sh shutdown-when-empty
+$srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 999
+grep 'main Q: .*residency.p50=[0-9]* residency.p99=[0-9]* residency.max=[0-9]*' rsyslog.out.stats.log > /dev/null
+if [ $? -ne 0 ]; then
+  echo "error: residency counters missing in stats output:"
+  cat rsyslog.out.stats.log
+  exit 1
+fi
+grep 'main Q: .*residency.max=[1-9]' rsyslog.out.stats.log > /dev/null
+if [ $? -ne 0 ]; then
+  echo "error: no residency recorded:"
+  cat rsyslog.out.stats.log
+  exit 1
+fi
+rm -f rsyslog.out.stats.log
+source $srcdir/diag.sh exit
@@ -0,0 +1,21 @@
+# Test for queue.targetresidency. The action queue starts with one worker,
+# which can not keep the residency of a backlog below the target, so
+# workers must be added. Once only a trickle of messages arrives, the
+# residency drops and workers must be retired again.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[queue-targetresidency.sh\]: test residency controlled worker pool
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup queue-targetresidency.conf
+source $srcdir/diag.sh injectmsg 0 3000
+source $srcdir/diag.sh wait-stats ": sink queue: .*workers.target=[2-8] workers.added=[1-9]" 15
+source $srcdir/diag.sh wait-stats ": omtesting: received=3000 committed=3000 " 30
+for i in `seq 3000 3019`; do
+	source $srcdir/diag.sh injectmsg $i 1
+	./msleep 500
+done
+source $srcdir/diag.sh wait-stats ": sink queue: .*workers.retired=[1-9]" 5
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 3019
+source $srcdir/diag.sh exit
@@ -0,0 +1,19 @@
+# Test worker wakeup. Single messages are injected with pauses in between,
+# so the workers are idle (or already retired) each time one arrives. Every
+# message must be processed right away, not only after some timeout. A
+# burst at the end must wake up all workers.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[queue-wakeup.sh\]: test wakeup of idle queue workers
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup queue-wakeup.conf
+for i in `seq 0 19`; do
+	source $srcdir/diag.sh injectmsg $i 1
+	source $srcdir/diag.sh wait-file-lines rsyslog.out.log $((i + 1)) 1
+	./msleep $((i * 20)) # workers retire after 200ms idle
+done
+source $srcdir/diag.sh injectmsg 20 20000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 20019
+source $srcdir/diag.sh exit
@@ -0,0 +1,26 @@
+# Test publisher confirms with multiple channels in omrabbitmq. All
+# messages are published over four channels, each batch is only committed
+# after the broker acked it. The queue must then hold all messages. Needs
+# RabbitMQ on localhost (guest/guest) with the management plugin and
+# rabbitmqadmin, the test is skipped otherwise.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[rabbitmq-confirms.sh\]: test omrabbitmq publisher confirms
+if ! type rabbitmqadmin >/dev/null 2>&1 || ! rabbitmqadmin list queues >/dev/null 2>&1; then
+	echo "no RabbitMQ management interface on localhost, skipping test"
+	exit 77
+fi
+source $srcdir/diag.sh init
+rabbitmqadmin delete queue name=rsyslog_testbench > /dev/null 2>&1
+rabbitmqadmin declare queue name=rsyslog_testbench durable=false > /dev/null
+rabbitmqadmin declare binding source=amq.direct destination=rsyslog_testbench \
+	routing_key=rsyslog_testbench > /dev/null
+source $srcdir/diag.sh startup rabbitmq-confirms.conf
+source $srcdir/diag.sh injectmsg 0 5000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+rabbitmqadmin -f raw_json get queue=rsyslog_testbench count=10000 ackmode=ack_requeue_false | \
+	grep -o '"payload":"[0-9]*"' | sed 's/.*:"\([0-9]*\)"/\1/' > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 4999
+rabbitmqadmin delete queue name=rsyslog_testbench > /dev/null
+source $srcdir/diag.sh exit
@@ -0,0 +1,790 @@
+/* Microbenchmarks for the core hot paths of rsyslogd: message construction,
+ * parsing, template processing, RainerScript expression evaluation, queue
+ * enqueue/dequeue for all queue types, batch iteration with and without
+ * prefetching, access to the hot message properties, stream writes and,
+ * if the module is built, mmanon. The program links
+ * the rsyslogd core (without its main()) and loads a small generated config
+ * to obtain templates, parsers and expressions exactly as rsyslogd sees them.
+ *
+ * Output is CSV, one line per benchmark:
+ *   benchmark,ops,seconds,ns_per_op
+ * so that results can easily be compared between builds. Additional
+ * information, like hardware counter readings, is given in comment lines
+ * starting with '#'.
+ *
+ * Usage: rsbench [-n ops] [-b benchmark-prefix]
+ *
+ * Part of the testbench for rsyslog.
+ *
+ * Copyright 2014 Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/time.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "rsyslog.h"
+#include "obj.h"
+#include "glbl.h"
+#include "prop.h"
+#include "msg.h"
+#include "parser.h"
+#include "template.h"
+#include "rsconf.h"
+#include "ruleset.h"
+#include "queue.h"
+#include "wti.h"
+#include "batch.h"
+#include "stream.h"
+#include "unicode-helper.h"
+#include "rainerscript.h"
+#include "iminternal.h"
+
+/* from tools/, there is no header for them */
+extern rsRetVal rsyslogd_InitGlobalClasses(void);
+extern rsRetVal syslogd_obtainClassPointers(void);
+extern rsRetVal queryLocalHostname(void);
+
+DEFobjCurrIf(obj)
+DEFobjCurrIf(glbl)
+DEFobjCurrIf(prop)
+DEFobjCurrIf(parser)
+DEFobjCurrIf(ruleset)
+DEFobjCurrIf(rsconf)
+DEFobjCurrIf(strm)
+
+static long nOps = 1000000;
+static char *benchPrefix = NULL; /* run only benchmarks starting with this */
+static char workDir[] = "/tmp/rsbench.XXXXXX";
+static prop_t *pInputName;
+
+static const char *msg3164 =
+	"<34>Oct 11 22:14:15 mymachine su[123]: 'su root' failed for lonvick on /dev/pts/8";
+static const char *msg5424 =
+	"<165>1 2003-10-11T22:14:15.003Z mymachine.example.com evntslog - ID47 "
+	"[exampleSDID@32473 iut=\"3\" eventSource=\"Application\" eventID=\"1011\"] "
+	"An application event log entry";
+
+static const char *templates[] = {
+	"RSYSLOG_TraditionalFileFormat",
+	"RSYSLOG_FileFormat",
+	"RSYSLOG_ForwardFormat",
+	"RSYSLOG_SyslogProtocol23Format",
+	NULL
+};
+
+/* the expressions are placed into rulesets bench_expr<n>, one per ruleset */
+static const struct {
+	const char *name;
+	const char *expr;
+} exprs[] = {
+	{ "num_cmp",	"$syslogseverity <= 4" },
+	{ "str_eq",	"$programname == \"su\"" },
+	{ "contains",	"$msg contains \"failed\"" },
+	{ "and",	"$hostname startswith \"my\" and $syslogfacility-text == \"auth\"" },
+	{ "re_match",	"re_match($msg, \"failed for [a-z]+\")" },
+	{ NULL, NULL }
+};
+
+static const struct {
+	const char *name;
+	queueType_t qType;
+	int opsDivisor;	/* disk queues are much slower, keep runtime sane */
+} qtypes[] = {
+	{ "FixedArray",	QUEUETYPE_FIXED_ARRAY,	1 },
+	{ "LinkedList",	QUEUETYPE_LINKEDLIST,	1 },
+	{ "LockFree",	QUEUETYPE_LOCKFREE,	1 },
+	{ "Disk",	QUEUETYPE_DISK,		10 },
+	{ "Direct",	QUEUETYPE_DIRECT,	1 },
+	{ NULL, 0, 0 }
+};
+
+/* batch iteration benchmarks: the message set is made much larger than the
+ * caches, so that each batch starts cold, just like batches of messages
+ * that input threads on other cores have written.
+ */
+#define BENCH_BATCH_MSGS	(256 * 1024)
+#define BENCH_BATCH_SIZE	1024
+
+#ifdef RSBENCH_MMANON
+/* mmanon is run via rulesets bench_mmanon<n>. The MSG of each message is
+ * reset before each run, as mmanon modifies it in place; this cost is
+ * included in the results.
+ */
+#define BENCH_MMANON_BATCH	64
+static const struct {
+	const char *name;
+	const char *params;
+	const char *msg;
+} mmanonCases[] = {
+	{ "mmanon.ipv4", "ipv6.enable=\"off\"",
+	  "<34>Oct 11 22:14:15 mymachine sshd[123]: Accepted publickey for root from "
+	  "192.168.10.20 port 52413 ssh2, forwarded by 10.1.2.3" },
+	{ "mmanon.ipv4ipv6", "",
+	  "<34>Oct 11 22:14:15 mymachine sshd[123]: Accepted publickey for root from "
+	  "2001:db8:85a3:8d3:1319:8a2e:370:7348 port 52413 ssh2, forwarded by 10.1.2.3" },
+	{ "mmanon.noaddr", "",
+	  "<34>Oct 11 22:14:15 mymachine su[123]: 'su root' failed for lonvick on /dev/pts/8, "
+	  "retry 3 of 5 within 600 seconds" },
+	{ NULL, NULL, NULL }
+};
+#endif
+
+/* consumer state for the queue benchmarks */
+static pthread_mutex_t mutConsumed = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t condConsumed = PTHREAD_COND_INITIALIZER;
+static long nConsumed;
+
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int
+selected(const char *name)
+{
+	return benchPrefix == NULL || !strncmp(name, benchPrefix, strlen(benchPrefix));
+}
+
+static void
+report(const char *name, long n, double t)
+{
+	printf("%s,%ld,%.6f,%.1f\n", name, n, t, t * 1e9 / n);
+	fflush(stdout);
+}
+
+
+/* construct a message the way an input does */
+static msg_t *
+newMsg(const char *raw)
+{
+	msg_t *pMsg;
+
+	if(msgConstruct(&pMsg) != RS_RET_OK)
+		return NULL;
+	MsgSetInputName(pMsg, pInputName);
+	MsgSetRawMsg(pMsg, (char*) raw, strlen(raw));
+	MsgSetRcvFrom(pMsg, glbl.GetLocalHostNameProp());
+	pMsg->msgFlags = NEEDS_PARSING | PARSE_HOSTNAME;
+	return pMsg;
+}
+
+static msg_t *
+newParsedMsg(const char *raw)
+{
+	msg_t *pMsg;
+
+	if((pMsg = newMsg(raw)) != NULL)
+		parser.ParseMsg(pMsg);
+	return pMsg;
+}
+
+
+static void
+benchMsg(void)
+{
+	msg_t *pMsg;
+	double t;
+	long i;
+
+	if(!selected("msg.construct"))
+		return;
+	t = now();
+	for(i = 0 ; i < nOps ; ++i) {
+		msgConstruct(&pMsg);
+		msgDestruct(&pMsg);
+	}
+	report("msg.construct", nOps, now() - t);
+}
+
+
+/* note that this includes message construction, see msg.construct */
+static void
+benchParse(const char *name, const char *raw)
+{
+	msg_t *pMsg;
+	double t;
+	long i;
+
+	if(!selected(name))
+		return;
+	t = now();
+	for(i = 0 ; i < nOps ; ++i) {
+		pMsg = newMsg(raw);
+		parser.ParseMsg(pMsg);
+		msgDestruct(&pMsg);
+	}
+	report(name, nOps, now() - t);
+}
+
+
+static void
+benchTpl(void)
+{
+	struct template *pTpl;
+	actWrkrIParams_t iparam;
+	struct syslogTime ttNow;
+	msg_t *pMsg;
+	char name[128];
+	double t;
+	long i;
+	int j;
+
+	pMsg = newParsedMsg(msg5424);
+	for(j = 0 ; templates[j] != NULL ; ++j) {
+		snprintf(name, sizeof(name), "tpl.%s", templates[j]);
+		if(!selected(name))
+			continue;
+		pTpl = tplFind(ourConf, (char*) templates[j], strlen(templates[j]));
+		if(pTpl == NULL) {
+			fprintf(stderr, "rsbench: template %s not found, skipped\n", templates[j]);
+			continue;
+		}
+		memset(&iparam, 0, sizeof(iparam));
+		memset(&ttNow, 0, sizeof(ttNow));
+		t = now();
+		for(i = 0 ; i < nOps ; ++i)
+			tplToString(pTpl, pMsg, &iparam, &ttNow);
+		report(name, nOps, now() - t);
+		free(iparam.param);
+	}
+	msgDestruct(&pMsg);
+}
+
+
+static void
+benchExpr(void)
+{
+	ruleset_t *pRuleset;
+	struct cnfstmt *stmt;
+	msg_t *pMsg;
+	uchar rsName[64];
+	char name[128];
+	volatile int sink = 0;
+	double t;
+	long i;
+	int j;
+
+	pMsg = newParsedMsg(msg3164);
+	for(j = 0 ; exprs[j].name != NULL ; ++j) {
+		snprintf(name, sizeof(name), "expr.%s", exprs[j].name);
+		if(!selected(name))
+			continue;
+		snprintf((char*) rsName, sizeof(rsName), "bench_expr%d", j);
+		if(ruleset.GetRuleset(ourConf, &pRuleset, rsName) != RS_RET_OK
+		   || (stmt = pRuleset->root) == NULL || stmt->nodetype != S_IF) {
+			fprintf(stderr, "rsbench: expression %s not found, skipped\n", exprs[j].name);
+			continue;
+		}
+		/* evaluate as the ruleset engine does: compiled if possible */
+		t = now();
+		if(stmt->d.s_if.prog != NULL) {
+			for(i = 0 ; i < nOps ; ++i)
+				sink += cnfprogEvalBool(stmt->d.s_if.prog, pMsg);
+		} else {
+			for(i = 0 ; i < nOps ; ++i)
+				sink += cnfexprEvalBool(stmt->d.s_if.expr, pMsg);
+		}
+		report(name, nOps, now() - t);
+	}
+	msgDestruct(&pMsg);
+}
+
+
+static rsRetVal
+benchConsumer(void __attribute__((unused)) *pUsr, batch_t *pBatch, wti_t __attribute__((unused)) *pWti)
+{
+	int i;
+
+	for(i = 0 ; i < pBatch->nElem ; ++i)
+		pBatch->eltState[i] = BATCH_STATE_COMM;
+	pthread_mutex_lock(&mutConsumed);
+	nConsumed += pBatch->nElem;
+	pthread_cond_signal(&condConsumed);
+	pthread_mutex_unlock(&mutConsumed);
+	return RS_RET_OK;
+}
+
+/* time from the first enqueue until the consumer has seen the last message */
+static void
+benchQueue(void)
+{
+	qqueue_t *pQueue;
+	msg_t *pMsg;
+	char name[128];
+	long n;
+	long i;
+	double t;
+	int j;
+
+	pMsg = newParsedMsg(msg3164);
+	for(j = 0 ; qtypes[j].name != NULL ; ++j) {
+		snprintf(name, sizeof(name), "queue.%s", qtypes[j].name);
+		if(!selected(name))
+			continue;
+		n = nOps / qtypes[j].opsDivisor;
+		if(n < 1)
+			n = 1;
+		nConsumed = 0;
+		if(qqueueConstruct(&pQueue, qtypes[j].qType, 1, 10000, benchConsumer) != RS_RET_OK) {
+			fprintf(stderr, "rsbench: could not create %s queue, skipped\n", qtypes[j].name);
+			continue;
+		}
+		obj.SetName((obj_t*) pQueue, (uchar*) name);
+		if(qtypes[j].qType == QUEUETYPE_DISK)
+			qqueueSetFilePrefix(pQueue, UCHAR_CONSTANT("rsbench"), sizeof("rsbench") - 1);
+		qqueueSettoQShutdown(pQueue, 100);
+		if(qqueueStart(pQueue) != RS_RET_OK) {
+			fprintf(stderr, "rsbench: could not start %s queue, skipped\n", qtypes[j].name);
+			qqueueDestruct(&pQueue);
+			continue;
+		}
+		t = now();
+		for(i = 0 ; i < n ; ++i)
+			qqueueEnqMsg(pQueue, eFLOWCTL_FULL_DELAY, MsgAddRef(pMsg));
+		pthread_mutex_lock(&mutConsumed);
+		while(nConsumed < n)
+			pthread_cond_wait(&condConsumed, &mutConsumed);
+		pthread_mutex_unlock(&mutConsumed);
+		report(name, n, now() - t);
+		qqueueDestruct(&pQueue);
+	}
+	msgDestruct(&pMsg);
+}
+
+
+/* count cache misses of the calling thread via perf_event_open(). Returns
+ * -1 if hardware counters are not available (e.g. in many VMs, or due to
+ * kernel.perf_event_paranoid).
+ */
+static int
+cacheMissCtrOpen(void)
+{
+#ifdef __linux__
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+static void
+cacheMissCtrStart(int fd)
+{
+#ifdef __linux__
+	if(fd != -1) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+}
+
+static long long
+cacheMissCtrStop(int fd)
+{
+	long long n = -1;
+#ifdef __linux__
+	if(fd != -1) {
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if(read(fd, &n, sizeof(n)) != sizeof(n))
+			n = -1;
+	}
+#endif
+	return n;
+}
+
+static void
+reportCacheMisses(const char *name, long long nMisses, long n)
+{
+	if(nMisses >= 0)
+		printf("# %s: %.2f cache misses per msg\n", name, (double) nMisses / n);
+	else
+		printf("# %s: hardware cache miss counter not available\n", name);
+}
+
+
+/* run an expression over all messages, batch by batch, as the ruleset
+ * engine does (see processBatch()), with or without software prefetching
+ */
+static void
+benchBatchRun(const char *name, struct cnfexpr *expr, msg_t **ppMsgs, int bPrefetch)
+{
+	batch_t batch;
+	volatile int sink = 0;
+	long long nMisses;
+	long nDone = 0;
+	long iMsg = 0;
+	double t;
+	int fd;
+	int i;
+
+	if(!selected(name))
+		return;
+	if(batchInit(&batch, BENCH_BATCH_SIZE) != RS_RET_OK)
+		return;
+	fd = cacheMissCtrOpen();
+	cacheMissCtrStart(fd);
+	t = now();
+	while(nDone < nOps) {
+		for(i = 0 ; i < BENCH_BATCH_SIZE ; ++i) {
+			batch.pElem[i].pMsg = ppMsgs[iMsg];
+			iMsg = (iMsg + 1) % BENCH_BATCH_MSGS;
+		}
+		batch.nElem = BENCH_BATCH_SIZE;
+		if(bPrefetch)
+			batchPrefetchStart(&batch);
+		for(i = 0 ; i < batchNumMsgs(&batch) ; ++i) {
+			if(bPrefetch)
+				batchPrefetch(&batch, i);
+			sink += cnfexprEvalBool(expr, batch.pElem[i].pMsg);
+		}
+		nDone += BENCH_BATCH_SIZE;
+	}
+	t = now() - t;
+	nMisses = cacheMissCtrStop(fd);
+	report(name, nDone, t);
+	reportCacheMisses(name, nMisses, nDone);
+	if(fd != -1)
+		close(fd);
+	batchFree(&batch);
+}
+
+
+/* read the properties the traditional default templates use (timestamp,
+ * hostname, msg) from a message set that does not fit into the cache. All
+ * lazily formatted strings are created in a warm-up pass, so the cache miss
+ * count shows how many distinct cache lines of msg_t the hot path touches.
+ */
+static void
+benchHotFieldsRun(const char *name, msg_t **ppMsgs)
+{
+	msg_t *pMsg;
+	size_t sink = 0;
+	long long nMisses;
+	long nDone;
+	long iMsg = 0;
+	double t;
+	int fd;
+
+	if(!selected(name))
+		return;
+	for(iMsg = 0 ; iMsg < BENCH_BATCH_MSGS ; ++iMsg)
+		getTimeReported(ppMsgs[iMsg], tplFmtRFC3164Date);
+	iMsg = 0;
+	fd = cacheMissCtrOpen();
+	cacheMissCtrStart(fd);
+	t = now();
+	for(nDone = 0 ; nDone < nOps ; ++nDone) {
+		pMsg = ppMsgs[iMsg];
+		iMsg = (iMsg + 1) % BENCH_BATCH_MSGS;
+		sink += (size_t) getTimeReported(pMsg, tplFmtRFC3164Date)[0];
+		sink += (size_t) getHOSTNAMELen(pMsg) + (size_t) getHOSTNAME(pMsg)[0];
+		sink += (size_t) getMSGLen(pMsg) + (size_t) getMSG(pMsg)[0];
+	}
+	t = now() - t;
+	nMisses = cacheMissCtrStop(fd);
+	report(name, nDone, t);
+	reportCacheMisses(name, nMisses, nDone);
+	if(sink == 0)
+		printf("# %s: unexpected empty properties\n", name);
+	if(fd != -1)
+		close(fd);
+}
+
+static void
+benchBatch(void)
+{
+	ruleset_t *pRuleset;
+	struct cnfstmt *stmt;
+	msg_t **ppMsgs;
+	int i;
+
+	if(!selected("batch.plain") && !selected("batch.prefetch") && !selected("msg.hotfields"))
+		return;
+	/* exprs[2] is "$msg contains ...", which touches the raw message */
+	if(ruleset.GetRuleset(ourConf, &pRuleset, UCHAR_CONSTANT("bench_expr2")) != RS_RET_OK
+	   || (stmt = pRuleset->root) == NULL || stmt->nodetype != S_IF) {
+		fprintf(stderr, "rsbench: expression for batch benchmarks not found, skipped\n");
+		stmt = NULL;
+	}
+	if((ppMsgs = calloc(BENCH_BATCH_MSGS, sizeof(msg_t*))) == NULL)
+		return;
+	for(i = 0 ; i < BENCH_BATCH_MSGS ; ++i) {
+		if((ppMsgs[i] = newParsedMsg(msg3164)) == NULL)
+			break;
+	}
+	if(i == BENCH_BATCH_MSGS) {
+		if(stmt != NULL) {
+			benchBatchRun("batch.plain", stmt->d.s_if.expr, ppMsgs, 0);
+			benchBatchRun("batch.prefetch", stmt->d.s_if.expr, ppMsgs, 1);
+		}
+		benchHotFieldsRun("msg.hotfields", ppMsgs);
+	} else {
+		fprintf(stderr, "rsbench: out of memory, batch benchmarks skipped\n");
+	}
+	for(i = 0 ; i < BENCH_BATCH_MSGS && ppMsgs[i] != NULL ; ++i)
+		msgDestruct(&ppMsgs[i]);
+	free(ppMsgs);
+}
+
+
+#ifdef RSBENCH_MMANON
+static void
+benchMmanon(void)
+{
+	ruleset_t *pRuleset;
+	wti_t *pWti = NULL;
+	batch_t batch;
+	msg_t *pMsgs[BENCH_MMANON_BATCH];
+	uchar *origMsg;
+	int lenOrigMsg;
+	int bShutdownImmediate = 0;
+	char name[64];
+	long nDone;
+	double t;
+	int nCases;
+	int i, j;
+
+	if(!selected("mmanon."))
+		return;
+	memset(&batch, 0, sizeof(batch));
+	if(   batchInit(&batch, BENCH_MMANON_BATCH) != RS_RET_OK
+	   || wtiConstruct(&pWti) != RS_RET_OK
+	   || wtiConstructFinalize(pWti) != RS_RET_OK) {
+		fprintf(stderr, "rsbench: could not set up worker, mmanon benchmarks skipped\n");
+		nCases = 0;
+	} else {
+		pWti->pbShutdownImmediate = &bShutdownImmediate;
+		nCases = sizeof(mmanonCases) / sizeof(mmanonCases[0]) - 1;
+	}
+	for(j = 0 ; j < nCases ; ++j) {
+		if(!selected(mmanonCases[j].name))
+			continue;
+		snprintf(name, sizeof(name), "bench_mmanon%d", j);
+		if(ruleset.GetRuleset(ourConf, &pRuleset, (uchar*) name) != RS_RET_OK) {
+			fprintf(stderr, "rsbench: ruleset %s not found, skipped\n", name);
+			continue;
+		}
+		for(i = 0 ; i < BENCH_MMANON_BATCH ; ++i) {
+			pMsgs[i] = newParsedMsg(mmanonCases[j].msg);
+			MsgSetRuleset(pMsgs[i], pRuleset);
+			batch.pElem[i].pMsg = pMsgs[i];
+		}
+		origMsg = ustrdup(getMSG(pMsgs[0]));
+		lenOrigMsg = getMSGLen(pMsgs[0]);
+		t = now();
+		for(nDone = 0 ; nDone < nOps ; nDone += BENCH_MMANON_BATCH) {
+			for(i = 0 ; i < BENCH_MMANON_BATCH ; ++i) {
+				MsgReplaceMSG(pMsgs[i], origMsg, lenOrigMsg);
+				batch.eltState[i] = BATCH_STATE_RDY;
+			}
+			batch.nElem = BENCH_MMANON_BATCH;
+			ruleset.ProcessBatch(&batch, pWti);
+		}
+		t = now() - t;
+		report(mmanonCases[j].name, nDone, t);
+		printf("# %s: %.1f MB/s of MSG\n", mmanonCases[j].name,
+		       (double) nDone * lenOrigMsg / t / (1024 * 1024));
+		free(origMsg);
+		for(i = 0 ; i < BENCH_MMANON_BATCH ; ++i)
+			msgDestruct(&pMsgs[i]);
+	}
+	if(pWti != NULL)
+		wtiDestruct(&pWti);
+	batchFree(&batch);
+}
+#endif
+
+
+static void
+benchStrm(void)
+{
+	strm_t *pStrm;
+	const char *line = "2003-10-11T22:14:15.003Z mymachine su[123]: 'su root' failed for lonvick on /dev/pts/8\n";
+	const size_t lenLine = strlen(line);
+	double t;
+	long i;
+
+	if(!selected("strm.write"))
+		return;
+	if(strm.Construct(&pStrm) != RS_RET_OK)
+		return;
+	strm.SetFName(pStrm, UCHAR_CONSTANT("rsbench.strm"), sizeof("rsbench.strm") - 1);
+	strm.SetDir(pStrm, (uchar*) workDir, strlen(workDir));
+	strm.SettOperationsMode(pStrm, STREAMMODE_WRITE_TRUNC);
+	strm.SetsType(pStrm, STREAMTYPE_FILE_SINGLE);
+	if(strm.ConstructFinalize(pStrm) != RS_RET_OK) {
+		strm.Destruct(&pStrm);
+		return;
+	}
+	t = now();
+	for(i = 0 ; i < nOps ; ++i)
+		strm.Write(pStrm, (uchar*) line, lenLine);
+	strm.Flush(pStrm);
+	report("strm.write", nOps, now() - t);
+	strm.Destruct(&pStrm);
+}
+
+
+/* create the config in our work directory. It needs an action, else
+ * rsyslog does not accept it.
+ */
+static rsRetVal
+writeConf(char *confFile, size_t lenConfFile)
+{
+	FILE *fp;
+	int j;
+	DEFiRet;
+
+	snprintf(confFile, lenConfFile, "%s/rsbench.conf", workDir);
+	if((fp = fopen(confFile, "w")) == NULL)
+		ABORT_FINALIZE(RS_RET_FOPEN_FAILURE);
+	fprintf(fp, "global(workDirectory=\"%s\")\n", workDir);
+	for(j = 0 ; exprs[j].name != NULL ; ++j)
+		fprintf(fp, "ruleset(name=\"bench_expr%d\") {\n\tif %s then stop\n}\n", j, exprs[j].expr);
+#ifdef RSBENCH_MMANON
+	fprintf(fp, "module(load=\"../plugins/mmanon/.libs/mmanon\")\n");
+	for(j = 0 ; mmanonCases[j].name != NULL ; ++j)
+		fprintf(fp, "ruleset(name=\"bench_mmanon%d\") {\n\taction(type=\"mmanon\" %s)\n}\n",
+			j, mmanonCases[j].params);
+#endif
+	fprintf(fp, "action(type=\"omfile\" file=\"/dev/null\")\n");
+	fclose(fp);
+finalize_it:
+	RETiRet;
+}
+
+static void
+cleanup(void)
+{
+	DIR *dir;
+	struct dirent *ent;
+	char fn[4096];
+
+	if((dir = opendir(workDir)) == NULL)
+		return;
+	while((ent = readdir(dir)) != NULL) {
+		if(ent->d_name[0] == '.')
+			continue;
+		snprintf(fn, sizeof(fn), "%s/%s", workDir, ent->d_name);
+		unlink(fn);
+	}
+	closedir(dir);
+	rmdir(workDir);
+}
+
+static rsRetVal
+init(void)
+{
+	char confFile[4096];
+	DEFiRet;
+
+	CHKiRet(rsyslogd_InitGlobalClasses());
+	CHKiRet(syslogd_obtainClassPointers());
+	CHKiRet(queryLocalHostname());
+	CHKiRet(modInitIminternal());
+
+	CHKiRet(objGetObjInterface(&obj));
+	CHKiRet(objUse(glbl,	CORE_COMPONENT));
+	CHKiRet(objUse(prop,	CORE_COMPONENT));
+	CHKiRet(objUse(parser,	CORE_COMPONENT));
+	CHKiRet(objUse(ruleset,	CORE_COMPONENT));
+	CHKiRet(objUse(rsconf,	CORE_COMPONENT));
+	CHKiRet(objUse(strm,	CORE_COMPONENT));
+
+	CHKiRet(writeConf(confFile, sizeof(confFile)));
+	CHKiRet(rsconf.Load(&ourConf, (uchar*) confFile));
+
+	CHKiRet(prop.Construct(&pInputName));
+	CHKiRet(prop.SetString(pInputName, UCHAR_CONSTANT("rsbench"), sizeof("rsbench") - 1));
+	CHKiRet(prop.ConstructFinalize(pInputName));
+finalize_it:
+	RETiRet;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	rsRetVal iRet;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:b:")) != -1) {
+		switch (opt) {
+		case 'n':	nOps = atol(optarg);
+				break;
+		case 'b':	benchPrefix = optarg;
+				break;
+		default:	printf("invalid option '%c' or value missing - terminating...\n", opt);
+				exit (1);
+				break;
+		}
+	}
+	if(nOps < 1) {
+		printf("ops must be positive\n");
+		exit(1);
+	}
+	if(mkdtemp(workDir) == NULL) {
+		perror("rsbench: mkdtemp");
+		exit(1);
+	}
+
+	dbgClassInit();
+	if((iRet = init()) != RS_RET_OK) {
+		fprintf(stderr, "rsbench: initialization failed with error %d\n", iRet);
+		cleanup();
+		exit(1);
+	}
+
+	printf("#benchmark,ops,seconds,ns_per_op\n");
+	benchMsg();
+	benchParse("parse.rfc3164", msg3164);
+	benchParse("parse.rfc5424", msg5424);
+	benchTpl();
+	benchExpr();
+	benchQueue();
+	benchBatch();
+#ifdef RSBENCH_MMANON
+	benchMmanon();
+#endif
+	benchStrm();
+
+	cleanup();
+	return 0;
+}
@@ -0,0 +1,48 @@
+# Test the script functions whose arguments are converted to C strings
+# in the worker arena: re_match(), re_extract(), field() and lookup().
+# The messages carry payloads of up to 6000 bytes, so the arena overflows
+# and must grow over the first batches. One input is bound to a ruleset
+# with its own queue (arena), the other one is processed directly on the
+# input thread, which has no arena and must fall back to malloc().
+# Results must be identical either way.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[rscript_arena.sh\]: test script functions with the worker arena
+source $srcdir/diag.sh init
+cat > rsyslog.lookup.json <<'TABLE'
+{ "version": 1, "table": [
+  { "index": "k0", "value": "v0" }, { "index": "k1", "value": "v1" },
+  { "index": "k2", "value": "v2" } ] }
+TABLE
+# $1 is the first message number, $2 the number of messages
+gen_input() {
+	awk -v first=$1 -v n=$2 'BEGIN {
+		for(i = first ; i < first + n ; ++i) {
+			printf("<167>Mar  1 01:00:00 172.20.245.8 tag msgnum:%8.8d:", i)
+			for(j = 0 ; j < (i * 37) % 6000 + 1 ; ++j)
+				printf("x")
+			printf(":k%d:\n", i % 4)
+		}
+	}' > rsyslog.input
+}
+source $srcdir/diag.sh startup rscript_arena.conf
+gen_input 0 5000
+source $srcdir/diag.sh tcpflood -p13515 -I rsyslog.input
+gen_input 5000 1000
+source $srcdir/diag.sh tcpflood -I rsyslog.input
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 5000 60
+source $srcdir/diag.sh wait-file-lines rsyslog.out.direct.log 1000 60
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+awk 'BEGIN {
+	for(i = 0 ; i < 6000 ; ++i)
+		printf("%8.8d,%d,ok,%s\n", i, (i * 37) % 6000 + 1, (i % 4 == 3) ? "" : "v" i % 4)
+}' > rsyslog.out.expected.log
+sort rsyslog.out.log rsyslog.out.direct.log > rsyslog.out.sorted.log
+if ! cmp rsyslog.out.expected.log rsyslog.out.sorted.log; then
+	echo "error: script functions returned wrong results"
+	diff rsyslog.out.expected.log rsyslog.out.sorted.log | head
+	exit 1
+fi
+rm -f rsyslog.lookup.json
+source $srcdir/diag.sh exit
@@ -0,0 +1,16 @@
+# Check == and != comparisons against constant string arrays.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_array_set.sh\]: testing comparisons against large string arrays
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_array_set.conf
+source $srcdir/diag.sh injectmsg  0 10
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cmp rsyslog.out.log $srcdir/resultdata/rscript_array_set.log
+if [ ! $? -eq 0 ]; then
+	echo "unexpected comparison results:"
+	cat rsyslog.out.log
+	exit 1
+fi;
+source $srcdir/diag.sh exit
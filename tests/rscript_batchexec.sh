@@ -0,0 +1,16 @@
+# Check ruleset execution in batch mode (global ruleset.batchexec).
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_batchexec.sh\]: testing batch execution of rulesets
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_batchexec.conf
+source $srcdir/diag.sh injectmsg  0 10
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cmp rsyslog.out.log $srcdir/resultdata/rscript_batchexec.log
+if [ ! $? -eq 0 ]; then
+	echo "unexpected batch execution results:"
+	cat rsyslog.out.log
+	exit 1
+fi;
+source $srcdir/diag.sh exit
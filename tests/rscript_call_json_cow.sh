@@ -0,0 +1,25 @@
+# Check that messages passed to a ruleset with its own queue do not
+# share modifications of their JSON properties with the original.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_call_json_cow.sh\]: testing private JSON trees with call
+source $srcdir/diag.sh init
+rm -f rsyslog2.out.log
+source $srcdir/diag.sh startup rscript_call_json_cow.conf
+source $srcdir/diag.sh injectmsg  0 5000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ `grep -c ',orig,main$' rsyslog.out.log` -ne 5000 ]; then
+	echo "original messages were modified by the called ruleset:"
+	grep -v ',orig,main$' rsyslog.out.log | head
+	exit 1
+fi
+if [ `grep -c ',copy,new$' rsyslog2.out.log` -ne 5000 ]; then
+	echo "copies do not contain the expected values:"
+	grep -v ',copy,new$' rsyslog2.out.log | head
+	exit 1
+fi
+rm -f rsyslog2.out.log
+cut -d, -f1 < rsyslog.out.log > rsyslog.out.tmp && mv rsyslog.out.tmp rsyslog.out.log
+source $srcdir/diag.sh seq-check  0 4999
+source $srcdir/diag.sh exit
@@ -0,0 +1,16 @@
+# Check inlining of calls and removal of constant and dead branches.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_callinline.sh\]: testing call inlining and dead-branch removal
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_callinline.conf
+source $srcdir/diag.sh injectmsg  0 10
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cmp rsyslog.out.log $srcdir/resultdata/rscript_callinline.log
+if [ ! $? -eq 0 ]; then
+	echo "unexpected call inlining results:"
+	cat rsyslog.out.log
+	exit 1
+fi;
+source $srcdir/diag.sh exit
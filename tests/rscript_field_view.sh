@@ -0,0 +1,17 @@
+# Check field() results when they are used as string views inside
+# compiled expressions (comparisons, nesting, concatenation, storing).
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_field_view.sh\]: testing field\(\) on string views
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_field_view.conf
+source $srcdir/diag.sh injectmsg  0 3
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cmp rsyslog.out.log $srcdir/resultdata/rscript_field_view.log
+if [ ! $? -eq 0 ]; then
+	echo "unexpected field() results:"
+	cat rsyslog.out.log
+	exit 1
+fi;
+source $srcdir/diag.sh exit
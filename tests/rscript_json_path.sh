@@ -0,0 +1,18 @@
+# Check access to nested JSON properties via their precompiled paths.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_json_path.sh\]: testing nested JSON property access
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_json_path.conf
+source $srcdir/diag.sh injectmsg  0 1000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+EXPECTED=',v,local,,,1,{ "a": { "b": { "c": "v" } }, "ok": "1" }'
+if [ `grep -c -F -- "$EXPECTED" rsyslog.out.log` -ne 1000 ]; then
+	echo "unexpected property values, expected '$EXPECTED':"
+	grep -v -F -- "$EXPECTED" rsyslog.out.log | head
+	exit 1
+fi
+cut -d, -f1 < rsyslog.out.log > rsyslog.out.tmp && mv rsyslog.out.tmp rsyslog.out.log
+source $srcdir/diag.sh seq-check  0 999
+source $srcdir/diag.sh exit
@@ -0,0 +1,17 @@
+# Check that local variables kept in slot storage behave the same as
+# those kept in the localvars JSON tree, also when both are mixed.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_localvar_slots.sh\]: testing slot storage for local variables
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_localvar_slots.conf
+source $srcdir/diag.sh injectmsg  0 4
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cmp rsyslog.out.log $srcdir/resultdata/rscript_localvar_slots.log
+if [ ! $? -eq 0 ]; then
+	echo "unexpected local variable values:"
+	cat rsyslog.out.log
+	exit 1
+fi;
+source $srcdir/diag.sh exit
@@ -0,0 +1,16 @@
+# Check the results of filter chains that are evaluated by a multi-match.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_multimatch.sh\]: testing multi-pattern matching of filter chains
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_multimatch.conf
+source $srcdir/diag.sh injectmsg  0 10
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cmp rsyslog.out.log $srcdir/resultdata/rscript_multimatch.log
+if [ ! $? -eq 0 ]; then
+	echo "unexpected filter results:"
+	cat rsyslog.out.log
+	exit 1
+fi;
+source $srcdir/diag.sh exit
@@ -0,0 +1,21 @@
+# Check a chain of PRI filters combined into a single dispatch table.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_pridispatch.sh\]: testing PRI filter dispatch
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_pridispatch.conf
+sleep 1
+source $srcdir/diag.sh tcpflood -m1 -P167
+source $srcdir/diag.sh tcpflood -m1 -P164
+source $srcdir/diag.sh tcpflood -m1 -P13
+source $srcdir/diag.sh tcpflood -m1 -P3
+source $srcdir/diag.sh tcpflood -m1 -P18
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+LC_ALL=C sort rsyslog.out.log | cmp - $srcdir/resultdata/rscript_pridispatch.log
+if [ ! $? -eq 0 ]; then
+	echo "unexpected PRI filter results:"
+	cat rsyslog.out.log
+	exit 1
+fi;
+source $srcdir/diag.sh exit
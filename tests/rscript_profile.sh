@@ -0,0 +1,26 @@
+# Test for the ruleset statement profiler. The action slows processing
+# down, so that impstats emits the profile counters while the messages
+# are processed. The filters must show up keyed by config file and line.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_profile.sh\]: test ruleset statement profiles
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_profile.conf
+source $srcdir/diag.sh injectmsg 0 1000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 999
+grep 'profile RSYSLOG_DefaultRuleset: .*rscript_profile.conf:13:if.hits=[1-9][0-9]* [^ ]*rscript_profile.conf:13:if.passed=[1-9]' rsyslog.out.stats.log > /dev/null
+if [ $? -ne 0 ]; then
+  echo "error: profile of matching filter missing in stats output:"
+  cat rsyslog.out.stats.log
+  exit 1
+fi
+grep 'profile RSYSLOG_DefaultRuleset: .*rscript_profile.conf:15:if.hits=[1-9][0-9]* [^ ]*rscript_profile.conf:15:if.passed=0 ' rsyslog.out.stats.log > /dev/null
+if [ $? -ne 0 ]; then
+  echo "error: profile of non-matching filter missing in stats output:"
+  cat rsyslog.out.stats.log
+  exit 1
+fi
+rm -f rsyslog.out.stats.log
+source $srcdir/diag.sh exit
@@ -0,0 +1,16 @@
+# Check that properties read multiple times by a ruleset reflect set/unset.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_propmemo.sh\]: testing property reads across set and unset
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_propmemo.conf
+source $srcdir/diag.sh injectmsg  0 5
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cmp rsyslog.out.log $srcdir/resultdata/rscript_propmemo.log
+if [ ! $? -eq 0 ]; then
+	echo "unexpected property values:"
+	cat rsyslog.out.log
+	exit 1
+fi;
+source $srcdir/diag.sh exit
@@ -0,0 +1,30 @@
+# Test the ratelimit() RainerScript function. Messages are limited per
+# key, with four keys. A fast burst must let through about the burst
+# size per key. After a pause, tokens are refilled in proportion to the
+# time passed, not just at the end of the interval. Invalid parameters
+# must be rejected.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[rscript_ratelimit.sh\]: test the ratelimit\(\) function
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check rscript_ratelimit-invalid.conf 0
+source $srcdir/diag.sh check-errmsg "ratelimit(): burst must be 1..65535"
+source $srcdir/diag.sh startup rscript_ratelimit.conf
+source $srcdir/diag.sh tcpflood -m2000
+./msleep 2000 # refills 20 tokens per key
+source $srcdir/diag.sh tcpflood -m400 -i2000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+# $1 is the phase, $2 and $3 the permitted range of messages per key
+check_counts() {
+	for k in 0 1 2 3; do
+		cnt=$(grep -c "^$1 k$k$" rsyslog.out.log)
+		if [ $cnt -lt $2 ] || [ $cnt -gt $3 ]; then
+			echo "error: $cnt messages for key k$k in $1, expected $2..$3"
+			exit 1
+		fi
+	done
+}
+check_counts burst 100 115
+check_counts refill 10 40
+source $srcdir/diag.sh exit
@@ -0,0 +1,16 @@
+# Check re_match(), re_extract() and ereregex filters with the PCRE2 engine.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_re_pcre2.sh\]: testing the PCRE2 regex engine
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_re_pcre2.conf
+source $srcdir/diag.sh injectmsg  0 10
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cmp rsyslog.out.log $srcdir/resultdata/rscript_re_pcre2.log
+if [ ! $? -eq 0 ]; then
+	echo "unexpected regex results:"
+	cat rsyslog.out.log
+	exit 1
+fi;
+source $srcdir/diag.sh exit
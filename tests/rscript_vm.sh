@@ -0,0 +1,16 @@
+# Check the results of compiled rainerscript expressions.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[rscript_vm.sh\]: testing compiled rainerscript expressions
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup rscript_vm.conf
+source $srcdir/diag.sh injectmsg  0 10
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+cmp rsyslog.out.log $srcdir/resultdata/rscript_vm.log
+if [ ! $? -eq 0 ]; then
+	echo "unexpected expression results:"
+	cat rsyslog.out.log
+	exit 1
+fi;
+source $srcdir/diag.sh exit
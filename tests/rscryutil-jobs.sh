@@ -0,0 +1,30 @@
+# Test multi-threaded decryption in rscryutil. The files hold several
+# crypto blocks (a HUP closes the first one), each larger than the 1MiB
+# units blocks are split into. Decrypting with one and with several
+# threads must both exactly reproduce the unencrypted copy.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[rscryutil-jobs.sh\]: test parallel decryption with rscryutil
+source $srcdir/diag.sh init
+mkdir test-logdir
+source $srcdir/diag.sh startup rscryutil-jobs.conf
+source $srcdir/diag.sh tcpflood -m3000 -d1000
+source $srcdir/diag.sh wait-file-lines test-logdir/plain.log 3000
+source $srcdir/diag.sh issue-HUP
+source $srcdir/diag.sh tcpflood -m3000 -i3000 -d1000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+
+for m in CBC CTR; do
+	f=test-logdir/$(echo $m | tr A-Z a-z).log
+	for j in 1 4; do
+		../tools/rscryutil -d -j $j -a AES128 -m $m -K 1234567890123456 $f \
+			> rsyslog.out.decrypted.log 2> rsyslog.out.err.log
+		if ! cmp test-logdir/plain.log rsyslog.out.decrypted.log; then
+			echo "error: $m file decrypted with $j jobs differs from plaintext"
+			cat rsyslog.out.err.log
+			exit 1
+		fi
+	done
+done
+source $srcdir/diag.sh exit
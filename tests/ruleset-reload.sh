@@ -0,0 +1,40 @@
+# Test reloading a ruleset from its file ("file" parameter) on HUP while
+# several workers process messages. The replaced scripts are freed while
+# rsyslogd runs, which must neither lose messages nor crash a worker that
+# is still executing an old script.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[ruleset-reload.sh\]: test reloading a ruleset file on HUP
+source $srcdir/diag.sh init
+echo 'set $!tag = "v1";
+call out' > work-ruleset-reload.conf
+source $srcdir/diag.sh startup ruleset-reload.conf
+source $srcdir/diag.sh injectmsg 0 5000
+source $srcdir/diag.sh wait-queueempty
+# reload while messages are being processed. The contents alternate in
+# size, so that each write is seen as a change.
+for i in 1 2 3 4 5 6; do
+	if [ $((i % 2)) -eq 0 ]; then tag="v2"; else tag="v333"; fi
+	echo "set \$!tag = \"$tag\";
+call out" > work-ruleset-reload.conf
+	kill -HUP `cat rsyslog.pid`
+	source $srcdir/diag.sh injectmsg $((4500 + i * 500)) 500
+done
+echo 'set $!tag = "final";
+call out' > work-ruleset-reload.conf
+source $srcdir/diag.sh issue-HUP
+source $srcdir/diag.sh injectmsg 8000 1000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 8999
+if [ `grep -c "^v1$" rsyslog2.out.log` -ne 5000 ]; then
+  echo "messages sent before the first reload were not processed by the first script:"
+  sort rsyslog2.out.log | uniq -c
+  exit 1
+fi
+if [ `grep -c "^final$" rsyslog2.out.log` -ne 1000 ]; then
+  echo "messages sent after the last reload were not processed by the last script:"
+  sort rsyslog2.out.log | uniq -c
+  exit 1
+fi
+source $srcdir/diag.sh exit
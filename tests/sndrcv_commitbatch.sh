@@ -0,0 +1,21 @@
+# Test that a batch that omfwd could not deliver is resent once the
+# action resumes. The receiver is started only after the sender has
+# tried (and failed) to forward the first batches. All messages must
+# arrive, none twice.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_commitbatch.sh\]: test resending of undelivered batch messages
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sndrcv_commitbatch_sender.conf 2
+source $srcdir/diag.sh tcpflood -m10000
+sleep 3 # let the sender fail on the missing receiver
+source $srcdir/diag.sh startup sndrcv_commitbatch_rcvr.conf
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 10000 60
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+sort -n rsyslog.out.log > rsyslog.out.sorted.log
+mv rsyslog.out.sorted.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
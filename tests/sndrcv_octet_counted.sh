@@ -0,0 +1,6 @@
+# This tests two rsyslog instances. Instance TWO sends data to
+# instance ONE via octet-counted TCP framing.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[sndrcv_octet_counted.sh\]: testing sending and receiving via tcp, octet-counted framing
+source $srcdir/sndrcv_drvr.sh sndrcv_octet_counted 50000
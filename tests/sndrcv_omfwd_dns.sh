@@ -0,0 +1,21 @@
+# Test cached asynchronous target resolution in omfwd. The target is
+# given by name with a short dns.ttl, so the address is refreshed in the
+# background between the two bursts. A second action points to a name
+# that can not be resolved; it must not hold up the working one. All
+# messages must arrive.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_omfwd_dns.sh\]: test omfwd asynchronous target resolution
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sndrcv_omfwd_dns_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_omfwd_dns_sender.conf 2
+source $srcdir/diag.sh tcpflood -m5000
+sleep 3 # let the cached address expire
+source $srcdir/diag.sh tcpflood -m5000 -i5000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 10000
+source $srcdir/diag.sh shutdown-immediate 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
@@ -0,0 +1,23 @@
+# Test batched sending in omudpspoof. The sender relays large transactions
+# of messages that do not fit into the MTU, so each of them needs to be
+# sent as several IP fragments. All messages must be reassembled and
+# arrive with intact content. Note that with UDP we can always have
+# message loss, so we keep the number of messages low.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_omudpspoof_batch.sh\]: test omudpspoof batched sending with fragments
+echo This test must be run as root [raw socket access required]
+if [ "$EUID" -ne 0 ]; then
+    exit 77 # Not root, skip this test
+fi
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sndrcv_omudpspoof_batch_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_omudpspoof_batch_sender.conf 2
+source $srcdir/diag.sh tcpflood -m1000 -d3000
+sleep 2 # make sure all data is received in input buffers
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 999 -E
+source $srcdir/diag.sh exit
@@ -0,0 +1,22 @@
+# Test an omrelp session pool spread over two receiver ports. All
+# messages must arrive, and both ports must have received a share.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_relp_pool.sh\]: test omrelp session pool
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sndrcv_relp_pool_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_relp_pool_sender.conf 2
+source $srcdir/diag.sh tcpflood -m50000
+sleep 2 # make sure all data is received in input buffers
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ ! -s rsyslog.out.log ] || [ ! -s rsyslog2.out.log ]; then
+	echo "error: sessions were not spread over both targets"
+	wc -l rsyslog.out.log rsyslog2.out.log
+	exit 1
+fi
+cat rsyslog2.out.log >> rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 49999
+source $srcdir/diag.sh exit
@@ -0,0 +1,30 @@
+# Test imrelp with several relp engine threads. The sender spreads the
+# messages over three omrelp actions, one per receiver port, and the
+# receiver runs three engines, so each port is served by its own thread.
+# Every port must receive its share completely and in order, and the
+# receiver must shut down cleanly with all engines running.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_relp_workers.sh\]: test imrelp with multiple engine threads
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sndrcv_relp_workers_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_relp_workers_sender.conf 2
+source $srcdir/diag.sh tcpflood -m30000
+sleep 2 # make sure all data is received in input buffers
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+for p in 0 1 2; do
+	awk -v p=$p '$1 != p { print "error: message " $2 " on wrong port"; exit 1 }
+		     $2 + 0 <= last && NR > 1 { print "error: " $2 " after " last; exit 1 }
+		     { last = $2 + 0 }
+		     END { if(NR != 10000) { print "error: " NR " messages on port " p; exit 1 } }' \
+		rsyslog.out.port$p.log
+	if [ $? -ne 0 ]; then
+		exit 1
+	fi
+done
+cat rsyslog.out.port*.log | cut -d' ' -f2 | sort -n > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 29999
+source $srcdir/diag.sh exit
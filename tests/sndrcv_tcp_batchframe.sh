@@ -0,0 +1,18 @@
+# Test batched TCP framing in omfwd. Messages of random size are forwarded
+# in large transactions once with traditional and once with octet-counted
+# framing. Both streams must arrive complete and with intact content.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_tcp_batchframe.sh\]: test omfwd batched TCP framing
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sndrcv_tcp_batchframe_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_tcp_batchframe_sender.conf 2
+source $srcdir/diag.sh tcpflood -m20000 -r -d3000
+sleep 2 # make sure all data is received in input buffers
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999 -E
+source $srcdir/diag.sh seq-check2 0 19999 -E
+source $srcdir/diag.sh exit
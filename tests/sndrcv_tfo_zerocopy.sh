@@ -0,0 +1,34 @@
+# Test TCP Fast Open and MSG_ZEROCOPY. The sender forwards large
+# messages with tcp.fastopen and tcp.zerocopy to an imtcp and an imptcp
+# listener, both with TFO enabled. All messages must arrive intact.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_tfo_zerocopy.sh\]: test TCP Fast Open and zero-copy send
+if [ "`uname`" != "Linux" ]; then
+    exit 77 # TFO and MSG_ZEROCOPY are Linux only, skip this test
+fi
+if [ $((`cat /proc/sys/net/ipv4/tcp_fastopen 2>/dev/null || echo 0` & 3)) -ne 3 ]; then
+    echo "TCP Fast Open not enabled for client and server (net.ipv4.tcp_fastopen), skipping"
+    exit 77
+fi
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sndrcv_tfo_zerocopy_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_tfo_zerocopy_sender.conf 2
+source $srcdir/diag.sh tcpflood -m2000 -d40000
+sleep 2 # make sure all data is received in input buffers
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+for f in rsyslog.out.log rsyslog2.out.log; do
+	if awk -F, 'length($2) != 40000 { print FILENAME ": " $1 " truncated"; bad=1 } END { exit !bad }' $f; then
+		echo "error: messages were not received intact"
+		exit 1
+	fi
+	cut -d, -f1 $f > rsyslog.out.cut.log
+	mv rsyslog.out.cut.log $f
+done
+source $srcdir/diag.sh seq-check 0 1999
+mv rsyslog2.out.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 1999
+source $srcdir/diag.sh exit
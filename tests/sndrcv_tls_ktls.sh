@@ -0,0 +1,27 @@
+# Test kernel TLS offload in nsd_gtls. Both sides run with
+# netstreamdriver.ktls="on". All messages must arrive, whether or not the
+# kernel can take over the session. If the kernel tls module is loaded,
+# the receiver must also report at least one offloaded RX direction.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_tls_ktls.sh\]: test kernel TLS offload
+source $srcdir/diag.sh init
+echo \$DefaultNetstreamDriverCAFile $srcdir/tls-certs/ca.pem     >rsyslog.conf.tlscert
+echo \$DefaultNetstreamDriverCertFile $srcdir/tls-certs/cert.pem >>rsyslog.conf.tlscert
+echo \$DefaultNetstreamDriverKeyFile $srcdir/tls-certs/key.pem   >>rsyslog.conf.tlscert
+source $srcdir/diag.sh startup sndrcv_tls_ktls_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_tls_ktls_sender.conf 2
+source $srcdir/diag.sh tcpflood -m20000
+sleep 2 # make sure all data is received in input buffers
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+./msleep 1500 # one more stats interval on the receiver
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999
+if grep -q '^tls ' /proc/modules 2>/dev/null; then
+	source $srcdir/diag.sh stats-check ": nsd_gtls: .*ktls.rx=[1-9]"
+else
+	echo "kernel tls module not loaded, offload counters not checked"
+fi
+source $srcdir/diag.sh exit
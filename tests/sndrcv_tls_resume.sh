@@ -0,0 +1,23 @@
+# Test TLS session resumption. The sender rebinds its TLS connection every
+# 1000 messages, so it must resume the previous session on most reconnects
+# instead of doing a full handshake. The receiver's nsd_gtls stats must
+# show both full and resumed handshakes, and all messages must arrive.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_tls_resume.sh\]: test TLS session resumption
+source $srcdir/diag.sh init
+echo \$DefaultNetstreamDriverCAFile $srcdir/tls-certs/ca.pem     >rsyslog.conf.tlscert
+echo \$DefaultNetstreamDriverCertFile $srcdir/tls-certs/cert.pem >>rsyslog.conf.tlscert
+echo \$DefaultNetstreamDriverKeyFile $srcdir/tls-certs/key.pem   >>rsyslog.conf.tlscert
+source $srcdir/diag.sh startup sndrcv_tls_resume_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_tls_resume_sender.conf 2
+source $srcdir/diag.sh tcpflood -m10000
+sleep 2 # make sure all data is received in input buffers
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+./msleep 1500 # one more stats interval on the receiver
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh stats-check ": nsd_gtls: server.handshakes.full=[1-9][0-9]* server.handshakes.resumed=[1-9]"
+source $srcdir/diag.sh exit
@@ -0,0 +1,24 @@
+# Test batched UDP forwarding in omfwd. The sender forwards transactions
+# of up to 128 messages, which must be sent with far fewer sendmmsg()
+# calls than messages. All messages must arrive at the receiver.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_udp_sendmmsg.sh\]: test omfwd UDP sendmmsg batching
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sndrcv_udp_sendmmsg_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_udp_sendmmsg_sender.conf 2
+source $srcdir/diag.sh tcpflood -m5000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 5000
+source $srcdir/diag.sh wait-stats ": omfwd udp 127.0.0.1:13515: sent=5000 failed=0 called.sendmmsg=[0-9]+"
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 4999
+ncalls=$(grep -o ': omfwd udp 127.0.0.1:13515: sent=5000 failed=0 called.sendmmsg=[0-9]*' \
+	rsyslog.out.stats.log | tail -1 | sed 's/.*=//')
+if [ "$ncalls" -ge 2500 ]; then
+	echo "error: $ncalls sendmmsg() calls for 5000 messages, batching does not work"
+	exit 1
+fi
+source $srcdir/diag.sh exit
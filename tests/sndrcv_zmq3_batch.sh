@@ -0,0 +1,22 @@
+# Test zmq batch modes between omzmq3 and imzmq3. The sender forwards
+# each message once as multipart batch and once as framed batch, to two
+# receiver sockets. Both streams must arrive completely. An unknown batch
+# mode must be reported at config verification.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_zmq3_batch.sh\]: test zmq batch modes
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check sndrcv_zmq3_batch_invalid.conf 1
+source $srcdir/diag.sh check-errmsg "unknown batchMode 'huge'"
+source $srcdir/diag.sh startup sndrcv_zmq3_batch_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_zmq3_batch_sender.conf 2
+source $srcdir/diag.sh tcpflood -m20000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 20000
+source $srcdir/diag.sh wait-file-lines rsyslog2.out.log 20000
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999
+source $srcdir/diag.sh seq-check2 0 19999
+source $srcdir/diag.sh exit
@@ -0,0 +1,23 @@
+# Test imzmq3 receiver threads. The receiver spreads its sockets over
+# three threads; one input has three connecting PULL readers, over which
+# the sender's binding PUSH socket distributes the messages. Both
+# streams must arrive completely.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_zmq3_threads.sh\]: test imzmq3 receiver threads and readers
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup sndrcv_zmq3_threads_sender.conf 2
+source $srcdir/diag.sh startup sndrcv_zmq3_threads_rcvr.conf
+source $srcdir/diag.sh tcpflood -m20000
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 20000
+source $srcdir/diag.sh wait-file-lines rsyslog2.out.log 20000
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+# the readers deliver in parallel, so order is not preserved
+sort -n rsyslog.out.log > rsyslog.out.sorted.log
+mv rsyslog.out.sorted.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 19999
+source $srcdir/diag.sh seq-check2 0 19999
+source $srcdir/diag.sh exit
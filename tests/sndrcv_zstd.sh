@@ -0,0 +1,28 @@
+# Test zstd compression in streams, omfwd/imptcp and disk queues. The
+# sender forwards through a zstd-compressed disk queue over a zstd
+# compressed TCP stream. The receiver writes a plain and a zstd compressed
+# file, which must have the same content. An unknown algorithm must be
+# reported at config verification.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[sndrcv_zstd.sh\]: test zstd compression
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check sndrcv_zstd_invalid.conf 1
+source $srcdir/diag.sh check-errmsg "compression algorithm 'brotli' is not supported"
+source $srcdir/diag.sh startup sndrcv_zstd_rcvr.conf
+source $srcdir/diag.sh startup sndrcv_zstd_sender.conf 2
+source $srcdir/diag.sh tcpflood -m20000
+sleep 2 # make sure all data is received in input buffers
+source $srcdir/diag.sh shutdown-when-empty 2
+source $srcdir/diag.sh wait-shutdown 2
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999
+if type zstd >/dev/null 2>&1; then
+	zstd -dc < rsyslog2.out.log | cmp - rsyslog.out.log
+	if [ $? -ne 0 ]; then
+		echo "error: zstd compressed output differs"
+		exit 1
+	fi
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,8 @@
+echo ===============================================================================
+echo \[sql_escape.sh\]: test for sql escaping of properties
+$srcdir/killrsyslog.sh # kill rsyslogd if it runs for some reason
+
+./nettester -tsql_escape -iudp
+if [ "$?" -ne "0" ]; then
+  exit 1
+fi
@@ -0,0 +1,24 @@
+# Test per-thread statistics counters with resetting. Eight main queue
+# workers run an action concurrently, so its "processed" counter is
+# updated from all of them. The counter is reset on every stats interval,
+# and the sum of all reported values must be exactly the number of
+# messages, both when summing concurrently updated slots and when resetting.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[stats-perthread.sh\]: test per-thread stats counters with reset
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup stats-perthread.conf
+source $srcdir/diag.sh tcpflood -m20000 -c4
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 20000
+./msleep 2500 # make sure the final counts have been emitted
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 19999
+sum=$(grep -o ': countme: processed=[0-9]*' rsyslog.out.stats.log | \
+	awk -F= '{ s += $2 } END { print s + 0 }')
+if [ "$sum" -ne 20000 ]; then
+	echo "error: processed counters sum up to $sum, expected 20000"
+	grep ': countme:' rsyslog.out.stats.log
+	exit 1
+fi
+source $srcdir/diag.sh exit
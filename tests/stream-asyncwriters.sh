@@ -0,0 +1,25 @@
+# Test the shared async writer pool of the stream subsystem. 20 dynafiles
+# are written with asyncWriting on. Instead of one writer thread per file,
+# only the two configured pool threads may exist, and all messages must be
+# written.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[stream-asyncwriters.sh\]: test shared async writer threads
+if [ ! -d /proc/self/task ]; then
+    exit 77 # needs Linux /proc to count the threads, skip this test
+fi
+source $srcdir/diag.sh init
+rm -f rsyslog.out.async.*.log
+source $srcdir/diag.sh startup stream-asyncwriters.conf
+source $srcdir/diag.sh tcpflood -m20000
+nwriters=$(cat /proc/`cat rsyslog.pid`/task/*/comm | grep -c '^rs:strm-writer$')
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ $nwriters -ne 2 ]; then
+	echo "error: expected 2 stream writer threads, found $nwriters"
+	exit 1
+fi
+cat rsyslog.out.async.*.log > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 19999
+rm -f rsyslog.out.async.*.log
+source $srcdir/diag.sh exit
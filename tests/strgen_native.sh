@@ -0,0 +1,19 @@
+# Check that the native strgens for RSYSLOG_SyslogProtocol23Format and
+# RSYSLOG_JSONFormat create the same output as equivalent string templates.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[strgen_native.sh\]: testing native RFC5424 and JSON strgens
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup strgen_native.conf
+source $srcdir/diag.sh tcpflood -m100
+./tcpflood -m1 -M "<165>1 2003-08-24T05:14:15.000003-07:00 192.0.2.1 myproc 8710 ID47 [exampleSDID@32473 iut=\"3\"] a \"quoted\" back\\\\slash msg"
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ `wc -l < rsyslog.out.p23native.log` -ne 101 ]; then
+	echo "unexpected number of messages:"
+	wc -l rsyslog.out.*.log
+	exit 1
+fi
+cmp rsyslog.out.p23native.log rsyslog.out.p23tpl.log || { diff rsyslog.out.p23native.log rsyslog.out.p23tpl.log | head; exit 1; }
+cmp rsyslog.out.jsonnative.log rsyslog.out.jsontpl.log || { diff rsyslog.out.jsonnative.log rsyslog.out.jsontpl.log | head; exit 1; }
+source $srcdir/diag.sh exit
@@ -0,0 +1,45 @@
+# Test string buffers around the inline storage size. PROCID and MSGID
+# are kept in counted strings; messages carry values of all lengths from
+# 1 to 80 (the inline buffer holds 31 characters) in RFC5424 and RFC3164
+# format and go through a disk queue, so the strings are also serialized
+# and read back. All values must arrive unmodified.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[stringbuf-lengths.sh\]: test counted strings of various lengths
+source $srcdir/diag.sh init
+# $1 is the file name, $2 is 1 for the input and 0 for the expected result
+gendata() {
+	awk -v input=$2 'BEGIN {
+		chars = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+		while(length(chars) < 300)
+			chars = chars chars
+		for(n = 0 ; n < 2000 ; ++n) {
+			pid = substr(chars, n % 10 + 1, n % 80 + 1)
+			msgid = substr(chars, n % 7 + 1, (n * 7) % 80 + 1)
+			data = substr(chars, 1, (n * 13) % 300 + 1)
+			if(input) {
+				if(n % 2 == 0)
+					printf("<13>1 2014-06-01T10:00:00Z host app %s %s - msgnum:%8.8d:%s\n",
+						pid, msgid, n, data)
+				else
+					printf("<13>Jun  1 10:00:00 host app[%s]: msgnum:%8.8d:%s\n",
+						pid, n, data)
+			} else {
+				printf("%8.8d,%s,%s,%s\n", n, pid, (n % 2 == 0) ? msgid : "-", data)
+			}
+		}
+	}' > $1
+}
+gendata rsyslog.input 1
+gendata rsyslog.out.expected.log 0
+source $srcdir/diag.sh startup stringbuf-lengths.conf
+source $srcdir/diag.sh tcpflood -I rsyslog.input
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 2000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if ! cmp rsyslog.out.expected.log rsyslog.out.log; then
+	echo "error: output differs from expected"
+	diff rsyslog.out.expected.log rsyslog.out.log | head -20
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,29 @@
+# Test message framing in imtcp and imptcp. Message bodies are copied in
+# bulk up to the next delimiter or to the end of an octet-counted frame,
+# so messages of random size (spanning multiple reads) and octet-counted
+# frames that contain LF characters must all come out unchanged.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[tcp-framing.sh\]: test LF and octet-counted framing in imtcp and imptcp
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup tcp-framing.conf
+source $srcdir/diag.sh tcpflood -p13514 -c20 -m10000 -r -d3000
+source $srcdir/diag.sh tcpflood -p13515 -c20 -m10000 -i10000 -r -d3000
+# octet-counted frames with an embedded LF, 100 to each input
+for port in 13514 13515; do
+	exec 3<>/dev/tcp/127.0.0.1/$port
+	for i in `seq 0 99`; do
+		m="<167>Mar  1 01:00:00 172.20.245.8 tag msgnum:`printf %8.8d $((20000 + (port - 13514) * 100 + i))`:10:x"$'\n'"line2"
+		printf "%d %s" ${#m} "$m" >&3
+	done
+	exec 3>&-
+done
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 20199 -E
+if [ `grep -c "^msgnum:00020[0-9]*:10:x#012line2$" rsyslog2.out.log` -ne 200 ]; then
+  echo "error: octet-counted frames not received as sent:"
+  head rsyslog2.out.log
+  exit 1
+fi
+source $srcdir/diag.sh exit
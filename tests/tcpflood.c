@@ -2,7 +2,9 @@
  * messages over them. This is used for stress-testing.
  *
  * Params
- * -t	target address (default 127.0.0.1)
+ * -t	target address (default 127.0.0.1). For UDP, this may be a comma-
+ *      separated list of addresses, messages are then spread over all of
+ *      them (and all -n ports)
  * -p	target port (default 13514)
  * -n	number of target ports (targets are in range -p..(-p+-n-1)
  *      Note -c must also be set to at LEAST the number of -n!
@@ -52,6 +54,21 @@
  * -z	private key file for TLS mode
  * -Z	cert (public key) file for TLS mode
  * -L	loglevel to use for GnuTLS troubleshooting (0-off to 10-all, 0 default)
+ * -o	send rate in messages per second (constant rate schedule). The rate is
+ *      total, it is split among the threads with -Y. Default: 0 (as fast as
+ *      possible)
+ * -g	burst size: with -o, send bursts of -g messages back-to-back, keeping
+ *      the average rate (bursty schedule). Default: 1
+ * -E	embed the send time into generated messages, as "ts=<usecs since epoch>:"
+ *      right after the msgnum field (shifts the following fields!)
+ * -A	receiver mode: do not send, but listen on -t/-p (-T udp or tcp) for
+ *      the messages rsyslog forwards and compute latency percentiles from
+ *      the embedded send times (see -E). Ends when -m messages have been
+ *      received or no data arrived for 10 seconds.
+ * -G	UDP only: gather this many messages and send them with a single
+ *      UDP_SEGMENT (GSO) send to the first target, so that a receiver with
+ *      UDP_GRO gets them as one coalesced datagram. All messages must have
+ *      the same length (no -r), at most 64 messages per send.
  *
  * Part of the testbench for rsyslog.
  *
@@ -89,7 +106,9 @@
 #include <pthread.h>
 #include <sys/resource.h>
 #include <sys/time.h>
+#include <poll.h>
 #include <errno.h>
+#include <netinet/udp.h>
 #ifdef ENABLE_GNUTLS
 #	include <gnutls/gnutls.h>
 #	if GNUTLS_VERSION_NUMBER <= 0x020b00
@@ -105,6 +124,8 @@
 
 #define MAX_EXTRADATA_LEN 100*1024
 #define MAX_SENDBUF 2 * MAX_EXTRADATA_LEN
+#define MAX_RCVLINE (MAX_EXTRADATA_LEN + 1024)
+#define RCV_IDLE_TIMEOUT 10 /* seconds without data until the receiver ends */
 
 static char *targetIP = "127.0.0.1";
 static char *msgPRI = "167";
@@ -139,6 +160,11 @@ static int numThrds = 1;	/* number of threads to use */
 static char *tlsCertFile = NULL;
 static char *tlsKeyFile = NULL;
 static int tlsLogLevel = 0;
+static long long sendRate = 0;	/* messages per second, 0 - as fast as possible */
+static int burstSize = 1;	/* with sendRate, messages sent back-to-back */
+static int bEmbedTimestamp = 0;	/* embed send time into messages? */
+static int bReceiver = 0;	/* run in receiver mode? */
+static int gsoSegs = 0;		/* UDP messages per GSO send, 0 - off */
 
 #ifdef ENABLE_GNUTLS
 static gnutls_session_t *sessArray;	/* array of TLS sessions to use */
@@ -171,7 +197,8 @@ struct runstats {
 };
 
 static int udpsock;			/* socket for sending in UDP mode */
-static struct sockaddr_in udpRcvr;	/* remote receiver in UDP mode */
+static struct sockaddr_in *udpRcvrs;	/* remote receivers in UDP mode */
+static int numUdpRcvrs = 0;
 
 static enum { TP_UDP, TP_TCP, TP_TLS } transport = TP_TCP;
 
@@ -180,25 +207,85 @@ static void initTLSSess(int);
 static int sendTLS(int i, char *buf, int lenBuf);
 static void closeTLSSess(int __attribute__((unused)) i);
 
-/* prepare send subsystem for UDP send */
+/* prepare send subsystem for UDP send. Each address given in -t
+ * (comma-separated) is combined with each of the -n ports.
+ */
 static inline int
 setupUDP(void)
 {
+	char *addrs;
+	char *addr;
+	char *save;
+	int numAddrs = 1;
+	int i;
+
 	if((udpsock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1)
 		return 1;
 
-	memset((char *) &udpRcvr, 0, sizeof(udpRcvr));
-	udpRcvr.sin_family = AF_INET;
-	udpRcvr.sin_port = htons(targetPort);
-	if(inet_aton(targetIP, &udpRcvr.sin_addr)==0) {
-		fprintf(stderr, "inet_aton() failed\n");
-		return(1);
+	for(i = 0 ; targetIP[i] ; ++i)
+		if(targetIP[i] == ',')
+			++numAddrs;
+	udpRcvrs = calloc(numAddrs * numTargetPorts, sizeof(struct sockaddr_in));
+	if(udpRcvrs == NULL || (addrs = strdup(targetIP)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for(addr = strtok_r(addrs, ",", &save) ; addr != NULL ; addr = strtok_r(NULL, ",", &save)) {
+		for(i = 0 ; i < numTargetPorts ; ++i) {
+			udpRcvrs[numUdpRcvrs].sin_family = AF_INET;
+			udpRcvrs[numUdpRcvrs].sin_port = htons(targetPort + i);
+			if(inet_aton(addr, &udpRcvrs[numUdpRcvrs].sin_addr)==0) {
+				fprintf(stderr, "inet_aton() failed for '%s'\n", addr);
+				free(addrs);
+				return(1);
+			}
+			++numUdpRcvrs;
+		}
+	}
+	free(addrs);
+	if(numUdpRcvrs == 0) {
+		fprintf(stderr, "no UDP target given\n");
+		return 1;
 	}
 
 	return 0;
 }
 
 
+/* send len bytes of equally sized messages of segLen each as one GSO
+ * send to the first UDP target.
+ */
+static int
+sendUDPGso(char *buf, int len, int segLen)
+{
+#ifdef UDP_SEGMENT
+	struct msghdr mh;
+	struct iovec iov;
+	char ctl[CMSG_SPACE(sizeof(uint16_t))];
+	struct cmsghdr *cm;
+
+	memset(&mh, 0, sizeof(mh));
+	memset(ctl, 0, sizeof(ctl));
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	mh.msg_name = &udpRcvrs[0];
+	mh.msg_namelen = sizeof(struct sockaddr_in);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = ctl;
+	mh.msg_controllen = sizeof(ctl);
+	cm = CMSG_FIRSTHDR(&mh);
+	cm->cmsg_level = SOL_UDP;
+	cm->cmsg_type = UDP_SEGMENT;
+	cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	*((uint16_t*) CMSG_DATA(cm)) = (uint16_t) segLen;
+	return (sendmsg(udpsock, &mh, 0) == len) ? 0 : 1;
+#else
+	return 1;
+#endif
+}
+
+
 /* open a single tcp connection
  */
 int openConn(int *fd)
@@ -343,8 +430,16 @@ genMsg(char *buf, size_t maxBuf, int *pLenBuf, struct instdata *inst)
 	int edLen; /* actual extra data length to use */
 	char extraData[MAX_EXTRADATA_LEN + 1];
 	char dynFileIDBuf[128] = "";
+	char tsBuf[32] = "";
+	struct timeval tv;
 	int done;
 
+	if(bEmbedTimestamp) {
+		gettimeofday(&tv, NULL);
+		snprintf(tsBuf, sizeof(tsBuf), "ts=%lld:",
+			 (long long) tv.tv_sec * 1000000 + tv.tv_usec);
+	}
+
 	if(dataFP != NULL) {
 		/* get message from file */
 		do {
@@ -367,11 +462,11 @@ genMsg(char *buf, size_t maxBuf, int *pLenBuf, struct instdata *inst)
 		if(extraDataLen == 0) {
 			if(useRFC5424Format) {
 				*pLenBuf = snprintf(buf, maxBuf, "<%s>1 2003-03-01T01:00:00.000Z mymachine.example.com tcpflood "
-						     "- tag [tcpflood@32473 MSGNUM=\"%8.8d\"] msgnum:%s%8.8d:%c",
-						       msgPRI, msgNum, dynFileIDBuf, msgNum, frameDelim);
+						     "- tag [tcpflood@32473 MSGNUM=\"%8.8d\"] msgnum:%s%8.8d:%s%c",
+						       msgPRI, msgNum, dynFileIDBuf, msgNum, tsBuf, frameDelim);
 			} else {
-				*pLenBuf = snprintf(buf, maxBuf, "<%s>Mar  1 01:00:00 172.20.245.8 tag msgnum:%s%8.8d:%c",
-						       msgPRI, dynFileIDBuf, msgNum, frameDelim);
+				*pLenBuf = snprintf(buf, maxBuf, "<%s>Mar  1 01:00:00 172.20.245.8 tag msgnum:%s%8.8d:%s%c",
+						       msgPRI, dynFileIDBuf, msgNum, tsBuf, frameDelim);
 			}
 		} else {
 			if(bRandomizeExtraData)
@@ -382,22 +477,51 @@ genMsg(char *buf, size_t maxBuf, int *pLenBuf, struct instdata *inst)
 			extraData[edLen] = '\0';
 			if(useRFC5424Format) {
 				*pLenBuf = snprintf(buf, maxBuf, "<%s>1 2003-03-01T01:00:00.000Z mymachine.example.com tcpflood "
-						     "- tag [tcpflood@32473 MSGNUM=\"%8.8d\"] msgnum:%s%8.8d:%c",
-						       msgPRI, msgNum, dynFileIDBuf, msgNum, frameDelim);
+						     "- tag [tcpflood@32473 MSGNUM=\"%8.8d\"] msgnum:%s%8.8d:%s%c",
+						       msgPRI, msgNum, dynFileIDBuf, msgNum, tsBuf, frameDelim);
 			} else {
-				*pLenBuf = snprintf(buf, maxBuf, "<%s>Mar  1 01:00:00 172.20.245.8 tag msgnum:%s%8.8d:%d:%s%c",
-						       msgPRI, dynFileIDBuf, msgNum, edLen, extraData, frameDelim);
+				*pLenBuf = snprintf(buf, maxBuf, "<%s>Mar  1 01:00:00 172.20.245.8 tag msgnum:%s%8.8d:%s%d:%s%c",
+						       msgPRI, dynFileIDBuf, msgNum, tsBuf, edLen, extraData, frameDelim);
 			}
 		}
 	} else {
 		/* use fixed message format from command line */
-		*pLenBuf = snprintf(buf, maxBuf, "%s\n", MsgToSend);
+		*pLenBuf = snprintf(buf, maxBuf, "%s%s%s\n", MsgToSend,
+				    (tsBuf[0] == '\0') ? "" : " ", tsBuf);
 	}
 	++inst->numSent;
 
 finalize_it: /*EMPTY to keep the compiler happy */;
 }
 
+
+/* get the current wallclock time in microseconds */
+static inline long long
+timeUs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+/* wait until message i is due according to the send schedule (-o, -g).
+ * We compute due times from the start time instead of sleeping a fixed
+ * time per message, so that the time needed for sending does not add up.
+ */
+static inline void
+waitSchedule(long long tStart, unsigned long long i, long long rate)
+{
+	long long tDue;
+	long long tNow;
+
+	tDue = tStart + (long long) ((i / burstSize) * burstSize * 1000000ull / rate);
+	tNow = timeUs();
+	if(tDue > tNow)
+		usleep(tDue - tNow);
+}
+
 /* send messages to the tcp connections we keep open. We use
  * a very basic format that helps identify the message
  * (via msgnum:<number>: e.g. msgnum:00000001:). This format is suitable
@@ -416,7 +540,17 @@ int sendMessages(struct instdata *inst)
 	char buf[MAX_EXTRADATA_LEN + 1024];
 	char sendBuf[MAX_SENDBUF];
 	int offsSendBuf = 0;
-
+	int nInGso = 0;
+	int lenGsoSeg = 0;
+	long long rate = 0;
+	long long tStart = 0;
+
+	if(sendRate > 0) {
+		rate = sendRate / numThrds;
+		if(rate == 0)
+			rate = 1;
+		tStart = timeUs();
+	}
 	if(!bSilent) {
 		if(dataFile == NULL) {
 			printf("Sending %llu messages.\n", inst->numMsgs);
@@ -442,6 +576,8 @@ int sendMessages(struct instdata *inst)
 				socknum = rnd % numConnections;
 			}
 		}
+		if(rate > 0 && i % burstSize == 0)
+			waitSchedule(tStart, i, rate);
 		genMsg(buf, sizeof(buf), &lenBuf, inst); /* generate the message to send according to params */
 		if(lenBuf == 0)
 			break;	/* terminate when no message could be generated */
@@ -454,8 +590,21 @@ int sendMessages(struct instdata *inst)
 				}
 			}
 			lenSend = send(sockArray[socknum], buf, lenBuf, 0);
+		} else if(transport == TP_UDP && gsoSegs > 0) {
+			/* gather the messages, they go out as one GSO send */
+			memcpy(sendBuf+offsSendBuf, buf, lenBuf);
+			offsSendBuf += lenBuf;
+			lenGsoSeg = lenBuf;
+			lenSend = lenBuf; /* simulate "good" call */
+			if(++nInGso == gsoSegs) {
+				if(sendUDPGso(sendBuf, offsSendBuf, lenBuf) != 0)
+					lenSend = -1;
+				offsSendBuf = 0;
+				nInGso = 0;
+			}
 		} else if(transport == TP_UDP) {
-			lenSend = sendto(udpsock, buf, lenBuf, 0, &udpRcvr, sizeof(udpRcvr));
+			lenSend = sendto(udpsock, buf, lenBuf, 0,
+					 (struct sockaddr*) &udpRcvrs[i % numUdpRcvrs], sizeof(struct sockaddr_in));
 		} else if(transport == TP_TLS) {
 			if(offsSendBuf + lenBuf < MAX_SENDBUF) {
 				memcpy(sendBuf+offsSendBuf, buf, lenBuf);
@@ -501,6 +650,10 @@ int sendMessages(struct instdata *inst)
 		/* send remaining buffer */
 		lenSend = sendTLS(socknum, sendBuf, offsSendBuf);
 	}
+	if(nInGso != 0 && sendUDPGso(sendBuf, offsSendBuf, lenGsoSeg) != 0) {
+		perror("send test data");
+		return(1);
+	}
 	if(!bSilent)
 		printf("\r%8.8d %s sent\n", i, statusText);
 
@@ -705,6 +858,239 @@ runTests(void)
 	return 0;
 }
 
+/* ---------- receiver mode (-A) ---------- */
+
+/* latencies (in us) of the messages received so far */
+static long long *latencies = NULL;
+static long long numLatencies = 0;
+static long long maxLatencies = 0;
+static long long numRcvd = 0;	/* messages received, with and without timestamp */
+
+/* process a single received message: if it contains an embedded send time,
+ * record its latency.
+ */
+static void
+rcvMsg(char *msg, long long tNow)
+{
+	char *ts;
+	long long *newArr;
+
+	++numRcvd;
+	if((ts = strstr(msg, "ts=")) == NULL)
+		return;
+	if(numLatencies == maxLatencies) {
+		maxLatencies = (maxLatencies == 0) ? 65536 : 2 * maxLatencies;
+		if((newArr = realloc(latencies, maxLatencies * sizeof(long long))) == NULL) {
+			fprintf(stderr, "out of memory, latency not recorded\n");
+			maxLatencies = numLatencies;
+			return;
+		}
+		latencies = newArr;
+	}
+	latencies[numLatencies] = tNow - atoll(ts + 3);
+	if(latencies[numLatencies] < 0)
+		latencies[numLatencies] = 0;
+	++numLatencies;
+}
+
+/* process a chunk of received data. Messages are LF-delimited. A partial
+ * message is kept in buf (which has room for MAX_RCVLINE) for the next call.
+ * Returns the new number of bytes in buf.
+ */
+static int
+rcvData(char *buf, int lenBuf, long long tNow)
+{
+	char *msg = buf;
+	char *eol;
+
+	while((eol = memchr(msg, '\n', lenBuf - (msg - buf))) != NULL) {
+		*eol = '\0';
+		rcvMsg(msg, tNow);
+		msg = eol + 1;
+	}
+	lenBuf -= msg - buf;
+	if(lenBuf == MAX_RCVLINE) { /* oversize message, process what we have */
+		buf[lenBuf - 1] = '\0';
+		rcvMsg(buf, tNow);
+		return 0;
+	}
+	memmove(buf, msg, lenBuf);
+	return lenBuf;
+}
+
+static int
+cmpLatency(const void *a, const void *b)
+{
+	const long long la = *(const long long*) a;
+	const long long lb = *(const long long*) b;
+	return (la < lb) ? -1 : (la > lb);
+}
+
+/* print the latency percentiles (in ms) */
+static void
+genLatencyStats(void)
+{
+	static const double pct[] = { 50.0, 90.0, 99.0, 99.9 };
+	static const char *pctName[] = { "p50:", "p90:", "p99:", "p99.9:" };
+	long long sum = 0;
+	long long idx;
+	long long i;
+	unsigned j;
+
+	if(numLatencies == 0) {
+		printf("received %lld messages, none with embedded send time (-E)\n", numRcvd);
+		return;
+	}
+	qsort(latencies, numLatencies, sizeof(long long), cmpLatency);
+	for(i = 0 ; i < numLatencies ; ++i)
+		sum += latencies[i];
+	if(bCSVoutput) {
+		printf("#numRcvd,numLatencies,min,avg,p50,p90,p99,p99.9,max\n");
+		printf("%lld,%lld,%.3f,%.3f", numRcvd, numLatencies, latencies[0] / 1000.0,
+		       (double) sum / numLatencies / 1000.0);
+	} else {
+		printf("Received: %lld messages, %lld with send time\n", numRcvd, numLatencies);
+		printf("Latency (ms):\n");
+		printf("  min:    %.3f\n", latencies[0] / 1000.0);
+		printf("  avg:    %.3f\n", (double) sum / numLatencies / 1000.0);
+	}
+	for(j = 0 ; j < sizeof(pct) / sizeof(pct[0]) ; ++j) {
+		idx = (long long) (numLatencies * pct[j] / 100.0 + 0.999999) - 1;
+		if(idx < 0)
+			idx = 0;
+		if(bCSVoutput)
+			printf(",%.3f", latencies[idx] / 1000.0);
+		else
+			printf("  %-8s%.3f\n", pctName[j], latencies[idx] / 1000.0);
+	}
+	if(bCSVoutput)
+		printf(",%.3f\n", latencies[numLatencies - 1] / 1000.0);
+	else
+		printf("  max:    %.3f\n", latencies[numLatencies - 1] / 1000.0);
+	printf("Latency is receive time minus send time, both wallclock.\n");
+}
+
+/* run as receiver: listen on -t/-p for the messages rsyslog forwards to us
+ * and compute their latency. We handle all connections (or the UDP
+ * socket) in a single poll() loop.
+ */
+static int
+runReceiver(void)
+{
+	struct sockaddr_in addr;
+	struct pollfd *fds;
+	char **bufs;
+	int *lenBufs;
+	int numFds = 1;
+	int maxFds;
+	int sock;
+	int on = 1;
+	int i;
+	int r;
+	long long tNow;
+	long long tLastData;
+
+	maxFds = numConnections + 1;
+	fds = calloc(maxFds, sizeof(struct pollfd));
+	bufs = calloc(maxFds, sizeof(char*));
+	lenBufs = calloc(maxFds, sizeof(int));
+	if(fds == NULL || bufs == NULL || lenBufs == NULL || (bufs[0] = malloc(MAX_RCVLINE)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	if((sock = socket(AF_INET, (transport == TP_UDP) ? SOCK_DGRAM : SOCK_STREAM, 0)) == -1) {
+		perror("socket()");
+		return 1;
+	}
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset((char *) &addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(targetPort);
+	if(inet_aton(targetIP, &addr.sin_addr)==0) {
+		fprintf(stderr, "inet_aton() failed\n");
+		return 1;
+	}
+	if(bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		perror("bind()");
+		return 1;
+	}
+	if(transport == TP_TCP && listen(sock, 20) != 0) {
+		perror("listen()");
+		return 1;
+	}
+	fds[0].fd = sock;
+	fds[0].events = POLLIN;
+	if(!bSilent)
+		printf("receiving on %s:%d\n", targetIP, targetPort);
+
+	tLastData = timeUs();
+	while(numMsgsToSend == 0 || numRcvd < numMsgsToSend) {
+		r = poll(fds, numFds, 1000);
+		tNow = timeUs();
+		if(r <= 0) {
+			if(r < 0 && errno != EINTR) {
+				perror("poll()");
+				return 1;
+			}
+			if(tNow - tLastData > RCV_IDLE_TIMEOUT * 1000000ll)
+				break;
+			continue;
+		}
+		tLastData = tNow;
+		if(transport == TP_UDP) {
+			r = recv(sock, bufs[0], MAX_RCVLINE - 1, 0);
+			if(r > 0) {
+				if(bufs[0][r - 1] == '\n')
+					--r;
+				bufs[0][r] = '\0';
+				rcvMsg(bufs[0], tNow);
+			}
+			continue;
+		}
+		if(fds[0].revents & POLLIN) {
+			if((r = accept(sock, NULL, NULL)) != -1) {
+				if(numFds == maxFds || (bufs[numFds] = malloc(MAX_RCVLINE)) == NULL) {
+					fprintf(stderr, "too many connections (see -c), closing new one\n");
+					close(r);
+				} else {
+					fds[numFds].fd = r;
+					fds[numFds].events = POLLIN;
+					lenBufs[numFds] = 0;
+					++numFds;
+				}
+			}
+		}
+		for(i = 1 ; i < numFds ; ++i) {
+			if(!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			r = recv(fds[i].fd, bufs[i] + lenBufs[i], MAX_RCVLINE - lenBufs[i], 0);
+			if(r > 0) {
+				lenBufs[i] = rcvData(bufs[i], lenBufs[i] + r, tNow);
+			} else if(r == 0 || errno != EINTR) {
+				close(fds[i].fd);
+				free(bufs[i]);
+				--numFds;
+				fds[i] = fds[numFds];
+				bufs[i] = bufs[numFds];
+				lenBufs[i] = lenBufs[numFds];
+				--i;
+			}
+		}
+	}
+
+	for(i = 0 ; i < numFds ; ++i) {
+		close(fds[i].fd);
+		free(bufs[i]);
+	}
+	free(fds);
+	free(bufs);
+	free(lenBufs);
+	genLatencyStats();
+	free(latencies);
+	return 0;
+}
+
 #	if defined(ENABLE_GNUTLS)
 /* This defines a log function to be provided to GnuTLS. It hopefully
  * helps us track down hard to find problems.
@@ -844,8 +1230,30 @@ int main(int argc, char *argv[])
 
 	setvbuf(stdout, buf, _IONBF, 48);
 	
-	while((opt = getopt(argc, argv, "b:ef:F:t:p:c:C:m:i:I:P:d:Dn:L:M:rsBR:S:T:XW:yYz:Z:")) != -1) {
+	while((opt = getopt(argc, argv, "Ab:eEf:F:g:G:t:p:c:C:m:i:I:o:P:d:Dn:L:M:rsBR:S:T:XW:yYz:Z:")) != -1) {
 		switch (opt) {
+		case 'A':	bReceiver = 1;
+				break;
+		case 'E':	bEmbedTimestamp = 1;
+				break;
+		case 'g':	burstSize = atoi(optarg);
+				if(burstSize < 1) {
+					fprintf(stderr, "-g must be at least 1!\n");
+					exit(1);
+				}
+				break;
+		case 'G':	gsoSegs = atoi(optarg);
+#				ifndef UDP_SEGMENT
+					fprintf(stderr, "UDP_SEGMENT not available: -G not supported!\n");
+					exit(1);
+#				endif
+				if(gsoSegs < 1 || gsoSegs > 64) {
+					fprintf(stderr, "-G must be in the range 1..64!\n");
+					exit(1);
+				}
+				break;
+		case 'o':	sendRate = atoll(optarg);
+				break;
 		case 'b':	batchsize = atoll(optarg);
 				break;
 		case 't':	targetIP = optarg;
@@ -942,6 +1350,14 @@ int main(int argc, char *argv[])
 	if(!isatty(1) || bSilent)
 		bShowProgress = 0;
 
+	if(bReceiver) {
+		if(transport == TP_TLS) {
+			fprintf(stderr, "receiver mode (-A) does not support TLS\n");
+			exit(1);
+		}
+		exit(runReceiver());
+	}
+
 	if(numConnections > 20) {
 		/* if we use many (whatever this means, 20 is randomly picked)
 		 * connections, we need to make sure we have a high enough
@@ -0,0 +1,37 @@
+# Test reception timestamps with the coarse clock and the cached local
+# time conversion. rsyslog runs in a timezone with a half hour offset.
+# The local time of every message must match what libc computes for its
+# unix timestamp, and it must be close to the current time.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[timestamp-coarseclock.sh\]: test coarse clock and cached local time
+source $srcdir/diag.sh init
+export TZ=RST-05:30
+tstart=$(date +%s)
+source $srcdir/diag.sh startup timestamp-coarseclock.conf
+source $srcdir/diag.sh tcpflood -m2000
+./msleep 1100 # make sure we cross at least one second boundary
+source $srcdir/diag.sh tcpflood -m2000 -i2000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+tend=$(date +%s)
+# drop the fractional seconds, they are not needed for the comparison
+sed -i 's/\.[0-9]*//' rsyslog.out.log
+if [ "$(cat rsyslog.out.log | wc -l)" -ne 4000 ]; then
+	echo "error: expected 4000 messages"
+	exit 1
+fi
+cut -d' ' -f2 rsyslog.out.log | sort -u | while read ts; do
+	if [ "$ts" -lt "$tstart" ] || [ "$ts" -gt "$tend" ]; then
+		echo "error: timestamp $ts not within test run ($tstart..$tend)"
+		exit 1
+	fi
+	expected=$(date -d @$ts +%Y-%m-%dT%H:%M:%S)+05:30
+	if grep " $ts " rsyslog.out.log | grep -v " $ts $expected$" | grep -q .; then
+		echo "error: wrong local time for $ts, expected $expected:"
+		grep " $ts " rsyslog.out.log | grep -v " $ts $expected$" | head -3
+		exit 1
+	fi
+done || exit 1
+unset TZ
+source $srcdir/diag.sh exit
@@ -0,0 +1,68 @@
+# Test the compiled form of templates: merged constants, templates with
+# more properties than are fetched at once, all escape modes and the
+# handling of a failed output buffer extension. The latter is caused by
+# a realloc() that fails for 1MB or more (see override_realloc.c), which
+# one oversized message needs for the "big" template. That message must
+# be left out of its output, and all other messages must be unaffected.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[tpl_compiled.sh\]: test compiled templates
+source $srcdir/diag.sh init
+awk 'BEGIN {
+	for(i = 0 ; i < 2000 ; ++i) {
+		if(i == 1000) {
+			printf("<167>Mar  1 01:00:00 172.20.245.8 tag msgnum:%8.8d::", i)
+			for(j = 0 ; j < 30000 ; ++j)
+				printf("x")
+			printf("\n")
+		} else {
+			printf("<167>Mar  1 01:00:00 172.20.245.8 tag msgnum:%8.8d:it%cs \"q\" a\\b:\n", i, 39)
+		}
+	}
+}' > rsyslog.input
+export RSYSLOG_TEST_REALLOC_FAIL=1048576
+export LD_PRELOAD=.libs/liboverride_realloc.so
+source $srcdir/diag.sh startup tpl_compiled.conf
+unset LD_PRELOAD RSYSLOG_TEST_REALLOC_FAIL
+source $srcdir/diag.sh tcpflood -I rsyslog.input
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+
+# merged constants
+awk '{ n = substr($0, 4, 8)
+	if($0 != "m=[" n "]<" n "|" n ">") {
+		print "error: wrong output of merged constants: " $0
+		exit 1
+	} }' rsyslog.out.merged.log || exit 1
+# 40 properties, more than are fetched at once
+awk -F, '{ for(i = 2 ; i <= 40 ; ++i) if($i != $1) break
+	if(NF != 40 || i != 41) {
+		print "error: wrong output of the 40 property template: " $0
+		exit 1
+	} }' rsyslog.out.many.log || exit 1
+cut -d, -f1 rsyslog.out.many.log > rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 1999
+# escape modes
+cat > rsyslog.out.expected.log <<'EOF'
+1999 json "it's \"q\" a\b"
+1999 none "it's "q" a\b"
+1999 sql "it\'s "q" a\\b"
+1999 stdsql "it''s "q" a\b"
+EOF
+awk '{ c[$0]++ } END { for(l in c) print c[l] " " l }' rsyslog.out.escape.log | \
+	sort -k2 > rsyslog.out.counted.log
+if ! cmp rsyslog.out.expected.log rsyslog.out.counted.log; then
+	echo "error: wrong output of the escape modes"
+	diff rsyslog.out.expected.log rsyslog.out.counted.log
+	exit 1
+fi
+# failed buffer extension, the oversized message must be missing
+awk -F'|' '{ for(i = 2 ; i <= 40 ; ++i) if($i != $1) break
+	if(NF != 40 || i != 41) {
+		print "error: wrong output of the big template: " substr($0, 1, 100)
+		exit 1
+	} }' rsyslog.out.big.log || exit 1
+cut -d: -f2 rsyslog.out.big.log > rsyslog.out.log
+echo 00001000 >> rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 1999
+source $srcdir/diag.sh exit
@@ -0,0 +1,18 @@
+# Check that a template shared by multiple actions is rendered again
+# after the message has been modified.
+# This file is part of the rsyslog project, released under ASL 2.0
+echo ===============================================================================
+echo \[tpl_shared_cache.sh\]: testing template shared by multiple actions
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup tpl_shared_cache.conf
+source $srcdir/diag.sh injectmsg  0 1000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+if [ `grep -c ',a$' rsyslog.out.log` -ne 2000 ] || [ `grep -c ',b$' rsyslog.out.log` -ne 1000 ]; then
+	echo "unexpected rendering of shared template:"
+	sort rsyslog.out.log | uniq -c | sort -n | head
+	exit 1
+fi
+grep ',b$' rsyslog.out.log | cut -d, -f1 > rsyslog.out.tmp && mv rsyslog.out.tmp rsyslog.out.log
+source $srcdir/diag.sh seq-check  0 999
+source $srcdir/diag.sh exit
@@ -0,0 +1,67 @@
+# Test the binary trace ring. Queue and network events are recorded with
+# a small ring per thread; on SIGUSR2 all rings must be dumped to the
+# trace file, merged in time order and limited to the ring size. Also
+# checks that invalid categories are rejected.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[trace-ring.sh\]: test trace ring dump on SIGUSR2
+source $srcdir/diag.sh init
+source $srcdir/diag.sh config-check trace-ring-invalid.conf 0
+source $srcdir/diag.sh check-errmsg "invalid trace.categories 'queue,bogus'"
+source $srcdir/diag.sh startup trace-ring.conf
+source $srcdir/diag.sh tcpflood -m5000 -c5
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 5000
+./msleep 500 # let tcpflood's sessions be closed
+kill -USR2 `cat rsyslog.pid`
+i=0
+while ! grep -q '^end of trace dump$' rsyslog.out.trace.log 2>/dev/null; do
+	./msleep 100
+	let "i++"
+	if [ $i -gt 100 ]; then
+		echo "error: trace dump not written"
+		exit 1
+	fi
+done
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 4999
+
+if [ "$(head -n1 rsyslog.out.trace.log)" != \
+     "rsyslogd trace dump, times in seconds relative to dump" ]; then
+	echo "error: trace dump header missing"
+	exit 1
+fi
+n=$(grep -cE ' net +tcpsrv 0x[0-9a-f]+: session 0x[0-9a-f]+ accepted$' rsyslog.out.trace.log)
+if [ "$n" -ne 5 ]; then
+	echo "error: $n session accepts traced, expected 5"
+	cat rsyslog.out.trace.log
+	exit 1
+fi
+n=$(grep -cE ' net +tcpsrv 0x[0-9a-f]+: closing session 0x[0-9a-f]+$' rsyslog.out.trace.log)
+if [ "$n" -ne 5 ]; then
+	echo "error: $n session closes traced, expected 5"
+	cat rsyslog.out.trace.log
+	exit 1
+fi
+if ! grep -qE ' queue +queue 0x[0-9a-f]+: dequeued [0-9]+, discarded 0, [0-9]+ remaining$' \
+	rsyslog.out.trace.log; then
+	echo "error: no dequeue traced"
+	cat rsyslog.out.trace.log
+	exit 1
+fi
+if grep -q ' action ' rsyslog.out.trace.log; then
+	echo "error: action category traced although not enabled"
+	exit 1
+fi
+# records are merged by time (all are in the past) and no thread may
+# have more than trace.records of them
+awk '/^-/ {	t = substr($1, 2) + 0
+		if(NR > 2 && t > prev) { print "error: out of order: " $0; err = 1 }
+		prev = t
+		if(++cnt[$2] > 64) { print "error: ring of " $2 " exceeds 64 records"; err = 1 }
+	}
+	END { exit err }' rsyslog.out.trace.log
+if [ $? -ne 0 ]; then
+	exit 1
+fi
+source $srcdir/diag.sh exit
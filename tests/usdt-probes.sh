@@ -0,0 +1,38 @@
+# Test the USDT static tracepoints. The binaries must carry the probes of
+# the "rsyslog" provider in their stapsdt notes, and a build with probes
+# must process messages as usual.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[usdt-probes.sh\]: test USDT static tracepoints
+if ! hash readelf 2>/dev/null; then
+	echo "readelf not available, skipping test"
+	exit 77
+fi
+# $1 is the (possibly libtool wrapped) binary, the remaining args are probe names
+check_probes() {
+	f=$1
+	shift
+	if [ -f $(dirname $f)/.libs/$(basename $f) ]; then
+		f=$(dirname $f)/.libs/$(basename $f)
+	fi
+	readelf -n $f | awk '/Provider:/ { prov = $2 } /Name:/ && prov == "rsyslog" { print $2 }' \
+		> rsyslog.out.probes.log
+	for probe in "$@"; do
+		if ! grep -qx $probe rsyslog.out.probes.log; then
+			echo "error: probe rsyslog:$probe missing in $f"
+			cat rsyslog.out.probes.log
+			exit 1
+		fi
+	done
+}
+check_probes ../tools/rsyslogd queue_enq queue_deq action_commit action_suspend action_resume
+check_probes ../.libs/lmtcpsrv.so tcp_accept tcp_close
+check_probes ../plugins/imudp/.libs/imudp.so udp_batch
+
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup usdt-probes.conf
+source $srcdir/diag.sh tcpflood -m10000 -c4
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
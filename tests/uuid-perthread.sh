@@ -0,0 +1,27 @@
+# Test $uuid generation with concurrent workers. Eight main queue
+# workers create UUIDs at the same time; each must be a well-formed
+# version 4 UUID, stable within a message and unique across messages.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[uuid-perthread.sh\]: test concurrent uuid generation
+source $srcdir/diag.sh init
+source $srcdir/diag.sh startup uuid-perthread.conf
+source $srcdir/diag.sh tcpflood -m20000 -c4
+source $srcdir/diag.sh wait-file-lines rsyslog.out.log 20000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+sort -n rsyslog.out.log > rsyslog.out.sorted.log
+mv rsyslog.out.sorted.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 19999
+n=$(grep -cE '^[0-9]{8} ([0-9A-F]{12}4[0-9A-F]{3}[89AB][0-9A-F]{15}) \1$' rsyslog.out.log)
+if [ "$n" -ne 20000 ]; then
+	echo "error: only $n of 20000 lines have a valid, stable UUID"
+	grep -vE '^[0-9]{8} ([0-9A-F]{12}4[0-9A-F]{3}[89AB][0-9A-F]{15}) \1$' rsyslog.out.log | head
+	exit 1
+fi
+n=$(cut -d' ' -f2 rsyslog.out.log | sort -u | wc -l)
+if [ "$n" -ne 20000 ]; then
+	echo "error: only $n of 20000 UUIDs are unique"
+	exit 1
+fi
+source $srcdir/diag.sh exit
@@ -0,0 +1,31 @@
+# Test omuxsock with multiple destination sockets. Messages are sent in
+# batches round-robin to two receivers, plus a third socket nobody
+# listens on; messages for it must be retried on the next destination.
+# All messages must arrive, spread over both live receivers.
+# This file is part of the rsyslog project, released  under GPLv3
+echo ===============================================================================
+echo \[uxsock_roundrobin.sh\]: test omuxsock round-robin over multiple sockets
+source $srcdir/diag.sh init
+./uxsockrcvr -srsyslog-testbench-dgram-uxsock -orsyslog.out.log &
+BGPROCESS=$!
+./uxsockrcvr -srsyslog-testbench-dgram-uxsock2 -orsyslog2.out.log &
+BGPROCESS2=$!
+source $srcdir/diag.sh startup uxsock_roundrobin.conf
+source $srcdir/diag.sh injectmsg 0 10000
+source $srcdir/diag.sh shutdown-when-empty
+source $srcdir/diag.sh wait-shutdown
+./msleep 500 # let the receivers pick up the last datagrams
+kill $BGPROCESS $BGPROCESS2
+wait $BGPROCESS $BGPROCESS2
+rm -f rsyslog-testbench-dgram-uxsock2 rsyslog-testbench-dgram-uxsock3
+for f in rsyslog.out.log rsyslog2.out.log; do
+	if [ `wc -l < $f` -lt 2500 ]; then
+		echo "error: messages were not spread over the receivers, $f has only `wc -l < $f`"
+		exit 1
+	fi
+done
+cat rsyslog2.out.log >> rsyslog.out.log
+sort -n rsyslog.out.log > rsyslog.out.sorted.log
+mv rsyslog.out.sorted.log rsyslog.out.log
+source $srcdir/diag.sh seq-check 0 9999
+source $srcdir/diag.sh exit
@@ -6,7 +6,7 @@
  * 
  * File begun on 2007-08-03 by RGerhards
  *
- * Copyright 2007 Rainer Gerhards and Adiscon GmbH.
+ * Copyright 2007-2014 Rainer Gerhards and Adiscon GmbH.
  *
  * This file is part of rsyslog.
  *
@@ -31,111 +31,264 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include "syslogd.h"
-#include "linkedlist.h"
+#include "atomic.h"
 #include "iminternal.h"
 
-static linkedList_t llMsgs;
-
-
-/* destructs an iminternal object
+/* Internal messages are stored in a bounded ring. Any thread may add
+ * messages (often while it is itself in trouble, e.g. an action in a
+ * retry loop), but only the main thread removes them. With atomic
+ * builtins, the ring is lock-free (a sequence number per slot tells
+ * producers and the consumer who owns it); otherwise a mutex guards it.
+ * Before messages are queued, we apply our own rate limit and collapse
+ * identical consecutive messages into a single "repeated" notice. So an
+ * error storm can neither grow memory without bound nor flood the
+ * message pipeline. -- rgerhards, 2014-07-08
  */
-static rsRetVal iminternalDestruct(iminternal_t *pThis)
+#define IMINTERNAL_QUEUE_SIZE 4096		/* must be a power of 2 */
+#define IMINTERNAL_RATELIMIT_INTERVAL 5		/* seconds */
+#define IMINTERNAL_RATELIMIT_BURST 1000
+
+static iminternal_t ring[IMINTERNAL_QUEUE_SIZE];
+static unsigned enqPos;		/* next slot to be filled by producers */
+static unsigned deqPos;		/* next slot to be emptied, consumer only */
+static int nLost = 0;		/* msgs dropped due to rate limit or full ring */
+static int nRepeats = 0;	/* repeats of the last msg not yet reported */
+static int lastHash = 0;	/* hash of the last msg that was accepted */
+static time_t tRateBegin = 0;
+static int nRateMsgs = 0;
+static int bWakeupPending = 0;
+static int fdWakeup[2] = { -1, -1 };	/* pipe, read side is watched by main thread */
+#ifdef HAVE_ATOMIC_BUILTINS
+#	define IMINTERNAL_LOCK()
+#	define IMINTERNAL_UNLOCK()
+#else
+static pthread_mutex_t mutRing = PTHREAD_MUTEX_INITIALIZER;
+#	define IMINTERNAL_LOCK() pthread_mutex_lock(&mutRing)
+#	define IMINTERNAL_UNLOCK() pthread_mutex_unlock(&mutRing)
+#endif
+DEF_ATOMIC_HELPER_MUT(mutLost);
+DEF_ATOMIC_HELPER_MUT(mutRepeats);
+DEF_ATOMIC_HELPER_MUT(mutRate);
+DEF_ATOMIC_HELPER_MUT(mutWakeup);
+
+
+/* put a message into the ring. Returns RS_RET_QUEUE_FULL if there is no
+ * free slot (we never wait, the caller drops the message in that case).
+ */
+static rsRetVal
+ringPut(msg_t *pMsg)
 {
+	iminternal_t *pSlot;
+	unsigned pos;
+	int diff;
 	DEFiRet;
 
-	assert(pThis != NULL);
-
-	if(pThis->pMsg != NULL)
-		msgDestruct(&pThis->pMsg);
-
-	free(pThis);
+	IMINTERNAL_LOCK();
+#ifdef HAVE_ATOMIC_BUILTINS
+	pos = enqPos;
+	while(1) {
+		pSlot = &ring[pos & (IMINTERNAL_QUEUE_SIZE - 1)];
+		diff = (int) (pSlot->seq - pos);
+		if(diff == 0) {
+			if(__sync_bool_compare_and_swap(&enqPos, pos, pos + 1))
+				break;
+			pos = enqPos;
+		} else if(diff < 0) {
+			ABORT_FINALIZE(RS_RET_QUEUE_FULL);
+		} else {
+			pos = enqPos; /* someone else got that slot */
+		}
+		ATOMIC_MEMORY_BARRIER();
+	}
+	pSlot->pMsg = pMsg;
+	ATOMIC_MEMORY_BARRIER(); /* msg must be visible before the slot is published */
+	pSlot->seq = pos + 1;
+#else
+	pos = enqPos;
+	pSlot = &ring[pos & (IMINTERNAL_QUEUE_SIZE - 1)];
+	diff = (int) (pSlot->seq - pos);
+	if(diff != 0)
+		ABORT_FINALIZE(RS_RET_QUEUE_FULL);
+	enqPos = pos + 1;
+	pSlot->pMsg = pMsg;
+	pSlot->seq = pos + 1;
+#endif
 
+finalize_it:
+	IMINTERNAL_UNLOCK();
 	RETiRet;
 }
 
 
-/* Construct an iminternal object
+/* remove a message from the ring, must only be called by the
+ * (single) consumer. Returns RS_RET_NO_MORE_DATA if the ring is empty.
  */
-static rsRetVal iminternalConstruct(iminternal_t **ppThis)
+static rsRetVal
+ringGet(msg_t **ppMsg)
 {
+	iminternal_t *pSlot;
 	DEFiRet;
-	iminternal_t *pThis;
 
-	assert(ppThis != NULL);
-
-	if((pThis = (iminternal_t*) calloc(1, sizeof(iminternal_t))) == NULL) {
-		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
-	}
+	IMINTERNAL_LOCK();
+	pSlot = &ring[deqPos & (IMINTERNAL_QUEUE_SIZE - 1)];
+#ifdef HAVE_ATOMIC_BUILTINS
+	ATOMIC_MEMORY_BARRIER();
+#endif
+	if(pSlot->seq != deqPos + 1)
+		ABORT_FINALIZE(RS_RET_NO_MORE_DATA);
+	*ppMsg = pSlot->pMsg;
+	pSlot->pMsg = NULL;
+#ifdef HAVE_ATOMIC_BUILTINS
+	ATOMIC_MEMORY_BARRIER(); /* slot must be empty before producers may reuse it */
+#endif
+	pSlot->seq = deqPos + IMINTERNAL_QUEUE_SIZE;
+	++deqPos;
 
 finalize_it:
-	if(iRet != RS_RET_OK) {
-		if(pThis != NULL)
-			iminternalDestruct(pThis);
+	IMINTERNAL_UNLOCK();
+	RETiRet;
+}
+
+
+/* our own rate limiter. We do not use ratelimit.c, as its state is
+ * not thread-safe and producers come from all threads. Returns 1
+ * if the message may be processed.
+ */
+static int
+withinRateLimit(void)
+{
+	time_t tNow;
+	time_t tBegin;
+
+	tNow = time(NULL);
+	tBegin = tRateBegin;
+	if(tNow - tBegin >= IMINTERNAL_RATELIMIT_INTERVAL || tNow < tBegin) {
+		if(ATOMIC_CAS_time_t(&tRateBegin, tBegin, tNow, &mutRate))
+			ATOMIC_STORE_0_TO_INT(&nRateMsgs, &mutRate);
 	}
+	return ATOMIC_ADD_AND_FETCH_int(&nRateMsgs, 1, &mutRate) <= IMINTERNAL_RATELIMIT_BURST;
+}
 
-	*ppThis = pThis;
 
-	RETiRet;
+/* compute the hash used to detect repeated messages. Severity and tag
+ * (which contains the error code) are part of it.
+ */
+static int
+msgHash(msg_t *pMsg)
+{
+	uchar *pszTag;
+	int lenTag;
+	unsigned h = 2166136261u;
+	int i;
+
+	getTAG(pMsg, &pszTag, &lenTag);
+	for(i = 0 ; i < lenTag ; ++i)
+		h = (h ^ pszTag[i]) * 16777619u;
+	for(i = 0 ; i < pMsg->iLenRawMsg ; ++i)
+		h = (h ^ pMsg->pszRawMsg[i]) * 16777619u;
+	h = (h ^ pMsg->iSeverity) * 16777619u;
+	return (int) (h & 0x7fffffff);
 }
 
 
-/* add a message to the linked list
+/* queue a notice (like "last message repeated n times"), based on a
+ * message that we already have. Failure is silently ignored.
+ */
+static void
+addNotice(msg_t *pTemplate, const char *fmt, int n)
+{
+	msg_t *pMsg;
+	char buf[128];
+	int len;
+
+	if((pMsg = MsgDup(pTemplate)) == NULL)
+		return;
+	len = snprintf(buf, sizeof(buf), fmt, n);
+	MsgSetRawMsg(pMsg, buf, len);
+	MsgSetMSGoffs(pMsg, 0);
+	if(ringPut(pMsg) != RS_RET_OK)
+		msgDestruct(&pMsg);
+}
+
+
+/* add a message to the ring buffer
  * Note: the pMsg reference counter is not incremented. Consequently,
  * the caller must NOT decrement it. The caller actually hands over
  * full ownership of the pMsg object.
  * The interface of this function is modelled after syslogd/logmsg(),
  * for which it is an "replacement".
+ * This function may be called concurrently by any thread. It never
+ * blocks. Messages are dropped if they exceed the rate limit or if
+ * the ring is full (which we report once we have room again).
  */
 rsRetVal iminternalAddMsg(msg_t *pMsg)
 {
+	int hash;
+	int n;
 	DEFiRet;
-	iminternal_t *pThis;
 
 	assert(pMsg != NULL);
 
-	CHKiRet(iminternalConstruct(&pThis));
+	if(!withinRateLimit()) {
+		ATOMIC_INC(&nLost, &mutLost);
+		ABORT_FINALIZE(RS_RET_DISCARDMSG);
+	}
 
-	pThis->pMsg = pMsg;
+	hash = msgHash(pMsg);
+	if(ATOMIC_CAS(&lastHash, hash, hash, &mutRepeats)) {
+		ATOMIC_INC(&nRepeats, &mutRepeats);
+		ABORT_FINALIZE(RS_RET_DISCARDMSG);
+	}
+	/* a new message, so first report what happened to its predecessors */
+	do {
+		n = nRepeats;
+	} while(!ATOMIC_CAS(&nRepeats, n, 0, &mutRepeats));
+	if(n > 0)
+		addNotice(pMsg, "last internal message repeated %d times", n);
+	do {
+		n = nLost;
+	} while(!ATOMIC_CAS(&nLost, n, 0, &mutLost));
+	if(n > 0)
+		addNotice(pMsg, "%d internal messages lost due to rate-limiting or queue overflow", n);
+	/* this is racy, but the worst thing that can happen is that a repeated
+	 * message is not collapsed, so we do not care.
+	 */
+	lastHash = hash;
+
+	if((iRet = ringPut(pMsg)) != RS_RET_OK) {
+		dbgprintf("iminternalAddMsg: ring full, message lost\n");
+		ATOMIC_INC(&nLost, &mutLost);
+		FINALIZE;
+	}
 
-	CHKiRet(llAppend(&llMsgs,  NULL, (void*) pThis));
+	if(ATOMIC_CAS(&bWakeupPending, 0, 1, &mutWakeup) && fdWakeup[1] != -1) {
+		if(write(fdWakeup[1], "", 1) != 1) {
+			dbgprintf("iminternal: could not wake up main thread\n");
+		}
+	}
 
 finalize_it:
-	if(iRet != RS_RET_OK) {
-		dbgprintf("iminternalAddMsg() error %d - can not otherwise report this error, message lost\n", iRet);
-		if(pThis != NULL)
-			iminternalDestruct(pThis);
-	}
+	if(iRet != RS_RET_OK)
+		msgDestruct(&pMsg);
 
 	RETiRet;
 }
 
 
-/* pull the first error message from the linked list, remove it
- * from the list and return it to the caller. The caller is
- * responsible for freeing the message!
+/* pull the first message from the ring and return it to
+ * the caller. The caller is responsible for freeing the message!
+ * Must only be called from the main thread.
  */
 rsRetVal iminternalRemoveMsg(msg_t **ppMsg)
 {
-	DEFiRet;
-	iminternal_t *pThis;
-	linkedListCookie_t llCookie = NULL;
-
 	assert(ppMsg != NULL);
-
-	CHKiRet(llGetNextElt(&llMsgs, &llCookie, (void*)&pThis));
-	*ppMsg = pThis->pMsg;
-	pThis->pMsg = NULL; /* we do no longer own it - important for destructor */
-
-	if(llDestroyRootElt(&llMsgs) != RS_RET_OK) {
-		dbgprintf("Root element of iminternal linked list could not be destroyed - there is "
-			"nothing we can do against it, we ignore it for now. Things may go wild "
-			"from here on. This is most probably a program logic error.\n");
-	}
-
-finalize_it:
-	RETiRet;
+	return ringGet(ppMsg);
 }
 
 /* tell the caller if we have any messages ready for processing.
@@ -146,7 +299,52 @@ rsRetVal iminternalHaveMsgReady(int* pbHaveOne)
 {
 	assert(pbHaveOne != NULL);
 
-	return llGetNumElts(&llMsgs, pbHaveOne);
+	IMINTERNAL_LOCK();
+#ifdef HAVE_ATOMIC_BUILTINS
+	ATOMIC_MEMORY_BARRIER();
+#endif
+	*pbHaveOne = (ring[deqPos & (IMINTERNAL_QUEUE_SIZE - 1)].seq == deqPos + 1);
+	IMINTERNAL_UNLOCK();
+	return RS_RET_OK;
+}
+
+
+/* Set up the wakeup pipe. Once it exists, producers notify the main
+ * thread via this pipe when they add messages, so that it can process
+ * them (this is needed if the main queue is in direct mode). This must
+ * be called after we have forked, as the fork closes all descriptors.
+ * Returns the descriptor that the main thread shall watch, -1 on error.
+ */
+int iminternalGetWakeupFd(void)
+{
+	if(fdWakeup[0] == -1) {
+		if(pipe(fdWakeup) != 0) {
+			fdWakeup[0] = fdWakeup[1] = -1;
+			return -1;
+		}
+		fcntl(fdWakeup[0], F_SETFL, O_NONBLOCK);
+		fcntl(fdWakeup[1], F_SETFL, O_NONBLOCK);
+		fcntl(fdWakeup[0], F_SETFD, FD_CLOEXEC);
+		fcntl(fdWakeup[1], F_SETFD, FD_CLOEXEC);
+		/* messages may have arrived before we had the pipe */
+		ATOMIC_STORE_0_TO_INT(&bWakeupPending, &mutWakeup);
+	}
+	return fdWakeup[0];
+}
+
+
+/* acknowledge a wakeup. Must be called by the main thread before it
+ * removes messages, so that no wakeup for new messages can be missed.
+ */
+void iminternalAckWakeup(void)
+{
+	char buf[64];
+
+	if(fdWakeup[0] != -1) {
+		while(read(fdWakeup[0], buf, sizeof(buf)) > 0)
+			/* just drain */;
+	}
+	ATOMIC_STORE_0_TO_INT(&bWakeupPending, &mutWakeup);
 }
 
 
@@ -155,9 +353,18 @@ rsRetVal iminternalHaveMsgReady(int* pbHaveOne)
  */
 rsRetVal modInitIminternal(void)
 {
+	unsigned i;
 	DEFiRet;
 
-	iRet = llInit(&llMsgs, iminternalDestruct, NULL, NULL);
+	for(i = 0 ; i < IMINTERNAL_QUEUE_SIZE ; ++i) {
+		ring[i].seq = i;
+		ring[i].pMsg = NULL;
+	}
+	enqPos = deqPos = 0;
+	INIT_ATOMIC_HELPER_MUT(mutLost);
+	INIT_ATOMIC_HELPER_MUT(mutRepeats);
+	INIT_ATOMIC_HELPER_MUT(mutRate);
+	INIT_ATOMIC_HELPER_MUT(mutWakeup);
 
 	RETiRet;
 }
@@ -165,15 +372,26 @@ rsRetVal modInitIminternal(void)
 
 /* de-initialize the iminternal subsystem
  * must be called once at the end of the program
- * Note: the error list must have been pulled first. We do
- * NOT care if there are any errors left - we simply destroy
+ * Note: the messages should have been pulled first. We do
+ * NOT care if there are any messages left - we simply destroy
  * them.
  */
 rsRetVal modExitIminternal(void)
 {
+	msg_t *pMsg;
 	DEFiRet;
 
-	iRet = llDestroy(&llMsgs);
+	while(ringGet(&pMsg) == RS_RET_OK)
+		msgDestruct(&pMsg);
+	if(fdWakeup[0] != -1) {
+		close(fdWakeup[0]);
+		close(fdWakeup[1]);
+		fdWakeup[0] = fdWakeup[1] = -1;
+	}
+	DESTROY_ATOMIC_HELPER_MUT(mutLost);
+	DESTROY_ATOMIC_HELPER_MUT(mutRepeats);
+	DESTROY_ATOMIC_HELPER_MUT(mutRate);
+	DESTROY_ATOMIC_HELPER_MUT(mutWakeup);
 
 	RETiRet;
 }
@@ -27,11 +27,12 @@
 #define IMINTERNAL_H_INCLUDED
 #include "template.h"
 
-/* this is a single entry for a parse routine. It describes exactly
- * one entry point/handler.
- * The short name is cslch (Configfile SysLine CommandHandler)
+/* a slot of the internal message ring. seq tells who owns the slot:
+ * it equals the enqueue position if the slot is free for that position
+ * and that position + 1 once the message has been stored.
  */
-struct iminternal_s { /* config file sysline parse entry */
+struct iminternal_s {
+	unsigned seq;	/* slot sequence number */
 	msg_t *pMsg;	/* the message (in all its glory) */
 };
 typedef struct iminternal_s iminternal_t;
@@ -42,5 +43,7 @@ rsRetVal modExitIminternal(void);
 rsRetVal iminternalAddMsg(msg_t *pMsg);
 rsRetVal iminternalHaveMsgReady(int* pbHaveOne);
 rsRetVal iminternalRemoveMsg(msg_t **ppMsg);
+int iminternalGetWakeupFd(void);
+void iminternalAckWakeup(void);
 
 #endif /* #ifndef IMINTERNAL_H_INCLUDED */
@@ -1,7 +1,41 @@
-/* msggen - a small diagnostic utility that does very quick
- * syslog() calls.
+/* msggen - a traffic generator for load testing the rsyslog inputs.
  *
- * Copyright 2008 Rainer Gerhards and Adiscon GmbH.
+ * Messages are either replayed from a captured corpus (one message per
+ * line) or generated synthetically in RFC3164, RFC5424 or JSON/CEE format
+ * with a configurable size distribution. They are sent by a number of
+ * concurrent threads at a controlled total rate to one of these targets:
+ *
+ *   uxsock:PATH	local datagram socket (imuxsock), default uxsock:/dev/log
+ *   udp:HOST:PORT	(imudp)
+ *   tcp:HOST:PORT	(imtcp, imptcp), one connection per thread
+ *   file:PATH		appended to a file (imfile); PRI is not written
+ *
+ * Params
+ * -t	target, see above
+ * -T	number of sender threads (default 1)
+ * -m	number of messages to send per thread (default 10, 0 means no limit,
+ *	use -d then)
+ * -d	run for this many seconds at most (default 0, no limit)
+ * -r	total send rate in messages per second, split among the threads
+ *	(default 0, as fast as possible)
+ * -f	format of synthetic messages: 3164 (default), 5424 or json
+ * -s	size distribution of synthetic messages (total length):
+ *	fixed:N, uniform:MIN:MAX or exp:MEAN:MAX (exponential, mean MEAN,
+ *	capped at MAX). Default: fixed:100
+ * -c	corpus file to replay instead of synthetic messages. Each line is
+ *	one message and is sent as-is. The corpus is replayed in a loop;
+ *	thread n starts at line n.
+ * -o	use octet-counted framing for tcp (default: LF delimited)
+ * -P	PRI of synthetic messages (default 134, local0.info)
+ *
+ * Synthetic messages contain "msgnum:NNNNNNNN:". Thread n of T sends the
+ * numbers n, n+T, n+2T, ... so that with -m the union of all threads is
+ * 0..(T*m-1) and can be checked with the testbench's chkseq tool.
+ *
+ * At the end, the number of messages and bytes sent and the achieved rate
+ * are printed to stderr.
+ *
+ * Copyright 2008-2014 Rainer Gerhards and Adiscon GmbH.
  *
  * This file is part of rsyslog.
  *
@@ -23,17 +57,516 @@
 
 #include "config.h"
 #include <stdio.h>
-#include <syslog.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+#define MAX_MSG 65536
+#define WRBUF_SIZE (256*1024)	/* stream targets (tcp, file) write in chunks */
+#define PACE_INTERVAL_US 1000	/* granularity of rate control */
+
+enum { T_UXSOCK, T_UDP, T_TCP, T_FILE };
+enum { F_3164, F_5424, F_JSON };
+enum { S_FIXED, S_UNIFORM, S_EXP };
+
+static int targetType = T_UXSOCK;
+static char *targetPath = "/dev/log";
+static char *targetHost = NULL;
+static char *targetPort = NULL;
+static int numThreads = 1;
+static long long numMsgs = 10;
+static int duration = 0;
+static double sendRate = 0;
+static int msgFormat = F_3164;
+static int sizeDist = S_FIXED;
+static int sizeA = 100;		/* fixed size, min or mean */
+static int sizeB = 100;		/* max */
+static char *corpusFile = NULL;
+static int bOctetCounted = 0;
+static int msgPRI = 134;
+
+/* the corpus, if one is used */
+static char *corpus = NULL;
+static char **corpusLines = NULL;
+static int *corpusLens = NULL;
+static int numCorpusLines = 0;
+
+/* filler for synthetic messages, with some slack for varying the offset */
+static char filler[MAX_MSG + 64];
 
-int main(int __attribute__((unused)) argc, char __attribute__((unused)) *argv[])
+static char localHostName[256];
+
+typedef struct sender_s {
+	pthread_t tid;
+	int idx;
+	int sock;			/* socket or file descriptor */
+	struct sockaddr_un addrUx;
+	unsigned rndState;
+	char *wrBuf;			/* stream targets only */
+	size_t lenWrBuf;
+	unsigned long long nSent;
+	unsigned long long nBytes;
+	int bFailed;
+} sender_t;
+
+
+static long long
+timeUs(void)
 {
-	int i;
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: msggen [-t target] [-T threads] [-m msgs-per-thread] [-d seconds]\n"
+			"              [-r msgs-per-second] [-f 3164|5424|json] [-s size-dist]\n"
+			"              [-c corpus-file] [-o] [-P pri]\n"
+			"target is uxsock:PATH, udp:HOST:PORT, tcp:HOST:PORT or file:PATH\n"
+			"size-dist is fixed:N, uniform:MIN:MAX or exp:MEAN:MAX\n");
+	exit(1);
+}
 
-	openlog("msggen", 0 , LOG_LOCAL0);
 
-	for(i = 0 ; i < 10 ; ++i)
-		syslog(LOG_NOTICE, "This is message number %d", i);
+static void
+parseTarget(char *arg)
+{
+	char *p;
+
+	if(!strncmp(arg, "uxsock:", 7)) {
+		targetType = T_UXSOCK;
+		targetPath = arg + 7;
+	} else if(!strncmp(arg, "file:", 5)) {
+		targetType = T_FILE;
+		targetPath = arg + 5;
+	} else if(!strncmp(arg, "udp:", 4) || !strncmp(arg, "tcp:", 4)) {
+		targetType = (arg[0] == 'u') ? T_UDP : T_TCP;
+		targetHost = arg + 4;
+		if((p = strrchr(targetHost, ':')) == NULL)
+			usage();
+		*p = '\0';
+		targetPort = p + 1;
+	} else {
+		usage();
+	}
+}
+
+
+static void
+parseSizeDist(char *arg)
+{
+	if(sscanf(arg, "fixed:%d", &sizeA) == 1) {
+		sizeDist = S_FIXED;
+		sizeB = sizeA;
+	} else if(sscanf(arg, "uniform:%d:%d", &sizeA, &sizeB) == 2) {
+		sizeDist = S_UNIFORM;
+	} else if(sscanf(arg, "exp:%d:%d", &sizeA, &sizeB) == 2) {
+		sizeDist = S_EXP;
+	} else {
+		usage();
+	}
+	if(sizeA < 1 || sizeB < sizeA || sizeB >= MAX_MSG) {
+		fprintf(stderr, "msggen: invalid message size distribution '%s'\n", arg);
+		exit(1);
+	}
+}
+
+
+/* read the corpus into memory and split it into lines */
+static void
+loadCorpus(void)
+{
+	FILE *fp;
+	long len;
+	char *p, *pEnd;
+	int i, n;
+
+	if((fp = fopen(corpusFile, "r")) == NULL) {
+		perror(corpusFile);
+		exit(1);
+	}
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if((corpus = malloc(len + 1)) == NULL || fread(corpus, 1, len, fp) != (size_t) len) {
+		fprintf(stderr, "msggen: cannot read corpus file %s\n", corpusFile);
+		exit(1);
+	}
+	fclose(fp);
+	corpus[len] = '\0';
+
+	for(p = corpus ; *p ; ++p)
+		if(*p == '\n')
+			++numCorpusLines;
+	if(len > 0 && corpus[len-1] != '\n')
+		++numCorpusLines;
+	corpusLines = malloc(numCorpusLines * sizeof(char*));
+	corpusLens = malloc(numCorpusLines * sizeof(int));
+	if(corpusLines == NULL || corpusLens == NULL) {
+		fprintf(stderr, "msggen: out of memory\n");
+		exit(1);
+	}
+	p = corpus;
+	n = numCorpusLines;
+	numCorpusLines = 0;
+	for(i = 0 ; i < n ; ++i) {
+		if((pEnd = strchr(p, '\n')) == NULL)
+			pEnd = p + strlen(p);
+		*pEnd = '\0';
+		if(pEnd > p) { /* empty lines are skipped */
+			corpusLines[numCorpusLines] = p;
+			corpusLens[numCorpusLines++] = pEnd - p;
+		}
+		p = pEnd + 1;
+	}
+	if(numCorpusLines == 0) {
+		fprintf(stderr, "msggen: corpus file %s is empty\n", corpusFile);
+		exit(1);
+	}
+}
+
+
+static int
+nextMsgSize(sender_t *pSndr)
+{
+	double u;
+	int size;
+
+	switch(sizeDist) {
+	case S_UNIFORM:
+		return sizeA + rand_r(&pSndr->rndState) % (sizeB - sizeA + 1);
+	case S_EXP:
+		u = (rand_r(&pSndr->rndState) + 1.0) / ((double) RAND_MAX + 2.0);
+		size = (int) (-log(u) * sizeA);
+		return (size > sizeB) ? sizeB : (size < 1 ? 1 : size);
+	default:
+		return sizeA;
+	}
+}
+
 
-	closelog();
+/* generate a synthetic message into buf, return its length */
+static int
+genMsg(sender_t *pSndr, long long msgnum, char *buf)
+{
+	char ts[64];
+	struct tm tm;
+	struct timeval tv;
+	int size, len, lenFill;
+
+	gettimeofday(&tv, NULL);
+	size = nextMsgSize(pSndr);
+
+	/* PRI is not written to files */
+	len = (targetType == T_FILE) ? 0 : sprintf(buf, "<%d>", msgPRI);
+
+	switch(msgFormat) {
+	case F_5424:
+		gmtime_r(&tv.tv_sec, &tm);
+		strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
+		len += sprintf(buf + len, "1 %s.%6.6ldZ %s msggen %d - [msggen@32473 thread=\"%d\"] "
+				"msgnum:%8.8lld:", ts, (long) tv.tv_usec, localHostName,
+				(int) getpid(), pSndr->idx, msgnum);
+		break;
+	case F_JSON:
+		localtime_r(&tv.tv_sec, &tm);
+		strftime(ts, sizeof(ts), "%b %e %H:%M:%S", &tm);
+		len += sprintf(buf + len, "%s %s msggen[%d]: @cee:{\"msgnum\":\"msgnum:%8.8lld:\","
+				"\"thread\":%d,\"msg\":\"", ts, localHostName, (int) getpid(),
+				msgnum, pSndr->idx);
+		break;
+	default:
+		localtime_r(&tv.tv_sec, &tm);
+		strftime(ts, sizeof(ts), "%b %e %H:%M:%S", &tm);
+		len += sprintf(buf + len, "%s %s msggen[%d]: msgnum:%8.8lld:", ts, localHostName,
+				(int) getpid(), msgnum);
+		break;
+	}
+
+	/* fill up to the requested size (if the header is not already longer) */
+	lenFill = size - len - ((msgFormat == F_JSON) ? 2 : 0);
+	if(lenFill > 0) {
+		memcpy(buf + len, filler + (msgnum % 64), lenFill);
+		len += lenFill;
+	}
+	if(msgFormat == F_JSON) {
+		memcpy(buf + len, "\"}", 2);
+		len += 2;
+	}
+	return len;
+}
+
+
+static int
+openTarget(sender_t *pSndr)
+{
+	struct addrinfo hints, *res;
+	int r;
+
+	switch(targetType) {
+	case T_UXSOCK:
+		if((pSndr->sock = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
+			perror("socket");
+			return -1;
+		}
+		memset(&pSndr->addrUx, 0, sizeof(pSndr->addrUx));
+		pSndr->addrUx.sun_family = AF_UNIX;
+		strncpy(pSndr->addrUx.sun_path, targetPath, sizeof(pSndr->addrUx.sun_path) - 1);
+		return 0;
+	case T_FILE:
+		if((pSndr->sock = open(targetPath, O_WRONLY|O_APPEND|O_CREAT, 0644)) < 0) {
+			perror(targetPath);
+			return -1;
+		}
+		return 0;
+	default:
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = (targetType == T_UDP) ? SOCK_DGRAM : SOCK_STREAM;
+		if((r = getaddrinfo(targetHost, targetPort, &hints, &res)) != 0) {
+			fprintf(stderr, "msggen: cannot resolve %s:%s: %s\n", targetHost,
+				targetPort, gai_strerror(r));
+			return -1;
+		}
+		if((pSndr->sock = socket(res->ai_family, res->ai_socktype, 0)) < 0
+		   || connect(pSndr->sock, res->ai_addr, res->ai_addrlen) != 0) {
+			perror("connect");
+			freeaddrinfo(res);
+			return -1;
+		}
+		freeaddrinfo(res);
+		return 0;
+	}
+}
+
+
+/* write the stream buffer out, handling partial writes */
+static int
+flushWrBuf(sender_t *pSndr)
+{
+	size_t offs = 0;
+	ssize_t r;
+
+	while(offs < pSndr->lenWrBuf) {
+		r = write(pSndr->sock, pSndr->wrBuf + offs, pSndr->lenWrBuf - offs);
+		if(r < 0) {
+			if(errno == EINTR)
+				continue;
+			perror("write");
+			return -1;
+		}
+		offs += r;
+	}
+	pSndr->lenWrBuf = 0;
 	return 0;
 }
+
+
+static int
+sendMsg(sender_t *pSndr, char *msg, int len)
+{
+	char frame[16];
+	int lenFrame = 0;
+	ssize_t r;
+
+	switch(targetType) {
+	case T_UXSOCK:
+		r = sendto(pSndr->sock, msg, len, 0, (struct sockaddr*) &pSndr->addrUx,
+			   sizeof(pSndr->addrUx));
+		break;
+	case T_UDP:
+		r = send(pSndr->sock, msg, len, 0);
+		if(r < 0 && errno == ECONNREFUSED)
+			r = 0; /* ICMP from an earlier datagram, nobody listening (yet) */
+		break;
+	default: /* stream targets */
+		if(bOctetCounted && targetType == T_TCP)
+			lenFrame = sprintf(frame, "%d ", len);
+		if(pSndr->lenWrBuf + lenFrame + len + 1 > WRBUF_SIZE && flushWrBuf(pSndr) != 0)
+			return -1;
+		memcpy(pSndr->wrBuf + pSndr->lenWrBuf, frame, lenFrame);
+		pSndr->lenWrBuf += lenFrame;
+		memcpy(pSndr->wrBuf + pSndr->lenWrBuf, msg, len);
+		pSndr->lenWrBuf += len;
+		if(!(bOctetCounted && targetType == T_TCP))
+			pSndr->wrBuf[pSndr->lenWrBuf++] = '\n';
+		r = lenFrame + len;
+		break;
+	}
+	if(r < 0) {
+		perror("send");
+		return -1;
+	}
+	pSndr->nBytes += r;
+	return 0;
+}
+
+
+static void *
+senderThread(void *arg)
+{
+	sender_t *const pSndr = (sender_t*) arg;
+	char *msgBuf;
+	char *msg;
+	int len;
+	long long i;
+	long long tStart, tNow;
+	long long tEnd = 0;
+	double ratePerThread;
+	long long checkEvery;
+	long long due;
+
+	if((msgBuf = malloc(MAX_MSG + 64)) == NULL
+	   || (targetType >= T_TCP && (pSndr->wrBuf = malloc(WRBUF_SIZE)) == NULL)) {
+		fprintf(stderr, "msggen: out of memory\n");
+		pSndr->bFailed = 1;
+		return NULL;
+	}
+	if(openTarget(pSndr) != 0) {
+		pSndr->bFailed = 1;
+		goto done;
+	}
+
+	/* rate control and duration are checked every checkEvery messages,
+	 * that is about every PACE_INTERVAL_US, so that we do not call
+	 * gettimeofday() per message at high rates.
+	 */
+	ratePerThread = sendRate / numThreads;
+	checkEvery = (ratePerThread > 0) ? (long long) (ratePerThread * PACE_INTERVAL_US / 1000000) : 1000;
+	if(checkEvery < 1)
+		checkEvery = 1;
+	tStart = timeUs();
+	if(duration > 0)
+		tEnd = tStart + (long long) duration * 1000000;
+	for(i = 0 ; (numMsgs == 0 || i < numMsgs) ; ++i) {
+		if(corpus != NULL) {
+			msg = corpusLines[(pSndr->idx + i) % numCorpusLines];
+			len = corpusLens[(pSndr->idx + i) % numCorpusLines];
+		} else {
+			msg = msgBuf;
+			len = genMsg(pSndr, i * numThreads + pSndr->idx, msgBuf);
+		}
+		if(sendMsg(pSndr, msg, len) != 0) {
+			pSndr->bFailed = 1;
+			break;
+		}
+		++pSndr->nSent;
+
+		if((ratePerThread > 0 || tEnd != 0) && (i + 1) % checkEvery == 0) {
+			if(targetType >= T_TCP && ratePerThread > 0 && flushWrBuf(pSndr) != 0) {
+				pSndr->bFailed = 1;
+				break;
+			}
+			tNow = timeUs();
+			if(tEnd != 0 && tNow >= tEnd)
+				break;
+			if(ratePerThread > 0) {
+				due = tStart + (long long) ((i + 1) * 1000000.0 / ratePerThread);
+				if(due > tNow)
+					usleep(due - tNow);
+			}
+		}
+	}
+	if(targetType >= T_TCP && !pSndr->bFailed && flushWrBuf(pSndr) != 0)
+		pSndr->bFailed = 1;
+	close(pSndr->sock);
+done:
+	free(pSndr->wrBuf);
+	free(msgBuf);
+	return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+	sender_t *senders;
+	unsigned long long nSent = 0, nBytes = 0;
+	long long tStart;
+	double secs;
+	int bFailed = 0;
+	int opt;
+	int i;
+
+	while((opt = getopt(argc, argv, "c:d:f:m:oP:r:s:t:T:")) != -1) {
+		switch(opt) {
+		case 'c':	corpusFile = optarg;
+				break;
+		case 'd':	duration = atoi(optarg);
+				break;
+		case 'f':	if(!strcmp(optarg, "3164"))
+					msgFormat = F_3164;
+				else if(!strcmp(optarg, "5424"))
+					msgFormat = F_5424;
+				else if(!strcmp(optarg, "json"))
+					msgFormat = F_JSON;
+				else
+					usage();
+				break;
+		case 'm':	numMsgs = atoll(optarg);
+				break;
+		case 'o':	bOctetCounted = 1;
+				break;
+		case 'P':	msgPRI = atoi(optarg);
+				break;
+		case 'r':	sendRate = atof(optarg);
+				break;
+		case 's':	parseSizeDist(optarg);
+				break;
+		case 't':	parseTarget(optarg);
+				break;
+		case 'T':	numThreads = atoi(optarg);
+				break;
+		default:	usage();
+		}
+	}
+	if(numThreads < 1 || (numMsgs == 0 && duration == 0))
+		usage();
+
+	if(corpusFile != NULL)
+		loadCorpus();
+	gethostname(localHostName, sizeof(localHostName) - 1);
+	for(i = 0 ; i < MAX_MSG ; ++i)
+		filler[i] = 'a' + i % 26;
+
+	if((senders = calloc(numThreads, sizeof(sender_t))) == NULL) {
+		fprintf(stderr, "msggen: out of memory\n");
+		exit(1);
+	}
+	tStart = timeUs();
+	for(i = 0 ; i < numThreads ; ++i) {
+		senders[i].idx = i;
+		senders[i].rndState = (unsigned) (tStart + i);
+		if(pthread_create(&senders[i].tid, NULL, senderThread, &senders[i]) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for(i = 0 ; i < numThreads ; ++i) {
+		pthread_join(senders[i].tid, NULL);
+		nSent += senders[i].nSent;
+		nBytes += senders[i].nBytes;
+		bFailed |= senders[i].bFailed;
+	}
+	secs = (timeUs() - tStart) / 1000000.0;
+
+	fprintf(stderr, "msggen: sent %llu messages (%llu bytes) in %.3f seconds, %.0f msgs/sec\n",
+		nSent, nBytes, secs, secs > 0 ? nSent / secs : 0.0);
+	free(senders);
+	free(corpusLines);
+	free(corpusLens);
+	free(corpus);
+	return bFailed ? 1 : 0;
+}
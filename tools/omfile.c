@@ -48,6 +48,7 @@
 #include <libgen.h>
 #include <unistd.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #ifdef OS_SOLARIS
 #	include <fcntl.h>
 #endif
@@ -71,6 +72,9 @@
 #include "statsobj.h"
 #include "sigprov.h"
 #include "cryprov.h"
+#include "cmpr.h"
+#include "hashtable.h"
+#include "memacct.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -85,45 +89,25 @@ DEF_OMOD_STATIC_DATA
 DEFobjCurrIf(errmsg)
 DEFobjCurrIf(strm)
 DEFobjCurrIf(statsobj)
+DEFobjCurrIf(cmpr)
 
-/* for our current LRU mechanism, we need a monotonically increasing counters. We use
- * it much like a "Lamport logical clock": we do not need the actual time, we just need
- * to know the sequence in which files were accessed. So we use a simple counter to
- * create that sequence. We use an unsigned 64 bit value which is extremely unlike to
- * wrap within the lifetime of a process. If we process 1,000,000 file writes per
- * second, the process could still exist over 500,000 years before a wrap to 0 happens.
- * That should be sufficient (and even than, there would no really bad effect ;)).
- * The variable below is the global counter/clock.
- */
-#if HAVE_ATOMIC_BUILTINS_64BIT
-static uint64 clockFileAccess = 0;
-#else
-static unsigned clockFileAccess = 0;
-#endif
-/* and the "tick" function */
-#ifndef HAVE_ATOMIC_BUILTINS
-static pthread_mutex_t mutClock;
-#endif
-static inline uint64
-getClockFileAccess(void)
-{
-#if HAVE_ATOMIC_BUILTINS_64BIT
-	return ATOMIC_INC_AND_FETCH_uint64(&clockFileAccess, &mutClock);
-#else
-	return ATOMIC_INC_AND_FETCH_unsigned(&clockFileAccess, &mutClock);
-#endif
-}
-
+static sbool bCmprIfLoaded = 0;	/* cmpr interface is only obtained if actually used */
 
 /* The following structure is a dynafile name cache entry.
  */
 struct s_dynaFileCacheEntry {
-	uchar *pName;		/* name currently open, if dynamic name */
+	uchar *pName;		/* name currently open, if dynamic name (owned by hash table) */
 	strm_t	*pStrm;		/* our output stream */
+	size_t	memSize;	/* stream buffer memory, as reported to memacct */
 	void	*sigprovFileData;	/* opaque data ptr for provider use */
-	uint64	clkTickAccessed;/* for LRU - based on clockFileAccess */
+	int	iIdx;		/* index of this entry inside the dynCache array */
+	struct s_dynaFileCacheEntry *pPrev; /* LRU list, most recently used first */
+	struct s_dynaFileCacheEntry *pNext; /* LRU list - or free list if entry is unused */
+	struct s_dynaFileCacheEntry *pSyncNext; /* list of entries written in current transaction */
+	sbool	bSyncPending;	/* entry is on the pending sync list */
 };
 typedef struct s_dynaFileCacheEntry dynaFileCacheEntry;
+typedef struct sharedStrm_s sharedStrm_t;
 
 
 #define IOBUF_DFLT_SIZE 4096	/* default size for io buffers */
@@ -142,6 +126,11 @@ typedef struct _instanceData {
 	int	fDirCreateMode;	/* creation mode for mkdir() */
 	int	bCreateDirs;	/* auto-create directories? */
 	int	bSyncFile;	/* should the file by sync()'ed? 1- yes, 0- no */
+	sbool	bGroupSync;	/* sync all files of a transaction at its end, via the sync coordinator */
+	int64	iPreallocExtent;	/* preallocate files in extents of this size, 0 - off */
+	dynaFileCacheEntry *pSyncPend;	/* dynafiles written in the current transaction (group sync) */
+	sbool	bSharedCache;	/* use the process-wide dynafile cache instead of our own */
+	sharedStrm_t *pCurrShared;	/* shared cache entry currently referenced, NULL if none */
 	uint8_t iNumTpls;	/* number of tpls we use */
 	uid_t	fileUID;	/* IDs for creation */
 	uid_t	dirUID;
@@ -164,12 +153,22 @@ typedef struct _instanceData {
 	int	iDynaFileCacheSize; /* size of file handle cache */
 	/* The cache is implemented as an array. An empty element is indicated
 	 * by a NULL pointer. Memory is allocated as needed. The following
-	 * pointer points to the overall structure.
+	 * pointer points to the overall structure. Entries in use are also
+	 * indexed by file name via a hash table and kept in a doubly-linked
+	 * LRU list, so that both lookup and eviction are O(1). Allocated
+	 * entries not currently in use (failed opens) are on a free list.
 	 */
 	dynaFileCacheEntry **dynCache;
+	struct hashtable *dynCacheHt;
+	dynaFileCacheEntry *pLRUHead;	/* most recently used */
+	dynaFileCacheEntry *pLRUTail;	/* least recently used, evicted first */
+	dynaFileCacheEntry *pFreeEntries;
 	off_t	iSizeLimit;		/* file size limit, 0 = no limit */
 	uchar	*pszSizeLimitCmd;	/* command to carry out when size limit is reached */
 	int 	iZipLevel;		/* zip mode to use for this selector */
+	int	iZipWorkers;		/* >0: parallel block compression with that many extra threads */
+	int	iCmprAlgo;		/* non-gzip compression algorithm (CMPR_ALGO_*), NONE: legacy zip */
+	uchar	*pszCmprDict;		/* compression dictionary file (zstd only) */
 	int	iIOBufSize;		/* size of associated io buffer */
 	int	iFlushInterval;		/* how fast flush buffer on inactivity? */
 	sbool	bFlushOnTXEnd;		/* flush write buffers when transaction has ended? */
@@ -219,6 +218,11 @@ struct modConfData_s {
 	uid_t dirUID;
 	gid_t fileGID;
 	gid_t dirGID;
+	int iSyncInterval;	/* group sync: max time (ms) to collect files for one sync batch */
+	int iSyncThreads;	/* group sync: max number of parallel fdatasync() calls */
+	sbool bSyncFS;		/* group sync: use syncfs() once per file system instead of fdatasync() */
+	int iSharedCacheSize;	/* max number of files in the shared dynafile cache */
+	sbool bAsyncClose;	/* close evicted dynafiles and rotate outchannels in the closer thread */
 };
 
 static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
@@ -238,6 +242,11 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "fileownernum", eCmdHdlrInt, 0 },
 	{ "filegroup", eCmdHdlrGID, 0 },
 	{ "filegroupnum", eCmdHdlrInt, 0 },
+	{ "sync.interval", eCmdHdlrNonNegInt, 0 },
+	{ "sync.threads", eCmdHdlrPositiveInt, 0 },
+	{ "sync.mode", eCmdHdlrGetWord, 0 },
+	{ "shareddynafilecachesize", eCmdHdlrPositiveInt, 0 },
+	{ "asyncclose", eCmdHdlrBinary, 0 },
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -248,10 +257,14 @@ static struct cnfparamblk modpblk =
 /* action (instance) parameters */
 static struct cnfparamdescr actpdescr[] = {
 	{ "dynafilecachesize", eCmdHdlrInt, 0 }, /* legacy: dynafilecachesize */
+	{ "shareddynafilecache", eCmdHdlrBinary, 0 },
 	{ "ziplevel", eCmdHdlrInt, 0 }, /* legacy: omfileziplevel */
 	{ "flushinterval", eCmdHdlrInt, 0 }, /* legacy: omfileflushinterval */
 	{ "asyncwriting", eCmdHdlrBinary, 0 }, /* legacy: omfileasyncwriting */
 	{ "veryrobustzip", eCmdHdlrBinary, 0 },
+	{ "zipworkers", eCmdHdlrNonNegInt, 0 },
+	{ "compression.algorithm", eCmdHdlrGetWord, 0 },
+	{ "compression.dictionary", eCmdHdlrString, 0 },
 	{ "flushontxend", eCmdHdlrBinary, 0 }, /* legacy: omfileflushontxend */
 	{ "iobuffersize", eCmdHdlrSize, 0 }, /* legacy: omfileiobuffersize */
 	{ "dirowner", eCmdHdlrUID, 0 }, /* legacy: dirowner */
@@ -267,6 +280,8 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "failonchownfailure", eCmdHdlrBinary, 0 }, /* legacy: failonchownfailure */
 	{ "createdirs", eCmdHdlrBinary, 0 }, /* legacy: createdirs */
 	{ "sync", eCmdHdlrBinary, 0 }, /* legacy: actionfileenablesync */
+	{ "sync.group", eCmdHdlrBinary, 0 },
+	{ "preallocate.extent", eCmdHdlrSize, 0 },
 	{ "file", eCmdHdlrString, 0 },     /* either "file" or ... */
 	{ "dynafile", eCmdHdlrString, 0 }, /* "dynafile" MUST be present */
 	{ "sig.provider", eCmdHdlrGetWord, 0 },
@@ -451,17 +466,278 @@ finalize_it:
 }
 
 
+/* LRU list handling */
+static inline void
+dynaFileLRUUnlink(instanceData *__restrict__ const pData, dynaFileCacheEntry *const pEntry)
+{
+	if(pEntry->pPrev == NULL)
+		pData->pLRUHead = pEntry->pNext;
+	else
+		pEntry->pPrev->pNext = pEntry->pNext;
+	if(pEntry->pNext == NULL)
+		pData->pLRUTail = pEntry->pPrev;
+	else
+		pEntry->pNext->pPrev = pEntry->pPrev;
+	pEntry->pPrev = pEntry->pNext = NULL;
+}
+
+static inline void
+dynaFileLRUPushFront(instanceData *__restrict__ const pData, dynaFileCacheEntry *const pEntry)
+{
+	pEntry->pPrev = NULL;
+	pEntry->pNext = pData->pLRUHead;
+	if(pData->pLRUHead == NULL)
+		pData->pLRUTail = pEntry;
+	else
+		pData->pLRUHead->pPrev = pEntry;
+	pData->pLRUHead = pEntry;
+}
+
+static inline void
+dynaFileLRUTouch(instanceData *__restrict__ const pData, dynaFileCacheEntry *const pEntry)
+{
+	if(pData->pLRUHead != pEntry) {
+		dynaFileLRUUnlink(pData, pEntry);
+		dynaFileLRUPushFront(pData, pEntry);
+	}
+}
+
+
+/* remember that a dynafile has been written in the current transaction */
+static inline void
+groupSyncAddPending(instanceData *__restrict__ const pData, dynaFileCacheEntry *const pEntry)
+{
+	if(!pEntry->bSyncPending) {
+		pEntry->bSyncPending = 1;
+		pEntry->pSyncNext = pData->pSyncPend;
+		pData->pSyncPend = pEntry;
+	}
+}
+
+
+/* allocate the dynafile cache structures */
+static rsRetVal
+dynaFileAllocCache(instanceData *__restrict__ const pData, const int iCacheSize)
+{
+	DEFiRet;
+	CHKmalloc(pData->dynCache = (dynaFileCacheEntry**)
+			calloc(iCacheSize, sizeof(dynaFileCacheEntry*)));
+	CHKmalloc(pData->dynCacheHt = create_hashtable(iCacheSize, hash_from_string,
+						       key_equals_string, NULL));
+	pData->pLRUHead = pData->pLRUTail = pData->pFreeEntries = NULL;
+	pData->pSyncPend = NULL;
+	pData->iCurrElt = -1;		  /* no current element */
+finalize_it:
+	RETiRet;
+}
+
+
+/* The closer. Closing a file may take considerable time: the stream
+ * buffer is flushed, the zip trailer is written, deferred syncs are done
+ * and, for outchannels, the size limit command is run. If that happens
+ * inline, e.g. when a dynafile is evicted from the cache, the whole action
+ * stalls. So such streams are handed over to a single, module-wide closer
+ * thread via a bounded queue (the submitter waits if it is full). The cache
+ * slot is available again immediately. A file that is still in the closer
+ * queue is not reopened before its close (and rotation) has completed.
+ * Actions whose streams reference per-action state (signature and crypto
+ * providers), that need the data synced at commit (group sync) or share
+ * streams (shared cache) always close inline.
+ */
+#define CLOSER_QUEUE_SIZE 128
+typedef struct closerJob_s {
+	strm_t *pStrm;
+	uchar *pszName;		/* file name, to keep it from being reopened too early */
+	uchar *pszRotateCmd;	/* size limit command to run after close, or NULL */
+	off_t iSizeLimit;
+} closerJob_t;
+
+static struct {
+	pthread_mutex_t mut;
+	pthread_cond_t notEmpty;
+	pthread_cond_t jobDone;
+	closerJob_t jobs[CLOSER_QUEUE_SIZE]; /* ring buffer, the job at head is being processed */
+	int head;
+	int nJobs;
+	sbool bRunning;
+	sbool bStop;
+	pthread_t tid;
+} closer;
+
+static inline int
+closerUsable(const instanceData *__restrict__ const pData)
+{
+	return runModConf != NULL && runModConf->bAsyncClose
+	       && !pData->useSigprov && !pData->useCryprov
+	       && !pData->bGroupSync && !pData->bSharedCache;
+}
+
+/* run the outchannel size limit command for a file that was just closed */
+static void
+closerRotate(closerJob_t *const pJob)
+{
+	uchar *pCmd;
+	uchar *pParams;
+	uchar *p;
+	struct stat statFile;
+
+	if((pCmd = ustrdup(pJob->pszRotateCmd)) == NULL)
+		return;
+	/* everything after the first space is a single parameter */
+	for(p = pCmd ; *p && *p != ' ' ; ++p)
+		/* JUST SKIP */;
+	if(*p == ' ') {
+		*p = '\0';
+		pParams = p + 1;
+	} else {
+		pParams = NULL;
+	}
+	execProg(pCmd, 1, pParams);
+	free(pCmd);
+
+	if(stat((char*) pJob->pszName, &statFile) == 0 && statFile.st_size >= pJob->iSizeLimit) {
+		errmsg.LogError(0, RS_RET_SIZELIMITCMD_DIDNT_RESOLVE, "omfile: file size "
+			"limit cmd for file '%s' did not resolve situation", pJob->pszName);
+	}
+}
+
+static void *
+closerThread(void __attribute__((unused)) *arg)
+{
+	closerJob_t job;
+
+	pthread_mutex_lock(&closer.mut);
+	while(1) {
+		while(closer.nJobs == 0 && !closer.bStop)
+			pthread_cond_wait(&closer.notEmpty, &closer.mut);
+		if(closer.nJobs == 0)
+			break; /* stop requested and all done */
+		job = closer.jobs[closer.head];
+		pthread_mutex_unlock(&closer.mut);
+
+		DBGPRINTF("omfile: closer closing '%s'\n", job.pszName);
+		strm.Destruct(&job.pStrm);
+		if(job.pszRotateCmd != NULL)
+			closerRotate(&job);
+
+		pthread_mutex_lock(&closer.mut);
+		free(closer.jobs[closer.head].pszName);
+		free(closer.jobs[closer.head].pszRotateCmd);
+		closer.head = (closer.head + 1) % CLOSER_QUEUE_SIZE;
+		--closer.nJobs;
+		pthread_cond_broadcast(&closer.jobDone);
+	}
+	pthread_mutex_unlock(&closer.mut);
+	return NULL;
+}
+
+/* hand a stream over to the closer. If bRotate is set, the size limit
+ * command is run after close. If the closer can not be used, we close
+ * (and rotate) inline. The stream pointer is consumed in any case.
+ */
+static void
+closerSubmit(instanceData *__restrict__ const pData, strm_t **ppStrm,
+	     const uchar *__restrict__ const pszName, const int bRotate)
+{
+	closerJob_t job;
+
+	job.pStrm = *ppStrm;
+	*ppStrm = NULL;
+	job.pszName = ustrdup(pszName);
+	job.pszRotateCmd = bRotate ? ustrdup(pData->pszSizeLimitCmd) : NULL;
+	job.iSizeLimit = pData->iSizeLimit;
+	if(job.pszName == NULL || (bRotate && job.pszRotateCmd == NULL))
+		goto inline_close;
+
+	pthread_mutex_lock(&closer.mut);
+	if(!closer.bRunning) {
+		closer.bStop = 0;
+		if(pthread_create(&closer.tid, NULL, closerThread, NULL) != 0) {
+			pthread_mutex_unlock(&closer.mut);
+			goto inline_close;
+		}
+		closer.bRunning = 1;
+	}
+	while(closer.nJobs == CLOSER_QUEUE_SIZE)
+		pthread_cond_wait(&closer.jobDone, &closer.mut);
+	closer.jobs[(closer.head + closer.nJobs) % CLOSER_QUEUE_SIZE] = job;
+	++closer.nJobs;
+	pthread_cond_signal(&closer.notEmpty);
+	pthread_mutex_unlock(&closer.mut);
+	return;
+
+inline_close:
+	strm.Destruct(&job.pStrm);
+	if(job.pszRotateCmd != NULL)
+		closerRotate(&job);
+	free(job.pszName);
+	free(job.pszRotateCmd);
+}
+
+/* wait until the given file is no longer in the closer queue */
+static void
+closerWaitFile(const uchar *__restrict__ const pszName)
+{
+	int i;
+
+	pthread_mutex_lock(&closer.mut);
+	i = 0;
+	while(i < closer.nJobs) {
+		if(!ustrcmp(closer.jobs[(closer.head + i) % CLOSER_QUEUE_SIZE].pszName, pszName)) {
+			DBGPRINTF("omfile: waiting for closer to finish '%s'\n", pszName);
+			pthread_cond_wait(&closer.jobDone, &closer.mut);
+			i = 0; /* queue has changed, rescan */
+		} else {
+			++i;
+		}
+	}
+	pthread_mutex_unlock(&closer.mut);
+}
+
+/* wait until all queued files are closed (HUP) */
+static void
+closerDrain(void)
+{
+	pthread_mutex_lock(&closer.mut);
+	while(closer.nJobs > 0)
+		pthread_cond_wait(&closer.jobDone, &closer.mut);
+	pthread_mutex_unlock(&closer.mut);
+}
+
+/* drain the queue and terminate the closer thread */
+static void
+closerStop(void)
+{
+	pthread_mutex_lock(&closer.mut);
+	if(!closer.bRunning) {
+		pthread_mutex_unlock(&closer.mut);
+		return;
+	}
+	closer.bStop = 1;
+	pthread_cond_signal(&closer.notEmpty);
+	pthread_mutex_unlock(&closer.mut);
+	pthread_join(closer.tid, NULL);
+	closer.bRunning = 0;
+}
+
+
 /* This function deletes an entry from the dynamic file name
  * cache. A pointer to the cache must be passed in as well
  * as the index of the to-be-deleted entry. This index may
  * point to an unallocated entry, in whcih case the
  * function immediately returns. Parameter bFreeEntry is 1
- * if the entry should be d_free()ed and 0 if not.
+ * if the entry should be d_free()ed and 0 if not. If bAsync is set, the
+ * stream is closed by the closer thread, and if it is DYNAFILE_ROTATE,
+ * the size limit command is run afterwards.
  */
+#define DYNAFILE_CLOSE_ASYNC 1
+#define DYNAFILE_ROTATE 2
 static rsRetVal
-dynaFileDelCacheEntry(instanceData *__restrict__ const pData, const int iEntry, const int bFreeEntry)
+dynaFileDelCacheEntry(instanceData *__restrict__ const pData, const int iEntry, const int bFreeEntry,
+		      const int bAsync)
 {
 	dynaFileCacheEntry **pCache = pData->dynCache;
+	uchar *pszName = NULL;
 	DEFiRet;
 	ASSERT(pCache != NULL);
 
@@ -472,12 +748,20 @@ dynaFileDelCacheEntry(instanceData *__restrict__ const pData, const int iEntry,
 		pCache[iEntry]->pName == NULL ? UCHAR_CONSTANT("[OPEN FAILED]") : pCache[iEntry]->pName);
 
 	if(pCache[iEntry]->pName != NULL) {
-		d_free(pCache[iEntry]->pName);
+		if(bAsync && pCache[iEntry]->pStrm != NULL)
+			pszName = ustrdup(pCache[iEntry]->pName);
+		/* the name is the hash key, so the hash table frees it */
+		hashtable_remove(pData->dynCacheHt, pCache[iEntry]->pName);
 		pCache[iEntry]->pName = NULL;
+		dynaFileLRUUnlink(pData, pCache[iEntry]);
 	}
 
 	if(pCache[iEntry]->pStrm != NULL) {
-		strm.Destruct(&pCache[iEntry]->pStrm);
+		memacctSub(MEMACCT_DYNAFILE, pCache[iEntry]->memSize);
+		if(pszName != NULL)
+			closerSubmit(pData, &pCache[iEntry]->pStrm, pszName, bAsync == DYNAFILE_ROTATE);
+		else
+			strm.Destruct(&pCache[iEntry]->pStrm);
 		if(pData->useSigprov) {
 			pData->sigprov.OnFileClose(pCache[iEntry]->sigprovFileData);
 			pCache[iEntry]->sigprovFileData = NULL;
@@ -490,6 +774,7 @@ dynaFileDelCacheEntry(instanceData *__restrict__ const pData, const int iEntry,
 	}
 
 finalize_it:
+	free(pszName);
 	RETiRet;
 }
 
@@ -506,8 +791,11 @@ dynaFileFreeCacheEntries(instanceData *__restrict__ const pData)
 
 	BEGINfunc;
 	for(i = 0 ; i < pData->iCurrCacheSize ; ++i) {
-		dynaFileDelCacheEntry(pData, i, 1);
+		dynaFileDelCacheEntry(pData, i, 1, 0);
 	}
+	pData->iCurrCacheSize = 0;
+	pData->pLRUHead = pData->pLRUTail = pData->pFreeEntries = NULL;
+	pData->pSyncPend = NULL;
 	pData->iCurrElt = -1; /* invalidate current element */
 	ENDfunc;
 }
@@ -523,6 +811,8 @@ static void dynaFileFreeCache(instanceData *__restrict__ const pData)
 	dynaFileFreeCacheEntries(pData);
 	if(pData->dynCache != NULL)
 		d_free(pData->dynCache);
+	if(pData->dynCacheHt != NULL)
+		hashtable_destroy(pData->dynCacheHt, 0);
 	ENDfunc;
 }
 
@@ -563,6 +853,7 @@ prepareFile(instanceData *__restrict__ const pData, const uchar *__restrict__ co
 	DEFiRet;
 
 	pData->pStrm = NULL;
+	closerWaitFile(newFileName);
 	if(access((char*)newFileName, F_OK) != 0) {
 		/* file does not exist, create it (and eventually parent directories */
 		if(pData->bCreateDirs) {
@@ -617,12 +908,25 @@ prepareFile(instanceData *__restrict__ const pData, const uchar *__restrict__ co
 	CHKiRet(strm.SetDir(pData->pStrm, szDirName, ustrlen(szDirName)));
 	CHKiRet(strm.SetiZipLevel(pData->pStrm, pData->iZipLevel));
 	CHKiRet(strm.SetbVeryReliableZip(pData->pStrm, pData->bVeryRobustZip));
+	CHKiRet(strm.SetiZipWorkers(pData->pStrm, pData->iZipWorkers));
+	if(pData->iCmprAlgo != CMPR_ALGO_NONE) {
+		CHKiRet(strm.SetiCmprAlgo(pData->pStrm, pData->iCmprAlgo));
+		if(pData->pszCmprDict != NULL) {
+			uchar *pszDict;
+			CHKmalloc(pszDict = ustrdup(pData->pszCmprDict));
+			CHKiRet(strm.SetpszCmprDict(pData->pStrm, pszDict));
+		}
+	}
 	CHKiRet(strm.SetsIOBufSize(pData->pStrm, (size_t) pData->iIOBufSize));
 	CHKiRet(strm.SettOperationsMode(pData->pStrm, STREAMMODE_WRITE_APPEND));
 	CHKiRet(strm.SettOpenMode(pData->pStrm, cs.fCreateMode));
 	CHKiRet(strm.SetbSync(pData->pStrm, pData->bSyncFile));
+	CHKiRet(strm.SetbDeferSync(pData->pStrm, pData->bGroupSync));
+	CHKiRet(strm.SetiPreallocExtent(pData->pStrm, pData->iPreallocExtent));
 	CHKiRet(strm.SetsType(pData->pStrm, STREAMTYPE_FILE_SINGLE));
-	CHKiRet(strm.SetiSizeLimit(pData->pStrm, pData->iSizeLimit));
+	/* with the closer, we do size limit processing ourselves, see sizeLimitCheck() */
+	CHKiRet(strm.SetiSizeLimit(pData->pStrm,
+		(pData->pszSizeLimitCmd != NULL && closerUsable(pData)) ? 0 : pData->iSizeLimit));
 	if(pData->useCryprov) {
 		CHKiRet(strm.Setcryprov(pData->pStrm, &pData->cryprov));
 		CHKiRet(strm.SetcryprovData(pData->pStrm, pData->cryprovData));
@@ -661,10 +965,7 @@ finalize_it:
 static inline rsRetVal
 prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__ const newFileName)
 {
-	uint64 ctOldest; /* "timestamp" of oldest element */
-	int iOldest;
-	int i;
-	int iFirstFree;
+	dynaFileCacheEntry *pEntry;
 	rsRetVal localRet;
 	dynaFileCacheEntry **pCache;
 	DEFiRet;
@@ -678,39 +979,22 @@ prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__
 	if(   (pData->iCurrElt != -1)
 	   && !ustrcmp(newFileName, pCache[pData->iCurrElt]->pName)) {
 	   	/* great, we are all set */
-		pCache[pData->iCurrElt]->clkTickAccessed = getClockFileAccess();
+		dynaFileLRUTouch(pData, pCache[pData->iCurrElt]);
 		STATSCOUNTER_INC(pData->ctrLevel0, pData->mutCtrLevel0);
-		/* LRU needs only a strictly monotonically increasing counter, so such a one could do */
 		FINALIZE;
 	}
 
-	/* ok, no luck. Now let's search the table if we find a matching spot.
-	 * While doing so, we also prepare for creation of a new one.
-	 */
+	/* ok, no luck. Now let's see if the file is in the cache */
 	pData->iCurrElt = -1;	/* invalid current element pointer */
-	iFirstFree = -1; /* not yet found */
-	iOldest = 0; /* we assume the first element to be the oldest - that will change as we loop */
-	ctOldest = getClockFileAccess(); /* there must always be an older one */
-	for(i = 0 ; i < pData->iCurrCacheSize ; ++i) {
-		if(pCache[i] == NULL || pCache[i]->pName == NULL) {
-			if(iFirstFree == -1)
-				iFirstFree = i;
-		} else { /* got an element, let's see if it matches */
-			if(!ustrcmp(newFileName, pCache[i]->pName)) {
-				/* we found our element! */
-				pData->pStrm = pCache[i]->pStrm;
-				if(pData->useSigprov)
-					pData->sigprovFileData = pCache[i]->sigprovFileData;
-				pData->iCurrElt = i;
-				pCache[i]->clkTickAccessed = getClockFileAccess(); /* update "timestamp" for LRU */
-				FINALIZE;
-			}
-			/* did not find it - so lets keep track of the counters for LRU */
-			if(pCache[i]->clkTickAccessed < ctOldest) {
-				ctOldest = pCache[i]->clkTickAccessed;
-				iOldest = i;
-				}
-		}
+	pEntry = hashtable_search(pData->dynCacheHt, (void*) newFileName);
+	if(pEntry != NULL) {
+		/* we found our element! */
+		pData->pStrm = pEntry->pStrm;
+		if(pData->useSigprov)
+			pData->sigprovFileData = pEntry->sigprovFileData;
+		pData->iCurrElt = pEntry->iIdx;
+		dynaFileLRUTouch(pData, pEntry);
+		FINALIZE;
 	}
 
 	/* we have not found an entry */
@@ -729,23 +1013,26 @@ prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__
 	 */
 	pData->pStrm = NULL, pData->sigprovFileData = NULL;
 
-	if(iFirstFree == -1 && (pData->iCurrCacheSize < pData->iDynaFileCacheSize)) {
-		/* there is space left, so set it to that index */
-		iFirstFree = pData->iCurrCacheSize++;
-		STATSCOUNTER_SETMAX_NOMUT(pData->ctrMax, (unsigned) pData->iCurrCacheSize);
-	}
-
 	/* Note that the following code sequence does not work with the cache entry itself,
 	 * but rather with pData->pStrm, the (sole) stream pointer in the non-dynafile case.
 	 * The cache array is only updated after the open was successful. -- rgerhards, 2010-03-21
 	 */
-	if(iFirstFree == -1) {
-		dynaFileDelCacheEntry(pData, iOldest, 0);
-		STATSCOUNTER_INC(pData->ctrEvict, pData->mutCtrEvict);
-		iFirstFree = iOldest; /* this one *is* now free ;) */
+	if(pData->pFreeEntries != NULL) {
+		/* re-use an entry whose file could not be opened */
+		pEntry = pData->pFreeEntries;
+		pData->pFreeEntries = pEntry->pNext;
+		pEntry->pNext = NULL;
+	} else if(pData->iCurrCacheSize < pData->iDynaFileCacheSize) {
+		/* there is space left, so we need to allocate memory for the cache structure */
+		CHKmalloc(pEntry = (dynaFileCacheEntry*) calloc(1, sizeof(dynaFileCacheEntry)));
+		pEntry->iIdx = pData->iCurrCacheSize;
+		pCache[pData->iCurrCacheSize++] = pEntry;
+		STATSCOUNTER_SETMAX_NOMUT(pData->ctrMax, (unsigned) pData->iCurrCacheSize);
 	} else {
-		/* we need to allocate memory for the cache structure */
-		CHKmalloc(pCache[iFirstFree] = (dynaFileCacheEntry*) calloc(1, sizeof(dynaFileCacheEntry)));
+		pEntry = pData->pLRUTail;
+		dynaFileDelCacheEntry(pData, pEntry->iIdx, 0,
+				      closerUsable(pData) ? DYNAFILE_CLOSE_ASYNC : 0);
+		STATSCOUNTER_INC(pData->ctrEvict, pData->mutCtrEvict);
 	}
 
 	/* Ok, we finally can open the file */
@@ -757,24 +1044,276 @@ prepareDynFile(instanceData *__restrict__ const pData, const uchar *__restrict__
 		 * will take care of too-frequent error messages.
 		 */
 		errmsg.LogError(0, localRet, "Could not open dynamic file '%s' [state %d] - discarding message", newFileName, localRet);
+		pEntry->pNext = pData->pFreeEntries;
+		pData->pFreeEntries = pEntry;
 		ABORT_FINALIZE(localRet);
 	}
 
-	if((pCache[iFirstFree]->pName = ustrdup(newFileName)) == NULL) {
+	if((pEntry->pName = ustrdup(newFileName)) == NULL) {
 		closeFile(pData); /* need to free failed entry! */
+		pEntry->pNext = pData->pFreeEntries;
+		pData->pFreeEntries = pEntry;
 		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 	}
-	pCache[iFirstFree]->pStrm = pData->pStrm;
+	if(!hashtable_insert(pData->dynCacheHt, pEntry->pName, pEntry)) {
+		d_free(pEntry->pName);
+		pEntry->pName = NULL;
+		closeFile(pData); /* need to free failed entry! */
+		pEntry->pNext = pData->pFreeEntries;
+		pData->pFreeEntries = pEntry;
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	pEntry->pStrm = pData->pStrm;
+	pEntry->memSize = pEntry->pStrm->memSize;
+	memacctAdd(MEMACCT_DYNAFILE, pEntry->memSize);
 	if(pData->useSigprov)
-		pCache[iFirstFree]->sigprovFileData = pData->sigprovFileData;
-	pCache[iFirstFree]->clkTickAccessed = getClockFileAccess();
-	pData->iCurrElt = iFirstFree;
-	DBGPRINTF("Added new entry %d for file cache, file '%s'.\n", iFirstFree, newFileName);
+		pEntry->sigprovFileData = pData->sigprovFileData;
+	dynaFileLRUPushFront(pData, pEntry);
+	pData->iCurrElt = pEntry->iIdx;
+	DBGPRINTF("Added new entry %d for file cache, file '%s'.\n", pEntry->iIdx, newFileName);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* The shared dynafile cache. Actions with shareddynafilecache="on" do not
+ * use their own cache, but a process-wide one, so that a file written by
+ * several actions is opened only once, and a single size limit applies to
+ * all of them. Each entry has its own write lock, as different actions may
+ * write to it concurrently. An action holds a reference to the entry it
+ * currently writes to; the reference is dropped when the action switches
+ * files and at the end of each transaction. Only unreferenced entries are
+ * evicted, in LRU order. The first action that opens a file determines
+ * the stream settings (zip, sync, ...), so all actions sharing files must
+ * use compatible settings.
+ */
+struct sharedStrm_s {
+	uchar	*pName;		/* file name, owned by the hash table */
+	strm_t	*pStrm;
+	size_t	memSize;	/* stream buffer memory, as reported to memacct */
+	pthread_mutex_t mut;	/* serializes writes from different actions */
+	int	nRefs;		/* number of actions currently using the entry */
+	sbool	bCloseOnRelease;/* HUP: close as soon as the last reference is gone */
+	struct sharedStrm_s *pPrev, *pNext; /* LRU list, most recently used first */
+};
+
+static struct {
+	pthread_mutex_t mut;
+	struct hashtable *ht;
+	sharedStrm_t *pLRUHead, *pLRUTail;
+	int nEntries;
+} sharedCache;
+
+
+static inline void
+sharedCacheLRUUnlink(sharedStrm_t *const pEntry)
+{
+	if(pEntry->pPrev == NULL)
+		sharedCache.pLRUHead = pEntry->pNext;
+	else
+		pEntry->pPrev->pNext = pEntry->pNext;
+	if(pEntry->pNext == NULL)
+		sharedCache.pLRUTail = pEntry->pPrev;
+	else
+		pEntry->pNext->pPrev = pEntry->pPrev;
+	pEntry->pPrev = pEntry->pNext = NULL;
+}
+
+static inline void
+sharedCacheLRUPushFront(sharedStrm_t *const pEntry)
+{
+	pEntry->pPrev = NULL;
+	pEntry->pNext = sharedCache.pLRUHead;
+	if(sharedCache.pLRUHead == NULL)
+		sharedCache.pLRUTail = pEntry;
+	else
+		sharedCache.pLRUHead->pPrev = pEntry;
+	sharedCache.pLRUHead = pEntry;
+}
+
+
+/* close a shared file and remove it from the cache. Must be called with
+ * the cache mutex held and only for unreferenced entries.
+ */
+static void
+sharedCacheDelEntry(sharedStrm_t *const pEntry)
+{
+	DBGPRINTF("omfile: removing '%s' from shared dynafile cache\n", pEntry->pName);
+	sharedCacheLRUUnlink(pEntry);
+	hashtable_remove(sharedCache.ht, pEntry->pName); /* frees the name */
+	memacctSub(MEMACCT_DYNAFILE, pEntry->memSize);
+	strm.Destruct(&pEntry->pStrm);
+	pthread_mutex_destroy(&pEntry->mut);
+	free(pEntry);
+	--sharedCache.nEntries;
+}
+
+
+/* drop the action's reference to its current shared file */
+static void
+sharedCacheRelease(instanceData *__restrict__ const pData)
+{
+	sharedStrm_t *const pEntry = pData->pCurrShared;
+
+	if(pEntry == NULL)
+		return;
+	pthread_mutex_lock(&sharedCache.mut);
+	if(--pEntry->nRefs == 0 && pEntry->bCloseOnRelease)
+		sharedCacheDelEntry(pEntry);
+	pthread_mutex_unlock(&sharedCache.mut);
+	pData->pCurrShared = NULL;
+	pData->pStrm = NULL;
+}
+
+
+/* close all shared files (HUP and shutdown). Files that are currently in
+ * use by an action are closed when the action releases them.
+ */
+static void
+sharedCacheCloseAll(void)
+{
+	sharedStrm_t *pEntry, *pNext;
+
+	pthread_mutex_lock(&sharedCache.mut);
+	for(pEntry = sharedCache.pLRUHead ; pEntry != NULL ; pEntry = pNext) {
+		pNext = pEntry->pNext;
+		if(pEntry->nRefs == 0)
+			sharedCacheDelEntry(pEntry);
+		else
+			pEntry->bCloseOnRelease = 1;
+	}
+	pthread_mutex_unlock(&sharedCache.mut);
+}
+
+
+/* counterpart of prepareDynFile() for the shared cache: make the shared
+ * stream for newFileName the action's current one, opening it if needed.
+ */
+static rsRetVal
+sharedCacheSelect(instanceData *__restrict__ const pData, const uchar *__restrict__ const newFileName)
+{
+	sharedStrm_t *pEntry;
+	sharedStrm_t *pVictim;
+	uchar *pName;
+	rsRetVal localRet;
+	DEFiRet;
+
+	if(pData->pCurrShared != NULL) {
+		if(!ustrcmp(newFileName, pData->pCurrShared->pName)) {
+			STATSCOUNTER_INC(pData->ctrLevel0, pData->mutCtrLevel0);
+			FINALIZE;
+		}
+		sharedCacheRelease(pData);
+	}
+	pData->pStrm = NULL;
+
+	pthread_mutex_lock(&sharedCache.mut);
+	pEntry = hashtable_search(sharedCache.ht, (void*) newFileName);
+	if(pEntry == NULL) {
+		STATSCOUNTER_INC(pData->ctrMiss, pData->mutCtrMiss);
+		/* make room by closing the least recently used idle files */
+		pVictim = sharedCache.pLRUTail;
+		while(sharedCache.nEntries >= runModConf->iSharedCacheSize && pVictim != NULL) {
+			if(pVictim->nRefs == 0) {
+				pEntry = pVictim->pPrev;
+				sharedCacheDelEntry(pVictim);
+				STATSCOUNTER_INC(pData->ctrEvict, pData->mutCtrEvict);
+				pVictim = pEntry;
+			} else {
+				pVictim = pVictim->pPrev;
+			}
+		}
+		localRet = prepareFile(pData, newFileName);
+		if(localRet != RS_RET_OK) {
+			pthread_mutex_unlock(&sharedCache.mut);
+			errmsg.LogError(0, localRet, "Could not open dynamic file '%s' [state %d] - "
+					"discarding message", newFileName, localRet);
+			ABORT_FINALIZE(localRet);
+		}
+		if(   (pEntry = calloc(1, sizeof(sharedStrm_t))) == NULL
+		   || (pName = ustrdup(newFileName)) == NULL) {
+			free(pEntry);
+			closeFile(pData);
+			pthread_mutex_unlock(&sharedCache.mut);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		if(!hashtable_insert(sharedCache.ht, pName, pEntry)) {
+			free(pName);
+			free(pEntry);
+			closeFile(pData);
+			pthread_mutex_unlock(&sharedCache.mut);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		pEntry->pName = pName;
+		pEntry->pStrm = pData->pStrm;
+		pEntry->memSize = pEntry->pStrm->memSize;
+		memacctAdd(MEMACCT_DYNAFILE, pEntry->memSize);
+		pthread_mutex_init(&pEntry->mut, NULL);
+		sharedCacheLRUPushFront(pEntry);
+		++sharedCache.nEntries;
+		DBGPRINTF("omfile: added '%s' to shared dynafile cache, %d entries\n",
+			  newFileName, sharedCache.nEntries);
+	} else if(sharedCache.pLRUHead != pEntry) {
+		sharedCacheLRUUnlink(pEntry);
+		sharedCacheLRUPushFront(pEntry);
+	}
+	++pEntry->nRefs;
+	pthread_mutex_unlock(&sharedCache.mut);
+
+	pData->pCurrShared = pEntry;
+	pData->pStrm = pEntry->pStrm;
 
 finalize_it:
 	RETiRet;
 }
 
+/* serialize access to the current stream if it is shared with other actions */
+static inline void
+sharedStrmLock(instanceData *__restrict__ const pData)
+{
+	if(pData->pCurrShared != NULL)
+		pthread_mutex_lock(&pData->pCurrShared->mut);
+}
+
+static inline void
+sharedStrmUnlock(instanceData *__restrict__ const pData)
+{
+	if(pData->pCurrShared != NULL)
+		pthread_mutex_unlock(&pData->pCurrShared->mut);
+}
+
+
+/* Outchannel size limit, if the closer is used: when the current file has
+ * reached the limit, it is handed over to the closer, which closes it
+ * and runs the size limit command. The file is reopened by the next write.
+ */
+static void
+sizeLimitCheck(instanceData *__restrict__ const pData)
+{
+	dynaFileCacheEntry *pEntry;
+	int64 offs;
+
+	if(pData->iSizeLimit == 0 || pData->pszSizeLimitCmd == NULL
+	   || pData->pStrm == NULL || !closerUsable(pData))
+		return;
+	if(strm.GetCurrOffset(pData->pStrm, &offs) != RS_RET_OK || offs < pData->iSizeLimit)
+		return;
+
+	if(pData->bDynamicName) {
+		if(pData->iCurrElt == -1)
+			return;
+		pEntry = pData->dynCache[pData->iCurrElt];
+		dynaFileDelCacheEntry(pData, pEntry->iIdx, 0, DYNAFILE_ROTATE);
+		pEntry->pNext = pData->pFreeEntries;
+		pData->pFreeEntries = pEntry;
+		pData->iCurrElt = -1;
+		pData->pStrm = NULL;
+	} else {
+		closerSubmit(pData, &pData->pStrm, pData->fname, 1);
+	}
+}
+
 
 /* do the actual write process. This function is to be called once we are ready for writing.
  * It will do buffered writes and persist data only when the buffer is full. Note that we must
@@ -791,10 +1330,14 @@ doWrite(instanceData *__restrict__ const pData, uchar *__restrict__ const pszBuf
 	DBGPRINTF("omfile: write to stream, pData->pStrm %p, lenBuf %d, strt data %.128s\n",
 		  pData->pStrm, lenBuf, pszBuf);
 	if(pData->pStrm != NULL){
-		CHKiRet(strm.Write(pData->pStrm, pszBuf, lenBuf));
+		sharedStrmLock(pData);
+		iRet = strm.Write(pData->pStrm, pszBuf, lenBuf);
+		sharedStrmUnlock(pData);
+		CHKiRet(iRet);
 		if(pData->useSigprov) {
 			CHKiRet(pData->sigprov.OnRecordWrite(pData->sigprovFileData, pszBuf, lenBuf));
 		}
+		sizeLimitCheck(pData);
 	}
 
 finalize_it:
@@ -802,22 +1345,27 @@ finalize_it:
 }
 
 
-/* rgerhards 2004-11-11: write to a file output.  */
+/* make sure pData->pStrm is the stream for the given message */
 static rsRetVal
-writeFile(instanceData *__restrict__ const pData,
-	  const actWrkrIParams_t *__restrict__ const pParam,
-	  const int iMsg)
+selectFile(instanceData *__restrict__ const pData,
+	   const actWrkrIParams_t *__restrict__ const pParam,
+	   const int iMsg)
 {
 	DEFiRet;
 
-	STATSCOUNTER_INC(pData->ctrRequests, pData->mutCtrRequests);
 	/* first check if we have a dynamic file name and, if so,
 	 * check if it still is ok or a new file needs to be created
 	 */
 	if(pData->bDynamicName) {
 		DBGPRINTF("omfile: file to log to: %s\n",
 			  actParam(pParam, pData->iNumTpls, iMsg, 1).param);
+		if(pData->bSharedCache) {
+			CHKiRet(sharedCacheSelect(pData, actParam(pParam, pData->iNumTpls, iMsg, 1).param));
+			FINALIZE;
+		}
 		CHKiRet(prepareDynFile(pData, actParam(pParam, pData->iNumTpls, iMsg, 1).param));
+		if(pData->bGroupSync && pData->iCurrElt != -1)
+			groupSyncAddPending(pData, pData->dynCache[pData->iCurrElt]);
 	} else { /* "regular", non-dynafile */
 		if(pData->pStrm == NULL) {
 			CHKiRet(prepareFile(pData, pData->fname));
@@ -828,6 +1376,21 @@ writeFile(instanceData *__restrict__ const pData,
 		}
 	}
 
+finalize_it:
+	RETiRet;
+}
+
+
+/* rgerhards 2004-11-11: write to a file output.  */
+static rsRetVal
+writeFile(instanceData *__restrict__ const pData,
+	  const actWrkrIParams_t *__restrict__ const pParam,
+	  const int iMsg)
+{
+	DEFiRet;
+
+	STATSCOUNTER_INC(pData->ctrRequests, pData->mutCtrRequests);
+	CHKiRet(selectFile(pData, pParam, iMsg));
 	CHKiRet(doWrite(pData,
 		 	actParam(pParam, pData->iNumTpls, iMsg, 0).param,
 		 	actParam(pParam, pData->iNumTpls, iMsg, 0).lenStr));
@@ -837,6 +1400,305 @@ finalize_it:
 }
 
 
+/* write a whole transaction. Consecutive records for the same file are
+ * gathered and handed over to the stream in one WriteV() call, which
+ * either copies them into the stream buffer or, if the buffer would
+ * overflow, writes buffer and records with a single writev(). Pending
+ * records are always written before the file is switched, because a
+ * dynafile cache eviction may destruct the stream they belong to.
+ * Errors for individual records are ignored, as in the non-batched case.
+ */
+#define WRITEV_MAX_RECORDS 256
+static rsRetVal
+writeFileIov(instanceData *__restrict__ const pData, strm_t *const pStrm,
+	     struct iovec *const iov, const int nIov)
+{
+	DEFiRet;
+	sharedStrmLock(pData);
+	iRet = strm.WriteV(pStrm, iov, nIov);
+	sharedStrmUnlock(pData);
+	if(pStrm == pData->pStrm)
+		sizeLimitCheck(pData);
+	RETiRet;
+}
+
+static rsRetVal
+writeFileBatch(instanceData *__restrict__ const pData,
+	       const actWrkrIParams_t *__restrict__ const pParams,
+	       const unsigned nParams)
+{
+	struct iovec iov[WRITEV_MAX_RECORDS];
+	strm_t *pStrmBatch = NULL;
+	const uchar *fname;
+	const uchar *fnameCurr;
+	int nIov = 0;
+	unsigned i;
+	DEFiRet;
+
+	for(i = 0 ; i < nParams ; ++i) {
+		STATSCOUNTER_INC(pData->ctrRequests, pData->mutCtrRequests);
+		if(nIov > 0 && pData->bDynamicName) {
+			fname = actParam(pParams, pData->iNumTpls, i, 1).param;
+			if(pData->bSharedCache)
+				fnameCurr = (pData->pCurrShared == NULL) ? NULL : pData->pCurrShared->pName;
+			else
+				fnameCurr = (pData->iCurrElt == -1) ? NULL : pData->dynCache[pData->iCurrElt]->pName;
+			if(fnameCurr == NULL || ustrcmp(fname, fnameCurr)) {
+				writeFileIov(pData, pStrmBatch, iov, nIov);
+				nIov = 0;
+			}
+		}
+		if(nIov == WRITEV_MAX_RECORDS) {
+			/* before selectFile(), as the write may rotate the file */
+			writeFileIov(pData, pStrmBatch, iov, nIov);
+			nIov = 0;
+		}
+		if(selectFile(pData, pParams, i) != RS_RET_OK || pData->pStrm == NULL)
+			continue;
+		pStrmBatch = pData->pStrm;
+		iov[nIov].iov_base = actParam(pParams, pData->iNumTpls, i, 0).param;
+		iov[nIov].iov_len = actParam(pParams, pData->iNumTpls, i, 0).lenStr;
+		++nIov;
+	}
+	if(nIov > 0)
+		CHKiRet(writeFileIov(pData, pStrmBatch, iov, nIov));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* Group sync. With sync="on" and sync.group="on", files are not synced on
+ * each write. Instead, all files written during a transaction are synced
+ * when it is committed, and the commit does not return before that has
+ * happened. Commits of all omfile actions are funneled through a single
+ * coordinator: the first committer becomes the leader, waits up to
+ * sync.interval ms for others to join, and then syncs the whole batch,
+ * either with parallel fdatasync() calls or with one syncfs() per file
+ * system. Syncing is done on duplicates of the file descriptors, so that
+ * no action lock needs to be held while we wait for the disk.
+ */
+static struct {
+	pthread_mutex_t mut;
+	pthread_cond_t batchDone;
+	int *fds;		/* descriptors collected for the next batch */
+	int nFds;
+	int maxFds;
+	uint64 genOpen;		/* generation of the batch currently being collected */
+	uint64 genDone;		/* last generation that has been synced */
+	sbool bBusy;		/* is a leader currently working on a batch? */
+} syncCoord;
+
+typedef struct {
+	int *fds;
+	int nFds;
+	int iNext;		/* next descriptor to sync */
+	pthread_mutex_t mut;	/* guards iNext (cheap compared to a sync) */
+} syncBatch_t;
+
+static void
+syncBatchRun(syncBatch_t *const pBatch)
+{
+	int i;
+
+	while(1) {
+		pthread_mutex_lock(&pBatch->mut);
+		i = pBatch->iNext++;
+		pthread_mutex_unlock(&pBatch->mut);
+		if(i >= pBatch->nFds)
+			break;
+#		if HAVE_FDATASYNC
+		if(fdatasync(pBatch->fds[i]) != 0)
+#		else
+		if(fsync(pBatch->fds[i]) != 0)
+#		endif
+			DBGPRINTF("omfile: group sync of fd %d failed, errno %d - ignored\n",
+				  pBatch->fds[i], errno);
+	}
+}
+
+static void *
+syncBatchThread(void *arg)
+{
+	syncBatchRun((syncBatch_t*) arg);
+	return NULL;
+}
+
+/* sync a batch of descriptors and close them */
+static void
+syncBatchDo(int *const fds, const int nFds)
+{
+	syncBatch_t batch;
+	pthread_t thrd[64];
+	int nThrds;
+	int i;
+
+#	ifdef HAVE_SYNCFS
+	if(runModConf->bSyncFS) {
+		struct stat st;
+		dev_t *devs;
+		int nDevs = 0;
+		int j;
+
+		if((devs = malloc(nFds * sizeof(dev_t))) != NULL) {
+			for(i = 0 ; i < nFds ; ++i) {
+				if(fstat(fds[i], &st) != 0)
+					continue;
+				for(j = 0 ; j < nDevs && devs[j] != st.st_dev ; ++j)
+					/* just search */;
+				if(j < nDevs)
+					continue;
+				devs[nDevs++] = st.st_dev;
+				if(syncfs(fds[i]) != 0)
+					DBGPRINTF("omfile: syncfs via fd %d failed, errno %d - ignored\n",
+						  fds[i], errno);
+			}
+			free(devs);
+			goto done;
+		}
+		/* out of memory: fall back to per-file syncs */
+	}
+#	endif
+
+	batch.fds = fds;
+	batch.nFds = nFds;
+	batch.iNext = 0;
+	pthread_mutex_init(&batch.mut, NULL);
+	nThrds = runModConf->iSyncThreads - 1; /* the leader itself also syncs */
+	if(nThrds > nFds - 1)
+		nThrds = nFds - 1;
+	if(nThrds > (int) (sizeof(thrd)/sizeof(pthread_t)))
+		nThrds = sizeof(thrd)/sizeof(pthread_t);
+	for(i = 0 ; i < nThrds ; ++i) {
+		if(pthread_create(&thrd[i], NULL, syncBatchThread, &batch) != 0)
+			break;
+	}
+	nThrds = i;
+	syncBatchRun(&batch);
+	for(i = 0 ; i < nThrds ; ++i)
+		pthread_join(thrd[i], NULL);
+	pthread_mutex_destroy(&batch.mut);
+
+#	ifdef HAVE_SYNCFS
+done:
+#	endif
+	for(i = 0 ; i < nFds ; ++i)
+		close(fds[i]);
+}
+
+/* hand over descriptors to the coordinator and wait until they are synced.
+ * The descriptors are closed by the coordinator.
+ */
+static rsRetVal
+syncCoordSubmit(const int *const fds, const int nFds)
+{
+	int *newFds;
+	int *batchFds;
+	int nBatchFds;
+	uint64 myGen;
+	uint64 batchGen;
+	int i;
+	DEFiRet;
+
+	pthread_mutex_lock(&syncCoord.mut);
+	if(syncCoord.nFds + nFds > syncCoord.maxFds) {
+		newFds = realloc(syncCoord.fds, (syncCoord.nFds + nFds + 64) * sizeof(int));
+		if(newFds == NULL) {
+			pthread_mutex_unlock(&syncCoord.mut);
+			/* we can not batch, but we still must not ack unsynced data */
+			syncBatchDo((int*) fds, nFds);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		syncCoord.fds = newFds;
+		syncCoord.maxFds = syncCoord.nFds + nFds + 64;
+	}
+	for(i = 0 ; i < nFds ; ++i)
+		syncCoord.fds[syncCoord.nFds++] = fds[i];
+	myGen = syncCoord.genOpen;
+
+	while(syncCoord.genDone < myGen) {
+		if(syncCoord.bBusy) {
+			pthread_cond_wait(&syncCoord.batchDone, &syncCoord.mut);
+			continue;
+		}
+		/* we become the leader for the open batch */
+		syncCoord.bBusy = 1;
+		if(runModConf->iSyncInterval > 0) {
+			pthread_mutex_unlock(&syncCoord.mut);
+			srSleep(runModConf->iSyncInterval / 1000, (runModConf->iSyncInterval % 1000) * 1000);
+			pthread_mutex_lock(&syncCoord.mut);
+		}
+		batchFds = syncCoord.fds;
+		nBatchFds = syncCoord.nFds;
+		batchGen = syncCoord.genOpen++;
+		syncCoord.fds = NULL;
+		syncCoord.nFds = syncCoord.maxFds = 0;
+		pthread_mutex_unlock(&syncCoord.mut);
+
+		DBGPRINTF("omfile: group sync of %d files, generation %llu\n", nBatchFds,
+			  (unsigned long long) batchGen);
+		syncBatchDo(batchFds, nBatchFds);
+		free(batchFds);
+
+		pthread_mutex_lock(&syncCoord.mut);
+		syncCoord.genDone = batchGen;
+		syncCoord.bBusy = 0;
+		pthread_cond_broadcast(&syncCoord.batchDone);
+	}
+	pthread_mutex_unlock(&syncCoord.mut);
+
+finalize_it:
+	RETiRet;
+}
+
+
+
+/* flush all files written in the current transaction and obtain the
+ * descriptors to sync. Must be called with mutWrite held. Dynafiles
+ * that were evicted in between have already been synced on close.
+ */
+static rsRetVal
+groupSyncCollect(instanceData *__restrict__ const pData, int **ppFds, int *pnFds)
+{
+	dynaFileCacheEntry *pEntry;
+	int *fds = NULL;
+	int nFds = 0;
+	int n;
+	int fd;
+	DEFiRet;
+
+	if(pData->bDynamicName) {
+		n = 0;
+		for(pEntry = pData->pSyncPend ; pEntry != NULL ; pEntry = pEntry->pSyncNext)
+			++n;
+		if(n > 0)
+			fds = malloc(n * sizeof(int));
+		while((pEntry = pData->pSyncPend) != NULL) {
+			pData->pSyncPend = pEntry->pSyncNext;
+			pEntry->pSyncNext = NULL;
+			pEntry->bSyncPending = 0;
+			if(pEntry->pStrm == NULL)
+				continue;
+			strm.Flush(pEntry->pStrm);
+			if(fds != NULL && (fd = strmGroupSyncBegin(pEntry->pStrm)) != -1)
+				fds[nFds++] = fd;
+		}
+		if(n > 0 && fds == NULL)
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	} else if(pData->pStrm != NULL) {
+		CHKmalloc(fds = malloc(sizeof(int)));
+		strm.Flush(pData->pStrm);
+		if((fd = strmGroupSyncBegin(pData->pStrm)) != -1)
+			fds[nFds++] = fd;
+	}
+
+finalize_it:
+	*ppFds = fds;
+	*pnFds = nFds;
+	RETiRet;
+}
+
+
 BEGINbeginCnfLoad
 CODESTARTbeginCnfLoad
 	loadModConf = pModConf;
@@ -848,10 +1710,16 @@ CODESTARTbeginCnfLoad
 	pModConf->dirUID = -1;
 	pModConf->fileGID = -1;
 	pModConf->dirGID = -1;
+	pModConf->iSyncInterval = 0;
+	pModConf->iSyncThreads = 4;
+	pModConf->bSyncFS = 0;
+	pModConf->iSharedCacheSize = 1000;
+	pModConf->bAsyncClose = 1;
 ENDbeginCnfLoad
 
 BEGINsetModCnf
 	struct cnfparamvals *pvals = NULL;
+	char *cstr;
 	int i;
 CODESTARTsetModCnf
 	pvals = nvlstGetParams(lst, &modpblk, NULL);
@@ -898,6 +1766,30 @@ CODESTARTsetModCnf
 			loadModConf->fileGID = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "filegroupnum")) {
 			loadModConf->fileGID = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "shareddynafilecachesize")) {
+			loadModConf->iSharedCacheSize = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "asyncclose")) {
+			loadModConf->bAsyncClose = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "sync.interval")) {
+			loadModConf->iSyncInterval = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "sync.threads")) {
+			loadModConf->iSyncThreads = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "sync.mode")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(!strcasecmp(cstr, "fdatasync")) {
+				loadModConf->bSyncFS = 0;
+			} else if(!strcasecmp(cstr, "syncfs")) {
+#				ifdef HAVE_SYNCFS
+				loadModConf->bSyncFS = 1;
+#				else
+				errmsg.LogError(0, RS_RET_NOT_IMPLEMENTED, "omfile: sync.mode \"syncfs\" "
+						"is not available on this platform, using fdatasync");
+#				endif
+			} else {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "omfile: invalid value for "
+						"'sync.mode' parameter (given is '%s')", cstr);
+			}
+			free(cstr);
 		} else {
 			dbgprintf("omfile: program error, non-handled "
 			  "param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
@@ -947,6 +1839,8 @@ BEGINfreeInstance
 CODESTARTfreeInstance
 	free(pData->tplName);
 	free(pData->fname);
+	free(pData->pszCmprDict);
+	sharedCacheRelease(pData);
 	if(pData->bDynamicName) {
 		dynaFileFreeCache(pData);
 	} else if(pData->pStrm != NULL)
@@ -984,27 +1878,61 @@ CODESTARTbeginTransaction
 ENDbeginTransaction
 
 
-BEGINcommitTransaction
+BEGINcommitBatch
 	instanceData *__restrict__ const pData = pWrkrData->pData;
 	unsigned i;
-CODESTARTcommitTransaction
+	rsRetVal localRet;
+	int *syncFds = NULL;
+	int nSyncFds = 0;
+CODESTARTcommitBatch
 	pthread_mutex_lock(&pData->mutWrite);
 
-	for(i = 0 ; i < nParams ; ++i) {
-		writeFile(pData, pParams, i);
+	if(pData->useSigprov) {
+		/* signature providers need to see each record as it is written.
+		 * A record we could not write (e.g. the dynafile can not be
+		 * opened) is reported as failed, retrying would not help.
+		 */
+		for(i = 0 ; i < nParams ; ++i) {
+			localRet = writeFile(pData, pParams, i);
+			if(localRet != RS_RET_OK)
+				pResults[i] = (localRet == RS_RET_SUSPENDED) ? RS_RET_ERR : localRet;
+		}
+	} else {
+		writeFileBatch(pData, pParams, nParams);
 	}
 	/* Note: pStrm may be NULL if there was an error opening the stream */
-	if(pData->bFlushOnTXEnd && pData->pStrm != NULL) {
+	if(pData->bGroupSync) {
+		/* data must be on disk before we ack, so we always flush */
+		CHKiRet(groupSyncCollect(pData, &syncFds, &nSyncFds));
+	} else if(pData->bFlushOnTXEnd && pData->pStrm != NULL) {
 		/* if we have an async writer, it controls the flush via
 		 * a timeout. However, without it, we actually need to flush,
 		 * else incomplete records are written.
 		 */
-		if(!pData->bUseAsyncWriter)
-			CHKiRet(strm.Flush(pData->pStrm));
+		if(!pData->bUseAsyncWriter) {
+			sharedStrmLock(pData);
+			iRet = strm.Flush(pData->pStrm);
+			sharedStrmUnlock(pData);
+			CHKiRet(iRet);
+		}
 	}
 finalize_it:
+	/* shared files are only referenced during a transaction */
+	sharedCacheRelease(pData);
 	pthread_mutex_unlock(&pData->mutWrite);
-ENDcommitTransaction
+	if(nSyncFds > 0) {
+		localRet = syncCoordSubmit(syncFds, nSyncFds);
+		if(iRet == RS_RET_OK)
+			iRet = localRet;
+	}
+	free(syncFds);
+	if(iRet == RS_RET_OK) {
+		for(i = 0 ; i < nParams ; ++i) {
+			if(pResults[i] == RS_RET_SUSPENDED)
+				pResults[i] = RS_RET_OK;
+		}
+	}
+ENDcommitBatch
 
 
 static inline void
@@ -1012,6 +1940,8 @@ setInstParamDefaults(instanceData *__restrict__ const pData)
 {
 	pData->fname = NULL;
 	pData->tplName = NULL;
+	pData->bSharedCache = 0;
+	pData->pCurrShared = NULL;
 	pData->fileUID = loadModConf->fileUID;
 	pData->fileGID = loadModConf->fileGID;
 	pData->dirUID = loadModConf->dirUID;
@@ -1022,8 +1952,13 @@ setInstParamDefaults(instanceData *__restrict__ const pData)
 	pData->fDirCreateMode = loadModConf->fDirCreateMode;
 	pData->bCreateDirs = 1;
 	pData->bSyncFile = 0;
+	pData->bGroupSync = 0;
+	pData->iPreallocExtent = 0;
 	pData->iZipLevel = 0;
 	pData->bVeryRobustZip = 0;
+	pData->iZipWorkers = 0;
+	pData->iCmprAlgo = CMPR_ALGO_NONE;
+	pData->pszCmprDict = NULL;
 	pData->bFlushOnTXEnd = FLUSHONTX_DFLT;
 	pData->iIOBufSize = IOBUF_DFLT_SIZE;
 	pData->iFlushInterval = FLUSH_INTRVL_DFLT;
@@ -1113,6 +2048,39 @@ initSigprov(instanceData *__restrict__ const pData, struct nvlst *lst)
 done:	return;
 }
 
+/* set the compression algorithm by name. "gzip" is handled by the
+ * traditional zip code (including zipworkers); all other algorithms
+ * go through the generic compression layer. Without a ziplevel, the
+ * algorithm's default level is used.
+ */
+static rsRetVal
+setCmprAlgo(instanceData *__restrict__ const pData, uchar *pszAlgo)
+{
+	int algo;
+	DEFiRet;
+
+	if(!bCmprIfLoaded) {
+		CHKiRet(objUse(cmpr, LM_CMPR_FILENAME));
+		bCmprIfLoaded = 1;
+	}
+	if(cmpr.GetAlgo(pszAlgo, &algo) != RS_RET_OK || !cmpr.IsSupported(algo)
+	   || algo == CMPR_ALGO_ZLIB) {
+		errmsg.LogError(0, RS_RET_CMPR_ALGO_UNSUPPORTED, "omfile: compression "
+				"algorithm '%s' is not supported", pszAlgo);
+		ABORT_FINALIZE(RS_RET_CMPR_ALGO_UNSUPPORTED);
+	}
+	if(algo == CMPR_ALGO_GZIP) {
+		if(pData->iZipLevel == 0)
+			pData->iZipLevel = 6; /* zlib default */
+	} else {
+		pData->iCmprAlgo = algo;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 static inline rsRetVal
 initCryprov(instanceData *__restrict__ const pData, struct nvlst *lst)
 {
@@ -1160,6 +2128,7 @@ finalize_it:
 BEGINnewActInst
 	struct cnfparamvals *pvals;
 	uchar *tplToUse;
+	char *cstr;
 	int i;
 CODESTARTnewActInst
 	DBGPRINTF("newActInst (omfile)\n");
@@ -1184,12 +2153,23 @@ CODESTARTnewActInst
 			continue;
 		if(!strcmp(actpblk.descr[i].name, "dynafilecachesize")) {
 			pData->iDynaFileCacheSize = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "shareddynafilecache")) {
+			pData->bSharedCache = (sbool) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "ziplevel")) {
 			pData->iZipLevel = (int) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "flushinterval")) {
 			pData->iFlushInterval = pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "veryrobustzip")) {
 			pData->bVeryRobustZip = pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "zipworkers")) {
+			pData->iZipWorkers = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "compression.algorithm")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			iRet = setCmprAlgo(pData, (uchar*) cstr);
+			free(cstr);
+			CHKiRet(iRet);
+		} else if(!strcmp(actpblk.descr[i].name, "compression.dictionary")) {
+			pData->pszCmprDict = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "asyncwriting")) {
 			pData->bUseAsyncWriter = pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "flushontxend")) {
@@ -1220,6 +2200,10 @@ CODESTARTnewActInst
 			pData->bFailOnChown = (int) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "sync")) {
 			pData->bSyncFile = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "sync.group")) {
+			pData->bGroupSync = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "preallocate.extent")) {
+			pData->iPreallocExtent = pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "createdirs")) {
 			pData->bCreateDirs = (int) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "file")) {
@@ -1248,6 +2232,34 @@ CODESTARTnewActInst
 		ABORT_FINALIZE(RS_RET_MISSING_CNFPARAMS);
 	}
 
+	if(pData->bGroupSync) {
+		if(!pData->bSyncFile) {
+			pData->bGroupSync = 0; /* nothing to sync */
+		} else if(pData->bUseAsyncWriter) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "omfile: sync.group can not be used "
+					"together with asyncwriting, asyncwriting disabled");
+			pData->bUseAsyncWriter = 0;
+		}
+	}
+
+	if(pData->bSharedCache) {
+		if(!pData->bDynamicName) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "omfile: shareddynafilecache can only "
+					"be used with dynafile, ignored");
+			pData->bSharedCache = 0;
+		} else if(   pData->sigprovName != NULL || pData->cryprovName != NULL
+			  || pData->bGroupSync) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "omfile: shareddynafilecache can not be "
+					"used together with sig.provider, cry.provider or sync.group, "
+					"shared cache disabled");
+			pData->bSharedCache = 0;
+		} else if(pData->bUseAsyncWriter) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "omfile: shareddynafilecache can not be "
+					"used together with asyncwriting, asyncwriting disabled");
+			pData->bUseAsyncWriter = 0;
+		}
+	}
+
 	if(pData->sigprovName != NULL) {
 		initSigprov(pData, lst);
 	}
@@ -1268,9 +2280,7 @@ CODESTARTnewActInst
 		pData->iNumTpls = 2;
 		// TODO: create unified code for this (legacy+v6 system)
 		/* we now allocate the cache table */
-		CHKmalloc(pData->dynCache = (dynaFileCacheEntry**)
-				calloc(pData->iDynaFileCacheSize, sizeof(dynaFileCacheEntry*)));
-		pData->iCurrElt = -1;		  /* no current element */
+		CHKiRet(dynaFileAllocCache(pData, pData->iDynaFileCacheSize));
 	}
 // TODO: add	pData->iSizeLimit = 0; /* default value, use outchannels to configure! */
 	setupInstStatsCtrs(pData);
@@ -1334,8 +2344,7 @@ CODESTARTparseSelectorAct
 		 */
 		CHKiRet(OMSRsetEntry(*ppOMSR, 1, ustrdup(pData->fname), OMSR_NO_RQD_TPL_OPTS));
 		/* we now allocate the cache table */
-		CHKmalloc(pData->dynCache = (dynaFileCacheEntry**)
-				calloc(cs.iDynaFileCacheSize, sizeof(dynaFileCacheEntry*)));
+		CHKiRet(dynaFileAllocCache(pData, cs.iDynaFileCacheSize));
 		break;
 
 	case '/':
@@ -1366,6 +2375,7 @@ CODESTARTparseSelectorAct
 	pData->iFlushInterval = cs.iFlushInterval;
 	pData->bUseAsyncWriter = cs.bUseAsyncWriter;
 	pData->bVeryRobustZip = 0;	/* cannot be specified via legacy conf */
+	pData->iZipWorkers = 0;		/* cannot be specified via legacy conf */
 	setupInstStatsCtrs(pData);
 CODE_STD_FINALIZERparseSelectorAct
 ENDparseSelectorAct
@@ -1400,7 +2410,12 @@ static rsRetVal resetConfigVariables(uchar __attribute__((unused)) *pp, void __a
 BEGINdoHUP
 CODESTARTdoHUP
 	pthread_mutex_lock(&pData->mutWrite);
-	if(pData->bDynamicName) {
+	/* files evicted before the HUP must be closed when we return */
+	closerDrain();
+	if(pData->bSharedCache) {
+		sharedCacheRelease(pData);
+		sharedCacheCloseAll();
+	} else if(pData->bDynamicName) {
 		dynaFileFreeCacheEntries(pData);
 	} else {
 		if(pData->pStrm != NULL) {
@@ -1416,13 +2431,26 @@ CODESTARTmodExit
 	objRelease(errmsg, CORE_COMPONENT);
 	objRelease(strm, CORE_COMPONENT);
 	objRelease(statsobj, CORE_COMPONENT);
-	DESTROY_ATOMIC_HELPER_MUT(mutClock);
+	if(bCmprIfLoaded)
+		objRelease(cmpr, LM_CMPR_FILENAME);
+	if(sharedCache.ht != NULL) {
+		sharedCacheCloseAll();
+		hashtable_destroy(sharedCache.ht, 0);
+	}
+	pthread_mutex_destroy(&sharedCache.mut);
+	closerStop();
+	pthread_cond_destroy(&closer.notEmpty);
+	pthread_cond_destroy(&closer.jobDone);
+	pthread_mutex_destroy(&closer.mut);
+	free(syncCoord.fds);
+	pthread_cond_destroy(&syncCoord.batchDone);
+	pthread_mutex_destroy(&syncCoord.mut);
 ENDmodExit
 
 
 BEGINqueryEtryPt
 CODESTARTqueryEtryPt
-CODEqueryEtryPt_STD_OMODTX_QUERIES
+CODEqueryEtryPt_STD_OMODBATCH_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
 CODEqueryEtryPt_STD_CONF2_QUERIES
 CODEqueryEtryPt_STD_CONF2_setModCnf_QUERIES
@@ -1439,8 +2467,12 @@ INITLegCnfVars
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
 	CHKiRet(objUse(strm, CORE_COMPONENT));
 	CHKiRet(objUse(statsobj, CORE_COMPONENT));
-
-	INIT_ATOMIC_HELPER_MUT(mutClock);
+	pthread_mutex_init(&syncCoord.mut, NULL);
+	pthread_mutex_init(&sharedCache.mut, NULL);
+	pthread_cond_init(&syncCoord.batchDone, NULL);
+	pthread_mutex_init(&closer.mut, NULL);
+	pthread_cond_init(&closer.notEmpty, NULL);
+	pthread_cond_init(&closer.jobDone, NULL);
 
 	INITChkCoreFeature(bCoreSupportsBatching, CORE_FEATURE_BATCHING);
 	DBGPRINTF("omfile: %susing transactional output interface.\n", bCoreSupportsBatching ? "" : "not ");
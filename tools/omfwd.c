@@ -37,6 +37,7 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <sys/socket.h>
 #ifdef USE_NETZIP
 #include <zlib.h>
 #endif
@@ -57,6 +58,8 @@
 #include "glbl.h"
 #include "errmsg.h"
 #include "unicode-helper.h"
+#include "cmpr.h"
+#include "statsobj.h"
 
 MODULE_TYPE_OUTPUT
 MODULE_TYPE_NOKEEP
@@ -71,14 +74,78 @@ DEFobjCurrIf(net)
 DEFobjCurrIf(netstrms)
 DEFobjCurrIf(netstrm)
 DEFobjCurrIf(tcpclt)
+DEFobjCurrIf(cmpr)
+DEFobjCurrIf(statsobj)
+
+static sbool bCmprIfLoaded = 0;	/* cmpr interface is only obtained if actually used */
 
 
 /* some local constants (just) for better readybility */
 #define IS_FLUSH 1
 #define NO_FLUSH 0
 
+#ifdef HAVE_SENDMMSG
+/* max number of datagrams we gather for a single sendmmsg() call */
+#define UDP_BATCH_MAX 256
+
+typedef struct udpBatchMsg_s {
+	struct iovec iov;	/* must be first, we get back here from the msghdr */
+	uchar *pBufFree;	/* buffer owned by the batch (compressed msg), else NULL */
+	sbool bSent;		/* successfully sent to at least one target */
+} udpBatchMsg_t;
+#endif
+
+/* target DNS cache: names are resolved by a background thread and the
+ * result is kept for dns.ttl seconds. Workers only use the cached addresses,
+ * so a slow or unreachable DNS server does not block them. An address set
+ * stays in use until a refresh succeeds.
+ */
+#define DFLT_DNS_TTL		60
+#define DNS_RETRY_INTERVAL	5	/* seconds until a failed lookup is retried */
+#define DNS_INITIAL_WAIT	2000	/* max ms to wait for the very first lookup */
+
+typedef struct fwdAddrs_s {
+	struct addrinfo *ai;
+	int nRefs;		/* guarded by the mutex of the owning cache */
+} fwdAddrs_t;
+
+typedef struct fwdDnsCache_s {
+	pthread_mutex_t mut;
+	pthread_cond_t condDone; /* signalled when a lookup has finished */
+	int nRefs;		/* owner plus a running lookup thread */
+	char *target;
+	char *port;
+	int socktype;
+	int ttl;
+	fwdAddrs_t *pAddrs;	/* current address set, NULL if not (yet) resolved */
+	time_t ttRefresh;	/* when the next lookup is due */
+	sbool bLookupRunning;
+} fwdDnsCache_t;
+
+/* target pool support */
+#define POOL_SELECT_RR		0	/* round-robin */
+#define POOL_SELECT_LEAST	1	/* least outstanding messages */
+#define POOL_SELECT_HASH	2	/* consistent hash over hash template (hostname) */
+#define POOL_RING_VNODES	64	/* points per target on the consistent hash ring */
+#define DFLT_POOL_EJECT_TIME	30
+
+typedef struct fwdPoolTarget_s {
+	char *target;
+	char *port;		/* NULL means "use port parameter" */
+	int nOutstanding;	/* msgs assigned in not yet finished transactions (all workers) */
+	time_t ttEjectedUntil;	/* unhealthy, not selected before then; 0 if healthy */
+	fwdDnsCache_t *pDnsCache;
+} fwdPoolTarget_t;
+
+typedef struct fwdPoolRingPoint_s {
+	uint32_t hash;
+	int iTarget;
+} fwdPoolRingPoint_t;
+
 typedef struct _instanceData {
 	uchar 	*tplName;	/* name of assigned template */
+	uchar	*poolHashTplName; /* name of template for pool hash key */
+	int iNumTpls;		/* number of templates requested */
 	uchar *pszStrmDrvr;
 	uchar *pszStrmDrvrAuthMode;
 	permittedPeers_t *pPermPeers;
@@ -88,11 +155,15 @@ typedef struct _instanceData {
 	char *port;
 	int protocol;
 	int iRebindInterval;	/* rebind interval */
+	int dnsTTL;		/* seconds a resolved target address is used */
+	fwdDnsCache_t *pDnsCache; /* NULL if a target pool is used */
 #	define	FORW_UDP 0
 #	define	FORW_TCP 1
 	/* following fields for TCP-based delivery */
 	TCPFRAMINGMODE tcp_framing;
 	int bResendLastOnRecon; /* should the last message be re-sent on a successful reconnect? */
+	sbool bTcpFastOpen;	/* use TCP Fast Open on connect */
+	sbool bTcpZeroCopy;	/* use MSG_ZEROCOPY for large sends (ptcp driver only) */
 #	define COMPRESS_NEVER 0
 #	define COMPRESS_SINGLE_MSG 1	/* old, single-message compression */
 	/* all other settings are for stream-compression */
@@ -100,22 +171,60 @@ typedef struct _instanceData {
 	uint8_t compressionMode;
 	int errsToReport;	/* max number of errors to report (per instance) */
 	sbool strmCompFlushOnTxEnd; /* flush stream compression on transaction end? */
+	int strmCmprAlgo;	/* stream compression algorithm, CMPR_ALGO_ZLIB is built-in deflate */
+	int strmCmprLevel;	/* level for non-zlib stream compression, -1 for default */
+	uchar *pszStrmCmprDict;	/* stream compression dictionary file (zstd only) */
+	statsobj_t *stats;	/* UDP forwarding stats, NULL for TCP */
+	STATSCOUNTER_DEF(ctrUdpSent, mutCtrUdpSent)
+	STATSCOUNTER_DEF(ctrUdpFailed, mutCtrUdpFailed)
+	STATSCOUNTER_DEF(ctrCallSendmmsg, mutCtrCallSendmmsg)
+	struct {
+		int nmemb;		/* number of targets, 0 if no pool is used */
+		fwdPoolTarget_t *targets;
+		int size;		/* connections per target and worker */
+		int select;		/* POOL_SELECT_* */
+		int ejectTime;		/* seconds a failed target is taken out of the pool */
+		unsigned iNextRR;	/* next target for round-robin selection */
+		fwdPoolRingPoint_t *ring; /* consistent hash ring, sorted by hash */
+		int nRing;
+		pthread_mutex_t mut;	/* guards target states and iNextRR */
+	} pool;
 } instanceData;
 
+/* Note: if a target pool is used, each pooled connection is represented by
+ * a wrkrInstanceData_t of its own (poolConns), so that all of the TCP
+ * framing and compression code works unmodified on it. The worker instance
+ * itself then only dispatches messages to them.
+ */
 typedef struct wrkrInstanceData {
 	instanceData *pData;
+	char *target;		/* target of this connection, points into instanceData */
+	char *port;		/* dito */
+	struct wrkrInstanceData *poolConns; /* pool.size connections per pool target, NULL if no pool */
+	int iPoolTarget;	/* target index, if we are a pooled connection */
+	unsigned nPoolPending;	/* msgs sent via this pooled connection in current transaction */
 	netstrms_t *pNS; /* netstream subsystem */
 	netstrm_t *pNetstrm; /* our output netstream */
-	struct addrinfo *f_addr;
+	fwdDnsCache_t *pDnsCache; /* where to get the target address from */
+	fwdAddrs_t *pAddrs;	/* address set in use (UDP) */
+	struct addrinfo *f_addr; /* shortcut to pAddrs->ai */
 	int *pSockArray;	/* sockets to use for UDP */
 	int bIsConnected;  /* are we connected to remote host? 0 - no, 1 - yes, UDP means addr resolved */
 	int nXmit;		/* number of transmissions since last (re-)bind */
 	tcpclt_t *pTCPClt;	/* our tcpclt object */
 	sbool bzInitDone; /* did we do an init of zstrm already? */
 	z_stream zstrm;	/* zip stream to use for tcp compression */
+	cmprCtx_t *pCmprCtx;	/* context for non-zlib stream compression */
 	uchar sndBuf[16*1024];	/* this is intensionally fixed -- see no good reason to make configurable */
 	unsigned offsSndBuf;	/* next free spot in send buffer */
+	struct iovec *batchMsgs; /* msgs of current transaction for tcpclt.SendBatch() */
+	unsigned maxBatchMsgs;	/* size of batchMsgs */
 	int errsToReport;	/* (remaining) number of errors to report */
+#	ifdef HAVE_SENDMMSG
+	udpBatchMsg_t *udpMsgs;	/* datagrams gathered during the current transaction */
+	struct mmsghdr *udpMmh;	/* headers for sendmmsg(), rebuilt for each target address */
+	unsigned nUdpMsgs;	/* number of entries in udpMsgs */
+#	endif
 } wrkrInstanceData_t;
 
 /* config data */
@@ -151,6 +260,8 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "ziplevel", eCmdHdlrInt, 0 },
 	{ "compression.mode", eCmdHdlrGetWord, 0 },
 	{ "compression.stream.flushontxend", eCmdHdlrBinary, 0 },
+	{ "compression.stream.algorithm", eCmdHdlrGetWord, 0 },
+	{ "compression.stream.dictionary", eCmdHdlrString, 0 },
 	{ "maxerrormessages", eCmdHdlrInt, 0 },
 	{ "rebindinterval", eCmdHdlrInt, 0 },
 	{ "streamdriver", eCmdHdlrGetWord, 0 },
@@ -158,7 +269,15 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "streamdriverauthmode", eCmdHdlrGetWord, 0 },
 	{ "streamdriverpermittedpeers", eCmdHdlrGetWord, 0 },
 	{ "resendlastmsgonreconnect", eCmdHdlrBinary, 0 },
+	{ "tcp.fastopen", eCmdHdlrBinary, 0 },
+	{ "tcp.zerocopy", eCmdHdlrBinary, 0 },
 	{ "template", eCmdHdlrGetWord, 0 },
+	{ "pool.targets", eCmdHdlrArray, 0 },
+	{ "pool.size", eCmdHdlrPositiveInt, 0 },
+	{ "pool.select", eCmdHdlrGetWord, 0 },
+	{ "pool.ejecttime", eCmdHdlrInt, 0 },
+	{ "pool.hashtemplate", eCmdHdlrGetWord, 0 },
+	{ "dns.ttl", eCmdHdlrInt, 0 },
 };
 static struct cnfparamblk actpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -193,6 +312,9 @@ ENDinitConfVars
 
 static rsRetVal doTryResume(wrkrInstanceData_t *);
 static rsRetVal doZipFinish(wrkrInstanceData_t *);
+#ifdef HAVE_SENDMMSG
+static void UDPBatchDiscard(wrkrInstanceData_t *);
+#endif
 
 /* this function gets the default template. It coordinates action between
  * old-style and new-style configuration parts.
@@ -232,6 +354,249 @@ finalize_it:
 	RETiRet;
 }
 
+/* CODE FOR THE TARGET DNS CACHE */
+
+static rsRetVal
+dnsCacheConstruct(fwdDnsCache_t **ppThis, char *target, char *port, int socktype, int ttl)
+{
+	fwdDnsCache_t *pThis;
+	DEFiRet;
+
+	CHKmalloc(pThis = calloc(1, sizeof(fwdDnsCache_t)));
+	pthread_mutex_init(&pThis->mut, NULL);
+	pthread_cond_init(&pThis->condDone, NULL);
+	pThis->nRefs = 1;
+	pThis->socktype = socktype;
+	pThis->ttl = ttl;
+	/* a NULL target is passed on to getaddrinfo(), as before */
+	if(   (target != NULL && (pThis->target = strdup(target)) == NULL)
+	   || (pThis->port = strdup((port == NULL) ? "514" : port)) == NULL) {
+		free(pThis->target);
+		pthread_cond_destroy(&pThis->condDone);
+		pthread_mutex_destroy(&pThis->mut);
+		free(pThis);
+		ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	*ppThis = pThis;
+finalize_it:
+	RETiRet;
+}
+
+
+/* drop a reference to an address set, must be called with the cache mutex held */
+static void
+dnsAddrsDeref(fwdAddrs_t *pAddrs)
+{
+	if(--pAddrs->nRefs == 0) {
+		freeaddrinfo(pAddrs->ai);
+		free(pAddrs);
+	}
+}
+
+
+static void
+dnsAddrsRelease(fwdDnsCache_t *pCache, fwdAddrs_t *pAddrs)
+{
+	if(pAddrs == NULL)
+		return;
+	pthread_mutex_lock(&pCache->mut);
+	dnsAddrsDeref(pAddrs);
+	pthread_mutex_unlock(&pCache->mut);
+}
+
+
+/* release a cache reference. The cache is destructed when the last one
+ * is gone, which may happen inside a lookup thread that outlived its action.
+ */
+static void
+dnsCacheRelease(fwdDnsCache_t *pCache)
+{
+	int nRefs;
+
+	if(pCache == NULL)
+		return;
+	pthread_mutex_lock(&pCache->mut);
+	nRefs = --pCache->nRefs;
+	pthread_mutex_unlock(&pCache->mut);
+	if(nRefs > 0)
+		return;
+
+	if(pCache->pAddrs != NULL)
+		dnsAddrsDeref(pCache->pAddrs);
+	pthread_cond_destroy(&pCache->condDone);
+	pthread_mutex_destroy(&pCache->mut);
+	free(pCache->target);
+	free(pCache->port);
+	free(pCache);
+}
+
+
+static void *
+dnsCacheLookupThrd(void *arg)
+{
+	fwdDnsCache_t *const pCache = (fwdDnsCache_t*) arg;
+	struct addrinfo hints;
+	struct addrinfo *res;
+	fwdAddrs_t *pAddrs = NULL;
+	int iErr;
+
+	memset(&hints, 0, sizeof(hints));
+	/* port must be numeric, because config file syntax requires this */
+	hints.ai_flags = AI_NUMERICSERV;
+	hints.ai_family = glbl.GetDefPFFamily();
+	hints.ai_socktype = pCache->socktype;
+	if((iErr = getaddrinfo(pCache->target, pCache->port, &hints, &res)) != 0) {
+		dbgprintf("omfwd: could not get addrinfo for hostname '%s':'%s': %d%s\n",
+			  pCache->target, pCache->port, iErr, gai_strerror(iErr));
+	} else if((pAddrs = malloc(sizeof(fwdAddrs_t))) == NULL) {
+		freeaddrinfo(res);
+	} else {
+		pAddrs->ai = res;
+		pAddrs->nRefs = 1;
+	}
+
+	pthread_mutex_lock(&pCache->mut);
+	if(pAddrs == NULL) {
+		/* keep what we had, if anything - it is probably still valid */
+		pCache->ttRefresh = time(NULL) + DNS_RETRY_INTERVAL;
+	} else {
+		dbgprintf("omfwd: %s resolved\n", pCache->target);
+		if(pCache->pAddrs != NULL)
+			dnsAddrsDeref(pCache->pAddrs);
+		pCache->pAddrs = pAddrs;
+		pCache->ttRefresh = time(NULL) + pCache->ttl;
+	}
+	pCache->bLookupRunning = 0;
+	pthread_cond_broadcast(&pCache->condDone);
+	pthread_mutex_unlock(&pCache->mut);
+
+	dnsCacheRelease(pCache);
+	return NULL;
+}
+
+
+/* start a background lookup, must be called with the cache mutex held */
+static void
+dnsCacheStartLookup(fwdDnsCache_t *pCache)
+{
+	pthread_t thrdID;
+	pthread_attr_t attr;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	++pCache->nRefs;
+	pCache->bLookupRunning = 1;
+	if(pthread_create(&thrdID, &attr, dnsCacheLookupThrd, pCache) != 0) {
+		dbgprintf("omfwd: could not start DNS lookup thread for '%s'\n", pCache->target);
+		--pCache->nRefs;
+		pCache->bLookupRunning = 0;
+		pCache->ttRefresh = time(NULL) + DNS_RETRY_INTERVAL;
+	}
+	pthread_attr_destroy(&attr);
+}
+
+
+/* obtain the current address set of the target. A refresh is started in
+ * the background if the cached one has expired, but the cached addresses
+ * are returned nevertheless. Only if nothing is known yet we wait (briefly)
+ * for the lookup to complete. The caller must release the addresses via
+ * dnsAddrsRelease().
+ */
+static rsRetVal
+dnsCacheGet(fwdDnsCache_t *pCache, fwdAddrs_t **ppAddrs)
+{
+	struct timespec tsWait;
+	DEFiRet;
+
+	pthread_mutex_lock(&pCache->mut);
+	if(!pCache->bLookupRunning && time(NULL) >= pCache->ttRefresh) {
+		dnsCacheStartLookup(pCache);
+		if(pCache->pAddrs == NULL && pCache->bLookupRunning) {
+			timeoutComp(&tsWait, DNS_INITIAL_WAIT);
+			while(pCache->bLookupRunning) {
+				if(pthread_cond_timedwait(&pCache->condDone, &pCache->mut, &tsWait) == ETIMEDOUT)
+					break;
+			}
+		}
+	}
+	if(pCache->pAddrs == NULL) {
+		iRet = RS_RET_SUSPENDED;
+	} else {
+		++pCache->pAddrs->nRefs;
+		*ppAddrs = pCache->pAddrs;
+	}
+	pthread_mutex_unlock(&pCache->mut);
+
+	RETiRet;
+}
+
+
+/* create the DNS caches for all targets of an action instance */
+static rsRetVal
+setupDnsCaches(instanceData *pData)
+{
+	const int socktype = (pData->protocol == FORW_UDP) ? SOCK_DGRAM : SOCK_STREAM;
+	fwdPoolTarget_t *pTarget;
+	int i;
+	DEFiRet;
+
+	if(pData->pool.nmemb == 0) {
+		CHKiRet(dnsCacheConstruct(&pData->pDnsCache, pData->target, pData->port,
+					  socktype, pData->dnsTTL));
+	}
+	for(i = 0 ; i < pData->pool.nmemb ; ++i) {
+		pTarget = &pData->pool.targets[i];
+		CHKiRet(dnsCacheConstruct(&pTarget->pDnsCache, pTarget->target,
+			(pTarget->port == NULL) ? pData->port : pTarget->port, socktype, pData->dnsTTL));
+	}
+finalize_it:
+	RETiRet;
+}
+
+
+/* Create the sockets for sending to the given addresses. We do not pass the
+ * target name to create_udp_socket(), as that would resolve it once again
+ * (synchronously). Instead, one socket per address family is created from
+ * the numeric form of the first address of that family.
+ */
+static int *
+createUDPSockets(struct addrinfo *addrs)
+{
+	static const int families[] = { AF_INET, AF_INET6 };
+	char szHost[NI_MAXHOST];
+	struct addrinfo *r;
+	int *pSocks = NULL;
+	int *pNew;
+	int *pMerged;
+	size_t i;
+
+	for(i = 0 ; i < sizeof(families)/sizeof(int) ; ++i) {
+		for(r = addrs ; r != NULL && r->ai_family != families[i] ; r = r->ai_next)
+			/* JUST SKIP */;
+		if(r == NULL)
+			continue;
+		if(getnameinfo(r->ai_addr, r->ai_addrlen, szHost, sizeof(szHost),
+			       NULL, 0, NI_NUMERICHOST) != 0)
+			continue;
+		if((pNew = net.create_udp_socket((uchar*)szHost, NULL, 0, 0, 0)) == NULL)
+			continue;
+		if(pSocks == NULL) {
+			pSocks = pNew;
+			continue;
+		}
+		if((pMerged = realloc(pSocks, (1 + pSocks[0] + pNew[0]) * sizeof(int))) == NULL) {
+			net.closeUDPListenSockets(pNew);
+			continue;
+		}
+		memcpy(pMerged + 1 + pMerged[0], pNew + 1, pNew[0] * sizeof(int));
+		pMerged[0] += pNew[0];
+		free(pNew);
+		pSocks = pMerged;
+	}
+	return pSocks;
+}
+
+
 /* Close the UDP sockets.
  * rgerhards, 2009-05-29
  */
@@ -242,7 +607,10 @@ closeUDPSockets(wrkrInstanceData_t *pWrkrData)
 	if(pWrkrData->pSockArray != NULL) {
 		net.closeUDPListenSockets(pWrkrData->pSockArray);
 		pWrkrData->pSockArray = NULL;
-		freeaddrinfo(pWrkrData->f_addr);
+	}
+	if(pWrkrData->pAddrs != NULL) {
+		dnsAddrsRelease(pWrkrData->pDnsCache, pWrkrData->pAddrs);
+		pWrkrData->pAddrs = NULL;
 		pWrkrData->f_addr = NULL;
 	}
 pWrkrData->bIsConnected = 0; // TODO: remove this variable altogether
@@ -338,6 +706,8 @@ ENDfreeCnf
 BEGINcreateInstance
 CODESTARTcreateInstance
 	pData->errsToReport = 5;
+	pData->iNumTpls = 1;
+	pthread_mutex_init(&pData->pool.mut, NULL);
 	if(cs.pszStrmDrvr != NULL)
 		CHKmalloc(pData->pszStrmDrvr = (uchar*)strdup((char*)cs.pszStrmDrvr));
 	if(cs.pszStrmDrvrAuthMode != NULL)
@@ -347,12 +717,46 @@ finalize_it:
 ENDcreateInstance
 
 
+/* create the pooled connections of a worker instance */
+static rsRetVal
+poolConstructConns(wrkrInstanceData_t *const pWrkrData)
+{
+	instanceData *const pData = pWrkrData->pData;
+	wrkrInstanceData_t *pConn;
+	fwdPoolTarget_t *pTarget;
+	int i;
+	DEFiRet;
+
+	CHKmalloc(pWrkrData->poolConns = calloc(pData->pool.nmemb * pData->pool.size,
+						sizeof(wrkrInstanceData_t)));
+	for(i = 0 ; i < pData->pool.nmemb * pData->pool.size ; ++i) {
+		pConn = &pWrkrData->poolConns[i];
+		pConn->iPoolTarget = i / pData->pool.size;
+		pTarget = &pData->pool.targets[pConn->iPoolTarget];
+		pConn->pData = pData;
+		pConn->target = pTarget->target;
+		pConn->port = (pTarget->port == NULL) ? pData->port : pTarget->port;
+		pConn->pDnsCache = pTarget->pDnsCache;
+		pConn->errsToReport = pData->errsToReport;
+		CHKiRet(initTCP(pConn));
+	}
+finalize_it:
+	RETiRet;
+}
+
+
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
 	dbgprintf("DDDD: createWrkrInstance: pWrkrData %p\n", pWrkrData);
 	pWrkrData->offsSndBuf = 0;
 	pWrkrData->errsToReport = pData->errsToReport;
-	iRet = initTCP(pWrkrData);
+	pWrkrData->target = pData->target;
+	pWrkrData->port = pData->port;
+	pWrkrData->pDnsCache = pData->pDnsCache;
+	if(pData->pool.nmemb > 0)
+		iRet = poolConstructConns(pWrkrData);
+	else
+		iRet = initTCP(pWrkrData);
 ENDcreateWrkrInstance
 
 
@@ -364,29 +768,59 @@ ENDisCompatibleWithFeature
 
 
 BEGINfreeInstance
+	int i;
 CODESTARTfreeInstance
+	if(pData->stats != NULL)
+		statsobj.Destruct(&(pData->stats));
+	dnsCacheRelease(pData->pDnsCache);
+	for(i = 0 ; i < pData->pool.nmemb ; ++i) {
+		dnsCacheRelease(pData->pool.targets[i].pDnsCache);
+		free(pData->pool.targets[i].target);
+		free(pData->pool.targets[i].port);
+	}
+	free(pData->pool.targets);
+	free(pData->pool.ring);
+	pthread_mutex_destroy(&pData->pool.mut);
+	free(pData->poolHashTplName);
 	free(pData->pszStrmDrvr);
 	free(pData->pszStrmDrvrAuthMode);
 	free(pData->port);
 	free(pData->target);
+	free(pData->pszStrmCmprDict);
 	net.DestructPermittedPeers(&pData->pPermPeers);
 ENDfreeInstance
 
 
 BEGINfreeWrkrInstance
+	int i;
 CODESTARTfreeWrkrInstance
 	DestructTCPInstanceData(pWrkrData);
 	closeUDPSockets(pWrkrData);
+	free(pWrkrData->batchMsgs);
+#	ifdef HAVE_SENDMMSG
+	UDPBatchDiscard(pWrkrData);
+	free(pWrkrData->udpMsgs);
+	free(pWrkrData->udpMmh);
+#	endif
 
-	if(pWrkrData->pData->protocol == FORW_TCP) {
+	if(pWrkrData->pTCPClt != NULL) {
 		tcpclt.Destruct(&pWrkrData->pTCPClt);
 	}
+	if(pWrkrData->poolConns != NULL) {
+		for(i = 0 ; i < pWrkrData->pData->pool.nmemb * pWrkrData->pData->pool.size ; ++i) {
+			DestructTCPInstanceData(&pWrkrData->poolConns[i]);
+			if(pWrkrData->poolConns[i].pTCPClt != NULL)
+				tcpclt.Destruct(&pWrkrData->poolConns[i].pTCPClt);
+		}
+		free(pWrkrData->poolConns);
+	}
 ENDfreeWrkrInstance
 
 
 BEGINdbgPrintInstInfo
 CODESTARTdbgPrintInstInfo
-	dbgprintf("%s", pData->target);
+	dbgprintf("%s", (pData->target == NULL && pData->pool.nmemb > 0)
+		? pData->pool.targets[0].target : pData->target);
 ENDdbgPrintInstInfo
 
 
@@ -456,6 +890,9 @@ static rsRetVal UDPSend(wrkrInstanceData_t *__restrict__ const pWrkrData,
 				--pWrkrData->errsToReport;
 			}
 			iRet = RS_RET_SUSPENDED;
+			STATSCOUNTER_INC(pWrkrData->pData->ctrUdpFailed, pWrkrData->pData->mutCtrUdpFailed);
+		} else {
+			STATSCOUNTER_INC(pWrkrData->pData->ctrUdpSent, pWrkrData->pData->mutCtrUdpSent);
 		}
 	}
 
@@ -464,6 +901,165 @@ finalize_it:
 }
 
 
+#ifdef HAVE_SENDMMSG
+/* discard all datagrams gathered so far */
+static void
+UDPBatchDiscard(wrkrInstanceData_t *__restrict__ const pWrkrData)
+{
+	unsigned i;
+
+	for(i = 0 ; i < pWrkrData->nUdpMsgs ; ++i)
+		free(pWrkrData->udpMsgs[i].pBufFree);
+	pWrkrData->nUdpMsgs = 0;
+}
+
+
+/* Send all gathered datagrams via sendmmsg(). The semantics are the same as
+ * with UDPSend(), but on a per-message basis: each message is tried on all
+ * sockets for a target address, and the next address is only tried for
+ * messages that could not yet be sent (or for all of them if send_to_all
+ * is set). If a message could not be sent at all, the action is suspended.
+ * Note that the rebind interval is only checked between batches.
+ */
+static rsRetVal
+UDPBatchFlush(wrkrInstanceData_t *__restrict__ const pWrkrData)
+{
+	instanceData *__restrict__ const pData = pWrkrData->pData;
+	struct mmsghdr *const mmh = pWrkrData->udpMmh;
+	udpBatchMsg_t *pMsg;
+	struct addrinfo *r;
+	unsigned nMsgs;
+	unsigned nPend;
+	unsigned nFailed;
+	unsigned j, k;
+	int i;
+	int nSent;
+	int lasterrno = ENOENT;
+	char errStr[1024];
+	DEFiRet;
+
+	nMsgs = pWrkrData->nUdpMsgs;
+	if(nMsgs == 0)
+		FINALIZE;
+
+	if(pWrkrData->pSockArray == NULL) {
+		CHKiRet(doTryResume(pWrkrData));
+	}
+	if(pWrkrData->pSockArray == NULL)
+		FINALIZE; /* same as UDPSend(): silently dropped */
+
+	for(r = pWrkrData->f_addr ; r != NULL ; r = r->ai_next) {
+		nPend = 0;
+		for(j = 0 ; j < nMsgs ; ++j) {
+			if(pWrkrData->udpMsgs[j].bSent && !send_to_all)
+				continue;
+			memset(&mmh[nPend], 0, sizeof(struct mmsghdr));
+			mmh[nPend].msg_hdr.msg_name = r->ai_addr;
+			mmh[nPend].msg_hdr.msg_namelen = r->ai_addrlen;
+			mmh[nPend].msg_hdr.msg_iov = &pWrkrData->udpMsgs[j].iov;
+			mmh[nPend].msg_hdr.msg_iovlen = 1;
+			++nPend;
+		}
+		if(nPend == 0)
+			break;
+		j = 0;
+		while(j < nPend) {
+			nSent = -1;
+			for(i = 0 ; i < *pWrkrData->pSockArray ; i++) {
+				nSent = sendmmsg(pWrkrData->pSockArray[i+1], mmh + j, nPend - j, 0);
+				STATSCOUNTER_INC(pData->ctrCallSendmmsg, pData->mutCtrCallSendmmsg);
+				if(nSent > 0)
+					break;
+				lasterrno = errno;
+				DBGPRINTF("sendmmsg() error: %d = %s.\n", lasterrno,
+					rs_strerror_r(lasterrno, errStr, sizeof(errStr)));
+			}
+			if(nSent <= 0) {
+				/* no socket could send this message, try the next one */
+				++j;
+				continue;
+			}
+			for(k = j ; k < j + nSent ; ++k) {
+				pMsg = (udpBatchMsg_t*) mmh[k].msg_hdr.msg_iov;
+				if(mmh[k].msg_len == pMsg->iov.iov_len)
+					pMsg->bSent = RSTRUE;
+			}
+			j += nSent;
+		}
+	}
+
+	nFailed = 0;
+	for(j = 0 ; j < nMsgs ; ++j) {
+		if(!pWrkrData->udpMsgs[j].bSent)
+			++nFailed;
+	}
+	STATSCOUNTER_ADD(pData->ctrUdpSent, pData->mutCtrUdpSent, nMsgs - nFailed);
+	if(nFailed > 0) {
+		STATSCOUNTER_ADD(pData->ctrUdpFailed, pData->mutCtrUdpFailed, nFailed);
+		dbgprintf("error forwarding %u of %u messages via udp, suspending\n",
+			  nFailed, nMsgs);
+		if(pWrkrData->errsToReport > 0) {
+			rs_strerror_r(lasterrno, errStr, sizeof(errStr));
+			errmsg.LogError(0, RS_RET_ERR_UDPSEND, "omfwd: error sending "
+					"via udp: %s", errStr);
+			if(pWrkrData->errsToReport == 1) {
+				errmsg.LogError(0, RS_RET_LAST_ERRREPORT, "omfwd: "
+						"max number of error message emitted "
+						"- further messages will be "
+						"suppressed");
+			}
+			--pWrkrData->errsToReport;
+		}
+		iRet = RS_RET_SUSPENDED;
+	}
+
+	if(pData->iRebindInterval) {
+		pWrkrData->nXmit += nMsgs;
+		if(pWrkrData->nXmit >= pData->iRebindInterval) {
+			dbgprintf("omfwd dropping UDP 'connection' (as configured)\n");
+			pWrkrData->nXmit = 0;
+			closeUDPSockets(pWrkrData);
+		}
+	}
+
+finalize_it:
+	UDPBatchDiscard(pWrkrData);
+	RETiRet;
+}
+
+
+/* add a datagram to the current batch. If pBufFree is given, the batch
+ * takes ownership of it (even in case of error).
+ */
+static rsRetVal
+UDPBatchAdd(wrkrInstanceData_t *__restrict__ const pWrkrData,
+	uchar *const msg, const size_t len, uchar *const pBufFree)
+{
+	udpBatchMsg_t *pMsg;
+	DEFiRet;
+
+	if(pWrkrData->udpMsgs == NULL) {
+		CHKmalloc(pWrkrData->udpMsgs = calloc(UDP_BATCH_MAX, sizeof(udpBatchMsg_t)));
+		CHKmalloc(pWrkrData->udpMmh = calloc(UDP_BATCH_MAX, sizeof(struct mmsghdr)));
+	}
+	if(pWrkrData->nUdpMsgs == UDP_BATCH_MAX) {
+		CHKiRet(UDPBatchFlush(pWrkrData));
+	}
+
+	pMsg = &pWrkrData->udpMsgs[pWrkrData->nUdpMsgs++];
+	pMsg->iov.iov_base = msg;
+	pMsg->iov.iov_len = len;
+	pMsg->pBufFree = pBufFree;
+	pMsg->bSent = RSFALSE;
+
+finalize_it:
+	if(iRet != RS_RET_OK)
+		free(pBufFree);
+	RETiRet;
+}
+#endif /* #ifdef HAVE_SENDMMSG */
+
+
 /* set the permitted peers -- rgerhards, 2008-05-19
  */
 static rsRetVal
@@ -507,6 +1103,77 @@ finalize_it:
 	RETiRet;
 }
 
+/* send an I/O vector, using writev() where the driver supports it. We
+ * must not modify the vector, as tcpclt retries it as a whole after
+ * reconnect. So a partially written element is completed via plain
+ * Send() before we continue with the rest.
+ */
+static rsRetVal
+TCPSendVUncompressed(wrkrInstanceData_t *pWrkrData, struct iovec *iov, int iovcnt)
+{
+	ssize_t lenSent;
+	ssize_t lenSend;
+	size_t alreadySent;
+	int i;
+	DEFiRet;
+
+	CHKiRet(netstrm.CheckConnection(pWrkrData->pNetstrm)); /* hack for plain tcp syslog - see ptcp driver for details */
+
+	i = 0;
+	while(i < iovcnt) {
+		CHKiRet(netstrm.SendV(pWrkrData->pNetstrm, iov + i, iovcnt - i, &lenSent));
+		DBGPRINTF("omfwd: TCP sent %ld bytes via SendV, %d vector elements left\n",
+			  (long) lenSent, iovcnt - i);
+		while(i < iovcnt && lenSent >= (ssize_t) iov[i].iov_len) {
+			lenSent -= iov[i].iov_len;
+			++i;
+		}
+		if(lenSent > 0) {
+			for(alreadySent = lenSent ; alreadySent != iov[i].iov_len ; alreadySent += lenSend) {
+				lenSend = iov[i].iov_len - alreadySent;
+				CHKiRet(netstrm.Send(pWrkrData->pNetstrm,
+						     (uchar*)iov[i].iov_base + alreadySent, &lenSend));
+			}
+			++i;
+		}
+	}
+
+finalize_it:
+	if(iRet != RS_RET_OK) {
+		/* error! */
+		dbgprintf("TCPSendVUncompressed error %d, destruct TCP Connection!\n", iRet);
+		DestructTCPInstanceData(pWrkrData);
+		iRet = RS_RET_SUSPENDED;
+	}
+	RETiRet;
+}
+
+/* stream compression via the generic compression layer (zstd, lz4) */
+static rsRetVal
+TCPSendBufCmpr(wrkrInstanceData_t *pWrkrData, cmprCtx_t *pCtx, uchar *buf, unsigned len, int op)
+{
+	const uchar *pIn;
+	size_t lenIn;
+	uchar *pOut;
+	size_t lenOut;
+	uchar zipBuf[32*1024];
+	DEFiRet;
+
+	pIn = buf;
+	lenIn = len;
+	do {
+		pOut = zipBuf;
+		lenOut = sizeof(zipBuf);
+		CHKiRet(cmpr.Process(pCtx, &pIn, &lenIn, &pOut, &lenOut, op));
+		if(lenOut != sizeof(zipBuf)) {
+			CHKiRet(TCPSendBufUncompressed(pWrkrData, zipBuf, sizeof(zipBuf) - lenOut));
+		}
+	} while(lenOut == 0);
+
+finalize_it:
+	RETiRet;
+}
+
 static rsRetVal
 TCPSendBufCompressed(wrkrInstanceData_t *pWrkrData, uchar *buf, unsigned len, sbool bIsFlush)
 {
@@ -516,6 +1183,16 @@ TCPSendBufCompressed(wrkrInstanceData_t *pWrkrData, uchar *buf, unsigned len, sb
 	int op;
 	DEFiRet;
 
+	if(pWrkrData->pData->strmCmprAlgo != CMPR_ALGO_ZLIB) {
+		if(pWrkrData->pCmprCtx == NULL) {
+			CHKiRet(cmpr.Construct(&pWrkrData->pCmprCtx, pWrkrData->pData->strmCmprAlgo, 0,
+					       pWrkrData->pData->strmCmprLevel, pWrkrData->pData->pszStrmCmprDict));
+		}
+		iRet = TCPSendBufCmpr(pWrkrData, pWrkrData->pCmprCtx, buf, len,
+			(pWrkrData->pData->strmCompFlushOnTxEnd && bIsFlush) ? CMPR_OP_FLUSH : CMPR_OP_RUN);
+		FINALIZE;
+	}
+
 	if(!pWrkrData->bzInitDone) {
 		/* allocate deflate state */
 		pWrkrData->zstrm.zalloc = Z_NULL;
@@ -576,6 +1253,17 @@ doZipFinish(wrkrInstanceData_t *pWrkrData)
 	unsigned outavail;
 	uchar zipBuf[32*1024];
 
+	if(pWrkrData->pCmprCtx != NULL) {
+		/* detach the context first: a send error destructs the connection,
+		 * which calls us again. A new connection starts a new compressed stream.
+		 */
+		cmprCtx_t *pCtx = pWrkrData->pCmprCtx;
+		pWrkrData->pCmprCtx = NULL;
+		iRet = TCPSendBufCmpr(pWrkrData, pCtx, NULL, 0, CMPR_OP_FINISH);
+		cmpr.Destruct(&pCtx);
+		goto done;
+	}
+
 	if(!pWrkrData->bzInitDone)
 		goto done;
 
@@ -606,12 +1294,21 @@ done:	RETiRet;
 }
 
 
-/* Add frame to send buffer (or send, if requried)
+/* Add frame to send buffer (or send, if requried). The frame is passed as
+ * I/O vector (see tcpclt), so that it is copied only once, right into the
+ * send buffer.
  */
-static rsRetVal TCPSendFrame(void *pvData, char *msg, size_t len)
+static rsRetVal TCPSendFrame(void *pvData, struct iovec *iov, int iovcnt)
 {
 	DEFiRet;
 	wrkrInstanceData_t *pWrkrData = (wrkrInstanceData_t *) pvData;
+	uchar *buf = NULL;
+	size_t len;
+	size_t iOffs;
+	int i;
+
+	for(len = 0, i = 0 ; i < iovcnt ; ++i)
+		len += iov[i].iov_len;
 
 	DBGPRINTF("omfwd: add %u bytes to send buffer (curr offs %u)\n",
 		(unsigned) len, pWrkrData->offsSndBuf);
@@ -622,17 +1319,58 @@ static rsRetVal TCPSendFrame(void *pvData, char *msg, size_t len)
 		iRet = RS_RET_PREVIOUS_COMMITTED;
 	}
 
-	/* check if the message is too large to fit into buffer */
+	/* check if the message is too large to fit into buffer. This is rare,
+	 * so we simply build the frame in a temporary buffer.
+	 */
 	if(len > sizeof(pWrkrData->sndBuf)) {
-		CHKiRet(TCPSendBuf(pWrkrData, (uchar*)msg, len, NO_FLUSH));
+		CHKmalloc(buf = MALLOC(len));
+		for(iOffs = 0, i = 0 ; i < iovcnt ; ++i) {
+			memcpy(buf + iOffs, iov[i].iov_base, iov[i].iov_len);
+			iOffs += iov[i].iov_len;
+		}
+		CHKiRet(TCPSendBuf(pWrkrData, buf, len, NO_FLUSH));
 		ABORT_FINALIZE(RS_RET_OK);	/* committed everything so far */
 	}
 
 	/* we now know the buffer has enough free space */
-	memcpy(pWrkrData->sndBuf + pWrkrData->offsSndBuf, msg, len);
-	pWrkrData->offsSndBuf += len;
+	for(i = 0 ; i < iovcnt ; ++i) {
+		memcpy(pWrkrData->sndBuf + pWrkrData->offsSndBuf, iov[i].iov_base, iov[i].iov_len);
+		pWrkrData->offsSndBuf += iov[i].iov_len;
+	}
 	iRet = RS_RET_DEFER_COMMIT;
 
+finalize_it:
+	free(buf);
+	RETiRet;
+}
+
+
+/* Send the frames of a whole batch (see tcpclt SendBatch()). This is
+ * called with the frames of a complete transaction, so we send them right
+ * away instead of copying them to the send buffer. With stream compression,
+ * the compressor is flushed after the last frame (if so configured).
+ */
+static rsRetVal TCPSendBatchV(void *pvData, struct iovec *iov, int iovcnt)
+{
+	wrkrInstanceData_t *pWrkrData = (wrkrInstanceData_t *) pvData;
+	int i;
+	DEFiRet;
+
+	if(pWrkrData->offsSndBuf != 0) {
+		/* keep order: whatever is still buffered must go first */
+		CHKiRet(TCPSendBuf(pWrkrData, pWrkrData->sndBuf, pWrkrData->offsSndBuf, NO_FLUSH));
+		pWrkrData->offsSndBuf = 0;
+	}
+
+	if(pWrkrData->pData->compressionMode >= COMPRESS_STREAM_ALWAYS) {
+		for(i = 0 ; i < iovcnt ; ++i) {
+			CHKiRet(TCPSendBufCompressed(pWrkrData, iov[i].iov_base, iov[i].iov_len,
+						     (i == iovcnt - 1) ? IS_FLUSH : NO_FLUSH));
+		}
+	} else {
+		CHKiRet(TCPSendVUncompressed(pWrkrData, iov, iovcnt));
+	}
+
 finalize_it:
 	RETiRet;
 }
@@ -661,6 +1399,8 @@ static rsRetVal TCPSendInit(void *pvData)
 	DEFiRet;
 	wrkrInstanceData_t *pWrkrData = (wrkrInstanceData_t *) pvData;
 	instanceData *pData;
+	fwdAddrs_t *pAddrs;
+	rsRetVal localRet;
 
 	assert(pWrkrData != NULL);
 	pData = pWrkrData->pData;
@@ -683,9 +1423,20 @@ static rsRetVal TCPSendInit(void *pvData)
 		if(pData->pPermPeers != NULL) {
 			CHKiRet(netstrm.SetDrvrPermPeers(pWrkrData->pNetstrm, pData->pPermPeers));
 		}
+		/* connect to the cached address, the name is still needed for TLS checks */
+		CHKiRet(dnsCacheGet(pWrkrData->pDnsCache, &pAddrs));
+		localRet = netstrm.SetConnectAddr(pWrkrData->pNetstrm, pAddrs->ai->ai_addr,
+						  pAddrs->ai->ai_addrlen);
+		dnsAddrsRelease(pWrkrData->pDnsCache, pAddrs);
+		CHKiRet(localRet);
+		if(pData->bTcpFastOpen || pData->bTcpZeroCopy) {
+			CHKiRet(netstrm.SetTcpOpts(pWrkrData->pNetstrm,
+				  (pData->bTcpFastOpen ? NSD_TCPOPT_FASTOPEN : 0)
+				| (pData->bTcpZeroCopy ? NSD_TCPOPT_ZEROCOPY : 0)));
+		}
 		/* params set, now connect */
 		CHKiRet(netstrm.Connect(pWrkrData->pNetstrm, glbl.GetDefPFFamily(),
-			(uchar*)pData->port, (uchar*)pData->target));
+			(uchar*)pWrkrData->port, (uchar*)pWrkrData->target));
 	}
 
 finalize_it:
@@ -698,50 +1449,286 @@ finalize_it:
 }
 
 
+/* CODE FOR TARGET POOLS */
+
+/* take a failed target out of the pool for pool.ejecttime seconds */
+static void
+poolEjectTarget(instanceData *const pData, const int iTarget)
+{
+	fwdPoolTarget_t *const pTarget = &pData->pool.targets[iTarget];
+	const time_t ttNow = time(NULL);
+	sbool bWasHealthy;
+
+	pthread_mutex_lock(&pData->pool.mut);
+	bWasHealthy = (pTarget->ttEjectedUntil <= ttNow);
+	pTarget->ttEjectedUntil = ttNow + pData->pool.ejectTime;
+	pthread_mutex_unlock(&pData->pool.mut);
+	if(bWasHealthy) {
+		errmsg.LogError(0, RS_RET_SUSPENDED, "omfwd: pool target %s:%s failed, "
+				"ejected from pool for %d seconds", pTarget->target,
+				(pTarget->port == NULL) ? pData->port : pTarget->port,
+				pData->pool.ejectTime);
+	}
+}
+
+
+/* check if a target may be used. Targets whose ejection time is over are
+ * eligible again; if they still fail, they are simply ejected again.
+ * pool.mut must be locked.
+ */
+static inline int
+poolTargetUsable(instanceData *const pData, const int iTarget, const time_t ttNow)
+{
+	return pData->pool.targets[iTarget].ttEjectedUntil <= ttNow;
+}
+
+
+/* the pool can be resumed if at least one target is usable */
+static rsRetVal
+poolTryResume(instanceData *const pData)
+{
+	const time_t ttNow = time(NULL);
+	int i;
+	DEFiRet;
+
+	iRet = RS_RET_SUSPENDED;
+	pthread_mutex_lock(&pData->pool.mut);
+	for(i = 0 ; i < pData->pool.nmemb ; ++i) {
+		if(poolTargetUsable(pData, i, ttNow)) {
+			iRet = RS_RET_OK;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pData->pool.mut);
+	RETiRet;
+}
+
+
+/* FNV-1a, used for the consistent hash ring */
+static uint32_t
+poolHash(const uchar *p, uint32_t h)
+{
+	for( ; *p ; ++p) {
+		h ^= *p;
+		h *= 16777619u;
+	}
+	return h;
+}
+#define POOL_HASH_INIT 2166136261u
+
+static int
+poolRingCmp(const void *v1, const void *v2)
+{
+	const fwdPoolRingPoint_t *const p1 = (const fwdPoolRingPoint_t*) v1;
+	const fwdPoolRingPoint_t *const p2 = (const fwdPoolRingPoint_t*) v2;
+	return (p1->hash > p2->hash) - (p1->hash < p2->hash);
+}
+
+/* build the consistent hash ring. Every target gets POOL_RING_VNODES points,
+ * so that the failure of a target spreads its load evenly over the others
+ * and only the keys of the failed target are moved.
+ */
+static rsRetVal
+poolBuildRing(instanceData *const pData)
+{
+	fwdPoolTarget_t *pTarget;
+	uchar szPoint[64];
+	int i, j;
+	DEFiRet;
+
+	pData->pool.nRing = pData->pool.nmemb * POOL_RING_VNODES;
+	CHKmalloc(pData->pool.ring = malloc(pData->pool.nRing * sizeof(fwdPoolRingPoint_t)));
+	for(i = 0 ; i < pData->pool.nmemb ; ++i) {
+		pTarget = &pData->pool.targets[i];
+		for(j = 0 ; j < POOL_RING_VNODES ; ++j) {
+			snprintf((char*)szPoint, sizeof(szPoint), ":%s#%d",
+				 (pTarget->port == NULL) ? "" : pTarget->port, j);
+			pData->pool.ring[i * POOL_RING_VNODES + j].hash =
+				poolHash(szPoint, poolHash((uchar*)pTarget->target, POOL_HASH_INIT));
+			pData->pool.ring[i * POOL_RING_VNODES + j].iTarget = i;
+		}
+	}
+	qsort(pData->pool.ring, pData->pool.nRing, sizeof(fwdPoolRingPoint_t), poolRingCmp);
+finalize_it:
+	RETiRet;
+}
+
+
+/* select a usable target according to pool.select. Returns -1 if no target
+ * is usable. pool.mut must be locked.
+ */
+static int
+poolSelectTarget(instanceData *const pData, const uchar *const hashKey, const time_t ttNow)
+{
+	uint32_t h;
+	int lo, hi, mid;
+	int i, iTarget;
+	int iBest = -1;
+
+	switch(pData->pool.select) {
+	case POOL_SELECT_HASH:
+		h = poolHash((hashKey == NULL) ? UCHAR_CONSTANT("") : hashKey, POOL_HASH_INIT);
+		/* find first ring point >= h, wrapping around */
+		lo = 0;
+		hi = pData->pool.nRing;
+		while(lo < hi) {
+			mid = (lo + hi) / 2;
+			if(pData->pool.ring[mid].hash < h)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for(i = 0 ; i < pData->pool.nRing ; ++i) {
+			iTarget = pData->pool.ring[(lo + i) % pData->pool.nRing].iTarget;
+			if(poolTargetUsable(pData, iTarget, ttNow))
+				return iTarget;
+		}
+		break;
+	case POOL_SELECT_LEAST:
+		/* start at the round-robin position so that ties are spread */
+		for(i = 0 ; i < pData->pool.nmemb ; ++i) {
+			iTarget = (pData->pool.iNextRR + i) % pData->pool.nmemb;
+			if(!poolTargetUsable(pData, iTarget, ttNow))
+				continue;
+			if(iBest == -1 || pData->pool.targets[iTarget].nOutstanding
+					  < pData->pool.targets[iBest].nOutstanding)
+				iBest = iTarget;
+		}
+		pData->pool.iNextRR = (pData->pool.iNextRR + 1) % pData->pool.nmemb;
+		break;
+	case POOL_SELECT_RR:
+	default:
+		for(i = 0 ; i < pData->pool.nmemb ; ++i) {
+			iTarget = (pData->pool.iNextRR + i) % pData->pool.nmemb;
+			if(poolTargetUsable(pData, iTarget, ttNow)) {
+				iBest = iTarget;
+				pData->pool.iNextRR = (iTarget + 1) % pData->pool.nmemb;
+				break;
+			}
+		}
+		break;
+	}
+	return iBest;
+}
+
+
+/* select the pooled connection for the next message and make sure it is
+ * connected. Within a target, the connection with the fewest messages in
+ * the current transaction is used. Targets that can not be connected are
+ * ejected and the next one is tried.
+ */
+static rsRetVal
+poolSelectConn(wrkrInstanceData_t *const pWrkrData, const uchar *const hashKey,
+	       wrkrInstanceData_t **const ppConn)
+{
+	instanceData *const pData = pWrkrData->pData;
+	wrkrInstanceData_t *pConn;
+	wrkrInstanceData_t *pTry;
+	int iTarget;
+	int i, j;
+	DEFiRet;
+
+	for(i = 0 ; i < pData->pool.nmemb ; ++i) {
+		pthread_mutex_lock(&pData->pool.mut);
+		iTarget = poolSelectTarget(pData, hashKey, time(NULL));
+		if(iTarget != -1)
+			++pData->pool.targets[iTarget].nOutstanding;
+		pthread_mutex_unlock(&pData->pool.mut);
+		if(iTarget == -1)
+			break;
+
+		pConn = &pWrkrData->poolConns[iTarget * pData->pool.size];
+		for(j = 1 ; j < pData->pool.size ; ++j) {
+			pTry = &pWrkrData->poolConns[iTarget * pData->pool.size + j];
+			if(pTry->nPoolPending < pConn->nPoolPending)
+				pConn = pTry;
+		}
+		++pConn->nPoolPending;
+		if(pConn->pNetstrm != NULL || TCPSendInit(pConn) == RS_RET_OK) {
+			*ppConn = pConn;
+			FINALIZE;
+		}
+		poolEjectTarget(pData, iTarget);
+	}
+	ABORT_FINALIZE(RS_RET_SUSPENDED);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* end the current transaction on all pooled connections: flush what is
+ * still buffered (only if bFlush is set, else it is discarded because the
+ * transaction will be retried) and update the outstanding message counts.
+ */
+static rsRetVal
+poolEndTransaction(wrkrInstanceData_t *const pWrkrData, const sbool bFlush)
+{
+	instanceData *const pData = pWrkrData->pData;
+	wrkrInstanceData_t *pConn;
+	rsRetVal localRet;
+	int i;
+	DEFiRet;
+
+	for(i = 0 ; i < pData->pool.nmemb * pData->pool.size ; ++i) {
+		pConn = &pWrkrData->poolConns[i];
+		if(pConn->offsSndBuf != 0) {
+			if(bFlush && iRet == RS_RET_OK) {
+				localRet = TCPSendBuf(pConn, pConn->sndBuf, pConn->offsSndBuf, IS_FLUSH);
+				if(localRet != RS_RET_OK) {
+					poolEjectTarget(pData, pConn->iPoolTarget);
+					iRet = RS_RET_SUSPENDED;
+				}
+			}
+			pConn->offsSndBuf = 0;
+		}
+		if(pConn->nPoolPending != 0) {
+			pthread_mutex_lock(&pData->pool.mut);
+			pData->pool.targets[pConn->iPoolTarget].nOutstanding -= pConn->nPoolPending;
+			pthread_mutex_unlock(&pData->pool.mut);
+			pConn->nPoolPending = 0;
+		}
+	}
+	RETiRet;
+}
+
+
 /* try to resume connection if it is not ready
  * rgerhards, 2007-08-02
  */
 static rsRetVal doTryResume(wrkrInstanceData_t *pWrkrData)
 {
-	int iErr;
-	struct addrinfo *res;
-	struct addrinfo hints;
+	fwdAddrs_t *pAddrs;
 	instanceData *pData;
 	DEFiRet;
 
-	if(pWrkrData->bIsConnected)
+	if(pWrkrData->poolConns != NULL) {
+		/* connections are established on demand, see poolSelectConn() */
+		CHKiRet(poolTryResume(pWrkrData->pData));
 		FINALIZE;
+	}
 	pData = pWrkrData->pData;
 
-	/* The remote address is not yet known and needs to be obtained */
-	dbgprintf(" %s\n", pData->target);
 	if(pData->protocol == FORW_UDP) {
-		memset(&hints, 0, sizeof(hints));
-		/* port must be numeric, because config file syntax requires this */
-		hints.ai_flags = AI_NUMERICSERV;
-		hints.ai_family = glbl.GetDefPFFamily();
-		hints.ai_socktype = SOCK_DGRAM;
-		if((iErr = (getaddrinfo(pData->target, pData->port, &hints, &res))) != 0) {
-			dbgprintf("could not get addrinfo for hostname '%s':'%s': %d%s\n",
-				  pData->target, pData->port, iErr, gai_strerror(iErr));
-			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		/* we also get here while "connected", to pick up refreshed addresses */
+		CHKiRet(dnsCacheGet(pWrkrData->pDnsCache, &pAddrs));
+		if(pAddrs == pWrkrData->pAddrs && pWrkrData->pSockArray != NULL) {
+			dnsAddrsRelease(pWrkrData->pDnsCache, pAddrs);
+			FINALIZE;
 		}
-		dbgprintf("%s found, resuming.\n", pData->target);
-		pWrkrData->f_addr = res;
+		dbgprintf("%s found, resuming.\n", pWrkrData->target);
+		closeUDPSockets(pWrkrData);
+		pWrkrData->pAddrs = pAddrs;
+		pWrkrData->f_addr = pAddrs->ai;
 		pWrkrData->bIsConnected = 1;
-		if(pWrkrData->pSockArray == NULL) {
-			pWrkrData->pSockArray = net.create_udp_socket((uchar*)pData->target, NULL, 0, 0);
-		}
-	} else {
+		pWrkrData->pSockArray = createUDPSockets(pAddrs->ai);
+	} else if(!pWrkrData->bIsConnected) {
+		dbgprintf(" %s\n", pWrkrData->target);
 		CHKiRet(TCPSendInit((void*)pWrkrData));
 	}
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
-		if(pWrkrData->f_addr != NULL) {
-			freeaddrinfo(pWrkrData->f_addr);
-			pWrkrData->f_addr = NULL;
-		}
 		iRet = RS_RET_SUSPENDED;
 	}
 
@@ -824,7 +1811,18 @@ processMsg(wrkrInstanceData_t *__restrict__ const pWrkrData,
 
 	if(pData->protocol == FORW_UDP) {
 		/* forward via UDP */
+#		ifdef HAVE_SENDMMSG
+		/* gathered and sent at end of transaction */
+#		ifdef USE_NETZIP
+		if(psz == out) {
+			out = NULL; /* now owned by the batch */
+			CHKiRet(UDPBatchAdd(pWrkrData, psz, l, psz));
+		} else
+#		endif
+			CHKiRet(UDPBatchAdd(pWrkrData, psz, l, NULL));
+#		else
 		CHKiRet(UDPSend(pWrkrData, psz, l));
+#		endif
 	} else {
 		/* forward via TCP */
 		iRet = tcpclt.Send(pWrkrData->pTCPClt, pWrkrData, (char *)psz, l);
@@ -842,19 +1840,121 @@ finalize_it:
 	RETiRet;
 }
 
-BEGINcommitTransaction
+/* send a transaction over the target pool. Messages are distributed over
+ * the targets message by message. If a target fails, it is ejected and the
+ * whole transaction is reported as suspended; the action engine retries it
+ * right away and it is then sent to the remaining targets.
+ */
+static rsRetVal
+poolCommitTransaction(wrkrInstanceData_t *const pWrkrData,
+	actWrkrIParams_t *const pParams, const unsigned nParams)
+{
+	instanceData *const pData = pWrkrData->pData;
+	wrkrInstanceData_t *pConn;
 	unsigned i;
-CODESTARTcommitTransaction
+	DEFiRet;
+
+	for(i = 0 ; i < nParams ; ++i) {
+		CHKiRet(poolSelectConn(pWrkrData, (pData->pool.select == POOL_SELECT_HASH)
+			? actParam(pParams, pData->iNumTpls, i, 1).param : NULL, &pConn));
+		iRet = processMsg(pConn, &actParam(pParams, pData->iNumTpls, i, 0));
+		if(iRet != RS_RET_OK && iRet != RS_RET_DEFER_COMMIT && iRet != RS_RET_PREVIOUS_COMMITTED) {
+			poolEjectTarget(pData, pConn->iPoolTarget);
+			ABORT_FINALIZE(RS_RET_SUSPENDED);
+		}
+	}
+	iRet = RS_RET_OK;
+
+finalize_it:
+	if(iRet == RS_RET_OK) {
+		iRet = poolEndTransaction(pWrkrData, 1);
+	} else {
+		poolEndTransaction(pWrkrData, 0);
+	}
+	RETiRet;
+}
+
+/* send a transaction via TCP with batched framing: all frames are handed
+ * to tcpclt at once, which results in a single writev() (or TLS record
+ * sequence) instead of one send call per message.
+ */
+static rsRetVal
+TCPSendBatch(wrkrInstanceData_t *__restrict__ const pWrkrData,
+	actWrkrIParams_t *__restrict__ const pParams, const unsigned nParams)
+{
+	struct iovec *msgs;
+	const unsigned iMaxLine = (unsigned) glbl.GetMaxLine();
+	unsigned nMsgs;
+	unsigned i;
+	DEFiRet;
+
+	if(nParams > pWrkrData->maxBatchMsgs) {
+		CHKmalloc(msgs = realloc(pWrkrData->batchMsgs, sizeof(struct iovec) * nParams));
+		pWrkrData->batchMsgs = msgs;
+		pWrkrData->maxBatchMsgs = nParams;
+	}
+	msgs = pWrkrData->batchMsgs;
+
+	for(nMsgs = 0, i = 0 ; i < nParams ; ++i) {
+		actWrkrIParams_t *const iparam = &actParam(pParams, pWrkrData->pData->iNumTpls, i, 0);
+		if(iparam->lenStr == 0)
+			continue; /* nothing to frame */
+		msgs[nMsgs].iov_base = iparam->param;
+		msgs[nMsgs].iov_len = (iparam->lenStr > iMaxLine) ? iMaxLine : iparam->lenStr;
+		++nMsgs;
+	}
+
+	iRet = tcpclt.SendBatch(pWrkrData->pTCPClt, pWrkrData, msgs, nMsgs);
+	if(iRet != RS_RET_OK) {
+		dbgprintf("error forwarding batch via tcp, suspending\n");
+		DestructTCPInstanceData(pWrkrData);
+		iRet = RS_RET_SUSPENDED;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+/* Messages are reported as delivered as soon as we know they have been
+ * handed to the kernel. With plain TCP this is the case whenever the send
+ * buffer is empty, so after a connection loss only the rest is resent.
+ * The batched paths (pool, TCP batch, sendmmsg) are all-or-nothing.
+ */
+BEGINcommitBatch
+	unsigned i;
+	unsigned nDone = 0;
+CODESTARTcommitBatch
+	if(pWrkrData->poolConns != NULL) {
+		iRet = poolCommitTransaction(pWrkrData, pParams, nParams);
+		FINALIZE;
+	}
 	CHKiRet(doTryResume(pWrkrData));
 
+	if(   pWrkrData->pData->protocol == FORW_TCP
+	   && pWrkrData->pData->compressionMode != COMPRESS_SINGLE_MSG) {
+		/* single-message compression needs per-message buffers, so it
+		 * uses the classic path below.
+		 */
+		CHKiRet(TCPSendBatch(pWrkrData, pParams, nParams));
+		FINALIZE;
+	}
+
 	dbgprintf(" %s:%s/%s\n", pWrkrData->pData->target, pWrkrData->pData->port,
 		 pWrkrData->pData->protocol == FORW_UDP ? "udp" : "tcp");
 
 	for(i = 0 ; i < nParams ; ++i) {
-		iRet = processMsg(pWrkrData, &actParam(pParams, 1, i, 0));
+		iRet = processMsg(pWrkrData, &actParam(pParams, pWrkrData->pData->iNumTpls, i, 0));
 		if(iRet != RS_RET_OK && iRet != RS_RET_DEFER_COMMIT && iRet != RS_RET_PREVIOUS_COMMITTED)
 			FINALIZE;
+		if(pWrkrData->pData->protocol == FORW_TCP && pWrkrData->offsSndBuf == 0) {
+			for( ; nDone <= i ; ++nDone)
+				pResults[nDone] = RS_RET_OK;
+		}
 	}
+#	ifdef HAVE_SENDMMSG
+	if(pWrkrData->pData->protocol == FORW_UDP)
+		CHKiRet(UDPBatchFlush(pWrkrData));
+#	endif
 
 dbgprintf("omfwd: endTransaction, offsSndBuf %u, iRet %d\n", pWrkrData->offsSndBuf, iRet);
 	if(pWrkrData->offsSndBuf != 0) {
@@ -862,7 +1962,15 @@ dbgprintf("omfwd: endTransaction, offsSndBuf %u, iRet %d\n", pWrkrData->offsSndB
 		pWrkrData->offsSndBuf = 0;
 	}
 finalize_it:
-ENDcommitTransaction
+#	ifdef HAVE_SENDMMSG
+	/* in case of error, the whole (UDP) batch will be retried */
+	UDPBatchDiscard(pWrkrData);
+#	endif
+	if(iRet == RS_RET_OK || iRet == RS_RET_DEFER_COMMIT || iRet == RS_RET_PREVIOUS_COMMITTED) {
+		for( ; nDone < nParams ; ++nDone)
+			pResults[nDone] = RS_RET_OK;
+	}
+ENDcommitBatch
 
 
 /* This function loads TCP support, if not already loaded. It will be called
@@ -898,7 +2006,8 @@ initTCP(wrkrInstanceData_t *pWrkrData)
 		CHKiRet(tcpclt.SetResendLastOnRecon(pWrkrData->pTCPClt, pData->bResendLastOnRecon));
 		/* and set callbacks */
 		CHKiRet(tcpclt.SetSendInit(pWrkrData->pTCPClt, TCPSendInit));
-		CHKiRet(tcpclt.SetSendFrame(pWrkrData->pTCPClt, TCPSendFrame));
+		CHKiRet(tcpclt.SetSendFrameV(pWrkrData->pTCPClt, TCPSendFrame));
+		CHKiRet(tcpclt.SetSendBatchV(pWrkrData->pTCPClt, TCPSendBatchV));
 		CHKiRet(tcpclt.SetSendPrepRetry(pWrkrData->pTCPClt, TCPSendPrepRetry));
 		CHKiRet(tcpclt.SetFraming(pWrkrData->pTCPClt, pData->tcp_framing));
 		CHKiRet(tcpclt.SetRebindInterval(pWrkrData->pTCPClt, pData->iRebindInterval));
@@ -919,15 +2028,95 @@ setInstParamDefaults(instanceData *pData)
 	pData->iStrmDrvrMode = 0;
 	pData->iRebindInterval = 0;
 	pData->bResendLastOnRecon = 0; 
+	pData->bTcpFastOpen = 0;
+	pData->bTcpZeroCopy = 0;
 	pData->pPermPeers = NULL;
 	pData->compressionLevel = 9;
 	pData->strmCompFlushOnTxEnd = 1;
 	pData->compressionMode = COMPRESS_NEVER;
+	pData->strmCmprAlgo = CMPR_ALGO_ZLIB;
+	pData->strmCmprLevel = -1;
+	pData->pszStrmCmprDict = NULL;
 	pData->errsToReport = 5;
+	pData->poolHashTplName = NULL;
+	pData->pool.nmemb = 0;
+	pData->pool.size = 1;
+	pData->pool.select = POOL_SELECT_RR;
+	pData->pool.ejectTime = DFLT_POOL_EJECT_TIME;
+	pData->dnsTTL = DFLT_DNS_TTL;
+}
+
+
+/* add a "host", "host:port" or "[ipv6-addr]:port" entry to the pool's
+ * target list.
+ */
+static rsRetVal
+addPoolTarget(instanceData *pData, int idx, char *entry)
+{
+	char *host = entry;
+	char *port = NULL;
+	char *p;
+	DEFiRet;
+
+	if(*host == '[') {
+		++host;
+		if((p = strchr(host, ']')) == NULL) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "omfwd: invalid pool target "
+				"'%s' - missing ']'", entry);
+			ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+		}
+		*p++ = '\0';
+		if(*p == ':')
+			port = p + 1;
+	} else if((p = strchr(host, ':')) != NULL && strchr(p + 1, ':') == NULL) {
+		/* exactly one colon: host:port. Otherwise it is a plain IPv6 address */
+		*p = '\0';
+		port = p + 1;
+	}
+
+	CHKmalloc(pData->pool.targets[idx].target = strdup(host));
+	if(port != NULL && *port != '\0') {
+		CHKmalloc(pData->pool.targets[idx].port = strdup(port));
+	}
+finalize_it:
+	RETiRet;
+}
+
+/* set up the UDP forwarding stats counters */
+static rsRetVal
+setupInstStatsCtrs(instanceData *__restrict__ const pData)
+{
+	uchar ctrName[512];
+	DEFiRet;
+
+	if(pData->protocol != FORW_UDP)
+		FINALIZE;
+
+	snprintf((char*)ctrName, sizeof(ctrName), "omfwd udp %s:%s", pData->target,
+		 (pData->port == NULL) ? "514" : pData->port);
+	ctrName[sizeof(ctrName)-1] = '\0'; /* be on the save side */
+	CHKiRet(statsobj.Construct(&(pData->stats)));
+	CHKiRet(statsobj.SetName(pData->stats, ctrName));
+	STATSCOUNTER_INIT(pData->ctrUdpSent, pData->mutCtrUdpSent);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("sent"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pData->ctrUdpSent)));
+	STATSCOUNTER_INIT(pData->ctrUdpFailed, pData->mutCtrUdpFailed);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("failed"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pData->ctrUdpFailed)));
+	STATSCOUNTER_INIT(pData->ctrCallSendmmsg, pData->mutCtrCallSendmmsg);
+	CHKiRet(statsobj.AddCounter(pData->stats, UCHAR_CONSTANT("called.sendmmsg"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &(pData->ctrCallSendmmsg)));
+	CHKiRet(statsobj.ConstructFinalize(pData->stats));
+
+finalize_it:
+	RETiRet;
 }
 
+
 BEGINnewActInst
 	struct cnfparamvals *pvals;
+	char *entry;
+	int j;
 	uchar *tplToUse;
 	char *cstr;
 	int i;
@@ -1046,10 +2235,64 @@ CODESTARTnewActInst
 			pData->errsToReport = (int) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "resendlastmsgonreconnect")) {
 			pData->bResendLastOnRecon = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "tcp.fastopen")) {
+			pData->bTcpFastOpen = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "tcp.zerocopy")) {
+			pData->bTcpZeroCopy = (sbool) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "compression.stream.flushontxend")) {
 			pData->strmCompFlushOnTxEnd = (sbool) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "compression.stream.algorithm")) {
+			if(!bCmprIfLoaded) {
+				CHKiRet(objUse(cmpr, LM_CMPR_FILENAME));
+				bCmprIfLoaded = 1;
+			}
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(cmpr.GetAlgo((uchar*) cstr, &pData->strmCmprAlgo) != RS_RET_OK
+			   || pData->strmCmprAlgo == CMPR_ALGO_GZIP
+			   || !cmpr.IsSupported(pData->strmCmprAlgo)) {
+				errmsg.LogError(0, RS_RET_CMPR_ALGO_UNSUPPORTED, "omfwd: compression "
+					 "algorithm '%s' is not supported", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_CMPR_ALGO_UNSUPPORTED);
+			}
+			free(cstr);
+		} else if(!strcmp(actpblk.descr[i].name, "compression.stream.dictionary")) {
+			pData->pszStrmCmprDict = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "pool.targets")) {
+			CHKmalloc(pData->pool.targets =
+				calloc(pvals[i].val.d.ar->nmemb, sizeof(fwdPoolTarget_t)));
+			pData->pool.nmemb = pvals[i].val.d.ar->nmemb;
+			for(j = 0 ; j <  pvals[i].val.d.ar->nmemb ; ++j) {
+				CHKmalloc(entry = es_str2cstr(pvals[i].val.d.ar->arr[j], NULL));
+				iRet = addPoolTarget(pData, j, entry);
+				free(entry);
+				CHKiRet(iRet);
+			}
+		} else if(!strcmp(actpblk.descr[i].name, "dns.ttl")) {
+			pData->dnsTTL = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "pool.size")) {
+			pData->pool.size = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "pool.ejecttime")) {
+			pData->pool.ejectTime = (int) pvals[i].val.d.n;
+		} else if(!strcmp(actpblk.descr[i].name, "pool.hashtemplate")) {
+			pData->poolHashTplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "pool.select")) {
+			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(!strcasecmp(cstr, "roundrobin")) {
+				pData->pool.select = POOL_SELECT_RR;
+			} else if(!strcasecmp(cstr, "leastoutstanding")) {
+				pData->pool.select = POOL_SELECT_LEAST;
+			} else if(!strcasecmp(cstr, "hash")) {
+				pData->pool.select = POOL_SELECT_HASH;
+			} else {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "omfwd: invalid value for 'pool.select' "
+					 "parameter (given is '%s')", cstr);
+				free(cstr);
+				ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+			}
+			free(cstr);
 		} else if(!strcmp(actpblk.descr[i].name, "compression.mode")) {
 			cstr = es_str2cstr(pvals[i].val.d.estr, NULL);
 			if(!strcasecmp(cstr, "stream:always")) {
@@ -1073,6 +2316,7 @@ CODESTARTnewActInst
 
 	if(complevel != -1) {
 		pData->compressionLevel = complevel;
+		pData->strmCmprLevel = complevel;
 		if(pData->compressionMode == COMPRESS_NEVER) {
 			/* to keep compatible with pre-7.3.11, only setting the
 			 * compresion level means old-style single-message mode.
@@ -1081,10 +2325,34 @@ CODESTARTnewActInst
 		}
 	}
 
-	CODE_STD_STRING_REQUESTnewActInst(1)
+	if(pData->pool.nmemb > 0) {
+		if(pData->protocol != FORW_TCP) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "omfwd: \"pool.targets\" can only "
+					"be used with protocol tcp");
+			ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+		}
+		if(pData->target != NULL) {
+			errmsg.LogError(0, RS_RET_PARAM_ERROR, "omfwd: \"target\" and "
+					"\"pool.targets\" can not be used together");
+			ABORT_FINALIZE(RS_RET_PARAM_ERROR);
+		}
+		if(pData->pool.select == POOL_SELECT_HASH) {
+			CHKiRet(poolBuildRing(pData));
+			pData->iNumTpls = 2;
+		}
+	}
+
+	CODE_STD_STRING_REQUESTnewActInst(pData->iNumTpls)
 
 	tplToUse = ustrdup((pData->tplName == NULL) ? getDfltTpl() : pData->tplName);
 	CHKiRet(OMSRsetEntry(*ppOMSR, 0, tplToUse, OMSR_NO_RQD_TPL_OPTS));
+	if(pData->iNumTpls == 2) {
+		CHKiRet(OMSRsetEntry(*ppOMSR, 1, ustrdup((pData->poolHashTplName == NULL)
+			? UCHAR_CONSTANT("RSYSLOG_omfwdPoolHashKeyTpl") : pData->poolHashTplName),
+			OMSR_NO_RQD_TPL_OPTS));
+	}
+	CHKiRet(setupDnsCaches(pData));
+	CHKiRet(setupInstStatsCtrs(pData));
 
 CODE_STD_FINALIZERnewActInst
 	cnfparamvalsDestruct(pvals, &actpblk);
@@ -1254,6 +2522,8 @@ CODE_STD_STRING_REQUESTparseSelectorAct(1)
 			cs.pPermPeers = NULL;
 		}
 	}
+	CHKiRet(setupDnsCaches(pData));
+	CHKiRet(setupInstStatsCtrs(pData));
 CODE_STD_FINALIZERparseSelectorAct
 ENDparseSelectorAct
 
@@ -1282,13 +2552,16 @@ CODESTARTmodExit
 	objRelease(netstrm, LM_NETSTRMS_FILENAME);
 	objRelease(netstrms, LM_NETSTRMS_FILENAME);
 	objRelease(tcpclt, LM_TCPCLT_FILENAME);
+	if(bCmprIfLoaded)
+		objRelease(cmpr, LM_CMPR_FILENAME);
+	objRelease(statsobj, CORE_COMPONENT);
 	freeConfigVars();
 ENDmodExit
 
 
 BEGINqueryEtryPt
 CODESTARTqueryEtryPt
-CODEqueryEtryPt_STD_OMODTX_QUERIES
+CODEqueryEtryPt_STD_OMODBATCH_QUERIES
 CODEqueryEtryPt_STD_OMOD8_QUERIES
 CODEqueryEtryPt_STD_CONF2_QUERIES
 CODEqueryEtryPt_STD_CONF2_setModCnf_QUERIES
@@ -1321,6 +2594,7 @@ CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
 	CHKiRet(objUse(errmsg, CORE_COMPONENT));
 	CHKiRet(objUse(net,LM_NET_FILENAME));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 
 	CHKiRet(regCfSysLineHdlr((uchar *)"actionforwarddefaulttemplate", 0, eCmdHdlrGetWord, setLegacyDfltTpl, NULL, NULL));
 	CHKiRet(regCfSysLineHdlr((uchar *)"actionsendtcprebindinterval", 0, eCmdHdlrInt, NULL, &cs.iTCPRebindInterval, NULL));
@@ -58,6 +58,7 @@ DEFobjCurrIf(datetime)
 
 /* static data */
 static int bParseHOSTNAMEandTAG;	/* cache for the equally-named global param - performance enhancement */
+static uchar isHostnameChar[256];	/* chars permitted in a HOSTNAME, set up in modInit */
 
 
 BEGINisCompatibleWithFeature
@@ -75,6 +76,8 @@ BEGINparse
 	uchar *p2parse;
 	int lenMsg;
 	int i;	/* general index for parsing */
+	int lenMax;
+	uchar *pEnd;
 	uchar bufParseTAG[CONF_TAG_MAXSIZE];
 	uchar bufParseHOSTNAME[CONF_HOSTNAME_MAXSIZE];
 CODESTARTparse
@@ -94,8 +97,8 @@ CODESTARTparse
 	if(datetime.ParseTIMESTAMP3339(&(pMsg->tTIMESTAMP), &p2parse, &lenMsg) == RS_RET_OK) {
 		/* we are done - parse pointer is moved by ParseTIMESTAMP3339 */;
 	} else if(datetime.ParseTIMESTAMP3164(&(pMsg->tTIMESTAMP), &p2parse, &lenMsg) == RS_RET_OK) {
-		if(pMsg->dfltTZ[0] != '\0')
-			applyDfltTZ(&pMsg->tTIMESTAMP, pMsg->dfltTZ);
+		if(MsgGetDfltTZ(pMsg)[0] != '\0')
+			applyDfltTZ(&pMsg->tTIMESTAMP, MsgGetDfltTZ(pMsg));
 		/* we are done - parse pointer is moved by ParseTIMESTAMP3164 */;
 	} else if(*p2parse == ' ' && lenMsg > 1) { /* try to see if it is slighly malformed - HP procurve seems to do that sometimes */
 		++p2parse;	/* move over space */
@@ -138,12 +141,10 @@ CODESTARTparse
 		 * that is not a valid hostname.
 		 */
 		if(lenMsg > 0 && pMsg->msgFlags & PARSE_HOSTNAME) {
-			i = 0;
-			while(i < lenMsg && (isalnum(p2parse[i]) || p2parse[i] == '.'
-				|| p2parse[i] == '_' || p2parse[i] == '-') && i < (CONF_HOSTNAME_MAXSIZE - 1)) {
-				bufParseHOSTNAME[i] = p2parse[i];
-				++i;
-			}
+			lenMax = (lenMsg < CONF_HOSTNAME_MAXSIZE - 1) ? lenMsg : CONF_HOSTNAME_MAXSIZE - 1;
+			for(i = 0 ; i < lenMax && isHostnameChar[p2parse[i]] ; ++i)
+				;
+			memcpy(bufParseHOSTNAME, p2parse, i);
 
 			if(i == lenMsg) {
 				/* we have a message that is empty immediately after the hostname,
@@ -175,11 +176,13 @@ CODESTARTparse
 		 * in RFC3164...). We now receive the full size, but will modify the
 		 * outputs so that only 32 characters max are used by default.
 		 */
-		i = 0;
-		while(lenMsg > 0 && *p2parse != ':' && *p2parse != ' ' && i < CONF_TAG_MAXSIZE - 2) {
-			bufParseTAG[i++] = *p2parse++;
-			--lenMsg;
-		}
+		lenMax = (lenMsg < CONF_TAG_MAXSIZE - 2) ? lenMsg : CONF_TAG_MAXSIZE - 2;
+		if((pEnd = memchr(p2parse, ':', lenMax)) != NULL)
+			lenMax = pEnd - p2parse;
+		i = ((pEnd = memchr(p2parse, ' ', lenMax)) == NULL) ? lenMax : pEnd - p2parse;
+		memcpy(bufParseTAG, p2parse, i);
+		p2parse += i;
+		lenMsg -= i;
 		if(lenMsg > 0 && *p2parse == ':') {
 			++p2parse; 
 			--lenMsg;
@@ -222,6 +225,7 @@ ENDqueryEtryPt
 
 
 BEGINmodInit(pmrfc3164)
+	int i;
 CODESTARTmodInit
 	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
 CODEmodInit_QueryRegCFSLineHdlr
@@ -231,6 +235,8 @@ CODEmodInit_QueryRegCFSLineHdlr
 	CHKiRet(objUse(datetime, CORE_COMPONENT));
 
 	DBGPRINTF("rfc3164 parser init called\n");
+	for(i = 0 ; i < 256 ; ++i)
+		isHostnameChar[i] = isalnum(i) || i == '.' || i == '_' || i == '-';
  	bParseHOSTNAMEandTAG = glbl.GetParseHOSTNAMEandTAG(); /* cache value, is set only during rsyslogd option processing */
 
 
@@ -141,8 +141,10 @@ static int parseRFCStructuredData(uchar **pp2parse, uchar *pResult, int *pLenStr
 	 * structured data. There may also be \] inside the structured data, which
 	 * do NOT terminate an element.
 	 */
-	if(lenStr == 0 || (*p2parse != '[' && *p2parse != '-'))
+	if(lenStr == 0 || (*p2parse != '[' && *p2parse != '-')) {
+		*pResult = '\0';
 		return 1; /* this is NOT structured data! */
+	}
 
 	if(*p2parse == '-') { /* empty structured data? */
 		*pResult++ = '-';
@@ -193,6 +195,80 @@ static int parseRFCStructuredData(uchar **pp2parse, uchar *pResult, int *pLenStr
 	return iRet;
 }
 
+/* Fast paths for the header fields. They locate the field end with
+ * memchr() and copy the field into a caller-provided (stack) buffer of
+ * size lenBuf. If the field does not fit or looks unusual, they return
+ * 1 without consuming anything, so that the caller can fall back to the
+ * generic functions above. If they succeed, the result is exactly what
+ * the generic functions would have returned.
+ */
+static inline int
+parseRFCFieldFast(uchar **pp2parse, uchar *pResult, int lenBuf, int *pLenStr)
+{
+	uchar *p2parse = *pp2parse;
+	uchar *pSP;
+	int lenFld;
+
+	pSP = memchr(p2parse, ' ', *pLenStr);
+	lenFld = (pSP == NULL) ? *pLenStr : pSP - p2parse;
+	if(lenFld >= lenBuf)
+		return 1;
+	memcpy(pResult, p2parse, lenFld);
+	pResult[lenFld] = '\0';
+	if(pSP == NULL) {
+		/* the generic parser also consumes the field, but flags an error */
+		*pp2parse += lenFld;
+		*pLenStr -= lenFld;
+	} else {
+		*pp2parse += lenFld + 1;
+		*pLenStr -= lenFld + 1;
+	}
+	return 0;
+}
+
+static inline int
+parseRFCStructuredDataFast(uchar **pp2parse, uchar *pResult, int lenBuf, int *pLenStr)
+{
+	uchar *p2parse = *pp2parse;
+	const int lenStr = *pLenStr;
+	uchar *pEnd;
+	int i;
+
+	if(lenStr == 0)
+		return 1;
+	if(*p2parse == '-') {
+		pResult[0] = '-';
+		pResult[1] = '\0';
+		i = 1;
+	} else if(*p2parse == '[') {
+		/* find the first ']' that is not escaped and followed by SP or
+		 * the end of the message. If there is none, the SD is malformed
+		 * and we leave it to the generic code.
+		 */
+		i = 1;
+		while(1) {
+			if((pEnd = memchr(p2parse + i, ']', lenStr - i)) == NULL)
+				return 1;
+			i = pEnd - p2parse + 1;
+			if(pEnd[-1] != '\\' && (i == lenStr || *(pEnd+1) == ' '))
+				break;
+		}
+		if(i >= lenBuf)
+			return 1;
+		memcpy(pResult, p2parse, i);
+		pResult[i] = '\0';
+		if(i < lenStr)
+			++i; /* eat SP after ']' */
+	} else {
+		return 1;
+	}
+	if(i < lenStr && p2parse[i] == ' ')
+		++i;
+	*pp2parse += i;
+	*pLenStr -= i;
+	return 0;
+}
+
 /* parse a RFC5424-formatted syslog message. This function returns
  * 0 if processing of the message shall continue and 1 if something
  * went wrong and this messe should be ignored. This function has been
@@ -212,7 +288,9 @@ static int parseRFCStructuredData(uchar **pp2parse, uchar *pResult, int *pLenStr
  */
 BEGINparse
 	uchar *p2parse;
+	uchar fieldBuf[2048];
 	uchar *pBuf = NULL;
+	uchar *pFld;
 	int lenMsg;
 	int bContParse = 1;
 CODESTARTparse
@@ -230,13 +308,6 @@ CODESTARTparse
 	p2parse += 2;
 	lenMsg -= 2;
 
-	/* Now get us some memory we can use as a work buffer while parsing.
-	 * We simply allocated a buffer sufficiently large to hold all of the
-	 * message, so we can not run into any troubles. I think this is
-	 * wiser than to use individual buffers.
-	 */
-	CHKmalloc(pBuf = MALLOC(sizeof(uchar) * (lenMsg + 1)));
-		
 	/* IMPORTANT NOTE:
 	 * Validation is not actually done below nor are any errors handled. I have
 	 * NOT included this for the current proof of concept. However, it is strongly
@@ -255,35 +326,51 @@ CODESTARTparse
 		bContParse = 0;
 	}
 
+	/* For the header fields, we use a stack buffer which is sufficient for
+	 * the vast majority of messages. Only if a field does not fit (or is
+	 * malformed), we get us a work buffer large enough to hold the rest of
+	 * the message and use the generic parsers.
+	 */
+#	define GET_FIELD(fieldParser) \
+		if(fieldParser##Fast(&p2parse, fieldBuf, sizeof(fieldBuf), &lenMsg) == 0) { \
+			pFld = fieldBuf; \
+		} else { \
+			if(pBuf == NULL) \
+				CHKmalloc(pBuf = MALLOC(sizeof(uchar) * (lenMsg + 1))); \
+			fieldParser(&p2parse, pBuf, &lenMsg); \
+			pFld = pBuf; \
+		}
+
 	/* HOSTNAME */
 	if(bContParse) {
-		parseRFCField(&p2parse, pBuf, &lenMsg);
-		MsgSetHOSTNAME(pMsg, pBuf, ustrlen(pBuf));
+		GET_FIELD(parseRFCField);
+		MsgSetHOSTNAME(pMsg, pFld, ustrlen(pFld));
 	}
 
 	/* APP-NAME */
 	if(bContParse) {
-		parseRFCField(&p2parse, pBuf, &lenMsg);
-		MsgSetAPPNAME(pMsg, (char*)pBuf);
+		GET_FIELD(parseRFCField);
+		MsgSetAPPNAME(pMsg, (char*)pFld);
 	}
 
 	/* PROCID */
 	if(bContParse) {
-		parseRFCField(&p2parse, pBuf, &lenMsg);
-		MsgSetPROCID(pMsg, (char*)pBuf);
+		GET_FIELD(parseRFCField);
+		MsgSetPROCID(pMsg, (char*)pFld);
 	}
 
 	/* MSGID */
 	if(bContParse) {
-		parseRFCField(&p2parse, pBuf, &lenMsg);
-		MsgSetMSGID(pMsg, (char*)pBuf);
+		GET_FIELD(parseRFCField);
+		MsgSetMSGID(pMsg, (char*)pFld);
 	}
 
 	/* STRUCTURED-DATA */
 	if(bContParse) {
-		parseRFCStructuredData(&p2parse, pBuf, &lenMsg);
-		MsgSetStructuredData(pMsg, (char*)pBuf);
+		GET_FIELD(parseRFCStructuredData);
+		MsgSetStructuredData(pMsg, (char*)pFld);
 	}
+#	undef GET_FIELD
 
 	/* MSG */
 	MsgSetMSGoffs(pMsg, p2parse - pMsg->pszRawMsg);
@@ -31,16 +31,22 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
 #include <gcrypt.h>
 
 #include "rsyslog.h"
 #include "libgcry.h"
 
+#if GCRYPT_VERSION_NUMBER < 0x010600
+/* older libgcrypt needs to be told we are multi-threaded */
+GCRY_THREAD_OPTION_PTHREAD_IMPL;
+#endif
+
 
 static enum { MD_DECRYPT, MD_WRITE_KEYFILE
 } mode = MD_DECRYPT;
 static int verbose = 0;
-static gcry_cipher_hd_t gcry_chd;
 static size_t blkLength;
 
 static char *keyfile = NULL;
@@ -143,14 +149,35 @@ eiGetIV(FILE *eifp, char *iv, size_t leniv)
 done:	return r;
 }
 
+/* reads the END record and the TAG record that may precede it.
+ * *pHaveTag is set if a tag was found.
+ */
 static int
-eiGetEND(FILE *eifp, off64_t *offs)
+eiGetEND(FILE *eifp, off64_t *offs, char *tag, int *pHaveTag)
 {
 	char rectype[EIF_MAX_RECTYPE_LEN+1];
 	char value[EIF_MAX_VALUE_LEN+1];
+	size_t i;
 	int r;
 
+	*pHaveTag = 0;
 	if((r = eiGetRecord(eifp, rectype, value)) != 0) goto done;
+	if(!strcmp(rectype, "TAG")) {
+		if(strlen(value) != 2 * RSGCRY_TAG_LEN) {
+			fprintf(stderr, "invalid TAG '%s'\n", value);
+			r = 1; goto done;
+		}
+		for(i = 0 ; i < RSGCRY_TAG_LEN ; ++i) {
+			unsigned byte;
+			if(sscanf(value + 2 * i, "%2x", &byte) != 1) {
+				fprintf(stderr, "invalid TAG '%s'\n", value);
+				r = 1; goto done;
+			}
+			tag[i] = (char) byte;
+		}
+		*pHaveTag = 1;
+		if((r = eiGetRecord(eifp, rectype, value)) != 0) goto done;
+	}
 	if(strcmp(rectype, "END")) {
 		fprintf(stderr, "no END record found when expected, record type "
 			"seen is '%s'\n", rectype);
@@ -161,55 +188,6 @@ eiGetEND(FILE *eifp, off64_t *offs)
 done:	return r;
 }
 
-static int
-initCrypt(FILE *eifp)
-{
- 	int r = 0;
-	gcry_error_t gcryError;
-	char iv[4096];
-
-	blkLength = gcry_cipher_get_algo_blklen(cry_algo);
-	if(blkLength > sizeof(iv)) {
-		fprintf(stderr, "internal error[%s:%d]: block length %d too large for "
-			"iv buffer\n", __FILE__, __LINE__, blkLength);
-		r = 1; goto done;
-	}
-	if((r = eiGetIV(eifp, iv, blkLength)) != 0) goto done;
-
-	size_t keyLength = gcry_cipher_get_algo_keylen(cry_algo);
-	if(strlen(cry_key) != keyLength) {
-		fprintf(stderr, "invalid key length; key is %u characters, but "
-			"exactly %u characters are required\n", cry_keylen,
-			keyLength);
-		r = 1; goto done;
-	}
-
-	gcryError = gcry_cipher_open(&gcry_chd, cry_algo, cry_mode, 0);
-	if (gcryError) {
-		printf("gcry_cipher_open failed:  %s/%s\n",
-			gcry_strsource(gcryError),
-			gcry_strerror(gcryError));
-		r = 1; goto done;
-	}
-
-	gcryError = gcry_cipher_setkey(gcry_chd, cry_key, keyLength);
-	if (gcryError) {
-		printf("gcry_cipher_setkey failed:  %s/%s\n",
-			gcry_strsource(gcryError),
-			gcry_strerror(gcryError));
-		r = 1; goto done;
-	}
-
-	gcryError = gcry_cipher_setiv(gcry_chd, iv, blkLength);
-	if (gcryError) {
-		printf("gcry_cipher_setiv failed:  %s/%s\n",
-			gcry_strsource(gcryError),
-			gcry_strerror(gcryError));
-		r = 1; goto done;
-	}
-done: return r;
-}
-
 static inline void
 removePadding(char *buf, size_t *plen)
 {
@@ -232,99 +210,361 @@ removePadding(char *buf, size_t *plen)
 done:	return;
 }
 
+/* Decryption is done by a pool of worker threads. The log files are
+ * mmap()ed and cut into units of work. Crypto blocks (IV..END) are
+ * independent of each other. Inside a block, CBC, CFB and ECB can be
+ * decrypted starting at any cipher block boundary, using the preceding
+ * ciphertext block as IV, and CTR by advancing the counter. So for these
+ * modes large crypto blocks are split into units of DECR_UNIT_SIZE bytes.
+ * All other modes (and GCM, where the tag covers the whole block) are
+ * processed one crypto block per unit. The main thread writes the units
+ * in order, so the output is the same as with sequential processing.
+ */
+#define DECR_UNIT_SIZE (1024*1024) /* must be a multiple of all cipher block sizes */
+#define DECR_MAX_BLKLEN 64
+#define DECR_UNITS_PER_JOB 4 /* max units in flight per worker */
+
+struct decrUnit {
+	const char *data;	/* ciphertext, points into the mmapped log file */
+	size_t len;
+	char iv[DECR_MAX_BLKLEN];
+	char tag[RSGCRY_TAG_LEN];
+	int bHaveTag;
+	off64_t blkEnd;		/* for error messages */
+	char *out;		/* decrypted data, set by worker */
+	size_t lenOut;
+	char *msg;		/* message to emit after the data, if any */
+	void *mapAddr;		/* set on the last unit of a file: unmap after writing */
+	size_t mapLen;
+	int bDone;
+};
+
+static int nJobs = 0; /* number of worker threads, 0 - number of CPUs */
+static struct decrUnit *units = NULL;
+static size_t nUnits = 0;
+static size_t maxUnits = 0;
+static size_t nextUnit = 0;	/* next unit to be picked up by a worker */
+static size_t nWritten = 0;	/* units already written */
+static pthread_mutex_t mutUnits = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t condDone = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t condSpace = PTHREAD_COND_INITIALIZER;
+
+static struct decrUnit *
+addUnit(void)
+{
+	struct decrUnit *newUnits;
+	size_t newMax;
+
+	if(nUnits == maxUnits) {
+		newMax = (maxUnits == 0) ? 64 : 2 * maxUnits;
+		if((newUnits = realloc(units, newMax * sizeof(struct decrUnit))) == NULL) {
+			perror("rscryutil");
+			exit(1);
+		}
+		units = newUnits;
+		maxUnits = newMax;
+	}
+	memset(&units[nUnits], 0, sizeof(struct decrUnit));
+	return &units[nUnits++];
+}
+
+/* add a message-only unit, so that it is emitted in sequence */
 static void
-decryptBlock(FILE *fpin, FILE *fpout, off64_t blkEnd, off64_t *pCurrOffs)
+addMsgUnit(const char *fmt, const char *arg)
 {
-	gcry_error_t gcryError;
-	size_t nRead, nWritten;
-	size_t toRead;
-	size_t leftTillBlkEnd;
-	char buf[64*1024];
-	
-	leftTillBlkEnd = blkEnd - *pCurrOffs;
+	struct decrUnit *u;
+	char buf[4096+128];
+
+	snprintf(buf, sizeof(buf), fmt, arg);
+	u = addUnit();
+	u->msg = strdup(buf);
+}
+
+static inline int
+modeIsSplittable(int mode)
+{
+	return mode == GCRY_CIPHER_MODE_CBC || mode == GCRY_CIPHER_MODE_CFB
+	    || mode == GCRY_CIPHER_MODE_ECB || mode == GCRY_CIPHER_MODE_CTR;
+}
+
+/* compute the IV (CTR: counter) for a unit starting offsInBlk bytes
+ * into the crypto block.
+ */
+static void
+unitIV(char *iv, const char *blkIV, const char *blkData, size_t offsInBlk)
+{
+	unsigned long long nBlks;
+	unsigned carry;
+	int i;
+
+	if(offsInBlk == 0 || cry_mode == GCRY_CIPHER_MODE_ECB) {
+		memcpy(iv, blkIV, blkLength);
+	} else if(cry_mode == GCRY_CIPHER_MODE_CTR) {
+		/* big endian counter + number of cipher blocks */
+		memcpy(iv, blkIV, blkLength);
+		nBlks = offsInBlk / blkLength;
+		carry = 0;
+		for(i = blkLength - 1 ; i >= 0 ; --i) {
+			carry += (unsigned char) iv[i] + (unsigned) (nBlks & 0xff);
+			iv[i] = (char) (carry & 0xff);
+			carry >>= 8;
+			nBlks >>= 8;
+		}
+	} else { /* CBC, CFB */
+		memcpy(iv, blkData + offsInBlk - blkLength, blkLength);
+	}
+}
+
+/* plan the decryption of a single file. Returns 0 on success. The
+ * units are appended to the unit table.
+ */
+static int
+planFile(char *name)
+{
+	FILE *eifp = NULL;
+	int fd = -1;
+	struct stat sb;
+	char *map = NULL;
+	size_t mapLen = 0;
+	char eifname[4096];
+	char iv[DECR_MAX_BLKLEN];
+	char tag[RSGCRY_TAG_LEN];
+	int bHaveTag;
+	off64_t blkEnd;
+	off64_t currOffs = 0;
+	size_t blkLen, offs, len;
+	struct decrUnit *u;
+	size_t frstUnit = nUnits;
+	int r = 0;
+
+	if(!strcmp(name, "-")) {
+		addMsgUnit("decrypt mode cannot work on stdin\n", NULL);
+		r = 1; goto done;
+	}
+	if((fd = open(name, O_RDONLY)) == -1 || fstat(fd, &sb) != 0) {
+		addMsgUnit("%s: could not open log file\n", name);
+		r = 1; goto done;
+	}
+	snprintf(eifname, sizeof(eifname), "%s%s", name, ENCINFO_SUFFIX);
+	eifname[sizeof(eifname)-1] = '\0';
+	if((eifp = fopen(eifname, "r")) == NULL) {
+		addMsgUnit("%s: could not open encryption info file\n", eifname);
+		r = 1; goto done;
+	}
+	if((r = eiCheckFiletype(eifp)) != 0)
+		goto done;
+	mapLen = (size_t) sb.st_size;
+	if(mapLen > 0) {
+		map = mmap(NULL, mapLen, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(map == MAP_FAILED) {
+			map = NULL;
+			addMsgUnit("%s: could not mmap log file\n", name);
+			r = 1; goto done;
+		}
+		madvise(map, mapLen, MADV_SEQUENTIAL);
+	}
+
 	while(1) {
-		toRead = sizeof(buf) <= leftTillBlkEnd ? sizeof(buf) : leftTillBlkEnd;
-		toRead = toRead - toRead % blkLength;
-		nRead = fread(buf, 1, toRead, fpin);
-		if(nRead == 0)
+		if(eiGetIV(eifp, iv, blkLength) != 0)
 			break;
-		leftTillBlkEnd -= nRead, *pCurrOffs += nRead;
-		gcryError = gcry_cipher_decrypt(
-				gcry_chd, // gcry_cipher_hd_t
-				buf,    // void *
-				nRead,    // size_t
-				NULL,    // const void *
-				0);   // size_t
-		if (gcryError) {
-			fprintf(stderr, "gcry_cipher_decrypt failed:  %s/%s\n",
-			gcry_strsource(gcryError),
-			gcry_strerror(gcryError));
-			return;
+		if(eiGetEND(eifp, &blkEnd, tag, &bHaveTag) != 0)
+			break;
+		if(blkEnd > (off64_t) mapLen)
+			blkEnd = (off64_t) mapLen;
+		if(blkEnd <= currOffs)
+			continue;
+		blkLen = blkEnd - currOffs;
+		if(!rsgcryModeIsStream(cry_mode))
+			blkLen -= blkLen % blkLength;
+		for(offs = 0 ; offs < blkLen ; offs += len) {
+			if(modeIsSplittable(cry_mode) && blkLen - offs > DECR_UNIT_SIZE)
+				len = DECR_UNIT_SIZE;
+			else
+				len = blkLen - offs;
+			u = addUnit();
+			u->data = map + currOffs + offs;
+			u->len = len;
+			u->blkEnd = blkEnd;
+			unitIV(u->iv, iv, map + currOffs, offs);
+			if(offs + len == blkLen && bHaveTag) {
+				memcpy(u->tag, tag, sizeof(tag));
+				u->bHaveTag = 1;
+			}
 		}
-		removePadding(buf, &nRead);
-		nWritten = fwrite(buf, 1, nRead, fpout);
-		if(nWritten != nRead) {
-			perror("fpout");
-			return;
+		currOffs = blkEnd;
+	}
+
+done:
+	if(r != 0)
+		addMsgUnit("error processing file %s\n", name);
+	if(map != NULL) {
+		if(nUnits > frstUnit) {
+			units[nUnits-1].mapAddr = map;
+			units[nUnits-1].mapLen = mapLen;
+		} else {
+			munmap(map, mapLen);
 		}
 	}
+	if(eifp != NULL)
+		fclose(eifp);
+	if(fd != -1)
+		close(fd);
+	return r;
 }
 
+/* decrypt a single unit. Errors are reported via u->msg. */
+static void
+decryptUnit(struct decrUnit *u)
+{
+	gcry_cipher_hd_t chd;
+	gcry_error_t gcryError;
+	char msg[1024];
 
-static int
-doDecrypt(FILE *logfp, FILE *eifp, FILE *outfp)
+	if(u->data == NULL)
+		return; /* message-only unit */
+	if((u->out = malloc(u->len)) == NULL) {
+		u->msg = strdup("rscryutil: out of memory\n");
+		return;
+	}
+	gcryError = gcry_cipher_open(&chd, cry_algo, cry_mode, 0);
+	if(gcryError) {
+		snprintf(msg, sizeof(msg), "gcry_cipher_open failed:  %s/%s\n",
+			gcry_strsource(gcryError), gcry_strerror(gcryError));
+		u->msg = strdup(msg);
+		return;
+	}
+	gcryError = gcry_cipher_setkey(chd, cry_key, cry_keylen);
+	if(gcryError) {
+		snprintf(msg, sizeof(msg), "gcry_cipher_setkey failed:  %s/%s\n",
+			gcry_strsource(gcryError), gcry_strerror(gcryError));
+		goto done;
+	}
+	if(cry_mode == GCRY_CIPHER_MODE_CTR)
+		gcryError = gcry_cipher_setctr(chd, u->iv, blkLength);
+	else
+		gcryError = gcry_cipher_setiv(chd, u->iv, blkLength);
+	if(gcryError) {
+		snprintf(msg, sizeof(msg), "gcry_cipher_setiv failed:  %s/%s\n",
+			gcry_strsource(gcryError), gcry_strerror(gcryError));
+		goto done;
+	}
+	gcryError = gcry_cipher_decrypt(chd, u->out, u->len, u->data, u->len);
+	if(gcryError) {
+		snprintf(msg, sizeof(msg), "gcry_cipher_decrypt failed:  %s/%s\n",
+			gcry_strsource(gcryError), gcry_strerror(gcryError));
+		goto done;
+	}
+	u->lenOut = u->len;
+#	ifdef RSGCRY_HAVE_GCM
+	if(u->bHaveTag && gcry_cipher_checktag(chd, u->tag, sizeof(u->tag)) != 0) {
+		snprintf(msg, sizeof(msg), "WARNING: block ending at offset %lld failed "
+			"authentication - log file was modified or is corrupt\n",
+			(long long) u->blkEnd);
+		u->msg = strdup(msg);
+	}
+#	endif
+	if(!rsgcryModeIsStream(cry_mode))
+		removePadding(u->out, &u->lenOut);
+	msg[0] = '\0';
+done:
+	if(msg[0] != '\0' && u->msg == NULL)
+		u->msg = strdup(msg);
+	gcry_cipher_close(chd);
+}
+
+static void *
+decryptWorker(void __attribute__((unused)) *arg)
 {
-	off64_t blkEnd;
-	off64_t currOffs = 0;
-	int r;
+	size_t i;
 
+	pthread_mutex_lock(&mutUnits);
 	while(1) {
-		/* process block */
-		if(initCrypt(eifp) != 0)
-			goto done;
-		if((r = eiGetEND(eifp, &blkEnd)) != 0) goto done;
-		decryptBlock(logfp, outfp, blkEnd, &currOffs);
-		gcry_cipher_close(gcry_chd);
+		while(nextUnit < nUnits && nextUnit >= nWritten + nJobs * DECR_UNITS_PER_JOB)
+			pthread_cond_wait(&condSpace, &mutUnits);
+		if(nextUnit >= nUnits)
+			break;
+		i = nextUnit++;
+		pthread_mutex_unlock(&mutUnits);
+		decryptUnit(&units[i]);
+		pthread_mutex_lock(&mutUnits);
+		units[i].bDone = 1;
+		pthread_cond_broadcast(&condDone);
 	}
-	r = 0;
-done:	return r;
+	pthread_mutex_unlock(&mutUnits);
+	return NULL;
 }
 
 static void
-decrypt(char *name)
+decrypt(char **names, int nNames)
 {
-	FILE *logfp = NULL, *eifp = NULL;
-	int r = 0;
-	char eifname[4096];
-	
-	if(!strcmp(name, "-")) {
-		fprintf(stderr, "decrypt mode cannot work on stdin\n");
-		goto err;
-	} else {
-		if((logfp = fopen(name, "r")) == NULL) {
-			perror(name);
-			goto err;
-		}
-		snprintf(eifname, sizeof(eifname), "%s%s", name, ENCINFO_SUFFIX);
-		eifname[sizeof(eifname)-1] = '\0';
-		if((eifp = fopen(eifname, "r")) == NULL) {
-			perror(eifname);
-			goto err;
-		}
-		if(eiCheckFiletype(eifp) != 0)
-			goto err;
+	pthread_t *workers;
+	struct decrUnit *u;
+	int nStarted;
+	int i;
+
+	blkLength = gcry_cipher_get_algo_blklen(cry_algo);
+	if(blkLength > DECR_MAX_BLKLEN) {
+		fprintf(stderr, "internal error[%s:%d]: block length %zd too large for "
+			"iv buffer\n", __FILE__, __LINE__, blkLength);
+		return;
+	}
+	size_t keyLength = gcry_cipher_get_algo_keylen(cry_algo);
+	if(cry_keylen != keyLength) {
+		fprintf(stderr, "invalid key length; key is %u characters, but "
+			"exactly %zd characters are required\n", cry_keylen,
+			keyLength);
+		return;
 	}
 
-	doDecrypt(logfp, eifp, stdout);
+	for(i = 0 ; i < nNames ; ++i)
+		planFile(names[i]);
 
-	fclose(logfp); logfp = NULL;
-	fclose(eifp); eifp = NULL;
-	return;
+	if(nJobs <= 0)
+		nJobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if(nJobs <= 0)
+		nJobs = 1;
+	if((workers = calloc(nJobs, sizeof(pthread_t))) == NULL) {
+		perror("rscryutil");
+		exit(1);
+	}
+	for(nStarted = 0 ; nStarted < nJobs ; ++nStarted)
+		if(pthread_create(&workers[nStarted], NULL, decryptWorker, NULL) != 0)
+			break;
+	if(nStarted == 0) {
+		fprintf(stderr, "rscryutil: could not create worker thread\n");
+		exit(1);
+	}
+	if(verbose)
+		fprintf(stderr, "decrypting %zd units with %d threads\n", nUnits, nStarted);
+
+	for(nWritten = 0 ; nWritten < nUnits ; ) {
+		u = &units[nWritten];
+		pthread_mutex_lock(&mutUnits);
+		while(!u->bDone)
+			pthread_cond_wait(&condDone, &mutUnits);
+		pthread_mutex_unlock(&mutUnits);
+		if(u->lenOut > 0 && fwrite(u->out, 1, u->lenOut, stdout) != u->lenOut) {
+			perror("stdout");
+			exit(1);
+		}
+		if(u->msg != NULL) {
+			fflush(stdout);
+			fputs(u->msg, stderr);
+		}
+		free(u->out);
+		free(u->msg);
+		if(u->mapAddr != NULL)
+			munmap(u->mapAddr, u->mapLen);
+		pthread_mutex_lock(&mutUnits);
+		++nWritten;
+		pthread_cond_broadcast(&condSpace);
+		pthread_mutex_unlock(&mutUnits);
+	}
 
-err:
-	fprintf(stderr, "error %d processing file %s\n", r, name);
-	if(logfp != NULL)
-		fclose(logfp);
+	for(i = 0 ; i < nStarted ; ++i)
+		pthread_join(workers[i], NULL);
+	free(workers);
+	free(units);
 }
 
 static void
@@ -409,19 +649,19 @@ static struct option long_options[] =
 	{"key-program", required_argument, NULL, 'p'},
 	{"algo", required_argument, NULL, 'a'},
 	{"mode", required_argument, NULL, 'm'},
+	{"jobs", required_argument, NULL, 'j'},
 	{NULL, 0, NULL, 0} 
 }; 
 
 int
 main(int argc, char *argv[])
 {
-	int i;
 	int opt;
 	int temp;
 	char *newKeyFile = NULL;
 
 	while(1) {
-		opt = getopt_long(argc, argv, "a:dfk:K:m:p:r:vVW:", long_options, NULL);
+		opt = getopt_long(argc, argv, "a:dfj:k:K:m:p:r:vVW:", long_options, NULL);
 		if(opt == -1)
 			break;
 		switch(opt) {
@@ -474,6 +714,9 @@ main(int argc, char *argv[])
 			}
 			cry_mode = temp;
 			break;
+		case 'j':
+			nJobs = atoi(optarg);
+			break;
 		case 'v':
 			verbose = 1;
 			break;
@@ -488,6 +731,10 @@ main(int argc, char *argv[])
 		}
 	}
 
+#	if GCRYPT_VERSION_NUMBER < 0x010600
+	gcry_control(GCRYCTL_SET_THREAD_CBS, &gcry_threads_pthread);
+#	endif
+	gcry_check_version(NULL);
 	setKey();
 
 	if(mode == MD_WRITE_KEYFILE) {
@@ -498,11 +745,11 @@ main(int argc, char *argv[])
 		}
 		write_keyfile(newKeyFile);
 	} else {
-		if(optind == argc)
-			decrypt("-");
-		else {
-			for(i = optind ; i < argc ; ++i)
-				decrypt(argv[i]);
+		if(optind == argc) {
+			char *stdinName = "-";
+			decrypt(&stdinName, 1);
+		} else {
+			decrypt(argv + optind, argc - optind);
 		}
 	}
 
@@ -30,6 +30,7 @@
 #include <gt_base.h>
 #include <gt_http.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include "librsgt.h"
 
@@ -183,13 +184,21 @@ done:
 	return r;
 }
 
+static void
+reportIOErr(FILE *errfp, const char *what)
+{
+	fprintf(errfp, "%s: %s\n", what, strerror(errno));
+}
+
 /* We handle both verify and extend with the same function as they
  * are very similiar.
  *
  * note: here we need to have the LOG file name, not signature!
+ * All messages go to errfp, so that concurrent verifications do not
+ * mix up their output.
  */
 static void
-verify(char *name)
+verify(char *name, FILE *errfp)
 {
 	FILE *logfp = NULL, *sigfp = NULL, *nsigfp = NULL;
 	block_sig_t *bs = NULL;
@@ -202,26 +211,27 @@ verify(char *name)
 	char nsigfname[4096];
 	gterrctx_t ectx;
 	
+	rsgt_errctxInit(&ectx);
 	if(!strcmp(name, "-")) {
-		fprintf(stderr, "%s mode cannot work on stdin\n",
+		fprintf(errfp, "%s mode cannot work on stdin\n",
 			mode == MD_VERIFY ? "verify" : "extend");
 		goto err;
 	} else {
 		snprintf(sigfname, sizeof(sigfname), "%s.gtsig", name);
 		sigfname[sizeof(sigfname)-1] = '\0';
 		if((logfp = fopen(name, "r")) == NULL) {
-			perror(name);
+			reportIOErr(errfp, name);
 			goto err;
 		}
 		if((sigfp = fopen(sigfname, "r")) == NULL) {
-			perror(sigfname);
+			reportIOErr(errfp, sigfname);
 			goto err;
 		}
 		if(mode == MD_EXTEND) {
 			snprintf(nsigfname, sizeof(nsigfname), "%s.gtsig.new", name);
 			nsigfname[sizeof(nsigfname)-1] = '\0';
 			if((nsigfp = fopen(nsigfname, "w")) == NULL) {
-				perror(nsigfname);
+				reportIOErr(errfp, nsigfname);
 				goto err;
 			}
 			snprintf(oldsigfname, sizeof(oldsigfname),
@@ -230,23 +240,21 @@ verify(char *name)
 		}
 	}
 
-	rsgtInit("rsyslog rsgtutil " VERSION);
-	rsgt_errctxInit(&ectx);
 	ectx.verbose = verbose;
-	ectx.fp = stderr;
+	ectx.fp = errfp;
 	ectx.filename = strdup(sigfname);
 
 	if((r = rsgt_chkFileHdr(sigfp, "LOGSIG10")) != 0) goto done;
 	if(mode == MD_EXTEND) {
 		if(fwrite("LOGSIG10", 8, 1, nsigfp) != 1) {
-			perror(nsigfname);
+			reportIOErr(errfp, nsigfname);
 			r = RSGTE_IO;
 			goto done;
 		}
 	}
 	gf = rsgt_vrfyConstruct_gf();
 	if(gf == NULL) {
-		fprintf(stderr, "error initializing signature file structure\n");
+		fprintf(errfp, "error initializing signature file structure\n");
 		goto done;
 	}
 
@@ -261,11 +269,11 @@ verify(char *name)
 			if((r = rsgt_getBlockParams(sigfp, 1, &bs, &bHasRecHashes,
 							&bHasIntermedHashes)) != 0) {
 				if(ectx.blkNum == 0) {
-					fprintf(stderr, "EOF before finding any signature block - "
+					fprintf(errfp, "EOF before finding any signature block - "
 						"is the file still open and being written to?\n");
 				} else {
 					if(verbose)
-						fprintf(stderr, "EOF after signature block %lld\n",
+						fprintf(errfp, "EOF after signature block %lld\n",
 							ectx.blkNum);
 				}
 				goto done;
@@ -299,44 +307,43 @@ done:
 	if(mode == MD_EXTEND) {
 		if(unlink(oldsigfname) != 0) {
 			if(errno != ENOENT) {
-				perror("unlink oldsig");
+				reportIOErr(errfp, "unlink oldsig");
 				r = RSGTE_IO;
 				goto err;
 			}
 		}
 		if(link(sigfname, oldsigfname) != 0) {
-			perror("link oldsig");
+			reportIOErr(errfp, "link oldsig");
 			r = RSGTE_IO;
 			goto err;
 		}
 		if(unlink(sigfname) != 0) {
-			perror("unlink cursig");
+			reportIOErr(errfp, "unlink cursig");
 			r = RSGTE_IO;
 			goto err;
 		}
 		if(link(nsigfname, sigfname) != 0) {
-			perror("link  newsig");
-			fprintf(stderr, "WARNING: current sig file has been "
+			reportIOErr(errfp, "link  newsig");
+			fprintf(errfp, "WARNING: current sig file has been "
 			        "renamed to %s - you need to manually recover "
 				"it.\n", oldsigfname);
 			r = RSGTE_IO;
 			goto err;
 		}
 		if(unlink(nsigfname) != 0) {
-			perror("unlink newsig");
-			fprintf(stderr, "WARNING: current sig file has been "
+			reportIOErr(errfp, "unlink newsig");
+			fprintf(errfp, "WARNING: current sig file has been "
 			        "renamed to %s - you need to manually recover "
 				"it.\n", oldsigfname);
 			r = RSGTE_IO;
 			goto err;
 		}
 	}
-	rsgtExit();
 	rsgt_errctxExit(&ectx);
 	return;
 
 err:
-	fprintf(stderr, "error %d (%s) processing file %s\n", r, RSGTE2String(r), name);
+	fprintf(errfp, "error %d (%s) processing file %s\n", r, RSGTE2String(r), name);
 	if(logfp != NULL)
 		fclose(logfp);
 	if(sigfp != NULL)
@@ -345,10 +352,99 @@ err:
 		fclose(nsigfp);
 		unlink(nsigfname);
 	}
-	rsgtExit();
 	rsgt_errctxExit(&ectx);
 }
 
+/* Parallel verification: with --jobs N, up to N files are verified (or
+ * extended) concurrently. This pays off as verifying a signature block
+ * requires a round-trip to the publication server. Inside a file, the
+ * blocks can not be processed concurrently, as the hash chain links each
+ * block to its predecessor. Each file's messages are collected in memory
+ * and written in command line order, so the output is the same as with
+ * sequential processing.
+ */
+struct vrfyJob {
+	char *name;
+	char *out;	/* collected messages */
+	size_t lenOut;
+	int bDone;
+};
+
+static int nJobs = 1;
+static struct vrfyJob *jobs;
+static int nJobsTotal;
+static int nextJob = 0;
+static pthread_mutex_t mutJobs = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t condJobDone = PTHREAD_COND_INITIALIZER;
+
+static void *
+verifyWorker(void __attribute__((unused)) *arg)
+{
+	struct vrfyJob *job;
+	FILE *fp;
+
+	pthread_mutex_lock(&mutJobs);
+	while(nextJob < nJobsTotal) {
+		job = &jobs[nextJob++];
+		pthread_mutex_unlock(&mutJobs);
+		if((fp = open_memstream(&job->out, &job->lenOut)) == NULL) {
+			verify(job->name, stderr);
+		} else {
+			verify(job->name, fp);
+			fclose(fp);
+		}
+		pthread_mutex_lock(&mutJobs);
+		job->bDone = 1;
+		pthread_cond_broadcast(&condJobDone);
+	}
+	pthread_mutex_unlock(&mutJobs);
+	return NULL;
+}
+
+static void
+verifyFiles(char **names, int nNames)
+{
+	pthread_t *workers;
+	int nStarted;
+	int i;
+
+	if(nJobs <= 1 || nNames == 1) {
+		for(i = 0 ; i < nNames ; ++i)
+			verify(names[i], stderr);
+		return;
+	}
+
+	if((jobs = calloc(nNames, sizeof(struct vrfyJob))) == NULL
+	   || (workers = calloc(nJobs, sizeof(pthread_t))) == NULL) {
+		perror("rsgtutil");
+		exit(1);
+	}
+	for(i = 0 ; i < nNames ; ++i)
+		jobs[i].name = names[i];
+	nJobsTotal = nNames;
+	for(nStarted = 0 ; nStarted < nJobs && nStarted < nNames ; ++nStarted)
+		if(pthread_create(&workers[nStarted], NULL, verifyWorker, NULL) != 0)
+			break;
+	if(nStarted == 0) /* no threads, so do it ourselves */
+		verifyWorker(NULL);
+
+	for(i = 0 ; i < nNames ; ++i) {
+		pthread_mutex_lock(&mutJobs);
+		while(!jobs[i].bDone)
+			pthread_cond_wait(&condJobDone, &mutJobs);
+		pthread_mutex_unlock(&mutJobs);
+		if(jobs[i].out != NULL) {
+			fwrite(jobs[i].out, 1, jobs[i].lenOut, stderr);
+			free(jobs[i].out);
+		}
+	}
+
+	for(i = 0 ; i < nStarted ; ++i)
+		pthread_join(workers[i], NULL);
+	free(workers);
+	free(jobs);
+}
+
 static void
 processFile(char *name)
 {
@@ -364,7 +460,7 @@ processFile(char *name)
 		break;
 	case MD_VERIFY:
 	case MD_EXTEND:
-		verify(name);
+		verify(name, stderr);
 		break;
 	}
 }
@@ -381,6 +477,7 @@ static struct option long_options[] =
 	{"extend", no_argument, NULL, 'e'},
 	{"publications-server", optional_argument, NULL, 'P'},
 	{"show-verified", no_argument, NULL, 's'},
+	{"jobs", required_argument, NULL, 'j'},
 	{NULL, 0, NULL, 0} 
 }; 
 
@@ -391,7 +488,7 @@ main(int argc, char *argv[])
 	int opt;
 
 	while(1) {
-		opt = getopt_long(argc, argv, "DvVTBtPs", long_options, NULL);
+		opt = getopt_long(argc, argv, "DvVTBtPsj:", long_options, NULL);
 		if(opt == -1)
 			break;
 		switch(opt) {
@@ -401,6 +498,9 @@ main(int argc, char *argv[])
 		case 's':
 			rsgt_read_showVerified = 1;
 			break;
+		case 'j':
+			nJobs = atoi(optarg);
+			break;
 		case 'V':
 			fprintf(stderr, "rsgtutil " VERSION "\n");
 			exit(0);
@@ -429,12 +529,24 @@ main(int argc, char *argv[])
 		}
 	}
 
+	if(mode == MD_VERIFY || mode == MD_EXTEND) {
+		if(rsgtInit("rsyslog rsgtutil " VERSION) != 0) {
+			fprintf(stderr, "error initializing signature library\n");
+			return 1;
+		}
+	}
+
 	if(optind == argc)
 		processFile("-");
+	else if(mode == MD_VERIFY || mode == MD_EXTEND)
+		verifyFiles(argv + optind, argc - optind);
 	else {
 		for(i = optind ; i < argc ; ++i)
 			processFile(argv[i]);
 	}
 
+	if(mode == MD_VERIFY || mode == MD_EXTEND)
+		rsgtExit();
+
 	return 0;
 }
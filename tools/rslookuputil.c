@@ -0,0 +1,451 @@
+/* This is a tool for compiling rsyslog lookup tables.
+ *
+ * The JSON table files used by lookup_table() must be parsed on each start
+ * and reload. For big tables, that takes a lot of time and (temporarily)
+ * memory. This tool compiles them into the binary format described in
+ * runtime/lookupbin.h, which rsyslog maps into memory and uses as is.
+ *
+ * Copyright 2014 Adiscon GmbH
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either exprs or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <json.h>
+
+#include "lookupbin.h"
+
+static enum { MD_COMPILE, MD_DUMP
+} mode = MD_COMPILE;
+static int verbose = 0;
+static char *outfile = NULL;
+
+/* a table row while compiling */
+typedef struct row_s {
+	const char *key;	/* string types */
+	uint32_t ikey;		/* integer types */
+	const char *val;
+	uint32_t pos;		/* position in the file, keeps duplicates in order */
+} row_t;
+
+
+static int
+cmpRowStr(const void *r1, const void *r2)
+{
+	const int cmp = strcmp(((const row_t*)r1)->key, ((const row_t*)r2)->key);
+	if(cmp != 0)
+		return cmp;
+	return (((const row_t*)r1)->pos < ((const row_t*)r2)->pos) ? -1 : 1;
+}
+
+static int
+cmpRowInt(const void *r1, const void *r2)
+{
+	const uint32_t k1 = ((const row_t*)r1)->ikey;
+	const uint32_t k2 = ((const row_t*)r2)->ikey;
+	if(k1 != k2)
+		return (k1 < k2) ? -1 : 1;
+	return (((const row_t*)r1)->pos < ((const row_t*)r2)->pos) ? -1 : 1;
+}
+
+
+static void *
+xcalloc(size_t n, size_t size)
+{
+	void *p;
+
+	if((p = calloc(n, size)) == NULL) {
+		fprintf(stderr, "rslookuputil: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+
+/* read and parse the JSON table file */
+static struct json_object *
+readJSON(const char *name)
+{
+	struct json_tokener *tokener;
+	struct json_object *json;
+	struct stat sb;
+	char *buf;
+	FILE *fp;
+
+	if((fp = fopen(name, "r")) == NULL || fstat(fileno(fp), &sb) == -1) {
+		perror(name);
+		exit(1);
+	}
+	buf = xcalloc(1, sb.st_size + 1);
+	if(fread(buf, 1, sb.st_size, fp) != (size_t) sb.st_size) {
+		fprintf(stderr, "%s: read error\n", name);
+		exit(1);
+	}
+	fclose(fp);
+	tokener = json_tokener_new();
+	json = json_tokener_parse_ex(tokener, buf, sb.st_size);
+	json_tokener_free(tokener);
+	free(buf);
+	if(json == NULL) {
+		fprintf(stderr, "%s: json parsing error\n", name);
+		exit(1);
+	}
+	return json;
+}
+
+
+/* append a string to the pool and return its offset */
+static uint32_t
+poolAdd(char *buf, size_t *pPoolEnd, const char *str)
+{
+	const size_t len = strlen(str) + 1;
+	const uint32_t off = (uint32_t) *pPoolEnd;
+
+	memcpy(buf + off, str, len);
+	*pPoolEnd += len;
+	return off;
+}
+
+
+static void
+compile(const char *infile)
+{
+	struct json_object *json, *jnomatch, *jtype, *jtab, *jrow, *jindex, *jvalue;
+	lookupbin_hdr_t hdr;
+	lookupbin_etry_t *etry;
+	lookupbin_slot_t *slots;
+	uint32_t *arr;
+	const char *type;
+	const char *nomatch;
+	row_t *rows;
+	char *buf;
+	char *tmpname;
+	uint64_t size;
+	size_t poolEnd;
+	uint32_t i, h, slot;
+	int idx;
+	int fd;
+	FILE *fp;
+
+	json = readJSON(infile);
+	jnomatch = json_object_object_get(json, "nomatch");
+	jtype = json_object_object_get(json, "type");
+	jtab = json_object_object_get(json, "table");
+	nomatch = (jnomatch == NULL) ? "" : json_object_get_string(jnomatch);
+	type = (jtype == NULL) ? "string" : json_object_get_string(jtype);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, LOOKUPBIN_MAGIC, LOOKUPBIN_MAGIC_LEN);
+	hdr.bom = LOOKUPBIN_BOM;
+	hdr.version = LOOKUPBIN_VERSION;
+	if(!strcmp(type, "string")) {
+		hdr.type = LOOKUPBIN_TYPE_STRING;
+	} else if(!strcmp(type, "hash")) {
+		hdr.type = LOOKUPBIN_TYPE_HASH;
+	} else if(!strcmp(type, "array")) {
+		hdr.type = LOOKUPBIN_TYPE_ARRAY;
+	} else if(!strcmp(type, "sparseArray")) {
+		hdr.type = LOOKUPBIN_TYPE_SPARSE_ARRAY;
+	} else {
+		fprintf(stderr, "%s: unknown type '%s'\n", infile, type);
+		exit(1);
+	}
+	if(jtab == NULL || !json_object_is_type(jtab, json_type_array)) {
+		fprintf(stderr, "%s: no table array\n", infile);
+		exit(1);
+	}
+	hdr.nmemb = json_object_array_length(jtab);
+
+	/* collect the rows and compute the file size */
+	rows = xcalloc(hdr.nmemb ? hdr.nmemb : 1, sizeof(row_t));
+	size = sizeof(hdr) + strlen(nomatch) + 1;
+	for(i = 0 ; i < hdr.nmemb ; ++i) {
+		jrow = json_object_array_get_idx(jtab, i);
+		jindex = json_object_object_get(jrow, "index");
+		jvalue = json_object_object_get(jrow, "value");
+		if(jindex == NULL || jvalue == NULL) {
+			fprintf(stderr, "%s: row %u lacks index or value\n", infile, (unsigned) i);
+			exit(1);
+		}
+		rows[i].val = json_object_get_string(jvalue);
+		rows[i].pos = i;
+		size += strlen(rows[i].val) + 1;
+		if(hdr.type == LOOKUPBIN_TYPE_STRING || hdr.type == LOOKUPBIN_TYPE_HASH) {
+			rows[i].key = json_object_get_string(jindex);
+			size += strlen(rows[i].key) + 1;
+		} else {
+			if((idx = json_object_get_int(jindex)) < 0) {
+				fprintf(stderr, "%s: index '%s' is not a valid non-negative "
+					"integer\n", infile, json_object_get_string(jindex));
+				exit(1);
+			}
+			rows[i].ikey = (uint32_t) idx;
+		}
+	}
+	if(hdr.type == LOOKUPBIN_TYPE_STRING || hdr.type == LOOKUPBIN_TYPE_HASH)
+		qsort(rows, hdr.nmemb, sizeof(row_t), cmpRowStr);
+	else
+		qsort(rows, hdr.nmemb, sizeof(row_t), cmpRowInt);
+	if(hdr.type == LOOKUPBIN_TYPE_ARRAY) {
+		for(i = 1 ; i < hdr.nmemb ; ++i) {
+			if(rows[i].ikey != rows[0].ikey + i) {
+				fprintf(stderr, "%s: type array requires consecutive indexes, "
+					"but %u follows %u\n", infile, (unsigned) rows[i].ikey,
+					(unsigned) rows[i-1].ikey);
+				exit(1);
+			}
+		}
+		hdr.first = (hdr.nmemb == 0) ? 0 : rows[0].ikey;
+	}
+
+	hdr.tabOff = sizeof(hdr);
+	if(hdr.type == LOOKUPBIN_TYPE_ARRAY) {
+		size += (uint64_t) hdr.nmemb * sizeof(uint32_t);
+	} else {
+		size += (uint64_t) hdr.nmemb * sizeof(lookupbin_etry_t);
+	}
+	if(hdr.type == LOOKUPBIN_TYPE_HASH) {
+		for(hdr.nslots = 16 ; hdr.nslots < 2 * (uint64_t) hdr.nmemb && hdr.nslots < 0x80000000u ; hdr.nslots <<= 1)
+			/* just search - load is at most 50% */;
+		hdr.slotOff = hdr.tabOff + hdr.nmemb * sizeof(lookupbin_etry_t);
+		size += (uint64_t) hdr.nslots * sizeof(lookupbin_slot_t);
+	}
+	if(size > 0xffffffffu) {
+		fprintf(stderr, "%s: table too large, the compiled file is limited to 4GiB\n",
+			infile);
+		exit(1);
+	}
+
+	/* fill the file image */
+	buf = xcalloc(1, (size_t) size);
+	poolEnd = (hdr.type == LOOKUPBIN_TYPE_HASH) ? hdr.slotOff + hdr.nslots * sizeof(lookupbin_slot_t)
+		: hdr.tabOff + hdr.nmemb * ((hdr.type == LOOKUPBIN_TYPE_ARRAY)
+					    ? sizeof(uint32_t) : sizeof(lookupbin_etry_t));
+	hdr.nomatch = poolAdd(buf, &poolEnd, nomatch);
+	etry = (lookupbin_etry_t*) (buf + hdr.tabOff);
+	arr = (uint32_t*) (buf + hdr.tabOff);
+	slots = (lookupbin_slot_t*) (buf + hdr.slotOff);
+	for(i = 0 ; i < hdr.nmemb ; ++i) {
+		switch(hdr.type) {
+		case LOOKUPBIN_TYPE_STRING:
+		case LOOKUPBIN_TYPE_HASH:
+			etry[i].key = poolAdd(buf, &poolEnd, rows[i].key);
+			etry[i].val = poolAdd(buf, &poolEnd, rows[i].val);
+			break;
+		case LOOKUPBIN_TYPE_ARRAY:
+			arr[i] = poolAdd(buf, &poolEnd, rows[i].val);
+			break;
+		case LOOKUPBIN_TYPE_SPARSE_ARRAY:
+			etry[i].key = rows[i].ikey;
+			etry[i].val = poolAdd(buf, &poolEnd, rows[i].val);
+			break;
+		}
+		if(hdr.type != LOOKUPBIN_TYPE_HASH)
+			continue;
+		h = lookupbinHash((const unsigned char*) rows[i].key);
+		for(slot = h & (hdr.nslots - 1) ; slots[slot].idx != 0 ; slot = (slot + 1) & (hdr.nslots - 1)) {
+			if(slots[slot].hash == h && !strcmp(rows[slots[slot].idx - 1].key, rows[i].key))
+				break; /* duplicate key, the first one wins */
+		}
+		if(slots[slot].idx == 0) {
+			slots[slot].hash = h;
+			slots[slot].idx = i + 1;
+		}
+	}
+	memcpy(buf, &hdr, sizeof(hdr));
+
+	/* write to a temporary file and rename it, so that a running rsyslogd
+	 * never sees a partially written table (see lookup_table() docs).
+	 */
+	tmpname = xcalloc(1, strlen(outfile) + sizeof(".tmp"));
+	strcpy(tmpname, outfile);
+	strcat(tmpname, ".tmp");
+	if((fd = open(tmpname, O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1
+	   || (fp = fdopen(fd, "w")) == NULL) {
+		perror(tmpname);
+		exit(1);
+	}
+	if(fwrite(buf, 1, (size_t) size, fp) != (size_t) size || fflush(fp) != 0
+	   || fsync(fd) != 0 || fclose(fp) != 0) {
+		perror(tmpname);
+		unlink(tmpname);
+		exit(1);
+	}
+	if(rename(tmpname, outfile) != 0) {
+		perror(outfile);
+		unlink(tmpname);
+		exit(1);
+	}
+	if(verbose)
+		fprintf(stderr, "%s: %u entries of type '%s' compiled to '%s', %llu bytes\n",
+			infile, (unsigned) hdr.nmemb, type, outfile, (unsigned long long) size);
+	free(tmpname);
+	free(buf);
+	free(rows);
+	json_object_put(json);
+}
+
+
+/* print a string as JSON string */
+static void
+printJSONStr(const char *s)
+{
+	putchar('"');
+	for( ; *s ; ++s) {
+		if(*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if((unsigned char) *s < 0x20)
+			printf("\\u%04x", (unsigned) (unsigned char) *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+
+/* print a compiled table as JSON table file. Only a basic sanity check is
+ * done, this is meant to check the compiler output.
+ */
+static void
+dump(const char *name)
+{
+	static const char *const types[] = { "string", "hash", "array", "sparseArray" };
+	const lookupbin_hdr_t *hdr;
+	const lookupbin_etry_t *etry;
+	const uint32_t *arr;
+	const char *map;
+	struct stat sb;
+	uint32_t i;
+	int fd;
+
+	if((fd = open(name, O_RDONLY)) == -1 || fstat(fd, &sb) == -1) {
+		perror(name);
+		exit(1);
+	}
+	if(sb.st_size < (off_t) sizeof(lookupbin_hdr_t)
+	   || (map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		fprintf(stderr, "%s: not a compiled lookup table\n", name);
+		exit(1);
+	}
+	hdr = (const lookupbin_hdr_t*) map;
+	if(memcmp(hdr->magic, LOOKUPBIN_MAGIC, LOOKUPBIN_MAGIC_LEN) || hdr->bom != LOOKUPBIN_BOM
+	   || hdr->version != LOOKUPBIN_VERSION || hdr->type > LOOKUPBIN_TYPE_SPARSE_ARRAY) {
+		fprintf(stderr, "%s: not a compiled lookup table for this platform and version\n",
+			name);
+		exit(1);
+	}
+	etry = (const lookupbin_etry_t*) (map + hdr->tabOff);
+	arr = (const uint32_t*) (map + hdr->tabOff);
+	printf("{ \"version\": 1, \"nomatch\": ");
+	printJSONStr(map + hdr->nomatch);
+	printf(", \"type\": \"%s\",\n  \"table\": [\n", types[hdr->type]);
+	for(i = 0 ; i < hdr->nmemb ; ++i) {
+		printf("    { \"index\": ");
+		switch(hdr->type) {
+		case LOOKUPBIN_TYPE_STRING:
+		case LOOKUPBIN_TYPE_HASH:
+			printJSONStr(map + etry[i].key);
+			printf(", \"value\": ");
+			printJSONStr(map + etry[i].val);
+			break;
+		case LOOKUPBIN_TYPE_ARRAY:
+			printf("%u, \"value\": ", (unsigned) (hdr->first + i));
+			printJSONStr(map + arr[i]);
+			break;
+		case LOOKUPBIN_TYPE_SPARSE_ARRAY:
+			printf("%u, \"value\": ", (unsigned) etry[i].key);
+			printJSONStr(map + etry[i].val);
+			break;
+		}
+		printf(" }%s\n", (i + 1 < hdr->nmemb) ? "," : "");
+	}
+	printf("  ]\n}\n");
+	munmap((void*) map, sb.st_size);
+	close(fd);
+}
+
+
+static struct option long_options[] =
+{
+	{"verbose", no_argument, NULL, 'v'},
+	{"version", no_argument, NULL, 'V'},
+	{"compile", no_argument, NULL, 'c'},
+	{"dump", no_argument, NULL, 'd'},
+	{"output", required_argument, NULL, 'o'},
+	{NULL, 0, NULL, 0}
+};
+
+int
+main(int argc, char *argv[])
+{
+	int opt;
+
+	while(1) {
+		opt = getopt_long(argc, argv, "cdo:vV", long_options, NULL);
+		if(opt == -1)
+			break;
+		switch(opt) {
+		case 'c':
+			mode = MD_COMPILE;
+			break;
+		case 'd':
+			mode = MD_DUMP;
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'V':
+			fprintf(stderr, "rslookuputil " VERSION "\n");
+			exit(0);
+			break;
+		case '?':
+			break;
+		default:fprintf(stderr, "getopt_long() returns unknown value %d\n", opt);
+			return 1;
+		}
+	}
+
+	if(optind + 1 != argc) {
+		fprintf(stderr, "ERROR: exactly one table file must be given\n");
+		exit(1);
+	}
+	if(mode == MD_COMPILE) {
+		if(outfile == NULL) {
+			fprintf(stderr, "ERROR: --output is required in --compile mode\n");
+			exit(1);
+		}
+		compile(argv[optind]);
+	} else {
+		dump(argv[optind]);
+	}
+	return 0;
+}
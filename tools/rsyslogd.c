@@ -43,6 +43,8 @@
 #include "errmsg.h"
 #include "threads.h"
 #include "dnscache.h"
+#include "pipestats.h"
+#include "memacct.h"
 #include "prop.h"
 #include "unicode-helper.h"
 #include "net.h"
@@ -134,10 +136,18 @@ rsyslogd_usage(void)
 rsRetVal
 diagGetMainMsgQSize(int *piSize)
 {
+	qqueue_t *pShard;
+	int i;
 	DEFiRet;
 	assert(piSize != NULL);
 	*piSize = (pMsgQueue->pqDA != NULL) ? pMsgQueue->pqDA->iQueueSize : 0;
 	*piSize += pMsgQueue->iQueueSize;
+	if(pMsgQueue->ppShards != NULL) {
+		for(i = 0 ; i < pMsgQueue->iNumShards ; ++i) {
+			pShard = pMsgQueue->ppShards[i];
+			*piSize += pShard->iQueueSize;
+		}
+	}
 	RETiRet;
 }
 
@@ -211,6 +221,10 @@ rsyslogd_InitGlobalClasses(void)
 	CHKiRet(objUse(net, LM_NET_FILENAME));
 
 	dnscacheInit();
+	pErrObj = "pipestats";
+	CHKiRet(pipestatsInit());
+	pErrObj = "memacct";
+	CHKiRet(memacctInit());
 	initRainerscript();
 	ratelimitModInit();
 
@@ -234,6 +248,49 @@ finalize_it:
 	RETiRet;
 }
 
+/* preprocess a single message: do the hostname-based ACL check, if still
+ * needed, and parse it. Returns RS_RET_DISCARDMSG if the message must be
+ * discarded. This is usually done by the main queue consumer, but inputs
+ * may request to have it done in their own threads (PARSE_IN_INPUT).
+ */
+static rsRetVal
+preprocessMsg(msg_t *pMsg)
+{
+	prop_t *ip;
+	prop_t *fqdn;
+	prop_t *localName;
+	int bIsPermitted;
+	rsRetVal localRet;
+	DEFiRet;
+
+	if((pMsg->msgFlags & NEEDS_ACLCHK_U) != 0) {
+		DBGPRINTF("msgConsumer: UDP ACL must be checked for message (hostname-based)\n");
+		if(net.cvthname(pMsg->rcvFrom.pfrominet, &localName, &fqdn, &ip) != RS_RET_OK)
+			FINALIZE;
+		bIsPermitted = net.isAllowedSender2((uchar*)"UDP",
+		    (struct sockaddr *)pMsg->rcvFrom.pfrominet, (char*)propGetSzStr(fqdn), 1);
+		if(!bIsPermitted) {
+			DBGPRINTF("Message from '%s' discarded, not a permitted sender host\n",
+				  propGetSzStr(fqdn));
+			ABORT_FINALIZE(RS_RET_DISCARDMSG);
+		}
+		/* save some of the info we obtained */
+		MsgSetRcvFrom(pMsg, localName);
+		CHKiRet(MsgSetRcvFromIP(pMsg, ip));
+		pMsg->msgFlags &= ~NEEDS_ACLCHK_U;
+	}
+	if((pMsg->msgFlags & NEEDS_PARSING) != 0) {
+		if((localRet = parser.ParseMsg(pMsg)) != RS_RET_OK)  {
+			DBGPRINTF("Message discarded, parsing error %d\n", localRet);
+			ABORT_FINALIZE(RS_RET_DISCARDMSG);
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* preprocess a batch of messages, that is ready them for actual processing. This is done
  * as a first stage and totally in parallel to any other worker active in the system. So
  * it helps us keep up the overall concurrency level.
@@ -241,49 +298,24 @@ finalize_it:
  */
 static inline rsRetVal
 preprocessBatch(batch_t *pBatch, int *pbShutdownImmediate) {
-	prop_t *ip;
-	prop_t *fqdn;
-	prop_t *localName;
-	prop_t *propFromHost = NULL;
-	prop_t *propFromHostIP = NULL;
-	int bIsPermitted;
 	msg_t *pMsg;
 	int i;
 	rsRetVal localRet;
 	DEFiRet;
 
 	for(i = 0 ; i < pBatch->nElem  && !*pbShutdownImmediate ; i++) {
+		if(!batchIsValidElem(pBatch, i))
+			continue; /* e.g. a packed message the queue could not unpack */
 		pMsg = pBatch->pElem[i].pMsg;
-		if((pMsg->msgFlags & NEEDS_ACLCHK_U) != 0) {
-			DBGPRINTF("msgConsumer: UDP ACL must be checked for message (hostname-based)\n");
-			if(net.cvthname(pMsg->rcvFrom.pfrominet, &localName, &fqdn, &ip) != RS_RET_OK)
-				continue;
-			bIsPermitted = net.isAllowedSender2((uchar*)"UDP",
-			    (struct sockaddr *)pMsg->rcvFrom.pfrominet, (char*)propGetSzStr(fqdn), 1);
-			if(!bIsPermitted) {
-				DBGPRINTF("Message from '%s' discarded, not a permitted sender host\n",
-					  propGetSzStr(fqdn));
-				pBatch->eltState[i] = BATCH_STATE_DISC;
-			} else {
-				/* save some of the info we obtained */
-				MsgSetRcvFrom(pMsg, localName);
-				CHKiRet(MsgSetRcvFromIP(pMsg, ip));
-				pMsg->msgFlags &= ~NEEDS_ACLCHK_U;
-			}
-		}
-		if((pMsg->msgFlags & NEEDS_PARSING) != 0) {
-			if((localRet = parser.ParseMsg(pMsg)) != RS_RET_OK)  {
-				DBGPRINTF("Message discarded, parsing error %d\n", localRet);
-				pBatch->eltState[i] = BATCH_STATE_DISC;
-			}
-		}
+		MsgResetMemSize(pMsg); /* left the queue, re-estimate once parsed */
+		localRet = preprocessMsg(pMsg);
+		if(localRet == RS_RET_DISCARDMSG)
+			pBatch->eltState[i] = BATCH_STATE_DISC;
+		else
+			CHKiRet(localRet);
 	}
 
 finalize_it:
-	if(propFromHost != NULL)
-		prop.Destruct(&propFromHost);
-	if(propFromHostIP != NULL)
-		prop.Destruct(&propFromHostIP);
 	RETiRet;
 }
 
@@ -297,13 +329,25 @@ finalize_it:
 static rsRetVal
 msgConsumer(void __attribute__((unused)) *notNeeded, batch_t *pBatch, wti_t *pWti)
 {
+	int i;
 	DEFiRet;
 	assert(pBatch != NULL);
+	if(pipestatsRate != 0) {
+		for(i = 0 ; i < pBatch->nElem ; i++)
+			PIPESTATS_STAMP(pBatch->pElem[i].pMsg, PIPESTAGE_DEQUEUE);
+	}
 	preprocessBatch(pBatch, pWti->pbShutdownImmediate);
+	if(pipestatsRate != 0) {
+		for(i = 0 ; i < pBatch->nElem ; i++)
+			PIPESTATS_STAMP(pBatch->pElem[i].pMsg, PIPESTAGE_PARSE);
+	}
 	ruleset.ProcessBatch(pBatch, pWti);
+	if(pipestatsRate != 0) {
+		for(i = 0 ; i < pBatch->nElem ; i++)
+			pipestatsRulesetDone(pBatch->pElem[i].pMsg);
+	}
 //TODO: the BATCH_STATE_COMM must be set somewhere down the road, but we 
 //do not have this yet and so we emulate -- 2010-06-10
-int i;
 	for(i = 0 ; i < pBatch->nElem  && !*pWti->pbShutdownImmediate ; i++) {
 		pBatch->eltState[i] = BATCH_STATE_COMM;
 	}
@@ -552,12 +596,36 @@ submitMsg2(msg_t *pMsg)
 		FINALIZE;
 	}
 
+	if(pMsg->msgFlags & PARSE_IN_INPUT) {
+		if(preprocessMsg(pMsg) == RS_RET_DISCARDMSG) {
+			msgDestruct(&pMsg);
+			FINALIZE;
+		}
+	}
+
+	pipestatsSubmit(pMsg);
 	qqueueEnqMsg(pQueue, pMsg->flowCtlType, pMsg);
 
 finalize_it:
 	RETiRet;
 }
 
+/* get the flow control state (QUEUE_FLOWCTL_*) of the queue messages
+ * bound to the given ruleset are submitted to. This permits inputs to
+ * apply backpressure to individual senders before they would be
+ * blocked by flow control.
+ */
+int
+getSubmitFlowCtlState(ruleset_t *pRuleset)
+{
+	qqueue_t *pQueue;
+
+	pQueue = (pRuleset == NULL) ? pMsgQueue : ruleset.GetRulesetQueue(pRuleset);
+	if(pQueue == NULL)
+		return QUEUE_FLOWCTL_OK;
+	return qqueueGetFlowCtlState(pQueue);
+}
+
 /* submit multiple messages at once, very similar to submitMsg, just
  * for multi_submit_t. All messages need to go into the SAME queue!
  * rgerhards, 2009-06-16
@@ -567,6 +635,7 @@ multiSubmitMsg2(multi_submit_t *pMultiSub)
 {
 	qqueue_t *pQueue;
 	ruleset_t *pRuleset;
+	int i, j;
 	DEFiRet;
 	assert(pMultiSub != NULL);
 
@@ -583,6 +652,23 @@ multiSubmitMsg2(multi_submit_t *pMultiSub)
 		FINALIZE;
 	}
 
+	/* preprocess messages that asked for it, keeping the order of the rest */
+	for(i = j = 0 ; i < pMultiSub->nElem ; ++i) {
+		if((pMultiSub->ppMsgs[i]->msgFlags & PARSE_IN_INPUT)
+		   && preprocessMsg(pMultiSub->ppMsgs[i]) == RS_RET_DISCARDMSG) {
+			msgDestruct(&pMultiSub->ppMsgs[i]);
+			continue;
+		}
+		pMultiSub->ppMsgs[j++] = pMultiSub->ppMsgs[i];
+	}
+	pMultiSub->nElem = j;
+	if(pMultiSub->nElem == 0)
+		FINALIZE;
+
+	if(pipestatsRate != 0) {
+		for(i = 0 ; i < pMultiSub->nElem ; ++i)
+			pipestatsSubmit(pMultiSub->ppMsgs[i]);
+	}
 	iRet = pQueue->MultiEnq(pQueue, pMultiSub);
 	pMultiSub->nElem = 0;
 
@@ -674,6 +760,33 @@ finalize_it:
 }
 
 
+/* pre-allocate msg objects if so configured (global(msgpool.prealloc=...)).
+ * Problems are reported, but we run without the slab in that case.
+ */
+static rsRetVal
+activateMsgPool(void)
+{
+	const int memFlags = (glblMsgPoolHugePages ? SRPAGES_HUGE : 0)
+			   | (glblMsgPoolMlock ? SRPAGES_MLOCK : 0);
+	int flagsDone;
+	rsRetVal localRet;
+
+	if(glblMsgPoolPrealloc == 0)
+		return RS_RET_OK;
+	localRet = msgPoolActivate(glblMsgPoolPrealloc, memFlags, &flagsDone);
+	if(localRet != RS_RET_OK) {
+		errmsg.LogError(0, localRet, "could not pre-allocate %d msg objects, "
+				"continuing without", glblMsgPoolPrealloc);
+	} else if((memFlags & ~flagsDone) != 0) {
+		errmsg.LogError(0, NO_ERRCODE, "pre-allocated msg objects are not%s%s; "
+				"check vm.nr_hugepages and the memlock limit",
+				((memFlags & ~flagsDone) & SRPAGES_HUGE) ? " in huge pages" : "",
+				((memFlags & ~flagsDone) & SRPAGES_MLOCK) ? " locked" : "");
+	}
+	return RS_RET_OK;
+}
+
+
 rsRetVal
 rsyslogdInit(void)
 {
@@ -686,6 +799,9 @@ rsyslogdInit(void)
 	sigAct.sa_handler = syslogd_sighup_handler;
 	sigaction(SIGHUP, &sigAct, NULL);
 
+	CHKiRet(pipestatsActivate());
+	CHKiRet(memacctActivate());
+	CHKiRet(activateMsgPool());
 	CHKiRet(rsconf.Activate(ourConf));
 	DBGPRINTF(" started.\n");
 
@@ -1125,8 +1241,11 @@ doHUP(void)
 	}
 
 	queryLocalHostname(); /* re-read our name */
+	datetimeTZChanged(); /* pick up a changed timezone */
 	ruleset.IterateAllActions(ourConf, doHUPActions, NULL);
 	lookupDoHUP();
+	rulesetReloadAll(ourConf);
+	rulesetDumpProfileAll(ourConf);
 }
 
 /* rsyslogdDoDie() is a signal handler. If called, it sets the bFinished variable
@@ -1180,13 +1299,18 @@ static void
 mainloop(void)
 {
 	struct timeval tvSelectTimeout;
+	fd_set readfds;
+	int fdWakeup;
 
 	BEGINfunc
-	/* first check if we have any internal messages queued and spit them out. We used
-	 * to do that on any loop iteration, but that is no longer necessry. The reason
-	 * is that once we reach this point here, we always run on multiple threads and
-	 * thus the main queue is properly initialized. -- rgerhards, 2008-06-09
+	/* first check if we have any internal messages queued and spit them out. If
+	 * the main queue runs in direct mode, internal messages continue to be stored
+	 * by iminternal, which then wakes us up via its pipe. We need to process them
+	 * here on the main thread, as the thread that emitted them may well be inside
+	 * an action. -- rgerhards, 2014-07-08
 	 */
+	fdWakeup = iminternalGetWakeupFd();
+	iminternalAckWakeup();
 	processImInternal();
 
 	while(!bFinished){
@@ -1198,10 +1322,18 @@ mainloop(void)
 		 */
 		tvSelectTimeout.tv_sec = 86400 /*1 day*/;
 		tvSelectTimeout.tv_usec = 0;
-		select(1, NULL, NULL, NULL, &tvSelectTimeout);
+		FD_ZERO(&readfds);
+		if(fdWakeup != -1)
+			FD_SET(fdWakeup, &readfds);
+		select(fdWakeup + 1, &readfds, NULL, NULL, &tvSelectTimeout);
 		if(bFinished)
 			break;	/* exit as quickly as possible */
 
+		if(fdWakeup != -1 && FD_ISSET(fdWakeup, &readfds)) {
+			iminternalAckWakeup();
+			processImInternal();
+		}
+
 		if(bHadHUP) {
 			doHUP();
 			bHadHUP = 0;
@@ -1267,6 +1399,10 @@ deinitAll(void)
 	qqueueDestruct(&pMsgQueue);
 	pMsgQueue = NULL;
 
+	/* shut down and persist the ruleset and action queues in parallel */
+	DBGPRINTF("Terminating ruleset and action queues...\n");
+	shutdownAllQueues(runConf);
+
 	/* Free ressources and close connections. This includes flushing any remaining
 	 * repeated msgs.
 	 */
@@ -1296,6 +1432,8 @@ deinitAll(void)
 	strExit();
 	ratelimitModExit();
 	dnscacheDeinit();
+	pipestatsExit();
+	memacctExit();
 	thrdExit();
 
 	module.UnloadAndDestructAll(eMOD_LINK_ALL);
@@ -1315,6 +1453,7 @@ deinitAll(void)
  * need to have a statement before variable definitions.
  * rgerhards, 20080-01-28
  */
+#ifndef RSBENCH /* tests/rsbench links the core without our main() */
 int
 main(int argc, char **argv)
 {
@@ -1326,3 +1465,4 @@ main(int argc, char **argv)
 	deinitAll();
 	return 0;
 }
+#endif
@@ -0,0 +1,200 @@
+/* smjson.c
+ * This is a strgen module for a canonical JSON representation of the
+ * standard message properties. Each message is written as a single line
+ * JSON object:
+ *
+ * {"timereported":"...","timegenerated":"...","hostname":"...",
+ *  "fromhost":"...","fromhost-ip":"...","syslogtag":"...",
+ *  "programname":"...","app-name":"...","procid":"...","msgid":"...",
+ *  "facility":"...","severity":"...","structured-data":"...",
+ *  "inputname":"...","msg":"..."}
+ *
+ * Timestamps are in RFC3339 format, facility and severity are given
+ * in their textual form. All values are JSON-escaped.
+ *
+ * NOTE: read comments in module-template.h to understand how this file
+ *       works!
+ *
+ * Copyright 2014 Rainer Gerhards and Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "rsyslog.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include "syslogd.h"
+#include "conf.h"
+#include "syslogd-types.h"
+#include "template.h"
+#include "msg.h"
+#include "module-template.h"
+#include "unicode-helper.h"
+
+MODULE_TYPE_STRGEN
+MODULE_TYPE_NOKEEP
+STRGEN_NAME("RSYSLOG_JSONFormat")
+
+/* internal structures
+ */
+DEF_SMOD_STATIC_DATA
+
+/* the properties we emit, in output order */
+enum {
+	JF_TIMEREPORTED,
+	JF_TIMEGENERATED,
+	JF_HOSTNAME,
+	JF_FROMHOST,
+	JF_FROMHOST_IP,
+	JF_SYSLOGTAG,
+	JF_PROGRAMNAME,
+	JF_APPNAME,
+	JF_PROCID,
+	JF_MSGID,
+	JF_FACILITY,
+	JF_SEVERITY,
+	JF_STRUCTURED_DATA,
+	JF_INPUTNAME,
+	JF_MSG,
+	JF_NFIELDS
+};
+
+static const char *fieldNames[JF_NFIELDS] = {
+	"timereported",
+	"timegenerated",
+	"hostname",
+	"fromhost",
+	"fromhost-ip",
+	"syslogtag",
+	"programname",
+	"app-name",
+	"procid",
+	"msgid",
+	"facility",
+	"severity",
+	"structured-data",
+	"inputname",
+	"msg"
+};
+
+
+/* config data */
+
+
+/* We first obtain pointers to all values and compute the exact size of
+ * their escaped representation. So when we finally copy, we know exactly
+ * what we need and do at most one alloc.
+ */
+BEGINstrgen
+	uchar *pVal[JF_NFIELDS];
+	size_t lenVal[JF_NFIELDS];
+	size_t lenName[JF_NFIELDS];
+	int lenTAG;
+	int lenInputName;
+	rs_size_t lenSD;
+	size_t lenTotal;
+	size_t iBuf;
+	int i;
+CODESTARTstrgen
+	/* first obtain all strings and their length */
+	pVal[JF_TIMEREPORTED] = (uchar*) getTimeReported(pMsg, tplFmtRFC3339Date);
+	pVal[JF_TIMEGENERATED] = (uchar*) getTimeGenerated(pMsg, tplFmtRFC3339Date);
+	pVal[JF_HOSTNAME] = (uchar*) getHOSTNAME(pMsg);
+	lenVal[JF_HOSTNAME] = getHOSTNAMELen(pMsg);
+	pVal[JF_FROMHOST] = getRcvFrom(pMsg);
+	pVal[JF_FROMHOST_IP] = getRcvFromIP(pMsg);
+	getTAG(pMsg, &pVal[JF_SYSLOGTAG], &lenTAG);
+	lenVal[JF_SYSLOGTAG] = lenTAG;
+	pVal[JF_PROGRAMNAME] = getProgramName(pMsg, LOCK_MUTEX);
+	pVal[JF_APPNAME] = (uchar*) getAPPNAME(pMsg, LOCK_MUTEX);
+	pVal[JF_PROCID] = (uchar*) getPROCID(pMsg, LOCK_MUTEX);
+	pVal[JF_MSGID] = (uchar*) getMSGID(pMsg);
+	pVal[JF_FACILITY] = (uchar*) getFacilityStr(pMsg);
+	pVal[JF_SEVERITY] = (uchar*) getSeverityStr(pMsg);
+	MsgGetStructuredData(pMsg, &pVal[JF_STRUCTURED_DATA], &lenSD);
+	lenVal[JF_STRUCTURED_DATA] = lenSD;
+	getInputName(pMsg, &pVal[JF_INPUTNAME], &lenInputName);
+	lenVal[JF_INPUTNAME] = lenInputName;
+	pVal[JF_MSG] = getMSG(pMsg);
+	lenVal[JF_MSG] = getMSGLen(pMsg);
+
+	/* calculate len: '{', per field '"name":"value"' plus ',' or '}', then "\n\0" */
+	lenTotal = 1 + 2;
+	for(i = 0 ; i < JF_NFIELDS ; ++i) {
+		switch(i) {
+		case JF_HOSTNAME:
+		case JF_SYSLOGTAG:
+		case JF_STRUCTURED_DATA:
+		case JF_INPUTNAME:
+		case JF_MSG:
+			break; /* length already known */
+		default:
+			lenVal[i] = ustrlen(pVal[i]);
+			break;
+		}
+		lenName[i] = strlen(fieldNames[i]);
+		lenTotal += lenName[i] + 6 + jsonEscapedLen(pVal[i], lenVal[i], RSTRUE);
+	}
+
+	/* now make sure buffer is large enough */
+	if(lenTotal  >= iparam->lenBuf)
+		CHKiRet(ExtendBuf(iparam, lenTotal));
+
+	/* and concatenate the resulting string */
+	iBuf = 0;
+	iparam->param[iBuf++] = '{';
+	for(i = 0 ; i < JF_NFIELDS ; ++i) {
+		iparam->param[iBuf++] = '"';
+		memcpy(iparam->param + iBuf, fieldNames[i], lenName[i]);
+		iBuf += lenName[i];
+		memcpy(iparam->param + iBuf, "\":\"", 3);
+		iBuf += 3;
+		iBuf += jsonEscapeRender(iparam->param + iBuf, pVal[i], lenVal[i], RSTRUE);
+		iparam->param[iBuf++] = '"';
+		iparam->param[iBuf++] = (i == JF_NFIELDS - 1) ? '}' : ',';
+	}
+
+	/* trailer */
+	iparam->param[iBuf++] = '\n';
+	iparam->param[iBuf] = '\0';
+
+	iparam->lenStr = iBuf; /* do not count \0! */
+
+finalize_it:
+ENDstrgen
+
+
+BEGINmodExit
+CODESTARTmodExit
+ENDmodExit
+
+
+BEGINqueryEtryPt
+CODESTARTqueryEtryPt
+CODEqueryEtryPt_STD_SMOD_QUERIES
+ENDqueryEtryPt
+
+
+BEGINmodInit(smjson)
+CODESTARTmodInit
+	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
+CODEmodInit_QueryRegCFSLineHdlr
+
+	dbgprintf("rsyslog JSON format strgen init called, compiled with version %s\n", VERSION);
+ENDmodInit
@@ -0,0 +1,164 @@
+/* smrfc5424.c
+ * This is a strgen module for the RFC5424 (syslog-protocol-23) format.
+ *
+ * Format generated:
+ * "<%PRI%>1 %TIMESTAMP:::date-rfc3339% %HOSTNAME% %APP-NAME% %PROCID% %MSGID% %STRUCTURED-DATA% %msg%\n"
+ *
+ * NOTE: read comments in module-template.h to understand how this file
+ *       works!
+ *
+ * Copyright 2014 Rainer Gerhards and Adiscon GmbH.
+ *
+ * This file is part of rsyslog.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "rsyslog.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include "syslogd.h"
+#include "conf.h"
+#include "syslogd-types.h"
+#include "template.h"
+#include "msg.h"
+#include "module-template.h"
+#include "unicode-helper.h"
+
+MODULE_TYPE_STRGEN
+MODULE_TYPE_NOKEEP
+STRGEN_NAME("RSYSLOG_SyslogProtocol23Format")
+
+/* internal structures
+ */
+DEF_SMOD_STATIC_DATA
+
+
+/* config data */
+
+
+/* As in the other strgens, we first obtain pointers to all strings needed
+ * (including their length) and then calculate the actual space required.
+ * So we do at most one alloc.
+ */
+BEGINstrgen
+	register int iBuf;
+	char *pPRI;
+	size_t lenPRI;
+	uchar *pTimeStamp;
+	size_t lenTimeStamp;
+	uchar *pHOSTNAME;
+	size_t lenHOSTNAME;
+	char *pAPPNAME;
+	size_t lenAPPNAME;
+	char *pPROCID;
+	size_t lenPROCID;
+	char *pMSGID;
+	size_t lenMSGID;
+	uchar *pSD;
+	rs_size_t lenSD;
+	uchar *pMSG;
+	size_t lenMSG;
+	size_t lenTotal;
+CODESTARTstrgen
+	/* first obtain all strings and their length (if not fixed) */
+	pPRI = getPRI(pMsg);
+	lenPRI = strlen(pPRI);
+	pTimeStamp = (uchar*) getTimeReported(pMsg, tplFmtRFC3339Date);
+	lenTimeStamp = ustrlen(pTimeStamp);
+	pHOSTNAME = (uchar*) getHOSTNAME(pMsg);
+	lenHOSTNAME = getHOSTNAMELen(pMsg);
+	pAPPNAME = getAPPNAME(pMsg, LOCK_MUTEX);
+	lenAPPNAME = strlen(pAPPNAME);
+	pPROCID = getPROCID(pMsg, LOCK_MUTEX);
+	lenPROCID = strlen(pPROCID);
+	pMSGID = getMSGID(pMsg);
+	lenMSGID = strlen(pMSGID);
+	MsgGetStructuredData(pMsg, &pSD, &lenSD);
+	pMSG = getMSG(pMsg);
+	lenMSG = getMSGLen(pMsg);
+
+	/* calculate len, constants for spaces and similar fixed strings */
+	lenTotal = 1 + lenPRI + 3 + lenTimeStamp + 1 + lenHOSTNAME + 1 + lenAPPNAME + 1
+		   + lenPROCID + 1 + lenMSGID + 1 + lenSD + 1 + lenMSG + 2;
+
+	/* now make sure buffer is large enough */
+	if(lenTotal  >= iparam->lenBuf)
+		CHKiRet(ExtendBuf(iparam, lenTotal));
+
+	/* and concatenate the resulting string */
+	iparam->param[0] = '<';
+	memcpy(iparam->param + 1, pPRI, lenPRI);
+	iBuf = lenPRI + 1;
+	memcpy(iparam->param + iBuf, ">1 ", 3);
+	iBuf += 3;
+
+	memcpy(iparam->param + iBuf, pTimeStamp, lenTimeStamp);
+	iBuf += lenTimeStamp;
+	iparam->param[iBuf++] = ' ';
+
+	memcpy(iparam->param + iBuf, pHOSTNAME, lenHOSTNAME);
+	iBuf += lenHOSTNAME;
+	iparam->param[iBuf++] = ' ';
+
+	memcpy(iparam->param + iBuf, pAPPNAME, lenAPPNAME);
+	iBuf += lenAPPNAME;
+	iparam->param[iBuf++] = ' ';
+
+	memcpy(iparam->param + iBuf, pPROCID, lenPROCID);
+	iBuf += lenPROCID;
+	iparam->param[iBuf++] = ' ';
+
+	memcpy(iparam->param + iBuf, pMSGID, lenMSGID);
+	iBuf += lenMSGID;
+	iparam->param[iBuf++] = ' ';
+
+	memcpy(iparam->param + iBuf, pSD, lenSD);
+	iBuf += lenSD;
+	iparam->param[iBuf++] = ' ';
+
+	memcpy(iparam->param + iBuf, pMSG, lenMSG);
+	iBuf += lenMSG;
+
+	/* trailer */
+	iparam->param[iBuf++] = '\n';
+	iparam->param[iBuf] = '\0';
+
+	iparam->lenStr = lenTotal - 1; /* do not count \0! */
+
+finalize_it:
+ENDstrgen
+
+
+BEGINmodExit
+CODESTARTmodExit
+ENDmodExit
+
+
+BEGINqueryEtryPt
+CODESTARTqueryEtryPt
+CODEqueryEtryPt_STD_SMOD_QUERIES
+ENDqueryEtryPt
+
+
+BEGINmodInit(smrfc5424)
+CODESTARTmodInit
+	*ipIFVersProvided = CURR_MOD_IF_VERSION; /* we only support the current interface specification */
+CODEmodInit_QueryRegCFSLineHdlr
+
+	dbgprintf("rsyslog RFC5424 format strgen init called, compiled with version %s\n", VERSION);
+ENDmodInit